@@ -29,10 +29,12 @@
 static int usage(void)
 {
 	fprintf(stderr,"Usage: ctrl <CMD>\n" \
-		       "CMD   := get <PARMS> | list | monitor\n" \
+		       "CMD   := get <PARMS> | list [ brief ] | monitor |\n" \
+		       "         cache [ FILE ]\n" \
 		       "PARMS := name <name> | id <id>\n" \
 		       "Examples:\n" \
 		       "\tctrl ls\n" \
+		       "\tctrl cache /run/genl.cache\n" \
 		       "\tctrl monitor\n" \
 		       "\tctrl get name foobar\n" \
 		       "\tctrl get id 0xF\n");
@@ -41,75 +43,9 @@ static int usage(void)
 
 int genl_ctrl_resolve_family(const char *family)
 {
-	struct rtnl_handle rth;
-	struct nlmsghdr *nlh;
-	struct genlmsghdr *ghdr;
-	int ret = 0;
-	struct {
-		struct nlmsghdr         n;
-		char                    buf[4096];
-	} req;
-
-	memset(&req, 0, sizeof(req));
-
-	nlh = &req.n;
-	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
-	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	nlh->nlmsg_type = GENL_ID_CTRL;
-
-	ghdr = NLMSG_DATA(&req.n);
-	ghdr->cmd = CTRL_CMD_GETFAMILY;
-
-	if (rtnl_open_byproto(&rth, 0, NETLINK_GENERIC) < 0) {
-		fprintf(stderr, "Cannot open generic netlink socket\n");
-		exit(1);
-	}
-
-	addattr_l(nlh, 128, CTRL_ATTR_FAMILY_NAME, family, strlen(family) + 1);
-
-	if (rtnl_talk(&rth, nlh, 0, 0, nlh) < 0) {
-		fprintf(stderr, "Error talking to the kernel\n");
-		goto errout;
-	}
-
-	{
-		struct rtattr *tb[CTRL_ATTR_MAX + 1];
-		struct genlmsghdr *ghdr = NLMSG_DATA(nlh);
-		int len = nlh->nlmsg_len;
-		struct rtattr *attrs;
-
-		if (nlh->nlmsg_type !=  GENL_ID_CTRL) {
-			fprintf(stderr, "Not a controller message, nlmsg_len=%d "
-				"nlmsg_type=0x%x\n", nlh->nlmsg_len, nlh->nlmsg_type);
-			goto errout;
-		}
-
-		if (ghdr->cmd != CTRL_CMD_NEWFAMILY) {
-			fprintf(stderr, "Unknown controller command %d\n", ghdr->cmd);
-			goto errout;
-		}
-
-		len -= NLMSG_LENGTH(GENL_HDRLEN);
-
-		if (len < 0) {
-			fprintf(stderr, "wrong controller message len %d\n", len);
-			return -1;
-		}
-
-		attrs = (struct rtattr *) ((char *) ghdr + GENL_HDRLEN);
-		parse_rtattr(tb, CTRL_ATTR_MAX, attrs, len);
+	int id = genl_resolve_family(NULL, family);
 
-		if (tb[CTRL_ATTR_FAMILY_ID] == NULL) {
-			fprintf(stderr, "Missing family id TLV\n");
-			goto errout;
-		}
-
-		ret = rta_getattr_u16(tb[CTRL_ATTR_FAMILY_ID]);
-	}
-
-errout:
-	rtnl_close(&rth);
-	return ret;
+	return id < 0 ? 0 : id;
 }
 
 void print_ctrl_cmd_flags(FILE *fp, __u32 fl)
@@ -236,7 +172,7 @@ static int print_ctrl(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	/* end of family definitions .. */
 	fprintf(fp,"\n");
 	if (tb[CTRL_ATTR_OPS]) {
-		struct rtattr *tb2[GENL_MAX_FAM_OPS];
+		struct rtattr *tb2[GENL_MAX_FAM_OPS + 1];
 		int i=0;
 		parse_rtattr_nested(tb2, GENL_MAX_FAM_OPS, tb[CTRL_ATTR_OPS]);
 		fprintf(fp, "\tcommands supported: \n");
@@ -277,10 +213,59 @@ static int print_ctrl(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		fprintf(fp,"\n");
 	}
 
-	fflush(fp);
 	return 0;
 }
 
+/* One line a family, from the cache: ids, commands and groups */
+static int print_ctrl_brief(const struct genl_family *f, void *arg)
+{
+	FILE *fp = arg;
+	int i, n = 0;
+
+	for (i = 0; i < 256; i++)
+		n += genl_family_has_op(f, i);
+	fprintf(fp, "%-16s 0x%-4x v%-2u hdr %-3u attrs %-4u cmds %*d",
+		f->name, f->id, f->version, f->hdrsize, f->maxattr,
+		f->ngrps ? -3 : 0, n);
+	for (i = 0; i < f->ngrps; i++)
+		fprintf(fp, "%s%s:0x%x", i ? "," : " groups ",
+			f->grps[i].name, f->grps[i].id);
+	fprintf(fp, "\n");
+	return 0;
+}
+
+/* The file holds what IPROUTE_GENL_CACHE points to */
+static int ctrl_cache(int argc, char **argv, int brief)
+{
+	struct rtnl_handle rth;
+	char *file = getenv("IPROUTE_GENL_CACHE");
+	int ret;
+
+	if (!brief && argc > 0)
+		file = *argv;
+	if (!brief && (file == NULL || *file == 0)) {
+		fprintf(stderr, "No cache file given and "
+			"IPROUTE_GENL_CACHE is not set\n");
+		return -1;
+	}
+
+	/* A brief list is made from the file itself if there is one */
+	if (brief && file && *file && access(file, R_OK) == 0)
+		return genl_family_walk(print_ctrl_brief, stdout);
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_GENERIC) < 0) {
+		fprintf(stderr, "Cannot open generic netlink socket\n");
+		return -1;
+	}
+	ret = genl_family_load_all(&rth);
+	rtnl_close(&rth);
+	if (ret < 0)
+		return -1;
+	if (brief)
+		return genl_family_walk(print_ctrl_brief, stdout);
+	return genl_family_save(file);
+}
+
 static int ctrl_list(int cmd, int argc, char **argv)
 {
 	struct rtnl_handle rth;
@@ -365,6 +350,17 @@ ctrl_done:
 	return ret;
 }
 
+static int ctrl_monitor(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	int ret;
+
+	genl_family_update(n);
+	ret = print_ctrl(who, n, arg);
+	fflush(arg);
+	return ret;
+}
+
 static int ctrl_listen(int argc, char **argv)
 {
 	struct rtnl_handle rth;
@@ -374,7 +370,7 @@ static int ctrl_listen(int argc, char **argv)
 		return -1;
 	}
 
-	if (rtnl_listen(&rth, print_ctrl, (void *) stdout) < 0)
+	if (rtnl_listen(&rth, ctrl_monitor, (void *) stdout) < 0)
 		return -1;
 
 	return 0;
@@ -394,8 +390,13 @@ static int parse_ctrl(struct genl_util *a, int argc, char **argv)
 		return ctrl_list(CTRL_CMD_GETFAMILY, argc-1, argv+1);
 	if (matches(*argv, "list") == 0 ||
 	    matches(*argv, "show") == 0 ||
-	    matches(*argv, "lst") == 0)
+	    matches(*argv, "lst") == 0) {
+		if (argc > 1 && matches(argv[1], "brief") == 0)
+			return ctrl_cache(argc-2, argv+2, 1);
 		return ctrl_list(CTRL_CMD_UNSPEC, argc-1, argv+1);
+	}
+	if (matches(*argv, "cache") == 0)
+		return ctrl_cache(argc-1, argv+1, 0);
 	if (matches(*argv, "help") == 0)
 		return usage();
 
@@ -64,6 +64,11 @@ static struct genl_util *get_genl_kind(char *str)
 		if (strcmp(f->name, str) == 0)
 			return f;
 
+	snprintf(buf, sizeof(buf), "%s_genl_util", str);
+	f = get_builtin_sym(buf);
+	if (f)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), "%s.so", str);
 	dlh = dlopen(buf, RTLD_LAZY);
 	if (dlh == NULL) {
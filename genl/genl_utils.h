@@ -3,6 +3,7 @@
 
 #include "utils.h"
 #include "linux/genetlink.h"
+#include "libgenl.h"
 
 struct genl_util
 {
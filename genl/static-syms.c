@@ -1,6 +1,48 @@
+#include <stdlib.h>
 #include <string.h>
-void *_dlsym(const char *sym)
+#include "utils.h"
+
+/*
+ * The plugin symbols built into this binary, as found by the Makefile
+ * and sorted by name; those of modules not linked in are weak and stay
+ * NULL.  Kinds are looked up here before any shared object is probed.
+ */
+#define BUILTIN_SYM(s)	extern char s[] __attribute__((weak));
+#include "static-syms.h"
+#undef BUILTIN_SYM
+
+struct builtin_sym
 {
+	const char	*name;
+	void		*sym;
+};
+
+#define BUILTIN_SYM(s)	{ #s, s },
+static const struct builtin_sym builtin_syms[] = {
 #include "static-syms.h"
+	{ NULL, NULL }
+};
+#undef BUILTIN_SYM
+
+void *builtin_sym(const char *sym)
+{
+	int lo = 0, hi = sizeof(builtin_syms)/sizeof(builtin_syms[0]) - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int d = strcmp(sym, builtin_syms[mid].name);
+
+		if (d == 0)
+			return builtin_syms[mid].sym;
+		if (d < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
 	return NULL;
 }
+
+void *_dlsym(const char *sym)
+{
+	return builtin_sym(sym);
+}
@@ -0,0 +1,41 @@
+#ifndef __BPF_ELF_H__
+#define __BPF_ELF_H__
+
+#include <asm/types.h>
+
+/* The ELF objects tc loads.  A program is the section its kind asks for
+ * ("classifier" for the bpf filter, "action" for the bpf action) unless
+ * a section is named.  The "maps" section is an array of struct
+ * bpf_elf_map, one per map symbol, and the "license" section a string.
+ * Loads of a map symbol are relocated to the map's file descriptor.
+ *
+ * A map with pinning is shared: the first load creates it under the BPF
+ * file system and later loads, on any device, open that one instead.
+ * PIN_GLOBAL_NS maps are shared by name with every object, PIN_OBJECT_NS
+ * maps only with loads of the same object.
+ */
+
+#define ELF_SECTION_CLASSIFIER	"classifier"
+#define ELF_SECTION_ACTION	"action"
+#define ELF_SECTION_MAPS	"maps"
+#define ELF_SECTION_LICENSE	"license"
+
+#define PIN_NONE		0
+#define PIN_OBJECT_NS		1
+#define PIN_GLOBAL_NS		2
+
+#define BPF_FS_DIR		"/sys/fs/bpf"
+#define BPF_FS_TC		"tc"
+#define BPF_FS_GLOBALS		"globals"
+
+struct bpf_elf_map {
+	__u32 type;
+	__u32 size_key;
+	__u32 size_value;
+	__u32 max_elem;
+	__u32 flags;
+	__u32 id;
+	__u32 pinning;
+};
+
+#endif /* __BPF_ELF_H__ */
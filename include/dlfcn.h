@@ -8,6 +8,7 @@
 #else
 
 #define RTLD_LAZY 0
+#define RTLD_GLOBAL 0
 #define _FAKE_DLFCN_HDL (void *)0xbeefcafe
 
 static inline void *dlopen(const char *file, int flag)
@@ -0,0 +1,44 @@
+#ifndef __LIBGENL_H__
+#define __LIBGENL_H__ 1
+
+#include <linux/genetlink.h>
+#include "libnetlink.h"
+
+#define GENL_CACHE_MAX_GRPS	8
+
+struct genl_mcast_grp
+{
+	char		name[GENL_NAMSIZ];
+	__u32		id;
+};
+
+/* What the controller told us about a generic netlink family; fixed
+ * size, as it is also what the cache file holds.
+ */
+struct genl_family
+{
+	char		name[GENL_NAMSIZ];
+	__u16		id;
+	__u32		version;
+	__u32		hdrsize;
+	__u32		maxattr;
+	__u32		ops[256 / 32];	/* bitmap of the supported commands */
+	__u32		ngrps;
+	struct genl_mcast_grp grps[GENL_CACHE_MAX_GRPS];
+};
+
+extern int genl_parse_family(const struct nlmsghdr *n,
+			     struct genl_family *f);
+extern const struct genl_family *genl_family_lookup(struct rtnl_handle *rth,
+						    const char *name);
+extern int genl_resolve_family(struct rtnl_handle *rth, const char *name);
+extern int genl_family_has_op(const struct genl_family *f, int cmd);
+extern int genl_family_group(const struct genl_family *f, const char *name);
+extern int genl_family_update(const struct nlmsghdr *n);
+extern void genl_family_flush(void);
+extern int genl_family_load_all(struct rtnl_handle *rth);
+extern int genl_family_save(const char *file);
+extern int genl_family_walk(int (*fn)(const struct genl_family *f, void *arg),
+			    void *arg);
+
+#endif /* __LIBGENL_H__ */
@@ -9,6 +9,19 @@
 #include <linux/if_addr.h>
 #include <linux/neighbour.h>
 
+struct rtnl_ring;
+struct rtnl_pipeline;
+struct rtnl_mmap_ring;
+struct rtnl_replay;
+struct rtnl_dump_state;
+
+struct rtnl_rx_stats
+{
+	__u64			frames;		/* messages read from the ring */
+	__u64			copied;		/* too large, received by copy */
+	__u64			overruns;	/* ENOBUFS, events dropped */
+};
+
 struct rtnl_handle
 {
 	int			fd;
@@ -16,15 +29,116 @@ struct rtnl_handle
 	struct sockaddr_nl	peer;
 	__u32			seq;
 	__u32			dump;
+	/* Receive buffer the kernel granted, see rtnl_set_rcvbuf() */
+	int			rcvbuf;
+	/* Receive buffer size for dumps and listening.  Zero (the default)
+	 * sizes the buffer from each pending datagram using MSG_PEEK, any
+	 * other value is used as a fixed buffer size (e.g. 1MB).
+	 */
+	unsigned int		bufsize;
+	char			*buf;
+	unsigned int		buflen;
+	/* Datagrams pulled per recvmmsg() call by rtnl_dump_filter_l()
+	 * and rtnl_listen(); 0 or 1 receives one datagram at a time.
+	 */
+	unsigned int		batch;
+	struct rtnl_ring	*ring;
+	struct rtnl_pipeline	*pipe;
+	struct rtnl_mmap_ring	*rx_ring;
+	struct rtnl_replay	*replay;
+	struct rtnl_dump_state	*dstate;
+	struct rtnl_rx_stats	rx_stats;
+	/* The nsid of the namespace the datagram rtnl_listen() is handing
+	 * to its filter came from, -1 for this one; only ever set under
+	 * RTNL_HANDLE_F_LISTEN_ALL_NSID, see rtnl_listen_all_nsid().
+	 */
+	int			nsid;
+	/* If set, rtnl_listen() calls idle(jarg) whenever nothing arrived
+	 * for idle_timeout milliseconds; a negative return ends it.
+	 */
+	int			idle_timeout;
+	int			(*idle)(void *jarg);
+	/* If set, rtnl_listen() calls resync(jarg) when the socket
+	 * overflowed and events were lost; a negative return ends it.
+	 */
+	int			(*resync)(void *jarg);
+	/* If set, rtnl_talk() hands requests to record(n, record_arg)
+	 * instead of the kernel and returns what it does, so commands
+	 * can be run against a model ("tc sim").
+	 */
+	int			(*record)(struct nlmsghdr *n, void *arg);
+	void			*record_arg;
+	unsigned int		flags;
 };
 
+/* rtnl_handle flags */
+#define RTNL_HANDLE_F_SUPPRESS_NLERR	0x1	/* dump errors only set errno */
+/* Dumps are held back until they are complete, and asked for again if
+ * the kernel flagged them inconsistent, see rtnl_dump_filter_l().
+ */
+#define RTNL_HANDLE_F_DUMP_CONSISTENT	0x2
+#define RTNL_HANDLE_F_LISTEN_ALL_NSID	0x4	/* events of every nsid */
+
+#define RTNL_DEFAULT_BUFSIZE	16384
+/* Without a fixed bufsize, every slot of a batch has room for a
+ * datagram of this size; only the pages a datagram fills are used.
+ */
+#define RTNL_BATCH_SLOTSIZE	(1024*1024)
+#define RTNL_DEFAULT_BATCH	32
+#define RTNL_RX_FRAME_SIZE	16384
+#define RTNL_RX_FRAME_NR	256
+
 extern int rcvbuf;
 
+/* Counters of the whole process for -timing, and the phases its time
+ * is charged to, see rtnl_phase().  Phases are timed only after
+ * rtnl_stats_start(), which also reports them at exit.
+ */
+enum {
+	RTNL_PHASE_RUN,		/* none of the others */
+	RTNL_PHASE_NAMES,	/* loading name tables */
+	RTNL_PHASE_LINKS,	/* filling the link cache */
+	RTNL_PHASE_DUMP,	/* requesting and receiving */
+	RTNL_PHASE_FILTER,	/* filtering and formatting messages */
+	RTNL_PHASE_OUTPUT,	/* writing standard output */
+	RTNL_PHASE_MAX
+};
+
+struct rtnl_stats
+{
+	__u64			sendmsg;	/* requests sent */
+	__u64			recvmsg;	/* receive calls */
+	__u64			rx_bytes;
+	__u64			msgs;		/* handed to a filter */
+	__u64			skipped;	/* of other requests */
+	__u64			tx_bytes;	/* written to stdout */
+	__u64			ns[RTNL_PHASE_MAX];
+};
+
+extern __thread struct rtnl_stats rtnl_stats;
+extern void rtnl_stats_start(void);
+extern int rtnl_phase(int phase);
+extern int rtnl_phase_dump(int phase);
+/* A cache of the program, whose memory the report is to tell */
+extern void rtnl_stats_mem(const char *name,
+			   void (*usage)(unsigned long *count,
+					 unsigned long *bytes));
+
+/* If set before rtnl_open(), handles are not connected to the kernel:
+ * dumps are answered from this capture (as written by "ip -capture",
+ * "tc -capture" or rtmon) with the messages of the type dumped, of the
+ * family and, for tc, the device asked for, and anything else fails.
+ */
+extern const char *rtnl_replay_file;
+
 extern int rtnl_open(struct rtnl_handle *rth, unsigned subscriptions);
+extern int rtnl_set_rcvbuf(int fd, int size);
+extern int rtnl_rcvbuf(struct rtnl_handle *rth, int size);
 extern int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions, int protocol);
 extern void rtnl_close(struct rtnl_handle *rth);
 extern int rtnl_wilddump_request(struct rtnl_handle *rth, int fam, int type);
 extern int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len);
+extern int rtnl_dump_request_strict(struct rtnl_handle *rth, struct nlmsghdr *n);
 
 typedef int (*rtnl_filter_t)(const struct sockaddr_nl *,
 			     struct nlmsghdr *n, void *);
@@ -35,6 +149,10 @@ struct rtnl_dump_filter_arg
 	void *arg1;
 };
 
+/* The messages of each datagram go to the filters of the list, which
+ * ends with a NULL filter, one filter after the other; the datagram is
+ * parsed only once.
+ */
 extern int rtnl_dump_filter_l(struct rtnl_handle *rth,
 			      const struct rtnl_dump_filter_arg *arg);
 extern int rtnl_dump_filter(struct rtnl_handle *rth, rtnl_filter_t filter,
@@ -42,6 +160,27 @@ extern int rtnl_dump_filter(struct rtnl_handle *rth, rtnl_filter_t filter,
 extern int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 		     unsigned groups, struct nlmsghdr *answer);
 extern int rtnl_send(struct rtnl_handle *rth, const void *buf, int);
+
+/* Pipelined talk: while a pipeline is open, rtnl_talk() requests that
+ * only expect an ACK are sent without waiting for it, keeping up to
+ * window requests outstanding.  Failed requests are reported through
+ * the handler with the cookie that was current when they were sent.
+ * Dumps and other requests first wait for all outstanding ACKs, as
+ * does rtnl_pipeline_sync(), which also counts the failures.
+ * With rtnl_pipeline_coalesce() the requests are also accumulated and
+ * written with one send() per size bytes.  With rtnl_pipeline_noack()
+ * creates and replaces are sent without NLM_F_ACK, so that only their
+ * failures are answered.
+ */
+typedef void (*rtnl_ack_error_t)(int cookie, int error, void *arg);
+
+extern int rtnl_pipeline_open(struct rtnl_handle *rth, unsigned int window,
+			      rtnl_ack_error_t handler, void *arg);
+extern void rtnl_pipeline_cookie(struct rtnl_handle *rth, int cookie);
+extern int rtnl_pipeline_coalesce(struct rtnl_handle *rth, unsigned int size);
+extern int rtnl_pipeline_noack(struct rtnl_handle *rth);
+extern int rtnl_pipeline_sync(struct rtnl_handle *rth);
+extern int rtnl_pipeline_close(struct rtnl_handle *rth);
 extern int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int);
 
 extern int addattr(struct nlmsghdr *n, int maxlen, int type);
@@ -61,6 +200,37 @@ extern int rta_addattr32(struct rtattr *rta, int maxlen, int type, __u32 data);
 extern int rta_addattr_l(struct rtattr *rta, int maxlen, int type, const void *data, int alen);
 
 extern int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len);
+
+/* Attribute table for hot paths parsing one message after another.
+ * Instead of clearing all max + 1 slots on every message, only the
+ * slots filled by the previous parse are reset, so a parse costs one
+ * walk over the attributes actually present.  Slots must not be
+ * assigned by the caller, as such entries would not be reset.  The
+ * tables are per thread, so messages may be parsed on several at once.
+ */
+struct rtattr_table
+{
+	int			max;
+	int			nused;
+};
+
+#define RTATTR_TABLE(name, maxtype)					\
+	static __thread struct {					\
+		struct rtattr_table	hdr;				\
+		struct rtattr		*tb[(maxtype) + 1];		\
+		__u16			used[(maxtype) + 1];		\
+	} name = { .hdr = { .max = (maxtype) } }
+
+extern struct rtattr **__parse_rtattr_table(struct rtattr_table *t,
+					    struct rtattr **tb, __u16 *used,
+					    struct rtattr *rta, int len);
+
+#define parse_rtattr_table(table, rta, len) \
+	(__parse_rtattr_table(&(table)->hdr, (table)->tb, (table)->used, \
+			      (rta), (len)))
+#define parse_rtattr_table_nested(table, rta) \
+	(parse_rtattr_table((table), RTA_DATA(rta), RTA_PAYLOAD(rta)))
+
 extern int parse_rtattr_byindex(struct rtattr *tb[], int max, struct rtattr *rta, int len);
 extern int __parse_rtattr_nested_compat(struct rtattr *tb[], int max, struct rtattr *rta, int len);
 
@@ -96,8 +266,77 @@ static inline const char *rta_getattr_str(const struct rtattr *rta)
 
 extern int rtnl_listen(struct rtnl_handle *, rtnl_filter_t handler,
 		       void *jarg);
+extern int rtnl_rx_ring_setup(struct rtnl_handle *rth, unsigned int frame_size,
+			      unsigned int frame_nr);
+extern int rtnl_listen_all_nsid(struct rtnl_handle *rth);
+
+/* A check for rtnl_kfilter() to make in the kernel: messages of type
+ * (an RTM_NEW*, and the RTM_DEL* after it) pass only if the field of
+ * size bytes at offset in their family header, which is hdrlen bytes,
+ * holds value.  If attr is set the field is read from that attribute
+ * instead, or from the header if it is absent and offset is not -1; an
+ * absent attribute passes otherwise.  With str the attribute holds that
+ * string.  Messages of other types pass.
+ */
+struct rtnl_kcheck
+{
+	__u16		type;
+	__u16		hdrlen;
+	int		offset;
+	unsigned int	size;
+	__u16		attr;
+	__u32		value;
+	const char	*str;
+};
+
+extern int rtnl_kfilter(struct rtnl_handle *rth,
+			const struct rtnl_kcheck *checks, int n);
+/* rtmon can write an index next to its capture file FILE as FILE.idx:
+ * a header, then entries in time order, each with the time and file
+ * offset of a timestamp record, so a replay can seek close to a given
+ * time instead of reading from the start.
+ */
+#define RTMON_INDEX_MAGIC	0x58444d52	/* "RMDX" */
+#define RTMON_INDEX_VERSION	1
+
+struct rtmon_index_hdr
+{
+	__u32	magic;
+	__u32	version;
+};
+
+struct rtmon_index
+{
+	__u32	sec;
+	__u32	usec;
+	__u64	offset;
+};
+
+/* With "compress", rtmon writes FILE as blocks of messages, each of
+ * them deflated after a struct rtmon_block; the index then points at
+ * blocks.  The magic is far too large to be the nlmsg_len of the
+ * messages of an uncompressed capture.  rtnl_from_file() inflates the
+ * blocks with rtnl_inflate, so that only programs that read them need
+ * zlib; it returns the length inflated, or -1.
+ */
+#define RTMON_BLOCK_MAGIC	0x4b4c424d	/* "MBLK" */
+#define RTMON_BLOCK_MAX		(64 << 20)	/* of data inflated */
+
+struct rtmon_block
+{
+	__u32	magic;
+	__u32	raw_len;	/* of the messages */
+	__u32	len;		/* of the deflated data that follows */
+	__u32	reserved;
+};
+
+extern int (*rtnl_inflate)(void *dst, size_t dstlen,
+			   const void *src, size_t srclen);
+
 extern int rtnl_from_file(FILE *, rtnl_filter_t handler,
 		       void *jarg);
+extern int rtnl_to_file(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *jarg);
 
 #define NLMSG_TAIL(nmsg) \
 	((struct rtattr *) (((void *) (nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
@@ -118,6 +357,11 @@ extern int rtnl_from_file(FILE *, rtnl_filter_t handler,
 #define IFLA_PAYLOAD(n)	NLMSG_PAYLOAD(n,sizeof(struct ifinfomsg))
 #endif
 
+#ifndef IFLA_STATS_RTA
+#define IFLA_STATS_RTA(r) \
+	((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct if_stats_msg))))
+#endif
+
 #ifndef NDA_RTA
 #define NDA_RTA(r) \
 	((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct ndmsg))))
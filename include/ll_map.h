@@ -4,6 +4,12 @@
 extern int ll_remember_index(const struct sockaddr_nl *who,
 			     struct nlmsghdr *n, void *arg);
 extern int ll_init_map(struct rtnl_handle *rth);
+extern int ll_init_map_full(struct rtnl_handle *rth);
+extern int ll_map_subscribe(struct rtnl_handle *rth);
+extern void ll_map_flush(void);
+extern int ll_map_export(const char *file);
+extern int ll_map_select(int nsid);
+extern void ll_map_forget_nsid(int nsid);
 extern unsigned ll_name_to_index(const char *name);
 extern const char *ll_index_to_name(unsigned idx);
 extern const char *ll_idx_n2a(unsigned idx, char *buf);
@@ -0,0 +1,36 @@
+#ifndef __NAMESPACE_H__
+#define __NAMESPACE_H__ 1
+
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#define NETNS_RUN_DIR "/var/run/netns"
+#define NETNS_ETC_DIR "/etc/netns"
+
+#ifndef CLONE_NEWNET
+#define CLONE_NEWNET 0x40000000	/* New network namespace (lo, device, names sockets, etc) */
+#endif
+
+#ifndef HAVE_SETNS
+static inline int setns(int fd, int nstype)
+{
+#ifdef __NR_setns
+	return syscall(__NR_setns, fd, nstype);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif /* HAVE_SETNS */
+
+#define NETNS_JOBS_MAX	256
+
+/* Runs in a child that is not in the namespace yet; returns the exit code */
+typedef int (*netns_job_t)(const char *name, void *arg);
+
+extern int netns_set(const char *name);
+extern int netns_foreach(int jobs, netns_job_t fn, void *arg);
+
+#endif /* __NAMESPACE_H__ */
@@ -0,0 +1,20 @@
+#ifndef __NETEM_DIST_H__
+#define __NETEM_DIST_H__ 1
+
+#include <linux/types.h>
+
+/*
+ * A .distb file is a netem distribution table as written by
+ * netem/makedistb: this header and then count __s16 values, both in
+ * the byte order of the host that made it.  A reader byte swaps the
+ * values if the magic comes back swapped.
+ */
+#define NETEM_DISTB_MAGIC	0x4e444254	/* "NDBT" */
+
+struct netem_distb_hdr
+{
+	__u32	magic;
+	__u32	count;
+};
+
+#endif /* __NETEM_DIST_H__ */
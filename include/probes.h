@@ -0,0 +1,24 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__ 1
+
+/* Static probes for tracing latencies with bpftrace, perf or
+ * SystemTap, e.g. "bpftrace -l 'usdt:/sbin/ip:iproute2:*'".  Built
+ * in when configure finds <sys/sdt.h>; a probe that is not attached
+ * costs a nop.
+ *
+ *	talk_entry(type, seq)		talk_exit(seq, ret)
+ *	dump_recv(bytes, datagrams)	listen_recv(bytes, datagrams)
+ *	batch_cmd_entry(lineno)		batch_cmd_exit(lineno, failed)
+ */
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)		DTRACE_PROBE1(iproute2, name, a)
+#define PROBE2(name, a, b)	DTRACE_PROBE2(iproute2, name, a, b)
+#else
+#define PROBE1(name, a)		do { } while (0)
+#define PROBE2(name, a, b)	do { } while (0)
+#endif
+
+#endif /* __PROBES_H__ */
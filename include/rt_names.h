@@ -14,6 +14,8 @@ int rtnl_rttable_a2n(__u32 *id, char *arg);
 int rtnl_rtrealm_a2n(__u32 *id, char *arg);
 int rtnl_dsfield_a2n(__u32 *id, char *arg);
 int rtnl_group_a2n(int *id, char *arg);
+int rtnl_db_compile(const char *file, const char *out);
+void rtnl_names_preload(void);
 
 const char *inet_proto_n2a(int proto, char *buf, int len);
 int inet_proto_a2n(char *buf);
@@ -3,6 +3,7 @@
 
 #include <asm/types.h>
 #include <resolv.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "libnetlink.h"
@@ -16,6 +17,7 @@ extern int show_raw;
 extern int resolve_hosts;
 extern int oneline;
 extern int timestamp;
+extern int dump_capture;
 extern char * _SL_;
 extern int max_flush_loops;
 
@@ -41,13 +43,14 @@ extern void incomplete_command(void) __attribute__((noreturn));
 #define NEXT_ARG_OK() (argc - 1 > 0)
 #define PREV_ARG() do { argv--; argc++; } while(0)
 
+/* 24 bytes: data holds the longest address family used here (IPv6) */
 typedef struct
 {
 	__u8 family;
 	__u8 bytelen;
 	__s16 bitlen;
 	__u32 flags;
-	__u32 data[8];
+	__u32 data[4];
 } inet_prefix;
 
 #define PREFIXLEN_SPECIFIED 1
@@ -94,6 +97,27 @@ extern int get_s8(__s8 *val, const char *arg, int base);
 extern char* hexstring_n2a(const __u8 *str, int len, char *buf, int blen);
 extern __u8* hexstring_a2n(const char *str, __u8 *buf, int blen);
 
+extern int resolve_prefetch;
+extern void resolve_flush(void);
+
+#define NAMECACHE_KEYLEN	24
+extern int namecache_get(const void *key, int klen, const char **name);
+extern void namecache_put(const void *key, int klen, const char *name);
+struct arena_chunk;
+struct arena
+{
+	struct arena_chunk	*chunks;
+	size_t			chunk_size;
+	char			*cur;
+	size_t			left;
+	size_t			size;	/* of all the chunks */
+};
+
+#define ARENA_CHUNK_SIZE	(256*1024)
+extern void arena_init(struct arena *a, size_t chunk_size);
+extern void *arena_alloc(struct arena *a, size_t len);
+extern void arena_free(struct arena *a);
+
 extern const char *format_host(int af, int len, const void *addr,
 			       char *buf, int buflen);
 extern const char *rt_addr_n2a(int af, int len, const void *addr,
@@ -106,6 +130,36 @@ void duparg2(const char *, const char *) __attribute__((noreturn));
 int matches(const char *arg, const char *pattern);
 extern int inet_addr_match(const inet_prefix *a, const inet_prefix *b, int bits);
 
+/* Keyword tables replace strcmp()/matches() chains in hot parsers.  The
+ * entries are listed in the order the chain tried them; kw_lookup()
+ * returns the id of the entry the chain would have taken (abbrev ones
+ * accept any prefix, like matches()), or -1.  Every accepted spelling
+ * is put in a collision-free hash table on first use, so a lookup is
+ * one hash and one compare.
+ */
+struct kw
+{
+	const char	*name;
+	int		id;
+	int		abbrev;
+};
+
+struct kw_slot;
+
+struct kw_table
+{
+	const struct kw	*kw;
+	int		nkw;
+	struct kw_slot	*slots;
+	unsigned int	mask;
+	unsigned int	seed;
+	unsigned int	maxlen;
+};
+
+#define KW_TABLE(kws)	{ .kw = (kws), .nkw = ARRAY_SIZE(kws) }
+
+extern int kw_lookup(struct kw_table *t, const char *arg);
+
 const char *dnet_ntop(int af, const void *addr, char *str, size_t len);
 int dnet_pton(int af, const char *src, void *addr);
 
@@ -144,12 +198,104 @@ static inline __u32 nl_mgrp(__u32 group)
 
 int print_timestamp(FILE *fp);
 
+/* fprintf(fp, "%s%s ", key, val) and fprintf(fp, "%s%u ", key, val),
+ * for the fields the show commands print a dozen of per object: the
+ * pieces are copied out as they are, with no format to interpret.
+ */
+void print_uint(FILE *fp, unsigned int val);
+
+static inline void print_field(FILE *fp, const char *key, const char *val)
+{
+	fputs(key, fp);
+	fputs(val, fp);
+	putc(' ', fp);
+}
+
+static inline void print_field_u(FILE *fp, const char *key, unsigned int val)
+{
+	fputs(key, fp);
+	print_uint(fp, val);
+	putc(' ', fp);
+}
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 extern int cmdlineno;
 extern ssize_t getcmdline(char **line, size_t *len, FILE *in);
 extern int makeargs(char *line, char *argv[], int maxargs);
 
+/* Batch input, split into arguments without copying when it is a file */
+struct cmdtmpl;
+struct cmdfile {
+	FILE	*in;
+	char	*map, *pos, *end, *released;
+	char	*line;
+	size_t	len;
+	char	**argv;
+	int	maxargs;
+	struct cmdtmpl	*tmpl;		/* from the first %directive on */
+	int	error;			/* input stopped by a template error */
+};
+
+extern int cmdfile_open(struct cmdfile *cf, FILE *in);
+extern int cmdfile_getargs(struct cmdfile *cf, char ***argvp);
+extern void cmdfile_close(struct cmdfile *cf);
+extern char *cmdfile_rawline(struct cmdfile *cf);
+extern int cmdfile_splitline(struct cmdfile *cf, char *line, char ***argvp);
+
+/* Batch templates: %for, %let and ${expression} (lib/cmdtmpl.c) */
+extern int cmdtmpl_start(struct cmdfile *cf, int argc, char ***argvp);
+extern int cmdtmpl_getargs(struct cmdfile *cf, char ***argvp);
+extern void cmdtmpl_free(struct cmdtmpl *t);
+
+/* Batch lines run by worker processes, in file order per key */
+struct batch_job_ops {
+	int	(*start)(void);
+	int	(*run)(int argc, char **argv);
+	int	(*sync)(void);
+	int	(*finish)(void);
+};
+
+struct batch_job;
+struct batch_jobs {
+	struct batch_job	*jobs;
+	int			njobs;
+	int			status;
+	int			failed;
+	int			unsynced;
+	int			dirty;
+	int			stop_on_error;
+	unsigned int		count;
+};
+
+#define BATCH_JOBS_MAX		1024
+extern int batch_jobs_start(struct batch_jobs *bj, int njobs,
+			    const struct batch_job_ops *ops, int stop_on_error);
+extern int batch_jobs_send(struct batch_jobs *bj, const char *key,
+			   int argc, char **argv);
+extern int batch_jobs_sync(struct batch_jobs *bj);
+extern int batch_jobs_finish(struct batch_jobs *bj);
+
+/* With -batch-latency N, how long lines take and the N slowest */
+extern unsigned int batch_latency;
+extern void batch_latency_begin(void);
+extern void batch_latency_end(void);
+extern void batch_latency_report(void);
+
+/* Serve batch lines from a UNIX socket, each run in a fork of the server */
+extern int cmd_server(const char *path, const struct batch_job_ops *ops);
+
+/* Symbols of the plugins linked into tc, ip and genl, from the sorted
+ * table static-syms.c builds.  Weak, since builds without the generated
+ * table (Android.mk) have only dlopen().
+ */
+extern void *builtin_sym(const char *sym) __attribute__((weak));
+
+static inline void *get_builtin_sym(const char *sym)
+{
+	return builtin_sym ? builtin_sym(sym) : NULL;
+}
+
 struct iplink_req;
 int iplink_parse(int argc, char **argv, struct iplink_req *req,
 		char **name, char **type, char **link, char **dev,
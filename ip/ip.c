@@ -10,6 +10,7 @@
  */
 
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <syslog.h>
@@ -22,6 +23,7 @@
 #include "SNAPSHOT.h"
 #include "utils.h"
 #include "ip_common.h"
+#include "probes.h"
 
 int preferred_family = AF_UNSPEC;
 int show_stats = 0;
@@ -29,10 +31,20 @@ int show_details = 0;
 int resolve_hosts = 0;
 int oneline = 0;
 int timestamp = 0;
+int dump_capture = 0;
 char * _SL_ = NULL;
+
+#define IP_OUTPUT_BUFSIZE	(256 * 1024)
+
 char *batch_file = NULL;
+static char *server_path;
 int force = 0;
+int do_all = 0;
 int max_flush_loops = 10;
+unsigned int batch_window = 0;
+unsigned int batch_coalesce = 0;
+int batch_noack = 0;
+unsigned int batch_jobs = 0;
 
 struct rtnl_handle rth = { .fd = -1 };
 
@@ -42,15 +54,18 @@ static void usage(void)
 {
 	fprintf(stderr,
 "Usage: ip [ OPTIONS ] OBJECT { COMMAND | help }\n"
-"       ip [ -force ] -batch filename\n"
-"where  OBJECT := { link | addr | addrlabel | route | rule | neigh | ntable |\n"
-"                   tunnel | tuntap | maddr | mroute | mrule | monitor | xfrm |\n"
-"                   netns | l2tp }\n"
+"       ip [ -force ] [ -window SIZE ] [ -coalesce BYTES ] [ -noack ]\n"
+"          [ -batch-jobs N ] [ -batch-latency N ] -batch filename\n"
+"       ip [ OPTIONS ] -server SOCKET\n"
+"where  OBJECT := { link | addr | addrlabel | route | rule | nexthop | neigh |\n"
+"                   ntable | tunnel | tuntap | maddr | mroute | mrule |\n"
+"                   monitor | xfrm | netns | l2tp | tcp_metrics }\n"
 "       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[esolve] |\n"
 "                    -f[amily] { inet | inet6 | ipx | dnet | link } |\n"
 "                    -l[oops] { maximum-addr-flush-attempts } |\n"
 "                    -o[neline] | -t[imestamp] | -b[atch] [filename] |\n"
-"                    -rc[vbuf] [size]}\n");
+"                    -rc[vbuf] [size] | -cap[ture] | -replay filename |\n"
+"                    -timing | -a[ll] }\n");
 	exit(-1);
 }
 
@@ -72,8 +87,11 @@ static const struct cmd {
 	{ "neighbour",	do_ipneigh },
 	{ "ntable",	do_ipntable },
 	{ "ntbl",	do_ipntable },
+	{ "nexthop",	do_ipnh },
 	{ "link",	do_iplink },
 	{ "l2tp",	do_ipl2tp },
+	{ "tcp_metrics",	do_tcp_metrics },
+	{ "tcpmetrics",	do_tcp_metrics },
 	{ "tunnel",	do_iptunnel },
 	{ "tunl",	do_iptunnel },
 	{ "tuntap",	do_iptuntap },
@@ -87,7 +105,7 @@ static const struct cmd {
 	{ 0,		0 }
 };
 
-static int do_cmd(const char *argv0, int argc, char **argv)
+int do_cmd(const char *argv0, int argc, char **argv)
 {
 	const struct cmd *c;
 
@@ -102,10 +120,262 @@ static int do_cmd(const char *argv0, int argc, char **argv)
 }
 
 #ifndef ANDROID
+static int batch_errors;
+
+static void batch_error(int lineno, int error, void *arg)
+{
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	fprintf(stderr, "Command failed %s:%d\n", (const char *)arg, lineno);
+	batch_errors++;
+}
+
+/* Give h the batch's pipeline settings, if it runs with -window */
+int batch_pipeline_open(struct rtnl_handle *h)
+{
+	if (!batch_window || h->pipe)
+		return 0;
+
+	if (rtnl_pipeline_open(h, batch_window, batch_error,
+			       (void *)batch_file) < 0 ||
+	    (batch_coalesce && rtnl_pipeline_coalesce(h, batch_coalesce) < 0) ||
+	    (batch_noack && rtnl_pipeline_noack(h) < 0)) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return -1;
+	}
+	rtnl_pipeline_cookie(h, cmdlineno);
+	return 0;
+}
+
+/* Sockets other than rth that commands put on the batch pipeline */
+#define BATCH_MAX_JOINED	4
+static struct rtnl_handle *batch_joined[BATCH_MAX_JOINED];
+static int batch_njoined;
+
+/*
+ * A command that talks over its own netlink socket (generic netlink,
+ * say) calls this once for it; while a pipelined batch runs, requests
+ * on it are then pipelined too and their errors reported per line.
+ */
+int batch_pipeline_join(struct rtnl_handle *h)
+{
+	if (rth.pipe == NULL || h->pipe)
+		return 0;
+	if (batch_njoined == BATCH_MAX_JOINED)
+		return 0;
+
+	if (batch_pipeline_open(h) < 0)
+		return -1;
+	batch_joined[batch_njoined++] = h;
+	return 0;
+}
+
+static int batch_pipeline_close(void)
+{
+	int ret = 0;
+
+	while (batch_njoined > 0)
+		if (rtnl_pipeline_close(batch_joined[--batch_njoined]) < 0)
+			ret = -1;
+	if (rth.pipe && rtnl_pipeline_close(&rth) < 0)
+		ret = -1;
+	return ret;
+}
+
+/* Commands may exit() on their own; still send what is queued */
+static void batch_exit(void)
+{
+	batch_pipeline_close();
+}
+
+static int batch_pipeline_sync(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < batch_njoined; i++)
+		if (rtnl_pipeline_sync(batch_joined[i]) < 0)
+			ret = -1;
+	if (rth.pipe && rtnl_pipeline_sync(&rth) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int batch_begin(void)
+{
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+
+	if ((batch_coalesce || batch_noack) && !batch_window)
+		batch_window = 64;
+	if (batch_window) {
+		if (batch_pipeline_open(&rth) < 0)
+			return -1;
+		atexit(batch_exit);
+	}
+	return 0;
+}
+
+static int batch_end(void)
+{
+	int ret = 0;
+
+	if (batch_pipeline_close() < 0 || batch_errors)
+		ret = -1;
+	rtnl_close(&rth);
+	batch_latency_report();
+	return ret;
+}
+
+/* Run one line of the batch; nonzero if it failed */
+static int batch_run(int argc, char **argv)
+{
+	int errors = batch_errors;
+	int failed;
+	int i;
+
+	rtnl_pipeline_cookie(&rth, cmdlineno);
+	for (i = 0; i < batch_njoined; i++)
+		rtnl_pipeline_cookie(batch_joined[i], cmdlineno);
+	PROBE1(batch_cmd_entry, cmdlineno);
+	batch_latency_begin();
+	failed = do_cmd(argv[0], argc, argv) != 0;
+	/* What a line printed goes out before the errors of the next */
+	fflush(stdout);
+	batch_latency_end();
+	PROBE2(batch_cmd_exit, cmdlineno, failed);
+	if (failed) {
+		fprintf(stderr, "Command failed %s:%d\n", batch_file, cmdlineno);
+		return 1;
+	}
+	return batch_errors != errors;
+}
+
+static const struct batch_job_ops batch_job_ops = {
+	.start	= batch_begin,
+	.run	= batch_run,
+	.sync	= batch_pipeline_sync,
+	.finish	= batch_end,
+};
+
+static const struct cmd *find_cmd(const char *argv0)
+{
+	const struct cmd *c;
+
+	for (c = cmds; c->cmd; ++c)
+		if (matches(argv0, c->cmd) == 0)
+			return c;
+	return NULL;
+}
+
+/*
+ * With -batch-jobs, routes are ordered by their table and destination,
+ * see iproute_batch_key(), and rules by their table.  Addresses,
+ * neighbours and link changes are ordered by the device they name,
+ * since they are about things of that device.  They run on the worker
+ * their key maps to; as routes depend on the devices and addresses
+ * before them and the other way round, all lines before a switch from
+ * one kind of key to the other are done first.  Every other line,
+ * adding or deleting links included, runs only after everything
+ * before it.
+ */
+enum {
+	BATCH_KEY_NONE,
+	BATCH_KEY_DEV,
+	BATCH_KEY_ROUTE,
+};
+
+static const char *batch_key(int argc, char **argv, int *kind)
+{
+	const struct cmd *c = find_cmd(argv[0]);
+	const char *key = NULL;
+	int i;
+
+	*kind = BATCH_KEY_NONE;
+	if (c == NULL)
+		return NULL;
+	if (c->func == do_iproute) {
+		key = iproute_batch_key(argc - 1, argv + 1);
+		if (key)
+			*kind = BATCH_KEY_ROUTE;
+		return key;
+	}
+	if (c->func == do_iprule) {
+		for (i = 1; i + 1 < argc; i++)
+			if (strcmp(argv[i], "table") == 0 ||
+			    strcmp(argv[i], "lookup") == 0) {
+				*kind = BATCH_KEY_ROUTE;
+				return argv[i + 1];
+			}
+		return NULL;
+	}
+	if (c->func == do_iplink) {
+		if (argc < 2 || matches(argv[1], "add") == 0 ||
+		    matches(argv[1], "delete") == 0)
+			return NULL;
+	} else if (c->func != do_ipaddr && c->func != do_ipneigh) {
+		return NULL;
+	}
+
+	for (i = 1; i + 1 < argc; i++)
+		if (strcmp(argv[i], "dev") == 0) {
+			*kind = BATCH_KEY_DEV;
+			return argv[i + 1];
+		}
+	return NULL;
+}
+
+/* ip -server: each line runs in a fork with a socket of its own */
+static int server_begin(void)
+{
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_options(int argc, char ***argvp);
+
+/* A line may start with options, like a command line */
+static int server_run(int argc, char **argv)
+{
+	char *args[argc + 2];
+	char **av = args;
+
+	args[0] = "ip";
+	memcpy(args + 1, argv, (argc + 1) * sizeof(char *));
+	argc = parse_options(argc + 1, &av);
+	if (argc <= 1)
+		usage();
+	return do_cmd(av[1], argc - 1, av + 1);
+}
+
+static const struct batch_job_ops server_ops = {
+	.start	= server_begin,
+	.run	= server_run,
+};
+
+/* Lines that change what later lines mean run on every worker */
+static int batch_is_switch(int argc, char **argv)
+{
+	const struct cmd *c = find_cmd(argv[0]);
+
+	if (c == NULL || argc < 2)
+		return 0;
+	if (c->func == do_iproute)
+		return strcmp(argv[1], "nhgroup") == 0;
+	return c->func == do_netns && matches(argv[1], "switch") == 0;
+}
+
 static int batch(const char *name)
 {
-	char *line = NULL;
-	size_t len = 0;
+	struct batch_jobs bj = { .njobs = 0 };
+	struct cmdfile cf;
+	char **largv;
+	int largc;
+	int dirty = 0;
+	int kind, last_kind = BATCH_KEY_NONE;
 	int ret = EXIT_SUCCESS;
 
 	if (name && strcmp(name, "-") != 0) {
@@ -116,44 +386,93 @@ static int batch(const char *name)
 		}
 	}
 
-	if (rtnl_open(&rth, 0) < 0) {
-		fprintf(stderr, "Cannot open rtnetlink\n");
+	if (batch_jobs > 1 &&
+	    batch_jobs_start(&bj, batch_jobs, &batch_job_ops, !force) < 0) {
+		fprintf(stderr, "Cannot start batch jobs: %s\n",
+			strerror(errno));
 		return EXIT_FAILURE;
 	}
 
-	cmdlineno = 0;
-	while (getcmdline(&line, &len, stdin) != -1) {
-		char *largv[100];
-		int largc;
+	if (batch_begin() < 0)
+		return EXIT_FAILURE;
 
-		largc = makeargs(line, largv, 100);
+	cmdfile_open(&cf, stdin);
+	cmdlineno = 0;
+	while ((largc = cmdfile_getargs(&cf, &largv)) != -1) {
 		if (largc == 0)
 			continue;	/* blank line */
 
-		if (do_cmd(largv[0], largc, largv)) {
-			fprintf(stderr, "Command failed %s:%d\n", name, cmdlineno);
+		if (bj.njobs) {
+			int sw = batch_is_switch(largc, largv);
+			const char *key = NULL;
+
+			kind = BATCH_KEY_NONE;
+			if (!sw)
+				key = batch_key(largc, largv, &kind);
+			if (key && last_kind != BATCH_KEY_NONE &&
+			    kind != last_kind && batch_jobs_sync(&bj) < 0) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+			if (key)
+				last_kind = kind;
+
+			if (key || sw) {
+				/* What we ran ourselves must be done first */
+				if (dirty && batch_pipeline_sync() < 0 &&
+				    !force) {
+					ret = EXIT_FAILURE;
+					break;
+				}
+				dirty = 0;
+				if (batch_jobs_send(&bj, key, largc, largv) < 0) {
+					ret = EXIT_FAILURE;
+					break;
+				}
+				if (!sw)
+					continue;
+			} else {
+				if (batch_jobs_sync(&bj) < 0) {
+					ret = EXIT_FAILURE;
+					break;
+				}
+				last_kind = BATCH_KEY_NONE;
+			}
+			dirty = 1;
+		}
+
+		if (batch_run(largc, largv)) {
 			ret = EXIT_FAILURE;
 			if (!force)
 				break;
 		}
 	}
-	if (line)
-		free(line);
+	if (cf.error)
+		ret = EXIT_FAILURE;
+	cmdfile_close(&cf);
 
-	rtnl_close(&rth);
+	if (bj.njobs && batch_jobs_finish(&bj))
+		ret = EXIT_FAILURE;
+	if (batch_end() < 0)
+		ret = EXIT_FAILURE;
 	return ret;
 }
-#endif
+#else
+int batch_pipeline_open(struct rtnl_handle *h)
+{
+	return 0;
+}
 
-int main(int argc, char **argv)
+int batch_pipeline_join(struct rtnl_handle *h)
 {
-	char *basename;
+	return 0;
+}
+#endif
 
-	basename = strrchr(argv[0], '/');
-	if (basename == NULL)
-		basename = argv[0];
-	else
-		basename++;
+/* Take the options off the front of argv; argv[0] is not one */
+static int parse_options(int argc, char ***argvp)
+{
+	char **argv = *argvp;
 
 	while (argc > 1) {
 		char *opt = argv[1];
@@ -220,13 +539,65 @@ int main(int argc, char **argv)
 			exit(0);
 		} else if (matches(opt, "-force") == 0) {
 			++force;
+		} else if (matches(opt, "-all") == 0) {
+			do_all = 1;
 #ifndef ANDROID
+		} else if (strcmp(opt, "-server") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			server_path = argv[1];
+		} else if (strcmp(opt, "-batch-jobs") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (get_unsigned(&batch_jobs, argv[1], 0) ||
+			    batch_jobs == 0 || batch_jobs > BATCH_JOBS_MAX) {
+				fprintf(stderr, "Invalid number of batch jobs '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
+		} else if (strcmp(opt, "-batch-latency") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (get_unsigned(&batch_latency, argv[1], 0) ||
+			    batch_latency == 0) {
+				fprintf(stderr, "Invalid number of lines '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
 		} else if (matches(opt, "-batch") == 0) {
 			argc--;
 			argv++;
 			if (argc <= 1)
 				usage();
 			batch_file = argv[1];
+		} else if (matches(opt, "-window") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (get_unsigned(&batch_window, argv[1], 0)) {
+				fprintf(stderr, "Invalid window size '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
+		} else if (matches(opt, "-coalesce") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (get_unsigned(&batch_coalesce, argv[1], 0)) {
+				fprintf(stderr, "Invalid coalesce size '%s'\n",
+					argv[1]);
+				exit(-1);
+			}
+		} else if (strcmp(opt, "-noack") == 0) {
+			batch_noack = 1;
 #endif
 		} else if (matches(opt, "-rcvbuf") == 0) {
 			unsigned int size;
@@ -241,6 +612,16 @@ int main(int argc, char **argv)
 				exit(-1);
 			}
 			rcvbuf = size;
+		} else if (matches(opt, "-capture") == 0) {
+			++dump_capture;
+		} else if (strcmp(opt, "-replay") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			rtnl_replay_file = argv[1];
+		} else if (strcmp(opt, "-timing") == 0) {
+			rtnl_stats_start();
 		} else if (matches(opt, "-help") == 0) {
 			usage();
 		} else {
@@ -251,10 +632,41 @@ int main(int argc, char **argv)
 	}
 
 	_SL_ = oneline ? "\\" : "\n" ;
+	*argvp = argv;
+	return argc;
+}
+
+int main(int argc, char **argv)
+{
+	char *basename;
+
+	basename = strrchr(argv[0], '/');
+	if (basename == NULL)
+		basename = argv[0];
+	else
+		basename++;
+
+	argc = parse_options(argc, &argv);
+
+	/* A listing is printed with a dozen stdio calls per object: into a
+	 * large buffer, which goes out in few writes unless a terminal
+	 * reads it, and without a lock per call, as only this thread
+	 * prints.  Monitors flush after every event themselves.
+	 */
+	if (!isatty(STDOUT_FILENO))
+		setvbuf(stdout, NULL, _IOFBF, IP_OUTPUT_BUFSIZE);
+	__fsetlocking(stdout, FSETLOCKING_BYCALLER);
+
+	if (dump_capture && isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending binary stream to stdout\n");
+		exit(-1);
+	}
 
 #ifndef ANDROID
 	if (batch_file)
 		return batch(batch_file);
+	if (server_path)
+		return cmd_server(server_path, &server_ops) < 0 ? EXIT_FAILURE : 0;
 #endif
 
 	if (rtnl_open(&rth, 0) < 0)
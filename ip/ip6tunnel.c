@@ -106,6 +106,79 @@ static void print_tunnel(struct ip6_tnl_parm *p)
 		printf(" dscp inherit");
 }
 
+/* The parameters of l as SIOCGETTUNNEL would give them; -1 if unknown */
+static int tnl_parm_from_nl(struct tnl_nl_link *l, struct ip6_tnl_parm *p)
+{
+	struct rtattr *tb[IFLA_IPTUN_MAX + 1];
+
+	if (l->kind == NULL || l->data == NULL || strcmp(l->kind, "ip6tnl"))
+		return -1;
+
+	parse_rtattr_nested(tb, IFLA_IPTUN_MAX, l->data);
+	memset(p, 0, sizeof(*p));
+	strncpy(p->name, l->name, IFNAMSIZ - 1);
+	if (tb[IFLA_IPTUN_LINK])
+		p->link = rta_getattr_u32(tb[IFLA_IPTUN_LINK]);
+	if (tb[IFLA_IPTUN_LOCAL] &&
+	    RTA_PAYLOAD(tb[IFLA_IPTUN_LOCAL]) == sizeof(p->laddr))
+		memcpy(&p->laddr, RTA_DATA(tb[IFLA_IPTUN_LOCAL]),
+		       sizeof(p->laddr));
+	if (tb[IFLA_IPTUN_REMOTE] &&
+	    RTA_PAYLOAD(tb[IFLA_IPTUN_REMOTE]) == sizeof(p->raddr))
+		memcpy(&p->raddr, RTA_DATA(tb[IFLA_IPTUN_REMOTE]),
+		       sizeof(p->raddr));
+	if (tb[IFLA_IPTUN_TTL])
+		p->hop_limit = rta_getattr_u8(tb[IFLA_IPTUN_TTL]);
+	if (tb[IFLA_IPTUN_ENCAP_LIMIT])
+		p->encap_limit = rta_getattr_u8(tb[IFLA_IPTUN_ENCAP_LIMIT]);
+	if (tb[IFLA_IPTUN_FLOWINFO])
+		p->flowinfo = rta_getattr_u32(tb[IFLA_IPTUN_FLOWINFO]);
+	if (tb[IFLA_IPTUN_FLAGS])
+		p->flags = rta_getattr_u32(tb[IFLA_IPTUN_FLAGS]);
+	if (tb[IFLA_IPTUN_PROTO])
+		p->proto = rta_getattr_u8(tb[IFLA_IPTUN_PROTO]);
+	return 0;
+}
+
+static int tnl_parm_fill(struct nlmsghdr *n, int maxlen, void *arg)
+{
+	struct ip6_tnl_parm *p = arg;
+
+	if (p->link)
+		addattr32(n, maxlen, IFLA_IPTUN_LINK, p->link);
+	addattr_l(n, maxlen, IFLA_IPTUN_LOCAL, &p->laddr, sizeof(p->laddr));
+	addattr_l(n, maxlen, IFLA_IPTUN_REMOTE, &p->raddr, sizeof(p->raddr));
+	addattr_l(n, maxlen, IFLA_IPTUN_TTL, &p->hop_limit, 1);
+	addattr_l(n, maxlen, IFLA_IPTUN_ENCAP_LIMIT, &p->encap_limit, 1);
+	addattr_l(n, maxlen, IFLA_IPTUN_FLOWINFO, &p->flowinfo, 4);
+	addattr32(n, maxlen, IFLA_IPTUN_FLAGS, p->flags);
+	addattr_l(n, maxlen, IFLA_IPTUN_PROTO, &p->proto, 1);
+	return 0;
+}
+
+struct tnl_get_ctx {
+	struct ip6_tnl_parm	*p;
+	int			found;
+};
+
+static int tnl_get_one(struct tnl_nl_link *l, void *arg)
+{
+	struct tnl_get_ctx *ctx = arg;
+
+	ctx->found = tnl_parm_from_nl(l, ctx->p) == 0;
+	return 0;
+}
+
+/* SIOCGETTUNNEL through rtnetlink if the kernel can, else the ioctl */
+static int tnl_get(const char *name, struct ip6_tnl_parm *p)
+{
+	struct tnl_get_ctx ctx = { .p = p };
+
+	if (tnl_nl_list(name, tnl_get_one, &ctx) == 0 && ctx.found)
+		return 0;
+	return tnl_get_ioctl(name, p);
+}
+
 static int parse_args(int argc, char **argv, int cmd, struct ip6_tnl_parm *p)
 {
 	int count = 0;
@@ -211,7 +284,7 @@ static int parse_args(int argc, char **argv, int cmd, struct ip6_tnl_parm *p)
 			if (cmd == SIOCCHGTUNNEL && count == 0) {
 				struct ip6_tnl_parm old_p;
 				memset(&old_p, 0, sizeof(old_p));
-				if (tnl_get_ioctl(*argv, &old_p))
+				if (tnl_get(*argv, &old_p))
 					return -1;
 				*p = old_p;
 			}
@@ -260,7 +333,33 @@ static int ip6_tnl_parm_match(const struct ip6_tnl_parm *p1,
 		(!p1->flags || (p1->flags & p2->flags)));
 }
 
-static int do_tunnels_list(struct ip6_tnl_parm *p)
+static int tnl_list_one(struct tnl_nl_link *l, void *arg)
+{
+	struct ip6_tnl_parm *p = arg;
+	struct ip6_tnl_parm p1;
+
+	if (l->type != ARPHRD_TUNNEL6)
+		return 0;
+	if (p->name[0] && strcmp(p->name, l->name))
+		return 0;
+	if (tnl_parm_from_nl(l, &p1) < 0) {
+		ip6_tnl_parm_init(&p1, 0);
+		strcpy(p1.name, l->name);
+		p1.link = l->ifindex;
+		if (tnl_get_ioctl(p1.name, &p1))
+			return 0;
+	}
+	if (!ip6_tnl_parm_match(p, &p1))
+		return 0;
+	print_tunnel(&p1);
+	if (show_stats && l->has_stats)
+		tnl_print_stats(&l->stats);
+	printf("\n");
+	return 0;
+}
+
+/* For kernels that cannot dump links: /proc/net/dev and the ioctls */
+static int do_tunnels_list_proc(struct ip6_tnl_parm *p)
 {
 	char buf[512];
 	int err = -1;
@@ -341,6 +440,13 @@ static int do_tunnels_list(struct ip6_tnl_parm *p)
 	return err;
 }
 
+static int do_tunnels_list(struct ip6_tnl_parm *p)
+{
+	if (tnl_nl_list(NULL, tnl_list_one, p) == 0)
+		return 0;
+	return do_tunnels_list_proc(p);
+}
+
 static int do_show(int argc, char **argv)
 {
         struct ip6_tnl_parm p;
@@ -355,7 +461,7 @@ static int do_show(int argc, char **argv)
 	if (!p.name[0] || show_stats)
 		do_tunnels_list(&p);
 	else {
-		if (tnl_get_ioctl(p.name, &p))
+		if (tnl_get(p.name, &p))
 			return -1;
 		print_tunnel(&p);
 		printf("\n");
@@ -373,6 +479,9 @@ static int do_add(int cmd, int argc, char **argv)
 	if (parse_args(argc, argv, cmd, &p) < 0)
 		return -1;
 
+	if (tnl_nl_supported(cmd == SIOCCHGTUNNEL && p.name[0] ?
+			     p.name : "ip6tnl0"))
+		return tnl_nl_add(cmd, "ip6tnl", p.name, tnl_parm_fill, &p);
 	return tnl_add_ioctl(cmd,
 			     cmd == SIOCCHGTUNNEL && p.name[0] ?
 			     p.name : "ip6tnl0", p.name, &p);
@@ -387,6 +496,8 @@ static int do_del(int argc, char **argv)
 	if (parse_args(argc, argv, SIOCDELTUNNEL, &p) < 0)
 		return -1;
 
+	if (p.name[0] && tnl_nl_supported(p.name))
+		return tnl_nl_del(p.name);
 	return tnl_del_ioctl(p.name[0] ? p.name : "ip6tnl0", p.name, &p);
 }
 
@@ -15,6 +15,8 @@ extern int ipaddr_list(int argc, char **argv);
 extern int ipaddr_list_link(int argc, char **argv);
 extern int iproute_monitor(int argc, char **argv);
 extern void iplink_usage(void) __attribute__((noreturn));
+extern int link_range(const char *word, const char **open,
+		      const char **close, unsigned *from, int *width);
 extern void iproute_reset_filter(void);
 extern void ipaddr_reset_filter(int);
 extern void ipneigh_reset_filter(void);
@@ -25,9 +27,12 @@ extern int print_prefix(const struct sockaddr_nl *who,
 			struct nlmsghdr *n, void *arg);
 extern int print_rule(const struct sockaddr_nl *who,
 		      struct nlmsghdr *n, void *arg);
+extern int print_nexthop(const struct sockaddr_nl *who,
+			 struct nlmsghdr *n, void *arg);
 extern int do_ipaddr(int argc, char **argv);
 extern int do_ipaddrlabel(int argc, char **argv);
 extern int do_iproute(int argc, char **argv);
+extern const char *iproute_batch_key(int argc, char **argv);
 extern int do_iprule(int argc, char **argv);
 extern int do_ipneigh(int argc, char **argv);
 extern int do_ipntable(int argc, char **argv);
@@ -42,6 +47,34 @@ extern int do_multirule(int argc, char **argv);
 extern int do_netns(int argc, char **argv);
 extern int do_xfrm(int argc, char **argv);
 extern int do_ipl2tp(int argc, char **argv);
+extern int do_tcp_metrics(int argc, char **argv);
+
+enum {
+	STEER_AUTO = 1,
+	STEER_NUMA_LOCAL,
+	STEER_SPREAD,
+};
+extern int iplink_steering_mode(const char *arg);
+extern int iplink_steering(const char *dev, int mode, int dry_run);
+extern int do_ipnh(int argc, char **argv);
+
+/* "ip route save" streams, also used by "ip rule save" */
+#define RTSAVE_F_INDEX		0x1
+#define RTSAVE_F_ZLIB		0x2
+
+typedef int (*rtsave_handler_t)(struct nlmsghdr *n, void *arg);
+
+extern int rtsave_begin(int flags);
+extern int rtsave_put(struct nlmsghdr *n, __u32 table);
+extern int rtsave_end(void);
+extern int rtsave_restore(__u32 table, rtsave_handler_t handler, void *arg);
+
+struct rtlpm;
+extern struct rtlpm *rtlpm_new(int family);
+extern int rtlpm_add(struct rtlpm *t, struct nlmsghdr *n);
+extern int rtlpm_build(struct rtlpm *t);
+extern struct nlmsghdr *rtlpm_lookup(struct rtlpm *t, const void *addr);
+extern void rtlpm_free(struct rtlpm *t);
 
 static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 {
@@ -52,6 +85,11 @@ static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 }
 
 extern struct rtnl_handle rth;
+extern char *batch_file;
+extern int do_all;
+extern int do_cmd(const char *argv0, int argc, char **argv);
+extern int batch_pipeline_open(struct rtnl_handle *h);
+extern int batch_pipeline_join(struct rtnl_handle *h);
 
 struct link_util
 {
@@ -68,6 +106,9 @@ struct link_util
 
 struct link_util *get_link_kind(const char *kind);
 int get_netns_fd(const char *name);
+int get_netns_id(const char *name);
+const char *netns_id_n2a(int nsid);
+void netns_ids_flush(void);
 
 #ifndef	INFINITY_LIFE_TIME
 #define     INFINITY_LIFE_TIME      0xFFFFFFFFU
@@ -24,6 +24,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <fnmatch.h>
+#include <stddef.h>
 
 #include <linux/netdevice.h>
 #include <linux/if_arp.h>
@@ -51,10 +52,21 @@ static struct
 	int flushp;
 	int flushe;
 	int group;
+	int master;
+	char *kind;
+	int flush_errors;
+	struct rtnl_handle *flush_rth;
+	int save;
 } filter;
 
 static int do_link;
 
+enum {
+	IPADDR_LIST,
+	IPADDR_FLUSH,
+	IPADDR_SAVE,
+};
+
 static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
@@ -67,6 +79,9 @@ static void usage(void)
 	fprintf(stderr, "       ip addr del IFADDR dev STRING\n");
 	fprintf(stderr, "       ip addr {show|flush} [ dev STRING ] [ scope SCOPE-ID ]\n");
 	fprintf(stderr, "                            [ to PREFIX ] [ FLAG-LIST ] [ label PATTERN ]\n");
+	fprintf(stderr, "       ip addr flush [ dev STRING ] [ scope SCOPE-ID ] ... fast\n");
+	fprintf(stderr, "       ip addr save [ dev STRING ] [ scope SCOPE-ID ] ... [ compress ]\n");
+	fprintf(stderr, "       ip addr restore\n");
 	fprintf(stderr, "IFADDR := PREFIX | ADDR peer PREFIX\n");
 	fprintf(stderr, "          [ broadcast ADDR ] [ anycast ADDR ]\n");
 	fprintf(stderr, "          [ label STRING ] [ scope SCOPE-ID ]\n");
@@ -184,11 +199,12 @@ static void print_linkmode(FILE *f, struct rtattr *tb)
 
 static void print_linktype(FILE *fp, struct rtattr *tb)
 {
-	struct rtattr *linkinfo[IFLA_INFO_MAX+1];
+	struct rtattr **linkinfo;
 	struct link_util *lu;
 	char *kind;
+	RTATTR_TABLE(linkinfo_tb, IFLA_INFO_MAX);
 
-	parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb);
+	linkinfo = parse_rtattr_table_nested(&linkinfo_tb, tb);
 
 	if (!linkinfo[IFLA_INFO_KIND])
 		return;
@@ -362,9 +378,10 @@ int print_linkinfo(const struct sockaddr_nl *who,
 {
 	FILE *fp = (FILE*)arg;
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
-	struct rtattr * tb[IFLA_MAX+1];
+	struct rtattr **tb;
 	int len = n->nlmsg_len;
 	unsigned m_flag = 0;
+	RTATTR_TABLE(link_tb, IFLA_MAX);
 
 	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
 		return 0;
@@ -378,7 +395,7 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	if (filter.up && !(ifi->ifi_flags&IFF_UP))
 		return 0;
 
-	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	tb = parse_rtattr_table(&link_tb, IFLA_RTA(ifi), len);
 	if (tb[IFLA_IFNAME] == NULL) {
 		fprintf(stderr, "BUG: device with ifindex %d has nil ifname\n", ifi->ifi_index);
 	}
@@ -393,17 +410,36 @@ int print_linkinfo(const struct sockaddr_nl *who,
 			return -1;
 	}
 
+	/* Kernels before 4.5 ignore these in the dump request */
+	if (filter.master &&
+	    (!tb[IFLA_MASTER] || rta_getattr_u32(tb[IFLA_MASTER]) != filter.master))
+		return 0;
+	if (filter.kind) {
+		struct rtattr *linkinfo[IFLA_INFO_MAX+1];
+
+		if (!tb[IFLA_LINKINFO])
+			return 0;
+		parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+		if (!linkinfo[IFLA_INFO_KIND] ||
+		    strcmp(rta_getattr_str(linkinfo[IFLA_INFO_KIND]), filter.kind))
+			return 0;
+	}
+
 	if (n->nlmsg_type == RTM_DELLINK)
 		fprintf(fp, "Deleted ");
 
-	fprintf(fp, "%d: %s", ifi->ifi_index,
-		tb[IFLA_IFNAME] ? rta_getattr_str(tb[IFLA_IFNAME]) : "<nil>");
+	print_uint(fp, ifi->ifi_index);
+	fputs(": ", fp);
+	fputs(tb[IFLA_IFNAME] ? rta_getattr_str(tb[IFLA_IFNAME]) : "<nil>", fp);
 
 	if (tb[IFLA_LINK]) {
 		SPRINT_BUF(b1);
 		int iflink = *(int*)RTA_DATA(tb[IFLA_LINK]);
 		if (iflink == 0)
 			fprintf(fp, "@NONE: ");
+		else if (tb[IFLA_LINK_NETNSID])
+			/* The index is one of another namespace */
+			fprintf(fp, "@if%d: ", iflink);
 		else {
 			fprintf(fp, "@%s: ", ll_idx_n2a(iflink, b1));
 			m_flag = ll_index_to_flags(iflink);
@@ -415,9 +451,9 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	print_link_flags(fp, ifi->ifi_flags, m_flag);
 
 	if (tb[IFLA_MTU])
-		fprintf(fp, "mtu %u ", *(int*)RTA_DATA(tb[IFLA_MTU]));
+		print_field_u(fp, "mtu ", *(int*)RTA_DATA(tb[IFLA_MTU]));
 	if (tb[IFLA_QDISC])
-		fprintf(fp, "qdisc %s ", rta_getattr_str(tb[IFLA_QDISC]));
+		print_field(fp, "qdisc ", rta_getattr_str(tb[IFLA_QDISC]));
 	if (tb[IFLA_MASTER]) {
 		SPRINT_BUF(b1);
 		fprintf(fp, "master %s ", ll_idx_n2a(*(int*)RTA_DATA(tb[IFLA_MASTER]), b1));
@@ -453,6 +489,17 @@ int print_linkinfo(const struct sockaddr_nl *who,
 						      ifi->ifi_type,
 						      b1, sizeof(b1)));
 		}
+		if (tb[IFLA_LINK_NETNSID]) {
+			int id = *(int*)RTA_DATA(tb[IFLA_LINK_NETNSID]);
+			const char *name = id >= 0 ? netns_id_n2a(id) : NULL;
+
+			if (name)
+				fprintf(fp, " link-netns %s", name);
+			else if (id >= 0)
+				fprintf(fp, " link-netnsid %d", id);
+			else
+				fprintf(fp, " link-netnsid unknown");
+		}
 	}
 
 	if (do_link && tb[IFLA_LINKINFO] && show_details)
@@ -477,7 +524,6 @@ int print_linkinfo(const struct sockaddr_nl *who,
 	}
 
 	fprintf(fp, "\n");
-	fflush(fp);
 	return 0;
 }
 
@@ -491,6 +537,24 @@ static int flush_update(void)
 	return 0;
 }
 
+/* The fast flush keeps every delete until the dump is done */
+static int flush_grow(int len)
+{
+	int size = filter.flushe ? filter.flushe * 2 : 65536;
+	char *b;
+
+	while (size < NLMSG_ALIGN(filter.flushp) + len)
+		size *= 2;
+	b = realloc(filter.flushb, size);
+	if (b == NULL) {
+		perror("Cannot allocate flush buffer");
+		return -1;
+	}
+	filter.flushb = b;
+	filter.flushe = size;
+	return 0;
+}
+
 static int set_lifetime(unsigned int *lifetime, char *argv)
 {
 	if (strcmp(argv, "forever") == 0)
@@ -562,17 +626,24 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (filter.family && filter.family != ifa->ifa_family)
 		return 0;
 
+	if (filter.save)
+		return rtsave_put(n, 0);
+
 	if (filter.flushb) {
 		struct nlmsghdr *fn;
 		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
+			if (filter.flush_rth) {
+				if (flush_grow(n->nlmsg_len))
+					return -1;
+			} else if (flush_update())
 				return -1;
 		}
 		fn = (struct nlmsghdr*)(filter.flushb + NLMSG_ALIGN(filter.flushp));
 		memcpy(fn, n, n->nlmsg_len);
 		fn->nlmsg_type = RTM_DELADDR;
 		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
+		if (!filter.flush_rth)
+			fn->nlmsg_seq = ++rth.seq;
 		filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
 		filter.flushed++;
 		if (show_stats < 2)
@@ -582,8 +653,11 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	if (n->nlmsg_type == RTM_DELADDR)
 		fprintf(fp, "Deleted ");
 
-	if (filter.oneline || filter.flushb)
-		fprintf(fp, "%u: %s", ifa->ifa_index, ll_index_to_name(ifa->ifa_index));
+	if (filter.oneline || filter.flushb) {
+		print_uint(fp, ifa->ifa_index);
+		fputs(": ", fp);
+		fputs(ll_index_to_name(ifa->ifa_index), fp);
+	}
 	if (ifa->ifa_family == AF_INET)
 		fprintf(fp, "    inet ");
 	else if (ifa->ifa_family == AF_INET6)
@@ -596,14 +670,14 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		fprintf(fp, "    family %d ", ifa->ifa_family);
 
 	if (rta_tb[IFA_LOCAL]) {
-		fprintf(fp, "%s", rt_addr_n2a(ifa->ifa_family,
-					      RTA_PAYLOAD(rta_tb[IFA_LOCAL]),
-					      RTA_DATA(rta_tb[IFA_LOCAL]),
-					      abuf, sizeof(abuf)));
+		fputs(rt_addr_n2a(ifa->ifa_family,
+				  RTA_PAYLOAD(rta_tb[IFA_LOCAL]),
+				  RTA_DATA(rta_tb[IFA_LOCAL]),
+				  abuf, sizeof(abuf)), fp);
 
 		if (rta_tb[IFA_ADDRESS] == NULL ||
 		    memcmp(RTA_DATA(rta_tb[IFA_ADDRESS]), RTA_DATA(rta_tb[IFA_LOCAL]), 4) == 0) {
-			fprintf(fp, "/%d ", ifa->ifa_prefixlen);
+			print_field_u(fp, "/", ifa->ifa_prefixlen);
 		} else {
 			fprintf(fp, " peer %s/%d ",
 				rt_addr_n2a(ifa->ifa_family,
@@ -615,11 +689,11 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 	}
 
 	if (rta_tb[IFA_BROADCAST]) {
-		fprintf(fp, "brd %s ",
-			rt_addr_n2a(ifa->ifa_family,
-				    RTA_PAYLOAD(rta_tb[IFA_BROADCAST]),
-				    RTA_DATA(rta_tb[IFA_BROADCAST]),
-				    abuf, sizeof(abuf)));
+		print_field(fp, "brd ",
+			    rt_addr_n2a(ifa->ifa_family,
+					RTA_PAYLOAD(rta_tb[IFA_BROADCAST]),
+					RTA_DATA(rta_tb[IFA_BROADCAST]),
+					abuf, sizeof(abuf)));
 	}
 	if (rta_tb[IFA_ANYCAST]) {
 		fprintf(fp, "any %s ",
@@ -628,7 +702,7 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 				    RTA_DATA(rta_tb[IFA_ANYCAST]),
 				    abuf, sizeof(abuf)));
 	}
-	fprintf(fp, "scope %s ", rtnl_rtscope_n2a(ifa->ifa_scope, b1, sizeof(b1)));
+	print_field(fp, "scope ", rtnl_rtscope_n2a(ifa->ifa_scope, b1, sizeof(b1)));
 	ifa_flags = ifa->ifa_flags;
 	if (ifa->ifa_flags&IFA_F_SECONDARY) {
 		ifa_flags &= ~IFA_F_SECONDARY;
@@ -672,8 +746,10 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		fprintf(fp, "       valid_lft ");
 		if (ci->ifa_valid == INFINITY_LIFE_TIME)
 			fprintf(fp, "forever");
-		else
-			fprintf(fp, "%usec", ci->ifa_valid);
+		else {
+			print_uint(fp, ci->ifa_valid);
+			fputs("sec", fp);
+		}
 		fprintf(fp, " preferred_lft ");
 		if (ci->ifa_prefered == INFINITY_LIFE_TIME)
 			fprintf(fp, "forever");
@@ -685,7 +761,6 @@ int print_addrinfo(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		}
 	}
 	fprintf(fp, "\n");
-	fflush(fp);
 	return 0;
 }
 
@@ -714,12 +789,66 @@ int print_addrinfo_secondary(const struct sockaddr_nl *who, struct nlmsghdr *n,
 struct nlmsg_list
 {
 	struct nlmsg_list *next;
+	struct nlmsg_list *ifnext;	/* same addr_index bucket */
 	struct nlmsghdr	  h;
 };
 
+struct nlmsg_chain
+{
+	struct nlmsg_list *head;
+	struct nlmsg_list *tail;
+	unsigned int	  count;
+	struct arena	  *arena;
+};
+
+/* Addresses bucketed by ifa_index, so that joining them with the
+ * link list costs one bucket walk per link rather than a walk over
+ * every address.  Dump order is kept within a bucket.
+ */
+struct addr_index
+{
+	struct nlmsg_list **head;
+	struct nlmsg_list **tail;
+	unsigned int	  mask;
+};
+
+static int addr_index_build(struct addr_index *idx, struct nlmsg_chain *ainfo,
+			    unsigned int nlinks)
+{
+	struct nlmsg_list *a;
+	unsigned int size = 64;
+
+	while (size < nlinks)
+		size <<= 1;
+
+	idx->head = calloc(size, sizeof(*idx->head));
+	idx->tail = calloc(size, sizeof(*idx->tail));
+	if (idx->head == NULL || idx->tail == NULL)
+		return -1;
+	idx->mask = size - 1;
+
+	for (a = ainfo->head; a; a = a->next) {
+		struct ifaddrmsg *ifa = NLMSG_DATA(&a->h);
+		unsigned int h = ifa->ifa_index & idx->mask;
+
+		a->ifnext = NULL;
+		if (idx->tail[h])
+			idx->tail[h]->ifnext = a;
+		else
+			idx->head[h] = a;
+		idx->tail[h] = a;
+	}
+	return 0;
+}
+
+static struct nlmsg_list *addr_index_first(struct addr_index *idx, int ifindex)
+{
+	return idx->head ? idx->head[ifindex & idx->mask] : NULL;
+}
+
 static int print_selected_addrinfo(int ifindex, struct nlmsg_list *ainfo, FILE *fp)
 {
-	for ( ;ainfo ;  ainfo = ainfo->next) {
+	for ( ;ainfo ;  ainfo = ainfo->ifnext) {
 		struct nlmsghdr *n = &ainfo->h;
 		struct ifaddrmsg *ifa = NLMSG_DATA(n);
 
@@ -742,31 +871,307 @@ static int print_selected_addrinfo(int ifindex, struct nlmsg_list *ainfo, FILE *
 static int store_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		       void *arg)
 {
-	struct nlmsg_list **linfo = (struct nlmsg_list**)arg;
+	struct nlmsg_chain *lchain = (struct nlmsg_chain *)arg;
 	struct nlmsg_list *h;
-	struct nlmsg_list **lp;
 
-	h = malloc(n->nlmsg_len+sizeof(void*));
+	h = arena_alloc(lchain->arena, n->nlmsg_len + offsetof(struct nlmsg_list, h));
 	if (h == NULL)
 		return -1;
 
 	memcpy(&h->h, n, n->nlmsg_len);
 	h->next = NULL;
 
-	for (lp = linfo; *lp; lp = &(*lp)->next) /* NOTHING */;
-	*lp = h;
+	if (lchain->tail)
+		lchain->tail->next = h;
+	else
+		lchain->head = h;
+	lchain->tail = h;
+	lchain->count++;
 
 	ll_remember_index(who, n, NULL);
 	return 0;
 }
 
-static int ipaddr_list_or_flush(int argc, char **argv, int flush)
+/* -capture: the link dump and, unless only links were asked for, the
+ * address dump, unfiltered.
+ */
+static int ipaddr_capture(void)
 {
-	struct nlmsg_list *linfo = NULL;
-	struct nlmsg_list *ainfo = NULL;
+	if (rtnl_wilddump_request(&rth, preferred_family, RTM_GETLINK) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, rtnl_to_file, stdout) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	if (filter.family == AF_PACKET)
+		return 0;
+
+	if (rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, rtnl_to_file, stdout) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Ask the kernel for the links of one master or kind only, and to
+ * leave out what will not be printed: statistics without -s and VF
+ * information unless links are listed.  Groups cannot be filtered by
+ * the kernel, print_linkinfo() checks those and again everything else.
+ */
+static int ipaddr_link_dump_request(void)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifm;
+		char			buf[128];
+	} req;
+	__u32 ext_mask = 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.n.nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
+	req.n.nlmsg_seq = rth.dump = ++rth.seq;
+	req.ifm.ifi_family = preferred_family;
+
+	if (do_link)
+		ext_mask |= RTEXT_FILTER_VF;
+	if (!do_link || !show_stats)
+		ext_mask |= RTEXT_FILTER_SKIP_STATS;
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, ext_mask);
+
+	if (filter.master)
+		addattr32(&req.n, sizeof(req), IFLA_MASTER, filter.master);
+	if (filter.kind) {
+		struct rtattr *linkinfo;
+
+		linkinfo = addattr_nest(&req.n, sizeof(req), IFLA_LINKINFO);
+		addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, filter.kind,
+			  strlen(filter.kind));
+		addattr_nest_end(&req.n, linkinfo);
+	}
+
+	return rtnl_send(&rth, &req, req.n.nlmsg_len);
+}
+
+/* Ask the kernel for the addresses of one device only.  Only strict
+ * dump requests may carry an ifa_index, everything else is filtered by
+ * print_addrinfo() and the address listing.
+ */
+static int ipaddr_dump_request(void)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifaddrmsg	ifa;
+	} req;
+	int ret;
+
+	if (filter.ifindex) {
+		memset(&req, 0, sizeof(req));
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		req.n.nlmsg_type = RTM_GETADDR;
+		req.ifa.ifa_family = filter.family;
+		req.ifa.ifa_index = filter.ifindex;
+
+		ret = rtnl_dump_request_strict(&rth, &req.n);
+		if (ret != 0)
+			return ret;
+	}
+	return rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR);
+}
+
+/* "ip addr flush ... fast" collects the deletes from a single dump and
+ * sends them through a pipeline once the dump is done, so the dump is
+ * not disturbed and nothing has to be looked for again.  Secondary
+ * addresses go first: deleting a primary takes its secondaries along,
+ * or promotes one of them, which a second round would have to chase.
+ */
+#define FLUSH_FAST_WINDOW	256
+
+static void flush_fast_error(int cookie, int error, void *arg)
+{
+	/* Already gone, e.g. with its primary */
+	if (error == EADDRNOTAVAIL)
+		return;
+	if (filter.flush_errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+}
+
+static int ipaddr_flush_fast(int bufsize)
+{
+	struct rtnl_handle frth;
+	int pass, ret = -1;
+
+	if (rtnl_open(&frth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	filter.flushb = NULL;
+	filter.flushp = 0;
+	filter.flushe = 0;
+	if (flush_grow(0) < 0) {
+		rtnl_close(&frth);
+		return -1;
+	}
+	filter.flush_rth = &frth;
+	filter.flushed = 0;
+	filter.flush_errors = 0;
+
+	if (ipaddr_dump_request() < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, print_addrinfo, stdout) < 0) {
+		fprintf(stderr, "Flush terminated\n");
+		goto out;
+	}
+	if (filter.flushed == 0) {
+		if (show_stats)
+			printf("Nothing to flush.\n");
+		ret = 0;
+		goto out;
+	}
+
+	if (rtnl_pipeline_open(&frth, FLUSH_FAST_WINDOW,
+			       flush_fast_error, NULL) < 0 ||
+	    rtnl_pipeline_coalesce(&frth, bufsize) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		goto out;
+	}
+	for (pass = 0; pass < 2; pass++) {
+		struct nlmsghdr *fn;
+		int len = filter.flushp;
+
+		for (fn = (struct nlmsghdr *)filter.flushb; NLMSG_OK(fn, len);
+		     fn = NLMSG_NEXT(fn, len)) {
+			struct ifaddrmsg *ifa = NLMSG_DATA(fn);
+
+			if (((ifa->ifa_flags & IFA_F_SECONDARY) != 0) == pass)
+				continue;
+			if (rtnl_talk(&frth, fn, 0, 0, NULL) < 0)
+				break;
+		}
+	}
+	if (rtnl_pipeline_close(&frth) < 0)
+		goto out;
+
+	if (show_stats) {
+		printf("\n*** Deleted %d addresses",
+		       filter.flushed - filter.flush_errors);
+		if (filter.flush_errors)
+			printf(", %d failed", filter.flush_errors);
+		printf(" ***\n");
+	}
+	ret = filter.flush_errors ? -1 : 0;
+out:
+	fflush(stdout);
+	free(filter.flushb);
+	filter.flushb = NULL;
+	rtnl_close(&frth);
+	filter.flush_rth = NULL;
+	return ret;
+}
+
+/* "ip addr save" writes the selected addresses in the stream format of
+ * "ip route save", and "ip addr restore" adds them back through a
+ * request pipeline.  Devices are known by their index, as in routes.
+ */
+#define RESTORE_WINDOW		256
+#define RESTORE_BATCH		32768
+
+static int ipaddr_save(int save_flags)
+{
+	int ret = 0;
+
+	filter.save = 1;
+	if (rtsave_begin(save_flags) < 0)
+		return 1;
+	if (ipaddr_dump_request() < 0) {
+		perror("Cannot send dump request");
+		ret = 1;
+	} else if (rtnl_dump_filter(&rth, print_addrinfo, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		ret = 1;
+	}
+	if (rtsave_end() < 0)
+		ret = 1;
+	return ret;
+}
+
+struct restore_state
+{
+	int	count;
+	int	errors;
+};
+
+static void restore_error(int cookie, int error, void *arg)
+{
+	struct restore_state *rs = arg;
+
+	/* Addresses that are already there are left alone */
+	if (error == EEXIST)
+		return;
+	if (rs->errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s (address %d)\n",
+			strerror(error), cookie);
+}
+
+static int restore_addr(struct nlmsghdr *n, void *arg)
+{
+	struct restore_state *rs = arg;
+
+	if (n->nlmsg_type != RTM_NEWADDR)
+		return 0;
+
+	n->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
+	rtnl_pipeline_cookie(&rth, ++rs->count);
+	return rtnl_talk(&rth, n, 0, 0, NULL);
+}
+
+static int ipaddr_restore(int argc, char **argv)
+{
+	struct restore_state rs = { 0 };
+	int ret;
+
+	if (argc > 0) {
+		if (matches(*argv, "help") == 0)
+			usage();
+		invarg("unknown restore option\n", *argv);
+	}
+
+	if (rtnl_pipeline_open(&rth, RESTORE_WINDOW, restore_error, &rs) < 0 ||
+	    rtnl_pipeline_coalesce(&rth, RESTORE_BATCH) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return 1;
+	}
+	ret = rtsave_restore(0, restore_addr, &rs);
+	if (rtnl_pipeline_close(&rth) < 0)
+		ret = -1;
+	if (rs.errors > 1)
+		fprintf(stderr, "%d of %d addresses were not restored\n",
+			rs.errors, rs.count);
+	return ret < 0 || rs.errors ? 2 : 0;
+}
+
+static int ipaddr_list_or_flush(int argc, char **argv, int action)
+{
+	struct arena arena;
+	struct nlmsg_chain linfo = { NULL, NULL, 0, &arena };
+	struct nlmsg_chain ainfo = { NULL, NULL, 0, &arena };
+	struct addr_index aidx = { NULL, NULL, 0 };
 	struct nlmsg_list *l, *n;
 	char *filter_dev = NULL;
 	int no_link = 0;
+	int fast = 0;
+	int flush = action == IPADDR_FLUSH;
+	int save = action == IPADDR_SAVE;
+	int save_flags = 0;
 
 	ipaddr_reset_filter(oneline);
 	filter.showqueue = 1;
@@ -777,7 +1182,7 @@ static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 	filter.group = INIT_NETDEV_GROUP;
 
 	if (flush) {
-		if (argc <= 0) {
+		if (argc <= 0 || (argc == 1 && strcmp(*argv, "fast") == 0)) {
 			fprintf(stderr, "Flush requires arguments.\n");
 
 			return -1;
@@ -788,6 +1193,8 @@ static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 		}
 	}
 
+	arena_init(&arena, 0);
+
 	while (argc > 0) {
 		if (strcmp(*argv, "to") == 0) {
 			NEXT_ARG();
@@ -842,6 +1249,18 @@ static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 			NEXT_ARG();
 			if (rtnl_group_a2n(&filter.group, *argv))
 				invarg("Invalid \"group\" value\n", *argv);
+		} else if (strcmp(*argv, "master") == 0) {
+			NEXT_ARG();
+			filter.master = ll_name_to_index(*argv);
+			if (!filter.master)
+				invarg("Device does not exist\n", *argv);
+		} else if (strcmp(*argv, "type") == 0) {
+			NEXT_ARG();
+			filter.kind = *argv;
+		} else if (flush && strcmp(*argv, "fast") == 0) {
+			fast = 1;
+		} else if (save && strcmp(*argv, "compress") == 0) {
+			save_flags |= RTSAVE_F_ZLIB;
 		} else {
 			if (strcmp(*argv, "dev") == 0) {
 				NEXT_ARG();
@@ -855,7 +1274,31 @@ static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 		argv++; argc--;
 	}
 
-	if (rtnl_wilddump_request(&rth, preferred_family, RTM_GETLINK) < 0) {
+	if (dump_capture && !flush)
+		return ipaddr_capture();
+
+	if (fast || save) {
+		char flushb[4096-512];
+
+		if (filter_dev) {
+			filter.ifindex = ll_name_to_index(filter_dev);
+			if (filter.ifindex <= 0) {
+				fprintf(stderr, "Device \"%s\" does not exist.\n", filter_dev);
+				return -1;
+			}
+		}
+		if (save)
+			return ipaddr_save(save_flags);
+		return ipaddr_flush_fast(sizeof(flushb)) < 0;
+	}
+
+	/* Links that are not dumped are named on demand, e.g. peers */
+	if (filter.master || filter.kind)
+		ll_init_map(&rth);
+
+	/* Links and addresses are stored and joined before printing */
+	rth.flags |= RTNL_HANDLE_F_DUMP_CONSISTENT;
+	if (ipaddr_link_dump_request() < 0) {
 		perror("Cannot send dump request");
 		exit(1);
 	}
@@ -896,7 +1339,7 @@ static int ipaddr_list_or_flush(int argc, char **argv, int flush)
 					.arg1 = NULL,
 				},
 			};
-			if (rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR) < 0) {
+			if (ipaddr_dump_request() < 0) {
 				perror("Cannot send dump request");
 				exit(1);
 			}
@@ -939,7 +1382,7 @@ flush_done:
 	}
 
 	if (filter.family != AF_PACKET) {
-		if (rtnl_wilddump_request(&rth, filter.family, RTM_GETADDR) < 0) {
+		if (ipaddr_dump_request() < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
@@ -948,12 +1391,18 @@ flush_done:
 			fprintf(stderr, "Dump terminated\n");
 			exit(1);
 		}
+
+		if (addr_index_build(&aidx, &ainfo, linfo.count) < 0) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
 	}
+	rth.flags &= ~RTNL_HANDLE_F_DUMP_CONSISTENT;
 
 
 	if (filter.family && filter.family != AF_PACKET) {
 		struct nlmsg_list **lp;
-		lp=&linfo;
+		lp=&linfo.head;
 
 		if (filter.oneline)
 			no_link = 1;
@@ -963,7 +1412,8 @@ flush_done:
 			struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
 			struct nlmsg_list *a;
 
-			for (a=ainfo; a; a=a->next) {
+			for (a = addr_index_first(&aidx, ifi->ifi_index); a;
+			     a = a->ifnext) {
 				struct nlmsghdr *n = &a->h;
 				struct ifaddrmsg *ifa = NLMSG_DATA(n);
 
@@ -1010,17 +1460,21 @@ flush_done:
 		}
 	}
 
-	for (l=linfo; l; l = n) {
+	for (l=linfo.head; l; l = n) {
 		n = l->next;
 		if (no_link || print_linkinfo(NULL, &l->h, stdout) == 0) {
 			struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
 			if (filter.family != AF_PACKET)
-				print_selected_addrinfo(ifi->ifi_index, ainfo, stdout);
+				print_selected_addrinfo(ifi->ifi_index,
+					addr_index_first(&aidx, ifi->ifi_index),
+					stdout);
 		}
 		fflush(stdout);
-		free(l);
 	}
 
+	arena_free(&arena);
+	free(aidx.head);
+	free(aidx.tail);
 	return 0;
 }
 
@@ -1028,7 +1482,7 @@ int ipaddr_list_link(int argc, char **argv)
 {
 	preferred_family = AF_PACKET;
 	do_link = 1;
-	return ipaddr_list_or_flush(argc, argv, 0);
+	return ipaddr_list_or_flush(argc, argv, IPADDR_LIST);
 }
 
 void ipaddr_reset_filter(int oneline)
@@ -1046,6 +1500,37 @@ static int default_scope(inet_prefix *lcl)
 	return 0;
 }
 
+/* The keywords of ipaddr_modify(), in the order they used to be tried */
+enum {
+	AKW_PEER,
+	AKW_BROADCAST,
+	AKW_ANYCAST,
+	AKW_SCOPE,
+	AKW_DEV,
+	AKW_LABEL,
+	AKW_VALID_LFT,
+	AKW_PREFERRED_LFT,
+	AKW_HOME,
+	AKW_NODAD,
+};
+
+static const struct kw addr_kws[] = {
+	{ "peer",		AKW_PEER, 0 },
+	{ "remote",		AKW_PEER, 0 },
+	{ "broadcast",		AKW_BROADCAST, 1 },
+	{ "brd",		AKW_BROADCAST, 0 },
+	{ "anycast",		AKW_ANYCAST, 0 },
+	{ "scope",		AKW_SCOPE, 0 },
+	{ "dev",		AKW_DEV, 0 },
+	{ "label",		AKW_LABEL, 0 },
+	{ "valid_lft",		AKW_VALID_LFT, 1 },
+	{ "preferred_lft",	AKW_PREFERRED_LFT, 1 },
+	{ "home",		AKW_HOME, 0 },
+	{ "nodad",		AKW_NODAD, 0 },
+};
+
+static struct kw_table addr_kw = KW_TABLE(addr_kws);
+
 static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 {
 	struct {
@@ -1077,8 +1562,8 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 	req.ifa.ifa_family = preferred_family;
 
 	while (argc > 0) {
-		if (strcmp(*argv, "peer") == 0 ||
-		    strcmp(*argv, "remote") == 0) {
+		switch (kw_lookup(&addr_kw, *argv)) {
+		case AKW_PEER:
 			NEXT_ARG();
 
 			if (peer_len)
@@ -1089,8 +1574,8 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 				req.ifa.ifa_family = peer.family;
 			addattr_l(&req.n, sizeof(req), IFA_ADDRESS, &peer.data, peer.bytelen);
 			req.ifa.ifa_prefixlen = peer.bitlen;
-		} else if (matches(*argv, "broadcast") == 0 ||
-			   strcmp(*argv, "brd") == 0) {
+			break;
+		case AKW_BROADCAST: {
 			inet_prefix addr;
 			NEXT_ARG();
 			if (brd_len)
@@ -1106,7 +1591,9 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 				addattr_l(&req.n, sizeof(req), IFA_BROADCAST, &addr.data, addr.bytelen);
 				brd_len = addr.bytelen;
 			}
-		} else if (strcmp(*argv, "anycast") == 0) {
+			break;
+		}
+		case AKW_ANYCAST: {
 			inet_prefix addr;
 			NEXT_ARG();
 			if (any_len)
@@ -1116,39 +1603,49 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 				req.ifa.ifa_family = addr.family;
 			addattr_l(&req.n, sizeof(req), IFA_ANYCAST, &addr.data, addr.bytelen);
 			any_len = addr.bytelen;
-		} else if (strcmp(*argv, "scope") == 0) {
+			break;
+		}
+		case AKW_SCOPE: {
 			unsigned scope = 0;
 			NEXT_ARG();
 			if (rtnl_rtscope_a2n(&scope, *argv))
 				invarg(*argv, "invalid scope value.");
 			req.ifa.ifa_scope = scope;
 			scoped = 1;
-		} else if (strcmp(*argv, "dev") == 0) {
+			break;
+		}
+		case AKW_DEV:
 			NEXT_ARG();
 			d = *argv;
-		} else if (strcmp(*argv, "label") == 0) {
+			break;
+		case AKW_LABEL:
 			NEXT_ARG();
 			l = *argv;
 			addattr_l(&req.n, sizeof(req), IFA_LABEL, l, strlen(l)+1);
-		} else if (matches(*argv, "valid_lft") == 0) {
+			break;
+		case AKW_VALID_LFT:
 			if (valid_lftp)
 				duparg("valid_lft", *argv);
 			NEXT_ARG();
 			valid_lftp = *argv;
 			if (set_lifetime(&valid_lft, *argv))
 				invarg("valid_lft value", *argv);
-		} else if (matches(*argv, "preferred_lft") == 0) {
+			break;
+		case AKW_PREFERRED_LFT:
 			if (preferred_lftp)
 				duparg("preferred_lft", *argv);
 			NEXT_ARG();
 			preferred_lftp = *argv;
 			if (set_lifetime(&preferred_lft, *argv))
 				invarg("preferred_lft value", *argv);
-		} else if (strcmp(*argv, "home") == 0) {
+			break;
+		case AKW_HOME:
 			req.ifa.ifa_flags |= IFA_F_HOMEADDRESS;
-		} else if (strcmp(*argv, "nodad") == 0) {
+			break;
+		case AKW_NODAD:
 			req.ifa.ifa_flags |= IFA_F_NODAD;
-		} else {
+			break;
+		default:
 			if (strcmp(*argv, "local") == 0) {
 				NEXT_ARG();
 			}
@@ -1244,7 +1741,7 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 int do_ipaddr(int argc, char **argv)
 {
 	if (argc < 1)
-		return ipaddr_list_or_flush(0, NULL, 0);
+		return ipaddr_list_or_flush(0, NULL, IPADDR_LIST);
 	if (matches(*argv, "add") == 0)
 		return ipaddr_modify(RTM_NEWADDR, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1);
 	if (matches(*argv, "change") == 0 ||
@@ -1256,9 +1753,13 @@ int do_ipaddr(int argc, char **argv)
 		return ipaddr_modify(RTM_DELADDR, 0, argc-1, argv+1);
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
-		return ipaddr_list_or_flush(argc-1, argv+1, 0);
+		return ipaddr_list_or_flush(argc-1, argv+1, IPADDR_LIST);
 	if (matches(*argv, "flush") == 0)
-		return ipaddr_list_or_flush(argc-1, argv+1, 1);
+		return ipaddr_list_or_flush(argc-1, argv+1, IPADDR_FLUSH);
+	if (matches(*argv, "save") == 0)
+		return ipaddr_list_or_flush(argc-1, argv+1, IPADDR_SAVE);
+	if (matches(*argv, "restore") == 0)
+		return ipaddr_restore(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		usage();
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip addr help\".\n", *argv);
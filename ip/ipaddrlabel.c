@@ -114,7 +114,8 @@ static int ipaddrlabel_list(int argc, char **argv)
 		return 1;
 	}
 
-	if (rtnl_dump_filter(&rth, print_addrlabel, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_addrlabel,
+			     stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
@@ -28,6 +28,7 @@
 
 #include "utils.h"
 #include "ip_common.h"
+#include "libgenl.h"
 
 enum {
 	L2TP_ADD,
@@ -355,9 +356,19 @@ static int get_response(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* The kernel dumps every session; this narrows "show session" down */
+static uint32_t filter_tunnel_id;
+
 static int session_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
-	int ret = get_response(n, arg);
+	struct l2tp_data *data = arg;
+	int ret;
+
+	memset(data, 0, sizeof(*data));
+	ret = get_response(n, arg);
+	if (ret == 0 && filter_tunnel_id &&
+	    data->config.tunnel_id != filter_tunnel_id)
+		return 0;
 
 	if (ret == 0)
 		print_session(arg);
@@ -365,6 +376,20 @@ static int session_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n, void
 	return ret;
 }
 
+/* One object by id: a plain GET instead of a dump of all of them */
+static int get_one(struct nlmsghdr *n, rtnl_filter_t print, struct l2tp_data *p)
+{
+	struct {
+		struct nlmsghdr 	n;
+		char			buf[2048];
+	} ans;
+
+	if (rtnl_talk(&genl_rth, n, 0, 0, &ans.n) < 0)
+		return -2;
+
+	return print(NULL, &ans.n, p);
+}
+
 static int get_session(struct l2tp_data *p)
 {
 	struct {
@@ -385,7 +410,10 @@ static int get_session(struct l2tp_data *p)
 	if (p->config.tunnel_id && p->config.session_id) {
 		addattr32(&req.n, 128, L2TP_ATTR_CONN_ID, p->config.tunnel_id);
 		addattr32(&req.n, 128, L2TP_ATTR_SESSION_ID, p->config.session_id);
+		req.n.nlmsg_flags = NLM_F_REQUEST;
+		return get_one(&req.n, session_nlmsg, p);
 	}
+	filter_tunnel_id = p->config.tunnel_id;
 
 	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0)
 		return -2;
@@ -400,7 +428,10 @@ static int get_session(struct l2tp_data *p)
 
 static int tunnel_nlmsg(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
-	int ret = get_response(n, arg);
+	int ret;
+
+	memset(arg, 0, sizeof(struct l2tp_data));
+	ret = get_response(n, arg);
 
 	if (ret == 0)
 		print_tunnel(arg);
@@ -425,8 +456,11 @@ static int get_tunnel(struct l2tp_data *p)
 	req.g.cmd = L2TP_CMD_TUNNEL_GET;
 	req.g.version = L2TP_GENL_VERSION;
 
-	if (p->config.tunnel_id)
+	if (p->config.tunnel_id) {
 		addattr32(&req.n, 1024, L2TP_ATTR_CONN_ID, p->config.tunnel_id);
+		req.n.nlmsg_flags = NLM_F_REQUEST;
+		return get_one(&req.n, tunnel_nlmsg, p);
+	}
 
 	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0)
 		return -2;
@@ -716,67 +750,6 @@ static int do_show(int argc, char **argv)
 	return 0;
 }
 
-static int genl_parse_getfamily(struct nlmsghdr *nlh)
-{
-	struct rtattr *tb[CTRL_ATTR_MAX + 1];
-	struct genlmsghdr *ghdr = NLMSG_DATA(nlh);
-	int len = nlh->nlmsg_len;
-	struct rtattr *attrs;
-
-	if (nlh->nlmsg_type != GENL_ID_CTRL) {
-		fprintf(stderr, "Not a controller message, nlmsg_len=%d "
-			"nlmsg_type=0x%x\n", nlh->nlmsg_len, nlh->nlmsg_type);
-		return -1;
-	}
-
-	if (ghdr->cmd != CTRL_CMD_NEWFAMILY) {
-		fprintf(stderr, "Unknown controller command %d\n", ghdr->cmd);
-		return -1;
-	}
-
-	len -= NLMSG_LENGTH(GENL_HDRLEN);
-
-	if (len < 0) {
-		fprintf(stderr, "wrong controller message len %d\n", len);
-		return -1;
-	}
-
-	attrs = (struct rtattr *) ((char *) ghdr + GENL_HDRLEN);
-	parse_rtattr(tb, CTRL_ATTR_MAX, attrs, len);
-
-	if (tb[CTRL_ATTR_FAMILY_ID] == NULL) {
-		fprintf(stderr, "Missing family id TLV\n");
-		return -1;
-	}
-
-	return rta_getattr_u16(tb[CTRL_ATTR_FAMILY_ID]);
-}
-
-int genl_ctrl_resolve_family(const char *family)
-{
-	struct {
-		struct nlmsghdr         n;
-		struct genlmsghdr	g;
-		char                    buf[1024];
-	} req;
-
-	memset(&req, 0, sizeof(req));
-	req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.n.nlmsg_type = GENL_ID_CTRL;
-	req.g.cmd = CTRL_CMD_GETFAMILY;
-
-	addattr_l(&req.n, 1024, CTRL_ATTR_FAMILY_NAME,
-		  family, strlen(family) + 1);
-
-	if (rtnl_talk(&genl_rth, &req.n, 0, 0, &req.n) < 0) {
-		fprintf(stderr, "Error talking to the kernel\n");
-		return -2;
-	}
-
-	return genl_parse_getfamily(&req.n);
-}
-
 int do_ipl2tp(int argc, char **argv)
 {
 	if (genl_family < 0) {
@@ -785,9 +758,13 @@ int do_ipl2tp(int argc, char **argv)
 			exit(1);
 		}
 
-		genl_family = genl_ctrl_resolve_family(L2TP_GENL_NAME);
+		genl_family = genl_resolve_family(&genl_rth, L2TP_GENL_NAME);
 		if (genl_family < 0)
 			exit(1);
+
+		/* With ip -batch -window, adds and dels are pipelined */
+		if (batch_pipeline_join(&genl_rth) < 0)
+			exit(1);
 	}
 
 	if (argc < 1)
@@ -21,10 +21,13 @@
 #include <linux/if.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
+#include <linux/if_arp.h>
 #include <linux/sockios.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
 #include <sys/ioctl.h>
 #include <linux/sockios.h>
 
@@ -39,6 +42,16 @@
 
 static void usage(void) __attribute__((noreturn));
 static int iplink_have_newlink(void);
+static unsigned iplink_name_to_index(const char *name);
+
+/* Set while "ip link" requests go through a bulk pipeline */
+static struct rtnl_handle *bulk_rth;
+
+/* "steering", applied through sysfs once the link is set */
+static struct {
+	int	mode;
+	int	dry_run;
+} steer;
 
 void iplink_usage(void)
 {
@@ -50,8 +63,13 @@ void iplink_usage(void)
 		fprintf(stderr, "                   [ mtu MTU ]\n");
 		fprintf(stderr, "                   type TYPE [ ARGS ]\n");
 		fprintf(stderr, "       ip link delete DEV type TYPE [ ARGS ]\n");
+		fprintf(stderr, "       ip link delete SELECT-LIST\n");
+		fprintf(stderr, "       ip link bulk { FILE | - }\n");
+		fprintf(stderr, "       ip link save [ SELECT-LIST ] [ compress ]\n");
+		fprintf(stderr, "       ip link restore\n");
 		fprintf(stderr, "\n");
-		fprintf(stderr, "       ip link set { dev DEVICE | group DEVGROUP } [ { up | down } ]\n");
+		fprintf(stderr, "       ip link set { dev DEVICE | group DEVGROUP | SELECT-LIST }\n");
+		fprintf(stderr, "	                  [ { up | down } ]\n");
 	} else
 		fprintf(stderr, "Usage: ip link set DEVICE [ { up | down } ]\n");
 
@@ -77,11 +95,15 @@ void iplink_usage(void)
 	fprintf(stderr, "				   [ spoofchk { on | off} ] ] \n");
 	fprintf(stderr, "			  [ master DEVICE ]\n");
 	fprintf(stderr, "			  [ nomaster ]\n");
-	fprintf(stderr, "       ip link show [ DEVICE | group GROUP ]\n");
+	fprintf(stderr, "			  [ steering { auto | numa-local | spread } [ dry-run ] ]\n");
+	fprintf(stderr, "       ip link show [ DEVICE | group GROUP ] [ master DEVICE ]\n");
+	fprintf(stderr, "                    [ type TYPE ]\n");
 
 	if (iplink_have_newlink()) {
 		fprintf(stderr, "\n");
 		fprintf(stderr, "TYPE := { vlan | veth | vcan | dummy | ifb | macvlan | can | bridge }\n");
+		fprintf(stderr, "SELECT-LIST := [ SELECT-LIST ] select { name PATTERN | type TYPE |\n");
+		fprintf(stderr, "                                     master DEVICE | group GROUP }\n");
 	}
 	exit(-1);
 }
@@ -110,6 +132,11 @@ struct link_util *get_link_kind(const char *id)
 		if (strcmp(l->id, id) == 0)
 			return l;
 
+	snprintf(buf, sizeof(buf), "%s_link_util", id);
+	l = get_builtin_sym(buf);
+	if (l)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), LIBDIR "/ip/link_%s.so", id);
 	dlh = dlopen(buf, RTLD_LAZY);
 	if (dlh == NULL) {
@@ -127,6 +154,7 @@ struct link_util *get_link_kind(const char *id)
 	if (l == NULL)
 		return NULL;
 
+reg:
 	l->next = linkutil_list;
 	linkutil_list = l;
 	return l;
@@ -395,7 +423,7 @@ int iplink_parse(int argc, char **argv, struct iplink_req *req,
 		} else if (matches(*argv, "master") == 0) {
 			int ifindex;
 			NEXT_ARG();
-			ifindex = ll_name_to_index(*argv);
+			ifindex = iplink_name_to_index(*argv);
 			if (!ifindex)
 				invarg("Device does not exist\n", *argv);
 			addattr_l(&req->n, sizeof(*req), IFLA_MASTER,
@@ -445,6 +473,19 @@ int iplink_parse(int argc, char **argv, struct iplink_req *req,
 				invarg("Invalid operstate\n", *argv);
 
 			addattr8(&req->n, sizeof(*req), IFLA_OPERSTATE, state);
+		} else if (strcmp(*argv, "steering") == 0) {
+			NEXT_ARG();
+			if (bulk_rth) {
+				fprintf(stderr, "\"steering\" is for a single device\n");
+				return -1;
+			}
+			steer.mode = iplink_steering_mode(*argv);
+			if (steer.mode < 0)
+				invarg("Invalid \"steering\" mode\n", *argv);
+			if (argc > 1 && strcmp(argv[1], "dry-run") == 0) {
+				steer.dry_run = 1;
+				argc--; argv++;
+			}
 		} else {
 			if (strcmp(*argv, "dev") == 0) {
 				NEXT_ARG();
@@ -461,7 +502,8 @@ int iplink_parse(int argc, char **argv, struct iplink_req *req,
 	return ret - argc;
 }
 
-static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
+static int iplink_build(int cmd, unsigned int flags, int argc, char **argv,
+			struct iplink_req *req, char **label)
 {
 	int len;
 	char *dev = NULL;
@@ -470,17 +512,16 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 	char *type = NULL;
 	int group;
 	struct link_util *lu = NULL;
-	struct iplink_req req;
 	int ret;
 
-	memset(&req, 0, sizeof(req));
+	memset(req, 0, sizeof(*req));
 
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST|flags;
-	req.n.nlmsg_type = cmd;
-	req.i.ifi_family = preferred_family;
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST|flags;
+	req->n.nlmsg_type = cmd;
+	req->i.ifi_family = preferred_family;
 
-	ret = iplink_parse(argc, argv, &req, &name, &type, &link, &dev, &group);
+	ret = iplink_parse(argc, argv, req, &name, &type, &link, &dev, &group);
 	if (ret < 0)
 		return ret;
 
@@ -489,7 +530,7 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 	if (group != -1) {
 		if (dev)
-			addattr_l(&req.n, sizeof(req), IFLA_GROUP,
+			addattr_l(&req->n, sizeof(*req), IFLA_GROUP,
 					&group, sizeof(group));
 		else {
 			if (argc) {
@@ -504,10 +545,9 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 				return -1;
 			}
 
-			req.i.ifi_index = 0;
-			addattr32(&req.n, sizeof(req), IFLA_GROUP, group);
-			if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
-				exit(2);
+			req->i.ifi_index = 0;
+			addattr32(&req->n, sizeof(*req), IFLA_GROUP, group);
+			*label = "group";
 			return 0;
 		}
 	}
@@ -521,10 +561,16 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 			exit(-1);
 		}
 
-		req.i.ifi_index = ll_name_to_index(dev);
-		if (req.i.ifi_index == 0) {
-			fprintf(stderr, "Cannot find device \"%s\"\n", dev);
-			return -1;
+		if (bulk_rth && (!name || strcmp(name, dev) == 0)) {
+			/* The kernel finds it by name, even if it is
+			 * still in the pipeline */
+			name = dev;
+		} else {
+			req->i.ifi_index = iplink_name_to_index(dev);
+			if (req->i.ifi_index == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n", dev);
+				return -1;
+			}
 		}
 	} else {
 		/* Allow "ip link add dev" and "ip link add name" */
@@ -534,15 +580,16 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 		if (link) {
 			int ifindex;
 
-			ifindex = ll_name_to_index(link);
+			ifindex = iplink_name_to_index(link);
 			if (ifindex == 0) {
 				fprintf(stderr, "Cannot find device \"%s\"\n",
 					link);
 				return -1;
 			}
-			addattr_l(&req.n, sizeof(req), IFLA_LINK, &ifindex, 4);
+			addattr_l(&req->n, sizeof(*req), IFLA_LINK, &ifindex, 4);
 		}
 	}
+	*label = name ? name : dev;
 
 	if (name) {
 		len = strlen(name) + 1;
@@ -550,25 +597,25 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 			invarg("\"\" is not a valid device identifier\n", "name");
 		if (len > IFNAMSIZ)
 			invarg("\"name\" too long\n", name);
-		addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, len);
+		addattr_l(&req->n, sizeof(*req), IFLA_IFNAME, name, len);
 	}
 
 	if (type) {
-		struct rtattr *linkinfo = NLMSG_TAIL(&req.n);
-		addattr_l(&req.n, sizeof(req), IFLA_LINKINFO, NULL, 0);
-		addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, type,
+		struct rtattr *linkinfo = NLMSG_TAIL(&req->n);
+		addattr_l(&req->n, sizeof(*req), IFLA_LINKINFO, NULL, 0);
+		addattr_l(&req->n, sizeof(*req), IFLA_INFO_KIND, type,
 			 strlen(type));
 
 		lu = get_link_kind(type);
 		if (lu && argc) {
-			struct rtattr * data = NLMSG_TAIL(&req.n);
-			addattr_l(&req.n, sizeof(req), IFLA_INFO_DATA, NULL, 0);
+			struct rtattr * data = NLMSG_TAIL(&req->n);
+			addattr_l(&req->n, sizeof(*req), IFLA_INFO_DATA, NULL, 0);
 
 			if (lu->parse_opt &&
-			    lu->parse_opt(lu, argc, argv, &req.n))
+			    lu->parse_opt(lu, argc, argv, &req->n))
 				return -1;
 
-			data->rta_len = (void *)NLMSG_TAIL(&req.n) - (void *)data;
+			data->rta_len = (void *)NLMSG_TAIL(&req->n) - (void *)data;
 		} else if (argc) {
 			if (matches(*argv, "help") == 0)
 				usage();
@@ -576,16 +623,648 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 					"Try \"ip link help\".\n", *argv);
 			return -1;
 		}
-		linkinfo->rta_len = (void *)NLMSG_TAIL(&req.n) - (void *)linkinfo;
+		linkinfo->rta_len = (void *)NLMSG_TAIL(&req->n) - (void *)linkinfo;
 	} else if (flags & NLM_F_CREATE) {
 		fprintf(stderr, "Not enough information: \"type\" argument "
 				"is required\n");
 		return -1;
 	}
 
+	return 0;
+}
+
+static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
+{
+	struct iplink_req req;
+	char *label;
+
+	if (iplink_build(cmd, flags, argc, argv, &req, &label) < 0)
+		return -1;
+
+	/* Only steering to report is nothing to send */
+	if (steer.dry_run && req.i.ifi_change == 0 &&
+	    req.n.nlmsg_len == NLMSG_LENGTH(sizeof(req.i)))
+		return iplink_steering(label, steer.mode, 1) < 0 ? -1 : 0;
+
 	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
 		exit(2);
 
+	if (steer.mode > 0 && cmd == RTM_NEWLINK &&
+	    iplink_steering(label, steer.mode, steer.dry_run) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* Returns 0 and fills cmd and flags if word is a modifying command */
+static int iplink_cmd(const char *word, int *cmd, unsigned int *flags)
+{
+	*cmd = RTM_NEWLINK;
+	if (matches(word, "add") == 0)
+		*flags = NLM_F_CREATE|NLM_F_EXCL;
+	else if (matches(word, "set") == 0 || matches(word, "change") == 0)
+		*flags = 0;
+	else if (matches(word, "replace") == 0)
+		*flags = NLM_F_CREATE|NLM_F_REPLACE;
+	else if (matches(word, "delete") == 0) {
+		*cmd = RTM_DELLINK;
+		*flags = 0;
+	} else
+		return -1;
+	return 0;
+}
+
+/*
+ * Bulk mode.  A word holding a range "{A..B}" turns the command into
+ * B - A + 1 commands, with the range replaced by A, A + 1, ... B in
+ * turn; all ranges of a command advance together and must have the
+ * same length, and a leading zero in A pads the numbers to its width.
+ * "ip link bulk FILE" reads one "add", "set", "replace" or "delete"
+ * command per line, which may use ranges as well.
+ *
+ * The requests are sent through a pipeline of LINK_BULK_WINDOW
+ * outstanding requests, written with one send() per LINK_BULK_SNDBUF
+ * bytes, and failures are reported per link as the ACKs come back.
+ * Devices to change or delete are named to the kernel rather than
+ * resolved, so they may be created earlier in the same pipeline; a
+ * "link" or "master" device that is not known yet makes us wait for
+ * the requests in flight before looking it up again.
+ */
+#define LINK_BULK_WINDOW	256
+#define LINK_BULK_SNDBUF	16384
+#define LINK_BULK_MAXARGS	128
+
+struct link_bulk
+{
+	char	(*labels)[IFNAMSIZ];
+	int	*lineno;
+	int	count;
+	int	max;
+	int	total;
+	int	errors;
+};
+
+static struct link_bulk bulk;
+
+static void link_bulk_error(int cookie, int error, void *arg)
+{
+	if (bulk.lineno[cookie])
+		fprintf(stderr, "line %d: ", bulk.lineno[cookie]);
+	fprintf(stderr, "%s: RTNETLINK answers: %s\n",
+		bulk.labels[cookie], strerror(error));
+	bulk.errors++;
+}
+
+static int link_bulk_open(void)
+{
+	if (rtnl_pipeline_open(&rth, LINK_BULK_WINDOW,
+			       link_bulk_error, NULL) < 0 ||
+	    rtnl_pipeline_coalesce(&rth, LINK_BULK_SNDBUF) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return -1;
+	}
+	bulk_rth = &rth;
+	return 0;
+}
+
+static int link_bulk_close(void)
+{
+	bulk_rth = NULL;
+	return rtnl_pipeline_close(&rth);
+}
+
+static unsigned iplink_name_to_index(const char *name)
+{
+	unsigned idx = ll_name_to_index(name);
+
+	/* It may be created by a request still in flight */
+	if (idx == 0 && bulk_rth) {
+		if (link_bulk_close() < 0 || link_bulk_open() < 0)
+			exit(2);
+		idx = ll_name_to_index(name);
+	}
+	return idx;
+}
+
+/* Sends n, reporting a failure as one of label at lineno */
+static void link_bulk_put(struct nlmsghdr *n, const char *label, int lineno)
+{
+	if (bulk.count == bulk.max) {
+		int max = bulk.max ? bulk.max * 2 : 1024;
+		void *labels = realloc(bulk.labels, max * sizeof(*bulk.labels));
+		void *lines = realloc(bulk.lineno, max * sizeof(*bulk.lineno));
+
+		if (labels)
+			bulk.labels = labels;
+		if (lines)
+			bulk.lineno = lines;
+		if (labels == NULL || lines == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(2);
+		}
+		bulk.max = max;
+	}
+
+	strncpy(bulk.labels[bulk.count], label, IFNAMSIZ - 1);
+	bulk.labels[bulk.count][IFNAMSIZ - 1] = '\0';
+	bulk.lineno[bulk.count] = lineno;
+	rtnl_pipeline_cookie(&rth, bulk.count++);
+	if (rtnl_talk(&rth, n, 0, 0, NULL) < 0)
+		exit(2);
+}
+
+static int link_bulk_send(int cmd, unsigned int flags, int argc, char **argv,
+			  int lineno)
+{
+	struct iplink_req req;
+	char *label;
+
+	bulk.total++;
+	if (iplink_build(cmd, flags, argc, argv, &req, &label) < 0) {
+		if (lineno)
+			fprintf(stderr, "line %d: invalid command\n", lineno);
+		bulk.errors++;
+		return -1;
+	}
+
+	link_bulk_put(&req.n, label, lineno);
+	return 0;
+}
+
+/* Finds "{A..B}" in word; returns the number of values or 0 */
+int link_range(const char *word, const char **open,
+	       const char **close, unsigned *from, int *width)
+{
+	const char *p;
+	char *end;
+	unsigned to;
+
+	for (p = strchr(word, '{'); p; p = strchr(p + 1, '{')) {
+		if (!isdigit(p[1]))
+			continue;
+		*from = strtoul(p + 1, &end, 10);
+		if (strncmp(end, "..", 2) || !isdigit(end[2]))
+			continue;
+		*width = p[1] == '0' ? end - p - 1 : 0;
+		to = strtoul(end + 2, &end, 10);
+		if (*end != '}' || to < *from)
+			continue;
+		*open = p;
+		*close = end + 1;
+		return to - *from + 1;
+	}
+	return 0;
+}
+
+static int iplink_has_range(int argc, char **argv)
+{
+	const char *open, *close;
+	unsigned from;
+	int width;
+
+	for (; argc > 0; argc--, argv++)
+		if (link_range(*argv, &open, &close, &from, &width))
+			return 1;
+	return 0;
+}
+
+/* Sends one command for every value of the ranges in argv */
+static int link_bulk_expand(int cmd, unsigned int flags, int argc,
+			    char **argv, int lineno)
+{
+	char *args[LINK_BULK_MAXARGS];
+	char *bufs[LINK_BULK_MAXARGS];
+	const char *open[LINK_BULK_MAXARGS], *close[LINK_BULK_MAXARGS];
+	unsigned from[LINK_BULK_MAXARGS];
+	int width[LINK_BULK_MAXARGS];
+	int i, k, count = 0, ret = 0;
+
+	if (argc > LINK_BULK_MAXARGS) {
+		fprintf(stderr, "Too many arguments\n");
+		return -1;
+	}
+
+	for (i = 0; i < argc; i++) {
+		int n = link_range(argv[i], &open[i], &close[i],
+				   &from[i], &width[i]);
+
+		bufs[i] = NULL;
+		if (n == 0)
+			continue;
+		if (count && n != count) {
+			fprintf(stderr, "Ranges of different length in "
+				"\"%s\"\n", argv[i]);
+			ret = -1;
+			goto out;
+		}
+		count = n;
+		bufs[i] = malloc(strlen(argv[i]) + 16);
+		if (bufs[i] == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			ret = -1;
+			goto out;
+		}
+	}
+	if (count == 0)
+		return link_bulk_send(cmd, flags, argc, argv, lineno);
+
+	for (k = 0; k < count; k++) {
+		for (i = 0; i < argc; i++) {
+			if (bufs[i] == NULL) {
+				args[i] = argv[i];
+				continue;
+			}
+			sprintf(bufs[i], "%.*s%0*u%s",
+				(int)(open[i] - argv[i]), argv[i],
+				width[i], from[i] + k, close[i]);
+			args[i] = bufs[i];
+		}
+		if (link_bulk_send(cmd, flags, argc, args, lineno) < 0)
+			ret = -1;
+	}
+out:
+	for (i = 0; i < argc; i++)
+		free(bufs[i]);
+	return ret;
+}
+
+static int link_bulk_finish(void)
+{
+	if (link_bulk_close() < 0)
+		bulk.errors++;
+	if (bulk.errors) {
+		fprintf(stderr, "%d of %d link requests failed\n",
+			bulk.errors, bulk.total);
+		return -1;
+	}
+	return 0;
+}
+
+static int iplink_bulk_args(int cmd, unsigned int flags, int argc, char **argv)
+{
+	if (link_bulk_open() < 0)
+		return -1;
+	link_bulk_expand(cmd, flags, argc, argv, 0);
+	return link_bulk_finish();
+}
+
+static int iplink_bulk(int argc, char **argv)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	if (argc != 1) {
+		fprintf(stderr, "Usage: ip link bulk { FILE | - }\n");
+		return -1;
+	}
+	if (strcmp(*argv, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(*argv, "r")) == NULL) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			*argv, strerror(errno));
+		return -1;
+	}
+
+	if (link_bulk_open() < 0)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *args[LINK_BULK_MAXARGS];
+		unsigned int flags;
+		char *cp;
+		int cmd, n;
+
+		lineno++;
+		cp = strchr(line, '#');
+		if (cp)
+			*cp = '\0';
+
+		n = makeargs(line, args, LINK_BULK_MAXARGS);
+		if (n == 0)
+			continue;
+		if (iplink_cmd(args[0], &cmd, &flags) < 0) {
+			fprintf(stderr, "line %d: unknown command \"%s\"\n",
+				lineno, args[0]);
+			bulk.errors++;
+			continue;
+		}
+		link_bulk_expand(cmd, flags, n - 1, args + 1, lineno);
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return link_bulk_finish();
+}
+
+/*
+ * Selections.  "select name PATTERN", "select type KIND", "select
+ * master DEVICE" and "select group GROUP" may be given instead of a
+ * device to "set" or "delete"; the command then applies to every link
+ * that matches all of them.  The links are picked from one dump, which
+ * the kernel already narrows down by master and kind, and the commands
+ * go through the bulk pipeline with "dev NAME" in front of the other
+ * arguments, so a failure is reported for its link only.
+ */
+struct link_select
+{
+	const char	*pattern;
+	const char	*kind;
+	int		master;
+	int		group;
+	char		(*names)[IFNAMSIZ];
+	int		count;
+	int		max;
+};
+
+/* Returns 1 if the link n with attributes tb matches all selectors */
+static int link_select_match(const struct link_select *sel,
+			     struct nlmsghdr *n, struct rtattr **tb)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+	if (n->nlmsg_type != RTM_NEWLINK ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return 0;
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
+	if (!tb[IFLA_IFNAME])
+		return 0;
+
+	if (sel->pattern &&
+	    fnmatch(sel->pattern, rta_getattr_str(tb[IFLA_IFNAME]), 0))
+		return 0;
+	if (sel->group != -1 &&
+	    (!tb[IFLA_GROUP] || rta_getattr_u32(tb[IFLA_GROUP]) != sel->group))
+		return 0;
+	/* In case the kernel did not filter */
+	if (sel->master &&
+	    (!tb[IFLA_MASTER] || rta_getattr_u32(tb[IFLA_MASTER]) != sel->master))
+		return 0;
+	if (sel->kind) {
+		struct rtattr *linkinfo[IFLA_INFO_MAX+1];
+
+		if (!tb[IFLA_LINKINFO])
+			return 0;
+		parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+		if (!linkinfo[IFLA_INFO_KIND] ||
+		    strcmp(rta_getattr_str(linkinfo[IFLA_INFO_KIND]), sel->kind))
+			return 0;
+	}
+	return 1;
+}
+
+static int link_select_keep(const struct sockaddr_nl *who,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct link_select *sel = arg;
+	struct rtattr *tb[IFLA_MAX+1];
+	const char *name;
+
+	if (!link_select_match(sel, n, tb))
+		return 0;
+	name = rta_getattr_str(tb[IFLA_IFNAME]);
+
+	if (sel->count == sel->max) {
+		int max = sel->max ? sel->max * 2 : 256;
+		void *names = realloc(sel->names, max * sizeof(*sel->names));
+
+		if (names == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		sel->names = names;
+		sel->max = max;
+	}
+	strncpy(sel->names[sel->count], name, IFNAMSIZ - 1);
+	sel->names[sel->count++][IFNAMSIZ - 1] = '\0';
+	return 0;
+}
+
+static int link_select_dump(struct link_select *sel, rtnl_filter_t fn)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	ifm;
+		char			buf[128];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.n.nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
+	req.n.nlmsg_seq = rth.dump = ++rth.seq;
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+	if (sel->master)
+		addattr32(&req.n, sizeof(req), IFLA_MASTER, sel->master);
+	if (sel->kind) {
+		struct rtattr *linkinfo;
+
+		linkinfo = addattr_nest(&req.n, sizeof(req), IFLA_LINKINFO);
+		addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, sel->kind,
+			  strlen(sel->kind));
+		addattr_nest_end(&req.n, linkinfo);
+	}
+
+	if (rtnl_send(&rth, &req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, fn, sel) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Parses the selector after the "select" at *argvp */
+static void link_select_parse(struct link_select *sel, int *argcp,
+			      char ***argvp)
+{
+	int argc = *argcp;
+	char **argv = *argvp;
+
+	NEXT_ARG();
+	if (strcmp(*argv, "name") == 0) {
+		NEXT_ARG();
+		sel->pattern = *argv;
+	} else if (strcmp(*argv, "type") == 0) {
+		NEXT_ARG();
+		sel->kind = *argv;
+	} else if (strcmp(*argv, "master") == 0) {
+		NEXT_ARG();
+		sel->master = ll_name_to_index(*argv);
+		if (sel->master == 0)
+			invarg("Device does not exist\n", *argv);
+	} else if (strcmp(*argv, "group") == 0) {
+		NEXT_ARG();
+		if (rtnl_group_a2n(&sel->group, *argv))
+			invarg("Invalid \"group\" value\n", *argv);
+	} else
+		invarg("unknown selector, use name, type, master "
+		       "or group\n", *argv);
+	*argcp = argc;
+	*argvp = argv;
+}
+
+static int iplink_has_select(int argc, char **argv)
+{
+	for (; argc > 0; argc--, argv++)
+		if (strcmp(*argv, "select") == 0)
+			return 1;
+	return 0;
+}
+
+static int iplink_select(int cmd, unsigned int flags, int argc, char **argv)
+{
+	struct link_select sel = { .group = -1 };
+	char *args[LINK_BULK_MAXARGS];
+	int i, n = 2, ret;
+
+	if (cmd != RTM_DELLINK && (flags & NLM_F_CREATE)) {
+		fprintf(stderr, "\"select\" cannot be used when creating "
+			"devices.\n");
+		return -1;
+	}
+
+	args[0] = "dev";
+	for (; argc > 0; argc--, argv++) {
+		if (strcmp(*argv, "select") != 0) {
+			if (strcmp(*argv, "dev") == 0) {
+				fprintf(stderr, "\"dev\" cannot be used with "
+					"\"select\".\n");
+				return -1;
+			}
+			if (n == LINK_BULK_MAXARGS) {
+				fprintf(stderr, "Too many arguments\n");
+				return -1;
+			}
+			args[n++] = *argv;
+			continue;
+		}
+		link_select_parse(&sel, &argc, &argv);
+	}
+
+	ll_init_map(&rth);
+	if (link_select_dump(&sel, link_select_keep) < 0)
+		return -1;
+
+	if (link_bulk_open() < 0)
+		return -1;
+	for (i = 0; i < sel.count; i++) {
+		args[1] = sel.names[i];
+		link_bulk_send(cmd, flags, n, args, 0);
+	}
+	ret = link_bulk_finish();
+	free(sel.names);
+	return ret;
+}
+
+/*
+ * "ip link save" keeps what a checkpoint needs to set back on links
+ * that exist again: the flags below, mtu, txqueuelen, group, alias and
+ * the Ethernet address.  Every link is saved as the RTM_NEWLINK that
+ * restores it, found by name since indexes are not kept across a
+ * re-creation, in the stream format of "ip route save".
+ */
+#define LINK_SAVE_FLAGS	(IFF_UP|IFF_NOARP|IFF_PROMISC|IFF_ALLMULTI|\
+			 IFF_MULTICAST|IFF_DYNAMIC)
+
+static int link_save(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		     void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX+1];
+	struct iplink_req req;
+	static const int keep[] = {
+		IFLA_IFNAME, IFLA_MTU, IFLA_TXQLEN, IFLA_GROUP, IFLA_IFALIAS,
+	};
+	int i;
+
+	if (!link_select_match(arg, n, tb))
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_type = RTM_NEWLINK;
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.i.ifi_change = LINK_SAVE_FLAGS;
+	req.i.ifi_flags = ifi->ifi_flags & LINK_SAVE_FLAGS;
+
+	for (i = 0; i < ARRAY_SIZE(keep); i++)
+		if (tb[keep[i]])
+			addattr_l(&req.n, sizeof(req), keep[i],
+				  RTA_DATA(tb[keep[i]]),
+				  RTA_PAYLOAD(tb[keep[i]]));
+	if (ifi->ifi_type == ARPHRD_ETHER && tb[IFLA_ADDRESS])
+		addattr_l(&req.n, sizeof(req), IFLA_ADDRESS,
+			  RTA_DATA(tb[IFLA_ADDRESS]),
+			  RTA_PAYLOAD(tb[IFLA_ADDRESS]));
+
+	return rtsave_put(&req.n, 0);
+}
+
+static int iplink_save(int argc, char **argv)
+{
+	struct link_select sel = { .group = -1 };
+	int save_flags = 0;
+	int ret = 0;
+
+	for (; argc > 0; argc--, argv++) {
+		if (strcmp(*argv, "select") == 0)
+			link_select_parse(&sel, &argc, &argv);
+		else if (strcmp(*argv, "compress") == 0)
+			save_flags |= RTSAVE_F_ZLIB;
+		else if (matches(*argv, "help") == 0)
+			usage();
+		else
+			invarg("unknown save option\n", *argv);
+	}
+
+	if (rtsave_begin(save_flags) < 0)
+		return 1;
+	if (link_select_dump(&sel, link_save) < 0)
+		ret = 1;
+	if (rtsave_end() < 0)
+		ret = 1;
+	return ret;
+}
+
+static int restore_link(struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX+1];
+
+	if (n->nlmsg_type != RTM_NEWLINK ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return 0;
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
+	if (!tb[IFLA_IFNAME])
+		return 0;
+
+	n->nlmsg_flags = NLM_F_REQUEST;
+	ifi->ifi_index = 0;
+	bulk.total++;
+	link_bulk_put(n, rta_getattr_str(tb[IFLA_IFNAME]), 0);
+	return 0;
+}
+
+static int iplink_restore(int argc, char **argv)
+{
+	int ret;
+
+	if (argc > 0) {
+		if (matches(*argv, "help") == 0)
+			usage();
+		invarg("unknown restore option\n", *argv);
+	}
+
+	if (link_bulk_open() < 0)
+		return -1;
+	ret = rtsave_restore(0, restore_link, NULL);
+	if (link_bulk_finish() < 0 || ret < 0)
+		return 2;
 	return 0;
 }
 
@@ -944,21 +1623,25 @@ int do_iplink(int argc, char **argv)
 {
 	if (argc > 0) {
 		if (iplink_have_newlink()) {
-			if (matches(*argv, "add") == 0)
-				return iplink_modify(RTM_NEWLINK,
-						     NLM_F_CREATE|NLM_F_EXCL,
-						     argc-1, argv+1);
-			if (matches(*argv, "set") == 0 ||
-			    matches(*argv, "change") == 0)
-				return iplink_modify(RTM_NEWLINK, 0,
-						     argc-1, argv+1);
-			if (matches(*argv, "replace") == 0)
-				return iplink_modify(RTM_NEWLINK,
-						     NLM_F_CREATE|NLM_F_REPLACE,
-						     argc-1, argv+1);
-			if (matches(*argv, "delete") == 0)
-				return iplink_modify(RTM_DELLINK, 0,
+			unsigned int flags;
+			int cmd;
+
+			if (iplink_cmd(*argv, &cmd, &flags) == 0) {
+				if (iplink_has_select(argc-1, argv+1))
+					return iplink_select(cmd, flags,
+							     argc-1, argv+1);
+				if (iplink_has_range(argc-1, argv+1))
+					return iplink_bulk_args(cmd, flags,
+								argc-1, argv+1);
+				return iplink_modify(cmd, flags,
 						     argc-1, argv+1);
+			}
+			if (matches(*argv, "bulk") == 0)
+				return iplink_bulk(argc-1, argv+1);
+			if (matches(*argv, "save") == 0)
+				return iplink_save(argc-1, argv+1);
+			if (matches(*argv, "restore") == 0)
+				return iplink_restore(argc-1, argv+1);
 		} else {
 #if IPLINK_IOCTL_COMPAT
 			if (matches(*argv, "set") == 0)
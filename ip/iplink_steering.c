@@ -0,0 +1,301 @@
+/*
+ * iplink_steering.c	RPS/XPS masks for "ip link set DEV steering".
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+#define SYSFS_NET	"/sys/class/net"
+#define SYSFS_CPU	"/sys/devices/system/cpu"
+#define SYSFS_NODE	"/sys/devices/system/node"
+
+static const char *steer_names[] = {
+	[STEER_AUTO]		= "auto",
+	[STEER_NUMA_LOCAL]	= "numa-local",
+	[STEER_SPREAD]		= "spread",
+};
+
+int iplink_steering_mode(const char *arg)
+{
+	int i;
+
+	for (i = STEER_AUTO; i <= STEER_SPREAD; i++)
+		if (strcmp(arg, steer_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+struct cpu_list
+{
+	int	*cpu;
+	int	count;
+	int	max;
+};
+
+/* Reads a list such as "0-3,8-11" as sysfs prints it */
+static int cpu_list_read(struct cpu_list *cl, const char *path)
+{
+	char buf[4096], *p = buf;
+	FILE *fp;
+
+	cl->count = 0;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	if (fgets(buf, sizeof(buf), fp) == NULL)
+		buf[0] = '\0';
+	fclose(fp);
+
+	while (*p && *p != '\n') {
+		char *end;
+		long lo, hi;
+
+		lo = hi = strtol(p, &end, 10);
+		if (end == p || lo < 0)
+			return -1;
+		if (*end == '-') {
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if (end == p || hi < lo)
+				return -1;
+		}
+		for (; lo <= hi; lo++) {
+			if (cl->count == cl->max) {
+				int max = cl->max ? cl->max * 2 : 64;
+				int *cpu = realloc(cl->cpu, max * sizeof(*cpu));
+
+				if (cpu == NULL)
+					return -1;
+				cl->cpu = cpu;
+				cl->max = max;
+			}
+			cl->cpu[cl->count++] = lo;
+		}
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+	return cl->count ? 0 : -1;
+}
+
+static int sysfs_read_int(const char *path, int *val)
+{
+	FILE *fp = fopen(path, "r");
+	int ret;
+
+	if (fp == NULL)
+		return -1;
+	ret = fscanf(fp, "%d", val) == 1 ? 0 : -1;
+	fclose(fp);
+	return ret;
+}
+
+/* The number of RX or TX queues the link reports, less those that
+ * are not in use: sysfs only has the real ones.
+ */
+static int steer_queues(const char *dev, const char *dir, int num)
+{
+	char path[128];
+	struct stat st;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		snprintf(path, sizeof(path), SYSFS_NET "/%s/queues/%s-%d",
+			 dev, dir, i);
+		if (stat(path, &st) < 0)
+			break;
+	}
+	return i;
+}
+
+static int steer_link_queues(const char *dev, int *rxq, int *txq)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[256];
+	} req;
+	struct {
+		struct nlmsghdr		n;
+		char			buf[16384];
+	} ans;
+	struct ifinfomsg *ifi = NLMSG_DATA(&ans.n);
+	struct rtattr *tb[IFLA_MAX+1];
+	int len;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.i.ifi_family = AF_UNSPEC;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, dev, strlen(dev) + 1);
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, &ans.n) < 0)
+		return -1;
+	len = ans.n.nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	if (ans.n.nlmsg_type != RTM_NEWLINK || len < 0)
+		return -1;
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+
+	/* Kernels before 3.0 do not tell, they have a queue each way */
+	*rxq = tb[IFLA_NUM_RX_QUEUES] ?
+		rta_getattr_u32(tb[IFLA_NUM_RX_QUEUES]) : 1;
+	*txq = tb[IFLA_NUM_TX_QUEUES] ?
+		rta_getattr_u32(tb[IFLA_NUM_TX_QUEUES]) : 1;
+	*rxq = steer_queues(dev, "rx", *rxq);
+	*txq = steer_queues(dev, "tx", *txq);
+	return 0;
+}
+
+/* Queue q of nq gets an equal share of the CPUs, or one CPU when
+ * there are more queues than CPUs; the mask is in the format of
+ * sysfs, 32 bit words most significant first.
+ */
+static void steer_mask(const struct cpu_list *cl, int q, int nq,
+		       char *buf, int size, char *list, int lsize)
+{
+	int first, last, words, w, i, len = 0;
+	__u32 *mask;
+
+	if (nq >= cl->count) {
+		first = q % cl->count;
+		last = first + 1;
+	} else {
+		first = q * cl->count / nq;
+		last = (q + 1) * cl->count / nq;
+	}
+
+	words = cl->cpu[cl->count - 1] / 32 + 1;
+	mask = calloc(words, sizeof(*mask));
+	if (mask == NULL) {
+		snprintf(buf, size, "0");
+		list[0] = '\0';
+		return;
+	}
+	list[0] = '\0';
+	for (i = first; i < last; i++) {
+		int cpu = cl->cpu[i];
+
+		mask[cpu / 32] |= 1U << (cpu % 32);
+		if (i == first || cl->cpu[i - 1] != cpu - 1)
+			len += snprintf(list + len, lsize - len, "%s%d",
+					i == first ? "" : ",", cpu);
+		else if (i + 1 == last || cl->cpu[i + 1] != cpu + 1)
+			len += snprintf(list + len, lsize - len, "-%d", cpu);
+		if (len >= lsize)
+			len = lsize - 1;
+	}
+
+	for (w = words - 1; w > 0 && mask[w] == 0; w--)
+		;
+	len = snprintf(buf, size, "%x", mask[w]);
+	while (--w >= 0 && len < size)
+		len += snprintf(buf + len, size - len, ",%08x", mask[w]);
+	free(mask);
+}
+
+static int steer_write(const char *path, const char *val)
+{
+	int fd, len = strlen(val), ret;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, val, len);
+	close(fd);
+	return ret == len ? 0 : -1;
+}
+
+static int steer_queue_set(const char *dev, const char *dir, const char *file,
+			   const struct cpu_list *cl, int q, int nq,
+			   int dry_run)
+{
+	char path[128], mask[2304], list[1024];
+
+	steer_mask(cl, q, nq, mask, sizeof(mask), list, sizeof(list));
+	if (dry_run) {
+		printf("%s-%d %s %s cpus %s\n", dir, q, file, mask, list);
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), SYSFS_NET "/%s/queues/%s-%d/%s",
+		 dev, dir, q, file);
+	if (steer_write(path, mask) == 0)
+		return 0;
+	/* Kernels without CONFIG_XPS have no xps_cpus */
+	if (errno == ENOENT && strcmp(file, "xps_cpus") == 0)
+		return 0;
+	fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+	return -1;
+}
+
+/*
+ * "numa-local" balances the queues over the CPUs of the device's NUMA
+ * node, "spread" over all online CPUs.  "auto" keeps to the node when
+ * it has a CPU for every queue, and spreads otherwise; devices without
+ * a node, such as virtual ones, are always spread.
+ */
+int iplink_steering(const char *dev, int mode, int dry_run)
+{
+	struct cpu_list online = { 0 }, local = { 0 };
+	const struct cpu_list *cl = &online;
+	char path[128];
+	int node = -1;
+	int rxq, txq, q;
+	int ret = 0;
+
+	if (steer_link_queues(dev, &rxq, &txq) < 0) {
+		fprintf(stderr, "Cannot get the queues of \"%s\"\n", dev);
+		return -1;
+	}
+	if (cpu_list_read(&online, SYSFS_CPU "/online") < 0) {
+		fprintf(stderr, "Cannot read the online CPUs\n");
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), SYSFS_NET "/%s/device/numa_node", dev);
+	if (sysfs_read_int(path, &node) < 0)
+		node = -1;
+	if (node >= 0 && mode != STEER_SPREAD) {
+		snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+		if (cpu_list_read(&local, path) == 0 &&
+		    (mode == STEER_NUMA_LOCAL ||
+		     local.count >= (rxq > txq ? rxq : txq)))
+			cl = &local;
+	}
+
+	if (dry_run) {
+		printf("%s: %d rx and %d tx queues", dev, rxq, txq);
+		if (node >= 0)
+			printf(", node %d", node);
+		printf(", %s over %d %sCPUs\n", steer_names[mode], cl->count,
+		       cl == &local ? "local " : "");
+	}
+
+	for (q = 0; q < rxq; q++)
+		if (steer_queue_set(dev, "rx", "rps_cpus", cl, q, rxq,
+				    dry_run) < 0)
+			ret = -1;
+	for (q = 0; q < txq; q++)
+		if (steer_queue_set(dev, "tx", "xps_cpus", cl, q, txq,
+				    dry_run) < 0)
+			ret = -1;
+
+	free(online.cpu);
+	free(local.cpu);
+	return ret;
+}
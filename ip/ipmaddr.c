@@ -28,6 +28,7 @@
 
 #include "rt_names.h"
 #include "utils.h"
+#include "ip_common.h"
 
 static struct {
 	char *dev;
@@ -47,7 +48,7 @@ static int parse_hex(char *str, unsigned char *addr, size_t size)
 {
 	int len=0;
 
-	while (*str && (len < 2 * size)) {
+	while (*str && len < size) {
 		int tmp;
 		if (str[1] == 0)
 			return -1;
@@ -68,6 +69,8 @@ struct ma_info
 	char		*features;
 	char		name[IFNAMSIZ];
 	inet_prefix	addr;
+	/* AF_PACKET addresses can be longer than inet_prefix holds */
+	unsigned char	lladdr[32];
 };
 
 void maddr_ins(struct ma_info **lst, struct ma_info *m)
@@ -104,7 +107,7 @@ void read_dev_mcast(struct ma_info **result_p)
 
 		m.addr.family = AF_PACKET;
 
-		len = parse_hex(hexa, (unsigned char*)&m.addr.data, sizeof (m.addr.data));
+		len = parse_hex(hexa, m.lladdr, sizeof(m.lladdr));
 		if (len >= 0) {
 			struct ma_info *ma = malloc(sizeof(m));
 
@@ -193,13 +196,96 @@ void read_igmp6(struct ma_info **result_p)
 	fclose(fp);
 }
 
+static int maddr_nl_one(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct ma_info **result_p = arg;
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	struct rtattr *tb[IFA_MAX+1];
+	struct ma_info *ma;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+	int alen;
+
+	if (n->nlmsg_type != RTM_GETMULTICAST)
+		return 0;
+	if (len < 0)
+		return -1;
+
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+	if (!tb[IFA_MULTICAST])
+		return 0;
+	alen = RTA_PAYLOAD(tb[IFA_MULTICAST]);
+	if (alen > sizeof(ma->addr.data))
+		return 0;
+
+	ma = calloc(1, sizeof(*ma));
+	if (ma == NULL)
+		return -1;
+	ma->index = ifa->ifa_index;
+	strncpy(ma->name, ll_index_to_name(ifa->ifa_index), IFNAMSIZ - 1);
+	if (filter.dev && strcmp(filter.dev, ma->name)) {
+		free(ma);
+		return 0;
+	}
+	/* rtnetlink does not report the number of users */
+	ma->users = 1;
+	ma->addr.family = ifa->ifa_family;
+	ma->addr.bytelen = alen;
+	ma->addr.bitlen = alen << 3;
+	memcpy(ma->addr.data, RTA_DATA(tb[IFA_MULTICAST]), alen);
+	maddr_ins(result_p, ma);
+	return 0;
+}
+
+/* Dump the groups of family over rtnetlink, on the filter device only
+ * where the kernel can (strict checking, 4.20+).  Returns -1, having
+ * added nothing, if the kernel cannot (IPv4 needs 6.13).
+ */
+static int read_mcast_nl(int family, struct ma_info **result_p)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifaddrmsg	ifa;
+	} req;
+	struct ma_info *list = NULL, *ma;
+	int ret = 0;
+
+	if (filter.dev) {
+		memset(&req, 0, sizeof(req));
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		req.n.nlmsg_type = RTM_GETMULTICAST;
+		req.ifa.ifa_family = family;
+		req.ifa.ifa_index = ll_name_to_index(filter.dev);
+		if (req.ifa.ifa_index == 0)
+			return 0;
+		ret = rtnl_dump_request_strict(&rth, &req.n);
+	}
+	if (ret == 0)
+		ret = rtnl_wilddump_request(&rth, family, RTM_GETMULTICAST);
+	if (ret < 0)
+		return -1;
+
+	rth.flags |= RTNL_HANDLE_F_SUPPRESS_NLERR;
+	ret = rtnl_dump_filter(&rth, maddr_nl_one, &list);
+	rth.flags &= ~RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	while ((ma = list) != NULL) {
+		list = ma->next;
+		if (ret < 0)
+			free(ma);
+		else
+			maddr_ins(result_p, ma);
+	}
+	return ret < 0 ? -1 : 0;
+}
+
 static void print_maddr(FILE *fp, struct ma_info *list)
 {
 	fprintf(fp, "\t");
 
 	if (list->addr.family == AF_PACKET) {
 		SPRINT_BUF(b1);
-		fprintf(fp, "link  %s", ll_addr_n2a((unsigned char*)list->addr.data,
+		fprintf(fp, "link  %s", ll_addr_n2a(list->lladdr,
 						    list->addr.bytelen, 0,
 						    b1, sizeof(b1)));
 	} else {
@@ -267,9 +353,14 @@ static int multiaddr_list(int argc, char **argv)
 
 	if (!filter.family || filter.family == AF_PACKET)
 		read_dev_mcast(&list);
-	if (!filter.family || filter.family == AF_INET)
+	if (!filter.family || filter.family == AF_INET ||
+	    filter.family == AF_INET6)
+		ll_init_map(&rth);
+	if ((!filter.family || filter.family == AF_INET) &&
+	    read_mcast_nl(AF_INET, &list) < 0)
 		read_igmp(&list);
-	if (!filter.family || filter.family == AF_INET6)
+	if ((!filter.family || filter.family == AF_INET6) &&
+	    read_mcast_nl(AF_INET6, &list) < 0)
 		read_igmp6(&list);
 	print_mlist(stdout, list);
 	return 0;
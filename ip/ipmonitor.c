@@ -20,16 +20,87 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <stddef.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <linux/net_namespace.h>
 
 #include "utils.h"
+#include "rt_names.h"
 #include "ip_common.h"
 
 static void usage(void) __attribute__((noreturn));
 int prefix_banner;
+static int link_quiet;
+static int mon_resync;
+/* The file "link-cache" keeps current for other programs */
+static const char *link_cache;
+
+/*
+ * "ip monitor all-nsid" also gets the events of every namespace that
+ * has an nsid here, on the same socket, and prints the namespace in
+ * front of them.  Their device names come from a link cache per nsid,
+ * learnt from the link events of the namespace alone, and dropped
+ * with its nsid.
+ */
+static int mon_nsid = -1;
+
+static void mon_select(int nsid)
+{
+	mon_nsid = nsid;
+	ll_map_select(nsid);
+}
+
+static void print_nsid_tag(FILE *fp, int nsid)
+{
+	const char *name = netns_id_n2a(nsid);
+
+	if (name)
+		fprintf(fp, "[netns %s]", name);
+	else
+		fprintf(fp, "[nsid %d]", nsid);
+}
+
+static int print_nsid_msg(struct nlmsghdr *n, FILE *fp)
+{
+	struct rtgenmsg *g = NLMSG_DATA(n);
+	struct rtattr *tb[NETNSA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_SPACE(sizeof(*g));
+	int nsid;
+
+	if (len < 0)
+		return -1;
+	parse_rtattr(tb, NETNSA_MAX, (void *)g + NLMSG_ALIGN(sizeof(*g)), len);
+	if (tb[NETNSA_NSID] == NULL)
+		return -1;
+	nsid = rta_getattr_u32(tb[NETNSA_NSID]);
+
+	/* Names are looked up again, and a gone namespace forgotten */
+	netns_ids_flush();
+	if (mon_nsid < 0 && n->nlmsg_type == RTM_DELNSID)
+		ll_map_forget_nsid(nsid);
+
+	if (prefix_banner)
+		fprintf(fp, "[NSID]");
+	if (n->nlmsg_type == RTM_DELNSID)
+		fprintf(fp, "Deleted ");
+	fprintf(fp, "nsid %d\n", nsid);
+	fflush(fp);
+	return 0;
+}
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: ip monitor [ all | LISTofOBJECTS ]\n");
+	fprintf(stderr, "Usage: ip monitor [ coalesce MSECS ] [ resync ] [ rcvbuf SIZE ]\n");
+	fprintf(stderr, "                  [ all-nsid ] [ link-cache FILE ]\n");
+	fprintf(stderr, "                  [ all | LISTofOBJECTS ] [ SELECTORS ]\n");
+	fprintf(stderr, "       ip monitor file FILE [ since TIME ] [ all | LISTofOBJECTS ]\n");
+	fprintf(stderr, "                  [ SELECTORS ]\n");
+	fprintf(stderr, "SELECTORS := [ dev DEV ] [ table TABLE_ID ] [ proto PROTO ]\n");
 	exit(-1);
 }
 
@@ -41,6 +112,8 @@ int accept_msg(const struct sockaddr_nl *who,
 
 	if (timestamp)
 		print_timestamp(fp);
+	if (mon_nsid >= 0)
+		print_nsid_tag(fp, mon_nsid);
 
 	if (n->nlmsg_type == RTM_NEWROUTE || n->nlmsg_type == RTM_DELROUTE) {
 		if (prefix_banner)
@@ -49,10 +122,15 @@ int accept_msg(const struct sockaddr_nl *who,
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK) {
-		ll_remember_index(who, n, NULL);
+		if (n->nlmsg_type == RTM_NEWLINK || link_quiet)
+			ll_remember_index(who, n, NULL);
+		if (link_quiet)
+			return 0;
 		if (prefix_banner)
 			fprintf(fp, "[LINK]");
 		print_linkinfo(who, n, arg);
+		if (n->nlmsg_type == RTM_DELLINK)
+			ll_remember_index(who, n, NULL);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWADDR || n->nlmsg_type == RTM_DELADDR) {
@@ -85,6 +163,10 @@ int accept_msg(const struct sockaddr_nl *who,
 		print_rule(who, n, arg);
 		return 0;
 	}
+	if (n->nlmsg_type == RTM_NEWNSID || n->nlmsg_type == RTM_DELNSID) {
+		print_nsid_msg(n, fp);
+		return 0;
+	}
 	if (n->nlmsg_type == 15) {
 		char *tstr;
 		time_t secs = ((__u32*)NLMSG_DATA(n))[0];
@@ -109,9 +191,911 @@ int accept_msg(const struct sockaddr_nl *who,
 	return 0;
 }
 
+/*
+ * "ip monitor file FILE since TIME" starts at the last entry of the
+ * rtmon index FILE.idx that is older than TIME, if there is one, after
+ * replaying the link dump at the head of the file to learn the device
+ * names.  Messages stamped before TIME are skipped, apart from keeping
+ * track of links, and so are those not in the list of objects.
+ */
+static time_t since;
+static int since_skip;
+static int head_stamps;
+
+static int parse_since(const char *arg, time_t *t)
+{
+	static const char *formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M",
+	};
+	struct tm tm;
+	char *end;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(arg, formats[i], &tm);
+		if (end && *end == 0) {
+			tm.tm_isdst = -1;
+			*t = mktime(&tm);
+			return 0;
+		}
+	}
+	*t = strtoul(arg, &end, 0);
+	return *end || end == arg ? -1 : 0;
+}
+
+static void monitor_link(const struct sockaddr_nl *who, struct nlmsghdr *n)
+{
+	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK)
+		ll_remember_index(who, n, NULL);
+}
+
+/* The head of a capture: a timestamp, then the links up to the next one */
+static int monitor_head(const struct sockaddr_nl *who,
+			struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type == 15 && head_stamps++)
+		return -1;
+	monitor_link(who, n);
+	return 0;
+}
+
+/* The objects asked for; a file holds every kind of message */
+static unsigned mon_groups;
+static char file_stamp[NLMSG_SPACE(8)];
+
+/*
+ * "dev", "table" and "proto" select the routes, addresses, neighbours
+ * and links printed, and the family given with -4 or -6 those of the
+ * neighbours as well.  Live, the same checks become a socket filter, so
+ * that the kernel drops most of the rest before copying it to us.
+ */
+static struct
+{
+	int	ifindex;
+	__u32	table;
+	int	protocol;
+} mon_filter = {
+	.protocol = -1,
+};
+
+static int monitor_match(struct nlmsghdr *n)
+{
+	int len;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE: {
+		struct rtmsg *r = NLMSG_DATA(n);
+		struct rtattr *tb[RTA_MAX+1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+		if (len < 0)
+			return 1;
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+		if (mon_filter.table && rtm_get_table(r, tb) != mon_filter.table)
+			return 0;
+		if (mon_filter.protocol >= 0 &&
+		    r->rtm_protocol != mon_filter.protocol)
+			return 0;
+		if (mon_filter.ifindex &&
+		    (!tb[RTA_OIF] ||
+		     rta_getattr_u32(tb[RTA_OIF]) != mon_filter.ifindex))
+			return 0;
+		return 1;
+	}
+	case RTM_NEWADDR:
+	case RTM_DELADDR: {
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+			return 1;
+		return !mon_filter.ifindex || ifa->ifa_index == mon_filter.ifindex;
+	}
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH: {
+		struct ndmsg *ndm = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ndm)))
+			return 1;
+		if (preferred_family && ndm->ndm_family != preferred_family)
+			return 0;
+		return !mon_filter.ifindex ||
+			ndm->ndm_ifindex == mon_filter.ifindex;
+	}
+	case RTM_NEWLINK:
+	case RTM_DELLINK: {
+		struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+			return 1;
+		return !mon_filter.ifindex || ifi->ifi_index == mon_filter.ifindex;
+	}
+	}
+	return 1;
+}
+
+static void monitor_kfilter(struct rtnl_handle *rth, unsigned groups)
+{
+	struct rtnl_kcheck c[8], *p = c;
+
+	memset(c, 0, sizeof(c));
+	if (mon_filter.table) {
+		p->type = RTM_NEWROUTE;
+		p->hdrlen = sizeof(struct rtmsg);
+		p->attr = RTA_TABLE;
+		p->offset = -1;
+		p->size = 4;
+		p->value = mon_filter.table;
+		p++;
+	}
+	if (mon_filter.protocol >= 0) {
+		p->type = RTM_NEWROUTE;
+		p->offset = offsetof(struct rtmsg, rtm_protocol);
+		p->size = 1;
+		p->value = mon_filter.protocol;
+		p++;
+	}
+	if (mon_filter.ifindex) {
+		/* Multipath routes have no RTA_OIF and pass */
+		p->type = RTM_NEWROUTE;
+		p->hdrlen = sizeof(struct rtmsg);
+		p->attr = RTA_OIF;
+		p->offset = -1;
+		p->size = 4;
+		p->value = mon_filter.ifindex;
+		p++;
+		p->type = RTM_NEWADDR;
+		p->offset = offsetof(struct ifaddrmsg, ifa_index);
+		p->size = 4;
+		p->value = mon_filter.ifindex;
+		p++;
+		p->type = RTM_NEWNEIGH;
+		p->offset = offsetof(struct ndmsg, ndm_ifindex);
+		p->size = 4;
+		p->value = mon_filter.ifindex;
+		p++;
+		/* The links of other devices still keep the names current,
+		 * if we only listen to them for that, and the link cache.
+		 */
+		if ((groups & nl_mgrp(RTNLGRP_LINK)) && !link_cache) {
+			p->type = RTM_NEWLINK;
+			p->offset = offsetof(struct ifinfomsg, ifi_index);
+			p->size = 4;
+			p->value = mon_filter.ifindex;
+			p++;
+		}
+	}
+	if (preferred_family) {
+		p->type = RTM_NEWNEIGH;
+		p->offset = offsetof(struct ndmsg, ndm_family);
+		p->size = 1;
+		p->value = preferred_family;
+		p++;
+	}
+	if (rtnl_kfilter(rth, c, p - c) < 0)
+		fprintf(stderr, "Warning: events are filtered in user space\n");
+}
+
+static int monitor_wanted(const struct nlmsghdr *n)
+{
+	int family = ((struct rtgenmsg *)NLMSG_DATA(n))->rtgen_family;
+	int grp;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		grp = RTNLGRP_LINK;
+		break;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		grp = family == AF_INET6 ? RTNLGRP_IPV6_IFADDR :
+			RTNLGRP_IPV4_IFADDR;
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		grp = family == AF_INET6 ? RTNLGRP_IPV6_ROUTE :
+			RTNLGRP_IPV4_ROUTE;
+		break;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		grp = RTNLGRP_NEIGH;
+		break;
+	case RTM_NEWPREFIX:
+		grp = RTNLGRP_IPV6_PREFIX;
+		break;
+	default:
+		return 1;
+	}
+	return (mon_groups & nl_mgrp(grp)) != 0;
+}
+
+static int monitor_replay(const struct sockaddr_nl *who,
+			  struct nlmsghdr *n, void *arg)
+{
+	if (since_skip) {
+		if (n->nlmsg_type != 15 ||
+		    ((__u32*)NLMSG_DATA(n))[0] < since) {
+			monitor_link(who, n);
+			return 0;
+		}
+		since_skip = 0;
+	}
+	if (!monitor_match(n)) {
+		monitor_link(who, n);
+		return 0;
+	}
+	if (mon_groups == ~RTMGRP_TC)
+		return accept_msg(who, n, arg);
+
+	/* Hold a timestamp back until a message it belongs to shows up */
+	if (n->nlmsg_type == 15) {
+		if (n->nlmsg_len <= sizeof(file_stamp))
+			memcpy(file_stamp, n, n->nlmsg_len);
+		return 0;
+	}
+	if (!monitor_wanted(n)) {
+		monitor_link(who, n);
+		return 0;
+	}
+	if (((struct nlmsghdr *)file_stamp)->nlmsg_len) {
+		accept_msg(who, (struct nlmsghdr *)file_stamp, arg);
+		((struct nlmsghdr *)file_stamp)->nlmsg_len = 0;
+	}
+	return accept_msg(who, n, arg);
+}
+
+/* Returns the offset to start reading at */
+static long monitor_seek_index(const char *file)
+{
+	struct rtmon_index_hdr h;
+	struct rtmon_index e;
+	char name[PATH_MAX];
+	long offset = 0;
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s.idx", file);
+	fp = fopen(name, "r");
+	if (fp == NULL)
+		return 0;
+	if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	    h.magic != RTMON_INDEX_MAGIC || h.version != RTMON_INDEX_VERSION) {
+		fprintf(stderr, "Ignoring unknown index \"%s\"\n", name);
+		fclose(fp);
+		return 0;
+	}
+	/* Entries are in time order; a few thousand for a large file */
+	while (fread(&e, sizeof(e), 1, fp) == 1 && e.sec < since)
+		offset = e.offset;
+	fclose(fp);
+	return offset;
+}
+
+#ifdef HAVE_ZLIB
+/* The blocks of "rtmon compress", for rtnl_from_file() */
+static int monitor_inflate(void *dst, size_t dstlen,
+			   const void *src, size_t srclen)
+{
+	uLongf len = dstlen;
+
+	if (uncompress(dst, &len, src, srclen) != Z_OK)
+		return -1;
+	return len;
+}
+#endif
+
+static int monitor_file(const char *file, unsigned groups, int since_given)
+{
+	long offset;
+	FILE *fp;
+
+#ifdef HAVE_ZLIB
+	rtnl_inflate = monitor_inflate;
+#endif
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		perror("Cannot fopen");
+		exit(-1);
+	}
+	mon_groups = groups;
+	if (!since_given)
+		return rtnl_from_file(fp, monitor_replay, stdout);
+
+	since_skip = 1;
+	offset = monitor_seek_index(file);
+	if (offset > 0) {
+		head_stamps = 0;
+		if (rtnl_from_file(fp, monitor_head, NULL) < 0 &&
+		    head_stamps < 2)
+			return -1;
+		if (fseek(fp, offset, SEEK_SET) < 0) {
+			perror("Cannot seek");
+			return -1;
+		}
+	}
+	return rtnl_from_file(fp, monitor_replay, stdout);
+}
+
+/*
+ * "ip monitor coalesce MSECS" keeps only the latest message per route
+ * (table, prefix, tos and metric), link, address and neighbour over a
+ * window of MSECS and prints what is left at the end of it, in the
+ * order the objects first changed, followed by the event rates of the
+ * window and the number of times the socket overflowed.  Other messages
+ * are printed as they come.
+ */
+#define MON_HASH_MIN		1024
+
+enum {
+	MON_ROUTE, MON_LINK, MON_ADDR, MON_NEIGH, MON_OTHER, MON_MAX
+};
+
+static const char *mon_class_names[MON_MAX] = {
+	"route", "link", "address", "neigh", "other"
+};
+
+struct mon_key
+{
+	__u32	class;
+	__s32	nsid;
+	__u32	family;
+	__u32	ifindex;	/* or the route table */
+	__u32	priority;
+	__u32	plen;
+	__u32	tos;
+	__u8	addr[16];
+};
+
+struct mon_ent
+{
+	struct mon_ent	*hash_next;
+	struct mon_ent	*next;
+	struct mon_ent	*prev;
+	struct mon_key	key;
+	struct nlmsghdr	*n;
+	int		size;
+};
+
+/* Latest message per object; the list keeps the order of insertion */
+struct mon_table
+{
+	struct mon_ent		**hash;
+	unsigned		size;
+	unsigned		count;
+	struct mon_ent		*head;
+	struct mon_ent		*last;
+};
+
+static struct
+{
+	unsigned		window;
+	struct timeval		start;
+	struct mon_table	table;
+	unsigned		events[MON_MAX];
+	__u64			overruns;
+} coal;
+
+static void mon_addr(struct mon_key *key, struct rtattr *rta)
+{
+	int len;
+
+	if (rta == NULL)
+		return;
+	len = RTA_PAYLOAD(rta);
+	memcpy(key->addr, RTA_DATA(rta), len < 16 ? len : 16);
+}
+
+/* Returns the class of n and fills key for the coalesced ones */
+static int mon_key(struct nlmsghdr *n, struct mon_key *key)
+{
+	int len;
+
+	memset(key, 0, sizeof(*key));
+	key->nsid = mon_nsid;
+	switch (n->nlmsg_type) {
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE: {
+		struct rtmsg *r = NLMSG_DATA(n);
+		struct rtattr *tb[RTA_MAX+1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+		if (len < 0)
+			return MON_OTHER;
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+		key->family = r->rtm_family;
+		key->ifindex = rtm_get_table(r, tb);
+		key->plen = r->rtm_dst_len;
+		key->tos = r->rtm_tos;
+		if (tb[RTA_PRIORITY])
+			key->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+		mon_addr(key, tb[RTA_DST]);
+		return key->class = MON_ROUTE;
+	}
+	case RTM_NEWLINK:
+	case RTM_DELLINK: {
+		struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+			return MON_OTHER;
+		key->ifindex = ifi->ifi_index;
+		return key->class = MON_LINK;
+	}
+	case RTM_NEWADDR:
+	case RTM_DELADDR: {
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+		struct rtattr *tb[IFA_MAX+1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+		if (len < 0)
+			return MON_OTHER;
+		parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+		key->family = ifa->ifa_family;
+		key->ifindex = ifa->ifa_index;
+		key->plen = ifa->ifa_prefixlen;
+		mon_addr(key, tb[IFA_LOCAL] ? tb[IFA_LOCAL] : tb[IFA_ADDRESS]);
+		return key->class = MON_ADDR;
+	}
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH: {
+		struct ndmsg *ndm = NLMSG_DATA(n);
+		struct rtattr *tb[NDA_MAX+1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+		if (len < 0)
+			return MON_OTHER;
+		parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm), len);
+		key->family = ndm->ndm_family;
+		key->ifindex = ndm->ndm_ifindex;
+		key->tos = ndm->ndm_flags & NTF_PROXY;
+		mon_addr(key, tb[NDA_DST]);
+		return key->class = MON_NEIGH;
+	}
+	}
+	return MON_OTHER;
+}
+
+static unsigned mon_hash(const struct mon_key *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	unsigned hash = 5381;
+	int i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash << 5) + hash + p[i];
+	return hash;
+}
+
+static void mon_table_init(struct mon_table *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+static void mon_table_free(struct mon_table *t)
+{
+	struct mon_ent *e, *next;
+
+	for (e = t->head; e; e = next) {
+		next = e->next;
+		free(e->n);
+		free(e);
+	}
+	free(t->hash);
+	mon_table_init(t);
+}
+
+static struct mon_ent *mon_lookup(struct mon_table *t,
+				  const struct mon_key *key)
+{
+	struct mon_ent *e;
+
+	if (t->size == 0)
+		return NULL;
+	for (e = t->hash[mon_hash(key) & (t->size - 1)]; e; e = e->hash_next)
+		if (memcmp(&e->key, key, sizeof(*key)) == 0)
+			return e;
+	return NULL;
+}
+
+static int mon_grow(struct mon_table *t)
+{
+	unsigned size = t->size ? t->size * 2 : MON_HASH_MIN;
+	struct mon_ent **hash, *e;
+
+	hash = calloc(size, sizeof(*hash));
+	if (hash == NULL)
+		return -1;
+	for (e = t->head; e; e = e->next) {
+		unsigned h = mon_hash(&e->key) & (size - 1);
+
+		e->hash_next = hash[h];
+		hash[h] = e;
+	}
+	free(t->hash);
+	t->hash = hash;
+	t->size = size;
+	return 0;
+}
+
+/* Stores a copy of n as the latest message of key */
+static struct mon_ent *mon_store(struct mon_table *t,
+				 const struct mon_key *key,
+				 const struct nlmsghdr *n)
+{
+	struct mon_ent *e = mon_lookup(t, key);
+
+	if (e == NULL) {
+		unsigned h;
+
+		if (t->count >= t->size && mon_grow(t) < 0)
+			goto oom;
+		e = calloc(1, sizeof(*e));
+		if (e == NULL)
+			goto oom;
+		e->key = *key;
+		h = mon_hash(key) & (t->size - 1);
+		e->hash_next = t->hash[h];
+		t->hash[h] = e;
+		e->prev = t->last;
+		if (t->last)
+			t->last->next = e;
+		else
+			t->head = e;
+		t->last = e;
+		t->count++;
+	}
+	if (e->size < n->nlmsg_len) {
+		void *p = realloc(e->n, n->nlmsg_len);
+
+		if (p == NULL)
+			goto oom;
+		e->n = p;
+		e->size = n->nlmsg_len;
+	}
+	memcpy(e->n, n, n->nlmsg_len);
+	return e;
+oom:
+	perror("Cannot allocate memory");
+	return NULL;
+}
+
+static void mon_remove(struct mon_table *t, const struct mon_key *key)
+{
+	struct mon_ent **pe, *e;
+
+	if (t->size == 0)
+		return;
+	for (pe = &t->hash[mon_hash(key) & (t->size - 1)]; (e = *pe) != NULL;
+	     pe = &e->hash_next)
+		if (memcmp(&e->key, key, sizeof(*key)) == 0)
+			break;
+	if (e == NULL)
+		return;
+	*pe = e->hash_next;
+
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		t->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		t->last = e->prev;
+	t->count--;
+	free(e->n);
+	free(e);
+}
+
+static void coalesce_flush(FILE *fp, const struct timeval *now)
+{
+	struct mon_ent *e;
+	unsigned changes = coal.table.count;
+	double secs;
+	unsigned total = 0;
+	int i, sep = 0;
+
+	for (e = coal.table.head; e; e = e->next) {
+		mon_select(e->key.nsid);
+		accept_msg(NULL, e->n, fp);
+	}
+	mon_table_free(&coal.table);
+
+	for (i = 0; i < MON_MAX; i++)
+		total += coal.events[i];
+	if (total || rth.rx_stats.overruns != coal.overruns) {
+		secs = (now->tv_sec - coal.start.tv_sec) +
+			(now->tv_usec - coal.start.tv_usec) / 1000000.;
+		if (secs <= 0)
+			secs = coal.window / 1000.;
+		fprintf(fp, "*** %u events, %u changes in %.3fs",
+			total, changes, secs);
+		for (i = 0; i < MON_MAX; i++) {
+			if (!coal.events[i])
+				continue;
+			fprintf(fp, "%s %s %.0f/s", sep++ ? "," : ":",
+				mon_class_names[i], coal.events[i] / secs);
+		}
+		if (rth.rx_stats.overruns != coal.overruns)
+			fprintf(fp, "; %llu overruns, events lost",
+				(unsigned long long)(rth.rx_stats.overruns -
+						     coal.overruns));
+		fprintf(fp, " ***\n");
+	}
+	fflush(fp);
+
+	memset(coal.events, 0, sizeof(coal.events));
+	coal.overruns = rth.rx_stats.overruns;
+	coal.start = *now;
+}
+
+static void coalesce_tick(FILE *fp)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	if ((now.tv_sec - coal.start.tv_sec) * 1000 +
+	    (now.tv_usec - coal.start.tv_usec) / 1000 >= coal.window)
+		coalesce_flush(fp, &now);
+}
+
+static int coalesce_idle(void *arg)
+{
+	coalesce_tick(arg);
+	return 0;
+}
+
+static int coalesce_msg(const struct sockaddr_nl *who,
+			struct nlmsghdr *n, void *arg)
+{
+	struct mon_key key;
+	int class;
+
+	class = mon_key(n, &key);
+	if (class == MON_OTHER || (class == MON_LINK && link_quiet)) {
+		if (class == MON_OTHER)
+			coal.events[MON_OTHER]++;
+		accept_msg(who, n, arg);
+		coalesce_tick(arg);
+		return 0;
+	}
+	coal.events[class]++;
+
+	if (mon_store(&coal.table, &key, n) == NULL)
+		return -1;
+
+	coalesce_tick(arg);
+	return 0;
+}
+
+/*
+ * "ip monitor resync" keeps the last known state of the routes, links,
+ * addresses and neighbours it monitors, from a dump at startup kept
+ * current by the events.  When the socket overflows and events are
+ * lost, they are all dumped again and the difference to the known
+ * state is printed as ordinary events: new or changed objects as they
+ * are now, vanished ones as deleted.  Statistics and cache information
+ * are not taken for a change.
+ */
+static struct mon_table mon_state;
+
+/* Enough for IFLA_MAX, RTA_MAX, IFA_MAX and NDA_MAX */
+#define MON_ATTR_MAX		64
+
+static int mon_skip_attr(int class, int type)
+{
+	switch (class) {
+	case MON_ROUTE:
+		return type == RTA_CACHEINFO || type == RTA_EXPIRES;
+	case MON_LINK:
+		return type == IFLA_STATS || type == IFLA_STATS64 ||
+			type == IFLA_AF_SPEC;
+	case MON_ADDR:
+		return type == IFA_CACHEINFO;
+	case MON_NEIGH:
+		return type == NDA_CACHEINFO || type == NDA_PROBES;
+	}
+	return 0;
+}
+
+static int mon_same(const struct nlmsghdr *a, const struct nlmsghdr *b,
+		    int class)
+{
+	struct rtattr *ta[MON_ATTR_MAX+1], *tb[MON_ATTR_MAX+1];
+	int size, cmp, max, i;
+
+	switch (class) {
+	case MON_ROUTE:
+		size = cmp = sizeof(struct rtmsg);
+		max = RTA_MAX;
+		break;
+	case MON_LINK:
+		size = sizeof(struct ifinfomsg);
+		cmp = offsetof(struct ifinfomsg, ifi_change);
+		max = IFLA_MAX;
+		break;
+	case MON_ADDR:
+		size = cmp = sizeof(struct ifaddrmsg);
+		max = IFA_MAX;
+		break;
+	default:
+		size = cmp = sizeof(struct ndmsg);
+		max = NDA_MAX;
+		break;
+	}
+	if (a->nlmsg_type != b->nlmsg_type ||
+	    a->nlmsg_len < NLMSG_LENGTH(size) ||
+	    b->nlmsg_len < NLMSG_LENGTH(size) ||
+	    memcmp(NLMSG_DATA(a), NLMSG_DATA(b), cmp))
+		return 0;
+
+	parse_rtattr(ta, max, (void *)NLMSG_DATA(a) + NLMSG_ALIGN(size),
+		     a->nlmsg_len - NLMSG_LENGTH(size));
+	parse_rtattr(tb, max, (void *)NLMSG_DATA(b) + NLMSG_ALIGN(size),
+		     b->nlmsg_len - NLMSG_LENGTH(size));
+	for (i = 1; i <= max; i++) {
+		if (mon_skip_attr(class, i))
+			continue;
+		if (!ta[i] != !tb[i])
+			return 0;
+		if (ta[i] && (RTA_PAYLOAD(ta[i]) != RTA_PAYLOAD(tb[i]) ||
+			      memcmp(RTA_DATA(ta[i]), RTA_DATA(tb[i]),
+				     RTA_PAYLOAD(ta[i]))))
+			return 0;
+	}
+	return 1;
+}
+
+static int mon_tracked(struct nlmsghdr *n, struct mon_key *key)
+{
+	int class = mon_key(n, key);
+
+	return class != MON_OTHER && monitor_wanted(n) && monitor_match(n);
+}
+
+static void mon_update(struct nlmsghdr *n)
+{
+	struct mon_key key;
+
+	if (!mon_tracked(n, &key))
+		return;
+	if (n->nlmsg_type == RTM_DELROUTE || n->nlmsg_type == RTM_DELLINK ||
+	    n->nlmsg_type == RTM_DELADDR || n->nlmsg_type == RTM_DELNEIGH)
+		mon_remove(&mon_state, &key);
+	else
+		mon_store(&mon_state, &key, n);
+}
+
+static int mon_collect(const struct sockaddr_nl *who,
+		       struct nlmsghdr *n, void *arg)
+{
+	struct mon_key key;
+
+	if (mon_tracked(n, &key) && mon_store(arg, &key, n) == NULL)
+		return -1;
+	return 0;
+}
+
+/* Dumps every object that is monitored into t */
+static int mon_dump(struct mon_table *t)
+{
+	static const struct {
+		int	type;
+		unsigned groups;
+	} dumps[] = {
+		{ RTM_GETLINK, 1 << (RTNLGRP_LINK - 1) },
+		{ RTM_GETADDR, (1 << (RTNLGRP_IPV4_IFADDR - 1)) |
+			       (1 << (RTNLGRP_IPV6_IFADDR - 1)) },
+		{ RTM_GETROUTE, (1 << (RTNLGRP_IPV4_ROUTE - 1)) |
+				(1 << (RTNLGRP_IPV6_ROUTE - 1)) },
+		{ RTM_GETNEIGH, 1 << (RTNLGRP_NEIGH - 1) },
+	};
+	struct rtnl_handle drth;
+	int i, ret = 0;
+
+	if (rtnl_open(&drth, 0) < 0)
+		return -1;
+	/* The state is compared against, it has to be a snapshot */
+	drth.flags |= RTNL_HANDLE_F_DUMP_CONSISTENT;
+	for (i = 0; i < ARRAY_SIZE(dumps) && ret == 0; i++) {
+		if (!(mon_groups & dumps[i].groups))
+			continue;
+		if (rtnl_wilddump_request(&drth, AF_UNSPEC, dumps[i].type) < 0) {
+			perror("Cannot send dump request");
+			ret = -1;
+		} else if (rtnl_dump_filter(&drth, mon_collect, t) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -1;
+		}
+	}
+	rtnl_close(&drth);
+	return ret;
+}
+
+static int monitor_resync(void *arg)
+{
+	FILE *fp = arg;
+	struct mon_table now;
+	struct mon_ent *e, *o;
+	unsigned changes = 0;
+
+	/* What came in before the overrun goes first */
+	if (coal.window) {
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		coalesce_flush(fp, &tv);
+	}
+
+	mon_table_init(&now);
+	if (mon_dump(&now) < 0) {
+		fprintf(stderr, "Cannot resync after overrun\n");
+		mon_table_free(&now);
+		return 0;
+	}
+
+	for (e = now.head; e; e = e->next) {
+		o = mon_lookup(&mon_state, &e->key);
+		if (o && mon_same(o->n, e->n, e->key.class))
+			continue;
+		accept_msg(NULL, e->n, fp);
+		changes++;
+	}
+	for (o = mon_state.head; o; o = o->next) {
+		if (mon_lookup(&now, &o->key))
+			continue;
+		/* Every RTM_DEL* follows its RTM_NEW* */
+		o->n->nlmsg_type |= 1;
+		accept_msg(NULL, o->n, fp);
+		changes++;
+	}
+	mon_table_free(&mon_state);
+	mon_state = now;
+
+	fprintf(fp, "*** Resync after overrun: %u changes ***\n", changes);
+	fflush(fp);
+	return 0;
+}
+
+/* Link events were lost as well, so the link cache is dumped again */
+static int monitor_overrun(void *arg)
+{
+	if (link_cache && ll_map_export(link_cache) < 0)
+		fprintf(stderr, "Cannot rewrite the link cache\n");
+	return mon_resync ? monitor_resync(arg) : 0;
+}
+
+static int monitor_event(const struct sockaddr_nl *who,
+			 struct nlmsghdr *n, void *arg)
+{
+	mon_select(rth.nsid);
+	if (mon_resync)
+		mon_update(n);
+	if (!monitor_match(n)) {
+		monitor_link(who, n);
+		return 0;
+	}
+	if (coal.window)
+		return coalesce_msg(who, n, arg);
+	return accept_msg(who, n, arg);
+}
+
+/* Events go out as they come rather than when stdout's buffer is full */
+static int monitor_msg(const struct sockaddr_nl *who,
+		       struct nlmsghdr *n, void *arg)
+{
+	int ret = monitor_event(who, n, arg);
+
+	fflush(arg);
+	return ret;
+}
+
 int do_ipmonitor(int argc, char **argv)
 {
 	char *file = NULL;
+	int since_given = 0;
+	unsigned window = 0;
+	unsigned size = 0;
+	int resync = 0;
+	int all_nsid = 0;
 	unsigned groups = ~RTMGRP_TC;
 	int llink=0;
 	int laddr=0;
@@ -128,6 +1112,27 @@ int do_ipmonitor(int argc, char **argv)
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (matches(*argv, "coalesce") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&window, *argv, 0) || window == 0)
+				invarg("invalid \"coalesce\" window\n", *argv);
+		} else if (strcmp(*argv, "rcvbuf") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&size, *argv, 0) || size == 0 ||
+			    size > INT_MAX)
+				invarg("invalid \"rcvbuf\" size\n", *argv);
+		} else if (strcmp(*argv, "resync") == 0) {
+			resync = 1;
+		} else if (strcmp(*argv, "all-nsid") == 0) {
+			all_nsid = 1;
+		} else if (strcmp(*argv, "link-cache") == 0) {
+			NEXT_ARG();
+			link_cache = *argv;
+		} else if (strcmp(*argv, "since") == 0) {
+			NEXT_ARG();
+			if (parse_since(*argv, &since))
+				invarg("invalid \"since\" time\n", *argv);
+			since_given = 1;
 		} else if (matches(*argv, "link") == 0) {
 			llink=1;
 			groups = 0;
@@ -146,6 +1151,23 @@ int do_ipmonitor(int argc, char **argv)
 		} else if (strcmp(*argv, "all") == 0) {
 			groups = ~RTMGRP_TC;
 			prefix_banner=1;
+		} else if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			mon_filter.ifindex = ll_name_to_index(*argv);
+			if (mon_filter.ifindex == 0)
+				invarg("Device does not exist\n", *argv);
+		} else if (strcmp(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&mon_filter.table, *argv) ||
+			    mon_filter.table == 0)
+				invarg("invalid table ID\n", *argv);
+		} else if (matches(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv))
+				invarg("invalid \"protocol\"\n", *argv);
+			mon_filter.protocol = prot;
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 		} else {
@@ -176,21 +1198,70 @@ int do_ipmonitor(int argc, char **argv)
 	if (lneigh) {
 		groups |= nl_mgrp(RTNLGRP_NEIGH);
 	}
-	if (file) {
-		FILE *fp;
-		fp = fopen(file, "r");
-		if (fp == NULL) {
-			perror("Cannot fopen");
-			exit(-1);
-		}
-		return rtnl_from_file(fp, accept_msg, stdout);
+	if (file && (window || resync || all_nsid || link_cache)) {
+		fprintf(stderr, "\"%s\" cannot be used with \"file\"\n",
+			window ? "coalesce" : resync ? "resync" :
+			all_nsid ? "all-nsid" : "link-cache");
+		exit(-1);
+	}
+	/* The state is dumped from here, and the indexes are ours */
+	if (all_nsid && (resync || mon_filter.ifindex)) {
+		fprintf(stderr, "\"%s\" cannot be used with \"all-nsid\"\n",
+			resync ? "resync" : "dev");
+		exit(-1);
+	}
+	if (file)
+		return monitor_file(file, groups, since_given);
+	if (since_given) {
+		fprintf(stderr, "\"since\" requires \"file\"\n");
+		exit(-1);
 	}
 
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
+	if (size && rtnl_rcvbuf(&rth, size) < 0)
+		exit(1);
+	if (all_nsid) {
+		int group = RTNLGRP_NSID;
+
+		if (rtnl_listen_all_nsid(&rth) < 0) {
+			perror("Cannot listen to all nsids");
+			exit(1);
+		}
+		/* To forget the links of namespaces that went away */
+		if (setsockopt(rth.fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+			       &group, sizeof(group)) < 0)
+			perror("Cannot join RTNLGRP_NSID");
+	}
+	if (show_stats)
+		fprintf(stderr, "Receive buffer: %d bytes\n", rth.rcvbuf);
 	ll_init_map(&rth);
+	if (!(groups & nl_mgrp(RTNLGRP_LINK)) && ll_map_subscribe(&rth) == 0)
+		link_quiet = 1;
+	rth.batch = RTNL_DEFAULT_BATCH;
+	rtnl_rx_ring_setup(&rth, RTNL_RX_FRAME_SIZE, RTNL_RX_FRAME_NR);
+	monitor_kfilter(&rth, groups);
+
+	mon_groups = groups;
+	if (link_cache && ll_map_export(link_cache) < 0)
+		exit(1);
+	if (resync) {
+		mon_table_init(&mon_state);
+		if (mon_dump(&mon_state) < 0)
+			exit(1);
+		mon_resync = 1;
+	}
+	if (resync || link_cache)
+		rth.resync = monitor_overrun;
+	if (window) {
+		coal.window = window;
+		mon_table_init(&coal.table);
+		gettimeofday(&coal.start, NULL);
+		rth.idle = coalesce_idle;
+		rth.idle_timeout = window;
+	}
 
-	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
+	if (rtnl_listen(&rth, monitor_msg, stdout) < 0)
 		exit(2);
 
 	return 0;
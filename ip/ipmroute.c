@@ -26,7 +26,9 @@
 #include <linux/if_arp.h>
 #include <linux/sockios.h>
 
+#include "rt_names.h"
 #include "utils.h"
+#include "ip_common.h"
 
 char filter_dev[16];
 int  filter_family;
@@ -44,10 +46,11 @@ static void usage(void)
 
 static char *viftable[32];
 
-struct rtfilter
+static struct rtfilter
 {
 	inet_prefix mdst;
 	inet_prefix msrc;
+	int iif;
 } filter;
 
 static void read_viftable(void)
@@ -163,6 +166,149 @@ static void read_mroute_list(FILE *ofp)
 	fclose(fp);
 }
 
+static int print_mroute(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	FILE *fp = (FILE*)arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len;
+	struct rtattr *tb[RTA_MAX+1];
+	inet_prefix maddr, msrc;
+	char sbuf[256];
+	char mbuf[256];
+	char obuf[256];
+	__u32 table;
+	int iif = 0;
+
+	if (n->nlmsg_type != RTM_NEWROUTE)
+		return 0;
+	len -= NLMSG_LENGTH(sizeof(*r));
+	if (len < 0) {
+		fprintf(stderr, "BUG: wrong nlmsg len %d\n", len);
+		return -1;
+	}
+	if (r->rtm_family != RTNL_FAMILY_IPMR)
+		return 0;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	/* /proc/net/ip_mr_cache only ever showed the default table */
+	table = tb[RTA_TABLE] ? rta_getattr_u32(tb[RTA_TABLE]) : r->rtm_table;
+	if (table != RT_TABLE_DEFAULT)
+		return 0;
+
+	memset(&maddr, 0, sizeof(maddr));
+	memset(&msrc, 0, sizeof(msrc));
+	maddr.family = msrc.family = AF_INET;
+	maddr.bitlen = msrc.bitlen = 32;
+	maddr.bytelen = msrc.bytelen = 4;
+	if (tb[RTA_DST])
+		memcpy(maddr.data, RTA_DATA(tb[RTA_DST]), 4);
+	if (tb[RTA_SRC])
+		memcpy(msrc.data, RTA_DATA(tb[RTA_SRC]), 4);
+	if (tb[RTA_IIF])
+		iif = rta_getattr_u32(tb[RTA_IIF]);
+
+	if (filter_dev[0] && iif != filter.iif)
+		return 0;
+	if (filter.mdst.family && inet_addr_match(&maddr, &filter.mdst, filter.mdst.bitlen))
+		return 0;
+	if (filter.msrc.family && inet_addr_match(&msrc, &filter.msrc, filter.msrc.bitlen))
+		return 0;
+
+	snprintf(obuf, sizeof(obuf), "(%s, %s)",
+		 format_host(AF_INET, 4, &msrc.data[0], sbuf, sizeof(sbuf)),
+		 format_host(AF_INET, 4, &maddr.data[0], mbuf, sizeof(mbuf)));
+
+	fprintf(fp, "%-32s Iif: ", obuf);
+
+	if (iif == 0)
+		fprintf(fp, "unresolved ");
+	else
+		fprintf(fp, "%-10s ", ll_index_to_name(iif));
+
+	if (tb[RTA_MULTIPATH]) {
+		struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		int nhlen = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+
+		if (RTNH_OK(nh, nhlen))
+			fprintf(fp, "Oifs: ");
+		for (; RTNH_OK(nh, nhlen); nh = RTNH_NEXT(nh)) {
+			fprintf(fp, "%s", ll_index_to_name(nh->rtnh_ifindex));
+			if (nh->rtnh_hops > 1)
+				fprintf(fp, "(ttl %d) ", nh->rtnh_hops);
+			else
+				fprintf(fp, " ");
+			nhlen -= RTNH_ALIGN(nh->rtnh_len);
+		}
+	}
+
+	if (show_stats && tb[RTA_MFC_STATS]) {
+		struct rta_mfc_stats *mfcs = RTA_DATA(tb[RTA_MFC_STATS]);
+
+		if (mfcs->mfcs_bytes) {
+			fprintf(fp, "%s  %llu packets, %llu bytes", _SL_,
+				(unsigned long long)mfcs->mfcs_packets,
+				(unsigned long long)mfcs->mfcs_bytes);
+			if (mfcs->mfcs_wrong_if)
+				fprintf(fp, ", %llu arrived on wrong iif.",
+					(unsigned long long)mfcs->mfcs_wrong_if);
+		}
+	}
+	fprintf(fp, "\n");
+	return 0;
+}
+
+/* Dump the default table, letting the kernel leave out the entries that
+ * do not use the iif device where it can (strict checking, 4.20+): it
+ * matches the device as input or output, print_mroute() narrows that
+ * down to the input.
+ */
+static int mroute_dump_request(void)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct rtmsg	r;
+		char		buf[64];
+	} req;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.n.nlmsg_type = RTM_GETROUTE;
+	req.r.rtm_family = RTNL_FAMILY_IPMR;
+	addattr32(&req.n, sizeof(req), RTA_TABLE, RT_TABLE_DEFAULT);
+	if (filter.iif)
+		addattr32(&req.n, sizeof(req), RTA_OIF, filter.iif);
+
+	ret = rtnl_dump_request_strict(&rth, &req.n);
+	if (ret == 0)
+		return rtnl_wilddump_request(&rth, RTNL_FAMILY_IPMR,
+					     RTM_GETROUTE);
+	return ret;
+}
+
+/* Returns -1 if the kernel cannot dump the multicast routes */
+static int mroute_list_nl(FILE *fp)
+{
+	int ret;
+
+	ll_init_map(&rth);
+
+	if (filter_dev[0]) {
+		filter.iif = ll_name_to_index(filter_dev);
+		if (filter.iif == 0)
+			return 0;
+	}
+
+	if (mroute_dump_request() < 0)
+		return -1;
+
+	rth.flags |= RTNL_HANDLE_F_SUPPRESS_NLERR;
+	ret = rtnl_dump_filter(&rth, print_mroute, fp);
+	rth.flags &= ~RTNL_HANDLE_F_SUPPRESS_NLERR;
+	return ret < 0 ? -1 : 0;
+}
 
 static int mroute_list(int argc, char **argv)
 {
@@ -184,6 +330,9 @@ static int mroute_list(int argc, char **argv)
 		argv++; argc--;
 	}
 
+	if (mroute_list_nl(stdout) == 0)
+		return 0;
+
 	read_viftable();
 	read_mroute_list(stdout);
 	return 0;
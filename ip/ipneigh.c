@@ -20,6 +20,12 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <errno.h>
+#include <signal.h>
+#include <strings.h>
+#include <time.h>
 
 #include "rt_names.h"
 #include "utils.h"
@@ -27,6 +33,7 @@
 
 #define NUD_VALID	(NUD_PERMANENT|NUD_NOARP|NUD_REACHABLE|NUD_PROBE|NUD_STALE|NUD_DELAY)
 #define MAX_ROUNDS	10
+#define MAX_LLADDR	32
 
 static struct
 {
@@ -39,8 +46,19 @@ static struct
 	char *flushb;
 	int flushp;
 	int flushe;
+	struct rtnl_handle *flush_rth;
+	int flush_errors;
+	int save;
+	int summary;
 } filter;
 
+enum {
+	IPNEIGH_SHOW,
+	IPNEIGH_FLUSH,
+	IPNEIGH_SAVE,
+	IPNEIGH_SUMMARY,
+};
+
 static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
@@ -49,6 +67,12 @@ static void usage(void)
 		        "          [ nud { permanent | noarp | stale | reachable } ]\n"
 		        "          | proxy ADDR } [ dev DEV ]\n");
 	fprintf(stderr, "       ip neigh {show|flush} [ to PREFIX ] [ dev DEV ] [ nud STATE ]\n");
+	fprintf(stderr, "       ip neigh flush [ to PREFIX ] [ dev DEV ] [ nud STATE ] fast\n");
+	fprintf(stderr, "       ip neigh save [ to PREFIX ] [ dev DEV ] [ nud STATE ] [ compress ]\n");
+	fprintf(stderr, "       ip neigh summary [ to PREFIX ] [ dev DEV ] [ nud STATE ]\n");
+	fprintf(stderr, "       ip neigh watch [ dev DEV ] [ interval SEC ] [ count N ]\n");
+	fprintf(stderr, "       ip neigh restore\n");
+	fprintf(stderr, "       ip neigh bulk { FILE | - } [ nud STATE ]\n");
 	exit(-1);
 }
 
@@ -91,6 +115,24 @@ static int flush_update(void)
 	return 0;
 }
 
+/* The fast flush keeps every delete of a round until the dump is done */
+static int flush_grow(int len)
+{
+	int size = filter.flushe ? filter.flushe * 2 : 65536;
+	char *b;
+
+	while (size < NLMSG_ALIGN(filter.flushp) + len)
+		size *= 2;
+	b = realloc(filter.flushb, size);
+	if (b == NULL) {
+		perror("Cannot allocate flush buffer");
+		return -1;
+	}
+	filter.flushb = b;
+	filter.flushe = size;
+	return 0;
+}
+
 
 static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 {
@@ -181,13 +223,137 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 }
 
 
+/* "ip neigh summary" counts the entries per device, family and state
+ * while the table is dumped, instead of printing them.  "ip neigh watch"
+ * keeps the same counts current from the neighbour group.
+ */
+#define NEIGH_NSTATES	9	/* the NUD_ bits, then NUD_NONE */
+#define NEIGH_PERMANENT	7
+#define NEIGH_SUM_HASH	256
+
+static const char *neigh_state_names[NEIGH_NSTATES] = {
+	"INCOMPLETE", "REACHABLE", "STALE", "DELAY", "PROBE",
+	"FAILED", "NOARP", "PERMANENT", "NONE",
+};
+
+struct neigh_sum
+{
+	struct neigh_sum	*next;
+	int			ifindex;
+	int			family;
+	unsigned		count[NEIGH_NSTATES];
+	unsigned		entries;
+	unsigned		peak;
+	/* churn of the current interval and of the whole watch */
+	unsigned		added, deleted, changed, failed;
+	unsigned long long	all_added, all_deleted, all_changed, all_failed;
+};
+
+static struct neigh_sum *neigh_sums[NEIGH_SUM_HASH];
+static int neigh_nsums;
+
+static int neigh_state_index(int state)
+{
+	int i = ffs(state & 0xFF);
+
+	return i ? i - 1 : NEIGH_NSTATES - 1;
+}
+
+static struct neigh_sum *neigh_sum_get(int ifindex, int family)
+{
+	unsigned h = (ifindex * 31 + family) % NEIGH_SUM_HASH;
+	struct neigh_sum *s;
+
+	for (s = neigh_sums[h]; s; s = s->next)
+		if (s->ifindex == ifindex && s->family == family)
+			return s;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL) {
+		perror("Cannot allocate neighbour summary");
+		return NULL;
+	}
+	s->ifindex = ifindex;
+	s->family = family;
+	s->next = neigh_sums[h];
+	neigh_sums[h] = s;
+	neigh_nsums++;
+	return s;
+}
+
+static int neigh_sum_cmp(const void *a, const void *b)
+{
+	const struct neigh_sum *x = *(const struct neigh_sum **)a;
+	const struct neigh_sum *y = *(const struct neigh_sum **)b;
+
+	if (x->ifindex != y->ifindex)
+		return x->ifindex < y->ifindex ? -1 : 1;
+	return x->family - y->family;
+}
+
+/* The summaries ordered by device, or NULL; the caller frees the array */
+static struct neigh_sum **neigh_sum_sorted(void)
+{
+	struct neigh_sum **v, *s;
+	int i, n = 0;
+
+	v = malloc((neigh_nsums ? : 1) * sizeof(*v));
+	if (v == NULL)
+		return NULL;
+	for (i = 0; i < NEIGH_SUM_HASH; i++)
+		for (s = neigh_sums[i]; s; s = s->next)
+			v[n++] = s;
+	qsort(v, n, sizeof(*v), neigh_sum_cmp);
+	return v;
+}
+
+static void neigh_sum_free(void)
+{
+	struct neigh_sum *s, *next;
+	int i;
+
+	for (i = 0; i < NEIGH_SUM_HASH; i++) {
+		for (s = neigh_sums[i]; s; s = next) {
+			next = s->next;
+			free(s);
+		}
+		neigh_sums[i] = NULL;
+	}
+	neigh_nsums = 0;
+}
+
+static const char *neigh_family(int family)
+{
+	switch (family) {
+	case AF_INET:
+		return "inet";
+	case AF_INET6:
+		return "inet6";
+	case AF_DECnet:
+		return "dnet";
+	}
+	return "unknown";
+}
+
+static void neigh_sum_print(FILE *fp, const struct neigh_sum *s)
+{
+	int i;
+
+	fprintf(fp, "dev %s %s entries %u", ll_index_to_name(s->ifindex),
+		neigh_family(s->family), s->entries);
+	for (i = 0; i < NEIGH_NSTATES; i++)
+		if (s->count[i])
+			fprintf(fp, " %s %u", neigh_state_names[i], s->count[i]);
+}
+
 int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE*)arg;
 	struct ndmsg *r = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[NDA_MAX+1];
+	struct rtattr **tb;
 	char abuf[256];
+	RTATTR_TABLE(neigh_tb, NDA_MAX);
 
 	if (n->nlmsg_type != RTM_NEWNEIGH && n->nlmsg_type != RTM_DELNEIGH) {
 		fprintf(stderr, "Not RTM_NEWNEIGH: %08x %08x %08x\n",
@@ -214,7 +380,7 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
              (r->ndm_family != AF_DECnet))
 		return 0;
 
-	parse_rtattr(tb, NDA_MAX, NDA_RTA(r), n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	tb = parse_rtattr_table(&neigh_tb, NDA_RTA(r), n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
 
 	if (tb[NDA_DST]) {
 		if (filter.pfx.family) {
@@ -232,17 +398,35 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
+	if (filter.summary) {
+		struct neigh_sum *sum = neigh_sum_get(r->ndm_ifindex,
+						      r->ndm_family);
+
+		if (sum == NULL)
+			return -1;
+		sum->count[neigh_state_index(r->ndm_state)]++;
+		sum->entries++;
+		return 0;
+	}
+
+	if (filter.save)
+		return rtsave_put(n, 0);
+
 	if (filter.flushb) {
 		struct nlmsghdr *fn;
 		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
+			if (filter.flush_rth) {
+				if (flush_grow(n->nlmsg_len))
+					return -1;
+			} else if (flush_update())
 				return -1;
 		}
 		fn = (struct nlmsghdr*)(filter.flushb + NLMSG_ALIGN(filter.flushp));
 		memcpy(fn, n, n->nlmsg_len);
 		fn->nlmsg_type = RTM_DELNEIGH;
 		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
+		if (!filter.flush_rth)
+			fn->nlmsg_seq = ++rth.seq;
 		filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
 		filter.flushed++;
 		if (show_stats < 2)
@@ -250,20 +434,21 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	}
 
 	if (tb[NDA_DST]) {
-		fprintf(fp, "%s ",
-			format_host(r->ndm_family,
-				    RTA_PAYLOAD(tb[NDA_DST]),
-				    RTA_DATA(tb[NDA_DST]),
-				    abuf, sizeof(abuf)));
+		print_field(fp, "",
+			    format_host(r->ndm_family,
+					RTA_PAYLOAD(tb[NDA_DST]),
+					RTA_DATA(tb[NDA_DST]),
+					abuf, sizeof(abuf)));
 	}
 	if (!filter.index && r->ndm_ifindex)
-		fprintf(fp, "dev %s ", ll_index_to_name(r->ndm_ifindex));
+		print_field(fp, "dev ", ll_index_to_name(r->ndm_ifindex));
 	if (tb[NDA_LLADDR]) {
 		SPRINT_BUF(b1);
-		fprintf(fp, "lladdr %s", ll_addr_n2a(RTA_DATA(tb[NDA_LLADDR]),
-					      RTA_PAYLOAD(tb[NDA_LLADDR]),
-					      ll_index_to_type(r->ndm_ifindex),
-					      b1, sizeof(b1)));
+		fputs("lladdr ", fp);
+		fputs(ll_addr_n2a(RTA_DATA(tb[NDA_LLADDR]),
+				  RTA_PAYLOAD(tb[NDA_LLADDR]),
+				  ll_index_to_type(r->ndm_ifindex),
+				  b1, sizeof(b1)), fp);
 	}
 	if (r->ndm_flags & NTF_ROUTER) {
 		fprintf(fp, " router");
@@ -276,7 +461,7 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		int hz = get_user_hz();
 
 		if (ci->ndm_refcnt)
-			printf(" ref %d", ci->ndm_refcnt);
+			fprintf(fp, " ref %d", ci->ndm_refcnt);
 		fprintf(fp, " used %d/%d/%d", ci->ndm_used/hz,
 		       ci->ndm_confirmed/hz, ci->ndm_updated/hz);
 	}
@@ -303,8 +488,6 @@ int print_neigh(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 #undef PRINT_FLAG
 	}
 	fprintf(fp, "\n");
-
-	fflush(fp);
 	return 0;
 }
 
@@ -314,10 +497,801 @@ void ipneigh_reset_filter()
 	filter.state = ~0;
 }
 
-int do_show_or_flush(int argc, char **argv, int flush)
+/* Ask the kernel to leave out neighbours on other devices.  Only strict
+ * dump requests may carry NDA_IFINDEX, and the state cannot be filtered
+ * by the kernel at all, so print_neigh() still checks everything.
+ */
+static int ipneigh_dump_request(struct ndmsg *ndm)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct ndmsg	ndm;
+		char		buf[64];
+	} req;
+	int ret;
+
+	if (filter.index) {
+		memset(&req, 0, sizeof(req));
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+		req.n.nlmsg_type = RTM_GETNEIGH;
+		req.ndm.ndm_family = ndm->ndm_family;
+		req.ndm.ndm_flags = ndm->ndm_flags & NTF_PROXY;
+		addattr32(&req.n, sizeof(req), NDA_IFINDEX, filter.index);
+
+		ret = rtnl_dump_request_strict(&rth, &req.n);
+		if (ret != 0)
+			return ret;
+	}
+	return rtnl_dump_request(&rth, RTM_GETNEIGH, ndm, sizeof(struct ndmsg));
+}
+
+/* "ip neigh flush ... fast" only collects the deletes while the table is
+ * dumped and sends them through a pipeline once the dump is done.  The
+ * table does not change under the dump, so nothing is skipped and one
+ * round is enough unless some deletes fail.
+ */
+#define FLUSH_FAST_WINDOW	256
+
+static void flush_fast_error(int cookie, int error, void *arg)
+{
+	/* Already gone, e.g. expired meanwhile */
+	if (error == ENOENT)
+		return;
+	if (filter.flush_errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+}
+
+static int ipneigh_flush_fast(struct ndmsg *ndm, int bufsize)
+{
+	struct rtnl_handle frth;
+	int round, ret = 1;
+
+	if (rtnl_open(&frth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	filter.flushb = NULL;
+	filter.flushp = 0;
+	filter.flushe = 0;
+	if (flush_grow(0) < 0) {
+		rtnl_close(&frth);
+		return -1;
+	}
+	filter.flush_rth = &frth;
+
+	for (round = 0; round < MAX_ROUNDS; round++) {
+		struct nlmsghdr *fn;
+		int len;
+
+		if (ipneigh_dump_request(ndm) < 0) {
+			perror("Cannot send dump request");
+			break;
+		}
+		filter.flushp = 0;
+		filter.flushed = 0;
+		filter.flush_errors = 0;
+		if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
+			fprintf(stderr, "Flush terminated\n");
+			break;
+		}
+
+		if (filter.flushed == 0) {
+			if (show_stats && round == 0)
+				printf("Nothing to flush.\n");
+			ret = 0;
+			break;
+		}
+
+		if (rtnl_pipeline_open(&frth, FLUSH_FAST_WINDOW,
+				       flush_fast_error, NULL) < 0 ||
+		    rtnl_pipeline_coalesce(&frth, bufsize) < 0) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			break;
+		}
+		len = filter.flushp;
+		for (fn = (struct nlmsghdr *)filter.flushb; NLMSG_OK(fn, len);
+		     fn = NLMSG_NEXT(fn, len))
+			if (rtnl_talk(&frth, fn, 0, 0, NULL) < 0)
+				break;
+		if (rtnl_pipeline_close(&frth) < 0)
+			break;
+
+		if (show_stats) {
+			printf("\n*** Round %d, deleted %d entries",
+			       round + 1, filter.flushed - filter.flush_errors);
+			if (filter.flush_errors)
+				printf(", %d failed", filter.flush_errors);
+			printf(" ***\n");
+		}
+		if (filter.flush_errors == 0) {
+			if (show_stats)
+				printf("*** Flush is complete after %d round%s ***\n",
+				       round + 1, round ? "s" : "");
+			ret = 0;
+			break;
+		}
+		/* Nothing went away, another round will not help */
+		if (filter.flush_errors == filter.flushed)
+			break;
+	}
+
+	if (ret)
+		printf("*** Flush not complete bailing out after %d round%s\n",
+		       round + (round < MAX_ROUNDS),
+		       round + (round < MAX_ROUNDS) > 1 ? "s" : "");
+	fflush(stdout);
+	free(filter.flushb);
+	rtnl_close(&frth);
+	filter.flush_rth = NULL;
+	return ret;
+}
+
+/* "ip neigh save" writes the selected entries in the stream format of
+ * "ip route save" and "ip neigh restore" replaces them back through a
+ * request pipeline.  Devices are known by their index, as in routes.
+ */
+#define RESTORE_WINDOW		256
+#define RESTORE_BATCH		32768
+
+struct restore_state
+{
+	int	count;
+	int	errors;
+};
+
+static void restore_error(int cookie, int error, void *arg)
+{
+	struct restore_state *rs = arg;
+
+	if (rs->errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s (neighbour %d)\n",
+			strerror(error), cookie);
+}
+
+static int restore_neigh(struct nlmsghdr *n, void *arg)
+{
+	struct restore_state *rs = arg;
+
+	if (n->nlmsg_type != RTM_NEWNEIGH)
+		return 0;
+
+	n->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK;
+	rtnl_pipeline_cookie(&rth, ++rs->count);
+	return rtnl_talk(&rth, n, 0, 0, NULL);
+}
+
+static int ipneigh_restore(int argc, char **argv)
+{
+	struct restore_state rs = { 0 };
+	int ret;
+
+	if (argc > 0) {
+		if (matches(*argv, "help") == 0)
+			usage();
+		invarg("unknown restore option\n", *argv);
+	}
+
+	if (rtnl_pipeline_open(&rth, RESTORE_WINDOW, restore_error, &rs) < 0 ||
+	    rtnl_pipeline_coalesce(&rth, RESTORE_BATCH) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return 1;
+	}
+	ret = rtsave_restore(0, restore_neigh, &rs);
+	if (rtnl_pipeline_close(&rth) < 0)
+		ret = -1;
+	if (rs.errors > 1)
+		fprintf(stderr, "%d of %d neighbours were not restored\n",
+			rs.errors, rs.count);
+	return ret < 0 || rs.errors ? 2 : 0;
+}
+
+/* "ip neigh bulk" installs "ADDR,LLADDR,DEV" lines, one per entry, as
+ * replaces.  The fields are parsed straight into one request that is
+ * reused for every line, the last device is remembered and the requests
+ * go through the pipeline without ACKs, so only failures are answered.
+ */
+struct neigh_bulk
+{
+	int	count;
+	int	errors;
+};
+
+static void neigh_bulk_error(int cookie, int error, void *arg)
+{
+	struct neigh_bulk *nb = arg;
+
+	if (cookie > 0)
+		fprintf(stderr, "line %d: ", cookie);
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	nb->errors++;
+}
+
+static char *neigh_bulk_field(char **cp)
+{
+	char *f = *cp, *e;
+
+	while (*f == ' ' || *f == '\t')
+		f++;
+	e = strchr(f, ',');
+	if (e) {
+		*cp = e + 1;
+	} else {
+		e = f + strlen(f);
+		*cp = e;
+	}
+	while (e > f && (e[-1] == ' ' || e[-1] == '\t' ||
+			 e[-1] == '\n' || e[-1] == '\r'))
+		e--;
+	*e = '\0';
+	return f;
+}
+
+static int neigh_bulk_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* aa:bb:...; one or two digits per byte, as ll_addr_a2n() takes them */
+static int neigh_bulk_lladdr(__u8 *lla, int size, const char *arg)
+{
+	int len = 0;
+
+	while (len < size) {
+		int hi = neigh_bulk_hex(*arg++), lo;
+
+		if (hi < 0)
+			return -1;
+		lo = neigh_bulk_hex(*arg);
+		if (lo >= 0) {
+			hi = hi * 16 + lo;
+			arg++;
+		}
+		lla[len++] = hi;
+		if (*arg == '\0')
+			return len;
+		if (*arg++ != ':')
+			return -1;
+	}
+	return -1;
+}
+
+static int ipneigh_bulk(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr 	n;
+		struct ndmsg 		ndm;
+		char   			buf[128];
+	} req;
+	struct neigh_bulk nb = { 0 };
+	char lastdev[IFNAMSIZ + 1] = "";
+	unsigned lastidx = 0;
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	int state = NUD_PERMANENT;
+	FILE *fp;
+
+	if (argc < 1)
+		usage();
+	if (strcmp(*argv, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(*argv, "r")) == NULL) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			*argv, strerror(errno));
+		return -1;
+	}
+	argc--; argv++;
+	while (argc > 0) {
+		if (strcmp(*argv, "nud") == 0) {
+			unsigned nud;
+
+			NEXT_ARG();
+			if (nud_state_a2n(&nud, *argv))
+				invarg("nud state is bad", *argv);
+			state = nud;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown bulk option\n", *argv);
+		}
+		argc--; argv++;
+	}
+
+	ll_init_map(&rth);
+	if (rtnl_pipeline_open(&rth, RESTORE_WINDOW, neigh_bulk_error, &nb) < 0 ||
+	    rtnl_pipeline_coalesce(&rth, RESTORE_BATCH) < 0 ||
+	    rtnl_pipeline_noack(&rth) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		if (fp != stdin)
+			fclose(fp);
+		return 1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_type = RTM_NEWNEIGH;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK;
+	req.ndm.ndm_state = state;
+
+	while (getline(&line, &len, fp) != -1) {
+		struct rtattr *rta;
+		char *cp = line, *addr, *lla, *dev;
+		__u8 dst[16];
+		int family, l;
+
+		lineno++;
+		if ((addr = strchr(line, '#')) != NULL)
+			*addr = '\0';
+		addr = neigh_bulk_field(&cp);
+		if (*addr == '\0' && *cp == '\0')
+			continue;
+		lla = neigh_bulk_field(&cp);
+		dev = neigh_bulk_field(&cp);
+		nb.count++;
+
+		if (*dev == '\0' || *neigh_bulk_field(&cp)) {
+			fprintf(stderr, "line %d: expected ADDR,LLADDR,DEV\n",
+				lineno);
+			nb.errors++;
+			continue;
+		}
+		if (inet_pton(AF_INET, addr, dst) == 1)
+			family = AF_INET, l = 4;
+		else if (inet_pton(AF_INET6, addr, dst) == 1)
+			family = AF_INET6, l = 16;
+		else
+			family = AF_UNSPEC, l = 0;
+		if (family == AF_UNSPEC ||
+		    (preferred_family != AF_UNSPEC &&
+		     preferred_family != family)) {
+			fprintf(stderr, "line %d: \"%s\" is not a valid address\n",
+				lineno, addr);
+			nb.errors++;
+			continue;
+		}
+
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+		req.ndm.ndm_family = family;
+		addattr_l(&req.n, sizeof(req), NDA_DST, dst, l);
+		if (strcmp(lla, "null") != 0) {
+			rta = NLMSG_TAIL(&req.n);
+			l = neigh_bulk_lladdr(RTA_DATA(rta), MAX_LLADDR, lla);
+			if (l < 0) {
+				fprintf(stderr, "line %d: \"%s\" is invalid lladdr.\n",
+					lineno, lla);
+				nb.errors++;
+				continue;
+			}
+			rta->rta_type = NDA_LLADDR;
+			rta->rta_len = RTA_LENGTH(l);
+			req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) +
+					  RTA_ALIGN(rta->rta_len);
+		}
+
+		if (strcmp(dev, lastdev) != 0) {
+			lastidx = ll_name_to_index(dev);
+			strncpy(lastdev, dev, IFNAMSIZ);
+		}
+		if (lastidx == 0) {
+			fprintf(stderr, "line %d: Cannot find device \"%s\"\n",
+				lineno, dev);
+			nb.errors++;
+			continue;
+		}
+		req.ndm.ndm_ifindex = lastidx;
+
+		rtnl_pipeline_cookie(&rth, lineno);
+		if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
+			break;
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	if (rtnl_pipeline_close(&rth) < 0 && nb.errors == 0)
+		nb.errors++;
+	if (nb.errors > 1)
+		fprintf(stderr, "%d of %d neighbours were not installed\n",
+			nb.errors, nb.count);
+	return nb.errors ? 2 : 0;
+}
+
+/* "ip neigh watch" dumps the table once and then follows the neighbour
+ * group, so that it knows the state of every entry and can tell adds,
+ * deletes and state changes apart.  Every interval it prints the counts
+ * of each device with what changed meanwhile, and the entries of each
+ * family that are not permanent against gc_thresh3; "!" marks a full
+ * table.  A lost event
+ * makes it dump the table again.
+ */
+#define NEIGH_ENT_HASH		65536
+#define NEIGH_WATCH_IDLE	200	/* ms, to notice signals */
+
+struct neigh_ent
+{
+	struct neigh_ent	*next;
+	int			ifindex;
+	__u8			family;
+	__u8			len;
+	__u16			state;
+	__u8			dst[16];
+};
+
+static struct
+{
+	struct neigh_ent	**ents;
+	struct rtnl_handle	rth;
+	int			baseline;
+	int			resyncs;
+	unsigned		interval;
+	unsigned		count;
+	unsigned		rounds;
+	double			start, last, next;
+	__u32			thresh3[2];	/* inet, inet6 */
+} nw;
+
+static volatile sig_atomic_t neigh_watch_stop;
+
+static void neigh_watch_sig(int sig)
+{
+	neigh_watch_stop = 1;
+}
+
+static double neigh_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned neigh_ent_hash(int ifindex, const __u8 *dst, int len)
+{
+	unsigned h = 2166136261U ^ ifindex;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ dst[i]) * 16777619U;
+	return h % NEIGH_ENT_HASH;
+}
+
+static void neigh_ent_free(void)
+{
+	struct neigh_ent *e, *next;
+	int i;
+
+	for (i = 0; i < NEIGH_ENT_HASH; i++) {
+		for (e = nw.ents[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+		nw.ents[i] = NULL;
+	}
+}
+
+static int neigh_watch_entry(const struct sockaddr_nl *who,
+			     struct nlmsghdr *n, void *arg)
+{
+	struct ndmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[NDA_MAX+1];
+	struct neigh_ent *e, **pe;
+	struct neigh_sum *s;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	const __u8 *dst;
+	int dlen;
+
+	if (n->nlmsg_type != RTM_NEWNEIGH && n->nlmsg_type != RTM_DELNEIGH)
+		return 0;
+	if (len < 0)
+		return -1;
+	if (r->ndm_flags & NTF_PROXY)
+		return 0;
+	if (filter.family && filter.family != r->ndm_family)
+		return 0;
+	if (filter.index && filter.index != r->ndm_ifindex)
+		return 0;
+
+	parse_rtattr(tb, NDA_MAX, NDA_RTA(r), len);
+	if (tb[NDA_DST] == NULL)
+		return 0;
+	dst = RTA_DATA(tb[NDA_DST]);
+	dlen = RTA_PAYLOAD(tb[NDA_DST]);
+	if (dlen > sizeof(e->dst))
+		return 0;
+
+	pe = &nw.ents[neigh_ent_hash(r->ndm_ifindex, dst, dlen)];
+	for (e = *pe; e; pe = &e->next, e = e->next)
+		if (e->ifindex == r->ndm_ifindex && e->family == r->ndm_family &&
+		    e->len == dlen && memcmp(e->dst, dst, dlen) == 0)
+			break;
+
+	s = neigh_sum_get(r->ndm_ifindex, r->ndm_family);
+	if (s == NULL)
+		return -1;
+
+	if (n->nlmsg_type == RTM_DELNEIGH) {
+		if (e == NULL)
+			return 0;
+		s->count[neigh_state_index(e->state)]--;
+		s->entries--;
+		s->deleted++;
+		*pe = e->next;
+		free(e);
+		return 0;
+	}
+
+	if (e == NULL) {
+		e = malloc(sizeof(*e));
+		if (e == NULL) {
+			perror("Cannot allocate neighbour entry");
+			return -1;
+		}
+		e->ifindex = r->ndm_ifindex;
+		e->family = r->ndm_family;
+		e->len = dlen;
+		memcpy(e->dst, dst, dlen);
+		e->state = r->ndm_state;
+		e->next = *pe;
+		*pe = e;
+		s->count[neigh_state_index(e->state)]++;
+		if (++s->entries > s->peak)
+			s->peak = s->entries;
+		if (!nw.baseline)
+			s->added++;
+	} else if (e->state != r->ndm_state) {
+		s->count[neigh_state_index(e->state)]--;
+		s->count[neigh_state_index(r->ndm_state)]++;
+		e->state = r->ndm_state;
+		s->changed++;
+	} else
+		return 0;
+
+	if (!nw.baseline && (r->ndm_state & NUD_FAILED))
+		s->failed++;
+	return 0;
+}
+
+static int neigh_watch_thresh(const struct sockaddr_nl *who,
+			      struct nlmsghdr *n, void *arg)
+{
+	struct ndtmsg *ndtm = NLMSG_DATA(n);
+	struct rtattr *tb[NDTA_MAX+1];
+
+	if (n->nlmsg_type != RTM_NEWNEIGHTBL ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*ndtm)))
+		return 0;
+	parse_rtattr(tb, NDTA_MAX, NDTA_RTA(ndtm),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndtm)));
+	if (tb[NDTA_THRESH3] == NULL)
+		return 0;
+	if (ndtm->ndtm_family == AF_INET)
+		nw.thresh3[0] = rta_getattr_u32(tb[NDTA_THRESH3]);
+	else if (ndtm->ndtm_family == AF_INET6)
+		nw.thresh3[1] = rta_getattr_u32(tb[NDTA_THRESH3]);
+	return 0;
+}
+
+static int neigh_watch_dump(void)
+{
+	int ret = 0;
+
+	nw.baseline = 1;
+	if (rtnl_wilddump_request(&rth, filter.family, RTM_GETNEIGH) < 0) {
+		perror("Cannot send dump request");
+		ret = -1;
+	} else if (rtnl_dump_filter(&rth, neigh_watch_entry, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		ret = -1;
+	}
+	nw.baseline = 0;
+	return ret;
+}
+
+static void neigh_watch_print(double now)
+{
+	double elapsed = now - nw.last;
+	unsigned total[2] = { 0, 0 };
+	struct neigh_sum **v;
+	char tbuf[32];
+	time_t t = time(NULL);
+	int i;
+
+	v = neigh_sum_sorted();
+	if (v == NULL)
+		return;
+	strftime(tbuf, sizeof(tbuf), "%H:%M:%S", localtime(&t));
+	for (i = 0; i < neigh_nsums; i++) {
+		struct neigh_sum *s = v[i];
+
+		/* Permanent entries are not collected, nor limited */
+		if (s->family == AF_INET)
+			total[0] += s->entries - s->count[NEIGH_PERMANENT];
+		else if (s->family == AF_INET6)
+			total[1] += s->entries - s->count[NEIGH_PERMANENT];
+		if (s->entries == 0 && s->added == 0 && s->deleted == 0)
+			continue;
+		printf("%s ", tbuf);
+		neigh_sum_print(stdout, s);
+		printf(" new %.1f/s del %.1f/s changed %.1f/s failed %.1f/s\n",
+		       s->added / elapsed, s->deleted / elapsed,
+		       s->changed / elapsed, s->failed / elapsed);
+		s->all_added += s->added;
+		s->all_deleted += s->deleted;
+		s->all_changed += s->changed;
+		s->all_failed += s->failed;
+		s->added = s->deleted = s->changed = s->failed = 0;
+	}
+	for (i = 0; i < 2; i++) {
+		if (nw.thresh3[i] == 0 ||
+		    (filter.family && filter.family != (i ? AF_INET6 : AF_INET)))
+			continue;
+		printf("%s %-5s gc_entries %u/%u%s\n", tbuf,
+		       i ? "inet6" : "inet", total[i], nw.thresh3[i],
+		       total[i] >= nw.thresh3[i] ? " !" : "");
+	}
+	if (neigh_nsums > 1)
+		printf("\n");
+	fflush(stdout);
+	free(v);
+	nw.last = now;
+	nw.rounds++;
+}
+
+static int neigh_watch_tick(void)
+{
+	double now;
+
+	if (neigh_watch_stop)
+		return -1;
+	now = neigh_now();
+	if (now < nw.next)
+		return 0;
+	neigh_watch_print(now);
+	while (nw.next <= now)
+		nw.next += nw.interval;
+	return nw.count && nw.rounds >= nw.count ? -1 : 0;
+}
+
+static int neigh_watch_msg(const struct sockaddr_nl *who,
+			   struct nlmsghdr *n, void *arg)
+{
+	if (neigh_watch_entry(who, n, arg) < 0)
+		return -1;
+	return neigh_watch_tick();
+}
+
+static int neigh_watch_idle(void *arg)
+{
+	return neigh_watch_tick();
+}
+
+/* Events were lost: start over from a dump, keeping the churn counted */
+static int neigh_watch_resync(void *arg)
+{
+	struct neigh_sum **v;
+	int i;
+
+	v = neigh_sum_sorted();
+	if (v == NULL)
+		return -1;
+	for (i = 0; i < neigh_nsums; i++) {
+		memset(v[i]->count, 0, sizeof(v[i]->count));
+		v[i]->entries = 0;
+	}
+	free(v);
+	neigh_ent_free();
+	nw.resyncs++;
+	return neigh_watch_dump();
+}
+
+static int ipneigh_watch(int argc, char **argv)
+{
+	char *filter_dev = NULL;
+	struct neigh_sum **v;
+	struct sigaction sa;
+	int i;
+
+	ipneigh_reset_filter();
+	filter.family = preferred_family;
+	memset(&nw, 0, sizeof(nw));
+	nw.interval = 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (filter_dev)
+				duparg("dev", *argv);
+			filter_dev = *argv;
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&nw.interval, *argv, 0) ||
+			    nw.interval == 0)
+				invarg("\"interval\" value is invalid\n", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&nw.count, *argv, 0))
+				invarg("\"count\" value is invalid\n", *argv);
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else
+			invarg("unknown watch option\n", *argv);
+		argc--; argv++;
+	}
+
+	ll_init_map(&rth);
+	if (filter_dev && (filter.index = ll_name_to_index(filter_dev)) == 0) {
+		fprintf(stderr, "Cannot find device \"%s\"\n", filter_dev);
+		return -1;
+	}
+
+	nw.ents = calloc(NEIGH_ENT_HASH, sizeof(*nw.ents));
+	if (nw.ents == NULL) {
+		perror("Cannot allocate neighbour table");
+		return 1;
+	}
+
+	/* Subscribe first, so that nothing between dump and listen is lost */
+	if (rtnl_open(&nw.rth, nl_mgrp(RTNLGRP_NEIGH)) < 0)
+		return 1;
+
+	if (rtnl_wilddump_request(&rth, filter.family, RTM_GETNEIGHTBL) < 0 ||
+	    rtnl_dump_filter(&rth, neigh_watch_thresh, NULL) < 0)
+		fprintf(stderr, "Cannot read the neighbour table thresholds\n");
+	if (neigh_watch_dump() < 0)
+		return 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = neigh_watch_sig;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	nw.start = nw.last = neigh_now();
+	nw.next = nw.start + nw.interval;
+	nw.rth.idle = neigh_watch_idle;
+	nw.rth.idle_timeout = NEIGH_WATCH_IDLE;
+	nw.rth.resync = neigh_watch_resync;
+	rtnl_listen(&nw.rth, neigh_watch_msg, NULL);
+	rtnl_close(&nw.rth);
+
+	if (nw.rounds > 0) {
+		printf("%s--- %u interval%s of %us", neigh_nsums > 1 ? "" : "\n",
+		       nw.rounds, nw.rounds > 1 ? "s" : "", nw.interval);
+		if (nw.resyncs)
+			printf(", %d resync%s after lost events", nw.resyncs,
+			       nw.resyncs > 1 ? "s" : "");
+		printf(" ---\n");
+		v = neigh_sum_sorted();
+		for (i = 0; v && i < neigh_nsums; i++) {
+			struct neigh_sum *s = v[i];
+
+			printf("dev %s %s peak entries %u new %llu del %llu "
+			       "changed %llu failed %llu\n",
+			       ll_index_to_name(s->ifindex),
+			       neigh_family(s->family), s->peak,
+			       s->all_added + s->added,
+			       s->all_deleted + s->deleted,
+			       s->all_changed + s->changed,
+			       s->all_failed + s->failed);
+		}
+		free(v);
+	}
+	neigh_ent_free();
+	free(nw.ents);
+	neigh_sum_free();
+	return 0;
+}
+
+int do_show_or_flush(int argc, char **argv, int action)
 {
 	char *filter_dev = NULL;
 	int state_given = 0;
+	int fast = 0;
+	int flush = action == IPNEIGH_FLUSH;
+	int save_flags = 0;
 	struct ndmsg ndm = { 0 };
 
 	ipneigh_reset_filter();
@@ -326,12 +1300,14 @@ int do_show_or_flush(int argc, char **argv, int flush)
 		filter.family = preferred_family;
 
 	if (flush) {
-		if (argc <= 0) {
+		if (argc <= 0 || (argc == 1 && strcmp(*argv, "fast") == 0)) {
 			fprintf(stderr, "Flush requires arguments.\n");
 			return -1;
 		}
 		filter.state = ~(NUD_PERMANENT|NUD_NOARP);
-	} else
+	} else if (action == IPNEIGH_SUMMARY)
+		filter.state = ~0;
+	else
 		filter.state = 0xFF & ~NUD_NOARP;
 
 	while (argc > 0) {
@@ -361,6 +1337,11 @@ int do_show_or_flush(int argc, char **argv, int flush)
 			filter.state |= state;
 		} else if (strcmp(*argv, "proxy") == 0)
 			ndm.ndm_flags = NTF_PROXY;
+		else if (flush && strcmp(*argv, "fast") == 0)
+			fast = 1;
+		else if (action == IPNEIGH_SAVE &&
+			 strcmp(*argv, "compress") == 0)
+			save_flags |= RTSAVE_F_ZLIB;
 		else {
 			if (strcmp(*argv, "to") == 0) {
 				NEXT_ARG();
@@ -386,14 +1367,18 @@ int do_show_or_flush(int argc, char **argv, int flush)
 	if (flush) {
 		int round = 0;
 		char flushb[4096-512];
+		struct ndmsg fndm = { .ndm_family = filter.family };
 
 		filter.flushb = flushb;
 		filter.flushp = 0;
 		filter.flushe = sizeof(flushb);
 		filter.state &= ~NUD_FAILED;
 
+		if (fast)
+			return ipneigh_flush_fast(&fndm, sizeof(flushb));
+
 		while (round < MAX_ROUNDS) {
-			if (rtnl_wilddump_request(&rth, filter.family, RTM_GETNEIGH) < 0) {
+			if (ipneigh_dump_request(&fndm) < 0) {
 				perror("Cannot send dump request");
 				exit(1);
 			}
@@ -427,12 +1412,73 @@ int do_show_or_flush(int argc, char **argv, int flush)
 
 	ndm.ndm_family = filter.family;
 
-	if (rtnl_dump_request(&rth, RTM_GETNEIGH, &ndm, sizeof(struct ndmsg)) < 0) {
+	if (action == IPNEIGH_SAVE) {
+		int ret = 0;
+
+		/* Entries still being resolved cannot be added back */
+		filter.state &= ~(NUD_INCOMPLETE|NUD_FAILED);
+		filter.save = 1;
+		if (rtsave_begin(save_flags) < 0)
+			return 1;
+		if (ipneigh_dump_request(&ndm) < 0) {
+			perror("Cannot send dump request");
+			ret = 1;
+		} else if (rtnl_dump_filter(&rth, print_neigh, NULL) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = 1;
+		}
+		if (rtsave_end() < 0)
+			ret = 1;
+		return ret;
+	}
+
+	if (action == IPNEIGH_SUMMARY) {
+		struct neigh_sum **v;
+		int i;
+
+		filter.summary = 1;
+		if (ipneigh_dump_request(&ndm) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
+		if (rtnl_dump_filter(&rth, print_neigh, NULL) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			exit(1);
+		}
+		v = neigh_sum_sorted();
+		if (v == NULL) {
+			perror("Cannot sort neighbour summary");
+			return 1;
+		}
+		for (i = 0; i < neigh_nsums; i++) {
+			neigh_sum_print(stdout, v[i]);
+			printf("\n");
+		}
+		free(v);
+		neigh_sum_free();
+		return 0;
+	}
+
+	if (resolve_hosts && !dump_capture) {
+		/* Throwaway pass so that all names resolve in parallel. */
+		FILE *fp = fopen("/dev/null", "w");
+
+		if (fp) {
+			resolve_prefetch = 1;
+			if (ipneigh_dump_request(&ndm) >= 0)
+				rtnl_dump_filter(&rth, print_neigh, fp);
+			fclose(fp);
+			resolve_flush();
+		}
+	}
+
+	if (ipneigh_dump_request(&ndm) < 0) {
 		perror("Cannot send dump request");
 		exit(1);
 	}
 
-	if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_neigh,
+			     stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		exit(1);
 	}
@@ -459,13 +1505,23 @@ int do_ipneigh(int argc, char **argv)
 		if (matches(*argv, "show") == 0 ||
 		    matches(*argv, "lst") == 0 ||
 		    matches(*argv, "list") == 0)
-			return do_show_or_flush(argc-1, argv+1, 0);
+			return do_show_or_flush(argc-1, argv+1, IPNEIGH_SHOW);
 		if (matches(*argv, "flush") == 0)
-			return do_show_or_flush(argc-1, argv+1, 1);
+			return do_show_or_flush(argc-1, argv+1, IPNEIGH_FLUSH);
+		if (matches(*argv, "save") == 0)
+			return do_show_or_flush(argc-1, argv+1, IPNEIGH_SAVE);
+		if (matches(*argv, "restore") == 0)
+			return ipneigh_restore(argc-1, argv+1);
+		if (matches(*argv, "summary") == 0)
+			return do_show_or_flush(argc-1, argv+1, IPNEIGH_SUMMARY);
+		if (matches(*argv, "watch") == 0)
+			return ipneigh_watch(argc-1, argv+1);
+		if (matches(*argv, "bulk") == 0)
+			return ipneigh_bulk(argc-1, argv+1);
 		if (matches(*argv, "help") == 0)
 			usage();
 	} else
-		return do_show_or_flush(0, NULL, 0);
+		return do_show_or_flush(0, NULL, IPNEIGH_SHOW);
 
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip neigh help\".\n", *argv);
 	exit(-1);
@@ -6,39 +6,29 @@
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/syscall.h>
+#include <sys/poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sched.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <errno.h>
 #include <unistd.h>
+#include <limits.h>
+#include <net/if.h>
+#include <time.h>
+#include <linux/net_namespace.h>
 
 #include "utils.h"
 #include "ip_common.h"
-
-#define NETNS_RUN_DIR "/var/run/netns"
-#define NETNS_ETC_DIR "/etc/netns"
-
-#ifndef CLONE_NEWNET
-#define CLONE_NEWNET 0x40000000	/* New network namespace (lo, device, names sockets, etc) */
-#endif
+#include "ll_map.h"
+#include "namespace.h"
 
 #ifndef MNT_DETACH
 #define MNT_DETACH	0x00000002	/* Just detach from the tree */
 #endif /* MNT_DETACH */
 
-#ifndef HAVE_SETNS
-static int setns(int fd, int nstype)
-{
-#ifdef __NR_setns
-	return syscall(__NR_setns, fd, nstype);
-#else
-	errno = ENOSYS;
-	return -1;
-#endif
-}
-#endif /* HAVE_SETNS */
 
 
 static void usage(void) __attribute__((noreturn));
@@ -49,7 +39,11 @@ static void usage(void)
 	fprintf(stderr, "       ip netns add NAME\n");
 	fprintf(stderr, "       ip netns delete NAME\n");
 	fprintf(stderr, "       ip netns exec NAME cmd ...\n");
-	fprintf(stderr, "       ip netns monitor\n");
+	fprintf(stderr, "       ip -all netns exec [ jobs N ] cmd ...\n");
+	fprintf(stderr, "       ip netns switch [ NAME ]   (in batch mode)\n");
+	fprintf(stderr, "       ip netns inventory [ jobs N ]\n");
+	fprintf(stderr, "       ip netns peers\n");
+	fprintf(stderr, "       ip netns monitor [ id ] [ batch MSEC ] [ exec [ jobs N ] cmd ... ]\n");
 	exit(-1);
 }
 
@@ -68,6 +62,135 @@ int get_netns_fd(const char *name)
 	return open(path, O_RDONLY);
 }
 
+/* The nsid the namespace open at fd has where h is, -1 if none */
+static int netns_id_fd(struct rtnl_handle *h, int fd)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct rtgenmsg		g;
+		char			buf[1024];
+	} req;
+	struct rtattr *tb[NETNSA_MAX + 1];
+	int len;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETNSID;
+	req.g.rtgen_family = AF_UNSPEC;
+	addattr32(&req.n, sizeof(req), NETNSA_FD, fd);
+
+	if (rtnl_talk(h, &req.n, 0, 0, &req.n) < 0 ||
+	    req.n.nlmsg_type != RTM_NEWNSID)
+		return -1;
+
+	len = req.n.nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct rtgenmsg)));
+	if (len < 0)
+		return -1;
+	parse_rtattr(tb, NETNSA_MAX, (struct rtattr *)
+		     ((char *)NLMSG_DATA(&req.n) +
+		      NLMSG_ALIGN(sizeof(struct rtgenmsg))), len);
+	if (tb[NETNSA_NSID] == NULL)
+		return -1;
+	return (int)rta_getattr_u32(tb[NETNSA_NSID]);
+}
+
+/* The nsid this namespace has here, -1 if it has none or on errors */
+int get_netns_id(const char *name)
+{
+	int fd, ret;
+
+	fd = get_netns_fd(name);
+	if (fd < 0)
+		return -1;
+	ret = netns_id_fd(&rth, fd);
+	close(fd);
+	return ret;
+}
+
+/*
+ * The names of the nsids that IFLA_LINK_NETNSID refers to.  They are
+ * looked up once, on a socket of their own since the caller is in the
+ * middle of a dump, and kept sorted until the namespace changes.
+ */
+struct netns_id_name {
+	int	nsid;
+	char	name[NAME_MAX + 1];
+};
+
+static struct netns_id_name *netns_ids;
+static int netns_nids = -1;
+
+static int netns_id_cmp(const void *a, const void *b)
+{
+	const struct netns_id_name *x = a, *y = b;
+
+	return x->nsid - y->nsid;
+}
+
+static void netns_ids_load(void)
+{
+	struct rtnl_handle h;
+	struct dirent *entry;
+	int max = 0, fd, id;
+	DIR *dir;
+
+	netns_nids = 0;
+	dir = opendir(NETNS_RUN_DIR);
+	if (!dir)
+		return;
+	if (rtnl_open(&h, 0) < 0) {
+		closedir(dir);
+		return;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+		fd = get_netns_fd(entry->d_name);
+		if (fd < 0)
+			continue;
+		id = netns_id_fd(&h, fd);
+		close(fd);
+		if (id < 0)
+			continue;
+		if (netns_nids == max) {
+			void *p;
+
+			max = max ? max * 2 : 16;
+			p = realloc(netns_ids, max * sizeof(*netns_ids));
+			if (p == NULL)
+				break;
+			netns_ids = p;
+		}
+		netns_ids[netns_nids].nsid = id;
+		strcpy(netns_ids[netns_nids].name, entry->d_name);
+		netns_nids++;
+	}
+	rtnl_close(&h);
+	closedir(dir);
+	qsort(netns_ids, netns_nids, sizeof(*netns_ids), netns_id_cmp);
+}
+
+const char *netns_id_n2a(int nsid)
+{
+	struct netns_id_name key, *e;
+
+	if (netns_nids < 0)
+		netns_ids_load();
+	key.nsid = nsid;
+	e = bsearch(&key, netns_ids, netns_nids, sizeof(*netns_ids),
+		    netns_id_cmp);
+	return e ? e->name : NULL;
+}
+
+void netns_ids_flush(void)
+{
+	free(netns_ids);
+	netns_ids = NULL;
+	netns_nids = -1;
+}
+
 static int netns_list(int argc, char **argv)
 {
 	struct dirent *entry;
@@ -116,14 +239,40 @@ static void bind_etc(const char *name)
 	closedir(dir);
 }
 
+/* Setup the proper environment for apps that are not netns
+ * aware; with sysfs unset /sys is left as it is.
+ */
+static int netns_enter(const char *name, int sysfs)
+{
+	if (netns_set(name) < 0)
+		return -1;
+
+	if (unshare(CLONE_NEWNS) < 0) {
+		fprintf(stderr, "unshare failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (!sysfs)
+		goto etc;
+
+	/* Mount a version of /sys that describes the network namespace */
+	if (umount2("/sys", MNT_DETACH) < 0) {
+		fprintf(stderr, "umount of /sys failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (mount(name, "/sys", "sysfs", 0, NULL) < 0) {
+		fprintf(stderr, "mount of /sys failed: %s\n",strerror(errno));
+		return -1;
+	}
+
+etc:
+	/* Setup bind mounts for config files in /etc */
+	bind_etc(name);
+	return 0;
+}
+
 static int netns_exec(int argc, char **argv)
 {
-	/* Setup the proper environment for apps that are not netns
-	 * aware, and execute a program in that environment.
-	 */
 	const char *name, *cmd;
-	char net_path[MAXPATHLEN];
-	int netns;
 
 	if (argc < 1) {
 		fprintf(stderr, "No netns name specified\n");
@@ -135,40 +284,407 @@ static int netns_exec(int argc, char **argv)
 	}
 	name = argv[0];
 	cmd = argv[1];
-	snprintf(net_path, sizeof(net_path), "%s/%s", NETNS_RUN_DIR, name);
-	netns = open(net_path, O_RDONLY);
-	if (netns < 0) {
-		fprintf(stderr, "Cannot open network namespace: %s\n",
-			strerror(errno));
+	if (netns_enter(name, 1) < 0)
+		return -1;
+
+	if (execvp(cmd, argv + 1)  < 0)
+		fprintf(stderr, "exec of %s failed: %s\n",
+			cmd, strerror(errno));
+	exit(-1);
+}
+
+/*
+ * ip -all netns exec runs the command in every namespace of
+ * NETNS_RUN_DIR through netns_foreach(), every line of its output
+ * prefixed with the namespace it came from.
+ *
+ * Our own tools talk netlink and do not look at /sys, so it is only
+ * remounted for other commands (and ip tuntap).  ip itself is not even
+ * exec()ed: the child runs the command line in-process on a fresh
+ * rtnetlink socket.
+ */
+struct netns_cmd {
+	int	argc;
+	char	**argv;
+};
+
+static int netns_cmd_is_ip(int argc, char **argv)
+{
+	const char *base = strrchr(argv[0], '/');
+
+	base = base ? base + 1 : argv[0];
+	return strcmp(base, "ip") == 0 && argc > 1 && argv[1][0] != '-';
+}
+
+static int netns_cmd_needs_sysfs(int argc, char **argv)
+{
+	static const char *own[] = { "ip", "tc", "ss", "bridge" };
+	const char *base = strrchr(argv[0], '/');
+	int i;
+
+	base = base ? base + 1 : argv[0];
+	for (i = 0; i < ARRAY_SIZE(own); i++)
+		if (strcmp(base, own[i]) == 0)
+			break;
+	if (i == ARRAY_SIZE(own))
+		return 1;
+
+	for (i = 1; i < argc; i++)
+		if (argv[i][0] != '-')
+			return strcmp(base, "ip") == 0 &&
+			       matches(argv[i], "tuntap") == 0;
+	return 0;
+}
+
+/* In the child of netns_foreach(): a fresh socket for the namespace */
+static int netns_reopen(void)
+{
+	rtnl_close(&rth);
+	if (rtnl_open(&rth, 0) < 0)
+		return -1;
+	ll_map_flush();
+	return 0;
+}
+
+static int netns_exec_one(const char *name, void *arg)
+{
+	struct netns_cmd *cmd = arg;
+	int argc = cmd->argc;
+	char **argv = cmd->argv;
+
+	if (netns_enter(name, netns_cmd_needs_sysfs(argc, argv)) < 0)
 		return -1;
+
+	if (netns_cmd_is_ip(argc, argv)) {
+		if (netns_reopen() < 0)
+			return 1;
+		return do_cmd(argv[1], argc - 1, argv + 1);
 	}
-	if (setns(netns, CLONE_NEWNET) < 0) {
-		fprintf(stderr, "seting the network namespace failed: %s\n",
-			strerror(errno));
+	execvp(argv[0], argv);
+	fprintf(stderr, "exec of %s failed: %s\n",
+		argv[0], strerror(errno));
+	return -1;
+}
+
+static int netns_get_jobs(int *argcp, char ***argvp)
+{
+	int argc = *argcp;
+	char **argv = *argvp;
+	int njobs = 0;
+
+	if (argc > 0 && matches(*argv, "jobs") == 0) {
+		NEXT_ARG();
+		if (get_integer(&njobs, *argv, 0) || njobs <= 0 ||
+		    njobs > NETNS_JOBS_MAX)
+			invarg("invalid number of jobs", *argv);
+		argc--; argv++;
+	}
+	*argcp = argc;
+	*argvp = argv;
+	return njobs;
+}
+
+static int netns_exec_all(int argc, char **argv)
+{
+	struct netns_cmd cmd;
+	int njobs = netns_get_jobs(&argc, &argv);
+
+	if (argc < 1) {
+		fprintf(stderr, "No cmd specified\n");
 		return -1;
 	}
+	cmd.argc = argc;
+	cmd.argv = argv;
+	return netns_foreach(njobs, netns_exec_one, &cmd);
+}
 
-	if (unshare(CLONE_NEWNS) < 0) {
-		fprintf(stderr, "unshare failed: %s\n", strerror(errno));
+/*
+ * ip netns inventory: the links with their addresses and the routes of
+ * every table, IPv4 and IPv6, of all the namespaces at once.  There is
+ * nothing to bind mount, so the children only setns() and dump.
+ */
+static int netns_inventory_one(const char *name, void *arg)
+{
+	static char *addr[] = { "address", "show", NULL };
+	static char *route[] = { "route", "show", "table", "all", NULL };
+
+	if (netns_set(name) < 0 || netns_reopen() < 0)
+		return -1;
+
+	preferred_family = AF_UNSPEC;
+	if (do_cmd(addr[0], 2, addr))
+		return 1;
+	fflush(stdout);
+	/* Without a family "table all" is a dump of both of them */
+	return do_cmd(route[0], 4, route);
+}
+
+static int netns_inventory(int argc, char **argv)
+{
+	int njobs = netns_get_jobs(&argc, &argv);
+
+	if (argc > 0) {
+		fprintf(stderr, "Unknown argument \"%s\", try \"ip netns help\".\n",
+			*argv);
 		return -1;
 	}
-	/* Mount a version of /sys that describes the network namespace */
-	if (umount2("/sys", MNT_DETACH) < 0) {
-		fprintf(stderr, "umount of /sys failed: %s\n", strerror(errno));
+	return netns_foreach(njobs, netns_inventory_one, NULL);
+}
+
+/*
+ * ip netns peers: both ends of every veth of this and all named
+ * namespaces.  The links are dumped once per namespace and hashed on
+ * (ifindex, peer ifindex), so the other end of a link is one lookup of
+ * the swapped pair away.  Indexes repeat from one namespace to the
+ * next, so a candidate in another namespace is taken only if it is the
+ * one IFLA_LINK_NETNSID names, which is asked from inside the
+ * namespace of the link in a second round.
+ */
+struct netns_link {
+	int	ns;
+	int	ifindex;
+	int	iflink;
+	int	nsid;		/* of the peer's namespace, -1: this one */
+	int	peer;		/* the other end, -1: not found */
+	int	next;		/* in the hash chain */
+	char	name[IFNAMSIZ];
+};
+
+struct netns_peers {
+	char			(*names)[NAME_MAX + 1];
+	int			nns;
+	struct netns_link	*links;
+	int			nlinks, max;
+	int			cur;
+};
+
+static unsigned netns_link_hash(int ifindex, int iflink, unsigned mask)
+{
+	return ((unsigned)ifindex * 2654435761U ^ (unsigned)iflink) & mask;
+}
+
+static int netns_peers_store(const struct sockaddr_nl *who,
+			     struct nlmsghdr *n, void *arg)
+{
+	struct netns_peers *p = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+	struct netns_link *l;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	if (tb[IFLA_LINK] == NULL || tb[IFLA_IFNAME] == NULL ||
+	    tb[IFLA_LINKINFO] == NULL)
+		return 0;
+	parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+	if (linkinfo[IFLA_INFO_KIND] == NULL ||
+	    strcmp(rta_getattr_str(linkinfo[IFLA_INFO_KIND]), "veth"))
+		return 0;
+
+	if (p->nlinks == p->max) {
+		int max = p->max ? p->max * 2 : 256;
+		void *q = realloc(p->links, max * sizeof(*p->links));
+
+		if (q == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(-1);
+		}
+		p->links = q;
+		p->max = max;
+	}
+	l = &p->links[p->nlinks++];
+	l->ns = p->cur;
+	l->ifindex = ifi->ifi_index;
+	l->iflink = rta_getattr_u32(tb[IFLA_LINK]);
+	l->nsid = tb[IFLA_LINK_NETNSID] ?
+		  (int)rta_getattr_u32(tb[IFLA_LINK_NETNSID]) : -1;
+	l->peer = -1;
+	strncpy(l->name, rta_getattr_str(tb[IFLA_IFNAME]), IFNAMSIZ - 1);
+	l->name[IFNAMSIZ - 1] = 0;
+	return 0;
+}
+
+static int netns_peers_enter(struct netns_peers *p, int self, int i)
+{
+	int fd;
+
+	if (i == 0)
+		return setns(self, CLONE_NEWNET);
+	fd = get_netns_fd(p->names[i]);
+	if (fd < 0)
+		return -1;
+	if (setns(fd, CLONE_NEWNET) < 0) {
+		close(fd);
 		return -1;
 	}
-	if (mount(name, "/sys", "sysfs", 0, NULL) < 0) {
-		fprintf(stderr, "mount of /sys failed: %s\n",strerror(errno));
+	close(fd);
+	return 0;
+}
+
+static int netns_peers(int argc, char **argv)
+{
+	struct netns_peers p;
+	struct rtnl_handle h;
+	struct dirent *entry;
+	struct stat st, self_st;
+	unsigned mask;
+	int *hash;
+	int self, i, j, k, first;
+	DIR *dir;
+
+	if (argc > 0) {
+		fprintf(stderr, "Unknown argument \"%s\", try \"ip netns help\".\n",
+			*argv);
 		return -1;
 	}
 
-	/* Setup bind mounts for config files in /etc */
-	bind_etc(name);
+	self = open("/proc/self/ns/net", O_RDONLY);
+	if (self < 0 || fstat(self, &self_st) < 0) {
+		fprintf(stderr, "Cannot open the current network namespace: %s\n",
+			strerror(errno));
+		return -1;
+	}
 
-	if (execvp(cmd, argv + 1)  < 0)
-		fprintf(stderr, "exec of %s failed: %s\n",
-			cmd, strerror(errno));
-	exit(-1);
+	memset(&p, 0, sizeof(p));
+	p.names = malloc(sizeof(*p.names));
+	if (p.names == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+	strcpy(p.names[p.nns++], ".");
+
+	dir = opendir(NETNS_RUN_DIR);
+	while (dir && (entry = readdir(dir)) != NULL) {
+		char path[MAXPATHLEN];
+		void *q;
+
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+		/* Already listed as the one we are in */
+		snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR,
+			 entry->d_name);
+		if (stat(path, &st) == 0 && st.st_dev == self_st.st_dev &&
+		    st.st_ino == self_st.st_ino)
+			continue;
+		q = realloc(p.names, (p.nns + 1) * sizeof(*p.names));
+		if (q == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(-1);
+		}
+		p.names = q;
+		strcpy(p.names[p.nns++], entry->d_name);
+	}
+	if (dir)
+		closedir(dir);
+
+	/* Round one: the veths of every namespace */
+	for (i = 0; i < p.nns; i++) {
+		if (netns_peers_enter(&p, self, i) < 0) {
+			fprintf(stderr, "%s: cannot enter: %s\n", p.names[i],
+				strerror(errno));
+			continue;
+		}
+		if (rtnl_open(&h, 0) < 0)
+			continue;
+		p.cur = i;
+		if (rtnl_wilddump_request(&h, AF_UNSPEC, RTM_GETLINK) < 0 ||
+		    rtnl_dump_filter(&h, netns_peers_store, &p) < 0)
+			fprintf(stderr, "%s: cannot dump links\n", p.names[i]);
+		rtnl_close(&h);
+	}
+
+	for (mask = 1; mask < 2 * p.nlinks; mask <<= 1)
+		;
+	mask--;
+	hash = malloc((mask + 1) * sizeof(int));
+	if (hash == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+	memset(hash, 0xff, (mask + 1) * sizeof(int));
+	for (i = 0; i < p.nlinks; i++) {
+		struct netns_link *l = &p.links[i];
+		unsigned b = netns_link_hash(l->ifindex, l->iflink, mask);
+
+		l->next = hash[b];
+		hash[b] = i;
+	}
+
+	/* Round two: match, asking each namespace what its nsids are */
+	for (first = 0; first < p.nlinks; first = k) {
+		int ns = p.links[first].ns, open = 0;
+
+		for (k = first; k < p.nlinks && p.links[k].ns == ns; k++)
+			;
+		for (i = first; i < k; i++) {
+			struct netns_link *l = &p.links[i];
+
+			if (l->peer >= 0)
+				continue;
+			j = hash[netns_link_hash(l->iflink, l->ifindex, mask)];
+			for (; j >= 0; j = p.links[j].next) {
+				struct netns_link *c = &p.links[j];
+				int fd, id;
+
+				if (c->ifindex != l->iflink ||
+				    c->iflink != l->ifindex || c->peer >= 0)
+					continue;
+				if (l->nsid < 0) {
+					if (c->ns != l->ns)
+						continue;
+				} else {
+					if (c->ns == l->ns)
+						continue;
+					if (!open) {
+						if (netns_peers_enter(&p, self, ns) < 0 ||
+						    rtnl_open(&h, 0) < 0)
+							break;
+						open = 1;
+					}
+					fd = c->ns ? get_netns_fd(p.names[c->ns]) :
+						     dup(self);
+					if (fd < 0)
+						continue;
+					id = netns_id_fd(&h, fd);
+					close(fd);
+					if (id != l->nsid)
+						continue;
+				}
+				l->peer = j;
+				c->peer = i;
+				break;
+			}
+		}
+		if (open)
+			rtnl_close(&h);
+	}
+	setns(self, CLONE_NEWNET);
+	close(self);
+
+	for (i = 0; i < p.nlinks; i++) {
+		struct netns_link *l = &p.links[i];
+
+		if (l->peer >= 0 && l->peer < i)
+			continue;
+		printf("%s %s <-> ", p.names[l->ns], l->name);
+		if (l->peer >= 0)
+			printf("%s %s\n", p.names[p.links[l->peer].ns],
+			       p.links[l->peer].name);
+		else if (l->nsid >= 0)
+			printf("nsid %d ifindex %d\n", l->nsid, l->iflink);
+		else
+			printf("ifindex %d\n", l->iflink);
+	}
+
+	free(hash);
+	free(p.links);
+	free(p.names);
+	return 0;
 }
 
 static int netns_delete(int argc, char **argv)
@@ -245,6 +761,379 @@ out_delete:
 }
 
 
+/*
+ * ip netns monitor with options keeps a table of the namespaces it has
+ * seen, so that it can tell who went away by inode and nsid, and
+ * handles the events of a burst together: within a batch interval an
+ * add and a delete of the same name cancel out.  A name is reported as
+ * added only once the namespace is bind mounted on it, which
+ * "ip netns add" does a moment after the file shows up.  The hook
+ * command runs once per reported event, up to "jobs" of them at a
+ * time; the events behind them wait in a queue.
+ */
+#define NETNS_MON_HASH	256
+
+struct netns_ent {
+	struct netns_ent *next;
+	struct netns_ent *dirty_next;
+	int		dirty;
+	int		reported;
+	ino_t		ino;
+	int		nsid;
+	char		name[NAME_MAX + 1];
+};
+
+struct netns_hook {
+	struct netns_hook *next;
+	pid_t		pid;
+	int		add;
+	ino_t		ino;
+	int		nsid;
+	char		name[NAME_MAX + 1];
+};
+
+static struct netns_ent *netns_hash[NETNS_MON_HASH];
+static struct netns_ent *netns_dirty, **netns_dirty_tail = &netns_dirty;
+static struct netns_hook *hook_head, **hook_tail = &hook_head;
+static struct netns_hook *hook_running;
+static int hook_nrunning;
+
+static unsigned netns_hashfn(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	return h % NETNS_MON_HASH;
+}
+
+static struct netns_ent *netns_ent_get(const char *name, int create)
+{
+	struct netns_ent **pp = &netns_hash[netns_hashfn(name)];
+	struct netns_ent *e;
+
+	for (e = *pp; e; e = e->next)
+		if (strcmp(e->name, name) == 0)
+			return e;
+	if (!create)
+		return NULL;
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+	strcpy(e->name, name);
+	e->nsid = -1;
+	e->next = *pp;
+	*pp = e;
+	return e;
+}
+
+static void netns_ent_free(struct netns_ent *e)
+{
+	struct netns_ent **pp = &netns_hash[netns_hashfn(e->name)];
+
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+	free(e);
+}
+
+static void netns_ent_dirty(struct netns_ent *e)
+{
+	if (e->dirty)
+		return;
+	e->dirty = 1;
+	e->dirty_next = NULL;
+	*netns_dirty_tail = e;
+	netns_dirty_tail = &e->dirty_next;
+}
+
+/* 1 if a namespace is mounted on name, 0 if not (yet), -1 if no name */
+static int netns_ent_stat(const char *name, dev_t dir_dev, ino_t *ino)
+{
+	char path[MAXPATHLEN];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, name);
+	if (stat(path, &st) < 0)
+		return -1;
+	if (st.st_dev == dir_dev)
+		return 0;
+	*ino = st.st_ino;
+	return 1;
+}
+
+static void netns_hook_queue(struct netns_ent *e, int add)
+{
+	struct netns_hook *h = malloc(sizeof(*h));
+
+	if (h == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+	h->next = NULL;
+	h->add = add;
+	h->ino = e->ino;
+	h->nsid = e->nsid;
+	strcpy(h->name, e->name);
+	*hook_tail = h;
+	hook_tail = &h->next;
+}
+
+static void netns_hook_reap(void)
+{
+	struct netns_hook *h, **pp;
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (pp = &hook_running; (h = *pp) != NULL; pp = &h->next)
+			if (h->pid == pid)
+				break;
+		if (h == NULL)
+			continue;
+		*pp = h->next;
+		hook_nrunning--;
+		if (WIFEXITED(status) && WEXITSTATUS(status))
+			fprintf(stderr, "%s: hook exited with status %d\n",
+				h->name, WEXITSTATUS(status));
+		else if (WIFSIGNALED(status))
+			fprintf(stderr, "%s: hook killed by signal %d\n",
+				h->name, WTERMSIG(status));
+		free(h);
+	}
+}
+
+static void netns_hook_run(int jobs, int argc, char **argv)
+{
+	netns_hook_reap();
+
+	while (hook_head && hook_nrunning < jobs) {
+		struct netns_hook *h = hook_head;
+		char *args[argc + 3];
+		char buf[32];
+
+		hook_head = h->next;
+		if (hook_head == NULL)
+			hook_tail = &hook_head;
+
+		fflush(stdout);
+		h->pid = fork();
+		if (h->pid < 0) {
+			fprintf(stderr, "%s: cannot start hook: %s\n",
+				h->name, strerror(errno));
+			free(h);
+			continue;
+		}
+		if (h->pid == 0) {
+			memcpy(args, argv, argc * sizeof(char *));
+			args[argc] = h->add ? "add" : "delete";
+			args[argc + 1] = h->name;
+			args[argc + 2] = NULL;
+			snprintf(buf, sizeof(buf), "%lu", (unsigned long)h->ino);
+			setenv("NETNS_INODE", buf, 1);
+			snprintf(buf, sizeof(buf), "%d", h->nsid);
+			setenv("NETNS_NSID", buf, 1);
+			execvp(args[0], args);
+			fprintf(stderr, "exec of %s failed: %s\n",
+				args[0], strerror(errno));
+			_exit(-1);
+		}
+		h->next = hook_running;
+		hook_running = h;
+		hook_nrunning++;
+	}
+}
+
+static void netns_mon_print(struct netns_ent *e, int add, int show_id)
+{
+	printf("%s %s", add ? "add" : "delete", e->name);
+	if (show_id) {
+		printf(" inode %lu", (unsigned long)e->ino);
+		if (e->nsid >= 0)
+			printf(" nsid %d", e->nsid);
+	}
+	printf("\n");
+}
+
+/* Report what the dirty entries came to; 1 if some are not mounted yet */
+static int netns_mon_flush(dev_t dir_dev, int show_id, int hook)
+{
+	struct netns_ent *e, *next;
+	ino_t ino;
+
+	e = netns_dirty;
+	netns_dirty = NULL;
+	netns_dirty_tail = &netns_dirty;
+	for (; e; e = next) {
+		next = e->dirty_next;
+		e->dirty = 0;
+		switch (netns_ent_stat(e->name, dir_dev, &ino)) {
+		case 0:
+			netns_ent_dirty(e);
+			continue;
+		case 1:
+			if (e->reported && e->ino == ino)
+				continue;
+			if (e->reported) {
+				/* Deleted and added again within the batch */
+				netns_mon_print(e, 0, show_id);
+				if (hook)
+					netns_hook_queue(e, 0);
+			}
+			e->ino = ino;
+			e->nsid = show_id || hook ? get_netns_id(e->name) : -1;
+			e->reported = 1;
+			netns_mon_print(e, 1, show_id);
+			if (hook)
+				netns_hook_queue(e, 1);
+			continue;
+		default:
+			if (e->reported) {
+				netns_mon_print(e, 0, show_id);
+				if (hook)
+					netns_hook_queue(e, 0);
+			}
+			netns_ent_free(e);
+		}
+	}
+	fflush(stdout);
+	return netns_dirty != NULL;
+}
+
+static long long netns_mon_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int netns_monitor_batch(int fd, int argc, char **argv)
+{
+	int show_id = 0, batch = 0, jobs = 0;
+	char **hook_argv = NULL;
+	int hook_argc = 0;
+	char buf[4096];
+	struct inotify_event *event;
+	struct dirent *entry;
+	struct stat st;
+	long long deadline;
+	DIR *dir;
+
+	while (argc > 0) {
+		if (matches(*argv, "id") == 0) {
+			show_id = 1;
+		} else if (matches(*argv, "batch") == 0) {
+			NEXT_ARG();
+			if (get_integer(&batch, *argv, 0) || batch < 0)
+				invarg("invalid batch interval", *argv);
+		} else if (matches(*argv, "exec") == 0) {
+			NEXT_ARG();
+			if (matches(*argv, "jobs") == 0) {
+				NEXT_ARG();
+				if (get_integer(&jobs, *argv, 0) || jobs <= 0 ||
+				    jobs > NETNS_JOBS_MAX)
+					invarg("invalid number of jobs", *argv);
+				NEXT_ARG();
+			}
+			hook_argc = argc;
+			hook_argv = argv;
+			break;
+		} else {
+			fprintf(stderr, "Unknown argument \"%s\", try \"ip netns help\".\n",
+				*argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+	if (jobs == 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+
+	if (stat(NETNS_RUN_DIR, &st) < 0) {
+		fprintf(stderr, "stat of %s failed: %s\n", NETNS_RUN_DIR,
+			strerror(errno));
+		return -1;
+	}
+
+	/* Know who is there already, so that their deletes carry the id */
+	dir = opendir(NETNS_RUN_DIR);
+	while (dir && (entry = readdir(dir)) != NULL) {
+		struct netns_ent *e;
+
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+		e = netns_ent_get(entry->d_name, 1);
+		if (netns_ent_stat(e->name, st.st_dev, &e->ino) <= 0) {
+			netns_ent_dirty(e);
+			continue;
+		}
+		e->reported = 1;
+		if (show_id || hook_argv)
+			e->nsid = get_netns_id(e->name);
+	}
+	if (dir)
+		closedir(dir);
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	deadline = netns_dirty ? 0 : -1;
+
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		long long now = netns_mon_now();
+		int timeout = -1;
+		ssize_t len;
+
+		if (deadline >= 0)
+			timeout = deadline > now ? deadline - now : 0;
+		else if (hook_nrunning)
+			timeout = 100;
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			return -1;
+		}
+		now = netns_mon_now();
+
+		if (pfd.revents & POLLIN) {
+			len = read(fd, buf, sizeof(buf));
+			if (len < 0) {
+				fprintf(stderr, "read failed: %s\n",
+					strerror(errno));
+				return -1;
+			}
+			for (event = (struct inotify_event *)buf;
+			     (char *)event < &buf[len];
+			     event = (struct inotify_event *)((char *)event + sizeof(*event) + event->len)) {
+				struct netns_ent *e;
+
+				e = netns_ent_get(event->name,
+						  event->mask & IN_CREATE);
+				if (e)
+					netns_ent_dirty(e);
+			}
+			if (netns_dirty && deadline < 0)
+				deadline = now + batch;
+		}
+
+		if (deadline >= 0 && now >= deadline) {
+			deadline = -1;
+			/* Names not mounted yet are looked at again soon */
+			if (netns_mon_flush(st.st_dev, show_id, hook_argv != NULL))
+				deadline = now + (batch > 10 ? batch : 10);
+		}
+		if (hook_argv)
+			netns_hook_run(jobs, hook_argc, hook_argv);
+	}
+	return 0;
+}
+
 static int netns_monitor(int argc, char **argv)
 {
 	char buf[4096];
@@ -261,6 +1150,8 @@ static int netns_monitor(int argc, char **argv)
 			strerror(errno));
 		return -1;
 	}
+	if (argc > 0)
+		return netns_monitor_batch(fd, argc, argv);
 	for(;;) {
 		ssize_t len = read(fd, buf, sizeof(buf));
 		if (len < 0) {
@@ -280,6 +1171,122 @@ static int netns_monitor(int argc, char **argv)
 	return 0;
 }
 
+/*
+ * "netns switch NAME" in a batch moves the whole process into NAME, so
+ * that the following lines configure it without a fork or exec each.
+ * Every namespace visited keeps its own rtnetlink socket for the rest
+ * of the batch; they are told apart by the inode of the namespace,
+ * since several names may be bound to the same one.  Without NAME the
+ * batch returns to the namespace it started in.
+ */
+struct netns_sock {
+	dev_t			dev;
+	ino_t			ino;
+	int			fd;
+	struct rtnl_handle	rth;
+};
+
+static struct netns_sock *netns_socks;
+static int netns_nsocks;
+static int netns_cur;
+
+static int netns_sock_get(int fd)
+{
+	struct netns_sock *ns;
+	struct stat st;
+	int i;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	for (i = 0; i < netns_nsocks; i++) {
+		if (netns_socks[i].dev == st.st_dev &&
+		    netns_socks[i].ino == st.st_ino) {
+			close(fd);
+			return i;
+		}
+	}
+
+	ns = realloc(netns_socks, (netns_nsocks + 1) * sizeof(*ns));
+	if (ns == NULL)
+		return -1;
+	netns_socks = ns;
+	ns = &netns_socks[netns_nsocks];
+	memset(ns, 0, sizeof(*ns));
+	ns->dev = st.st_dev;
+	ns->ino = st.st_ino;
+	ns->fd = fd;
+	ns->rth.fd = -1;
+	return netns_nsocks++;
+}
+
+static int netns_switch(int argc, char **argv)
+{
+	struct netns_sock *ns;
+	int fd, i;
+
+	if (!batch_file) {
+		fprintf(stderr, "\"ip netns switch\" is only valid in batch mode\n");
+		return -1;
+	}
+
+	if (netns_nsocks == 0) {
+		fd = open("/proc/self/ns/net", O_RDONLY);
+		if (fd < 0 || netns_sock_get(fd) < 0) {
+			fprintf(stderr, "Cannot open the current network namespace: %s\n",
+				strerror(errno));
+			return -1;
+		}
+		netns_cur = 0;
+	}
+
+	if (argc > 0) {
+		fd = get_netns_fd(argv[0]);
+		if (fd < 0) {
+			fprintf(stderr, "Cannot open network namespace \"%s\": %s\n",
+				argv[0], strerror(errno));
+			return -1;
+		}
+		i = netns_sock_get(fd);
+		if (i < 0) {
+			fprintf(stderr, "Cannot use network namespace \"%s\": %s\n",
+				argv[0], strerror(errno));
+			close(fd);
+			return -1;
+		}
+	} else {
+		i = 0;
+	}
+	if (i == netns_cur)
+		return 0;
+
+	ns = &netns_socks[i];
+	if (setns(ns->fd, CLONE_NEWNET) < 0) {
+		fprintf(stderr, "seting the network namespace failed: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	/* What is in flight belongs to the namespace we leave */
+	if (rth.pipe)
+		rtnl_pipeline_close(&rth);
+	netns_socks[netns_cur].rth = rth;
+	netns_cur = i;
+
+	if (ns->rth.fd < 0 && rtnl_open(&ns->rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		exit(1);
+	}
+	rth = ns->rth;
+	if (batch_pipeline_open(&rth) < 0)
+		exit(1);
+
+	/* ifindexes, names and nsids mean something else here */
+	ll_map_flush();
+	netns_ids_flush();
+	return 0;
+}
+
 int do_netns(int argc, char **argv)
 {
 	if (argc < 1)
@@ -298,12 +1305,24 @@ int do_netns(int argc, char **argv)
 	if (matches(*argv, "delete") == 0)
 		return netns_delete(argc-1, argv+1);
 
-	if (matches(*argv, "exec") == 0)
+	if (matches(*argv, "exec") == 0) {
+		if (do_all)
+			return netns_exec_all(argc-1, argv+1);
 		return netns_exec(argc-1, argv+1);
+	}
+
+	if (matches(*argv, "peers") == 0)
+		return netns_peers(argc-1, argv+1);
+
+	if (matches(*argv, "inventory") == 0)
+		return netns_inventory(argc-1, argv+1);
 
 	if (matches(*argv, "monitor") == 0)
 		return netns_monitor(argc-1, argv+1);
 
+	if (matches(*argv, "switch") == 0)
+		return netns_switch(argc-1, argv+1);
+
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip netns help\".\n", *argv);
 	exit(-1);
 }
@@ -0,0 +1,509 @@
+/*
+ * ipnexthop.c		"ip nexthop".
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Nexthop objects live in the kernel apart from the routes using them.
+ * A route that names one with "nhid" follows whatever the object says,
+ * so repointing or failing over a nexthop shared by any number of
+ * routes takes a single RTM_NEWNEXTHOP instead of a rewrite of each
+ * route.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/nexthop.h>
+
+#include "rt_names.h"
+#include "utils.h"
+#include "ip_common.h"
+
+#define NHA_RTA(r)	((struct rtattr *)(((char *)(r)) + NLMSG_ALIGN(sizeof(struct nhmsg))))
+
+/* Members of one group, as many as the kernel takes */
+#define NH_GROUP_MAX	256
+
+struct nh_flush
+{
+	__u32	id;
+	int	group;
+};
+
+static struct
+{
+	__u32	id;
+	int	ifindex;
+	int	groups;
+	struct nh_flush *flushb;
+	int	flushp;
+	int	flushe;
+	int	flush_errors;
+} filter;
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: ip nexthop { add | replace } id ID NH [ protocol RTPROTO ]\n");
+	fprintf(stderr, "       ip nexthop { delete | get } id ID\n");
+	fprintf(stderr, "       ip nexthop { list | flush } [ id ID ] [ dev DEV ] [ groups ]\n");
+	fprintf(stderr, "NH := { blackhole | [ via ADDRESS ] [ dev DEV ] [ onlink ] |\n");
+	fprintf(stderr, "        group GROUP }\n");
+	fprintf(stderr, "GROUP := ID[,WEIGHT][/ID[,WEIGHT]]...\n");
+	exit(-1);
+}
+
+static void print_nh_group(FILE *fp, const struct rtattr *rta)
+{
+	const struct nexthop_grp *g = RTA_DATA(rta);
+	int i, n = RTA_PAYLOAD(rta) / sizeof(*g);
+
+	fprintf(fp, "group ");
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%s%u", i ? "/" : "", g[i].id);
+		if (g[i].weight)
+			fprintf(fp, ",%u", g[i].weight + 1);
+	}
+	fprintf(fp, " ");
+}
+
+int print_nexthop(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
+{
+	FILE *fp = (FILE *)arg;
+	struct nhmsg *nhm = NLMSG_DATA(n);
+	int len = n->nlmsg_len;
+	struct rtattr *tb[NHA_MAX+1];
+	char abuf[256];
+	SPRINT_BUF(b1);
+
+	if (n->nlmsg_type != RTM_NEWNEXTHOP && n->nlmsg_type != RTM_DELNEXTHOP)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*nhm));
+	if (len < 0)
+		return -1;
+
+	parse_rtattr(tb, NHA_MAX, NHA_RTA(nhm), len);
+
+	/* The kernel filters for us where it can; older ones did not */
+	if (tb[NHA_ID] == NULL)
+		return 0;
+	if (filter.id && rta_getattr_u32(tb[NHA_ID]) != filter.id)
+		return 0;
+	if (filter.ifindex && (tb[NHA_OIF] == NULL ||
+			       rta_getattr_u32(tb[NHA_OIF]) != filter.ifindex))
+		return 0;
+	if (filter.groups && tb[NHA_GROUP] == NULL)
+		return 0;
+
+	if (filter.flushb) {
+		if (filter.flushp == filter.flushe) {
+			int size = filter.flushe ? 2 * filter.flushe : 256;
+			struct nh_flush *b;
+
+			b = realloc(filter.flushb, size * sizeof(*b));
+			if (b == NULL) {
+				perror("realloc");
+				return -1;
+			}
+			filter.flushb = b;
+			filter.flushe = size;
+		}
+		filter.flushb[filter.flushp].id = rta_getattr_u32(tb[NHA_ID]);
+		filter.flushb[filter.flushp].group = tb[NHA_GROUP] != NULL;
+		filter.flushp++;
+		return 0;
+	}
+
+	if (n->nlmsg_type == RTM_DELNEXTHOP)
+		fprintf(fp, "Deleted ");
+
+	fprintf(fp, "id %u ", rta_getattr_u32(tb[NHA_ID]));
+	if (tb[NHA_GROUP])
+		print_nh_group(fp, tb[NHA_GROUP]);
+	if (tb[NHA_BLACKHOLE])
+		fprintf(fp, "blackhole ");
+	if (tb[NHA_GATEWAY])
+		fprintf(fp, "via %s ",
+			format_host(nhm->nh_family,
+				    RTA_PAYLOAD(tb[NHA_GATEWAY]),
+				    RTA_DATA(tb[NHA_GATEWAY]),
+				    abuf, sizeof(abuf)));
+	if (tb[NHA_OIF])
+		fprintf(fp, "dev %s ",
+			ll_index_to_name(rta_getattr_u32(tb[NHA_OIF])));
+	if (nhm->nh_scope != RT_SCOPE_UNIVERSE)
+		fprintf(fp, "scope %s ",
+			rtnl_rtscope_n2a(nhm->nh_scope, b1, sizeof(b1)));
+	if (nhm->nh_protocol != RTPROT_BOOT &&
+	    nhm->nh_protocol != RTPROT_UNSPEC)
+		fprintf(fp, "proto %s ",
+			rtnl_rtprot_n2a(nhm->nh_protocol, b1, sizeof(b1)));
+	if (nhm->nh_flags & RTNH_F_DEAD)
+		fprintf(fp, "dead ");
+	if (nhm->nh_flags & RTNH_F_ONLINK)
+		fprintf(fp, "onlink ");
+	if (nhm->nh_flags & RTNH_F_LINKDOWN)
+		fprintf(fp, "linkdown ");
+	fprintf(fp, "\n");
+	fflush(fp);
+	return 0;
+}
+
+static int parse_nh_group(struct nlmsghdr *n, int maxlen, const char *arg)
+{
+	struct nexthop_grp grp[NH_GROUP_MAX];
+	char buf[strlen(arg) + 1];
+	int count = 0;
+	char *p, *save;
+
+	/* Batch lines may be run again, so the argument is left alone */
+	strcpy(buf, arg);
+	memset(grp, 0, sizeof(grp));
+	for (p = strtok_r(buf, "/", &save); p; p = strtok_r(NULL, "/", &save)) {
+		char *w = strchr(p, ',');
+		unsigned weight;
+
+		if (count == NH_GROUP_MAX)
+			invarg("too many nexthops in group\n", arg);
+		if (w) {
+			*w++ = '\0';
+			if (get_unsigned(&weight, w, 0) || weight == 0 ||
+			    weight > 256)
+				invarg("\"weight\" is invalid\n", w);
+			grp[count].weight = weight - 1;
+		}
+		if (get_u32(&grp[count].id, p, 0) || grp[count].id == 0)
+			invarg("invalid nexthop id in group\n", p);
+		count++;
+	}
+	if (count == 0)
+		invarg("group needs at least one nexthop\n", "");
+	return addattr_l(n, maxlen, NHA_GROUP, grp, count * sizeof(grp[0]));
+}
+
+static int ipnh_modify(int cmd, unsigned flags, int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct nhmsg	nhm;
+		char		buf[NH_GROUP_MAX * sizeof(struct nexthop_grp) + 256];
+	} req;
+	__u32 id = 0;
+	int have_nh = 0;
+	int group = 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST|flags;
+	req.n.nlmsg_type = cmd;
+	req.nhm.nh_family = preferred_family;
+	if (cmd == RTM_NEWNEXTHOP)
+		req.nhm.nh_protocol = RTPROT_BOOT;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "id") == 0) {
+			NEXT_ARG();
+			if (id)
+				duparg("id", *argv);
+			if (get_u32(&id, *argv, 0) || id == 0)
+				invarg("invalid id\n", *argv);
+			addattr32(&req.n, sizeof(req), NHA_ID, id);
+		} else if (cmd != RTM_NEWNEXTHOP) {
+			invarg("unknown argument\n", *argv);
+		} else if (strcmp(*argv, "via") == 0) {
+			inet_prefix addr;
+
+			NEXT_ARG();
+			get_addr(&addr, *argv, req.nhm.nh_family);
+			if (req.nhm.nh_family == AF_UNSPEC)
+				req.nhm.nh_family = addr.family;
+			addattr_l(&req.n, sizeof(req), NHA_GATEWAY,
+				  &addr.data, addr.bytelen);
+			have_nh = 1;
+		} else if (strcmp(*argv, "dev") == 0) {
+			int ifindex;
+
+			NEXT_ARG();
+			ll_init_map(&rth);
+			ifindex = ll_name_to_index(*argv);
+			if (ifindex == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n",
+					*argv);
+				return -1;
+			}
+			addattr32(&req.n, sizeof(req), NHA_OIF, ifindex);
+			have_nh = 1;
+		} else if (strcmp(*argv, "onlink") == 0) {
+			req.nhm.nh_flags |= RTNH_F_ONLINK;
+		} else if (strcmp(*argv, "blackhole") == 0) {
+			addattr_l(&req.n, sizeof(req), NHA_BLACKHOLE, NULL, 0);
+			have_nh = 1;
+		} else if (strcmp(*argv, "group") == 0) {
+			NEXT_ARG();
+			parse_nh_group(&req.n, sizeof(req), *argv);
+			have_nh = group = 1;
+		} else if (matches(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv))
+				invarg("\"protocol\" value is invalid\n", *argv);
+			req.nhm.nh_protocol = prot;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (id == 0 && cmd != RTM_NEWNEXTHOP) {
+		fprintf(stderr, "Nexthop id is required\n");
+		return -1;
+	}
+	if (cmd == RTM_NEWNEXTHOP && !have_nh) {
+		fprintf(stderr, "Nexthop needs a gateway, a device, a group or \"blackhole\"\n");
+		return -1;
+	}
+	/* Only a group can do without a family */
+	if (cmd == RTM_NEWNEXTHOP && !group && req.nhm.nh_family == AF_UNSPEC)
+		req.nhm.nh_family = AF_INET;
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
+		return -2;
+	return 0;
+}
+
+static int ipnh_get(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct nhmsg	nhm;
+		char		buf[NH_GROUP_MAX * sizeof(struct nexthop_grp) + 256];
+	} req;
+	__u32 id = 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETNEXTHOP;
+	req.nhm.nh_family = preferred_family;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "id") == 0) {
+			NEXT_ARG();
+			if (get_u32(&id, *argv, 0) || id == 0)
+				invarg("invalid id\n", *argv);
+		} else
+			usage();
+		argc--; argv++;
+	}
+	if (id == 0) {
+		fprintf(stderr, "Nexthop id is required\n");
+		return -1;
+	}
+	addattr32(&req.n, sizeof(req), NHA_ID, id);
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, &req.n) < 0)
+		return -2;
+	ll_init_map(&rth);
+	if (print_nexthop(NULL, &req.n, stdout) < 0) {
+		fprintf(stderr, "An error :-)\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int ipnh_dump_request(void)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct nhmsg	nhm;
+		char		buf[64];
+	} req;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+	req.n.nlmsg_type = RTM_GETNEXTHOP;
+	req.nhm.nh_family = preferred_family;
+	if (filter.ifindex)
+		addattr32(&req.n, sizeof(req), NHA_OIF, filter.ifindex);
+	if (filter.groups)
+		addattr_l(&req.n, sizeof(req), NHA_GROUPS, NULL, 0);
+
+	ret = rtnl_dump_request_strict(&rth, &req.n);
+	if (ret != 0)
+		return ret;
+	return rtnl_dump_request(&rth, RTM_GETNEXTHOP, &req.nhm,
+				 sizeof(struct nhmsg));
+}
+
+#define FLUSH_WINDOW	256
+
+static void flush_error(int cookie, int error, void *arg)
+{
+	/* Went away with a group or a device meanwhile */
+	if (error == ENOENT)
+		return;
+	if (filter.flush_errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+}
+
+static int ipnh_flush(void)
+{
+	struct rtnl_handle frth;
+	int pass, i, ret = -1;
+
+	if (rtnl_open(&frth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	filter.flushb = malloc(256 * sizeof(*filter.flushb));
+	if (filter.flushb == NULL) {
+		perror("malloc");
+		rtnl_close(&frth);
+		return -1;
+	}
+	filter.flushp = 0;
+	filter.flushe = 256;
+	filter.flush_errors = 0;
+
+	if (ipnh_dump_request() < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, print_nexthop, stdout) < 0) {
+		fprintf(stderr, "Flush terminated\n");
+		goto out;
+	}
+	if (filter.flushp == 0) {
+		if (show_stats)
+			printf("Nothing to flush.\n");
+		ret = 0;
+		goto out;
+	}
+
+	if (rtnl_pipeline_open(&frth, FLUSH_WINDOW, flush_error, NULL) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		goto out;
+	}
+	/* Groups go first, so their members are unused when deleted */
+	for (pass = 1; pass >= 0; pass--) {
+		for (i = 0; i < filter.flushp; i++) {
+			struct {
+				struct nlmsghdr	n;
+				struct nhmsg	nhm;
+				char		buf[16];
+			} req;
+
+			if (filter.flushb[i].group != pass)
+				continue;
+			memset(&req, 0, sizeof(req));
+			req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg));
+			req.n.nlmsg_flags = NLM_F_REQUEST;
+			req.n.nlmsg_type = RTM_DELNEXTHOP;
+			addattr32(&req.n, sizeof(req), NHA_ID,
+				  filter.flushb[i].id);
+			if (rtnl_talk(&frth, &req.n, 0, 0, NULL) < 0)
+				break;
+		}
+	}
+	if (rtnl_pipeline_close(&frth) < 0)
+		goto out;
+
+	if (show_stats) {
+		printf("\n*** Deleted %d nexthops", filter.flushp - filter.flush_errors);
+		if (filter.flush_errors)
+			printf(", %d failed", filter.flush_errors);
+		printf(" ***\n");
+	}
+	ret = filter.flush_errors ? -1 : 0;
+out:
+	fflush(stdout);
+	free(filter.flushb);
+	filter.flushb = NULL;
+	rtnl_close(&frth);
+	return ret;
+}
+
+static int ipnh_list_or_flush(int argc, char **argv, int flush)
+{
+	memset(&filter, 0, sizeof(filter));
+
+	while (argc > 0) {
+		if (strcmp(*argv, "id") == 0) {
+			NEXT_ARG();
+			if (get_u32(&filter.id, *argv, 0) || filter.id == 0)
+				invarg("invalid id\n", *argv);
+		} else if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			ll_init_map(&rth);
+			filter.ifindex = ll_name_to_index(*argv);
+			if (filter.ifindex == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n",
+					*argv);
+				return -1;
+			}
+		} else if (strcmp(*argv, "groups") == 0) {
+			filter.groups = 1;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument\n", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (flush)
+		return ipnh_flush();
+
+	ll_init_map(&rth);
+	if (ipnh_dump_request() < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_nexthop,
+			     stdout) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+int do_ipnh(int argc, char **argv)
+{
+	if (argc < 1)
+		return ipnh_list_or_flush(0, NULL, 0);
+
+	if (matches(*argv, "add") == 0)
+		return ipnh_modify(RTM_NEWNEXTHOP, NLM_F_CREATE|NLM_F_EXCL,
+				   argc-1, argv+1);
+	if (matches(*argv, "replace") == 0)
+		return ipnh_modify(RTM_NEWNEXTHOP, NLM_F_CREATE|NLM_F_REPLACE,
+				   argc-1, argv+1);
+	if (matches(*argv, "delete") == 0)
+		return ipnh_modify(RTM_DELNEXTHOP, 0, argc-1, argv+1);
+	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0 ||
+	    matches(*argv, "lst") == 0)
+		return ipnh_list_or_flush(argc-1, argv+1, 0);
+	if (matches(*argv, "flush") == 0)
+		return ipnh_list_or_flush(argc-1, argv+1, 1);
+	if (matches(*argv, "get") == 0)
+		return ipnh_get(argc-1, argv+1);
+	if (matches(*argv, "help") == 0)
+		usage();
+	fprintf(stderr, "Command \"%s\" is unknown, try \"ip nexthop help\".\n", *argv);
+	exit(-1);
+}
@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -49,6 +51,7 @@ static void usage(void)
 		"          [ thresh1 VAL ] [ thresh2 VAL ] [ thresh3 VAL ] [ gc_int MSEC ]\n"
 		"          [ PARMS ]\n"
 		"Usage: ip ntable show [ dev DEV ] [ name NAME ]\n"
+		"Usage: ip ntable watch [ name NAME ] [ interval SEC ] [ count N ]\n"
 
 		"PARMS := [ base_reachable MSEC ] [ retrans MSEC ] [ gc_stale MSEC ]\n"
 		"         [ delay_probe MSEC ] [ queue LEN ]\n"
@@ -625,7 +628,8 @@ static int ipntable_show(int argc, char **argv)
 		exit(1);
 	}
 
-	if (rtnl_dump_filter(&rth, print_ntable, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_ntable,
+			     stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		exit(1);
 	}
@@ -633,6 +637,251 @@ static int ipntable_show(int argc, char **argv)
 	return 0;
 }
 
+/* "ip ntable watch" dumps the tables every interval over rth and prints
+ * what the cache counters did meanwhile, one line per table; "!" marks
+ * intervals with forced GC runs, i.e. the table hit gc_thresh3 (or
+ * gc_thresh2 for more than 5s).  The peaks are printed at the end.
+ */
+#define NTABLE_WATCH_MAX	16
+
+struct ntable_watch
+{
+	int			family;
+	char			name[32];
+	int			seen;
+	int			valid;
+	__u32			entries;
+	__u32			thresh3;
+	struct ndt_stats	stats;
+	struct ndt_stats	first;
+	double			peak_allocs;
+	double			peak_destroys;
+	double			peak_forced;
+	__u32			peak_entries;
+	int			pressure;
+};
+
+static struct ntable_watch ntable_watch[NTABLE_WATCH_MAX];
+static int ntable_nwatch;
+static volatile sig_atomic_t ntable_watch_stop;
+
+static void ntable_watch_sig(int sig)
+{
+	ntable_watch_stop = 1;
+}
+
+static double ntable_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int collect_ntable(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			  void *arg)
+{
+	struct ndtmsg *ndtm = NLMSG_DATA(n);
+	struct rtattr *tb[NDTA_MAX+1];
+	struct ntable_watch *w = NULL;
+	const char *name;
+	int i;
+
+	if (n->nlmsg_type != RTM_NEWNEIGHTBL)
+		return 0;
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ndtm)))
+		return -1;
+	if (preferred_family && preferred_family != ndtm->ndtm_family)
+		return 0;
+
+	parse_rtattr(tb, NDTA_MAX, NDTA_RTA(ndtm),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndtm)));
+
+	/* The per device messages carry no counters */
+	if (!tb[NDTA_NAME] || !tb[NDTA_STATS])
+		return 0;
+	name = rta_getattr_str(tb[NDTA_NAME]);
+	if (strlen(filter.name) > 0 && strcmp(filter.name, name))
+		return 0;
+
+	for (i = 0; i < ntable_nwatch; i++) {
+		if (ntable_watch[i].family == ndtm->ndtm_family &&
+		    strcmp(ntable_watch[i].name, name) == 0) {
+			w = &ntable_watch[i];
+			break;
+		}
+	}
+	if (w == NULL) {
+		if (ntable_nwatch == NTABLE_WATCH_MAX)
+			return 0;
+		w = &ntable_watch[ntable_nwatch++];
+		memset(w, 0, sizeof(*w));
+		w->family = ndtm->ndtm_family;
+		strncpy(w->name, name, sizeof(w->name) - 1);
+	}
+
+	w->seen = 1;
+	memcpy(&w->stats, RTA_DATA(tb[NDTA_STATS]), sizeof(w->stats));
+	if (tb[NDTA_CONFIG]) {
+		struct ndt_config *ndtc = RTA_DATA(tb[NDTA_CONFIG]);
+
+		w->entries = ndtc->ndtc_entries;
+	}
+	if (tb[NDTA_THRESH3])
+		w->thresh3 = rta_getattr_u32(tb[NDTA_THRESH3]);
+	return 0;
+}
+
+static const char *ntable_family(int family)
+{
+	switch (family) {
+	case AF_INET:
+		return "inet";
+	case AF_INET6:
+		return "inet6";
+	case AF_DECnet:
+		return "dnet";
+	}
+	return "unknown";
+}
+
+static void ntable_watch_print(struct ntable_watch *w,
+			       const struct ndt_stats *prev, double elapsed)
+{
+	double allocs, destroys, forced, failed;
+	char tbuf[32];
+	time_t t = time(NULL);
+
+	allocs = (w->stats.ndts_allocs - prev->ndts_allocs) / elapsed;
+	destroys = (w->stats.ndts_destroys - prev->ndts_destroys) / elapsed;
+	forced = (w->stats.ndts_forced_gc_runs -
+		  prev->ndts_forced_gc_runs) / elapsed;
+	failed = (w->stats.ndts_res_failed - prev->ndts_res_failed) / elapsed;
+
+	strftime(tbuf, sizeof(tbuf), "%H:%M:%S", localtime(&t));
+	printf("%s %-5s %-12s entries %u/%u allocs %.1f/s destroys %.1f/s "
+	       "hash_grows %llu forced_gc %.1f/s res_failed %.1f/s%s\n",
+	       tbuf, ntable_family(w->family), w->name, w->entries, w->thresh3,
+	       allocs, destroys,
+	       (unsigned long long)(w->stats.ndts_hash_grows -
+				    prev->ndts_hash_grows),
+	       forced, failed, forced > 0 ? " !" : "");
+
+	if (allocs > w->peak_allocs)
+		w->peak_allocs = allocs;
+	if (destroys > w->peak_destroys)
+		w->peak_destroys = destroys;
+	if (forced > w->peak_forced)
+		w->peak_forced = forced;
+	if (forced > 0)
+		w->pressure++;
+}
+
+static int ipntable_watch(int argc, char **argv)
+{
+	struct ndt_stats prev[NTABLE_WATCH_MAX];
+	unsigned int interval = 1, count = 0;
+	struct sigaction sa;
+	double last = 0, now;
+	int i, rounds = 0;
+
+	ipntable_reset_filter();
+
+	while (argc > 0) {
+		if (strcmp(*argv, "name") == 0) {
+			NEXT_ARG();
+			strncpy(filter.name, *argv, sizeof(filter.name) - 1);
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || interval == 0)
+				invarg("\"interval\" value is invalid\n", *argv);
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				invarg("\"count\" value is invalid\n", *argv);
+		} else
+			invarg("unknown", *argv);
+
+		argc--; argv++;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ntable_watch_sig;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ntable_nwatch = 0;
+	while (!ntable_watch_stop) {
+		struct timespec ts;
+
+		for (i = 0; i < ntable_nwatch; i++)
+			ntable_watch[i].seen = 0;
+
+		if (rtnl_wilddump_request(&rth, preferred_family,
+					  RTM_GETNEIGHTBL) < 0) {
+			perror("Cannot send dump request");
+			return 1;
+		}
+		if (rtnl_dump_filter(&rth, collect_ntable, NULL) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return 1;
+		}
+		now = ntable_now();
+
+		for (i = 0; i < ntable_nwatch; i++) {
+			struct ntable_watch *w = &ntable_watch[i];
+
+			if (!w->seen) {
+				w->valid = 0;
+				continue;
+			}
+			if (w->valid)
+				ntable_watch_print(w, &prev[i], now - last);
+			else
+				w->first = w->stats;
+			if (w->entries > w->peak_entries)
+				w->peak_entries = w->entries;
+			prev[i] = w->stats;
+			w->valid = 1;
+		}
+		if (rounds++ == 0 && ntable_nwatch == 0) {
+			fprintf(stderr, "No neighbour table to watch\n");
+			return 1;
+		}
+		if (rounds > 1 && ntable_nwatch > 1)
+			printf("\n");
+		fflush(stdout);
+		last = now;
+
+		if (count && rounds > count)
+			break;
+
+		ts.tv_sec = interval;
+		ts.tv_nsec = 0;
+		while (!ntable_watch_stop && nanosleep(&ts, &ts) < 0 &&
+		       errno == EINTR)
+			;
+	}
+
+	if (rounds < 2)
+		return 0;
+	printf("%s--- %d interval%s of %us ---\n", ntable_nwatch > 1 ? "" : "\n",
+	       rounds - 1, rounds > 2 ? "s" : "", interval);
+	for (i = 0; i < ntable_nwatch; i++) {
+		struct ntable_watch *w = &ntable_watch[i];
+
+		printf("%-5s %-12s peak entries %u allocs %.1f/s destroys %.1f/s "
+		       "forced_gc %.1f/s, %d interval%s with forced GC, "
+		       "%llu hash grows\n",
+		       ntable_family(w->family), w->name, w->peak_entries,
+		       w->peak_allocs, w->peak_destroys, w->peak_forced,
+		       w->pressure, w->pressure == 1 ? "" : "s",
+		       (unsigned long long)(w->stats.ndts_hash_grows -
+					    w->first.ndts_hash_grows));
+	}
+	return 0;
+}
+
 int do_ipntable(int argc, char **argv)
 {
 	ll_init_map(&rth);
@@ -647,6 +896,8 @@ int do_ipntable(int argc, char **argv)
 		    matches(*argv, "lst") == 0 ||
 		    matches(*argv, "list") == 0)
 			return ipntable_show(argc-1, argv+1);
+		if (matches(*argv, "watch") == 0)
+			return ipntable_watch(argc-1, argv+1);
 		if (matches(*argv, "help") == 0)
 			usage();
 	} else
@@ -11,19 +11,27 @@
  */
 
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <linux/in_route.h>
 #include <errno.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "rt_names.h"
 #include "utils.h"
@@ -37,6 +45,10 @@ enum list_action {
 	IPROUTE_LIST,
 	IPROUTE_FLUSH,
 	IPROUTE_SAVE,
+	IPROUTE_DIFF,
+	IPROUTE_SYNC,
+	IPROUTE_METRICS,
+	IPROUTE_SHOWDUMP,
 };
 static const char *mx_names[RTAX_MAX+1] = {
 	[RTAX_MTU]	= "mtu",
@@ -58,12 +70,20 @@ static void usage(void) __attribute__((noreturn));
 static void usage(void)
 {
 	fprintf(stderr, "Usage: ip route { list | flush } SELECTOR\n");
-	fprintf(stderr, "       ip route save SELECTOR\n");
-	fprintf(stderr, "       ip route restore\n");
+	fprintf(stderr, "       ip route flush SELECTOR fast\n");
+	fprintf(stderr, "       ip route list SELECTOR longest\n");
+	fprintf(stderr, "       ip route list SELECTOR columns\n");
+	fprintf(stderr, "       ip route save SELECTOR [ index ] [ compress ]\n");
+	fprintf(stderr, "       ip route restore [ table TABLE_ID ]\n");
+	fprintf(stderr, "       ip route showdump SELECTOR [ jobs N ]\n");
+	fprintf(stderr, "       ip route { diff | sync } SELECTOR\n");
+	fprintf(stderr, "       ip route change-metrics OPTIONS match SELECTOR\n");
 	fprintf(stderr, "       ip route get ADDRESS [ from ADDRESS iif STRING ]\n");
 	fprintf(stderr, "                            [ oif STRING ]  [ tos TOS ]\n");
-	fprintf(stderr, "                            [ mark NUMBER ]\n");
+	fprintf(stderr, "                            [ mark NUMBER ] [ batch FILE ]\n");
+	fprintf(stderr, "                            [ offline [ table TABLE_ID ] ]\n");
 	fprintf(stderr, "       ip route { add | del | change | append | replace } ROUTE\n");
+	fprintf(stderr, "       ip route nhgroup NAME nexthop NH [ nexthop NH ]...\n");
 	fprintf(stderr, "SELECTOR := [ root PREFIX ] [ match PREFIX ] [ exact PREFIX ]\n");
 	fprintf(stderr, "            [ table TABLE_ID ] [ proto RTPROTO ]\n");
 	fprintf(stderr, "            [ type TYPE ] [ scope SCOPE ]\n");
@@ -72,6 +92,8 @@ static void usage(void)
 	fprintf(stderr, "             [ table TABLE_ID ] [ proto RTPROTO ]\n");
 	fprintf(stderr, "             [ scope SCOPE ] [ metric METRIC ]\n");
 	fprintf(stderr, "INFO_SPEC := NH OPTIONS FLAGS [ nexthop NH ]...\n");
+	fprintf(stderr, "             NH OPTIONS FLAGS nhgroup NAME\n");
+	fprintf(stderr, "             nhid ID OPTIONS FLAGS\n");
 	fprintf(stderr, "NH := [ via ADDRESS ] [ dev STRING ] [ weight NUMBER ] NHFLAGS\n");
 	fprintf(stderr, "OPTIONS := FLAGS [ mtu NUMBER ] [ advmss NUMBER ]\n");
 	fprintf(stderr, "           [ rtt TIME ] [ rttvar TIME ] [reordering NUMBER ]\n");
@@ -98,6 +120,8 @@ static struct
 	char *flushb;
 	int flushp;
 	int flushe;
+	struct rtnl_handle *flush_rth;
+	int flush_errors;
 	int protocol, protocolmask;
 	int scope, scopemask;
 	int type, typemask;
@@ -112,6 +136,7 @@ static struct
 	inet_prefix mdst;
 	inet_prefix rsrc;
 	inet_prefix msrc;
+	int columns;
 } filter;
 
 static int flush_update(void)
@@ -277,17 +302,155 @@ int calc_host_len(struct rtmsg *r)
 		return -1;
 }
 
+/* Multipath routes repeat the same few gateways over and over, so
+ * their text is kept in a small direct-mapped cache, one per thread.
+ */
+#define GW_CACHE_SIZE	256
+
+static __thread struct gw_cache
+{
+	int		family;
+	int		len;
+	__u8		addr[16];
+	char		name[64];
+} gw_cache[GW_CACHE_SIZE];
+
+static const char *format_gateway(int family, const struct rtattr *rta,
+				  char *buf, int buflen)
+{
+	const __u8 *addr = RTA_DATA(rta);
+	int len = RTA_PAYLOAD(rta);
+	struct gw_cache *c;
+	const char *name;
+
+	/* Names looked up in the background are not known yet */
+	if (len < 4 || len > sizeof(c->addr) || resolve_prefetch)
+		return format_host(family, len, addr, buf, buflen);
+
+	c = &gw_cache[(addr[len - 1] ^ addr[len - 2] << 3 ^ addr[len - 3] << 5)
+		      % GW_CACHE_SIZE];
+	if (c->family == family && c->len == len &&
+	    memcmp(c->addr, addr, len) == 0)
+		return c->name;
+
+	name = format_host(family, len, addr, buf, buflen);
+	if (strlen(name) < sizeof(c->name)) {
+		c->family = family;
+		c->len = len;
+		memcpy(c->addr, addr, len);
+		strcpy(c->name, name);
+	}
+	return name;
+}
+
+/* "ip route list ... columns": the table routel used to make with a
+ * shell loop, one line per route and one more per further nexthop.
+ * filter.columns is the width of an address column.
+ */
+static void print_columns_hdr(FILE *fp)
+{
+	int w = filter.columns;
+
+	fprintf(fp, "%*s%-3s %*s %*s %8s %8s%7s %s\n",
+		w, "target", "", w, "gateway", w, "source",
+		"proto", "scope", "dev", "tbl");
+}
+
+static void print_columns_hop(FILE *fp, struct rtmsg *r,
+			      const char *target, const char *mask,
+			      const struct rtattr *gw, int oif,
+			      const char *src, __u32 table)
+{
+	char gbuf[256], via[64];
+	SPRINT_BUF(b1);
+	SPRINT_BUF(b2);
+	SPRINT_BUF(b3);
+	int w = filter.columns;
+	const char *g = "";
+
+	if (gw)
+		g = format_gateway(r->rtm_family, gw, gbuf, sizeof(gbuf));
+	else if (r->rtm_type != RTN_UNICAST)
+		g = rtnl_rtntype_n2a(r->rtm_type, via, sizeof(via));
+
+	if (!target) {
+		fprintf(fp, "%*s%-3s %*s %*s %8s %8s%7s\n", w, "", "", w, g,
+			w, "", "", "", oif ? ll_index_to_name(oif) : "");
+		return;
+	}
+	fprintf(fp, "%*s%-3s %*s %*s %8s %8s%7s %s\n",
+		w, target, mask, w, g, w, src,
+		rtnl_rtprot_n2a(r->rtm_protocol, b1, sizeof(b1)),
+		rtnl_rtscope_n2a(r->rtm_scope, b2, sizeof(b2)),
+		oif ? ll_index_to_name(oif) : "",
+		rtnl_rttable_n2a(table, b3, sizeof(b3)));
+}
+
+static int print_route_columns(FILE *fp, struct rtmsg *r, struct rtattr **tb,
+			       __u32 table, int host_len)
+{
+	char abuf[256], sbuf[64], mask[8] = "";
+	const char *target = "default";
+	const char *src = "";
+	struct rtnexthop *nh;
+	int len, first = 1;
+
+	if (tb[RTA_DST]) {
+		target = rt_addr_n2a(r->rtm_family, RTA_PAYLOAD(tb[RTA_DST]),
+				     RTA_DATA(tb[RTA_DST]), abuf, sizeof(abuf));
+		if (r->rtm_dst_len != host_len)
+			snprintf(mask, sizeof(mask), " %u", r->rtm_dst_len);
+	} else if (r->rtm_dst_len) {
+		target = "0";
+		snprintf(mask, sizeof(mask), " %u", r->rtm_dst_len);
+	}
+	if (tb[RTA_PREFSRC])
+		src = rt_addr_n2a(r->rtm_family, RTA_PAYLOAD(tb[RTA_PREFSRC]),
+				  RTA_DATA(tb[RTA_PREFSRC]), sbuf, sizeof(sbuf));
+
+	if (!tb[RTA_MULTIPATH]) {
+		print_columns_hop(fp, r, target, mask, tb[RTA_GATEWAY],
+				  tb[RTA_OIF] ? rta_getattr_u32(tb[RTA_OIF]) : 0,
+				  src, table);
+		return 0;
+	}
+
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	while (len >= sizeof(*nh) && nh->rtnh_len <= len) {
+		struct rtattr *gw = NULL, *a;
+		int alen = nh->rtnh_len - sizeof(*nh);
+
+		for (a = RTNH_DATA(nh); RTA_OK(a, alen); a = RTA_NEXT(a, alen))
+			if (a->rta_type == RTA_GATEWAY)
+				gw = a;
+		print_columns_hop(fp, r, first ? target : NULL, mask, gw,
+				  nh->rtnh_ifindex, src, table);
+		first = 0;
+		len -= NLMSG_ALIGN(nh->rtnh_len);
+		nh = RTNH_NEXT(nh);
+	}
+	return 0;
+}
+
+/*
+ * The fields are tested one after the other, in output order.  On big
+ * dumps the routes look alike and these tests are predicted well; a
+ * table of fields visited from a bitmask of the attributes present
+ * printed the same but took a few percent longer, so it is kept plain.
+ */
 int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE*)arg;
 	struct rtmsg *r = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[RTA_MAX+1];
+	struct rtattr **tb;
 	char abuf[256];
 	int host_len = -1;
 	__u32 table;
 	SPRINT_BUF(b1);
-	static int hz;
+	static __thread int hz;
+	RTATTR_TABLE(route_tb, RTA_MAX);
 
 	if (n->nlmsg_type != RTM_NEWROUTE && n->nlmsg_type != RTM_DELROUTE) {
 		fprintf(stderr, "Not a route: %08x %08x %08x\n",
@@ -304,7 +467,7 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 
 	host_len = calc_host_len(r);
 
-	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	tb = parse_rtattr_table(&route_tb, RTM_RTA(r), len);
 	table = rtm_get_table(r, tb);
 
 	if (!filter_nlmsg(n, tb, host_len))
@@ -320,32 +483,38 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		memcpy(fn, n, n->nlmsg_len);
 		fn->nlmsg_type = RTM_DELROUTE;
 		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
+		if (filter.flush_rth) {
+			if (rtnl_talk(filter.flush_rth, fn, 0, 0, NULL) < 0)
+				return -1;
+		} else {
+			fn->nlmsg_seq = ++rth.seq;
+			filter.flushp = (((char*)fn) + n->nlmsg_len) - filter.flushb;
+		}
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
 	}
 
+	if (filter.columns)
+		return print_route_columns(fp, r, tb, table, host_len);
+
 	if (n->nlmsg_type == RTM_DELROUTE)
 		fprintf(fp, "Deleted ");
 	if (r->rtm_type != RTN_UNICAST && !filter.type)
-		fprintf(fp, "%s ", rtnl_rtntype_n2a(r->rtm_type, b1, sizeof(b1)));
+		print_field(fp, "", rtnl_rtntype_n2a(r->rtm_type, b1, sizeof(b1)));
 
 	if (tb[RTA_DST]) {
 		if (r->rtm_dst_len != host_len) {
-			fprintf(fp, "%s/%u ", rt_addr_n2a(r->rtm_family,
-							 RTA_PAYLOAD(tb[RTA_DST]),
-							 RTA_DATA(tb[RTA_DST]),
-							 abuf, sizeof(abuf)),
-				r->rtm_dst_len
-				);
+			fputs(rt_addr_n2a(r->rtm_family,
+					  RTA_PAYLOAD(tb[RTA_DST]),
+					  RTA_DATA(tb[RTA_DST]),
+					  abuf, sizeof(abuf)), fp);
+			print_field_u(fp, "/", r->rtm_dst_len);
 		} else {
-			fprintf(fp, "%s ", format_host(r->rtm_family,
-						       RTA_PAYLOAD(tb[RTA_DST]),
-						       RTA_DATA(tb[RTA_DST]),
-						       abuf, sizeof(abuf))
-				);
+			print_field(fp, "", format_host(r->rtm_family,
+							RTA_PAYLOAD(tb[RTA_DST]),
+							RTA_DATA(tb[RTA_DST]),
+							abuf, sizeof(abuf)));
 		}
 	} else if (r->rtm_dst_len) {
 		fprintf(fp, "0/%d ", r->rtm_dst_len);
@@ -375,36 +544,36 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		fprintf(fp, "tos %s ", rtnl_dsfield_n2a(r->rtm_tos, b1, sizeof(b1)));
 	}
 
+	if (tb[RTA_NH_ID])
+		fprintf(fp, "nhid %u ", rta_getattr_u32(tb[RTA_NH_ID]));
 	if (tb[RTA_GATEWAY] && filter.rvia.bitlen != host_len) {
-		fprintf(fp, "via %s ",
-			format_host(r->rtm_family,
-				    RTA_PAYLOAD(tb[RTA_GATEWAY]),
-				    RTA_DATA(tb[RTA_GATEWAY]),
-				    abuf, sizeof(abuf)));
+		print_field(fp, "via ",
+			    format_gateway(r->rtm_family, tb[RTA_GATEWAY],
+					   abuf, sizeof(abuf)));
 	}
 	if (tb[RTA_OIF] && filter.oifmask != -1)
-		fprintf(fp, "dev %s ", ll_index_to_name(*(int*)RTA_DATA(tb[RTA_OIF])));
+		print_field(fp, "dev ", ll_index_to_name(*(int*)RTA_DATA(tb[RTA_OIF])));
 
 	if (!(r->rtm_flags&RTM_F_CLONED)) {
 		if (table != RT_TABLE_MAIN && !filter.tb)
-			fprintf(fp, " table %s ", rtnl_rttable_n2a(table, b1, sizeof(b1)));
+			print_field(fp, " table ", rtnl_rttable_n2a(table, b1, sizeof(b1)));
 		if (r->rtm_protocol != RTPROT_BOOT && filter.protocolmask != -1)
-			fprintf(fp, " proto %s ", rtnl_rtprot_n2a(r->rtm_protocol, b1, sizeof(b1)));
+			print_field(fp, " proto ", rtnl_rtprot_n2a(r->rtm_protocol, b1, sizeof(b1)));
 		if (r->rtm_scope != RT_SCOPE_UNIVERSE && filter.scopemask != -1)
-			fprintf(fp, " scope %s ", rtnl_rtscope_n2a(r->rtm_scope, b1, sizeof(b1)));
+			print_field(fp, " scope ", rtnl_rtscope_n2a(r->rtm_scope, b1, sizeof(b1)));
 	}
 	if (tb[RTA_PREFSRC] && filter.rprefsrc.bitlen != host_len) {
 		/* Do not use format_host(). It is our local addr
 		   and symbolic name will not be useful.
 		 */
-		fprintf(fp, " src %s ",
-			rt_addr_n2a(r->rtm_family,
-				    RTA_PAYLOAD(tb[RTA_PREFSRC]),
-				    RTA_DATA(tb[RTA_PREFSRC]),
-				    abuf, sizeof(abuf)));
+		print_field(fp, " src ",
+			    rt_addr_n2a(r->rtm_family,
+					RTA_PAYLOAD(tb[RTA_PREFSRC]),
+					RTA_DATA(tb[RTA_PREFSRC]),
+					abuf, sizeof(abuf)));
 	}
 	if (tb[RTA_PRIORITY])
-		fprintf(fp, " metric %u ", rta_getattr_u32(tb[RTA_PRIORITY]));
+		print_field_u(fp, " metric ", rta_getattr_u32(tb[RTA_PRIORITY]));
 	if (r->rtm_flags & RTNH_F_DEAD)
 		fprintf(fp, "dead ");
 	if (r->rtm_flags & RTNH_F_ONLINK)
@@ -513,10 +682,10 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	if (tb[RTA_METRICS]) {
 		int i;
 		unsigned mxlock = 0;
-		struct rtattr *mxrta[RTAX_MAX+1];
+		struct rtattr **mxrta;
+		RTATTR_TABLE(metrics_tb, RTAX_MAX);
 
-		parse_rtattr(mxrta, RTAX_MAX, RTA_DATA(tb[RTA_METRICS]),
-			    RTA_PAYLOAD(tb[RTA_METRICS]));
+		mxrta = parse_rtattr_table_nested(&metrics_tb, tb[RTA_METRICS]);
 		if (mxrta[RTAX_LOCK])
 			mxlock = *(unsigned*)RTA_DATA(mxrta[RTAX_LOCK]);
 
@@ -568,6 +737,9 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
 
 		for (;;) {
+			struct rtattr *gw = NULL, *flow = NULL, *a;
+			int alen;
+
 			if (len < sizeof(*nh))
 				break;
 			if (nh->rtnh_len > len)
@@ -579,27 +751,32 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 					fprintf(fp, " ");
 			} else
 				fprintf(fp, "%s\tnexthop", _SL_);
-			if (nh->rtnh_len > sizeof(*nh)) {
-				parse_rtattr(tb, RTA_MAX, RTNH_DATA(nh), nh->rtnh_len - sizeof(*nh));
-				if (tb[RTA_GATEWAY]) {
-					fprintf(fp, " via %s ",
-						format_host(r->rtm_family,
-							    RTA_PAYLOAD(tb[RTA_GATEWAY]),
-							    RTA_DATA(tb[RTA_GATEWAY]),
-							    abuf, sizeof(abuf)));
-				}
-				if (tb[RTA_FLOW]) {
-					__u32 to = rta_getattr_u32(tb[RTA_FLOW]);
-					__u32 from = to>>16;
-					to &= 0xFFFF;
-					fprintf(fp, " realm%s ", from ? "s" : "");
-					if (from) {
-						fprintf(fp, "%s/",
-							rtnl_rtrealm_n2a(from, b1, sizeof(b1)));
-					}
-					fprintf(fp, "%s",
-						rtnl_rtrealm_n2a(to, b1, sizeof(b1)));
+
+			/* A nexthop carries a gateway and a realm at most */
+			alen = nh->rtnh_len - sizeof(*nh);
+			for (a = RTNH_DATA(nh); RTA_OK(a, alen);
+			     a = RTA_NEXT(a, alen)) {
+				if (a->rta_type == RTA_GATEWAY)
+					gw = a;
+				else if (a->rta_type == RTA_FLOW)
+					flow = a;
+			}
+			if (gw) {
+				fprintf(fp, " via %s ",
+					format_gateway(r->rtm_family, gw,
+						       abuf, sizeof(abuf)));
+			}
+			if (flow) {
+				__u32 to = rta_getattr_u32(flow);
+				__u32 from = to>>16;
+				to &= 0xFFFF;
+				fprintf(fp, " realm%s ", from ? "s" : "");
+				if (from) {
+					fprintf(fp, "%s/",
+						rtnl_rtrealm_n2a(from, b1, sizeof(b1)));
 				}
+				fprintf(fp, "%s",
+					rtnl_rtrealm_n2a(to, b1, sizeof(b1)));
 			}
 			if (r->rtm_flags&RTM_F_CLONED && r->rtm_type == RTN_MULTICAST) {
 				fprintf(fp, " %s", ll_index_to_name(nh->rtnh_ifindex));
@@ -620,21 +797,26 @@ int print_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 		}
 	}
 	fprintf(fp, "\n");
-	fflush(fp);
 	return 0;
 }
 
 
-int parse_one_nh(struct rtattr *rta, struct rtnexthop *rtnh, int *argcp, char ***argvp)
+/* Appends the attributes of one nexthop to n, right after rtnh */
+int parse_one_nh(struct nlmsghdr *n, int maxlen, struct rtmsg *r,
+		 struct rtnexthop *rtnh, int *argcp, char ***argvp)
 {
 	int argc = *argcp;
 	char **argv = *argvp;
 
 	while (++argv, --argc > 0) {
 		if (strcmp(*argv, "via") == 0) {
+			inet_prefix addr;
 			NEXT_ARG();
-			rta_addattr32(rta, 4096, RTA_GATEWAY, get_addr32(*argv));
-			rtnh->rtnh_len += sizeof(struct rtattr) + 4;
+			get_addr(&addr, *argv, r->rtm_family);
+			if (r->rtm_family == AF_UNSPEC)
+				r->rtm_family = addr.family;
+			addattr_l(n, maxlen, RTA_GATEWAY, &addr.data,
+				  addr.bytelen);
 		} else if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
 			if ((rtnh->rtnh_ifindex = ll_name_to_index(*argv)) == 0) {
@@ -654,26 +836,23 @@ int parse_one_nh(struct rtattr *rta, struct rtnexthop *rtnh, int *argcp, char **
 			NEXT_ARG();
 			if (get_rt_realms(&realm, *argv))
 				invarg("\"realm\" value is invalid\n", *argv);
-			rta_addattr32(rta, 4096, RTA_FLOW, realm);
-			rtnh->rtnh_len += sizeof(struct rtattr) + 4;
+			addattr32(n, maxlen, RTA_FLOW, realm);
 		} else
 			break;
 	}
+	rtnh->rtnh_len = (void *)NLMSG_TAIL(n) - (void *)rtnh;
 	*argcp = argc;
 	*argvp = argv;
 	return 0;
 }
 
-int parse_nexthops(struct nlmsghdr *n, struct rtmsg *r, int argc, char **argv)
+/* Builds RTA_MULTIPATH in place, in one pass over the arguments */
+int parse_nexthops(struct nlmsghdr *n, int maxlen, struct rtmsg *r,
+		   int argc, char **argv)
 {
-	char buf[1024];
-	struct rtattr *rta = (void*)buf;
+	struct rtattr *nest = addattr_nest(n, maxlen, RTA_MULTIPATH);
 	struct rtnexthop *rtnh;
 
-	rta->rta_type = RTA_MULTIPATH;
-	rta->rta_len = RTA_LENGTH(0);
-	rtnh = RTA_DATA(rta);
-
 	while (argc > 0) {
 		if (strcmp(*argv, "nexthop") != 0) {
 			fprintf(stderr, "Error: \"nexthop\" or end of line is expected instead of \"%s\"\n", *argv);
@@ -683,26 +862,203 @@ int parse_nexthops(struct nlmsghdr *n, struct rtmsg *r, int argc, char **argv)
 			fprintf(stderr, "Error: unexpected end of line after \"nexthop\"\n");
 			exit(-1);
 		}
+		if (NLMSG_ALIGN(n->nlmsg_len) + sizeof(*rtnh) > maxlen) {
+			fprintf(stderr, "Error: too many nexthops\n");
+			exit(-1);
+		}
+		rtnh = (struct rtnexthop *)NLMSG_TAIL(n);
 		memset(rtnh, 0, sizeof(*rtnh));
-		rtnh->rtnh_len = sizeof(*rtnh);
-		rta->rta_len += rtnh->rtnh_len;
-		parse_one_nh(rta, rtnh, &argc, &argv);
-		rtnh = RTNH_NEXT(rtnh);
+		n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + sizeof(*rtnh);
+		parse_one_nh(n, maxlen, r, rtnh, &argc, &argv);
 	}
 
-	if (rta->rta_len > RTA_LENGTH(0))
-		addattr_l(n, 1024, RTA_MULTIPATH, RTA_DATA(rta), RTA_PAYLOAD(rta));
+	addattr_nest_end(n, nest);
+	if (RTA_PAYLOAD(nest) == 0)
+		n->nlmsg_len = (void *)nest - (void *)n;
 	return 0;
 }
 
+/*
+ * "ip route nhgroup NAME nexthop NH..." defines a set of nexthops that
+ * routes then take with "nhgroup NAME".  The group is parsed once and
+ * its RTA_MULTIPATH payload copied into every route using it, which is
+ * what a batch of routes sharing one ECMP set wants.
+ */
+#define NHGROUP_HASH	64
+
+struct nhgroup
+{
+	struct nhgroup	*next;
+	char		*name;
+	int		family;
+	int		len;
+	char		data[];
+};
 
-int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
+static struct nhgroup *nhgroups[NHGROUP_HASH];
+
+static struct nhgroup **nhgroup_slot(const char *name)
+{
+	struct nhgroup **p;
+	unsigned h = 5381;
+	const char *c;
+
+	for (c = name; *c; c++)
+		h = h * 33 + *c;
+	for (p = &nhgroups[h % NHGROUP_HASH]; *p; p = &(*p)->next)
+		if (strcmp((*p)->name, name) == 0)
+			break;
+	return p;
+}
+
+static int iproute_nhgroup(int argc, char **argv)
 {
 	struct {
-		struct nlmsghdr 	n;
-		struct rtmsg 		r;
-		char   			buf[1024];
+		struct nlmsghdr	n;
+		struct rtmsg	r;
+		char		buf[4096];
 	} req;
+	struct nhgroup **p, *g;
+	struct rtattr *mp;
+	const char *name;
+
+	if (argc < 1 || strcmp(*argv, "help") == 0)
+		usage();
+	name = *argv;
+	argc--; argv++;
+	if (argc == 0) {
+		fprintf(stderr, "Error: nhgroup \"%s\" has no nexthops\n",
+			name);
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.r.rtm_family = preferred_family;
+	ll_init_map(&rth);
+	parse_nexthops(&req.n, sizeof(req), &req.r, argc, argv);
+	mp = (struct rtattr *)req.buf;
+
+	g = malloc(sizeof(*g) + RTA_PAYLOAD(mp));
+	if (g == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	g->name = strdup(name);
+	g->family = req.r.rtm_family;
+	g->len = RTA_PAYLOAD(mp);
+	memcpy(g->data, RTA_DATA(mp), g->len);
+
+	/* A new definition replaces the old one */
+	p = nhgroup_slot(name);
+	if (*p) {
+		g->next = (*p)->next;
+		free((*p)->name);
+		free(*p);
+	} else
+		g->next = NULL;
+	*p = g;
+	return 0;
+}
+
+static int nhgroup_put(struct nlmsghdr *n, int maxlen, struct rtmsg *r,
+		       const char *name)
+{
+	struct nhgroup *g = *nhgroup_slot(name);
+
+	if (g == NULL) {
+		fprintf(stderr, "Error: nhgroup \"%s\" is not defined\n", name);
+		exit(-1);
+	}
+	if (r->rtm_family == AF_UNSPEC)
+		r->rtm_family = g->family;
+	else if (g->family != AF_UNSPEC && r->rtm_family != g->family) {
+		fprintf(stderr, "Error: nhgroup \"%s\" is of another family\n",
+			name);
+		exit(-1);
+	}
+	return addattr_l(n, maxlen, RTA_MULTIPATH, g->data, g->len);
+}
+
+
+struct iproute_req
+{
+	struct nlmsghdr 	n;
+	struct rtmsg 		r;
+	char   			buf[4096];
+};
+
+/* The keywords of iproute_parse(), in the order they used to be tried */
+enum {
+	RKW_SRC,
+	RKW_VIA,
+	RKW_FROM,
+	RKW_TOS,
+	RKW_METRIC,
+	RKW_SCOPE,
+	RKW_MTU,
+	RKW_HOPLIMIT,
+	RKW_ADVMSS,
+	RKW_REORDERING,
+	RKW_RTT,
+	RKW_RTO_MIN,
+	RKW_WINDOW,
+	RKW_CWND,
+	RKW_INITCWND,
+	RKW_INITRWND,
+	RKW_RTTVAR,
+	RKW_SSTHRESH,
+	RKW_REALMS,
+	RKW_ONLINK,
+	RKW_NEXTHOP,
+	RKW_NHGROUP,
+	RKW_NHID,
+	RKW_PROTOCOL,
+	RKW_TABLE,
+	RKW_DEV,
+};
+
+static const struct kw route_kws[] = {
+	{ "src",		RKW_SRC, 0 },
+	{ "via",		RKW_VIA, 0 },
+	{ "from",		RKW_FROM, 0 },
+	{ "tos",		RKW_TOS, 0 },
+	{ "dsfield",		RKW_TOS, 1 },
+	{ "metric",		RKW_METRIC, 1 },
+	{ "priority",		RKW_METRIC, 1 },
+	{ "preference",		RKW_METRIC, 1 },
+	{ "scope",		RKW_SCOPE, 0 },
+	{ "mtu",		RKW_MTU, 0 },
+	{ "hoplimit",		RKW_HOPLIMIT, 0 },
+	{ "advmss",		RKW_ADVMSS, 0 },
+	{ "reordering",		RKW_REORDERING, 1 },
+	{ "rtt",		RKW_RTT, 0 },
+	{ "rto_min",		RKW_RTO_MIN, 0 },
+	{ "window",		RKW_WINDOW, 1 },
+	{ "cwnd",		RKW_CWND, 1 },
+	{ "initcwnd",		RKW_INITCWND, 1 },
+	{ "initrwnd",		RKW_INITRWND, 1 },
+	{ "rttvar",		RKW_RTTVAR, 1 },
+	{ "ssthresh",		RKW_SSTHRESH, 1 },
+	{ "realms",		RKW_REALMS, 1 },
+	{ "onlink",		RKW_ONLINK, 0 },
+	{ "nexthop",		RKW_NEXTHOP, 0 },
+	{ "nhgroup",		RKW_NHGROUP, 0 },
+	{ "nhid",		RKW_NHID, 0 },
+	{ "protocol",		RKW_PROTOCOL, 1 },
+	{ "table",		RKW_TABLE, 1 },
+	{ "dev",		RKW_DEV, 0 },
+	{ "oif",		RKW_DEV, 0 },
+};
+
+static struct kw_table route_kw = KW_TABLE(route_kws);
+
+/* Build the request for "ip route add|del|..." ROUTE into req.  Routes
+ * that do not name a table go to deftable, if it is set.
+ */
+static int iproute_parse(int cmd, unsigned flags, int argc, char **argv,
+			 struct iproute_req *req, __u32 deftable)
+{
 	char  mxbuf[256];
 	struct rtattr * mxrta = (void*)mxbuf;
 	unsigned mxlock = 0;
@@ -710,76 +1066,87 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 	int gw_ok = 0;
 	int dst_ok = 0;
 	int nhs_ok = 0;
+	const char *nhgroup = NULL;
 	int scope_ok = 0;
 	int table_ok = 0;
 	int raw = 0;
 
-	memset(&req, 0, sizeof(req));
+	memset(req, 0, sizeof(*req));
 
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST|flags;
-	req.n.nlmsg_type = cmd;
-	req.r.rtm_family = preferred_family;
-	req.r.rtm_table = RT_TABLE_MAIN;
-	req.r.rtm_scope = RT_SCOPE_NOWHERE;
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST|flags;
+	req->n.nlmsg_type = cmd;
+	req->r.rtm_family = preferred_family;
+	req->r.rtm_table = RT_TABLE_MAIN;
+	req->r.rtm_scope = RT_SCOPE_NOWHERE;
 
 	if (cmd != RTM_DELROUTE) {
-		req.r.rtm_protocol = RTPROT_BOOT;
-		req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-		req.r.rtm_type = RTN_UNICAST;
+		req->r.rtm_protocol = RTPROT_BOOT;
+		req->r.rtm_scope = RT_SCOPE_UNIVERSE;
+		req->r.rtm_type = RTN_UNICAST;
 	}
 
 	mxrta->rta_type = RTA_METRICS;
 	mxrta->rta_len = RTA_LENGTH(0);
 
 	while (argc > 0) {
-		if (strcmp(*argv, "src") == 0) {
+		switch (kw_lookup(&route_kw, *argv)) {
+		case RKW_SRC: {
 			inet_prefix addr;
 			NEXT_ARG();
-			get_addr(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			addattr_l(&req.n, sizeof(req), RTA_PREFSRC, &addr.data, addr.bytelen);
-		} else if (strcmp(*argv, "via") == 0) {
+			get_addr(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
+			addattr_l(&req->n, sizeof(*req), RTA_PREFSRC, &addr.data, addr.bytelen);
+			break;
+		}
+		case RKW_VIA: {
 			inet_prefix addr;
 			gw_ok = 1;
 			NEXT_ARG();
-			get_addr(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			addattr_l(&req.n, sizeof(req), RTA_GATEWAY, &addr.data, addr.bytelen);
-		} else if (strcmp(*argv, "from") == 0) {
+			get_addr(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
+			addattr_l(&req->n, sizeof(*req), RTA_GATEWAY, &addr.data, addr.bytelen);
+			break;
+		}
+		case RKW_FROM: {
 			inet_prefix addr;
 			NEXT_ARG();
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
+			get_prefix(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
 			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req), RTA_SRC, &addr.data, addr.bytelen);
-			req.r.rtm_src_len = addr.bitlen;
-		} else if (strcmp(*argv, "tos") == 0 ||
-			   matches(*argv, "dsfield") == 0) {
+				addattr_l(&req->n, sizeof(*req), RTA_SRC, &addr.data, addr.bytelen);
+			req->r.rtm_src_len = addr.bitlen;
+			break;
+		}
+		case RKW_TOS: {
 			__u32 tos;
 			NEXT_ARG();
 			if (rtnl_dsfield_a2n(&tos, *argv))
 				invarg("\"tos\" value is invalid\n", *argv);
-			req.r.rtm_tos = tos;
-		} else if (matches(*argv, "metric") == 0 ||
-			   matches(*argv, "priority") == 0 ||
-			   matches(*argv, "preference") == 0) {
+			req->r.rtm_tos = tos;
+			break;
+		}
+		case RKW_METRIC: {
 			__u32 metric;
 			NEXT_ARG();
 			if (get_u32(&metric, *argv, 0))
 				invarg("\"metric\" value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_PRIORITY, metric);
-		} else if (strcmp(*argv, "scope") == 0) {
+			addattr32(&req->n, sizeof(*req), RTA_PRIORITY, metric);
+			break;
+		}
+		case RKW_SCOPE: {
 			__u32 scope = 0;
 			NEXT_ARG();
 			if (rtnl_rtscope_a2n(&scope, *argv))
 				invarg("invalid \"scope\" value\n", *argv);
-			req.r.rtm_scope = scope;
+			req->r.rtm_scope = scope;
 			scope_ok = 1;
-		} else if (strcmp(*argv, "mtu") == 0) {
+			break;
+		}
+		case RKW_MTU: {
 			unsigned mtu;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -789,7 +1156,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&mtu, *argv, 0))
 				invarg("\"mtu\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_MTU, mtu);
-		} else if (strcmp(*argv, "hoplimit") == 0) {
+			break;
+		}
+		case RKW_HOPLIMIT: {
 			unsigned hoplimit;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -799,7 +1168,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&hoplimit, *argv, 0))
 				invarg("\"hoplimit\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_HOPLIMIT, hoplimit);
-		} else if (strcmp(*argv, "advmss") == 0) {
+			break;
+		}
+		case RKW_ADVMSS: {
 			unsigned mss;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -809,7 +1180,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&mss, *argv, 0))
 				invarg("\"mss\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_ADVMSS, mss);
-		} else if (matches(*argv, "reordering") == 0) {
+			break;
+		}
+		case RKW_REORDERING: {
 			unsigned reord;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -819,7 +1192,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&reord, *argv, 0))
 				invarg("\"reordering\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_REORDERING, reord);
-		} else if (strcmp(*argv, "rtt") == 0) {
+			break;
+		}
+		case RKW_RTT: {
 			unsigned rtt;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -830,7 +1205,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 				invarg("\"rtt\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_RTT, 
 				(raw) ? rtt : rtt * 8);
-		} else if (strcmp(*argv, "rto_min") == 0) {
+			break;
+		}
+		case RKW_RTO_MIN: {
 			unsigned rto_min;
 			NEXT_ARG();
 			mxlock |= (1<<RTAX_RTO_MIN);
@@ -839,7 +1216,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 				       *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_RTO_MIN,
 				      rto_min);
-		} else if (matches(*argv, "window") == 0) {
+			break;
+		}
+		case RKW_WINDOW: {
 			unsigned win;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -849,7 +1228,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"window\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_WINDOW, win);
-		} else if (matches(*argv, "cwnd") == 0) {
+			break;
+		}
+		case RKW_CWND: {
 			unsigned win;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -859,7 +1240,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"cwnd\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_CWND, win);
-		} else if (matches(*argv, "initcwnd") == 0) {
+			break;
+		}
+		case RKW_INITCWND: {
 			unsigned win;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -869,7 +1252,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"initcwnd\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_INITCWND, win);
-		} else if (matches(*argv, "initrwnd") == 0) {
+			break;
+		}
+		case RKW_INITRWND: {
 			unsigned win;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -879,7 +1264,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"initrwnd\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_INITRWND, win);
-		} else if (matches(*argv, "rttvar") == 0) {
+			break;
+		}
+		case RKW_RTTVAR: {
 			unsigned win;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -890,7 +1277,9 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 				invarg("\"rttvar\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_RTTVAR,
 				(raw) ? win : win * 4);
-		} else if (matches(*argv, "ssthresh") == 0) {
+			break;
+		}
+		case RKW_SSTHRESH: {
 			unsigned win;
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
@@ -900,40 +1289,68 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"ssthresh\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_SSTHRESH, win);
-		} else if (matches(*argv, "realms") == 0) {
+			break;
+		}
+		case RKW_REALMS: {
 			__u32 realm;
 			NEXT_ARG();
 			if (get_rt_realms(&realm, *argv))
 				invarg("\"realm\" value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_FLOW, realm);
-		} else if (strcmp(*argv, "onlink") == 0) {
-			req.r.rtm_flags |= RTNH_F_ONLINK;
-		} else if (strcmp(*argv, "nexthop") == 0) {
+			addattr32(&req->n, sizeof(*req), RTA_FLOW, realm);
+			break;
+		}
+		case RKW_ONLINK:
+			req->r.rtm_flags |= RTNH_F_ONLINK;
+			break;
+		case RKW_NEXTHOP:
+			if (nhgroup) {
+				fprintf(stderr, "Error: \"nexthop\" cannot follow \"nhgroup\"\n");
+				exit(-1);
+			}
 			nhs_ok = 1;
 			break;
-		} else if (matches(*argv, "protocol") == 0) {
+		case RKW_NHGROUP:
+			NEXT_ARG();
+			if (nhgroup)
+				duparg("nhgroup", *argv);
+			nhgroup = *argv;
+			break;
+		case RKW_NHID: {
+			__u32 id;
+			NEXT_ARG();
+			if (get_u32(&id, *argv, 0) || id == 0)
+				invarg("\"nhid\" value is invalid\n", *argv);
+			addattr32(&req->n, sizeof(*req), RTA_NH_ID, id);
+			gw_ok = 1;
+			break;
+		}
+		case RKW_PROTOCOL: {
 			__u32 prot;
 			NEXT_ARG();
 			if (rtnl_rtprot_a2n(&prot, *argv))
 				invarg("\"protocol\" value is invalid\n", *argv);
-			req.r.rtm_protocol = prot;
-		} else if (matches(*argv, "table") == 0) {
+			req->r.rtm_protocol = prot;
+			break;
+		}
+		case RKW_TABLE: {
 			__u32 tid;
 			NEXT_ARG();
 			if (rtnl_rttable_a2n(&tid, *argv))
 				invarg("\"table\" value is invalid\n", *argv);
 			if (tid < 256)
-				req.r.rtm_table = tid;
+				req->r.rtm_table = tid;
 			else {
-				req.r.rtm_table = RT_TABLE_UNSPEC;
-				addattr32(&req.n, sizeof(req), RTA_TABLE, tid);
+				req->r.rtm_table = RT_TABLE_UNSPEC;
+				addattr32(&req->n, sizeof(*req), RTA_TABLE, tid);
 			}
 			table_ok = 1;
-		} else if (strcmp(*argv, "dev") == 0 ||
-			   strcmp(*argv, "oif") == 0) {
+			break;
+		}
+		case RKW_DEV:
 			NEXT_ARG();
 			d = *argv;
-		} else {
+			break;
+		default: {
 			int type;
 			inet_prefix dst;
 
@@ -943,21 +1360,24 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 			if ((**argv < '0' || **argv > '9') &&
 			    rtnl_rtntype_a2n(&type, *argv) == 0) {
 				NEXT_ARG();
-				req.r.rtm_type = type;
+				req->r.rtm_type = type;
 			}
 
 			if (matches(*argv, "help") == 0)
 				usage();
 			if (dst_ok)
 				duparg2("to", *argv);
-			get_prefix(&dst, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = dst.family;
-			req.r.rtm_dst_len = dst.bitlen;
+			get_prefix(&dst, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = dst.family;
+			req->r.rtm_dst_len = dst.bitlen;
 			dst_ok = 1;
 			if (dst.bytelen)
-				addattr_l(&req.n, sizeof(req), RTA_DST, &dst.data, dst.bytelen);
+				addattr_l(&req->n, sizeof(*req), RTA_DST, &dst.data, dst.bytelen);
+		}
 		}
+		if (nhs_ok)
+			break;
 		argc--; argv++;
 	}
 
@@ -971,45 +1391,62 @@ int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
 				fprintf(stderr, "Cannot find device \"%s\"\n", d);
 				return -1;
 			}
-			addattr32(&req.n, sizeof(req), RTA_OIF, idx);
+			addattr32(&req->n, sizeof(*req), RTA_OIF, idx);
 		}
 	}
 
 	if (mxrta->rta_len > RTA_LENGTH(0)) {
 		if (mxlock)
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_LOCK, mxlock);
-		addattr_l(&req.n, sizeof(req), RTA_METRICS, RTA_DATA(mxrta), RTA_PAYLOAD(mxrta));
+		addattr_l(&req->n, sizeof(*req), RTA_METRICS, RTA_DATA(mxrta), RTA_PAYLOAD(mxrta));
 	}
 
 	if (nhs_ok)
-		parse_nexthops(&req.n, &req.r, argc, argv);
+		parse_nexthops(&req->n, sizeof(*req), &req->r, argc, argv);
+	if (nhgroup)
+		nhgroup_put(&req->n, sizeof(*req), &req->r, nhgroup);
 
 	if (!table_ok) {
-		if (req.r.rtm_type == RTN_LOCAL ||
-		    req.r.rtm_type == RTN_BROADCAST ||
-		    req.r.rtm_type == RTN_NAT ||
-		    req.r.rtm_type == RTN_ANYCAST)
-			req.r.rtm_table = RT_TABLE_LOCAL;
+		if (req->r.rtm_type == RTN_LOCAL ||
+		    req->r.rtm_type == RTN_BROADCAST ||
+		    req->r.rtm_type == RTN_NAT ||
+		    req->r.rtm_type == RTN_ANYCAST)
+			req->r.rtm_table = RT_TABLE_LOCAL;
+		else if (deftable >= 256) {
+			req->r.rtm_table = RT_TABLE_UNSPEC;
+			addattr32(&req->n, sizeof(*req), RTA_TABLE, deftable);
+		} else if (deftable)
+			req->r.rtm_table = deftable;
 	}
 	if (!scope_ok) {
-		if (req.r.rtm_type == RTN_LOCAL ||
-		    req.r.rtm_type == RTN_NAT)
-			req.r.rtm_scope = RT_SCOPE_HOST;
-		else if (req.r.rtm_type == RTN_BROADCAST ||
-			 req.r.rtm_type == RTN_MULTICAST ||
-			 req.r.rtm_type == RTN_ANYCAST)
-			req.r.rtm_scope = RT_SCOPE_LINK;
-		else if (req.r.rtm_type == RTN_UNICAST ||
-			 req.r.rtm_type == RTN_UNSPEC) {
+		if (req->r.rtm_type == RTN_LOCAL ||
+		    req->r.rtm_type == RTN_NAT)
+			req->r.rtm_scope = RT_SCOPE_HOST;
+		else if (req->r.rtm_type == RTN_BROADCAST ||
+			 req->r.rtm_type == RTN_MULTICAST ||
+			 req->r.rtm_type == RTN_ANYCAST)
+			req->r.rtm_scope = RT_SCOPE_LINK;
+		else if (req->r.rtm_type == RTN_UNICAST ||
+			 req->r.rtm_type == RTN_UNSPEC) {
 			if (cmd == RTM_DELROUTE)
-				req.r.rtm_scope = RT_SCOPE_NOWHERE;
-			else if (!gw_ok && !nhs_ok)
-				req.r.rtm_scope = RT_SCOPE_LINK;
+				req->r.rtm_scope = RT_SCOPE_NOWHERE;
+			else if (!gw_ok && !nhs_ok && !nhgroup)
+				req->r.rtm_scope = RT_SCOPE_LINK;
 		}
 	}
 
-	if (req.r.rtm_family == AF_UNSPEC)
-		req.r.rtm_family = AF_INET;
+	if (req->r.rtm_family == AF_UNSPEC)
+		req->r.rtm_family = AF_INET;
+
+	return 0;
+}
+
+int iproute_modify(int cmd, unsigned flags, int argc, char **argv)
+{
+	struct iproute_req req;
+
+	if (iproute_parse(cmd, flags, argc, argv, &req, 0) < 0)
+		return -1;
 
 	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
 		exit(2);
@@ -1064,54 +1501,655 @@ static int iproute_flush_cache(void)
 	return 0;
 }
 
-int save_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
+/* Dump routes, letting the kernel drop those outside the selected
+ * table, oif, protocol and type where it can (strict checking, 4.20+).
+ * filter_nlmsg() still runs on everything received, so it remains the
+ * authority on what is shown and the fallback on older kernels.
+ */
+static int iproute_dump_request(int family)
 {
+	struct {
+		struct nlmsghdr	n;
+		struct rtmsg	r;
+		char		buf[64];
+	} req;
 	int ret;
-	int len = n->nlmsg_len;
+
+	if (filter.tb <= 0 && !filter.oif &&
+	    !(filter.protocolmask && filter.protocol) &&
+	    !(filter.typemask && filter.type))
+		return rtnl_wilddump_request(&rth, family, RTM_GETROUTE);
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.n.nlmsg_type = RTM_GETROUTE;
+	req.r.rtm_family = family;
+	if (filter.protocolmask)
+		req.r.rtm_protocol = filter.protocol;
+	if (filter.typemask)
+		req.r.rtm_type = filter.type;
+	if (filter.tb > 0)
+		addattr32(&req.n, sizeof(req), RTA_TABLE, filter.tb);
+	if (filter.oif)
+		addattr32(&req.n, sizeof(req), RTA_OIF, filter.oif);
+
+	ret = rtnl_dump_request_strict(&rth, &req.n);
+	if (ret == 0)
+		return rtnl_wilddump_request(&rth, family, RTM_GETROUTE);
+	return ret;
+}
+
+/* Whether anything narrower than a whole table is selected */
+static int iproute_filter_selects(void)
+{
+	return filter.rdst.family || filter.mdst.family ||
+	       filter.rsrc.family || filter.msrc.family ||
+	       filter.rvia.family || filter.rprefsrc.family ||
+	       filter.oif || filter.iif || filter.tosmask || filter.markmask;
+}
+
+static int count_route(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		       void *arg)
+{
 	struct rtmsg *r = NLMSG_DATA(n);
 	struct rtattr *tb[RTA_MAX+1];
-	int host_len = -1;
-
-	if (isatty(STDOUT_FILENO)) {
-		fprintf(stderr, "Not sending binary stream to stdout\n");
-		return -1;
-	}
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
 
-	host_len = calc_host_len(r);
-	len -= NLMSG_LENGTH(sizeof(*r));
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
 	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (filter_nlmsg(n, tb, calc_host_len(r)))
+		(*(int *)arg)++;
+	return 0;
+}
 
-	if (!filter_nlmsg(n, tb, host_len))
-		return 0;
+/* IPv4 keeps no route cache since 3.6, only PMTU and redirect exceptions,
+ * and the kernel cannot delete those one by one: its only flush bumps
+ * the generation of every cached route, and all flows look up their
+ * routes again.  With a selector that is done only if some exception
+ * matches.  IPv6 exceptions are deleted one by one instead, with
+ * RTM_F_CLONED in the RTM_DELROUTE.
+ */
+static int iproute_flush_cache4(void)
+{
+	int selective = iproute_filter_selects();
+	int matched = 0;
 
-	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
-	if ((ret > 0) && (ret != n->nlmsg_len)) {
-		fprintf(stderr, "Short write while saving nlmsg\n");
-		ret = -EIO;
+	if (selective) {
+		if (rtnl_rtcache_request(&rth, AF_INET) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		if (rtnl_dump_filter(&rth, count_route, &matched) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return -1;
+		}
+		if (matched == 0) {
+			if (show_stats)
+				printf("Nothing to flush in the IPv4 routing cache.\n");
+			return 0;
+		}
 	}
 
-	return ret == n->nlmsg_len ? 0 : ret;
+	if (iproute_flush_cache() < 0)
+		return -1;
+	if (show_stats) {
+		if (selective)
+			printf("*** %d IPv4 cache entr%s matched, ", matched,
+			       matched > 1 ? "ies" : "y");
+		else
+			printf("*** ");
+		printf("IPv4 routing cache is flushed.\n");
+	}
+	return 0;
 }
 
-static int iproute_list_flush_or_save(int argc, char **argv, int action)
+/* Since 5.3 exceptions are only dumped if RTM_F_CLONED asks for them */
+static int iproute_flush_request(int family)
 {
-	int do_ipv6 = preferred_family;
-	char *id = NULL;
-	char *od = NULL;
-	unsigned int mark = 0;
-	rtnl_filter_t filter_fn;
+	if (filter.cloned)
+		return rtnl_rtcache_request(&rth, family);
+	return iproute_dump_request(family);
+}
 
-	if (action == IPROUTE_SAVE)
-		filter_fn = save_route;
-	else
-		filter_fn = print_route;
+/* "ip route save index|compress" writes a versioned stream instead of
+ * bare netlink messages.  The header is never compressed; with
+ * RTSAVE_F_ZLIB everything after it is a gzip stream.  With
+ * RTSAVE_F_INDEX the header is followed by one index entry per table
+ * and the messages are grouped by table in index order, so that a
+ * restore of a single table can skip the others.  Anything that does
+ * not start with RTSAVE_MAGIC is read as the old raw format; the magic
+ * is far too large to be the nlmsg_len of a saved route.
+ */
+#define RTSAVE_MAGIC		0x54525049	/* "IPRT" */
+#define RTSAVE_VERSION		1
 
-	iproute_reset_filter();
-	filter.tb = RT_TABLE_MAIN;
+struct rtsave_hdr
+{
+	__u32	magic;
+	__u16	version;
+	__u16	flags;
+	__u32	tables;
+	__u32	reserved;
+};
 
-	if ((action == IPROUTE_FLUSH) && argc <= 0) {
-		fprintf(stderr, "\"ip route flush\" requires arguments.\n");
-		return -1;
+struct rtsave_index
+{
+	__u32	table;
+	__u32	count;
+	__u64	len;
+};
+
+struct rtsave_msg
+{
+	struct rtsave_msg	*next;
+	struct nlmsghdr		n;
+};
+
+struct rtsave_table
+{
+	struct rtsave_index	idx;
+	struct rtsave_msg	*head;
+	struct rtsave_msg	**tail;
+};
+
+struct rtsave_file
+{
+	int		fd;
+#ifdef HAVE_ZLIB
+	gzFile		gz;
+#endif
+	char		*pushback;
+	int		pushlen;
+};
+
+static struct {
+	int			flags;
+	struct rtsave_file	file;
+	struct arena		arena;
+	struct rtsave_table	*tables;
+	int			ntables;
+} rtsave;
+
+static int rtsave_zlib(struct rtsave_file *f)
+{
+#ifdef HAVE_ZLIB
+	return f->gz != NULL;
+#else
+	return 0;
+#endif
+}
+
+static int rtsave_write(struct rtsave_file *f, const void *buf, int len)
+{
+	int ret;
+
+#ifdef HAVE_ZLIB
+	if (f->gz) {
+		if (gzwrite(f->gz, buf, len) != len) {
+			fprintf(stderr, "Short write while saving nlmsg\n");
+			return -EIO;
+		}
+		return 0;
+	}
+#endif
+	ret = write(f->fd, buf, len);
+	if (ret < 0)
+		return ret;
+	if (ret != len) {
+		fprintf(stderr, "Short write while saving nlmsg\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Returns the number of bytes read, short only at end of file */
+static int rtsave_read(struct rtsave_file *f, void *buf, int len)
+{
+	char *p = buf;
+	int done = 0;
+
+	if (f->pushlen) {
+		done = f->pushlen < len ? f->pushlen : len;
+		memcpy(p, f->pushback, done);
+		f->pushback += done;
+		f->pushlen -= done;
+	}
+
+	while (done < len) {
+		int ret;
+
+#ifdef HAVE_ZLIB
+		if (f->gz)
+			ret = gzread(f->gz, p + done, len - done);
+		else
+#endif
+			ret = read(f->fd, p + done, len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+static int rtsave_skip(struct rtsave_file *f, __u64 len)
+{
+	char buf[8192];
+
+	if (!rtsave_zlib(f) && lseek(f->fd, len, SEEK_CUR) != (off_t)-1)
+		return 0;
+
+	while (len) {
+		int chunk = len < sizeof(buf) ? len : sizeof(buf);
+
+		if (rtsave_read(f, buf, chunk) != chunk) {
+			fprintf(stderr, "Truncated route stream\n");
+			return -1;
+		}
+		len -= chunk;
+	}
+	return 0;
+}
+
+static int rtsave_open_zlib(struct rtsave_file *f, const char *mode)
+{
+#ifdef HAVE_ZLIB
+	int fd = dup(f->fd);
+
+	if (fd < 0 || (f->gz = gzdopen(fd, mode)) == NULL) {
+		fprintf(stderr, "Cannot set up zlib stream\n");
+		return -1;
+	}
+	return 0;
+#else
+	fprintf(stderr, "ip was built without zlib support\n");
+	return -1;
+#endif
+}
+
+static int rtsave_close(struct rtsave_file *f)
+{
+#ifdef HAVE_ZLIB
+	if (f->gz) {
+		int ret = gzclose(f->gz);
+
+		f->gz = NULL;
+		if (ret != Z_OK) {
+			fprintf(stderr, "Error closing zlib stream\n");
+			return -1;
+		}
+	}
+#endif
+	return 0;
+}
+
+static int rtsave_write_hdr(int tables)
+{
+	struct rtsave_hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = RTSAVE_MAGIC;
+	hdr.version = RTSAVE_VERSION;
+	hdr.flags = rtsave.flags;
+	hdr.tables = tables;
+
+	if (rtsave_write(&rtsave.file, &hdr, sizeof(hdr)) < 0)
+		return -1;
+	if ((rtsave.flags & RTSAVE_F_ZLIB) &&
+	    rtsave_open_zlib(&rtsave.file, "wb") < 0)
+		return -1;
+	return 0;
+}
+
+int rtsave_begin(int flags)
+{
+	memset(&rtsave, 0, sizeof(rtsave));
+	rtsave.flags = flags;
+	rtsave.file.fd = STDOUT_FILENO;
+
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending binary stream to stdout\n");
+		return -1;
+	}
+	if (flags & RTSAVE_F_INDEX) {
+		arena_init(&rtsave.arena, 0);
+		return 0;
+	}
+	if (flags)
+		return rtsave_write_hdr(0);
+	return 0;
+}
+
+static int rtsave_queue(struct nlmsghdr *n, __u32 table)
+{
+	struct rtsave_table *t = NULL;
+	struct rtsave_msg *m;
+	int i;
+
+	for (i = rtsave.ntables - 1; i >= 0; i--) {
+		if (rtsave.tables[i].idx.table == table) {
+			t = &rtsave.tables[i];
+			break;
+		}
+	}
+	if (t == NULL) {
+		t = realloc(rtsave.tables, (rtsave.ntables + 1) * sizeof(*t));
+		if (t == NULL)
+			return -ENOMEM;
+		rtsave.tables = t;
+		t += rtsave.ntables++;
+		memset(t, 0, sizeof(*t));
+		t->idx.table = table;
+		t->tail = &t->head;
+	}
+
+	m = arena_alloc(&rtsave.arena, offsetof(struct rtsave_msg, n) + n->nlmsg_len);
+	if (m == NULL)
+		return -ENOMEM;
+	memcpy(&m->n, n, n->nlmsg_len);
+	m->next = NULL;
+	*t->tail = m;
+	t->tail = &m->next;
+	t->idx.count++;
+	t->idx.len += n->nlmsg_len;
+	return 0;
+}
+
+static int rtsave_table_cmp(const void *a, const void *b)
+{
+	const struct rtsave_table *ta = a, *tb = b;
+
+	if (ta->idx.table == tb->idx.table)
+		return 0;
+	return ta->idx.table < tb->idx.table ? -1 : 1;
+}
+
+int rtsave_end(void)
+{
+	int ret = 0;
+	int i;
+
+	if (rtsave.flags & RTSAVE_F_INDEX) {
+		qsort(rtsave.tables, rtsave.ntables, sizeof(*rtsave.tables),
+		      rtsave_table_cmp);
+
+		ret = rtsave_write_hdr(rtsave.ntables);
+		for (i = 0; ret == 0 && i < rtsave.ntables; i++)
+			ret = rtsave_write(&rtsave.file, &rtsave.tables[i].idx,
+					   sizeof(struct rtsave_index));
+		for (i = 0; ret == 0 && i < rtsave.ntables; i++) {
+			struct rtsave_msg *m;
+
+			for (m = rtsave.tables[i].head; m && ret == 0; m = m->next)
+				ret = rtsave_write(&rtsave.file, &m->n, m->n.nlmsg_len);
+		}
+		free(rtsave.tables);
+		arena_free(&rtsave.arena);
+	}
+
+	if (rtsave_close(&rtsave.file) < 0)
+		ret = -1;
+	return ret;
+}
+
+/* Add n, a message of table, to the stream started by rtsave_begin() */
+int rtsave_put(struct nlmsghdr *n, __u32 table)
+{
+	if (rtsave.flags & RTSAVE_F_INDEX)
+		return rtsave_queue(n, table);
+
+	return rtsave_write(&rtsave.file, n, n->nlmsg_len);
+}
+
+int save_route(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
+{
+	int len = n->nlmsg_len;
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	int host_len = -1;
+
+	host_len = calc_host_len(r);
+	len -= NLMSG_LENGTH(sizeof(*r));
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	if (!filter_nlmsg(n, tb, host_len))
+		return 0;
+
+	return rtsave_put(n, rtm_get_table(r, tb));
+}
+
+/* Run the listing once with the output thrown away, so that every
+ * address it would print is resolved in parallel before the real pass.
+ */
+static void iproute_prefetch_hosts(int do_ipv6)
+{
+	FILE *fp;
+	int err;
+
+	fp = fopen("/dev/null", "w");
+	if (fp == NULL)
+		return;
+
+	if (!filter.cloned)
+		err = iproute_dump_request(do_ipv6);
+	else
+		err = rtnl_rtcache_request(&rth, do_ipv6);
+
+	resolve_prefetch = 1;
+	if (err >= 0)
+		rtnl_dump_filter(&rth, print_route, fp);
+	fclose(fp);
+	resolve_flush();
+}
+
+/* "ip route flush ... fast": delete while the dump is running.  The
+ * RTM_DELROUTE requests go out on a second socket through the request
+ * pipeline, FLUSH_FAST_WINDOW of them in flight, coalesced into sends
+ * the size of the flush buffer.  The next round's dump only returns
+ * what survived (failed deletes or routes the walk missed), so rounds
+ * are few and their number is capped.
+ */
+#define FLUSH_FAST_WINDOW	256
+#define FLUSH_FAST_ROUNDS	10
+
+static void flush_fast_error(int cookie, int error, void *arg)
+{
+	/* Already gone, e.g. removed with its device */
+	if (error == ESRCH)
+		return;
+	if (filter.flush_errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+}
+
+static int iproute_flush_fast(int do_ipv6, int bufsize)
+{
+	struct rtnl_handle frth;
+	int round;
+
+	if (rtnl_open(&frth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	filter.flush_rth = &frth;
+
+	for (round = 0; round < FLUSH_FAST_ROUNDS; round++) {
+		if (rtnl_pipeline_open(&frth, FLUSH_FAST_WINDOW,
+				       flush_fast_error, NULL) < 0 ||
+		    rtnl_pipeline_coalesce(&frth, bufsize) < 0) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			break;
+		}
+		if (iproute_flush_request(do_ipv6) < 0) {
+			perror("Cannot send dump request");
+			break;
+		}
+		filter.flushed = 0;
+		filter.flush_errors = 0;
+		if (rtnl_dump_filter(&rth, print_route, stdout) < 0) {
+			fprintf(stderr, "Flush terminated\n");
+			break;
+		}
+		if (rtnl_pipeline_close(&frth) < 0)
+			break;
+
+		if (filter.flushed == 0) {
+			if (show_stats) {
+				if (round == 0 && (!filter.cloned || do_ipv6 == AF_INET6))
+					printf("Nothing to flush.\n");
+				else
+					printf("*** Flush is complete after %d round%s ***\n",
+					       round, round > 1 ? "s" : "");
+			}
+			fflush(stdout);
+			rtnl_close(&frth);
+			filter.flush_rth = NULL;
+			return 0;
+		}
+		if (show_stats) {
+			printf("\n*** Round %d, deleted %d entries",
+			       round + 1, filter.flushed - filter.flush_errors);
+			if (filter.flush_errors)
+				printf(", %d failed", filter.flush_errors);
+			printf(" ***\n");
+			fflush(stdout);
+		}
+		/* Nothing went away, another round will not help */
+		if (filter.flush_errors == filter.flushed)
+			break;
+	}
+
+	if (round == FLUSH_FAST_ROUNDS || filter.flush_errors == filter.flushed)
+		printf("\n*** Flush not completed after %d round%s, %d entries remain ***\n",
+		       round + (round < FLUSH_FAST_ROUNDS),
+		       round + (round < FLUSH_FAST_ROUNDS) > 1 ? "s" : "",
+		       filter.flushed);
+	rtnl_pipeline_close(&frth);
+	rtnl_close(&frth);
+	filter.flush_rth = NULL;
+	return -1;
+}
+
+/* "ip route show match PREFIX longest" indexes the matching routes of
+ * every table in the dump and prints only the one a lookup of PREFIX
+ * would pick in each of them.
+ */
+struct longest_match
+{
+	int		ntables;
+	__u32		*table;
+	struct rtlpm	**lpm;
+};
+
+static int longest_collect(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			   void *arg)
+{
+	struct longest_match *lm = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	__u32 table;
+	int i;
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (!filter_nlmsg(n, tb, calc_host_len(r)))
+		return 0;
+
+	table = rtm_get_table(r, tb);
+	for (i = 0; i < lm->ntables; i++)
+		if (lm->table[i] == table)
+			break;
+	if (i == lm->ntables) {
+		__u32 *t = realloc(lm->table, (i + 1) * sizeof(*t));
+		struct rtlpm **l = realloc(lm->lpm, (i + 1) * sizeof(*l));
+
+		if (t)
+			lm->table = t;
+		if (l)
+			lm->lpm = l;
+		if (t == NULL || l == NULL ||
+		    (lm->lpm[i] = rtlpm_new(filter.mdst.family)) == NULL)
+			return -1;
+		lm->table[i] = table;
+		lm->ntables++;
+	}
+	return rtlpm_add(lm->lpm[i], n) < 0 ? -1 : 0;
+}
+
+static int iproute_list_longest(int do_ipv6)
+{
+	struct longest_match lm;
+	int i, ret = 0;
+
+	memset(&lm, 0, sizeof(lm));
+	if (iproute_dump_request(do_ipv6) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, longest_collect, &lm) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	for (i = 0; i < lm.ntables; i++) {
+		struct nlmsghdr *n;
+
+		if (ret == 0 && rtlpm_build(lm.lpm[i]) < 0) {
+			fprintf(stderr, "Out of memory\n");
+			ret = -1;
+		}
+		if (ret == 0) {
+			n = rtlpm_lookup(lm.lpm[i], filter.mdst.data);
+			if (n)
+				print_route(NULL, n, stdout);
+		}
+		rtlpm_free(lm.lpm[i]);
+	}
+	free(lm.table);
+	free(lm.lpm);
+	return ret;
+}
+
+static int iproute_diff(int do_ipv6, int sync);
+static int iproute_apply_metrics(int do_ipv6);
+static int iproute_showdump(int do_ipv6, int njobs);
+
+#define SHOWDUMP_JOBS_MAX	64
+
+static int iproute_list_flush_or_save(int argc, char **argv, int action)
+{
+	int do_ipv6 = preferred_family;
+	char *id = NULL;
+	char *od = NULL;
+	unsigned int mark = 0;
+	int fast = 0;
+	int longest = 0;
+	int save_flags = 0;
+	int njobs = 1;
+	rtnl_filter_t filter_fn;
+
+	if (action == IPROUTE_SAVE)
+		filter_fn = save_route;
+	else if (action == IPROUTE_LIST && dump_capture)
+		filter_fn = rtnl_to_file;
+	else
+		filter_fn = print_route;
+
+	iproute_reset_filter();
+	/* A dump shows what was saved, whatever the tables */
+	filter.tb = action == IPROUTE_SHOWDUMP ? 0 : RT_TABLE_MAIN;
+
+	if ((action == IPROUTE_FLUSH) &&
+	    (argc <= 0 || (argc == 1 && strcmp(*argv, "fast") == 0))) {
+		fprintf(stderr, "\"ip route flush\" requires arguments.\n");
+		return -1;
 	}
 
 	while (argc > 0) {
@@ -1201,6 +2239,27 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 			    (strchr(*argv, '/') == NULL ||
 			     (*argv)[0] == '/'))
 				filter.realmmask &= ~0xFFFF0000U;
+		} else if (action == IPROUTE_FLUSH &&
+			   strcmp(*argv, "fast") == 0) {
+			fast = 1;
+		} else if (action == IPROUTE_LIST &&
+			   strcmp(*argv, "longest") == 0) {
+			longest = 1;
+		} else if (action == IPROUTE_LIST && !dump_capture &&
+			   strcmp(*argv, "columns") == 0) {
+			filter.columns = 15;
+		} else if (action == IPROUTE_SAVE &&
+			   strcmp(*argv, "index") == 0) {
+			save_flags |= RTSAVE_F_INDEX;
+		} else if (action == IPROUTE_SAVE &&
+			   strcmp(*argv, "compress") == 0) {
+			save_flags |= RTSAVE_F_ZLIB;
+		} else if (action == IPROUTE_SHOWDUMP &&
+			   strcmp(*argv, "jobs") == 0) {
+			NEXT_ARG();
+			if (get_integer(&njobs, *argv, 0) || njobs <= 0 ||
+			    njobs > SHOWDUMP_JOBS_MAX)
+				invarg("invalid number of jobs", *argv);
 		} else if (matches(*argv, "from") == 0) {
 			NEXT_ARG();
 			if (matches(*argv, "root") == 0) {
@@ -1239,6 +2298,9 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 
 	if (do_ipv6 == AF_UNSPEC && filter.tb)
 		do_ipv6 = AF_INET;
+	/* Mixed listings keep the narrow columns, as routel did */
+	if (filter.columns && do_ipv6 == AF_INET6)
+		filter.columns = 39;
 
 	ll_init_map(&rth);
 
@@ -1264,27 +2326,48 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 	}
 	filter.mark = mark;
 
+	if (action == IPROUTE_SHOWDUMP)
+		exit(iproute_showdump(do_ipv6, njobs) < 0);
+
+	if (action == IPROUTE_DIFF || action == IPROUTE_SYNC) {
+		if (filter.cloned) {
+			fprintf(stderr, "The route cache cannot be synced\n");
+			return -1;
+		}
+		exit(iproute_diff(do_ipv6, action == IPROUTE_SYNC) < 0);
+	}
+
+	if (action == IPROUTE_METRICS) {
+		if (filter.cloned) {
+			fprintf(stderr, "Metrics of the route cache cannot be changed\n");
+			return -1;
+		}
+		exit(iproute_apply_metrics(do_ipv6) < 0);
+	}
+
 	if (action == IPROUTE_FLUSH) {
 		int round = 0;
 		char flushb[4096-512];
 		time_t start = time(0);
 
 		if (filter.cloned) {
-			if (do_ipv6 != AF_INET6) {
-				iproute_flush_cache();
-				if (show_stats)
-					printf("*** IPv4 routing cache is flushed.\n");
-			}
+			if (do_ipv6 != AF_INET6 && iproute_flush_cache4() < 0)
+				exit(1);
 			if (do_ipv6 == AF_INET)
 				return 0;
+			/* Only IPv6 exceptions are deleted by RTM_DELROUTE */
+			do_ipv6 = AF_INET6;
 		}
 
 		filter.flushb = flushb;
 		filter.flushp = 0;
 		filter.flushe = sizeof(flushb);
 
+		if (fast)
+			exit(iproute_flush_fast(do_ipv6, sizeof(flushb)) < 0);
+
 		for (;;) {
-			if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
+			if (iproute_flush_request(do_ipv6) < 0) {
 				perror("Cannot send dump request");
 				exit(1);
 			}
@@ -1320,8 +2403,24 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 		}
 	}
 
+	if (longest) {
+		if (!filter.mdst.family || filter.cloned) {
+			fprintf(stderr, "\"longest\" needs \"match PREFIX\"\n");
+			return -1;
+		}
+		exit(iproute_list_longest(do_ipv6) < 0);
+	}
+
+	if (resolve_hosts && action == IPROUTE_LIST && !dump_capture)
+		iproute_prefetch_hosts(do_ipv6);
+
+	if (action == IPROUTE_SAVE && rtsave_begin(save_flags) < 0)
+		exit(1);
+	if (filter.columns)
+		print_columns_hdr(stdout);
+
 	if (!filter.cloned) {
-		if (rtnl_wilddump_request(&rth, do_ipv6, RTM_GETROUTE) < 0) {
+		if (iproute_dump_request(do_ipv6) < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
@@ -1337,39 +2436,43 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 		exit(1);
 	}
 
+	if (action == IPROUTE_SAVE && rtsave_end() < 0)
+		exit(1);
+
 	exit(0);
 }
 
 
-int iproute_get(int argc, char **argv)
+struct iproute_get_opts
 {
-	struct {
-		struct nlmsghdr 	n;
-		struct rtmsg 		r;
-		char   			buf[1024];
-	} req;
-	char  *idev = NULL;
-	char  *odev = NULL;
-	int connected = 0;
-	int from_ok = 0;
-	unsigned int mark = 0;
-
-	memset(&req, 0, sizeof(req));
-
-	iproute_reset_filter();
-	filter.cloned = 2;
+	char	*idev;
+	char	*odev;
+	char	*batch;
+	int	connected;
+	int	from_ok;
+	int	offline;
+	__u32	table;
+	__u32	mark;
+};
 
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.n.nlmsg_type = RTM_GETROUTE;
-	req.r.rtm_family = preferred_family;
-	req.r.rtm_table = 0;
-	req.r.rtm_protocol = 0;
-	req.r.rtm_scope = 0;
-	req.r.rtm_type = 0;
-	req.r.rtm_src_len = 0;
-	req.r.rtm_dst_len = 0;
-	req.r.rtm_tos = 0;
+/* Build the RTM_GETROUTE request for "ip route get" arguments */
+static int iproute_get_parse(int argc, char **argv, struct iproute_req *req,
+			     struct iproute_get_opts *opts)
+{
+	memset(req, 0, sizeof(*req));
+	memset(opts, 0, sizeof(*opts));
+
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_type = RTM_GETROUTE;
+	req->r.rtm_family = preferred_family;
+	req->r.rtm_table = 0;
+	req->r.rtm_protocol = 0;
+	req->r.rtm_scope = 0;
+	req->r.rtm_type = 0;
+	req->r.rtm_src_len = 0;
+	req->r.rtm_dst_len = 0;
+	req->r.rtm_tos = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "tos") == 0 ||
@@ -1378,33 +2481,42 @@ int iproute_get(int argc, char **argv)
 			NEXT_ARG();
 			if (rtnl_dsfield_a2n(&tos, *argv))
 				invarg("TOS value is invalid\n", *argv);
-			req.r.rtm_tos = tos;
+			req->r.rtm_tos = tos;
 		} else if (matches(*argv, "from") == 0) {
 			inet_prefix addr;
 			NEXT_ARG();
 			if (matches(*argv, "help") == 0)
 				usage();
-			from_ok = 1;
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
+			opts->from_ok = 1;
+			get_prefix(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
 			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req), RTA_SRC, &addr.data, addr.bytelen);
-			req.r.rtm_src_len = addr.bitlen;
+				addattr_l(&req->n, sizeof(*req), RTA_SRC, &addr.data, addr.bytelen);
+			req->r.rtm_src_len = addr.bitlen;
 		} else if (matches(*argv, "iif") == 0) {
 			NEXT_ARG();
-			idev = *argv;
+			opts->idev = *argv;
 		} else if (matches(*argv, "mark") == 0) {
 			NEXT_ARG();
-			get_unsigned(&mark, *argv, 0);
+			get_unsigned(&opts->mark, *argv, 0);
 		} else if (matches(*argv, "oif") == 0 ||
 			   strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
-			odev = *argv;
+			opts->odev = *argv;
 		} else if (matches(*argv, "notify") == 0) {
-			req.r.rtm_flags |= RTM_F_NOTIFY;
+			req->r.rtm_flags |= RTM_F_NOTIFY;
 		} else if (matches(*argv, "connected") == 0) {
-			connected = 1;
+			opts->connected = 1;
+		} else if (strcmp(*argv, "batch") == 0) {
+			NEXT_ARG();
+			opts->batch = *argv;
+		} else if (strcmp(*argv, "offline") == 0) {
+			opts->offline = 1;
+		} else if (matches(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&opts->table, *argv) || opts->table == 0)
+				invarg("table id value is invalid\n", *argv);
 		} else {
 			inet_prefix addr;
 			if (strcmp(*argv, "to") == 0) {
@@ -1412,57 +2524,403 @@ int iproute_get(int argc, char **argv)
 			}
 			if (matches(*argv, "help") == 0)
 				usage();
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
+			get_prefix(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
 			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req), RTA_DST, &addr.data, addr.bytelen);
-			req.r.rtm_dst_len = addr.bitlen;
+				addattr_l(&req->n, sizeof(*req), RTA_DST, &addr.data, addr.bytelen);
+			req->r.rtm_dst_len = addr.bitlen;
 		}
 		argc--; argv++;
 	}
 
-	if (req.r.rtm_dst_len == 0) {
-		fprintf(stderr, "need at least destination address\n");
-		exit(1);
-	}
-
-	ll_init_map(&rth);
-
-	if (idev || odev)  {
+	if (opts->idev || opts->odev)  {
 		int idx;
 
-		if (idev) {
-			if ((idx = ll_name_to_index(idev)) == 0) {
-				fprintf(stderr, "Cannot find device \"%s\"\n", idev);
+		if (opts->idev) {
+			if ((idx = ll_name_to_index(opts->idev)) == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n", opts->idev);
 				return -1;
 			}
-			addattr32(&req.n, sizeof(req), RTA_IIF, idx);
+			addattr32(&req->n, sizeof(*req), RTA_IIF, idx);
 		}
-		if (odev) {
-			if ((idx = ll_name_to_index(odev)) == 0) {
-				fprintf(stderr, "Cannot find device \"%s\"\n", odev);
+		if (opts->odev) {
+			if ((idx = ll_name_to_index(opts->odev)) == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n", opts->odev);
 				return -1;
 			}
-			addattr32(&req.n, sizeof(req), RTA_OIF, idx);
+			addattr32(&req->n, sizeof(*req), RTA_OIF, idx);
 		}
 	}
-	if (mark)
-		addattr32(&req.n, sizeof(req), RTA_MARK, mark);
+	if (opts->mark)
+		addattr32(&req->n, sizeof(*req), RTA_MARK, opts->mark);
 
-	if (req.r.rtm_family == AF_UNSPEC)
-		req.r.rtm_family = AF_INET;
+	if (req->r.rtm_family == AF_UNSPEC)
+		req->r.rtm_family = AF_INET;
 
-	if (rtnl_talk(&rth, &req.n, 0, 0, &req.n) < 0)
-		exit(2);
+	if (opts->offline &&
+	    (opts->idev || opts->odev || opts->from_ok || opts->mark ||
+	     opts->connected)) {
+		fprintf(stderr, "\"offline\" only looks up a destination\n");
+		return -1;
+	}
+	if (opts->table && !opts->offline) {
+		fprintf(stderr, "\"table\" needs \"offline\"\n");
+		return -1;
+	}
 
-	if (connected && !from_ok) {
-		struct rtmsg *r = NLMSG_DATA(&req.n);
-		int len = req.n.nlmsg_len;
-		struct rtattr * tb[RTA_MAX+1];
+	return 0;
+}
 
-		if (print_route(NULL, &req.n, (void*)stdout) < 0) {
-			fprintf(stderr, "An error :-)\n");
+/* "ip route get ... offline" resolves destinations against one dump of
+ * the routing tables, indexed for longest prefix match, instead of
+ * asking the kernel every time.  Only the default rules are emulated:
+ * the local, main and default table are tried in this order, or just
+ * the one given with "table".  Throw routes fall through to the next
+ * table.
+ */
+#define OFFLINE_TABLES		3
+
+struct offline_rib
+{
+	int		ntables;
+	__u32		table[OFFLINE_TABLES];
+	struct rtlpm	*lpm[OFFLINE_TABLES];
+};
+
+static struct offline_rib offline_rib[2];
+
+static int offline_collect(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			   void *arg)
+{
+	struct offline_rib *rib = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	__u32 table;
+	int i;
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	table = rtm_get_table(r, tb);
+
+	for (i = 0; i < rib->ntables; i++)
+		if (rib->table[i] == table)
+			return rtlpm_add(rib->lpm[i], n) < 0 ? -1 : 0;
+	return 0;
+}
+
+static struct offline_rib *offline_rib_get(int family, __u32 table)
+{
+	struct offline_rib *rib = &offline_rib[family == AF_INET6];
+	int i;
+
+	if (rib->ntables)
+		return rib;
+
+	if (table) {
+		rib->table[rib->ntables++] = table;
+	} else {
+		rib->table[rib->ntables++] = RT_TABLE_LOCAL;
+		rib->table[rib->ntables++] = RT_TABLE_MAIN;
+		rib->table[rib->ntables++] = RT_TABLE_DEFAULT;
+	}
+	for (i = 0; i < rib->ntables; i++) {
+		rib->lpm[i] = rtlpm_new(family);
+		if (rib->lpm[i] == NULL)
+			goto nomem;
+	}
+
+	if (rtnl_wilddump_request(&rth, family, RTM_GETROUTE) < 0) {
+		perror("Cannot send dump request");
+		exit(1);
+	}
+	if (rtnl_dump_filter(&rth, offline_collect, rib) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		exit(1);
+	}
+
+	for (i = 0; i < rib->ntables; i++)
+		if (rtlpm_build(rib->lpm[i]) < 0)
+			goto nomem;
+	return rib;
+
+nomem:
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+}
+
+static int iproute_get_offline(struct iproute_req *req,
+			       struct iproute_get_opts *opts)
+{
+	struct rtmsg *r = &req->r;
+	struct rtattr *tb[RTA_MAX+1];
+	struct offline_rib *rib;
+	struct nlmsghdr *n = NULL;
+	char abuf[256];
+	const char *dst;
+	int i;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), req->n.nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[RTA_DST] == NULL)
+		return -1;
+
+	rib = offline_rib_get(r->rtm_family, opts->table);
+	for (i = 0; i < rib->ntables; i++) {
+		n = rtlpm_lookup(rib->lpm[i], RTA_DATA(tb[RTA_DST]));
+		if (n && ((struct rtmsg *)NLMSG_DATA(n))->rtm_type != RTN_THROW)
+			break;
+		n = NULL;
+	}
+
+	dst = rt_addr_n2a(r->rtm_family, RTA_PAYLOAD(tb[RTA_DST]),
+			  RTA_DATA(tb[RTA_DST]), abuf, sizeof(abuf));
+	if (n == NULL) {
+		fprintf(stderr, "%s: Network is unreachable\n", dst);
+		return -1;
+	}
+	printf("%s ", dst);
+	return print_route(NULL, n, stdout);
+}
+
+/* "ip route get ... batch FILE" looks up one destination per line of
+ * FILE, each line holding the arguments of "ip route get" that are
+ * added to the ones on the command line.  Up to GET_BATCH_WINDOW
+ * requests are kept in flight on a socket of their own, written with
+ * one send() per GET_BATCH_SNDBUF bytes.  The kernel answers them in
+ * order, so the results come out in input order.
+ */
+#define GET_BATCH_WINDOW	128
+#define GET_BATCH_SNDBUF	16384
+
+struct get_batch
+{
+	struct rtnl_handle	rth;
+	char			sndbuf[GET_BATCH_SNDBUF];
+	int			sndlen;
+	__u32			seq;
+	int			pending;
+	int			errors;
+	int			lineno[GET_BATCH_WINDOW];
+};
+
+static int get_batch_flush(struct get_batch *gb)
+{
+	if (gb->sndlen == 0)
+		return 0;
+	if (rtnl_send(&gb->rth, gb->sndbuf, gb->sndlen) < 0) {
+		perror("Cannot send route request");
+		return -1;
+	}
+	gb->sndlen = 0;
+	return 0;
+}
+
+/* Collect answers until no more than max requests are outstanding */
+static int get_batch_recv(struct get_batch *gb, int max)
+{
+	char buf[16384];
+
+	while (gb->pending > max) {
+		struct nlmsghdr *h;
+		int status;
+
+		status = recv(gb->rth.fd, buf, sizeof(buf), 0);
+		if (status < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("netlink receive error");
+			return -1;
+		}
+		if (status == 0) {
+			fprintf(stderr, "EOF on netlink\n");
+			return -1;
+		}
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status)) {
+			__u32 age = gb->seq - h->nlmsg_seq;
+			int lineno;
+
+			if (h->nlmsg_pid != gb->rth.local.nl_pid ||
+			    age >= gb->pending)
+				continue;
+			lineno = gb->lineno[h->nlmsg_seq % GET_BATCH_WINDOW];
+			gb->pending--;
+
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(h);
+
+				if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+					fprintf(stderr, "ERROR truncated\n");
+				else
+					fprintf(stderr, "line %d: RTNETLINK answers: %s\n",
+						lineno, strerror(-err->error));
+				gb->errors++;
+				continue;
+			}
+			if (print_route(NULL, h, stdout) < 0) {
+				fprintf(stderr, "line %d: not a route\n", lineno);
+				gb->errors++;
+			}
+		}
+	}
+	return 0;
+}
+
+static int get_batch_send(struct get_batch *gb, struct nlmsghdr *n, int lineno)
+{
+	if (gb->pending == GET_BATCH_WINDOW) {
+		if (get_batch_flush(gb) < 0 ||
+		    get_batch_recv(gb, GET_BATCH_WINDOW - 1) < 0)
+			return -1;
+	}
+	if (gb->sndlen + NLMSG_ALIGN(n->nlmsg_len) > sizeof(gb->sndbuf) &&
+	    get_batch_flush(gb) < 0)
+		return -1;
+
+	n->nlmsg_seq = ++gb->seq;
+	gb->lineno[gb->seq % GET_BATCH_WINDOW] = lineno;
+	memcpy(gb->sndbuf + gb->sndlen, n, n->nlmsg_len);
+	gb->sndlen += NLMSG_ALIGN(n->nlmsg_len);
+	gb->pending++;
+	return 0;
+}
+
+static int iproute_get_batch(int argc, char **argv, const char *name)
+{
+	struct get_batch *gb;
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	char **args;
+	FILE *fp;
+	int ret = 0;
+
+	if (strcmp(name, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(name, "r")) == NULL) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+
+	gb = calloc(1, sizeof(*gb));
+	args = malloc((argc + 100) * sizeof(char *));
+	if (gb == NULL || args == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	if (rtnl_open(&gb->rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		struct iproute_get_opts opts;
+		struct iproute_req req;
+		char *cp;
+		int n;
+
+		lineno++;
+		cp = strchr(line, '#');
+		if (cp)
+			*cp = '\0';
+
+		memcpy(args, argv, argc * sizeof(char *));
+		n = makeargs(line, args + argc, 100);
+		if (n == 0)
+			continue;
+
+		if (iproute_get_parse(argc + n, args, &req, &opts) < 0 ||
+		    req.r.rtm_dst_len == 0 || opts.connected || opts.batch) {
+			fprintf(stderr, "line %d: invalid route lookup\n", lineno);
+			gb->errors++;
+			continue;
+		}
+		if (opts.offline) {
+			/* Keep the output in input order */
+			if (get_batch_flush(gb) < 0 || get_batch_recv(gb, 0) < 0) {
+				ret = -1;
+				break;
+			}
+			if (iproute_get_offline(&req, &opts) < 0)
+				gb->errors++;
+			continue;
+		}
+		if (get_batch_send(gb, &req.n, lineno) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret == 0 &&
+	    (get_batch_flush(gb) < 0 || get_batch_recv(gb, 0) < 0))
+		ret = -1;
+	fflush(stdout);
+
+	if (gb->errors)
+		ret = -1;
+	rtnl_close(&gb->rth);
+	free(gb);
+	free(args);
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
+int iproute_get(int argc, char **argv)
+{
+	struct iproute_get_opts opts;
+	struct iproute_req req;
+	int i;
+
+	iproute_reset_filter();
+	filter.cloned = 2;
+
+	ll_init_map(&rth);
+
+	if (iproute_get_parse(argc, argv, &req, &opts) < 0)
+		return -1;
+
+	if (opts.batch) {
+		int n = 0;
+
+		if (opts.connected) {
+			fprintf(stderr, "\"connected\" cannot be used with \"batch\"\n");
+			exit(1);
+		}
+		/* Everything but the batch argument applies to every line */
+		for (i = 0; i < argc; i++) {
+			if (strcmp(argv[i], "batch") == 0) {
+				i++;
+				continue;
+			}
+			argv[n++] = argv[i];
+		}
+		exit(iproute_get_batch(n, argv, opts.batch) < 0);
+	}
+
+	if (req.r.rtm_dst_len == 0) {
+		fprintf(stderr, "need at least destination address\n");
+		exit(1);
+	}
+
+	if (opts.offline)
+		exit(iproute_get_offline(&req, &opts) < 0);
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, &req.n) < 0)
+		exit(2);
+
+	if (opts.connected && !opts.from_ok) {
+		struct rtmsg *r = NLMSG_DATA(&req.n);
+		int len = req.n.nlmsg_len;
+		struct rtattr * tb[RTA_MAX+1];
+
+		if (print_route(NULL, &req.n, (void*)stdout) < 0) {
+			fprintf(stderr, "An error :-)\n");
 			exit(1);
 		}
 
@@ -1485,11 +2943,11 @@ int iproute_get(int argc, char **argv)
 			fprintf(stderr, "Failed to connect the route\n");
 			return -1;
 		}
-		if (!odev && tb[RTA_OIF])
+		if (!opts.odev && tb[RTA_OIF])
 			tb[RTA_OIF]->rta_type = 0;
 		if (tb[RTA_GATEWAY])
 			tb[RTA_GATEWAY]->rta_type = 0;
-		if (!idev && tb[RTA_IIF])
+		if (!opts.idev && tb[RTA_IIF])
 			tb[RTA_IIF]->rta_type = 0;
 		req.n.nlmsg_flags = NLM_F_REQUEST;
 		req.n.nlmsg_type = RTM_GETROUTE;
@@ -1506,24 +2964,1093 @@ int iproute_get(int argc, char **argv)
 	exit(0);
 }
 
-int restore_handler(const struct sockaddr_nl *nl, struct nlmsghdr *n, void *arg)
+#define RESTORE_WINDOW		256
+#define RESTORE_BATCH		32768
+
+enum rtsave_format {
+	RTSAVE_RAW,
+	RTSAVE_V1,
+	RTSAVE_TEXT,
+};
+
+/* Read the header of a route stream on stdin.  Without the magic the
+ * bytes are pushed back as the start of an old raw stream, or with
+ * text_ok of a text file: raw streams start with a small nlmsg_len,
+ * so they always have a zero among the first four bytes.
+ */
+static int rtsave_open_input(struct rtsave_file *f, struct rtsave_hdr *hdr,
+			     int text_ok)
 {
+	char *p = (char *)hdr;
 	int ret;
 
+	memset(f, 0, sizeof(*f));
+	f->fd = STDIN_FILENO;
+
+	ret = rtsave_read(f, hdr, sizeof(*hdr));
+	if (ret < 0)
+		return -1;
+	if (ret == sizeof(*hdr) && hdr->magic == RTSAVE_MAGIC) {
+		if (hdr->version != RTSAVE_VERSION) {
+			fprintf(stderr, "Unsupported route stream version %u\n",
+				hdr->version);
+			return -1;
+		}
+		if ((hdr->flags & RTSAVE_F_ZLIB) &&
+		    rtsave_open_zlib(f, "rb") < 0)
+			return -1;
+		return RTSAVE_V1;
+	}
+
+	f->pushback = p;
+	f->pushlen = ret;
+	if (text_ok && ret >= 4 && p[0] && p[1] && p[2] && p[3])
+		return RTSAVE_TEXT;
+	hdr->flags = 0;
+	return RTSAVE_RAW;
+}
+
+static int rtsave_read_stream(struct rtsave_file *f, __u64 limit, __u32 table,
+			      rtsave_handler_t handler, void *arg)
+{
+	char buf[8192];
+	struct nlmsghdr *n = (struct nlmsghdr *)buf;
+	__u64 done = 0;
+
+	while (limit == 0 || done < limit) {
+		int len, l, ret;
+
+		ret = rtsave_read(f, n, sizeof(*n));
+		if (ret < 0)
+			return -1;
+		if (ret == 0 && limit == 0)
+			return 0;
+		if (ret != sizeof(*n)) {
+			fprintf(stderr, "Truncated route stream\n");
+			return -1;
+		}
+
+		len = n->nlmsg_len;
+		l = len - sizeof(*n);
+		if (l < 0 || len > sizeof(buf)) {
+			fprintf(stderr, "!!!malformed message: len=%d\n", len);
+			return -1;
+		}
+		if (rtsave_read(f, NLMSG_DATA(n), NLMSG_ALIGN(l)) < l) {
+			fprintf(stderr, "Truncated route stream\n");
+			return -1;
+		}
+		done += len;
+
+		if (table) {
+			struct rtmsg *r = NLMSG_DATA(n);
+			struct rtattr *tb[RTA_MAX+1];
+
+			if (l < sizeof(*r))
+				continue;
+			parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len - NLMSG_LENGTH(sizeof(*r)));
+			if (rtm_get_table(r, tb) != table)
+				continue;
+		}
+
+		if (handler(n, arg) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int rtsave_read_indexed(struct rtsave_file *f, int tables, __u32 table,
+			       rtsave_handler_t handler, void *arg)
+{
+	struct rtsave_index *idx;
+	int len = tables * sizeof(*idx);
+	int i, ret = 0;
+
+	idx = malloc(len ? : 1);
+	if (idx == NULL)
+		return -1;
+	if (rtsave_read(f, idx, len) != len) {
+		fprintf(stderr, "Truncated route stream index\n");
+		free(idx);
+		return -1;
+	}
+
+	for (i = 0; ret == 0 && i < tables; i++) {
+		if (idx[i].len == 0)
+			continue;
+		if (table && idx[i].table != table)
+			ret = rtsave_skip(f, idx[i].len);
+		else
+			ret = rtsave_read_stream(f, idx[i].len, 0, handler, arg);
+	}
+	free(idx);
+	return ret;
+}
+
+/* Hand every saved route (of table, if set) to handler */
+static int rtsave_load(struct rtsave_file *f, struct rtsave_hdr *hdr,
+		       __u32 table, rtsave_handler_t handler, void *arg)
+{
+	if (hdr->flags & RTSAVE_F_INDEX)
+		return rtsave_read_indexed(f, hdr->tables, table, handler, arg);
+	return rtsave_read_stream(f, 0, table, handler, arg);
+}
+
+/* Hand every message (of table, if set) of the stream on stdin to handler */
+int rtsave_restore(__u32 table, rtsave_handler_t handler, void *arg)
+{
+	struct rtsave_file file;
+	struct rtsave_hdr hdr;
+	int ret;
+
+	if (rtsave_open_input(&file, &hdr, 0) < 0)
+		return -1;
+	ret = rtsave_load(&file, &hdr, table, handler, arg);
+	if (rtsave_close(&file) < 0)
+		ret = -1;
+	return ret;
+}
+
+struct restore_state
+{
+	int	count;
+	int	errors;
+};
+
+static void restore_error(int cookie, int error, void *arg)
+{
+	struct restore_state *rs = arg;
+
+	/* Routes that already exist are left alone, routes that
+	 * are already gone need not be deleted.
+	 */
+	if (error == EEXIST || error == ESRCH)
+		return;
+	if (rs->errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s (route %d)\n",
+			strerror(error), cookie);
+}
+
+static int restore_route(struct nlmsghdr *n, void *arg)
+{
+	struct restore_state *rs = arg;
+
 	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+	rtnl_pipeline_cookie(&rth, ++rs->count);
+	return rtnl_talk(&rth, n, 0, 0, NULL);
+}
+
+static int restore_begin(struct restore_state *rs)
+{
+	memset(rs, 0, sizeof(*rs));
+	if (rtnl_pipeline_open(&rth, RESTORE_WINDOW, restore_error, rs) < 0 ||
+	    rtnl_pipeline_coalesce(&rth, RESTORE_BATCH) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int restore_end(struct restore_state *rs)
+{
+	int ret = rtnl_pipeline_close(&rth);
+
+	if (rs->errors > 1)
+		fprintf(stderr, "%d of %d routes were not restored\n",
+			rs->errors, rs->count);
+	return ret < 0 || rs->errors ? -1 : 0;
+}
+
+int iproute_restore(int argc, char **argv)
+{
+	struct restore_state rs;
+	__u32 table = 0;
+	int ret;
+
+	while (argc > 0) {
+		if (matches(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&table, *argv) || table == 0)
+				invarg("table id value is invalid\n", *argv);
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown restore option\n", *argv);
+		}
+		argc--; argv++;
+	}
+
+	ll_init_map(&rth);
+
+	if (restore_begin(&rs) < 0)
+		exit(1);
+	ret = rtsave_restore(table, restore_route, &rs);
+	if (restore_end(&rs) < 0)
+		ret = -1;
+
+	exit(ret < 0);
+}
+
+/* "ip route showdump" prints the routes of a "save" stream on stdin
+ * that pass the selectors.  The messages are taken in whole, mapped
+ * when stdin is an uncompressed file and read into memory otherwise.
+ * With "jobs N" they are cut at message boundaries into chunks, which
+ * N threads, the calling one among them, filter and print to memory;
+ * the calling thread writes the chunks out in order as they complete.
+ * Each thread looks links up in a cache of its own; names are only
+ * resolved by a single job.
+ */
+#define SHOWDUMP_CHUNKS		8	/* per job, to keep them all busy */
+#define SHOWDUMP_READ		(1 << 20)
+
+struct showdump_chunk
+{
+	char		*start;
+	size_t		len;
+	char		*out;
+	size_t		outlen;
+	int		err;
+	int		done;
+};
+
+struct showdump
+{
+	char			*map;
+	size_t			maplen;
+	char			*data;
+	size_t			len;
+	int			family;
+	struct showdump_chunk	*chunk;
+	int			nchunks;
+	int			taken;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+};
+
+/* The messages of the stream after its header and index */
+static int showdump_load(struct showdump *sd, struct rtsave_file *f,
+			 struct rtsave_hdr *hdr)
+{
+	size_t size = 0;
+	struct stat st;
+	off_t off;
+
+	if ((hdr->flags & RTSAVE_F_INDEX) &&
+	    rtsave_skip(f, (__u64)hdr->tables * sizeof(struct rtsave_index)) < 0)
+		return -1;
+
+	if (!rtsave_zlib(f) && fstat(f->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (off = lseek(f->fd, 0, SEEK_CUR)) != (off_t)-1 &&
+	    st.st_size > off) {
+		sd->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE, f->fd, 0);
+		if (sd->map != MAP_FAILED) {
+			off -= f->pushlen;
+			sd->maplen = st.st_size;
+			sd->data = sd->map + off;
+			sd->len = st.st_size - off;
+			return 0;
+		}
+		sd->map = NULL;
+	}
+
+	for (;;) {
+		int want, ret;
+
+		if (size - sd->len < SHOWDUMP_READ) {
+			char *data;
+
+			size = size ? size * 2 : 4 * SHOWDUMP_READ;
+			data = realloc(sd->data, size);
+			if (data == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				return -1;
+			}
+			sd->data = data;
+		}
+		want = size - sd->len > (1U << 30) ? 1U << 30 : size - sd->len;
+		ret = rtsave_read(f, sd->data + sd->len, want);
+		if (ret < 0)
+			return -1;
+		sd->len += ret;
+		if (ret < want)
+			return 0;
+	}
+}
+
+/* Check the framing and cut the messages into about nchunks chunks of
+ * whole messages.  What precedes a malformed message is still shown,
+ * the rest is cut off.
+ */
+static int showdump_split(struct showdump *sd, int nchunks)
+{
+	size_t chunk = sd->len / nchunks + 1;
+	size_t pos = 0, start = 0;
+	int ret = 0;
+
+	sd->chunk = calloc(nchunks, sizeof(*sd->chunk));
+	if (sd->chunk == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	while (pos < sd->len) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(sd->data + pos);
+		size_t left = sd->len - pos;
+
+		if (left < sizeof(*n) || n->nlmsg_len > left) {
+			fprintf(stderr, "Truncated route stream\n");
+			ret = -1;
+			break;
+		}
+		if (n->nlmsg_len < sizeof(*n)) {
+			fprintf(stderr, "!!!malformed message: len=%u\n",
+				n->nlmsg_len);
+			ret = -1;
+			break;
+		}
+		pos += NLMSG_ALIGN(n->nlmsg_len);
+		if (pos > sd->len)
+			pos = sd->len;
+		if (pos - start >= chunk) {
+			sd->chunk[sd->nchunks].start = sd->data + start;
+			sd->chunk[sd->nchunks++].len = pos - start;
+			start = pos;
+		}
+	}
+	if (pos > start) {
+		sd->chunk[sd->nchunks].start = sd->data + start;
+		sd->chunk[sd->nchunks++].len = pos - start;
+	}
+	sd->len = pos;
+	return ret;
+}
+
+static int showdump_print(char *p, size_t len, int family, FILE *fp)
+{
+	size_t pos = 0;
+
+	while (pos < len) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(p + pos);
+		struct rtmsg *r = NLMSG_DATA(n);
+
+		pos += NLMSG_ALIGN(n->nlmsg_len);
+		if (family != AF_UNSPEC &&
+		    n->nlmsg_len >= NLMSG_LENGTH(sizeof(*r)) &&
+		    r->rtm_family != family)
+			continue;
+		if (print_route(NULL, n, fp) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void showdump_decode(struct showdump *sd, struct showdump_chunk *c)
+{
+	FILE *fp = open_memstream(&c->out, &c->outlen);
+
+	if (fp == NULL) {
+		c->err = -1;
+		return;
+	}
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	c->err = showdump_print(c->start, c->len, sd->family, fp);
+	if (fclose(fp))
+		c->err = -1;
+}
+
+static void *showdump_worker(void *arg)
+{
+	struct showdump *sd = arg;
 
 	ll_init_map(&rth);
+	pthread_mutex_lock(&sd->lock);
+	while (sd->taken < sd->nchunks) {
+		struct showdump_chunk *c = &sd->chunk[sd->taken++];
+
+		pthread_mutex_unlock(&sd->lock);
+		showdump_decode(sd, c);
+		pthread_mutex_lock(&sd->lock);
+		c->done = 1;
+		pthread_cond_signal(&sd->cond);
+	}
+	pthread_mutex_unlock(&sd->lock);
+	ll_map_flush();
+	return NULL;
+}
+
+/* Write the chunks in order, decoding others while the next is not
+ * ready.  A chunk that failed ends the output, as it would have
+ * without jobs.
+ */
+static int showdump_write(struct showdump *sd, FILE *fp)
+{
+	int i, ret = 0;
+
+	pthread_mutex_lock(&sd->lock);
+	for (i = 0; i < sd->nchunks; i++) {
+		struct showdump_chunk *c = &sd->chunk[i];
+
+		while (!c->done) {
+			struct showdump_chunk *t;
+
+			if (sd->taken == sd->nchunks) {
+				pthread_cond_wait(&sd->cond, &sd->lock);
+				continue;
+			}
+			t = &sd->chunk[sd->taken++];
+			pthread_mutex_unlock(&sd->lock);
+			showdump_decode(sd, t);
+			pthread_mutex_lock(&sd->lock);
+			t->done = 1;
+		}
+		pthread_mutex_unlock(&sd->lock);
+
+		if (c->out)
+			fwrite(c->out, 1, c->outlen, fp);
+		free(c->out);
+		c->out = NULL;
+
+		pthread_mutex_lock(&sd->lock);
+		if (c->err < 0) {
+			sd->taken = sd->nchunks;
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sd->lock);
+	return ret;
+}
+
+static int iproute_showdump(int do_ipv6, int njobs)
+{
+	pthread_t tids[SHOWDUMP_JOBS_MAX];
+	struct rtsave_file file;
+	struct rtsave_hdr hdr;
+	struct showdump sd;
+	int i, started, ret;
+
+	memset(&sd, 0, sizeof(sd));
+	sd.family = do_ipv6;
 
-	ret = rtnl_talk(&rth, n, 0, 0, n);
-	if ((ret < 0) && (errno == EEXIST))
-		ret = 0;
+	if (rtsave_open_input(&file, &hdr, 0) < 0)
+		return -1;
+	ret = showdump_load(&sd, &file, &hdr);
+	if (rtsave_close(&file) < 0)
+		ret = -1;
+	if (ret < 0)
+		goto out;
+
+	if (resolve_hosts)
+		njobs = 1;
+	ret = showdump_split(&sd, njobs * SHOWDUMP_CHUNKS);
+	if (sd.nchunks == 0)
+		goto out;
+
+	if (njobs == 1) {
+		if (showdump_print(sd.data, sd.len, sd.family, stdout) < 0)
+			ret = -1;
+		goto out;
+	}
 
+	pthread_mutex_init(&sd.lock, NULL);
+	pthread_cond_init(&sd.cond, NULL);
+	for (started = 1; started < njobs; started++)
+		if (pthread_create(&tids[started], NULL, showdump_worker,
+				   &sd) != 0)
+			break;
+	if (showdump_write(&sd, stdout) < 0)
+		ret = -1;
+	for (i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
+	pthread_cond_destroy(&sd.cond);
+	pthread_mutex_destroy(&sd.lock);
+
+	for (i = 0; i < sd.nchunks; i++)
+		free(sd.chunk[i].out);
+out:
+	free(sd.chunk);
+	if (sd.map)
+		munmap(sd.map, sd.maplen);
+	else
+		free(sd.data);
 	return ret;
 }
 
-int iproute_restore(void)
+/* "ip route diff|sync" hashes the desired routes, either a "save"
+ * stream or lines in "ip route add" syntax, on the fields the kernel
+ * tells routes apart by, then matches the current routes against them
+ * while they are dumped.  Only missing, different and unwanted routes
+ * are printed or sent; routes outside the SELECTOR are left alone on
+ * both sides.
+ */
+#define RTDIFF_ADD		0
+#define RTDIFF_SAME		1
+#define RTDIFF_REPLACE		2
+
+struct rtdiff_key
+{
+	__u32	table;
+	__u32	priority;
+	__u8	family;
+	__u8	dst_len;
+	__u8	src_len;
+	__u8	tos;
+	__u8	dst[16];
+	__u8	src[16];
+};
+
+struct rtdiff_ent
+{
+	struct rtdiff_ent	*next;
+	struct rtdiff_ent	*hnext;
+	struct rtdiff_key	key;
+	unsigned int		hash;
+	int			state;
+	struct nlmsghdr		n;
+};
+
+static struct {
+	struct arena		arena;
+	struct rtdiff_ent	*want;
+	struct rtdiff_ent	**want_tail;
+	struct rtdiff_ent	*unwanted;
+	struct rtdiff_ent	**unwanted_tail;
+	struct rtdiff_ent	**hash;
+	unsigned int		mask;
+	int			count;
+} rtdiff;
+
+/* Attributes that make two routes with the same key different */
+static const int rtdiff_attrs[] = {
+	RTA_OIF, RTA_GATEWAY, RTA_PREFSRC, RTA_METRICS,
+	RTA_MULTIPATH, RTA_FLOW, RTA_NH_ID,
+};
+
+static int rtdiff_parse(struct nlmsghdr *n, struct rtattr **tb,
+			struct rtdiff_key *key)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return -1;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	memset(key, 0, sizeof(*key));
+	key->table = rtm_get_table(r, tb);
+	key->family = r->rtm_family;
+	key->dst_len = r->rtm_dst_len;
+	key->src_len = r->rtm_src_len;
+	key->tos = r->rtm_tos;
+	if (tb[RTA_PRIORITY])
+		key->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+	else if (r->rtm_family == AF_INET6)
+		key->priority = 1024;	/* IP6_RT_PRIO_USER */
+	if (tb[RTA_DST] && RTA_PAYLOAD(tb[RTA_DST]) <= sizeof(key->dst))
+		memcpy(key->dst, RTA_DATA(tb[RTA_DST]), RTA_PAYLOAD(tb[RTA_DST]));
+	if (tb[RTA_SRC] && RTA_PAYLOAD(tb[RTA_SRC]) <= sizeof(key->src))
+		memcpy(key->src, RTA_DATA(tb[RTA_SRC]), RTA_PAYLOAD(tb[RTA_SRC]));
+	return 0;
+}
+
+static unsigned int rtdiff_hash(const struct rtdiff_key *key)
+{
+	const __u8 *p = (const __u8 *)key;
+	unsigned int hash = 5381;
+	int i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash << 5) + hash + p[i];
+	return hash;
+}
+
+static int rtdiff_attr_equal(struct rtattr *a, struct rtattr *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	return RTA_PAYLOAD(a) == RTA_PAYLOAD(b) &&
+	       memcmp(RTA_DATA(a), RTA_DATA(b), RTA_PAYLOAD(a)) == 0;
+}
+
+static int rtdiff_equal(struct nlmsghdr *a, struct rtattr **ta,
+			struct nlmsghdr *b, struct rtattr **tb)
+{
+	struct rtmsg *ra = NLMSG_DATA(a);
+	struct rtmsg *rb = NLMSG_DATA(b);
+	int i;
+
+	/* IPv6 does not keep the scope, it is always reported as global */
+	if (ra->rtm_family != AF_INET6 && ra->rtm_scope != rb->rtm_scope)
+		return 0;
+	if (ra->rtm_protocol != rb->rtm_protocol ||
+	    ra->rtm_type != rb->rtm_type ||
+	    ((ra->rtm_flags ^ rb->rtm_flags) & RTNH_F_ONLINK))
+		return 0;
+
+	for (i = 0; i < sizeof(rtdiff_attrs) / sizeof(rtdiff_attrs[0]); i++) {
+		int type = rtdiff_attrs[i];
+		struct rtattr *mxa[RTAX_MAX+1];
+		struct rtattr *mxb[RTAX_MAX+1];
+		int j;
+
+		if (type != RTA_METRICS || !ta[type] || !tb[type]) {
+			if (!rtdiff_attr_equal(ta[type], tb[type]))
+				return 0;
+			continue;
+		}
+
+		/* Metrics come back in RTAX order, not as they were given */
+		parse_rtattr(mxa, RTAX_MAX, RTA_DATA(ta[type]), RTA_PAYLOAD(ta[type]));
+		parse_rtattr(mxb, RTAX_MAX, RTA_DATA(tb[type]), RTA_PAYLOAD(tb[type]));
+		for (j = 1; j <= RTAX_MAX; j++)
+			if (!rtdiff_attr_equal(mxa[j], mxb[j]))
+				return 0;
+	}
+	return 1;
+}
+
+static struct rtdiff_ent *rtdiff_copy(struct nlmsghdr *n,
+				      const struct rtdiff_key *key)
+{
+	struct rtdiff_ent *e;
+
+	e = arena_alloc(&rtdiff.arena, offsetof(struct rtdiff_ent, n) + n->nlmsg_len);
+	if (e == NULL)
+		return NULL;
+	memcpy(&e->n, n, n->nlmsg_len);
+	e->key = *key;
+	e->hash = rtdiff_hash(key);
+	e->state = RTDIFF_ADD;
+	e->next = e->hnext = NULL;
+	return e;
+}
+
+static int rtdiff_want(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *tb[RTA_MAX+1];
+	struct rtdiff_key key;
+	struct rtdiff_ent *e;
+
+	if (rtdiff_parse(n, tb, &key) < 0)
+		return 0;
+	if (!filter_nlmsg(n, tb, calc_host_len(NLMSG_DATA(n))))
+		return 0;
+
+	e = rtdiff_copy(n, &key);
+	if (e == NULL)
+		return -1;
+	*rtdiff.want_tail = e;
+	rtdiff.want_tail = &e->next;
+	rtdiff.count++;
+	return 0;
+}
+
+static int rtdiff_want_text(struct rtsave_file *f, __u32 deftable)
 {
-	exit(rtnl_from_file(stdin, &restore_handler, NULL));
+	char *text = NULL, *line, *next;
+	size_t size = 0, len = 0;
+	int lineno = 0;
+	int ret;
+
+	do {
+		if (size - len < 4096) {
+			char *p = realloc(text, size + 65536);
+
+			if (p == NULL) {
+				free(text);
+				return -1;
+			}
+			text = p;
+			size += 65536;
+		}
+		ret = rtsave_read(f, text + len, size - len - 1);
+		if (ret < 0) {
+			free(text);
+			return -1;
+		}
+		len += ret;
+	} while (ret > 0);
+	text[len] = '\0';
+
+	for (line = text; line; line = next) {
+		struct iproute_req req;
+		char *argv[100];
+		int argc;
+
+		lineno++;
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		if (strchr(line, '#'))
+			*strchr(line, '#') = '\0';
+
+		argc = makeargs(line, argv, 100);
+		if (argc == 0)
+			continue;
+		if (iproute_parse(RTM_NEWROUTE, 0, argc, argv, &req, deftable) < 0 ||
+		    rtdiff_want(&req.n, NULL) < 0) {
+			fprintf(stderr, "Invalid route at line %d\n", lineno);
+			free(text);
+			return -1;
+		}
+	}
+	free(text);
+	return 0;
+}
+
+static int rtdiff_hash_want(void)
+{
+	struct rtdiff_ent *e, **pe;
+	unsigned int size = 64;
+
+	while (size < rtdiff.count)
+		size <<= 1;
+	rtdiff.hash = calloc(size, sizeof(*rtdiff.hash));
+	if (rtdiff.hash == NULL)
+		return -1;
+	rtdiff.mask = size - 1;
+
+	for (e = rtdiff.want; e; e = e->next) {
+		/* The last of several routes with the same key wins */
+		for (pe = &rtdiff.hash[e->hash & rtdiff.mask]; *pe; pe = &(*pe)->hnext) {
+			if ((*pe)->hash == e->hash &&
+			    memcmp(&(*pe)->key, &e->key, sizeof(e->key)) == 0) {
+				(*pe)->state = RTDIFF_SAME;
+				e->hnext = (*pe)->hnext;
+				break;
+			}
+		}
+		*pe = e;
+	}
+	return 0;
+}
+
+static int rtdiff_have(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		       void *arg)
+{
+	struct rtattr *tb[RTA_MAX+1];
+	struct rtattr *tw[RTA_MAX+1];
+	struct rtdiff_key key;
+	struct rtdiff_ent *e;
+	struct rtmsg *w;
+	unsigned int hash;
+
+	if (rtdiff_parse(n, tb, &key) < 0)
+		return 0;
+	if (!filter_nlmsg(n, tb, calc_host_len(NLMSG_DATA(n))))
+		return 0;
+
+	hash = rtdiff_hash(&key);
+	for (e = rtdiff.hash[hash & rtdiff.mask]; e; e = e->hnext)
+		if (e->hash == hash && memcmp(&e->key, &key, sizeof(key)) == 0)
+			break;
+
+	if (e == NULL) {
+		e = rtdiff_copy(n, &key);
+		if (e == NULL)
+			return -1;
+		*rtdiff.unwanted_tail = e;
+		rtdiff.unwanted_tail = &e->next;
+		return 0;
+	}
+
+	/* Another route with this key was matched already */
+	if (e->state != RTDIFF_ADD)
+		return 0;
+
+	w = NLMSG_DATA(&e->n);
+	parse_rtattr(tw, RTA_MAX, RTM_RTA(w), e->n.nlmsg_len - NLMSG_LENGTH(sizeof(*w)));
+	e->state = rtdiff_equal(&e->n, tw, n, tb) ? RTDIFF_SAME : RTDIFF_REPLACE;
+	return 0;
+}
+
+static int iproute_diff(int do_ipv6, int sync)
+{
+	static const char *verb[] = { "add", NULL, "replace" };
+	struct restore_state rs;
+	struct rtsave_file file;
+	struct rtsave_hdr hdr;
+	struct rtdiff_ent *e;
+	int stats[3] = { 0, 0, 0 };
+	int deleted = 0;
+	int fmt, ret;
+
+	memset(&rtdiff, 0, sizeof(rtdiff));
+	arena_init(&rtdiff.arena, 0);
+	rtdiff.want_tail = &rtdiff.want;
+	rtdiff.unwanted_tail = &rtdiff.unwanted;
+
+	fmt = rtsave_open_input(&file, &hdr, 1);
+	if (fmt < 0)
+		return -1;
+	if (fmt == RTSAVE_TEXT)
+		ret = rtdiff_want_text(&file, filter.tb > 0 ? filter.tb : 0);
+	else
+		ret = rtsave_load(&file, &hdr, 0, rtdiff_want, NULL);
+	if (rtsave_close(&file) < 0 || ret < 0)
+		return -1;
+	if (rtdiff_hash_want() < 0)
+		return -1;
+
+	if (iproute_dump_request(do_ipv6) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, rtdiff_have, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	if (sync && restore_begin(&rs) < 0)
+		return -1;
+
+	/* New and changed routes go in before the unwanted ones are
+	 * removed, so that nothing is left without a route in between.
+	 */
+	for (e = rtdiff.want; e; e = e->next) {
+		stats[e->state]++;
+		if (e->state == RTDIFF_SAME)
+			continue;
+		if (!sync) {
+			printf("%s ", verb[e->state]);
+			print_route(NULL, &e->n, stdout);
+			continue;
+		}
+		e->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK |
+				   NLM_F_CREATE | NLM_F_REPLACE;
+		rtnl_pipeline_cookie(&rth, ++rs.count);
+		if (rtnl_talk(&rth, &e->n, 0, 0, NULL) < 0)
+			break;
+	}
+	for (e = rtdiff.unwanted; e; e = e->next) {
+		deleted++;
+		if (!sync) {
+			printf("delete ");
+			print_route(NULL, &e->n, stdout);
+			continue;
+		}
+		e->n.nlmsg_type = RTM_DELROUTE;
+		e->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+		rtnl_pipeline_cookie(&rth, ++rs.count);
+		if (rtnl_talk(&rth, &e->n, 0, 0, NULL) < 0)
+			break;
+	}
+
+	ret = 0;
+	if (sync && restore_end(&rs) < 0)
+		ret = -1;
+	if (show_stats)
+		printf("%d added, %d replaced, %d deleted, %d unchanged\n",
+		       stats[RTDIFF_ADD], stats[RTDIFF_REPLACE], deleted,
+		       stats[RTDIFF_SAME]);
+	fflush(stdout);
+
+	free(rtdiff.hash);
+	arena_free(&rtdiff.arena);
+	return ret;
+}
+
+/* "ip route change-metrics": the metrics of the OPTIONS replace those
+ * of every route the SELECTOR matches, everything else about the
+ * routes is sent back as it was dumped.
+ */
+struct chmx_ent
+{
+	struct chmx_ent		*next;
+	struct nlmsghdr		n;
+};
+
+static struct {
+	struct arena		arena;
+	struct rtattr		*mx;
+	__u32			given;
+	__u32			lock;
+	struct chmx_ent		*head;
+	struct chmx_ent		**tail;
+	int			count;
+	int			unchanged;
+} chmx;
+
+static int chmx_unchanged(struct rtattr **old, __u32 oldlock)
+{
+	struct rtattr *mx[RTAX_MAX+1];
+	int i;
+
+	if (((oldlock & ~chmx.given) | chmx.lock) != oldlock)
+		return 0;
+	parse_rtattr(mx, RTAX_MAX, RTA_DATA(chmx.mx), RTA_PAYLOAD(chmx.mx));
+	for (i = 1; i <= RTAX_MAX; i++) {
+		if (i == RTAX_LOCK || mx[i] == NULL)
+			continue;
+		if (old[i] == NULL ||
+		    RTA_PAYLOAD(old[i]) != RTA_PAYLOAD(mx[i]) ||
+		    memcmp(RTA_DATA(old[i]), RTA_DATA(mx[i]), RTA_PAYLOAD(mx[i])))
+			return 0;
+	}
+	return 1;
+}
+
+static int chmx_collect(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX+1];
+	struct rtattr *old[RTAX_MAX+1];
+	struct rtattr *rta, *mxrta, *nest;
+	struct chmx_ent *e;
+	__u32 oldlock = 0;
+	int size, alen;
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
+	if (r->rtm_flags & RTM_F_CLONED)
+		return 0;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (!filter_nlmsg(n, tb, calc_host_len(r)))
+		return 0;
+
+	memset(old, 0, sizeof(old));
+	if (tb[RTA_METRICS])
+		parse_rtattr(old, RTAX_MAX, RTA_DATA(tb[RTA_METRICS]),
+			     RTA_PAYLOAD(tb[RTA_METRICS]));
+	if (old[RTAX_LOCK])
+		oldlock = rta_getattr_u32(old[RTAX_LOCK]);
+	if (chmx_unchanged(old, oldlock)) {
+		chmx.unchanged++;
+		return 0;
+	}
+
+	size = n->nlmsg_len + RTA_ALIGN(RTA_PAYLOAD(chmx.mx)) + 2 * RTA_LENGTH(4);
+	e = arena_alloc(&chmx.arena, offsetof(struct chmx_ent, n) + size);
+	if (e == NULL)
+		return -1;
+
+	/* The route as it is, less its metrics */
+	memcpy(&e->n, n, NLMSG_LENGTH(sizeof(*r)));
+	e->n.nlmsg_len = NLMSG_LENGTH(sizeof(*r));
+	for (rta = RTM_RTA(r), alen = len; RTA_OK(rta, alen);
+	     rta = RTA_NEXT(rta, alen))
+		if (rta->rta_type != RTA_METRICS)
+			addattr_l(&e->n, size, rta->rta_type, RTA_DATA(rta),
+				  RTA_PAYLOAD(rta));
+
+	/* Old metrics that are not set again, also those unknown here,
+	 * then the new ones
+	 */
+	nest = NLMSG_TAIL(&e->n);
+	addattr_l(&e->n, size, RTA_METRICS, NULL, 0);
+	if (tb[RTA_METRICS]) {
+		alen = RTA_PAYLOAD(tb[RTA_METRICS]);
+		for (rta = RTA_DATA(tb[RTA_METRICS]); RTA_OK(rta, alen);
+		     rta = RTA_NEXT(rta, alen)) {
+			if (rta->rta_type == RTAX_LOCK ||
+			    (rta->rta_type < 32 &&
+			     (chmx.given & (1 << rta->rta_type))))
+				continue;
+			addattr_l(&e->n, size, rta->rta_type, RTA_DATA(rta),
+				  RTA_PAYLOAD(rta));
+		}
+	}
+	alen = RTA_PAYLOAD(chmx.mx);
+	for (mxrta = RTA_DATA(chmx.mx); RTA_OK(mxrta, alen);
+	     mxrta = RTA_NEXT(mxrta, alen))
+		if (mxrta->rta_type != RTAX_LOCK)
+			addattr_l(&e->n, size, mxrta->rta_type,
+				  RTA_DATA(mxrta), RTA_PAYLOAD(mxrta));
+	if ((oldlock & ~chmx.given) | chmx.lock)
+		addattr32(&e->n, size, RTAX_LOCK,
+			  (oldlock & ~chmx.given) | chmx.lock);
+	nest->rta_len = (void *)NLMSG_TAIL(&e->n) - (void *)nest;
+
+	e->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_REPLACE;
+	e->next = NULL;
+	*chmx.tail = e;
+	chmx.tail = &e->next;
+	chmx.count++;
+	return 0;
+}
+
+static int iproute_apply_metrics(int do_ipv6)
+{
+	struct restore_state rs;
+	struct chmx_ent *e;
+	int ret;
+
+	arena_init(&chmx.arena, 0);
+	chmx.head = NULL;
+	chmx.tail = &chmx.head;
+
+	if (iproute_dump_request(do_ipv6) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, chmx_collect, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	if (restore_begin(&rs) < 0)
+		return -1;
+	for (e = chmx.head; e; e = e->next) {
+		rtnl_pipeline_cookie(&rth, ++rs.count);
+		if (rtnl_talk(&rth, &e->n, 0, 0, NULL) < 0)
+			break;
+	}
+	ret = rtnl_pipeline_close(&rth) < 0 || rs.errors ? -1 : 0;
+	if (rs.errors > 1)
+		fprintf(stderr, "%d of %d routes were not changed\n",
+			rs.errors, rs.count);
+	if (show_stats)
+		printf("%d changed, %d unchanged\n",
+		       chmx.count - rs.errors, chmx.unchanged);
+	fflush(stdout);
+
+	arena_free(&chmx.arena);
+	return ret;
+}
+
+static int iproute_change_metrics(int argc, char **argv)
+{
+	struct iproute_req req;
+	struct rtattr *tb[RTA_MAX+1];
+	struct rtattr *mx[RTAX_MAX+1];
+	int i, n;
+
+	for (n = 0; n < argc; n++)
+		if (strcmp(argv[n], "match") == 0)
+			break;
+	if (n == 0 || n == argc) {
+		fprintf(stderr, "\"ip route change-metrics\" needs OPTIONS and \"match SELECTOR\".\n");
+		return -1;
+	}
+
+	if (iproute_parse(RTM_NEWROUTE, 0, n, argv, &req, 0) < 0)
+		return -1;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(&req.r),
+		     req.n.nlmsg_len - NLMSG_LENGTH(sizeof(req.r)));
+	for (i = 0; i <= RTA_MAX; i++)
+		if (tb[i] && i != RTA_METRICS)
+			break;
+	if (i <= RTA_MAX || tb[RTA_METRICS] == NULL ||
+	    req.r.rtm_dst_len || req.r.rtm_src_len || req.r.rtm_tos ||
+	    req.r.rtm_flags) {
+		fprintf(stderr, "Only metrics can be changed, such as \"initcwnd\" or \"mtu lock\".\n");
+		return -1;
+	}
+
+	memset(&chmx, 0, sizeof(chmx));
+	chmx.mx = tb[RTA_METRICS];
+	parse_rtattr(mx, RTAX_MAX, RTA_DATA(chmx.mx), RTA_PAYLOAD(chmx.mx));
+	for (i = 1; i <= RTAX_MAX; i++)
+		if (mx[i] && i != RTAX_LOCK)
+			chmx.given |= 1 << i;
+	if (mx[RTAX_LOCK])
+		chmx.lock = rta_getattr_u32(mx[RTAX_LOCK]);
+
+	return iproute_list_flush_or_save(argc - n - 1, argv + n + 1,
+					  IPROUTE_METRICS);
 }
 
 void iproute_reset_filter()
@@ -1533,6 +4060,69 @@ void iproute_reset_filter()
 	filter.msrc.bitlen = -1;
 }
 
+/*
+ * The key of "ip route add|change|replace|...|delete ROUTE" for
+ * -batch-jobs: its table and destination, so that the lines about one
+ * route run in order on one worker.  The destination is only looked
+ * for where the route grammar puts it, after an optional "to" and
+ * type; NULL (run after everything before) if it is not there.
+ */
+const char *iproute_batch_key(int argc, char **argv)
+{
+	static const char *verbs[] = {
+		"add", "change", "replace", "prepend", "append", "test",
+		"delete",
+	};
+	static char key[64];
+	char buf[INET6_ADDRSTRLEN + 8], abuf[INET6_ADDRSTRLEN];
+	__u32 table = RT_TABLE_MAIN;
+	inet_prefix dst;
+	unsigned int i;
+	int type = RTN_UNICAST;
+	char *arg;
+
+	if (argc < 2)
+		return NULL;
+	for (i = 0; i < ARRAY_SIZE(verbs); i++)
+		if (matches(argv[0], verbs[i]) == 0)
+			break;
+	if (i == ARRAY_SIZE(verbs) && strcmp(argv[0], "chg") != 0)
+		return NULL;
+	argc--; argv++;
+
+	if (strcmp(*argv, "to") == 0 && argc > 1) {
+		argc--; argv++;
+	}
+	if ((**argv < '0' || **argv > '9') && argc > 1 &&
+	    rtnl_rtntype_a2n(&type, *argv) == 0) {
+		argc--; argv++;
+	}
+	arg = *argv;
+	if (kw_lookup(&route_kw, arg) >= 0 ||
+	    strlen(arg) >= sizeof(buf))
+		return NULL;
+	strcpy(buf, arg);
+	if (get_prefix_1(&dst, buf, preferred_family))
+		return NULL;
+
+	/* The kernel's default for the types that go to the local table */
+	if (type == RTN_LOCAL || type == RTN_BROADCAST ||
+	    type == RTN_NAT || type == RTN_ANYCAST)
+		table = RT_TABLE_LOCAL;
+	for (argc--, argv++; argc > 1; argc--, argv++)
+		if (strcmp(*argv, "table") == 0) {
+			if (rtnl_rttable_a2n(&table, argv[1]))
+				return NULL;
+			break;
+		}
+
+	snprintf(key, sizeof(key), "%u %d %s/%u", table, dst.family,
+		 dst.bytelen ? rt_addr_n2a(dst.family, dst.bytelen, dst.data,
+					   abuf, sizeof(abuf)) : "",
+		 dst.bitlen);
+	return key;
+}
+
 int do_iproute(int argc, char **argv)
 {
 	if (argc < 1)
@@ -1568,8 +4158,19 @@ int do_iproute(int argc, char **argv)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_FLUSH);
 	if (matches(*argv, "save") == 0)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_SAVE);
+	if (strcmp(*argv, "diff") == 0)
+		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_DIFF);
+	if (strcmp(*argv, "sync") == 0)
+		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_SYNC);
+	if (strcmp(*argv, "change-metrics") == 0)
+		return iproute_change_metrics(argc-1, argv+1);
 	if (matches(*argv, "restore") == 0)
-		return iproute_restore();
+		return iproute_restore(argc-1, argv+1);
+	if (strcmp(*argv, "showdump") == 0)
+		return iproute_list_flush_or_save(argc-1, argv+1,
+						  IPROUTE_SHOWDUMP);
+	if (strcmp(*argv, "nhgroup") == 0)
+		return iproute_nhgroup(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		usage();
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip route help\".\n", *argv);
@@ -0,0 +1,228 @@
+/*
+ * iproute_lpm.c	Longest prefix match over dumped routes.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * A multibit trie with a 16 bit first level and 8 bit levels below it,
+ * built with prefix expansion: every slot holds the best route for all
+ * addresses below it, so a lookup is one array access per level and
+ * never backtracks.  Routes are inserted shortest prefix first, which
+ * means a slot that already points to a child node is never covered
+ * by a later, shorter prefix; a new child inherits the route of the
+ * slot it replaces.  Among routes with the same prefix the one with
+ * the lowest metric wins, as in the kernel.  Routes with a TOS or a
+ * source prefix are not indexed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "utils.h"
+#include "ip_common.h"
+
+#define LPM_ROOT_BITS		16
+#define LPM_NODE_BITS		8
+#define LPM_CHILD		0x80000000U
+
+struct rtlpm_route
+{
+	struct nlmsghdr		*n;
+	__u32			priority;
+	int			order;
+	__u8			plen;
+	__u8			dst[16];
+};
+
+struct rtlpm
+{
+	int			family;
+	int			bits;
+	struct arena		arena;
+	struct rtlpm_route	*routes;
+	int			nroutes;
+	int			maxroutes;
+	__u32			**nodes;
+	int			nnodes;
+	int			maxnodes;
+};
+
+struct rtlpm *rtlpm_new(int family)
+{
+	struct rtlpm *t;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	t->family = family;
+	t->bits = family == AF_INET6 ? 128 : 32;
+	arena_init(&t->arena, 0);
+	return t;
+}
+
+void rtlpm_free(struct rtlpm *t)
+{
+	if (t == NULL)
+		return;
+	arena_free(&t->arena);
+	free(t->routes);
+	free(t->nodes);
+	free(t);
+}
+
+/* Returns 1 if the route was indexed, 0 if it is not eligible */
+int rtlpm_add(struct rtlpm *t, struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	struct rtlpm_route *rt;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0 ||
+	    r->rtm_family != t->family || r->rtm_dst_len > t->bits ||
+	    r->rtm_tos || r->rtm_src_len || (r->rtm_flags & RTM_F_CLONED))
+		return 0;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	if (t->nroutes == t->maxroutes) {
+		int max = t->maxroutes ? t->maxroutes * 2 : 1024;
+
+		rt = realloc(t->routes, max * sizeof(*rt));
+		if (rt == NULL)
+			return -1;
+		t->routes = rt;
+		t->maxroutes = max;
+	}
+
+	rt = &t->routes[t->nroutes];
+	memset(rt, 0, sizeof(*rt));
+	rt->n = arena_alloc(&t->arena, n->nlmsg_len);
+	if (rt->n == NULL)
+		return -1;
+	memcpy(rt->n, n, n->nlmsg_len);
+	rt->plen = r->rtm_dst_len;
+	rt->order = t->nroutes;
+	if (tb[RTA_PRIORITY])
+		rt->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+	if (tb[RTA_DST])
+		memcpy(rt->dst, RTA_DATA(tb[RTA_DST]),
+		       RTA_PAYLOAD(tb[RTA_DST]) < t->bits / 8 ?
+		       RTA_PAYLOAD(tb[RTA_DST]) : t->bits / 8);
+	t->nroutes++;
+	return 1;
+}
+
+/* Shortest prefix first; for the same prefix the preferred route last */
+static int rtlpm_cmp(const void *a, const void *b)
+{
+	const struct rtlpm_route *ra = a, *rb = b;
+
+	if (ra->plen != rb->plen)
+		return ra->plen < rb->plen ? -1 : 1;
+	if (ra->priority != rb->priority)
+		return ra->priority > rb->priority ? -1 : 1;
+	return rb->order - ra->order;
+}
+
+static int rtlpm_node(struct rtlpm *t, int size, __u32 fill)
+{
+	__u32 *node;
+	int i;
+
+	if (t->nnodes == t->maxnodes) {
+		int max = t->maxnodes ? t->maxnodes * 2 : 64;
+		__u32 **nodes = realloc(t->nodes, max * sizeof(*nodes));
+
+		if (nodes == NULL)
+			return -1;
+		t->nodes = nodes;
+		t->maxnodes = max;
+	}
+
+	node = arena_alloc(&t->arena, size * sizeof(__u32));
+	if (node == NULL)
+		return -1;
+	for (i = 0; i < size; i++)
+		node[i] = fill;
+	t->nodes[t->nnodes] = node;
+	return t->nnodes++;
+}
+
+/* The stride bits of addr starting at bit pos */
+static unsigned int rtlpm_bits(const __u8 *addr, int pos, int stride)
+{
+	unsigned int v = addr[pos / 8];
+
+	if (stride == LPM_ROOT_BITS)
+		v = (v << 8) | addr[pos / 8 + 1];
+	return v;
+}
+
+static int rtlpm_insert(struct rtlpm *t, struct rtlpm_route *rt, __u32 leaf)
+{
+	__u32 *node = t->nodes[0];
+	int stride = LPM_ROOT_BITS;
+	int pos = 0;
+
+	for (;;) {
+		unsigned int idx = rtlpm_bits(rt->dst, pos, stride);
+		int child;
+
+		if (rt->plen <= pos + stride) {
+			unsigned int span = 1U << (pos + stride - rt->plen);
+			unsigned int i;
+
+			idx &= ~(span - 1);
+			for (i = 0; i < span; i++)
+				node[idx + i] = leaf;
+			return 0;
+		}
+
+		if (!(node[idx] & LPM_CHILD)) {
+			child = rtlpm_node(t, 1 << LPM_NODE_BITS, node[idx]);
+			if (child < 0)
+				return -1;
+			node[idx] = LPM_CHILD | child;
+		}
+		node = t->nodes[node[idx] & ~LPM_CHILD];
+		pos += stride;
+		stride = LPM_NODE_BITS;
+	}
+}
+
+int rtlpm_build(struct rtlpm *t)
+{
+	int i;
+
+	qsort(t->routes, t->nroutes, sizeof(*t->routes), rtlpm_cmp);
+
+	if (rtlpm_node(t, 1 << LPM_ROOT_BITS, 0) < 0)
+		return -1;
+	for (i = 0; i < t->nroutes; i++)
+		if (rtlpm_insert(t, &t->routes[i], i + 1) < 0)
+			return -1;
+	return 0;
+}
+
+struct nlmsghdr *rtlpm_lookup(struct rtlpm *t, const void *addr)
+{
+	const __u8 *a = addr;
+	__u32 e;
+	int pos;
+
+	if (t->nnodes == 0)
+		return NULL;
+
+	e = t->nodes[0][rtlpm_bits(a, 0, LPM_ROOT_BITS)];
+	for (pos = LPM_ROOT_BITS; e & LPM_CHILD; pos += LPM_NODE_BITS)
+		e = t->nodes[e & ~LPM_CHILD][a[pos / 8]];
+
+	return e ? t->routes[e - 1].n : NULL;
+}
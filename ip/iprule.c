@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -32,7 +33,11 @@ static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: ip rule [ list | add | del | flush ] SELECTOR ACTION\n");
+	fprintf(stderr, "Usage: ip rule [ add | del ] SELECTOR ACTION\n");
+	fprintf(stderr, "       ip rule { list | flush | save } [ pref NUMBER[-NUMBER] ] [ table TABLE_ID ]\n");
+	fprintf(stderr, "       ip rule save ... [ index ] [ compress ]\n");
+	fprintf(stderr, "       ip rule restore [ table TABLE_ID ]\n");
+	fprintf(stderr, "       ip rule bulk { FILE | - }\n");
 	fprintf(stderr, "SELECTOR := [ not ] [ from PREFIX ] [ to PREFIX ] [ tos TOS ] [ fwmark FWMARK[/MASK] ]\n");
 	fprintf(stderr, "            [ iif STRING ] [ oif STRING ] [ pref NUMBER ]\n");
 	fprintf(stderr, "ACTION := [ table TABLE_ID ]\n");
@@ -43,6 +48,31 @@ static void usage(void)
 	exit(-1);
 }
 
+/* Bulk requests, restores and flushes are pipelined on rth */
+#define RULE_BULK_WINDOW	256
+#define RULE_BULK_SNDBUF	32768
+#define RULE_BULK_MAXARGS	64
+
+struct iprule_req
+{
+	struct nlmsghdr 	n;
+	struct rtmsg 		r;
+	char   			buf[1024];
+};
+
+static struct
+{
+	int	prefmask;
+	__u32	pref_min;
+	__u32	pref_max;
+	__u32	table;
+	char	*flushb;
+	int	flushp;
+	int	flushe;
+	int	count;
+	int	errors;
+} filter;
+
 int print_rule(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE*)arg;
@@ -195,24 +225,108 @@ int print_rule(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
-static int iprule_list(int argc, char **argv)
+static int iprule_filter(int argc, char **argv, const char *cmd,
+			 int *save_flags)
+{
+	memset(&filter, 0, sizeof(filter));
+
+	while (argc > 0) {
+		if (matches(*argv, "preference") == 0 ||
+		    matches(*argv, "order") == 0 ||
+		    matches(*argv, "priority") == 0) {
+			char *dash;
+
+			NEXT_ARG();
+			if ((dash = strchr(*argv, '-')) != NULL)
+				*dash = '\0';
+			if (get_u32(&filter.pref_min, *argv, 0))
+				invarg("preference value is invalid\n", *argv);
+			filter.pref_max = filter.pref_min;
+			if (dash && (get_u32(&filter.pref_max, dash + 1, 0) ||
+				     filter.pref_max < filter.pref_min))
+				invarg("preference range is invalid\n", dash + 1);
+			filter.prefmask = 1;
+		} else if (matches(*argv, "table") == 0 ||
+			   strcmp(*argv, "lookup") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&filter.table, *argv) ||
+			    filter.table == 0)
+				invarg("invalid table ID\n", *argv);
+		} else if (save_flags && strcmp(*argv, "index") == 0) {
+			*save_flags |= RTSAVE_F_INDEX;
+		} else if (save_flags && strcmp(*argv, "compress") == 0) {
+			*save_flags |= RTSAVE_F_ZLIB;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			fprintf(stderr, "\"ip rule %s\" does not take \"%s\".\n",
+				cmd, *argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+	return 0;
+}
+
+/* Returns 1 if the rule n passes the pref and table filters */
+static int iprule_match(struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[FRA_MAX+1];
+	__u32 pref;
+
+	if (n->nlmsg_type != RTM_NEWRULE || len < 0)
+		return 0;
+	if (!filter.prefmask && !filter.table)
+		return 1;
+
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(r), len);
+	pref = tb[FRA_PRIORITY] ? rta_getattr_u32(tb[FRA_PRIORITY]) : 0;
+	if (filter.prefmask &&
+	    (pref < filter.pref_min || pref > filter.pref_max))
+		return 0;
+	if (filter.table && rtm_get_table(r, tb) != filter.table)
+		return 0;
+	return 1;
+}
+
+static int list_rule(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		     void *arg)
+{
+	if (!iprule_match(n))
+		return 0;
+	if (dump_capture)
+		return rtnl_to_file(who, n, arg);
+	return print_rule(who, n, arg);
+}
+
+static int save_rule(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		     void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[FRA_MAX+1];
+
+	if (!iprule_match(n))
+		return 0;
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	return rtsave_put(n, rtm_get_table(r, tb));
+}
+
+static int iprule_dump(rtnl_filter_t fn)
 {
 	int af = preferred_family;
 
 	if (af == AF_UNSPEC)
 		af = AF_INET;
 
-	if (argc > 0) {
-		fprintf(stderr, "\"ip rule show\" does not take any arguments.\n");
-		return -1;
-	}
-
 	if (rtnl_wilddump_request(&rth, af, RTM_GETRULE) < 0) {
 		perror("Cannot send dump request");
 		return 1;
 	}
 
-	if (rtnl_dump_filter(&rth, print_rule, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, fn, stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
@@ -220,48 +334,66 @@ static int iprule_list(int argc, char **argv)
 	return 0;
 }
 
+static int iprule_list(int argc, char **argv)
+{
+	if (iprule_filter(argc, argv, "show", NULL) < 0)
+		return -1;
+
+	return iprule_dump(list_rule);
+}
+
+static int iprule_save(int argc, char **argv)
+{
+	int save_flags = 0;
+	int ret;
 
-static int iprule_modify(int cmd, int argc, char **argv)
+	if (iprule_filter(argc, argv, "save", &save_flags) < 0)
+		return -1;
+
+	if (rtsave_begin(save_flags) < 0)
+		return 1;
+	ret = iprule_dump(save_rule);
+	if (rtsave_end() < 0)
+		ret = 1;
+	return ret;
+}
+
+static void iprule_build(int cmd, int argc, char **argv, struct iprule_req *req)
 {
 	int table_ok = 0;
-	struct {
-		struct nlmsghdr 	n;
-		struct rtmsg 		r;
-		char   			buf[1024];
-	} req;
-
-	memset(&req, 0, sizeof(req));
-
-	req.n.nlmsg_type = cmd;
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.r.rtm_family = preferred_family;
-	req.r.rtm_protocol = RTPROT_BOOT;
-	req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-	req.r.rtm_table = 0;
-	req.r.rtm_type = RTN_UNSPEC;
-	req.r.rtm_flags = 0;
+
+	memset(req, 0, sizeof(*req));
+
+	req->n.nlmsg_type = cmd;
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->r.rtm_family = preferred_family;
+	req->r.rtm_protocol = RTPROT_BOOT;
+	req->r.rtm_scope = RT_SCOPE_UNIVERSE;
+	req->r.rtm_table = 0;
+	req->r.rtm_type = RTN_UNSPEC;
+	req->r.rtm_flags = 0;
 
 	if (cmd == RTM_NEWRULE) {
-		req.n.nlmsg_flags |= NLM_F_CREATE|NLM_F_EXCL;
-		req.r.rtm_type = RTN_UNICAST;
+		req->n.nlmsg_flags |= NLM_F_CREATE|NLM_F_EXCL;
+		req->r.rtm_type = RTN_UNICAST;
 	}
 
 	while (argc > 0) {
 		if (strcmp(*argv, "not") == 0) {
-			req.r.rtm_flags |= FIB_RULE_INVERT;
+			req->r.rtm_flags |= FIB_RULE_INVERT;
 		} else if (strcmp(*argv, "from") == 0) {
 			inet_prefix dst;
 			NEXT_ARG();
-			get_prefix(&dst, *argv, req.r.rtm_family);
-			req.r.rtm_src_len = dst.bitlen;
-			addattr_l(&req.n, sizeof(req), FRA_SRC, &dst.data, dst.bytelen);
+			get_prefix(&dst, *argv, req->r.rtm_family);
+			req->r.rtm_src_len = dst.bitlen;
+			addattr_l(&req->n, sizeof(*req), FRA_SRC, &dst.data, dst.bytelen);
 		} else if (strcmp(*argv, "to") == 0) {
 			inet_prefix dst;
 			NEXT_ARG();
-			get_prefix(&dst, *argv, req.r.rtm_family);
-			req.r.rtm_dst_len = dst.bitlen;
-			addattr_l(&req.n, sizeof(req), FRA_DST, &dst.data, dst.bytelen);
+			get_prefix(&dst, *argv, req->r.rtm_family);
+			req->r.rtm_dst_len = dst.bitlen;
+			addattr_l(&req->n, sizeof(*req), FRA_DST, &dst.data, dst.bytelen);
 		} else if (matches(*argv, "preference") == 0 ||
 			   matches(*argv, "order") == 0 ||
 			   matches(*argv, "priority") == 0) {
@@ -269,14 +401,14 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			NEXT_ARG();
 			if (get_u32(&pref, *argv, 0))
 				invarg("preference value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), FRA_PRIORITY, pref);
+			addattr32(&req->n, sizeof(*req), FRA_PRIORITY, pref);
 		} else if (strcmp(*argv, "tos") == 0 ||
 			   matches(*argv, "dsfield") == 0) {
 			__u32 tos;
 			NEXT_ARG();
 			if (rtnl_dsfield_a2n(&tos, *argv))
 				invarg("TOS value is invalid\n", *argv);
-			req.r.rtm_tos = tos;
+			req->r.rtm_tos = tos;
 		} else if (strcmp(*argv, "fwmark") == 0) {
 			char *slash;
 			__u32 fwmark, fwmask;
@@ -285,18 +417,18 @@ static int iprule_modify(int cmd, int argc, char **argv)
 				*slash = '\0';
 			if (get_u32(&fwmark, *argv, 0))
 				invarg("fwmark value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), FRA_FWMARK, fwmark);
+			addattr32(&req->n, sizeof(*req), FRA_FWMARK, fwmark);
 			if (slash) {
 				if (get_u32(&fwmask, slash+1, 0))
 					invarg("fwmask value is invalid\n", slash+1);
-				addattr32(&req.n, sizeof(req), FRA_FWMASK, fwmask);
+				addattr32(&req->n, sizeof(*req), FRA_FWMASK, fwmask);
 			}
 		} else if (matches(*argv, "realms") == 0) {
 			__u32 realm;
 			NEXT_ARG();
 			if (get_rt_realms(&realm, *argv))
 				invarg("invalid realms\n", *argv);
-			addattr32(&req.n, sizeof(req), FRA_FLOW, realm);
+			addattr32(&req->n, sizeof(*req), FRA_FLOW, realm);
 		} else if (matches(*argv, "table") == 0 ||
 			   strcmp(*argv, "lookup") == 0) {
 			__u32 tid;
@@ -304,25 +436,25 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			if (rtnl_rttable_a2n(&tid, *argv))
 				invarg("invalid table ID\n", *argv);
 			if (tid < 256)
-				req.r.rtm_table = tid;
+				req->r.rtm_table = tid;
 			else {
-				req.r.rtm_table = RT_TABLE_UNSPEC;
-				addattr32(&req.n, sizeof(req), FRA_TABLE, tid);
+				req->r.rtm_table = RT_TABLE_UNSPEC;
+				addattr32(&req->n, sizeof(*req), FRA_TABLE, tid);
 			}
 			table_ok = 1;
 		} else if (strcmp(*argv, "dev") == 0 ||
 			   strcmp(*argv, "iif") == 0) {
 			NEXT_ARG();
-			addattr_l(&req.n, sizeof(req), FRA_IFNAME, *argv, strlen(*argv)+1);
+			addattr_l(&req->n, sizeof(*req), FRA_IFNAME, *argv, strlen(*argv)+1);
 		} else if (strcmp(*argv, "oif") == 0) {
 			NEXT_ARG();
-			addattr_l(&req.n, sizeof(req), FRA_OIFNAME, *argv, strlen(*argv)+1);
+			addattr_l(&req->n, sizeof(*req), FRA_OIFNAME, *argv, strlen(*argv)+1);
 		} else if (strcmp(*argv, "nat") == 0 ||
 			   matches(*argv, "map-to") == 0) {
 			NEXT_ARG();
 			fprintf(stderr, "Warning: route NAT is deprecated\n");
-			addattr32(&req.n, sizeof(req), RTA_GATEWAY, get_addr32(*argv));
-			req.r.rtm_type = RTN_NAT;
+			addattr32(&req->n, sizeof(*req), RTA_GATEWAY, get_addr32(*argv));
+			req->r.rtm_type = RTN_NAT;
 		} else {
 			int type;
 
@@ -337,23 +469,30 @@ static int iprule_modify(int cmd, int argc, char **argv)
 				NEXT_ARG();
 				if (get_u32(&target, *argv, 0))
 					invarg("invalid target\n", *argv);
-				addattr32(&req.n, sizeof(req), FRA_GOTO, target);
+				addattr32(&req->n, sizeof(*req), FRA_GOTO, target);
 			} else if (matches(*argv, "nop") == 0)
 				type = FR_ACT_NOP;
 			else if (rtnl_rtntype_a2n(&type, *argv))
 				invarg("Failed to parse rule type", *argv);
-			req.r.rtm_type = type;
+			req->r.rtm_type = type;
 			table_ok = 1;
 		}
 		argc--;
 		argv++;
 	}
 
-	if (req.r.rtm_family == AF_UNSPEC)
-		req.r.rtm_family = AF_INET;
+	if (req->r.rtm_family == AF_UNSPEC)
+		req->r.rtm_family = AF_INET;
 
 	if (!table_ok && cmd == RTM_NEWRULE)
-		req.r.rtm_table = RT_TABLE_MAIN;
+		req->r.rtm_table = RT_TABLE_MAIN;
+}
+
+static int iprule_modify(int cmd, int argc, char **argv)
+{
+	struct iprule_req req;
+
+	iprule_build(cmd, argc, argv, &req);
 
 	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
 		return 2;
@@ -361,59 +500,210 @@ static int iprule_modify(int cmd, int argc, char **argv)
 	return 0;
 }
 
+static void rule_bulk_error(int cookie, int error, void *arg)
+{
+	/* What flush and restore want is already the case */
+	if (arg && (error == ENOENT || error == EEXIST))
+		return;
+	if (cookie > 0)
+		fprintf(stderr, "%s %d: ", arg ? (char *)arg : "line", cookie);
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	filter.errors++;
+}
+
+static int rule_bulk_open(const char *what)
+{
+	filter.count = 0;
+	filter.errors = 0;
+	if (rtnl_pipeline_open(&rth, RULE_BULK_WINDOW, rule_bulk_error,
+			       (void *)what) < 0 ||
+	    rtnl_pipeline_coalesce(&rth, RULE_BULK_SNDBUF) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int rule_bulk_send(struct nlmsghdr *n, int cookie)
+{
+	filter.count++;
+	rtnl_pipeline_cookie(&rth, cookie);
+	return rtnl_talk(&rth, n, 0, 0, NULL);
+}
+
+static int rule_bulk_close(void)
+{
+	if (rtnl_pipeline_close(&rth) < 0 && filter.errors == 0)
+		filter.errors++;
+	if (filter.errors) {
+		if (filter.errors > 1)
+			fprintf(stderr, "%d of %d rule requests failed\n",
+				filter.errors, filter.count);
+		return -1;
+	}
+	return 0;
+}
 
 static int flush_rule(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
-	struct rtnl_handle rth2;
 	struct rtmsg *r = NLMSG_DATA(n);
-	int len = n->nlmsg_len;
 	struct rtattr * tb[FRA_MAX+1];
+	struct nlmsghdr *fn;
 
-	len -= NLMSG_LENGTH(sizeof(*r));
-	if (len < 0)
-		return -1;
-
-	parse_rtattr(tb, FRA_MAX, RTM_RTA(r), len);
+	if (!iprule_match(n))
+		return 0;
 
-	if (tb[FRA_PRIORITY]) {
-		n->nlmsg_type = RTM_DELRULE;
-		n->nlmsg_flags = NLM_F_REQUEST;
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
 
-		if (rtnl_open(&rth2, 0) < 0)
-			return -1;
+	/* The rule without a priority is the local table lookup */
+	if (!tb[FRA_PRIORITY])
+		return 0;
 
-		if (rtnl_talk(&rth2, n, 0, 0, NULL) < 0)
-			return -2;
+	if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
+		int size = filter.flushe ? filter.flushe * 2 : 65536;
+		char *b;
 
-		rtnl_close(&rth2);
+		while (size < NLMSG_ALIGN(filter.flushp) + n->nlmsg_len)
+			size *= 2;
+		b = realloc(filter.flushb, size);
+		if (b == NULL) {
+			perror("Cannot allocate flush buffer");
+			return -1;
+		}
+		filter.flushb = b;
+		filter.flushe = size;
 	}
-
+	fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
+	memcpy(fn, n, n->nlmsg_len);
+	fn->nlmsg_type = RTM_DELRULE;
+	fn->nlmsg_flags = NLM_F_REQUEST;
+	filter.flushp = NLMSG_ALIGN(filter.flushp) + n->nlmsg_len;
 	return 0;
 }
 
+/* The deletes are collected during the dump and sent through a
+ * pipeline once it is done, rather than one request per rule.
+ */
 static int iprule_flush(int argc, char **argv)
 {
-	int af = preferred_family;
-
-	if (af == AF_UNSPEC)
-		af = AF_INET;
+	struct nlmsghdr *fn;
+	int len, ret;
 
-	if (argc > 0) {
-		fprintf(stderr, "\"ip rule flush\" does not allow arguments\n");
+	if (iprule_filter(argc, argv, "flush", NULL) < 0)
 		return -1;
+
+	ret = iprule_dump(flush_rule);
+	if (ret == 0 && filter.flushp && rule_bulk_open("rule") == 0) {
+		len = filter.flushp;
+		for (fn = (struct nlmsghdr *)filter.flushb; NLMSG_OK(fn, len);
+		     fn = NLMSG_NEXT(fn, len))
+			if (rule_bulk_send(fn, filter.count + 1) < 0)
+				break;
+		if (rule_bulk_close() < 0)
+			ret = 2;
+		else if (show_stats)
+			printf("*** Deleted %d rules ***\n", filter.count);
+	} else if (ret == 0 && filter.flushp == 0 && show_stats)
+		printf("Nothing to flush.\n");
+	free(filter.flushb);
+	filter.flushb = NULL;
+	return ret;
+}
+
+static int restore_rule(struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type != RTM_NEWRULE)
+		return 0;
+
+	/* EXCL, or a rule already there would be added a second time */
+	n->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
+	return rule_bulk_send(n, filter.count + 1);
+}
+
+static int iprule_restore(int argc, char **argv)
+{
+	__u32 table = 0;
+	int ret;
+
+	while (argc > 0) {
+		if (matches(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&table, *argv) || table == 0)
+				invarg("table id value is invalid\n", *argv);
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown restore option\n", *argv);
+		}
+		argc--; argv++;
 	}
 
-	if (rtnl_wilddump_request(&rth, af, RTM_GETRULE) < 0) {
-		perror("Cannot send dump request");
+	if (rule_bulk_open("rule") < 0)
 		return 1;
+	ret = rtsave_restore(table, restore_rule, NULL);
+	if (rule_bulk_close() < 0)
+		ret = -1;
+	return ret < 0 ? 2 : 0;
+}
+
+/* "ip rule bulk" reads "add ..." and "del ..." lines and pipelines them */
+static int iprule_bulk(int argc, char **argv)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	if (argc != 1) {
+		fprintf(stderr, "Usage: ip rule bulk { FILE | - }\n");
+		return -1;
+	}
+	if (strcmp(*argv, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(*argv, "r")) == NULL) {
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			*argv, strerror(errno));
+		return -1;
 	}
 
-	if (rtnl_dump_filter(&rth, flush_rule, NULL) < 0) {
-		fprintf(stderr, "Flush terminated\n");
-		return 1;
+	if (rule_bulk_open(NULL) < 0)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *args[RULE_BULK_MAXARGS];
+		struct iprule_req req;
+		char *cp;
+		int cmd, n;
+
+		lineno++;
+		cp = strchr(line, '#');
+		if (cp)
+			*cp = '\0';
+
+		n = makeargs(line, args, RULE_BULK_MAXARGS);
+		if (n == 0)
+			continue;
+		if (matches(args[0], "add") == 0)
+			cmd = RTM_NEWRULE;
+		else if (matches(args[0], "delete") == 0)
+			cmd = RTM_DELRULE;
+		else {
+			fprintf(stderr, "line %d: unknown command \"%s\"\n",
+				lineno, args[0]);
+			filter.count++;
+			filter.errors++;
+			continue;
+		}
+		iprule_build(cmd, n - 1, args + 1, &req);
+		if (rule_bulk_send(&req.n, lineno) < 0)
+			break;
 	}
 
-	return 0;
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return rule_bulk_close() < 0 ? 2 : 0;
 }
 
 int do_iprule(int argc, char **argv)
@@ -430,6 +720,12 @@ int do_iprule(int argc, char **argv)
 		return iprule_modify(RTM_DELRULE, argc-1, argv+1);
 	} else if (matches(argv[0], "flush") == 0) {
 		return iprule_flush(argc-1, argv+1);
+	} else if (matches(argv[0], "save") == 0) {
+		return iprule_save(argc-1, argv+1);
+	} else if (matches(argv[0], "restore") == 0) {
+		return iprule_restore(argc-1, argv+1);
+	} else if (matches(argv[0], "bulk") == 0) {
+		return iprule_bulk(argc-1, argv+1);
 	} else if (matches(argv[0], "help") == 0)
 		usage();
 
@@ -28,6 +28,10 @@
 #include "ip_common.h"
 #include "tunnel.h"
 
+#ifndef IP_DF
+#define IP_DF		0x4000		/* Flag: "Don't Fragment"	*/
+#endif
+
 static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
@@ -47,6 +51,185 @@ static void usage(void)
 	exit(-1);
 }
 
+static const char *tnl_kind(int protocol)
+{
+	switch (protocol) {
+	case IPPROTO_IPIP:
+		return "ipip";
+	case IPPROTO_GRE:
+		return "gre";
+	case IPPROTO_IPV6:
+		return "sit";
+	}
+	return NULL;
+}
+
+static const char *tnl_basedev(int protocol)
+{
+	switch (protocol) {
+	case IPPROTO_IPIP:
+		return "tunl0";
+	case IPPROTO_GRE:
+		return "gre0";
+	case IPPROTO_IPV6:
+		return "sit0";
+	}
+	return NULL;
+}
+
+/* The parameters of l as SIOCGETTUNNEL would give them; -1 if unknown */
+static int tnl_parm_from_nl(struct tnl_nl_link *l, struct ip_tunnel_parm *p,
+			    struct ip_tunnel_6rd *ip6rd)
+{
+	struct rtattr *tb[IFLA_IPTUN_MAX + 1];
+	int gre;
+
+	if (l->kind == NULL || l->data == NULL)
+		return -1;
+	if (strcmp(l->kind, "gre") == 0)
+		gre = 1;
+	else if (strcmp(l->kind, "ipip") == 0 || strcmp(l->kind, "sit") == 0)
+		gre = 0;
+	else
+		return -1;
+
+	memset(p, 0, sizeof(*p));
+	memset(ip6rd, 0, sizeof(*ip6rd));
+	strncpy(p->name, l->name, IFNAMSIZ - 1);
+	p->iph.version = 4;
+	p->iph.ihl = 5;
+
+	if (gre) {
+		struct rtattr *gtb[IFLA_GRE_MAX + 1];
+
+		parse_rtattr_nested(gtb, IFLA_GRE_MAX, l->data);
+		p->iph.protocol = IPPROTO_GRE;
+		if (gtb[IFLA_GRE_LINK])
+			p->link = rta_getattr_u32(gtb[IFLA_GRE_LINK]);
+		if (gtb[IFLA_GRE_IFLAGS])
+			p->i_flags = rta_getattr_u16(gtb[IFLA_GRE_IFLAGS]);
+		if (gtb[IFLA_GRE_OFLAGS])
+			p->o_flags = rta_getattr_u16(gtb[IFLA_GRE_OFLAGS]);
+		if (gtb[IFLA_GRE_IKEY])
+			p->i_key = rta_getattr_u32(gtb[IFLA_GRE_IKEY]);
+		if (gtb[IFLA_GRE_OKEY])
+			p->o_key = rta_getattr_u32(gtb[IFLA_GRE_OKEY]);
+		if (gtb[IFLA_GRE_LOCAL])
+			p->iph.saddr = rta_getattr_u32(gtb[IFLA_GRE_LOCAL]);
+		if (gtb[IFLA_GRE_REMOTE])
+			p->iph.daddr = rta_getattr_u32(gtb[IFLA_GRE_REMOTE]);
+		if (gtb[IFLA_GRE_TTL])
+			p->iph.ttl = rta_getattr_u8(gtb[IFLA_GRE_TTL]);
+		if (gtb[IFLA_GRE_TOS])
+			p->iph.tos = rta_getattr_u8(gtb[IFLA_GRE_TOS]);
+		if (!gtb[IFLA_GRE_PMTUDISC] ||
+		    rta_getattr_u8(gtb[IFLA_GRE_PMTUDISC]))
+			p->iph.frag_off = htons(IP_DF);
+		return 0;
+	}
+
+	parse_rtattr_nested(tb, IFLA_IPTUN_MAX, l->data);
+	p->iph.protocol = l->kind[0] == 's' ? IPPROTO_IPV6 : IPPROTO_IPIP;
+	if (tb[IFLA_IPTUN_PROTO] && l->kind[0] == 's' &&
+	    rta_getattr_u8(tb[IFLA_IPTUN_PROTO]))
+		p->iph.protocol = rta_getattr_u8(tb[IFLA_IPTUN_PROTO]);
+	if (tb[IFLA_IPTUN_LINK])
+		p->link = rta_getattr_u32(tb[IFLA_IPTUN_LINK]);
+	if (tb[IFLA_IPTUN_LOCAL])
+		p->iph.saddr = rta_getattr_u32(tb[IFLA_IPTUN_LOCAL]);
+	if (tb[IFLA_IPTUN_REMOTE])
+		p->iph.daddr = rta_getattr_u32(tb[IFLA_IPTUN_REMOTE]);
+	if (tb[IFLA_IPTUN_TTL])
+		p->iph.ttl = rta_getattr_u8(tb[IFLA_IPTUN_TTL]);
+	if (tb[IFLA_IPTUN_TOS])
+		p->iph.tos = rta_getattr_u8(tb[IFLA_IPTUN_TOS]);
+	if (!tb[IFLA_IPTUN_PMTUDISC] ||
+	    rta_getattr_u8(tb[IFLA_IPTUN_PMTUDISC]))
+		p->iph.frag_off = htons(IP_DF);
+	if (tb[IFLA_IPTUN_FLAGS])
+		p->i_flags = rta_getattr_u16(tb[IFLA_IPTUN_FLAGS]);
+
+	if (tb[IFLA_IPTUN_6RD_PREFIX] &&
+	    RTA_PAYLOAD(tb[IFLA_IPTUN_6RD_PREFIX]) == sizeof(ip6rd->prefix))
+		memcpy(&ip6rd->prefix, RTA_DATA(tb[IFLA_IPTUN_6RD_PREFIX]),
+		       sizeof(ip6rd->prefix));
+	if (tb[IFLA_IPTUN_6RD_RELAY_PREFIX])
+		ip6rd->relay_prefix =
+			rta_getattr_u32(tb[IFLA_IPTUN_6RD_RELAY_PREFIX]);
+	if (tb[IFLA_IPTUN_6RD_PREFIXLEN])
+		ip6rd->prefixlen =
+			rta_getattr_u16(tb[IFLA_IPTUN_6RD_PREFIXLEN]);
+	if (tb[IFLA_IPTUN_6RD_RELAY_PREFIXLEN])
+		ip6rd->relay_prefixlen =
+			rta_getattr_u16(tb[IFLA_IPTUN_6RD_RELAY_PREFIXLEN]);
+	return 0;
+}
+
+static int tnl_parm_fill(struct nlmsghdr *n, int maxlen, void *arg)
+{
+	struct ip_tunnel_parm *p = arg;
+	__u8 pmtudisc = !!(p->iph.frag_off & htons(IP_DF));
+
+	if (p->iph.protocol == IPPROTO_GRE) {
+		addattr32(n, maxlen, IFLA_GRE_IKEY, p->i_key);
+		addattr32(n, maxlen, IFLA_GRE_OKEY, p->o_key);
+		addattr_l(n, maxlen, IFLA_GRE_IFLAGS, &p->i_flags, 2);
+		addattr_l(n, maxlen, IFLA_GRE_OFLAGS, &p->o_flags, 2);
+		addattr_l(n, maxlen, IFLA_GRE_LOCAL, &p->iph.saddr, 4);
+		addattr_l(n, maxlen, IFLA_GRE_REMOTE, &p->iph.daddr, 4);
+		addattr_l(n, maxlen, IFLA_GRE_PMTUDISC, &pmtudisc, 1);
+		if (p->link)
+			addattr32(n, maxlen, IFLA_GRE_LINK, p->link);
+		addattr_l(n, maxlen, IFLA_GRE_TTL, &p->iph.ttl, 1);
+		addattr_l(n, maxlen, IFLA_GRE_TOS, &p->iph.tos, 1);
+		return 0;
+	}
+
+	if (p->link)
+		addattr32(n, maxlen, IFLA_IPTUN_LINK, p->link);
+	addattr_l(n, maxlen, IFLA_IPTUN_LOCAL, &p->iph.saddr, 4);
+	addattr_l(n, maxlen, IFLA_IPTUN_REMOTE, &p->iph.daddr, 4);
+	addattr_l(n, maxlen, IFLA_IPTUN_TTL, &p->iph.ttl, 1);
+	addattr_l(n, maxlen, IFLA_IPTUN_TOS, &p->iph.tos, 1);
+	addattr_l(n, maxlen, IFLA_IPTUN_PMTUDISC, &pmtudisc, 1);
+	if (p->iph.protocol == IPPROTO_IPV6) {
+		__u16 flags = p->i_flags & SIT_ISATAP;
+
+		addattr_l(n, maxlen, IFLA_IPTUN_FLAGS, &flags, 2);
+	}
+	return 0;
+}
+
+struct tnl_get_ctx {
+	struct ip_tunnel_parm	*p;
+	struct ip_tunnel_6rd	*ip6rd;
+	int			found;
+};
+
+static int tnl_get_one(struct tnl_nl_link *l, void *arg)
+{
+	struct tnl_get_ctx *ctx = arg;
+
+	ctx->found = tnl_parm_from_nl(l, ctx->p, ctx->ip6rd) == 0;
+	return 0;
+}
+
+/* SIOCGETTUNNEL through rtnetlink if the kernel can, else the ioctl */
+static int tnl_get(const char *name, struct ip_tunnel_parm *p,
+		   struct ip_tunnel_6rd *ip6rd)
+{
+	struct ip_tunnel_6rd dummy;
+	struct tnl_get_ctx ctx = {
+		.p = p, .ip6rd = ip6rd ? ip6rd : &dummy,
+	};
+
+	if (tnl_nl_list(name, tnl_get_one, &ctx) == 0 && ctx.found)
+		return 0;
+	if (ip6rd)
+		memset(ip6rd, 0, sizeof(*ip6rd));
+	return tnl_get_ioctl(name, p);
+}
+
 static int parse_args(int argc, char **argv, int cmd, struct ip_tunnel_parm *p)
 {
 	int count = 0;
@@ -58,9 +241,6 @@ static int parse_args(int argc, char **argv, int cmd, struct ip_tunnel_parm *p)
 
 	p->iph.version = 4;
 	p->iph.ihl = 5;
-#ifndef IP_DF
-#define IP_DF		0x4000		/* Flag: "Don't Fragment"	*/
-#endif
 	p->iph.frag_off = htons(IP_DF);
 
 	while (argc > 0) {
@@ -200,7 +380,7 @@ static int parse_args(int argc, char **argv, int cmd, struct ip_tunnel_parm *p)
 			if (cmd == SIOCCHGTUNNEL && count == 0) {
 				struct ip_tunnel_parm old_p;
 				memset(&old_p, 0, sizeof(old_p));
-				if (tnl_get_ioctl(*argv, &old_p))
+				if (tnl_get(*argv, &old_p, NULL))
 					return -1;
 				*p = old_p;
 			}
@@ -258,6 +438,7 @@ static int parse_args(int argc, char **argv, int cmd, struct ip_tunnel_parm *p)
 static int do_add(int cmd, int argc, char **argv)
 {
 	struct ip_tunnel_parm p;
+	const char *basedev;
 
 	if (parse_args(argc, argv, cmd, &p) < 0)
 		return -1;
@@ -267,47 +448,47 @@ static int do_add(int cmd, int argc, char **argv)
 		return -1;
 	}
 
-	switch (p.iph.protocol) {
-	case IPPROTO_IPIP:
-		return tnl_add_ioctl(cmd, "tunl0", p.name, &p);
-	case IPPROTO_GRE:
-		return tnl_add_ioctl(cmd, "gre0", p.name, &p);
-	case IPPROTO_IPV6:
-		return tnl_add_ioctl(cmd, "sit0", p.name, &p);
-	default:
+	basedev = tnl_basedev(p.iph.protocol);
+	if (basedev == NULL) {
 		fprintf(stderr, "cannot determine tunnel mode (ipip, gre or sit)\n");
 		return -1;
 	}
-	return -1;
+	if (tnl_nl_supported(cmd == SIOCCHGTUNNEL && p.name[0] ?
+			     p.name : basedev))
+		return tnl_nl_add(cmd, tnl_kind(p.iph.protocol), p.name,
+				  tnl_parm_fill, &p);
+	return tnl_add_ioctl(cmd, basedev, p.name, &p);
 }
 
 static int do_del(int argc, char **argv)
 {
 	struct ip_tunnel_parm p;
+	const char *basedev;
 
 	if (parse_args(argc, argv, SIOCDELTUNNEL, &p) < 0)
 		return -1;
 
-	switch (p.iph.protocol) {
-	case IPPROTO_IPIP:
-		return tnl_del_ioctl("tunl0", p.name, &p);
-	case IPPROTO_GRE:
-		return tnl_del_ioctl("gre0", p.name, &p);
-	case IPPROTO_IPV6:
-		return tnl_del_ioctl("sit0", p.name, &p);
-	default:
-		return tnl_del_ioctl(p.name, p.name, &p);
-	}
-	return -1;
+	if (p.name[0] && tnl_nl_supported(p.name))
+		return tnl_nl_del(p.name);
+
+	/* Without a name the ioctl looks the tunnel up by its parameters */
+	basedev = tnl_basedev(p.iph.protocol);
+	return tnl_del_ioctl(basedev ? basedev : p.name, p.name, &p);
 }
 
-static void print_tunnel(struct ip_tunnel_parm *p)
+/* ip6rd is what rtnetlink said, NULL to ask the ioctl */
+static void print_tunnel(struct ip_tunnel_parm *p, struct ip_tunnel_6rd *ip6rd)
 {
-	struct ip_tunnel_6rd ip6rd;
+	struct ip_tunnel_6rd get6rd;
 	char s1[1024];
 	char s2[1024];
 
-	memset(&ip6rd, 0, sizeof(ip6rd));
+	if (ip6rd == NULL) {
+		ip6rd = &get6rd;
+		memset(ip6rd, 0, sizeof(*ip6rd));
+		if (p->iph.protocol == IPPROTO_IPV6)
+			tnl_ioctl_get_6rd(p->name, ip6rd);
+	}
 
 	/* Do not use format_host() for local addr,
 	 * symbolic name will not be useful.
@@ -361,14 +542,14 @@ static void print_tunnel(struct ip_tunnel_parm *p)
 	if (!(p->iph.frag_off&htons(IP_DF)))
 		printf(" nopmtudisc");
 
-	if (p->iph.protocol == IPPROTO_IPV6 && !tnl_ioctl_get_6rd(p->name, &ip6rd) && ip6rd.prefixlen) {
+	if (p->iph.protocol == IPPROTO_IPV6 && ip6rd->prefixlen) {
 		printf(" 6rd-prefix %s/%u ",
-		       inet_ntop(AF_INET6, &ip6rd.prefix, s1, sizeof(s1)),
-		       ip6rd.prefixlen);
-		if (ip6rd.relay_prefix) {
+		       inet_ntop(AF_INET6, &ip6rd->prefix, s1, sizeof(s1)),
+		       ip6rd->prefixlen);
+		if (ip6rd->relay_prefix) {
 			printf("6rd-relay_prefix %s/%u ",
-			       format_host(AF_INET, 4, &ip6rd.relay_prefix, s1, sizeof(s1)),
-			       ip6rd.relay_prefixlen);
+			       format_host(AF_INET, 4, &ip6rd->relay_prefix, s1, sizeof(s1)),
+			       ip6rd->relay_prefixlen);
 		}
 	}
 
@@ -391,7 +572,44 @@ static void print_tunnel(struct ip_tunnel_parm *p)
 		printf("%s  Checksum output packets.", _SL_);
 }
 
-static int do_tunnels_list(struct ip_tunnel_parm *p)
+static int tnl_parm_match(const struct ip_tunnel_parm *p,
+			  const struct ip_tunnel_parm *p1)
+{
+	return !((p->link && p1->link != p->link) ||
+		 (p->name[0] && strcmp(p1->name, p->name)) ||
+		 (p->iph.daddr && p1->iph.daddr != p->iph.daddr) ||
+		 (p->iph.saddr && p1->iph.saddr != p->iph.saddr) ||
+		 (p->i_key && p1->i_key != p->i_key));
+}
+
+static int tnl_list_one(struct tnl_nl_link *l, void *arg)
+{
+	struct ip_tunnel_parm *p = arg;
+	struct ip_tunnel_parm p1;
+	struct ip_tunnel_6rd ip6rd, *six = &ip6rd;
+
+	if (l->type != ARPHRD_TUNNEL && l->type != ARPHRD_IPGRE &&
+	    l->type != ARPHRD_SIT)
+		return 0;
+	if (p->name[0] && strcmp(p->name, l->name))
+		return 0;
+	if (tnl_parm_from_nl(l, &p1, &ip6rd) < 0) {
+		memset(&p1, 0, sizeof(p1));
+		if (tnl_get_ioctl(l->name, &p1))
+			return 0;
+		six = NULL;
+	}
+	if (!tnl_parm_match(p, &p1))
+		return 0;
+	print_tunnel(&p1, six);
+	if (show_stats && l->has_stats)
+		tnl_print_stats(&l->stats);
+	printf("\n");
+	return 0;
+}
+
+/* For kernels that cannot dump links: /proc/net/dev and the ioctls */
+static int do_tunnels_list_proc(struct ip_tunnel_parm *p)
 {
 	char name[IFNAMSIZ];
 	unsigned long  rx_bytes, rx_packets, rx_errs, rx_drops,
@@ -446,13 +664,9 @@ static int do_tunnels_list(struct ip_tunnel_parm *p)
 		memset(&p1, 0, sizeof(p1));
 		if (tnl_get_ioctl(name, &p1))
 			continue;
-		if ((p->link && p1.link != p->link) ||
-		    (p->name[0] && strcmp(p1.name, p->name)) ||
-		    (p->iph.daddr && p1.iph.daddr != p->iph.daddr) ||
-		    (p->iph.saddr && p1.iph.saddr != p->iph.saddr) ||
-		    (p->i_key && p1.i_key != p->i_key))
+		if (!tnl_parm_match(p, &p1))
 			continue;
-		print_tunnel(&p1);
+		print_tunnel(&p1, NULL);
 		if (show_stats) {
 			printf("%s", _SL_);
 			printf("RX: Packets    Bytes        Errors CsumErrs OutOfSeq Mcasts%s", _SL_);
@@ -468,33 +682,32 @@ static int do_tunnels_list(struct ip_tunnel_parm *p)
 	return 0;
 }
 
+static int do_tunnels_list(struct ip_tunnel_parm *p)
+{
+	if (tnl_nl_list(NULL, tnl_list_one, p) == 0)
+		return 0;
+	return do_tunnels_list_proc(p);
+}
+
 static int do_show(int argc, char **argv)
 {
-	int err;
 	struct ip_tunnel_parm p;
+	struct ip_tunnel_6rd ip6rd;
+	const char *basedev;
 
 	ll_init_map(&rth);
 	if (parse_args(argc, argv, SIOCGETTUNNEL, &p) < 0)
 		return -1;
 
-	switch (p.iph.protocol) {
-	case IPPROTO_IPIP:
-		err = tnl_get_ioctl(p.name[0] ? p.name : "tunl0", &p);
-		break;
-	case IPPROTO_GRE:
-		err = tnl_get_ioctl(p.name[0] ? p.name : "gre0", &p);
-		break;
-	case IPPROTO_IPV6:
-		err = tnl_get_ioctl(p.name[0] ? p.name : "sit0", &p);
-		break;
-	default:
+	basedev = tnl_basedev(p.iph.protocol);
+	if (basedev == NULL) {
 		do_tunnels_list(&p);
 		return 0;
 	}
-	if (err)
+	if (tnl_get(p.name[0] ? p.name : basedev, &p, &ip6rd))
 		return -1;
 
-	print_tunnel(&p);
+	print_tunnel(&p, &ip6rd);
 	printf("\n");
 	return 0;
 }
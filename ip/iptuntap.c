@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
 #include <linux/if.h>
@@ -32,22 +33,49 @@
 
 #define TUNDEV "/dev/net/tun"
 
+/* File descriptors one SCM_RIGHTS message can carry (SCM_MAX_FD) */
+#define TAP_MAX_QUEUES	253
+
+struct tap_add
+{
+	uid_t	uid;
+	gid_t	gid;
+	int	queues;
+	int	handoff;
+};
+
+/* Set when a range of devices is added or deleted */
+static int tap_bulk;
+
 static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
 {
 	fprintf(stderr, "Usage: ip tuntap { add | del } [ dev PHYS_DEV ] \n");
 	fprintf(stderr, "          [ mode { tun | tap } ] [ user USER ] [ group GROUP ]\n");
-	fprintf(stderr, "          [ one_queue ] [ pi ] [ vnet_hdr ]\n");
+	fprintf(stderr, "          [ one_queue ] [ pi ] [ vnet_hdr ] [ multi_queue ]\n");
+	fprintf(stderr, "          [ queues NUMBER ] [ handoff SOCKET ]\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Where: USER  := { STRING | NUMBER }\n");
+	fprintf(stderr, "Where: PHYS_DEV may hold a range {A..B} to add or delete many\n");
+	fprintf(stderr, "       USER  := { STRING | NUMBER }\n");
 	fprintf(stderr, "       GROUP := { STRING | NUMBER }\n");
 	exit(-1);
 }
 
-static int tap_add_ioctl(struct ifreq *ifr, uid_t uid, gid_t gid)
+static void tap_error(const struct ifreq *ifr, const char *what)
 {
-	int fd;
+	if (tap_bulk)
+		fprintf(stderr, "%s: ", ifr->ifr_name);
+	perror(what);
+}
+
+/* Creates the device of ifr.  With a.queues, that many queues are
+ * opened, the first one creating the device, and their descriptors
+ * are left in fds.
+ */
+static int tap_add_ioctl(struct ifreq *ifr, const struct tap_add *a, int *fds)
+{
+	int fd, i;
 	int ret = -1;
 
 #ifdef IFF_TUN_EXCL
@@ -60,28 +88,128 @@ static int tap_add_ioctl(struct ifreq *ifr, uid_t uid, gid_t gid)
 		return -1;
 	}
 	if (ioctl(fd, TUNSETIFF, ifr)) {
-		perror("ioctl(TUNSETIFF)");
+		tap_error(ifr, "ioctl(TUNSETIFF)");
 		goto out;
 	}
-	if (uid != -1 && ioctl(fd, TUNSETOWNER, uid)) {
-		perror("ioctl(TUNSETOWNER)");
+	if (a->uid != -1 && ioctl(fd, TUNSETOWNER, a->uid)) {
+		tap_error(ifr, "ioctl(TUNSETOWNER)");
 		goto out;
 	}
-	if (gid != -1 && ioctl(fd, TUNSETGROUP, gid)) {
-		perror("ioctl(TUNSETGROUP)");
+	if (a->gid != -1 && ioctl(fd, TUNSETGROUP, a->gid)) {
+		tap_error(ifr, "ioctl(TUNSETGROUP)");
 		goto out;
 	}
 	if (ioctl(fd, TUNSETPERSIST, 1)) {
-		perror("ioctl(TUNSETPERSIST)");
+		tap_error(ifr, "ioctl(TUNSETPERSIST)");
 		goto out;
 	}
-	ret = 0;
+	if (a->queues == 0) {
+		ret = 0;
+		goto out;
+	}
+
+	/* The other queues attach to the device, which now exists */
+#ifdef IFF_TUN_EXCL
+	ifr->ifr_flags &= ~IFF_TUN_EXCL;
+#endif
+	fds[0] = fd;
+	for (i = 1; i < a->queues; i++) {
+		fds[i] = open(TUNDEV, O_RDWR);
+		if (fds[i] < 0) {
+			perror("open");
+			break;
+		}
+		if (ioctl(fds[i], TUNSETIFF, ifr)) {
+			tap_error(ifr, "ioctl(TUNSETIFF)");
+			close(fds[i]);
+			break;
+		}
+	}
+	if (i == a->queues)
+		return 0;
+	while (--i > 0)
+		close(fds[i]);
  out:
 	close(fd);
 	return ret;
 }
 
-static int tap_del_ioctl(struct ifreq *ifr)
+static int tap_handoff_open(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path \"%s\" is too long\n", path);
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "Cannot connect to \"%s\": %s\n", path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* One message per device: its name padded to IFNAMSIZ, with the
+ * descriptors of its queues in SCM_RIGHTS.
+ */
+static int tap_handoff(int sk, const struct ifreq *ifr, const int *fds,
+		       int queues)
+{
+	char name[IFNAMSIZ];
+	char cbuf[CMSG_SPACE(TAP_MAX_QUEUES * sizeof(int))];
+	struct iovec iov = { .iov_base = name, .iov_len = sizeof(name) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = CMSG_SPACE(queues * sizeof(int)),
+	};
+	struct cmsghdr *cmsg;
+
+	memset(name, 0, sizeof(name));
+	memcpy(name, ifr->ifr_name, strnlen(ifr->ifr_name, IFNAMSIZ - 1));
+	memset(cbuf, 0, sizeof(cbuf));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(queues * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, queues * sizeof(int));
+
+	if (sendmsg(sk, &msg, 0) < 0) {
+		tap_error(ifr, "sendmsg");
+		return -1;
+	}
+	return 0;
+}
+
+static int tap_add(struct ifreq *ifr, void *arg)
+{
+	const struct tap_add *a = arg;
+	int fds[TAP_MAX_QUEUES];
+	int i, ret;
+
+	if (tap_add_ioctl(ifr, a, fds) < 0)
+		return -1;
+	if (a->queues == 0)
+		return 0;
+
+	ret = tap_handoff(a->handoff, ifr, fds, a->queues);
+	for (i = 0; i < a->queues; i++)
+		close(fds[i]);
+	return ret;
+}
+
+static int tap_del_ioctl(struct ifreq *ifr, void *arg)
 {
 	int fd = open(TUNDEV, O_RDWR);
 	int ret = -1;
@@ -91,11 +219,11 @@ static int tap_del_ioctl(struct ifreq *ifr)
 		return -1;
 	}
 	if (ioctl(fd, TUNSETIFF, ifr)) {
-		perror("ioctl(TUNSETIFF)");
+		tap_error(ifr, "ioctl(TUNSETIFF)");
 		goto out;
 	}
 	if (ioctl(fd, TUNSETPERSIST, 0)) {
-		perror("ioctl(TUNSETPERSIST)");
+		tap_error(ifr, "ioctl(TUNSETPERSIST)");
 		goto out;
 	}
 	ret = 0;
@@ -104,7 +232,8 @@ static int tap_del_ioctl(struct ifreq *ifr)
 	return ret;
 
 }
-static int parse_args(int argc, char **argv, struct ifreq *ifr, uid_t *uid, gid_t *gid)
+static int parse_args(int argc, char **argv, struct ifreq *ifr, uid_t *uid,
+		      gid_t *gid, int *queues, char **handoff)
 {
 	int count = 0;
 
@@ -168,6 +297,18 @@ static int parse_args(int argc, char **argv, struct ifreq *ifr, uid_t *uid, gid_
 			ifr->ifr_flags |= IFF_ONE_QUEUE;
 		} else if (matches(*argv, "vnet_hdr") == 0) {
 			ifr->ifr_flags |= IFF_VNET_HDR;
+		} else if (matches(*argv, "multi_queue") == 0) {
+			ifr->ifr_flags |= IFF_MULTI_QUEUE;
+		} else if (queues && matches(*argv, "queues") == 0) {
+			NEXT_ARG();
+			if (get_integer(queues, *argv, 0) || *queues < 1 ||
+			    *queues > TAP_MAX_QUEUES)
+				invarg("invalid number of queues\n", *argv);
+			if (*queues > 1)
+				ifr->ifr_flags |= IFF_MULTI_QUEUE;
+		} else if (handoff && matches(*argv, "handoff") == 0) {
+			NEXT_ARG();
+			*handoff = *argv;
 		} else if (matches(*argv, "dev") == 0) {
 			NEXT_ARG();
 			strncpy(ifr->ifr_name, *argv, IFNAMSIZ-1);
@@ -188,30 +329,87 @@ static int parse_args(int argc, char **argv, struct ifreq *ifr, uid_t *uid, gid_
 }
 
 
+/* Runs fn for the device of ifr, or for every device of a range in
+ * the arguments.
+ */
+static int tap_foreach(int argc, char **argv, struct ifreq *ifr,
+		       int (*fn)(struct ifreq *, void *), void *arg)
+{
+	const char *open, *close;
+	unsigned from;
+	int width, count = 0;
+	int i, k, errors = 0;
+
+	for (i = 0; i < argc && count == 0; i++)
+		count = link_range(argv[i], &open, &close, &from, &width);
+	if (count == 0)
+		return fn(ifr, arg);
+
+	tap_bulk = 1;
+	for (k = 0; k < count; k++) {
+		struct ifreq r = *ifr;
+		char name[64];
+
+		snprintf(name, sizeof(name), "%.*s%0*u%s",
+			 (int)(open - argv[i - 1]), argv[i - 1],
+			 width, from + k, close);
+		if (strlen(name) >= IFNAMSIZ) {
+			fprintf(stderr, "\"%s\" is too long\n", name);
+			errors++;
+			continue;
+		}
+		strcpy(r.ifr_name, name);
+		if (fn(&r, arg) < 0)
+			errors++;
+	}
+	if (errors) {
+		fprintf(stderr, "%d of %d devices failed\n", errors, count);
+		return -1;
+	}
+	return 0;
+}
+
 static int do_add(int argc, char **argv)
 {
 	struct ifreq ifr;
-	uid_t uid = -1;
-	gid_t gid = -1;
+	struct tap_add a = { .uid = -1, .gid = -1, .handoff = -1 };
+	char *handoff = NULL;
+	int ret;
 
-	if (parse_args(argc, argv, &ifr, &uid, &gid) < 0)
+	if (parse_args(argc, argv, &ifr, &a.uid, &a.gid, &a.queues,
+		       &handoff) < 0)
 		return -1;
 
 	if (!(ifr.ifr_flags & TUN_TYPE_MASK)) {
 		fprintf(stderr, "You failed to specify a tunnel mode\n");
 		return -1;
 	}
-	return tap_add_ioctl(&ifr, uid, gid);
+	if (a.queues && !handoff) {
+		fprintf(stderr, "Queues are closed on exit, \"queues\" needs \"handoff\"\n");
+		return -1;
+	}
+	if (handoff) {
+		if (a.queues == 0)
+			a.queues = 1;
+		a.handoff = tap_handoff_open(handoff);
+		if (a.handoff < 0)
+			return -1;
+	}
+
+	ret = tap_foreach(argc, argv, &ifr, tap_add, &a);
+	if (a.handoff >= 0)
+		close(a.handoff);
+	return ret;
 }
 
 static int do_del(int argc, char **argv)
 {
 	struct ifreq ifr;
 
-	if (parse_args(argc, argv, &ifr, NULL, NULL) < 0)
+	if (parse_args(argc, argv, &ifr, NULL, NULL, NULL, NULL) < 0)
 		return -1;
 
-	return tap_del_ioctl(&ifr);
+	return tap_foreach(argc, argv, &ifr, tap_del_ioctl, NULL);
 }
 
 static int read_prop(char *dev, char *prop, long *value)
@@ -263,7 +461,14 @@ static void print_flags(long flags)
 	if (flags & IFF_VNET_HDR)
 		printf(" vnet_hdr");
 
-	flags &= ~(IFF_TUN|IFF_TAP|IFF_NO_PI|IFF_ONE_QUEUE|IFF_VNET_HDR);
+	if (flags & IFF_MULTI_QUEUE)
+		printf(" multi_queue");
+
+	if (flags & IFF_PERSIST)
+		printf(" persist");
+
+	flags &= ~(IFF_TUN|IFF_TAP|IFF_NO_PI|IFF_ONE_QUEUE|IFF_VNET_HDR|
+		   IFF_MULTI_QUEUE|IFF_PERSIST);
 	if (flags)
 		printf(" UNKNOWN_FLAGS:%lx", flags);
 }
@@ -28,6 +28,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <endian.h>
@@ -41,6 +43,7 @@
 
 #include "utils.h"
 #include "xfrm.h"
+#include "ip_common.h"
 
 #define STRBUF_SIZE	(128)
 #define STRBUF_CAT(buf, str) \
@@ -55,6 +58,9 @@
 		} \
 	} while(0);
 
+/* Output buffer for listings that do not go to a terminal */
+#define XFRM_OUTBUF_SIZE	(256*1024)
+
 struct xfrm_filter filter;
 
 static void usage(void) __attribute__((noreturn));
@@ -137,19 +143,19 @@ int xfrm_xfrmproto_getbyname(char *name)
 	return -1;
 }
 
+/* Printing looks names up by number, without walking the tables above */
+static const char *const xfrmproto_names[256] = {
+	[IPPROTO_ESP] = "esp", [IPPROTO_AH] = "ah", [IPPROTO_COMP] = "comp",
+	[IPPROTO_ROUTING] = "route2", [IPPROTO_DSTOPTS] = "hao",
+	[IPSEC_PROTO_ANY] = "ipsec-any",
+};
+
 const char *strxf_xfrmproto(__u8 proto)
 {
 	static char str[16];
-	int i;
-
-	for (i = 0; ; i++) {
-		const struct typeent *t = &xfrmproto_types[i];
-		if (!t->t_name || t->t_type == -1)
-			break;
 
-		if (t->t_type == proto)
-			return t->t_name;
-	}
+	if (xfrmproto_names[proto])
+		return xfrmproto_names[proto];
 
 	sprintf(str, "%u", proto);
 	return str;
@@ -178,19 +184,18 @@ int xfrm_algotype_getbyname(char *name)
 	return -1;
 }
 
+static const char *const algotype_names[XFRMA_MAX + 1] = {
+	[XFRMA_ALG_CRYPT] = "enc", [XFRMA_ALG_AUTH] = "auth",
+	[XFRMA_ALG_COMP] = "comp", [XFRMA_ALG_AEAD] = "aead",
+	[XFRMA_ALG_AUTH_TRUNC] = "auth-trunc",
+};
+
 const char *strxf_algotype(int type)
 {
 	static char str[32];
-	int i;
-
-	for (i = 0; ; i++) {
-		const struct typeent *t = &algo_types[i];
-		if (!t->t_name || t->t_type == -1)
-			break;
 
-		if (t->t_type == type)
-			return t->t_name;
-	}
+	if (type >= 0 && type <= XFRMA_MAX && algotype_names[type])
+		return algotype_names[type];
 
 	sprintf(str, "%d", type);
 	return str;
@@ -244,21 +249,24 @@ const char *strxf_share(__u8 share)
 	return str;
 }
 
+/* getprotobynumber() reads /etc/protocols; ask once per number */
 const char *strxf_proto(__u8 proto)
 {
-	static char buf[32];
+	static const char *names[256];
+	static char numbers[256][4];
 	struct protoent *pp;
-	const char *p;
+
+	if (names[proto])
+		return names[proto];
 
 	pp = getprotobynumber(proto);
 	if (pp)
-		p = pp->p_name;
-	else {
-		sprintf(buf, "%u", proto);
-		p = buf;
+		names[proto] = strdup(pp->p_name);
+	if (names[proto] == NULL) {
+		sprintf(numbers[proto], "%u", proto);
+		names[proto] = numbers[proto];
 	}
-
-	return p;
+	return names[proto];
 }
 
 const char *strxf_ptype(__u8 ptype)
@@ -280,6 +288,14 @@ const char *strxf_ptype(__u8 ptype)
 	return str;
 }
 
+static const char *const xfrm_mode_names[XFRM_MODE_MAX] = {
+	[XFRM_MODE_TRANSPORT] = "transport",
+	[XFRM_MODE_TUNNEL] = "tunnel",
+	[XFRM_MODE_ROUTEOPTIMIZATION] = "ro",
+	[XFRM_MODE_IN_TRIGGER] = "in_trigger",
+	[XFRM_MODE_BEET] = "beet",
+};
+
 void xfrm_id_info_print(xfrm_address_t *saddr, struct xfrm_id *id,
 			__u8 mode, __u32 reqid, __u16 family, int force_spi,
 			FILE *fp, const char *prefix, const char *title)
@@ -316,27 +332,10 @@ void xfrm_id_info_print(xfrm_address_t *saddr, struct xfrm_id *id,
 		fprintf(fp, "(0x%08x)", reqid);
 	fprintf(fp, " ");
 
-	fprintf(fp, "mode ");
-	switch (mode) {
-	case XFRM_MODE_TRANSPORT:
-		fprintf(fp, "transport");
-		break;
-	case XFRM_MODE_TUNNEL:
-		fprintf(fp, "tunnel");
-		break;
-	case XFRM_MODE_ROUTEOPTIMIZATION:
-		fprintf(fp, "ro");
-		break;
-	case XFRM_MODE_IN_TRIGGER:
-		fprintf(fp, "in_trigger");
-		break;
-	case XFRM_MODE_BEET:
-		fprintf(fp, "beet");
-		break;
-	default:
-		fprintf(fp, "%u", mode);
-		break;
-	}
+	if (mode < ARRAY_SIZE(xfrm_mode_names))
+		fprintf(fp, "mode %s", xfrm_mode_names[mode]);
+	else
+		fprintf(fp, "mode %u", mode);
 	fprintf(fp, "%s", _SL_);
 }
 
@@ -512,85 +511,88 @@ void xfrm_selector_print(struct xfrm_selector *sel, __u16 family,
 	fprintf(fp, "%s", _SL_);
 }
 
+/* Keys go out as hex in chunks, not one fprintf() per byte */
+static void xfrm_key_print(const unsigned char *key, int len, FILE *fp)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[256];
+	int n = 0;
+
+	while (len-- > 0) {
+		buf[n++] = hex[*key >> 4];
+		buf[n++] = hex[*key++ & 0xf];
+		if (n == sizeof(buf)) {
+			fwrite(buf, 1, n, fp);
+			n = 0;
+		}
+	}
+	if (n)
+		fwrite(buf, 1, n, fp);
+}
+
+/* The algo structures share alg_name and alg_key_len, then differ */
 static void __xfrm_algo_print(struct xfrm_algo *algo, int type, int len,
-			      FILE *fp, const char *prefix, int newline)
+			      int hdrlen, const unsigned char *key,
+			      FILE *fp, const char *prefix)
 {
 	int keylen;
-	int i;
 
 	if (prefix)
 		fputs(prefix, fp);
 
-	fprintf(fp, "%s ", strxf_algotype(type));
+	fputs(strxf_algotype(type), fp);
+	putc(' ', fp);
 
-	if (len < sizeof(*algo)) {
-		fprintf(fp, "(ERROR truncated)");
-		goto fin;
+	if (len < hdrlen) {
+		fputs("(ERROR truncated)", fp);
+		return;
 	}
-	len -= sizeof(*algo);
+	len -= hdrlen;
 
-	fprintf(fp, "%s ", algo->alg_name);
+	fputs(algo->alg_name, fp);
+	putc(' ', fp);
 
 	keylen = algo->alg_key_len / 8;
 	if (len < keylen) {
-		fprintf(fp, "(ERROR truncated)");
-		goto fin;
+		fputs("(ERROR truncated)", fp);
+		return;
 	}
 
-	fprintf(fp, "0x");
-	for (i = 0; i < keylen; i ++)
-		fprintf(fp, "%.2x", (unsigned char)algo->alg_key[i]);
+	fputs("0x", fp);
+	xfrm_key_print(key, keylen, fp);
 
 	if (show_stats > 0)
 		fprintf(fp, " (%d bits)", algo->alg_key_len);
-
- fin:
-	if (newline)
-		fprintf(fp, "%s", _SL_);
 }
 
-static inline void xfrm_algo_print(struct xfrm_algo *algo, int type, int len,
-				   FILE *fp, const char *prefix)
+static void xfrm_algo_print(struct xfrm_algo *algo, int type, int len,
+			    FILE *fp, const char *prefix)
 {
-	return __xfrm_algo_print(algo, type, len, fp, prefix, 1);
+	__xfrm_algo_print(algo, type, len, sizeof(*algo),
+			  (unsigned char *)algo->alg_key, fp, prefix);
+	fputs(_SL_, fp);
 }
 
 static void xfrm_aead_print(struct xfrm_algo_aead *algo, int len,
 			    FILE *fp, const char *prefix)
 {
-	struct {
-		struct xfrm_algo algo;
-		char key[algo->alg_key_len / 8];
-	} base;
-
-	memcpy(base.algo.alg_name, algo->alg_name, sizeof(base.algo.alg_name));
-	base.algo.alg_key_len = algo->alg_key_len;
-	memcpy(base.algo.alg_key, algo->alg_key, algo->alg_key_len / 8);
-
-	__xfrm_algo_print(&base.algo, XFRMA_ALG_AEAD, len, fp, prefix, 0);
-
-	fprintf(fp, " %d", algo->alg_icv_len);
-
-	fprintf(fp, "%s", _SL_);
+	__xfrm_algo_print((struct xfrm_algo *)algo, XFRMA_ALG_AEAD, len,
+			  sizeof(*algo), (unsigned char *)algo->alg_key,
+			  fp, prefix);
+	if (len >= sizeof(*algo))
+		fprintf(fp, " %d", algo->alg_icv_len);
+	fputs(_SL_, fp);
 }
 
 static void xfrm_auth_trunc_print(struct xfrm_algo_auth *algo, int len,
 				  FILE *fp, const char *prefix)
 {
-	struct {
-		struct xfrm_algo algo;
-		char key[algo->alg_key_len / 8];
-	} base;
-
-	memcpy(base.algo.alg_name, algo->alg_name, sizeof(base.algo.alg_name));
-	base.algo.alg_key_len = algo->alg_key_len;
-	memcpy(base.algo.alg_key, algo->alg_key, algo->alg_key_len / 8);
-
-	__xfrm_algo_print(&base.algo, XFRMA_ALG_AUTH_TRUNC, len, fp, prefix, 0);
-
-	fprintf(fp, " %d", algo->alg_trunc_len);
-
-	fprintf(fp, "%s", _SL_);
+	__xfrm_algo_print((struct xfrm_algo *)algo, XFRMA_ALG_AUTH_TRUNC, len,
+			  sizeof(*algo), (unsigned char *)algo->alg_key,
+			  fp, prefix);
+	if (len >= sizeof(*algo))
+		fprintf(fp, " %d", algo->alg_trunc_len);
+	fputs(_SL_, fp);
 }
 
 static void xfrm_tmpl_print(struct xfrm_user_tmpl *tmpls, int len,
@@ -1085,23 +1087,30 @@ int xfrm_id_parse(xfrm_address_t *saddr, struct xfrm_id *id, __u16 *family,
 	return 0;
 }
 
+int xfrm_mode_getbyname(const char *name)
+{
+	if (matches(name, "transport") == 0)
+		return XFRM_MODE_TRANSPORT;
+	if (matches(name, "tunnel") == 0)
+		return XFRM_MODE_TUNNEL;
+	if (matches(name, "ro") == 0)
+		return XFRM_MODE_ROUTEOPTIMIZATION;
+	if (matches(name, "in_trigger") == 0)
+		return XFRM_MODE_IN_TRIGGER;
+	if (matches(name, "beet") == 0)
+		return XFRM_MODE_BEET;
+	return -1;
+}
+
 int xfrm_mode_parse(__u8 *mode, int *argcp, char ***argvp)
 {
 	int argc = *argcp;
 	char **argv = *argvp;
+	int ret = xfrm_mode_getbyname(*argv);
 
-	if (matches(*argv, "transport") == 0)
-		*mode = XFRM_MODE_TRANSPORT;
-	else if (matches(*argv, "tunnel") == 0)
-		*mode = XFRM_MODE_TUNNEL;
-	else if (matches(*argv, "ro") == 0)
-		*mode = XFRM_MODE_ROUTEOPTIMIZATION;
-	else if (matches(*argv, "in_trigger") == 0)
-		*mode = XFRM_MODE_IN_TRIGGER;
-	else if (matches(*argv, "beet") == 0)
-		*mode = XFRM_MODE_BEET;
-	else
+	if (ret < 0)
 		invarg("\"MODE\" is invalid", *argv);
+	*mode = ret;
 
 	*argcp = argc;
 	*argvp = argv;
@@ -1439,6 +1448,435 @@ int xfrm_lifetime_cfg_parse(struct xfrm_lifetime_cfg *lft,
 	return 0;
 }
 
+/*
+ * In batch mode the first listing of the SAD or SPD dumps all of it and
+ * keeps the messages sorted by an address: states by destination,
+ * policies by selector destination.  The entries within a prefix are
+ * then a range found by binary search, and later listings in the batch
+ * need no dump.  A command that changes the table drops its index.
+ */
+static int xfrm_index_alen(__u16 family)
+{
+	return family == AF_INET6 ? 16 : 4;
+}
+
+static int xfrm_index_cmp(const void *a, const void *b)
+{
+	const struct xfrm_index_ent *x = a, *y = b;
+
+	if (x->family != y->family)
+		return x->family < y->family ? -1 : 1;
+	return memcmp(&x->addr, &y->addr, xfrm_index_alen(x->family));
+}
+
+static int xfrm_index_collect(const struct sockaddr_nl *who,
+			      struct nlmsghdr *n, void *arg)
+{
+	struct xfrm_index *idx = arg;
+	struct xfrm_index_ent *e;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(idx->hdrlen))
+		return 0;
+
+	if (idx->n == idx->max) {
+		int max = idx->max ? idx->max * 2 : 1024;
+
+		e = realloc(idx->ent, max * sizeof(*e));
+		if (e == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		idx->ent = e;
+		idx->max = max;
+	}
+
+	e = &idx->ent[idx->n];
+	e->n = arena_alloc(&idx->arena, n->nlmsg_len);
+	if (e->n == NULL) {
+		perror("arena_alloc");
+		return -1;
+	}
+	memcpy(e->n, n, n->nlmsg_len);
+	idx->key(e->n, &e->family, &e->addr);
+	idx->n++;
+	return 0;
+}
+
+int xfrm_index_build(struct xfrm_index *idx, struct rtnl_handle *rth,
+		     int type)
+{
+	xfrm_index_free(idx);
+	arena_init(&idx->arena, 0);
+
+	if (rtnl_wilddump_request(rth, AF_UNSPEC, type) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(rth, xfrm_index_collect, idx) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		xfrm_index_free(idx);
+		return -1;
+	}
+	qsort(idx->ent, idx->n, sizeof(*idx->ent), xfrm_index_cmp);
+	idx->valid = 1;
+	return 0;
+}
+
+void xfrm_index_free(struct xfrm_index *idx)
+{
+	if (!idx->valid && idx->ent == NULL)
+		return;
+	arena_free(&idx->arena);
+	free(idx->ent);
+	idx->ent = NULL;
+	idx->n = idx->max = 0;
+	idx->valid = 0;
+}
+
+/* First entry not below key */
+static int xfrm_index_lower(struct xfrm_index *idx,
+			    const struct xfrm_index_ent *key)
+{
+	int lo = 0, hi = idx->n;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (xfrm_index_cmp(&idx->ent[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Hand the entries with an address within addr/plen to filter, or all
+ * of them if plen is 0.
+ */
+int xfrm_index_walk(struct xfrm_index *idx, __u16 family,
+		    xfrm_address_t *addr, int plen,
+		    rtnl_filter_t filter, void *arg)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct xfrm_index_ent lo, hi;
+	int i, end;
+
+	if (plen == 0) {
+		i = 0;
+		end = idx->n;
+	} else {
+		int alen = xfrm_index_alen(family), bit;
+
+		memset(&lo, 0, sizeof(lo));
+		lo.family = family;
+		memcpy(&lo.addr, addr, alen);
+		hi = lo;
+		for (bit = plen; bit < alen * 8; bit++) {
+			((__u8 *)&lo.addr)[bit / 8] &= ~(0x80 >> (bit % 8));
+			((__u8 *)&hi.addr)[bit / 8] |= 0x80 >> (bit % 8);
+		}
+		i = xfrm_index_lower(idx, &lo);
+		for (end = i; end < idx->n &&
+		     xfrm_index_cmp(&idx->ent[end], &hi) <= 0; end++)
+			;
+	}
+
+	for (; i < end; i++)
+		if (filter(&nladdr, idx->ent[i].n, arg) < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * deleteall sends each delete through a second socket while the objects
+ * are still being dumped, with up to XFRM_DELETE_WINDOW of them waiting
+ * for their ACK.  The kernel's walk keeps its place across deletions, so
+ * a single dump reaches every object.  A copy of each request in flight
+ * is kept; the ones that fail for a reason other than being gone already
+ * are resent once the dump is done, for up to max_flush_loops rounds.
+ */
+#define XFRM_DELETE_SLOTS	(2 * XFRM_DELETE_WINDOW)
+
+static void xfrm_delete_error(int cookie, int error, void *arg)
+{
+	struct xfrm_delete *xd = arg;
+	struct nlmsghdr *n;
+
+	if (error == ENOENT)
+		return;
+
+	n = (struct nlmsghdr *)(xd->slot +
+				(cookie % XFRM_DELETE_SLOTS) * XFRM_DELETE_MSGSIZE);
+	if (xd->retry_len + NLMSG_ALIGN(n->nlmsg_len) > xd->retry_size) {
+		int size = xd->retry_size ? xd->retry_size * 2 : 65536;
+		char *retry = realloc(xd->retry, size);
+
+		if (retry == NULL) {
+			xd->lost++;
+			return;
+		}
+		xd->retry = retry;
+		xd->retry_size = size;
+	}
+	memcpy(xd->retry + xd->retry_len, n, n->nlmsg_len);
+	xd->retry_len += NLMSG_ALIGN(n->nlmsg_len);
+	xd->retries++;
+	xd->error = error;
+}
+
+int xfrm_delete_open(struct xfrm_delete *xd)
+{
+	memset(xd, 0, sizeof(*xd));
+	xd->slot = malloc(XFRM_DELETE_SLOTS * XFRM_DELETE_MSGSIZE);
+	if (xd->slot == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	if (rtnl_open_byproto(&xd->rth, 0, NETLINK_XFRM) < 0) {
+		free(xd->slot);
+		return -1;
+	}
+	if (rtnl_pipeline_open(&xd->rth, XFRM_DELETE_WINDOW,
+			       xfrm_delete_error, xd) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		rtnl_close(&xd->rth);
+		free(xd->slot);
+		return -1;
+	}
+	return 0;
+}
+
+int xfrm_delete_send(struct xfrm_delete *xd, struct nlmsghdr *n)
+{
+	int cookie = xd->sent++;
+
+	if (n->nlmsg_len > XFRM_DELETE_MSGSIZE) {
+		fprintf(stderr, "Delete request too long\n");
+		return -1;
+	}
+	memcpy(xd->slot + (cookie % XFRM_DELETE_SLOTS) * XFRM_DELETE_MSGSIZE,
+	       n, n->nlmsg_len);
+	rtnl_pipeline_cookie(&xd->rth, cookie);
+	return rtnl_talk(&xd->rth, n, 0, 0, NULL);
+}
+
+/* Returns the number of objects that could not be deleted, or -1 */
+int xfrm_delete_close(struct xfrm_delete *xd)
+{
+	char *buf = NULL;
+	int round, ret = -1;
+
+	if (rtnl_pipeline_sync(&xd->rth) < 0)
+		goto out;
+
+	for (round = 0; xd->retries && !xd->lost &&
+	     (max_flush_loops == 0 || round < max_flush_loops); round++) {
+		struct nlmsghdr *n;
+		int len = xd->retry_len, prev = xd->retries;
+
+		free(buf);
+		buf = xd->retry;
+		xd->retry = NULL;
+		xd->retry_len = xd->retry_size = 0;
+		xd->retries = 0;
+
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all retry round = %d\n", round);
+		for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len))
+			if (xfrm_delete_send(xd, n) < 0)
+				goto out;
+		if (rtnl_pipeline_sync(&xd->rth) < 0)
+			goto out;
+		/* Nothing went away, another round will not help */
+		if (xd->retries == prev)
+			break;
+	}
+
+	ret = xd->retries + xd->lost;
+	if (ret)
+		fprintf(stderr, "RTNETLINK answers: %s\n"
+			"Delete-all failed for %d entr%s\n",
+			strerror(xd->error), ret, ret > 1 ? "ies" : "y");
+out:
+	rtnl_pipeline_close(&xd->rth);
+	rtnl_close(&xd->rth);
+	free(buf);
+	free(xd->retry);
+	free(xd->slot);
+	return ret;
+}
+
+/*
+ * Bulk mode: "ip xfrm { state | policy } bulk FILE" reads one SA or
+ * policy per line in a compact positional format; the callers build the
+ * NEWSA/NEWPOLICY message straight from the fields.  The requests go
+ * out through a pipeline of XFRM_BULK_WINDOW outstanding requests on a
+ * single socket, written with one send() per XFRM_BULK_SNDBUF bytes,
+ * and failures are reported by line as the ACKs come back.  A malformed
+ * line stops the run; what was sent before it stays.
+ */
+#define XFRM_BULK_WINDOW	256
+#define XFRM_BULK_SNDBUF	65536
+#define XFRM_BULK_MAXARGS	64
+#define XFRM_BULK_MSGSIZE	4096
+
+static const char *bulk_name;
+
+static void xfrm_bulk_error(int cookie, int error, void *arg)
+{
+	int *errors = arg;
+
+	fprintf(stderr, "%s:%d: RTNETLINK answers: %s\n",
+		bulk_name, cookie, strerror(error));
+	(*errors)++;
+}
+
+int xfrm_bulk_invarg(const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s \"%s\"\n", bulk_name, cmdlineno, msg, arg);
+	return -1;
+}
+
+static int xfrm_hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* Same rules as ALGO-KEY on the command line; returns the length in bytes */
+int xfrm_algo_key_parse(char *buf, int max, const char *key)
+{
+	int slen = strlen(key);
+	int len, i, j;
+
+	if (slen <= 2 || strncmp(key, "0x", 2) != 0) {
+		if (slen > max)
+			return -1;
+		memcpy(buf, key, slen);
+		return slen;
+	}
+
+	key += 2;
+	slen -= 2;
+	len = (slen + 1) / 2;
+	if (len > max)
+		return -1;
+
+	/* An odd number of digits has an implied leading zero */
+	for (i = -(slen % 2), j = 0; j < len; i += 2, j++) {
+		int hi = i >= 0 ? xfrm_hexval(key[i]) : 0;
+		int lo = xfrm_hexval(key[i + 1]);
+
+		if (hi < 0 || lo < 0)
+			return -1;
+		buf[j] = hi << 4 | lo;
+	}
+	return len;
+}
+
+/* An address or "any"; *family must be AF_UNSPEC or match it */
+int xfrm_bulk_addr(xfrm_address_t *addr, __u8 *plen, __u16 *family,
+		   char *arg)
+{
+	inet_prefix p;
+
+	if (get_prefix_1(&p, arg, *family) < 0)
+		return xfrm_bulk_invarg("invalid address", arg);
+	if (p.family != AF_UNSPEC) {
+		if (*family != AF_UNSPEC && *family != p.family)
+			return xfrm_bulk_invarg("address family mismatch", arg);
+		*family = p.family;
+	}
+	if (plen)
+		*plen = p.bitlen;
+	else if (p.bitlen != p.bytelen * 8)
+		return xfrm_bulk_invarg("prefix length not allowed", arg);
+
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, p.data, p.bytelen);
+	return 0;
+}
+
+int xfrm_bulk(const char *name, int cmd, xfrm_bulk_build_t build)
+{
+	struct rtnl_handle brth;
+	FILE *fp = stdin;
+	char *line = NULL;
+	size_t len = 0;
+	char *buf;
+	int total = 0, errors = 0, ret = 0;
+
+	if (strcmp(name, "-") != 0) {
+		fp = fopen(name, "r");
+		if (fp == NULL) {
+			fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+	bulk_name = name;
+
+	buf = malloc(XFRM_BULK_MSGSIZE);
+	if (buf == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	if (rtnl_open_byproto(&brth, 0, NETLINK_XFRM) < 0)
+		exit(1);
+	if (rtnl_pipeline_open(&brth, XFRM_BULK_WINDOW,
+			       xfrm_bulk_error, &errors) < 0 ||
+	    rtnl_pipeline_coalesce(&brth, XFRM_BULK_SNDBUF) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		exit(1);
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		struct nlmsghdr *n = (struct nlmsghdr *)buf;
+		char *largv[XFRM_BULK_MAXARGS];
+		int largc;
+
+		largc = makeargs(line, largv, XFRM_BULK_MAXARGS);
+		if (largc == 0)
+			continue;
+
+		memset(buf, 0, XFRM_BULK_MSGSIZE);
+		n->nlmsg_flags = NLM_F_REQUEST;
+		n->nlmsg_type = cmd;
+		if (build(n, XFRM_BULK_MSGSIZE, largc, largv) < 0) {
+			ret = -1;
+			break;
+		}
+
+		rtnl_pipeline_cookie(&brth, cmdlineno);
+		if (rtnl_talk(&brth, n, 0, 0, NULL) < 0) {
+			ret = -1;
+			break;
+		}
+		total++;
+	}
+
+	if (rtnl_pipeline_close(&brth) < 0)
+		ret = -1;
+	if (errors)
+		ret = -1;
+	if (show_stats)
+		fprintf(stderr, "%d record%s sent, %d failed\n",
+			total, total == 1 ? "" : "s", errors);
+
+	rtnl_close(&brth);
+	free(line);
+	free(buf);
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
 int do_xfrm(int argc, char **argv)
 {
 	memset(&filter, 0, sizeof(filter));
@@ -1446,6 +1884,10 @@ int do_xfrm(int argc, char **argv)
 	if (argc < 1)
 		usage();
 
+	/* In batch mode something may have been printed already */
+	if (!batch_file && !isatty(STDOUT_FILENO))
+		setvbuf(stdout, NULL, _IOFBF, XFRM_OUTBUF_SIZE);
+
 	if (matches(*argv, "state") == 0 ||
 	    matches(*argv, "sa") == 0)
 		return do_xfrm_state(argc-1, argv+1);
@@ -19,60 +19,446 @@
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <stddef.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "SNAPSHOT.h"
 
 #include "utils.h"
 #include "libnetlink.h"
+#include "rt_names.h"
 
 int resolve_hosts = 0;
 static int init_phase = 1;
+static volatile int stop;
 
-static void write_stamp(FILE *fp)
+/*
+ * The capture is written through a stdio buffer of out.bufsize bytes
+ * and flushed when the buffer fills up or out.sync milliseconds after
+ * the previous flush, whichever comes first; "sync 0" flushes after
+ * every message.  On rotation the file is renamed to FILE.1 (and older
+ * ones to FILE.2, ...) and a new one is started with a link dump, as
+ * at startup.  The index gets an entry at the first timestamp after at
+ * least RTMON_INDEX_STRIDE bytes or one second.
+ *
+ * With "compress" the buffer is a block instead: when it fills up, or
+ * at a flush, its messages are deflated and written after a struct
+ * rtmon_block.  Index entries then point at blocks, so there is one at
+ * most at the start of each; offset and maxsize count the bytes of
+ * the file, raw_offset those of the messages.
+ */
+#define RTMON_INDEX_STRIDE	65536
+
+static struct
+{
+	const char		*file;
+	FILE			*fp;
+	FILE			*idx;
+	unsigned		bufsize;
+	unsigned		sync;
+	unsigned long long	maxsize;
+	unsigned		maxage;
+	int			keep;
+	int			index;
+	int			dirty;
+	int			compress;
+	char			*block;
+	unsigned		blen;
+	unsigned		bsize;
+	unsigned long long	raw_offset;
+	unsigned long long	offset;
+	unsigned long long	idx_offset;
+	struct timeval		idx_time;
+	struct timeval		synced;
+	struct timeval		opened;
+} out = {
+	.bufsize	= 65536,
+	.sync		= 1000,
+};
+
+static long tv_ms(const struct timeval *a, const struct timeval *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 +
+		(a->tv_usec - b->tv_usec) / 1000;
+}
+
+static void out_fwrite(const void *data, int len)
+{
+	if (fwrite(data, 1, len, out.fp) != len) {
+		perror("Cannot write capture file");
+		exit(1);
+	}
+	out.offset += len;
+}
+
+static void out_block(void)
+{
+#ifdef HAVE_ZLIB
+	static Bytef *zbuf;
+	static uLong zsize;
+	struct rtmon_block b = { .magic = RTMON_BLOCK_MAGIC };
+	uLongf zlen = compressBound(out.blen);
+
+	if (out.blen == 0)
+		return;
+	if (zlen > zsize) {
+		zsize = zlen;
+		zbuf = realloc(zbuf, zsize);
+		if (zbuf == NULL) {
+			perror("rtmon: realloc");
+			exit(1);
+		}
+	}
+	if (compress2(zbuf, &zlen, (Bytef *)out.block, out.blen,
+		      Z_DEFAULT_COMPRESSION) != Z_OK) {
+		fprintf(stderr, "Cannot compress capture block\n");
+		exit(1);
+	}
+	b.raw_len = out.blen;
+	b.len = zlen;
+	out_fwrite(&b, sizeof(b));
+	out_fwrite(zbuf, zlen);
+	out.blen = 0;
+#endif
+}
+
+static void out_write(const void *data, int len)
+{
+	out.raw_offset += len;
+	out.dirty = 1;
+	if (!out.compress) {
+		out_fwrite(data, len);
+		return;
+	}
+
+	if (out.blen + len > out.bsize) {
+		unsigned size = out.bsize ? out.bsize : out.bufsize;
+
+		while (size < out.blen + len)
+			size *= 2;
+		out.block = realloc(out.block, size);
+		if (out.block == NULL) {
+			perror("rtmon: realloc");
+			exit(1);
+		}
+		out.bsize = size;
+	}
+	memcpy(out.block + out.blen, data, len);
+	out.blen += len;
+	if (out.blen >= out.bufsize)
+		out_block();
+}
+
+static void index_stamp(const struct timeval *tv)
+{
+	struct rtmon_index e;
+
+	if (!out.idx || out.blen)
+		return;
+	if (out.raw_offset &&
+	    out.raw_offset - out.idx_offset < RTMON_INDEX_STRIDE &&
+	    tv_ms(tv, &out.idx_time) < 1000)
+		return;
+
+	e.sec = tv->tv_sec;
+	e.usec = tv->tv_usec;
+	e.offset = out.offset;
+	fwrite(&e, 1, sizeof(e), out.idx);
+	out.idx_offset = out.raw_offset;
+	out.idx_time = *tv;
+}
+
+static void write_stamp(struct timeval *tv)
 {
 	char buf[128];
 	struct nlmsghdr *n1 = (void*)buf;
-	struct timeval tv;
 
 	n1->nlmsg_type = 15;
 	n1->nlmsg_flags = 0;
 	n1->nlmsg_seq = 0;
 	n1->nlmsg_pid = 0;
 	n1->nlmsg_len = NLMSG_LENGTH(4*2);
-	gettimeofday(&tv, NULL);
-	((__u32*)NLMSG_DATA(n1))[0] = tv.tv_sec;
-	((__u32*)NLMSG_DATA(n1))[1] = tv.tv_usec;
-	fwrite((void*)n1, 1, NLMSG_ALIGN(n1->nlmsg_len), fp);
+	gettimeofday(tv, NULL);
+	((__u32*)NLMSG_DATA(n1))[0] = tv->tv_sec;
+	((__u32*)NLMSG_DATA(n1))[1] = tv->tv_usec;
+	index_stamp(tv);
+	out_write(n1, NLMSG_ALIGN(n1->nlmsg_len));
+}
+
+static void out_sync(const struct timeval *now)
+{
+	out.synced = *now;
+	if (!out.dirty)
+		return;
+	out_block();
+	/* The data first, an index entry must not point past it */
+	if (fflush(out.fp) || (out.idx && fflush(out.idx))) {
+		perror("Cannot write capture file");
+		exit(1);
+	}
+	out.dirty = 0;
+}
+
+static char *out_name(char *buf, int n, const char *suffix)
+{
+	if (n)
+		sprintf(buf, "%s.%d%s", out.file, n, suffix);
+	else
+		sprintf(buf, "%s%s", out.file, suffix);
+	return buf;
+}
+
+static void out_shift(int from, int to)
+{
+	char a[PATH_MAX], b[PATH_MAX];
+
+	if (rename(out_name(a, from, ""), out_name(b, to, "")) < 0 &&
+	    errno != ENOENT)
+		fprintf(stderr, "Cannot rename \"%s\": %s\n", a, strerror(errno));
+	if (out.index)
+		rename(out_name(a, from, ".idx"), out_name(b, to, ".idx"));
+}
+
+static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		    void *arg);
+
+static void out_open(void)
+{
+	char name[PATH_MAX];
+	struct timeval tv;
+
+	out.fp = fopen(out.file, "w");
+	if (out.fp == NULL) {
+		perror("Cannot fopen");
+		exit(-1);
+	}
+	if (out.sync)
+		setvbuf(out.fp, NULL, _IOFBF, out.bufsize);
+
+	out.idx = NULL;
+	if (out.index) {
+		struct rtmon_index_hdr h = {
+			.magic = RTMON_INDEX_MAGIC,
+			.version = RTMON_INDEX_VERSION,
+		};
+
+		out.idx = fopen(out_name(name, 0, ".idx"), "w");
+		if (out.idx == NULL) {
+			perror("Cannot fopen index");
+			exit(-1);
+		}
+		fwrite(&h, 1, sizeof(h), out.idx);
+	}
+	out.offset = 0;
+	out.raw_offset = 0;
+	out.idx_offset = 0;
+	write_stamp(&tv);
+	out.opened = tv;
+	out.synced = tv;
+}
+
+static void out_close(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	out_sync(&now);
+	fclose(out.fp);
+	if (out.idx)
+		fclose(out.idx);
+}
+
+static void out_rotate(void)
+{
+	struct rtnl_handle drth;
+	char name[PATH_MAX];
+	int i, last = out.keep;
+
+	out_close();
+
+	if (last) {
+		unlink(out_name(name, last, ""));
+		unlink(out_name(name, last, ".idx"));
+	} else {
+		for (last = 1; access(out_name(name, last, ""), F_OK) == 0; last++)
+			;
+	}
+	for (i = last - 1; i >= 0; i--)
+		out_shift(i, i + 1);
+
+	out_open();
+
+	/* Start the new file with the links, so it can be read alone */
+	if (rtnl_open(&drth, 0) < 0)
+		exit(1);
+	if (rtnl_wilddump_request(&drth, AF_UNSPEC, RTM_GETLINK) < 0) {
+		perror("Cannot send dump request");
+		exit(1);
+	}
+	init_phase = 1;
+	if (rtnl_dump_filter(&drth, dump_msg, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		exit(1);
+	}
+	init_phase = 0;
+	rtnl_close(&drth);
+}
+
+static void out_tick(const struct timeval *now)
+{
+	if (!out.sync || tv_ms(now, &out.synced) >= out.sync)
+		out_sync(now);
+	if ((out.maxsize && out.offset >= out.maxsize) ||
+	    (out.maxage && now->tv_sec - out.opened.tv_sec >= out.maxage))
+		out_rotate();
 }
 
 static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 		    void *arg)
 {
-	FILE *fp = (FILE*)arg;
-	if (!init_phase)
-		write_stamp(fp);
-	fwrite((void*)n, 1, NLMSG_ALIGN(n->nlmsg_len), fp);
-	fflush(fp);
+	struct timeval tv;
+
+	if (init_phase) {
+		out_write(n, NLMSG_ALIGN(n->nlmsg_len));
+		return 0;
+	}
+	write_stamp(&tv);
+	out_write(n, NLMSG_ALIGN(n->nlmsg_len));
+	out_tick(&tv);
+	return 0;
+}
+
+static int dump_idle(void *arg)
+{
+	struct timeval now;
+
+	if (stop)
+		return -1;
+	gettimeofday(&now, NULL);
+	out_tick(&now);
 	return 0;
 }
 
+static void sig_stop(int sig)
+{
+	stop = 1;
+}
+
 void usage(void)
 {
-	fprintf(stderr, "Usage: rtmon file FILE [ all | LISTofOBJECTS]\n");
+	fprintf(stderr, "Usage: rtmon file FILE [ buffer BYTES ] [ sync MSECS ] [ index ]\n");
+	fprintf(stderr, "             [ compress ]\n");
+	fprintf(stderr, "             [ maxsize BYTES ] [ maxage SECS ] [ keep COUNT ]\n");
+	fprintf(stderr, "             [ rcvbuf BYTES ]\n");
+	fprintf(stderr, "             [ all | LISTofOBJECTS] [ SELECTORS ]\n");
 	fprintf(stderr, "LISTofOBJECTS := [ link ] [ address ] [ route ]\n");
+	fprintf(stderr, "SELECTORS := [ dev DEV ] [ table TABLE_ID ] [ proto PROTO ]\n");
+	exit(-1);
+}
+
+static unsigned long long get_option(const char *name, const char *arg)
+{
+	unsigned long long val;
+	char *end;
+
+	val = strtoull(arg, &end, 0);
+	if (end == arg)
+		goto bad;
+	switch (*end) {
+	case 'k': case 'K':
+		val <<= 10;
+		end++;
+		break;
+	case 'm': case 'M':
+		val <<= 20;
+		end++;
+		break;
+	case 'g': case 'G':
+		val <<= 30;
+		end++;
+		break;
+	}
+	if (*end == 0)
+		return val;
+bad:
+	fprintf(stderr, "Invalid \"%s\" value \"%s\"\n", name, arg);
 	exit(-1);
 }
 
+/*
+ * "dev", "table" and "proto" keep the events of other devices, routing
+ * tables and protocols out of the capture, with a socket filter.  The
+ * link dumps that start each file are written whole.
+ */
+static struct
+{
+	int	ifindex;
+	__u32	table;
+	int	protocol;
+} sel = {
+	.protocol = -1,
+};
+
+static void kfilter(struct rtnl_handle *rth)
+{
+	struct rtnl_kcheck c[6], *p = c;
+
+	memset(c, 0, sizeof(c));
+	if (sel.table) {
+		p->type = RTM_NEWROUTE;
+		p->hdrlen = sizeof(struct rtmsg);
+		p->attr = RTA_TABLE;
+		p->offset = -1;
+		p->size = 4;
+		p->value = sel.table;
+		p++;
+	}
+	if (sel.protocol >= 0) {
+		p->type = RTM_NEWROUTE;
+		p->offset = offsetof(struct rtmsg, rtm_protocol);
+		p->size = 1;
+		p->value = sel.protocol;
+		p++;
+	}
+	if (sel.ifindex) {
+		/* Multipath routes have no RTA_OIF and are kept */
+		p->type = RTM_NEWROUTE;
+		p->hdrlen = sizeof(struct rtmsg);
+		p->attr = RTA_OIF;
+		p->offset = -1;
+		p->size = 4;
+		p->value = sel.ifindex;
+		p++;
+		p->type = RTM_NEWADDR;
+		p->offset = offsetof(struct ifaddrmsg, ifa_index);
+		p->size = 4;
+		p->value = sel.ifindex;
+		p++;
+		p->type = RTM_NEWLINK;
+		p->offset = offsetof(struct ifinfomsg, ifi_index);
+		p->size = 4;
+		p->value = sel.ifindex;
+		p++;
+	}
+	if (rtnl_kfilter(rth, c, p - c) < 0)
+		exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
-	FILE *fp;
 	struct rtnl_handle rth;
 	int family = AF_UNSPEC;
 	unsigned groups = ~0U;
 	int llink = 0;
 	int laddr = 0;
 	int lroute = 0;
+	unsigned long long rcvsize = 0;
 	char *file = NULL;
 
 	while (argc > 1) {
@@ -108,6 +494,55 @@ main(int argc, char **argv)
 			if (argc <= 1)
 				usage();
 			file = argv[1];
+		} else if (matches(argv[1], "buffer") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			out.bufsize = get_option("buffer", argv[1]);
+			if (out.bufsize < 4096)
+				out.bufsize = 4096;
+		} else if (strcmp(argv[1], "rcvbuf") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			rcvsize = get_option("rcvbuf", argv[1]);
+			if (rcvsize > INT_MAX)
+				rcvsize = INT_MAX;
+		} else if (strcmp(argv[1], "sync") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			out.sync = get_option("sync", argv[1]);
+		} else if (strcmp(argv[1], "index") == 0) {
+			out.index = 1;
+		} else if (strcmp(argv[1], "compress") == 0) {
+#ifdef HAVE_ZLIB
+			out.compress = 1;
+#else
+			fprintf(stderr, "rtmon was built without zlib support\n");
+			exit(-1);
+#endif
+		} else if (strcmp(argv[1], "maxsize") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			out.maxsize = get_option("maxsize", argv[1]);
+		} else if (strcmp(argv[1], "maxage") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			out.maxage = get_option("maxage", argv[1]);
+		} else if (strcmp(argv[1], "keep") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			out.keep = get_option("keep", argv[1]);
 		} else if (matches(argv[1], "link") == 0) {
 			llink=1;
 			groups = 0;
@@ -119,6 +554,37 @@ main(int argc, char **argv)
 			groups = 0;
 		} else if (strcmp(argv[1], "all") == 0) {
 			groups = ~0U;
+		} else if (strcmp(argv[1], "dev") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			sel.ifindex = ll_name_to_index(argv[1]);
+			if (sel.ifindex == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n", argv[1]);
+				exit(-1);
+			}
+		} else if (strcmp(argv[1], "table") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (rtnl_rttable_a2n(&sel.table, argv[1]) || sel.table == 0) {
+				fprintf(stderr, "Invalid table ID \"%s\"\n", argv[1]);
+				exit(-1);
+			}
+		} else if (matches(argv[1], "protocol") == 0) {
+			__u32 prot;
+
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			if (rtnl_rtprot_a2n(&prot, argv[1])) {
+				fprintf(stderr, "Invalid protocol \"%s\"\n", argv[1]);
+				exit(-1);
+			}
+			sel.protocol = prot;
 		} else if (matches(argv[1], "help") == 0) {
 			usage();
 		} else {
@@ -147,31 +613,38 @@ main(int argc, char **argv)
 			groups |= nl_mgrp(RTNLGRP_IPV6_ROUTE);
 	}
 
-	fp = fopen(file, "w");
-	if (fp == NULL) {
-		perror("Cannot fopen");
-		exit(-1);
-	}
+	out.file = file;
+	out_open();
 
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
+	if (rcvsize && rtnl_rcvbuf(&rth, rcvsize) < 0)
+		exit(1);
+	kfilter(&rth);
 
 	if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETLINK) < 0) {
 		perror("Cannot send dump request");
 		exit(1);
 	}
 
-	write_stamp(fp);
-
-	if (rtnl_dump_filter(&rth, dump_msg, fp) < 0) {
+	if (rtnl_dump_filter(&rth, dump_msg, NULL) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
 
 	init_phase = 0;
+	rth.batch = RTNL_DEFAULT_BATCH;
+	rtnl_rx_ring_setup(&rth, RTNL_RX_FRAME_SIZE, RTNL_RX_FRAME_NR);
+
+	/* Wake up for the time based flush, and to flush on exit */
+	signal(SIGINT, sig_stop);
+	signal(SIGTERM, sig_stop);
+	rth.idle = dump_idle;
+	rth.idle_timeout = out.sync && out.sync < 1000 ? out.sync : 1000;
 
-	if (rtnl_listen(&rth, dump_msg, (void*)fp) < 0)
+	if (rtnl_listen(&rth, dump_msg, NULL) < 0 && !stop)
 		exit(2);
 
+	out_close();
 	exit(0);
 }
@@ -0,0 +1,542 @@
+/*
+ * tcp_metrics.c	"ip tcp_metrics"
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <linux/genetlink.h>
+#include <linux/tcp_metrics.h>
+
+#include "utils.h"
+#include "ip_common.h"
+#include "libgenl.h"
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: ip tcp_metrics { show | flush } [ [ address ] PREFIX ] [ saddr PREFIX ]\n");
+	fprintf(stderr, "       ip tcp_metrics { get | delete } [ address ] ADDRESS [ saddr ADDRESS ]\n");
+	fprintf(stderr, "       ip tcp_metrics flush all\n");
+	exit(-1);
+}
+
+/* netlink socket */
+static struct rtnl_handle genl_rth;
+static int genl_family = -1;
+
+#define TCPM_FLUSH_WINDOW	256
+#define TCPM_FLUSH_BATCH	32768
+
+enum {
+	TCPM_SHOW,
+	TCPM_FLUSH,
+	TCPM_GET,
+	TCPM_DEL,
+};
+
+static struct
+{
+	int		cmd;
+	inet_prefix	daddr;
+	inet_prefix	saddr;
+	int		count;
+	int		errors;
+} f;
+
+/* The entries of a dump are kept until it is done, to be printed in
+ * address order or deleted through the pipeline.
+ */
+struct tcpm_ent
+{
+	inet_prefix		daddr;
+	inet_prefix		saddr;
+	struct nlmsghdr		*n;
+};
+
+static struct tcpm_ent *tcpm_ents;
+static int tcpm_nents, tcpm_maxents;
+
+static void tcpm_request(struct nlmsghdr *n, int cmd, int flags)
+{
+	struct genlmsghdr *g = NLMSG_DATA(n);
+
+	n->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	n->nlmsg_type = genl_family;
+	n->nlmsg_flags = NLM_F_REQUEST | flags;
+	g->cmd = cmd;
+	g->version = TCP_METRICS_GENL_VERSION;
+	g->reserved = 0;
+}
+
+static void tcpm_addattr(struct nlmsghdr *n, int maxlen, const inet_prefix *a,
+			 int v4, int v6)
+{
+	addattr_l(n, maxlen, a->family == AF_INET ? v4 : v6, a->data,
+		  a->bytelen);
+}
+
+static int tcpm_get_addr(const struct rtattr *v4, const struct rtattr *v6,
+			 inet_prefix *a)
+{
+	const struct rtattr *rta = v4 ? v4 : v6;
+
+	memset(a, 0, sizeof(*a));
+	if (rta == NULL)
+		return 0;
+	a->family = v4 ? AF_INET : AF_INET6;
+	a->bytelen = v4 ? 4 : 16;
+	if (RTA_PAYLOAD(rta) < a->bytelen)
+		return -1;
+	a->bitlen = a->bytelen * 8;
+	memcpy(a->data, RTA_DATA(rta), a->bytelen);
+	return 1;
+}
+
+/* Returns 1 and fills in tb and the addresses for an entry to look at */
+static int tcpm_parse(struct nlmsghdr *n, struct rtattr **tb,
+		      inet_prefix *daddr, inet_prefix *saddr)
+{
+	struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+	if (n->nlmsg_type != genl_family)
+		return 0;
+	if (len < 0)
+		return -1;
+	if (ghdr->cmd != TCP_METRICS_CMD_GET)
+		return 0;
+
+	parse_rtattr(tb, TCP_METRICS_ATTR_MAX, (void *)ghdr + GENL_HDRLEN, len);
+	if (tcpm_get_addr(tb[TCP_METRICS_ATTR_ADDR_IPV4],
+			  tb[TCP_METRICS_ATTR_ADDR_IPV6], daddr) <= 0 ||
+	    tcpm_get_addr(tb[TCP_METRICS_ATTR_SADDR_IPV4],
+			  tb[TCP_METRICS_ATTR_SADDR_IPV6], saddr) < 0)
+		return 0;
+
+	if (preferred_family != AF_UNSPEC && preferred_family != daddr->family)
+		return 0;
+	if (f.daddr.family &&
+	    (f.daddr.family != daddr->family ||
+	     inet_addr_match(daddr, &f.daddr, f.daddr.bitlen)))
+		return 0;
+	if (f.saddr.family &&
+	    (f.saddr.family != saddr->family ||
+	     inet_addr_match(saddr, &f.saddr, f.saddr.bitlen)))
+		return 0;
+	return 1;
+}
+
+static void print_msecs(FILE *fp, const char *name, __u64 ms)
+{
+	fprintf(fp, " %s %llu.%03llusec", name, ms / 1000, ms % 1000);
+}
+
+static __u64 tcpm_getattr_msecs(const struct rtattr *rta)
+{
+	if (RTA_PAYLOAD(rta) >= sizeof(__u64))
+		return rta_getattr_u64(rta);
+	return rta_getattr_u32(rta);
+}
+
+static void print_tcpm(FILE *fp, struct rtattr **tb, const inet_prefix *daddr,
+		       const inet_prefix *saddr)
+{
+	static const char *names[TCP_METRIC_MAX + 1] = {
+		[TCP_METRIC_RTT]	= "rtt",
+		[TCP_METRIC_RTTVAR]	= "rttvar",
+		[TCP_METRIC_SSTHRESH]	= "ssthresh",
+		[TCP_METRIC_CWND]	= "cwnd",
+		[TCP_METRIC_REORDERING]	= "reordering",
+	};
+	char abuf[256];
+
+	fprintf(fp, "%s", format_host(daddr->family, daddr->bytelen,
+				      daddr->data, abuf, sizeof(abuf)));
+
+	if (tb[TCP_METRICS_ATTR_AGE])
+		print_msecs(fp, "age", tcpm_getattr_msecs(tb[TCP_METRICS_ATTR_AGE]));
+
+	if (tb[TCP_METRICS_ATTR_TW_TS_STAMP]) {
+		__s32 age = rta_getattr_u32(tb[TCP_METRICS_ATTR_TW_TS_STAMP]);
+		__u32 tsval = tb[TCP_METRICS_ATTR_TW_TSVAL] ?
+			rta_getattr_u32(tb[TCP_METRICS_ATTR_TW_TSVAL]) : 0;
+
+		fprintf(fp, " tw_ts %u/%dsec ago", tsval, age);
+	}
+
+	if (tb[TCP_METRICS_ATTR_VALS]) {
+		struct rtattr *m[TCP_METRIC_MAX + 2];
+		int i;
+
+		parse_rtattr_nested(m, TCP_METRIC_MAX + 1,
+				    tb[TCP_METRICS_ATTR_VALS]);
+		for (i = 0; i <= TCP_METRIC_REORDERING; i++) {
+			struct rtattr *us = NULL;
+			__u32 val;
+
+			/* The times are in usecs where the kernel has them */
+			if (i == TCP_METRIC_RTT)
+				us = m[TCP_METRIC_RTT_US + 1];
+			else if (i == TCP_METRIC_RTTVAR)
+				us = m[TCP_METRIC_RTTVAR_US + 1];
+			if (us) {
+				fprintf(fp, " %s %uus", names[i],
+					rta_getattr_u32(us));
+				continue;
+			}
+			if (m[i + 1] == NULL)
+				continue;
+			val = rta_getattr_u32(m[i + 1]);
+			if (i == TCP_METRIC_RTT || i == TCP_METRIC_RTTVAR)
+				fprintf(fp, " %s %lluus", names[i],
+					(unsigned long long)val * 1000);
+			else
+				fprintf(fp, " %s %u", names[i], val);
+		}
+	}
+
+	if (tb[TCP_METRICS_ATTR_FOPEN_MSS])
+		fprintf(fp, " fo_mss %u",
+			rta_getattr_u16(tb[TCP_METRICS_ATTR_FOPEN_MSS]));
+	if (tb[TCP_METRICS_ATTR_FOPEN_SYN_DROPS]) {
+		fprintf(fp, " fo_syn_drops %u",
+			rta_getattr_u16(tb[TCP_METRICS_ATTR_FOPEN_SYN_DROPS]));
+		if (tb[TCP_METRICS_ATTR_FOPEN_SYN_DROP_TS]) {
+			__u64 ts = tcpm_getattr_msecs(tb[TCP_METRICS_ATTR_FOPEN_SYN_DROP_TS]);
+
+			fprintf(fp, "/%llu.%03llusec ago", ts / 1000, ts % 1000);
+		}
+	}
+	if (tb[TCP_METRICS_ATTR_FOPEN_COOKIE]) {
+		struct rtattr *c = tb[TCP_METRICS_ATTR_FOPEN_COOKIE];
+		const __u8 *p = RTA_DATA(c);
+		int i;
+
+		fprintf(fp, " fo_cookie ");
+		for (i = 0; i < RTA_PAYLOAD(c); i++)
+			fprintf(fp, "%02x", p[i]);
+	}
+
+	if (saddr->family)
+		fprintf(fp, " source %s",
+			format_host(saddr->family, saddr->bytelen,
+				    saddr->data, abuf, sizeof(abuf)));
+	fprintf(fp, "\n");
+}
+
+static int collect_tcpm(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct rtattr *tb[TCP_METRICS_ATTR_MAX + 1];
+	inet_prefix daddr, saddr;
+	struct tcpm_ent *e;
+	int ret;
+
+	ret = tcpm_parse(n, tb, &daddr, &saddr);
+	if (ret <= 0)
+		return ret;
+
+	if (tcpm_nents == tcpm_maxents) {
+		int max = tcpm_maxents ? tcpm_maxents * 2 : 256;
+		struct tcpm_ent *ents;
+
+		ents = realloc(tcpm_ents, max * sizeof(*ents));
+		if (ents == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		tcpm_ents = ents;
+		tcpm_maxents = max;
+	}
+	e = &tcpm_ents[tcpm_nents];
+	e->n = malloc(n->nlmsg_len);
+	if (e->n == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	memcpy(e->n, n, n->nlmsg_len);
+	e->daddr = daddr;
+	e->saddr = saddr;
+	tcpm_nents++;
+	return 0;
+}
+
+static int tcpm_cmp(const void *a, const void *b)
+{
+	const struct tcpm_ent *x = a, *y = b;
+	int ret;
+
+	if (x->daddr.family != y->daddr.family)
+		return x->daddr.family - y->daddr.family;
+	ret = memcmp(x->daddr.data, y->daddr.data, x->daddr.bytelen);
+	if (ret)
+		return ret;
+	if (x->saddr.family != y->saddr.family)
+		return x->saddr.family - y->saddr.family;
+	return memcmp(x->saddr.data, y->saddr.data, x->saddr.bytelen);
+}
+
+static void tcpm_free(void)
+{
+	while (tcpm_nents)
+		free(tcpm_ents[--tcpm_nents].n);
+	free(tcpm_ents);
+	tcpm_ents = NULL;
+	tcpm_maxents = 0;
+}
+
+static int tcpm_dump(void)
+{
+	struct {
+		struct nlmsghdr		n;
+		char			buf[NLMSG_ALIGN(GENL_HDRLEN) + 128];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	tcpm_request(&req.n, TCP_METRICS_CMD_GET, NLM_F_ROOT | NLM_F_MATCH);
+	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
+
+	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&genl_rth, collect_tcpm, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void tcpm_flush_error(int cookie, int error, void *arg)
+{
+	/* Already gone, e.g. evicted meanwhile */
+	if (error == ENOENT)
+		return;
+	if (f.errors++ == 0)
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+}
+
+/* Deletes the collected entries one by one, each with its source
+ * address so that only the matching entry goes; the requests are
+ * pipelined.
+ */
+static int tcpm_flush_collected(void)
+{
+	struct {
+		struct nlmsghdr		n;
+		char			buf[NLMSG_ALIGN(GENL_HDRLEN) + 128];
+	} req;
+	int i;
+
+	if (rtnl_pipeline_open(&genl_rth, TCPM_FLUSH_WINDOW,
+			       tcpm_flush_error, NULL) < 0 ||
+	    rtnl_pipeline_coalesce(&genl_rth, TCPM_FLUSH_BATCH) < 0) {
+		fprintf(stderr, "Cannot set up request pipeline\n");
+		return -1;
+	}
+	for (i = 0; i < tcpm_nents; i++) {
+		struct tcpm_ent *e = &tcpm_ents[i];
+
+		memset(&req, 0, sizeof(req));
+		tcpm_request(&req.n, TCP_METRICS_CMD_DEL, 0);
+		tcpm_addattr(&req.n, sizeof(req), &e->daddr,
+			     TCP_METRICS_ATTR_ADDR_IPV4,
+			     TCP_METRICS_ATTR_ADDR_IPV6);
+		if (e->saddr.family)
+			tcpm_addattr(&req.n, sizeof(req), &e->saddr,
+				     TCP_METRICS_ATTR_SADDR_IPV4,
+				     TCP_METRICS_ATTR_SADDR_IPV6);
+		if (rtnl_talk(&genl_rth, &req.n, 0, 0, NULL) < 0)
+			break;
+	}
+	if (rtnl_pipeline_close(&genl_rth) < 0)
+		return -1;
+	f.count = i;
+	return i < tcpm_nents ? -1 : 0;
+}
+
+static int tcpm_talk(int cmd, int flags)
+{
+	struct {
+		struct nlmsghdr		n;
+		char			buf[NLMSG_ALIGN(GENL_HDRLEN) + 128];
+	} req;
+	struct {
+		struct nlmsghdr		n;
+		char			buf[4096];
+	} ans;
+	struct rtattr *tb[TCP_METRICS_ATTR_MAX + 1];
+	inet_prefix daddr, saddr;
+
+	memset(&req, 0, sizeof(req));
+	tcpm_request(&req.n, cmd, flags);
+	if (f.daddr.family)
+		tcpm_addattr(&req.n, sizeof(req), &f.daddr,
+			     TCP_METRICS_ATTR_ADDR_IPV4,
+			     TCP_METRICS_ATTR_ADDR_IPV6);
+	if (f.saddr.family)
+		tcpm_addattr(&req.n, sizeof(req), &f.saddr,
+			     TCP_METRICS_ATTR_SADDR_IPV4,
+			     TCP_METRICS_ATTR_SADDR_IPV6);
+
+	if (cmd != TCP_METRICS_CMD_GET)
+		return rtnl_talk(&genl_rth, &req.n, 0, 0, NULL) < 0 ? -2 : 0;
+
+	if (rtnl_talk(&genl_rth, &req.n, 0, 0, &ans.n) < 0)
+		return -2;
+	if (tcpm_parse(&ans.n, tb, &daddr, &saddr) > 0)
+		print_tcpm(stdout, tb, &daddr, &saddr);
+	return 0;
+}
+
+static void tcpm_get_prefix(inet_prefix *a, char *arg, const char *what)
+{
+	if (a->family) {
+		fprintf(stderr, "Duplicate \"%s\"\n", what);
+		exit(-1);
+	}
+	if (f.cmd == TCPM_GET || f.cmd == TCPM_DEL) {
+		get_addr(a, arg, preferred_family);
+		a->bitlen = a->bytelen * 8;
+	} else
+		get_prefix(a, arg, preferred_family);
+	if (a->family != AF_INET && a->family != AF_INET6)
+		invarg("Only IPv4 and IPv6 addresses", arg);
+}
+
+static int do_tcpm(int cmd, int argc, char **argv)
+{
+	int ret = 0;
+	int all = 0;
+	int i;
+
+	memset(&f, 0, sizeof(f));
+	f.cmd = cmd;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "saddr") == 0 || strcmp(*argv, "source") == 0) {
+			NEXT_ARG();
+			tcpm_get_prefix(&f.saddr, *argv, "saddr");
+		} else if (strcmp(*argv, "all") == 0 && cmd == TCPM_FLUSH) {
+			all = 1;
+		} else {
+			if (strcmp(*argv, "address") == 0 ||
+			    strcmp(*argv, "addr") == 0)
+				NEXT_ARG();
+			if (matches(*argv, "help") == 0)
+				usage();
+			tcpm_get_prefix(&f.daddr, *argv, "address");
+		}
+		argc--; argv++;
+	}
+
+	if (all && (f.daddr.family || f.saddr.family)) {
+		fprintf(stderr, "\"all\" takes no addresses\n");
+		return -1;
+	}
+
+	switch (cmd) {
+	case TCPM_GET:
+	case TCPM_DEL:
+		if (!f.daddr.family) {
+			fprintf(stderr, "An address is required\n");
+			return -1;
+		}
+		return tcpm_talk(cmd == TCPM_GET ? TCP_METRICS_CMD_GET :
+				 TCP_METRICS_CMD_DEL, 0);
+	case TCPM_FLUSH:
+		/* The kernel takes care of everything or of a single host
+		 * with all its sources in one request.
+		 */
+		if ((!f.daddr.family && !f.saddr.family &&
+		     preferred_family == AF_UNSPEC) ||
+		    (f.daddr.family && !f.saddr.family &&
+		     f.daddr.bitlen == f.daddr.bytelen * 8))
+			return tcpm_talk(TCP_METRICS_CMD_DEL, 0);
+		break;
+	}
+
+	if (tcpm_dump() < 0) {
+		tcpm_free();
+		return -2;
+	}
+
+	if (cmd == TCPM_FLUSH) {
+		if (tcpm_nents == 0) {
+			if (show_stats)
+				printf("Nothing to flush.\n");
+		} else {
+			if (tcpm_flush_collected() < 0)
+				ret = -2;
+			if (show_stats) {
+				printf("*** Deleted %d entries", f.count - f.errors);
+				if (f.errors)
+					printf(", %d failed", f.errors);
+				printf(" ***\n");
+			}
+		}
+		tcpm_free();
+		return ret;
+	}
+
+	qsort(tcpm_ents, tcpm_nents, sizeof(*tcpm_ents), tcpm_cmp);
+	for (i = 0; i < tcpm_nents; i++) {
+		struct rtattr *tb[TCP_METRICS_ATTR_MAX + 1];
+		struct tcpm_ent *e = &tcpm_ents[i];
+		struct genlmsghdr *ghdr = NLMSG_DATA(e->n);
+
+		parse_rtattr(tb, TCP_METRICS_ATTR_MAX, (void *)ghdr + GENL_HDRLEN,
+			     e->n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+		print_tcpm(stdout, tb, &e->daddr, &e->saddr);
+	}
+	fflush(stdout);
+	tcpm_free();
+	return 0;
+}
+
+int do_tcp_metrics(int argc, char **argv)
+{
+	if (genl_family < 0) {
+		if (rtnl_open_byproto(&genl_rth, 0, NETLINK_GENERIC) < 0) {
+			fprintf(stderr, "Cannot open generic netlink socket\n");
+			exit(1);
+		}
+
+		genl_family = genl_resolve_family(&genl_rth,
+						  TCP_METRICS_GENL_NAME);
+		if (genl_family < 0)
+			exit(1);
+	}
+
+	if (argc < 1)
+		return do_tcpm(TCPM_SHOW, 0, NULL);
+	if (matches(*argv, "show") == 0 ||
+	    matches(*argv, "list") == 0 ||
+	    matches(*argv, "lst") == 0)
+		return do_tcpm(TCPM_SHOW, argc-1, argv+1);
+	if (matches(*argv, "get") == 0)
+		return do_tcpm(TCPM_GET, argc-1, argv+1);
+	if (matches(*argv, "delete") == 0)
+		return do_tcpm(TCPM_DEL, argc-1, argv+1);
+	if (matches(*argv, "flush") == 0)
+		return do_tcpm(TCPM_FLUSH, argc-1, argv+1);
+	if (matches(*argv, "help") == 0)
+		usage();
+
+	fprintf(stderr, "Command \"%s\" is unknown, try \"ip tcp_metrics help\".\n", *argv);
+	exit(-1);
+}
@@ -34,8 +34,10 @@
 #include <linux/if.h>
 #include <linux/ip.h>
 #include <linux/if_tunnel.h>
+#include <linux/if_arp.h>
 
 #include "utils.h"
+#include "ip_common.h"
 #include "tunnel.h"
 
 const char *tnl_strproto(__u8 proto)
@@ -154,3 +156,240 @@ int tnl_ioctl_get_6rd(const char *name, void *p)
 {
 	return tnl_gen_ioctl(SIOCGET6RD, name, p, EINVAL);
 }
+
+/*
+ * rtnetlink: all tunnels come in one RTM_GETLINK dump, with their
+ * parameters in IFLA_INFO_DATA and their counters in IFLA_STATS64,
+ * instead of a line of /proc/net/dev and an ioctl per device.  Kernels
+ * that cannot describe a kind of tunnel that way leave IFLA_INFO_DATA
+ * out; the callers then fall back to the ioctls for that device.
+ */
+struct tnl_nl_ctx {
+	tnl_nl_fn	fn;
+	void		*arg;
+};
+
+static int tnl_nl_parse(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct tnl_nl_ctx *ctx = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+	struct tnl_nl_link l;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+
+	switch (ifi->ifi_type) {
+	case ARPHRD_TUNNEL:
+	case ARPHRD_TUNNEL6:
+	case ARPHRD_IPGRE:
+	case ARPHRD_SIT:
+		break;
+	default:
+		return 0;
+	}
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	if (tb[IFLA_IFNAME] == NULL)
+		return 0;
+
+	memset(&l, 0, sizeof(l));
+	l.ifindex = ifi->ifi_index;
+	l.type = ifi->ifi_type;
+	l.name = rta_getattr_str(tb[IFLA_IFNAME]);
+	if (tb[IFLA_LINKINFO]) {
+		parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+		if (linkinfo[IFLA_INFO_KIND])
+			l.kind = rta_getattr_str(linkinfo[IFLA_INFO_KIND]);
+		l.data = linkinfo[IFLA_INFO_DATA];
+	}
+
+	if (tb[IFLA_STATS64] &&
+	    RTA_PAYLOAD(tb[IFLA_STATS64]) >= sizeof(l.stats)) {
+		memcpy(&l.stats, RTA_DATA(tb[IFLA_STATS64]), sizeof(l.stats));
+		l.has_stats = 1;
+	} else if (tb[IFLA_STATS] &&
+		   RTA_PAYLOAD(tb[IFLA_STATS]) >= sizeof(struct rtnl_link_stats)) {
+		struct rtnl_link_stats *s = RTA_DATA(tb[IFLA_STATS]);
+
+		l.stats.rx_packets = s->rx_packets;
+		l.stats.tx_packets = s->tx_packets;
+		l.stats.rx_bytes = s->rx_bytes;
+		l.stats.tx_bytes = s->tx_bytes;
+		l.stats.rx_errors = s->rx_errors;
+		l.stats.tx_errors = s->tx_errors;
+		l.stats.tx_dropped = s->tx_dropped;
+		l.stats.multicast = s->multicast;
+		l.stats.collisions = s->collisions;
+		l.stats.rx_length_errors = s->rx_length_errors;
+		l.stats.rx_over_errors = s->rx_over_errors;
+		l.stats.rx_crc_errors = s->rx_crc_errors;
+		l.stats.rx_frame_errors = s->rx_frame_errors;
+		l.stats.rx_fifo_errors = s->rx_fifo_errors;
+		l.stats.tx_aborted_errors = s->tx_aborted_errors;
+		l.stats.tx_carrier_errors = s->tx_carrier_errors;
+		l.stats.tx_heartbeat_errors = s->tx_heartbeat_errors;
+		l.stats.tx_window_errors = s->tx_window_errors;
+		l.has_stats = 1;
+	}
+
+	return ctx->fn(&l, ctx->arg);
+}
+
+/* Every tunnel device, or only the one called name; -1 if not asked */
+int tnl_nl_list(const char *name, tnl_nl_fn fn, void *arg)
+{
+	struct tnl_nl_ctx ctx = { .fn = fn, .arg = arg };
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[256];
+	} req;
+
+	if (name == NULL || name[0] == 0) {
+		if (rtnl_wilddump_request(&rth, AF_UNSPEC, RTM_GETLINK) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		if (rtnl_dump_filter(&rth, tnl_nl_parse, &ctx) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.i.ifi_family = AF_UNSPEC;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, strlen(name) + 1);
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, &req.n) < 0)
+		return -1;
+	return tnl_nl_parse(NULL, &req.n, &ctx) < 0 ? -1 : 0;
+}
+
+static int tnl_nl_has_data(struct tnl_nl_link *l, void *arg)
+{
+	*(int *)arg = l->kind && l->data;
+	return 0;
+}
+
+/*
+ * Whether the tunnel called name (or gre0, tunl0... for the kind of a
+ * new one) is driven through rtnetlink.  A device that is not there is
+ * left to rtnetlink, which loads the module on its own.
+ */
+int tnl_nl_supported(const char *name)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[256];
+	} req;
+	struct tnl_nl_ctx ctx = { .fn = tnl_nl_has_data };
+	int ok = 1;
+
+	if (ll_name_to_index(name) == 0)
+		return 1;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.i.ifi_family = AF_UNSPEC;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, strlen(name) + 1);
+
+	ctx.arg = &ok;
+	if (rtnl_talk(&rth, &req.n, 0, 0, &req.n) < 0)
+		return 0;
+	if (tnl_nl_parse(NULL, &req.n, &ctx) < 0)
+		return 0;
+	return ok;
+}
+
+int tnl_nl_add(int cmd, const char *kind, const char *name,
+	       tnl_nl_fill_fn fill, void *p)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[1024];
+	} req;
+	struct rtattr *linkinfo, *data;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	if (cmd == SIOCADDTUNNEL)
+		req.n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+	req.n.nlmsg_type = RTM_NEWLINK;
+	req.i.ifi_family = AF_UNSPEC;
+
+	if (name[0])
+		addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name,
+			  strlen(name) + 1);
+	linkinfo = NLMSG_TAIL(&req.n);
+	addattr_l(&req.n, sizeof(req), IFLA_LINKINFO, NULL, 0);
+	addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, kind, strlen(kind));
+	data = NLMSG_TAIL(&req.n);
+	addattr_l(&req.n, sizeof(req), IFLA_INFO_DATA, NULL, 0);
+	if (fill(&req.n, sizeof(req), p) < 0)
+		return -1;
+	data->rta_len = (void *)NLMSG_TAIL(&req.n) - (void *)data;
+	linkinfo->rta_len = (void *)NLMSG_TAIL(&req.n) - (void *)linkinfo;
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
+		return -1;
+	return 0;
+}
+
+int tnl_nl_del(const char *name)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[256];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_DELLINK;
+	req.i.ifi_family = AF_UNSPEC;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, strlen(name) + 1);
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
+		return -1;
+	return 0;
+}
+
+/* The counters the way the /proc/net/dev based listing shows them */
+void tnl_print_stats(const struct rtnl_link_stats64 *s)
+{
+	printf("%s", _SL_);
+	printf("RX: Packets    Bytes        Errors CsumErrs OutOfSeq Mcasts%s", _SL_);
+	printf("    %-10llu %-12llu %-6llu %-8llu %-8llu %-8llu%s",
+	       (unsigned long long)s->rx_packets,
+	       (unsigned long long)s->rx_bytes,
+	       (unsigned long long)s->rx_errors,
+	       (unsigned long long)(s->rx_length_errors + s->rx_over_errors +
+				    s->rx_crc_errors + s->rx_frame_errors),
+	       (unsigned long long)s->rx_fifo_errors,
+	       (unsigned long long)s->multicast, _SL_);
+	printf("TX: Packets    Bytes        Errors DeadLoop NoRoute  NoBufs%s", _SL_);
+	printf("    %-10llu %-12llu %-6llu %-8llu %-8llu %-6llu",
+	       (unsigned long long)s->tx_packets,
+	       (unsigned long long)s->tx_bytes,
+	       (unsigned long long)s->tx_errors,
+	       (unsigned long long)s->collisions,
+	       (unsigned long long)(s->tx_carrier_errors +
+				    s->tx_aborted_errors +
+				    s->tx_window_errors +
+				    s->tx_heartbeat_errors),
+	       (unsigned long long)s->tx_dropped);
+}
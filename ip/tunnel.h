@@ -23,9 +23,32 @@
 #define __TUNNEL_H__ 1
 
 #include <linux/types.h>
+#include <linux/if_link.h>
+#include "libnetlink.h"
 
 const char *tnl_strproto(__u8 proto);
 
+/* A tunnel device as an RTM_GETLINK dump describes it */
+struct tnl_nl_link {
+	int			ifindex;
+	unsigned short		type;		/* ARPHRD_* */
+	const char		*name;
+	const char		*kind;		/* NULL without IFLA_LINKINFO */
+	struct rtattr		*data;		/* IFLA_INFO_DATA, may be NULL */
+	int			has_stats;
+	struct rtnl_link_stats64 stats;
+};
+
+typedef int (*tnl_nl_fn)(struct tnl_nl_link *l, void *arg);
+typedef int (*tnl_nl_fill_fn)(struct nlmsghdr *n, int maxlen, void *p);
+
+int tnl_nl_list(const char *name, tnl_nl_fn fn, void *arg);
+int tnl_nl_supported(const char *name);
+int tnl_nl_add(int cmd, const char *kind, const char *name,
+	       tnl_nl_fill_fn fill, void *p);
+int tnl_nl_del(const char *name);
+void tnl_print_stats(const struct rtnl_link_stats64 *s);
+
 int tnl_get_ioctl(const char *basedev, void *p);
 int tnl_add_ioctl(int cmd, const char *basedev, const char *name, void *p);
 int tnl_del_ioctl(const char *basedev, const char *name, void *p);
@@ -73,6 +73,38 @@ struct xfrm_buffer {
 
 	int nlmsg_count;
 	struct rtnl_handle *rth;
+	struct xfrm_delete *del;	/* if set, deletes go out at once */
+};
+
+struct xfrm_index_ent {
+	__u16 family;
+	xfrm_address_t addr;
+	struct nlmsghdr *n;
+};
+
+struct xfrm_index {
+	int valid;
+	int hdrlen;		/* of the messages, checked before key() */
+	void (*key)(struct nlmsghdr *n, __u16 *family, xfrm_address_t *addr);
+	struct arena arena;
+	struct xfrm_index_ent *ent;
+	int n;
+	int max;
+};
+
+#define XFRM_DELETE_WINDOW	256
+#define XFRM_DELETE_MSGSIZE	256
+
+struct xfrm_delete {
+	struct rtnl_handle rth;
+	char *slot;		/* the requests waiting for their ACK */
+	int sent;
+	char *retry;		/* the ones that failed */
+	int retry_len;
+	int retry_size;
+	int retries;
+	int lost;
+	int error;
 };
 
 struct xfrm_filter {
@@ -116,6 +148,22 @@ int do_xfrm_state(int argc, char **argv);
 int do_xfrm_policy(int argc, char **argv);
 int do_xfrm_monitor(int argc, char **argv);
 
+int xfrm_index_build(struct xfrm_index *idx, struct rtnl_handle *rth,
+		     int type);
+void xfrm_index_free(struct xfrm_index *idx);
+int xfrm_index_walk(struct xfrm_index *idx, __u16 family,
+		    xfrm_address_t *addr, int plen,
+		    rtnl_filter_t filter, void *arg);
+int xfrm_delete_open(struct xfrm_delete *xd);
+int xfrm_delete_send(struct xfrm_delete *xd, struct nlmsghdr *n);
+int xfrm_delete_close(struct xfrm_delete *xd);
+typedef int (*xfrm_bulk_build_t)(struct nlmsghdr *n, int maxlen,
+				 int argc, char **argv);
+int xfrm_bulk(const char *name, int cmd, xfrm_bulk_build_t build);
+int xfrm_bulk_invarg(const char *msg, const char *arg);
+int xfrm_algo_key_parse(char *buf, int max, const char *key);
+int xfrm_bulk_addr(xfrm_address_t *addr, __u8 *plen, __u16 *family,
+		   char *arg);
 int xfrm_addr_match(xfrm_address_t *x1, xfrm_address_t *x2, int bits);
 int xfrm_xfrmproto_is_ipsec(__u8 proto);
 int xfrm_xfrmproto_is_ro(__u8 proto);
@@ -148,6 +196,7 @@ void xfrm_policy_info_print(struct xfrm_userpolicy_info *xpinfo,
 			    const char *title);
 int xfrm_id_parse(xfrm_address_t *saddr, struct xfrm_id *id, __u16 *family,
 		  int loose, int *argcp, char ***argvp);
+int xfrm_mode_getbyname(const char *name);
 int xfrm_mode_parse(__u8 *mode, int *argcp, char ***argvp);
 int xfrm_encap_type_parse(__u16 *type, int *argcp, char ***argvp);
 int xfrm_reqid_parse(__u32 *reqid, int *argcp, char ***argvp);
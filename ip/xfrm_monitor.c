@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <endian.h>
+#include <sys/time.h>
 #include <linux/xfrm.h>
 #include "utils.h"
 #include "xfrm.h"
@@ -38,7 +39,8 @@ static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: ip xfrm monitor [ all | LISTofXFRM-OBJECTS ]\n");
+	fprintf(stderr, "Usage: ip xfrm monitor [ aggregate MSECS [ prefix4 PLEN ] [ prefix6 PLEN ]\n");
+	fprintf(stderr, "                         [ storm RATE ] ] [ all | LISTofXFRM-OBJECTS ]\n");
 	exit(-1);
 }
 
@@ -303,12 +305,14 @@ static int xfrm_accept_msg(const struct sockaddr_nl *who,
 	case XFRM_MSG_UPDSA:
 	case XFRM_MSG_EXPIRE:
 		xfrm_state_print(who, n, arg);
+		fflush(fp);
 		return 0;
 	case XFRM_MSG_NEWPOLICY:
 	case XFRM_MSG_DELPOLICY:
 	case XFRM_MSG_UPDPOLICY:
 	case XFRM_MSG_POLEXPIRE:
 		xfrm_policy_print(who, n, arg);
+		fflush(fp);
 		return 0;
 	case XFRM_MSG_ACQUIRE:
 		xfrm_acquire_print(who, n, arg);
@@ -342,6 +346,371 @@ static int xfrm_accept_msg(const struct sockaddr_nl *who,
 
 extern struct rtnl_handle rth;
 
+/*
+ * "ip xfrm monitor aggregate MSECS" counts the events of a window of
+ * MSECS by type, XFRM protocol and source and destination prefix
+ * instead of printing them, and prints one line per group at the end
+ * of it, the busiest first, followed by the number of times the socket
+ * overflowed.  The prefixes are the addresses cut to "prefix4" and
+ * "prefix6" bits.  An acquire group at or above "storm" events per
+ * second is marked as a storm: the kernel is asking for SAs faster
+ * than the key manager installs them.
+ */
+#define AGG_HASH_SIZE	4096
+
+enum {
+	AGG_NEWSA, AGG_UPDSA, AGG_DELSA, AGG_EXPIRE_SOFT, AGG_EXPIRE_HARD,
+	AGG_ACQUIRE, AGG_NEWPOLICY, AGG_UPDPOLICY, AGG_DELPOLICY,
+	AGG_POLEXPIRE, AGG_FLUSHSA, AGG_FLUSHPOLICY, AGG_REPORT, AGG_AEVENT,
+	AGG_MAPPING, AGG_OTHER, AGG_MAX
+};
+
+static const char *agg_type_names[AGG_MAX] = {
+	"newsa", "updsa", "delsa", "expire-soft", "expire-hard",
+	"acquire", "newpolicy", "updpolicy", "delpolicy",
+	"polexpire", "flushsa", "flushpolicy", "report", "aevent",
+	"mapping", "other"
+};
+
+struct agg_key
+{
+	__u16		type;
+	__u16		family;
+	__u8		proto;
+	xfrm_address_t	saddr;
+	xfrm_address_t	daddr;
+};
+
+struct agg_ent
+{
+	struct agg_ent	*next;
+	struct agg_key	key;
+	unsigned	count;
+};
+
+static struct
+{
+	unsigned	window;
+	unsigned	plen4;
+	unsigned	plen6;
+	unsigned	storm;
+	struct timeval	start;
+	struct agg_ent	*hash[AGG_HASH_SIZE];
+	unsigned	groups;
+	unsigned	events;
+	__u64		overruns;
+} agg = {
+	.plen4 = 24,
+	.plen6 = 64,
+	.storm = 100,
+};
+
+static void agg_addr(xfrm_address_t *dst, const xfrm_address_t *src,
+		     __u16 family)
+{
+	unsigned plen = family == AF_INET6 ? agg.plen6 : agg.plen4;
+	__u8 *p = (__u8 *)dst;
+	int i;
+
+	memset(dst, 0, sizeof(*dst));
+	if (family != AF_INET && family != AF_INET6)
+		return;
+	memcpy(dst, src, family == AF_INET6 ? 16 : 4);
+	for (i = plen / 8; i < 16; i++) {
+		if (i == plen / 8 && plen % 8)
+			p[i] &= 0xff << (8 - plen % 8);
+		else
+			p[i] = 0;
+	}
+}
+
+static void agg_sa(struct agg_key *key, const struct xfrm_usersa_info *xsinfo)
+{
+	key->family = xsinfo->family;
+	key->proto = xsinfo->id.proto;
+	agg_addr(&key->saddr, &xsinfo->saddr, key->family);
+	agg_addr(&key->daddr, &xsinfo->id.daddr, key->family);
+}
+
+static void agg_sel(struct agg_key *key, const struct xfrm_selector *sel)
+{
+	key->family = sel->family;
+	agg_addr(&key->saddr, &sel->saddr, key->family);
+	agg_addr(&key->daddr, &sel->daddr, key->family);
+}
+
+/* Too short messages are counted as "other" rather than looked into */
+static void agg_key(struct nlmsghdr *n, struct agg_key *key)
+{
+	int len = n->nlmsg_len;
+	void *data = NLMSG_DATA(n);
+
+	memset(key, 0, sizeof(*key));
+	key->type = AGG_OTHER;
+
+	switch (n->nlmsg_type) {
+	case XFRM_MSG_NEWSA:
+	case XFRM_MSG_UPDSA:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_usersa_info)))
+			return;
+		key->type = n->nlmsg_type == XFRM_MSG_NEWSA ?
+			AGG_NEWSA : AGG_UPDSA;
+		agg_sa(key, data);
+		break;
+	case XFRM_MSG_DELSA: {
+		struct xfrm_usersa_id *xsid = data;
+		struct rtattr *tb[XFRMA_MAX+1];
+
+		if (len < NLMSG_SPACE(sizeof(*xsid)))
+			return;
+		key->type = AGG_DELSA;
+		parse_rtattr(tb, XFRMA_MAX, XFRMSID_RTA(xsid),
+			     len - NLMSG_SPACE(sizeof(*xsid)));
+		if (tb[XFRMA_SA] &&
+		    RTA_PAYLOAD(tb[XFRMA_SA]) >= sizeof(struct xfrm_usersa_info)) {
+			agg_sa(key, RTA_DATA(tb[XFRMA_SA]));
+			break;
+		}
+		key->family = xsid->family;
+		key->proto = xsid->proto;
+		agg_addr(&key->daddr, &xsid->daddr, key->family);
+		break;
+	}
+	case XFRM_MSG_EXPIRE: {
+		struct xfrm_user_expire *xexp = data;
+
+		if (len < NLMSG_LENGTH(sizeof(*xexp)))
+			return;
+		key->type = xexp->hard ? AGG_EXPIRE_HARD : AGG_EXPIRE_SOFT;
+		agg_sa(key, &xexp->state);
+		break;
+	}
+	case XFRM_MSG_ACQUIRE: {
+		struct xfrm_user_acquire *xacq = data;
+
+		if (len < NLMSG_LENGTH(sizeof(*xacq)))
+			return;
+		key->type = AGG_ACQUIRE;
+		key->family = xacq->sel.family;
+		if (key->family == AF_UNSPEC)
+			key->family = xacq->policy.sel.family;
+		key->proto = xacq->id.proto;
+		agg_addr(&key->saddr, &xacq->saddr, key->family);
+		agg_addr(&key->daddr, &xacq->id.daddr, key->family);
+		break;
+	}
+	case XFRM_MSG_NEWPOLICY:
+	case XFRM_MSG_UPDPOLICY:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_userpolicy_info)))
+			return;
+		key->type = n->nlmsg_type == XFRM_MSG_NEWPOLICY ?
+			AGG_NEWPOLICY : AGG_UPDPOLICY;
+		agg_sel(key, &((struct xfrm_userpolicy_info *)data)->sel);
+		break;
+	case XFRM_MSG_DELPOLICY:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_userpolicy_id)))
+			return;
+		key->type = AGG_DELPOLICY;
+		agg_sel(key, &((struct xfrm_userpolicy_id *)data)->sel);
+		break;
+	case XFRM_MSG_POLEXPIRE:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_user_polexpire)))
+			return;
+		key->type = AGG_POLEXPIRE;
+		agg_sel(key, &((struct xfrm_user_polexpire *)data)->pol.sel);
+		break;
+	case XFRM_MSG_FLUSHSA:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_usersa_flush)))
+			return;
+		key->type = AGG_FLUSHSA;
+		key->proto = ((struct xfrm_usersa_flush *)data)->proto;
+		break;
+	case XFRM_MSG_FLUSHPOLICY:
+		key->type = AGG_FLUSHPOLICY;
+		break;
+	case XFRM_MSG_REPORT:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_user_report)))
+			return;
+		key->type = AGG_REPORT;
+		key->proto = ((struct xfrm_user_report *)data)->proto;
+		agg_sel(key, &((struct xfrm_user_report *)data)->sel);
+		break;
+	case XFRM_MSG_NEWAE:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_aevent_id)))
+			return;
+		key->type = AGG_AEVENT;
+		key->family = ((struct xfrm_aevent_id *)data)->sa_id.family;
+		key->proto = ((struct xfrm_aevent_id *)data)->sa_id.proto;
+		agg_addr(&key->saddr, &((struct xfrm_aevent_id *)data)->saddr,
+			 key->family);
+		agg_addr(&key->daddr,
+			 &((struct xfrm_aevent_id *)data)->sa_id.daddr,
+			 key->family);
+		break;
+	case XFRM_MSG_MAPPING:
+		if (len < NLMSG_LENGTH(sizeof(struct xfrm_user_mapping)))
+			return;
+		key->type = AGG_MAPPING;
+		key->family = ((struct xfrm_user_mapping *)data)->id.family;
+		key->proto = ((struct xfrm_user_mapping *)data)->id.proto;
+		agg_addr(&key->daddr, &((struct xfrm_user_mapping *)data)->id.daddr,
+			 key->family);
+		break;
+	}
+}
+
+static unsigned agg_hash(const struct agg_key *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	unsigned h = 2166136261u;
+	int i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h % AGG_HASH_SIZE;
+}
+
+static int agg_count(const struct agg_key *key)
+{
+	unsigned h = agg_hash(key);
+	struct agg_ent *e;
+
+	for (e = agg.hash[h]; e; e = e->next)
+		if (memcmp(&e->key, key, sizeof(*key)) == 0)
+			break;
+	if (e == NULL) {
+		e = calloc(1, sizeof(*e));
+		if (e == NULL) {
+			perror("calloc");
+			return -1;
+		}
+		e->key = *key;
+		e->next = agg.hash[h];
+		agg.hash[h] = e;
+		agg.groups++;
+	}
+	e->count++;
+	agg.events++;
+	return 0;
+}
+
+static int agg_cmp(const void *a, const void *b)
+{
+	const struct agg_ent *ea = *(const struct agg_ent **)a;
+	const struct agg_ent *eb = *(const struct agg_ent **)b;
+
+	if (ea->count != eb->count)
+		return ea->count < eb->count ? 1 : -1;
+	return ea->key.type - eb->key.type;
+}
+
+static void agg_print_prefix(FILE *fp, const char *title,
+			     const struct agg_key *key,
+			     const xfrm_address_t *addr)
+{
+	char abuf[256];
+
+	if (key->family != AF_INET && key->family != AF_INET6)
+		return;
+	fprintf(fp, " %s %s/%u", title,
+		rt_addr_n2a(key->family, sizeof(*addr), addr,
+			    abuf, sizeof(abuf)),
+		key->family == AF_INET6 ? agg.plen6 : agg.plen4);
+}
+
+static void agg_flush(FILE *fp, const struct timeval *now)
+{
+	struct agg_ent **ents = NULL;
+	struct agg_ent *e;
+	double secs;
+	int i, n = 0;
+
+	secs = (now->tv_sec - agg.start.tv_sec) +
+		(now->tv_usec - agg.start.tv_usec) / 1000000.;
+	if (secs <= 0)
+		secs = agg.window / 1000.;
+
+	if (agg.groups)
+		ents = malloc(agg.groups * sizeof(*ents));
+	for (i = 0; i < AGG_HASH_SIZE; i++) {
+		for (e = agg.hash[i]; e; e = e->next)
+			if (ents)
+				ents[n++] = e;
+	}
+	if (ents)
+		qsort(ents, n, sizeof(*ents), agg_cmp);
+
+	if (timestamp)
+		print_timestamp(fp);
+	for (i = 0; i < n; i++) {
+		e = ents[i];
+		fprintf(fp, "%s", agg_type_names[e->key.type]);
+		if (e->key.proto)
+			fprintf(fp, " proto %s", strxf_xfrmproto(e->key.proto));
+		agg_print_prefix(fp, "src", &e->key, &e->key.saddr);
+		agg_print_prefix(fp, "dst", &e->key, &e->key.daddr);
+		fprintf(fp, " count %u rate %.0f/s", e->count, e->count / secs);
+		if (e->key.type == AGG_ACQUIRE && agg.storm &&
+		    e->count / secs >= agg.storm)
+			fprintf(fp, " storm");
+		fprintf(fp, "\n");
+	}
+	free(ents);
+
+	if (agg.events || rth.rx_stats.overruns != agg.overruns) {
+		fprintf(fp, "*** %u events, %u groups in %.3fs",
+			agg.events, agg.groups, secs);
+		if (rth.rx_stats.overruns != agg.overruns)
+			fprintf(fp, "; %llu overruns, events lost",
+				(unsigned long long)(rth.rx_stats.overruns -
+						     agg.overruns));
+		fprintf(fp, " ***\n");
+	}
+	fflush(fp);
+
+	for (i = 0; i < AGG_HASH_SIZE; i++) {
+		while ((e = agg.hash[i]) != NULL) {
+			agg.hash[i] = e->next;
+			free(e);
+		}
+	}
+	agg.groups = agg.events = 0;
+	agg.overruns = rth.rx_stats.overruns;
+	agg.start = *now;
+}
+
+static void agg_tick(FILE *fp)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	if ((now.tv_sec - agg.start.tv_sec) * 1000 +
+	    (now.tv_usec - agg.start.tv_usec) / 1000 >= agg.window)
+		agg_flush(fp, &now);
+}
+
+static int agg_idle(void *arg)
+{
+	agg_tick(arg);
+	return 0;
+}
+
+static int agg_msg(const struct sockaddr_nl *who,
+		   struct nlmsghdr *n, void *arg)
+{
+	struct agg_key key;
+
+	if (n->nlmsg_type == NLMSG_ERROR || n->nlmsg_type == NLMSG_NOOP ||
+	    n->nlmsg_type == NLMSG_DONE)
+		return 0;
+
+	agg_key(n, &key);
+	if (agg_count(&key) < 0)
+		return -1;
+	agg_tick(arg);
+	return 0;
+}
+
 int do_xfrm_monitor(int argc, char **argv)
 {
 	char *file = NULL;
@@ -359,6 +728,22 @@ int do_xfrm_monitor(int argc, char **argv)
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (matches(*argv, "aggregate") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&agg.window, *argv, 0) || agg.window == 0)
+				invarg("invalid \"aggregate\" window\n", *argv);
+		} else if (strcmp(*argv, "prefix4") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&agg.plen4, *argv, 0) || agg.plen4 > 32)
+				invarg("invalid \"prefix4\" length\n", *argv);
+		} else if (strcmp(*argv, "prefix6") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&agg.plen6, *argv, 0) || agg.plen6 > 128)
+				invarg("invalid \"prefix6\" length\n", *argv);
+		} else if (strcmp(*argv, "storm") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&agg.storm, *argv, 0))
+				invarg("invalid \"storm\" rate\n", *argv);
 		} else if (matches(*argv, "acquire") == 0) {
 			lacquire=1;
 			groups = 0;
@@ -399,6 +784,10 @@ int do_xfrm_monitor(int argc, char **argv)
 	if (lreport)
 		groups |= nl_mgrp(XFRMNLGRP_REPORT);
 
+	if (file && agg.window) {
+		fprintf(stderr, "\"aggregate\" cannot be used with \"file\"\n");
+		exit(-1);
+	}
 	if (file) {
 		FILE *fp;
 		fp = fopen(file, "r");
@@ -414,6 +803,16 @@ int do_xfrm_monitor(int argc, char **argv)
 	if (rtnl_open_byproto(&rth, groups, NETLINK_XFRM) < 0)
 		exit(1);
 
+	if (agg.window) {
+		rth.batch = RTNL_DEFAULT_BATCH;
+		gettimeofday(&agg.start, NULL);
+		rth.idle = agg_idle;
+		rth.idle_timeout = agg.window;
+		if (rtnl_listen(&rth, agg_msg, (void*)stdout) < 0)
+			exit(2);
+		return 0;
+	}
+
 	if (rtnl_listen(&rth, xfrm_accept_msg, (void*)stdout) < 0)
 		exit(2);
 
@@ -61,6 +61,7 @@ static void usage(void)
 	fprintf(stderr, "        [ mark MARK [ mask MASK ] ] [ index INDEX ] [ ptype PTYPE ]\n");
 	fprintf(stderr, "        [ action ACTION ] [ priority PRIORITY ] [ flag FLAG-LIST ]\n");
 	fprintf(stderr, "        [ LIMIT-LIST ] [ TMPL-LIST ]\n");
+	fprintf(stderr, "Usage: ip xfrm policy bulk [ update ] { FILE | - }\n");
 	fprintf(stderr, "Usage: ip xfrm policy { delete | get } { SELECTOR | index INDEX } dir DIR\n");
 	fprintf(stderr, "        [ ctx CTX ] [ mark MARK [ mask MASK ] ] [ ptype PTYPE ]\n");
 	fprintf(stderr, "Usage: ip xfrm policy { deleteall | list } [ SELECTOR ] [ dir DIR ]\n");
@@ -404,6 +405,124 @@ static int xfrm_policy_modify(int cmd, unsigned flags, int argc, char **argv)
 	return 0;
 }
 
+/*
+ * A "bulk" record is DIR SRC[/PLEN] DST[/PLEN] PRIORITY [ block | TMPLS ]
+ * with TMPLS := [ TMPLS ] tmpl XFRM-PROTO REQID MODE [ TSRC TDST ];
+ * the template addresses are given for, and only for, tunnel and beet.
+ */
+static int xfrm_policy_bulk_build(struct nlmsghdr *n, int maxlen,
+				  int argc, char **argv)
+{
+	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
+	struct xfrm_user_tmpl tmpls[XFRM_TMPLS_BUF_SIZE / sizeof(struct xfrm_user_tmpl)];
+	int ntmpls = 0;
+	int ret;
+
+	if (argc < 4)
+		return xfrm_bulk_invarg("too few fields after", argv[argc - 1]);
+
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*xpinfo));
+	xpinfo->sel.family = preferred_family;
+	xpinfo->lft.soft_byte_limit = XFRM_INF;
+	xpinfo->lft.hard_byte_limit = XFRM_INF;
+	xpinfo->lft.soft_packet_limit = XFRM_INF;
+	xpinfo->lft.hard_packet_limit = XFRM_INF;
+
+	if (strcmp(argv[0], "in") == 0)
+		xpinfo->dir = XFRM_POLICY_IN;
+	else if (strcmp(argv[0], "out") == 0)
+		xpinfo->dir = XFRM_POLICY_OUT;
+	else if (strcmp(argv[0], "fwd") == 0)
+		xpinfo->dir = XFRM_POLICY_FWD;
+	else
+		return xfrm_bulk_invarg("invalid DIR", argv[0]);
+
+	if (xfrm_bulk_addr(&xpinfo->sel.saddr, &xpinfo->sel.prefixlen_s,
+			   &xpinfo->sel.family, argv[1]) < 0 ||
+	    xfrm_bulk_addr(&xpinfo->sel.daddr, &xpinfo->sel.prefixlen_d,
+			   &xpinfo->sel.family, argv[2]) < 0)
+		return -1;
+	if (xpinfo->sel.family == AF_UNSPEC)
+		xpinfo->sel.family = AF_INET;
+	if (get_u32(&xpinfo->priority, argv[3], 0))
+		return xfrm_bulk_invarg("invalid PRIORITY", argv[3]);
+
+	argc -= 4;
+	argv += 4;
+	if (argc == 1 && strcmp(*argv, "block") == 0) {
+		xpinfo->action = XFRM_POLICY_BLOCK;
+		return 0;
+	}
+
+	memset(tmpls, 0, sizeof(tmpls));
+	for (; argc > 0; argc -= ret, argv += ret) {
+		struct xfrm_user_tmpl *tmpl = &tmpls[ntmpls];
+		int mode;
+
+		if (strcmp(*argv, "tmpl") != 0)
+			return xfrm_bulk_invarg("expected \"tmpl\", not", *argv);
+		if (argc < 4)
+			return xfrm_bulk_invarg("too few fields after", *argv);
+		if (ntmpls == ARRAY_SIZE(tmpls))
+			return xfrm_bulk_invarg("too many templates at", *argv);
+
+		ret = xfrm_xfrmproto_getbyname(argv[1]);
+		if (ret < 0)
+			return xfrm_bulk_invarg("invalid XFRM-PROTO", argv[1]);
+		tmpl->id.proto = ret;
+		if (get_u32(&tmpl->reqid, argv[2], 0))
+			return xfrm_bulk_invarg("invalid REQID", argv[2]);
+		mode = xfrm_mode_getbyname(argv[3]);
+		if (mode < 0)
+			return xfrm_bulk_invarg("invalid MODE", argv[3]);
+		tmpl->mode = mode;
+		tmpl->family = xpinfo->sel.family;
+		tmpl->aalgos = ~(__u32)0;
+		tmpl->ealgos = ~(__u32)0;
+		tmpl->calgos = ~(__u32)0;
+
+		ret = 4;
+		if (mode == XFRM_MODE_TUNNEL || mode == XFRM_MODE_BEET) {
+			if (argc < 6)
+				return xfrm_bulk_invarg("too few fields after",
+							argv[3]);
+			tmpl->family = AF_UNSPEC;
+			if (xfrm_bulk_addr(&tmpl->saddr, NULL, &tmpl->family,
+					   argv[4]) < 0 ||
+			    xfrm_bulk_addr(&tmpl->id.daddr, NULL,
+					   &tmpl->family, argv[5]) < 0)
+				return -1;
+			if (tmpl->family == AF_UNSPEC)
+				tmpl->family = xpinfo->sel.family;
+			ret = 6;
+		}
+		ntmpls++;
+	}
+
+	if (ntmpls &&
+	    addattr_l(n, maxlen, XFRMA_TMPL, tmpls,
+		      ntmpls * sizeof(struct xfrm_user_tmpl)) < 0)
+		return -1;
+	return 0;
+}
+
+static int xfrm_policy_bulk(int argc, char **argv)
+{
+	int cmd = XFRM_MSG_NEWPOLICY;
+
+	if (argc > 0 && strcmp(*argv, "update") == 0) {
+		cmd = XFRM_MSG_UPDPOLICY;
+		argc--; argv++;
+	}
+	if (argc != 1) {
+		fprintf(stderr, "Usage: ip xfrm policy bulk [ update ] { FILE | - }\n");
+		exit(-1);
+	}
+	if (xfrm_bulk(*argv, cmd, xfrm_policy_bulk_build) < 0)
+		exit(2);
+	return 0;
+}
+
 static int xfrm_policy_filter_match(struct xfrm_userpolicy_info *xpinfo,
 				    __u8 ptype)
 {
@@ -552,7 +671,6 @@ int xfrm_policy_print(const struct sockaddr_nl *who, struct nlmsghdr *n,
 
 	if (oneline)
 		fprintf(fp, "\n");
-	fflush(fp);
 
 	return 0;
 }
@@ -767,14 +885,31 @@ static int xfrm_policy_keep(const struct sockaddr_nl *who,
 	xb->offset += new_n->nlmsg_len;
 	xb->nlmsg_count ++;
 
+	if (xb->del) {
+		xb->offset = 0;
+		return xfrm_delete_send(xb->del, new_n);
+	}
+
 	return 0;
 }
 
+static struct xfrm_index spd_index;
+
+static void xfrm_policy_key(struct nlmsghdr *n, __u16 *family,
+			    xfrm_address_t *addr)
+{
+	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
+
+	*family = xpinfo->sel.family;
+	memcpy(addr, &xpinfo->sel.daddr, sizeof(*addr));
+}
+
 static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 {
 	char *selp = NULL;
 	struct rtnl_handle rth;
 
+	memset(&filter, 0, sizeof(filter));
 	if (argc > 0)
 		filter.use = 1;
 	filter.xpinfo.sel.family = preferred_family;
@@ -843,52 +978,57 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 
 	if (deleteall) {
 		struct xfrm_buffer xb;
+		struct xfrm_delete xd;
 		char buf[NLMSG_DELETEALL_BUF_SIZE];
-		int i;
 
+		if (xfrm_delete_open(&xd) < 0)
+			exit(1);
 		xb.buf = buf;
 		xb.size = sizeof(buf);
+		xb.offset = 0;
+		xb.nlmsg_count = 0;
 		xb.rth = &rth;
+		xb.del = &xd;
 
-		for (i = 0; ; i++) {
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all round = %d\n", i);
-
-			if (rtnl_wilddump_request(&rth, preferred_family, XFRM_MSG_GETPOLICY) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-
-			if (rtnl_dump_filter(&rth, xfrm_policy_keep, &xb) < 0) {
-				fprintf(stderr, "Delete-all terminated\n");
-				exit(1);
-			}
-			if (xb.nlmsg_count == 0) {
-				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
-				break;
-			}
-
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request");
+		if (rtnl_wilddump_request(&rth, preferred_family, XFRM_MSG_GETPOLICY) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
+		if (rtnl_dump_filter(&rth, xfrm_policy_keep, &xb) < 0) {
+			fprintf(stderr, "Delete-all terminated\n");
+			exit(1);
+		}
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
+		if (xfrm_delete_close(&xd) != 0)
+			exit(1);
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all completed\n");
+
+	} else if (batch_file && !dump_capture) {
+		if (!spd_index.valid) {
+			spd_index.hdrlen = sizeof(struct xfrm_userpolicy_info);
+			spd_index.key = xfrm_policy_key;
+			if (xfrm_index_build(&spd_index, &rth,
+					     XFRM_MSG_GETPOLICY) < 0)
 				exit(1);
-			}
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
 		}
+		xfrm_index_walk(&spd_index, filter.xpinfo.sel.family,
+				&filter.xpinfo.sel.daddr,
+				filter.use ? filter.sel_dst_mask : 0,
+				xfrm_policy_print, stdout);
+		fflush(stdout);
+		rtnl_close(&rth);
+		return 0;
+
 	} else {
 		if (rtnl_wilddump_request(&rth, preferred_family, XFRM_MSG_GETPOLICY) < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
 
-		if (rtnl_dump_filter(&rth, xfrm_policy_print, stdout) < 0) {
+		if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file :
+				     xfrm_policy_print, stdout) < 0) {
 			fprintf(stderr, "Dump terminated\n");
 			exit(1);
 		}
@@ -1043,12 +1183,20 @@ int do_xfrm_policy(int argc, char **argv)
 	if (argc < 1)
 		return xfrm_policy_list_or_deleteall(0, NULL, 0);
 
+	/* Anything but a query may change the SPD */
+	if (matches(*argv, "list") != 0 && matches(*argv, "show") != 0 &&
+	    matches(*argv, "lst") != 0 && matches(*argv, "get") != 0 &&
+	    matches(*argv, "count") != 0)
+		xfrm_index_free(&spd_index);
+
 	if (matches(*argv, "add") == 0)
 		return xfrm_policy_modify(XFRM_MSG_NEWPOLICY, 0,
 					  argc-1, argv+1);
 	if (matches(*argv, "update") == 0)
 		return xfrm_policy_modify(XFRM_MSG_UPDPOLICY, 0,
 					  argc-1, argv+1);
+	if (matches(*argv, "bulk") == 0)
+		return xfrm_policy_bulk(argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
 		return xfrm_policy_delete(argc-1, argv+1);
 	if (matches(*argv, "deleteall") == 0 || matches(*argv, "delall") == 0)
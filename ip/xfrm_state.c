@@ -65,6 +65,7 @@ static void usage(void)
 	fprintf(stderr, "        [ replay-window SIZE ] [ replay-seq SEQ ] [ replay-oseq SEQ ]\n");
 	fprintf(stderr, "        [ flag FLAG-LIST ] [ sel SELECTOR ] [ LIMIT-LIST ] [ encap ENCAP ]\n");
 	fprintf(stderr, "        [ coa ADDR[/PLEN] ] [ ctx CTX ]\n");
+	fprintf(stderr, "Usage: ip xfrm state bulk [ update ] { FILE | - }\n");
 	fprintf(stderr, "Usage: ip xfrm state allocspi ID [ mode MODE ] [ mark MARK [ mask MASK ] ]\n");
 	fprintf(stderr, "        [ reqid REQID ] [ seq SEQ ] [ min SPI max SPI ]\n");
 	fprintf(stderr, "Usage: ip xfrm state { delete | get } ID [ mark MARK [ mask MASK ] ]\n");
@@ -118,7 +119,6 @@ static int xfrm_algo_parse(struct xfrm_algo *alg, enum xfrm_attr_type_t type,
 			   char *name, char *key, char *buf, int max)
 {
 	int len;
-	int slen = strlen(key);
 
 #if 0
 	/* XXX: verifying both name and key is required! */
@@ -127,45 +127,9 @@ static int xfrm_algo_parse(struct xfrm_algo *alg, enum xfrm_attr_type_t type,
 
 	strncpy(alg->alg_name, name, sizeof(alg->alg_name));
 
-	if (slen > 2 && strncmp(key, "0x", 2) == 0) {
-		/* split two chars "0x" from the top */
-		char *p = key + 2;
-		int plen = slen - 2;
-		int i;
-		int j;
-
-		/* Converting hexadecimal numbered string into real key;
-		 * Convert each two chars into one char(value). If number
-		 * of the length is odd, add zero on the top for rounding.
-		 */
-
-		/* calculate length of the converted values(real key) */
-		len = (plen + 1) / 2;
-		if (len > max)
-			invarg("\"ALGO-KEY\" makes buffer overflow\n", key);
-
-		for (i = - (plen % 2), j = 0; j < len; i += 2, j++) {
-			char vbuf[3];
-			__u8 val;
-
-			vbuf[0] = i >= 0 ? p[i] : '0';
-			vbuf[1] = p[i + 1];
-			vbuf[2] = '\0';
-
-			if (get_u8(&val, vbuf, 16))
-				invarg("\"ALGO-KEY\" is invalid", key);
-
-			buf[j] = val;
-		}
-	} else {
-		len = slen;
-		if (len > 0) {
-			if (len > max)
-				invarg("\"ALGO-KEY\" makes buffer overflow\n", key);
-
-			strncpy(buf, key, len);
-		}
-	}
+	len = xfrm_algo_key_parse(buf, max, key);
+	if (len < 0)
+		invarg("\"ALGO-KEY\" is invalid or too long", key);
 
 	alg->alg_key_len = len * 8;
 
@@ -556,6 +520,122 @@ static int xfrm_state_modify(int cmd, unsigned flags, int argc, char **argv)
 	return 0;
 }
 
+/*
+ * A "bulk" record is SRC DST XFRM-PROTO SPI REQID MODE [ ALGO-LIST ],
+ * with ALGO-LIST written as for "add".
+ */
+static int xfrm_state_bulk_build(struct nlmsghdr *n, int maxlen,
+				 int argc, char **argv)
+{
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+	char *protop = argv[2];
+	int ret, algos = 0;
+	__u32 spi;
+
+	if (argc < 6)
+		return xfrm_bulk_invarg("too few fields after", argv[argc - 1]);
+
+	n->nlmsg_len = NLMSG_LENGTH(sizeof(*xsinfo));
+	xsinfo->family = preferred_family;
+	xsinfo->lft.soft_byte_limit = XFRM_INF;
+	xsinfo->lft.hard_byte_limit = XFRM_INF;
+	xsinfo->lft.soft_packet_limit = XFRM_INF;
+	xsinfo->lft.hard_packet_limit = XFRM_INF;
+
+	if (xfrm_bulk_addr(&xsinfo->saddr, NULL, &xsinfo->family, argv[0]) < 0 ||
+	    xfrm_bulk_addr(&xsinfo->id.daddr, NULL, &xsinfo->family, argv[1]) < 0)
+		return -1;
+	if (xsinfo->family == AF_UNSPEC)
+		xsinfo->family = AF_INET;
+
+	ret = xfrm_xfrmproto_getbyname(argv[2]);
+	if (ret < 0 || !xfrm_xfrmproto_is_ipsec(ret))
+		return xfrm_bulk_invarg("invalid XFRM-PROTO", argv[2]);
+	xsinfo->id.proto = ret;
+	if (get_u32(&spi, argv[3], 0))
+		return xfrm_bulk_invarg("invalid SPI", argv[3]);
+	xsinfo->id.spi = htonl(spi);
+	if (get_u32(&xsinfo->reqid, argv[4], 0))
+		return xfrm_bulk_invarg("invalid REQID", argv[4]);
+	ret = xfrm_mode_getbyname(argv[5]);
+	if (ret < 0 || ret == XFRM_MODE_ROUTEOPTIMIZATION ||
+	    ret == XFRM_MODE_IN_TRIGGER)
+		return xfrm_bulk_invarg("invalid MODE", argv[5]);
+	xsinfo->mode = ret;
+
+	for (argc -= 6, argv += 6; argc > 0; argc -= ret, argv += ret) {
+		struct {
+			union {
+				struct xfrm_algo alg;
+				struct xfrm_algo_aead aead;
+				struct xfrm_algo_auth auth;
+			} u;
+			char buf[XFRM_ALGO_KEY_BUF_SIZE];
+		} alg = {};
+		int type = xfrm_algotype_getbyname(*argv);
+		char *buf = alg.u.alg.alg_key;
+		int len = sizeof(alg.u.alg);
+		int klen;
+
+		if (type < 0)
+			return xfrm_bulk_invarg("invalid ALGO-TYPE", *argv);
+		ret = type == XFRMA_ALG_AEAD || type == XFRMA_ALG_AUTH_TRUNC ? 4 : 3;
+		if (argc < ret)
+			return xfrm_bulk_invarg("too few fields after", *argv);
+		if (algos & (1 << type))
+			return xfrm_bulk_invarg("duplicate", *argv);
+		algos |= 1 << type;
+
+		strncpy(alg.u.alg.alg_name, argv[1],
+			sizeof(alg.u.alg.alg_name) - 1);
+		switch (type) {
+		case XFRMA_ALG_AEAD:
+			if (get_u32(&alg.u.aead.alg_icv_len, argv[3], 0))
+				return xfrm_bulk_invarg("invalid ALGO-ICV-LEN",
+							argv[3]);
+			buf = alg.u.aead.alg_key;
+			len = sizeof(alg.u.aead);
+			break;
+		case XFRMA_ALG_AUTH_TRUNC:
+			if (get_u32(&alg.u.auth.alg_trunc_len, argv[3], 0))
+				return xfrm_bulk_invarg("invalid ALGO-TRUNC-LEN",
+							argv[3]);
+			buf = alg.u.auth.alg_key;
+			len = sizeof(alg.u.auth);
+			break;
+		}
+
+		klen = xfrm_algo_key_parse(buf, sizeof(alg.buf), argv[2]);
+		if (klen < 0)
+			return xfrm_bulk_invarg("invalid ALGO-KEY", argv[2]);
+		alg.u.alg.alg_key_len = klen * 8;
+
+		if (addattr_l(n, maxlen, type, &alg, len + klen) < 0)
+			return -1;
+	}
+
+	if (!algos)
+		return xfrm_bulk_invarg("ALGO is required with proto", protop);
+	return 0;
+}
+
+static int xfrm_state_bulk(int argc, char **argv)
+{
+	int cmd = XFRM_MSG_NEWSA;
+
+	if (argc > 0 && strcmp(*argv, "update") == 0) {
+		cmd = XFRM_MSG_UPDSA;
+		argc--; argv++;
+	}
+	if (argc != 1) {
+		fprintf(stderr, "Usage: ip xfrm state bulk [ update ] { FILE | - }\n");
+		exit(-1);
+	}
+	if (xfrm_bulk(*argv, cmd, xfrm_state_bulk_build) < 0)
+		exit(2);
+	return 0;
+}
+
 static int xfrm_state_allocspi(int argc, char **argv)
 {
 	struct rtnl_handle rth;
@@ -808,7 +888,6 @@ int xfrm_state_print(const struct sockaddr_nl *who, struct nlmsghdr *n,
 
 	if (oneline)
 		fprintf(fp, "\n");
-	fflush(fp);
 
 	return 0;
 }
@@ -950,14 +1029,68 @@ static int xfrm_state_keep(const struct sockaddr_nl *who,
 	xb->offset += new_n->nlmsg_len;
 	xb->nlmsg_count ++;
 
+	if (xb->del) {
+		xb->offset = 0;
+		return xfrm_delete_send(xb->del, new_n);
+	}
+
 	return 0;
 }
 
+/*
+ * Newer kernels leave out the SAs of other protocols and addresses when
+ * asked, older ones ignore the attributes; xfrm_state_filter_match()
+ * still checks every SA either way.
+ */
+static int xfrm_state_dump_request(struct rtnl_handle *rth)
+{
+	struct {
+		struct nlmsghdr n;
+		char buf[256];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_HDRLEN;
+	req.n.nlmsg_type = XFRM_MSG_GETSA;
+	req.n.nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
+	req.n.nlmsg_seq = rth->dump = ++rth->seq;
+
+	if (filter.use && filter.id_proto_mask)
+		addattr8(&req.n, sizeof(req), XFRMA_PROTO,
+			 filter.xsinfo.id.proto);
+	if (filter.use && (filter.id_src_mask || filter.id_dst_mask)) {
+		struct xfrm_address_filter af;
+
+		memset(&af, 0, sizeof(af));
+		af.saddr = filter.xsinfo.saddr;
+		af.daddr = filter.xsinfo.id.daddr;
+		af.family = filter.xsinfo.family;
+		af.splen = filter.id_src_mask;
+		af.dplen = filter.id_dst_mask;
+		addattr_l(&req.n, sizeof(req), XFRMA_ADDRESS_FILTER,
+			  &af, sizeof(af));
+	}
+
+	return rtnl_send(rth, (char *)&req, req.n.nlmsg_len);
+}
+
+static struct xfrm_index sad_index;
+
+static void xfrm_state_key(struct nlmsghdr *n, __u16 *family,
+			   xfrm_address_t *addr)
+{
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+
+	*family = xsinfo->family;
+	memcpy(addr, &xsinfo->id.daddr, sizeof(*addr));
+}
+
 static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 {
 	char *idp = NULL;
 	struct rtnl_handle rth;
 
+	memset(&filter, 0, sizeof(filter));
 	if(argc > 0)
 		filter.use = 1;
 	filter.xsinfo.family = preferred_family;
@@ -1000,53 +1133,57 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 
 	if (deleteall) {
 		struct xfrm_buffer xb;
+		struct xfrm_delete xd;
 		char buf[NLMSG_DELETEALL_BUF_SIZE];
-		int i;
 
+		if (xfrm_delete_open(&xd) < 0)
+			exit(1);
 		xb.buf = buf;
 		xb.size = sizeof(buf);
+		xb.offset = 0;
+		xb.nlmsg_count = 0;
 		xb.rth = &rth;
+		xb.del = &xd;
 
-		for (i = 0; ; i++) {
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all round = %d\n", i);
-
-			if (rtnl_wilddump_request(&rth, preferred_family, XFRM_MSG_GETSA) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-
-			if (rtnl_dump_filter(&rth, xfrm_state_keep, &xb) < 0) {
-				fprintf(stderr, "Delete-all terminated\n");
-				exit(1);
-			}
-			if (xb.nlmsg_count == 0) {
-				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
-				break;
-			}
-
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request\n");
+		if (xfrm_state_dump_request(&rth) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
+		if (rtnl_dump_filter(&rth, xfrm_state_keep, &xb) < 0) {
+			fprintf(stderr, "Delete-all terminated\n");
+			exit(1);
+		}
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
+		if (xfrm_delete_close(&xd) != 0)
+			exit(1);
+		if (show_stats > 1)
+			fprintf(stderr, "Delete-all completed\n");
+
+	} else if (batch_file && !dump_capture) {
+		if (!sad_index.valid) {
+			sad_index.hdrlen = sizeof(struct xfrm_usersa_info);
+			sad_index.key = xfrm_state_key;
+			if (xfrm_index_build(&sad_index, &rth,
+					     XFRM_MSG_GETSA) < 0)
 				exit(1);
-			}
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
 		}
+		xfrm_index_walk(&sad_index, filter.xsinfo.family,
+				&filter.xsinfo.id.daddr,
+				filter.use ? filter.id_dst_mask : 0,
+				xfrm_state_print, stdout);
+		fflush(stdout);
+		rtnl_close(&rth);
+		return 0;
 
 	} else {
-		if (rtnl_wilddump_request(&rth, preferred_family, XFRM_MSG_GETSA) < 0) {
+		if (xfrm_state_dump_request(&rth) < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
 
-		if (rtnl_dump_filter(&rth, xfrm_state_print, stdout) < 0) {
+		if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file :
+				     xfrm_state_print, stdout) < 0) {
 			fprintf(stderr, "Dump terminated\n");
 			exit(1);
 		}
@@ -1191,12 +1328,20 @@ int do_xfrm_state(int argc, char **argv)
 	if (argc < 1)
 		return xfrm_state_list_or_deleteall(0, NULL, 0);
 
+	/* Anything but a query may change the SAD */
+	if (matches(*argv, "list") != 0 && matches(*argv, "show") != 0 &&
+	    matches(*argv, "lst") != 0 && matches(*argv, "get") != 0 &&
+	    matches(*argv, "count") != 0)
+		xfrm_index_free(&sad_index);
+
 	if (matches(*argv, "add") == 0)
 		return xfrm_state_modify(XFRM_MSG_NEWSA, 0,
 					 argc-1, argv+1);
 	if (matches(*argv, "update") == 0)
 		return xfrm_state_modify(XFRM_MSG_UPDSA, 0,
 					 argc-1, argv+1);
+	if (matches(*argv, "bulk") == 0)
+		return xfrm_state_bulk(argc-1, argv+1);
 	if (matches(*argv, "allocspi") == 0)
 		return xfrm_state_allocspi(argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
@@ -0,0 +1,88 @@
+/*
+ * arena.c		Bump allocator for captured netlink messages.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Dumps that are collected before they are printed (ip addr, ...) used
+ * to malloc() every message.  An arena hands out consecutive pieces of
+ * large chunks instead, so the messages sit next to each other when
+ * they are walked again, and everything is released with one call.
+ * Pieces are never freed one by one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define ARENA_ALIGN(len)	(((len) + 7) & ~7UL)
+
+struct arena_chunk
+{
+	struct arena_chunk	*next;
+	size_t			size;
+	char			data[0];
+};
+
+void arena_init(struct arena *a, size_t chunk_size)
+{
+	memset(a, 0, sizeof(*a));
+	a->chunk_size = chunk_size ? : ARENA_CHUNK_SIZE;
+}
+
+void *arena_alloc(struct arena *a, size_t len)
+{
+	struct arena_chunk *c;
+	size_t size;
+	void *p;
+
+	len = ARENA_ALIGN(len);
+	if (len <= a->left) {
+		p = a->cur;
+		a->cur += len;
+		a->left -= len;
+		return p;
+	}
+
+	/* Oversized requests get a chunk of their own, so that the
+	 * remainder of the current chunk is not thrown away.
+	 */
+	size = len > a->chunk_size / 4 ? len : a->chunk_size;
+	c = malloc(sizeof(*c) + size);
+	if (c == NULL)
+		return NULL;
+	c->size = size;
+	a->size += sizeof(*c) + size;
+
+	if (size != a->chunk_size && a->chunks) {
+		c->next = a->chunks->next;
+		a->chunks->next = c;
+		return c->data;
+	}
+
+	c->next = a->chunks;
+	a->chunks = c;
+	a->cur = c->data + len;
+	a->left = size - len;
+	return c->data;
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->chunks = NULL;
+	a->cur = NULL;
+	a->left = 0;
+	a->size = 0;
+}
@@ -0,0 +1,609 @@
+/*
+ * batchjobs.c		Run the lines of a batch file in worker processes.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * With -batch-jobs the process reading a batch forks the workers and
+ * hands each line to one of them, chosen by the line's ordering key
+ * (the device or table it names), so lines with the same key run in
+ * file order on the same worker.  Lines are sent down one pipe per
+ * worker, with their line number, as NUL separated arguments.  Workers
+ * report failures, and answer syncs, on a pipe shared by all of them.
+ * A line without a key waits for a sync of every worker before the
+ * reader runs it itself.  Workers are processes rather than threads
+ * since commands keep their state in globals.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+#define BATCH_JOB_BUFSIZE	(64 * 1024)
+
+enum {
+	BATCH_MSG_LINE,
+	BATCH_MSG_SYNC,
+};
+
+enum {
+	BATCH_REPORT_FAILED,
+	BATCH_REPORT_SYNCED,
+};
+
+struct batch_msg {
+	int	type;
+	int	lineno;
+	int	argc;
+	int	len;
+};
+
+struct batch_report {
+	int	type;
+	int	job;
+	int	lineno;
+};
+
+struct batch_job {
+	int	fd;
+	pid_t	pid;
+	int	unsynced;
+	size_t	len;
+	char	buf[BATCH_JOB_BUFSIZE];
+};
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t cc = read(fd, p, len);
+
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc <= 0)
+			return -1;
+		p += cc;
+		len -= cc;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t cc = write(fd, p, len);
+
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc <= 0)
+			return -1;
+		p += cc;
+		len -= cc;
+	}
+	return 0;
+}
+
+static int batch_job_index = -1;
+
+static void batch_report(int fd, int type)
+{
+	struct batch_report r = {
+		.type = type, .job = batch_job_index, .lineno = cmdlineno,
+	};
+
+	if (write_full(fd, &r, sizeof(r)) < 0)
+		exit(1);
+}
+
+static void batch_worker(int in, int out, const struct batch_job_ops *ops,
+			 int stop_on_error)
+{
+	struct batch_msg m;
+	char *buf = NULL, **argv = NULL;
+	int bufsize = 0, maxargs = 0;
+	int ret = 0;
+
+	if (ops->start && ops->start() < 0)
+		exit(1);
+
+	while (read_full(in, &m, sizeof(m)) == 0) {
+		char *p;
+		int i;
+
+		if (m.len + 1 > bufsize) {
+			bufsize = m.len + 1;
+			buf = realloc(buf, bufsize);
+		}
+		if (m.argc + 1 > maxargs) {
+			maxargs = m.argc + 1;
+			argv = realloc(argv, maxargs * sizeof(char *));
+		}
+		if (!buf || !argv) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		if (read_full(in, buf, m.len) < 0)
+			break;
+
+		cmdlineno = m.lineno;
+		if (m.type == BATCH_MSG_SYNC) {
+			if (ops->sync && ops->sync() < 0) {
+				ret = 1;
+				batch_report(out, BATCH_REPORT_FAILED);
+			}
+			batch_report(out, BATCH_REPORT_SYNCED);
+			continue;
+		}
+
+		for (i = 0, p = buf; i < m.argc; i++, p += strlen(p) + 1)
+			argv[i] = p;
+		argv[i] = NULL;
+
+		if (ops->run(m.argc, argv)) {
+			ret = 1;
+			batch_report(out, BATCH_REPORT_FAILED);
+			if (stop_on_error)
+				break;
+		}
+		fflush(stdout);
+	}
+
+	if (ops->finish && ops->finish() < 0)
+		ret = 1;
+	exit(ret);
+}
+
+int batch_jobs_start(struct batch_jobs *bj, int njobs,
+		     const struct batch_job_ops *ops, int stop_on_error)
+{
+	int status[2];
+	int i, j;
+
+	memset(bj, 0, sizeof(*bj));
+	bj->stop_on_error = stop_on_error;
+	bj->jobs = calloc(njobs, sizeof(*bj->jobs));
+	if (!bj->jobs || pipe(status) < 0)
+		return -1;
+	bj->status = status[0];
+
+	/* A worker dying is reported by its pipe, not by killing us */
+	signal(SIGPIPE, SIG_IGN);
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 0; i < njobs; i++) {
+		struct batch_job *job = &bj->jobs[i];
+		int fds[2];
+
+		if (pipe(fds) < 0)
+			return -1;
+		job->pid = fork();
+		if (job->pid < 0)
+			return -1;
+		if (job->pid == 0) {
+			for (j = 0; j < i; j++)
+				close(bj->jobs[j].fd);
+			close(fds[1]);
+			close(status[0]);
+			batch_job_index = i;
+			batch_worker(fds[0], status[1], ops, stop_on_error);
+		}
+		close(fds[0]);
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+		job->fd = fds[1];
+		bj->njobs++;
+	}
+	close(status[1]);
+	fcntl(bj->status, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+static void batch_job_lost(struct batch_jobs *bj, struct batch_job *job)
+{
+	close(job->fd);
+	job->fd = -1;
+	job->len = 0;
+	if (job->unsynced) {
+		job->unsynced = 0;
+		bj->unsynced--;
+	}
+	bj->failed++;
+}
+
+/* Take in what the workers reported; reports of a worker are in the
+ * order of its lines, so a sync answer covers everything before it.
+ */
+static void batch_jobs_reports(struct batch_jobs *bj)
+{
+	struct batch_report r[64];
+	ssize_t cc;
+	int i;
+
+	while ((cc = read(bj->status, r, sizeof(r))) > 0) {
+		for (i = 0; i < cc / (int)sizeof(r[0]); i++) {
+			struct batch_job *job = &bj->jobs[r[i].job];
+
+			if (r[i].type == BATCH_REPORT_FAILED) {
+				bj->failed++;
+			} else if (job->unsynced) {
+				job->unsynced--;
+				bj->unsynced--;
+			}
+		}
+	}
+}
+
+/* Write out what is buffered for job, taking reports while the pipe
+ * is full so that a worker blocked on reporting does not block us.
+ */
+static void batch_job_flush(struct batch_jobs *bj, struct batch_job *job)
+{
+	size_t done = 0;
+
+	while (job->fd >= 0 && done < job->len) {
+		struct pollfd pfd[2] = {
+			{ .fd = job->fd, .events = POLLOUT },
+			{ .fd = bj->status, .events = POLLIN },
+		};
+		ssize_t cc = write(job->fd, job->buf + done, job->len - done);
+
+		if (cc > 0) {
+			done += cc;
+			continue;
+		}
+		if (cc < 0 && errno != EAGAIN && errno != EINTR) {
+			batch_job_lost(bj, job);
+			break;
+		}
+		if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+			break;
+		if (pfd[1].revents)
+			batch_jobs_reports(bj);
+	}
+	job->len = 0;
+}
+
+static void batch_job_put(struct batch_jobs *bj, struct batch_job *job,
+			  int type, int argc, char **argv)
+{
+	struct batch_msg m = { .type = type, .lineno = cmdlineno, .argc = argc };
+	size_t len = 0;
+	int i;
+
+	if (job->fd < 0)
+		return;
+
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	m.len = len;
+
+	if (job->len + sizeof(m) + len > sizeof(job->buf))
+		batch_job_flush(bj, job);
+	if (sizeof(m) + len > sizeof(job->buf)) {
+		/* Too long to buffer, so write it out directly */
+		fcntl(job->fd, F_SETFL, 0);
+		if (write_full(job->fd, &m, sizeof(m)) < 0)
+			batch_job_lost(bj, job);
+		for (i = 0; job->fd >= 0 && i < argc; i++)
+			if (write_full(job->fd, argv[i], strlen(argv[i]) + 1) < 0)
+				batch_job_lost(bj, job);
+		if (job->fd >= 0)
+			fcntl(job->fd, F_SETFL, O_NONBLOCK);
+		return;
+	}
+
+	memcpy(job->buf + job->len, &m, sizeof(m));
+	job->len += sizeof(m);
+	for (i = 0; i < argc; i++) {
+		size_t l = strlen(argv[i]) + 1;
+
+		memcpy(job->buf + job->len, argv[i], l);
+		job->len += l;
+	}
+}
+
+/* Queue a line for the worker owning key, or for every worker without
+ * one.  Returns -1 once a failure should end the batch.
+ */
+int batch_jobs_send(struct batch_jobs *bj, const char *key,
+		    int argc, char **argv)
+{
+	int i;
+
+	if (key) {
+		unsigned int h = 2166136261u;
+
+		while (*key)
+			h = (h ^ (unsigned char)*key++) * 16777619;
+		batch_job_put(bj, &bj->jobs[h % bj->njobs], BATCH_MSG_LINE,
+			      argc, argv);
+	} else {
+		for (i = 0; i < bj->njobs; i++)
+			batch_job_put(bj, &bj->jobs[i], BATCH_MSG_LINE,
+				      argc, argv);
+	}
+	bj->dirty = 1;
+
+	if ((++bj->count & 63) == 0)
+		batch_jobs_reports(bj);
+	return bj->failed && bj->stop_on_error ? -1 : 0;
+}
+
+/* Wait until the workers have done all the lines sent to them */
+int batch_jobs_sync(struct batch_jobs *bj)
+{
+	int i;
+
+	if (!bj->dirty)
+		goto out;
+
+	for (i = 0; i < bj->njobs; i++) {
+		struct batch_job *job = &bj->jobs[i];
+
+		if (job->fd < 0)
+			continue;
+		batch_job_put(bj, job, BATCH_MSG_SYNC, 0, NULL);
+		batch_job_flush(bj, job);
+		if (job->fd >= 0) {
+			job->unsynced++;
+			bj->unsynced++;
+		}
+	}
+
+	while (bj->unsynced > 0) {
+		struct pollfd pfd[bj->njobs + 1];
+
+		for (i = 0; i < bj->njobs; i++) {
+			pfd[i].fd = bj->jobs[i].unsynced ? bj->jobs[i].fd : -1;
+			pfd[i].events = 0;
+		}
+		pfd[i].fd = bj->status;
+		pfd[i].events = POLLIN;
+
+		if (poll(pfd, bj->njobs + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (pfd[bj->njobs].revents)
+			batch_jobs_reports(bj);
+		/* A worker that exited will not answer */
+		for (i = 0; i < bj->njobs; i++)
+			if (pfd[i].fd >= 0 && (pfd[i].revents & POLLERR) &&
+			    bj->jobs[i].unsynced)
+				batch_job_lost(bj, &bj->jobs[i]);
+	}
+	bj->dirty = 0;
+out:
+	return bj->failed && bj->stop_on_error ? -1 : 0;
+}
+
+/* Let the workers finish; returns the number of failures */
+int batch_jobs_finish(struct batch_jobs *bj)
+{
+	int i, status;
+
+	for (i = 0; i < bj->njobs; i++) {
+		struct batch_job *job = &bj->jobs[i];
+
+		if (job->fd < 0)
+			continue;
+		batch_job_flush(bj, job);
+		if (job->fd >= 0)
+			close(job->fd);
+	}
+
+	fcntl(bj->status, F_SETFL, 0);
+	batch_jobs_reports(bj);
+	close(bj->status);
+
+	for (i = 0; i < bj->njobs; i++) {
+		if (waitpid(bj->jobs[i].pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status)) {
+			if (!bj->failed)
+				bj->failed++;
+		}
+	}
+	free(bj->jobs);
+	bj->jobs = NULL;
+	bj->njobs = 0;
+	return bj->failed;
+}
+
+/*
+ * Latencies of batch lines go into a histogram of 8 buckets per power
+ * of two of nanoseconds, so any value is known to within 12.5%, as
+ * HdrHistogram does with 3 significant bits.  The slowest lines are
+ * kept, slowest first, in an array of batch_latency entries.
+ */
+#define LAT_SUB_BITS	3
+#define LAT_SUB		(1 << LAT_SUB_BITS)
+#define LAT_BUCKETS	((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct lat_line {
+	__u64	ns;
+	int	lineno;
+};
+
+unsigned int batch_latency;
+
+static __u64 lat_hist[LAT_BUCKETS];
+static __u64 lat_count, lat_total, lat_min, lat_max;
+static struct lat_line *lat_top;
+static unsigned int lat_ntop;
+static __u64 lat_start;
+
+static __u64 lat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int lat_bucket(__u64 ns)
+{
+	int e;
+
+	if (ns < LAT_SUB)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	return (e - LAT_SUB_BITS + 1) * LAT_SUB +
+	       ((ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Smallest value of bucket i */
+static __u64 lat_bucket_low(int i)
+{
+	int e = i / LAT_SUB + LAT_SUB_BITS - 1;
+
+	if (i < LAT_SUB)
+		return i;
+	return (__u64)(LAT_SUB + i % LAT_SUB) << (e - LAT_SUB_BITS);
+}
+
+void batch_latency_begin(void)
+{
+	if (batch_latency)
+		lat_start = lat_now();
+}
+
+void batch_latency_end(void)
+{
+	__u64 ns;
+	unsigned int i;
+
+	if (!batch_latency)
+		return;
+	ns = lat_now() - lat_start;
+
+	lat_hist[lat_bucket(ns)]++;
+	if (lat_count == 0 || ns < lat_min)
+		lat_min = ns;
+	if (ns > lat_max)
+		lat_max = ns;
+	lat_count++;
+	lat_total += ns;
+
+	if (lat_ntop == batch_latency && ns <= lat_top[lat_ntop - 1].ns)
+		return;
+	if (lat_top == NULL) {
+		lat_top = calloc(batch_latency, sizeof(*lat_top));
+		if (lat_top == NULL)
+			return;
+	}
+	if (lat_ntop < batch_latency)
+		lat_ntop++;
+	for (i = lat_ntop - 1; i > 0 && lat_top[i - 1].ns < ns; i--)
+		lat_top[i] = lat_top[i - 1];
+	lat_top[i].ns = ns;
+	lat_top[i].lineno = cmdlineno;
+}
+
+static void lat_print(FILE *fp, const char *name, __u64 ns)
+{
+	if (name)
+		fprintf(fp, " %s ", name);
+	if (ns >= 1000000000)
+		fprintf(fp, "%.2fs", ns / 1e9);
+	else if (ns >= 1000000)
+		fprintf(fp, "%.2fms", ns / 1e6);
+	else if (ns >= 1000)
+		fprintf(fp, "%.1fus", ns / 1e3);
+	else
+		fprintf(fp, "%lluns", (unsigned long long)ns);
+}
+
+/* Upper end of the bucket holding the given fraction of the lines */
+static __u64 lat_percentile(double frac)
+{
+	__u64 want = frac * lat_count, seen = 0;
+	int i;
+
+	if (want < frac * lat_count || want == 0)
+		want++;
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += lat_hist[i];
+		if (seen >= want)
+			break;
+	}
+	if (i + 1 >= LAT_BUCKETS || lat_bucket_low(i + 1) > lat_max)
+		return lat_max;
+	return lat_bucket_low(i + 1) - 1;
+}
+
+/* Print the latencies of the lines run by this process on stderr */
+void batch_latency_report(void)
+{
+	static const struct {
+		const char	*name;
+		double		frac;
+	} pct[] = {
+		{ "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 },
+		{ "p99.9", 0.999 },
+	};
+	FILE *fp = stderr;
+	__u64 octave[64] = { 0 };
+	__u64 most = 0;
+	unsigned int i;
+	int b;
+
+	if (!batch_latency || lat_count == 0)
+		return;
+
+	if (batch_job_index >= 0)
+		fprintf(fp, "worker %d: ", batch_job_index);
+	fprintf(fp, "%llu lines,", (unsigned long long)lat_count);
+	lat_print(fp, "total", lat_total);
+	lat_print(fp, "min", lat_min);
+	for (i = 0; i < ARRAY_SIZE(pct); i++)
+		lat_print(fp, pct[i].name, lat_percentile(pct[i].frac));
+	lat_print(fp, "max", lat_max);
+	fprintf(fp, "\n");
+
+	/* The histogram is shown by power of two, to keep it short */
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		__u64 low = lat_bucket_low(b);
+		int e = low ? 63 - __builtin_clzll(low) : 0;
+
+		octave[e] += lat_hist[b];
+		if (octave[e] > most)
+			most = octave[e];
+	}
+	for (b = 0; b < 64; b++) {
+		if (!octave[b])
+			continue;
+		fprintf(fp, "  >=");
+		lat_print(fp, NULL, 1ULL << b);
+		fprintf(fp, "\t%10llu %5.1f%% ", (unsigned long long)octave[b],
+			100.0 * octave[b] / lat_count);
+		for (i = 0; i < 40 * octave[b] / most; i++)
+			fputc('#', fp);
+		fputc('\n', fp);
+	}
+
+	fprintf(fp, "  slowest lines:");
+	for (i = 0; i < lat_ntop; i++) {
+		fprintf(fp, "%s %d (", i ? "," : "", lat_top[i].lineno);
+		lat_print(fp, NULL, lat_top[i].ns);
+		fputc(')', fp);
+	}
+	fprintf(fp, "\n");
+}
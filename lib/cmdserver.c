@@ -0,0 +1,397 @@
+/*
+ * cmdserver.c		Serve batch commands over a UNIX socket.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * "ip -server PATH" and "tc -server PATH" listen on PATH and run every
+ * line a client writes as a batch line would be run.  Each line runs in
+ * a fork of the server, so a command that exits or leaves its globals
+ * behind does not take the server with it, while the link cache, the
+ * name tables and the loaded plugins are inherited warm.  The link
+ * cache is kept current from RTNLGRP_LINK events, drained before each
+ * fork.  The reply to a line is a header "STATUS LENGTH\n", STATUS
+ * being the exit status the command would have had, followed by
+ * LENGTH bytes of its standard output and standard error.  Lines are
+ * run one at a time, in the order they arrive.
+ *
+ * Since the lines run with the privileges of the server, the socket is
+ * made accessible to its owner only and connections of other users
+ * (but root) are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "libnetlink.h"
+#include "ll_map.h"
+#include "rt_names.h"
+
+#define CMD_SERVER_MAXCLIENTS	64
+#define CMD_SERVER_MAXLINE	(64 * 1024)
+#define CMD_SERVER_MAXARGS	1024
+
+struct cmd_client {
+	int	fd;
+	size_t	len;
+	char	buf[CMD_SERVER_MAXLINE];
+};
+
+static struct cmd_client *clients[CMD_SERVER_MAXCLIENTS];
+static int nclients;
+static int listen_fd = -1;
+static struct rtnl_handle ev = { .fd = -1 };
+
+static int cmd_server_listen(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path \"%s\" is too long\n", path);
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("Cannot create socket");
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		if (errno != EADDRINUSE) {
+			perror("Cannot bind socket");
+			close(fd);
+			return -1;
+		}
+		/* Take over the socket of a server that is gone */
+		if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+			fprintf(stderr, "\"%s\" is already being served\n", path);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		unlink(path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 ||
+		    bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+			perror("Cannot bind socket");
+			return -1;
+		}
+	}
+
+	if (chmod(path, 0600) < 0) {
+		perror("Cannot chmod socket");
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	if (listen(fd, 128) < 0) {
+		perror("Cannot listen");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Whether the peer of fd may run commands as the server */
+static int cmd_server_peer_ok(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+/* Apply the link events queued so far to the cache */
+static void cmd_server_links(struct rtnl_handle *rth)
+{
+	char buf[32768];
+	struct sockaddr_nl nladdr;
+
+	for (;;) {
+		struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+		struct msghdr msg = {
+			.msg_name = &nladdr,
+			.msg_namelen = sizeof(nladdr),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+		struct nlmsghdr *h;
+		ssize_t cc;
+
+		cc = recvmsg(ev.fd, &msg, MSG_DONTWAIT);
+		if (cc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				/* Events were lost; start over */
+				ll_map_flush();
+				ll_init_map_full(rth);
+				continue;
+			}
+			return;
+		}
+		if (cc == 0)
+			return;
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, cc);
+		     h = NLMSG_NEXT(h, cc))
+			ll_remember_index(&nladdr, h, NULL);
+	}
+}
+
+/* Run one line in a fork, with its output collected from a pipe */
+static int cmd_server_run(const struct batch_job_ops *ops, char *line,
+			  char **outp, size_t *lenp)
+{
+	size_t len = 0, size = 0;
+	char *out = NULL;
+	int pfd[2], status, i;
+	pid_t pid;
+
+	if (pipe(pfd) < 0)
+		return -1;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		char *argv[CMD_SERVER_MAXARGS];
+		char *cp;
+		int argc, fd;
+
+		for (i = 0; i < nclients; i++)
+			close(clients[i]->fd);
+		close(listen_fd);
+		close(ev.fd);
+		close(pfd[0]);
+		fd = open("/dev/null", O_RDONLY);
+		if (fd >= 0 && fd != STDIN_FILENO) {
+			dup2(fd, STDIN_FILENO);
+			close(fd);
+		}
+		dup2(pfd[1], STDOUT_FILENO);
+		dup2(pfd[1], STDERR_FILENO);
+		close(pfd[1]);
+
+		cp = strchr(line, '#');
+		if (cp)
+			*cp = '\0';
+		argc = makeargs(line, argv, CMD_SERVER_MAXARGS);
+		if (argc == 0)
+			exit(0);
+		if (ops->start && ops->start() < 0)
+			exit(1);
+		status = ops->run(argc, argv);
+		if (ops->finish && ops->finish() < 0 && status == 0)
+			status = 1;
+		exit(status);
+	}
+
+	close(pfd[1]);
+	for (;;) {
+		ssize_t cc;
+
+		if (len == size) {
+			size = size ? 2 * size : 4096;
+			out = realloc(out, size);
+			if (out == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+		cc = read(pfd[0], out + len, size - len);
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc <= 0)
+			break;
+		len += cc;
+	}
+	close(pfd[0]);
+	*outp = out;
+	*lenp = len;
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	return 128 + WTERMSIG(status);
+}
+
+static int cmd_server_reply(int fd, int status, const char *out, size_t len)
+{
+	char hdr[32];
+	int n;
+
+	n = snprintf(hdr, sizeof(hdr), "%d %zu\n", status, len);
+	if (write(fd, hdr, n) != n)
+		return -1;
+	while (len > 0) {
+		ssize_t cc = write(fd, out, len);
+
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc <= 0)
+			return -1;
+		out += cc;
+		len -= cc;
+	}
+	return 0;
+}
+
+static void cmd_client_close(int i)
+{
+	close(clients[i]->fd);
+	free(clients[i]);
+	clients[i] = clients[--nclients];
+}
+
+/* Run the complete lines a client sent; -1 if it has to go */
+static int cmd_client_input(struct cmd_client *c,
+			    const struct batch_job_ops *ops,
+			    struct rtnl_handle *rth)
+{
+	char *line, *nl;
+	ssize_t cc;
+
+	cc = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+	if (cc < 0 && errno == EINTR)
+		return 0;
+	if (cc <= 0)
+		return -1;
+	c->len += cc;
+
+	line = c->buf;
+	while ((nl = memchr(line, '\n', c->buf + c->len - line)) != NULL) {
+		char *out = NULL;
+		size_t len = 0;
+		int status;
+
+		*nl = '\0';
+		cmd_server_links(rth);
+		status = cmd_server_run(ops, line, &out, &len);
+		if (status < 0) {
+			static const char msg[] = "Cannot run command\n";
+
+			status = 255;
+			free(out);
+			out = strdup(msg);
+			len = out ? strlen(out) : 0;
+		}
+		cc = cmd_server_reply(c->fd, status, out, len);
+		free(out);
+		if (cc < 0)
+			return -1;
+		line = nl + 1;
+	}
+
+	c->len -= line - c->buf;
+	memmove(c->buf, line, c->len);
+	if (c->len == sizeof(c->buf) - 1) {
+		fprintf(stderr, "Line from client is too long\n");
+		return -1;
+	}
+	return 0;
+}
+
+int cmd_server(const char *path, const struct batch_job_ops *ops)
+{
+	struct rtnl_handle rth = { .fd = -1 };
+	int i;
+
+	listen_fd = cmd_server_listen(path);
+	if (listen_fd < 0)
+		return -1;
+
+	if (rtnl_open(&rth, 0) < 0 || rtnl_open(&ev, RTMGRP_LINK) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	ll_init_map_full(&rth);
+	rtnl_names_preload();
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		struct pollfd pfd[CMD_SERVER_MAXCLIENTS + 2];
+
+		pfd[0].fd = listen_fd;
+		pfd[0].events = nclients < CMD_SERVER_MAXCLIENTS ? POLLIN : 0;
+		pfd[1].fd = ev.fd;
+		pfd[1].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			pfd[i + 2].fd = clients[i]->fd;
+			pfd[i + 2].events = POLLIN;
+		}
+
+		if (poll(pfd, nclients + 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (pfd[1].revents)
+			cmd_server_links(&rth);
+
+		/* Backwards, since closing moves the last client down */
+		for (i = nclients - 1; i >= 0; i--) {
+			if (pfd[i + 2].revents &&
+			    cmd_client_input(clients[i], ops, &rth) < 0)
+				cmd_client_close(i);
+		}
+
+		if (pfd[0].revents) {
+			struct cmd_client *c;
+			int fd = accept(listen_fd, NULL, NULL);
+
+			if (fd < 0)
+				continue;
+			if (!cmd_server_peer_ok(fd)) {
+				close(fd);
+				continue;
+			}
+			c = malloc(sizeof(*c));
+			if (c == NULL) {
+				close(fd);
+				continue;
+			}
+			c->fd = fd;
+			c->len = 0;
+			clients[nclients++] = c;
+		}
+	}
+
+	close(listen_fd);
+	unlink(path);
+	return -1;
+}
@@ -0,0 +1,726 @@
+/*
+ * cmdtmpl.c		Loops and variables in batch files.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * A batch file that has a line starting with '%' is read as a template
+ * from there on:
+ *
+ *	%let NAME = EXPR
+ *	%for NAME in EXPR .. EXPR [ step EXPR ]
+ *	...
+ *	%done
+ *
+ * and ${EXPR} in a command, or in a directive, is replaced by the
+ * value of the expression, where names of variables stand alone.
+ * Values are integers or IPv4/IPv6 addresses; an address plus or minus
+ * an integer is an address, carried across octets, and the difference
+ * of two addresses is an integer.  Integers have + - * / % and
+ * parentheses.  The body of a loop is kept as text and its lines are
+ * expanded one at a time as commands are asked for, so only the body
+ * is held in memory however many times it runs.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "utils.h"
+
+#define TMPL_MAXDEPTH	16
+
+struct tval
+{
+	int		family;		/* AF_UNSPEC for an integer */
+	long long	n;
+	__u32		a[4];		/* host order, most significant first */
+};
+
+struct tvar
+{
+	char		*name;
+	struct tval	val;
+};
+
+/* Lines of the outermost loop, that inner loops share */
+struct tbody
+{
+	char		**lines;
+	int		*linenos;
+	int		count;
+	int		size;
+};
+
+struct tframe
+{
+	struct tbody	*body;
+	int		owner;		/* the outermost loop frees body */
+	int		first, last;	/* lines of the loop in body */
+	int		pc;
+	int		var;
+	struct tval	cur;
+	struct tval	stop;
+	long long	step;
+};
+
+struct cmdtmpl
+{
+	struct tvar	*vars;
+	int		nvars;
+	struct tframe	frames[TMPL_MAXDEPTH];
+	int		depth;
+	char		*out;
+	size_t		outlen;
+	int		lineno;		/* of the line being expanded */
+};
+
+static int tmpl_error(struct cmdtmpl *t, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int tmpl_error(struct cmdtmpl *t, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "Template error at line %d: ", t->lineno);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	return -1;
+}
+
+static void *tmpl_realloc(void *p, size_t len)
+{
+	p = realloc(p, len);
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static struct tvar *tmpl_var(struct cmdtmpl *t, const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < t->nvars; i++)
+		if (strlen(t->vars[i].name) == len &&
+		    strncmp(t->vars[i].name, name, len) == 0)
+			return &t->vars[i];
+	return NULL;
+}
+
+static int tmpl_setvar(struct cmdtmpl *t, const char *name, size_t len,
+		       const struct tval *v)
+{
+	struct tvar *var = tmpl_var(t, name, len);
+
+	if (!var) {
+		t->vars = tmpl_realloc(t->vars, (t->nvars + 1) * sizeof(*var));
+		var = &t->vars[t->nvars++];
+		var->name = tmpl_realloc(NULL, len + 1);
+		memcpy(var->name, name, len);
+		var->name[len] = '\0';
+	}
+	var->val = *v;
+	return var - t->vars;
+}
+
+/* Addresses as 128 bit numbers; IPv4 uses the last word */
+static void tval_add(struct tval *v, long long n)
+{
+	__u32 ext = n < 0 ? 0xffffffff : 0;
+	__u32 w[4] = { ext, ext, (__u64)n >> 32, n };
+	__u64 carry = 0;
+	int i;
+
+	if (v->family == AF_INET) {
+		v->a[3] += (__u32)n;
+		return;
+	}
+	for (i = 3; i >= 0; i--) {
+		__u64 sum = (__u64)v->a[i] + w[i] + carry;
+
+		v->a[i] = sum;
+		carry = sum >> 32;
+	}
+}
+
+static int tval_cmp(const struct tval *x, const struct tval *y)
+{
+	int i;
+
+	if (x->family == AF_UNSPEC)
+		return x->n < y->n ? -1 : x->n > y->n;
+	for (i = 0; i < 4; i++)
+		if (x->a[i] != y->a[i])
+			return x->a[i] < y->a[i] ? -1 : 1;
+	return 0;
+}
+
+static long long tval_diff(const struct tval *x, const struct tval *y)
+{
+	__u64 hi = ((__u64)x->a[2] << 32 | x->a[3]) -
+		   ((__u64)y->a[2] << 32 | y->a[3]);
+
+	return (long long)hi;
+}
+
+static void tval_print(const struct tval *v, char *buf, size_t len)
+{
+	__u32 a[4];
+	int i;
+
+	if (v->family == AF_UNSPEC) {
+		snprintf(buf, len, "%lld", v->n);
+		return;
+	}
+	for (i = 0; i < 4; i++)
+		a[i] = htonl(v->a[i]);
+	inet_ntop(v->family, v->family == AF_INET ? &a[3] : a, buf, len);
+}
+
+struct texpr
+{
+	struct cmdtmpl	*t;
+	const char	*p;
+};
+
+static int expr(struct texpr *e, struct tval *v);
+
+static void skip_ws(struct texpr *e)
+{
+	while (isspace((unsigned char)*e->p))
+		e->p++;
+}
+
+static int primary(struct texpr *e, struct tval *v)
+{
+	const char *s;
+	char word[64];
+	size_t len;
+
+	skip_ws(e);
+	memset(v, 0, sizeof(*v));
+	if (*e->p == '(') {
+		e->p++;
+		if (expr(e, v))
+			return -1;
+		skip_ws(e);
+		if (*e->p != ')')
+			return tmpl_error(e->t, "missing ')' before \"%s\"", e->p);
+		e->p++;
+		return 0;
+	}
+
+	/* A number, an address or a name; ".." ends an address */
+	for (s = e->p; isalnum((unsigned char)*s) || *s == '_' || *s == ':' ||
+	     (*s == '.' && s[1] != '.'); s++)
+		;
+	len = s - e->p;
+	if (len == 0 || len >= sizeof(word))
+		return tmpl_error(e->t, "bad expression \"%s\"", e->p);
+	memcpy(word, e->p, len);
+	word[len] = '\0';
+	e->p = s;
+
+	if (strchr(word, '.') || strchr(word, ':')) {
+		inet_prefix addr;
+		int i;
+
+		if (get_addr_1(&addr, word, AF_UNSPEC) ||
+		    (addr.family != AF_INET && addr.family != AF_INET6))
+			return tmpl_error(e->t, "bad address \"%s\"", word);
+		v->family = addr.family;
+		if (addr.family == AF_INET)
+			v->a[3] = ntohl(addr.data[0]);
+		else
+			for (i = 0; i < 4; i++)
+				v->a[i] = ntohl(addr.data[i]);
+		return 0;
+	}
+	if (isdigit((unsigned char)word[0])) {
+		char *end;
+
+		v->n = strtoll(word, &end, strncmp(word, "0x", 2) ? 10 : 16);
+		if (*end)
+			return tmpl_error(e->t, "bad number \"%s\"", word);
+		return 0;
+	}
+	if (!tmpl_var(e->t, word, len))
+		return tmpl_error(e->t, "unknown variable \"%s\"", word);
+	*v = tmpl_var(e->t, word, len)->val;
+	return 0;
+}
+
+static int unary(struct texpr *e, struct tval *v)
+{
+	skip_ws(e);
+	if (*e->p == '-') {
+		e->p++;
+		if (unary(e, v))
+			return -1;
+		if (v->family != AF_UNSPEC)
+			return tmpl_error(e->t, "cannot negate an address");
+		if (v->n == LLONG_MIN)
+			return tmpl_error(e->t, "overflow");
+		v->n = -v->n;
+		return 0;
+	}
+	return primary(e, v);
+}
+
+static int term(struct texpr *e, struct tval *v)
+{
+	struct tval r;
+	char op;
+
+	if (unary(e, v))
+		return -1;
+	for (;;) {
+		skip_ws(e);
+		op = *e->p;
+		if (op != '*' && op != '/' && op != '%')
+			return 0;
+		e->p++;
+		if (unary(e, &r))
+			return -1;
+		if (v->family != AF_UNSPEC || r.family != AF_UNSPEC)
+			return tmpl_error(e->t, "'%c' of an address", op);
+		if (op != '*' && r.n == 0)
+			return tmpl_error(e->t, "division by zero");
+		if (op == '*') {
+			if (__builtin_mul_overflow(v->n, r.n, &v->n))
+				return tmpl_error(e->t, "overflow");
+		} else if (v->n == LLONG_MIN && r.n == -1) {
+			/* traps on x86, for % as well */
+			return tmpl_error(e->t, "overflow");
+		} else if (op == '/')
+			v->n /= r.n;
+		else
+			v->n %= r.n;
+	}
+}
+
+static int expr(struct texpr *e, struct tval *v)
+{
+	struct tval r;
+	char op;
+
+	if (term(e, v))
+		return -1;
+	for (;;) {
+		skip_ws(e);
+		op = *e->p;
+		if (op != '+' && op != '-')
+			return 0;
+		e->p++;
+		if (term(e, &r))
+			return -1;
+
+		if (v->family == AF_UNSPEC && r.family == AF_UNSPEC) {
+			if (op == '+' ?
+			    __builtin_add_overflow(v->n, r.n, &v->n) :
+			    __builtin_sub_overflow(v->n, r.n, &v->n))
+				return tmpl_error(e->t, "overflow");
+		} else if (r.family == AF_UNSPEC) {
+			if (op == '-' && r.n == LLONG_MIN)
+				return tmpl_error(e->t, "overflow");
+			tval_add(v, op == '+' ? r.n : -r.n);
+		} else if (v->family == AF_UNSPEC && op == '+') {
+			long long n = v->n;
+
+			*v = r;
+			tval_add(v, n);
+		} else if (op == '-' && v->family == r.family) {
+			v->n = tval_diff(v, &r);
+			v->family = AF_UNSPEC;
+		} else
+			return tmpl_error(e->t, "bad address arithmetic");
+	}
+}
+
+/* A whole expression, up to end or to a ".." or a word if stop is set */
+static int eval(struct cmdtmpl *t, const char **pp, struct tval *v, int stop)
+{
+	struct texpr e = { .t = t, .p = *pp };
+
+	if (expr(&e, v))
+		return -1;
+	skip_ws(&e);
+	if (*e.p && !stop)
+		return tmpl_error(t, "junk at \"%s\"", e.p);
+	*pp = e.p;
+	return 0;
+}
+
+/* Replace each ${EXPR} of line into t->out, ending it with a newline */
+static int expand(struct cmdtmpl *t, const char *line)
+{
+	size_t n = 0;
+
+	for (;;) {
+		const char *d = strstr(line, "${");
+		size_t len = d ? (size_t)(d - line) : strlen(line);
+		char val[INET6_ADDRSTRLEN + 24];
+		struct tval v;
+		const char *p;
+
+		if (n + len + sizeof(val) + 2 > t->outlen) {
+			t->outlen = 2 * (n + len + sizeof(val) + 2);
+			t->out = tmpl_realloc(t->out, t->outlen);
+		}
+		memcpy(t->out + n, line, len);
+		n += len;
+		if (!d)
+			break;
+
+		p = d + 2;
+		if (eval(t, &p, &v, 1))
+			return -1;
+		if (*p != '}')
+			return tmpl_error(t, "expected '}' at \"%s\"", p);
+		tval_print(&v, val, sizeof(val));
+		len = strlen(val);
+		memcpy(t->out + n, val, len);
+		n += len;
+		line = p + 1;
+	}
+	t->out[n++] = '\n';
+	t->out[n] = '\0';
+	return 0;
+}
+
+static const char *directive(const char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (*line != '%' || strncmp(line + 1, name, len) ||
+	    (line[len + 1] && !isspace((unsigned char)line[len + 1])))
+		return NULL;
+	line += len + 1;
+	while (isspace((unsigned char)*line))
+		line++;
+	return line;
+}
+
+static int is_directive(const char *line)
+{
+	while (*line == ' ' || *line == '\t')
+		line++;
+	return *line == '%';
+}
+
+static int name_len(const char *p)
+{
+	int n = 0;
+
+	if (!isalpha((unsigned char)*p) && *p != '_')
+		return 0;
+	while (isalnum((unsigned char)p[n]) || p[n] == '_')
+		n++;
+	return n;
+}
+
+static int do_let(struct cmdtmpl *t, const char *p)
+{
+	int len = name_len(p);
+	const char *q = p + len;
+	struct tval v;
+
+	while (*q == ' ' || *q == '\t')
+		q++;
+	if (len == 0 || *q != '=')
+		return tmpl_error(t, "expected %%let NAME = EXPR, not \"%s\"", p);
+	q++;
+	if (eval(t, &q, &v, 0))
+		return -1;
+	tmpl_setvar(t, p, len, &v);
+	return 0;
+}
+
+static void free_body(struct tbody *b)
+{
+	while (b->count)
+		free(b->lines[--b->count]);
+	free(b->lines);
+	free(b->linenos);
+	free(b);
+}
+
+static void pop_frame(struct cmdtmpl *t)
+{
+	struct tframe *f = &t->frames[--t->depth];
+
+	if (f->owner)
+		free_body(f->body);
+}
+
+/* Whether the loop of frame f has another turn, setting its variable */
+static int loop_next(struct cmdtmpl *t, struct tframe *f, int first)
+{
+	if (!first) {
+		struct tval prev = f->cur;
+
+		if (f->cur.family == AF_UNSPEC)
+			f->cur.n += f->step;
+		else
+			tval_add(&f->cur, f->step);
+		/* An address range stops where it would wrap */
+		if ((tval_cmp(&f->cur, &prev) < 0) != (f->step < 0))
+			return 0;
+	}
+	if (f->step > 0 ? tval_cmp(&f->cur, &f->stop) > 0 :
+			  tval_cmp(&f->cur, &f->stop) < 0)
+		return 0;
+	t->vars[f->var].val = f->cur;
+	f->pc = f->first;
+	return 1;
+}
+
+/* Starts the loop of the %for at p, with its lines at [first, last) */
+static int do_for(struct cmdtmpl *t, const char *p, struct tbody *body,
+		  int first, int last, int owner)
+{
+	struct tframe *f;
+	int len = name_len(p);
+	const char *q = p + len;
+
+	if (t->depth == TMPL_MAXDEPTH)
+		return tmpl_error(t, "loops nested too deep");
+	f = &t->frames[t->depth];
+	memset(f, 0, sizeof(*f));
+
+	while (*q == ' ' || *q == '\t')
+		q++;
+	if (len == 0 || strncmp(q, "in", 2) || !isspace((unsigned char)q[2]))
+		return tmpl_error(t, "expected %%for NAME in A .. B, not \"%s\"",
+				  p);
+	q += 3;
+	if (eval(t, &q, &f->cur, 1))
+		return -1;
+	if (strncmp(q, "..", 2))
+		return tmpl_error(t, "expected \"..\" at \"%s\"", q);
+	q += 2;
+	if (eval(t, &q, &f->stop, 1))
+		return -1;
+
+	f->step = 1;
+	if (*q) {
+		struct tval step;
+
+		if (strncmp(q, "step", 4) || !isspace((unsigned char)q[4]))
+			return tmpl_error(t, "junk at \"%s\"", q);
+		q += 5;
+		if (eval(t, &q, &step, 0))
+			return -1;
+		if (step.family != AF_UNSPEC || step.n == 0)
+			return tmpl_error(t, "step must be a number other than 0");
+		f->step = step.n;
+	}
+	if (f->cur.family != f->stop.family)
+		return tmpl_error(t, "range from %s to another kind of value",
+				  f->cur.family == AF_UNSPEC ? "a number" :
+				  "an address");
+
+	f->var = tmpl_setvar(t, p, len, &f->cur);
+	f->body = body;
+	f->owner = owner;
+	f->first = first;
+	f->last = last;
+	t->depth++;
+	if (!loop_next(t, f, 1))
+		pop_frame(t);
+	return 0;
+}
+
+/* Reads the body of a %for from the file, up to its %done */
+static struct tbody *read_body(struct cmdtmpl *t, struct cmdfile *cf)
+{
+	struct tbody *b = tmpl_realloc(NULL, sizeof(*b));
+	int nest = 0;
+
+	memset(b, 0, sizeof(*b));
+	for (;;) {
+		char *line = cmdfile_rawline(cf);
+
+		if (!line) {
+			tmpl_error(t, "%%for without %%done");
+			free_body(b);
+			return NULL;
+		}
+		if (directive(line, "for"))
+			nest++;
+		if (directive(line, "done") && nest-- == 0)
+			return b;
+		if (b->count == b->size) {
+			b->size = b->size ? 2 * b->size : 16;
+			b->lines = tmpl_realloc(b->lines,
+						b->size * sizeof(char *));
+			b->linenos = tmpl_realloc(b->linenos,
+						  b->size * sizeof(int));
+		}
+		b->lines[b->count] = strdup(line);
+		if (!b->lines[b->count]) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		b->linenos[b->count++] = cmdlineno;
+	}
+}
+
+/* The %done of the %for at line i of f */
+static int find_done(struct tframe *f, int i)
+{
+	int nest = 0;
+
+	for (i++; i < f->last; i++) {
+		if (directive(f->body->lines[i], "for"))
+			nest++;
+		else if (directive(f->body->lines[i], "done") && nest-- == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int run_directive(struct cmdtmpl *t, struct cmdfile *cf,
+			 const char *line, int pc)
+{
+	const char *p;
+
+	if ((p = directive(line, "let")) != NULL)
+		return do_let(t, p);
+	if ((p = directive(line, "for")) != NULL) {
+		struct tframe *f;
+		struct tbody *b;
+		int done;
+
+		if (t->depth == 0) {
+			/* The text of line goes when the body is read */
+			char *head = strdup(p);
+			int ret;
+
+			if (!head) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+			b = read_body(t, cf);
+			ret = b ? do_for(t, head, b, 0, b->count, 1) : -1;
+			/* A loop that did not start has not taken the body */
+			if (ret < 0 && b)
+				free_body(b);
+			free(head);
+			return ret;
+		}
+		f = &t->frames[t->depth - 1];
+		done = find_done(f, pc);
+		if (done < 0)
+			return tmpl_error(t, "%%for without %%done");
+		f->pc = done + 1;
+		return do_for(t, p, f->body, pc + 1, done, 0);
+	}
+	if (directive(line, "done"))
+		return tmpl_error(t, "%%done without %%for");
+	return tmpl_error(t, "unknown directive \"%s\"", line);
+}
+
+int cmdtmpl_getargs(struct cmdfile *cf, char ***argvp)
+{
+	struct cmdtmpl *t = cf->tmpl;
+
+	for (;;) {
+		const char *line;
+		int pc = -1;
+
+		if (t->depth) {
+			struct tframe *f = &t->frames[t->depth - 1];
+
+			if (f->pc == f->last) {
+				if (!loop_next(t, f, 0))
+					pop_frame(t);
+				continue;
+			}
+			pc = f->pc++;
+			line = f->body->lines[pc];
+			cmdlineno = f->body->linenos[pc];
+		} else {
+			line = cmdfile_rawline(cf);
+			if (!line)
+				return -1;
+		}
+		t->lineno = cmdlineno;
+
+		if (is_directive(line)) {
+			if (expand(t, line) < 0 ||
+			    run_directive(t, cf, t->out, pc) < 0)
+				goto err;
+			continue;
+		}
+		if (expand(t, line) < 0)
+			goto err;
+		return cmdfile_splitline(cf, t->out, argvp);
+	}
+err:
+	cf->error = 1;
+	while (t->depth)
+		pop_frame(t);
+	return -1;
+}
+
+/* The first directive, already split into arguments */
+int cmdtmpl_start(struct cmdfile *cf, int argc, char ***argvp)
+{
+	struct cmdtmpl *t = tmpl_realloc(NULL, sizeof(*t));
+	char **argv = *argvp;
+	size_t len = 0;
+	char *line;
+	int i;
+
+	memset(t, 0, sizeof(*t));
+	cf->tmpl = t;
+	t->lineno = cmdlineno;
+
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	line = tmpl_realloc(NULL, len + 1);
+	line[0] = '\0';
+	for (i = 0; i < argc; i++) {
+		strcat(line, argv[i]);
+		strcat(line, " ");
+	}
+	if (expand(t, line) < 0 || run_directive(t, cf, t->out, -1) < 0) {
+		free(line);
+		cf->error = 1;
+		return -1;
+	}
+	free(line);
+	return cmdtmpl_getargs(cf, argvp);
+}
+
+void cmdtmpl_free(struct cmdtmpl *t)
+{
+	int i;
+
+	if (!t)
+		return;
+	while (t->depth)
+		pop_frame(t);
+	for (i = 0; i < t->nvars; i++)
+		free(t->vars[i].name);
+	free(t->vars);
+	free(t->out);
+	free(t);
+}
@@ -19,24 +19,104 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "utils.h"
 
+/*
+ * The protocols database is read once, into a table indexed by number
+ * and a list of the names and aliases sorted for a binary search: ss
+ * and tc look a protocol up for each socket or filter they print.  The
+ * first entry of a number or name is the one kept, as getprotobynumber()
+ * and getprotobyname() would find.  Should the database not be listable
+ * the lookups go to those instead.
+ */
+struct proto_name
+{
+	const char	*name;
+	int		proto;
+	int		order;
+};
+
+static const char *proto_names[256];
+static struct proto_name *proto_by_name;
+static int proto_nnames;
+static pthread_once_t proto_once = PTHREAD_ONCE_INIT;
+
+static int proto_name_cmp(const void *a, const void *b)
+{
+	const struct proto_name *x = a, *y = b;
+	int d = strcmp(x->name, y->name);
+
+	return d ? d : x->order - y->order;
+}
+
+static void proto_add_name(const char *name, int proto, int *size)
+{
+	struct proto_name *n;
+
+	if (proto_nnames == *size) {
+		int nsize = *size ? *size * 2 : 64;
+
+		n = realloc(proto_by_name, nsize * sizeof(*n));
+		if (n == NULL)
+			return;
+		proto_by_name = n;
+		*size = nsize;
+	}
+	n = &proto_by_name[proto_nnames];
+	n->name = strdup(name);
+	if (n->name == NULL)
+		return;
+	n->proto = proto;
+	n->order = proto_nnames++;
+}
+
+static void inet_proto_initialize(void)
+{
+	struct protoent *pe;
+	int size = 0, i, j;
+
+	setprotoent(1);
+	while ((pe = getprotoent()) != NULL) {
+		char **alias;
+
+		if (pe->p_proto < 0 || pe->p_proto > 255)
+			continue;
+		if (proto_names[pe->p_proto] == NULL)
+			proto_names[pe->p_proto] = strdup(pe->p_name);
+		proto_add_name(pe->p_name, pe->p_proto, &size);
+		for (alias = pe->p_aliases; alias && *alias; alias++)
+			proto_add_name(*alias, pe->p_proto, &size);
+	}
+	endprotoent();
+
+	qsort(proto_by_name, proto_nnames, sizeof(*proto_by_name),
+	      proto_name_cmp);
+	for (i = j = 0; i < proto_nnames; i++) {
+		if (j && strcmp(proto_by_name[i].name,
+				proto_by_name[j - 1].name) == 0)
+			continue;
+		proto_by_name[j++] = proto_by_name[i];
+	}
+	proto_nnames = j;
+}
+
 char *inet_proto_n2a(int proto, char *buf, int len)
 {
-	static char ncache[16];
-	static int icache = -1;
 	struct protoent *pe;
 
-	if (proto == icache)
-		return ncache;
+	pthread_once(&proto_once, inet_proto_initialize);
 
-	pe = getprotobynumber(proto);
-	if (pe) {
-		icache = proto;
-		strncpy(ncache, pe->p_name, 16);
-		strncpy(buf, pe->p_name, len);
-		return buf;
+	if (proto >= 0 && proto <= 255 && proto_names[proto])
+		return (char *)proto_names[proto];
+
+	if (proto_nnames == 0) {
+		pe = getprotobynumber(proto);
+		if (pe) {
+			strncpy(buf, pe->p_name, len);
+			return buf;
+		}
 	}
 	snprintf(buf, len, "ipproto-%d", proto);
 	return buf;
@@ -44,12 +124,8 @@ char *inet_proto_n2a(int proto, char *buf, int len)
 
 int inet_proto_a2n(char *buf)
 {
-	static char ncache[16];
-	static int icache = -1;
 	struct protoent *pe;
-
-	if (icache>=0 && strcmp(ncache, buf) == 0)
-		return icache;
+	int lo = 0, hi;
 
 	if (buf[0] >= '0' && buf[0] <= '9') {
 		__u8 ret;
@@ -58,13 +134,25 @@ int inet_proto_a2n(char *buf)
 		return ret;
 	}
 
-	pe = getprotobyname(buf);
-	if (pe) {
-		icache = pe->p_proto;
-		strncpy(ncache, pe->p_name, 16);
-		return pe->p_proto;
+	pthread_once(&proto_once, inet_proto_initialize);
+
+	hi = proto_nnames;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int d = strcmp(buf, proto_by_name[mid].name);
+
+		if (d == 0)
+			return proto_by_name[mid].proto;
+		if (d < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (proto_nnames == 0) {
+		pe = getprotobyname(buf);
+		if (pe)
+			return pe->p_proto;
 	}
 	return -1;
 }
-
-
@@ -0,0 +1,426 @@
+/*
+ * libgenl.c	Generic netlink family resolution.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Families are resolved with CTRL_CMD_GETFAMILY the first time they
+ * are asked for and kept for the life of the process, so a batch asks
+ * the controller once rather than once per line.  Tools that listen to
+ * the controller's multicast group pass its messages to
+ * genl_family_update(), which drops a family on CTRL_CMD_DELFAMILY
+ * and refreshes it on CTRL_CMD_NEWFAMILY; its id may change when the
+ * module is loaded again.
+ *
+ * When IPROUTE_GENL_CACHE names a file, the table "genl ctrl cache"
+ * wrote there is loaded instead, so the families in it are known
+ * without asking the controller at all.  It is only trusted within the
+ * boot it was written in; after loading or unloading a genetlink
+ * module it has to be written again, or kept current by a "genl ctrl
+ * monitor" running with the same variable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+#include "libgenl.h"
+#include "utils.h"
+
+#define GENL_CACHE_MAX_OPS	256
+#define GENL_CACHE_MAGIC	0x47464331	/* "GFC1" */
+
+struct genl_cache_hdr
+{
+	__u32	magic;
+	__u32	count;
+	__u32	recsize;
+	char	boot_id[40];
+};
+
+/* Per thread, as the link cache is */
+static __thread struct genl_family *genl_cache;
+static __thread int genl_cache_count;
+static __thread int genl_cache_max;
+static __thread const char *genl_cache_file;
+static __thread int genl_cache_state;	/* 0 - not loaded, 1 - from file, -1 - off */
+
+int genl_parse_family(const struct nlmsghdr *n, struct genl_family *f)
+{
+	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+	struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	int len = n->nlmsg_len;
+
+	if (n->nlmsg_type != GENL_ID_CTRL) {
+		fprintf(stderr, "Not a controller message, nlmsg_len=%d "
+			"nlmsg_type=0x%x\n", n->nlmsg_len, n->nlmsg_type);
+		return -1;
+	}
+
+	len -= NLMSG_LENGTH(GENL_HDRLEN);
+	if (len < 0) {
+		fprintf(stderr, "wrong controller message len %d\n", len);
+		return -1;
+	}
+
+	parse_rtattr(tb, CTRL_ATTR_MAX,
+		     (struct rtattr *)((char *)ghdr + GENL_HDRLEN), len);
+	if (tb[CTRL_ATTR_FAMILY_ID] == NULL ||
+	    tb[CTRL_ATTR_FAMILY_NAME] == NULL) {
+		fprintf(stderr, "Missing family id TLV\n");
+		return -1;
+	}
+
+	memset(f, 0, sizeof(*f));
+	strncpy(f->name, rta_getattr_str(tb[CTRL_ATTR_FAMILY_NAME]),
+		sizeof(f->name) - 1);
+	f->id = rta_getattr_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	if (tb[CTRL_ATTR_VERSION])
+		f->version = rta_getattr_u32(tb[CTRL_ATTR_VERSION]);
+	if (tb[CTRL_ATTR_HDRSIZE])
+		f->hdrsize = rta_getattr_u32(tb[CTRL_ATTR_HDRSIZE]);
+	if (tb[CTRL_ATTR_MAXATTR])
+		f->maxattr = rta_getattr_u32(tb[CTRL_ATTR_MAXATTR]);
+
+	if (tb[CTRL_ATTR_OPS]) {
+		struct rtattr *ops[GENL_CACHE_MAX_OPS + 1];
+		int i;
+
+		parse_rtattr_nested(ops, GENL_CACHE_MAX_OPS, tb[CTRL_ATTR_OPS]);
+		for (i = 0; i <= GENL_CACHE_MAX_OPS; i++) {
+			struct rtattr *op[CTRL_ATTR_OP_MAX + 1];
+			__u32 cmd;
+
+			if (ops[i] == NULL)
+				continue;
+			parse_rtattr_nested(op, CTRL_ATTR_OP_MAX, ops[i]);
+			if (op[CTRL_ATTR_OP_ID] == NULL)
+				continue;
+			cmd = rta_getattr_u32(op[CTRL_ATTR_OP_ID]);
+			if (cmd < GENL_CACHE_MAX_OPS)
+				f->ops[cmd / 32] |= 1U << (cmd % 32);
+		}
+	}
+
+	if (tb[CTRL_ATTR_MCAST_GROUPS]) {
+		struct rtattr *grp;
+		int glen = RTA_PAYLOAD(tb[CTRL_ATTR_MCAST_GROUPS]);
+
+		for (grp = RTA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]);
+		     RTA_OK(grp, glen) && f->ngrps < GENL_CACHE_MAX_GRPS;
+		     grp = RTA_NEXT(grp, glen)) {
+			struct rtattr *g[CTRL_ATTR_MCAST_GRP_MAX + 1];
+			struct genl_mcast_grp *mg = &f->grps[f->ngrps];
+
+			parse_rtattr_nested(g, CTRL_ATTR_MCAST_GRP_MAX, grp);
+			if (g[CTRL_ATTR_MCAST_GRP_ID] == NULL ||
+			    g[CTRL_ATTR_MCAST_GRP_NAME] == NULL)
+				continue;
+			strncpy(mg->name,
+				rta_getattr_str(g[CTRL_ATTR_MCAST_GRP_NAME]),
+				sizeof(mg->name) - 1);
+			mg->id = rta_getattr_u32(g[CTRL_ATTR_MCAST_GRP_ID]);
+			f->ngrps++;
+		}
+	}
+	return 0;
+}
+
+static int genl_boot_id(char *buf, int len)
+{
+	FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+	int ok;
+
+	memset(buf, 0, len);
+	if (fp == NULL)
+		return -1;
+	ok = fgets(buf, len, fp) != NULL;
+	fclose(fp);
+	return ok ? 0 : -1;
+}
+
+static void genl_cache_load(void)
+{
+	struct genl_cache_hdr hdr;
+	char boot_id[sizeof(hdr.boot_id)];
+	FILE *fp;
+
+	if (genl_cache_state)
+		return;
+	genl_cache_state = -1;
+	genl_cache_file = getenv("IPROUTE_GENL_CACHE");
+	if (genl_cache_file == NULL || *genl_cache_file == 0)
+		return;
+	genl_cache_state = 1;
+
+	fp = fopen(genl_cache_file, "r");
+	if (fp == NULL)
+		return;
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != GENL_CACHE_MAGIC ||
+	    hdr.recsize != sizeof(struct genl_family) ||
+	    genl_boot_id(boot_id, sizeof(boot_id)) < 0 ||
+	    memcmp(boot_id, hdr.boot_id, sizeof(boot_id)) != 0 ||
+	    hdr.count > 4096)
+		goto out;
+
+	genl_cache = calloc(hdr.count ? hdr.count : 1, sizeof(*genl_cache));
+	if (genl_cache == NULL)
+		goto out;
+	genl_cache_max = hdr.count ? hdr.count : 1;
+	genl_cache_count = fread(genl_cache, sizeof(*genl_cache), hdr.count,
+				 fp);
+out:
+	fclose(fp);
+}
+
+/* Written next to the file and renamed over it */
+int genl_family_save(const char *file)
+{
+	struct genl_cache_hdr hdr;
+	char tmpname[PATH_MAX];
+	FILE *fp;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = GENL_CACHE_MAGIC;
+	hdr.count = genl_cache_count;
+	hdr.recsize = sizeof(struct genl_family);
+	if (genl_boot_id(hdr.boot_id, sizeof(hdr.boot_id)) < 0) {
+		fprintf(stderr, "Cannot read the boot id\n");
+		return -1;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp%d", file, getpid());
+	fp = fopen(tmpname, "w");
+	if (fp == NULL) {
+		perror(tmpname);
+		return -1;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(genl_cache, sizeof(*genl_cache), genl_cache_count,
+		   fp) != genl_cache_count) {
+		fclose(fp);
+		unlink(tmpname);
+		return -1;
+	}
+	if (fclose(fp) != 0 || rename(tmpname, file) < 0) {
+		perror(file);
+		unlink(tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+static struct genl_family *genl_cache_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < genl_cache_count; i++)
+		if (strcmp(genl_cache[i].name, name) == 0)
+			return &genl_cache[i];
+	return NULL;
+}
+
+static void genl_cache_drop(const char *name)
+{
+	struct genl_family *f = genl_cache_find(name);
+
+	if (f)
+		*f = genl_cache[--genl_cache_count];
+}
+
+static struct genl_family *genl_cache_store(const struct genl_family *nf)
+{
+	struct genl_family *f = genl_cache_find(nf->name);
+
+	if (f == NULL) {
+		if (genl_cache_count == genl_cache_max) {
+			int max = genl_cache_max ? genl_cache_max * 2 : 16;
+			void *p = realloc(genl_cache, max * sizeof(*genl_cache));
+
+			if (p == NULL)
+				return NULL;
+			genl_cache = p;
+			genl_cache_max = max;
+		}
+		f = &genl_cache[genl_cache_count++];
+	}
+	*f = *nf;
+	return f;
+}
+
+/* rth may be NULL; a socket is then opened for the request */
+const struct genl_family *genl_family_lookup(struct rtnl_handle *rth,
+					     const char *name)
+{
+	struct rtnl_handle tmp;
+	struct genl_family nf;
+	struct genl_family *f;
+	struct {
+		struct nlmsghdr		n;
+		struct genlmsghdr	g;
+		char			buf[4096];
+	} req;
+
+	genl_cache_load();
+	f = genl_cache_find(name);
+	if (f)
+		return f;
+
+	if (rth == NULL) {
+		if (rtnl_open_byproto(&tmp, 0, NETLINK_GENERIC) < 0) {
+			fprintf(stderr, "Cannot open generic netlink socket\n");
+			return NULL;
+		}
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = GENL_ID_CTRL;
+	req.g.cmd = CTRL_CMD_GETFAMILY;
+	addattr_l(&req.n, sizeof(req), CTRL_ATTR_FAMILY_NAME,
+		  name, strlen(name) + 1);
+
+	if (rtnl_talk(rth ? rth : &tmp, &req.n, 0, 0, &req.n) < 0) {
+		fprintf(stderr, "Error talking to the kernel\n");
+		f = NULL;
+	} else if (genl_parse_family(&req.n, &nf) == 0)
+		f = genl_cache_store(&nf);
+
+	if (rth == NULL)
+		rtnl_close(&tmp);
+	return f;
+}
+
+int genl_resolve_family(struct rtnl_handle *rth, const char *name)
+{
+	const struct genl_family *f = genl_family_lookup(rth, name);
+
+	return f ? f->id : -1;
+}
+
+int genl_family_has_op(const struct genl_family *f, int cmd)
+{
+	if (cmd < 0 || cmd >= GENL_CACHE_MAX_OPS)
+		return 0;
+	return !!(f->ops[cmd / 32] & (1U << (cmd % 32)));
+}
+
+/* The id of a multicast group of the family, or -1 */
+int genl_family_group(const struct genl_family *f, const char *name)
+{
+	int i;
+
+	for (i = 0; i < f->ngrps; i++)
+		if (strcmp(f->grps[i].name, name) == 0)
+			return f->grps[i].id;
+	return -1;
+}
+
+/* Returns 1 if n was a family notification and the cache changed.
+ * With a cache file every family is kept, and the file rewritten.
+ */
+int genl_family_update(const struct nlmsghdr *n)
+{
+	struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+	struct genl_family nf;
+	int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+	if (n->nlmsg_type != GENL_ID_CTRL || len < 0)
+		return 0;
+
+	genl_cache_load();
+	switch (ghdr->cmd) {
+	case CTRL_CMD_DELFAMILY:
+		parse_rtattr(tb, CTRL_ATTR_MAX,
+			     (struct rtattr *)((char *)ghdr + GENL_HDRLEN), len);
+		if (tb[CTRL_ATTR_FAMILY_NAME] == NULL)
+			return 0;
+		if (genl_cache_find(rta_getattr_str(tb[CTRL_ATTR_FAMILY_NAME])) == NULL)
+			return 0;
+		genl_cache_drop(rta_getattr_str(tb[CTRL_ATTR_FAMILY_NAME]));
+		break;
+	case CTRL_CMD_NEWFAMILY:
+		if (genl_parse_family(n, &nf) < 0)
+			return 0;
+		/* Only refresh what somebody asked for */
+		if (genl_cache_state < 0 && genl_cache_find(nf.name) == NULL)
+			return 0;
+		genl_cache_store(&nf);
+		break;
+	default:
+		return 0;
+	}
+	if (genl_cache_state > 0)
+		genl_family_save(genl_cache_file);
+	return 1;
+}
+
+static int genl_load_one(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			 void *arg)
+{
+	struct genl_family nf;
+
+	if (genl_parse_family(n, &nf) < 0)
+		return -1;
+	return genl_cache_store(&nf) ? 0 : -1;
+}
+
+/* Replace the cache with a dump of all families */
+int genl_family_load_all(struct rtnl_handle *rth)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct genlmsghdr	g;
+	} req;
+
+	genl_cache_load();
+	genl_family_flush();
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	req.n.nlmsg_flags = NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST;
+	req.n.nlmsg_type = GENL_ID_CTRL;
+	req.n.nlmsg_seq = rth->dump = ++rth->seq;
+	req.g.cmd = CTRL_CMD_GETFAMILY;
+
+	if (rtnl_send(rth, &req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(rth, genl_load_one, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* In cache order; stops at the first non-zero return */
+int genl_family_walk(int (*fn)(const struct genl_family *f, void *arg),
+		     void *arg)
+{
+	int i, ret;
+
+	genl_cache_load();
+	for (i = 0; i < genl_cache_count; i++) {
+		ret = fn(&genl_cache[i], arg);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+void genl_family_flush(void)
+{
+	free(genl_cache);
+	genl_cache = NULL;
+	genl_cache_count = genl_cache_max = 0;
+}
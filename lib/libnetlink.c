@@ -17,22 +17,90 @@
 #include <fcntl.h>
 #include <net/if_arp.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <poll.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "libnetlink.h"
+#include "probes.h"
 
 int rcvbuf = 1024 * 1024;
+const char *rtnl_replay_file;
+
+static void rtnl_ring_free(struct rtnl_ring *ring);
+static int rtnl_pipeline_wait(struct rtnl_handle *rth, unsigned int target);
+static void rtnl_rx_ring_free(struct rtnl_handle *rth);
+static int rtnl_replay_open(struct rtnl_handle *rth);
+static int rtnl_replay_request(struct rtnl_handle *rth, int type,
+			       const void *req, int len);
+static int rtnl_replay_dump(struct rtnl_handle *rth,
+			    const struct rtnl_dump_filter_arg *arg);
+static void rtnl_dump_keep(struct rtnl_handle *rth, const void *head,
+			   int headlen, const void *body, int bodylen,
+			   int strict);
+static void rtnl_dump_state_free(struct rtnl_dump_state *d);
 
 void rtnl_close(struct rtnl_handle *rth)
 {
+	rtnl_rx_ring_free(rth);
 	if (rth->fd >= 0) {
 		close(rth->fd);
 		rth->fd = -1;
 	}
+	free(rth->buf);
+	rth->buf = NULL;
+	rth->buflen = 0;
+	rtnl_ring_free(rth->ring);
+	rth->ring = NULL;
+	free(rth->pipe);
+	rth->pipe = NULL;
+	free(rth->replay);
+	rth->replay = NULL;
+	rtnl_dump_state_free(rth->dstate);
+	rth->dstate = NULL;
+}
+
+/* Sets the receive buffer of a netlink socket to size bytes, beyond
+ * net.core.rmem_max with SO_RCVBUFFORCE if we are allowed to.  Returns
+ * the size the kernel granted, which may be smaller, or -1.
+ */
+int rtnl_set_rcvbuf(int fd, int size)
+{
+	socklen_t len = sizeof(size);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+		perror("SO_RCVBUF");
+		return -1;
+	}
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0) {
+		perror("SO_RCVBUF");
+		return -1;
+	}
+	/* The kernel doubles the value to account for its overhead */
+	return size / 2;
+}
+
+/* Resizes the receive buffer of an open handle, e.g. for a listener
+ * that must absorb event bursts, and warns if the kernel grants less.
+ */
+int rtnl_rcvbuf(struct rtnl_handle *rth, int size)
+{
+	int granted = rtnl_set_rcvbuf(rth->fd, size);
+
+	if (granted < 0)
+		return -1;
+	if (granted < size)
+		fprintf(stderr, "Warning: receive buffer is %d bytes, "
+			"%d requested\n", granted, size);
+	rth->rcvbuf = granted;
+	return 0;
 }
 
 int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
@@ -43,6 +111,9 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
 
 	memset(rth, 0, sizeof(*rth));
 
+	if (rtnl_replay_file)
+		return rtnl_replay_open(rth);
+
 	rth->fd = socket(AF_NETLINK, SOCK_RAW, protocol);
 	if (rth->fd < 0) {
 		perror("Cannot open netlink socket");
@@ -54,10 +125,9 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
 		return -1;
 	}
 
-	if (setsockopt(rth->fd,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf)) < 0) {
-		perror("SO_RCVBUF");
+	rth->rcvbuf = rtnl_set_rcvbuf(rth->fd, rcvbuf);
+	if (rth->rcvbuf < 0)
 		return -1;
-	}
 
 	memset(&rth->local, 0, sizeof(rth->local));
 	rth->local.nl_family = AF_NETLINK;
@@ -99,6 +169,9 @@ int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 		__u32 ext_filter_mask;
 	} req;
 
+	if (rtnl_pipeline_wait(rth, 0) < 0)
+		return -1;
+
 	memset(&req, 0, sizeof(req));
 	req.nlh.nlmsg_len = sizeof(req);
 	req.nlh.nlmsg_type = type;
@@ -111,11 +184,30 @@ int rtnl_wilddump_request(struct rtnl_handle *rth, int family, int type)
 	req.ext_req.rta_len = RTA_LENGTH(sizeof(__u32));
 	req.ext_filter_mask = RTEXT_FILTER_VF;
 
+	if (rth->replay)
+		return rtnl_replay_request(rth, type, &req.g, sizeof(req.g));
+	rtnl_dump_keep(rth, &req, sizeof(req), NULL, 0, 0);
+	rtnl_stats.sendmsg++;
 	return send(rth->fd, (void*)&req, sizeof(req), 0);
 }
 
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int len)
 {
+	if (rtnl_pipeline_wait(rth, 0) < 0)
+		return -1;
+	if (rth->replay) {
+		const struct nlmsghdr *n = buf;
+
+		if (len < NLMSG_HDRLEN || (n->nlmsg_flags & NLM_F_DUMP) != NLM_F_DUMP)
+			return rtnl_replay_request(rth, -1, NULL, 0);
+		rth->dump = ++rth->seq;
+		return rtnl_replay_request(rth, n->nlmsg_type, NLMSG_DATA(n),
+					   len - NLMSG_HDRLEN);
+	}
+	if (len >= NLMSG_HDRLEN &&
+	    (((const struct nlmsghdr *)buf)->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP)
+		rtnl_dump_keep(rth, buf, len, NULL, 0, 0);
+	rtnl_stats.sendmsg++;
 	return send(rth->fd, buf, len, 0);
 }
 
@@ -125,6 +217,10 @@ int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 	int status;
 	char resp[1024];
 
+	if (rtnl_pipeline_wait(rth, 0) < 0)
+		return -1;
+
+	rtnl_stats.sendmsg++;
 	status = send(rth->fd, buf, len, 0);
 	if (status < 0)
 		return status;
@@ -167,19 +263,523 @@ int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len)
 		.msg_iovlen = 2,
 	};
 
+	if (rtnl_pipeline_wait(rth, 0) < 0)
+		return -1;
+
 	nlh.nlmsg_len = NLMSG_LENGTH(len);
 	nlh.nlmsg_type = type;
 	nlh.nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
 	nlh.nlmsg_pid = 0;
 	nlh.nlmsg_seq = rth->dump = ++rth->seq;
 
+	if (rth->replay)
+		return rtnl_replay_request(rth, type, req, len);
+	rtnl_dump_keep(rth, &nlh, sizeof(nlh), req, len, 0);
+	rtnl_stats.sendmsg++;
 	return sendmsg(rth->fd, &msg, 0);
 }
 
-int rtnl_dump_filter_l(struct rtnl_handle *rth,
-		       const struct rtnl_dump_filter_arg *arg)
+/* Send a dump request whose header fields and attributes ask the
+ * kernel to filter (e.g. RTM_GETROUTE by table or oif).  Kernels only
+ * honour those with NETLINK_GET_STRICT_CHK, which is enabled just
+ * for this request: the plain rtgenmsg requests sent elsewhere would
+ * be refused under strict checking.  The flag is latched when the
+ * dump starts, so it can be dropped right after send().
+ * Returns 1 if sent, 0 if the kernel has no strict checking (nothing
+ * was sent and the caller should use rtnl_wilddump_request()) and -1
+ * on error.
+ */
+int rtnl_dump_request_strict(struct rtnl_handle *rth, struct nlmsghdr *n)
 {
-	struct sockaddr_nl nladdr;
+	int one = 1, zero = 0;
+	int ret;
+
+	if (rtnl_pipeline_wait(rth, 0) < 0)
+		return -1;
+
+	/* A capture is filtered only as far as a plain request would be */
+	if (rth->replay)
+		return 0;
+
+	if (setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+		       &one, sizeof(one)) < 0)
+		return 0;
+
+	n->nlmsg_flags = NLM_F_DUMP|NLM_F_REQUEST;
+	n->nlmsg_pid = 0;
+	n->nlmsg_seq = rth->dump = ++rth->seq;
+
+	rtnl_dump_keep(rth, n, n->nlmsg_len, NULL, 0, 1);
+	rtnl_stats.sendmsg++;
+	ret = send(rth->fd, n, n->nlmsg_len, 0);
+
+	setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+		   &zero, sizeof(zero));
+	return ret < 0 ? -1 : 1;
+}
+
+/* Receive one datagram into the handle's buffer.  Unless a fixed
+ * rth->bufsize was requested, the pending datagram is peeked first so
+ * that the buffer can be grown to hold it and nothing is truncated.
+ */
+static int rtnl_recvmsg(struct rtnl_handle *rth, struct msghdr *msg)
+{
+	struct iovec *iov = msg->msg_iov;
+	unsigned int len = rth->bufsize;
+	size_t controllen = msg->msg_controllen;
+	int status;
+
+	rtnl_stats.recvmsg++;
+	if (len == 0) {
+		iov->iov_base = NULL;
+		iov->iov_len = 0;
+		status = recvmsg(rth->fd, msg, MSG_PEEK | MSG_TRUNC);
+		if (status <= 0)
+			return status;
+		len = status;
+		if (len < RTNL_DEFAULT_BUFSIZE)
+			len = RTNL_DEFAULT_BUFSIZE;
+	}
+
+	if (len > rth->buflen) {
+		char *buf = realloc(rth->buf, len);
+
+		if (buf == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		rth->buf = buf;
+		rth->buflen = len;
+	}
+
+	iov->iov_base = rth->buf;
+	iov->iov_len = rth->buflen;
+	msg->msg_controllen = controllen;
+	status = recvmsg(rth->fd, msg, 0);
+	if (status > 0)
+		rtnl_stats.rx_bytes += status;
+	return status;
+}
+
+/* Room for the nsid of a datagram, see rtnl_listen_all_nsid() */
+#define RTNL_NSID_CTRLLEN	CMSG_SPACE(sizeof(int))
+
+static int rtnl_msg_nsid(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+		if (cmsg->cmsg_level == SOL_NETLINK &&
+		    cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			return *(int *)CMSG_DATA(cmsg);
+	return -1;
+}
+
+#ifdef HAVE_RECVMMSG
+struct rtnl_ring
+{
+	unsigned int		count;
+	unsigned int		slotlen;
+	unsigned int		grow;	/* slotlen the next call wants */
+	struct mmsghdr		*msgs;
+	struct iovec		*iov;
+	struct sockaddr_nl	*addr;
+	char			*bufs;
+	char			*ctrl;
+};
+
+static void rtnl_ring_free(struct rtnl_ring *ring)
+{
+	if (ring == NULL)
+		return;
+	free(ring->msgs);
+	free(ring->iov);
+	free(ring->addr);
+	free(ring->bufs);
+	free(ring->ctrl);
+	free(ring);
+}
+
+static struct rtnl_ring *rtnl_ring_alloc(unsigned int count,
+					 unsigned int slotlen)
+{
+	struct rtnl_ring *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+
+	ring->count = count;
+	ring->slotlen = slotlen;
+	ring->msgs = calloc(count, sizeof(*ring->msgs));
+	ring->iov = calloc(count, sizeof(*ring->iov));
+	ring->addr = calloc(count, sizeof(*ring->addr));
+	ring->bufs = malloc((size_t)count * slotlen);
+	ring->ctrl = malloc(count * RTNL_NSID_CTRLLEN);
+	if (!ring->msgs || !ring->iov || !ring->addr || !ring->bufs ||
+	    !ring->ctrl) {
+		rtnl_ring_free(ring);
+		return NULL;
+	}
+	return ring;
+}
+
+/* Pull up to count datagrams with a single recvmmsg() call.
+ * Blocks for the first datagram only.  Returns the number of
+ * datagrams received, 0 on EOF or -1 with errno set.
+ *
+ * Slots are malloc()ed large but not touched, so that, as with the
+ * peek of rtnl_recvmsg(), big datagrams are not cut off. Should one
+ * still be, the real length MSG_TRUNC reports makes the slots of the
+ * next call big enough for it.
+ */
+static int rtnl_recvmmsg(struct rtnl_handle *rth, unsigned int count)
+{
+	struct rtnl_ring *ring = rth->ring;
+	unsigned int slotlen = rth->bufsize ? : RTNL_BATCH_SLOTSIZE;
+	unsigned int i;
+	int status;
+
+	if (ring && !rth->bufsize && ring->grow > slotlen)
+		slotlen = ring->grow;
+	if (ring && (ring->count != count || ring->slotlen != slotlen)) {
+		rtnl_ring_free(ring);
+		ring = rth->ring = NULL;
+	}
+	if (ring == NULL) {
+		ring = rth->ring = rtnl_ring_alloc(count, slotlen);
+		if (ring == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ring->grow = slotlen;
+	}
+
+	for (i = 0; i < ring->count; i++) {
+		struct msghdr *msg = &ring->msgs[i].msg_hdr;
+
+		ring->iov[i].iov_base = ring->bufs + (size_t)i * slotlen;
+		ring->iov[i].iov_len = slotlen;
+		msg->msg_name = &ring->addr[i];
+		msg->msg_namelen = sizeof(ring->addr[i]);
+		msg->msg_iov = &ring->iov[i];
+		msg->msg_iovlen = 1;
+		if (rth->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+			msg->msg_control = ring->ctrl + i * RTNL_NSID_CTRLLEN;
+			msg->msg_controllen = RTNL_NSID_CTRLLEN;
+		} else {
+			msg->msg_control = NULL;
+			msg->msg_controllen = 0;
+		}
+		msg->msg_flags = 0;
+		ring->msgs[i].msg_len = 0;
+	}
+
+	rtnl_stats.recvmsg++;
+	status = recvmmsg(rth->fd, ring->msgs, ring->count,
+			  MSG_WAITFORONE | MSG_TRUNC, NULL);
+	for (i = 0; status > 0 && i < (unsigned int)status; i++) {
+		struct mmsghdr *m = &ring->msgs[i];
+
+		if (m->msg_len > slotlen) {
+			if (!rth->bufsize && m->msg_len > ring->grow)
+				ring->grow = (m->msg_len + 4095) & ~4095U;
+			m->msg_len = slotlen;
+		}
+		rtnl_stats.rx_bytes += m->msg_len;
+	}
+	return status;
+}
+#else
+struct rtnl_ring;
+
+static void rtnl_ring_free(struct rtnl_ring *ring)
+{
+}
+#endif
+
+/*
+ * The state of the dumps of a handle.  The last dump request is kept so
+ * that a dump the kernel flagged NLM_F_DUMP_INTR (the objects changed
+ * while it was being made) can be asked for again.  Streamed dumps have
+ * been handed to the filters by then and only get a warning; under
+ * RTNL_HANDLE_F_DUMP_CONSISTENT the messages are held back in snap
+ * until NLMSG_DONE and the dump is restarted up to RTNL_DUMP_RESTARTS
+ * times.  msgv holds the messages of a datagram (or of the whole held
+ * dump) for a list of several filters, which see them one filter after
+ * the other, so that the datagram is walked only once.
+ */
+#define RTNL_DUMP_RESTARTS	3
+
+struct rtnl_dump_state
+{
+	struct nlmsghdr		*req;
+	int			reqlen;
+	int			strict;
+	int			intr;
+	int			restarts;
+	struct nlmsghdr		**msgv;
+	unsigned int		msgc;
+	unsigned int		msgmax;
+	char			*snap;
+	size_t			snaplen;
+	size_t			snapsize;
+};
+
+static void rtnl_dump_state_free(struct rtnl_dump_state *d)
+{
+	if (d == NULL)
+		return;
+	free(d->req);
+	free(d->msgv);
+	free(d->snap);
+	free(d);
+}
+
+static struct rtnl_dump_state *rtnl_dump_state(struct rtnl_handle *rth)
+{
+	if (rth->dstate == NULL)
+		rth->dstate = calloc(1, sizeof(*rth->dstate));
+	return rth->dstate;
+}
+
+/* Keep a copy of a dump request for a restart; without memory there
+ * will be no restart.
+ */
+static void rtnl_dump_keep(struct rtnl_handle *rth, const void *head,
+			   int headlen, const void *body, int bodylen,
+			   int strict)
+{
+	struct rtnl_dump_state *d = rtnl_dump_state(rth);
+	int len = headlen + bodylen;
+	void *req;
+
+	if (d == NULL)
+		return;
+	if (len > d->reqlen) {
+		req = realloc(d->req, len);
+		if (req == NULL) {
+			d->reqlen = 0;
+			return;
+		}
+		d->req = req;
+	}
+	memcpy(d->req, head, headlen);
+	if (bodylen)
+		memcpy((char *)d->req + headlen, body, bodylen);
+	d->reqlen = len;
+	d->strict = strict;
+}
+
+static int rtnl_dump_resend(struct rtnl_handle *rth)
+{
+	struct rtnl_dump_state *d = rth->dstate;
+	int one = 1, zero = 0;
+	int ret;
+
+	d->req->nlmsg_seq = rth->dump = ++rth->seq;
+	if (d->strict)
+		setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+			   &one, sizeof(one));
+	rtnl_stats.sendmsg++;
+	ret = send(rth->fd, d->req, d->reqlen, 0);
+	if (d->strict)
+		setsockopt(rth->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK,
+			   &zero, sizeof(zero));
+	if (ret < 0)
+		perror("Cannot send dump request");
+	return ret;
+}
+
+static int rtnl_dump_push(struct rtnl_dump_state *d, struct nlmsghdr *h)
+{
+	if (d->msgc == d->msgmax) {
+		unsigned int max = d->msgmax ? d->msgmax * 2 : 256;
+		struct nlmsghdr **v = realloc(d->msgv, max * sizeof(*v));
+
+		if (v == NULL)
+			return -1;
+		d->msgv = v;
+		d->msgmax = max;
+	}
+	d->msgv[d->msgc++] = h;
+	return 0;
+}
+
+static int rtnl_dump_hold(struct rtnl_dump_state *d, const struct nlmsghdr *h)
+{
+	size_t len = NLMSG_ALIGN(h->nlmsg_len);
+
+	if (d->snaplen + len > d->snapsize) {
+		size_t size = d->snapsize ? d->snapsize : 65536;
+		char *snap;
+
+		while (size < d->snaplen + len)
+			size *= 2;
+		snap = realloc(d->snap, size);
+		if (snap == NULL)
+			return -1;
+		d->snap = snap;
+		d->snapsize = size;
+	}
+	memcpy(d->snap + d->snaplen, h, h->nlmsg_len);
+	d->snaplen += len;
+	return 0;
+}
+
+static int rtnl_dump_deliver(const struct rtnl_dump_filter_arg *arg,
+			     const struct sockaddr_nl *nladdr,
+			     struct nlmsghdr **msgv, unsigned int msgc)
+{
+	const struct rtnl_dump_filter_arg *a;
+	unsigned int i;
+	int err;
+
+	for (a = arg; a->filter; a++) {
+		for (i = 0; i < msgc; i++) {
+			rtnl_stats.msgs++;
+			err = a->filter(nladdr, msgv[i], a->arg1);
+			if (err < 0)
+				return err;
+		}
+	}
+	return 0;
+}
+
+/* Returns <0 on error, 1 once NLMSG_DONE is seen and 0 otherwise. */
+static int rtnl_dump_datagram(struct rtnl_handle *rth,
+			      const struct rtnl_dump_filter_arg *arg,
+			      struct sockaddr_nl *nladdr, char *buf,
+			      int status, int msg_flags)
+{
+	struct rtnl_dump_state *d = rth->dstate;
+	struct nlmsghdr *h = (struct nlmsghdr*)buf;
+	int hold = rth->flags & RTNL_HANDLE_F_DUMP_CONSISTENT;
+	int single = arg[0].filter == NULL || arg[1].filter == NULL;
+	int found_done = 0;
+	int msglen = status;
+	int err;
+
+	d->msgc = 0;
+	while (NLMSG_OK(h, msglen)) {
+		if (nladdr->nl_pid != 0 ||
+		    h->nlmsg_pid != rth->local.nl_pid ||
+		    h->nlmsg_seq != rth->dump) {
+			rtnl_stats.skipped++;
+			goto skip_it;
+		}
+
+		if (h->nlmsg_type == NLMSG_DONE) {
+			found_done = 1;
+			break;
+		}
+		if (h->nlmsg_type == NLMSG_ERROR) {
+			struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+			if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+				fprintf(stderr,
+					"ERROR truncated\n");
+			} else if (err->error == -ENOENT && d->strict) {
+				/* The filter of a strict dump names something
+				 * that does not exist (a routing table, say):
+				 * as after a plain dump, there is nothing.
+				 */
+				found_done = 1;
+				break;
+			} else {
+				errno = -err->error;
+				if (!(rth->flags & RTNL_HANDLE_F_SUPPRESS_NLERR))
+					perror("RTNETLINK answers");
+			}
+			return -1;
+		}
+		if (h->nlmsg_flags & NLM_F_DUMP_INTR)
+			d->intr = 1;
+
+		if (hold) {
+			if (rtnl_dump_hold(d, h) < 0)
+				goto oom;
+		} else if (single) {
+			if (arg[0].filter == NULL)
+				goto skip_it;
+			rtnl_stats.msgs++;
+			err = arg[0].filter(nladdr, h, arg[0].arg1);
+			if (err < 0)
+				return err;
+		} else if (rtnl_dump_push(d, h) < 0) {
+			goto oom;
+		}
+
+skip_it:
+		h = NLMSG_NEXT(h, msglen);
+	}
+
+	if (d->msgc) {
+		err = rtnl_dump_deliver(arg, nladdr, d->msgv, d->msgc);
+		if (err < 0)
+			return err;
+	}
+
+	if (found_done)
+		return 1;
+
+	if (msg_flags & MSG_TRUNC) {
+		fprintf(stderr, "Message truncated\n");
+		return 0;
+	}
+	if (msglen) {
+		fprintf(stderr, "!!!Remnant of size %d\n", msglen);
+		return -1;
+	}
+	return 0;
+oom:
+	perror("Cannot hold dump");
+	return -1;
+}
+
+/* At NLMSG_DONE: returns 1 if the dump was asked for again, 0 once it
+ * is complete and <0 on error.
+ */
+static int rtnl_dump_done(struct rtnl_handle *rth,
+			  const struct rtnl_dump_filter_arg *arg)
+{
+	static const struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct rtnl_dump_state *d = rth->dstate;
+	size_t pos;
+	int err;
+
+	if (!(rth->flags & RTNL_HANDLE_F_DUMP_CONSISTENT)) {
+		if (d->intr)
+			fprintf(stderr, "Dump was interrupted and may be inconsistent\n");
+		return 0;
+	}
+
+	if (d->intr && d->reqlen && d->restarts < RTNL_DUMP_RESTARTS) {
+		d->restarts++;
+		d->intr = 0;
+		d->snaplen = 0;
+		return rtnl_dump_resend(rth) < 0 ? -1 : 1;
+	}
+	if (d->intr)
+		fprintf(stderr, "Dump still inconsistent after %d restarts\n",
+			d->restarts);
+
+	d->msgc = 0;
+	for (pos = 0; pos < d->snaplen;
+	     pos += NLMSG_ALIGN(((struct nlmsghdr *)(d->snap + pos))->nlmsg_len))
+		if (rtnl_dump_push(d, (struct nlmsghdr *)(d->snap + pos)) < 0) {
+			perror("Cannot hold dump");
+			return -1;
+		}
+	err = rtnl_dump_deliver(arg, &nladdr, d->msgv, d->msgc);
+	d->snaplen = 0;
+	return err < 0 ? err : 0;
+}
+
+static int rtnl_dump_filter_loop(struct rtnl_handle *rth,
+				 const struct rtnl_dump_filter_arg *arg)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
 	struct iovec iov;
 	struct msghdr msg = {
 		.msg_name = &nladdr,
@@ -187,17 +787,68 @@ int rtnl_dump_filter_l(struct rtnl_handle *rth,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char buf[16384];
 
-	iov.iov_base = buf;
+	if (rth->replay)
+		return rtnl_replay_dump(rth, arg);
+
+	if (rtnl_dump_state(rth) == NULL) {
+		perror("Cannot allocate dump state");
+		return -1;
+	}
+	rth->dstate->intr = 0;
+	rth->dstate->restarts = 0;
+	rth->dstate->snaplen = 0;
+
 	while (1) {
 		int status;
-		const struct rtnl_dump_filter_arg *a;
-		int found_done = 0;
-		int msglen = 0;
+		int phase;
+		int err;
+
+#ifdef HAVE_RECVMMSG
+		if (rth->batch > 1) {
+			struct rtnl_ring *ring;
+			int i;
+
+			status = rtnl_recvmmsg(rth, rth->batch);
+			if (status < 0) {
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				if (errno == ENOSYS) {
+					rth->batch = 0;
+					continue;
+				}
+				fprintf(stderr, "netlink receive error %s (%d)\n",
+					strerror(errno), errno);
+				return -1;
+			}
+			if (status == 0) {
+				fprintf(stderr, "EOF on netlink\n");
+				return -1;
+			}
 
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rth->fd, &msg, 0);
+			PROBE2(dump_batch, rth->dump, status);
+			ring = rth->ring;
+			phase = rtnl_phase_dump(RTNL_PHASE_FILTER);
+			for (i = 0; i < status; i++) {
+				err = rtnl_dump_datagram(rth, arg, &ring->addr[i],
+							 ring->iov[i].iov_base,
+							 ring->msgs[i].msg_len,
+							 ring->msgs[i].msg_hdr.msg_flags);
+				if (err > 0) {
+					/* The rest is of the old dump, if any */
+					err = rtnl_dump_done(rth, arg);
+					if (err <= 0)
+						return err;
+					break;
+				}
+				if (err < 0)
+					return err;
+			}
+			rtnl_phase(phase);
+			continue;
+		}
+#endif
+		status = rtnl_recvmsg(rth, &msg);
 
 		if (status < 0) {
 			if (errno == EINTR || errno == EAGAIN)
@@ -212,70 +863,394 @@ int rtnl_dump_filter_l(struct rtnl_handle *rth,
 			return -1;
 		}
 
-		for (a = arg; a->filter; a++) {
-			struct nlmsghdr *h = (struct nlmsghdr*)buf;
-			msglen = status;
+		PROBE2(dump_batch, rth->dump, 1);
+		phase = rtnl_phase_dump(RTNL_PHASE_FILTER);
+		err = rtnl_dump_datagram(rth, arg, &nladdr, rth->buf, status,
+					 msg.msg_flags);
+		if (err > 0) {
+			err = rtnl_dump_done(rth, arg);
+			if (err <= 0)
+				return err;
+		} else if (err < 0) {
+			return err;
+		}
+		rtnl_phase(phase);
+	}
+}
+
+int rtnl_dump_filter_l(struct rtnl_handle *rth,
+		       const struct rtnl_dump_filter_arg *arg)
+{
+	int phase = rtnl_phase_dump(RTNL_PHASE_DUMP);
+	int ret;
+
+	PROBE1(dump_entry, rth->dump);
+	ret = rtnl_dump_filter_loop(rth, arg);
+	PROBE2(dump_exit, rth->dump, ret);
+	rtnl_phase(phase);
+	return ret;
+}
+
+int rtnl_dump_filter(struct rtnl_handle *rth,
+		     rtnl_filter_t filter,
+		     void *arg1)
+{
+	const struct rtnl_dump_filter_arg a[2] = {
+		{ .filter = filter, .arg1 = arg1, },
+		{ .filter = NULL,   .arg1 = NULL, },
+	};
 
-			while (NLMSG_OK(h, msglen)) {
-				int err;
+	return rtnl_dump_filter_l(rth, a);
+}
 
-				if (nladdr.nl_pid != 0 ||
-				    h->nlmsg_pid != rth->local.nl_pid ||
-				    h->nlmsg_seq != rth->dump)
-					goto skip_it;
+struct rtnl_pipeline
+{
+	unsigned int		window;
+	unsigned int		head;
+	unsigned int		count;
+	int			cookie;
+	rtnl_ack_error_t	handler;
+	void			*arg;
+	char			*sndbuf;
+	unsigned int		sndsize;
+	unsigned int		sndlen;
+	unsigned int		unsent;
+	unsigned int		errors;
+	int			noack;
+	unsigned int		quiet;		/* sent without ACK in a row */
+	struct {
+		__u32		seq;
+		int		cookie;
+		int		acked;
+	} slot[0];
+};
+
+int rtnl_pipeline_open(struct rtnl_handle *rth, unsigned int window,
+		       rtnl_ack_error_t handler, void *arg)
+{
+	struct rtnl_pipeline *pipe;
 
-				if (h->nlmsg_type == NLMSG_DONE) {
-					found_done = 1;
-					break; /* process next filter */
-				}
-				if (h->nlmsg_type == NLMSG_ERROR) {
-					struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-					if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
-						fprintf(stderr,
-							"ERROR truncated\n");
-					} else {
-						errno = -err->error;
-						perror("RTNETLINK answers");
-					}
-					return -1;
-				}
-				err = a->filter(&nladdr, h, a->arg1);
-				if (err < 0)
-					return err;
+	if (window == 0 || rth->pipe)
+		return -1;
 
-skip_it:
-				h = NLMSG_NEXT(h, msglen);
-			}
+	pipe = calloc(1, sizeof(*pipe) + window * sizeof(pipe->slot[0]));
+	if (pipe == NULL)
+		return -1;
+
+	pipe->window = window;
+	pipe->handler = handler;
+	pipe->arg = arg;
+	rth->pipe = pipe;
+	return 0;
+}
+
+void rtnl_pipeline_cookie(struct rtnl_handle *rth, int cookie)
+{
+	if (rth->pipe)
+		rth->pipe->cookie = cookie;
+}
+
+/* Leave NLM_F_ACK off pipelined creates and replaces: the kernel only
+ * answers them if they fail.  Every window-th request still asks for an
+ * ACK, and waits for all outstanding requests end with an ACKed no-op,
+ * so that silence can be told from success.
+ */
+int rtnl_pipeline_noack(struct rtnl_handle *rth)
+{
+	if (rth->pipe == NULL)
+		return -1;
+	rth->pipe->noack = 1;
+	return 0;
+}
+
+/* Queue pipelined requests in a buffer of up to size bytes and write
+ * them to the kernel with a single send().
+ */
+int rtnl_pipeline_coalesce(struct rtnl_handle *rth, unsigned int size)
+{
+	struct rtnl_pipeline *pipe = rth->pipe;
+	int sndbuf = size;
+	socklen_t len = sizeof(sndbuf);
+
+	if (pipe == NULL || pipe->sndbuf || size < NLMSG_HDRLEN)
+		return -1;
+
+	/* Writes larger than the socket send buffer are rejected */
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0 ||
+	    getsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0) {
+		perror("SO_SNDBUF");
+		return -1;
+	}
+	if (sndbuf - 32 < size)
+		size = sndbuf - 32;
+
+	pipe->sndbuf = malloc(size);
+	if (pipe->sndbuf == NULL)
+		return -1;
+	pipe->sndsize = size;
+	return 0;
+}
+
+static int rtnl_pipeline_flush(struct rtnl_handle *rth)
+{
+	struct rtnl_pipeline *pipe = rth->pipe;
+	int status;
+
+	if (pipe == NULL || pipe->sndlen == 0)
+		return 0;
+
+	rtnl_stats.sendmsg++;
+	status = send(rth->fd, pipe->sndbuf, pipe->sndlen, 0);
+	pipe->sndlen = 0;
+	if (status < 0) {
+		int error = errno;
+
+		perror("Cannot talk to rtnetlink");
+		/* Nothing will ever acknowledge the queued requests */
+		while (pipe->unsent) {
+			unsigned int i = (pipe->head + pipe->count - 1) % pipe->window;
+
+			if (pipe->handler)
+				pipe->handler(pipe->slot[i].cookie, error, pipe->arg);
+			pipe->count--;
+			pipe->unsent--;
+			pipe->errors++;
 		}
+		return -1;
+	}
+	pipe->unsent = 0;
+	return 0;
+}
 
-		if (found_done)
-			return 0;
+int rtnl_pipeline_close(struct rtnl_handle *rth)
+{
+	int ret;
+
+	ret = rtnl_pipeline_wait(rth, 0);
+	if (rth->pipe)
+		free(rth->pipe->sndbuf);
+	free(rth->pipe);
+	rth->pipe = NULL;
+	return ret;
+}
 
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
+/* Wait for all outstanding ACKs; returns the number of requests that
+ * failed since the last sync, or -1 if the wait itself failed.
+ */
+int rtnl_pipeline_sync(struct rtnl_handle *rth)
+{
+	unsigned int errors;
+
+	if (rth->pipe == NULL)
+		return 0;
+	if (rtnl_pipeline_wait(rth, 0) < 0)
+		return -1;
+	errors = rth->pipe->errors;
+	rth->pipe->errors = 0;
+	return errors;
+}
+
+/* ACKs come back in the order the requests were sent, so every slot
+ * older than the acknowledged sequence number can be retired as well.
+ */
+static void rtnl_pipeline_ack(struct rtnl_pipeline *pipe, struct nlmsghdr *h)
+{
+	struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+
+	while (pipe->count) {
+		__s32 delta = h->nlmsg_seq - pipe->slot[pipe->head].seq;
+		int cookie = pipe->slot[pipe->head].cookie;
+		int error;
+
+		if (delta < 0)
+			return;
+
+		pipe->head = (pipe->head + 1) % pipe->window;
+		pipe->count--;
+		if (delta > 0)
+			continue;
+
+		if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+			fprintf(stderr, "ERROR truncated\n");
+			error = EBADMSG;
+		} else
+			error = -err->error;
+
+		if (error == 0)
+			return;
+		pipe->errors++;
+		if (pipe->handler)
+			pipe->handler(cookie, error, pipe->arg);
+		else
+			fprintf(stderr, "RTNETLINK answers: %s\n",
+				strerror(error));
+		return;
+	}
+}
+
+static void rtnl_pipeline_datagram(struct rtnl_handle *rth,
+				   struct sockaddr_nl *nladdr,
+				   char *buf, int status)
+{
+	struct nlmsghdr *h;
+
+	if (nladdr->nl_pid != 0)
+		return;
+
+	for (h = (struct nlmsghdr*)buf; NLMSG_OK(h, status);
+	     h = NLMSG_NEXT(h, status)) {
+		if (h->nlmsg_pid != rth->local.nl_pid ||
+		    h->nlmsg_type != NLMSG_ERROR)
 			continue;
+		rtnl_pipeline_ack(rth->pipe, h);
+	}
+}
+
+/* Nothing acknowledges the newest requests sent without NLM_F_ACK but
+ * the ACK of a later message; send one that does nothing.
+ */
+static int rtnl_pipeline_barrier(struct rtnl_handle *rth)
+{
+	struct rtnl_pipeline *pipe = rth->pipe;
+	struct nlmsghdr n = {
+		.nlmsg_len	= NLMSG_HDRLEN,
+		.nlmsg_type	= NLMSG_NOOP,
+		.nlmsg_flags	= NLM_F_REQUEST | NLM_F_ACK,
+	};
+
+	if (pipe->count == 0 ||
+	    pipe->slot[(pipe->head + pipe->count - 1) % pipe->window].acked)
+		return 0;
+
+	n.nlmsg_seq = ++rth->seq;
+	pipe->quiet = 0;
+	if (pipe->sndbuf && pipe->sndlen + NLMSG_HDRLEN <= pipe->sndsize) {
+		memcpy(pipe->sndbuf + pipe->sndlen, &n, NLMSG_HDRLEN);
+		pipe->sndlen += NLMSG_HDRLEN;
+		return 0;
+	}
+	if (rtnl_pipeline_flush(rth) < 0)
+		return -1;
+	rtnl_stats.sendmsg++;
+	if (send(rth->fd, &n, n.nlmsg_len, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		return -1;
+	}
+	return 0;
+}
+
+/* Collect ACKs until no more than target requests are outstanding. */
+static int rtnl_pipeline_wait(struct rtnl_handle *rth, unsigned int target)
+{
+	struct rtnl_pipeline *pipe = rth->pipe;
+	struct sockaddr_nl nladdr;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	if (pipe && pipe->noack && target == 0 &&
+	    rtnl_pipeline_barrier(rth) < 0)
+		return -1;
+	if (rtnl_pipeline_flush(rth) < 0)
+		return -1;
+
+	while (pipe && pipe->count > target) {
+		int status;
+
+#ifdef HAVE_RECVMMSG
+		if (rth->batch != 1) {
+			struct rtnl_ring *ring;
+			int i;
+
+			status = rtnl_recvmmsg(rth, rth->batch > 1 ?
+					       rth->batch : RTNL_DEFAULT_BATCH);
+			if (status < 0 && errno == ENOSYS) {
+				rth->batch = 1;
+				continue;
+			}
+			if (status > 0) {
+				ring = rth->ring;
+				for (i = 0; i < status; i++)
+					rtnl_pipeline_datagram(rth, &ring->addr[i],
+							       ring->iov[i].iov_base,
+							       ring->msgs[i].msg_len);
+				continue;
+			}
+		} else
+#endif
+		{
+			status = rtnl_recvmsg(rth, &msg);
+			if (status > 0) {
+				rtnl_pipeline_datagram(rth, &nladdr, rth->buf,
+						       status);
+				continue;
+			}
 		}
-		if (msglen) {
-			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
-			exit(1);
+
+		if (status < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			return -1;
 		}
+		fprintf(stderr, "EOF on netlink\n");
+		return -1;
 	}
+	return 0;
 }
 
-int rtnl_dump_filter(struct rtnl_handle *rth,
-		     rtnl_filter_t filter,
-		     void *arg1)
+static int rtnl_pipeline_send(struct rtnl_handle *rth, struct nlmsghdr *n)
 {
-	const struct rtnl_dump_filter_arg a[2] = {
-		{ .filter = filter, .arg1 = arg1, },
-		{ .filter = NULL,   .arg1 = NULL, },
-	};
+	struct rtnl_pipeline *pipe = rth->pipe;
+	unsigned int tail;
 
-	return rtnl_dump_filter_l(rth, a);
+	if (pipe->count >= pipe->window &&
+	    rtnl_pipeline_wait(rth, pipe->window - 1) < 0)
+		return -1;
+
+	n->nlmsg_seq = ++rth->seq;
+	if (pipe->noack && (n->nlmsg_flags & NLM_F_CREATE) &&
+	    pipe->quiet + 1 < pipe->window) {
+		n->nlmsg_flags &= ~NLM_F_ACK;
+		pipe->quiet++;
+	} else {
+		n->nlmsg_flags |= NLM_F_ACK;
+		pipe->quiet = 0;
+	}
+
+	if (pipe->sndlen + NLMSG_ALIGN(n->nlmsg_len) > pipe->sndsize &&
+	    rtnl_pipeline_flush(rth) < 0)
+		return -1;
+
+	if (NLMSG_ALIGN(n->nlmsg_len) <= pipe->sndsize) {
+		memcpy(pipe->sndbuf + pipe->sndlen, n, n->nlmsg_len);
+		memset(pipe->sndbuf + pipe->sndlen + n->nlmsg_len, 0,
+		       NLMSG_ALIGN(n->nlmsg_len) - n->nlmsg_len);
+		pipe->sndlen += NLMSG_ALIGN(n->nlmsg_len);
+		pipe->unsent++;
+	} else {
+		rtnl_stats.sendmsg++;
+		if (send(rth->fd, n, n->nlmsg_len, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			return -1;
+		}
+	}
+
+	tail = (pipe->head + pipe->count) % pipe->window;
+	pipe->slot[tail].seq = n->nlmsg_seq;
+	pipe->slot[tail].cookie = pipe->cookie;
+	pipe->slot[tail].acked = !!(n->nlmsg_flags & NLM_F_ACK);
+	pipe->count++;
+	return 0;
 }
 
-int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
-	      unsigned groups, struct nlmsghdr *answer)
+static int rtnl_talk_wait(struct rtnl_handle *rtnl, struct nlmsghdr *n,
+			  pid_t peer, unsigned groups, struct nlmsghdr *answer)
 {
 	int status;
 	unsigned seq;
@@ -293,6 +1268,16 @@ int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 	};
 	char   buf[16384];
 
+	if (rtnl->replay)
+		return rtnl_replay_request(rtnl, -1, NULL, 0);
+
+	if (rtnl->pipe) {
+		if (answer == NULL && peer == 0 && groups == 0)
+			return rtnl_pipeline_send(rtnl, n);
+		if (rtnl_pipeline_wait(rtnl, 0) < 0)
+			return -1;
+	}
+
 	memset(&nladdr, 0, sizeof(nladdr));
 	nladdr.nl_family = AF_NETLINK;
 	nladdr.nl_pid = peer;
@@ -303,6 +1288,7 @@ int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 	if (answer == NULL)
 		n->nlmsg_flags |= NLM_F_ACK;
 
+	rtnl_stats.sendmsg++;
 	status = sendmsg(rtnl->fd, &msg, 0);
 
 	if (status < 0) {
@@ -312,82 +1298,375 @@ int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 
 	memset(buf,0,sizeof(buf));
 
-	iov.iov_base = buf;
+	iov.iov_base = buf;
+
+	while (1) {
+		iov.iov_len = sizeof(buf);
+		rtnl_stats.recvmsg++;
+		status = recvmsg(rtnl->fd, &msg, 0);
+
+		if (status < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			return -1;
+		}
+		if (status == 0) {
+			fprintf(stderr, "EOF on netlink\n");
+			return -1;
+		}
+		if (msg.msg_namelen != sizeof(nladdr)) {
+			fprintf(stderr, "sender address length == %d\n", msg.msg_namelen);
+			exit(1);
+		}
+		for (h = (struct nlmsghdr*)buf; status >= sizeof(*h); ) {
+			int len = h->nlmsg_len;
+			int l = len - sizeof(*h);
+
+			if (l < 0 || len>status) {
+				if (msg.msg_flags & MSG_TRUNC) {
+					fprintf(stderr, "Truncated message\n");
+					return -1;
+				}
+				fprintf(stderr, "!!!malformed message: len=%d\n", len);
+				exit(1);
+			}
+
+			if (nladdr.nl_pid != peer ||
+			    h->nlmsg_pid != rtnl->local.nl_pid ||
+			    h->nlmsg_seq != seq) {
+				/* Don't forget to skip that message. */
+				status -= NLMSG_ALIGN(len);
+				h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
+				continue;
+			}
+
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+				if (l < sizeof(struct nlmsgerr)) {
+					fprintf(stderr, "ERROR truncated\n");
+				} else {
+					errno = -err->error;
+					if (errno == 0) {
+						if (answer)
+							memcpy(answer, h, h->nlmsg_len);
+						return 0;
+					}
+					perror("RTNETLINK answers");
+				}
+				return -1;
+			}
+			if (answer) {
+				memcpy(answer, h, h->nlmsg_len);
+				return 0;
+			}
+
+			fprintf(stderr, "Unexpected reply!!!\n");
+
+			status -= NLMSG_ALIGN(len);
+			h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
+		}
+		if (msg.msg_flags & MSG_TRUNC) {
+			fprintf(stderr, "Message truncated\n");
+			continue;
+		}
+		if (status) {
+			fprintf(stderr, "!!!Remnant of size %d\n", status);
+			exit(1);
+		}
+	}
+}
+
+int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
+	      unsigned groups, struct nlmsghdr *answer)
+{
+	int ret;
+
+	if (rtnl->record) {
+		if (answer) {
+			errno = EOPNOTSUPP;
+			return -1;
+		}
+		return rtnl->record(n, rtnl->record_arg);
+	}
+
+	PROBE2(talk_entry, n->nlmsg_type, n->nlmsg_flags);
+	ret = rtnl_talk_wait(rtnl, n, peer, groups, answer);
+	PROBE2(talk_exit, n->nlmsg_seq, ret);
+	return ret;
+}
+
+/* Hand every message of one datagram to the listen handler. */
+static int rtnl_listen_datagram(rtnl_filter_t handler, void *jarg,
+				struct sockaddr_nl *nladdr, socklen_t namelen,
+				char *buf, int status, int msg_flags)
+{
+	struct nlmsghdr *h;
+
+	if (namelen != sizeof(*nladdr)) {
+		fprintf(stderr, "Sender address length == %d\n", namelen);
+		exit(1);
+	}
+	for (h = (struct nlmsghdr*)buf; status >= sizeof(*h); ) {
+		int err;
+		int len = h->nlmsg_len;
+		int l = len - sizeof(*h);
+
+		if (l<0 || len>status) {
+			if (msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "Truncated message\n");
+				return -1;
+			}
+			fprintf(stderr, "!!!malformed message: len=%d\n", len);
+			exit(1);
+		}
+
+		err = handler(nladdr, h, jarg);
+		if (err < 0)
+			return err;
+
+		status -= NLMSG_ALIGN(len);
+		h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
+	}
+	if (msg_flags & MSG_TRUNC) {
+		fprintf(stderr, "Message truncated\n");
+		return 0;
+	}
+	if (status) {
+		fprintf(stderr, "!!!Remnant of size %d\n", status);
+		exit(1);
+	}
+	return 0;
+}
+
+struct rtnl_mmap_ring
+{
+	void			*base;
+	size_t			size;
+	unsigned int		block_size;
+	unsigned int		frame_size;
+	unsigned int		frames_per_block;
+	unsigned int		frame_nr;
+	unsigned int		head;
+};
+
+static void rtnl_rx_ring_free(struct rtnl_handle *rth)
+{
+	struct rtnl_mmap_ring *ring = rth->rx_ring;
+
+	if (ring == NULL)
+		return;
+	munmap(ring->base, ring->size);
+	free(ring);
+	rth->rx_ring = NULL;
+}
+
+/* Map a NETLINK_RX_RING of frame_nr frames of frame_size bytes so that
+ * rtnl_listen() can hand messages to its handler straight from the
+ * ring.  Must be called after any dump on the socket is finished, as
+ * dump replies would be delivered to the ring too.  Fails with
+ * ENOPROTOOPT on kernels without netlink mmap support; the handle then
+ * keeps using ordinary receives.
+ */
+int rtnl_rx_ring_setup(struct rtnl_handle *rth, unsigned int frame_size,
+		       unsigned int frame_nr)
+{
+	struct rtnl_mmap_ring *ring;
+	struct nl_mmap_req req;
+	unsigned int page = getpagesize();
+
+	if (rth->rx_ring || frame_nr == 0 ||
+	    frame_size < NL_MMAP_HDRLEN + NLMSG_HDRLEN) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (rth->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	frame_size = NL_MMAP_MSG_ALIGN(frame_size);
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return -1;
+
+	ring->frame_size = frame_size;
+	ring->block_size = (frame_size + page - 1) & ~(page - 1);
+	ring->frames_per_block = ring->block_size / frame_size;
+	ring->frame_nr = (frame_nr + ring->frames_per_block - 1) /
+		ring->frames_per_block * ring->frames_per_block;
+	ring->size = (size_t)ring->block_size *
+		(ring->frame_nr / ring->frames_per_block);
+
+	req.nm_block_size = ring->block_size;
+	req.nm_block_nr = ring->frame_nr / ring->frames_per_block;
+	req.nm_frame_size = ring->frame_size;
+	req.nm_frame_nr = ring->frame_nr;
+
+	if (setsockopt(rth->fd, SOL_NETLINK, NETLINK_RX_RING,
+		       &req, sizeof(req)) < 0) {
+		free(ring);
+		return -1;
+	}
+
+	ring->base = mmap(NULL, ring->size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, rth->fd, 0);
+	if (ring->base == MAP_FAILED) {
+		int err = errno;
+
+		memset(&req, 0, sizeof(req));
+		setsockopt(rth->fd, SOL_NETLINK, NETLINK_RX_RING,
+			   &req, sizeof(req));
+		free(ring);
+		errno = err;
+		return -1;
+	}
+
+	memset(&rth->rx_stats, 0, sizeof(rth->rx_stats));
+	rth->rx_ring = ring;
+	return 0;
+}
+
+/* Have rtnl_listen() receive the events of the namespaces that have an
+ * nsid here as well, setting rth->nsid for each datagram.  The nsid
+ * comes in a control message, which ring frames have no room for, so
+ * this has to be asked for before rtnl_rx_ring_setup(), which then
+ * leaves the handle with ordinary receives.
+ */
+int rtnl_listen_all_nsid(struct rtnl_handle *rth)
+{
+	int on = 1;
+
+	if (rth->rx_ring) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (setsockopt(rth->fd, SOL_NETLINK, NETLINK_LISTEN_ALL_NSID,
+		       &on, sizeof(on)) < 0)
+		return -1;
+	rth->flags |= RTNL_HANDLE_F_LISTEN_ALL_NSID;
+	return 0;
+}
+
+static struct nl_mmap_hdr *rtnl_rx_frame(struct rtnl_mmap_ring *ring)
+{
+	unsigned int block = ring->head / ring->frames_per_block;
+	unsigned int frame = ring->head % ring->frames_per_block;
+
+	return ring->base + (size_t)block * ring->block_size +
+		frame * ring->frame_size;
+}
+
+static void rtnl_rx_frame_release(struct rtnl_mmap_ring *ring,
+				  struct nl_mmap_hdr *hdr)
+{
+	hdr->nm_status = NL_MMAP_STATUS_UNUSED;
+	ring->head = (ring->head + 1) % ring->frame_nr;
+}
+
+static int rtnl_listen_ring(struct rtnl_handle *rtnl, rtnl_filter_t handler,
+			    void *jarg)
+{
+	struct rtnl_mmap_ring *ring = rtnl->rx_ring;
+	struct sockaddr_nl nladdr;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
 
 	while (1) {
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rtnl->fd, &msg, 0);
+		struct nl_mmap_hdr *hdr = rtnl_rx_frame(ring);
+		struct pollfd pfd = {
+			.fd = rtnl->fd,
+			.events = POLLIN | POLLERR,
+		};
+		int status, err;
+
+		switch (hdr->nm_status) {
+		case NL_MMAP_STATUS_VALID:
+			rtnl->rx_stats.frames++;
+			memset(&nladdr, 0, sizeof(nladdr));
+			nladdr.nl_family = AF_NETLINK;
+			nladdr.nl_pid = hdr->nm_pid;
+			nladdr.nl_groups = hdr->nm_group;
+			err = 0;
+			if (hdr->nm_len)
+				err = rtnl_listen_datagram(handler, jarg, &nladdr,
+							   sizeof(nladdr),
+							   (char *)hdr + NL_MMAP_HDRLEN,
+							   hdr->nm_len, 0);
+			rtnl_rx_frame_release(ring, hdr);
+			if (err < 0)
+				return err;
+			continue;
 
-		if (status < 0) {
-			if (errno == EINTR || errno == EAGAIN)
+		case NL_MMAP_STATUS_COPY:
+			/* Too large for a frame, queued for a normal receive */
+			rtnl->rx_stats.copied++;
+			msg.msg_namelen = sizeof(nladdr);
+			status = rtnl_recvmsg(rtnl, &msg);
+			rtnl_rx_frame_release(ring, hdr);
+			if (status > 0) {
+				err = rtnl_listen_datagram(handler, jarg, &nladdr,
+							   msg.msg_namelen,
+							   rtnl->buf, status,
+							   msg.msg_flags);
+				if (err < 0)
+					return err;
 				continue;
-			fprintf(stderr, "netlink receive error %s (%d)\n",
-				strerror(errno), errno);
-			return -1;
-		}
-		if (status == 0) {
-			fprintf(stderr, "EOF on netlink\n");
-			return -1;
-		}
-		if (msg.msg_namelen != sizeof(nladdr)) {
-			fprintf(stderr, "sender address length == %d\n", msg.msg_namelen);
-			exit(1);
-		}
-		for (h = (struct nlmsghdr*)buf; status >= sizeof(*h); ) {
-			int len = h->nlmsg_len;
-			int l = len - sizeof(*h);
-
-			if (l < 0 || len>status) {
-				if (msg.msg_flags & MSG_TRUNC) {
-					fprintf(stderr, "Truncated message\n");
-					return -1;
-				}
-				fprintf(stderr, "!!!malformed message: len=%d\n", len);
-				exit(1);
 			}
+			break;
 
-			if (nladdr.nl_pid != peer ||
-			    h->nlmsg_pid != rtnl->local.nl_pid ||
-			    h->nlmsg_seq != seq) {
-				/* Don't forget to skip that message. */
-				status -= NLMSG_ALIGN(len);
-				h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
-				continue;
-			}
+		case NL_MMAP_STATUS_SKIP:
+			rtnl_rx_frame_release(ring, hdr);
+			continue;
 
-			if (h->nlmsg_type == NLMSG_ERROR) {
-				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-				if (l < sizeof(struct nlmsgerr)) {
-					fprintf(stderr, "ERROR truncated\n");
-				} else {
-					errno = -err->error;
-					if (errno == 0) {
-						if (answer)
-							memcpy(answer, h, h->nlmsg_len);
-						return 0;
-					}
-					perror("RTNETLINK answers");
-				}
-				return -1;
+		default:
+			status = poll(&pfd, 1, rtnl->idle ? rtnl->idle_timeout : -1);
+			if (status == 0 && rtnl->idle) {
+				err = rtnl->idle(jarg);
+				if (err < 0)
+					return err;
+				continue;
 			}
-			if (answer) {
-				memcpy(answer, h, h->nlmsg_len);
-				return 0;
+			if (status > 0 && !(pfd.revents & POLLERR))
+				continue;
+			if (status > 0) {
+				socklen_t len = sizeof(err);
+
+				if (getsockopt(rtnl->fd, SOL_SOCKET, SO_ERROR,
+					       &err, &len) == 0 && err) {
+					status = -1;
+					errno = err;
+				} else
+					continue;
 			}
+			break;
+		}
 
-			fprintf(stderr, "Unexpected reply!!!\n");
-
-			status -= NLMSG_ALIGN(len);
-			h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
+		if (status == 0) {
+			fprintf(stderr, "EOF on netlink\n");
+			return -1;
 		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
+		if (errno == EINTR || errno == EAGAIN)
+			continue;
+		fprintf(stderr, "netlink receive error %s (%d)\n",
+			strerror(errno), errno);
+		if (errno == ENOBUFS) {
+			rtnl->rx_stats.overruns++;
+			fprintf(stderr, "netlink ring: %llu frames, %llu copied, %llu overruns\n",
+				(unsigned long long)rtnl->rx_stats.frames,
+				(unsigned long long)rtnl->rx_stats.copied,
+				(unsigned long long)rtnl->rx_stats.overruns);
+			if (rtnl->resync && (err = rtnl->resync(jarg)) < 0)
+				return err;
 			continue;
 		}
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
-		}
+		return -1;
 	}
 }
 
@@ -396,7 +1675,7 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 		void *jarg)
 {
 	int status;
-	struct nlmsghdr *h;
+	int err;
 	struct sockaddr_nl nladdr;
 	struct iovec iov;
 	struct msghdr msg = {
@@ -405,65 +1684,253 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char   buf[8192];
+	union {
+		char		buf[RTNL_NSID_CTRLLEN];
+		struct cmsghdr	align;
+	} ctrl;
+	int all_nsid = rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID;
 
 	memset(&nladdr, 0, sizeof(nladdr));
 	nladdr.nl_family = AF_NETLINK;
 	nladdr.nl_pid = 0;
 	nladdr.nl_groups = 0;
+	rtnl->nsid = -1;
+
+	if (rtnl_pipeline_wait(rtnl, 0) < 0)
+		return -1;
+
+	if (rtnl->replay)
+		return rtnl_replay_request(rtnl, -1, NULL, 0);
+
+	if (rtnl->rx_ring)
+		return rtnl_listen_ring(rtnl, handler, jarg);
+
+	if (rtnl->idle) {
+		struct timeval tv = {
+			.tv_sec = rtnl->idle_timeout / 1000,
+			.tv_usec = (rtnl->idle_timeout % 1000) * 1000,
+		};
+
+		if (setsockopt(rtnl->fd, SOL_SOCKET, SO_RCVTIMEO,
+			       &tv, sizeof(tv)) < 0) {
+			perror("SO_RCVTIMEO");
+			return -1;
+		}
+	}
 
-	iov.iov_base = buf;
 	while (1) {
-		iov.iov_len = sizeof(buf);
-		status = recvmsg(rtnl->fd, &msg, 0);
+#ifdef HAVE_RECVMMSG
+		if (rtnl->batch > 1) {
+			struct rtnl_ring *ring;
+			int i;
+
+			status = rtnl_recvmmsg(rtnl, rtnl->batch);
+			if (status < 0) {
+				if (errno == EAGAIN && rtnl->idle) {
+					err = rtnl->idle(jarg);
+					if (err < 0)
+						return err;
+					continue;
+				}
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				if (errno == ENOSYS) {
+					rtnl->batch = 0;
+					continue;
+				}
+				fprintf(stderr, "netlink receive error %s (%d)\n",
+					strerror(errno), errno);
+				if (errno == ENOBUFS) {
+					rtnl->rx_stats.overruns++;
+					if (rtnl->resync &&
+					    (err = rtnl->resync(jarg)) < 0)
+						return err;
+					continue;
+				}
+				return -1;
+			}
+			if (status == 0) {
+				fprintf(stderr, "EOF on netlink\n");
+				return -1;
+			}
+
+			PROBE1(listen_batch, status);
+			ring = rtnl->ring;
+			for (i = 0; i < status; i++) {
+				struct msghdr *m = &ring->msgs[i].msg_hdr;
+
+				if (all_nsid)
+					rtnl->nsid = rtnl_msg_nsid(m);
+				err = rtnl_listen_datagram(handler, jarg,
+							   &ring->addr[i],
+							   m->msg_namelen,
+							   ring->iov[i].iov_base,
+							   ring->msgs[i].msg_len,
+							   m->msg_flags);
+				if (err < 0)
+					return err;
+			}
+			continue;
+		}
+#endif
+		if (all_nsid) {
+			msg.msg_control = ctrl.buf;
+			msg.msg_controllen = sizeof(ctrl.buf);
+		}
+		status = rtnl_recvmsg(rtnl, &msg);
 
 		if (status < 0) {
+			if (errno == EAGAIN && rtnl->idle) {
+				err = rtnl->idle(jarg);
+				if (err < 0)
+					return err;
+				continue;
+			}
 			if (errno == EINTR || errno == EAGAIN)
 				continue;
 			fprintf(stderr, "netlink receive error %s (%d)\n",
 				strerror(errno), errno);
-			if (errno == ENOBUFS)
+			if (errno == ENOBUFS) {
+				rtnl->rx_stats.overruns++;
+				if (rtnl->resync &&
+				    (err = rtnl->resync(jarg)) < 0)
+					return err;
 				continue;
+			}
 			return -1;
 		}
 		if (status == 0) {
 			fprintf(stderr, "EOF on netlink\n");
 			return -1;
 		}
-		if (msg.msg_namelen != sizeof(nladdr)) {
-			fprintf(stderr, "Sender address length == %d\n", msg.msg_namelen);
-			exit(1);
-		}
-		for (h = (struct nlmsghdr*)buf; status >= sizeof(*h); ) {
-			int err;
-			int len = h->nlmsg_len;
-			int l = len - sizeof(*h);
 
-			if (l<0 || len>status) {
-				if (msg.msg_flags & MSG_TRUNC) {
-					fprintf(stderr, "Truncated message\n");
-					return -1;
-				}
-				fprintf(stderr, "!!!malformed message: len=%d\n", len);
-				exit(1);
-			}
+		PROBE1(listen_batch, 1);
+		if (all_nsid)
+			rtnl->nsid = rtnl_msg_nsid(&msg);
+		err = rtnl_listen_datagram(handler, jarg, &nladdr,
+					   msg.msg_namelen, rtnl->buf, status,
+					   msg.msg_flags);
+		if (err < 0)
+			return err;
+	}
+}
 
-			err = handler(&nladdr, h, jarg);
-			if (err < 0)
-				return err;
+/* Replays a regular file in place through a private mapping, starting
+ * at the current position of rtnl and leaving it after the last message
+ * handled.  Returns 1 if the file cannot be mapped.
+ */
+static int rtnl_from_map(FILE *rtnl, rtnl_filter_t handler, void *jarg,
+			 const struct sockaddr_nl *nladdr)
+{
+	struct stat st;
+	off_t start, pos;
+	char *map;
+	int err = 0;
+
+	start = ftello(rtnl);
+	if (start < 0 || fstat(fileno(rtnl), &st) < 0 ||
+	    !S_ISREG(st.st_mode) || st.st_size <= start ||
+	    (size_t)st.st_size != st.st_size)
+		return 1;
+
+	map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+		   fileno(rtnl), 0);
+	if (map == MAP_FAILED)
+		return 1;
+	/* Blocks are read, and inflated, one by one */
+	if (st.st_size - start >= sizeof(__u32) &&
+	    *(__u32 *)(map + start) == RTMON_BLOCK_MAGIC) {
+		munmap(map, st.st_size);
+		return 1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
 
-			status -= NLMSG_ALIGN(len);
-			h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
+	for (pos = start; pos < st.st_size; ) {
+		struct nlmsghdr *h = (struct nlmsghdr *)(map + pos);
+		off_t left = st.st_size - pos;
+
+		if (left < sizeof(*h)) {
+			fprintf(stderr, "rtnl-from_file: truncated message\n");
+			err = -1;
+			break;
 		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
+		if (h->nlmsg_len < sizeof(*h) || h->nlmsg_len > left) {
+			if (h->nlmsg_len < sizeof(*h))
+				fprintf(stderr, "!!!malformed message: len=%u @%llu\n",
+					h->nlmsg_len, (unsigned long long)pos);
+			else
+				fprintf(stderr, "rtnl-from_file: truncated message\n");
+			err = -1;
+			break;
 		}
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
+		pos += NLMSG_ALIGN(h->nlmsg_len);
+		if (pos > st.st_size)
+			pos = st.st_size;
+
+		err = handler(nladdr, h, jarg);
+		if (err < 0)
+			break;
+		err = 0;
+	}
+
+	munmap(map, st.st_size);
+	fseeko(rtnl, pos, SEEK_SET);
+	return err;
+}
+
+int (*rtnl_inflate)(void *dst, size_t dstlen, const void *src, size_t srclen);
+
+/* The messages of the block whose header rtnl_from_file() just read */
+static int rtnl_from_block(FILE *rtnl, const struct rtmon_block *b,
+			   rtnl_filter_t handler, void *jarg,
+			   const struct sockaddr_nl *nladdr)
+{
+	char *packed, *raw;
+	__u32 pos;
+	int err = -1;
+
+	if (rtnl_inflate == NULL) {
+		fprintf(stderr, "rtnl_from_file: compressed capture, not supported\n");
+		return -1;
+	}
+	if (b->raw_len > RTMON_BLOCK_MAX || b->len > RTMON_BLOCK_MAX) {
+		fprintf(stderr, "!!!malformed block: len=%u @%ld\n",
+			b->len, ftell(rtnl));
+		return -1;
+	}
+	packed = malloc(b->len + 1);
+	raw = malloc(b->raw_len + 1);
+	if (packed == NULL || raw == NULL) {
+		perror("rtnl_from_file: malloc");
+		goto out;
+	}
+	if (fread(packed, 1, b->len, rtnl) != b->len) {
+		fprintf(stderr, "rtnl-from_file: truncated block\n");
+		goto out;
+	}
+	if (rtnl_inflate(raw, b->raw_len, packed, b->len) != b->raw_len) {
+		fprintf(stderr, "rtnl_from_file: corrupt block @%ld\n",
+			ftell(rtnl));
+		goto out;
+	}
+
+	for (pos = 0, err = 0; pos < b->raw_len && err >= 0; ) {
+		struct nlmsghdr *h = (struct nlmsghdr *)(raw + pos);
+		__u32 left = b->raw_len - pos;
+
+		if (left < sizeof(*h) || h->nlmsg_len < sizeof(*h) ||
+		    h->nlmsg_len > left) {
+			fprintf(stderr, "!!!malformed message in block\n");
+			err = -1;
+			break;
 		}
+		pos += NLMSG_ALIGN(h->nlmsg_len);
+		err = handler(nladdr, h, jarg);
 	}
+out:
+	free(packed);
+	free(raw);
+	return err;
 }
 
 int rtnl_from_file(FILE *rtnl, rtnl_filter_t handler,
@@ -479,6 +1946,11 @@ int rtnl_from_file(FILE *rtnl, rtnl_filter_t handler,
 	nladdr.nl_pid = 0;
 	nladdr.nl_groups = 0;
 
+	/* Pipes and the like are read a message at a time */
+	status = rtnl_from_map(rtnl, handler, jarg, &nladdr);
+	if (status != 1)
+		return status;
+
 	while (1) {
 		int err, len;
 		int l;
@@ -494,6 +1966,14 @@ int rtnl_from_file(FILE *rtnl, rtnl_filter_t handler,
 		if (status == 0)
 			return 0;
 
+		if (status == sizeof(*h) && h->nlmsg_len == RTMON_BLOCK_MAGIC) {
+			err = rtnl_from_block(rtnl, (struct rtmon_block *)h,
+					      handler, jarg, &nladdr);
+			if (err < 0)
+				return err;
+			continue;
+		}
+
 		len = h->nlmsg_len;
 		l = len - sizeof(*h);
 
@@ -520,6 +2000,183 @@ int rtnl_from_file(FILE *rtnl, rtnl_filter_t handler,
 	}
 }
 
+/* Dump filter writing each message unchanged to the FILE in jarg, in
+ * the framing rtnl_from_file() reads back.
+ */
+int rtnl_to_file(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		 void *jarg)
+{
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+
+	if (fwrite(n, 1, len, (FILE *)jarg) != len) {
+		perror("rtnl_to_file: fwrite");
+		return -1;
+	}
+	return 0;
+}
+
+struct rtnl_replay
+{
+	int			type;	/* of the messages last asked for */
+	unsigned char		family;
+	int			ifindex;
+};
+
+/* The capture, mapped once for all handles of the process */
+static char *replay_map;
+static size_t replay_len;
+
+static int rtnl_replay_load(void)
+{
+	struct stat st;
+	int fd;
+
+	if (replay_map)
+		return 0;
+
+	fd = open(rtnl_replay_file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(rtnl_replay_file);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode) || (size_t)st.st_size != st.st_size) {
+		fprintf(stderr, "%s: not a regular file\n", rtnl_replay_file);
+		close(fd);
+		return -1;
+	}
+	replay_len = st.st_size;
+	/* Private and writable, as filters may change messages in place */
+	replay_map = replay_len ? mmap(NULL, replay_len,
+				       PROT_READ|PROT_WRITE, MAP_PRIVATE,
+				       fd, 0) : "";
+	close(fd);
+	if (replay_map == MAP_FAILED) {
+		perror(rtnl_replay_file);
+		replay_map = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static int rtnl_replay_open(struct rtnl_handle *rth)
+{
+	if (rtnl_replay_load() < 0)
+		return -1;
+
+	rth->replay = calloc(1, sizeof(*rth->replay));
+	if (rth->replay == NULL) {
+		perror("Cannot replay");
+		return -1;
+	}
+	rth->fd = -1;
+	rth->local.nl_family = AF_NETLINK;
+	rth->seq = time(NULL);
+	return 0;
+}
+
+/* Dump requests are noted for rtnl_replay_dump(); type is -1 for
+ * anything else, which cannot be answered without a kernel.
+ */
+static int rtnl_replay_request(struct rtnl_handle *rth, int type,
+			       const void *req, int len)
+{
+	struct rtnl_replay *r = rth->replay;
+
+	if (type < RTM_BASE) {
+		static int warned;
+
+		/* Once, as some requests are only made to decorate output */
+		if (!warned++)
+			fprintf(stderr, "Cannot talk to the kernel while replaying %s\n",
+				rtnl_replay_file);
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	/* Dumps of NEW objects are requested with GET, two types on */
+	r->type = type & ~3;
+	r->family = len > 0 ? *(const unsigned char *)req : AF_UNSPEC;
+	r->ifindex = 0;
+	if ((type == RTM_GETQDISC || type == RTM_GETTCLASS ||
+	     type == RTM_GETTFILTER) && len >= sizeof(struct tcmsg))
+		r->ifindex = ((const struct tcmsg *)req)->tcm_ifindex;
+	return NLMSG_LENGTH(len);
+}
+
+static int rtnl_replay_match(const struct rtnl_replay *r,
+			     const struct nlmsghdr *h)
+{
+	if (h->nlmsg_type != r->type)
+		return 0;
+	/* Links come back without a family whichever one was asked for */
+	if (r->family != AF_UNSPEC && h->nlmsg_len >= NLMSG_LENGTH(1) &&
+	    *(unsigned char *)NLMSG_DATA(h) != AF_UNSPEC &&
+	    *(unsigned char *)NLMSG_DATA(h) != r->family)
+		return 0;
+	if (r->ifindex &&
+	    (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct tcmsg)) ||
+	     ((struct tcmsg *)NLMSG_DATA(h))->tcm_ifindex != r->ifindex))
+		return 0;
+	return 1;
+}
+
+/* Answer the last dump request from the capture */
+static int rtnl_replay_dump(struct rtnl_handle *rth,
+			    const struct rtnl_dump_filter_arg *arg)
+{
+	const struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct rtnl_dump_state *d;
+	size_t pos = 0;
+	int phase, err;
+
+	if (rth->replay->type == 0) {
+		fprintf(stderr, "Dump without a request\n");
+		return -1;
+	}
+
+	/* There is nothing to receive, the whole time goes to the filters */
+	phase = rtnl_phase_dump(RTNL_PHASE_FILTER);
+	if (rtnl_dump_state(rth) == NULL) {
+		perror("Cannot allocate dump state");
+		return -1;
+	}
+	d = rth->dstate;
+	d->msgc = 0;
+	while (replay_len - pos >= sizeof(struct nlmsghdr)) {
+		struct nlmsghdr *h = (struct nlmsghdr *)(replay_map + pos);
+
+		if (h->nlmsg_len < sizeof(*h) ||
+		    h->nlmsg_len > replay_len - pos) {
+			fprintf(stderr, "%s: malformed message @%zu\n",
+				rtnl_replay_file, pos);
+			rtnl_phase(phase);
+			return -1;
+		}
+		pos += NLMSG_ALIGN(h->nlmsg_len);
+		if (pos > replay_len)
+			pos = replay_len;
+		if (!rtnl_replay_match(rth->replay, h)) {
+			rtnl_stats.skipped++;
+			continue;
+		}
+		if (rtnl_dump_push(d, h) < 0) {
+			perror("Cannot hold dump");
+			rtnl_phase(phase);
+			return -1;
+		}
+	}
+	err = rtnl_dump_deliver(arg, &nladdr, d->msgv, d->msgc);
+	if (err < 0) {
+		rtnl_phase(phase);
+		return err;
+	}
+	rtnl_phase(phase);
+	rth->replay->type = 0;
+	return 0;
+}
+
 int addattr(struct nlmsghdr *n, int maxlen, int type)
 {
 	return addattr_l(n, maxlen, type, NULL, 0);
@@ -662,6 +2319,27 @@ int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len)
 	return 0;
 }
 
+struct rtattr **__parse_rtattr_table(struct rtattr_table *t,
+				     struct rtattr **tb, __u16 *used,
+				     struct rtattr *rta, int len)
+{
+	while (t->nused)
+		tb[used[--t->nused]] = NULL;
+
+	while (RTA_OK(rta, len)) {
+		unsigned short type = rta->rta_type;
+
+		if (type <= t->max && !tb[type]) {
+			tb[type] = rta;
+			used[t->nused++] = type;
+		}
+		rta = RTA_NEXT(rta,len);
+	}
+	if (len)
+		fprintf(stderr, "!!!Deficit %d, rta_len=%d\n", len, rta->rta_len);
+	return tb;
+}
+
 int parse_rtattr_byindex(struct rtattr *tb[], int max, struct rtattr *rta, int len)
 {
 	int i = 0;
@@ -74,11 +74,10 @@ int ll_addr_a2n(char *lladdr, int len, char *arg)
 
 		for (i=0; i<len; i++) {
 			int temp;
+			/* arg is left alone, bulk commands reuse it */
 			char *cp = strchr(arg, ':');
-			if (cp) {
-				*cp = 0;
+			if (cp)
 				cp++;
-			}
 			if (sscanf(arg, "%x", &temp) != 1) {
 				fprintf(stderr, "\"%s\" is invalid lladdr.\n", arg);
 				return -1;
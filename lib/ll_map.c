@@ -15,9 +15,15 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/if.h>
 
 #include "libnetlink.h"
@@ -25,74 +31,926 @@
 
 extern unsigned int if_nametoindex (const char *);
 
+/*
+ * The entries are linked by slot numbers rather than pointers, see
+ * ll_ent(), and keep the usual hardware addresses of up to
+ * LL_ADDR_INLINE bytes in place; longer ones (tunnels, infiniband)
+ * are allocated on their own.
+ */
+#define LL_ADDR_INLINE	8
+#define LL_ADDR_MAX	20
+
 struct ll_cache
 {
-	struct ll_cache   *idx_next;
+	unsigned int	idx_next;
+	unsigned int	name_next;
 	unsigned	flags;
 	int		index;
 	unsigned short	type;
 	unsigned short	alen;
 	char		name[IFNAMSIZ];
-	unsigned char	addr[20];
+	union {
+		unsigned char	addr[LL_ADDR_INLINE];
+		unsigned char	*long_addr;
+	} u;
 };
 
-#define IDXMAP_SIZE	1024
-static struct ll_cache *idx_head[IDXMAP_SIZE];
+/*
+ * Both hashes start small and double whenever the number of cached
+ * links exceeds the number of buckets, so lookups stay O(1) no matter
+ * how many interfaces the host has.
+ *
+ * The cache, and the socket it asks the kernel with, belong to the
+ * thread, so that threads of a program linked with the library can
+ * look links up (in their own namespaces, even) without locking.
+ * ll_map_flush() frees a thread's cache before it exits.
+ */
+#define LLMAP_INIT_SIZE	256
+#define LLMAP_NS_INIT_SIZE	16	/* of another namespace */
+
+static __thread unsigned int *idx_head;
+static __thread unsigned int *name_head;
+static __thread unsigned int llmap_size;
+static __thread unsigned int llmap_count;
+/* The nsid whose cache the above are, see ll_map_select() */
+static __thread int llmap_nsid = -1;
+
+/*
+ * The entries of all the thread's caches come from chunks of
+ * LLPOOL_CHUNK, which never move, so that the names handed out stay
+ * where they are.  Slot 0 is never used and ends a chain; freed slots
+ * are chained on idx_next for reuse, and the chunks are given back
+ * once the last entry is gone.
+ */
+#define LLPOOL_SHIFT	8
+#define LLPOOL_CHUNK	(1 << LLPOOL_SHIFT)
+
+static __thread struct ll_cache **llpool;
+static __thread unsigned int llpool_chunks;
+static __thread unsigned int llpool_used;
+static __thread unsigned int llpool_free;
+static __thread unsigned int llpool_live;
+static __thread unsigned long llpool_long;	/* bytes of long addresses */
+
+static inline struct ll_cache *ll_ent(unsigned int slot)
+{
+	return &llpool[slot >> LLPOOL_SHIFT][slot & (LLPOOL_CHUNK - 1)];
+}
+
+static void ll_pool_release(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < llpool_chunks; i++)
+		free(llpool[i]);
+	free(llpool);
+	llpool = NULL;
+	llpool_chunks = llpool_used = llpool_free = 0;
+}
+
+static void ll_map_memory(unsigned long *count, unsigned long *bytes);
+
+static unsigned int ll_ent_alloc(void)
+{
+	unsigned int slot = llpool_free;
+
+	if (slot) {
+		llpool_free = ll_ent(slot)->idx_next;
+	} else {
+		if (llpool_used == 0)
+			llpool_used = 1;
+		if ((llpool_used >> LLPOOL_SHIFT) == llpool_chunks) {
+			struct ll_cache **pool, *chunk;
+
+			pool = realloc(llpool, (llpool_chunks + 1) * sizeof(*pool));
+			if (pool == NULL)
+				return 0;
+			llpool = pool;
+			chunk = malloc(LLPOOL_CHUNK * sizeof(*chunk));
+			if (chunk == NULL)
+				return 0;
+			llpool[llpool_chunks++] = chunk;
+			rtnl_stats_mem("links", ll_map_memory);
+		}
+		slot = llpool_used++;
+	}
+	memset(ll_ent(slot), 0, sizeof(struct ll_cache));
+	llpool_live++;
+	return slot;
+}
+
+static void ll_ent_free(unsigned int slot)
+{
+	struct ll_cache *im = ll_ent(slot);
+
+	if (im->alen > LL_ADDR_INLINE) {
+		free(im->u.long_addr);
+		llpool_long -= im->alen;
+	}
+	im->alen = 0;
+	im->idx_next = llpool_free;
+	llpool_free = slot;
+	if (--llpool_live == 0)
+		ll_pool_release();
+}
+
+static const unsigned char *ll_addr(const struct ll_cache *im)
+{
+	return im->alen > LL_ADDR_INLINE ? im->u.long_addr : im->u.addr;
+}
+
+static void ll_set_addr(struct ll_cache *im, const void *addr, int alen)
+{
+	unsigned char *p = im->u.addr;
+
+	if (alen > LL_ADDR_MAX)
+		alen = LL_ADDR_MAX;
+	if (im->alen > LL_ADDR_INLINE) {
+		if (alen == im->alen) {
+			memcpy(im->u.long_addr, addr, alen);
+			return;
+		}
+		free(im->u.long_addr);
+		llpool_long -= im->alen;
+	}
+	memset(im->u.addr, 0, sizeof(im->u.addr));
+	if (alen > LL_ADDR_INLINE) {
+		p = malloc(alen);
+		if (p == NULL) {
+			im->alen = 0;
+			return;
+		}
+		im->u.long_addr = p;
+		llpool_long += alen;
+	}
+	im->alen = alen;
+	memcpy(p, addr, alen);
+}
 
-static inline struct ll_cache *idxhead(int idx)
+static inline unsigned int namehash(const char *str)
 {
-	return idx_head[idx & (IDXMAP_SIZE - 1)];
+	unsigned int hash = 5381;
+
+	while (*str)
+		hash = (hash << 5) + hash + (unsigned char)*str++;
+	return hash;
+}
+
+static inline unsigned int idxhead(int idx)
+{
+	if (idx_head == NULL)
+		return 0;
+	return idx_head[idx & (llmap_size - 1)];
+}
+
+static inline unsigned int namehead(const char *name)
+{
+	if (name_head == NULL)
+		return 0;
+	return name_head[namehash(name) & (llmap_size - 1)];
+}
+
+static void ll_hash_name(unsigned int slot)
+{
+	struct ll_cache *im = ll_ent(slot);
+	unsigned int *head = &name_head[namehash(im->name) & (llmap_size - 1)];
+
+	im->name_next = *head;
+	*head = slot;
+}
+
+static void ll_unhash_name(unsigned int slot)
+{
+	unsigned int *sp;
+
+	sp = &name_head[namehash(ll_ent(slot)->name) & (llmap_size - 1)];
+	for (; *sp; sp = &ll_ent(*sp)->name_next) {
+		if (*sp == slot) {
+			*sp = ll_ent(slot)->name_next;
+			break;
+		}
+	}
+}
+
+static int ll_map_resize(unsigned int size)
+{
+	unsigned int *nidx, *nname;
+	unsigned int i, s, next, osize = llmap_size;
+
+	nidx = calloc(size, sizeof(*nidx));
+	nname = calloc(size, sizeof(*nname));
+	if (nidx == NULL || nname == NULL) {
+		free(nidx);
+		free(nname);
+		return -1;
+	}
+
+	for (i = 0; i < osize; i++) {
+		for (s = idx_head[i]; s; s = next) {
+			struct ll_cache *im = ll_ent(s);
+			unsigned int h;
+
+			next = im->idx_next;
+			h = im->index & (size - 1);
+			im->idx_next = nidx[h];
+			nidx[h] = s;
+
+			h = namehash(im->name) & (size - 1);
+			im->name_next = nname[h];
+			nname[h] = s;
+		}
+	}
+
+	free(idx_head);
+	free(name_head);
+	idx_head = nidx;
+	name_head = nname;
+	llmap_size = size;
+	return 0;
+}
+
+static void ll_forget_index(int index)
+{
+	unsigned int *sp, s;
+
+	if (idx_head == NULL)
+		return;
+
+	for (sp = &idx_head[index & (llmap_size - 1)]; (s = *sp) != 0;
+	     sp = &ll_ent(s)->idx_next) {
+		if (ll_ent(s)->index == index) {
+			*sp = ll_ent(s)->idx_next;
+			ll_unhash_name(s);
+			ll_ent_free(s);
+			llmap_count--;
+			return;
+		}
+	}
+}
+
+/* The entry for index, added or renamed to name as need be */
+static struct ll_cache *ll_store(int index, const char *name)
+{
+	struct ll_cache *im;
+	unsigned int *sp, s;
+
+	if (llmap_size == 0 &&
+	    ll_map_resize(llmap_nsid < 0 ? LLMAP_INIT_SIZE :
+					   LLMAP_NS_INIT_SIZE) < 0)
+		return NULL;
+
+	for (sp = &idx_head[index & (llmap_size - 1)]; (s = *sp) != 0;
+	     sp = &ll_ent(s)->idx_next)
+		if (ll_ent(s)->index == index)
+			break;
+
+	if (s == 0) {
+		s = ll_ent_alloc();
+		if (s == 0)
+			return NULL;
+		im = ll_ent(s);
+		im->index = index;
+		im->idx_next = idx_head[index & (llmap_size - 1)];
+		idx_head[index & (llmap_size - 1)] = s;
+		strncpy(im->name, name, IFNAMSIZ);
+		im->name[IFNAMSIZ-1] = 0;
+		ll_hash_name(s);
+		llmap_count++;
+	} else if (strncmp(ll_ent(s)->name, name, IFNAMSIZ - 1) != 0) {
+		im = ll_ent(s);
+		ll_unhash_name(s);
+		strncpy(im->name, name, IFNAMSIZ);
+		im->name[IFNAMSIZ-1] = 0;
+		ll_hash_name(s);
+	}
+
+	if (llmap_count > llmap_size)
+		ll_map_resize(llmap_size << 1);
+	return ll_ent(s);
+}
+
+/* Free the entries of the cache whose index hash is head */
+static void ll_free_entries(unsigned int *head, unsigned int size)
+{
+	unsigned int i, s, next;
+
+	for (i = 0; i < size; i++) {
+		for (s = head[i]; s; s = next) {
+			next = ll_ent(s)->idx_next;
+			ll_ent_free(s);
+		}
+	}
+}
+
+/* Empty the thread's own cache, keeping its hashes */
+static void ll_map_clear(void)
+{
+	ll_free_entries(idx_head, llmap_size);
+	if (llmap_size) {
+		memset(idx_head, 0, llmap_size * sizeof(*idx_head));
+		memset(name_head, 0, llmap_size * sizeof(*name_head));
+	}
+	llmap_count = 0;
+}
+
+/*
+ * The link cache file.  "ip monitor link-cache FILE" writes the links
+ * of its namespace to FILE, records in slots by ifindex (linear
+ * probing) after a header, and changes them in place on link events.
+ * Programs run with IPROUTE_LINK_CACHE naming such a file copy it
+ * rather than dumping the links, provided it is of their namespace
+ * and still kept current: the writer holds a shared flock on it for as
+ * long as it runs.  The generation is odd while a record changes, and
+ * a copy made across a change is made again.  When the slots fill up
+ * or events were lost, the writer dumps the links again into a new
+ * file that it renames over the old one.
+ */
+#define LLCACHE_MAGIC		0x4c4c4331	/* "LLC1" */
+#define LLCACHE_MIN_SLOTS	64
+#define LLCACHE_RETRIES		1000
+
+struct llcache_hdr
+{
+	__u32	magic;
+	__u32	recsize;
+	__u32	seq;		/* 0 until written, odd while changing */
+	__u32	size;		/* of the slots, a power of two */
+	__u32	count;
+	__u32	pid;
+	__u64	netns;
+};
+
+struct llcache_rec
+{
+	__s32	index;		/* 0 in free slots */
+	__u32	flags;
+	__u16	type;
+	__u16	alen;
+	char	name[IFNAMSIZ];
+	__u8	addr[20];
+};
+
+/* The file this thread writes, if any */
+static __thread struct llcache_hdr *llcache;
+static __thread size_t llcache_len;
+static __thread int llcache_fd = -1;
+static __thread char llcache_file[PATH_MAX];
+
+/* The inode of our network namespace, 0 if the kernel does not tell */
+static __u64 llcache_netns(void)
+{
+	struct stat stb;
+
+	if (stat("/proc/self/ns/net", &stb) < 0)
+		return 0;
+	return stb.st_ino;
+}
+
+static struct llcache_rec *llcache_slots(struct llcache_hdr *h)
+{
+	return (struct llcache_rec *)(h + 1);
+}
+
+/* The slot of index, or the free one where it would go */
+static struct llcache_rec *llcache_slot(struct llcache_hdr *h, int index)
+{
+	struct llcache_rec *r = llcache_slots(h);
+	unsigned int i = index & (h->size - 1);
+
+	while (r[i].index && r[i].index != index)
+		i = (i + 1) & (h->size - 1);
+	return &r[i];
+}
+
+static void llcache_fill(struct llcache_rec *r, const struct ll_cache *im)
+{
+	r->index = im->index;
+	r->flags = im->flags;
+	r->type = im->type;
+	r->alen = im->alen;
+	memcpy(r->name, im->name, sizeof(r->name));
+	memset(r->addr, 0, sizeof(r->addr));
+	memcpy(r->addr, ll_addr(im), im->alen);
+}
+
+static void llcache_begin(void)
+{
+	llcache->seq++;
+	__sync_synchronize();
+}
+
+static void llcache_end(void)
+{
+	__sync_synchronize();
+	llcache->seq++;
+}
+
+static void llcache_close(void)
+{
+	if (llcache)
+		munmap(llcache, llcache_len);
+	if (llcache_fd >= 0)
+		close(llcache_fd);
+	llcache = NULL;
+	llcache_fd = -1;
+}
+
+/* Write the thread's own cache to a new file renamed over file */
+static int llcache_write(const char *file)
+{
+	char tmpname[PATH_MAX];
+	struct llcache_hdr *h;
+	struct ll_cache *im;
+	unsigned int size = LLCACHE_MIN_SLOTS, i, s;
+	size_t len;
+	int fd;
+
+	while (size < 2 * llmap_count)
+		size <<= 1;
+	len = sizeof(*h) + (size_t)size * sizeof(struct llcache_rec);
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp%d", file, getpid());
+	fd = open(tmpname, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror(tmpname);
+		return -1;
+	}
+	if (flock(fd, LOCK_SH) < 0 || ftruncate(fd, len) < 0 ||
+	    (h = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED,
+		      fd, 0)) == MAP_FAILED) {
+		perror(tmpname);
+		close(fd);
+		unlink(tmpname);
+		return -1;
+	}
+
+	h->magic = LLCACHE_MAGIC;
+	h->recsize = sizeof(struct llcache_rec);
+	h->size = size;
+	h->pid = getpid();
+	h->netns = llcache_netns();
+	for (i = 0; i < llmap_size; i++) {
+		for (s = idx_head[i]; s; s = ll_ent(s)->idx_next) {
+			im = ll_ent(s);
+			llcache_fill(llcache_slot(h, im->index), im);
+			h->count++;
+		}
+	}
+	__sync_synchronize();
+	h->seq = 2;
+
+	if (rename(tmpname, file) < 0) {
+		perror(file);
+		munmap(h, len);
+		close(fd);
+		unlink(tmpname);
+		return -1;
+	}
+
+	llcache_close();
+	llcache = h;
+	llcache_len = len;
+	llcache_fd = fd;
+	if (llcache_file != file)
+		snprintf(llcache_file, sizeof(llcache_file), "%s", file);
+	return 0;
+}
+
+static void llcache_put(const struct ll_cache *im)
+{
+	struct llcache_rec *r;
+
+	if (llcache == NULL || llmap_nsid >= 0)
+		return;
+
+	r = llcache_slot(llcache, im->index);
+	if (r->index == 0 && 2 * (llcache->count + 1) > llcache->size) {
+		if (llcache_write(llcache_file) < 0)
+			llcache_close();
+		return;
+	}
+
+	llcache_begin();
+	if (r->index == 0)
+		llcache->count++;
+	llcache_fill(r, im);
+	llcache_end();
+}
+
+/* Empty the slot of index, moving up whatever probed past it */
+static void llcache_del(int index)
+{
+	struct llcache_rec *slots, *r;
+	unsigned int mask, i, j;
+
+	if (llcache == NULL || llmap_nsid >= 0)
+		return;
+
+	r = llcache_slot(llcache, index);
+	if (r->index == 0)
+		return;
+
+	slots = llcache_slots(llcache);
+	mask = llcache->size - 1;
+	i = r - slots;
+	llcache_begin();
+	for (j = (i + 1) & mask; slots[j].index; j = (j + 1) & mask) {
+		unsigned int home = slots[j].index & mask;
+
+		/* Stays if its home lies cyclically in (i, j] */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		slots[i] = slots[j];
+		i = j;
+	}
+	memset(&slots[i], 0, sizeof(slots[i]));
+	llcache->count--;
+	llcache_end();
 }
 
+/*
+ * Apply one link message to the cache.  RTM_NEWLINK adds or refreshes
+ * (and renames) an entry, RTM_DELLINK drops it, so the same callback
+ * serves both the initial dump and RTNLGRP_LINK notifications.
+ */
 int ll_remember_index(const struct sockaddr_nl *who,
 		      struct nlmsghdr *n, void *arg)
 {
-	int h;
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
-	struct ll_cache *im, **imp;
+	struct ll_cache *im;
 	struct rtattr *tb[IFLA_MAX+1];
 
-	if (n->nlmsg_type != RTM_NEWLINK)
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
 		return 0;
 
-	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(ifi)))
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
 		return -1;
 
+	if (n->nlmsg_type == RTM_DELLINK) {
+		ll_forget_index(ifi->ifi_index);
+		llcache_del(ifi->ifi_index);
+		return 0;
+	}
+
 	memset(tb, 0, sizeof(tb));
 	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
 	if (tb[IFLA_IFNAME] == NULL)
 		return 0;
 
-	h = ifi->ifi_index & (IDXMAP_SIZE - 1);
-	for (imp = &idx_head[h]; (im=*imp)!=NULL; imp = &im->idx_next)
-		if (im->index == ifi->ifi_index)
-			break;
-
-	if (im == NULL) {
-		im = malloc(sizeof(*im));
-		if (im == NULL)
-			return 0;
-		im->idx_next = *imp;
-		im->index = ifi->ifi_index;
-		*imp = im;
-	}
+	im = ll_store(ifi->ifi_index, RTA_DATA(tb[IFLA_IFNAME]));
+	if (im == NULL)
+		return 0;
 
 	im->type = ifi->ifi_type;
 	im->flags = ifi->ifi_flags;
-	if (tb[IFLA_ADDRESS]) {
-		int alen;
-		im->alen = alen = RTA_PAYLOAD(tb[IFLA_ADDRESS]);
-		if (alen > sizeof(im->addr))
-			alen = sizeof(im->addr);
-		memcpy(im->addr, RTA_DATA(tb[IFLA_ADDRESS]), alen);
-	} else {
-		im->alen = 0;
-		memset(im->addr, 0, sizeof(im->addr));
+	if (tb[IFLA_ADDRESS])
+		ll_set_addr(im, RTA_DATA(tb[IFLA_ADDRESS]),
+			    RTA_PAYLOAD(tb[IFLA_ADDRESS]));
+	else
+		ll_set_addr(im, NULL, 0);
+
+	llcache_put(im);
+	return 0;
+}
+
+/*
+ * ll_init_map() no longer dumps every link up front.  Misses are
+ * resolved with a targeted RTM_GETLINK on a private socket (so that a
+ * lookup from inside a dump or listen callback cannot steal messages
+ * from the caller's handle), and only after LLMAP_LAZY_MISSES of them
+ * is the whole table pulled in at once.
+ */
+#define LLMAP_LAZY_MISSES	16
+
+static __thread int llmap_lazy;
+static __thread int llmap_full;
+static __thread int llmap_misses;
+static __thread struct rtnl_handle llmap_rth = { .fd = -1 };
+
+/*
+ * The caches of the namespaces that have an nsid here, for listeners
+ * of all of them (rtnl_listen_all_nsid()), in an array by nsid.  The
+ * cache ll_map_select() picks stands in for the thread's own until it
+ * is put back with -1.  They only learn from the link messages given
+ * to ll_remember_index(); asking the kernel would tell about the links
+ * of this namespace, so a miss there stays a miss.
+ */
+struct ll_map_ns
+{
+	unsigned int		*idx_head;
+	unsigned int		*name_head;
+	unsigned int		size;
+	unsigned int		count;
+};
+
+static __thread struct ll_map_ns *llmap_ns;
+static __thread int llmap_nns;
+static __thread struct ll_map_ns llmap_own;
+
+static void ll_map_ns_free(struct ll_map_ns *m)
+{
+	ll_free_entries(m->idx_head, m->size);
+	free(m->idx_head);
+	free(m->name_head);
+	memset(m, 0, sizeof(*m));
+}
+
+int ll_map_select(int nsid)
+{
+	struct ll_map_ns *m;
+
+	if (nsid == llmap_nsid)
+		return 0;
+	if (nsid >= llmap_nns) {
+		int n = llmap_nns ? llmap_nns * 2 : 16;
+
+		if (n <= nsid)
+			n = nsid + 1;
+
+		m = realloc(llmap_ns, n * sizeof(*m));
+		if (m == NULL)
+			return -1;
+		memset(m + llmap_nns, 0, (n - llmap_nns) * sizeof(*m));
+		llmap_ns = m;
+		llmap_nns = n;
 	}
-	strcpy(im->name, RTA_DATA(tb[IFLA_IFNAME]));
+
+	m = llmap_nsid < 0 ? &llmap_own : &llmap_ns[llmap_nsid];
+	m->idx_head = idx_head;
+	m->name_head = name_head;
+	m->size = llmap_size;
+	m->count = llmap_count;
+
+	m = nsid < 0 ? &llmap_own : &llmap_ns[nsid];
+	idx_head = m->idx_head;
+	name_head = m->name_head;
+	llmap_size = m->size;
+	llmap_count = m->count;
+	llmap_nsid = nsid < 0 ? -1 : nsid;
 	return 0;
 }
 
+/* Drops the cache of nsid, whose namespace went away */
+void ll_map_forget_nsid(int nsid)
+{
+	if (nsid < 0 || nsid >= llmap_nns)
+		return;
+	if (nsid == llmap_nsid)
+		ll_map_select(-1);
+	ll_map_ns_free(&llmap_ns[nsid]);
+}
+
+static int ll_map_dump(struct rtnl_handle *rth)
+{
+	int phase = rtnl_phase(RTNL_PHASE_LINKS);
+	unsigned int flags = rth->flags;
+	int ret;
+
+	if (rtnl_wilddump_request(rth, AF_UNSPEC, RTM_GETLINK) < 0) {
+		perror("Cannot send dump request");
+		rtnl_phase(phase);
+		return -1;
+	}
+
+	/* A table with links renamed halfway through would be no use */
+	rth->flags |= RTNL_HANDLE_F_DUMP_CONSISTENT;
+	ret = rtnl_dump_filter(rth, ll_remember_index, NULL);
+	rth->flags = flags;
+	if (ret < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		rtnl_phase(phase);
+		return -1;
+	}
+
+	llmap_full = 1;
+	rtnl_phase(phase);
+	return 0;
+}
+
+/* Returns 1 if the link was found, 0 if the kernel has no such link
+ * and -1 if the kernel could not be asked.
+ */
+static int ll_link_query(unsigned idx, const char *name)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[64];
+	} req;
+	struct sockaddr_nl nladdr;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	char buf[32768];
+	struct nlmsghdr *h;
+	int status;
+
+	if (llmap_rth.fd < 0 && rtnl_open(&llmap_rth, 0) < 0)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.n.nlmsg_seq = ++llmap_rth.seq;
+	req.i.ifi_family = AF_UNSPEC;
+	req.i.ifi_index = idx;
+	if (name)
+		addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name,
+			  strlen(name) + 1);
+
+	rtnl_stats.sendmsg++;
+	if (send(llmap_rth.fd, &req, req.n.nlmsg_len, 0) < 0)
+		return -1;
+
+	while (1) {
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		status = recvmsg(llmap_rth.fd, &msg, 0);
+		if (status < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		if (status == 0 || (msg.msg_flags & MSG_TRUNC))
+			return -1;
+		rtnl_stats.recvmsg++;
+		rtnl_stats.rx_bytes += status;
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status)) {
+			if (h->nlmsg_seq != req.n.nlmsg_seq)
+				continue;
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(h);
+
+				if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+					return -1;
+				return err->error == -ENODEV ? 0 : -1;
+			}
+			if (h->nlmsg_type == RTM_NEWLINK) {
+				ll_remember_index(&nladdr, h, NULL);
+				return 1;
+			}
+		}
+	}
+}
+
+static int llcache_copy(const char *file)
+{
+	struct llcache_hdr *h;
+	struct stat stb;
+	int fd, tries, ret = -1;
+
+	fd = open(file, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &stb) < 0 || stb.st_size < sizeof(*h) ||
+	    (stb.st_uid != getuid() && stb.st_uid != 0) ||
+	    flock(fd, LOCK_EX|LOCK_NB) == 0) {
+		close(fd);
+		return -1;
+	}
+	h = mmap(NULL, stb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED)
+		return -1;
+	if (h->magic != LLCACHE_MAGIC ||
+	    h->recsize != sizeof(struct llcache_rec) ||
+	    h->size == 0 || (h->size & (h->size - 1)) ||
+	    sizeof(*h) + (size_t)h->size * h->recsize > stb.st_size ||
+	    h->netns != llcache_netns())
+		goto out;
+
+	for (tries = 0; tries < LLCACHE_RETRIES; tries++) {
+		const struct llcache_rec *r = llcache_slots(h);
+		__u32 seq = h->seq;
+		unsigned int i;
+
+		__sync_synchronize();
+		if (seq == 0)
+			break;
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		ll_map_clear();
+		for (i = 0; i < h->size; i++) {
+			struct ll_cache *im;
+
+			if (r[i].index <= 0)
+				continue;
+			im = ll_store(r[i].index, r[i].name);
+			if (im == NULL)
+				break;
+			im->flags = r[i].flags;
+			im->type = r[i].type;
+			ll_set_addr(im, r[i].addr, r[i].alen);
+		}
+		__sync_synchronize();
+		if (i == h->size && h->seq == seq) {
+			llmap_full = 1;
+			ret = 0;
+			break;
+		}
+	}
+	if (ret < 0)
+		ll_map_clear();
+out:
+	munmap(h, stb.st_size);
+	return ret;
+}
+
+/* Fill the thread's own cache from the file IPROUTE_LINK_CACHE names,
+ * if it is of use; returns 0 if the cache now holds every link.
+ */
+static int llcache_load(void)
+{
+	const char *file = getenv("IPROUTE_LINK_CACHE");
+	int phase, ret;
+
+	if (file == NULL || *file == 0 || llmap_nsid >= 0 || llcache ||
+	    rtnl_replay_file)
+		return -1;
+
+	phase = rtnl_phase(RTNL_PHASE_LINKS);
+	ret = llcache_copy(file);
+	rtnl_phase(phase);
+	return ret;
+}
+
+/* Returns -1 if the kernel could not be asked, otherwise the cache is
+ * now authoritative for the requested link.
+ */
+static int ll_map_resolve(unsigned idx, const char *name)
+{
+	/* A capture can be dumped, but not asked about a single link */
+	if (++llmap_misses < LLMAP_LAZY_MISSES && !rtnl_replay_file) {
+		int phase = rtnl_phase(RTNL_PHASE_LINKS);
+		int ret = ll_link_query(idx, name);
+
+		rtnl_phase(phase);
+		return ret;
+	}
+
+	if (llcache_load() == 0)
+		return 1;
+	if (llmap_rth.fd < 0 && !llmap_rth.replay &&
+	    rtnl_open(&llmap_rth, 0) < 0)
+		return -1;
+	if (ll_map_dump(&llmap_rth) < 0)
+		exit(1);
+	return 1;
+}
+
+static const struct ll_cache *ll_find_index(unsigned idx)
+{
+	unsigned int s;
+
+	for (s = idxhead(idx); s; s = ll_ent(s)->idx_next)
+		if (ll_ent(s)->index == idx)
+			return ll_ent(s);
+	return NULL;
+}
+
+static const struct ll_cache *ll_find_name(const char *name)
+{
+	unsigned int s;
+
+	for (s = namehead(name); s; s = ll_ent(s)->name_next)
+		if (strcmp(ll_ent(s)->name, name) == 0)
+			return ll_ent(s);
+	return NULL;
+}
+
+static const struct ll_cache *ll_get_by_index(unsigned idx)
+{
+	const struct ll_cache *im = ll_find_index(idx);
+
+	if (im || !llmap_lazy || llmap_full || llmap_nsid >= 0 ||
+	    ll_map_resolve(idx, NULL) < 0)
+		return im;
+	return ll_find_index(idx);
+}
+
+static const struct ll_cache *ll_get_by_name(const char *name, int *asked)
+{
+	const struct ll_cache *im = ll_find_name(name);
+
+	*asked = 0;
+	if (im || !llmap_lazy || llmap_full || llmap_nsid >= 0 ||
+	    strlen(name) >= IFNAMSIZ || ll_map_resolve(0, name) < 0)
+		return im;
+
+	*asked = 1;
+	return ll_find_name(name);
+}
+
 const char *ll_idx_n2a(unsigned idx, char *buf)
 {
 	const struct ll_cache *im;
@@ -100,9 +958,9 @@ const char *ll_idx_n2a(unsigned idx, char *buf)
 	if (idx == 0)
 		return "*";
 
-	for (im = idxhead(idx); im; im = im->idx_next)
-		if (im->index == idx)
-			return im->name;
+	im = ll_get_by_index(idx);
+	if (im)
+		return im->name;
 
 	snprintf(buf, IFNAMSIZ, "if%d", idx);
 	return buf;
@@ -111,7 +969,7 @@ const char *ll_idx_n2a(unsigned idx, char *buf)
 
 const char *ll_index_to_name(unsigned idx)
 {
-	static char nbuf[IFNAMSIZ];
+	static __thread char nbuf[IFNAMSIZ];
 
 	return ll_idx_n2a(idx, nbuf);
 }
@@ -122,10 +980,9 @@ int ll_index_to_type(unsigned idx)
 
 	if (idx == 0)
 		return -1;
-	for (im = idxhead(idx); im; im = im->idx_next)
-		if (im->index == idx)
-			return im->type;
-	return -1;
+
+	im = ll_get_by_index(idx);
+	return im ? im->type : -1;
 }
 
 unsigned ll_index_to_flags(unsigned idx)
@@ -135,10 +992,8 @@ unsigned ll_index_to_flags(unsigned idx)
 	if (idx == 0)
 		return 0;
 
-	for (im = idxhead(idx); im; im = im->idx_next)
-		if (im->index == idx)
-			return im->flags;
-	return 0;
+	im = ll_get_by_index(idx);
+	return im ? im->flags : 0;
 }
 
 unsigned ll_index_to_addr(unsigned idx, unsigned char *addr,
@@ -149,44 +1004,31 @@ unsigned ll_index_to_addr(unsigned idx, unsigned char *addr,
 	if (idx == 0)
 		return 0;
 
-	for (im = idxhead(idx); im; im = im->idx_next) {
-		if (im->index == idx) {
-			if (alen > sizeof(im->addr))
-				alen = sizeof(im->addr);
-			if (alen > im->alen)
-				alen = im->alen;
-			memcpy(addr, im->addr, alen);
-			return alen;
-		}
-	}
-	return 0;
+	im = ll_get_by_index(idx);
+	if (im == NULL)
+		return 0;
+
+	if (alen > im->alen)
+		alen = im->alen;
+	memcpy(addr, ll_addr(im), alen);
+	return alen;
 }
 
 unsigned ll_name_to_index(const char *name)
 {
-	static char ncache[IFNAMSIZ];
-	static int icache;
-	struct ll_cache *im;
-	int i;
-	unsigned idx;
+	const struct ll_cache *im;
+	unsigned idx = 0;
+	int asked;
 
 	if (name == NULL)
 		return 0;
 
-	if (icache && strcmp(name, ncache) == 0)
-		return icache;
+	im = ll_get_by_name(name, &asked);
+	if (im)
+		return im->index;
 
-	for (i=0; i<IDXMAP_SIZE; i++) {
-		for (im = idx_head[i]; im; im = im->idx_next) {
-			if (strcmp(im->name, name) == 0) {
-				icache = im->index;
-				strcpy(ncache, name);
-				return im->index;
-			}
-		}
-	}
-
-	idx = if_nametoindex(name);
+	if (!asked && llmap_nsid < 0)
+		idx = if_nametoindex(name);
 	if (idx == 0)
 		sscanf(name, "if%u", &idx);
 	return idx;
@@ -194,22 +1036,88 @@ unsigned ll_name_to_index(const char *name)
 
 int ll_init_map(struct rtnl_handle *rth)
 {
-	static int initialized;
+	llmap_lazy = 1;
+	return 0;
+}
 
-	if (initialized)
+/* Pull in every link right away, for callers that want the whole
+ * table rather than a handful of translations.
+ */
+int ll_init_map_full(struct rtnl_handle *rth)
+{
+	if (llmap_full || llcache_load() == 0)
 		return 0;
 
-	if (rtnl_wilddump_request(rth, AF_UNSPEC, RTM_GETLINK) < 0) {
-		perror("Cannot send dump request");
+	if (ll_map_dump(rth) < 0)
 		exit(1);
-	}
+	return 0;
+}
 
-	if (rtnl_dump_filter(rth, ll_remember_index, NULL) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		exit(1);
+/*
+ * Keep the cache current on a long-lived handle: join RTNLGRP_LINK so
+ * that link events arrive alongside whatever else the caller listens
+ * to.  The listen callback must pass RTM_NEWLINK/RTM_DELLINK messages
+ * to ll_remember_index().
+ */
+int ll_map_subscribe(struct rtnl_handle *rth)
+{
+	int group = RTNLGRP_LINK;
+
+	if (setsockopt(rth->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+		       &group, sizeof(group)) < 0) {
+		perror("Cannot join RTNLGRP_LINK");
+		return -1;
 	}
+	return 0;
+}
 
-	initialized = 1;
+/* Forget everything, e.g. because the caller moved to another network
+ * namespace; the next lookup starts afresh there.
+ */
+void ll_map_flush(void)
+{
+	int i;
 
-	return 0;
+	ll_map_select(-1);
+	for (i = 0; i < llmap_nns; i++)
+		ll_map_ns_free(&llmap_ns[i]);
+	ll_map_clear();
+	llmap_full = 0;
+	llmap_misses = 0;
+	if (llmap_rth.fd >= 0 || llmap_rth.replay)
+		rtnl_close(&llmap_rth);
+}
+
+/* Dump the links and keep them in file from now on, see llcache_write();
+ * called again after events were lost, it starts over.
+ */
+int ll_map_export(const char *file)
+{
+	int ret;
+
+	llcache_close();
+	ll_map_flush();
+	if (rtnl_open(&llmap_rth, 0) < 0 || ll_map_dump(&llmap_rth) < 0)
+		return -1;
+	ret = llcache_write(file);
+	rtnl_close(&llmap_rth);
+	return ret;
+}
+
+/* What the thread's caches hold: entries, and bytes with the hashes */
+static void ll_map_memory(unsigned long *count, unsigned long *bytes)
+{
+	unsigned long heads = llmap_size;
+	int i;
+
+	if (llmap_nsid >= 0)
+		heads += llmap_own.size;
+	for (i = 0; i < llmap_nns; i++)
+		if (i != llmap_nsid)
+			heads += llmap_ns[i].size;
+
+	*count = llpool_live;
+	*bytes = llpool_chunks * (LLPOOL_CHUNK * sizeof(struct ll_cache) +
+				  sizeof(*llpool)) +
+		 heads * 2 * sizeof(*idx_head) + llpool_long;
 }
@@ -29,85 +29,50 @@
 #include "rt_names.h"
 
 
-#define __PF(f,n) { ETH_P_##f, #n },
-static const struct {
-	int id;
-	const char *name;
-} llproto_names[] = {
-__PF(LOOP,loop)
-__PF(PUP,pup)
-__PF(PUPAT,pupat)
-__PF(IP,ip)
-__PF(X25,x25)
-__PF(ARP,arp)
-__PF(BPQ,bpq)
-__PF(IEEEPUP,ieeepup)
-__PF(IEEEPUPAT,ieeepupat)
-__PF(DEC,dec)
-__PF(DNA_DL,dna_dl)
-__PF(DNA_RC,dna_rc)
-__PF(DNA_RT,dna_rt)
-__PF(LAT,lat)
-__PF(DIAG,diag)
-__PF(CUST,cust)
-__PF(SCA,sca)
-__PF(RARP,rarp)
-__PF(ATALK,atalk)
-__PF(AARP,aarp)
-__PF(IPX,ipx)
-__PF(IPV6,ipv6)
-__PF(PPP_DISC,ppp_disc)
-__PF(PPP_SES,ppp_ses)
-__PF(ATMMPOA,atmmpoa)
-__PF(ATMFATE,atmfate)
-__PF(802_3,802_3)
-__PF(AX25,ax25)
-__PF(ALL,all)
-__PF(802_2,802_2)
-__PF(SNAP,snap)
-__PF(DDCMP,ddcmp)
-__PF(WAN_PPP,wan_ppp)
-__PF(PPP_MP,ppp_mp)
-__PF(LOCALTALK,localtalk)
-__PF(CAN,can)
-__PF(PPPTALK,ppptalk)
-__PF(TR_802_2,tr_802_2)
-__PF(MOBITEX,mobitex)
-__PF(CONTROL,control)
-__PF(IRDA,irda)
-__PF(ECONET,econet)
-__PF(TIPC,tipc)
-__PF(AOE,aoe)
-
-{ 0x8100, "802.1Q" },
-{ 0x88cc, "LLDP" },
-{ ETH_P_IP, "ipv4" },
-};
-#undef __PF
+/*
+ * The names of ll_proto_names.h, sorted by mkllnames at build time
+ * into llproto_by_num and llproto_by_name.
+ */
+#include "ll_proto_tables.h"
 
+#define N(a)	(sizeof(a)/sizeof(a[0]))
 
 const char * ll_proto_n2a(unsigned short id, char *buf, int len)
 {
-        int i;
+	int lo = 0, hi = N(llproto_by_num);
 
 	id = ntohs(id);
 
-        for (i=0; i<sizeof(llproto_names)/sizeof(llproto_names[0]); i++) {
-                 if (llproto_names[i].id == id)
-			return llproto_names[i].name;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (llproto_by_num[mid].id == id)
+			return llproto_by_num[mid].name;
+		if (llproto_by_num[mid].id > id)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
-        snprintf(buf, len, "[%d]", id);
-        return buf;
+	snprintf(buf, len, "[%d]", id);
+	return buf;
 }
 
 int ll_proto_a2n(unsigned short *id, char *buf)
 {
-        int i;
-        for (i=0; i<sizeof(llproto_names)/sizeof(llproto_names[0]); i++) {
-                 if (strcasecmp(llproto_names[i].name, buf) == 0) {
-			 *id = htons(llproto_names[i].id);
-			 return 0;
-		 }
+	int lo = 0, hi = N(llproto_by_name);
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int d = strcasecmp(buf, llproto_by_name[mid].name);
+
+		if (d == 0) {
+			*id = htons(llproto_by_name[mid].id);
+			return 0;
+		}
+		if (d < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
 	if (get_u16(id, buf, 0))
 		return -1;
@@ -0,0 +1,148 @@
+/*
+ * mkllnames.c	Build the lookup tables of ll_proto.c and ll_types.c.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Run on the build host.  It prints the protocol names sorted for a
+ * binary search with strcasecmp(), and the numbers of each list either
+ * as a direct index, for the ARPHRD_ types below ARPHRD_NONE, or
+ * sorted, for the sparse ETH_P_ numbers.  Where a number has several
+ * names the first listed is the one kept for printing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_arp.h>
+
+struct ll_name
+{
+	unsigned int	id;
+	const char	*name;
+	int		order;		/* in the list */
+};
+
+static struct ll_name llproto[] = {
+#define __PF(f, n) { ETH_P_##f, #n },
+#define __PN(v, n) { v, #n },
+#include "ll_proto_names.h"
+#undef __PN
+#undef __PF
+};
+
+static struct ll_name arphrd[] = {
+#define __PF(f, n) { ARPHRD_##f, #n },
+#define __PN(v, n) { v, #n },
+#include "ll_type_names.h"
+#undef __PN
+#undef __PF
+};
+
+#define N(a)	(sizeof(a)/sizeof(a[0]))
+
+static int by_name(const void *a, const void *b)
+{
+	return strcasecmp(((const struct ll_name *)a)->name,
+			  ((const struct ll_name *)b)->name);
+}
+
+static int by_id(const void *a, const void *b)
+{
+	const struct ll_name *x = a, *y = b;
+
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return x->order - y->order;
+}
+
+static void print_names(const char *table, struct ll_name *n, int cnt)
+{
+	int i;
+
+	qsort(n, cnt, sizeof(*n), by_name);
+	printf("static const struct ll_name %s_by_name[] = {\n", table);
+	for (i = 0; i < cnt; i++) {
+		if (i && strcasecmp(n[i].name, n[i - 1].name) == 0) {
+			fprintf(stderr, "mkllnames: %s listed twice\n",
+				n[i].name);
+			exit(1);
+		}
+		printf("\t{ 0x%04x, \"%s\" },\n", n[i].id, n[i].name);
+	}
+	printf("};\n\n");
+}
+
+/* Numbers below dense are indexed directly, the rest searched */
+static void print_ids(const char *table, struct ll_name *n, int cnt,
+		      unsigned int dense)
+{
+	unsigned int max = 0;
+	int i;
+
+	qsort(n, cnt, sizeof(*n), by_id);
+	if (dense) {
+		for (i = 0; i < cnt; i++)
+			if (n[i].id < dense && n[i].id >= max)
+				max = n[i].id + 1;
+		printf("static const char *const %s_by_id[%u] = {\n",
+		       table, max);
+		for (i = 0; i < cnt; i++) {
+			if (n[i].id >= dense)
+				continue;
+			if (i && n[i].id == n[i - 1].id)
+				continue;
+			printf("\t[%u] = \"%s\",\n", n[i].id, n[i].name);
+		}
+		printf("};\n\n");
+	}
+
+	printf("static const struct ll_name %s_by_num[] = {\n", table);
+	for (i = 0; i < cnt; i++) {
+		if (n[i].id < dense)
+			continue;
+		if (i && n[i].id == n[i - 1].id)
+			continue;
+		printf("\t{ 0x%04x, \"%s\" },\n", n[i].id, n[i].name);
+	}
+	printf("};\n\n");
+}
+
+static void number(struct ll_name *n, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++)
+		n[i].order = i;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2 || (strcmp(argv[1], "proto") && strcmp(argv[1], "type"))) {
+		fprintf(stderr, "Usage: mkllnames { proto | type }\n");
+		return 1;
+	}
+
+	printf("/* Generated by mkllnames, do not edit */\n\n"
+	       "struct ll_name\n{\n"
+	       "\tunsigned short\tid;\n"
+	       "\tconst char\t*name;\n};\n\n");
+
+	if (strcmp(argv[1], "proto") == 0) {
+		number(llproto, N(llproto));
+		print_ids("llproto", llproto, N(llproto), 0);
+		print_names("llproto", llproto, N(llproto));
+	} else {
+		number(arphrd, N(arphrd));
+		print_ids("arphrd", arphrd, N(arphrd), ARPHRD_NONE);
+	}
+	return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * namecache.c		Optional on-disk cache of resolved names.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * When IPROUTE_NAME_CACHE names a file, host and service names that
+ * were looked up (including failed lookups) are kept there for
+ * IPROUTE_NAME_CACHE_TTL seconds (default 300), so that tools run in a
+ * loop do not query DNS or parse /etc/services again every time.
+ *
+ * The file is an array of fixed size records after a short header, so
+ * it is simply mapped and indexed on load.  New entries are merged with
+ * the unexpired old ones and written back atomically at exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+
+#define NAMECACHE_MAGIC		0x4e434331	/* "NCC1" */
+#define NAMECACHE_TTL		300
+#define NAMECACHE_HASH		1024
+
+struct namecache_hdr {
+	__u32	magic;
+	__u32	count;
+};
+
+struct namecache_rec {
+	__u32	expires;
+	__u8	klen;
+	__u8	negative;
+	__u8	key[NAMECACHE_KEYLEN];
+	char	name[256 - 6 - NAMECACHE_KEYLEN];
+};
+
+struct namecache_ent {
+	struct namecache_ent		*next;
+	const struct namecache_rec	*rec;
+};
+
+static struct namecache_ent *nc_hash[NAMECACHE_HASH];
+static const char *nc_file;
+static unsigned int nc_ttl = NAMECACHE_TTL;
+static int nc_state;		/* 0 - not loaded, 1 - active, -1 - off */
+static int nc_dirty;
+
+static unsigned int nc_keyhash(const __u8 *key, int klen)
+{
+	unsigned int hash = 5381;
+
+	while (klen-- > 0)
+		hash = (hash << 5) + hash + *key++;
+	return hash & (NAMECACHE_HASH - 1);
+}
+
+static struct namecache_ent *nc_find(const void *key, int klen)
+{
+	struct namecache_ent *e;
+
+	for (e = nc_hash[nc_keyhash(key, klen)]; e; e = e->next)
+		if (e->rec->klen == klen && memcmp(e->rec->key, key, klen) == 0)
+			return e;
+	return NULL;
+}
+
+static void nc_insert(const struct namecache_rec *rec)
+{
+	struct namecache_ent *e = nc_find(rec->key, rec->klen);
+	unsigned int h;
+
+	if (e) {
+		e->rec = rec;
+		return;
+	}
+
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		return;
+	h = nc_keyhash(rec->key, rec->klen);
+	e->rec = rec;
+	e->next = nc_hash[h];
+	nc_hash[h] = e;
+}
+
+static void namecache_save(void)
+{
+	char tmpname[PATH_MAX];
+	struct namecache_hdr hdr;
+	struct namecache_ent *e;
+	time_t now = time(NULL);
+	FILE *fp;
+	int i;
+
+	if (!nc_dirty)
+		return;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp%d", nc_file, getpid());
+	fp = fopen(tmpname, "w");
+	if (fp == NULL)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = NAMECACHE_MAGIC;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	for (i = 0; i < NAMECACHE_HASH; i++) {
+		for (e = nc_hash[i]; e; e = e->next) {
+			if (e->rec->expires <= now)
+				continue;
+			if (fwrite(e->rec, sizeof(*e->rec), 1, fp) != 1)
+				goto fail;
+			hdr.count++;
+		}
+	}
+	if (fseek(fp, 0, SEEK_SET) < 0 ||
+	    fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto fail;
+	if (fclose(fp) != 0 || rename(tmpname, nc_file) < 0)
+		unlink(tmpname);
+	return;
+
+fail:
+	fclose(fp);
+	unlink(tmpname);
+}
+
+static int namecache_load(void)
+{
+	const struct namecache_hdr *hdr;
+	const struct namecache_rec *rec;
+	struct stat st;
+	time_t now;
+	char *ttl;
+	void *map;
+	__u32 i;
+	int fd;
+
+	if (nc_state)
+		return nc_state;
+
+	nc_state = -1;
+	nc_file = getenv("IPROUTE_NAME_CACHE");
+	if (nc_file == NULL || *nc_file == 0)
+		return nc_state;
+	ttl = getenv("IPROUTE_NAME_CACHE_TTL");
+	if (ttl && get_unsigned(&nc_ttl, ttl, 0) < 0)
+		nc_ttl = NAMECACHE_TTL;
+
+	nc_state = 1;
+	atexit(namecache_save);
+
+	fd = open(nc_file, O_RDONLY);
+	if (fd < 0)
+		return nc_state;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return nc_state;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return nc_state;
+
+	hdr = map;
+	if (hdr->magic != NAMECACHE_MAGIC ||
+	    sizeof(*hdr) + (__u64)hdr->count * sizeof(*rec) > st.st_size) {
+		munmap(map, st.st_size);
+		return nc_state;
+	}
+
+	/* The mapping stays for the life of the process; entries point
+	 * straight into it.
+	 */
+	now = time(NULL);
+	rec = (const void *)(hdr + 1);
+	for (i = 0; i < hdr->count; i++, rec++) {
+		if (rec->expires <= now || rec->klen > NAMECACHE_KEYLEN ||
+		    memchr(rec->name, 0, sizeof(rec->name)) == NULL)
+			continue;
+		nc_insert(rec);
+	}
+	return nc_state;
+}
+
+/*
+ * Returns 1 and sets *name (NULL for a remembered failure) if key is
+ * cached, 0 otherwise.
+ */
+int namecache_get(const void *key, int klen, const char **name)
+{
+	struct namecache_ent *e;
+
+	if (klen > NAMECACHE_KEYLEN || namecache_load() < 0)
+		return 0;
+
+	e = nc_find(key, klen);
+	if (e == NULL)
+		return 0;
+	*name = e->rec->negative ? NULL : e->rec->name;
+	return 1;
+}
+
+void namecache_put(const void *key, int klen, const char *name)
+{
+	struct namecache_rec *rec;
+
+	if (klen > NAMECACHE_KEYLEN || namecache_load() < 0)
+		return;
+	if (name && strlen(name) >= sizeof(rec->name))
+		return;
+
+	rec = calloc(1, sizeof(*rec));
+	if (rec == NULL)
+		return;
+	rec->expires = time(NULL) + nc_ttl;
+	rec->klen = klen;
+	memcpy(rec->key, key, klen);
+	if (name)
+		strcpy(rec->name, name);
+	else
+		rec->negative = 1;
+	nc_insert(rec);
+	nc_dirty = 1;
+}
@@ -0,0 +1,283 @@
+/*
+ * namespace.c	Running things in named network namespaces.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/param.h>
+#include <sys/poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "namespace.h"
+
+int netns_set(const char *name)
+{
+	char net_path[MAXPATHLEN];
+	int netns;
+
+	snprintf(net_path, sizeof(net_path), "%s/%s", NETNS_RUN_DIR, name);
+	netns = open(net_path, O_RDONLY);
+	if (netns < 0) {
+		fprintf(stderr, "Cannot open network namespace \"%s\": %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+	if (setns(netns, CLONE_NEWNET) < 0) {
+		fprintf(stderr, "seting the network namespace \"%s\" failed: %s\n",
+			name, strerror(errno));
+		close(netns);
+		return -1;
+	}
+	close(netns);
+	return 0;
+}
+
+/*
+ * netns_foreach() calls fn for every namespace of NETNS_RUN_DIR, each
+ * time in a forked child, with up to jobs of them at a time (0: one
+ * per CPU).  The children's stdout and stderr come back through pipes
+ * and every line is printed prefixed with the namespace it came from.
+ * Processes rather than threads, so that fn may use all the (not
+ * thread safe) printing code, and may setns() and exit() as it likes.
+ */
+#define NETNS_LINE_MAX	4096
+
+struct netns_job;
+
+struct netns_out {
+	struct netns_job *job;
+	int	fd;
+	FILE	*fp;
+	int	len;
+	char	buf[NETNS_LINE_MAX];
+};
+
+struct netns_job {
+	pid_t		pid;
+	char		name[NAME_MAX + 1];
+	struct netns_out out[2];
+};
+
+/* Print what is complete in o->buf; everything if flush is set */
+static void netns_out_lines(struct netns_job *job, struct netns_out *o,
+			    int flush)
+{
+	char *p = o->buf, *nl;
+	int left = o->len;
+
+	while (left > 0) {
+		nl = memchr(p, '\n', left);
+		if (nl == NULL) {
+			if (!flush && left < sizeof(o->buf))
+				break;
+			nl = p + left;
+		}
+		fprintf(o->fp, "%s: %.*s\n", job->name, (int)(nl - p), p);
+		if (nl == p + left) {
+			left = 0;
+			break;
+		}
+		left -= nl + 1 - p;
+		p = nl + 1;
+	}
+	memmove(o->buf, p, left);
+	o->len = left;
+}
+
+static int netns_job_start(struct netns_job *jobs, int njobs,
+			   struct netns_job *job, netns_job_t fn, void *arg)
+{
+	int out[2], err[2];
+	int i;
+
+	if (pipe(out) < 0)
+		return -1;
+	if (pipe(err) < 0) {
+		close(out[0]);
+		close(out[1]);
+		return -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	job->pid = fork();
+	if (job->pid < 0) {
+		close(out[0]); close(out[1]);
+		close(err[0]); close(err[1]);
+		return -1;
+	}
+
+	if (job->pid == 0) {
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].pid <= 0 || &jobs[i] == job)
+				continue;
+			if (jobs[i].out[0].fd >= 0)
+				close(jobs[i].out[0].fd);
+			if (jobs[i].out[1].fd >= 0)
+				close(jobs[i].out[1].fd);
+		}
+		close(out[0]);
+		close(err[0]);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+		close(out[1]);
+		close(err[1]);
+
+		exit(fn(job->name, arg));
+	}
+
+	close(out[1]);
+	close(err[1]);
+	job->out[0].job = job->out[1].job = job;
+	job->out[0].fd = out[0];
+	job->out[0].fp = stdout;
+	job->out[0].len = 0;
+	job->out[1].fd = err[0];
+	job->out[1].fp = stderr;
+	job->out[1].len = 0;
+	return 0;
+}
+
+static int netns_job_reap(struct netns_job *job)
+{
+	int status;
+
+	if (waitpid(job->pid, &status, 0) < 0)
+		return -1;
+	job->pid = 0;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return 0;
+	if (WIFEXITED(status))
+		fprintf(stderr, "%s: command exited with status %d\n",
+			job->name, WEXITSTATUS(status));
+	else
+		fprintf(stderr, "%s: command killed by signal %d\n",
+			job->name, WTERMSIG(status));
+	return -1;
+}
+
+int netns_foreach(int njobs, netns_job_t fn, void *arg)
+{
+	struct netns_job *jobs;
+	struct pollfd *pfd;
+	struct netns_out **pout;
+	struct dirent *entry = NULL;
+	int running = 0, failed = 0;
+	DIR *dir;
+	int i;
+
+	if (njobs <= 0)
+		njobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (njobs <= 0)
+		njobs = 1;
+	if (njobs > NETNS_JOBS_MAX)
+		njobs = NETNS_JOBS_MAX;
+
+	dir = opendir(NETNS_RUN_DIR);
+	if (!dir)
+		return 0;
+
+	jobs = calloc(njobs, sizeof(*jobs));
+	pfd = calloc(2 * njobs, sizeof(*pfd));
+	pout = calloc(2 * njobs, sizeof(*pout));
+	if (!jobs || !pfd || !pout) {
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+
+	for (;;) {
+		int n = 0;
+
+		/* Fill the free slots */
+		for (i = 0; i < njobs && dir; i++) {
+			if (jobs[i].pid > 0)
+				continue;
+			do {
+				entry = readdir(dir);
+			} while (entry && (strcmp(entry->d_name, ".") == 0 ||
+					   strcmp(entry->d_name, "..") == 0));
+			if (entry == NULL) {
+				closedir(dir);
+				dir = NULL;
+				break;
+			}
+			strcpy(jobs[i].name, entry->d_name);
+			if (netns_job_start(jobs, njobs, &jobs[i], fn, arg) < 0) {
+				fprintf(stderr, "%s: cannot start: %s\n",
+					jobs[i].name, strerror(errno));
+				jobs[i].pid = 0;
+				failed++;
+				continue;
+			}
+			running++;
+		}
+		if (running == 0)
+			break;
+
+		for (i = 0; i < njobs; i++) {
+			int k;
+
+			if (jobs[i].pid <= 0)
+				continue;
+			for (k = 0; k < 2; k++) {
+				if (jobs[i].out[k].fd < 0)
+					continue;
+				pfd[n].fd = jobs[i].out[k].fd;
+				pfd[n].events = POLLIN;
+				pout[n++] = &jobs[i].out[k];
+			}
+		}
+
+		if (n && poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			exit(-1);
+		}
+
+		for (i = 0; i < n; i++) {
+			struct netns_out *o = pout[i];
+			ssize_t len;
+
+			if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			len = read(o->fd, o->buf + o->len, sizeof(o->buf) - o->len);
+			if (len > 0) {
+				o->len += len;
+				netns_out_lines(o->job, o, 0);
+				continue;
+			}
+			netns_out_lines(o->job, o, 1);
+			close(o->fd);
+			o->fd = -1;
+		}
+		fflush(stdout);
+
+		/* Reap the jobs whose output is all in */
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].pid <= 0 ||
+			    jobs[i].out[0].fd >= 0 || jobs[i].out[1].fd >= 0)
+				continue;
+			if (netns_job_reap(&jobs[i]) < 0)
+				failed++;
+			running--;
+		}
+	}
+
+	free(pout);
+	free(pfd);
+	free(jobs);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * nlfilter.c		Kernel socket filters for monitor sockets.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * A monitor that only prints the events of one device or table still
+ * has every event of its groups copied to it.  rtnl_kfilter() turns
+ * the checks it makes into a classic BPF program on the socket, so the
+ * kernel drops the rest before queueing them.  Attributes are found
+ * with the SKF_AD_NLATTR extension.  Notifications come one per skb,
+ * so the program sees each one from its header; parts of dumps
+ * (NLM_F_MULTI), errors and messages of types without checks always
+ * pass.  Callers keep their own checks: the filter only saves copies.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+
+#include "libnetlink.h"
+
+#define KF_ACCEPT	0xffffffff
+#define KF_MAXINSNS	512
+
+struct kf_prog
+{
+	struct sock_filter	insn[KF_MAXINSNS];
+	unsigned int		len;
+};
+
+static int kf_emit(struct kf_prog *p, __u16 code, __u8 jt, __u8 jf, __u32 k)
+{
+	if (p->len == KF_MAXINSNS)
+		return -1;
+	p->insn[p->len].code = code;
+	p->insn[p->len].jt = jt;
+	p->insn[p->len].jf = jf;
+	p->insn[p->len].k = k;
+	p->len++;
+	return 0;
+}
+
+#define KF_STMT(p, code, k)	kf_emit(p, code, 0, 0, k)
+
+/* Fields are loaded big endian; v is what a host order load would give */
+static __u32 kf_value(unsigned int size, __u32 v)
+{
+	switch (size) {
+	case 2:
+		return htons(v);
+	case 4:
+		return htonl(v);
+	}
+	return v;
+}
+
+static __u16 kf_size(unsigned int size)
+{
+	switch (size) {
+	case 2:
+		return BPF_H;
+	case 4:
+		return BPF_W;
+	}
+	return BPF_B;
+}
+
+/* A == k, or the message goes */
+static int kf_require(struct kf_prog *p, __u32 k)
+{
+	return kf_emit(p, BPF_JMP|BPF_JEQ|BPF_K, 1, 0, k) ||
+	       KF_STMT(p, BPF_RET|BPF_K, 0);
+}
+
+/* The attribute, whose offset is in X, holds the string s */
+static int kf_string(struct kf_prog *p, const char *s)
+{
+	unsigned int len = strlen(s) + 1, i;
+	const unsigned char *b = (const unsigned char *)s;
+
+	if (KF_STMT(p, BPF_LD|BPF_H|BPF_IND, 0) ||
+	    kf_require(p, htons(RTA_LENGTH(len))))
+		return -1;
+	for (i = 0; i < len; ) {
+		unsigned int n = len - i >= 4 ? 4 : len - i >= 2 ? 2 : 1;
+		__u32 v = 0, j;
+
+		for (j = 0; j < n; j++)
+			v = (v << 8) | b[i + j];
+		if (KF_STMT(p, BPF_LD|kf_size(n)|BPF_IND, RTA_LENGTH(i)) ||
+		    kf_require(p, v))
+			return -1;
+		i += n;
+	}
+	return 0;
+}
+
+static int kf_check(struct kf_prog *p, const struct rtnl_kcheck *c)
+{
+	__u32 body = NLMSG_HDRLEN + NLMSG_ALIGN(c->hdrlen);
+	unsigned int skip;
+
+	if (c->attr == 0)
+		return KF_STMT(p, BPF_LD|kf_size(c->size)|BPF_ABS,
+			       NLMSG_HDRLEN + c->offset) ||
+		       kf_require(p, kf_value(c->size, c->value));
+
+	if (KF_STMT(p, BPF_LD|BPF_IMM, body) ||
+	    KF_STMT(p, BPF_LDX|BPF_IMM, c->attr) ||
+	    KF_STMT(p, BPF_LD|BPF_B|BPF_ABS, SKF_AD_OFF + SKF_AD_NLATTR))
+		return -1;
+
+	if (c->str) {
+		/* An absent attribute passes */
+		skip = p->len;
+		if (kf_emit(p, BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 0) ||
+		    KF_STMT(p, BPF_MISC|BPF_TAX, 0) ||
+		    kf_string(p, c->str) || p->len - skip - 1 > 255)
+			return -1;
+		p->insn[skip].jt = p->len - skip - 1;
+		return 0;
+	}
+
+	if (c->offset < 0) {
+		/* Absent passes: skip tax, the load and the comparison */
+		return kf_emit(p, BPF_JMP|BPF_JEQ|BPF_K, 4, 0, 0) ||
+		       KF_STMT(p, BPF_MISC|BPF_TAX, 0) ||
+		       KF_STMT(p, BPF_LD|kf_size(c->size)|BPF_IND,
+			       RTA_LENGTH(0)) ||
+		       kf_require(p, kf_value(c->size, c->value));
+	}
+
+	/* Absent falls back on the header field */
+	return kf_emit(p, BPF_JMP|BPF_JEQ|BPF_K, 3, 0, 0) ||
+	       KF_STMT(p, BPF_MISC|BPF_TAX, 0) ||
+	       KF_STMT(p, BPF_LD|kf_size(c->size)|BPF_IND, RTA_LENGTH(0)) ||
+	       KF_STMT(p, BPF_JMP|BPF_JA, 1) ||
+	       KF_STMT(p, BPF_LD|kf_size(c->size)|BPF_ABS,
+		       NLMSG_HDRLEN + c->offset) ||
+	       kf_require(p, kf_value(c->size, c->value));
+}
+
+int rtnl_kfilter(struct rtnl_handle *rth, const struct rtnl_kcheck *checks,
+		 int n)
+{
+	struct kf_prog *p;
+	struct sock_fprog fprog;
+	int i, j, ret = -1;
+
+	if (n == 0 || rth->replay)
+		return 0;
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return -1;
+
+	/* Dumps and errors pass */
+	if (KF_STMT(p, BPF_LD|BPF_H|BPF_ABS, 6) ||
+	    kf_emit(p, BPF_JMP|BPF_JSET|BPF_K, 0, 1, htons(NLM_F_MULTI)) ||
+	    KF_STMT(p, BPF_RET|BPF_K, KF_ACCEPT))
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		__u16 type = checks[i].type;
+		unsigned int jump;
+
+		for (j = 0; j < i; j++)
+			if (checks[j].type == type)
+				break;
+		if (j < i)
+			continue;
+
+		/* The checks of one type, then accept; other types jump
+		 * over them to the next type.
+		 */
+		if (KF_STMT(p, BPF_LD|BPF_H|BPF_ABS, 4) ||
+		    kf_emit(p, BPF_JMP|BPF_JEQ|BPF_K, 2, 0, htons(type)) ||
+		    kf_emit(p, BPF_JMP|BPF_JEQ|BPF_K, 1, 0, htons(type + 1)) ||
+		    KF_STMT(p, BPF_JMP|BPF_JA, 0))
+			goto out;
+		jump = p->len - 1;
+		for (j = i; j < n; j++)
+			if (checks[j].type == type && kf_check(p, &checks[j]))
+				goto out;
+		if (KF_STMT(p, BPF_RET|BPF_K, KF_ACCEPT))
+			goto out;
+		p->insn[jump].k = p->len - jump - 1;
+	}
+	if (KF_STMT(p, BPF_RET|BPF_K, KF_ACCEPT))
+		goto out;
+
+	fprog.len = p->len;
+	fprog.filter = p->insn;
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+		       &fprog, sizeof(fprog)) < 0) {
+		perror("SO_ATTACH_FILTER");
+		goto out;
+	}
+	ret = 0;
+out:
+	if (ret < 0 && p->len == KF_MAXINSNS)
+		fprintf(stderr, "Socket filter too long\n");
+	free(p);
+	return ret;
+}
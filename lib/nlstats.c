@@ -0,0 +1,202 @@
+/*
+ * nlstats.c		Where a command spends its time, for -timing.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * The counters are kept for the whole process rather than per
+ * rtnl_handle, since commands open and close handles of their own
+ * (ll_map, netns) and the report is made at exit.  Time is charged to
+ * one phase at a time: rtnl_phase() switches, returning the phase to
+ * switch back to.  Standard output is replaced by a stream that times
+ * its writes, so output is told apart from formatting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "libnetlink.h"
+
+/* Per thread, like the handles they count for */
+__thread struct rtnl_stats rtnl_stats;
+
+static __thread int stats_on;
+static pid_t stats_pid;
+static __thread int phase_cur;
+static __thread __u64 phase_start;
+static __u64 stats_start;
+
+#define STATS_MEM_MAX	4
+
+static struct {
+	const char	*name;
+	void		(*usage)(unsigned long *count, unsigned long *bytes);
+} stats_mem[STATS_MEM_MAX];
+static int stats_nmem;
+
+static const char *phase_names[RTNL_PHASE_MAX] = {
+	[RTNL_PHASE_RUN]	= "other",
+	[RTNL_PHASE_NAMES]	= "names",
+	[RTNL_PHASE_LINKS]	= "links",
+	[RTNL_PHASE_DUMP]	= "dump",
+	[RTNL_PHASE_FILTER]	= "format",
+	[RTNL_PHASE_OUTPUT]	= "output",
+};
+
+static __u64 stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int rtnl_phase(int phase)
+{
+	int old = phase_cur;
+	__u64 now;
+
+	if (!stats_on || phase == old)
+		return old;
+	now = stats_now();
+	rtnl_stats.ns[old] += now - phase_start;
+	phase_start = now;
+	phase_cur = phase;
+	return old;
+}
+
+/* For the dump loops: within a name or link lookup the whole time
+ * goes to the lookup.
+ */
+int rtnl_phase_dump(int phase)
+{
+	if (phase_cur == RTNL_PHASE_NAMES || phase_cur == RTNL_PHASE_LINKS)
+		return phase_cur;
+	return rtnl_phase(phase);
+}
+
+static ssize_t stats_write(void *cookie, const char *buf, size_t len)
+{
+	int old = rtnl_phase(RTNL_PHASE_OUTPUT);
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t cc = write(STDOUT_FILENO, buf + done, len - done);
+
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc <= 0)
+			break;
+		done += cc;
+	}
+	rtnl_stats.tx_bytes += done;
+	rtnl_phase(old);
+	return done ? (ssize_t)done : -1;
+}
+
+/* Caches register once they have something; the same name again is
+ * not added twice.
+ */
+void rtnl_stats_mem(const char *name,
+		    void (*usage)(unsigned long *count, unsigned long *bytes))
+{
+	int i;
+
+	for (i = 0; i < stats_nmem; i++)
+		if (strcmp(stats_mem[i].name, name) == 0)
+			return;
+	if (stats_nmem == STATS_MEM_MAX)
+		return;
+	stats_mem[stats_nmem].name = name;
+	stats_mem[stats_nmem].usage = usage;
+	stats_nmem++;
+}
+
+static void ms(FILE *fp, const char *name, __u64 ns)
+{
+	fprintf(fp, " %s %llu.%03llums", name,
+		(unsigned long long)ns / 1000000,
+		(unsigned long long)ns / 1000 % 1000);
+}
+
+static void rtnl_stats_report(void)
+{
+	unsigned long count, bytes;
+	struct rusage ru;
+	__u64 now;
+	int i;
+
+	fflush(stdout);
+	/* Workers forked by -batch-jobs, -server or ss -P leave it to us */
+	if (getpid() != stats_pid)
+		return;
+	now = stats_now();
+	rtnl_stats.ns[phase_cur] += now - phase_start;
+	phase_start = now;
+	getrusage(RUSAGE_SELF, &ru);
+
+	fprintf(stderr, "timing:");
+	ms(stderr, "wall", now - stats_start);
+	ms(stderr, "user", ru.ru_utime.tv_sec * 1000000000ULL +
+		   ru.ru_utime.tv_usec * 1000ULL);
+	ms(stderr, "sys", ru.ru_stime.tv_sec * 1000000000ULL +
+		   ru.ru_stime.tv_usec * 1000ULL);
+	fprintf(stderr, " maxrss %ldkB\n", ru.ru_maxrss);
+
+	fprintf(stderr, "phases:");
+	for (i = 0; i < RTNL_PHASE_MAX; i++)
+		ms(stderr, phase_names[i], rtnl_stats.ns[i]);
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "netlink: sendmsg %llu recvmsg %llu rx %llu bytes "
+		"msgs %llu skipped %llu out %llu bytes\n",
+		(unsigned long long)rtnl_stats.sendmsg,
+		(unsigned long long)rtnl_stats.recvmsg,
+		(unsigned long long)rtnl_stats.rx_bytes,
+		(unsigned long long)rtnl_stats.msgs,
+		(unsigned long long)rtnl_stats.skipped,
+		(unsigned long long)rtnl_stats.tx_bytes);
+
+	if (stats_nmem == 0)
+		return;
+	fprintf(stderr, "memory:");
+	for (i = 0; i < stats_nmem; i++) {
+		stats_mem[i].usage(&count, &bytes);
+		fprintf(stderr, " %s %lu in %lu bytes", stats_mem[i].name,
+			count, bytes);
+	}
+	fprintf(stderr, "\n");
+}
+
+/* Start timing now, with a report on stderr at exit */
+void rtnl_stats_start(void)
+{
+	static cookie_io_functions_t io = { .write = stats_write };
+	FILE *fp;
+
+	if (stats_on)
+		return;
+	stats_on = 1;
+	stats_pid = getpid();
+	stats_start = phase_start = stats_now();
+	phase_cur = RTNL_PHASE_RUN;
+
+	fflush(stdout);
+	fp = fopencookie(NULL, "w", io);
+	if (fp) {
+		setvbuf(fp, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF,
+			BUFSIZ);
+		stdout = fp;
+	}
+	atexit(rtnl_stats_report);
+}
@@ -15,13 +15,18 @@
 #include <syslog.h>
 #include <fcntl.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include <asm/types.h>
 #include <linux/rtnetlink.h>
 
 #include "rt_names.h"
+#include "libnetlink.h"
 
 #ifndef CONFDIR
 #define CONFDIR "/etc/iproute2"
@@ -33,6 +38,311 @@ struct rtnl_hash_entry {
 	unsigned int		id;
 };
 
+/*
+ * Compiled names database.
+ *
+ * "rtnamesdb FILE" writes FILE.db: a header, the entries sorted by id,
+ * an index of the same entries sorted by name and the string table.
+ * The header records the mtime, size and inode of FILE, so a stale
+ * database is simply ignored and the text file is parsed as before.
+ */
+#define RTNL_DB_MAGIC	0x42445452	/* "RTDB" */
+#define RTNL_DB_VERSION	1
+
+struct rtnl_db_hdr {
+	__u32	magic;
+	__u32	version;
+	__u64	src_mtime;
+	__u64	src_size;
+	__u64	src_ino;
+	__u32	count;
+	__u32	byname;		/* offset of the name-sorted index */
+	__u32	strtab;		/* offset of the string table */
+	__u32	strlen;
+};
+
+struct rtnl_db_entry {
+	__u32	id;
+	__u32	name;		/* offset into the string table */
+};
+
+struct rtnl_db {
+	const char			*base;
+	size_t				len;
+	const struct rtnl_db_hdr	*hdr;
+	const struct rtnl_db_entry	*ent;
+	const __u32			*byname;
+	const char			*strtab;
+};
+
+static int rtnl_db_parse_line(char *p, int *id, char *namebuf)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == '#' || *p == '\n' || *p == 0)
+		return 0;
+	if (sscanf(p, "0x%x %s\n", id, namebuf) != 2 &&
+	    sscanf(p, "0x%x %s #", id, namebuf) != 2 &&
+	    sscanf(p, "%d %s\n", id, namebuf) != 2 &&
+	    sscanf(p, "%d %s #", id, namebuf) != 2)
+		return -1;
+	return 1;
+}
+
+static struct rtnl_db *rtnl_db_open(const char *file)
+{
+	char dbname[PATH_MAX];
+	const struct rtnl_db_hdr *hdr;
+	struct rtnl_db *db;
+	struct stat st, dst;
+	void *base;
+	__u32 i;
+	int fd;
+
+	if (stat(file, &st) < 0)
+		return NULL;
+
+	snprintf(dbname, sizeof(dbname), "%s.db", file);
+	fd = open(dbname, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &dst) < 0 || dst.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, dst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	hdr = base;
+	if (hdr->magic != RTNL_DB_MAGIC || hdr->version != RTNL_DB_VERSION ||
+	    hdr->src_mtime != st.st_mtime || hdr->src_size != st.st_size ||
+	    hdr->src_ino != st.st_ino)
+		goto stale;
+	if (hdr->byname != sizeof(*hdr) + hdr->count * sizeof(struct rtnl_db_entry) ||
+	    hdr->strtab != hdr->byname + hdr->count * sizeof(__u32) ||
+	    hdr->strtab + (__u64)hdr->strlen > dst.st_size ||
+	    hdr->strlen == 0 || ((char *)base)[hdr->strtab + hdr->strlen - 1])
+		goto stale;
+
+	db = malloc(sizeof(*db));
+	if (db == NULL)
+		goto stale;
+	db->base = base;
+	db->len = dst.st_size;
+	db->hdr = hdr;
+	db->ent = (void *)(db->base + sizeof(*hdr));
+	db->byname = (void *)(db->base + hdr->byname);
+	db->strtab = db->base + hdr->strtab;
+
+	for (i = 0; i < hdr->count; i++) {
+		if (db->ent[i].name >= hdr->strlen ||
+		    db->byname[i] >= hdr->count) {
+			free(db);
+			goto stale;
+		}
+	}
+	return db;
+
+stale:
+	munmap(base, dst.st_size);
+	return NULL;
+}
+
+static const char *rtnl_db_id2name(const struct rtnl_db *db, __u32 id)
+{
+	const struct rtnl_db_entry *ent = db->ent;
+	__u32 lo = 0, hi = db->hdr->count;
+
+	while (lo < hi) {
+		__u32 mid = lo + (hi - lo) / 2;
+
+		if (ent[mid].id == id)
+			return db->strtab + ent[mid].name;
+		if (ent[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static const char *rtnl_db_name2id(const struct rtnl_db *db,
+				   const char *name, __u32 *id)
+{
+	__u32 lo = 0, hi = db->hdr->count;
+
+	while (lo < hi) {
+		__u32 mid = lo + (hi - lo) / 2;
+		const struct rtnl_db_entry *e = &db->ent[db->byname[mid]];
+		int cmp = strcmp(db->strtab + e->name, name);
+
+		if (cmp == 0) {
+			*id = e->id;
+			return db->strtab + e->name;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+struct rtnl_db_build {
+	struct rtnl_db_entry	*ent;
+	char			*strtab;
+};
+
+static __thread struct rtnl_db_build *db_sort_ctx;
+
+static int db_cmp_id(const void *a, const void *b)
+{
+	const struct rtnl_db_entry *x = a, *y = b;
+
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	/* keep file order among duplicates, the later line wins */
+	return x->name < y->name ? -1 : x->name > y->name;
+}
+
+static int db_cmp_name(const void *a, const void *b)
+{
+	const struct rtnl_db_entry *ent = db_sort_ctx->ent;
+
+	return strcmp(db_sort_ctx->strtab + ent[*(const __u32 *)a].name,
+		      db_sort_ctx->strtab + ent[*(const __u32 *)b].name);
+}
+
+int rtnl_db_compile(const char *file, const char *out)
+{
+	struct rtnl_db_build b = { NULL, NULL };
+	struct rtnl_db_hdr hdr;
+	char tmpname[PATH_MAX];
+	char buf[512], namebuf[512];
+	unsigned int n = 0, nalloc = 0, slen = 1, salloc = 0, i, j;
+	__u32 *byname = NULL;
+	struct stat st;
+	FILE *fp;
+	int id, ret = -1;
+
+	fp = fopen(file, "r");
+	if (fp == NULL || fstat(fileno(fp), &st) < 0) {
+		perror(file);
+		if (fp)
+			fclose(fp);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		int len, err = rtnl_db_parse_line(buf, &id, namebuf);
+
+		if (err < 0) {
+			fprintf(stderr, "Database %s is corrupted at %s\n",
+				file, buf);
+			goto out;
+		}
+		if (err == 0 || id < 0)
+			continue;
+
+		len = strlen(namebuf) + 1;
+		if (n == nalloc) {
+			nalloc = nalloc ? nalloc * 2 : 256;
+			b.ent = realloc(b.ent, nalloc * sizeof(*b.ent));
+		}
+		if (slen + len > salloc) {
+			salloc = salloc ? salloc * 2 : 4096;
+			if (salloc < slen + len)
+				salloc = slen + len;
+			b.strtab = realloc(b.strtab, salloc);
+		}
+		if (b.ent == NULL || b.strtab == NULL) {
+			perror("realloc");
+			goto out;
+		}
+		b.strtab[0] = 0;
+		b.ent[n].id = id;
+		b.ent[n].name = slen;
+		memcpy(b.strtab + slen, namebuf, len);
+		slen += len;
+		n++;
+	}
+
+	if (n) {
+		/* Sort by id and drop all but the last of each duplicate id,
+		 * matching what a fresh parse of the text file yields.
+		 */
+		qsort(b.ent, n, sizeof(*b.ent), db_cmp_id);
+		for (i = 0, j = 0; i < n; i++) {
+			if (i + 1 < n && b.ent[i + 1].id == b.ent[i].id)
+				continue;
+			b.ent[j++] = b.ent[i];
+		}
+		n = j;
+
+		byname = malloc(n * sizeof(*byname));
+		if (byname == NULL) {
+			perror("malloc");
+			goto out;
+		}
+		for (i = 0; i < n; i++)
+			byname[i] = i;
+		db_sort_ctx = &b;
+		qsort(byname, n, sizeof(*byname), db_cmp_name);
+	}
+	if (b.strtab == NULL) {
+		b.strtab = malloc(1);
+		if (b.strtab == NULL)
+			goto out;
+		b.strtab[0] = 0;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = RTNL_DB_MAGIC;
+	hdr.version = RTNL_DB_VERSION;
+	hdr.src_mtime = st.st_mtime;
+	hdr.src_size = st.st_size;
+	hdr.src_ino = st.st_ino;
+	hdr.count = n;
+	hdr.byname = sizeof(hdr) + n * sizeof(*b.ent);
+	hdr.strtab = hdr.byname + n * sizeof(*byname);
+	hdr.strlen = slen;
+
+	fclose(fp);
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp%d", out, getpid());
+	fp = fopen(tmpname, "w");
+	if (fp == NULL) {
+		perror(tmpname);
+		goto out;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (n && fwrite(b.ent, sizeof(*b.ent), n, fp) != n) ||
+	    (n && fwrite(byname, sizeof(*byname), n, fp) != n) ||
+	    fwrite(b.strtab, slen, 1, fp) != 1) {
+		perror(tmpname);
+		fclose(fp);
+		fp = NULL;
+		unlink(tmpname);
+		goto out;
+	}
+	if (fclose(fp) != 0 || rename(tmpname, out) < 0) {
+		perror(out);
+		fp = NULL;
+		unlink(tmpname);
+		goto out;
+	}
+	fp = NULL;
+	ret = 0;
+out:
+	if (fp)
+		fclose(fp);
+	free(byname);
+	free(b.ent);
+	free(b.strtab);
+	return ret;
+}
+
 static void
 rtnl_hash_initialize(char *file, struct rtnl_hash_entry **hash, int size)
 {
@@ -44,20 +354,15 @@ rtnl_hash_initialize(char *file, struct rtnl_hash_entry **hash, int size)
 	if (!fp)
 		return;
 	while (fgets(buf, sizeof(buf), fp)) {
-		char *p = buf;
-		int id;
+		int id, err;
 		char namebuf[512];
 
-		while (*p == ' ' || *p == '\t')
-			p++;
-		if (*p == '#' || *p == '\n' || *p == 0)
+		err = rtnl_db_parse_line(buf, &id, namebuf);
+		if (err == 0)
 			continue;
-		if (sscanf(p, "0x%x %s\n", &id, namebuf) != 2 &&
-		    sscanf(p, "0x%x %s #", &id, namebuf) != 2 &&
-		    sscanf(p, "%d %s\n", &id, namebuf) != 2 &&
-		    sscanf(p, "%d %s #", &id, namebuf) != 2) {
+		if (err < 0) {
 			fprintf(stderr, "Database %s is corrupted at %s\n",
-				file, p);
+				file, buf);
 			fclose(fp);
 			return;
 		}
@@ -75,32 +380,37 @@ rtnl_hash_initialize(char *file, struct rtnl_hash_entry **hash, int size)
 
 static void rtnl_tab_initialize(char *file, char **tab, int size)
 {
+	struct rtnl_db *db;
 	char buf[512];
 	FILE *fp;
 
+	db = rtnl_db_open(file);
+	if (db) {
+		__u32 i;
+
+		for (i = 0; i < db->hdr->count && db->ent[i].id < size; i++)
+			tab[db->ent[i].id] = (char *)db->strtab + db->ent[i].name;
+		return;
+	}
+
 	fp = fopen(file, "r");
 	if (!fp)
 		return;
 	while (fgets(buf, sizeof(buf), fp)) {
-		char *p = buf;
-		int id;
+		int id, err;
 		char namebuf[512];
 
-		while (*p == ' ' || *p == '\t')
-			p++;
-		if (*p == '#' || *p == '\n' || *p == 0)
+		err = rtnl_db_parse_line(buf, &id, namebuf);
+		if (err == 0)
 			continue;
-		if (sscanf(p, "0x%x %s\n", &id, namebuf) != 2 &&
-		    sscanf(p, "0x%x %s #", &id, namebuf) != 2 &&
-		    sscanf(p, "%d %s\n", &id, namebuf) != 2 &&
-		    sscanf(p, "%d %s #", &id, namebuf) != 2) {
+		if (err < 0) {
 			fprintf(stderr, "Database %s is corrupted at %s\n",
-				file, p);
+				file, buf);
 			fclose(fp);
 			return;
 		}
 
-		if (id<0 || id>size)
+		if (id<0 || id>=size)
 			continue;
 
 		tab[id] = strdup(namebuf);
@@ -108,6 +418,115 @@ static void rtnl_tab_initialize(char *file, char **tab, int size)
 	fclose(fp);
 }
 
+/*
+ * Reverse (name -> id) index, built once when a table is loaded so
+ * that the *_a2n() lookups do not scan every id.  Where a name is
+ * listed under several ids, the entry the old linear scan would have
+ * found first is kept.
+ */
+struct rtnl_nhash_entry {
+	struct rtnl_nhash_entry	*next;
+	char			*name;
+	__u32			id;
+};
+
+struct rtnl_nhash {
+	struct rtnl_nhash_entry	**head;
+	struct rtnl_nhash_entry	*pool;
+	unsigned int		size;
+	unsigned int		used;
+};
+
+static unsigned int rtnl_name_hash(const char *str)
+{
+	unsigned int hash = 5381;
+
+	while (*str)
+		hash = (hash << 5) + hash + (unsigned char)*str++;
+	return hash;
+}
+
+static struct rtnl_nhash_entry *
+rtnl_nhash_lookup(const struct rtnl_nhash *nh, const char *name)
+{
+	struct rtnl_nhash_entry *ne;
+
+	if (nh->head == NULL)
+		return NULL;
+
+	ne = nh->head[rtnl_name_hash(name) & (nh->size - 1)];
+	for (; ne; ne = ne->next)
+		if (strcmp(ne->name, name) == 0)
+			return ne;
+	return NULL;
+}
+
+static int rtnl_nhash_alloc(struct rtnl_nhash *nh, unsigned int count)
+{
+	unsigned int size = 256;
+
+	while (size < count)
+		size <<= 1;
+
+	nh->head = calloc(size, sizeof(*nh->head));
+	nh->pool = malloc((count ? count : 1) * sizeof(*nh->pool));
+	if (nh->head == NULL || nh->pool == NULL) {
+		free(nh->head);
+		free(nh->pool);
+		nh->head = NULL;
+		nh->pool = NULL;
+		return -1;
+	}
+	nh->size = size;
+	nh->used = 0;
+	return 0;
+}
+
+static void rtnl_nhash_add(struct rtnl_nhash *nh, char *name, __u32 id)
+{
+	struct rtnl_nhash_entry *ne, **head;
+
+	if (rtnl_nhash_lookup(nh, name))
+		return;
+
+	ne = &nh->pool[nh->used++];
+	head = &nh->head[rtnl_name_hash(name) & (nh->size - 1)];
+	ne->name = name;
+	ne->id = id;
+	ne->next = *head;
+	*head = ne;
+}
+
+static void rtnl_tab_build_nhash(struct rtnl_nhash *nh, char **tab, int size)
+{
+	int i, count = 0;
+
+	for (i = 0; i < size; i++)
+		if (tab[i])
+			count++;
+	if (rtnl_nhash_alloc(nh, count) < 0)
+		return;
+	for (i = 0; i < size; i++)
+		if (tab[i])
+			rtnl_nhash_add(nh, tab[i], i);
+}
+
+static void rtnl_hash_build_nhash(struct rtnl_nhash *nh,
+				  struct rtnl_hash_entry **hash, int size)
+{
+	struct rtnl_hash_entry *entry;
+	int i, count = 0;
+
+	for (i = 0; i < size; i++)
+		for (entry = hash[i]; entry; entry = entry->next)
+			count++;
+	if (rtnl_nhash_alloc(nh, count) < 0)
+		return;
+	for (i = 0; i < size; i++)
+		for (entry = hash[i]; entry; entry = entry->next)
+			rtnl_nhash_add(nh, entry->name, entry->id);
+}
+
 static char * rtnl_rtprot_tab[256] = {
 	[RTPROT_UNSPEC] = "none",
 	[RTPROT_REDIRECT] ="redirect",
@@ -128,13 +547,20 @@ static char * rtnl_rtprot_tab[256] = {
 
 
 
-static int rtnl_rtprot_init;
+/* Each table is read once, by whichever thread needs it first, and
+ * only read after that.
+ */
+static pthread_once_t rtnl_rtprot_once = PTHREAD_ONCE_INIT;
+static struct rtnl_nhash rtnl_rtprot_nhash;
 
 static void rtnl_rtprot_initialize(void)
 {
-	rtnl_rtprot_init = 1;
+	int phase = rtnl_phase(RTNL_PHASE_NAMES);
+
 	rtnl_tab_initialize(CONFDIR "/rt_protos",
 			    rtnl_rtprot_tab, 256);
+	rtnl_tab_build_nhash(&rtnl_rtprot_nhash, rtnl_rtprot_tab, 256);
+	rtnl_phase(phase);
 }
 
 char * rtnl_rtprot_n2a(int id, char *buf, int len)
@@ -144,8 +570,7 @@ char * rtnl_rtprot_n2a(int id, char *buf, int len)
 		return buf;
 	}
 	if (!rtnl_rtprot_tab[id]) {
-		if (!rtnl_rtprot_init)
-			rtnl_rtprot_initialize();
+		pthread_once(&rtnl_rtprot_once, rtnl_rtprot_initialize);
 	}
 	if (rtnl_rtprot_tab[id])
 		return rtnl_rtprot_tab[id];
@@ -155,27 +580,24 @@ char * rtnl_rtprot_n2a(int id, char *buf, int len)
 
 int rtnl_rtprot_a2n(__u32 *id, char *arg)
 {
-	static char *cache = NULL;
-	static unsigned long res;
+	static __thread char *cache = NULL;
+	static __thread unsigned long res;
+	struct rtnl_nhash_entry *ne;
 	char *end;
-	int i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtprot_init)
-		rtnl_rtprot_initialize();
+	pthread_once(&rtnl_rtprot_once, rtnl_rtprot_initialize);
 
-	for (i=0; i<256; i++) {
-		if (rtnl_rtprot_tab[i] &&
-		    strcmp(rtnl_rtprot_tab[i], arg) == 0) {
-			cache = rtnl_rtprot_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	ne = rtnl_nhash_lookup(&rtnl_rtprot_nhash, arg);
+	if (ne) {
+		cache = ne->name;
+		res = ne->id;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -191,17 +613,21 @@ static char * rtnl_rtscope_tab[256] = {
 	"global",
 };
 
-static int rtnl_rtscope_init;
+static pthread_once_t rtnl_rtscope_once = PTHREAD_ONCE_INIT;
+static struct rtnl_nhash rtnl_rtscope_nhash;
 
 static void rtnl_rtscope_initialize(void)
 {
-	rtnl_rtscope_init = 1;
+	int phase = rtnl_phase(RTNL_PHASE_NAMES);
+
 	rtnl_rtscope_tab[255] = "nowhere";
 	rtnl_rtscope_tab[254] = "host";
 	rtnl_rtscope_tab[253] = "link";
 	rtnl_rtscope_tab[200] = "site";
 	rtnl_tab_initialize(CONFDIR "/rt_scopes",
 			    rtnl_rtscope_tab, 256);
+	rtnl_tab_build_nhash(&rtnl_rtscope_nhash, rtnl_rtscope_tab, 256);
+	rtnl_phase(phase);
 }
 
 char * rtnl_rtscope_n2a(int id, char *buf, int len)
@@ -211,8 +637,7 @@ char * rtnl_rtscope_n2a(int id, char *buf, int len)
 		return buf;
 	}
 	if (!rtnl_rtscope_tab[id]) {
-		if (!rtnl_rtscope_init)
-			rtnl_rtscope_initialize();
+		pthread_once(&rtnl_rtscope_once, rtnl_rtscope_initialize);
 	}
 	if (rtnl_rtscope_tab[id])
 		return rtnl_rtscope_tab[id];
@@ -222,27 +647,24 @@ char * rtnl_rtscope_n2a(int id, char *buf, int len)
 
 int rtnl_rtscope_a2n(__u32 *id, char *arg)
 {
-	static char *cache = NULL;
-	static unsigned long res;
+	static __thread char *cache = NULL;
+	static __thread unsigned long res;
+	struct rtnl_nhash_entry *ne;
 	char *end;
-	int i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtscope_init)
-		rtnl_rtscope_initialize();
+	pthread_once(&rtnl_rtscope_once, rtnl_rtscope_initialize);
 
-	for (i=0; i<256; i++) {
-		if (rtnl_rtscope_tab[i] &&
-		    strcmp(rtnl_rtscope_tab[i], arg) == 0) {
-			cache = rtnl_rtscope_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	ne = rtnl_nhash_lookup(&rtnl_rtscope_nhash, arg);
+	if (ne) {
+		cache = ne->name;
+		res = ne->id;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -258,13 +680,17 @@ static char * rtnl_rtrealm_tab[256] = {
 	"unknown",
 };
 
-static int rtnl_rtrealm_init;
+static pthread_once_t rtnl_rtrealm_once = PTHREAD_ONCE_INIT;
+static struct rtnl_nhash rtnl_rtrealm_nhash;
 
 static void rtnl_rtrealm_initialize(void)
 {
-	rtnl_rtrealm_init = 1;
+	int phase = rtnl_phase(RTNL_PHASE_NAMES);
+
 	rtnl_tab_initialize(CONFDIR "/rt_realms",
 			    rtnl_rtrealm_tab, 256);
+	rtnl_tab_build_nhash(&rtnl_rtrealm_nhash, rtnl_rtrealm_tab, 256);
+	rtnl_phase(phase);
 }
 
 char * rtnl_rtrealm_n2a(int id, char *buf, int len)
@@ -274,8 +700,7 @@ char * rtnl_rtrealm_n2a(int id, char *buf, int len)
 		return buf;
 	}
 	if (!rtnl_rtrealm_tab[id]) {
-		if (!rtnl_rtrealm_init)
-			rtnl_rtrealm_initialize();
+		pthread_once(&rtnl_rtrealm_once, rtnl_rtrealm_initialize);
 	}
 	if (rtnl_rtrealm_tab[id])
 		return rtnl_rtrealm_tab[id];
@@ -286,27 +711,24 @@ char * rtnl_rtrealm_n2a(int id, char *buf, int len)
 
 int rtnl_rtrealm_a2n(__u32 *id, char *arg)
 {
-	static char *cache = NULL;
-	static unsigned long res;
+	static __thread char *cache = NULL;
+	static __thread unsigned long res;
+	struct rtnl_nhash_entry *ne;
 	char *end;
-	int i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtrealm_init)
-		rtnl_rtrealm_initialize();
+	pthread_once(&rtnl_rtrealm_once, rtnl_rtrealm_initialize);
 
-	for (i=0; i<256; i++) {
-		if (rtnl_rtrealm_tab[i] &&
-		    strcmp(rtnl_rtrealm_tab[i], arg) == 0) {
-			cache = rtnl_rtrealm_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	ne = rtnl_nhash_lookup(&rtnl_rtrealm_nhash, arg);
+	if (ne) {
+		cache = ne->name;
+		res = ne->id;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 0);
@@ -327,13 +749,20 @@ static struct rtnl_hash_entry * rtnl_rttable_hash[256] = {
 	[255] = &local_table_entry,
 };
 
-static int rtnl_rttable_init;
+static pthread_once_t rtnl_rttable_once = PTHREAD_ONCE_INIT;
+static struct rtnl_nhash rtnl_rttable_nhash;
+static struct rtnl_db *rtnl_rttable_db;
 
 static void rtnl_rttable_initialize(void)
 {
-	rtnl_rttable_init = 1;
-	rtnl_hash_initialize(CONFDIR "/rt_tables",
-			     rtnl_rttable_hash, 256);
+	int phase = rtnl_phase(RTNL_PHASE_NAMES);
+
+	rtnl_rttable_db = rtnl_db_open(CONFDIR "/rt_tables");
+	if (!rtnl_rttable_db)
+		rtnl_hash_initialize(CONFDIR "/rt_tables",
+				     rtnl_rttable_hash, 256);
+	rtnl_hash_build_nhash(&rtnl_rttable_nhash, rtnl_rttable_hash, 256);
+	rtnl_phase(phase);
 }
 
 char * rtnl_rttable_n2a(__u32 id, char *buf, int len)
@@ -344,8 +773,13 @@ char * rtnl_rttable_n2a(__u32 id, char *buf, int len)
 		snprintf(buf, len, "%u", id);
 		return buf;
 	}
-	if (!rtnl_rttable_init)
-		rtnl_rttable_initialize();
+	pthread_once(&rtnl_rttable_once, rtnl_rttable_initialize);
+	if (rtnl_rttable_db) {
+		const char *name = rtnl_db_id2name(rtnl_rttable_db, id);
+
+		if (name)
+			return (char *)name;
+	}
 	entry = rtnl_rttable_hash[id & 255];
 	while (entry && entry->id != id)
 		entry = entry->next;
@@ -357,9 +791,9 @@ char * rtnl_rttable_n2a(__u32 id, char *buf, int len)
 
 int rtnl_rttable_a2n(__u32 *id, char *arg)
 {
-	static char *cache = NULL;
-	static unsigned long res;
-	struct rtnl_hash_entry *entry;
+	static __thread char *cache = NULL;
+	static __thread unsigned long res;
+	struct rtnl_nhash_entry *ne;
 	char *end;
 	__u32 i;
 
@@ -368,21 +802,26 @@ int rtnl_rttable_a2n(__u32 *id, char *arg)
 		return 0;
 	}
 
-	if (!rtnl_rttable_init)
-		rtnl_rttable_initialize();
+	pthread_once(&rtnl_rttable_once, rtnl_rttable_initialize);
 
-	for (i=0; i<256; i++) {
-		entry = rtnl_rttable_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
-			*id = res;
+	if (rtnl_rttable_db) {
+		const char *name = rtnl_db_name2id(rtnl_rttable_db, arg, id);
+
+		if (name) {
+			cache = (char *)name;
+			res = *id;
 			return 0;
 		}
 	}
 
+	ne = rtnl_nhash_lookup(&rtnl_rttable_nhash, arg);
+	if (ne) {
+		cache = ne->name;
+		res = ne->id;
+		*id = res;
+		return 0;
+	}
+
 	i = strtoul(arg, &end, 0);
 	if (!end || end == arg || *end || i > RT_TABLE_MAX)
 		return -1;
@@ -395,13 +834,17 @@ static char * rtnl_rtdsfield_tab[256] = {
 	"0",
 };
 
-static int rtnl_rtdsfield_init;
+static pthread_once_t rtnl_rtdsfield_once = PTHREAD_ONCE_INIT;
+static struct rtnl_nhash rtnl_rtdsfield_nhash;
 
 static void rtnl_rtdsfield_initialize(void)
 {
-	rtnl_rtdsfield_init = 1;
+	int phase = rtnl_phase(RTNL_PHASE_NAMES);
+
 	rtnl_tab_initialize(CONFDIR "/rt_dsfield",
 			    rtnl_rtdsfield_tab, 256);
+	rtnl_tab_build_nhash(&rtnl_rtdsfield_nhash, rtnl_rtdsfield_tab, 256);
+	rtnl_phase(phase);
 }
 
 char * rtnl_dsfield_n2a(int id, char *buf, int len)
@@ -411,8 +854,7 @@ char * rtnl_dsfield_n2a(int id, char *buf, int len)
 		return buf;
 	}
 	if (!rtnl_rtdsfield_tab[id]) {
-		if (!rtnl_rtdsfield_init)
-			rtnl_rtdsfield_initialize();
+		pthread_once(&rtnl_rtdsfield_once, rtnl_rtdsfield_initialize);
 	}
 	if (rtnl_rtdsfield_tab[id])
 		return rtnl_rtdsfield_tab[id];
@@ -423,27 +865,24 @@ char * rtnl_dsfield_n2a(int id, char *buf, int len)
 
 int rtnl_dsfield_a2n(__u32 *id, char *arg)
 {
-	static char *cache = NULL;
-	static unsigned long res;
+	static __thread char *cache = NULL;
+	static __thread unsigned long res;
+	struct rtnl_nhash_entry *ne;
 	char *end;
-	int i;
 
 	if (cache && strcmp(cache, arg) == 0) {
 		*id = res;
 		return 0;
 	}
 
-	if (!rtnl_rtdsfield_init)
-		rtnl_rtdsfield_initialize();
+	pthread_once(&rtnl_rtdsfield_once, rtnl_rtdsfield_initialize);
 
-	for (i=0; i<256; i++) {
-		if (rtnl_rtdsfield_tab[i] &&
-		    strcmp(rtnl_rtdsfield_tab[i], arg) == 0) {
-			cache = rtnl_rtdsfield_tab[i];
-			res = i;
-			*id = res;
-			return 0;
-		}
+	ne = rtnl_nhash_lookup(&rtnl_rtdsfield_nhash, arg);
+	if (ne) {
+		cache = ne->name;
+		res = ne->id;
+		*id = res;
+		return 0;
 	}
 
 	res = strtoul(arg, &end, 16);
@@ -460,20 +899,27 @@ static struct rtnl_hash_entry * rtnl_group_hash[256] = {
 	[0] = &dflt_group_entry,
 };
 
-static int rtnl_group_init;
+static pthread_once_t rtnl_group_once = PTHREAD_ONCE_INIT;
+static struct rtnl_nhash rtnl_group_nhash;
+static struct rtnl_db *rtnl_group_db;
 
 static void rtnl_group_initialize(void)
 {
-	rtnl_group_init = 1;
-	rtnl_hash_initialize("/etc/iproute2/group",
-			     rtnl_group_hash, 256);
+	int phase = rtnl_phase(RTNL_PHASE_NAMES);
+
+	rtnl_group_db = rtnl_db_open("/etc/iproute2/group");
+	if (!rtnl_group_db)
+		rtnl_hash_initialize("/etc/iproute2/group",
+				     rtnl_group_hash, 256);
+	rtnl_hash_build_nhash(&rtnl_group_nhash, rtnl_group_hash, 256);
+	rtnl_phase(phase);
 }
 
 int rtnl_group_a2n(int *id, char *arg)
 {
-	static char *cache = NULL;
-	static unsigned long res;
-	struct rtnl_hash_entry *entry;
+	static __thread char *cache = NULL;
+	static __thread unsigned long res;
+	struct rtnl_nhash_entry *ne;
 	char *end;
 	int i;
 
@@ -482,24 +928,44 @@ int rtnl_group_a2n(int *id, char *arg)
 		return 0;
 	}
 
-	if (!rtnl_group_init)
-		rtnl_group_initialize();
+	pthread_once(&rtnl_group_once, rtnl_group_initialize);
+
+	if (rtnl_group_db) {
+		__u32 gid;
+		const char *name = rtnl_db_name2id(rtnl_group_db, arg, &gid);
 
-	for (i=0; i<256; i++) {
-		entry = rtnl_group_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
+		if (name) {
+			cache = (char *)name;
+			res = gid;
 			*id = res;
 			return 0;
 		}
 	}
 
+	ne = rtnl_nhash_lookup(&rtnl_group_nhash, arg);
+	if (ne) {
+		cache = ne->name;
+		res = ne->id;
+		*id = res;
+		return 0;
+	}
+
 	i = strtol(arg, &end, 0);
 	if (!end || end == arg || *end || i < 0)
 		return -1;
 	*id = i;
 	return 0;
 }
+
+/* Read every name table now, for a process that forks the commands
+ * using them (ip -server) instead of letting each load them on demand.
+ */
+void rtnl_names_preload(void)
+{
+	pthread_once(&rtnl_rtprot_once, rtnl_rtprot_initialize);
+	pthread_once(&rtnl_rtscope_once, rtnl_rtscope_initialize);
+	pthread_once(&rtnl_rtrealm_once, rtnl_rtrealm_initialize);
+	pthread_once(&rtnl_rttable_once, rtnl_rttable_initialize);
+	pthread_once(&rtnl_rtdsfield_once, rtnl_rtdsfield_initialize);
+	pthread_once(&rtnl_group_once, rtnl_group_initialize);
+}
@@ -26,6 +26,9 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 #include "utils.h"
@@ -276,8 +279,140 @@ static int get_addr_ipv4(__u8 *ap, const char *cp)
 	return 1;
 }
 
+/*
+ * Single pass parsers for the usual spellings of addresses and prefix
+ * lengths, as batch files hold them by the million: decimal dotted
+ * quads and IPv6 hex groups.  Anything else (octal or hex octets, an
+ * IPv4 tail on IPv6, netmasks) is left to the general parsers, so the
+ * result is always the one they would give.  *end is set to the
+ * character after the address.
+ */
+static int fast_ipv4(__u8 *ap, const char *p, const char **end)
+{
+	__u8 a[4] = { 0 };
+	int i = 0;
+
+	for (;;) {
+		unsigned n = 0;
+		const char *d = p;
+
+		while (*p >= '0' && *p <= '9') {
+			n = n * 10 + *p++ - '0';
+			if (n > 255)
+				return 0;
+		}
+		if (p == d || (*d == '0' && p - d > 1))
+			return 0;
+		a[i++] = n;
+		if (*p != '.' || i == 4)
+			break;
+		p++;
+	}
+	memcpy(ap, a, 4);
+	*end = p;
+	return 1;
+}
+
+static int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static int fast_ipv6(__u8 *ap, const char *p, const char **end)
+{
+	__u16 w[8];
+	int n = 0, gap = -1, more = 0, i;
+
+	if (*p == ':') {
+		if (p[1] != ':')
+			return 0;
+		gap = 0;
+		p += 2;
+	}
+	while (*p && *p != '/') {
+		unsigned v = 0;
+		int d, x;
+
+		for (d = 0; d < 5 && (x = hexval(*p)) >= 0; d++, p++)
+			v = (v << 4) | x;
+		if (d == 0 || d > 4 || *p == '.' || n == 8)
+			return 0;
+		w[n++] = v;
+		more = 0;
+		if (*p != ':')
+			break;
+		if (*++p == ':') {
+			if (gap >= 0)
+				return 0;
+			gap = n;
+			p++;
+		} else
+			more = 1;
+	}
+	if (more || (gap < 0 ? n != 8 : n > 7))
+		return 0;
+
+	memset(ap, 0, 16);
+	for (i = 0; i < n; i++) {
+		int k = (gap < 0 || i < gap) ? i : 8 - n + i;
+
+		ap[2 * k] = w[i] >> 8;
+		ap[2 * k + 1] = w[i];
+	}
+	*end = p;
+	return 1;
+}
+
+static int fast_addr(inet_prefix *addr, const char *name, int family,
+		     const char **end)
+{
+	if ((family == AF_UNSPEC || family == AF_INET) &&
+	    fast_ipv4((__u8 *)addr->data, name, end) &&
+	    (**end == '\0' || **end == '/')) {
+		addr->family = AF_INET;
+		addr->bytelen = 4;
+		addr->bitlen = -1;
+		return 1;
+	}
+	if ((family == AF_UNSPEC || family == AF_INET6) &&
+	    fast_ipv6((__u8 *)addr->data, name, end) &&
+	    (**end == '\0' || **end == '/')) {
+		addr->family = AF_INET6;
+		addr->bytelen = 16;
+		addr->bitlen = -1;
+		return 1;
+	}
+	return 0;
+}
+
+/* A prefix length in plain decimal */
+static int fast_plen(const char *p, unsigned *plen)
+{
+	unsigned n = 0;
+	const char *d = p;
+
+	while (*p >= '0' && *p <= '9' && p - d < 3)
+		n = n * 10 + *p++ - '0';
+	if (*p || p == d || (*d == '0' && p - d > 1))
+		return 0;
+	*plen = n;
+	return 1;
+}
+
 int get_addr_1(inet_prefix *addr, const char *name, int family)
 {
+	const char *end;
+
+	memset(addr, 0, sizeof(*addr));
+
+	if (family != AF_DECnet && fast_addr(addr, name, family, &end) &&
+	    *end == '\0')
+		return 0;
 	memset(addr, 0, sizeof(*addr));
 
 	if (strcmp(name, "default") == 0 ||
@@ -332,9 +467,24 @@ int get_prefix_1(inet_prefix *dst, char *arg, int family)
 	int err;
 	unsigned plen;
 	char *slash;
+	const char *end;
 
 	memset(dst, 0, sizeof(*dst));
 
+	if (family != AF_DECnet && fast_addr(dst, arg, family, &end)) {
+		dst->bitlen = dst->family == AF_INET6 ? 128 : 32;
+		if (*end == '\0')
+			return 0;
+		if (fast_plen(end + 1, &plen)) {
+			if (plen > dst->bitlen)
+				return -1;
+			dst->flags |= PREFIXLEN_SPECIFIED;
+			dst->bitlen = plen;
+			return 0;
+		}
+		memset(dst, 0, sizeof(*dst));
+	}
+
 	if (strcmp(arg, "default") == 0 ||
 	    strcmp(arg, "any") == 0 ||
 	    strcmp(arg, "all") == 0) {
@@ -453,6 +603,120 @@ int matches(const char *cmd, const char *pattern)
 	return memcmp(pattern, cmd, len);
 }
 
+struct kw_slot
+{
+	const char	*key;
+	unsigned int	len;
+	int		id;
+};
+
+static unsigned int kw_hash(const char *key, unsigned int len,
+			    unsigned int seed)
+{
+	unsigned int h = 2166136261U ^ seed;
+
+	while (len--)
+		h = (h ^ (unsigned char)*key++) * 16777619U;
+	return h ^ (h >> 15);
+}
+
+/* Every spelling the chain accepts, first taker wins */
+static int kw_spellings(struct kw_table *t, struct kw_slot *keys)
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < t->nkw; i++) {
+		const struct kw *k = &t->kw[i];
+		unsigned int len = strlen(k->name);
+		unsigned int l = k->abbrev ? 0 : len;
+
+		for (; l <= len; l++) {
+			if (keys) {
+				for (j = 0; j < n; j++)
+					if (keys[j].len == l &&
+					    memcmp(keys[j].key, k->name, l) == 0)
+						break;
+				if (j < n)
+					continue;
+				keys[n].key = k->name;
+				keys[n].len = l;
+				keys[n].id = k->id;
+			}
+			n++;
+		}
+	}
+	return n;
+}
+
+static int kw_build(struct kw_table *t)
+{
+	struct kw_slot *keys, *slots;
+	unsigned int size, seed;
+	int i, n;
+
+	/* Count first, with no keys nothing is deduplicated: an upper bound */
+	n = kw_spellings(t, NULL);
+	keys = calloc(n, sizeof(*keys));
+	if (keys == NULL)
+		return -1;
+	n = kw_spellings(t, keys);
+
+	for (size = 16; size < 2 * n; size <<= 1)
+		;
+	slots = NULL;
+	for (;;) {
+		slots = realloc(slots, size * sizeof(*slots));
+		if (slots == NULL) {
+			free(keys);
+			return -1;
+		}
+		for (seed = 1; seed < 256; seed++) {
+			memset(slots, 0, size * sizeof(*slots));
+			for (i = 0; i < n; i++) {
+				struct kw_slot *s = &slots[kw_hash(keys[i].key,
+								   keys[i].len,
+								   seed) & (size - 1)];
+				if (s->key)
+					break;
+				*s = keys[i];
+			}
+			if (i == n)
+				goto done;
+		}
+		size <<= 1;
+	}
+done:
+	t->maxlen = 0;
+	for (i = 0; i < n; i++)
+		if (keys[i].len > t->maxlen)
+			t->maxlen = keys[i].len;
+	free(keys);
+	t->mask = size - 1;
+	t->seed = seed;
+	t->slots = slots;
+	return 0;
+}
+
+int kw_lookup(struct kw_table *t, const char *arg)
+{
+	const struct kw_slot *s;
+	unsigned int len;
+
+	if (t->slots == NULL && kw_build(t) < 0) {
+		fprintf(stderr, "Cannot build keyword table\n");
+		exit(1);
+	}
+
+	len = strnlen(arg, t->maxlen + 1);
+	if (len > t->maxlen)
+		return -1;
+
+	s = &t->slots[kw_hash(arg, len, t->seed) & t->mask];
+	if (s->key && s->len == len && memcmp(s->key, arg, len) == 0)
+		return s->id;
+	return -1;
+}
+
 int inet_addr_match(const inet_prefix *a, const inet_prefix *b, int bits)
 {
 	const __u32 *a1 = a->data;
@@ -481,6 +745,9 @@ int inet_addr_match(const inet_prefix *a, const inet_prefix *b, int bits)
 	return 0;
 }
 
+/* The programs define it; this is for those linking the library */
+int resolve_hosts __attribute__((weak));
+
 int __iproute2_hz_internal;
 
 int __get_hz(void)
@@ -520,12 +787,95 @@ int __get_user_hz(void)
 	return sysconf(_SC_CLK_TCK);
 }
 
+/* Decimal octets, so that a dotted quad is four copies */
+static struct {
+	char	str[4];
+	__u8	len;
+} dec_octet[256];
+
+static char *fmt_ipv4(char *p, const __u8 *a)
+{
+	int i;
+
+	if (dec_octet[255].len == 0) {
+		for (i = 0; i < 256; i++)
+			dec_octet[i].len = snprintf(dec_octet[i].str,
+						    sizeof(dec_octet[i].str),
+						    "%d", i);
+	}
+
+	for (i = 0; i < 4; i++) {
+		memcpy(p, dec_octet[a[i]].str, 3);
+		p += dec_octet[a[i]].len;
+		*p++ = '.';
+	}
+	p[-1] = '\0';
+	return p - 1;
+}
+
+/* inet_ntop() output, RFC 5952 style: the first longest run of two or
+ * more zero groups becomes "::", ::a.b.c.d and ::ffff:a.b.c.d keep the
+ * dotted quad.
+ */
+static void fmt_ipv6(char *p, const __u8 *a)
+{
+	static const char hex[] = "0123456789abcdef";
+	int best = -1, bestlen = 1, cur = -1;
+	__u16 w[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = (a[2 * i] << 8) | a[2 * i + 1];
+		if (w[i] == 0) {
+			if (cur < 0)
+				cur = i;
+			if (i - cur + 1 > bestlen) {
+				best = cur;
+				bestlen = i - cur + 1;
+			}
+		} else
+			cur = -1;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (i == best) {
+			*p++ = ':';
+			if (i == 0)
+				*p++ = ':';
+			i += bestlen - 1;
+			continue;
+		}
+		if (i == 6 && best == 0 &&
+		    (bestlen == 6 || (bestlen == 5 && w[5] == 0xffff))) {
+			fmt_ipv4(p, a + 12);
+			return;
+		}
+		if (w[i] >> 12)
+			*p++ = hex[w[i] >> 12];
+		if (w[i] >> 8)
+			*p++ = hex[(w[i] >> 8) & 0xf];
+		if (w[i] >> 4)
+			*p++ = hex[(w[i] >> 4) & 0xf];
+		*p++ = hex[w[i] & 0xf];
+		if (i < 7)
+			*p++ = ':';
+	}
+	*p = '\0';
+}
+
 const char *rt_addr_n2a(int af, int len, const void *addr, char *buf, int buflen)
 {
 	switch (af) {
 	case AF_INET:
+		if (buflen < INET_ADDRSTRLEN)
+			return inet_ntop(af, addr, buf, buflen);
+		fmt_ipv4(buf, addr);
+		return buf;
 	case AF_INET6:
-		return inet_ntop(af, addr, buf, buflen);
+		if (buflen < INET6_ADDRSTRLEN)
+			return inet_ntop(af, addr, buf, buflen);
+		fmt_ipv6(buf, addr);
+		return buf;
 #ifndef ANDROID
 	case AF_IPX:
 		return ipx_ntop(af, addr, buf, buflen);
@@ -549,11 +899,192 @@ struct namerec
 	inet_prefix addr;
 };
 
+/* Shared by the threads of a process under nht_lock; names are never
+ * freed, so they can be used after it is dropped.
+ */
 #define NHASH 257
 static struct namerec *nht[NHASH];
+static pthread_mutex_t nht_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static const char *resolve_address(const void *addr, int len, int af)
+/*
+ * Prefetching.  While resolve_prefetch is set, resolve_address() only
+ * queues addresses it has not seen and answers numerically.  A dump is
+ * run once that way with its output discarded, then resolve_flush()
+ * looks every queued address up from a small pool of threads, and the
+ * real dump finds all the names (or negative entries) in nht[].
+ */
+int resolve_prefetch;
+
+#define RESOLVE_THREADS		16
+#define RESOLVE_TIMEOUT		5	/* seconds for the whole batch */
+
+struct resolve_job
 {
+	struct resolve_job *next;	/* queue of jobs not yet started */
+	struct resolve_job *all;	/* every job of this batch */
+	struct namerec *n;
+	int started;	/* taken by a worker, under resolve_lock */
+	int done;
+	int abandoned;
+	char *name;
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} sa;
+	socklen_t salen;
+};
+
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolve_cond = PTHREAD_COND_INITIALIZER;
+static struct resolve_job *resolve_queue;
+static struct resolve_job *resolve_all;
+static int resolve_pending;
+static int resolve_done;
+
+static int host_cache_key(__u8 *key, const void *addr, int len, int af)
+{
+	if (len > NAMECACHE_KEYLEN - 2)
+		return 0;
+	key[0] = 'H';
+	key[1] = af;
+	memcpy(key + 2, addr, len);
+	return len + 2;
+}
+
+static void *resolve_worker(void *arg)
+{
+	struct resolve_job *j;
+	char host[NI_MAXHOST];
+
+	pthread_mutex_lock(&resolve_lock);
+	while ((j = resolve_queue) != NULL) {
+		resolve_queue = j->next;
+		j->started = 1;
+		pthread_mutex_unlock(&resolve_lock);
+
+		if (getnameinfo(&j->sa.sa, j->salen, host, sizeof(host),
+				NULL, 0, NI_NAMEREQD) == 0)
+			j->name = strdup(host);
+
+		pthread_mutex_lock(&resolve_lock);
+		if (j->abandoned) {
+			free(j->name);
+			free(j);
+			continue;
+		}
+		j->done = 1;
+		resolve_done++;
+		pthread_cond_signal(&resolve_cond);
+	}
+	pthread_mutex_unlock(&resolve_lock);
+	return NULL;
+}
+
+static void resolve_queue_job(struct namerec *n, const void *addr,
+			      int len, int af)
+{
+	struct resolve_job *j;
+
+	if (af != AF_INET && af != AF_INET6)
+		return;
+
+	j = calloc(1, sizeof(*j));
+	if (j == NULL)
+		return;
+	j->n = n;
+	if (af == AF_INET) {
+		j->sa.sin.sin_family = AF_INET;
+		memcpy(&j->sa.sin.sin_addr, addr, 4);
+		j->salen = sizeof(j->sa.sin);
+	} else {
+		j->sa.sin6.sin6_family = AF_INET6;
+		memcpy(&j->sa.sin6.sin6_addr, addr, 16);
+		j->salen = sizeof(j->sa.sin6);
+	}
+	j->next = resolve_queue;
+	resolve_queue = j;
+	j->all = resolve_all;
+	resolve_all = j;
+	resolve_pending++;
+}
+
+static void resolve_flush_locked(void)
+{
+	struct resolve_job *j, *next;
+	struct timespec deadline;
+	int i, nthreads;
+
+	resolve_prefetch = 0;
+	if (resolve_pending == 0)
+		return;
+
+	nthreads = resolve_pending < RESOLVE_THREADS ?
+		resolve_pending : RESOLVE_THREADS;
+
+	pthread_mutex_lock(&resolve_lock);
+	for (i = 0; i < nthreads; i++) {
+		pthread_t tid;
+
+		if (pthread_create(&tid, NULL, resolve_worker, NULL) != 0)
+			break;
+		pthread_detach(tid);
+	}
+	if (i == 0) {
+		/* No threads at all: do the lookups inline. */
+		pthread_mutex_unlock(&resolve_lock);
+		resolve_worker(NULL);
+		pthread_mutex_lock(&resolve_lock);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += RESOLVE_TIMEOUT;
+	while (resolve_done < resolve_pending) {
+		if (pthread_cond_timedwait(&resolve_cond, &resolve_lock,
+					   &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	/* Whatever did not make it in time stays a negative entry.  Jobs
+	 * no worker took are freed here; those still being looked up are
+	 * left to their worker, which frees them when it is done.
+	 */
+	resolve_queue = NULL;
+	for (j = resolve_all; j; j = next) {
+		next = j->all;
+		if (j->done) {
+			__u8 key[NAMECACHE_KEYLEN];
+			int klen;
+
+			j->n->name = j->name;
+			klen = host_cache_key(key, j->n->addr.data,
+					      j->n->addr.bytelen,
+					      j->n->addr.family);
+			if (klen)
+				namecache_put(key, klen, j->name);
+			free(j);
+		} else if (j->started)
+			j->abandoned = 1;
+		else
+			free(j);
+	}
+	resolve_all = NULL;
+	resolve_pending = resolve_done = 0;
+	pthread_mutex_unlock(&resolve_lock);
+}
+
+void resolve_flush(void)
+{
+	pthread_mutex_lock(&nht_lock);
+	resolve_flush_locked();
+	pthread_mutex_unlock(&nht_lock);
+}
+
+static const char *resolve_address_locked(const void *addr, int len, int af)
+{
+	__u8 key[NAMECACHE_KEYLEN];
+	const char *name;
+	int klen;
 	struct namerec *n;
 	struct hostent *h_ent;
 	unsigned hash;
@@ -567,6 +1098,9 @@ static const char *resolve_address(const void *addr, int len, int af)
 		len = 4;
 	}
 
+	if (!resolve_prefetch && resolve_pending)
+		resolve_flush_locked();
+
 	hash = *(__u32 *)(addr + len - 4) % NHASH;
 
 	for (n = nht[hash]; n; n = n->next) {
@@ -583,16 +1117,48 @@ static const char *resolve_address(const void *addr, int len, int af)
 	memcpy(n->addr.data, addr, len);
 	n->next = nht[hash];
 	nht[hash] = n;
+
+	klen = host_cache_key(key, addr, len, af);
+	if (klen && namecache_get(key, klen, &name)) {
+		if (name)
+			n->name = strdup(name);
+		return n->name;
+	}
+
+	if (resolve_prefetch) {
+		resolve_queue_job(n, addr, len, af);
+		return NULL;
+	}
+
 	if (++notfirst == 1)
 		sethostent(1);
 	fflush(stdout);
 
 	if ((h_ent = gethostbyaddr(addr, len, af)) != NULL)
 		n->name = strdup(h_ent->h_name);
+	if (klen)
+		namecache_put(key, klen, n->name);
 
 	/* Even if we fail, "negative" entry is remembered. */
 	return n->name;
 }
+
+static const char *resolve_address(const void *addr, int len, int af)
+{
+	const char *name;
+
+	pthread_mutex_lock(&nht_lock);
+	name = resolve_address_locked(addr, len, af);
+	pthread_mutex_unlock(&nht_lock);
+	return name;
+}
+#else
+int resolve_prefetch;
+
+void resolve_flush(void)
+{
+	resolve_prefetch = 0;
+}
 #endif
 
 
@@ -690,6 +1256,16 @@ __u8* hexstring_a2n(const char *str, __u8 *buf, int blen)
 	return buf;
 }
 
+void print_uint(FILE *fp, unsigned int val)
+{
+	char buf[10], *p = buf + sizeof(buf);
+
+	do
+		*--p = '0' + val % 10;
+	while (val /= 10);
+	fwrite(p, 1, buf + sizeof(buf) - p, fp);
+}
+
 int print_timestamp(FILE *fp)
 {
 	struct timeval tv;
@@ -751,6 +1327,251 @@ ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
 	}
 	return cc;
 }
+
+/* Batch files are mapped privately and split in place: arguments point
+ * into the mapping, continuations are joined by sliding the rest of the
+ * argument back over the backslash and newline, and consumed pages are
+ * given back so a large file does not stay resident.  Input that cannot
+ * be mapped is read with getcmdline() and split the same way.
+ */
+#define CMDFILE_RELEASE	(16 << 20)
+
+int cmdfile_open(struct cmdfile *cf, FILE *in)
+{
+	struct stat st;
+	void *map;
+
+	memset(cf, 0, sizeof(*cf));
+	cf->in = in;
+
+	if (fstat(fileno(in), &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0 || ftello(in) != 0)
+		return 0;
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fileno(in), 0);
+	if (map == MAP_FAILED)
+		return 0;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	cf->map = cf->pos = cf->released = map;
+	cf->end = cf->map + st.st_size;
+	return 0;
+}
+
+void cmdfile_close(struct cmdfile *cf)
+{
+	if (cf->map)
+		munmap(cf->map, cf->end - cf->map);
+	cmdtmpl_free(cf->tmpl);
+	free(cf->line);
+	free(cf->argv);
+	memset(cf, 0, sizeof(*cf));
+}
+
+/* Arguments of the previous command are done with by now */
+static void cmdfile_release(struct cmdfile *cf)
+{
+	if (cf->pos - cf->released >= CMDFILE_RELEASE) {
+		long pg = getpagesize();
+		char *upto = cf->map + ((cf->pos - cf->map) & ~(pg - 1));
+
+		madvise(cf->released, upto - cf->released, MADV_DONTNEED);
+		cf->released = upto;
+	}
+}
+
+static void cmdfile_addarg(struct cmdfile *cf, int argc, char *arg)
+{
+	if (argc + 1 >= cf->maxargs) {
+		cf->maxargs = cf->maxargs ? 2 * cf->maxargs : 64;
+		cf->argv = realloc(cf->argv, cf->maxargs * sizeof(char *));
+		if (!cf->argv) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	cf->argv[argc] = arg;
+}
+
+/* An argument running into the end of the mapping has no room for its
+ * terminator; it is the last one, so a copy of it is cheap.
+ */
+static char *cmdfile_tail(struct cmdfile *cf, char *arg, size_t len)
+{
+	free(cf->line);
+	cf->line = malloc(len + 1);
+	if (!cf->line) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	cf->len = len + 1;
+	memcpy(cf->line, arg, len);
+	cf->line[len] = '\0';
+	return cf->line;
+}
+
+static const unsigned char cmd_special[256] = {
+	[' '] = 1, ['\t'] = 1, ['\r'] = 1, ['\n'] = 1, ['#'] = 1, ['\\'] = 1,
+};
+
+/* Split the logical line at *pp into cf->argv, stopping at end.  Returns
+ * the argument count, or -1 if input ends right after a continuation.
+ */
+static int cmdfile_split(struct cmdfile *cf, char **pp, char *end)
+{
+	char *r = *pp, *w = NULL, *arg = NULL;
+	int argc = 0;
+
+	while (r < end) {
+		char c = *r;
+
+		if (c == '\\' && r + 1 < end && r[1] == '\n') {
+			if (r + 2 == end) {
+				fprintf(stderr, "Missing continuation line\n");
+				*pp = end;
+				return -1;
+			}
+			++cmdlineno;
+			r += 2;
+			continue;
+		}
+		if (c == '\n' || c == '#') {
+			if (c == '#') {
+				r = memchr(r, '\n', end - r);
+				if (!r)
+					r = end;
+			}
+			break;
+		}
+		if (c == ' ' || c == '\t' || c == '\r') {
+			if (arg) {
+				*w = '\0';
+				cmdfile_addarg(cf, argc++, arg);
+				arg = NULL;
+			}
+			r++;
+			continue;
+		}
+		if (!arg)
+			arg = w = r;
+		if (w == r) {
+			while (r < end && !cmd_special[(unsigned char)*r])
+				r++;
+			w = r;
+		} else
+			*w++ = *r++;
+	}
+	if (arg) {
+		if (w < end || !cf->map)
+			*w = '\0';
+		else
+			arg = cmdfile_tail(cf, arg, w - arg);
+		cmdfile_addarg(cf, argc++, arg);
+	}
+	if (r < end)
+		r++;	/* the newline */
+	*pp = r;
+
+	cmdfile_addarg(cf, argc, NULL);
+	return argc;
+}
+
+/* Read the next command into cf->argv.  Returns its argument count,
+ * 0 for a blank line, or -1 at end of input.
+ */
+int cmdfile_getargs(struct cmdfile *cf, char ***argvp)
+{
+	char *p;
+	int argc;
+
+	if (cf->tmpl)
+		return cmdtmpl_getargs(cf, argvp);
+
+	if (!cf->map) {
+		ssize_t cc = getcmdline(&cf->line, &cf->len, cf->in);
+
+		if (cc < 0)
+			return -1;
+		p = cf->line;
+		argc = cmdfile_split(cf, &p, cf->line + strlen(cf->line));
+	} else {
+		if (cf->pos >= cf->end)
+			return -1;
+		cmdfile_release(cf);
+		++cmdlineno;
+		argc = cmdfile_split(cf, &cf->pos, cf->end);
+	}
+	*argvp = cf->argv;
+
+	if (argc > 0 && cf->argv[0][0] == '%')
+		return cmdtmpl_start(cf, argc, argvp);
+	return argc;
+}
+
+/* The next logical line as text for templates: continuations joined,
+ * comment dropped.  NULL at end of input.
+ */
+char *cmdfile_rawline(struct cmdfile *cf)
+{
+	size_t n = 0;
+	char *r;
+
+	if (!cf->map) {
+		if (getcmdline(&cf->line, &cf->len, cf->in) < 0)
+			return NULL;
+		return cf->line;
+	}
+
+	if (cf->pos >= cf->end)
+		return NULL;
+	cmdfile_release(cf);
+	++cmdlineno;
+
+	for (r = cf->pos; r < cf->end && *r != '\n'; r++) {
+		if (*r == '\\' && r + 1 < cf->end && r[1] == '\n') {
+			++cmdlineno;
+			r++;
+			continue;
+		}
+		if (*r == '#') {
+			r = memchr(r, '\n', cf->end - r);
+			if (!r)
+				r = cf->end;
+			break;
+		}
+		if (n + 2 > cf->len) {
+			cf->len = cf->len ? 2 * cf->len : 256;
+			cf->line = realloc(cf->line, cf->len);
+			if (!cf->line) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+		cf->line[n++] = *r;
+	}
+	cf->pos = r < cf->end ? r + 1 : r;
+	if (!cf->line) {
+		cf->len = 256;
+		cf->line = malloc(cf->len);
+		if (!cf->line) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	cf->line[n] = '\0';
+	return cf->line;
+}
+
+/* Split a line a template expanded; it ends in a newline, so that
+ * arguments are ended in place.
+ */
+int cmdfile_splitline(struct cmdfile *cf, char *line, char ***argvp)
+{
+	int argc = cmdfile_split(cf, &line, line + strlen(line));
+
+	*argvp = cf->argv;
+	return argc;
+}
 #endif
 
 /* split command line into argument vector */
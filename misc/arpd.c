@@ -18,10 +18,11 @@
 #include <netdb.h>
 #include <db_185.h>
 #include <sys/ioctl.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <time.h>
@@ -46,6 +47,10 @@ int	ifnum;
 int	*ifvec;
 char	**ifnames;
 
+/* ifvec by ifindex: open addressing, 0 is a free slot */
+int		*if_hash;
+unsigned int	if_hash_mask;
+
 struct dbkey
 {
 	__u32	iface;
@@ -60,7 +65,21 @@ struct dbkey
 
 struct rtnl_handle rth;
 
-struct pollfd pset[2];
+/*
+ * A packet socket for each interface of the command line, bound to it,
+ * so that the kernel does not even queue the ARP of the others; one for
+ * all of them without a list.  If they fit, each has its own ring.
+ */
+struct arp_sock
+{
+	int		fd;
+	unsigned char	*ring;
+	unsigned int	ring_cur;
+	unsigned int	ring_nr;
+};
+
+struct arp_sock	*arp_socks;
+int		arp_nsocks;
 int udp_sock = -1;
 
 volatile int do_exit;
@@ -91,28 +110,56 @@ int no_kernel_broadcasts;
 int broadcast_rate = 1000;
 int broadcast_burst = 3000;
 int poll_timeout = 30000;
+int sync_interval = 60;
 
 void usage(void)
 {
 	fprintf(stderr,
 		"Usage: arpd [ -lkh? ] [ -a N ] [ -b dbase ] [ -B number ]"
-		" [ -f file ] [ -n time ] [-p interval ] [ -R rate ] [ interfaces ]\n");
+		" [ -f file ] [ -n time ] [-p interval ] [ -R rate ] [ -S interval ]"
+		" [ interfaces ]\n");
 	exit(1);
 }
 
 int handle_if(int ifindex)
 {
-	int i;
+	unsigned int i;
 
 	if (ifnum == 0)
 		return 1;
 
-	for (i=0; i<ifnum; i++)
-		if (ifvec[i] == ifindex)
+	for (i = ifindex & if_hash_mask; if_hash[i];
+	     i = (i + 1) & if_hash_mask)
+		if (if_hash[i] == ifindex)
 			return 1;
 	return 0;
 }
 
+int if_hash_init(void)
+{
+	unsigned int size = 16;
+	int i;
+
+	while (size < 2 * ifnum)
+		size *= 2;
+	if_hash = calloc(size, sizeof(*if_hash));
+	if (!if_hash)
+		return -1;
+	if_hash_mask = size - 1;
+
+	for (i = 0; i < ifnum; i++) {
+		unsigned int k;
+
+		if (handle_if(ifvec[i]))
+			continue;
+		for (k = ifvec[i] & if_hash_mask; if_hash[k];
+		     k = (k + 1) & if_hash_mask)
+			;
+		if_hash[k] = ifvec[i];
+	}
+	return 0;
+}
+
 int sysctl_adjusted;
 
 void do_sysctl_adjustments(void)
@@ -178,14 +225,72 @@ void undo_sysctl_adjustments(void)
 }
 
 
+/*
+ * Probes are built into probe_queue and go out together, with one
+ * sendmmsg() where libc has it, once the batch of kernel requests
+ * that asked for them is handled.
+ */
+#define PROBE_BATCH	32
+
+struct probe
+{
+	unsigned char		buf[64];
+	int			len;
+	struct sockaddr_ll	sll;
+};
+
+struct probe	probe_queue[PROBE_BATCH];
+int		probe_count;
+
+void flush_probes(void)
+{
+	int i, sent = 0;
+
+	if (probe_count == 0)
+		return;
+
+#ifdef HAVE_SENDMMSG
+	{
+		struct mmsghdr msgs[PROBE_BATCH];
+		struct iovec iov[PROBE_BATCH];
+
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < probe_count; i++) {
+			iov[i].iov_base = probe_queue[i].buf;
+			iov[i].iov_len = probe_queue[i].len;
+			msgs[i].msg_hdr.msg_name = &probe_queue[i].sll;
+			msgs[i].msg_hdr.msg_namelen = sizeof(probe_queue[i].sll);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		while (sent < probe_count) {
+			int n = sendmmsg(arp_socks[0].fd, msgs + sent,
+					 probe_count - sent, 0);
+			if (n <= 0)
+				break;
+			sent += n;
+		}
+	}
+#else
+	for (i = 0; i < probe_count; i++)
+		if (sendto(arp_socks[0].fd, probe_queue[i].buf, probe_queue[i].len, 0,
+			   (struct sockaddr*)&probe_queue[i].sll,
+			   sizeof(probe_queue[i].sll)) >= 0)
+			sent++;
+#endif
+	stats.probes_sent += sent;
+	probe_count = 0;
+}
+
 int send_probe(int ifindex, __u32 addr)
 {
 	struct ifreq ifr;
 	struct sockaddr_in dst;
 	socklen_t len;
-	unsigned char buf[256];
+	unsigned char *buf = probe_queue[probe_count].buf;
 	struct arphdr *ah = (struct arphdr*)buf;
 	unsigned char *p = (unsigned char *)(ah+1);
+	struct sockaddr_ll *psll = &probe_queue[probe_count].sll;
 	struct sockaddr_ll sll;
 
 	memset(&ifr, 0, sizeof(ifr));
@@ -220,6 +325,7 @@ int send_probe(int ifindex, __u32 addr)
 	memcpy(p, &dst.sin_addr, 4);
 	p+=4;
 
+	memset(&sll, 0, sizeof(sll));
 	sll.sll_family = AF_PACKET;
 	memset(sll.sll_addr, 0xFF, sizeof(sll.sll_addr));
 	sll.sll_ifindex = ifindex;
@@ -230,9 +336,10 @@ int send_probe(int ifindex, __u32 addr)
 	memcpy(p, &addr, 4);
 	p+=4;
 
-	if (sendto(pset[0].fd, buf, p-buf, 0, (struct sockaddr*)&sll, sizeof(sll)) < 0)
-		return -1;
-	stats.probes_sent++;
+	*psll = sll;
+	probe_queue[probe_count].len = p - buf;
+	if (++probe_count == PROBE_BATCH)
+		flush_probes();
 	return 0;
 }
 
@@ -296,6 +403,182 @@ void prepare_neg_entry(__u8 *ndata, __u32 stamp)
 	ndata[5] = stamp;
 }
 
+/*
+ * The daemon works from an in-memory copy of the database: an open
+ * addressing table keyed by ifindex and address, holding the same
+ * records the database does.  Changed entries are marked dirty and
+ * written out by cache_sync(), which runs on SIGHUP, every
+ * sync_interval seconds and on exit; that is also where negative
+ * entries older than negative_timeout are dropped.
+ */
+
+#define ARP_DATA_MAX	16
+
+enum {
+	ENT_FREE,
+	ENT_USED,
+	ENT_DEAD,	/* deleted; dirty until removed from the database */
+};
+
+struct arp_ent
+{
+	struct dbkey	key;
+	__u8		state;
+	__u8		dirty;
+	__u8		size;
+	__u8		data[ARP_DATA_MAX];
+};
+
+struct arp_ent	*cache;
+unsigned int	cache_size;	/* a power of two */
+unsigned int	cache_slots;	/* not ENT_FREE */
+unsigned int	cache_dead;
+time_t		last_sync;
+
+unsigned int cache_hash(const struct dbkey *key)
+{
+	__u32 h = key->addr * 0x9e3779b1U ^ key->iface * 0x85ebca6bU;
+
+	return h ^ (h >> 16);
+}
+
+/* Slot holding key, or where it would go */
+struct arp_ent *cache_slot(const struct dbkey *key)
+{
+	unsigned int i = cache_hash(key) & (cache_size - 1);
+	struct arp_ent *reuse = NULL;
+
+	for (;; i = (i + 1) & (cache_size - 1)) {
+		struct arp_ent *e = &cache[i];
+
+		if (e->state == ENT_FREE)
+			return reuse ? reuse : e;
+		if (e->key.iface == key->iface && e->key.addr == key->addr)
+			return e;
+		if (e->state == ENT_DEAD && !e->dirty && reuse == NULL)
+			reuse = e;
+	}
+}
+
+int cache_resize(unsigned int size)
+{
+	struct arp_ent *old = cache;
+	unsigned int i, old_size = cache_size;
+
+	cache = calloc(size, sizeof(*cache));
+	if (cache == NULL) {
+		cache = old;
+		return -1;
+	}
+	cache_size = size;
+	cache_slots = cache_dead = 0;
+
+	for (i = 0; i < old_size; i++) {
+		struct arp_ent *e;
+
+		if (old[i].state == ENT_FREE ||
+		    (old[i].state == ENT_DEAD && !old[i].dirty))
+			continue;
+		e = cache_slot(&old[i].key);
+		*e = old[i];
+		cache_slots++;
+		if (e->state == ENT_DEAD)
+			cache_dead++;
+	}
+	free(old);
+	return 0;
+}
+
+struct arp_ent *cache_get(const struct dbkey *key)
+{
+	struct arp_ent *e;
+
+	if (cache_size == 0)
+		return NULL;
+	e = cache_slot(key);
+	return e->state == ENT_USED ? e : NULL;
+}
+
+int cache_put(const struct dbkey *key, const void *data, int size)
+{
+	struct arp_ent *e;
+
+	if (size > ARP_DATA_MAX)
+		return -1;
+	if ((cache_slots + 1) * 2 > cache_size &&
+	    cache_resize(cache_size ? cache_size * 2 : 1024) < 0)
+		return -1;
+
+	e = cache_slot(key);
+	if (e->state == ENT_FREE)
+		cache_slots++;
+	else if (e->state == ENT_DEAD)
+		cache_dead--;
+	e->key = *key;
+	e->state = ENT_USED;
+	e->dirty = 1;
+	e->size = size;
+	memcpy(e->data, data, size);
+	return 0;
+}
+
+void cache_del(struct arp_ent *e)
+{
+	e->state = ENT_DEAD;
+	e->dirty = 1;
+	cache_dead++;
+}
+
+int cache_load(void)
+{
+	DBT dbkey, dbdat;
+	struct dbkey key;
+
+	while (dbase->seq(dbase, &dbkey, &dbdat, R_NEXT) == 0) {
+		if (dbkey.size != sizeof(key))
+			continue;
+		memcpy(&key, dbkey.data, sizeof(key));
+		if (cache_put(&key, dbdat.data, dbdat.size) < 0)
+			continue;
+		cache_slot(&key)->dirty = 0;
+	}
+	last_sync = time(NULL);
+	return 0;
+}
+
+void cache_sync(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache_size; i++) {
+		struct arp_ent *e = &cache[i];
+		DBT dbkey, dbdat;
+
+		if (e->state == ENT_USED && IS_NEG(e->data) &&
+		    !NEG_VALID(e->data))
+			cache_del(e);
+		if (!e->dirty)
+			continue;
+
+		dbkey.data = &e->key;
+		dbkey.size = sizeof(e->key);
+		if (e->state == ENT_USED) {
+			dbdat.data = e->data;
+			dbdat.size = e->size;
+			dbase->put(dbase, &dbkey, &dbdat, 0);
+		} else {
+			dbase->del(dbase, &dbkey, 0);
+		}
+		e->dirty = 0;
+	}
+	dbase->sync(dbase, 0);
+	last_sync = time(NULL);
+
+	/* Rehash once a quarter of the table is tombstones */
+	if (cache_dead > cache_size / 4)
+		cache_resize(cache_size);
+}
+
 
 int do_one_request(struct nlmsghdr *n)
 {
@@ -303,11 +586,11 @@ int do_one_request(struct nlmsghdr *n)
 	int len = n->nlmsg_len;
 	struct rtattr * tb[NDA_MAX+1];
 	struct dbkey key;
-	DBT dbkey, dbdat;
+	struct arp_ent *ent;
 	int do_acct = 0;
 
 	if (n->nlmsg_type == NLMSG_DONE) {
-		dbase->sync(dbase, 0);
+		cache_sync();
 
 		/* Now we have at least mirror of kernel db, so that
 		 * may start real resolution.
@@ -337,13 +620,7 @@ int do_one_request(struct nlmsghdr *n)
 
 	key.iface = ndm->ndm_ifindex;
 	memcpy(&key.addr, RTA_DATA(tb[NDA_DST]), 4);
-	dbkey.data = &key;
-	dbkey.size = sizeof(key);
-
-	if (dbase->get(dbase, &dbkey, &dbdat, 0) != 0) {
-		dbdat.data = 0;
-		dbdat.size = 0;
-	}
+	ent = cache_get(&key);
 
 	if (n->nlmsg_type == RTM_GETNEIGH) {
 		if (!(n->nlmsg_flags&NLM_F_REQUEST))
@@ -361,24 +638,26 @@ int do_one_request(struct nlmsghdr *n)
 			 * Kernel is going to initiate broadcast resolution.
 			 * OK, we invalidate our information as well.
 			 */
-			if (dbdat.data && !IS_NEG(dbdat.data))
+			if (ent && !IS_NEG(ent->data))
 				stats.app_neg++;
 
-			dbase->del(dbase, &dbkey, 0);
+			if (ent)
+				cache_del(ent);
 		} else {
 			/* If we get this kernel does not have any information.
 			 * If we have something tell this to kernel. */
 			stats.app_recv++;
-			if (dbdat.data && !IS_NEG(dbdat.data)) {
+			if (ent && !IS_NEG(ent->data)) {
 				stats.app_success++;
-				respond_to_kernel(key.iface, key.addr, dbdat.data, dbdat.size);
+				respond_to_kernel(key.iface, key.addr,
+						  (char *)ent->data, ent->size);
 				return 0;
 			}
 
 			/* Sheeit! We have nothing to tell. */
 			/* If we have recent negative entry, be silent. */
-			if (dbdat.data && NEG_VALID(dbdat.data)) {
-				if (NEG_CNT(dbdat.data) >= active_probing) {
+			if (ent && NEG_VALID(ent->data)) {
+				if (NEG_CNT(ent->data) >= active_probing) {
 					stats.app_suppressed++;
 					return 0;
 				}
@@ -389,8 +668,8 @@ int do_one_request(struct nlmsghdr *n)
 		if (active_probing &&
 		    queue_active_probe(ndm->ndm_ifindex, key.addr) == 0 &&
 		    do_acct) {
-			NEG_CNT(dbdat.data)++;
-			dbase->put(dbase, &dbkey, &dbdat, 0);
+			NEG_CNT(ent->data)++;
+			ent->dirty = 1;
 		}
 	} else if (n->nlmsg_type == RTM_NEWNEIGH) {
 		if (n->nlmsg_flags&NLM_F_REQUEST)
@@ -400,27 +679,24 @@ int do_one_request(struct nlmsghdr *n)
 			/* Kernel was not able to resolve. Host is dead.
 			 * Create negative entry if it is not present
 			 * or renew it if it is too old. */
-			if (!dbdat.data ||
-			    !IS_NEG(dbdat.data) ||
-			    !NEG_VALID(dbdat.data)) {
+			if (!ent ||
+			    !IS_NEG(ent->data) ||
+			    !NEG_VALID(ent->data)) {
 				__u8 ndata[6];
 				stats.kern_neg++;
 				prepare_neg_entry(ndata, time(NULL));
-				dbdat.data = ndata;
-				dbdat.size = sizeof(ndata);
-				dbase->put(dbase, &dbkey, &dbdat, 0);
+				cache_put(&key, ndata, sizeof(ndata));
 			}
 		} else if (tb[NDA_LLADDR]) {
-			if (dbdat.data && !IS_NEG(dbdat.data)) {
-				if (memcmp(RTA_DATA(tb[NDA_LLADDR]), dbdat.data, dbdat.size) == 0)
+			if (ent && !IS_NEG(ent->data)) {
+				if (memcmp(RTA_DATA(tb[NDA_LLADDR]), ent->data, ent->size) == 0)
 					return 0;
 				stats.kern_change++;
 			} else {
 				stats.kern_new++;
 			}
-			dbdat.data = RTA_DATA(tb[NDA_LLADDR]);
-			dbdat.size = RTA_PAYLOAD(tb[NDA_LLADDR]);
-			dbase->put(dbase, &dbkey, &dbdat, 0);
+			cache_put(&key, RTA_DATA(tb[NDA_LLADDR]),
+				  RTA_PAYLOAD(tb[NDA_LLADDR]));
 		}
 	}
 	return 0;
@@ -431,7 +707,22 @@ void load_initial_table(void)
 	rtnl_wilddump_request(&rth, AF_INET, RTM_GETNEIGH);
 }
 
+/* Requests drained from the netlink socket per wakeup */
+#define KERN_BATCH	64
+
+int get_one_kern_msg(void);
+
 void get_kern_msg(void)
+{
+	int i;
+
+	for (i = 0; i < KERN_BATCH; i++)
+		if (get_one_kern_msg() <= 0)
+			break;
+	flush_probes();
+}
+
+int get_one_kern_msg(void)
 {
 	int status;
 	struct nlmsghdr *h;
@@ -453,49 +744,38 @@ void get_kern_msg(void)
 	status = recvmsg(rth.fd, &msg, MSG_DONTWAIT);
 
 	if (status <= 0)
-		return;
+		return status;
 
 	if (msg.msg_namelen != sizeof(nladdr))
-		return;
+		return 1;
 
 	if (nladdr.nl_pid)
-		return;
+		return 1;
 
 	for (h = (struct nlmsghdr*)buf; status >= sizeof(*h); ) {
 		int len = h->nlmsg_len;
 		int l = len - sizeof(*h);
 
 		if (l < 0 || len > status)
-			return;
+			return 1;
 
 		if (do_one_request(h) < 0)
-			return;
+			return 1;
 
 		status -= NLMSG_ALIGN(len);
 		h = (struct nlmsghdr*)((char*)h + NLMSG_ALIGN(len));
 	}
+	return 1;
 }
 
 /* Receive gratuitous ARP messages and store them, that's all. */
-void get_arp_pkt(void)
+void do_arp_pkt(const unsigned char *buf, int n, const struct sockaddr_ll *sll)
 {
-	unsigned char buf[1024];
-	struct sockaddr_ll sll;
-	socklen_t sll_len = sizeof(sll);
-	struct arphdr *a = (struct arphdr*)buf;
+	const struct arphdr *a = (const struct arphdr*)buf;
 	struct dbkey key;
-	DBT dbkey, dbdat;
-	int n;
+	struct arp_ent *ent;
 
-	n = recvfrom(pset[0].fd, buf, sizeof(buf), MSG_DONTWAIT,
-		     (struct sockaddr*)&sll, &sll_len);
-	if (n < 0) {
-		if (errno != EINTR && errno != EAGAIN)
-			syslog(LOG_ERR, "recvfrom: %m");
-		return;
-	}
-
-	if (ifnum && !handle_if(sll.sll_ifindex))
+	if (ifnum && !handle_if(sll->sll_ifindex))
 		return;
 
 	/* Sanity checks */
@@ -505,31 +785,191 @@ void get_arp_pkt(void)
 	     a->ar_op != htons(ARPOP_REPLY)) ||
 	    a->ar_pln != 4 ||
 	    a->ar_pro != htons(ETH_P_IP) ||
-	    a->ar_hln != sll.sll_halen ||
+	    a->ar_hln != sll->sll_halen ||
 	    sizeof(*a) + 2*4 + 2*a->ar_hln > n)
 		return;
 
-	key.iface = sll.sll_ifindex;
-	memcpy(&key.addr, (char*)(a+1) + a->ar_hln, 4);
+	key.iface = sll->sll_ifindex;
+	memcpy(&key.addr, (const char*)(a+1) + a->ar_hln, 4);
 
 	/* DAD message, ignore. */
 	if (key.addr == 0)
 		return;
 
-	dbkey.data = &key;
-	dbkey.size = sizeof(key);
-
-	if (dbase->get(dbase, &dbkey, &dbdat, 0) == 0 && !IS_NEG(dbdat.data)) {
-		if (memcmp(dbdat.data, a+1, dbdat.size) == 0)
+	ent = cache_get(&key);
+	if (ent && !IS_NEG(ent->data)) {
+		if (memcmp(ent->data, a+1, ent->size) == 0)
 			return;
 		stats.arp_change++;
 	} else {
 		stats.arp_new++;
 	}
 
-	dbdat.data = a+1;
-	dbdat.size = a->ar_hln;
-	dbase->put(dbase, &dbkey, &dbdat, 0);
+	cache_put(&key, a+1, a->ar_hln);
+}
+
+/*
+ * Only IPv4 ARP requests and replies are worth waking up for; the rest
+ * of the ARP traffic on a large L2 domain is dropped in the kernel.
+ * The packet socket is SOCK_DGRAM, so offset 0 is the ARP header.
+ */
+struct sock_filter arp_filter[] = {
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 2),			/* ar_pro */
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 6),
+	BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 5),			/* ar_pln */
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 4, 0, 4),
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 6),			/* ar_op */
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ARPOP_REQUEST, 1, 0),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ARPOP_REPLY, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, 1024),
+	BPF_STMT(BPF_RET|BPF_K, 0),
+};
+
+int attach_arp_filter(int fd)
+{
+	struct sock_fprog fprog = {
+		.len = sizeof(arp_filter) / sizeof(arp_filter[0]),
+		.filter = arp_filter,
+	};
+
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			  &fprog, sizeof(fprog));
+}
+
+#ifdef TPACKET3_HDRLEN
+/*
+ * With a TPACKET_V3 ring the kernel fills whole blocks of packets and
+ * hands them over at once; a flood costs a poll() per block rather
+ * than a recvfrom() per packet.
+ */
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCK_NR		32
+#define RING_IF_BLOCK_NR	4	/* for each of many interfaces */
+#define RING_FRAME_SIZE		2048
+#define RING_RETIRE_MS		10
+
+int setup_rx_ring(struct arp_sock *s, unsigned int nr)
+{
+	int fd = s->fd;
+	struct tpacket_req3 req;
+	int ver = TPACKET_V3;
+	void *p;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = nr;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * nr;
+	req.tp_retire_blk_tov = RING_RETIRE_MS;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+		goto fallback;
+
+	p = mmap(NULL, RING_BLOCK_SIZE * nr,
+		 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		memset(&req, 0, sizeof(req));
+		setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		goto fallback;
+	}
+	s->ring = p;
+	s->ring_nr = nr;
+	return 0;
+
+fallback:
+	ver = TPACKET_V1;
+	setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver));
+	return -1;
+}
+
+void get_arp_ring(struct arp_sock *s)
+{
+	for (;;) {
+		struct tpacket_block_desc *bd;
+		struct tpacket3_hdr *h;
+		unsigned int i;
+
+		bd = (struct tpacket_block_desc *)(s->ring +
+				s->ring_cur * RING_BLOCK_SIZE);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+		__sync_synchronize();
+
+		h = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			struct sockaddr_ll *sll;
+
+			sll = (struct sockaddr_ll *)((char *)h +
+					TPACKET_ALIGN(sizeof(*h)));
+			do_arp_pkt((unsigned char *)h + h->tp_net,
+				   h->tp_snaplen, sll);
+			h = (struct tpacket3_hdr *)((char *)h + h->tp_next_offset);
+		}
+
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		s->ring_cur = (s->ring_cur + 1) % s->ring_nr;
+	}
+}
+#endif
+
+/* Packets read per wakeup without a ring */
+#define ARP_BATCH	64
+
+void get_arp_pkt(struct arp_sock *s)
+{
+	unsigned char buf[1024];
+	struct sockaddr_ll sll;
+	socklen_t sll_len;
+	int i, n;
+
+#ifdef TPACKET3_HDRLEN
+	if (s->ring) {
+		get_arp_ring(s);
+		return;
+	}
+#endif
+	for (i = 0; i < ARP_BATCH; i++) {
+		sll_len = sizeof(sll);
+		n = recvfrom(s->fd, buf, sizeof(buf), MSG_DONTWAIT,
+			     (struct sockaddr*)&sll, &sll_len);
+		if (n < 0) {
+			if (errno != EINTR && errno != EAGAIN)
+				syslog(LOG_ERR, "recvfrom: %m");
+			return;
+		}
+		do_arp_pkt(buf, n, &sll);
+	}
+}
+
+int open_arp_sock(struct arp_sock *s, int ifindex, unsigned int ring_nr)
+{
+	struct sockaddr_ll sll;
+
+	s->fd = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (s->fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	/* Both are optimizations; arpd works without them */
+	if (attach_arp_filter(s->fd) < 0)
+		perror("arpd: SO_ATTACH_FILTER");
+#ifdef TPACKET3_HDRLEN
+	setup_rx_ring(s, ring_nr);
+#endif
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_ifindex = ifindex;
+	if (bind(s->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+		perror("bind");
+		return -1;
+	}
+	return 0;
 }
 
 void catch_signal(int sig, void (*handler)(int))
@@ -587,13 +1027,19 @@ void send_stats(void)
 }
 
 
+/* Events taken per epoll_wait() */
+#define ARP_EVENTS	64
+
 int main(int argc, char **argv)
 {
+	struct epoll_event ev, evs[ARP_EVENTS];
+	int epfd;
+	int i, n;
 	int opt;
 	int do_list = 0;
 	char *do_load = NULL;
 
-	while ((opt = getopt(argc, argv, "h?b:lf:a:n:p:kR:B:")) != EOF) {
+	while ((opt = getopt(argc, argv, "h?b:lf:a:n:p:kR:B:S:")) != EOF) {
 		switch (opt) {
 	        case 'b':
 			dbname = optarg;
@@ -637,6 +1083,12 @@ int main(int argc, char **argv)
 				exit(-1);
 			}
 			break;
+		case 'S':
+			if ((sync_interval = atoi(optarg)) <= 0) {
+				fprintf(stderr, "Invalid sync interval\n");
+				exit(-1);
+			}
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -673,6 +1125,10 @@ int main(int argc, char **argv)
 			}
 			ifvec[i] = ifr.ifr_ifindex;
 		}
+		if (if_hash_init() < 0) {
+			perror("malloc");
+			exit(-1);
+		}
 	}
 
 	dbase = dbopen(dbname, O_CREAT|O_RDWR, 0644, DB_HASH, NULL);
@@ -757,20 +1213,26 @@ int main(int argc, char **argv)
 	if (do_load || do_list)
 		goto out;
 
-	pset[0].fd = socket(PF_PACKET, SOCK_DGRAM, 0);
-	if (pset[0].fd < 0) {
-		perror("socket");
-		exit(-1);
+	if (cache_load() < 0) {
+		perror("arpd: cache");
+		goto do_abort;
 	}
 
-	if (1) {
-		struct sockaddr_ll sll;
-		memset(&sll, 0, sizeof(sll));
-		sll.sll_family = AF_PACKET;
-		sll.sll_protocol = htons(ETH_P_ARP);
-		sll.sll_ifindex = (ifnum == 1 ? ifvec[0] : 0);
-		if (bind(pset[0].fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
-			perror("bind");
+	arp_nsocks = ifnum ? ifnum : 1;
+	arp_socks = calloc(arp_nsocks, sizeof(*arp_socks));
+	epfd = epoll_create(arp_nsocks + 1);
+	if (!arp_socks || epfd < 0) {
+		perror("arpd: epoll");
+		goto do_abort;
+	}
+	for (i = 0; i < arp_nsocks; i++) {
+		if (open_arp_sock(&arp_socks[i], ifnum ? ifvec[i] : 0,
+				  ifnum > 1 ? RING_IF_BLOCK_NR : RING_BLOCK_NR) < 0)
+			goto do_abort;
+		ev.events = EPOLLIN|EPOLLPRI;
+		ev.data.ptr = &arp_socks[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, arp_socks[i].fd, &ev) < 0) {
+			perror("arpd: epoll_ctl");
 			goto do_abort;
 		}
 	}
@@ -779,7 +1241,12 @@ int main(int argc, char **argv)
 		perror("rtnl_open");
 		goto do_abort;
 	}
-	pset[1].fd = rth.fd;
+	ev.events = EPOLLIN|EPOLLPRI;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, rth.fd, &ev) < 0) {
+		perror("arpd: epoll_ctl");
+		goto do_abort;
+	}
 
 	load_initial_table();
 
@@ -794,12 +1261,6 @@ int main(int argc, char **argv)
 	catch_signal(SIGHUP, sig_sync);
 	catch_signal(SIGUSR1, sig_stats);
 
-#define EVENTS (POLLIN|POLLPRI|POLLERR|POLLHUP)
-	pset[0].events = EVENTS;
-	pset[0].revents = 0;
-	pset[1].events = EVENTS;
-	pset[1].revents = 0;
-
 	sigsetjmp(env, 1);
 
 	for (;;) {
@@ -807,26 +1268,29 @@ int main(int argc, char **argv)
 
 		if (do_exit)
 			break;
-		if (do_sync) {
+		if (do_sync || time(NULL) - last_sync >= sync_interval) {
 			in_poll = 0;
-			dbase->sync(dbase, 0);
+			cache_sync();
 			do_sync = 0;
 			in_poll = 1;
 		}
 		if (do_stats)
 			send_stats();
-		if (poll(pset, 2, poll_timeout) > 0) {
+		if ((n = epoll_wait(epfd, evs, ARP_EVENTS, poll_timeout)) > 0) {
 			in_poll = 0;
-			if (pset[0].revents&EVENTS)
-				get_arp_pkt();
-			if (pset[1].revents&EVENTS)
-				get_kern_msg();
+			for (i = 0; i < n; i++) {
+				if (evs[i].data.ptr)
+					get_arp_pkt(evs[i].data.ptr);
+				else
+					get_kern_msg();
+			}
 		} else {
 			do_sync = 1;
 		}
 	}
 
 	undo_sysctl_adjustments();
+	cache_sync();
 out:
 	dbase->close(dbase);
 	exit(0);
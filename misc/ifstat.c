@@ -18,6 +18,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <fnmatch.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -34,6 +36,10 @@
 
 #include <SNAPSHOT.h>
 
+#include "namespace.h"
+#include "shmstat.h"
+#include "stathist.h"
+
 int dump_zeros = 0;
 int reset_history = 0;
 int ignore_history = 0;
@@ -42,6 +48,8 @@ int no_update = 0;
 int scan_interval = 0;
 int time_constant = 0;
 int show_errors = 0;
+int compact = 0;
+int all_netns = 0;
 double W;
 char **patterns;
 int npatterns;
@@ -51,19 +59,46 @@ int source_mismatch;
 
 #define MAXS (sizeof(struct rtnl_link_stats)/sizeof(__u32))
 
+#define IFSTAT_HASH	16384
+#define IFSTAT_NETNS_HASH	256	/* other namespaces have few links */
+
 struct ifstat_ent
 {
 	struct ifstat_ent	*next;
+	struct ifstat_ent	*hash;
 	char			*name;
 	int			ifindex;
+	int			gen;
 	unsigned long long	val[MAXS];
 	double			rate[MAXS];
-	__u32			ival[MAXS];
+	__u64			ival[MAXS];
 };
 
 struct ifstat_ent *kern_db;
 struct ifstat_ent *hist_db;
 
+/* The daemon keeps its kern_db entries across samples and finds them
+ * by ifindex; link events add, rename and remove them.
+ */
+static struct ifstat_ent **kern_hash;
+static int kern_hsize = IFSTAT_HASH;
+static struct ifstat_ent **kern_tail = &kern_db;
+static int kern_gen;
+static int kern_dead;
+static struct rtnl_handle dump_rth;
+static struct rtnl_handle event_rth = { .fd = -1 };
+static int use_getstats = 1;
+static struct shmstat *shm;
+
+/* A kern_db entry as the daemon publishes it in shared memory */
+struct ifstat_shm_ent
+{
+	int			ifindex;
+	char			name[IFNAMSIZ];
+	unsigned long long	val[MAXS];
+	double			rate[MAXS];
+};
+
 static int match(const char *id)
 {
 	int i;
@@ -78,6 +113,47 @@ static int match(const char *id)
 	return 0;
 }
 
+/* The counters of a link message, 64 bit ones where the kernel has them */
+static int get_counters(__u64 *ival, struct rtattr *tb[])
+{
+	int i;
+
+	if (tb[IFLA_STATS64] &&
+	    RTA_PAYLOAD(tb[IFLA_STATS64]) >= MAXS*sizeof(__u64)) {
+		memcpy(ival, RTA_DATA(tb[IFLA_STATS64]), MAXS*sizeof(__u64));
+		return 0;
+	}
+	if (tb[IFLA_STATS] &&
+	    RTA_PAYLOAD(tb[IFLA_STATS]) >= MAXS*sizeof(__u32)) {
+		__u32 *stats = RTA_DATA(tb[IFLA_STATS]);
+
+		for (i=0; i<MAXS; i++)
+			ival[i] = stats[i];
+		return 0;
+	}
+	return -1;
+}
+
+static struct ifstat_ent *new_ent(int ifindex, const char *name,
+				  const __u64 *ival)
+{
+	struct ifstat_ent *n;
+	int i;
+
+	n = malloc(sizeof(*n));
+	if (!n)
+		abort();
+	n->hash = NULL;
+	n->gen = kern_gen;
+	n->ifindex = ifindex;
+	n->name = strdup(name);
+	memcpy(&n->ival, ival, sizeof(n->ival));
+	memset(&n->rate, 0, sizeof(n->rate));
+	for (i=0; i<MAXS; i++)
+		n->val[i] = n->ival[i];
+	return n;
+}
+
 static int get_nlmsg(const struct sockaddr_nl *who,
 		     struct nlmsghdr *m, void *arg)
 {
@@ -85,7 +161,7 @@ static int get_nlmsg(const struct sockaddr_nl *who,
 	struct rtattr * tb[IFLA_MAX+1];
 	int len = m->nlmsg_len;
 	struct ifstat_ent *n;
-	int i;
+	__u64 ival[MAXS];
 
 	if (m->nlmsg_type != RTM_NEWLINK)
 		return 0;
@@ -98,18 +174,10 @@ static int get_nlmsg(const struct sockaddr_nl *who,
 		return 0;
 
 	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
-	if (tb[IFLA_IFNAME] == NULL || tb[IFLA_STATS] == NULL)
+	if (tb[IFLA_IFNAME] == NULL || get_counters(ival, tb) < 0)
 		return 0;
 
-	n = malloc(sizeof(*n));
-	if (!n)
-		abort();
-	n->ifindex = ifi->ifi_index;
-	n->name = strdup(RTA_DATA(tb[IFLA_IFNAME]));
-	memcpy(&n->ival, RTA_DATA(tb[IFLA_STATS]), sizeof(n->ival));
-	memset(&n->rate, 0, sizeof(n->rate));
-	for (i=0; i<MAXS; i++)
-		n->val[i] = n->ival[i];
+	n = new_ent(ifi->ifi_index, RTA_DATA(tb[IFLA_IFNAME]), ival);
 	n->next = kern_db;
 	kern_db = n;
 	return 0;
@@ -187,7 +255,7 @@ void load_raw_table(FILE *fp)
 			*next++ = 0;
 			if (sscanf(p, "%llu", n->val+i) != 1)
 				abort();
-			n->ival[i] = (__u32)n->val[i];
+			n->ival[i] = n->val[i];
 			p = next;
 			if (!(next = strchr(p, ' ')))
 				abort();
@@ -209,6 +277,84 @@ void load_raw_table(FILE *fp)
 	}
 }
 
+/* A kern_db entry in the binary history file */
+struct ifstat_hist_ent
+{
+	__u32			name;
+	int			ifindex;
+	unsigned long long	val[MAXS];
+	double			rate[MAXS];
+};
+
+static struct stathist hist_map;
+
+/* Returns 1 if the history was binary and is loaded, see stathist_map() */
+static int load_hist_table(int fd)
+{
+	struct ifstat_ent **tail = &kern_db;
+	__u32 i;
+	int err;
+
+	err = stathist_map(&hist_map, fd, sizeof(struct ifstat_hist_ent));
+	if (err <= 0)
+		return err;
+
+	strcpy(info_source, hist_map.hdr->info);
+	for (i = 0; i < hist_map.hdr->count; i++) {
+		const struct ifstat_hist_ent *e;
+		struct ifstat_ent *n;
+		const char *name;
+		int k;
+
+		if ((e = stathist_rec(&hist_map, i, &name)) == NULL)
+			continue;
+		if ((n = malloc(sizeof(*n))) == NULL)
+			abort();
+		n->ifindex = e->ifindex;
+		n->name = (char *)name;
+		memcpy(n->val, e->val, sizeof(n->val));
+		memcpy(n->rate, e->rate, sizeof(n->rate));
+		for (k=0; k<MAXS; k++)
+			n->ival[k] = n->val[k];
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+	return 1;
+}
+
+/* The history as dump_raw_db(fp, 1) would write it, in binary */
+static int write_hist_db(int fd)
+{
+	struct stathist_out o;
+	struct ifstat_ent *n, *h = hist_db;
+
+	stathist_out_init(&o, sizeof(struct ifstat_hist_ent));
+	for (n = kern_db; n; n = n->next) {
+		struct ifstat_hist_ent *e;
+		unsigned long long *vals = n->val;
+		double *rates = n->rate;
+
+		if (!match(n->name)) {
+			struct ifstat_ent *h1;
+
+			for (h1 = h; h1; h1 = h1->next) {
+				if (h1->ifindex == n->ifindex) {
+					vals = h1->val;
+					rates = h1->rate;
+					h = h1->next;
+					break;
+				}
+			}
+		}
+		e = stathist_out_rec(&o, n->name);
+		e->ifindex = n->ifindex;
+		memcpy(e->val, vals, sizeof(e->val));
+		memcpy(e->rate, rates, sizeof(e->rate));
+	}
+	return stathist_out_write(&o, fd, info_source);
+}
+
 void dump_raw_db(FILE *fp, int to_hist)
 {
 	struct ifstat_ent *n, *h;
@@ -416,6 +562,58 @@ void dump_incr_db(FILE *fp)
 	}
 }
 
+static const char *stat_names[MAXS] = {
+	"rx_packets", "tx_packets", "rx_bytes", "tx_bytes",
+	"rx_errors", "tx_errors", "rx_dropped", "tx_dropped",
+	"multicast", "collisions",
+	"rx_length_errors", "rx_over_errors", "rx_crc_errors",
+	"rx_frame_errors", "rx_fifo_errors", "rx_missed_errors",
+	"tx_aborted_errors", "tx_carrier_errors", "tx_fifo_errors",
+	"tx_heartbeat_errors", "tx_window_errors",
+	"rx_compressed", "tx_compressed",
+};
+
+/* One line of DEV/COUNTER=VALUE for the counters that moved since the
+ * history, or that are not zero without one; all of them with -z.  The
+ * counters of a link are diffed as a whole first, in a loop the
+ * compiler vectorizes, so that quiet links cost no more than that.
+ */
+void dump_compact_db(FILE *fp, int incr)
+{
+	static const unsigned long long zero[MAXS];
+	struct ifstat_ent *n, *h = hist_db;
+	const char *sep = "";
+
+	for (n = kern_db; n; n = n->next) {
+		const unsigned long long *base = zero;
+		unsigned long long vals[MAXS], moved = 0;
+		struct ifstat_ent *h1;
+		int i;
+
+		for (h1 = incr ? h : NULL; h1; h1 = h1->next) {
+			if (h1->ifindex == n->ifindex) {
+				base = h1->val;
+				h = h1->next;
+				break;
+			}
+		}
+		for (i = 0; i < MAXS; i++) {
+			vals[i] = n->val[i] - base[i];
+			moved |= vals[i];
+		}
+		if ((!moved && !dump_zeros) || !match(n->name))
+			continue;
+		for (i = 0; i < MAXS; i++) {
+			if (!vals[i] && !dump_zeros)
+				continue;
+			fprintf(fp, "%s%s/%s=%llu", sep, n->name, stat_names[i],
+				vals[i]);
+			sep = " ";
+		}
+	}
+	fputc('\n', fp);
+}
+
 
 static int children;
 
@@ -423,60 +621,554 @@ void sigchild(int signo)
 {
 }
 
-void update_db(int interval)
+void sigterm(int signo)
 {
-	struct ifstat_ent *n, *h;
+	shmstat_destroy(shm);
+	_exit(0);
+}
 
-	n = kern_db;
-	kern_db = NULL;
+static struct ifstat_ent *kern_lookup(int ifindex)
+{
+	struct ifstat_ent *n;
+
+	for (n = kern_hash[ifindex & (kern_hsize-1)]; n; n = n->hash)
+		if (n->ifindex == ifindex)
+			return n;
+	return NULL;
+}
+
+static void kern_insert(struct ifstat_ent *n)
+{
+	struct ifstat_ent **h = &kern_hash[n->ifindex & (kern_hsize-1)];
+
+	n->hash = *h;
+	*h = n;
+	n->next = NULL;
+	*kern_tail = n;
+	kern_tail = &n->next;
+}
+
+/* Unhashed at once, freed by the next kern_sweep() */
+static void kern_unlink(struct ifstat_ent *n)
+{
+	struct ifstat_ent **h = &kern_hash[n->ifindex & (kern_hsize-1)];
+
+	for (; *h; h = &(*h)->hash) {
+		if (*h == n) {
+			*h = n->hash;
+			break;
+		}
+	}
+	n->gen = -1;
+	kern_dead = 1;
+}
+
+/* Drop the entries not stamped with the current generation */
+static void kern_sweep(void)
+{
+	struct ifstat_ent **np = &kern_db;
+
+	while (*np) {
+		struct ifstat_ent *n = *np;
+
+		if (n->gen == kern_gen) {
+			np = &n->next;
+			continue;
+		}
+		if (n->gen >= 0)
+			kern_unlink(n);
+		*np = n->next;
+		free(n->name);
+		free(n);
+	}
+	kern_tail = np;
+	kern_dead = 0;
+}
+
+static void sample_ent(struct ifstat_ent *n, const __u64 *ival, int interval)
+{
+	int i;
+
+	for (i = 0; i < MAXS; i++) {
+		if (ival[i] < n->ival[i]) {
+			memset(n->ival, 0, sizeof(n->ival));
+			break;
+		}
+	}
+	for (i = 0; i < MAXS; i++) {
+		double sample;
+		unsigned long long incr = ival[i] - n->ival[i];
+		n->val[i] += incr;
+		n->ival[i] = ival[i];
+		sample = (double)(incr*1000)/interval;
+		if (interval >= scan_interval) {
+			n->rate[i] += W*(sample-n->rate[i]);
+		} else if (interval >= 1000) {
+			if (interval >= time_constant) {
+				n->rate[i] = sample;
+			} else {
+				double w = W*(double)interval/scan_interval;
+				n->rate[i] += w*(sample-n->rate[i]);
+			}
+		}
+	}
+}
+
+/* A link dump or event: track the interface, and sample it if interval
+ * is set.  Only interfaces that are up are kept, as in load_info().
+ */
+static int update_link(const struct sockaddr_nl *who,
+		       struct nlmsghdr *m, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(m);
+	struct rtattr * tb[IFLA_MAX+1];
+	int len = m->nlmsg_len;
+	int interval = *(int *)arg;
+	struct ifstat_ent *n;
+	__u64 ival[MAXS];
+	const char *name;
+
+	if (m->nlmsg_type != RTM_NEWLINK && m->nlmsg_type != RTM_DELLINK)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0)
+		return -1;
+
+	n = kern_lookup(ifi->ifi_index);
+	if (m->nlmsg_type == RTM_DELLINK || !(ifi->ifi_flags&IFF_UP)) {
+		if (n)
+			kern_unlink(n);
+		return 0;
+	}
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+	if (tb[IFLA_IFNAME] == NULL || get_counters(ival, tb) < 0)
+		return 0;
+	name = RTA_DATA(tb[IFLA_IFNAME]);
+
+	if (n == NULL) {
+		kern_insert(new_ent(ifi->ifi_index, name, ival));
+		return 0;
+	}
+	if (strcmp(n->name, name)) {
+		free(n->name);
+		n->name = strdup(name);
+	}
+	if (interval)
+		sample_ent(n, ival, interval);
+	n->gen = kern_gen;
+	return 0;
+}
+
+static int update_stats(const struct sockaddr_nl *who,
+			struct nlmsghdr *m, void *arg)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(m);
+	struct rtattr * tb[IFLA_STATS_MAX+1];
+	int len = m->nlmsg_len;
+	struct ifstat_ent *n;
+	__u64 ival[MAXS];
+
+	if (m->nlmsg_type != RTM_NEWSTATS)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*ifsm));
+	if (len < 0)
+		return -1;
+
+	n = kern_lookup(ifsm->ifindex);
+	if (n == NULL)
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+	if (tb[IFLA_STATS_LINK_64] == NULL ||
+	    RTA_PAYLOAD(tb[IFLA_STATS_LINK_64]) < MAXS*sizeof(__u64))
+		return 0;
+	memcpy(ival, RTA_DATA(tb[IFLA_STATS_LINK_64]), sizeof(ival));
+	sample_ent(n, ival, *(int *)arg);
+	return 0;
+}
+
+/* Apply the queued link events; after an overrun, dump the links again */
+static void drain_events(void)
+{
+	static char buf[32768];
+	int resync = 0;
+	int zero = 0;
+
+	if (event_rth.fd < 0)
+		return;
+
+	for (;;) {
+		struct nlmsghdr *h;
+		int status;
+
+		status = recv(event_rth.fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				resync = 1;
+				continue;
+			}
+			break;
+		}
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status))
+			update_link(NULL, h, &zero);
+	}
+
+	if (resync) {
+		kern_gen++;
+		if (rtnl_wilddump_request(&dump_rth, AF_INET, RTM_GETLINK) < 0 ||
+		    rtnl_dump_filter(&dump_rth, update_link, &zero) < 0)
+			exit(1);
+		kern_sweep();
+	}
+}
+
+static int dump_stats(int interval)
+{
+	struct if_stats_msg ifsm = {
+		.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64),
+	};
+
+	if (rtnl_dump_request(&dump_rth, RTM_GETSTATS, &ifsm, sizeof(ifsm)) < 0)
+		return -1;
+	return rtnl_dump_filter(&dump_rth, update_stats, &interval);
+}
+
+/* Set up the daemon's table: entries are updated in place from then on */
+static void init_db(void)
+{
+	struct ifstat_ent *db;
+
+	kern_hash = calloc(kern_hsize, sizeof(*kern_hash));
+	if (kern_hash == NULL)
+		abort();
+	if (rtnl_open(&event_rth, RTMGRP_LINK) < 0 ||
+	    rtnl_open(&dump_rth, 0) < 0)
+		exit(1);
 
 	load_info();
 
-	h = kern_db;
-	kern_db = n;
+	db = kern_db;
+	kern_db = NULL;
+	while (db) {
+		struct ifstat_ent *n = db;
 
-	for (n = kern_db; n; n = n->next) {
-		struct ifstat_ent *h1;
-		for (h1 = h; h1; h1 = h1->next) {
-			if (h1->ifindex == n->ifindex) {
-				int i;
-				for (i = 0; i < MAXS; i++) {
-					if ((long)(h1->ival[i] - n->ival[i]) < 0) {
-						memset(n->ival, 0, sizeof(n->ival));
-						break;
-					}
-				}
-				for (i = 0; i < MAXS; i++) {
-					double sample;
-					unsigned long incr = h1->ival[i] - n->ival[i];
-					n->val[i] += incr;
-					n->ival[i] = h1->ival[i];
-					sample = (double)(incr*1000)/interval;
-					if (interval >= scan_interval) {
-						n->rate[i] += W*(sample-n->rate[i]);
-					} else if (interval >= 1000) {
-						if (interval >= time_constant) {
-							n->rate[i] = sample;
-						} else {
-							double w = W*(double)interval/scan_interval;
-							n->rate[i] += w*(sample-n->rate[i]);
-						}
-					}
-				}
+		db = db->next;
+		kern_insert(n);
+	}
+}
 
-				while (h != h1) {
-					struct ifstat_ent *tmp = h;
-					h = h->next;
-					free(tmp->name);
-					free(tmp);
-				};
-				h = h1->next;
-				free(h1->name);
-				free(h1);
+/* Only 64 bit counters are dumped, with RTM_GETSTATS; older kernels
+ * without it get full link dumps.
+ */
+void update_db(int interval)
+{
+	drain_events();
+
+	if (use_getstats && dump_stats(interval) < 0) {
+		if (errno != EOPNOTSUPP && errno != EINVAL) {
+			fprintf(stderr, "Dump terminated\n");
+			exit(1);
+		}
+		use_getstats = 0;
+	}
+	if (!use_getstats) {
+		kern_gen++;
+		if (rtnl_wilddump_request(&dump_rth, AF_INET, RTM_GETLINK) < 0 ||
+		    rtnl_dump_filter(&dump_rth, update_link, &interval) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			exit(1);
+		}
+	}
+	if (kern_dead || !use_getstats)
+		kern_sweep();
+}
+
+static struct ifstat_shm_ent *shm_fill(struct ifstat_shm_ent *e)
+{
+	struct ifstat_ent *n;
+
+	for (n = kern_db; n; n = n->next, e++) {
+		e->ifindex = n->ifindex;
+		memset(e->name, 0, sizeof(e->name));
+		strncpy(e->name, n->name, sizeof(e->name) - 1);
+		memcpy(e->val, n->val, sizeof(e->val));
+		memcpy(e->rate, n->rate, sizeof(e->rate));
+	}
+	return e;
+}
+
+/* With -N the daemon samples every namespace of NETNS_RUN_DIR besides
+ * its own.  It enters each just once, to open the netlink sockets there,
+ * which go on talking to that namespace.  Each has its own table and
+ * sockets, which netns_switch() swaps in.
+ */
+struct ifstat_netns
+{
+	struct ifstat_netns	*next;
+	char			name[NAME_MAX + 1];
+	__u64			ino;
+	int			seen;
+	size_t			count;	/* of published entries */
+	struct ifstat_ent	*db;
+	struct ifstat_ent	**tail;
+	struct ifstat_ent	**hash;
+	int			hsize;
+	int			gen;
+	int			dead;
+	struct rtnl_handle	dump_rth;
+	struct rtnl_handle	event_rth;
+	int			use_getstats;
+};
+
+static struct ifstat_netns self_netns;
+static struct ifstat_netns *cur_netns = &self_netns;
+static int self_netns_fd = -1;
+
+static void netns_switch(struct ifstat_netns *ns)
+{
+	struct ifstat_netns *c = cur_netns;
+
+	if (ns == c)
+		return;
+	c->db = kern_db;
+	/* kern_tail may point at kern_db itself */
+	c->tail = kern_tail == &kern_db ? &c->db : kern_tail;
+	c->hash = kern_hash;
+	c->hsize = kern_hsize;
+	c->gen = kern_gen;
+	c->dead = kern_dead;
+	c->dump_rth = dump_rth;
+	c->event_rth = event_rth;
+	c->use_getstats = use_getstats;
+
+	kern_db = ns->db;
+	kern_tail = ns->tail == &ns->db ? &kern_db : ns->tail;
+	kern_hash = ns->hash;
+	kern_hsize = ns->hsize;
+	kern_gen = ns->gen;
+	kern_dead = ns->dead;
+	dump_rth = ns->dump_rth;
+	event_rth = ns->event_rth;
+	use_getstats = ns->use_getstats;
+	cur_netns = ns;
+}
+
+static struct ifstat_netns *netns_open(const char *name, __u64 ino)
+{
+	struct ifstat_netns *ns;
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, name);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (setns(fd, CLONE_NEWNET) < 0) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	if ((ns = calloc(1, sizeof(*ns))) == NULL)
+		abort();
+	strcpy(ns->name, name);
+	ns->ino = ino;
+	ns->tail = &ns->db;
+	ns->hsize = IFSTAT_NETNS_HASH;
+	ns->event_rth.fd = -1;
+	ns->use_getstats = 1;
+	netns_switch(ns);
+	init_db();
+	netns_switch(&self_netns);
+
+	if (setns(self_netns_fd, CLONE_NEWNET) < 0)
+		exit(1);
+	return ns;
+}
+
+static void netns_free(struct ifstat_netns *ns)
+{
+	while (ns->db) {
+		struct ifstat_ent *n = ns->db;
+
+		ns->db = n->next;
+		free(n->name);
+		free(n);
+	}
+	if (ns->event_rth.fd >= 0)
+		rtnl_close(&ns->event_rth);
+	rtnl_close(&ns->dump_rth);
+	free(ns->hash);
+	free(ns);
+}
+
+/* Follow NETNS_RUN_DIR: enter the new namespaces, drop those that are
+ * gone or whose name now stands for another one.
+ */
+static void netns_scan(void)
+{
+	struct ifstat_netns *ns, **np;
+	struct dirent *de;
+	DIR *dir;
+
+	for (ns = self_netns.next; ns; ns = ns->next)
+		ns->seen = 0;
+
+	dir = opendir(NETNS_RUN_DIR);
+	while (dir && (de = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		struct stat stb;
+
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, de->d_name);
+		if (stat(path, &stb) < 0 || stb.st_ino == self_netns.ino)
+			continue;
+		for (ns = self_netns.next; ns; ns = ns->next)
+			if (ns->ino == stb.st_ino && !strcmp(ns->name, de->d_name))
 				break;
-			}
+		if (ns == NULL &&
+		    (ns = netns_open(de->d_name, stb.st_ino)) != NULL) {
+			ns->next = self_netns.next;
+			self_netns.next = ns;
+		}
+		if (ns)
+			ns->seen = 1;
+	}
+	if (dir)
+		closedir(dir);
+
+	for (np = &self_netns.next; (ns = *np) != NULL; ) {
+		if (ns->seen) {
+			np = &ns->next;
+			continue;
 		}
+		*np = ns->next;
+		netns_free(ns);
+	}
+}
+
+static void update_netns(int interval)
+{
+	struct ifstat_netns *ns;
+
+	netns_scan();
+	for (ns = &self_netns; ns; ns = ns->next) {
+		netns_switch(ns);
+		update_db(interval);
+	}
+	netns_switch(&self_netns);
+}
+
+/* The tables of all namespaces, each after its struct shmstat_ns */
+static void publish_netns(void)
+{
+	struct ifstat_netns *ns;
+	struct ifstat_ent *n;
+	size_t size = 0;
+	char *p;
+
+	for (ns = &self_netns; ns; ns = ns->next) {
+		netns_switch(ns);
+		ns->count = 0;
+		for (n = kern_db; n; n = n->next)
+			ns->count++;
+		size += sizeof(struct shmstat_ns) +
+			ns->count * sizeof(struct ifstat_shm_ent);
+	}
+	netns_switch(&self_netns);
+	if ((p = shmstat_begin(shm, size)) == NULL)
+		return;
+	for (ns = &self_netns; ns; ns = ns->next) {
+		struct shmstat_ns *h = (struct shmstat_ns *)p;
+
+		memset(h, 0, sizeof(*h));
+		h->ino = ns->ino;
+		h->count = ns->count;
+		snprintf(h->name, sizeof(h->name), "%.*s",
+			 (int)sizeof(h->name) - 1, ns->name);
+		netns_switch(ns);
+		p = (char *)shm_fill((struct ifstat_shm_ent *)(h + 1));
+	}
+	netns_switch(&self_netns);
+	shmstat_end(shm);
+}
+
+static void publish_db(void)
+{
+	struct ifstat_shm_ent *e;
+	struct ifstat_ent *n;
+	size_t cnt = 0;
+
+	if (shm == NULL)
+		return;
+	if (all_netns) {
+		publish_netns();
+		return;
+	}
+	for (n = kern_db; n; n = n->next)
+		cnt++;
+	if ((e = shmstat_begin(shm, cnt * sizeof(*e))) == NULL)
+		return;
+	shm_fill(e);
+	shmstat_end(shm);
+}
+
+/* The table of a running daemon, from its shared memory segment */
+static int load_shm_db(void)
+{
+	struct ifstat_ent *db = NULL;
+	struct ifstat_shm_ent *tbl;
+	char info[sizeof(info_source)];
+	char name[64];
+	size_t len, i;
+
+	shmstat_name(name, sizeof(name), "ifstat", getuid());
+	tbl = shmstat_read(name, &len, info, sizeof(info));
+	if (tbl == NULL && getuid()) {
+		shmstat_name(name, sizeof(name), "ifstat", 0);
+		tbl = shmstat_read(name, &len, info, sizeof(info));
+	}
+	if (tbl == NULL)
+		tbl = shmstat_read_netns("ifstat", sizeof(*tbl), &len,
+					 info, sizeof(info));
+	if (tbl == NULL)
+		return -1;
+
+	if (info_source[0] && strcmp(info_source, info))
+		source_mismatch = 1;
+	strcpy(info_source, info);
+
+	for (i = 0; i < len / sizeof(*tbl); i++) {
+		struct ifstat_ent *n = malloc(sizeof(*n));
+		int k;
+
+		if (!n)
+			abort();
+		n->ifindex = tbl[i].ifindex;
+		n->name = strdup(tbl[i].name);
+		memcpy(n->val, tbl[i].val, sizeof(n->val));
+		memcpy(n->rate, tbl[i].rate, sizeof(n->rate));
+		for (k=0; k<MAXS; k++)
+			n->ival[k] = n->val[k];
+		n->next = db;
+		db = n;
+	}
+	free(tbl);
+
+	while (db) {
+		struct ifstat_ent *n = db;
+
+		db = db->next;
+		n->next = kern_db;
+		kern_db = n;
 	}
+	return 0;
 }
 
 #define T_DIFF(a,b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
@@ -484,6 +1176,8 @@ void update_db(int interval)
 
 void server_loop(int fd)
 {
+	char name[64];
+
 	struct timeval snaptime = { 0 };
 	struct pollfd p;
 	p.fd = fd;
@@ -492,7 +1186,20 @@ void server_loop(int fd)
 	sprintf(info_source, "%d.%lu sampling_interval=%d time_const=%d",
 		getpid(), (unsigned long)random(), scan_interval/1000, time_constant/1000);
 
-	load_info();
+	init_db();
+
+	if (all_netns) {
+		self_netns.ino = shmstat_netns();
+		self_netns_fd = open("/proc/self/ns/net", O_RDONLY);
+		if (self_netns_fd < 0)
+			exit(1);
+		netns_scan();
+		shmstat_netns_name(name, sizeof(name), "ifstat", getuid());
+	} else {
+		shmstat_name(name, sizeof(name), "ifstat", getuid());
+	}
+	shm = shmstat_create(name, info_source);
+	publish_db();
 
 	for (;;) {
 		int status;
@@ -502,7 +1209,11 @@ void server_loop(int fd)
 		gettimeofday(&now, NULL);
 		tdiff = T_DIFF(now, snaptime);
 		if (tdiff >= scan_interval) {
-			update_db(tdiff);
+			if (all_netns)
+				update_netns(tdiff);
+			else
+				update_db(tdiff);
+			publish_db();
 			snaptime = now;
 			tdiff = 0;
 		}
@@ -521,8 +1232,14 @@ void server_loop(int fd)
 				} else {
 					FILE *fp = fdopen(clnt, "w");
 					if (fp) {
-						if (tdiff > 0)
+						if (tdiff > 0) {
+							/* Leave the parent's
+							 * sockets alone */
+							event_rth.fd = -1;
+							if (rtnl_open(&dump_rth, 0) < 0)
+								exit(1);
 							update_db(tdiff);
+						}
 						dump_raw_db(fp, 0);
 					}
 					exit(0);
@@ -555,9 +1272,11 @@ static void usage(void)
 "Usage: ifstat [OPTION] [ PATTERN [ PATTERN ] ]\n"
 "   -h, --help		this message\n"
 "   -a, --ignore	ignore history\n"
+"   -c, --compact	one line of the non-zero counters, as DEV/NAME=VALUE\n"
 "   -d, --scan=SECS	sample every statistics every SECS\n"
 "   -e, --errors	show errors\n"
 "   -n, --nooutput	do history only\n"
+"   -N, --all-netns	with -d, sample all named network namespaces too\n"
 "   -r, --reset		reset history\n"
 "   -s, --noupdate	don;t update history\n"
 "   -t, --interval=SECS	report average over the last SECS\n"
@@ -570,9 +1289,11 @@ static void usage(void)
 static const struct option longopts[] = {
 	{ "help", 0, 0, 'h' },
 	{ "ignore",  0,  0, 'a' },
+	{ "compact", 0, 0, 'c' },
 	{ "scan", 1, 0, 'd'},
 	{ "errors", 0, 0, 'e' },
 	{ "nooutput", 0, 0, 'n' },
+	{ "all-netns", 0, 0, 'N' },
 	{ "reset", 0, 0, 'r' },
 	{ "noupdate", 0, 0, 's' },
 	{ "interval", 1, 0, 't' },
@@ -586,10 +1307,11 @@ int main(int argc, char *argv[])
 	char hist_name[128];
 	struct sockaddr_un sun;
 	FILE *hist_fp = NULL;
+	char *end;
 	int ch;
 	int fd;
 
-	while ((ch = getopt_long(argc, argv, "hvVzrnasd:t:eK",
+	while ((ch = getopt_long(argc, argv, "hvVzrnascNd:t:eK",
 			longopts, NULL)) != EOF) {
 		switch(ch) {
 		case 'z':
@@ -607,12 +1329,18 @@ int main(int argc, char *argv[])
 		case 'n':
 			no_output = 1;
 			break;
+		case 'N':
+			all_netns = 1;
+			break;
 		case 'e':
 			show_errors = 1;
 			break;
+		case 'c':
+			compact = 1;
+			break;
 		case 'd':
-			scan_interval = atoi(optarg) * 1000;
-			if (scan_interval <= 0) {
+			scan_interval = strtod(optarg, &end) * 1000;
+			if (*end || scan_interval <= 0) {
 				fprintf(stderr, "ifstat: invalid scan interval\n");
 				exit(-1);
 			}
@@ -665,6 +1393,8 @@ int main(int argc, char *argv[])
 		}
 		signal(SIGPIPE, SIG_IGN);
 		signal(SIGCHLD, sigchild);
+		signal(SIGTERM, sigterm);
+		signal(SIGINT, sigterm);
 		server_loop(fd);
 		exit(0);
 	}
@@ -720,13 +1450,25 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		load_raw_table(hist_fp);
+		switch (load_hist_table(fileno(hist_fp))) {
+		case 0:
+			load_raw_table(hist_fp);
+			break;
+		case -1:
+			fprintf(stderr, "ifstat: history file is damaged, resetting\n");
+			break;
+		}
 
 		hist_db = kern_db;
 		kern_db = NULL;
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	if (load_shm_db() == 0) {
+		if (hist_db && source_mismatch) {
+			fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
 	    (connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0
 	     || (strcpy(sun.sun_path+1, "ifstat0"),
 		 connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
@@ -752,16 +1494,18 @@ int main(int argc, char *argv[])
 	}
 
 	if (!no_output) {
-		if (ignore_history || hist_db == NULL)
+		if (compact)
+			dump_compact_db(stdout, !ignore_history && hist_db);
+		else if (ignore_history || hist_db == NULL)
 			dump_kern_db(stdout);
 		else
 			dump_incr_db(stdout);
 	}
 	if (!no_update) {
-		ftruncate(fileno(hist_fp), 0);
-		rewind(hist_fp);
-		dump_raw_db(hist_fp, 1);
-		fflush(hist_fp);
+		if (write_hist_db(fileno(hist_fp)) < 0) {
+			perror("ifstat: write history file");
+			exit(-1);
+		}
 	}
 	exit(0);
 }
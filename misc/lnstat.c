@@ -26,7 +26,7 @@
 #define FIELD_WIDTH_DEFAULT	8
 #define FIELD_WIDTH_MAX		20
 
-#define DEFAULT_INTERVAL	2
+#define DEFAULT_INTERVAL	2000		/* milliseconds */
 
 #define HDR_LINE_LENGTH		(MAX_FIELDS*FIELD_WIDTH_MAX)
 
@@ -35,6 +35,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <linux/types.h>
 
 #include "lnstat.h"
 
@@ -46,6 +50,7 @@ static struct option opts[] = {
 	{ "help", 0, NULL, 'h' },
 	{ "interval", 1, NULL, 'i' },
 	{ "keys", 1, NULL, 'k' },
+	{ "output", 1, NULL, 'o' },
 	{ "subject", 1, NULL, 's' },
 	{ "width", 1, NULL, 'w' },
 };
@@ -66,8 +71,10 @@ static int usage(char *name, int exit_code)
 	fprintf(stderr, "\t-f --file <file>\tStatistics file to use\n");
 	fprintf(stderr, "\t-h --help\t\tThis help message\n");
 	fprintf(stderr, "\t-i --interval <intv>\t"
-			"Set interval to 'intv' seconds\n");
+			"Set interval to 'intv' seconds, may be fractional\n");
 	fprintf(stderr, "\t-k --keys k,k,k,...\tDisplay only keys specified\n");
+	fprintf(stderr, "\t-o --output <fmt>\t"
+			"Output as table, csv or binary\n");
 	fprintf(stderr, "\t-s --subject [0-2]\t?\n");
 	fprintf(stderr, "\t-w --width n,n,n,...\tWidth for each field\n");
 	fprintf(stderr, "\n");
@@ -88,26 +95,125 @@ struct field_params {
 	struct field_param params[MAX_FIELDS];
 };
 
+enum output {
+	OUTPUT_TABLE,
+	OUTPUT_CSV,
+	OUTPUT_BINARY,
+};
+
+/* Right-aligned in width columns, as "%*lu" would print it */
+static char *put_ulong(char *p, unsigned long v, unsigned int width)
+{
+	char tmp[24];
+	unsigned int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (width > n) {
+		*p++ = ' ';
+		width--;
+	}
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+/* Each tick makes one line in a buffer and writes it at once.  Binary
+ * records are native __u64s: the time in microseconds since the epoch,
+ * then the fields in the order of the header.
+ */
 static void print_line(FILE *of, const struct lnstat_file *lnstat_files,
-		       const struct field_params *fp)
+		       const struct field_params *fp, enum output output)
 {
+	char line[MAX_FIELDS * 24 + 32];
+	__u64 rec[MAX_FIELDS + 1];
+	struct timeval tv;
+	char *p = line;
 	int i;
 
-	for (i = 0; i < fp->num; i++) {
-		struct lnstat_field *lf = fp->params[i].lf;
-		char formatbuf[255];
+	if (output == OUTPUT_BINARY) {
+		gettimeofday(&tv, NULL);
+		rec[0] = tv.tv_sec * 1000000ULL + tv.tv_usec;
+		for (i = 0; i < fp->num; i++)
+			rec[i + 1] = fp->params[i].lf->result;
+		fwrite(rec, sizeof(rec[0]), fp->num + 1, of);
+		return;
+	}
 
-		snprintf(formatbuf, sizeof(formatbuf)-1, "%%%ulu|",
-			 fp->params[i].print.width);
-		fprintf(of, formatbuf, lf->result);
+	if (output == OUTPUT_CSV) {
+		gettimeofday(&tv, NULL);
+		p = put_ulong(p, tv.tv_sec, 0);
+		*p++ = '.';
+		p = put_ulong(p, tv.tv_usec / 1000 + 1000, 0);
+		/* The thousand only pads the milliseconds with zeroes */
+		memmove(p - 4, p - 3, 3);
+		p--;
+		for (i = 0; i < fp->num; i++) {
+			*p++ = ',';
+			p = put_ulong(p, fp->params[i].lf->result, 0);
+		}
+	} else {
+		for (i = 0; i < fp->num; i++) {
+			p = put_ulong(p, fp->params[i].lf->result,
+				      fp->params[i].print.width);
+			*p++ = '|';
+		}
 	}
+	*p++ = '\n';
+	fwrite(line, 1, p - line, of);
+}
+
+static void print_csv_hdr(FILE *of, const struct field_params *fp)
+{
+	int i;
+
+	fputs("time", of);
+	for (i = 0; i < fp->num; i++)
+		fprintf(of, ",%s:%s", fp->params[i].lf->file->basename,
+			fp->params[i].lf->name);
 	fputc('\n', of);
 }
 
+/* Files none of the chosen fields are in are not read at all, and the
+ * others only up to their last chosen column.
+ */
+static struct lnstat_file *prune_files(struct lnstat_file *lnstat_files,
+				       const struct field_params *fps)
+{
+	struct lnstat_file *lf, *next, *used = NULL;
+	int i;
+
+	for (lf = lnstat_files; lf; lf = lf->next)
+		lf->scan_fields = 0;
+	for (i = 0; i < fps->num; i++) {
+		struct lnstat_field *f = fps->params[i].lf;
+
+		if (f->file->scan_fields < f->num + 1)
+			f->file->scan_fields = f->num + 1;
+	}
+	/* Keeping the order of the list */
+	for (lf = lnstat_files; lf; lf = next) {
+		next = lf->next;
+		if (lf->scan_fields == 0)
+			continue;
+		lf->next = used;
+		used = lf;
+	}
+	for (lf = used, used = NULL; lf; lf = next) {
+		next = lf->next;
+		lf->next = used;
+		used = lf;
+	}
+	return used;
+}
+
 /* find lnstat_field according to user specification */
 static int map_field_params(struct lnstat_file *lnstat_files,
 			    struct field_params *fps, int interval)
 {
+	struct timeval tv = { interval / 1000, interval % 1000 * 1000 };
 	int i, j = 0;
 	struct lnstat_file *lf;
 
@@ -116,8 +222,7 @@ static int map_field_params(struct lnstat_file *lnstat_files,
 		for (lf = lnstat_files; lf; lf = lf->next) {
 			for (i = 0; i < lf->num_fields; i++) {
 				fps->params[j].lf = &lf->fields[i];
-				fps->params[j].lf->file->interval.tv_sec =
-								interval;
+				fps->params[j].lf->file->interval = tv;
 				if (!fps->params[j].print.width)
 					fps->params[j].print.width =
 							FIELD_WIDTH_DEFAULT;
@@ -144,7 +249,7 @@ static int map_field_params(struct lnstat_file *lnstat_files,
 				fps->params[i].name);
 			return 0;
 		}
-		fps->params[i].lf->file->interval.tv_sec = interval;
+		fps->params[i].lf->file->interval = tv;
 		if (!fps->params[i].print.width)
 			fps->params[i].print.width = FIELD_WIDTH_DEFAULT;
 	}
@@ -214,12 +319,48 @@ static int print_hdr(FILE *of, struct table_hdr *th)
 }
 
 
+/* A timer firing every interval milliseconds at absolute times, so the
+ * time spent reading and printing does not make the samples drift.
+ */
+static int open_timer(int interval)
+{
+	struct itimerspec its = {
+		{ interval / 1000, interval % 1000 * 1000000 }, { 0, 0 }
+	};
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (fd < 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+	its.it_value.tv_sec += its.it_interval.tv_sec;
+	its.it_value.tv_nsec += its.it_interval.tv_nsec;
+	if (its.it_value.tv_nsec >= 1000000000) {
+		its.it_value.tv_sec++;
+		its.it_value.tv_nsec -= 1000000000;
+	}
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void wait_interval(int tfd, int interval)
+{
+	unsigned long long ticks;
+
+	if (tfd < 0 || read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks))
+		usleep(interval * 1000);
+}
+
 int main(int argc, char **argv)
 {
 	struct lnstat_file *lnstat_files;
 	const char *basename;
 	int c;
 	int interval = DEFAULT_INTERVAL;
+	enum output output = OUTPUT_TABLE;
 	int hdr = 2;
 	enum {
 		MODE_DUMP,
@@ -248,7 +389,7 @@ int main(int argc, char **argv)
 		num_req_files = 1;
 	}
 
-	while ((c = getopt_long(argc, argv,"Vc:df:h?i:k:s:w:",
+	while ((c = getopt_long(argc, argv,"Vc:df:h?i:k:o:s:w:",
 				opts, NULL)) != -1) {
 		int i, len = 0;
 		char *tmp, *tok;
@@ -268,7 +409,20 @@ int main(int argc, char **argv)
 				usage(argv[0], 0);
 				break;
 			case 'i':
-				sscanf(optarg, "%u", &interval);
+				/* Milliseconds, rounded; less is a second */
+				interval = strtod(optarg, NULL) * 1000 + 0.5;
+				if (interval < 1)
+					interval = 1000;
+				break;
+			case 'o':
+				if (!strcmp(optarg, "table"))
+					output = OUTPUT_TABLE;
+				else if (!strcmp(optarg, "csv"))
+					output = OUTPUT_CSV;
+				else if (!strcmp(optarg, "binary"))
+					output = OUTPUT_BINARY;
+				else
+					usage(argv[0], 1);
 				break;
 			case 'k':
 				tmp = strdup(optarg);
@@ -319,7 +473,7 @@ int main(int argc, char **argv)
 				       (const char **) req_files);
 
 	switch (mode) {
-		int i;
+		int i, tfd;
 		struct table_hdr *header;
 	case MODE_DUMP:
 		lnstat_dump(stderr, lnstat_files);
@@ -328,21 +482,24 @@ int main(int argc, char **argv)
 
 		if (!map_field_params(lnstat_files, &fp, interval))
 			exit(1);
+		lnstat_files = prune_files(lnstat_files, &fp);
 
 		header = build_hdr_string(lnstat_files, &fp, 80);
 		if (!header)
 			exit(1);
 
-		if (interval < 1 )
-			interval=1;
-
+		tfd = count > 1 ? open_timer(interval) : -1;
 		for (i = 0; i < count; i++) {
-			if  ((hdr > 1 && (! (i % 20))) || (hdr == 1 && i == 0))
+			if (i)
+				wait_interval(tfd, interval);
+			if (output == OUTPUT_TABLE &&
+			    ((hdr > 1 && (! (i % 20))) || (hdr == 1 && i == 0)))
 				print_hdr(stdout, header);
+			else if (output == OUTPUT_CSV && hdr && i == 0)
+				print_csv_hdr(stdout, &fp);
 			lnstat_update(lnstat_files);
-			print_line(stdout, lnstat_files, &fp);
+			print_line(stdout, lnstat_files, &fp, output);
 			fflush(stdout);
-			sleep(interval);
 		}
 	}
 
@@ -28,8 +28,11 @@ struct lnstat_file {
 	struct timeval last_read;		/* last time of read */
 	struct timeval interval;		/* interval */
 	int compat;				/* 1 == backwards compat mode */
-	FILE *fp;
+	int fd;					/* kept open, read with pread() */
+	char *buf;				/* whole file as last read */
+	size_t bufsize;
 	unsigned int num_fields;		/* number of fields */
+	unsigned int scan_fields;		/* leading fields parsed, 0: all */
 	struct lnstat_field fields[LNSTAT_MAX_FIELDS_PER_LINE];
 };
 
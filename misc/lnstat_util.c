@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <time.h>
 
@@ -35,53 +36,99 @@
 
 #define RTSTAT_COMPAT_LINE "entries  in_hit in_slow_tot in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search\n"
 
-/* Read (and summarize for SMP) the different stats vars. */
-static int scan_lines(struct lnstat_file *lf, int i)
+/* Read the whole file from the start into lf->buf, which grows until
+ * the file fits; the descriptor stays open for the next tick.
+ */
+static int lnstat_read(struct lnstat_file *lf)
 {
-	int j, num_lines = 0;
-
-	for (j = 0; j < lf->num_fields; j++)
-		lf->fields[j].values[i] = 0;
+	for (;;) {
+		ssize_t n = pread(lf->fd, lf->buf, lf->bufsize - 1, 0);
+
+		if (n < 0)
+			return -1;
+		if (n < lf->bufsize - 1) {
+			lf->buf[n] = 0;
+			return n;
+		}
+		lf->bufsize *= 2;
+		lf->buf = realloc(lf->buf, lf->bufsize);
+		if (!lf->buf)
+			return -1;
+	}
+}
 
-	while(!feof(lf->fp)) {
-		char buf[FGETS_BUF_SIZE];
-		char *ptr = buf;
+/* One hexadecimal field, leaving *pp after it but never past the line */
+static inline unsigned long hex_field(const char **pp)
+{
+	const char *p = *pp;
+	unsigned long v = 0;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	for (;; p++) {
+		unsigned int c = *p;
+
+		if (c - '0' < 10)
+			c -= '0';
+		else if ((c | 0x20) - 'a' < 6)
+			c = (c | 0x20) - 'a' + 10;
+		else
+			break;
+		v = (v << 4) | c;
+	}
+	*pp = p;
+	return v;
+}
 
+/* Read (and summarize for SMP) the different stats vars.  Each row is
+ * one CPU; all columns but the first, the table size, are summed.  The
+ * rows are parsed into row[] and added a whole row at a time, a loop
+ * the compiler vectorizes.  Columns past lf->scan_fields, which nobody
+ * looks at, are not parsed.
+ */
+static int scan_lines(struct lnstat_file *lf, int i, const char *p)
+{
+	unsigned long sum[LNSTAT_MAX_FIELDS_PER_LINE] = { 0 };
+	unsigned long row[LNSTAT_MAX_FIELDS_PER_LINE];
+	int j, n = lf->scan_fields ? : lf->num_fields, num_lines = 0;
+
+	while (*p) {
+		for (j = 0; j < n; j++)
+			row[j] = hex_field(&p);
+		for (j = 1; j < n; j++)
+			sum[j] += row[j];
+		sum[0] = row[0];
 		num_lines++;
 
-		fgets(buf, sizeof(buf)-1, lf->fp);
-		gettimeofday(&lf->last_read, NULL);
-
-		for (j = 0; j < lf->num_fields; j++) {
-			unsigned long f = strtoul(ptr, &ptr, 16);
-			if (j == 0)
-				lf->fields[j].values[i] = f;
-			else
-				lf->fields[j].values[i] += f;
-		}
+		p = strchr(p, '\n');
+		if (!p)
+			break;
+		p++;
 	}
+
+	for (j = 0; j < n; j++)
+		lf->fields[j].values[i] = sum[j];
 	return num_lines;
 }
 
+/* Whether the interval has passed.  Ticks of lnstat's timer come at
+ * exact multiples of the interval, so one that arrives a little before
+ * the previous read plus the interval still counts.
+ */
 static int time_after(struct timeval *last,
 		      struct timeval *tout,
 		      struct timeval *now)
 {
-	if (now->tv_sec > last->tv_sec + tout->tv_sec)
-		return 1;
-
-	if (now->tv_sec == last->tv_sec + tout->tv_sec) {
-		if (now->tv_usec > last->tv_usec + tout->tv_usec)
-			return 1;
-	}
+	long long due = (last->tv_sec + tout->tv_sec) * 1000000LL +
+			last->tv_usec + tout->tv_usec;
+	long long slack = (tout->tv_sec * 1000000LL + tout->tv_usec) / 4;
 
-	return 0;
+	return now->tv_sec * 1000000LL + now->tv_usec + slack > due;
 }
 
 int lnstat_update(struct lnstat_file *lnstat_files)
 {
 	struct lnstat_file *lf;
-	char buf[FGETS_BUF_SIZE];
 	struct timeval tv;
 
 	gettimeofday(&tv, NULL);
@@ -90,26 +137,32 @@ int lnstat_update(struct lnstat_file *lnstat_files)
 		if (time_after(&lf->last_read, &lf->interval, &tv)) {
 			int i;
 			struct lnstat_field *lfi;
+			unsigned long long us;
+			const char *p;
+
+			if (lnstat_read(lf) < 0)
+				continue;
+			gettimeofday(&lf->last_read, NULL);
 
-			rewind(lf->fp);
+			p = lf->buf;
 			if (!lf->compat) {
 				/* skip first line */
-				fgets(buf, sizeof(buf)-1, lf->fp);
+				p = strchr(p, '\n');
+				p = p ? p + 1 : "";
 			}
-			scan_lines(lf, 1);
+			scan_lines(lf, 1, p);
 
+			us = lf->interval.tv_sec * 1000000ULL +
+			     lf->interval.tv_usec;
 			for (i = 0, lfi = &lf->fields[i];
 			     i < lf->num_fields; i++, lfi = &lf->fields[i]) {
 				if (i == 0)
 					lfi->result = lfi->values[1];
 				else
 					lfi->result = (lfi->values[1]-lfi->values[0])
-				    			/ lf->interval.tv_sec;
+							* 1000000ULL / us;
+				lfi->values[0] = lfi->values[1];
 			}
-
-			rewind(lf->fp);
-			fgets(buf, sizeof(buf)-1, lf->fp);
-			scan_lines(lf, 0);
 		}
 	}
 
@@ -125,6 +178,7 @@ static int __lnstat_scan_fields(struct lnstat_file *lf, char *buf)
 	tok = strtok(buf, " \t\n");
 	for (i = 0; i < LNSTAT_MAX_FIELDS_PER_LINE; i++) {
 		lf->fields[i].file = lf;
+		lf->fields[i].num = i;
 		strncpy(lf->fields[i].name, tok, LNSTAT_MAX_FIELD_NAME_LEN);
 		/* has to be null-terminate since we initialize to zero
 		 * and field size is NAME_LEN + 1 */
@@ -140,9 +194,16 @@ static int __lnstat_scan_fields(struct lnstat_file *lf, char *buf)
 static int lnstat_scan_fields(struct lnstat_file *lf)
 {
 	char buf[FGETS_BUF_SIZE];
+	size_t len;
 
-	rewind(lf->fp);
-	fgets(buf, sizeof(buf)-1, lf->fp);
+	if (lnstat_read(lf) < 0)
+		return -1;
+	len = strcspn(lf->buf, "\n");
+	if (len > sizeof(buf) - 2)
+		len = sizeof(buf) - 2;
+	memcpy(buf, lf->buf, len);
+	buf[len] = '\n';
+	buf[len + 1] = 0;
 
 	return __lnstat_scan_fields(lf, buf);
 }
@@ -191,8 +252,15 @@ static struct lnstat_file *alloc_and_open(const char *path, const char *file)
 	lf->interval.tv_sec = 1;
 
 	/* open */
-	lf->fp = fopen(lf->path, "r");
-	if (!lf->fp) {
+	lf->fd = open(lf->path, O_RDONLY);
+	if (lf->fd < 0) {
+		free(lf);
+		return NULL;
+	}
+	lf->bufsize = 4096;
+	lf->buf = malloc(lf->bufsize);
+	if (!lf->buf) {
+		close(lf->fd);
 		free(lf);
 		return NULL;
 	}
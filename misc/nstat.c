@@ -18,6 +18,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <fnmatch.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -29,6 +31,10 @@
 
 #include <SNAPSHOT.h>
 
+#include "namespace.h"
+#include "shmstat.h"
+#include "stathist.h"
+
 int dump_zeros = 0;
 int reset_history = 0;
 int ignore_history = 0;
@@ -36,6 +42,8 @@ int no_output = 0;
 int no_update = 0;
 int scan_interval = 0;
 int time_constant = 0;
+int all_netns = 0;
+int compact = 0;
 double W;
 char **patterns;
 int npatterns;
@@ -81,6 +89,7 @@ struct nstat_ent
 
 struct nstat_ent *kern_db;
 struct nstat_ent *hist_db;
+static struct shmstat *shm;
 
 char *useless_numbers[] = {
 "IpForwarding", "IpDefaultTTL",
@@ -207,11 +216,7 @@ void load_ugly_table(FILE *fp)
 			if (sscanf(p+1, "%lu", &n->ival) != 1)
 				abort();
 			n->val = n->ival;
-			/* Trick to skip "dummy" trailing ICMP MIB in 2.4 */
-			if (strcmp(idbuf, "IcmpOutAddrMaskReps") == 0)
-				idbuf[5] = 0;
-			else
-				n = n->next;
+			n = n->next;
 		} while (p > buf + off + 2);
 	}
 
@@ -228,9 +233,47 @@ void load_ugly_table(FILE *fp)
 	}
 }
 
+/* The daemon reads the same /proc files at every sample, and their
+ * layout does not change while it runs.  So it remembers, for each
+ * file, the text that names the counters (the name lines of the ugly
+ * tables, the first word of each line of the good ones) and the entry
+ * each value goes to.  While that text is unchanged, a sample only
+ * compares it and converts the numbers in place; otherwise the tables
+ * are loaded and merged as before and the layout is learnt again.
+ */
+struct nstat_layout
+{
+	int			(*open)(void);
+	int			fd;	/* kept open, see netns_open() */
+	int			ugly;
+	char			*key;
+	int			keylen;
+	struct nstat_ent	**ent;
+	unsigned long		*val;
+	int			nval;
+};
+
+static struct nstat_layout layouts[] = {
+	{ .open = net_netstat_open, .fd = -1, .ugly = 1 },
+	{ .open = net_snmp6_open, .fd = -1 },
+	{ .open = net_snmp_open, .fd = -1, .ugly = 1 },
+};
+
+#define NLAYOUTS	(sizeof(layouts)/sizeof(layouts[0]))
+
+/* The file of l, read from its start */
+static int layout_open(struct nstat_layout *l)
+{
+	if (l->fd < 0)
+		return l->open();
+	if (lseek(l->fd, 0, SEEK_SET) < 0)
+		return -1;
+	return dup(l->fd);
+}
+
 void load_snmp(void)
 {
-	FILE *fp = fdopen(net_snmp_open(), "r");
+	FILE *fp = fdopen(layout_open(&layouts[2]), "r");
 	if (fp) {
 		load_ugly_table(fp);
 		fclose(fp);
@@ -239,7 +282,7 @@ void load_snmp(void)
 
 void load_snmp6(void)
 {
-	FILE *fp = fdopen(net_snmp6_open(), "r");
+	FILE *fp = fdopen(layout_open(&layouts[1]), "r");
 	if (fp) {
 		load_good_table(fp);
 		fclose(fp);
@@ -248,13 +291,88 @@ void load_snmp6(void)
 
 void load_netstat(void)
 {
-	FILE *fp = fdopen(net_netstat_open(), "r");
+	FILE *fp = fdopen(layout_open(&layouts[0]), "r");
 	if (fp) {
 		load_ugly_table(fp);
 		fclose(fp);
 	}
 }
 
+/* A kern_db entry in the binary history file */
+struct nstat_hist_ent
+{
+	__u32			name;
+	__u32			pad;
+	unsigned long long	val;
+	double			rate;
+};
+
+static struct stathist hist_map;
+
+/* Returns 1 if the history was binary and is loaded, see stathist_map() */
+static int load_hist_table(int fd)
+{
+	struct nstat_ent **tail = &kern_db;
+	__u32 i;
+	int err;
+
+	err = stathist_map(&hist_map, fd, sizeof(struct nstat_hist_ent));
+	if (err <= 0)
+		return err;
+
+	strcpy(info_source, hist_map.hdr->info);
+	for (i = 0; i < hist_map.hdr->count; i++) {
+		const struct nstat_hist_ent *e;
+		struct nstat_ent *n;
+		const char *name;
+
+		if ((e = stathist_rec(&hist_map, i, &name)) == NULL ||
+		    useless_number((char *)name))
+			continue;
+		if ((n = malloc(sizeof(*n))) == NULL)
+			abort();
+		n->id = (char *)name;
+		n->ival = (unsigned long)e->val;
+		n->val = e->val;
+		n->rate = e->rate;
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+	return 1;
+}
+
+/* The history as dump_kern_db(fp, 1) would write it, in binary */
+static int write_hist_db(int fd)
+{
+	struct stathist_out o;
+	struct nstat_ent *n, *h = hist_db;
+
+	stathist_out_init(&o, sizeof(struct nstat_hist_ent));
+	for (n = kern_db; n; n = n->next) {
+		struct nstat_hist_ent *e;
+		unsigned long long val = n->val;
+
+		if (!dump_zeros && !val && !n->rate)
+			continue;
+		if (!match(n->id)) {
+			struct nstat_ent *h1;
+
+			for (h1 = h; h1; h1 = h1->next) {
+				if (strcmp(h1->id, n->id) == 0) {
+					val = h1->val;
+					h = h1->next;
+					break;
+				}
+			}
+		}
+		e = stathist_out_rec(&o, n->id);
+		e->val = val;
+		e->rate = n->rate;
+	}
+	return stathist_out_write(&o, fd, info_source);
+}
+
 void dump_kern_db(FILE *fp, int to_hist)
 {
 	struct nstat_ent *n, *h;
@@ -309,13 +427,232 @@ void dump_incr_db(FILE *fp)
 	}
 }
 
+/* One line of ID=VALUE for the counters that moved since the history,
+ * or that are not zero without one; all of them with -z.
+ */
+void dump_compact_db(FILE *fp, int incr)
+{
+	struct nstat_ent *n, *h = hist_db;
+	const char *sep = "";
+
+	for (n = kern_db; n; n = n->next) {
+		unsigned long long val = n->val;
+		struct nstat_ent *h1;
+
+		for (h1 = incr ? h : NULL; h1; h1 = h1->next) {
+			if (strcmp(h1->id, n->id) == 0) {
+				/* an overflow, as dump_incr_db() shows it */
+				val = val < h1->val ? 0 : val - h1->val;
+				h = h1->next;
+				break;
+			}
+		}
+		if ((!val && !dump_zeros) || !match(n->id))
+			continue;
+		fprintf(fp, "%s%s=%llu", sep, n->id, val);
+		sep = " ";
+	}
+	fputc('\n', fp);
+}
+
 static int children;
 
 void sigchild(int signo)
 {
 }
 
-void update_db(int interval)
+void sigterm(int signo)
+{
+	shmstat_destroy(shm);
+	_exit(0);
+}
+
+static void sample_ent(struct nstat_ent *n, unsigned long ival, int interval)
+{
+	double sample;
+	unsigned long incr = ival - n->ival;
+
+	n->val += incr;
+	n->ival = ival;
+	sample = (double)(incr*1000)/interval;
+	if (interval >= scan_interval) {
+		n->rate += W*(sample-n->rate);
+	} else if (interval >= 1000) {
+		if (interval >= time_constant) {
+			n->rate = sample;
+		} else {
+			double w = W*(double)interval/scan_interval;
+			n->rate += w*(sample-n->rate);
+		}
+	}
+}
+
+
+static char *proc_buf;
+static int proc_size;
+
+/* The whole file, in a buffer reused from one read to the next */
+static char *read_proc(int fd)
+{
+	int len = 0;
+
+	if (fd < 0)
+		return "";
+	for (;;) {
+		int n;
+
+		if (proc_size - len < 4096) {
+			proc_size = proc_size ? proc_size * 2 : 16384;
+			proc_buf = realloc(proc_buf, proc_size);
+			if (!proc_buf)
+				abort();
+		}
+		n = read(fd, proc_buf + len, proc_size - len - 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			len = 0;
+			break;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	close(fd);
+	proc_buf[len] = 0;
+	return proc_buf;
+}
+
+static struct nstat_ent *find_ent(const char *id)
+{
+	struct nstat_ent *n;
+
+	for (n = kern_db; n; n = n->next)
+		if (strcmp(n->id, id) == 0)
+			return n;
+	return NULL;
+}
+
+/* Learn the layout of l from buf, for the entries now in kern_db */
+static void layout_learn(struct nstat_layout *l, char *buf)
+{
+	char id[256];
+	char *p = buf;
+	int max = 0;
+
+	free(l->key);
+	l->key = malloc(strlen(buf) + 1);
+	if (!l->key)
+		abort();
+	l->keylen = 0;
+	l->nval = 0;
+
+	while (*p) {
+		char *eol = p + strcspn(p, "\n");
+		char *names = p;
+		int plen = 0;
+
+		if (l->ugly) {
+			plen = strcspn(p, ":");
+			if (p + plen >= eol || *eol == 0)
+				break;
+			names = p + plen + 1;
+		}
+		memcpy(l->key + l->keylen, p, l->ugly ? eol - p : strcspn(p, " \t\n"));
+		l->keylen += l->ugly ? eol - p : strcspn(p, " \t\n");
+		l->key[l->keylen++] = '\n';
+
+		for (;;) {
+			int len;
+
+			names += strspn(names, " \t");
+			len = strcspn(names, " \t\n");
+			if (len == 0 || names >= eol)
+				break;
+			if (l->nval == max) {
+				max = max ? max * 2 : 256;
+				l->ent = realloc(l->ent, max * sizeof(*l->ent));
+				l->val = realloc(l->val, max * sizeof(*l->val));
+				if (!l->ent || !l->val)
+					abort();
+			}
+			snprintf(id, sizeof(id), "%.*s%.*s", plen, p, len, names);
+			l->ent[l->nval++] = find_ent(id);
+			names += len;
+			if (!l->ugly)
+				break;
+		}
+
+		p = *eol ? eol + 1 : eol;
+		if (l->ugly) {
+			/* the line of values */
+			p += strcspn(p, "\n");
+			if (*p)
+				p++;
+		}
+	}
+}
+
+/* The values of buf into l->val; -1 if the layout of buf is not l's */
+static int layout_parse(struct nstat_layout *l, char *buf)
+{
+	char *key = l->key;
+	char *end = l->key + l->keylen;
+	char *p = buf;
+	int nval = 0;
+
+	while (*p) {
+		char *eol = p + strcspn(p, "\n");
+		int len = l->ugly ? eol - p : strcspn(p, " \t\n");
+
+		if (end - key < len + 1 || memcmp(key, p, len) ||
+		    key[len] != '\n')
+			return -1;
+		key += len + 1;
+
+		if (l->ugly) {
+			if (*eol == 0)
+				return -1;
+			p = eol + 1;
+			eol = p + strcspn(p, "\n");
+			p += strcspn(p, ":");
+			if (p >= eol)
+				return -1;
+			p++;
+		} else {
+			p += len;
+		}
+
+		for (;;) {
+			char *q;
+
+			p += strspn(p, " \t");
+			if (p >= eol)
+				break;
+			if (nval == l->nval)
+				return -1;
+			l->val[nval++] = strtoul(p, &q, 10);
+			if (q == p)
+				return -1;
+			p = q;
+		}
+		p = *eol ? eol + 1 : eol;
+	}
+
+	if (key != end || nval != l->nval)
+		return -1;
+	return 0;
+}
+
+static void learn_layouts(void)
+{
+	int i;
+
+	for (i = 0; i < NLAYOUTS; i++)
+		layout_learn(&layouts[i], read_proc(layout_open(&layouts[i])));
+}
+
+static void reload_db(int interval)
 {
 	struct nstat_ent *n, *h;
 
@@ -333,21 +670,7 @@ void update_db(int interval)
 		struct nstat_ent *h1;
 		for (h1 = h; h1; h1 = h1->next) {
 			if (strcmp(h1->id, n->id) == 0) {
-				double sample;
-				unsigned long incr = h1->ival - n->ival;
-				n->val += incr;
-				n->ival = h1->ival;
-				sample = (double)(incr*1000)/interval;
-				if (interval >= scan_interval) {
-					n->rate += W*(sample-n->rate);
-				} else if (interval >= 1000) {
-					if (interval >= time_constant) {
-						n->rate = sample;
-					} else {
-						double w = W*(double)interval/scan_interval;
-						n->rate += w*(sample-n->rate);
-					}
-				}
+				sample_ent(n, h1->ival, interval);
 
 				while (h != h1) {
 					struct nstat_ent *tmp = h;
@@ -364,11 +687,329 @@ void update_db(int interval)
 	}
 }
 
+void update_db(int interval)
+{
+	int i, k;
+
+	for (i = 0; i < NLAYOUTS; i++) {
+		struct nstat_layout *l = &layouts[i];
+
+		if (l->key == NULL ||
+		    layout_parse(l, read_proc(layout_open(l))) < 0)
+			break;
+	}
+	if (i < NLAYOUTS) {
+		reload_db(interval);
+		learn_layouts();
+		return;
+	}
+
+	for (i = 0; i < NLAYOUTS; i++) {
+		struct nstat_layout *l = &layouts[i];
+
+		for (k = 0; k < l->nval; k++)
+			if (l->ent[k])
+				sample_ent(l->ent[k], l->val[k], interval);
+	}
+}
+
+/* With -N the daemon samples every namespace of NETNS_RUN_DIR besides
+ * its own.  It enters each just once, to open its /proc files, which
+ * show that namespace's counters whenever they are read again.  Each
+ * has its own kern_db and layouts, which netns_switch() swaps in.
+ */
+struct nstat_netns
+{
+	struct nstat_netns	*next;
+	char			name[NAME_MAX + 1];
+	__u64			ino;
+	int			seen;
+	size_t			count;	/* of published entries */
+	struct nstat_ent	*db;
+	struct nstat_layout	layouts[NLAYOUTS];
+};
+
+static struct nstat_netns self_netns;
+static struct nstat_netns *cur_netns = &self_netns;
+static int self_netns_fd = -1;
+
+static void netns_switch(struct nstat_netns *ns)
+{
+	if (ns == cur_netns)
+		return;
+	cur_netns->db = kern_db;
+	memcpy(cur_netns->layouts, layouts, sizeof(layouts));
+	kern_db = ns->db;
+	memcpy(layouts, ns->layouts, sizeof(layouts));
+	cur_netns = ns;
+}
+
+static struct nstat_netns *netns_open(const char *name, __u64 ino)
+{
+	struct nstat_netns *ns;
+	char path[PATH_MAX];
+	int fd, i;
+
+	snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, name);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (setns(fd, CLONE_NEWNET) < 0) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	if ((ns = calloc(1, sizeof(*ns))) == NULL)
+		abort();
+	strcpy(ns->name, name);
+	ns->ino = ino;
+	for (i = 0; i < NLAYOUTS; i++) {
+		ns->layouts[i].open = layouts[i].open;
+		ns->layouts[i].ugly = layouts[i].ugly;
+		ns->layouts[i].fd = layouts[i].open();
+	}
+	if (setns(self_netns_fd, CLONE_NEWNET) < 0)
+		exit(1);
+
+	netns_switch(ns);
+	load_netstat();
+	load_snmp6();
+	load_snmp();
+	learn_layouts();
+	netns_switch(&self_netns);
+	return ns;
+}
+
+static void netns_free(struct nstat_netns *ns)
+{
+	int i;
+
+	while (ns->db) {
+		struct nstat_ent *n = ns->db;
+
+		ns->db = n->next;
+		free(n->id);
+		free(n);
+	}
+	for (i = 0; i < NLAYOUTS; i++) {
+		struct nstat_layout *l = &ns->layouts[i];
+
+		if (l->fd >= 0)
+			close(l->fd);
+		free(l->key);
+		free(l->ent);
+		free(l->val);
+	}
+	free(ns);
+}
+
+/* Follow NETNS_RUN_DIR: enter the new namespaces, drop those that are
+ * gone or whose name now stands for another one.
+ */
+static void netns_scan(void)
+{
+	struct nstat_netns *ns, **np;
+	struct dirent *de;
+	DIR *dir;
+
+	for (ns = self_netns.next; ns; ns = ns->next)
+		ns->seen = 0;
+
+	dir = opendir(NETNS_RUN_DIR);
+	while (dir && (de = readdir(dir)) != NULL) {
+		char path[PATH_MAX];
+		struct stat stb;
+
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", NETNS_RUN_DIR, de->d_name);
+		if (stat(path, &stb) < 0 || stb.st_ino == self_netns.ino)
+			continue;
+		for (ns = self_netns.next; ns; ns = ns->next)
+			if (ns->ino == stb.st_ino && !strcmp(ns->name, de->d_name))
+				break;
+		if (ns == NULL &&
+		    (ns = netns_open(de->d_name, stb.st_ino)) != NULL) {
+			ns->next = self_netns.next;
+			self_netns.next = ns;
+		}
+		if (ns)
+			ns->seen = 1;
+	}
+	if (dir)
+		closedir(dir);
+
+	for (np = &self_netns.next; (ns = *np) != NULL; ) {
+		if (ns->seen) {
+			np = &ns->next;
+			continue;
+		}
+		*np = ns->next;
+		netns_free(ns);
+	}
+}
+
+static void update_netns(int interval)
+{
+	struct nstat_netns *ns;
+
+	netns_scan();
+	for (ns = &self_netns; ns; ns = ns->next) {
+		netns_switch(ns);
+		update_db(interval);
+	}
+	netns_switch(&self_netns);
+}
+
+/* A kern_db entry as the daemon publishes it in shared memory */
+struct nstat_shm_ent
+{
+	char			id[64];
+	unsigned long long	val;
+	double			rate;
+};
+
+
+static int shm_ent_ok(const struct nstat_ent *n)
+{
+	return (dump_zeros || n->val || n->rate) &&
+		strlen(n->id) < sizeof(((struct nstat_shm_ent *)0)->id);
+}
+
+static size_t shm_count(void)
+{
+	struct nstat_ent *n;
+	size_t cnt = 0;
+
+	for (n = kern_db; n; n = n->next)
+		if (shm_ent_ok(n))
+			cnt++;
+	return cnt;
+}
+
+static struct nstat_shm_ent *shm_fill(struct nstat_shm_ent *e)
+{
+	struct nstat_ent *n;
+
+	for (n = kern_db; n; n = n->next) {
+		if (!shm_ent_ok(n))
+			continue;
+		memset(e->id, 0, sizeof(e->id));
+		strcpy(e->id, n->id);
+		e->val = n->val;
+		e->rate = n->rate;
+		e++;
+	}
+	return e;
+}
+
+/* The tables of all namespaces, each after its struct shmstat_ns */
+static void publish_netns(void)
+{
+	struct nstat_netns *ns;
+	size_t size = 0;
+	char *p;
+
+	for (ns = &self_netns; ns; ns = ns->next) {
+		netns_switch(ns);
+		ns->count = shm_count();
+		size += sizeof(struct shmstat_ns) +
+			ns->count * sizeof(struct nstat_shm_ent);
+	}
+	netns_switch(&self_netns);
+	if ((p = shmstat_begin(shm, size)) == NULL)
+		return;
+	for (ns = &self_netns; ns; ns = ns->next) {
+		struct shmstat_ns *h = (struct shmstat_ns *)p;
+
+		memset(h, 0, sizeof(*h));
+		h->ino = ns->ino;
+		h->count = ns->count;
+		snprintf(h->name, sizeof(h->name), "%.*s",
+			 (int)sizeof(h->name) - 1, ns->name);
+		netns_switch(ns);
+		p = (char *)shm_fill((struct nstat_shm_ent *)(h + 1));
+	}
+	netns_switch(&self_netns);
+	shmstat_end(shm);
+}
+
+/* The counters clients would get from dump_kern_db() */
+static void publish_db(void)
+{
+	struct nstat_shm_ent *e;
+
+	if (shm == NULL)
+		return;
+	if (all_netns) {
+		publish_netns();
+		return;
+	}
+	e = shmstat_begin(shm, shm_count() * sizeof(*e));
+	if (e == NULL)
+		return;
+	shm_fill(e);
+	shmstat_end(shm);
+}
+
+/* The table of a running daemon, from its shared memory segment */
+static int load_shm_db(void)
+{
+	struct nstat_ent *db = NULL;
+	struct nstat_shm_ent *tbl;
+	char info[sizeof(info_source)];
+	char name[64];
+	size_t len, i;
+
+	shmstat_name(name, sizeof(name), "nstat", getuid());
+	tbl = shmstat_read(name, &len, info, sizeof(info));
+	if (tbl == NULL && getuid()) {
+		shmstat_name(name, sizeof(name), "nstat", 0);
+		tbl = shmstat_read(name, &len, info, sizeof(info));
+	}
+	if (tbl == NULL)
+		tbl = shmstat_read_netns("nstat", sizeof(*tbl), &len,
+					 info, sizeof(info));
+	if (tbl == NULL)
+		return -1;
+
+	if (info_source[0] && strcmp(info_source, info))
+		source_mismatch = 1;
+	strcpy(info_source, info);
+
+	for (i = 0; i < len / sizeof(*tbl); i++) {
+		struct nstat_ent *n;
+
+		if (useless_number(tbl[i].id))
+			continue;
+		if ((n = malloc(sizeof(*n))) == NULL)
+			abort();
+		n->id = strdup(tbl[i].id);
+		n->ival = (unsigned long)tbl[i].val;
+		n->val = tbl[i].val;
+		n->rate = tbl[i].rate;
+		n->next = db;
+		db = n;
+	}
+	free(tbl);
+
+	while (db) {
+		struct nstat_ent *n = db;
+
+		db = db->next;
+		n->next = kern_db;
+		kern_db = n;
+	}
+	return 0;
+}
+
 #define T_DIFF(a,b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
 
 
 void server_loop(int fd)
 {
+	char name[64];
+
 	struct timeval snaptime = { 0 };
 	struct pollfd p;
 	p.fd = fd;
@@ -380,6 +1021,20 @@ void server_loop(int fd)
 	load_netstat();
 	load_snmp6();
 	load_snmp();
+	learn_layouts();
+
+	if (all_netns) {
+		self_netns.ino = shmstat_netns();
+		self_netns_fd = open("/proc/self/ns/net", O_RDONLY);
+		if (self_netns_fd < 0)
+			exit(1);
+		netns_scan();
+		shmstat_netns_name(name, sizeof(name), "nstat", getuid());
+	} else {
+		shmstat_name(name, sizeof(name), "nstat", getuid());
+	}
+	shm = shmstat_create(name, info_source);
+	publish_db();
 
 	for (;;) {
 		int status;
@@ -388,7 +1043,11 @@ void server_loop(int fd)
 		gettimeofday(&now, NULL);
 		tdiff = T_DIFF(now, snaptime);
 		if (tdiff >= scan_interval) {
-			update_db(tdiff);
+			if (all_netns)
+				update_netns(tdiff);
+			else
+				update_db(tdiff);
+			publish_db();
 			snaptime = now;
 			tdiff = 0;
 		}
@@ -437,7 +1096,7 @@ static void usage(void) __attribute__((noreturn));
 static void usage(void)
 {
 	fprintf(stderr,
-"Usage: nstat [ -h?vVzrnasd:t: ] [ PATTERN [ PATTERN ] ]\n"
+"Usage: nstat [ -h?vVzrnascNd:t: ] [ PATTERN [ PATTERN ] ]\n"
 		);
 	exit(-1);
 }
@@ -451,7 +1110,7 @@ int main(int argc, char *argv[])
 	int ch;
 	int fd;
 
-	while ((ch = getopt(argc, argv, "h?vVzrnasd:t:")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?vVzrnascNd:t:")) != EOF) {
 		switch(ch) {
 		case 'z':
 			dump_zeros = 1;
@@ -468,8 +1127,14 @@ int main(int argc, char *argv[])
 		case 'n':
 			no_output = 1;
 			break;
+		case 'N':
+			all_netns = 1;
+			break;
+		case 'c':
+			compact = 1;
+			break;
 		case 'd':
-			scan_interval = 1000*atoi(optarg);
+			scan_interval = 1000*strtod(optarg, NULL);
 			break;
 		case 't':
 			if (sscanf(optarg, "%d", &time_constant) != 1 ||
@@ -519,6 +1184,8 @@ int main(int argc, char *argv[])
 		}
 		signal(SIGPIPE, SIG_IGN);
 		signal(SIGCHLD, sigchild);
+		signal(SIGTERM, sigterm);
+		signal(SIGINT, sigterm);
 		server_loop(fd);
 		exit(0);
 	}
@@ -572,13 +1239,25 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		load_good_table(hist_fp);
+		switch (load_hist_table(fileno(hist_fp))) {
+		case 0:
+			load_good_table(hist_fp);
+			break;
+		case -1:
+			fprintf(stderr, "nstat: history file is damaged, resetting\n");
+			break;
+		}
 
 		hist_db = kern_db;
 		kern_db = NULL;
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	if (load_shm_db() == 0) {
+		if (hist_db && source_mismatch) {
+			fprintf(stderr, "nstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
 	    (connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0
 	     || (strcpy(sun.sun_path+1, "nstat0"),
 		 connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
@@ -606,16 +1285,18 @@ int main(int argc, char *argv[])
 	}
 
 	if (!no_output) {
-		if (ignore_history || hist_db == NULL)
+		if (compact)
+			dump_compact_db(stdout, !ignore_history && hist_db);
+		else if (ignore_history || hist_db == NULL)
 			dump_kern_db(stdout, 0);
 		else
 			dump_incr_db(stdout);
 	}
 	if (!no_update) {
-		ftruncate(fileno(hist_fp), 0);
-		rewind(hist_fp);
-		dump_kern_db(hist_fp, 1);
-		fflush(hist_fp);
+		if (write_hist_db(fileno(hist_fp)) < 0) {
+			perror("nstat: write history file");
+			exit(-1);
+		}
 	}
 	exit(0);
 }
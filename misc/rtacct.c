@@ -23,7 +23,6 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/poll.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <signal.h>
@@ -33,6 +32,8 @@
 
 #include <SNAPSHOT.h>
 
+#include "shmstat.h"
+
 int reset_history = 0;
 int ignore_history = 0;
 int no_output = 0;
@@ -75,6 +76,7 @@ struct rtacct_data kern_db_static;
 
 struct rtacct_data *kern_db = &kern_db_static;
 struct rtacct_data *hist_db;
+static struct shmstat *shm;
 
 void nread(int fd, char *buf, int tot)
 {
@@ -97,6 +99,7 @@ void nread(int fd, char *buf, int tot)
 __u32 *read_kern_table(__u32 *tbl)
 {
 	static __u32 *tbl_ptr;
+	static int proc_fd = -1;
 	int fd;
 
 	if (magic_number) {
@@ -120,10 +123,11 @@ __u32 *read_kern_table(__u32 *tbl)
 		return tbl_ptr;
 	}
 
-	fd = net_rtacct_open();
-	if (fd >= 0) {
-		nread(fd, (char*)tbl, 256*16);
-		close(fd);
+	/* The file is kept open and read again from the start */
+	if (proc_fd < 0)
+		proc_fd = net_rtacct_open();
+	if (proc_fd >= 0 && lseek(proc_fd, 0, SEEK_SET) == 0) {
+		nread(proc_fd, (char*)tbl, 256*16);
 	} else {
 		memset(tbl, 0, 256*16);
 	}
@@ -291,52 +295,78 @@ void dump_incr_db(FILE *fp)
 }
 
 
-static int children;
-
-void sigchild(int signo)
+void sigterm(int signo)
 {
+	shmstat_destroy(shm);
+	_exit(0);
 }
 
 /* Server side only: read kernel data, update tables, calculate rates. */
 
-void update_db(int interval)
+/* The increments of one scan.  This loop is plain enough for the
+ * compiler to vectorize; it also tells whether anything moved at all.
+ */
+static int kern_delta(const __u32 *ival, const __u32 *old, __u32 *incr)
 {
+	__u32 any = 0;
 	int i;
+
+	for (i = 0; i < 256*4; i++) {
+		incr[i] = ival[i] - old[i];
+		any |= incr[i];
+	}
+	return any != 0;
+}
+
+void update_db(struct rtacct_data *db, int interval)
+{
+	int i, realm;
 	__u32 *ival;
 	__u32 _ival[256*4];
+	__u32 incr[256*4];
+	int moved;
 
 	ival = read_kern_table(_ival);
-
-	for (i=0; i<256*4; i++) {
-		double sample;
-		__u32 incr = ival[i] - kern_db->ival[i];
-
-		if (ival[i] == 0 && incr == 0 &&
-		    kern_db->val[i] == 0 && kern_db->rate[i] == 0)
+	moved = kern_delta(ival, db->ival, incr);
+
+	/* Idle realms have nothing to add and no rate to decay, which is
+	 * most of them; they are passed over four counters at a time.
+	 */
+	for (realm = 0; realm < 256; realm++) {
+		int base = realm*4;
+
+		if ((!moved || !(incr[base] | incr[base+1] |
+				 incr[base+2] | incr[base+3])) &&
+		    db->rate[base] == 0 && db->rate[base+1] == 0 &&
+		    db->rate[base+2] == 0 && db->rate[base+3] == 0)
 			continue;
 
-		kern_db->val[i] += incr;
-		kern_db->ival[i] = ival[i];
-		sample = (double)(incr*1000)/interval;
-		if (interval >= scan_interval) {
-			kern_db->rate[i] += W*(sample-kern_db->rate[i]);
-		} else if (interval >= 1000) {
-			if (interval >= time_constant) {
-				kern_db->rate[i] = sample;
-			} else {
-				double w = W*(double)interval/scan_interval;
-				kern_db->rate[i] += w*(sample-kern_db->rate[i]);
+		for (i = base; i < base+4; i++) {
+			double sample;
+
+			db->val[i] += incr[i];
+			db->ival[i] = ival[i];
+			sample = (double)(incr[i]*1000)/interval;
+			if (interval >= scan_interval) {
+				db->rate[i] += W*(sample-db->rate[i]);
+			} else if (interval >= 1000) {
+				if (interval >= time_constant) {
+					db->rate[i] = sample;
+				} else {
+					double w = W*(double)interval/scan_interval;
+					db->rate[i] += w*(sample-db->rate[i]);
+				}
 			}
 		}
 	}
 }
 
-void send_db(int fd)
+void send_db(int fd, const struct rtacct_data *db)
 {
 	int tot = 0;
 
-	while (tot < sizeof(*kern_db)) {
-		int n = write(fd, ((char*)kern_db) + tot, sizeof(*kern_db)-tot);
+	while (tot < sizeof(*db)) {
+		int n = write(fd, ((char*)db) + tot, sizeof(*db)-tot);
 		if (n < 0) {
 			if (errno == EINTR)
 				continue;
@@ -348,6 +378,41 @@ void send_db(int fd)
 
 
 
+
+static void publish_db(void)
+{
+	void *p;
+
+	if (shm && (p = shmstat_begin(shm, sizeof(*kern_db))) != NULL) {
+		memcpy(p, kern_db, sizeof(*kern_db));
+		shmstat_end(shm);
+	}
+}
+
+/* The table of a running daemon, from its shared memory segment */
+static int load_shm_db(void)
+{
+	char name[64];
+	size_t len;
+	void *p;
+
+	shmstat_name(name, sizeof(name), "rtacct", getuid());
+	p = shmstat_read(name, &len, NULL, 0);
+	if (p == NULL && getuid()) {
+		shmstat_name(name, sizeof(name), "rtacct", 0);
+		p = shmstat_read(name, &len, NULL, 0);
+	}
+	if (p == NULL)
+		return -1;
+	if (len != sizeof(*kern_db)) {
+		free(p);
+		return -1;
+	}
+	memcpy(kern_db, p, sizeof(*kern_db));
+	free(p);
+	return 0;
+}
+
 #define T_DIFF(a,b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
 
 
@@ -363,6 +428,8 @@ void pad_kern_table(struct rtacct_data *dat, __u32 *ival)
 
 void server_loop(int fd)
 {
+	static struct rtacct_data snap;
+	char name[64];
 	struct timeval snaptime = { 0 };
 	struct pollfd p;
 	p.fd = fd;
@@ -375,14 +442,18 @@ void server_loop(int fd)
 
 	pad_kern_table(kern_db, read_kern_table(kern_db->ival));
 
+	shmstat_name(name, sizeof(name), "rtacct", getuid());
+	shm = shmstat_create(name, kern_db->signature);
+	publish_db();
+
 	for (;;) {
-		int status;
 		int tdiff;
 		struct timeval now;
 		gettimeofday(&now, NULL);
 		tdiff = T_DIFF(now, snaptime);
 		if (tdiff >= scan_interval) {
-			update_db(tdiff);
+			update_db(kern_db, tdiff);
+			publish_db();
 			snaptime = now;
 			tdiff = 0;
 		}
@@ -390,23 +461,18 @@ void server_loop(int fd)
 		    && (p.revents&POLLIN)) {
 			int clnt = accept(fd, NULL, NULL);
 			if (clnt >= 0) {
-				pid_t pid;
-				if (children >= 5) {
-					close(clnt);
-				} else if ((pid = fork()) != 0) {
-					if (pid>0)
-						children++;
-					close(clnt);
-				} else {
-					if (tdiff > 0)
-						update_db(tdiff);
-					send_db(clnt);
-					exit(0);
-				}
+				/* Bring a copy up to date, as a child of
+				 * ours used to, and answer from it.  The
+				 * table fits in the socket buffer, so this
+				 * does not wait for the client.
+				 */
+				snap = *kern_db;
+				if (tdiff > 0)
+					update_db(&snap, tdiff);
+				send_db(clnt, &snap);
+				close(clnt);
 			}
 		}
-		while (children && waitpid(-1, &status, WNOHANG) > 0)
-			children--;
 	}
 }
 
@@ -529,7 +595,8 @@ int main(int argc, char *argv[])
 			exit(-1);
 		}
 		signal(SIGPIPE, SIG_IGN);
-		signal(SIGCHLD, sigchild);
+		signal(SIGTERM, sigterm);
+		signal(SIGINT, sigterm);
 		server_loop(fd);
 		exit(0);
 	}
@@ -596,7 +663,13 @@ int main(int argc, char *argv[])
 		close(fd);
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	if (load_shm_db() == 0) {
+		if (hist_db && hist_db->signature[0] &&
+		    strcmp(kern_db->signature, hist_db->signature)) {
+			fprintf(stderr, "rtacct: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
 	    (connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0
 	     || (strcpy(sun.sun_path+1, "rtacct0"),
 		 connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
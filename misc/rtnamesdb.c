@@ -0,0 +1,89 @@
+/*
+ * rtnamesdb.c		Compile /etc/iproute2 name databases for fast loading.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+#include "rt_names.h"
+
+#ifndef CONFDIR
+#define CONFDIR "/etc/iproute2"
+#endif
+
+static const char *default_files[] = {
+	CONFDIR "/rt_tables",
+	CONFDIR "/rt_protos",
+	CONFDIR "/rt_scopes",
+	CONFDIR "/rt_realms",
+	CONFDIR "/rt_dsfield",
+	"/etc/iproute2/group",
+	NULL
+};
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: rtnamesdb [ -o OUTPUT ] [ FILE ... ]\n"
+"       with no FILE, every database in " CONFDIR " is compiled\n");
+	exit(-1);
+}
+
+static int compile(const char *file, const char *out)
+{
+	char dbname[PATH_MAX];
+
+	if (out == NULL) {
+		snprintf(dbname, sizeof(dbname), "%s.db", file);
+		out = dbname;
+	}
+	return rtnl_db_compile(file, out);
+}
+
+int main(int argc, char **argv)
+{
+	const char *out = NULL;
+	int ch, i, ret = 0;
+
+	while ((ch = getopt(argc, argv, "o:h")) != EOF) {
+		switch (ch) {
+		case 'o':
+			out = optarg;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (out && argc != 1)
+		usage();
+
+	if (argc == 0) {
+		for (i = 0; default_files[i]; i++) {
+			if (access(default_files[i], R_OK) < 0)
+				continue;
+			if (compile(default_files[i], NULL) < 0)
+				ret = 1;
+		}
+		return ret;
+	}
+
+	for (i = 0; i < argc; i++)
+		if (compile(argv[i], out) < 0)
+			ret = 1;
+	return ret;
+}
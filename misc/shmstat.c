@@ -0,0 +1,286 @@
+/*
+ * shmstat.c	Shared memory export of the ifstat, nstat and rtacct daemons.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "shmstat.h"
+
+#define SHMSTAT_RETRIES		1000
+
+struct shmstat
+{
+	char			name[64];
+	int			fd;
+	struct shmstat_hdr	*hdr;
+	size_t			size;
+};
+
+/* The inode of our network namespace, 0 if the kernel does not tell */
+__u64 shmstat_netns(void)
+{
+	struct stat stb;
+
+	if (stat("/proc/self/ns/net", &stb) < 0)
+		return 0;
+	return stb.st_ino;
+}
+
+/* Like the abstract sockets of the daemons, segments are per network
+ * namespace, which /dev/shm is not; so the name includes the namespace.
+ */
+void shmstat_name(char *name, size_t len, const char *tool, int uid)
+{
+	__u64 ino = shmstat_netns();
+
+	if (ino)
+		snprintf(name, len, "/%s%d.%llu", tool, uid,
+			 (unsigned long long)ino);
+	else
+		snprintf(name, len, "/%s%d", tool, uid);
+}
+
+/* The segment of a daemon of all namespaces, the same from any of them */
+void shmstat_netns_name(char *name, size_t len, const char *tool, int uid)
+{
+	snprintf(name, len, "/%s%d.netns", tool, uid);
+}
+
+/* Make room for len bytes of data, remapping the segment if it grows */
+static int shmstat_grow(struct shmstat *s, size_t len)
+{
+	size_t size = sizeof(struct shmstat_hdr) + len;
+	void *p;
+
+	if (size <= s->size)
+		return 0;
+	if (size < 2 * s->size)
+		size = 2 * s->size;
+	size = (size + 4095) & ~4095UL;
+
+	if (ftruncate(s->fd, size) < 0)
+		return -1;
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	if (s->hdr)
+		munmap(s->hdr, s->size);
+	s->hdr = p;
+	s->size = size;
+	return 0;
+}
+
+struct shmstat *shmstat_create(const char *name, const char *info)
+{
+	struct shmstat *s;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return NULL;
+
+	strncpy(s->name, name, sizeof(s->name) - 1);
+	shm_unlink(name);
+	s->fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0644);
+	if (s->fd < 0) {
+		free(s);
+		return NULL;
+	}
+	if (flock(s->fd, LOCK_SH) < 0 || shmstat_grow(s, 0) < 0) {
+		close(s->fd);
+		shm_unlink(name);
+		free(s);
+		return NULL;
+	}
+
+	s->hdr->magic = SHMSTAT_MAGIC;
+	s->hdr->version = SHMSTAT_VERSION;
+	s->hdr->pid = getpid();
+	strncpy(s->hdr->info, info, sizeof(s->hdr->info) - 1);
+	return s;
+}
+
+/* Returns where to write len bytes of data; readers retry until
+ * shmstat_end().  NULL if the segment cannot grow, nothing is changed.
+ */
+void *shmstat_begin(struct shmstat *s, size_t len)
+{
+	if (shmstat_grow(s, len) < 0)
+		return NULL;
+	s->hdr->seq++;
+	__sync_synchronize();
+	s->hdr->len = len;
+	return s->hdr + 1;
+}
+
+void shmstat_end(struct shmstat *s)
+{
+	__sync_synchronize();
+	s->hdr->seq++;
+}
+
+/* Remove the segment; only the daemon, not the children it forks */
+void shmstat_destroy(struct shmstat *s)
+{
+	if (s && s->hdr->pid == getpid())
+		shm_unlink(s->name);
+}
+
+static struct shmstat_hdr *shmstat_map(int fd, struct shmstat_hdr *h,
+				       size_t *size)
+{
+	struct stat stb;
+	void *p;
+
+	if (h)
+		munmap(h, *size);
+	if (fstat(fd, &stb) < 0 || stb.st_size < sizeof(*h))
+		return NULL;
+	p = mmap(NULL, stb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	*size = stb.st_size;
+	return p;
+}
+
+/* A consistent copy of the data of segment name, malloc()ed, with its
+ * info string.  NULL if there is no running daemon owned by us or root.
+ */
+void *shmstat_read(const char *name, size_t *len, char *info,
+		   size_t infolen)
+{
+	struct shmstat_hdr *h = NULL;
+	struct stat stb;
+	size_t size = 0;
+	void *data = NULL;
+	int fd, tries;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &stb) < 0 ||
+	    (stb.st_uid != getuid() && stb.st_uid != 0) ||
+	    (h = shmstat_map(fd, NULL, &size)) == NULL)
+		goto out;
+	if (h->magic != SHMSTAT_MAGIC || h->version != SHMSTAT_VERSION ||
+	    flock(fd, LOCK_EX|LOCK_NB) == 0)
+		goto out;
+
+	for (tries = 0; tries < SHMSTAT_RETRIES; tries++) {
+		__u32 seq = h->seq;
+		__u64 n;
+		void *p;
+
+		__sync_synchronize();
+		if (seq == 0)
+			break;
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		n = h->len;
+		if (sizeof(*h) + n > size) {
+			if ((h = shmstat_map(fd, h, &size)) == NULL)
+				break;
+			continue;
+		}
+		p = realloc(data, n ? n : 1);
+		if (p == NULL)
+			break;
+		data = p;
+		memcpy(data, h + 1, n);
+		if (info) {
+			strncpy(info, h->info, infolen - 1);
+			info[infolen - 1] = 0;
+		}
+		__sync_synchronize();
+		if (h->seq == seq) {
+			*len = n;
+			munmap(h, size);
+			close(fd);
+			return data;
+		}
+	}
+out:
+	free(data);
+	if (h)
+		munmap(h, size);
+	close(fd);
+	return NULL;
+}
+
+/* The entries of namespace ino in the data of a segment of
+ * shmstat_netns_name(); NULL if it has no such namespace.
+ */
+static void *shmstat_ns_find(void *data, size_t len, size_t entsize,
+			     __u64 ino, size_t *count)
+{
+	char *p = data, *end = p + len;
+
+	while (end - p >= sizeof(struct shmstat_ns)) {
+		struct shmstat_ns *ns = (struct shmstat_ns *)p;
+		size_t size = ns->count * entsize;
+
+		p += sizeof(*ns);
+		if (end - p < size)
+			break;
+		if (ns->ino == ino) {
+			*count = ns->count;
+			return p;
+		}
+		p += size;
+	}
+	return NULL;
+}
+
+/* Like shmstat_read(), our table from the segment of a daemon of all
+ * namespaces, owned by us or root, if it has our namespace.  The info
+ * string gets the namespace, so histories of different ones differ.
+ */
+void *shmstat_read_netns(const char *tool, size_t entsize, size_t *len,
+			 char *info, size_t infolen)
+{
+	__u64 ino = shmstat_netns();
+	char name[64];
+	size_t all, count;
+	void *data, *tbl;
+
+	if (ino == 0)
+		return NULL;
+	shmstat_netns_name(name, sizeof(name), tool, getuid());
+	data = shmstat_read(name, &all, info, infolen);
+	if (data == NULL && getuid()) {
+		shmstat_netns_name(name, sizeof(name), tool, 0);
+		data = shmstat_read(name, &all, info, infolen);
+	}
+	if (data == NULL)
+		return NULL;
+
+	tbl = shmstat_ns_find(data, all, entsize, ino, &count);
+	if (tbl == NULL) {
+		free(data);
+		return NULL;
+	}
+	memmove(data, tbl, count * entsize);
+	*len = count * entsize;
+	if (info) {
+		size_t l = strlen(info);
+
+		snprintf(info + l, infolen - l, " netns=%llu",
+			 (unsigned long long)ino);
+	}
+	return data;
+}
@@ -0,0 +1,58 @@
+#ifndef _SHMSTAT_H
+#define _SHMSTAT_H
+
+#include <stddef.h>
+#include <asm/types.h>
+
+/*
+ * The -d daemons of ifstat, nstat and rtacct publish their table in a
+ * POSIX shared memory segment named after their socket, so clients can
+ * read it without a connection and a fork per client.  The table is
+ * rewritten in place under a sequence counter that is odd while the
+ * daemon writes; a reader copies the data and retries if the counter
+ * moved.  The daemon holds a shared flock() on the segment while it
+ * runs, so a segment left behind by a dead daemon is ignored.  The data
+ * format belongs to each tool.
+ */
+#define SHMSTAT_MAGIC		0x54534d48	/* "HMST" */
+#define SHMSTAT_VERSION		1
+
+struct shmstat_hdr
+{
+	__u32		magic;
+	__u32		version;
+	volatile __u32	seq;
+	__u32		pid;		/* of the daemon */
+	__u64		len;		/* bytes of data after the header */
+	char		info[128];	/* info_source of the daemon */
+};
+
+/* The daemons of every named namespace (-N) publish them all in one
+ * segment, named by shmstat_netns_name(): the table of each namespace
+ * follows one of these, and clients pick theirs by its inode.
+ */
+struct shmstat_ns
+{
+	__u64		ino;		/* of /proc/self/ns/net there */
+	__u32		count;		/* entries that follow */
+	__u32		pad;
+	char		name[64];	/* in NETNS_RUN_DIR, "" for the daemon's */
+};
+
+struct shmstat;
+
+extern __u64 shmstat_netns(void);
+
+extern void shmstat_name(char *name, size_t len, const char *tool, int uid);
+extern void shmstat_netns_name(char *name, size_t len, const char *tool,
+			       int uid);
+extern struct shmstat *shmstat_create(const char *name, const char *info);
+extern void *shmstat_begin(struct shmstat *s, size_t len);
+extern void shmstat_end(struct shmstat *s);
+extern void shmstat_destroy(struct shmstat *s);
+extern void *shmstat_read(const char *name, size_t *len, char *info,
+			  size_t infolen);
+extern void *shmstat_read_netns(const char *tool, size_t entsize,
+				size_t *len, char *info, size_t infolen);
+
+#endif
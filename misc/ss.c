@@ -26,17 +26,27 @@
 #include <dirent.h>
 #include <fnmatch.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <mntent.h>
+#include <ftw.h>
+#include <limits.h>
 
 #include "utils.h"
 #include "rt_names.h"
 #include "ll_map.h"
 #include "libnetlink.h"
+#include "namespace.h"
 #include "SNAPSHOT.h"
 
 #include <netinet/tcp.h>
 #include <linux/sock_diag.h>
 #include <linux/inet_diag.h>
 #include <linux/unix_diag.h>
+#include <linux/packet_diag.h>
+#include <linux/netlink_diag.h>
 
 int resolve_hosts = 0;
 int resolve_services = 1;
@@ -45,7 +55,9 @@ int show_options = 0;
 int show_details = 0;
 int show_users = 0;
 int show_mem = 0;
+int explain_filter = 0;
 int show_tcpinfo = 0;
+int diag_rcvbuf = 0;
 
 int netid_width;
 int state_width;
@@ -103,6 +115,7 @@ struct filter
 	int states;
 	int families;
 	struct ssfilter *f;
+	int nobc;	/* kernel refused the bytecode, filter here */
 };
 
 struct filter default_filter = {
@@ -197,117 +210,563 @@ static FILE *ephemeral_ports_open(void)
 	return generic_proc_open("PROC_IP_LOCAL_PORT_RANGE", "sys/net/ipv4/ip_local_port_range");
 }
 
+/*
+ * --max-mem: a budget for what ss keeps from one socket to the next
+ * (the UNIX table kept to name peers, the inodes wanted by -p, groups,
+ * sockets kept by --sort, the --watch table).  Sockets are otherwise
+ * printed as they are read.  When a structure would go over the
+ * budget it degrades instead of growing, and says so once on stderr.
+ */
+static size_t mem_cap;
+static size_t mem_used;
+
+static int mem_charge(size_t size, const char *what)
+{
+	static const char *warned[8];
+	int i;
+
+	if (!mem_cap || mem_used + size <= mem_cap) {
+		mem_used += size;
+		return 0;
+	}
+	for (i = 0; i < ARRAY_SIZE(warned) && warned[i]; i++)
+		if (warned[i] == what)
+			return -1;
+	if (i < ARRAY_SIZE(warned))
+		warned[i] = what;
+	fprintf(stderr, "ss: --max-mem reached, %s\n", what);
+	return -1;
+}
+
+static void mem_uncharge(size_t size)
+{
+	mem_used -= size < mem_used ? size : mem_used;
+}
+
+static int mem_parse(const char *arg)
+{
+	unsigned long long v;
+	char *end;
+
+	v = strtoull(arg, &end, 0);
+	switch (*end) {
+	case 'g': case 'G':
+		v *= 1024;
+		/* fall through */
+	case 'm': case 'M':
+		v *= 1024;
+		/* fall through */
+	case 'k': case 'K':
+		v *= 1024;
+		end++;
+	}
+	if (end == arg || *end || v == 0 || v != (size_t)v) {
+		fprintf(stderr, "ss: invalid memory size \"%s\"\n", arg);
+		return -1;
+	}
+	mem_cap = v;
+	return 0;
+}
+
+/*
+ * Sockets are told apart by cgroup with the cgroup v2 ID the kernel
+ * reports with INET_DIAG_CGROUP_ID (5.7 and later), which is the file
+ * handle of the cgroup's directory.  Kernels without it leave the ID
+ * to be found from the owner: when a filter or group asks for cgroups
+ * (need_cgroups), the /proc walk of -p also notes the cgroup of every
+ * process, and a socket gets that of its first owner.  Each cgroup is kept once, by ID and
+ * by path.
+ */
+struct cg_ent {
+	struct cg_ent	*next_id;
+	struct cg_ent	*next_path;
+	__u64		id;
+	char		path[0];
+};
+
+#define CG_HASH_SIZE	1024
+
+static struct cg_ent *cg_id_hash[CG_HASH_SIZE];
+static struct cg_ent *cg_path_hash[CG_HASH_SIZE];
+static pthread_mutex_t cg_lock = PTHREAD_MUTEX_INITIALIZER;
+static int need_cgroups;
+
+static const char *cg_root(void)
+{
+	static char *root;
+	static int done;
+	struct mntent *m;
+	FILE *fp;
+
+	if (done)
+		return root;
+	done = 1;
+	fp = setmntent("/proc/mounts", "r");
+	if (fp == NULL)
+		return NULL;
+	while ((m = getmntent(fp)) != NULL)
+		if (strcmp(m->mnt_type, "cgroup2") == 0) {
+			root = strdup(m->mnt_dir);
+			break;
+		}
+	endmntent(fp);
+	return root;
+}
+
+static int cg_handle_id(const char *dir, __u64 *id)
+{
+	union {
+		struct file_handle	fh;
+		char			buf[sizeof(struct file_handle) + 8];
+	} h;
+	int mnt_id;
+
+	h.fh.handle_bytes = 8;
+	if (name_to_handle_at(AT_FDCWD, dir, &h.fh, &mnt_id, 0) < 0 ||
+	    h.fh.handle_bytes != 8)
+		return -1;
+	memcpy(id, h.fh.f_handle, sizeof(*id));
+	return 0;
+}
+
+static unsigned int cg_hashfn(const char *path)
+{
+	unsigned int h = 2166136261u;
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 16777619;
+	return h & (CG_HASH_SIZE - 1);
+}
+
+static unsigned int cg_id_hashfn(__u64 id)
+{
+	return (id ^ (id >> 32)) * 2654435761U & (CG_HASH_SIZE - 1);
+}
+
+static struct cg_ent *cg_add(const char *path, __u64 id)
+{
+	struct cg_ent *c = malloc(sizeof(*c) + strlen(path) + 1);
+
+	if (c == NULL)
+		abort();
+	c->id = id;
+	strcpy(c->path, path);
+	c->next_path = cg_path_hash[cg_hashfn(path)];
+	cg_path_hash[cg_hashfn(path)] = c;
+	c->next_id = cg_id_hash[cg_id_hashfn(id)];
+	cg_id_hash[cg_id_hashfn(id)] = c;
+	return c;
+}
+
+/* The cgroup of a path below the cgroup2 mount, such as
+ * "/system.slice/sshd.service"; its ID is 0 when it is not found.
+ * Called from the /proc walkers, hence the lock.
+ */
+static struct cg_ent *cg_by_path(const char *path)
+{
+	const char *root;
+	struct cg_ent *c;
+	char dir[PATH_MAX];
+	__u64 id = 0;
+
+	pthread_mutex_lock(&cg_lock);
+	for (c = cg_path_hash[cg_hashfn(path)]; c; c = c->next_path)
+		if (strcmp(c->path, path) == 0)
+			goto out;
+	root = cg_root();
+	if (root) {
+		snprintf(dir, sizeof(dir), "%s%s", root, path);
+		if (cg_handle_id(dir, &id) < 0)
+			id = 0;
+	}
+	c = cg_add(path, id);
+out:
+	pthread_mutex_unlock(&cg_lock);
+	return c;
+}
+
+static int cg_walk_one(const char *fpath, const struct stat *st, int type,
+		       struct FTW *ftw)
+{
+	const char *root = cg_root();
+	__u64 id;
+
+	if (type == FTW_D && cg_handle_id(fpath, &id) == 0) {
+		const char *path = fpath + strlen(root);
+
+		cg_add(*path ? path : "/", id);
+	}
+	return 0;
+}
+
+/* The path of a cgroup ID, from one walk of the whole hierarchy */
+static const char *cg_by_id(__u64 id)
+{
+	static int walked;
+	struct cg_ent *c;
+
+	for (;;) {
+		for (c = cg_id_hash[cg_id_hashfn(id)]; c; c = c->next_id)
+			if (c->id == id)
+				return c->path;
+		if (walked || cg_root() == NULL)
+			return NULL;
+		walked = 1;
+		nftw(cg_root(), cg_walk_one, 16, FTW_PHYS | FTW_MOUNT);
+	}
+}
+
+/* The cgroup of a process, from the cgroup v2 line of /proc/<pid>/cgroup */
+static const struct cg_ent *cg_of_pid(int procfd, int pid)
+{
+	char name[64], line[PATH_MAX + 8];
+	const struct cg_ent *c = NULL;
+	FILE *fp;
+	int fd;
+
+	snprintf(name, sizeof(name), "%d/cgroup", pid);
+	fd = openat(procfd, name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	fp = fdopen(fd, "r");
+	if (fp == NULL) {
+		close(fd);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			c = cg_by_path(line + 3);
+			break;
+		}
+	}
+	fclose(fp);
+	return c;
+}
+
+/* What all the sockets of a process share */
+struct user_proc {
+	int		pid;
+	const struct cg_ent *cgroup;
+	char		process[16];
+};
+
 struct user_ent {
 	struct user_ent	*next;
+	const struct user_proc *proc;
 	unsigned int	ino;
-	int		pid;
 	int		fd;
-	char		process[0];
 };
 
-#define USER_ENT_HASH_SIZE	256
-struct user_ent *user_ent_hash[USER_ENT_HASH_SIZE];
+/*
+ * Socket owners are found by walking /proc/<pid>/fd.  sock_diag does
+ * not report owning processes (only the uid), so there is no way
+ * around the walk; it is spread over one thread per CPU instead,
+ * using openat()/readlinkat() relative to each fd directory.  Every
+ * thread keeps its own list and the hash, sized to the number of
+ * sockets found, is built once they are done.
+ *
+ * A host with many sockets has few processes owning them, so an entry
+ * only holds the inode and fd and points at the record of its
+ * process.  Both come from the arena of the thread that found them,
+ * which is kept until the hash is built again.
+ */
+#define USER_ENT_MAX_THREADS	16
+#define USER_ENT_ARENA_CHUNK	(16*1024)
+
+static struct user_ent **user_ent_hash;
+static unsigned int user_ent_hash_size;
+static unsigned int user_ent_count;
+static int user_ent_built;
+static struct arena user_ent_arena[USER_ENT_MAX_THREADS];
+
+/*
+ * With -p the listing is first run with output discarded and
+ * user_ent_collect set: find_users() then only records the inodes of
+ * sockets that passed the filter.  The /proc walk then records owners
+ * of just those, all of them for a socket that several processes
+ * share.
+ */
+static int user_ent_collect;
+static unsigned int *user_ent_wanted;
+static unsigned int user_ent_wanted_size;
+static unsigned int user_ent_wanted_count;
+
+static int user_ent_wanted_slot(unsigned int ino, int add)
+{
+	unsigned int i = (ino * 2654435761U) & (user_ent_wanted_size - 1);
+
+	while (user_ent_wanted[i]) {
+		if (user_ent_wanted[i] == ino)
+			return i;
+		i = (i + 1) & (user_ent_wanted_size - 1);
+	}
+	if (!add)
+		return -1;
+	user_ent_wanted[i] = ino;
+	user_ent_wanted_count++;
+	return i;
+}
+
+static void user_ent_want(unsigned int ino)
+{
+	if (user_ent_wanted_count * 2 >= user_ent_wanted_size) {
+		unsigned int *old = user_ent_wanted;
+		unsigned int i, osize = user_ent_wanted_size;
+
+		if (mem_charge((osize ? osize : 1024) * sizeof(*old),
+			       "not looking up owners of every socket"))
+			return;
+		user_ent_wanted_size = osize ? osize * 2 : 1024;
+		user_ent_wanted = calloc(user_ent_wanted_size, sizeof(*old));
+		if (!user_ent_wanted)
+			abort();
+		user_ent_wanted_count = 0;
+		for (i = 0; i < osize; i++)
+			if (old[i])
+				user_ent_wanted_slot(old[i], 1);
+		free(old);
+	}
+	user_ent_wanted_slot(ino, 1);
+}
 
 static int user_ent_hashfn(unsigned int ino)
 {
-	int val = (ino >> 24) ^ (ino >> 16) ^ (ino >> 8) ^ ino;
+	unsigned int val = (ino >> 24) ^ (ino >> 16) ^ (ino >> 8) ^ ino;
 
-	return val & (USER_ENT_HASH_SIZE - 1);
+	val ^= ino * 2654435761U;
+	return val & (user_ent_hash_size - 1);
 }
 
-static void user_ent_add(unsigned int ino, const char *process, int pid, int fd)
+static void *user_ent_alloc(struct arena *a, size_t len)
 {
-	struct user_ent *p, **pp;
-	int str_len;
+	void *p = arena_alloc(a, len);
 
-	str_len = strlen(process) + 1;
-	p = malloc(sizeof(struct user_ent) + str_len);
 	if (!p)
 		abort();
-	p->next = NULL;
-	p->ino = ino;
-	p->pid = pid;
-	p->fd = fd;
-	strcpy(p->process, process);
-
-	pp = &user_ent_hash[user_ent_hashfn(ino)];
-	p->next = *pp;
-	*pp = p;
+	return p;
 }
 
-static void user_ent_hash_build(void)
+struct user_ent_walk {
+	int		procfd;
+	const int	*pids;
+	int		npids;
+	int		next;
+	pthread_mutex_t	lock;
+};
+
+struct user_ent_list {
+	struct user_ent_walk	*walk;
+	struct arena		*arena;
+	struct user_ent		*head;
+	unsigned int		count;
+};
+
+static void user_ent_scan_pid(struct user_ent_list *l, int pid)
 {
-	const char *root = getenv("PROC_ROOT") ? : "/proc/";
+	const char *pattern = "socket:[";
+	struct user_proc *proc = NULL;
+	char name[64];
 	struct dirent *d;
-	char name[1024];
-	int nameoff;
 	DIR *dir;
+	int dfd;
 
-	strcpy(name, root);
-	if (strlen(name) == 0 || name[strlen(name)-1] != '/')
-		strcat(name, "/");
-
-	nameoff = strlen(name);
-
-	dir = opendir(name);
-	if (!dir)
+	snprintf(name, sizeof(name), "%d/fd", pid);
+	dfd = openat(l->walk->procfd, name, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		return;
+	dir = fdopendir(dfd);
+	if (dir == NULL) {
+		close(dfd);
 		return;
+	}
 
 	while ((d = readdir(dir)) != NULL) {
-		struct dirent *d1;
-		char process[16];
-		int pid, pos;
-		DIR *dir1;
+		struct user_ent *p;
+		unsigned int ino;
+		char lnk[64];
+		ssize_t link_len;
 		char crap;
+		int fd;
 
-		if (sscanf(d->d_name, "%d%c", &pid, &crap) != 1)
+		if (sscanf(d->d_name, "%d%c", &fd, &crap) != 1)
+			continue;
+
+		link_len = readlinkat(dfd, d->d_name, lnk, sizeof(lnk)-1);
+		if (link_len == -1)
 			continue;
+		lnk[link_len] = '\0';
 
-		sprintf(name + nameoff, "%d/fd/", pid);
-		pos = strlen(name);
-		if ((dir1 = opendir(name)) == NULL)
+		if (strncmp(lnk, pattern, strlen(pattern)))
 			continue;
 
-		process[0] = '\0';
+		if (sscanf(lnk, "socket:[%u]", &ino) != 1)
+			continue;
 
-		while ((d1 = readdir(dir1)) != NULL) {
-			const char *pattern = "socket:[";
-			unsigned int ino;
-			char lnk[64];
-			int fd;
-			ssize_t link_len;
+		if (user_ent_wanted && user_ent_wanted_slot(ino, 0) < 0)
+			continue;
 
-			if (sscanf(d1->d_name, "%d%c", &fd, &crap) != 1)
-				continue;
+		if (proc == NULL) {
+			FILE *fp;
+			int sfd;
+
+			proc = user_ent_alloc(l->arena, sizeof(*proc));
+			proc->pid = pid;
+			proc->cgroup = NULL;
+			proc->process[0] = '\0';
+			snprintf(name, sizeof(name), "%d/stat", pid);
+			sfd = openat(l->walk->procfd, name, O_RDONLY);
+			if (sfd >= 0 && (fp = fdopen(sfd, "r")) != NULL) {
+				fscanf(fp, "%*d (%15[^)])", proc->process);
+				fclose(fp);
+			} else if (sfd >= 0)
+				close(sfd);
+			if (need_cgroups)
+				proc->cgroup = cg_of_pid(l->walk->procfd, pid);
+		}
 
-			sprintf(name+pos, "%d", fd);
+		p = user_ent_alloc(l->arena, sizeof(*p));
+		p->proc = proc;
+		p->ino = ino;
+		p->fd = fd;
+		p->next = l->head;
+		l->head = p;
+		l->count++;
+	}
+	closedir(dir);
+}
 
-			link_len = readlink(name, lnk, sizeof(lnk)-1);
-			if (link_len == -1)
-				continue;
-			lnk[link_len] = '\0';
+static void *user_ent_worker(void *arg)
+{
+	struct user_ent_list *l = arg;
+	struct user_ent_walk *w = l->walk;
 
-			if (strncmp(lnk, pattern, strlen(pattern)))
-				continue;
+	for (;;) {
+		int i;
 
-			sscanf(lnk, "socket:[%u]", &ino);
+		pthread_mutex_lock(&w->lock);
+		i = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		if (i >= w->npids)
+			break;
+		user_ent_scan_pid(l, w->pids[i]);
+	}
+	return NULL;
+}
 
-			if (process[0] == '\0') {
-				char tmp[1024];
-				FILE *fp;
+/* Owned sockets, and bytes of their entries and the hash */
+static void user_ent_memory(unsigned long *count, unsigned long *bytes)
+{
+	int i;
 
-				snprintf(tmp, sizeof(tmp), "%s/%d/stat", root, pid);
-				if ((fp = fopen(tmp, "r")) != NULL) {
-					fscanf(fp, "%*d (%[^)])", process);
-					fclose(fp);
-				}
-			}
+	*count = user_ent_count;
+	*bytes = user_ent_hash ? user_ent_hash_size * sizeof(*user_ent_hash) : 0;
+	for (i = 0; i < USER_ENT_MAX_THREADS; i++)
+		*bytes += user_ent_arena[i].size;
+}
+
+static void user_ent_hash_build(void)
+{
+	const char *root = getenv("PROC_ROOT") ? : "/proc/";
+	struct user_ent_list lists[USER_ENT_MAX_THREADS];
+	pthread_t tids[USER_ENT_MAX_THREADS];
+	struct user_ent_walk w;
+	struct user_ent *p, *next;
+	unsigned int total = 0;
+	int *pids = NULL, npids = 0, nalloc = 0;
+	int i, nthreads, started;
+	struct dirent *d;
+	DIR *dir;
+
+	user_ent_built = 1;
+	for (i = 0; i < USER_ENT_MAX_THREADS; i++) {
+		arena_free(&user_ent_arena[i]);
+		arena_init(&user_ent_arena[i], USER_ENT_ARENA_CHUNK);
+	}
+	free(user_ent_hash);
+	user_ent_hash = NULL;
+	user_ent_count = 0;
+	memset(&w, 0, sizeof(w));
+	if (user_ent_wanted && user_ent_wanted_count == 0)
+		return;
+	w.procfd = open(root, O_RDONLY | O_DIRECTORY);
+	if (w.procfd < 0)
+		return;
+
+	dir = opendir(root);
+	if (!dir) {
+		close(w.procfd);
+		return;
+	}
+	while ((d = readdir(dir)) != NULL) {
+		int pid;
+		char crap;
 
-			user_ent_add(ino, process, pid, fd);
+		if (sscanf(d->d_name, "%d%c", &pid, &crap) != 1)
+			continue;
+		if (npids == nalloc) {
+			nalloc = nalloc ? nalloc * 2 : 1024;
+			pids = realloc(pids, nalloc * sizeof(*pids));
+			if (!pids)
+				abort();
 		}
-		closedir(dir1);
+		pids[npids++] = pid;
 	}
 	closedir(dir);
+
+	w.pids = pids;
+	w.npids = npids;
+	pthread_mutex_init(&w.lock, NULL);
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > USER_ENT_MAX_THREADS)
+		nthreads = USER_ENT_MAX_THREADS;
+	if (nthreads > npids / 64 + 1)
+		nthreads = npids / 64 + 1;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	memset(lists, 0, sizeof(lists));
+	for (i = 0; i < nthreads; i++) {
+		lists[i].walk = &w;
+		lists[i].arena = &user_ent_arena[i];
+	}
+
+	/* The calling thread is worker 0. */
+	for (started = 1; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, user_ent_worker,
+				   &lists[started]) != 0)
+			break;
+	user_ent_worker(&lists[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_mutex_destroy(&w.lock);
+	close(w.procfd);
+	free(pids);
+
+	for (i = 0; i < nthreads; i++)
+		total += lists[i].count;
+
+	user_ent_count = total;
+	user_ent_hash_size = 256;
+	while (user_ent_hash_size < total)
+		user_ent_hash_size <<= 1;
+	user_ent_hash = calloc(user_ent_hash_size, sizeof(*user_ent_hash));
+	if (!user_ent_hash)
+		abort();
+
+	for (i = 0; i < nthreads; i++) {
+		for (p = lists[i].head; p; p = next) {
+			struct user_ent **pp;
+
+			next = p->next;
+			pp = &user_ent_hash[user_ent_hashfn(p->ino)];
+			p->next = *pp;
+			*pp = p;
+		}
+	}
+	rtnl_stats_mem("sockets", user_ent_memory);
 }
 
 int find_users(unsigned ino, char *buf, int buflen)
@@ -319,6 +778,14 @@ int find_users(unsigned ino, char *buf, int buflen)
 	if (!ino)
 		return 0;
 
+	if (user_ent_collect) {
+		user_ent_want(ino);
+		return 0;
+	}
+
+	if (!user_ent_hash)
+		return 0;
+
 	p = user_ent_hash[user_ent_hashfn(ino)];
 	ptr = buf;
 	while (p) {
@@ -330,7 +797,7 @@ int find_users(unsigned ino, char *buf, int buflen)
 
 		snprintf(ptr, buflen - (ptr - buf),
 			 "(\"%s\",%d,%d),",
-			 p->process, p->pid, p->fd);
+			 p->proc->process, p->proc->pid, p->fd);
 		ptr += strlen(ptr);
 		cnt++;
 
@@ -344,6 +811,27 @@ int find_users(unsigned ino, char *buf, int buflen)
 	return cnt;
 }
 
+/* The cgroup ID of a socket the kernel did not give one for */
+static __u64 user_ent_cgroup(unsigned int ino)
+{
+	struct user_ent *p;
+
+	if (!ino)
+		return 0;
+	if (user_ent_collect) {
+		user_ent_want(ino);
+		return 0;
+	}
+	if (!user_ent_built)
+		user_ent_hash_build();
+	if (!user_ent_hash)
+		return 0;
+	for (p = user_ent_hash[user_ent_hashfn(ino)]; p; p = p->next)
+		if (p->ino == ino && p->proc->cgroup)
+			return p->proc->cgroup->id;
+	return 0;
+}
+
 /* Get stats from slab */
 
 struct slabstat
@@ -445,8 +933,18 @@ struct tcpstat
 	int		refcnt;
 	unsigned long long sk;
 	int		rto, ato, qack, cwnd, ssthresh;
+	unsigned	iface;
+	unsigned	mark;
+	__u64		cgroup_id;
 };
 
+static __u64 sock_cgroup_id(const struct tcpstat *s)
+{
+	if (s->cgroup_id || !need_cgroups)
+		return s->cgroup_id;
+	return user_ent_cgroup(s->ino);
+}
+
 static const char *tmr_name[] = {
 	"off",
 	"on",
@@ -499,6 +997,102 @@ struct scache
 
 struct scache *rlist;
 
+/*
+ * Output.  main() gives stdout one large fully buffered area, so the
+ * listing leaves in big write()s, and the fields printed for every
+ * socket are formatted by hand below rather than through printf().
+ */
+#define SS_OUTBUF_SIZE	(1 << 20)
+
+static const char ss_spaces[] =
+	"                                                                ";
+
+static void out_pad(int n)
+{
+	while (n > 0) {
+		int k = n > sizeof(ss_spaces) - 1 ? sizeof(ss_spaces) - 1 : n;
+
+		fwrite(ss_spaces, 1, k, stdout);
+		n -= k;
+	}
+}
+
+/* printf("%-*s", width, s) */
+static void out_left(const char *s, int width)
+{
+	int len = strlen(s);
+
+	fwrite(s, 1, len, stdout);
+	out_pad(width - len);
+}
+
+/* printf("%*s", width, s) */
+static void out_right(const char *s, int width)
+{
+	int len = strlen(s);
+
+	out_pad(width - len);
+	fwrite(s, 1, len, stdout);
+}
+
+/* Formats v backwards ending at end, returns the first character. */
+static char *ss_utoa(char *end, unsigned int v)
+{
+	*end = 0;
+	do {
+		*--end = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+/* printf("%-*d", width, v) */
+static void out_int_left(int v, int width)
+{
+	char buf[16];
+	char *p = ss_utoa(buf + sizeof(buf) - 1, v < 0 ? -(unsigned)v : v);
+
+	if (v < 0)
+		*--p = '-';
+	out_left(p, width);
+}
+
+static void print_netid_state(const char *netid, const char *state)
+{
+	if (netid_width) {
+		out_left(netid, netid_width);
+		putchar(' ');
+	}
+	if (state_width) {
+		out_left(state, state_width);
+		putchar(' ');
+	}
+}
+
+static void print_queues(int rq, int wq)
+{
+	out_int_left(rq, 6);
+	putchar(' ');
+	out_int_left(wq, 6);
+	putchar(' ');
+}
+
+static const char *ss_inet4_ntoa(const __u8 *a, char *buf)
+{
+	char tmp[4][4];
+	char *p = buf;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		const char *s = ss_utoa(tmp[i] + 3, a[i]);
+
+		while (*s)
+			*p++ = *s++;
+		*p++ = i < 3 ? '.' : 0;
+	}
+	return buf;
+}
+
 void init_service_resolver(void)
 {
 	char buf[128];
@@ -556,13 +1150,43 @@ static int is_ephemeral(int port)
 }
 
 
+static int service_resolver_wanted;
+
+static int service_cache_key(__u8 *key, int port)
+{
+	int len = strlen(dg_proto);
+
+	if (len > NAMECACHE_KEYLEN - 3)
+		return 0;
+	key[0] = 'S';
+	key[1] = port >> 8;
+	key[2] = port;
+	memcpy(key + 3, dg_proto, len);
+	return len + 3;
+}
+
 const char *__resolve_service(int port)
 {
+	__u8 key[NAMECACHE_KEYLEN];
+	const char *res = NULL;
 	struct scache *c;
+	int klen;
+
+	klen = service_cache_key(key, port);
+	if (klen && namecache_get(key, klen, &res))
+		return res;
+
+	/* rpcinfo is only run once a port is not in the name cache */
+	if (service_resolver_wanted) {
+		service_resolver_wanted = 0;
+		init_service_resolver();
+	}
 
 	for (c = rlist; c; c = c->next) {
-		if (c->port == port && c->proto == dg_proto)
-			return c->name;
+		if (c->port == port && c->proto == dg_proto) {
+			res = c->name;
+			goto out;
+		}
 	}
 
 	if (!is_ephemeral(port)) {
@@ -574,10 +1198,13 @@ const char *__resolve_service(int port)
 		}
 		se = getservbyport(htons(port), dg_proto);
 		if (se)
-			return se->s_name;
+			res = se->s_name;
 	}
 
-	return NULL;
+out:
+	if (klen)
+		namecache_put(key, klen, res);
+	return res;
 }
 
 
@@ -631,8 +1258,7 @@ const char *resolve_service(int port)
 	}
 
 	do_numeric:
-	sprintf(buf, "%u", port);
-	return buf;
+	return ss_utoa(buf + sizeof(buf) - 1, port);
 }
 
 void formatted_print(const inet_prefix *a, int port)
@@ -647,6 +1273,8 @@ void formatted_print(const inet_prefix *a, int port)
 		if (a->data[0] == 0) {
 			buf[0] = '*';
 			buf[1] = 0;
+		} else if (!resolve_hosts) {
+			ap = ss_inet4_ntoa((const __u8 *)a->data, buf);
 		} else {
 			ap = format_host(AF_INET, 4, a->data, buf, sizeof(buf));
 		}
@@ -658,13 +1286,20 @@ void formatted_print(const inet_prefix *a, int port)
 		else
 			est_len = addr_width + ((est_len-addr_width+3)/4)*4;
 	}
-	printf("%*s:%-*s ", est_len, ap, serv_width, resolve_service(port));
+	out_right(ap, est_len);
+	putchar(':');
+	out_left(resolve_service(port), serv_width);
+	putchar(' ');
 }
 
 struct aafilter
 {
 	inet_prefix	addr;
 	int		port;
+	unsigned	iface;
+	__u32		mark;
+	__u32		mask;
+	__u64		cgroup_id;
 	struct aafilter *next;
 };
 
@@ -778,6 +1413,23 @@ int run_ssfilter(struct ssfilter *f, struct tcpstat *s)
 		struct aafilter *a = (void*)f->pred;
 		return s->lport <= a->port;
 	}
+		case SSF_DEVCOND:
+	{
+		struct aafilter *a = (void*)f->pred;
+		return s->iface == a->iface;
+	}
+		case SSF_MARKMASK:
+	{
+		struct aafilter *a = (void*)f->pred;
+		return (s->mark & a->mask) == a->mark;
+	}
+		case SSF_CGROUPCOND:
+	{
+		struct aafilter *a = (void*)f->pred;
+		if (s->local.family != AF_INET && s->local.family != AF_INET6)
+			return 0;
+		return sock_cgroup_id(s) == a->cgroup_id;
+	}
 
 		/* Yup. It is recursion. Sorry. */
 		case SSF_AND:
@@ -886,16 +1538,43 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		((struct inet_diag_bc_op*)*bytecode)[1] = (struct inet_diag_bc_op){ 0, 0, x->port };
 		return 8;
 	}
-
-		case SSF_AND:
+		case SSF_DEVCOND:
 	{
-		char *a1, *a2, *a, l1, l2;
-		l1 = ssfilter_bytecompile(f->pred, &a1);
-		l2 = ssfilter_bytecompile(f->post, &a2);
-		if (!(a = malloc(l1+l2))) abort();
-		memcpy(a, a1, l1);
-		memcpy(a+l1, a2, l2);
-		free(a1); free(a2);
+		struct aafilter *x = (void*)f->pred;
+		if (!(*bytecode=malloc(8))) abort();
+		((struct inet_diag_bc_op*)*bytecode)[0] = (struct inet_diag_bc_op){ INET_DIAG_BC_DEV_COND, 8, 12 };
+		memcpy(*bytecode + 4, &x->iface, 4);
+		return 8;
+	}
+		case SSF_MARKMASK:
+	{
+		struct aafilter *x = (void*)f->pred;
+		struct inet_diag_markcond *cond;
+		if (!(*bytecode=malloc(12))) abort();
+		((struct inet_diag_bc_op*)*bytecode)[0] = (struct inet_diag_bc_op){ INET_DIAG_BC_MARK_COND, 12, 16 };
+		cond = (struct inet_diag_markcond *)(*bytecode + 4);
+		cond->mark = x->mark;
+		cond->mask = x->mask;
+		return 12;
+	}
+		case SSF_CGROUPCOND:
+	{
+		struct aafilter *x = (void*)f->pred;
+		if (!(*bytecode=malloc(12))) abort();
+		((struct inet_diag_bc_op*)*bytecode)[0] = (struct inet_diag_bc_op){ INET_DIAG_BC_CGROUP_COND, 12, 16 };
+		memcpy(*bytecode + 4, &x->cgroup_id, 8);
+		return 12;
+	}
+
+		case SSF_AND:
+	{
+		char *a1, *a2, *a, l1, l2;
+		l1 = ssfilter_bytecompile(f->pred, &a1);
+		l2 = ssfilter_bytecompile(f->post, &a2);
+		if (!(a = malloc(l1+l2))) abort();
+		memcpy(a, a1, l1);
+		memcpy(a+l1, a2, l2);
+		free(a1); free(a2);
 		ssfilter_patch(a, l1, l2);
 		*bytecode = a;
 		return l1+l2;
@@ -929,58 +1608,237 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 	}
 }
 
-static int remember_he(struct aafilter *a, struct hostent *he)
+/* Compiled once: the dumps of every table, and of every --watch
+ * interval, send the same bytecode.
+ */
+static int ssfilter_bytecode(struct ssfilter *f, char **bc)
 {
-	char **ptr = he->h_addr_list;
-	int cnt = 0;
-	int len;
+	static struct ssfilter *compiled;
+	static char *code;
+	static int len;
+
+	if (f != compiled) {
+		free(code);
+		code = NULL;
+		len = ssfilter_bytecompile(f, &code);
+		compiled = f;
+	}
+	*bc = code;
+	return len;
+}
 
-	if (he->h_addrtype == AF_INET)
-		len = 4;
-	else if (he->h_addrtype == AF_INET6)
-		len = 16;
-	else
+/*
+ * Host names in the filter are not looked up as the parser meets
+ * them: parse_hostcond() queues them, and once the whole filter is
+ * parsed ssfilter_resolve_hosts() looks them all up at once from a
+ * few threads and fills in their conditions.  The addresses also go
+ * to the name cache (IPROUTE_NAME_CACHE), so that ss run every second
+ * with the same filter does not ask DNS again until they expire.
+ */
+#define HOST_LOOKUP_THREADS	16
+#define HOST_LOOKUP_ADDRS	32
+
+struct host_lookup {
+	struct host_lookup	*next;
+	struct host_lookup	*same;	/* earlier lookup of the name */
+	struct aafilter		*a;
+	char			*name;
+	int			fam;
+	int			cnt;
+	int			cached;
+	inet_prefix		addr[HOST_LOOKUP_ADDRS];
+};
+
+static struct host_lookup *host_lookups;
+static struct host_lookup *host_lookup_next;
+static pthread_mutex_t host_lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int host_lookup_add(struct aafilter *a, const char *name, int fam)
+{
+	struct host_lookup *l = calloc(1, sizeof(*l)), **pp;
+
+	if (l == NULL || (l->name = strdup(name)) == NULL) {
+		free(l);
+		return -1;
+	}
+	l->a = a;
+	l->fam = fam;
+	for (pp = &host_lookups; *pp; pp = &(*pp)->next)
+		if (!l->same && (*pp)->fam == fam &&
+		    strcmp((*pp)->name, name) == 0)
+			l->same = *pp;
+	*pp = l;
+	return 0;
+}
+
+static int host_lookup_key(__u8 *key, const struct host_lookup *l)
+{
+	int len = strlen(l->name);
+	__u64 h = 14695981039346656037ULL;
+	const char *c;
+
+	key[1] = l->fam;
+	if (len <= NAMECACHE_KEYLEN - 2) {
+		key[0] = 'A';
+		memcpy(key + 2, l->name, len);
+		return len + 2;
+	}
+	/* Long names are keyed by their hash */
+	for (c = l->name; *c; c++)
+		h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+	key[0] = 'a';
+	memcpy(key + 2, &h, sizeof(h));
+	return sizeof(h) + 2;
+}
+
+/* The cached addresses are kept as text, separated by spaces */
+static int host_lookup_cached(struct host_lookup *l)
+{
+	__u8 key[NAMECACHE_KEYLEN];
+	char buf[256], *tok, *save = NULL;
+	const char *val;
+
+	if (!namecache_get(key, host_lookup_key(key, l), &val) || !val)
 		return 0;
+	snprintf(buf, sizeof(buf), "%s", val);
+	for (tok = strtok_r(buf, " ", &save); tok && l->cnt < HOST_LOOKUP_ADDRS;
+	     tok = strtok_r(NULL, " ", &save)) {
+		inet_prefix *p = &l->addr[l->cnt];
+
+		p->family = strchr(tok, ':') ? AF_INET6 : AF_INET;
+		p->bytelen = p->family == AF_INET ? 4 : 16;
+		if (inet_pton(p->family, tok, p->data) == 1)
+			l->cnt++;
+	}
+	l->cached = l->cnt > 0;
+	return l->cnt;
+}
+
+static void host_lookup_cache(const struct host_lookup *l)
+{
+	__u8 key[NAMECACHE_KEYLEN];
+	char buf[256], addr[INET6_ADDRSTRLEN];
+	int i, len = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < l->cnt; i++) {
+		inet_ntop(l->addr[i].family, l->addr[i].data, addr, sizeof(addr));
+		if (len + strlen(addr) + 2 > sizeof(buf))
+			return;
+		len += sprintf(buf + len, "%s%s", i ? " " : "", addr);
+	}
+	namecache_put(key, host_lookup_key(key, l), buf);
+}
+
+static void host_lookup_one(struct host_lookup *l)
+{
+	struct addrinfo hints, *res, *ai;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = l->fam;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(l->name, NULL, &hints, &res) != 0)
+		return;
+	for (ai = res; ai && l->cnt < HOST_LOOKUP_ADDRS; ai = ai->ai_next) {
+		inet_prefix *p = &l->addr[l->cnt];
+
+		if (ai->ai_family == AF_INET) {
+			p->bytelen = 4;
+			memcpy(p->data, &((struct sockaddr_in *)ai->ai_addr)->sin_addr, 4);
+		} else if (ai->ai_family == AF_INET6) {
+			p->bytelen = 16;
+			memcpy(p->data, &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, 16);
+		} else
+			continue;
+		p->family = ai->ai_family;
+		l->cnt++;
+	}
+	freeaddrinfo(res);
+}
+
+static void *host_lookup_worker(void *arg)
+{
+	struct host_lookup *l;
+
+	for (;;) {
+		pthread_mutex_lock(&host_lookup_lock);
+		while ((l = host_lookup_next) != NULL && (l->same || l->cnt))
+			host_lookup_next = l->next;
+		if (l)
+			host_lookup_next = l->next;
+		pthread_mutex_unlock(&host_lookup_lock);
+		if (l == NULL)
+			return NULL;
+		host_lookup_one(l);
+	}
+}
+
+/* The condition gets one address, and a copy of itself for every
+ * further one.
+ */
+static void host_lookup_fill(struct aafilter *a, const struct host_lookup *l)
+{
+	int i;
 
-	while (*ptr) {
+	for (i = 0; i < l->cnt; i++) {
 		struct aafilter *b = a;
+
 		if (a->addr.bitlen) {
 			if ((b = malloc(sizeof(*b))) == NULL)
-				return cnt;
+				return;
 			*b = *a;
 			b->next = a->next;
 			a->next = b;
 		}
-		memcpy(b->addr.data, *ptr, len);
-		b->addr.bytelen = len;
-		b->addr.bitlen = len*8;
-		b->addr.family = he->h_addrtype;
-		ptr++;
-		cnt++;
+		b->addr = l->addr[i];
+		b->addr.bitlen = l->addr[i].bytelen * 8;
 	}
-	return cnt;
 }
 
-static int get_dns_host(struct aafilter *a, const char *addr, int fam)
+int ssfilter_resolve_hosts(void)
 {
-	static int notfirst;
-	int cnt = 0;
-	struct hostent *he;
-
-	a->addr.bitlen = 0;
-	if (!notfirst) {
-		sethostent(1);
-		notfirst = 1;
+	pthread_t tids[HOST_LOOKUP_THREADS];
+	struct host_lookup *l, *next;
+	int i, n = 0, started, err = 0;
+
+	for (l = host_lookups; l; l = l->next)
+		if (!l->same && !host_lookup_cached(l))
+			n++;
+	if (n > HOST_LOOKUP_THREADS)
+		n = HOST_LOOKUP_THREADS;
+
+	host_lookup_next = host_lookups;
+	for (started = 1; started < n; started++)
+		if (pthread_create(&tids[started], NULL, host_lookup_worker,
+				   NULL) != 0)
+			break;
+	if (n)
+		host_lookup_worker(NULL);
+	for (i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	for (l = host_lookups; l; l = next) {
+		const struct host_lookup *r = l->same ? : l;
+
+		next = l->next;
+		if (r->cnt == 0) {
+			if (!err)
+				fprintf(stderr, "Error: an inet prefix is expected rather than \"%s\".\n",
+					l->name);
+			err = -1;
+		} else {
+			if (r == l && !l->cached)
+				host_lookup_cache(l);
+			host_lookup_fill(l->a, r);
+		}
 	}
-	he = gethostbyname2(addr, fam == AF_UNSPEC ? AF_INET : fam);
-	if (he)
-		cnt = remember_he(a, he);
-	if (fam == AF_UNSPEC) {
-		he = gethostbyname2(addr, AF_INET6);
-		if (he)
-			cnt += remember_he(a, he);
+	for (l = host_lookups; l; l = next) {
+		next = l->next;
+		free(l->name);
+		free(l);
 	}
-	return !cnt;
+	host_lookups = NULL;
+	return err;
 }
 
 static int xll_initted = 0;
@@ -1001,6 +1859,413 @@ static const char *xll_index_to_name(int index)
 	return ll_index_to_name(index);
 }
 
+/*
+ * With --group-by, inet sockets that pass the filter are counted by
+ * the keys asked for instead of being printed, and only the counts
+ * are shown, largest first.  Groups are kept in a hash table on a
+ * binary key holding just the fields grouped by, with addresses
+ * masked to the prefix length given.
+ */
+enum {
+	GROUP_NETID,
+	GROUP_STATE,
+	GROUP_SRC,
+	GROUP_DST,
+	GROUP_SPORT,
+	GROUP_DPORT,
+	GROUP_UID,
+	GROUP_DEV,
+	GROUP_PROCESS,
+	GROUP_CGROUP,
+};
+
+static const char *group_names[] = {
+	[GROUP_NETID]	= "netid",
+	[GROUP_STATE]	= "state",
+	[GROUP_SRC]	= "src",
+	[GROUP_DST]	= "dst",
+	[GROUP_SPORT]	= "sport",
+	[GROUP_DPORT]	= "dport",
+	[GROUP_UID]	= "uid",
+	[GROUP_DEV]	= "dev",
+	[GROUP_PROCESS]	= "process",
+	[GROUP_CGROUP]	= "cgroup",
+};
+
+#define GROUP_MAX_KEYS	8
+
+static struct {
+	int	type;
+	int	plen;
+} group_keys[GROUP_MAX_KEYS];
+static int group_nkeys;
+static unsigned int top_count;
+
+struct group_key {
+	const char	*netid;
+	const char	*process;
+	int		state;
+	int		sport, dport;
+	unsigned	uid;
+	unsigned	iface;
+	__u64		cgroup;
+	inet_prefix	src, dst;
+};
+
+struct group_ent {
+	struct group_ent	*next;
+	unsigned long long	count;
+	unsigned long long	rq, wq;
+	/* with -i, the sums and minimum of their tcp_info */
+	unsigned long long	pacing, delivery, acked, received;
+	__u32			min_rtt;
+	unsigned int		hash;
+	struct group_key	key;
+};
+
+static struct group_ent **group_hash;
+static unsigned int group_hash_size;
+static unsigned int group_count;
+static unsigned long long group_total;
+static unsigned long long group_dropped;
+static struct group_ent *group_last;	/* the group of the last socket */
+
+static int group_parse(const char *arg)
+{
+	char *list = strdup(arg), *tok, *save = NULL;
+	unsigned int i;
+
+	if (list == NULL)
+		return -1;
+	for (tok = strtok_r(list, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char *slash = strchr(tok, '/');
+
+		if (group_nkeys == GROUP_MAX_KEYS) {
+			fprintf(stderr, "ss: too many group-by keys\n");
+			goto err;
+		}
+		if (slash)
+			*slash++ = '\0';
+		for (i = 0; i < ARRAY_SIZE(group_names); i++)
+			if (strcmp(tok, group_names[i]) == 0)
+				break;
+		if (i == ARRAY_SIZE(group_names)) {
+			fprintf(stderr, "ss: unknown group-by key \"%s\"\n", tok);
+			goto err;
+		}
+		group_keys[group_nkeys].type = i;
+		group_keys[group_nkeys].plen = -1;
+		if (slash) {
+			if ((i != GROUP_SRC && i != GROUP_DST) ||
+			    get_integer(&group_keys[group_nkeys].plen, slash, 0) ||
+			    group_keys[group_nkeys].plen < 0 ||
+			    group_keys[group_nkeys].plen > 128) {
+				fprintf(stderr, "ss: invalid prefix length in \"%s/%s\"\n",
+					tok, slash);
+				goto err;
+			}
+		}
+		if (i == GROUP_PROCESS)
+			show_users = 1;
+		if (i == GROUP_CGROUP)
+			need_cgroups = 1;
+		group_nkeys++;
+	}
+	free(list);
+	return 0;
+err:
+	free(list);
+	return -1;
+}
+
+static void group_mask(inet_prefix *dst, const inet_prefix *a, int plen)
+{
+	int bits = a->bytelen * 8;
+	__u8 *p = (__u8 *)dst->data;
+	int i;
+
+	dst->family = a->family;
+	dst->bytelen = a->bytelen;
+	dst->bitlen = plen < 0 || plen > bits ? bits : plen;
+	memcpy(dst->data, a->data, a->bytelen);
+	for (i = dst->bitlen; i < bits; i++)
+		p[i / 8] &= ~(0x80 >> (i % 8));
+}
+
+/* Owner names are kept once each, so that keys can hold pointers
+ * which outlive the owner table of a namespace.
+ */
+struct group_name {
+	struct group_name	*next;
+	char			name[0];
+};
+
+static struct group_name *group_name_hash[256];
+
+static const char *group_process(unsigned int ino)
+{
+	struct group_name *n;
+	struct user_ent *p;
+	unsigned int h = 0;
+	const char *c;
+
+	if (!ino || !user_ent_hash)
+		return NULL;
+	for (p = user_ent_hash[user_ent_hashfn(ino)]; p; p = p->next)
+		if (p->ino == ino)
+			break;
+	if (p == NULL)
+		return NULL;
+
+	for (c = p->proc->process; *c; c++)
+		h = h * 31 + (unsigned char)*c;
+	h &= ARRAY_SIZE(group_name_hash) - 1;
+	for (n = group_name_hash[h]; n; n = n->next)
+		if (strcmp(n->name, p->proc->process) == 0)
+			return n->name;
+	n = malloc(sizeof(*n) + strlen(p->proc->process) + 1);
+	if (n == NULL)
+		abort();
+	strcpy(n->name, p->proc->process);
+	n->next = group_name_hash[h];
+	group_name_hash[h] = n;
+	return n->name;
+}
+
+static unsigned int group_hashfn(const struct group_key *k)
+{
+	const unsigned char *p = (const unsigned char *)k;
+	unsigned int h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < sizeof(*k); i++)
+		h = (h ^ p[i]) * 16777619;
+	return h;
+}
+
+static void group_grow(void)
+{
+	unsigned int size = group_hash_size ? group_hash_size * 2 : 1024;
+	struct group_ent **hash = calloc(size, sizeof(*hash));
+	unsigned int i;
+
+	if (hash == NULL)
+		abort();
+	for (i = 0; i < group_hash_size; i++) {
+		struct group_ent *g, *next;
+
+		for (g = group_hash[i]; g; g = next) {
+			next = g->next;
+			g->next = hash[g->hash & (size - 1)];
+			hash[g->hash & (size - 1)] = g;
+		}
+	}
+	free(group_hash);
+	group_hash = hash;
+	group_hash_size = size;
+}
+
+/* Count a socket that passed the filter */
+static void group_add(const char *netid, const struct tcpstat *s)
+{
+	struct group_key k;
+	struct group_ent *g;
+	unsigned int h;
+	int i;
+
+	group_last = NULL;
+	/* The --processes pass only notes which owners are wanted */
+	if (user_ent_collect) {
+		find_users(s->ino, NULL, 0);
+		return;
+	}
+
+	memset(&k, 0, sizeof(k));
+	for (i = 0; i < group_nkeys; i++) {
+		switch (group_keys[i].type) {
+		case GROUP_NETID:
+			k.netid = netid;
+			break;
+		case GROUP_STATE:
+			k.state = s->state;
+			break;
+		case GROUP_SRC:
+			group_mask(&k.src, &s->local, group_keys[i].plen);
+			break;
+		case GROUP_DST:
+			group_mask(&k.dst, &s->remote, group_keys[i].plen);
+			break;
+		case GROUP_SPORT:
+			k.sport = s->lport;
+			break;
+		case GROUP_DPORT:
+			k.dport = s->rport;
+			break;
+		case GROUP_UID:
+			k.uid = s->uid;
+			break;
+		case GROUP_DEV:
+			k.iface = s->iface;
+			break;
+		case GROUP_PROCESS:
+			k.process = group_process(s->ino);
+			break;
+		case GROUP_CGROUP:
+			k.cgroup = sock_cgroup_id(s);
+			break;
+		}
+	}
+
+	if (group_count >= group_hash_size)
+		group_grow();
+	h = group_hashfn(&k);
+	for (g = group_hash[h & (group_hash_size - 1)]; g; g = g->next)
+		if (g->hash == h && memcmp(&g->key, &k, sizeof(k)) == 0)
+			break;
+	if (g == NULL) {
+		if (mem_charge(sizeof(*g) + sizeof(*group_hash),
+			       "not counting sockets of new groups")) {
+			group_dropped++;
+			return;
+		}
+		g = malloc(sizeof(*g));
+		if (g == NULL)
+			abort();
+		memset(g, 0, sizeof(*g));
+		g->hash = h;
+		g->key = k;
+		g->next = group_hash[h & (group_hash_size - 1)];
+		group_hash[h & (group_hash_size - 1)] = g;
+		group_count++;
+	}
+	g->count++;
+	g->rq += s->rq;
+	g->wq += s->wq;
+	group_total++;
+	group_last = g;
+}
+
+static const char *group_format(const struct group_ent *g, int i,
+				char *buf, size_t len)
+{
+	const struct group_key *k = &g->key;
+	const inet_prefix *a;
+
+	switch (group_keys[i].type) {
+	case GROUP_NETID:
+		return k->netid;
+	case GROUP_STATE:
+		return sstate_name[k->state];
+	case GROUP_SRC:
+	case GROUP_DST:
+		a = group_keys[i].type == GROUP_SRC ? &k->src : &k->dst;
+		if (!inet_ntop(a->family, a->data, buf, len))
+			return "?";
+		if (group_keys[i].plen >= 0 && a->bitlen < a->bytelen * 8)
+			snprintf(buf + strlen(buf), len - strlen(buf),
+				 "/%d", a->bitlen);
+		return buf;
+	case GROUP_SPORT:
+		snprintf(buf, len, "%d", k->sport);
+		return buf;
+	case GROUP_DPORT:
+		snprintf(buf, len, "%d", k->dport);
+		return buf;
+	case GROUP_UID:
+		snprintf(buf, len, "%u", k->uid);
+		return buf;
+	case GROUP_DEV:
+		return k->iface ? xll_index_to_name(k->iface) : "*";
+	case GROUP_PROCESS:
+		return k->process ? : "-";
+	case GROUP_CGROUP:
+		if (k->cgroup == 0)
+			return "-";
+		if (cg_by_id(k->cgroup))
+			return cg_by_id(k->cgroup);
+		snprintf(buf, len, "%llu", (unsigned long long)k->cgroup);
+		return buf;
+	}
+	return "?";
+}
+
+static int group_cmp(const void *a, const void *b)
+{
+	const struct group_ent *g = *(const struct group_ent **)a;
+	const struct group_ent *h = *(const struct group_ent **)b;
+
+	if (g->count != h->count)
+		return g->count > h->count ? -1 : 1;
+	return memcmp(&g->key, &h->key, sizeof(g->key));
+}
+
+static char *sprint_bw(char *buf, double bw);
+
+/* Print the groups, largest first, or the top_count largest */
+static void group_print(void)
+{
+	struct group_ent **v;
+	unsigned int i, j, n = 0;
+	int width[GROUP_MAX_KEYS];
+	char buf[INET6_ADDRSTRLEN + 8];
+	int k;
+
+	v = malloc((group_count + 1) * sizeof(*v));
+	if (v == NULL)
+		abort();
+	for (i = 0; i < group_hash_size; i++) {
+		struct group_ent *g;
+
+		for (g = group_hash[i]; g; g = g->next)
+			v[n++] = g;
+	}
+	qsort(v, n, sizeof(*v), group_cmp);
+	if (top_count && top_count < n)
+		n = top_count;
+
+	for (k = 0; k < group_nkeys; k++) {
+		width[k] = strlen(group_names[group_keys[k].type]);
+		for (j = 0; j < n; j++) {
+			int w = strlen(group_format(v[j], k, buf, sizeof(buf)));
+
+			if (w > width[k])
+				width[k] = w;
+		}
+		printf("%-*s ", width[k], group_names[group_keys[k].type]);
+	}
+	printf("%10s %10s %10s", "count", "recv-q", "send-q");
+	if (show_tcpinfo)
+		printf(" %10s %10s %14s %14s %8s", "pacing", "delivery",
+		       "bytes_acked", "bytes_rcvd", "minrtt");
+	printf("\n");
+
+	for (j = 0; j < n; j++) {
+		for (k = 0; k < group_nkeys; k++)
+			printf("%-*s ", width[k],
+			       group_format(v[j], k, buf, sizeof(buf)));
+		printf("%10llu %10llu %10llu",
+		       v[j]->count, v[j]->rq, v[j]->wq);
+		if (show_tcpinfo) {
+			char b1[32], b2[32];
+
+			printf(" %10s %10s %14llu %14llu %8g",
+			       sprint_bw(b1, v[j]->pacing * 8.),
+			       sprint_bw(b2, v[j]->delivery * 8.),
+			       v[j]->acked, v[j]->received,
+			       v[j]->min_rtt / 1000.);
+		}
+		printf("\n");
+	}
+	if (n < group_count)
+		printf("(%u more groups)\n", group_count - n);
+	printf("total %llu sockets in %u groups\n", group_total, group_count);
+	if (group_dropped)
+		printf("(%llu sockets not counted for --max-mem)\n",
+		       group_dropped);
+	free(v);
+}
+
 static int xll_name_to_index(const char *dev)
 {
 	if (!xll_initted)
@@ -1010,7 +2275,7 @@ static int xll_name_to_index(const char *dev)
 
 void *parse_hostcond(char *addr)
 {
-	char *port = NULL;
+	char *port = NULL, *lookup = NULL;
 	struct aafilter a;
 	struct aafilter *res;
 	int fam = preferred_family;
@@ -1152,10 +2417,8 @@ void *parse_hostcond(char *addr)
 	}
 	if (addr && *addr && *addr != '*') {
 		if (get_prefix_1(&a.addr, addr, fam)) {
-			if (get_dns_host(&a, addr, fam)) {
-				fprintf(stderr, "Error: an inet prefix is expected rather than \"%s\".\n", addr);
-				return NULL;
-			}
+			a.addr.bitlen = 0;
+			lookup = addr;
 		}
 	}
 
@@ -1163,87 +2426,291 @@ void *parse_hostcond(char *addr)
 	res = malloc(sizeof(*res));
 	if (res)
 		memcpy(res, &a, sizeof(a));
+	if (res && lookup && host_lookup_add(res, lookup, fam)) {
+		free(res);
+		return NULL;
+	}
 	return res;
 }
 
-static int tcp_show_line(char *line, const struct filter *f, int family)
+void *parse_devcond(char *dev)
 {
-	struct tcpstat s;
-	char *loc, *rem, *data;
-	char opt[256];
-	int n;
-	char *p;
-
-	if ((p = strchr(line, ':')) == NULL)
-		return -1;
-	loc = p+2;
-
-	if ((p = strchr(loc, ':')) == NULL)
-		return -1;
-	p[5] = 0;
-	rem = p+6;
+	struct aafilter a;
+	struct aafilter *res;
 
-	if ((p = strchr(rem, ':')) == NULL)
-		return -1;
-	p[5] = 0;
-	data = p+6;
+	memset(&a, 0, sizeof(a));
+	a.iface = xll_name_to_index(dev);
+	if (a.iface == 0 && get_unsigned(&a.iface, dev, 0))
+		return NULL;
 
-	do {
-		int state = (data[1] >= 'A') ? (data[1] - 'A' + 10) : (data[1] - '0');
+	res = malloc(sizeof(*res));
+	if (res)
+		memcpy(res, &a, sizeof(a));
+	return res;
+}
 
-		if (!(f->states & (1<<state)))
-			return 0;
-	} while (0);
+void *parse_markmask(char *markmask)
+{
+	struct aafilter a;
+	struct aafilter *res;
+	char *slash;
 
-	s.local.family = s.remote.family = family;
-	if (family == AF_INET) {
-		sscanf(loc, "%x:%x", s.local.data, (unsigned*)&s.lport);
-		sscanf(rem, "%x:%x", s.remote.data, (unsigned*)&s.rport);
-		s.local.bytelen = s.remote.bytelen = 4;
-	} else {
-		sscanf(loc, "%08x%08x%08x%08x:%x",
-		       s.local.data,
-		       s.local.data+1,
-		       s.local.data+2,
-		       s.local.data+3,
-		       &s.lport);
-		sscanf(rem, "%08x%08x%08x%08x:%x",
-		       s.remote.data,
-		       s.remote.data+1,
-		       s.remote.data+2,
-		       s.remote.data+3,
-		       &s.rport);
-		s.local.bytelen = s.remote.bytelen = 16;
+	memset(&a, 0, sizeof(a));
+	a.mask = 0xffffffff;
+	if ((slash = strchr(markmask, '/')) != NULL) {
+		*slash = 0;
+		if (get_u32(&a.mask, slash+1, 0))
+			return NULL;
 	}
+	if (get_u32(&a.mark, markmask, 0))
+		return NULL;
+	a.mark &= a.mask;
 
-	if (f->f && run_ssfilter(f->f, &s) == 0)
-		return 0;
+	res = malloc(sizeof(*res));
+	if (res)
+		memcpy(res, &a, sizeof(a));
+	return res;
+}
 
-	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %x:%x %x %d %d %u %d %llx %d %d %d %d %d %[^\n]\n",
-		   &s.state, &s.wq, &s.rq,
-		   &s.timer, &s.timeout, &s.retrs, &s.uid, &s.probes, &s.ino,
-		   &s.refcnt, &s.sk, &s.rto, &s.ato, &s.qack,
-		   &s.cwnd, &s.ssthresh, opt);
+void *parse_cgroupcond(char *path)
+{
+	struct aafilter a;
+	struct aafilter *res;
 
-	if (n < 17)
-		opt[0] = 0;
+	char buf[PATH_MAX];
 
-	if (n < 12) {
-		s.rto = 0;
-		s.cwnd = 2;
-		s.ssthresh = -1;
-		s.ato = s.qack = 0;
+	if (path[0] != '/') {
+		snprintf(buf, sizeof(buf), "/%s", path);
+		path = buf;
 	}
+	memset(&a, 0, sizeof(a));
+	a.cgroup_id = cg_by_path(path)->id;
+	if (a.cgroup_id == 0)
+		return NULL;
 
-	if (netid_width)
-		printf("%-*s ", netid_width, "tcp");
-	if (state_width)
-		printf("%-*s ", state_width, sstate_name[s.state]);
-
-	printf("%-6d %-6d ", s.rq, s.wq);
+	res = malloc(sizeof(*res));
+	if (res)
+		memcpy(res, &a, sizeof(a));
+	return res;
+}
 
-	formatted_print(&s.local, s.lport);
+/*
+ * The /proc/net/{tcp,udp,raw} readers for kernels without a diag
+ * module.  With a million sockets the time went to sscanf(), which
+ * measures the string and runs the whole conversion machinery for
+ * every line, so the lines are parsed here by hand: the fields are
+ * all hex or decimal numbers in a fixed order.
+ */
+static inline int proc_hexdigit(unsigned char c)
+{
+	if ((unsigned char)(c - '0') < 10)
+		return c - '0';
+	c |= 0x20;
+	if ((unsigned char)(c - 'a') < 6)
+		return c - 'a' + 10;
+	return -1;
+}
+
+static const char *proc_skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+static const char *proc_hex(const char *p, unsigned long long *v)
+{
+	int d;
+
+	if (p[0] == '0' && (p[1] | 0x20) == 'x' && proc_hexdigit(p[2]) >= 0)
+		p += 2;
+	if ((d = proc_hexdigit(*p)) < 0)
+		return NULL;
+	*v = 0;
+	do {
+		*v = (*v << 4) | d;
+	} while ((d = proc_hexdigit(*++p)) >= 0);
+	return p;
+}
+
+static const char *proc_dec(const char *p, unsigned long long *v)
+{
+	int neg = 0;
+
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+	if ((unsigned char)(*p - '0') >= 10)
+		return NULL;
+	*v = 0;
+	do {
+		*v = *v * 10 + (*p - '0');
+	} while ((unsigned char)(*++p - '0') < 10);
+	if (neg)
+		*v = -*v;
+	return p;
+}
+
+/* Like sscanf() for a format of 'x' (hex int), 'X' (hex long long),
+ * 'd' (decimal int, or unsigned), '*' (a field skipped), ':' and
+ * ' ', each field first skipping blanks.  Returns the number of
+ * values stored; the rest of the line is left in *rest.
+ */
+static int proc_scan(const char *p, const char *fmt, void **out,
+		     const char **rest)
+{
+	unsigned long long v;
+	int n = 0;
+
+	for (; *fmt; fmt++) {
+		const char *q;
+
+		switch (*fmt) {
+		case ' ':
+			continue;
+		case ':':
+			if (*p != ':')
+				goto out;
+			p++;
+			continue;
+		case 'd':
+			q = proc_dec(proc_skip_space(p), &v);
+			break;
+		case '*':
+			p = q = proc_skip_space(p);
+			while (*q && *q != ' ' && *q != ':')
+				q++;
+			if (q == p)
+				goto out;
+			p = q;
+			continue;
+		default:
+			q = proc_hex(proc_skip_space(p), &v);
+			break;
+		}
+		if (q == NULL)
+			break;
+		p = q;
+		if (*fmt == 'X')
+			*(unsigned long long *)out[n] = v;
+		else
+			*(unsigned int *)out[n] = v;
+		n++;
+	}
+out:
+	*rest = p;
+	return n;
+}
+
+/* An address as the kernel prints it, words of 8 hex digits in host
+ * order, then ":PORT".
+ */
+static int proc_addr(const char *p, inet_prefix *a, int *port)
+{
+	int i, k, d, words = a->family == AF_INET ? 1 : 4;
+	unsigned long long v;
+
+	for (i = 0; i < words; i++) {
+		__u32 w = 0;
+
+		for (k = 0; k < 8 && (d = proc_hexdigit(*p)) >= 0; k++, p++)
+			w = (w << 4) | d;
+		if (k == 0)
+			return -1;
+		a->data[i] = w;
+	}
+	if (*p++ != ':' || proc_hex(p, &v) == NULL)
+		return -1;
+	*port = v;
+	a->bytelen = words * 4;
+	return 0;
+}
+
+/* What follows the last number, as %[^\n] would store it in opt */
+static int proc_opt(const char *rest, char *opt, size_t len)
+{
+	rest = proc_skip_space(rest);
+	if (!*rest)
+		return 0;
+	snprintf(opt, len, "%s", rest);
+	return 1;
+}
+
+static int tcp_show_line(char *line, const struct filter *f, int family)
+{
+	struct tcpstat s;
+	char *loc, *rem, *data;
+	char opt[256];
+	int n;
+	char *p;
+
+	if ((p = strchr(line, ':')) == NULL)
+		return -1;
+	loc = p+2;
+
+	if ((p = strchr(loc, ':')) == NULL)
+		return -1;
+	p[5] = 0;
+	rem = p+6;
+
+	if ((p = strchr(rem, ':')) == NULL)
+		return -1;
+	p[5] = 0;
+	data = p+6;
+
+	do {
+		int state = (data[1] >= 'A') ? (data[1] - 'A' + 10) : (data[1] - '0');
+
+		if (!(f->states & (1<<state)))
+			return 0;
+	} while (0);
+
+	s.local.family = s.remote.family = family;
+	s.iface = s.mark = 0;
+	s.ino = 0;
+	s.cgroup_id = 0;
+	if (proc_addr(loc, &s.local, &s.lport) ||
+	    proc_addr(rem, &s.remote, &s.rport))
+		return 0;
+
+	if (f->f && run_ssfilter(f->f, &s) == 0)
+		return 0;
+
+	opt[0] = 0;
+	{
+		void *out[] = {
+			&s.state, &s.wq, &s.rq,
+			&s.timer, &s.timeout, &s.retrs, &s.uid, &s.probes,
+			&s.ino, &s.refcnt, &s.sk, &s.rto, &s.ato, &s.qack,
+			&s.cwnd, &s.ssthresh,
+		};
+		const char *rest;
+
+		n = proc_scan(data, "x x:x x:x x d d d d X d d d d d",
+			      out, &rest);
+		if (n == 16)
+			n += proc_opt(rest, opt, sizeof(opt));
+	}
+
+	if (n < 17)
+		opt[0] = 0;
+
+	if (n < 12) {
+		s.rto = 0;
+		s.cwnd = 2;
+		s.ssthresh = -1;
+		s.ato = s.qack = 0;
+	}
+
+	if (group_nkeys) {
+		group_add("tcp", &s);
+		return 0;
+	}
+
+	print_netid_state("tcp", sstate_name[s.state]);
+
+	print_queues(s.rq, s.wq);
+
+	formatted_print(&s.local, s.lport);
 	formatted_print(&s.remote, s.rport);
 
 	if (show_options) {
@@ -1289,30 +2756,56 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	return 0;
 }
 
+/* Feed the lines of fp but the header to worker.  The file is read in
+ * large blocks straight from the descriptor rather than by fgets().
+ */
 static int generic_record_read(FILE *fp,
 			       int (*worker)(char*, const struct filter *, int),
 			       const struct filter *f, int fam)
 {
-	char line[256];
+	static char *buf;
+	const size_t size = 256 * 1024;
+	int fd = fileno(fp), header = 1;
+	size_t len = 0;
+
+	if (!buf && (buf = malloc(size)) == NULL)
+		return -1;
 
-	/* skip header */
-	if (fgets(line, sizeof(line), fp) == NULL)
-		goto outerr;
+	while (1) {
+		ssize_t n = read(fd, buf + len, size - len);
+		char *line, *nl, *end;
 
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		int n = strlen(line);
-		if (n == 0 || line[n-1] != '\n') {
-			errno = -EINVAL;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
 			return -1;
 		}
-		line[n-1] = 0;
-
-		if (worker(line, f, fam) < 0)
-			return 0;
+		if (n == 0)
+			break;
+		end = buf + len + n;
+		for (line = buf; (nl = memchr(line, '\n', end - line)) != NULL;
+		     line = nl + 1) {
+			*nl = 0;
+			if (header) {
+				header = 0;
+				continue;
+			}
+			if (worker(line, f, fam) < 0)
+				return 0;
+		}
+		len = end - line;
+		if (len == size) {
+			errno = EINVAL;
+			return -1;
+		}
+		memmove(buf, line, len);
 	}
-outerr:
-
-	return ferror(fp) ? -1 : 0;
+	if (len) {
+		/* the last line has no newline */
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
 }
 
 static char *sprint_bw(char *buf, double bw)
@@ -1327,10 +2820,79 @@ static char *sprint_bw(char *buf, double bw)
 	return buf;
 }
 
+/* tcp_info fields newer than the C library's struct tcp_info, in the
+ * order the kernel appends them (4.1 to 4.10).
+ */
+struct tcp_info_tail
+{
+	__u64	tcpi_pacing_rate;	/* bytes per second */
+	__u64	tcpi_max_pacing_rate;
+	__u64	tcpi_bytes_acked;
+	__u64	tcpi_bytes_received;
+	__u32	tcpi_segs_out;
+	__u32	tcpi_segs_in;
+	__u32	tcpi_notsent_bytes;
+	__u32	tcpi_min_rtt;		/* usec */
+	__u32	tcpi_data_segs_in;
+	__u32	tcpi_data_segs_out;
+	__u64	tcpi_delivery_rate;	/* bytes per second */
+	__u64	tcpi_busy_time;		/* usec */
+	__u64	tcpi_rwnd_limited;
+	__u64	tcpi_sndbuf_limited;
+};
+
+/* Copy the tcp_info of a diag message, zero filling what an older
+ * kernel did not send.  Returns 0 when there is none.
+ */
+static int tcp_info_get(struct rtattr *attr, struct tcp_info *info,
+			struct tcp_info_tail *tail)
+{
+	const char *data;
+	int len;
+
+	memset(info, 0, sizeof(*info));
+	memset(tail, 0, sizeof(*tail));
+	if (attr == NULL)
+		return 0;
+	data = RTA_DATA(attr);
+	len = RTA_PAYLOAD(attr);
+	memcpy(info, data, len < sizeof(*info) ? len : sizeof(*info));
+	if (len > sizeof(*info)) {
+		len -= sizeof(*info);
+		memcpy(tail, data + sizeof(*info),
+		       len < sizeof(*tail) ? len : sizeof(*tail));
+	}
+	return 1;
+}
+
+/* Add the tcp_info of a socket to the group group_add() put it in */
+static void group_add_info(struct nlmsghdr *nlh, struct inet_diag_msg *r)
+{
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info;
+	struct tcp_info_tail tail;
+	struct group_ent *g = group_last;
+
+	if (!show_tcpinfo || g == NULL)
+		return;
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (!tcp_info_get(tb[INET_DIAG_INFO], &info, &tail))
+		return;
+	g->pacing += tail.tcpi_pacing_rate != ~0ULL ? tail.tcpi_pacing_rate : 0;
+	g->delivery += tail.tcpi_delivery_rate;
+	g->acked += tail.tcpi_bytes_acked;
+	g->received += tail.tcpi_bytes_received;
+	if (tail.tcpi_min_rtt && (!g->min_rtt || tail.tcpi_min_rtt < g->min_rtt))
+		g->min_rtt = tail.tcpi_min_rtt;
+}
+
 static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r)
 {
 	struct rtattr * tb[INET_DIAG_MAX+1];
-	char b1[64];
+	struct tcp_info ti;
+	struct tcp_info_tail tail;
+	char b1[64], b2[64];
 	double rtt = 0;
 
 	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
@@ -1356,17 +2918,8 @@ static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r)
 		       minfo->idiag_tmem);
 	}
 
-	if (tb[INET_DIAG_INFO]) {
-		struct tcp_info *info;
-		int len = RTA_PAYLOAD(tb[INET_DIAG_INFO]);
-
-		/* workaround for older kernels with less fields */
-		if (len < sizeof(*info)) {
-			info = alloca(sizeof(*info));
-			memset(info, 0, sizeof(*info));
-			memcpy(info, RTA_DATA(tb[INET_DIAG_INFO]), len);
-		} else
-			info = RTA_DATA(tb[INET_DIAG_INFO]);
+	if (tcp_info_get(tb[INET_DIAG_INFO], &ti, &tail)) {
+		const struct tcp_info *info = &ti;
 
 		if (show_options) {
 			if (info->tcpi_options & TCPI_OPT_TIMESTAMPS)
@@ -1419,93 +2972,918 @@ static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r)
 		if (info->tcpi_rcv_space)
 			printf(" rcv_space:%d", info->tcpi_rcv_space);
 
+		if (tail.tcpi_pacing_rate) {
+			printf(" pacing_rate %sbps",
+			       sprint_bw(b1, tail.tcpi_pacing_rate * 8.));
+			if (tail.tcpi_max_pacing_rate != ~0ULL)
+				printf("/%sbps",
+				       sprint_bw(b2, tail.tcpi_max_pacing_rate * 8.));
+		}
+		if (tail.tcpi_delivery_rate)
+			printf(" delivery_rate %sbps",
+			       sprint_bw(b1, tail.tcpi_delivery_rate * 8.));
+		if (tail.tcpi_busy_time) {
+			printf(" busy:%llums",
+			       (unsigned long long)tail.tcpi_busy_time / 1000);
+			if (tail.tcpi_rwnd_limited)
+				printf(" rwnd_limited:%llums(%.1f%%)",
+				       (unsigned long long)tail.tcpi_rwnd_limited / 1000,
+				       100.0 * tail.tcpi_rwnd_limited /
+				       tail.tcpi_busy_time);
+			if (tail.tcpi_sndbuf_limited)
+				printf(" sndbuf_limited:%llums(%.1f%%)",
+				       (unsigned long long)tail.tcpi_sndbuf_limited / 1000,
+				       100.0 * tail.tcpi_sndbuf_limited /
+				       tail.tcpi_busy_time);
+		}
+		if (tail.tcpi_bytes_acked)
+			printf(" bytes_acked:%llu",
+			       (unsigned long long)tail.tcpi_bytes_acked);
+		if (tail.tcpi_bytes_received)
+			printf(" bytes_received:%llu",
+			       (unsigned long long)tail.tcpi_bytes_received);
+		if (tail.tcpi_min_rtt)
+			printf(" minrtt:%g", (double)tail.tcpi_min_rtt / 1000);
 	}
 }
 
-static int tcp_show_sock(struct nlmsghdr *nlh, struct filter *f)
+/* The kernel reports sk_mark only to CAP_NET_ADMIN, 0 otherwise. */
+static unsigned inet_diag_mark(struct nlmsghdr *nlh)
 {
 	struct inet_diag_msg *r = NLMSG_DATA(nlh);
-	struct tcpstat s;
+	struct rtattr *tb[INET_DIAG_MAX+1];
 
-	s.state = r->idiag_state;
-	s.local.family = s.remote.family = r->idiag_family;
-	s.lport = ntohs(r->id.idiag_sport);
-	s.rport = ntohs(r->id.idiag_dport);
-	if (s.local.family == AF_INET) {
-		s.local.bytelen = s.remote.bytelen = 4;
-	} else {
-		s.local.bytelen = s.remote.bytelen = 16;
-	}
-	memcpy(s.local.data, r->id.idiag_src, s.local.bytelen);
-	memcpy(s.remote.data, r->id.idiag_dst, s.local.bytelen);
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[INET_DIAG_MARK])
+		return *(__u32 *)RTA_DATA(tb[INET_DIAG_MARK]);
+	return 0;
+}
 
-	if (f && f->f && run_ssfilter(f->f, &s) == 0)
-		return 0;
+static __u64 inet_diag_cgroup_id(struct nlmsghdr *nlh)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
 
-	if (netid_width)
-		printf("%-*s ", netid_width, "tcp");
-	if (state_width)
-		printf("%-*s ", state_width, sstate_name[s.state]);
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[INET_DIAG_CGROUP_ID])
+		return rta_getattr_u64(tb[INET_DIAG_CGROUP_ID]);
+	return 0;
+}
 
-	printf("%-6d %-6d ", r->idiag_rqueue, r->idiag_wqueue);
+/*
+ * -K closes every TCP and UDP socket that passes the filter with
+ * SOCK_DESTROY, as the dump goes.  The requests are queued in a buffer
+ * and sent many to a datagram over a netlink socket of their own.  Only
+ * the last of a batch asks for an ack; the kernel answers the others
+ * only when they fail, and has answered them all by the time the ack
+ * of the last arrives.  So closing a socket costs no round trip, nor a
+ * message back when it works.
+ */
+static int kill_sockets;
+static int kill_fd = -1;
+static char kill_buf[32768];
+static int kill_len;
+static struct nlmsghdr *kill_last;
+static unsigned int kill_seq;
+static unsigned int kill_sent, kill_failed;
+static int kill_errno;
+
+static void kill_status(int error)
+{
+	/* ENOENT, ESTALE: the socket is gone already */
+	if (error && error != -ENOENT && error != -ESTALE) {
+		kill_failed++;
+		kill_errno = -error;
+	}
+}
 
-	formatted_print(&s.local, s.lport);
-	formatted_print(&s.remote, s.rport);
+/* Answers dropped while the last ack still got through */
+static void kill_overrun(void)
+{
+	socklen_t len = sizeof(int);
+	int err;
 
-	if (show_options) {
-		if (r->idiag_timer) {
-			if (r->idiag_timer > 4)
-				r->idiag_timer = 5;
-			printf(" timer:(%s,%s,%d)",
-			       tmr_name[r->idiag_timer],
-			       print_ms_timer(r->idiag_expires),
-			       r->idiag_retrans);
-		}
-	}
-	if (show_users) {
-		char ubuf[4096];
-		if (find_users(r->idiag_inode, ubuf, sizeof(ubuf)) > 0)
-			printf(" users:(%s)", ubuf);
-	}
-	if (show_details) {
-		if (r->idiag_uid)
-			printf(" uid:%u", (unsigned)r->idiag_uid);
-		printf(" ino:%u", r->idiag_inode);
-		printf(" sk:");
-		if (r->id.idiag_cookie[1] != 0)
-			printf("%08x", r->id.idiag_cookie[1]);
- 		printf("%08x", r->id.idiag_cookie[0]);
-	}
-	if (show_mem || show_tcpinfo) {
-		printf("\n\t");
-		tcp_show_info(nlh, r);
+	if (getsockopt(kill_fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err) {
+		kill_failed++;
+		kill_errno = err;
 	}
+}
 
-	printf("\n");
+static void kill_flush(void)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct nlmsghdr *h;
+	char buf[16384];
+	int len, flags = 0;
 
-	return 0;
+	if (!kill_len)
+		return;
+	kill_last->nlmsg_flags |= NLM_F_ACK;
+
+	rtnl_stats.sendmsg++;
+	len = sendto(kill_fd, kill_buf, kill_len, 0,
+		     (struct sockaddr *)&nladdr, sizeof(nladdr));
+	kill_len = 0;
+	if (len < 0) {
+		kill_failed++;
+		kill_errno = errno;
+		return;
+	}
+
+	while (1) {
+		len = recv(kill_fd, buf, sizeof(buf), flags);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (flags)
+				return;
+			/* Answers were dropped, so how many failed is
+			 * unknown; what is left is already queued.
+			 */
+			kill_failed++;
+			kill_errno = errno;
+			flags = MSG_DONTWAIT;
+			continue;
+		}
+		rtnl_stats.recvmsg++;
+		rtnl_stats.rx_bytes += len;
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+		     h = NLMSG_NEXT(h, len)) {
+			struct nlmsgerr *err = NLMSG_DATA(h);
+
+			if (h->nlmsg_type != NLMSG_ERROR ||
+			    h->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+				continue;
+			kill_status(err->error);
+			if (h->nlmsg_seq == kill_seq && !flags) {
+				kill_overrun();
+				return;
+			}
+		}
+	}
 }
 
-static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
+static void kill_sock(struct nlmsghdr *nlh, int protocol)
 {
-	int fd;
-	struct sockaddr_nl nladdr;
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
 	struct {
 		struct nlmsghdr nlh;
-		struct inet_diag_req r;
-	} req;
-	char    *bc = NULL;
-	int	bclen;
-	struct msghdr msg;
-	struct rtattr rta;
-	char	buf[8192];
-	struct iovec iov[3];
+		struct inet_diag_req_v2 r;
+	} *req;
 
-	if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG)) < 0)
-		return -1;
+	/* Not while -p or -r run the listing to collect names */
+	if (user_ent_collect || resolve_prefetch)
+		return;
+	if (kill_fd < 0) {
+		kill_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
+		if (kill_fd < 0) {
+			perror("ss: Cannot open sock_diag socket");
+			exit(1);
+		}
+		/* room for the answers of a batch that fails entirely */
+		rtnl_set_rcvbuf(kill_fd, 4 * 1024 * 1024);
+	}
+	if (kill_len + NLMSG_ALIGN(sizeof(*req)) > sizeof(kill_buf))
+		kill_flush();
+
+	req = (void *)(kill_buf + kill_len);
+	memset(req, 0, sizeof(*req));
+	req->nlh.nlmsg_len = sizeof(*req);
+	req->nlh.nlmsg_type = SOCK_DESTROY;
+	req->nlh.nlmsg_flags = NLM_F_REQUEST;
+	req->nlh.nlmsg_seq = ++kill_seq;
+	req->r.sdiag_family = r->idiag_family;
+	req->r.sdiag_protocol = protocol;
+	req->r.id = r->id;
+	kill_last = &req->nlh;
+	kill_len += NLMSG_ALIGN(sizeof(*req));
+	kill_sent++;
+}
 
-	memset(&nladdr, 0, sizeof(nladdr));
-	nladdr.nl_family = AF_NETLINK;
+/* Send what is queued and report the sockets that could not be closed */
+static void kill_done(void)
+{
+	if (!kill_sockets)
+		return;
+	kill_flush();
+	if (kill_failed)
+		fprintf(stderr, "ss: %u of %u sockets not closed: %s\n",
+			kill_failed, kill_sent,
+			kill_errno == EOPNOTSUPP ?
+			"no SOCK_DESTROY in the kernel (CONFIG_INET_DIAG_DESTROY)" :
+			strerror(kill_errno));
+}
+
+/*
+ * For ss -s: a TCP dump of the bare diag headers, counted by state
+ * and local port, instead of reading /proc/slabinfo.
+ */
+struct tcp_census
+{
+	int		states[SS_MAX];
+	int		ports;
+	unsigned char	port_map[65536 / 8];
+};
+
+static struct tcp_census *tcp_census;
+
+static void tcp_census_add(const struct tcpstat *s)
+{
+	struct tcp_census *c = tcp_census;
+
+	if (s->state < SS_MAX)
+		c->states[s->state]++;
+	if (s->state != SS_TIME_WAIT && s->state != SS_SYN_RECV &&
+	    !(c->port_map[s->lport / 8] & (1 << (s->lport % 8)))) {
+		c->port_map[s->lport / 8] |= 1 << (s->lport % 8);
+		c->ports++;
+	}
+}
+
+/*
+ * With --sort, TCP sockets that pass the filter are not printed as
+ * they come but kept, a copy of each diag message with the value
+ * sorted by, and printed largest first once the dumps are done.  With
+ * --top N only the N largest are kept, in a min-heap, so the memory
+ * used does not grow with the table.
+ */
+enum {
+	SORT_NONE,
+	SORT_RTT,
+	SORT_RETRANS,
+	SORT_SENDQ,
+	SORT_RECVQ,
+	SORT_BW,
+	SORT_PACING,
+	SORT_DELIVERY,
+	SORT_MINRTT,
+	SORT_BUSY,
+	SORT_RWND_LIMITED,
+	SORT_SNDBUF_LIMITED,
+	SORT_ACKED,
+	SORT_RECEIVED,
+};
+
+static const char *sort_names[] = {
+	[SORT_RTT]	= "rtt",
+	[SORT_RETRANS]	= "retrans",
+	[SORT_SENDQ]	= "send-q",
+	[SORT_RECVQ]	= "recv-q",
+	[SORT_BW]	= "bw",
+	[SORT_PACING]	= "pacing",
+	[SORT_DELIVERY]	= "delivery",
+	[SORT_MINRTT]	= "minrtt",
+	[SORT_BUSY]	= "busy",
+	[SORT_RWND_LIMITED]	= "rwnd-limited",
+	[SORT_SNDBUF_LIMITED]	= "sndbuf-limited",
+	[SORT_ACKED]	= "acked",
+	[SORT_RECEIVED]	= "received",
+};
+
+static int sort_key;
+
+struct sort_ent {
+	double		val;
+	struct nlmsghdr	*nlh;
+};
+
+static struct sort_ent *sort_ents;
+static unsigned int sort_count;
+static unsigned int sort_size;
+
+static int sort_parse(const char *arg)
+{
+	int i;
+
+	for (i = SORT_RTT; i < ARRAY_SIZE(sort_names); i++) {
+		if (strcmp(arg, sort_names[i]) == 0) {
+			sort_key = i;
+			return 0;
+		}
+	}
+	fprintf(stderr, "ss: unknown sort key \"%s\"\n", arg);
+	return -1;
+}
+
+static double sort_value(struct nlmsghdr *nlh, struct inet_diag_msg *r)
+{
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info;
+	struct tcp_info_tail tail;
+	double rtt;
+
+	if (sort_key == SORT_SENDQ)
+		return r->idiag_wqueue;
+	if (sort_key == SORT_RECVQ)
+		return r->idiag_rqueue;
+
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (!tcp_info_get(tb[INET_DIAG_INFO], &info, &tail))
+		return 0;
+
+	switch (sort_key) {
+	case SORT_RTT:
+		return info.tcpi_rtt;
+	case SORT_RETRANS:
+		return info.tcpi_total_retrans;
+	case SORT_PACING:
+		return tail.tcpi_pacing_rate;
+	case SORT_DELIVERY:
+		return tail.tcpi_delivery_rate;
+	case SORT_MINRTT:
+		return tail.tcpi_min_rtt;
+	case SORT_BUSY:
+		return tail.tcpi_busy_time;
+	case SORT_RWND_LIMITED:
+		return tail.tcpi_rwnd_limited;
+	case SORT_SNDBUF_LIMITED:
+		return tail.tcpi_sndbuf_limited;
+	case SORT_ACKED:
+		return tail.tcpi_bytes_acked;
+	case SORT_RECEIVED:
+		return tail.tcpi_bytes_received;
+	}
+
+	rtt = info.tcpi_rtt;
+	if (tb[INET_DIAG_VEGASINFO]) {
+		const struct tcpvegas_info *vinfo
+			= RTA_DATA(tb[INET_DIAG_VEGASINFO]);
+
+		if (vinfo->tcpv_enabled &&
+		    vinfo->tcpv_rtt && vinfo->tcpv_rtt != 0x7fffffff)
+			rtt = vinfo->tcpv_rtt;
+	}
+	if (rtt > 0 && info.tcpi_snd_mss && info.tcpi_snd_cwnd)
+		return (double)info.tcpi_snd_cwnd *
+		       (double)info.tcpi_snd_mss * 8000000. / rtt;
+	return 0;
+}
+
+static struct nlmsghdr *sort_copy(struct nlmsghdr *old, struct nlmsghdr *nlh)
+{
+	struct nlmsghdr *p = realloc(old, nlh->nlmsg_len);
+
+	if (!p) {
+		perror("ss: sort");
+		exit(-1);
+	}
+	return memcpy(p, nlh, nlh->nlmsg_len);
+}
+
+static void sort_swap(unsigned int a, unsigned int b)
+{
+	struct sort_ent t = sort_ents[a];
+
+	sort_ents[a] = sort_ents[b];
+	sort_ents[b] = t;
+}
+
+/* Move entry i of the min-heap down to its place */
+static void sort_sift(unsigned int i)
+{
+	unsigned int c;
+
+	for (; (c = 2 * i + 1) < sort_count; i = c) {
+		if (c + 1 < sort_count &&
+		    sort_ents[c + 1].val < sort_ents[c].val)
+			c++;
+		if (sort_ents[i].val <= sort_ents[c].val)
+			break;
+		sort_swap(i, c);
+	}
+}
+
+static void sort_add(struct nlmsghdr *nlh, struct inet_diag_msg *r)
+{
+	double val = sort_value(nlh, r);
+	unsigned int i;
+
+	if (!top_count && sort_count &&
+	    mem_charge(sizeof(*sort_ents) + nlh->nlmsg_len,
+		       "keeping only the largest sockets that fit")) {
+		/* what is kept becomes the --top */
+		top_count = sort_count;
+		for (i = sort_count / 2; i-- > 0; )
+			sort_sift(i);
+	}
+
+	if (top_count && sort_count == top_count) {
+		if (val <= sort_ents[0].val)
+			return;
+		/* replace the smallest and sift it down */
+		sort_ents[0].val = val;
+		sort_ents[0].nlh = sort_copy(sort_ents[0].nlh, nlh);
+		sort_sift(0);
+		return;
+	}
+
+	if (sort_count == sort_size) {
+		sort_size = sort_size ? sort_size * 2 : 256;
+		if (top_count && sort_size > top_count)
+			sort_size = top_count;
+		sort_ents = realloc(sort_ents, sort_size * sizeof(*sort_ents));
+		if (!sort_ents) {
+			perror("ss: sort");
+			exit(-1);
+		}
+	}
+	i = sort_count++;
+	sort_ents[i].val = val;
+	sort_ents[i].nlh = sort_copy(NULL, nlh);
+	if (!top_count)
+		return;
+	for (; i > 0 && sort_ents[(i - 1) / 2].val > sort_ents[i].val;
+	     i = (i - 1) / 2)
+		sort_swap(i, (i - 1) / 2);
+}
+
+/*
+ * With --watch, the TCP table is dumped every interval over one
+ * sock_diag socket and compared with the previous dump, keyed by the
+ * socket cookie: new (+), closed (-) and state-changed (~) sockets are
+ * printed, and sockets whose byte or retransmit counters moved (=),
+ * with the deltas.  Entries come from a pool and are recycled through
+ * a free list, so a steady table allocates nothing per round.
+ */
+static double watch_interval;
+
+struct watch_ent
+{
+	struct watch_ent *next;
+	__u64		cookie;
+	unsigned	round;
+	int		state;
+	inet_prefix	local, remote;
+	int		lport, rport;
+	__u64		acked, received;
+	__u32		retrans;
+};
+
+#define WATCH_CHUNK	1024
+
+static struct watch_ent **watch_hash;
+static unsigned watch_hsize;
+static unsigned watch_count;
+static unsigned watch_round;
+static struct watch_ent *watch_free;
+static int watch_changes;
+
+static unsigned watch_slot(__u64 cookie)
+{
+	return (cookie * 0x9E3779B97F4A7C15ULL) >> 32 & (watch_hsize - 1);
+}
+
+static void watch_grow(void)
+{
+	unsigned old = watch_hsize, i;
+	struct watch_ent **ohash = watch_hash;
+
+	watch_hsize = old ? old * 2 : 1024;
+	watch_hash = calloc(watch_hsize, sizeof(*watch_hash));
+	if (!watch_hash) {
+		perror("ss: watch table");
+		exit(-1);
+	}
+	for (i = 0; i < old; i++) {
+		struct watch_ent *e, *next;
+
+		for (e = ohash[i]; e; e = next) {
+			unsigned slot = watch_slot(e->cookie);
+
+			next = e->next;
+			e->next = watch_hash[slot];
+			watch_hash[slot] = e;
+		}
+	}
+	free(ohash);
+}
+
+static struct watch_ent *watch_alloc(void)
+{
+	struct watch_ent *e;
+
+	if (!watch_free) {
+		int i;
+
+		if (mem_charge(WATCH_CHUNK * (sizeof(*e) + sizeof(*watch_hash)),
+			       "not watching new sockets"))
+			return NULL;
+		e = malloc(WATCH_CHUNK * sizeof(*e));
+		if (!e) {
+			perror("ss: watch table");
+			exit(-1);
+		}
+		for (i = 0; i < WATCH_CHUNK; i++) {
+			e[i].next = watch_free;
+			watch_free = &e[i];
+		}
+	}
+	e = watch_free;
+	watch_free = e->next;
+	return e;
+}
+
+static void watch_print(int mark, const struct watch_ent *e, int old_state)
+{
+	if (!watch_changes++ && watch_round > 1) {
+		char tbuf[32];
+		time_t now = time(NULL);
+
+		strftime(tbuf, sizeof(tbuf), "%T", localtime(&now));
+		printf("--- %s\n", tbuf);
+	}
+	printf("%c %-11s ", mark, sstate_name[e->state]);
+	formatted_print(&e->local, e->lport);
+	formatted_print(&e->remote, e->rport);
+	if (mark == '~')
+		printf(" was:%s", sstate_name[old_state]);
+	printf("\n");
+}
+
+static void watch_print_deltas(const struct watch_ent *e, __u64 acked,
+			       __u64 received, __u32 retrans)
+{
+	printf("\tacked:+%llu rcvd:+%llu retrans:+%u\n",
+	       (unsigned long long)(acked - e->acked),
+	       (unsigned long long)(received - e->received),
+	       retrans - e->retrans);
+}
+
+static void watch_sock(struct nlmsghdr *nlh, struct inet_diag_msg *r,
+		       const struct tcpstat *s)
+{
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	__u64 cookie = r->id.idiag_cookie[0] |
+		       (__u64)r->id.idiag_cookie[1] << 32;
+	__u64 acked = 0, received = 0;
+	__u32 retrans = 0;
+	int counters = 0;
+	struct watch_ent *e;
+	unsigned slot;
+	int old_state, moved;
+
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[INET_DIAG_INFO]) {
+		const struct tcp_info *info = RTA_DATA(tb[INET_DIAG_INFO]);
+		int len = RTA_PAYLOAD(tb[INET_DIAG_INFO]);
+
+		if (len >= sizeof(*info)) {
+			retrans = info->tcpi_total_retrans;
+			counters = 1;
+		}
+		if (len >= sizeof(*info) + sizeof(struct tcp_info_tail)) {
+			const struct tcp_info_tail *tail = (void *)(info + 1);
+
+			acked = tail->tcpi_bytes_acked;
+			received = tail->tcpi_bytes_received;
+		}
+	}
+
+	if (watch_hsize) {
+		slot = watch_slot(cookie);
+		for (e = watch_hash[slot]; e; e = e->next)
+			if (e->cookie == cookie)
+				break;
+	} else
+		e = NULL;
+
+	if (!e) {
+		e = watch_alloc();
+		if (!e)
+			return;
+		if (watch_count >= watch_hsize)
+			watch_grow();
+		slot = watch_slot(cookie);
+		e->next = watch_hash[slot];
+		watch_hash[slot] = e;
+		watch_count++;
+		e->cookie = cookie;
+		e->state = s->state;
+		e->local = s->local;
+		e->remote = s->remote;
+		e->lport = s->lport;
+		e->rport = s->rport;
+		e->acked = acked;
+		e->received = received;
+		e->retrans = retrans;
+		e->round = watch_round;
+		watch_print('+', e, 0);
+		return;
+	}
+
+	e->round = watch_round;
+	old_state = e->state;
+	e->state = s->state;
+	/* Time-wait and request sockets carry no tcp_info */
+	moved = counters && (acked != e->acked || received != e->received ||
+			     retrans != e->retrans);
+	if (old_state != s->state)
+		watch_print('~', e, old_state);
+	else if (moved)
+		watch_print('=', e, 0);
+	if (!moved)
+		return;
+	watch_print_deltas(e, acked, received, retrans);
+	e->acked = acked;
+	e->received = received;
+	e->retrans = retrans;
+}
+
+/* Drop the sockets that were not seen in this round */
+static void watch_sweep(void)
+{
+	unsigned i;
+
+	for (i = 0; i < watch_hsize; i++) {
+		struct watch_ent **pp = &watch_hash[i], *e;
+
+		while ((e = *pp) != NULL) {
+			if (e->round == watch_round) {
+				pp = &e->next;
+				continue;
+			}
+			watch_print('-', e, 0);
+			*pp = e->next;
+			e->next = watch_free;
+			watch_free = e;
+			watch_count--;
+		}
+	}
+}
+
+/*
+ * With --sample, the TCP sockets that pass the filter are found by one
+ * dump, and from then on only those are asked for, by their diag id,
+ * at fixed times on the monotonic clock.  Each answer becomes a CSV
+ * line on stdout; sockets that are gone drop out, and ss ends when
+ * none is left.
+ */
+static double sample_interval;
+
+struct sample_sock
+{
+	__u8			family;
+	struct inet_diag_sockid	id;
+};
+
+static struct sample_sock *sample_socks;
+static unsigned int sample_count;
+static unsigned int sample_size;
+
+/* Requests per datagram: their answers, with tcp_info, must all fit
+ * in the receive buffer, since the kernel queues them before we read.
+ */
+#define SAMPLE_BATCH	64
+
+static void sample_add(struct inet_diag_msg *r)
+{
+	if (sample_count == sample_size) {
+		size_t size = sample_size ? sample_size * 2 : 256;
+
+		if (mem_charge((size - sample_size) * sizeof(*sample_socks),
+			       "not sampling more sockets"))
+			return;
+		sample_socks = realloc(sample_socks,
+				       size * sizeof(*sample_socks));
+		if (!sample_socks) {
+			perror("ss: sample");
+			exit(-1);
+		}
+		sample_size = size;
+	}
+	sample_socks[sample_count].family = r->idiag_family;
+	sample_socks[sample_count].id = r->id;
+	sample_count++;
+}
+
+static int tcp_show_sock(struct nlmsghdr *nlh, struct filter *f)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct tcpstat s;
+
+	s.state = r->idiag_state;
+	s.local.family = s.remote.family = r->idiag_family;
+	s.lport = ntohs(r->id.idiag_sport);
+	s.rport = ntohs(r->id.idiag_dport);
+	if (s.local.family == AF_INET) {
+		s.local.bytelen = s.remote.bytelen = 4;
+	} else {
+		s.local.bytelen = s.remote.bytelen = 16;
+	}
+	memcpy(s.local.data, r->id.idiag_src, s.local.bytelen);
+	memcpy(s.remote.data, r->id.idiag_dst, s.local.bytelen);
+	s.iface = r->id.idiag_if;
+	s.mark = 0;
+	s.ino = r->idiag_inode;
+	s.cgroup_id = 0;
+
+	if (f && f->f) {
+		s.mark = inet_diag_mark(nlh);
+		if (need_cgroups)
+			s.cgroup_id = inet_diag_cgroup_id(nlh);
+		if (run_ssfilter(f->f, &s) == 0)
+			return 0;
+	}
+
+	if (tcp_census) {
+		tcp_census_add(&s);
+		return 0;
+	}
+
+	if (watch_interval) {
+		watch_sock(nlh, r, &s);
+		return 0;
+	}
+
+	if (sample_interval) {
+		sample_add(r);
+		return 0;
+	}
+
+	if (sort_key) {
+		sort_add(nlh, r);
+		return 0;
+	}
+
+	if (group_nkeys) {
+		s.uid = r->idiag_uid;
+		s.rq = r->idiag_rqueue;
+		s.wq = r->idiag_wqueue;
+		if (need_cgroups && !s.cgroup_id)
+			s.cgroup_id = inet_diag_cgroup_id(nlh);
+		group_add("tcp", &s);
+		group_add_info(nlh, r);
+		return 0;
+	}
+
+	if (kill_sockets)
+		kill_sock(nlh, IPPROTO_TCP);
+
+	print_netid_state("tcp", sstate_name[s.state]);
+
+	print_queues(r->idiag_rqueue, r->idiag_wqueue);
+
+	formatted_print(&s.local, s.lport);
+	formatted_print(&s.remote, s.rport);
+
+	if (show_options) {
+		if (r->idiag_timer) {
+			if (r->idiag_timer > 4)
+				r->idiag_timer = 5;
+			printf(" timer:(%s,%s,%d)",
+			       tmr_name[r->idiag_timer],
+			       print_ms_timer(r->idiag_expires),
+			       r->idiag_retrans);
+		}
+	}
+	if (show_users) {
+		char ubuf[4096];
+		if (find_users(r->idiag_inode, ubuf, sizeof(ubuf)) > 0)
+			printf(" users:(%s)", ubuf);
+	}
+	if (show_details) {
+		if (r->idiag_uid)
+			printf(" uid:%u", (unsigned)r->idiag_uid);
+		printf(" ino:%u", r->idiag_inode);
+		printf(" sk:");
+		if (r->id.idiag_cookie[1] != 0)
+			printf("%08x", r->id.idiag_cookie[1]);
+ 		printf("%08x", r->id.idiag_cookie[0]);
+	}
+	if (show_mem || show_tcpinfo) {
+		printf("\n\t");
+		tcp_show_info(nlh, r);
+	}
+
+	printf("\n");
+
+	return 0;
+}
+
+/* Called with errno set from a diag request that carried bytecode.
+ * Kernels before 4.x reject DEV_COND and MARK_COND with EINVAL and
+ * MARK_COND needs CAP_NET_ADMIN (EPERM); then drop the bytecode and
+ * run the filter in user space for the rest of this invocation.
+ */
+static int bytecode_refused(struct filter *f)
+{
+	if (!f->f || f->nobc || (errno != EINVAL && errno != EPERM))
+		return 0;
+	if (explain_filter)
+		fprintf(stderr, "Kernel refused filter bytecode (%s), "
+			"filtering in user space.\n", strerror(errno));
+	f->nobc = 1;
+	return 1;
+}
+
+/* A sock_diag socket with the receive buffer asked for by --rcvbuf */
+static int diag_socket(void)
+{
+	int fd;
+
+	if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG)) < 0)
+		return -1;
+	if (diag_rcvbuf) {
+		int size = rtnl_set_rcvbuf(fd, diag_rcvbuf);
+
+		if (size < 0) {
+			close(fd);
+			return -1;
+		}
+		if (size < diag_rcvbuf) {
+			fprintf(stderr, "Warning: receive buffer is %d bytes, "
+				"%d requested\n", size, diag_rcvbuf);
+			diag_rcvbuf = size;
+		}
+	}
+	return fd;
+}
+
+/* Account one datagram of a diag dump for --timing */
+static void diag_received(ssize_t status)
+{
+	rtnl_stats.recvmsg++;
+	if (status > 0)
+		rtnl_stats.rx_bytes += status;
+}
+
+/* Format one socket, charging the time to formatting for --timing */
+static int diag_show(int (*show)(struct nlmsghdr *, struct filter *),
+		     struct nlmsghdr *h, struct filter *f)
+{
+	int phase = rtnl_phase_dump(RTNL_PHASE_FILTER);
+	int err;
+
+	rtnl_stats.msgs++;
+	err = show(h, f);
+	rtnl_phase(phase);
+	return err;
+}
+
+/*
+ * The extensions a TCP dump asks for.  The kernel fills each one asked
+ * for in every socket it sends, so ask only for what the output, the
+ * --sort key or --watch reads: the counts of ss -s and the keys of
+ * --group-by come from the bare diag header.
+ */
+static __u8 tcp_diag_extensions(void)
+{
+	__u8 ext = 0;
+
+	if (tcp_census)
+		return 0;
+	if (show_mem) {
+		ext |= (1<<(INET_DIAG_MEMINFO-1));
+		ext |= (1<<(INET_DIAG_SKMEMINFO-1));
+	}
+	if (show_tcpinfo) {
+		ext |= (1<<(INET_DIAG_INFO-1));
+		ext |= (1<<(INET_DIAG_VEGASINFO-1));
+		ext |= (1<<(INET_DIAG_CONG-1));
+	}
+	if (watch_interval)
+		ext |= (1<<(INET_DIAG_INFO-1));
+	switch (sort_key) {
+	case SORT_BW:
+		ext |= (1<<(INET_DIAG_VEGASINFO-1));
+		/* fall through */
+	case SORT_RTT:
+	case SORT_RETRANS:
+	case SORT_PACING:
+	case SORT_DELIVERY:
+	case SORT_MINRTT:
+	case SORT_BUSY:
+	case SORT_RWND_LIMITED:
+	case SORT_SNDBUF_LIMITED:
+	case SORT_ACKED:
+	case SORT_RECEIVED:
+		ext |= (1<<(INET_DIAG_INFO-1));
+		break;
+	}
+	return ext;
+}
+
+static int tcp_dump_netlink(int fd, struct filter *f, FILE *dump_fp,
+			    int socktype)
+{
+	struct sockaddr_nl nladdr;
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req r;
+	} req;
+	char    *bc = NULL;
+	int	bclen;
+	struct msghdr msg;
+	struct rtattr rta;
+	char	buf[8192];
+	struct iovec iov[3];
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
 
 	req.nlh.nlmsg_len = sizeof(req);
 	req.nlh.nlmsg_type = socktype;
@@ -1515,23 +3893,14 @@ static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
 	memset(&req.r, 0, sizeof(req.r));
 	req.r.idiag_family = AF_INET;
 	req.r.idiag_states = f->states;
-	if (show_mem) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_MEMINFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
-	}
-
-	if (show_tcpinfo) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
-	}
+	req.r.idiag_ext = tcp_diag_extensions();
 
 	iov[0] = (struct iovec){
 		.iov_base = &req,
 		.iov_len = sizeof(req)
 	};
-	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
+	if (f->f && !f->nobc) {
+		bclen = ssfilter_bytecode(f->f, &bc);
 		rta.rta_type = INET_DIAG_REQ_BYTECODE;
 		rta.rta_len = RTA_LENGTH(bclen);
 		iov[1] = (struct iovec){ &rta, sizeof(rta) };
@@ -1543,13 +3912,12 @@ static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
 		.msg_name = (void*)&nladdr,
 		.msg_namelen = sizeof(nladdr),
 		.msg_iov = iov,
-		.msg_iovlen = f->f ? 3 : 1,
+		.msg_iovlen = (f->f && !f->nobc) ? 3 : 1,
 	};
 
-	if (sendmsg(fd, &msg, 0) < 0) {
-		close(fd);
+	rtnl_stats.sendmsg++;
+	if (sendmsg(fd, &msg, 0) < 0)
 		return -1;
-	}
 
 	iov[0] = (struct iovec){
 		.iov_base = buf,
@@ -1568,6 +3936,7 @@ static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
 		};
 
 		status = recvmsg(fd, &msg, 0);
+		diag_received(status);
 
 		if (status < 0) {
 			if (errno == EINTR)
@@ -1577,64 +3946,259 @@ static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
 		}
 		if (status == 0) {
 			fprintf(stderr, "EOF on netlink\n");
-			close(fd);
 			return 0;
 		}
 
-		if (dump_fp)
-			fwrite(buf, 1, NLMSG_ALIGN(status), dump_fp);
+		if (dump_fp)
+			fwrite(buf, 1, NLMSG_ALIGN(status), dump_fp);
+
+		h = (struct nlmsghdr*)buf;
+		while (NLMSG_OK(h, status)) {
+			int err;
+			struct inet_diag_msg *r = NLMSG_DATA(h);
+
+			if (/*h->nlmsg_pid != rth->local.nl_pid ||*/
+			    h->nlmsg_seq != 123456)
+				goto skip_it;
+
+			if (h->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+				if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+					fprintf(stderr, "ERROR truncated\n");
+				} else {
+					errno = -err->error;
+					if (errno == EOPNOTSUPP)
+						return -1;
+					if (bytecode_refused(f))
+						return tcp_dump_netlink(fd, f, dump_fp,
+									socktype);
+					perror("TCPDIAG answers");
+				}
+				return 0;
+			}
+			if (!dump_fp) {
+				if (!(f->families & (1<<r->idiag_family))) {
+					h = NLMSG_NEXT(h, status);
+					continue;
+				}
+				err = diag_show(tcp_show_sock, h,
+						f->nobc ? f : NULL);
+				if (err < 0)
+					return err;
+			}
+
+skip_it:
+			h = NLMSG_NEXT(h, status);
+		}
+		if (msg.msg_flags & MSG_TRUNC) {
+			fprintf(stderr, "Message truncated\n");
+			continue;
+		}
+		if (status) {
+			fprintf(stderr, "!!!Remnant of size %d\n", status);
+			exit(1);
+		}
+	}
+	return 0;
+}
+
+static int tcp_show_netlink(struct filter *f, FILE *dump_fp, int socktype)
+{
+	int fd, ret;
+
+	if ((fd = diag_socket()) < 0)
+		return -1;
+	ret = tcp_dump_netlink(fd, f, dump_fp, socktype);
+	close(fd);
+	return ret;
+}
+
+static int tcp_watch(struct filter *f)
+{
+	struct timespec ts;
+	int fd;
+
+	if ((fd = diag_socket()) < 0) {
+		perror("ss: sock_diag socket");
+		return -1;
+	}
+
+	while (1) {
+		watch_round++;
+		watch_changes = 0;
+		if (tcp_dump_netlink(fd, f, NULL, TCPDIAG_GETSOCK) < 0) {
+			fprintf(stderr, "ss: --watch needs sock_diag "
+				"(tcp_diag) in the kernel\n");
+			close(fd);
+			return -1;
+		}
+		watch_sweep();
+		fflush(stdout);
+		ts.tv_sec = watch_interval;
+		ts.tv_nsec = (watch_interval - ts.tv_sec) * 1000000000;
+		while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+			;
+	}
+}
+
+static void sample_print(const char *when, struct nlmsghdr *h)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(h);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info;
+	struct tcp_info_tail tail;
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     h->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	tcp_info_get(tb[INET_DIAG_INFO], &info, &tail);
+	inet_ntop(r->idiag_family, r->id.idiag_src, src, sizeof(src));
+	inet_ntop(r->idiag_family, r->id.idiag_dst, dst, sizeof(dst));
+
+	printf("%s,%08x%08x,%s,%u,%s,%u,%s,%u,%u,%u,%u,%u,%u,%llu,%llu,"
+	       "%llu,%llu,%u,%llu,%llu,%llu\n",
+	       when, r->id.idiag_cookie[1], r->id.idiag_cookie[0],
+	       src, ntohs(r->id.idiag_sport), dst, ntohs(r->id.idiag_dport),
+	       sstate_name[r->idiag_state < SS_MAX ? r->idiag_state : 0],
+	       info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_snd_cwnd,
+	       info.tcpi_snd_ssthresh, info.tcpi_retrans,
+	       info.tcpi_total_retrans,
+	       (unsigned long long)tail.tcpi_bytes_acked,
+	       (unsigned long long)tail.tcpi_bytes_received,
+	       (unsigned long long)tail.tcpi_pacing_rate,
+	       (unsigned long long)tail.tcpi_delivery_rate,
+	       tail.tcpi_min_rtt,
+	       (unsigned long long)tail.tcpi_busy_time,
+	       (unsigned long long)tail.tcpi_rwnd_limited,
+	       (unsigned long long)tail.tcpi_sndbuf_limited);
+}
+
+/* Ask for sockets [first, first + n) and print the answers.  The
+ * sockets that are gone get family 0.
+ */
+static int sample_batch(int fd, const char *when, unsigned int first,
+			unsigned int n)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 r;
+	} req[SAMPLE_BATCH];
+	char buf[65536];
+	unsigned int i, left = n;
+
+	memset(req, 0, n * sizeof(req[0]));
+	for (i = 0; i < n; i++) {
+		req[i].nlh.nlmsg_len = sizeof(req[i]);
+		req[i].nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+		req[i].nlh.nlmsg_flags = NLM_F_REQUEST;
+		req[i].nlh.nlmsg_seq = first + i + 1;
+		req[i].r.sdiag_family = sample_socks[first + i].family;
+		req[i].r.sdiag_protocol = IPPROTO_TCP;
+		req[i].r.idiag_states = SS_ALL;
+		req[i].r.idiag_ext = (1<<(INET_DIAG_INFO-1));
+		req[i].r.id = sample_socks[first + i].id;
+	}
+
+	rtnl_stats.sendmsg++;
+	if (sendto(fd, req, n * sizeof(req[0]), 0,
+		   (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		perror("ss: sample request");
+		return -1;
+	}
+
+	while (left) {
+		struct nlmsghdr *h;
+		int len = recv(fd, buf, sizeof(buf), 0);
+
+		diag_received(len);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("ss: sample answer");
+			return -1;
+		}
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+		     h = NLMSG_NEXT(h, len)) {
+			unsigned int k = h->nlmsg_seq - 1;
+
+			if (k < first || k >= first + n)
+				continue;
+			left--;
+			if (h->nlmsg_type == NLMSG_ERROR)
+				sample_socks[k].family = 0;
+			else
+				sample_print(when, h);
+		}
+	}
+	return 0;
+}
+
+static void timespec_add(struct timespec *t, double secs)
+{
+	long ns = (secs - (long)secs) * 1000000000;
+
+	t->tv_sec += (long)secs + (t->tv_nsec + ns) / 1000000000;
+	t->tv_nsec = (t->tv_nsec + ns) % 1000000000;
+}
 
-		h = (struct nlmsghdr*)buf;
-		while (NLMSG_OK(h, status)) {
-			int err;
-			struct inet_diag_msg *r = NLMSG_DATA(h);
+static int tcp_sample(struct filter *f)
+{
+	struct timespec next, now;
+	char when[32];
+	int fd;
 
-			if (/*h->nlmsg_pid != rth->local.nl_pid ||*/
-			    h->nlmsg_seq != 123456)
-				goto skip_it;
+	if ((fd = diag_socket()) < 0) {
+		perror("ss: sock_diag socket");
+		return -1;
+	}
+	if (tcp_dump_netlink(fd, f, NULL, TCPDIAG_GETSOCK) < 0) {
+		fprintf(stderr, "ss: --sample needs sock_diag "
+			"(tcp_diag) in the kernel\n");
+		close(fd);
+		return -1;
+	}
 
-			if (h->nlmsg_type == NLMSG_DONE) {
-				close(fd);
-				return 0;
-			}
-			if (h->nlmsg_type == NLMSG_ERROR) {
-				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
-				if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
-					fprintf(stderr, "ERROR truncated\n");
-				} else {
-					errno = -err->error;
-					if (errno == EOPNOTSUPP) {
-						close(fd);
-						return -1;
-					}
-					perror("TCPDIAG answers");
-				}
+	printf("time,cookie,src,sport,dst,dport,state,rtt_us,rttvar_us,"
+	       "cwnd,ssthresh,retrans,total_retrans,bytes_acked,"
+	       "bytes_received,pacing_rate_Bps,delivery_rate_Bps,min_rtt_us,"
+	       "busy_us,rwnd_limited_us,sndbuf_limited_us\n");
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (sample_count) {
+		struct timespec real;
+		unsigned int i, j;
+
+		clock_gettime(CLOCK_REALTIME, &real);
+		snprintf(when, sizeof(when), "%ld.%03ld",
+			 (long)real.tv_sec, real.tv_nsec / 1000000);
+		for (i = 0; i < sample_count; i += SAMPLE_BATCH) {
+			unsigned int n = sample_count - i;
+
+			if (n > SAMPLE_BATCH)
+				n = SAMPLE_BATCH;
+			if (sample_batch(fd, when, i, n) < 0) {
 				close(fd);
-				return 0;
-			}
-			if (!dump_fp) {
-				if (!(f->families & (1<<r->idiag_family))) {
-					h = NLMSG_NEXT(h, status);
-					continue;
-				}
-				err = tcp_show_sock(h, NULL);
-				if (err < 0) {
-					close(fd);
-					return err;
-				}
+				return -1;
 			}
-
-skip_it:
-			h = NLMSG_NEXT(h, status);
-		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			fprintf(stderr, "Message truncated\n");
-			continue;
-		}
-		if (status) {
-			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
 		}
+		for (i = j = 0; i < sample_count; i++)
+			if (sample_socks[i].family)
+				sample_socks[j++] = sample_socks[i];
+		sample_count = j;
+		fflush(stdout);
+
+		/* The next slot of the schedule that is still ahead */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		do {
+			timespec_add(&next, sample_interval);
+		} while (next.tv_sec < now.tv_sec ||
+			 (next.tv_sec == now.tv_sec &&
+			  next.tv_nsec <= now.tv_nsec));
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &next, NULL) == EINTR)
+			;
 	}
 	close(fd);
 	return 0;
@@ -1690,7 +4254,7 @@ static int tcp_show_netlink_file(struct filter *f)
 			return -1;
 		}
 
-		err = tcp_show_sock(h, f);
+		err = diag_show(tcp_show_sock, h, f);
 		if (err < 0)
 			return err;
 	}
@@ -1699,8 +4263,6 @@ static int tcp_show_netlink_file(struct filter *f)
 static int tcp_show(struct filter *f, int socktype)
 {
 	FILE *fp = NULL;
-	char *buf = NULL;
-	int bufsize = 64*1024;
 
 	dg_proto = TCP_PROTO;
 
@@ -1713,38 +4275,9 @@ static int tcp_show(struct filter *f, int socktype)
 
 	/* Sigh... We have to parse /proc/net/tcp... */
 
-
-	/* Estimate amount of sockets and try to allocate
-	 * huge buffer to read all the table at one read.
-	 * Limit it by 16MB though. The assumption is: as soon as
-	 * kernel was able to hold information about N connections,
-	 * it is able to give us some memory for snapshot.
-	 */
-	if (1) {
-		int guess = slabstat.socks+slabstat.tcp_syns;
-		if (f->states&(1<<SS_TIME_WAIT))
-			guess += slabstat.tcp_tws;
-		if (guess > (16*1024*1024)/128)
-			guess = (16*1024*1024)/128;
-		guess *= 128;
-		if (guess > bufsize)
-			bufsize = guess;
-	}
-	while (bufsize >= 64*1024) {
-		if ((buf = malloc(bufsize)) != NULL)
-			break;
-		bufsize /= 2;
-	}
-	if (buf == NULL) {
-		errno = ENOMEM;
-		return -1;
-	}
-
 	if (f->families & (1<<AF_INET)) {
 		if ((fp = net_tcp_open()) == NULL)
 			goto outerr;
-
-		setbuffer(fp, buf, bufsize);
 		if (generic_record_read(fp, tcp_show_line, f, AF_INET))
 			goto outerr;
 		fclose(fp);
@@ -1752,20 +4285,16 @@ static int tcp_show(struct filter *f, int socktype)
 
 	if ((f->families & (1<<AF_INET6)) &&
 	    (fp = net_tcp6_open()) != NULL) {
-		setbuffer(fp, buf, bufsize);
 		if (generic_record_read(fp, tcp_show_line, f, AF_INET6))
 			goto outerr;
 		fclose(fp);
 	}
 
-	free(buf);
 	return 0;
 
 outerr:
 	do {
 		int saved_errno = errno;
-		if (buf)
-			free(buf);
 		if (fp)
 			fclose(fp);
 		errno = saved_errno;
@@ -1796,83 +4325,415 @@ int dgram_show_line(char *line, const struct filter *f, int family)
 	p[5] = 0;
 	data = p+6;
 
-	do {
-		int state = (data[1] >= 'A') ? (data[1] - 'A' + 10) : (data[1] - '0');
+	do {
+		int state = (data[1] >= 'A') ? (data[1] - 'A' + 10) : (data[1] - '0');
+
+		if (!(f->states & (1<<state)))
+			return 0;
+	} while (0);
+
+	s.local.family = s.remote.family = family;
+	s.iface = s.mark = 0;
+	s.ino = 0;
+	s.cgroup_id = 0;
+	if (proc_addr(loc, &s.local, &s.lport) ||
+	    proc_addr(rem, &s.remote, &s.rport))
+		return 0;
+
+	if (f->f && run_ssfilter(f->f, &s) == 0)
+		return 0;
+
+	opt[0] = 0;
+	{
+		void *out[] = {
+			&s.state, &s.wq, &s.rq, &s.uid, &s.ino, &s.refcnt,
+			&s.sk,
+		};
+		const char *rest;
+
+		n = proc_scan(data, "x x:x *:* * d * d d X", out, &rest);
+		if (n == 7)
+			n += proc_opt(rest, opt, sizeof(opt));
+	}
+
+	if (n < 9)
+		opt[0] = 0;
+
+	if (group_nkeys) {
+		group_add(dg_proto, &s);
+		return 0;
+	}
+
+	print_netid_state(dg_proto, sstate_name[s.state]);
+
+	print_queues(s.rq, s.wq);
+
+	formatted_print(&s.local, s.lport);
+	formatted_print(&s.remote, s.rport);
+
+	if (show_users) {
+		char ubuf[4096];
+		if (find_users(s.ino, ubuf, sizeof(ubuf)) > 0)
+			printf(" users:(%s)", ubuf);
+	}
+
+	if (show_details) {
+		if (s.uid)
+			printf(" uid=%u", (unsigned)s.uid);
+		printf(" ino=%u", s.ino);
+		printf(" sk=%llx", s.sk);
+		if (opt[0])
+			printf(" opt:\"%s\"", opt);
+	}
+	printf("\n");
+
+	return 0;
+}
+
+
+static int dgram_show_sock(struct nlmsghdr *nlh, struct filter *f)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct tcpstat s;
+
+	s.state = r->idiag_state;
+	s.local.family = s.remote.family = r->idiag_family;
+	s.lport = ntohs(r->id.idiag_sport);
+	s.rport = ntohs(r->id.idiag_dport);
+	if (s.local.family == AF_INET) {
+		s.local.bytelen = s.remote.bytelen = 4;
+	} else {
+		s.local.bytelen = s.remote.bytelen = 16;
+	}
+	memcpy(s.local.data, r->id.idiag_src, s.local.bytelen);
+	memcpy(s.remote.data, r->id.idiag_dst, s.local.bytelen);
+	s.iface = r->id.idiag_if;
+	s.mark = 0;
+	s.ino = r->idiag_inode;
+	s.cgroup_id = 0;
+
+	if (f && f->f) {
+		s.mark = inet_diag_mark(nlh);
+		if (need_cgroups)
+			s.cgroup_id = inet_diag_cgroup_id(nlh);
+		if (run_ssfilter(f->f, &s) == 0)
+			return 0;
+	}
+
+	if (group_nkeys) {
+		s.uid = r->idiag_uid;
+		s.rq = r->idiag_rqueue;
+		s.wq = r->idiag_wqueue;
+		if (need_cgroups && !s.cgroup_id)
+			s.cgroup_id = inet_diag_cgroup_id(nlh);
+		group_add(dg_proto, &s);
+		return 0;
+	}
+
+	if (kill_sockets)
+		kill_sock(nlh, IPPROTO_UDP);
+
+	print_netid_state(dg_proto, sstate_name[s.state]);
+
+	print_queues(r->idiag_rqueue, r->idiag_wqueue);
+
+	formatted_print(&s.local, s.lport);
+	formatted_print(&s.remote, s.rport);
+
+	if (show_users) {
+		char ubuf[4096];
+		if (find_users(r->idiag_inode, ubuf, sizeof(ubuf)) > 0)
+			printf(" users:(%s)", ubuf);
+	}
+
+	if (show_details) {
+		if (r->idiag_uid)
+			printf(" uid=%u", (unsigned)r->idiag_uid);
+		printf(" ino=%u", r->idiag_inode);
+		printf(" sk=");
+		if (r->id.idiag_cookie[1] != 0)
+			printf("%x%08x", r->id.idiag_cookie[1],
+			       r->id.idiag_cookie[0]);
+		else
+			printf("%x", r->id.idiag_cookie[0]);
+	}
+	printf("\n");
+
+	return 0;
+}
+
+/* Dump UDP or RAW sockets of one family through SOCK_DIAG_BY_FAMILY.
+ * The filter is compiled to inet_diag bytecode exactly as for TCP, so
+ * the kernel drops unwanted sockets before they are copied to us.
+ * Returns -1 if the kernel has no diag module for this protocol and
+ * nothing was printed, so that the caller may fall back to /proc.
+ */
+static int dgram_show_netlink(struct filter *f, int family, int protocol)
+{
+	int fd;
+	struct sockaddr_nl nladdr;
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 r;
+	} req;
+	char    *bc = NULL;
+	int	bclen;
+	struct msghdr msg;
+	struct rtattr rta;
+	char	buf[8192];
+	struct iovec iov[3];
+
+	if ((fd = diag_socket()) < 0)
+		return -1;
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
+	req.nlh.nlmsg_seq = 123456;
+	req.r.sdiag_family = family;
+	req.r.sdiag_protocol = protocol;
+	req.r.idiag_states = f->states;
+	/* raw_diag reads the wanted raw protocol from the pad byte,
+	 * IPPROTO_RAW there matches raw sockets of every protocol.
+	 */
+	if (protocol == IPPROTO_RAW)
+		req.r.pad = IPPROTO_RAW;
+
+	iov[0] = (struct iovec){
+		.iov_base = &req,
+		.iov_len = sizeof(req)
+	};
+	if (f->f && !f->nobc) {
+		bclen = ssfilter_bytecode(f->f, &bc);
+		rta.rta_type = INET_DIAG_REQ_BYTECODE;
+		rta.rta_len = RTA_LENGTH(bclen);
+		iov[1] = (struct iovec){ &rta, sizeof(rta) };
+		iov[2] = (struct iovec){ bc, bclen };
+		req.nlh.nlmsg_len += RTA_LENGTH(bclen);
+	}
+
+	msg = (struct msghdr) {
+		.msg_name = (void*)&nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+		.msg_iovlen = (f->f && !f->nobc) ? 3 : 1,
+	};
+
+	rtnl_stats.sendmsg++;
+	if (sendmsg(fd, &msg, 0) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	while (1) {
+		int status;
+		struct nlmsghdr *h;
+		socklen_t slen = sizeof(nladdr);
+
+		status = recvfrom(fd, buf, sizeof(buf), 0,
+				  (struct sockaddr *) &nladdr, &slen);
+		diag_received(status);
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("OVERRUN");
+			continue;
+		}
+		if (status == 0) {
+			fprintf(stderr, "EOF on netlink\n");
+			close(fd);
+			return 0;
+		}
+
+		h = (struct nlmsghdr*)buf;
+		while (NLMSG_OK(h, status)) {
+			int err;
+
+			if (h->nlmsg_seq != 123456)
+				goto skip_it;
+
+			if (h->nlmsg_type == NLMSG_DONE) {
+				int *done = NLMSG_DATA(h);
+
+				/* Recent kernels report a missing diag
+				 * handler of a dump in NLMSG_DONE.
+				 */
+				close(fd);
+				if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(int)) &&
+				    *done < 0) {
+					errno = -*done;
+					return -1;
+				}
+				return 0;
+			}
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				/* ENOENT: no udp_diag/raw_diag in this
+				 * kernel, EINVAL: no SOCK_DIAG_BY_FAMILY
+				 * or unknown bytecode.  All arrive before
+				 * any socket.
+				 */
+				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+				close(fd);
+				if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+					errno = -err->error;
+					if (bytecode_refused(f))
+						return dgram_show_netlink(f, family, protocol);
+				}
+				return -1;
+			}
+			err = diag_show(dgram_show_sock, h, f->nobc ? f : NULL);
+			if (err < 0) {
+				close(fd);
+				return err;
+			}
+
+skip_it:
+			h = NLMSG_NEXT(h, status);
+		}
+		if (status) {
+			fprintf(stderr, "!!!Remnant of size %d\n", status);
+			exit(1);
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+/*
+ * ss -E: the kernel multicasts every TCP and UDP socket it destroys to
+ * the SKNLGRP_*_DESTROY groups, TCP ones with their last tcp_info.
+ * They are printed as they come, through the filter in user space, and
+ * ss sleeps in recvmsg() in between.
+ */
+static int show_events;
 
-		if (!(f->states & (1<<state)))
-			return 0;
-	} while (0);
+static int sock_events_join(int fd, const struct filter *f)
+{
+	static const struct {
+		int	db;
+		int	family;
+		int	group;
+	} groups[] = {
+		{ TCP_DB, AF_INET,	SKNLGRP_INET_TCP_DESTROY },
+		{ TCP_DB, AF_INET6,	SKNLGRP_INET6_TCP_DESTROY },
+		{ UDP_DB, AF_INET,	SKNLGRP_INET_UDP_DESTROY },
+		{ UDP_DB, AF_INET6,	SKNLGRP_INET6_UDP_DESTROY },
+	};
+	int i, joined = 0;
 
-	s.local.family = s.remote.family = family;
-	if (family == AF_INET) {
-		sscanf(loc, "%x:%x", s.local.data, (unsigned*)&s.lport);
-		sscanf(rem, "%x:%x", s.remote.data, (unsigned*)&s.rport);
-		s.local.bytelen = s.remote.bytelen = 4;
-	} else {
-		sscanf(loc, "%08x%08x%08x%08x:%x",
-		       s.local.data,
-		       s.local.data+1,
-		       s.local.data+2,
-		       s.local.data+3,
-		       &s.lport);
-		sscanf(rem, "%08x%08x%08x%08x:%x",
-		       s.remote.data,
-		       s.remote.data+1,
-		       s.remote.data+2,
-		       s.remote.data+3,
-		       &s.rport);
-		s.local.bytelen = s.remote.bytelen = 16;
+	for (i = 0; i < ARRAY_SIZE(groups); i++) {
+		if (!(f->dbs & (1<<groups[i].db)) ||
+		    !(f->families & (1<<groups[i].family)))
+			continue;
+		if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+			       &groups[i].group, sizeof(groups[i].group)) < 0) {
+			perror("ss: cannot join socket destroy events");
+			return -1;
+		}
+		joined++;
 	}
+	return joined;
+}
 
-	if (f->f && run_ssfilter(f->f, &s) == 0)
+static int sock_event(struct nlmsghdr *h, struct filter *f)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(h);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	int protocol = 0;
+
+	if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+	    h->nlmsg_len < NLMSG_LENGTH(sizeof(*r)))
+		return 0;
+	if (!(f->families & (1<<r->idiag_family)) ||
+	    !(f->states & (1<<r->idiag_state)))
 		return 0;
 
-	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %*x:%*x %*x %d %*d %u %d %llx %[^\n]\n",
-	       &s.state, &s.wq, &s.rq,
-	       &s.uid, &s.ino,
-	       &s.refcnt, &s.sk, opt);
+	parse_rtattr(tb, INET_DIAG_MAX, (struct rtattr*)(r+1),
+		     h->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (tb[INET_DIAG_PROTOCOL])
+		protocol = rta_getattr_u8(tb[INET_DIAG_PROTOCOL]);
 
-	if (n < 9)
-		opt[0] = 0;
+	switch (protocol) {
+	case IPPROTO_TCP:
+		if (!(f->dbs & (1<<TCP_DB)))
+			return 0;
+		return diag_show(tcp_show_sock, h, f);
+	case IPPROTO_UDP:
+		if (!(f->dbs & (1<<UDP_DB)))
+			return 0;
+		dg_proto = UDP_PROTO;
+		return diag_show(dgram_show_sock, h, f);
+	}
+	return 0;
+}
 
-	if (netid_width)
-		printf("%-*s ", netid_width, dg_proto);
-	if (state_width)
-		printf("%-*s ", state_width, sstate_name[s.state]);
+static int sock_events(struct filter *f)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	char buf[16384];
+	int fd, ret;
 
-	printf("%-6d %-6d ", s.rq, s.wq);
+	if ((fd = diag_socket()) < 0) {
+		perror("ss: sock_diag socket");
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		perror("ss: bind sock_diag socket");
+		close(fd);
+		return -1;
+	}
+	ret = sock_events_join(fd, f);
+	if (ret <= 0) {
+		if (ret == 0)
+			fprintf(stderr, "ss: -E shows TCP and UDP sockets only\n");
+		close(fd);
+		return -1;
+	}
 
-	formatted_print(&s.local, s.lport);
-	formatted_print(&s.remote, s.rport);
+	while (1) {
+		struct nlmsghdr *h;
+		int status;
 
-	if (show_users) {
-		char ubuf[4096];
-		if (find_users(s.ino, ubuf, sizeof(ubuf)) > 0)
-			printf(" users:(%s)", ubuf);
-	}
+		status = recv(fd, buf, sizeof(buf), 0);
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				fprintf(stderr, "ss: events were lost\n");
+				continue;
+			}
+			perror("ss: recv");
+			break;
+		}
+		diag_received(status);
+		if (status == 0)
+			break;
 
-	if (show_details) {
-		if (s.uid)
-			printf(" uid=%u", (unsigned)s.uid);
-		printf(" ino=%u", s.ino);
-		printf(" sk=%llx", s.sk);
-		if (opt[0])
-			printf(" opt:\"%s\"", opt);
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status))
+			if (sock_event(h, f) < 0)
+				goto out;
+		fflush(stdout);
 	}
-	printf("\n");
-
-	return 0;
+out:
+	close(fd);
+	return -1;
 }
 
-
 int udp_show(struct filter *f)
 {
 	FILE *fp = NULL;
 
+	int diag = !getenv("PROC_NET_UDP") && !getenv("PROC_ROOT");
+
 	dg_proto = UDP_PROTO;
 
-	if (f->families&(1<<AF_INET)) {
+	if ((f->families&(1<<AF_INET)) &&
+	    (!diag || dgram_show_netlink(f, AF_INET, IPPROTO_UDP))) {
 		if ((fp = net_udp_open()) == NULL)
 			goto outerr;
 		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
@@ -1881,6 +4742,7 @@ int udp_show(struct filter *f)
 	}
 
 	if ((f->families&(1<<AF_INET6)) &&
+	    (!diag || dgram_show_netlink(f, AF_INET6, IPPROTO_UDP)) &&
 	    (fp = net_udp6_open()) != NULL) {
 		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
 			goto outerr;
@@ -1902,9 +4764,12 @@ int raw_show(struct filter *f)
 {
 	FILE *fp = NULL;
 
+	int diag = !getenv("PROC_NET_RAW") && !getenv("PROC_ROOT");
+
 	dg_proto = RAW_PROTO;
 
-	if (f->families&(1<<AF_INET)) {
+	if ((f->families&(1<<AF_INET)) &&
+	    (!diag || dgram_show_netlink(f, AF_INET, IPPROTO_RAW))) {
 		if ((fp = net_raw_open()) == NULL)
 			goto outerr;
 		if (generic_record_read(fp, dgram_show_line, f, AF_INET))
@@ -1913,6 +4778,7 @@ int raw_show(struct filter *f)
 	}
 
 	if ((f->families&(1<<AF_INET6)) &&
+	    (!diag || dgram_show_netlink(f, AF_INET6, IPPROTO_RAW)) &&
 	    (fp = net_raw6_open()) != NULL) {
 		if (generic_record_read(fp, dgram_show_line, f, AF_INET6))
 			goto outerr;
@@ -1934,6 +4800,7 @@ outerr:
 struct unixstat
 {
 	struct unixstat *next;
+	struct unixstat *hnext;		/* in the inode hash */
 	int ino;
 	int peer;
 	int rq;
@@ -1949,24 +4816,106 @@ int unix_state_map[] = { SS_CLOSE, SS_SYN_SENT,
 			 SS_ESTABLISHED, SS_CLOSING };
 
 
-#define MAX_UNIX_REMEMBER (1024*1024/sizeof(struct unixstat))
+/* Sockets in the order to print them, for peers to be named */
+static struct unixstat *unix_list;
+static struct unixstat **unix_tail = &unix_list;
+static unsigned int unix_count;
+
+static void unix_list_add(struct unixstat *u)
+{
+	u->next = NULL;
+	*unix_tail = u;
+	unix_tail = &u->next;
+	unix_count++;
+}
+
+static struct unixstat *unix_list_take(void)
+{
+	struct unixstat *list = unix_list;
+
+	unix_list = NULL;
+	unix_tail = &unix_list;
+	unix_count = 0;
+	return list;
+}
+
+static int unix_cmp(const void *a, const void *b)
+{
+	const struct unixstat *u = *(const struct unixstat **)a;
+	const struct unixstat *v = *(const struct unixstat **)b;
+
+	if (u->type != v->type)
+		return u->type < v->type ? -1 : 1;
+	if (u->ino != v->ino)
+		return u->ino < v->ino ? -1 : 1;
+	return 0;
+}
+
+/* Order the list by type and inode, as /proc/net/unix was shown */
+static void unix_list_sort(void)
+{
+	unsigned int i, n = unix_count;
+	struct unixstat **v, *u;
+
+	if (n < 2)
+		return;
+	v = malloc(n * sizeof(*v));
+	if (v == NULL)
+		return;
+	for (i = 0, u = unix_list; u; u = u->next)
+		v[i++] = u;
+	qsort(v, n, sizeof(*v), unix_cmp);
+	unix_list_take();
+	for (i = 0; i < n; i++)
+		unix_list_add(v[i]);
+	free(v);
+}
+
+/* Freed entries, for the next ones to reuse */
+static struct unixstat *unix_pool;
 
 void unix_list_free(struct unixstat *list)
 {
 	while (list) {
 		struct unixstat *s = list;
 		list = list->next;
-		if (s->name)
+		mem_uncharge(sizeof(*s));
+		if (s->name) {
+			mem_uncharge(strlen(s->name) + 1);
 			free(s->name);
-		free(s);
+		}
+		s->next = unix_pool;
+		unix_pool = s;
 	}
 }
 
+static unsigned int unix_hash(int ino, unsigned int hsize)
+{
+	return ((unsigned int)ino * 2654435761u) & (hsize - 1);
+}
+
 void unix_list_print(struct unixstat *list, struct filter *f)
 {
-	struct unixstat *s;
+	struct unixstat *s, **hash;
+	unsigned int hsize = 256, n = 0;
 	char *peer;
 
+	for (s = list; s; s = s->next)
+		n++;
+	while (hsize < 2 * n)
+		hsize <<= 1;
+	hash = calloc(hsize, sizeof(*hash));
+	if (hash == NULL) {
+		perror("calloc");
+		return;
+	}
+	for (s = list; s; s = s->next) {
+		unsigned int h = unix_hash(s->ino, hsize);
+
+		s->hnext = hash[h];
+		hash[h] = s;
+	}
+
 	for (s = list; s; s = s->next) {
 		if (!(f->states & (1<<s->state)))
 			continue;
@@ -1978,7 +4927,9 @@ void unix_list_print(struct unixstat *list, struct filter *f)
 		peer = "*";
 		if (s->peer) {
 			struct unixstat *p;
-			for (p = list; p; p = p->next) {
+
+			for (p = hash[unix_hash(s->peer, hsize)]; p;
+			     p = p->hnext) {
 				if (s->peer == p->ino)
 					break;
 			}
@@ -1993,6 +4944,7 @@ void unix_list_print(struct unixstat *list, struct filter *f)
 			struct tcpstat tst;
 			tst.local.family = AF_UNIX;
 			tst.remote.family = AF_UNIX;
+			tst.iface = tst.mark = 0;
 			memcpy(tst.local.data, &s->name, sizeof(s->name));
 			if (strcmp(peer, "*") == 0)
 				memset(tst.remote.data, 0, sizeof(peer));
@@ -2002,12 +4954,9 @@ void unix_list_print(struct unixstat *list, struct filter *f)
 				continue;
 		}
 
-		if (netid_width)
-			printf("%-*s ", netid_width,
-			       s->type == SOCK_STREAM ? "u_str" : "u_dgr");
-		if (state_width)
-			printf("%-*s ", state_width, sstate_name[s->state]);
-		printf("%-6d %-6d ", s->rq, s->wq);
+		print_netid_state(s->type == SOCK_STREAM ? "u_str" : "u_dgr",
+				  sstate_name[s->state]);
+		print_queues(s->rq, s->wq);
 		printf("%*s %-*d %*s %-*d",
 		       addr_width, s->name ? : "*", serv_width, s->ino,
 		       addr_width, peer, serv_width, s->peer);
@@ -2018,61 +4967,79 @@ void unix_list_print(struct unixstat *list, struct filter *f)
 		}
 		printf("\n");
 	}
+	free(hash);
+}
+
+/* A cleared entry for one more socket.  Past --max-mem the sockets in
+ * hand are printed first, and peers among them are named only there.
+ */
+static struct unixstat *unix_alloc(struct filter *f)
+{
+	struct unixstat *u;
+
+	if (mem_charge(sizeof(*u), "printing UNIX sockets in parts, "
+		       "peers in other parts show as ?") < 0) {
+		struct unixstat *list = unix_list_take();
+
+		unix_list_print(list, f);
+		unix_list_free(list);
+		/* one socket is kept whatever the budget */
+		mem_used += sizeof(*u);
+	}
+
+	if (unix_pool) {
+		u = unix_pool;
+		unix_pool = u->next;
+	} else {
+		u = malloc(sizeof(*u));
+		if (u == NULL)
+			return NULL;
+	}
+	memset(u, 0, sizeof(*u));
+	return u;
 }
 
+/* Collect a socket of the dump; they are printed once all are in,
+ * so that peers can be named.
+ */
 static int unix_show_sock(struct nlmsghdr *nlh, struct filter *f)
 {
 	struct unix_diag_msg *r = NLMSG_DATA(nlh);
 	struct rtattr *tb[UNIX_DIAG_MAX+1];
-	char name[128];
-	int peer_ino;
-	int rqlen;
+	struct unixstat *u;
 
 	parse_rtattr(tb, UNIX_DIAG_MAX, (struct rtattr*)(r+1),
 		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
 
-	if (netid_width)
-		printf("%-*s ", netid_width,
-				r->udiag_type == SOCK_STREAM ? "u_str" : "u_dgr");
-	if (state_width)
-		printf("%-*s ", state_width, sstate_name[r->udiag_state]);
+	u = unix_alloc(f);
+	if (u == NULL)
+		return -1;
+	u->ino = r->udiag_ino;
+	u->type = r->udiag_type;
+	u->state = r->udiag_state;
 
 	if (tb[UNIX_DIAG_RQLEN])
-		rqlen = *(int *)RTA_DATA(tb[UNIX_DIAG_RQLEN]);
-	else
-		rqlen = 0;
-
-	printf("%-6d %-6d ", rqlen, 0);
+		u->rq = *(int *)RTA_DATA(tb[UNIX_DIAG_RQLEN]);
 
 	if (tb[UNIX_DIAG_NAME]) {
 		int len = RTA_PAYLOAD(tb[UNIX_DIAG_NAME]);
 
-		memcpy(name, RTA_DATA(tb[UNIX_DIAG_NAME]), len);
-		name[len] = '\0';
-		if (name[0] == '\0')
-			name[0] = '@';
-	} else
-		sprintf(name, "*");
-
-	if (tb[UNIX_DIAG_PEER])
-		peer_ino = *(int *)RTA_DATA(tb[UNIX_DIAG_PEER]);
-	else
-		peer_ino = 0;
-
-	printf("%*s %-*d %*s %-*d",
-			addr_width, name,
-			serv_width, r->udiag_ino,
-			addr_width, "*", /* FIXME */
-			serv_width, peer_ino);
-
-	if (show_users) {
-		char ubuf[4096];
-		if (find_users(r->udiag_ino, ubuf, sizeof(ubuf)) > 0)
-			printf(" users:(%s)", ubuf);
+		u->name = malloc(len + 1);
+		if (u->name == NULL) {
+			unix_list_free(u);
+			return -1;
+		}
+		mem_used += len + 1;
+		memcpy(u->name, RTA_DATA(tb[UNIX_DIAG_NAME]), len);
+		u->name[len] = '\0';
+		if (u->name[0] == '\0')
+			u->name[0] = '@';
 	}
 
-	printf("\n");
+	if (tb[UNIX_DIAG_PEER])
+		u->peer = *(int *)RTA_DATA(tb[UNIX_DIAG_PEER]);
 
+	unix_list_add(u);
 	return 0;
 }
 
@@ -2084,8 +5051,10 @@ static int unix_show_netlink(struct filter *f, FILE *dump_fp)
 		struct unix_diag_req r;
 	} req;
 	char	buf[8192];
+	struct unixstat *list;
+	int phase;
 
-	if ((fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG)) < 0)
+	if ((fd = diag_socket()) < 0)
 		return -1;
 
 	memset(&req, 0, sizeof(req));
@@ -2098,6 +5067,7 @@ static int unix_show_netlink(struct filter *f, FILE *dump_fp)
 	req.r.udiag_states = f->states;
 	req.r.udiag_show = UDIAG_SHOW_NAME | UDIAG_SHOW_PEER | UDIAG_SHOW_RQLEN;
 
+	rtnl_stats.sendmsg++;
 	if (send(fd, &req, sizeof(req), 0) < 0) {
 		close(fd);
 		return -1;
@@ -2111,6 +5081,7 @@ static int unix_show_netlink(struct filter *f, FILE *dump_fp)
 
 		status = recvfrom(fd, buf, sizeof(buf), 0,
 				  (struct sockaddr *) &nladdr, &slen);
+		diag_received(status);
 		if (status < 0) {
 			if (errno == EINTR)
 				continue;
@@ -2146,12 +5117,14 @@ static int unix_show_netlink(struct filter *f, FILE *dump_fp)
 						fprintf(stderr, "UDIAG answers %d\n", errno);
 				}
 				close(fd);
+				unix_list_free(unix_list_take());
 				return -1;
 			}
 			if (!dump_fp) {
-				err = unix_show_sock(h, f);
+				err = diag_show(unix_show_sock, h, f);
 				if (err < 0) {
 					close(fd);
+					unix_list_free(unix_list_take());
 					return err;
 				}
 			}
@@ -2168,6 +5141,11 @@ skip_it:
 
 close_it:
 	close(fd);
+	list = unix_list_take();
+	phase = rtnl_phase_dump(RTNL_PHASE_FILTER);
+	unix_list_print(list, f);
+	rtnl_phase(phase);
+	unix_list_free(list);
 	return 0;
 }
 
@@ -2177,8 +5155,7 @@ int unix_show(struct filter *f)
 	char buf[256];
 	char name[128];
 	int  newformat = 0;
-	int  cnt;
-	struct unixstat *list = NULL;
+	struct unixstat *list;
 
 	if (!getenv("PROC_NET_UNIX") && !getenv("PROC_ROOT")
 	    && unix_show_netlink(f, NULL) == 0)
@@ -2190,15 +5167,13 @@ int unix_show(struct filter *f)
 
 	if (memcmp(buf, "Peer", 4) == 0)
 		newformat = 1;
-	cnt = 0;
 
 	while (fgets(buf, sizeof(buf)-1, fp)) {
-		struct unixstat *u, **insp;
+		struct unixstat *u;
 		int flags;
 
-		if (!(u = malloc(sizeof(*u))))
+		if (!(u = unix_alloc(f)))
 			break;
-		u->name = NULL;
 
 		if (sscanf(buf, "%x: %x %x %x %x %x %d %s",
 			   &u->peer, &u->rq, &u->wq, &flags, &u->type,
@@ -2221,40 +5196,275 @@ int unix_show(struct filter *f)
 			u->wq = 0;
 		}
 
-		insp = &list;
-		while (*insp) {
-			if (u->type < (*insp)->type ||
-			    (u->type == (*insp)->type &&
-			     u->ino < (*insp)->ino))
-				break;
-			insp = &(*insp)->next;
-		}
-		u->next = *insp;
-		*insp = u;
+		unix_list_add(u);
 
 		if (name[0]) {
 			if ((u->name = malloc(strlen(name)+1)) == NULL)
 				break;
+			mem_used += strlen(name) + 1;
 			strcpy(u->name, name);
 		}
-		if (++cnt > MAX_UNIX_REMEMBER) {
-			unix_list_print(list, f);
-			unix_list_free(list);
-			list = NULL;
-			cnt = 0;
+	}
+	fclose(fp);
+
+	unix_list_sort();
+	list = unix_list_take();
+	unix_list_print(list, f);
+	unix_list_free(list);
+	return 0;
+}
+
+
+static int packet_show_one(struct filter *f, int type, int prot, int iface,
+			   int rq, unsigned uid, unsigned ino,
+			   unsigned long long sk)
+{
+	if (type == SOCK_RAW && !(f->dbs&(1<<PACKET_R_DB)))
+		return 0;
+	if (type == SOCK_DGRAM && !(f->dbs&(1<<PACKET_DG_DB)))
+		return 0;
+	if (f->f) {
+		struct tcpstat tst;
+		tst.local.family = AF_PACKET;
+		tst.remote.family = AF_PACKET;
+		tst.rport = 0;
+		tst.lport = iface;
+		tst.iface = iface;
+		tst.mark = 0;
+		tst.local.data[0] = prot;
+		tst.remote.data[0] = 0;
+		if (run_ssfilter(f->f, &tst) == 0)
+			return 0;
+	}
+
+	print_netid_state(type == SOCK_RAW ? "p_raw" : "p_dgr", "UNCONN");
+	print_queues(rq, 0);
+	if (prot == 3) {
+		printf("%*s:", addr_width, "*");
+	} else {
+		char tb[16];
+		printf("%*s:", addr_width,
+		       ll_proto_n2a(htons(prot), tb, sizeof(tb)));
+	}
+	if (iface == 0) {
+		printf("%-*s ", serv_width, "*");
+	} else {
+		printf("%-*s ", serv_width, xll_index_to_name(iface));
+	}
+	printf("%*s*%-*s",
+	       addr_width, "", serv_width, "");
+
+	if (show_users) {
+		char ubuf[4096];
+		if (find_users(ino, ubuf, sizeof(ubuf)) > 0)
+			printf(" users:(%s)", ubuf);
+	}
+	if (show_details) {
+		printf(" ino=%u uid=%u sk=%llx", ino, uid, sk);
+	}
+	printf("\n");
+
+	return 0;
+}
+
+static int netlink_show_one(struct filter *f, int prot, int pid,
+			    unsigned groups, int rq, int wq,
+			    unsigned long long sk, unsigned long long cb)
+{
+	if (f->f) {
+		struct tcpstat tst;
+		tst.local.family = AF_NETLINK;
+		tst.remote.family = AF_NETLINK;
+		tst.iface = tst.mark = 0;
+		tst.rport = -1;
+		tst.lport = pid;
+		tst.local.data[0] = prot;
+		tst.remote.data[0] = 0;
+		if (run_ssfilter(f->f, &tst) == 0)
+			return 0;
+	}
+
+	print_netid_state("nl", "UNCONN");
+	print_queues(rq, wq);
+	if (resolve_services && prot == 0)
+		printf("%*s:", addr_width, "rtnl");
+	else if (resolve_services && prot == 3)
+		printf("%*s:", addr_width, "fw");
+	else if (resolve_services && prot == 4)
+		printf("%*s:", addr_width, "tcpdiag");
+	else
+		printf("%*d:", addr_width, prot);
+	if (pid == -1) {
+		printf("%-*s ", serv_width, "*");
+	} else if (resolve_services) {
+		int done = 0;
+		if (!pid) {
+			done = 1;
+			printf("%-*s ", serv_width, "kernel");
+		} else if (pid > 0) {
+			char procname[64];
+			FILE *fp;
+			sprintf(procname, "%s/%d/stat",
+				getenv("PROC_ROOT") ? : "/proc", pid);
+			if ((fp = fopen(procname, "r")) != NULL) {
+				if (fscanf(fp, "%*d (%[^)])", procname) == 1) {
+					sprintf(procname+strlen(procname), "/%d", pid);
+					printf("%-*s ", serv_width, procname);
+					done = 1;
+				}
+				fclose(fp);
+			}
+		}
+		if (!done)
+			printf("%-*d ", serv_width, pid);
+	} else {
+		printf("%-*d ", serv_width, pid);
+	}
+	printf("%*s*%-*s",
+	       addr_width, "", serv_width, "");
+
+	if (show_details) {
+		printf(" sk=%llx cb=%llx groups=0x%08x", sk, cb, groups);
+	}
+	printf("\n");
+
+	return 0;
+}
+
+/* Send a SOCK_DIAG_BY_FAMILY dump request and feed every answer
+ * to show().  packet_diag and netlink_diag have no bytecode, so the
+ * kernel only selects by family (and netlink protocol); the rest of
+ * the filter runs in show().  Returns -1 when the kernel lacks the
+ * diag module, before anything is printed.
+ */
+static int sockdiag_dump(struct filter *f, void *req, size_t len,
+			 int (*show)(struct nlmsghdr *, struct filter *))
+{
+	int fd;
+	char	buf[8192];
+
+	if ((fd = diag_socket()) < 0)
+		return -1;
+
+	rtnl_stats.sendmsg++;
+	if (send(fd, req, len, 0) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	while (1) {
+		ssize_t status;
+		struct nlmsghdr *h;
+		struct sockaddr_nl nladdr;
+		socklen_t slen = sizeof(nladdr);
+
+		status = recvfrom(fd, buf, sizeof(buf), 0,
+				  (struct sockaddr *) &nladdr, &slen);
+		diag_received(status);
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("OVERRUN");
+			continue;
+		}
+		if (status == 0) {
+			fprintf(stderr, "EOF on netlink\n");
+			break;
+		}
+
+		h = (struct nlmsghdr*)buf;
+		while (NLMSG_OK(h, status)) {
+			int err;
+
+			if (h->nlmsg_seq != 123456)
+				goto skip_it;
+
+			if (h->nlmsg_type == NLMSG_DONE) {
+				int *done = NLMSG_DATA(h);
+
+				close(fd);
+				if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(int)) &&
+				    *done < 0) {
+					errno = -*done;
+					return -1;
+				}
+				return 0;
+			}
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+				if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr)))
+					errno = -err->error;
+				close(fd);
+				return -1;
+			}
+			err = diag_show(show, h, f);
+			if (err < 0) {
+				close(fd);
+				return err;
+			}
+
+skip_it:
+			h = NLMSG_NEXT(h, status);
+		}
+
+		if (status) {
+			fprintf(stderr, "!!!Remnant of size %zd\n", status);
+			exit(1);
 		}
 	}
-	fclose(fp);
-	if (list) {
-		unix_list_print(list, f);
-		unix_list_free(list);
-		list = NULL;
-		cnt = 0;
+
+	close(fd);
+	return 0;
+}
+
+static int packet_show_sock(struct nlmsghdr *nlh, struct filter *f)
+{
+	struct packet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[PACKET_DIAG_MAX+1];
+	unsigned long long sk;
+	int iface = 0;
+	int rq = 0;
+	unsigned uid = 0;
+
+	parse_rtattr(tb, PACKET_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+
+	if (tb[PACKET_DIAG_INFO]) {
+		struct packet_diag_info *pinfo = RTA_DATA(tb[PACKET_DIAG_INFO]);
+		iface = pinfo->pdi_index;
+	}
+	if (tb[PACKET_DIAG_MEMINFO]) {
+		__u32 *skmeminfo = RTA_DATA(tb[PACKET_DIAG_MEMINFO]);
+		rq = skmeminfo[SK_MEMINFO_RMEM_ALLOC];
 	}
+	if (tb[PACKET_DIAG_UID])
+		uid = *(__u32 *)RTA_DATA(tb[PACKET_DIAG_UID]);
 
-	return 0;
+	sk = ((unsigned long long)r->pdiag_cookie[1] << 32) |
+		r->pdiag_cookie[0];
+
+	return packet_show_one(f, r->pdiag_type, r->pdiag_num, iface,
+			       rq, uid, r->pdiag_ino, sk);
 }
 
+static int packet_show_netlink(struct filter *f)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct packet_diag_req r;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
+	req.nlh.nlmsg_seq = 123456;
+
+	req.r.sdiag_family = AF_PACKET;
+	req.r.pdiag_show = PACKET_SHOW_INFO | PACKET_SHOW_MEMINFO;
+
+	return sockdiag_dump(f, &req, sizeof(req), packet_show_sock);
+}
 
 int packet_show(struct filter *f)
 {
@@ -2272,6 +5482,10 @@ int packet_show(struct filter *f)
 	if (!(f->states & (1<<SS_CLOSE)))
 		return 0;
 
+	if (!getenv("PROC_NET_PACKET") && !getenv("PROC_ROOT")
+	    && packet_show_netlink(f) == 0)
+		return 0;
+
 	if ((fp = net_packet_open()) == NULL)
 		return -1;
 	fgets(buf, sizeof(buf)-1, fp);
@@ -2282,55 +5496,61 @@ int packet_show(struct filter *f)
 		       &type, &prot, &iface, &state,
 		       &rq, &uid, &ino);
 
-		if (type == SOCK_RAW && !(f->dbs&(1<<PACKET_R_DB)))
-			continue;
-		if (type == SOCK_DGRAM && !(f->dbs&(1<<PACKET_DG_DB)))
-			continue;
-		if (f->f) {
-			struct tcpstat tst;
-			tst.local.family = AF_PACKET;
-			tst.remote.family = AF_PACKET;
-			tst.rport = 0;
-			tst.lport = iface;
-			tst.local.data[0] = prot;
-			tst.remote.data[0] = 0;
-			if (run_ssfilter(f->f, &tst) == 0)
-				continue;
-		}
+		packet_show_one(f, type, prot, iface, rq, uid, ino, sk);
+	}
 
-		if (netid_width)
-			printf("%-*s ", netid_width,
-			       type == SOCK_RAW ? "p_raw" : "p_dgr");
-		if (state_width)
-			printf("%-*s ", state_width, "UNCONN");
-		printf("%-6d %-6d ", rq, 0);
-		if (prot == 3) {
-			printf("%*s:", addr_width, "*");
-		} else {
-			char tb[16];
-			printf("%*s:", addr_width,
-			       ll_proto_n2a(htons(prot), tb, sizeof(tb)));
-		}
-		if (iface == 0) {
-			printf("%-*s ", serv_width, "*");
-		} else {
-			printf("%-*s ", serv_width, xll_index_to_name(iface));
-		}
-		printf("%*s*%-*s",
-		       addr_width, "", serv_width, "");
+	return 0;
+}
 
-		if (show_users) {
-			char ubuf[4096];
-			if (find_users(ino, ubuf, sizeof(ubuf)) > 0)
-				printf(" users:(%s)", ubuf);
-		}
-		if (show_details) {
-			printf(" ino=%u uid=%u sk=%llx", ino, uid, sk);
-		}
-		printf("\n");
+static int netlink_show_sock(struct nlmsghdr *nlh, struct filter *f)
+{
+	struct netlink_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[NETLINK_DIAG_MAX+1];
+	unsigned long long sk, cb = 0;
+	unsigned groups = 0;
+	int rq = 0, wq = 0;
+
+	parse_rtattr(tb, NETLINK_DIAG_MAX, (struct rtattr*)(r+1),
+		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+
+	if (tb[NETLINK_DIAG_MEMINFO]) {
+		__u32 *skmeminfo = RTA_DATA(tb[NETLINK_DIAG_MEMINFO]);
+		rq = skmeminfo[SK_MEMINFO_RMEM_ALLOC];
+		wq = skmeminfo[SK_MEMINFO_WMEM_ALLOC];
 	}
+	if (tb[NETLINK_DIAG_GROUPS] &&
+	    RTA_PAYLOAD(tb[NETLINK_DIAG_GROUPS]) >= sizeof(__u32))
+		groups = *(__u32 *)RTA_DATA(tb[NETLINK_DIAG_GROUPS]);
+	if (tb[NETLINK_DIAG_FLAGS] &&
+	    (*(__u32 *)RTA_DATA(tb[NETLINK_DIAG_FLAGS]) & NDIAG_FLAG_CB_RUNNING))
+		cb = 1;
+
+	sk = ((unsigned long long)r->ndiag_cookie[1] << 32) |
+		r->ndiag_cookie[0];
+
+	return netlink_show_one(f, r->ndiag_protocol, (int)r->ndiag_portid,
+				groups, rq, wq, sk, cb);
+}
 
-	return 0;
+static int netlink_show_netlink(struct filter *f)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct netlink_diag_req r;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	req.nlh.nlmsg_flags = NLM_F_ROOT|NLM_F_MATCH|NLM_F_REQUEST;
+	req.nlh.nlmsg_seq = 123456;
+
+	req.r.sdiag_family = AF_NETLINK;
+	req.r.sdiag_protocol = NDIAG_PROTO_ALL;
+	req.r.ndiag_show = NDIAG_SHOW_GROUPS | NDIAG_SHOW_MEMINFO |
+			   NDIAG_SHOW_FLAGS;
+
+	return sockdiag_dump(f, &req, sizeof(req), netlink_show_sock);
 }
 
 int netlink_show(struct filter *f)
@@ -2345,6 +5565,10 @@ int netlink_show(struct filter *f)
 	if (!(f->states & (1<<SS_CLOSE)))
 		return 0;
 
+	if (!getenv("PROC_NET_NETLINK") && !getenv("PROC_ROOT")
+	    && netlink_show_netlink(f) == 0)
+		return 0;
+
 	if ((fp = net_netlink_open()) == NULL)
 		return -1;
 	fgets(buf, sizeof(buf)-1, fp);
@@ -2354,64 +5578,7 @@ int netlink_show(struct filter *f)
 		       &sk,
 		       &prot, &pid, &groups, &rq, &wq, &cb, &rc);
 
-		if (f->f) {
-			struct tcpstat tst;
-			tst.local.family = AF_NETLINK;
-			tst.remote.family = AF_NETLINK;
-			tst.rport = -1;
-			tst.lport = pid;
-			tst.local.data[0] = prot;
-			tst.remote.data[0] = 0;
-			if (run_ssfilter(f->f, &tst) == 0)
-				continue;
-		}
-
-		if (netid_width)
-			printf("%-*s ", netid_width, "nl");
-		if (state_width)
-			printf("%-*s ", state_width, "UNCONN");
-		printf("%-6d %-6d ", rq, wq);
-		if (resolve_services && prot == 0)
-			printf("%*s:", addr_width, "rtnl");
-		else if (resolve_services && prot == 3)
-			printf("%*s:", addr_width, "fw");
-		else if (resolve_services && prot == 4)
-			printf("%*s:", addr_width, "tcpdiag");
-		else
-			printf("%*d:", addr_width, prot);
-		if (pid == -1) {
-			printf("%-*s ", serv_width, "*");
-		} else if (resolve_services) {
-			int done = 0;
-			if (!pid) {
-				done = 1;
-				printf("%-*s ", serv_width, "kernel");
-			} else if (pid > 0) {
-				char procname[64];
-				FILE *fp;
-				sprintf(procname, "%s/%d/stat",
-					getenv("PROC_ROOT") ? : "/proc", pid);
-				if ((fp = fopen(procname, "r")) != NULL) {
-					if (fscanf(fp, "%*d (%[^)])", procname) == 1) {
-						sprintf(procname+strlen(procname), "/%d", pid);
-						printf("%-*s ", serv_width, procname);
-						done = 1;
-					}
-					fclose(fp);
-				}
-			}
-			if (!done)
-				printf("%-*d ", serv_width, pid);
-		} else {
-			printf("%-*d ", serv_width, pid);
-		}
-		printf("%*s*%-*s",
-		       addr_width, "", serv_width, "");
-
-		if (show_details) {
-			printf(" sk=%llx cb=%llx groups=0x%08x", sk, cb, groups);
-		}
-		printf("\n");
+		netlink_show_one(f, prot, pid, groups, rq, wq, sk, cb);
 	}
 
 	return 0;
@@ -2539,31 +5706,63 @@ int get_sockstat(struct sockstat *s)
 	return 0;
 }
 
+/* Fill c by a dump of all TCP sockets, without extensions */
+static int tcp_census_get(struct tcp_census *c)
+{
+	struct filter f = {
+		.dbs = (1<<TCP_DB),
+		.states = SS_ALL,
+		.families = ~0,
+	};
+	int err;
+
+	memset(c, 0, sizeof(*c));
+	tcp_census = c;
+	err = tcp_show_netlink(&f, NULL, TCPDIAG_GETSOCK);
+	tcp_census = NULL;
+	return err;
+}
+
 int print_summary(void)
 {
 	struct sockstat s;
 	struct snmpstat sn;
+	struct tcp_census c;
+	int kernel, syns, tws, ports;
 
 	if (get_sockstat(&s) < 0)
 		perror("ss: get_sockstat");
 	if (get_snmp_int("Tcp:", "CurrEstab", &sn.tcp_estab) < 0)
 		perror("ss: get_snmpstat");
 
-	printf("Total: %d (kernel %d)\n", s.socks, slabstat.socks);
+	if (tcp_census_get(&c) == 0) {
+		kernel = s.socks;
+		syns = c.states[SS_SYN_RECV];
+		tws = c.states[SS_TIME_WAIT];
+		ports = c.ports;
+	} else {
+		get_slabstat(&slabstat);
+		kernel = slabstat.socks;
+		syns = slabstat.tcp_syns;
+		tws = slabstat.tcp_tws;
+		ports = slabstat.tcp_ports;
+	}
+
+	printf("Total: %d (kernel %d)\n", s.socks, kernel);
 
 	printf("TCP:   %d (estab %d, closed %d, orphaned %d, synrecv %d, timewait %d/%d), ports %d\n",
-	       s.tcp_total + slabstat.tcp_syns + s.tcp_tws,
+	       s.tcp_total + syns + s.tcp_tws,
 	       sn.tcp_estab,
 	       s.tcp_total - (s.tcp4_hashed+s.tcp6_hashed-s.tcp_tws),
 	       s.tcp_orphans,
-	       slabstat.tcp_syns,
-	       s.tcp_tws, slabstat.tcp_tws,
-	       slabstat.tcp_ports
+	       syns,
+	       s.tcp_tws, tws,
+	       ports
 	       );
 
 	printf("\n");
 	printf("Transport Total     IP        IPv6\n");
-	printf("*	  %-9d %-9s %-9s\n", slabstat.socks, "-", "-");
+	printf("*	  %-9d %-9s %-9s\n", kernel, "-", "-");
 	printf("RAW	  %-9d %-9d %-9d\n", s.raw4+s.raw6, s.raw4, s.raw6);
 	printf("UDP	  %-9d %-9d %-9d\n", s.udp4+s.udp6, s.udp4, s.udp6);
 	printf("TCP	  %-9d %-9d %-9d\n", s.tcp4_hashed+s.tcp6_hashed, s.tcp4_hashed, s.tcp6_hashed);
@@ -2579,6 +5778,439 @@ int print_summary(void)
 	return 0;
 }
 
+static int parallel_dumps;
+
+/* Socket tables in the order they are listed. */
+static const int show_order[] = {
+	NETLINK_DB, PACKET_R_DB, UNIX_ST_DB, RAW_DB, UDP_DB, TCP_DB, DCCP_DB,
+};
+#define SHOW_JOBS	(sizeof(show_order)/sizeof(show_order[0]))
+
+static int show_wanted(struct filter *f, int db)
+{
+	switch (db) {
+	case PACKET_R_DB:
+		return (f->dbs & PACKET_DBM) != 0;
+	case UNIX_ST_DB:
+		return (f->dbs & UNIX_DBM) != 0;
+	default:
+		return (f->dbs & (1<<db)) != 0;
+	}
+}
+
+static void show_one(struct filter *f, int db)
+{
+	if (!show_wanted(f, db))
+		return;
+
+	switch (db) {
+	case NETLINK_DB:
+		netlink_show(f);
+		break;
+	case PACKET_R_DB:
+		packet_show(f);
+		break;
+	case UNIX_ST_DB:
+		unix_show(f);
+		break;
+	case RAW_DB:
+		raw_show(f);
+		break;
+	case UDP_DB:
+		udp_show(f);
+		break;
+	case TCP_DB:
+		tcp_show(f, TCPDIAG_GETSOCK);
+		break;
+	case DCCP_DB:
+		tcp_show(f, DCCPDIAG_GETSOCK);
+		break;
+	}
+}
+
+/*
+ * --parallel: every table is dumped by its own child process writing
+ * into a pipe.  The parent drains all pipes as data arrives and then
+ * prints the outputs in the usual order, so the listing looks the same
+ * but takes about as long as the slowest single dump.  Processes rather
+ * than threads keep the (not thread safe) printing code untouched.
+ */
+struct show_job {
+	int	fd;
+	pid_t	pid;
+	char	*buf;
+	size_t	len, size;
+};
+
+static int show_sockets_parallel(struct filter *f)
+{
+	struct show_job jobs[SHOW_JOBS];
+	struct pollfd pfd[SHOW_JOBS];
+	int i, n, open_fds = 0;
+
+	fflush(stdout);
+	memset(jobs, 0, sizeof(jobs));
+	for (i = 0; i < SHOW_JOBS; i++) {
+		int p[2];
+
+		jobs[i].fd = -1;
+		if (!show_wanted(f, show_order[i]))
+			continue;
+		if (pipe(p) < 0)
+			goto fallback;
+		jobs[i].pid = fork();
+		if (jobs[i].pid < 0) {
+			close(p[0]);
+			close(p[1]);
+			goto fallback;
+		}
+		if (jobs[i].pid == 0) {
+			close(p[0]);
+			dup2(p[1], STDOUT_FILENO);
+			close(p[1]);
+			show_one(f, show_order[i]);
+			fflush(stdout);
+			_exit(0);
+		}
+		close(p[1]);
+		jobs[i].fd = p[0];
+		open_fds++;
+	}
+
+	while (open_fds) {
+		for (i = 0, n = 0; i < SHOW_JOBS; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			pfd[n].fd = jobs[i].fd;
+			pfd[n].events = POLLIN;
+			n++;
+		}
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+		for (i = 0, n = 0; i < SHOW_JOBS; i++) {
+			struct show_job *j = &jobs[i];
+			ssize_t r;
+
+			if (j->fd < 0)
+				continue;
+			if (!(pfd[n++].revents & (POLLIN|POLLHUP|POLLERR)))
+				continue;
+			if (j->size - j->len < 65536) {
+				j->size = j->size ? j->size * 2 : 262144;
+				j->buf = realloc(j->buf, j->size);
+				if (!j->buf)
+					abort();
+			}
+			r = read(j->fd, j->buf + j->len, j->size - j->len);
+			if (r > 0) {
+				j->len += r;
+			} else if (r == 0 || errno != EINTR) {
+				close(j->fd);
+				j->fd = -1;
+				open_fds--;
+			}
+		}
+	}
+
+	for (i = 0; i < SHOW_JOBS; i++) {
+		if (jobs[i].pid > 0)
+			waitpid(jobs[i].pid, NULL, 0);
+		if (jobs[i].len)
+			fwrite(jobs[i].buf, 1, jobs[i].len, stdout);
+		free(jobs[i].buf);
+	}
+	return 0;
+
+fallback:
+	/* Could not start every dump; let the children that did run
+	 * finish unseen and list everything the ordinary way.
+	 */
+	for (i = 0; i < SHOW_JOBS; i++) {
+		if (jobs[i].fd >= 0)
+			close(jobs[i].fd);
+		if (jobs[i].pid > 0)
+			waitpid(jobs[i].pid, NULL, 0);
+	}
+	return -1;
+}
+
+static void show_sockets(struct filter *f)
+{
+	int i;
+
+	if (parallel_dumps && !user_ent_collect && !resolve_prefetch &&
+	    !group_nkeys && !sort_key && !kill_sockets &&
+	    show_sockets_parallel(f) == 0)
+		return;
+
+	for (i = 0; i < SHOW_JOBS; i++)
+		show_one(f, show_order[i]);
+}
+
+/* Run the listing once with stdout pointed at /dev/null.  This queues
+ * every address for parallel resolution (-r) and collects the inodes
+ * of the sockets that pass the filter (-p), so the real listing finds
+ * names and owners ready when it prints.
+ */
+static void prepare_run(void (*show)(struct filter *), struct filter *f)
+{
+	int null, saved;
+
+	null = open("/dev/null", O_WRONLY);
+	if (null < 0)
+		return;
+	saved = dup(STDOUT_FILENO);
+	if (saved < 0) {
+		close(null);
+		return;
+	}
+
+	fflush(stdout);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	resolve_prefetch = resolve_hosts;
+	user_ent_collect = show_users;
+	show(f);
+	fflush(stdout);
+	user_ent_collect = 0;
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	if (show_users && user_ent_wanted)
+		user_ent_hash_build();
+	if (resolve_hosts)
+		resolve_flush();
+}
+
+static void prepare_sockets(struct filter *f)
+{
+	struct filter pf = *f;
+
+	if (!show_users)
+		pf.dbs &= (1<<RAW_DB)|(1<<UDP_DB)|(1<<TCP_DB)|(1<<DCCP_DB);
+	if (pf.dbs == 0)
+		return;
+	prepare_run(show_sockets, &pf);
+}
+
+static int sort_cmp(const void *a, const void *b)
+{
+	const struct sort_ent *x = a, *y = b;
+
+	if (x->val != y->val)
+		return x->val < y->val ? 1 : -1;
+	return 0;
+}
+
+static void sort_show(struct filter *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < sort_count; i++)
+		tcp_show_sock(sort_ents[i].nlh, NULL);
+}
+
+/* Print the sockets kept by --sort, finding names and owners for just
+ * those.
+ */
+static void sort_print(void)
+{
+	unsigned int i;
+
+	qsort(sort_ents, sort_count, sizeof(*sort_ents), sort_cmp);
+	sort_key = SORT_NONE;
+	if (resolve_hosts || show_users)
+		prepare_run(sort_show, NULL);
+	sort_show(NULL);
+	for (i = 0; i < sort_count; i++) {
+		mem_uncharge(sizeof(*sort_ents) + sort_ents[i].nlh->nlmsg_len);
+		free(sort_ents[i].nlh);
+	}
+	free(sort_ents);
+	sort_ents = NULL;
+	sort_count = sort_size = 0;
+}
+
+/*
+ * --all-netns: the listing of every namespace of NETNS_RUN_DIR, each
+ * one by a child that moves into it before it opens its sock_diag
+ * sockets and reads /proc/net.  Every line comes out prefixed with the
+ * name of its namespace.
+ */
+static int all_netns;
+
+static int show_sockets_netns(const char *name, void *arg)
+{
+	struct filter *f = arg;
+
+	if (netns_set(name) < 0)
+		return -1;
+	if (!sort_key && ((resolve_hosts && !group_nkeys) || show_users))
+		prepare_sockets(f);
+	show_sockets(f);
+	/* The counts and the kept sockets are the child's */
+	if (group_nkeys)
+		group_print();
+	if (sort_key)
+		sort_print();
+	kill_done();
+	fflush(stdout);
+	return 0;
+}
+
+static void ssfilter_print_hostcond(FILE *fp, const char *dir,
+				    struct aafilter *a)
+{
+	char abuf[256];
+	int multi = a->next != NULL;
+
+	if (multi)
+		fprintf(fp, "(");
+	for (; a; a = a->next) {
+		fprintf(fp, "%s ", dir);
+		if (a->addr.family == AF_UNIX) {
+			char *p;
+			memcpy(&p, a->addr.data, sizeof(p));
+			fprintf(fp, "unix:%s", p ? : "*");
+		} else if (a->addr.family == AF_PACKET ||
+			   a->addr.family == AF_NETLINK) {
+			fprintf(fp, "%s:", a->addr.family == AF_PACKET ?
+				"link" : "netlink");
+			if (a->addr.bitlen)
+				fprintf(fp, "%u", a->addr.data[0]);
+			else
+				fprintf(fp, "*");
+		} else if (a->addr.bitlen) {
+			fprintf(fp, "%s/%d",
+				inet_ntop(a->addr.family, a->addr.data,
+					  abuf, sizeof(abuf)) ? : "?",
+				a->addr.bitlen);
+		} else {
+			fprintf(fp, "*");
+		}
+		if (a->port != -1)
+			fprintf(fp, ":%d", a->port);
+		if (a->next)
+			fprintf(fp, " | ");
+	}
+	if (multi)
+		fprintf(fp, ")");
+}
+
+static void ssfilter_print(FILE *fp, struct ssfilter *f)
+{
+	struct aafilter *a = (void*)f->pred;
+
+	switch (f->type) {
+	case SSF_S_AUTO:
+		fprintf(fp, "autobound");
+		break;
+	case SSF_DCOND:
+		ssfilter_print_hostcond(fp, "dst", a);
+		break;
+	case SSF_SCOND:
+		ssfilter_print_hostcond(fp, "src", a);
+		break;
+	case SSF_D_GE:
+		fprintf(fp, "dport >= :%d", a->port);
+		break;
+	case SSF_D_LE:
+		fprintf(fp, "dport <= :%d", a->port);
+		break;
+	case SSF_S_GE:
+		fprintf(fp, "sport >= :%d", a->port);
+		break;
+	case SSF_S_LE:
+		fprintf(fp, "sport <= :%d", a->port);
+		break;
+	case SSF_DEVCOND:
+		fprintf(fp, "dev %s", xll_index_to_name(a->iface));
+		break;
+	case SSF_MARKMASK:
+		fprintf(fp, "fwmark 0x%x/0x%x", a->mark, a->mask);
+		break;
+	case SSF_CGROUPCOND:
+		fprintf(fp, "cgroup %s", cg_by_id(a->cgroup_id) ? : "?");
+		break;
+	case SSF_AND:
+	case SSF_OR:
+		fprintf(fp, "(");
+		ssfilter_print(fp, f->pred);
+		fprintf(fp, f->type == SSF_AND ? " & " : " | ");
+		ssfilter_print(fp, f->post);
+		fprintf(fp, ")");
+		break;
+	case SSF_NOT:
+		fprintf(fp, "!");
+		ssfilter_print(fp, f->pred);
+		break;
+	}
+}
+
+static int ssfilter_has(struct ssfilter *f, int type)
+{
+	if (f == NULL)
+		return 0;
+	if (f->type == type)
+		return 1;
+	switch (f->type) {
+	case SSF_AND:
+	case SSF_OR:
+		return ssfilter_has(f->pred, type) || ssfilter_has(f->post, type);
+	case SSF_NOT:
+		return ssfilter_has(f->pred, type);
+	}
+	return 0;
+}
+
+/* --explain-filter: tell where each part of the query is evaluated. */
+static void explain_ssfilter(FILE *fp, struct filter *f)
+{
+	int i;
+
+	fprintf(fp, "States: 0x%04x, in kernel (inet_diag idiag_states):",
+		f->states);
+	for (i = 1; i < SS_MAX; i++)
+		if (f->states & (1<<i))
+			fprintf(fp, " %s", sstate_namel[i]);
+	fprintf(fp, "\n");
+
+	if (!f->f) {
+		fprintf(fp, "Filter: none\n\n");
+		return;
+	}
+
+	fprintf(fp, "Filter: ");
+	ssfilter_print(fp, f->f);
+	fprintf(fp, "\n");
+
+	if (f->dbs & ((1<<TCP_DB)|(1<<DCCP_DB)|(1<<UDP_DB)|(1<<RAW_DB))) {
+		char *bc = NULL;
+		int bclen = ssfilter_bytecode(f->f, &bc);
+
+		fprintf(fp, "  tcp, dccp, udp, raw: in kernel, %d bytes of "
+			"inet_diag bytecode\n", bclen);
+		if (ssfilter_has(f->f, SSF_DEVCOND) ||
+		    ssfilter_has(f->f, SSF_MARKMASK))
+			fprintf(fp, "    dev and fwmark need a 4.x kernel, fwmark "
+				"also CAP_NET_ADMIN; else in user space\n");
+		if (ssfilter_has(f->f, SSF_CGROUPCOND))
+			fprintf(fp, "    cgroup needs a 5.10 kernel, else in user "
+				"space, through the owners before 5.7\n");
+		fprintf(fp, "    in user space when read from /proc\n");
+	}
+	if (f->dbs & ((1<<UNIX_DG_DB)|(1<<UNIX_ST_DB)|
+		      (1<<PACKET_DG_DB)|(1<<PACKET_R_DB)|(1<<NETLINK_DB)))
+		fprintf(fp, "  unix, packet, netlink: in user space\n");
+	fprintf(fp, "\n");
+}
+
 static void _usage(FILE *dest)
 {
 	fprintf(dest,
@@ -2596,6 +6228,21 @@ static void _usage(FILE *dest)
 "   -p, --processes	show process using socket\n"
 "   -i, --info		show internal TCP information\n"
 "   -s, --summary	show socket usage summary\n"
+"   -P, --parallel	dump socket tables in parallel\n"
+"       --rcvbuf=SIZE	netlink receive buffer size for dumps\n"
+"       --max-mem=SIZE	memory kept across sockets, e.g. 64M\n"
+"       --all-netns	list the sockets of all named network namespaces\n"
+"       --timing	report where the time went on stderr\n"
+"       --group-by=KEY[,KEY]...  count sockets by KEY instead of listing them\n"
+"       KEY := {netid|state|src[/LEN]|dst[/LEN]|sport|dport|uid|dev|process|cgroup}\n"
+"       --sort=KEY	list TCP sockets largest KEY first\n"
+"       KEY := {rtt|retrans|send-q|recv-q|bw|pacing|delivery|minrtt|busy|\n"
+"               rwnd-limited|sndbuf-limited|acked|received}\n"
+"       --top=N		show only the N largest groups or sockets\n"
+"       --watch=SECS	print changes of the TCP table every SECS\n"
+"       --sample=SECS	print tcp_info of the TCP sockets as CSV every SECS\n"
+"   -E, --events	print TCP and UDP sockets as they are destroyed\n"
+"   -K, --kill		close the TCP and UDP sockets listed\n"
 "\n"
 "   -4, --ipv4          display only IP version 4 sockets\n"
 "   -6, --ipv6          display only IP version 6 sockets\n"
@@ -2612,6 +6259,7 @@ static void _usage(FILE *dest)
 "\n"
 "   -D, --diag=FILE     Dump raw information about TCP sockets to FILE\n"
 "   -F, --filter=FILE   read filter information from FILE\n"
+"       --explain-filter show which parts of FILTER run in the kernel\n"
 "       FILTER := [ state TCP-STATE ] [ EXPRESSION ]\n"
 		);
 }
@@ -2680,9 +6328,22 @@ static const struct option long_opts[] = {
 	{ "socket", 1, 0, 'A' },
 	{ "query", 1, 0, 'A' },
 	{ "summary", 0, 0, 's' },
+	{ "parallel", 0, 0, 'P' },
+	{ "explain-filter", 0, 0, 'X' },
 	{ "diag", 1, 0, 'D' },
 	{ "filter", 1, 0, 'F' },
 	{ "version", 0, 0, 'V' },
+	{ "rcvbuf", 1, 0, 'R' },
+	{ "all-netns", 0, 0, 'N' },
+	{ "timing", 0, 0, 'T' },
+	{ "group-by", 1, 0, 'G' },
+	{ "top", 1, 0, 'J' },
+	{ "kill", 0, 0, 'K' },
+	{ "max-mem", 1, 0, 'M' },
+	{ "sample", 1, 0, 'S' },
+	{ "watch", 1, 0, 'W' },
+	{ "events", 0, 0, 'E' },
+	{ "sort", 1, 0, 'O' },
 	{ "help", 0, 0, 'h' },
 	{ 0 }
 
@@ -2702,7 +6363,9 @@ int main(int argc, char *argv[])
 
 	current_filter.states = default_filter.states;
 
-	while ((ch = getopt_long(argc, argv, "dhaletuwxnro460spf:miA:D:F:vV",
+	setvbuf(stdout, NULL, _IOFBF, SS_OUTBUF_SIZE);
+
+	while ((ch = getopt_long(argc, argv, "dhaletuwxnro460spPf:miA:D:F:vVKE",
 				 long_opts, NULL)) != EOF) {
 		switch(ch) {
 		case 'n':
@@ -2726,7 +6389,12 @@ int main(int argc, char *argv[])
 			break;
 		case 'p':
 			show_users++;
-			user_ent_hash_build();
+			break;
+		case 'P':
+			parallel_dumps = 1;
+			break;
+		case 'X':
+			explain_filter = 1;
 			break;
 		case 'd':
 			current_filter.dbs |= (1<<DCCP_DB);
@@ -2851,6 +6519,60 @@ int main(int argc, char *argv[])
 				exit(-1);
 			}
 			break;
+		case 'R':
+			if (get_integer(&diag_rcvbuf, optarg, 0) ||
+			    diag_rcvbuf <= 0) {
+				fprintf(stderr, "ss: invalid rcvbuf size \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case 'N':
+			all_netns = 1;
+			break;
+		case 'T':
+			rtnl_stats_start();
+			break;
+		case 'G':
+			if (group_parse(optarg) < 0)
+				exit(-1);
+			break;
+		case 'J':
+			if (get_unsigned(&top_count, optarg, 0) || !top_count) {
+				fprintf(stderr, "ss: invalid top count \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case 'K':
+			kill_sockets = 1;
+			break;
+		case 'E':
+			show_events = 1;
+			break;
+		case 'M':
+			if (mem_parse(optarg) < 0)
+				exit(-1);
+			break;
+		case 'O':
+			if (sort_parse(optarg) < 0)
+				exit(-1);
+			break;
+		case 'W':
+		case 'S':
+		{
+			double *interval = ch == 'W' ? &watch_interval :
+						       &sample_interval;
+			char *end;
+
+			*interval = strtod(optarg, &end);
+			if (*end || end == optarg || !(*interval > 0)) {
+				fprintf(stderr, "ss: invalid interval \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		}
 		case 'v':
 		case 'V':
 			printf("ss utility, iproute2-ss%s\n", SNAPSHOT);
@@ -2866,8 +6588,6 @@ int main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	get_slabstat(&slabstat);
-
 	if (do_summary) {
 		print_summary();
 		if (do_default && argc == 0)
@@ -2912,6 +6632,51 @@ int main(int argc, char *argv[])
 		else
 			current_filter.families = default_filter.families;
 	}
+	if (kill_sockets) {
+		if (group_nkeys || sort_key || watch_interval) {
+			fprintf(stderr, "ss: -K does not go with --group-by, "
+				"--sort or --watch\n");
+			exit(-1);
+		}
+		current_filter.dbs &= (1<<TCP_DB)|(1<<UDP_DB);
+	}
+	if (sort_key) {
+		if (group_nkeys) {
+			fprintf(stderr, "ss: --sort does not go with "
+				"--group-by\n");
+			exit(-1);
+		}
+		current_filter.dbs &= (1<<TCP_DB)|(1<<DCCP_DB);
+	}
+	if (top_count && !sort_key && !group_nkeys) {
+		fprintf(stderr, "ss: --top needs --sort or --group-by\n");
+		exit(-1);
+	}
+	if (watch_interval || sample_interval) {
+		if (all_netns || group_nkeys || sort_key || kill_sockets ||
+		    (watch_interval && sample_interval)) {
+			fprintf(stderr, "ss: --watch and --sample go with none "
+				"of each other, --all-netns, --group-by, "
+				"--sort, -K\n");
+			exit(-1);
+		}
+		current_filter.dbs &= (1<<TCP_DB);
+	}
+	if (show_events) {
+		if (all_netns || group_nkeys || sort_key || kill_sockets ||
+		    watch_interval || sample_interval || dump_tcpdiag) {
+			fprintf(stderr, "ss: -E goes with none of --watch, "
+				"--sample, --all-netns, --group-by, --sort, "
+				"-K, -D\n");
+			exit(-1);
+		}
+		current_filter.dbs &= (1<<TCP_DB)|(1<<UDP_DB);
+		/* The last tcp_info is what the events are for */
+		show_tcpinfo = 1;
+	}
+	/* Only inet sockets are counted by groups */
+	if (group_nkeys)
+		current_filter.dbs &= (1<<TCP_DB)|(1<<DCCP_DB)|(1<<UDP_DB)|(1<<RAW_DB);
 	if (current_filter.dbs == 0) {
 		fprintf(stderr, "ss: no socket tables to show with such filter.\n");
 		exit(0);
@@ -2923,7 +6688,7 @@ int main(int argc, char *argv[])
 
 	if (resolve_services && resolve_hosts &&
 	    (current_filter.dbs&(UNIX_DBM|(1<<TCP_DB)|(1<<UDP_DB)|(1<<DCCP_DB))))
-		init_service_resolver();
+		service_resolver_wanted = 1;
 
 	/* Now parse filter... */
 	if (argc == 0 && filter_fp) {
@@ -2953,11 +6718,21 @@ int main(int argc, char *argv[])
 		argc--; argv++;
 	}
 
+	if (ssfilter_has(current_filter.f, SSF_CGROUPCOND))
+		need_cgroups = 1;
+
+	/* Destroyed sockets are mostly closed ones */
+	if (show_events && !saw_states)
+		current_filter.states = SS_ALL;
+
 	if (current_filter.states == 0) {
 		fprintf(stderr, "ss: no socket states to show with such filter.\n");
 		exit(0);
 	}
 
+	if (explain_filter)
+		explain_ssfilter(stdout, &current_filter);
+
 	if (dump_tcpdiag) {
 		FILE *dump_fp = stdout;
 		if (!(current_filter.dbs & (1<<TCP_DB))) {
@@ -3016,31 +6791,34 @@ int main(int argc, char *argv[])
 
 	addr_width = addrp_width - serv_width - 1;
 
-	if (netid_width)
-		printf("%-*s ", netid_width, "Netid");
-	if (state_width)
-		printf("%-*s ", state_width, "State");
-	printf("%-6s %-6s ", "Recv-Q", "Send-Q");
+	if (!group_nkeys && !watch_interval && !sample_interval) {
+		print_netid_state("Netid", "State");
+		printf("%-6s %-6s ", "Recv-Q", "Send-Q");
 
-	printf("%*s:%-*s %*s:%-*s\n",
-	       addr_width, "Local Address", serv_width, "Port",
-	       addr_width, "Peer Address", serv_width, "Port");
+		printf("%*s:%-*s %*s:%-*s\n",
+		       addr_width, "Local Address", serv_width, "Port",
+		       addr_width, "Peer Address", serv_width, "Port");
+	}
 
 	fflush(stdout);
 
-	if (current_filter.dbs & (1<<NETLINK_DB))
-		netlink_show(&current_filter);
-	if (current_filter.dbs & PACKET_DBM)
-		packet_show(&current_filter);
-	if (current_filter.dbs & UNIX_DBM)
-		unix_show(&current_filter);
-	if (current_filter.dbs & (1<<RAW_DB))
-		raw_show(&current_filter);
-	if (current_filter.dbs & (1<<UDP_DB))
-		udp_show(&current_filter);
-	if (current_filter.dbs & (1<<TCP_DB))
-		tcp_show(&current_filter, TCPDIAG_GETSOCK);
-	if (current_filter.dbs & (1<<DCCP_DB))
-		tcp_show(&current_filter, DCCPDIAG_GETSOCK);
+	rtnl_phase(RTNL_PHASE_DUMP);
+	if (watch_interval)
+		return tcp_watch(&current_filter) < 0;
+	if (show_events)
+		return sock_events(&current_filter) < 0;
+	if (sample_interval)
+		return tcp_sample(&current_filter) < 0;
+	if (all_netns)
+		return netns_foreach(0, show_sockets_netns, &current_filter) ? 1 : 0;
+
+	if (!sort_key && ((resolve_hosts && !group_nkeys) || show_users))
+		prepare_sockets(&current_filter);
+	show_sockets(&current_filter);
+	if (group_nkeys)
+		group_print();
+	if (sort_key)
+		sort_print();
+	kill_done();
 	return 0;
 }
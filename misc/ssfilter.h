@@ -8,6 +8,9 @@
 #define SSF_S_GE  7
 #define SSF_S_LE  8
 #define SSF_S_AUTO  9
+#define SSF_DEVCOND 10
+#define SSF_MARKMASK 11
+#define SSF_CGROUPCOND 12
 
 struct ssfilter
 {
@@ -18,4 +21,8 @@ struct ssfilter
 
 int ssfilter_parse(struct ssfilter **f, int argc, char **argv, FILE *fp);
 void *parse_hostcond(char*);
+int ssfilter_resolve_hosts(void);
+void *parse_devcond(char*);
+void *parse_markmask(char*);
+void *parse_cgroupcond(char*);
 
@@ -25,6 +25,7 @@ static char		**yy_argv;
 static int		yy_argc;
 static FILE		*yy_fp;
 static ssfilter_t	*yy_ret;
+static int		tok_type = -1;
 
 static int yylex(void);
 
@@ -36,6 +37,7 @@ static void yyerror(char *s)
 %}
 
 %token HOSTCOND DCOND SCOND DPORT SPORT LEQ GEQ NEQ AUTOBOUND
+%token DEVNAME DEVCOND FWMARK MARKMASK CGROUP CGROUPCOND
 %left '|'
 %left '&'
 %nonassoc '!'
@@ -112,6 +114,45 @@ expr:	DCOND HOSTCOND
         {
                 $$ = alloc_node(SSF_S_AUTO, NULL);
         }
+
+        | DEVNAME DEVCOND
+        {
+		$$ = alloc_node(SSF_DEVCOND, $2);
+        }
+        | DEVNAME '=' DEVCOND
+        {
+		$$ = alloc_node(SSF_DEVCOND, $3);
+        }
+        | DEVNAME NEQ DEVCOND
+        {
+		$$ = alloc_node(SSF_NOT, alloc_node(SSF_DEVCOND, $3));
+        }
+
+        | FWMARK MARKMASK
+        {
+		$$ = alloc_node(SSF_MARKMASK, $2);
+        }
+        | FWMARK '=' MARKMASK
+        {
+		$$ = alloc_node(SSF_MARKMASK, $3);
+        }
+        | FWMARK NEQ MARKMASK
+        {
+		$$ = alloc_node(SSF_NOT, alloc_node(SSF_MARKMASK, $3));
+        }
+
+        | CGROUP CGROUPCOND
+        {
+		$$ = alloc_node(SSF_CGROUPCOND, $2);
+        }
+        | CGROUP '=' CGROUPCOND
+        {
+		$$ = alloc_node(SSF_CGROUPCOND, $3);
+        }
+        | CGROUP NEQ CGROUPCOND
+        {
+		$$ = alloc_node(SSF_NOT, alloc_node(SSF_CGROUPCOND, $3));
+        }
         | expr '|' expr
         {
                 $$ = alloc_node(SSF_OR, $1);
@@ -252,6 +293,45 @@ int yylex(void)
 		return '<';
 	if (strcmp(curtok, "autobound") == 0)
 		return AUTOBOUND;
+	if (strcmp(curtok, "dev") == 0) {
+		tok_type = DEVNAME;
+		return DEVNAME;
+	}
+	if (strcmp(curtok, "fwmark") == 0) {
+		tok_type = FWMARK;
+		return FWMARK;
+	}
+	if (strcmp(curtok, "cgroup") == 0) {
+		tok_type = CGROUP;
+		return CGROUP;
+	}
+	if (tok_type == DEVNAME) {
+		tok_type = -1;
+		yylval = (void*)parse_devcond(curtok);
+		if (yylval == NULL) {
+			fprintf(stderr, "Cannot find device \"%s\".\n", curtok);
+			exit(1);
+		}
+		return DEVCOND;
+	}
+	if (tok_type == FWMARK) {
+		tok_type = -1;
+		yylval = (void*)parse_markmask(curtok);
+		if (yylval == NULL) {
+			fprintf(stderr, "Cannot parse fwmark \"%s\".\n", curtok);
+			exit(1);
+		}
+		return MARKMASK;
+	}
+	if (tok_type == CGROUP) {
+		tok_type = -1;
+		yylval = (void*)parse_cgroupcond(curtok);
+		if (yylval == NULL) {
+			fprintf(stderr, "Cannot find cgroup \"%s\".\n", curtok);
+			exit(1);
+		}
+		return CGROUPCOND;
+	}
 	yylval = (void*)parse_hostcond(curtok);
 	if (yylval == NULL) {
 		fprintf(stderr, "Cannot parse dst/src address.\n");
@@ -271,5 +351,7 @@ int ssfilter_parse(struct ssfilter **f, int argc, char **argv, FILE *fp)
 		fprintf(stderr, " Sorry.\n");
 		return -1;
 	}
+	if (ssfilter_resolve_hosts())
+		exit(1);
 	return 0;
 }
@@ -0,0 +1,146 @@
+/*
+ * stathist.c	Binary history files of ifstat and nstat.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stathist.h"
+
+/* Returns 1 if fd is a valid binary history, now mapped, 0 if it is
+ * not a binary history, -1 if it is one but damaged.
+ */
+int stathist_map(struct stathist *h, int fd, __u32 recsize)
+{
+	const struct stathist_hdr *hdr;
+	struct stat stb;
+	void *p;
+
+	__u32 magic;
+
+	memset(h, 0, sizeof(*h));
+	if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+	    magic != STATHIST_MAGIC)
+		return 0;
+	if (fstat(fd, &stb) < 0 || stb.st_size < sizeof(*hdr))
+		return -1;
+	p = mmap(NULL, stb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	hdr = p;
+	if (hdr->version != STATHIST_VERSION || hdr->recsize != recsize ||
+	    sizeof(*hdr) + (__u64)hdr->count * recsize + hdr->names !=
+	    stb.st_size ||
+	    (hdr->names && ((char *)p)[stb.st_size - 1] != 0) ||
+	    memchr(hdr->info, 0, sizeof(hdr->info)) == NULL) {
+		munmap(p, stb.st_size);
+		return -1;
+	}
+	h->hdr = hdr;
+	h->maplen = stb.st_size;
+	return 1;
+}
+
+/* Record i and its name, NULL if the record names nothing valid */
+const void *stathist_rec(const struct stathist *h, __u32 i, const char **name)
+{
+	const char *rec = (const char *)(h->hdr + 1) + i * h->hdr->recsize;
+	__u32 off = *(const __u32 *)rec;
+
+	if (off >= h->hdr->names)
+		return NULL;
+	*name = (const char *)(h->hdr + 1) +
+		h->hdr->count * h->hdr->recsize + off;
+	return rec;
+}
+
+void stathist_unmap(struct stathist *h)
+{
+	if (h->hdr)
+		munmap((void *)h->hdr, h->maplen);
+	h->hdr = NULL;
+}
+
+void stathist_out_init(struct stathist_out *o, __u32 recsize)
+{
+	memset(o, 0, sizeof(*o));
+	o->recsize = recsize;
+}
+
+static void *grow(char *buf, size_t *max, size_t need)
+{
+	if (need <= *max)
+		return buf;
+	*max = *max ? *max * 2 : 4096;
+	if (*max < need)
+		*max = need;
+	buf = realloc(buf, *max);
+	if (buf == NULL)
+		abort();
+	return buf;
+}
+
+/* A zeroed record named name, to be filled before the next call */
+void *stathist_out_rec(struct stathist_out *o, const char *name)
+{
+	size_t len = strlen(name) + 1;
+	char *rec;
+
+	o->recs = grow(o->recs, &o->recmax, o->reclen + o->recsize);
+	o->names = grow(o->names, &o->namemax, o->namelen + len);
+
+	rec = o->recs + o->reclen;
+	memset(rec, 0, o->recsize);
+	*(__u32 *)rec = o->namelen;
+	memcpy(o->names + o->namelen, name, len);
+	o->reclen += o->recsize;
+	o->namelen += len;
+	o->count++;
+	return rec;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0)
+			return -1;
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Replace the contents of fd with the records and free them */
+int stathist_out_write(struct stathist_out *o, int fd, const char *info)
+{
+	struct stathist_hdr hdr = {
+		.magic = STATHIST_MAGIC,
+		.version = STATHIST_VERSION,
+		.recsize = o->recsize,
+		.count = o->count,
+		.names = o->namelen,
+	};
+	int err;
+
+	strncpy(hdr.info, info, sizeof(hdr.info) - 1);
+	err = ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0 ||
+	      write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+	      write_all(fd, o->recs, o->reclen) < 0 ||
+	      write_all(fd, o->names, o->namelen) < 0;
+	free(o->recs);
+	free(o->names);
+	stathist_out_init(o, o->recsize);
+	return err ? -1 : 0;
+}
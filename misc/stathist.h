@@ -0,0 +1,54 @@
+#ifndef _STATHIST_H
+#define _STATHIST_H
+
+#include <stddef.h>
+#include <asm/types.h>
+
+/*
+ * Binary history files of ifstat and nstat: a header, count records of
+ * recsize bytes and a dictionary of NUL terminated names.  Each record
+ * starts with the __u32 offset of its name in the dictionary; the rest
+ * of the layout belongs to the tool.  The file is used as it is mapped,
+ * nothing is parsed.  Files without the magic are read as text.
+ */
+#define STATHIST_MAGIC		0x48545348	/* "HSTH" */
+#define STATHIST_VERSION	1
+
+struct stathist_hdr
+{
+	__u32	magic;
+	__u32	version;
+	__u32	recsize;
+	__u32	count;
+	__u32	names;		/* bytes of the dictionary */
+	__u32	pad;
+	char	info[128];	/* info_source of the counters */
+};
+
+struct stathist
+{
+	const struct stathist_hdr *hdr;
+	size_t			maplen;
+};
+
+extern int stathist_map(struct stathist *h, int fd, __u32 recsize);
+extern const void *stathist_rec(const struct stathist *h, __u32 i,
+				const char **name);
+extern void stathist_unmap(struct stathist *h);
+
+struct stathist_out
+{
+	char	*recs;
+	size_t	reclen, recmax;
+	char	*names;
+	size_t	namelen, namemax;
+	__u32	recsize;
+	__u32	count;
+};
+
+extern void stathist_out_init(struct stathist_out *o, __u32 recsize);
+extern void *stathist_out_rec(struct stathist_out *o, const char *name);
+extern int stathist_out_write(struct stathist_out *o, int fd,
+			      const char *info);
+
+#endif
@@ -0,0 +1,1047 @@
+/*
+ * tcstat.c	ifstat for qdiscs and classes.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <fnmatch.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <math.h>
+#include <getopt.h>
+
+#include <libnetlink.h>
+#include <ll_map.h>
+#include <linux/if.h>
+#include <linux/gen_stats.h>
+#include <linux/pkt_sched.h>
+
+#include <SNAPSHOT.h>
+
+#include "shmstat.h"
+#include "stathist.h"
+
+int dump_zeros = 0;
+int reset_history = 0;
+int ignore_history = 0;
+int no_output = 0;
+int no_update = 0;
+int scan_interval = 0;
+int time_constant = 0;
+double W;
+char **patterns;
+int npatterns;
+
+char info_source[128];
+int source_mismatch;
+
+/* bytes, packets, drops, overlimits and requeues only ever grow;
+ * backlog and qlen are the current queue and are not summed up.
+ */
+#define MAXS		7
+#define NCOUNTERS	5
+#define S_BYTES		0
+#define S_PACKETS	1
+#define S_DROPS		2
+#define S_OVERLIMITS	3
+#define S_REQUEUES	4
+#define S_BACKLOG	5
+#define S_QLEN		6
+
+#define TCSTAT_HASH	65536
+#define TCSTAT_NAMSIZ	(IFNAMSIZ + 16)
+
+/* A qdisc (minor 0) or class of a device, named DEV/HANDLE */
+struct tcstat_ent
+{
+	struct tcstat_ent	*next;
+	struct tcstat_ent	*hash;
+	char			*name;
+	int			ifindex;
+	__u32			handle;
+	int			gen;
+	unsigned long long	val[MAXS];
+	double			rate[MAXS];
+	__u64			ival[MAXS];
+};
+
+struct tcstat_ent *kern_db;
+struct tcstat_ent *hist_db;
+
+/* The daemon keeps its entries across samples, found by device and
+ * handle; every sample dumps all qdiscs and then the classes of each
+ * device that has a qdisc, and drops what the dumps no longer show.
+ */
+static struct tcstat_ent *kern_hash[TCSTAT_HASH];
+static struct tcstat_ent *hist_hash[TCSTAT_HASH];
+static struct tcstat_ent **kern_tail = &kern_db;
+static int kern_gen;
+static struct rtnl_handle dump_rth;
+static struct shmstat *shm;
+static int *devs;
+static int ndevs, maxdevs;
+
+/* A kern_db entry as the daemon publishes it in shared memory */
+struct tcstat_shm_ent
+{
+	int			ifindex;
+	__u32			handle;
+	char			name[TCSTAT_NAMSIZ];
+	unsigned long long	val[MAXS];
+	double			rate[MAXS];
+};
+
+RTATTR_TABLE(tc_tb, TCA_MAX);
+RTATTR_TABLE(stats_tb, TCA_STATS_MAX);
+
+static int match(const char *id)
+{
+	int i;
+
+	if (npatterns == 0)
+		return 1;
+
+	for (i=0; i<npatterns; i++) {
+		if (!fnmatch(patterns[i], id, 0))
+			return 1;
+	}
+	return 0;
+}
+
+static unsigned int tcstat_hash(int ifindex, __u32 handle)
+{
+	return (handle + (handle >> 16) * 31 + ifindex * 1021) &
+		(TCSTAT_HASH-1);
+}
+
+static struct tcstat_ent *db_lookup(struct tcstat_ent **hash, int ifindex,
+				    __u32 handle)
+{
+	struct tcstat_ent *n;
+
+	for (n = hash[tcstat_hash(ifindex, handle)]; n; n = n->hash)
+		if (n->ifindex == ifindex && n->handle == handle)
+			return n;
+	return NULL;
+}
+
+static void db_hash(struct tcstat_ent **hash, struct tcstat_ent *n)
+{
+	struct tcstat_ent **h = &hash[tcstat_hash(n->ifindex, n->handle)];
+
+	n->hash = *h;
+	*h = n;
+}
+
+static void kern_unhash(struct tcstat_ent *n)
+{
+	struct tcstat_ent **h = &kern_hash[tcstat_hash(n->ifindex, n->handle)];
+
+	for (; *h; h = &(*h)->hash) {
+		if (*h == n) {
+			*h = n->hash;
+			break;
+		}
+	}
+}
+
+/* Drop the entries the last dumps did not show */
+static void kern_sweep(void)
+{
+	struct tcstat_ent **np = &kern_db;
+
+	while (*np) {
+		struct tcstat_ent *n = *np;
+
+		if (n->gen == kern_gen) {
+			np = &n->next;
+			continue;
+		}
+		kern_unhash(n);
+		*np = n->next;
+		free(n->name);
+		free(n);
+	}
+	kern_tail = np;
+}
+
+/* Kernels may send more or less than the structure we know about */
+static void get_struct(void *p, size_t size, const struct rtattr *rta)
+{
+	memset(p, 0, size);
+	memcpy(p, RTA_DATA(rta),
+	       RTA_PAYLOAD(rta) < size ? RTA_PAYLOAD(rta) : size);
+}
+
+/* The counters of a qdisc or class message, from TCA_STATS2 or the
+ * older TCA_STATS.
+ */
+static int get_counters(__u64 *ival, struct rtattr *tb[])
+{
+	struct gnet_stats_basic bs = {0};
+	struct gnet_stats_queue q = {0};
+
+	if (tb[TCA_STATS2]) {
+		struct rtattr **tbs;
+
+		tbs = parse_rtattr_table_nested(&stats_tb, tb[TCA_STATS2]);
+		if (tbs[TCA_STATS_BASIC] == NULL)
+			return -1;
+		get_struct(&bs, sizeof(bs), tbs[TCA_STATS_BASIC]);
+		if (tbs[TCA_STATS_QUEUE])
+			get_struct(&q, sizeof(q), tbs[TCA_STATS_QUEUE]);
+	} else if (tb[TCA_STATS]) {
+		struct tc_stats st;
+
+		get_struct(&st, sizeof(st), tb[TCA_STATS]);
+		bs.bytes = st.bytes;
+		bs.packets = st.packets;
+		q.drops = st.drops;
+		q.overlimits = st.overlimits;
+		q.backlog = st.backlog;
+		q.qlen = st.qlen;
+	} else
+		return -1;
+
+	ival[S_BYTES] = bs.bytes;
+	ival[S_PACKETS] = bs.packets;
+	ival[S_DROPS] = q.drops;
+	ival[S_OVERLIMITS] = q.overlimits;
+	ival[S_REQUEUES] = q.requeues;
+	ival[S_BACKLOG] = q.backlog;
+	ival[S_QLEN] = q.qlen;
+	return 0;
+}
+
+static void format_name(char *buf, int ifindex, __u32 handle)
+{
+	const char *dev = ll_index_to_name(ifindex);
+
+	if (TC_H_MIN(handle))
+		snprintf(buf, TCSTAT_NAMSIZ, "%s/%x:%x", dev,
+			 TC_H_MAJ(handle)>>16, TC_H_MIN(handle));
+	else
+		snprintf(buf, TCSTAT_NAMSIZ, "%s/%x:", dev,
+			 TC_H_MAJ(handle)>>16);
+}
+
+static struct tcstat_ent *new_ent(int ifindex, __u32 handle,
+				  const char *name, const __u64 *ival)
+{
+	struct tcstat_ent *n;
+	int i;
+
+	n = malloc(sizeof(*n));
+	if (!n)
+		abort();
+	n->next = n->hash = NULL;
+	n->gen = kern_gen;
+	n->ifindex = ifindex;
+	n->handle = handle;
+	n->name = strdup(name);
+	memcpy(&n->ival, ival, sizeof(n->ival));
+	memset(&n->rate, 0, sizeof(n->rate));
+	for (i=0; i<MAXS; i++)
+		n->val[i] = n->ival[i];
+	return n;
+}
+
+/* A counter that went back means the object was created again, unless
+ * it is a 32 bit one that wrapped while the bytes went on.
+ */
+static void sample_ent(struct tcstat_ent *n, const __u64 *ival, int interval)
+{
+	int i;
+
+	if (ival[S_BYTES] < n->ival[S_BYTES])
+		memset(n->ival, 0, sizeof(n->ival));
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		double sample;
+		unsigned long long incr = ival[i] - n->ival[i];
+
+		if (i != S_BYTES)
+			incr = (__u32)incr;
+		n->val[i] += incr;
+		n->ival[i] = ival[i];
+		sample = (double)(incr*1000)/interval;
+		if (interval >= scan_interval) {
+			n->rate[i] += W*(sample-n->rate[i]);
+		} else if (interval >= 1000) {
+			if (interval >= time_constant) {
+				n->rate[i] = sample;
+			} else {
+				double w = W*(double)interval/scan_interval;
+				n->rate[i] += w*(sample-n->rate[i]);
+			}
+		}
+	}
+	for (; i < MAXS; i++)
+		n->val[i] = n->ival[i] = ival[i];
+}
+
+static void note_dev(int ifindex)
+{
+	if (ndevs && devs[ndevs-1] == ifindex)
+		return;
+	if (ndevs == maxdevs) {
+		maxdevs = maxdevs ? maxdevs * 2 : 64;
+		devs = realloc(devs, maxdevs * sizeof(*devs));
+		if (devs == NULL)
+			abort();
+	}
+	devs[ndevs++] = ifindex;
+}
+
+/* A qdisc or class of a dump: add or sample its entry */
+static int update_ent(const struct sockaddr_nl *who,
+		      struct nlmsghdr *m, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(m);
+	int len = m->nlmsg_len;
+	int interval = *(int *)arg;
+	char name[TCSTAT_NAMSIZ];
+	struct rtattr **tb;
+	struct tcstat_ent *n;
+	__u32 handle = t->tcm_handle;
+	__u64 ival[MAXS];
+
+	if (m->nlmsg_type != RTM_NEWQDISC && m->nlmsg_type != RTM_NEWTCLASS)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*t));
+	if (len < 0)
+		return -1;
+	if (m->nlmsg_type == RTM_NEWQDISC) {
+		note_dev(t->tcm_ifindex);
+		handle = TC_H_MAJ(handle);
+	}
+
+	tb = parse_rtattr_table(&tc_tb, TCA_RTA(t), len);
+	if (get_counters(ival, tb) < 0)
+		return 0;
+
+	n = db_lookup(kern_hash, t->tcm_ifindex, handle);
+	format_name(name, t->tcm_ifindex, handle);
+	if (n == NULL) {
+		n = new_ent(t->tcm_ifindex, handle, name, ival);
+		db_hash(kern_hash, n);
+		*kern_tail = n;
+		kern_tail = &n->next;
+		return 0;
+	}
+	/* Unattached default qdiscs all have handle 0 */
+	if (n->gen == kern_gen)
+		return 0;
+	if (strcmp(n->name, name)) {
+		free(n->name);
+		n->name = strdup(name);
+	}
+	if (interval)
+		sample_ent(n, ival, interval);
+	n->gen = kern_gen;
+	return 0;
+}
+
+/* One sample of every qdisc and class; interval 0 only loads them */
+void update_db(int interval)
+{
+	struct tcmsg t;
+	int i;
+
+	kern_gen++;
+	ndevs = 0;
+
+	if (rtnl_wilddump_request(&dump_rth, AF_UNSPEC, RTM_GETLINK) < 0 ||
+	    rtnl_dump_filter(&dump_rth, ll_remember_index, NULL) < 0)
+		goto fail;
+
+	memset(&t, 0, sizeof(t));
+	t.tcm_family = AF_UNSPEC;
+	if (rtnl_dump_request(&dump_rth, RTM_GETQDISC, &t, sizeof(t)) < 0 ||
+	    rtnl_dump_filter(&dump_rth, update_ent, &interval) < 0)
+		goto fail;
+
+	for (i = 0; i < ndevs; i++) {
+		t.tcm_ifindex = devs[i];
+		if (rtnl_dump_request(&dump_rth, RTM_GETTCLASS, &t, sizeof(t)) < 0 ||
+		    rtnl_dump_filter(&dump_rth, update_ent, &interval) < 0)
+			goto fail;
+	}
+
+	kern_sweep();
+	return;
+
+fail:
+	fprintf(stderr, "Dump terminated\n");
+	exit(1);
+}
+
+void load_info(void)
+{
+	if (rtnl_open(&dump_rth, 0) < 0)
+		exit(1);
+	update_db(0);
+}
+
+void load_raw_table(FILE *fp)
+{
+	char buf[4096];
+	struct tcstat_ent **tail = &kern_db;
+	struct tcstat_ent *n;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		char *p;
+		char *next;
+		int i;
+
+		if (buf[0] == '#') {
+			buf[strlen(buf)-1] = 0;
+			if (info_source[0] && strcmp(info_source, buf+1))
+				source_mismatch = 1;
+			snprintf(info_source, sizeof(info_source), "%.*s",
+				 (int)sizeof(info_source) - 1, buf+1);
+			continue;
+		}
+		if ((n = malloc(sizeof(*n))) == NULL)
+			abort();
+
+		if (sscanf(buf, "%d %x", &n->ifindex, &n->handle) != 2)
+			abort();
+		if (!(p = strchr(buf, ' ')) || !(p = strchr(p+1, ' ')))
+			abort();
+		p++;
+		if (!(next = strchr(p, ' ')))
+			abort();
+		*next++ = 0;
+
+		n->name = strdup(p);
+		p = next;
+
+		for (i=0; i<MAXS; i++) {
+			unsigned rate;
+			if (!(next = strchr(p, ' ')))
+				abort();
+			*next++ = 0;
+			if (sscanf(p, "%llu", n->val+i) != 1)
+				abort();
+			n->ival[i] = n->val[i];
+			p = next;
+			if (!(next = strchr(p, ' ')))
+				abort();
+			*next++ = 0;
+			if (sscanf(p, "%u", &rate) != 1)
+				abort();
+			n->rate[i] = rate;
+			p = next;
+		}
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+}
+
+/* A kern_db entry in the binary history file */
+struct tcstat_hist_ent
+{
+	__u32			name;
+	int			ifindex;
+	__u32			handle;
+	__u32			pad;
+	unsigned long long	val[MAXS];
+	double			rate[MAXS];
+};
+
+static struct stathist hist_map;
+
+/* Returns 1 if the history was binary and is loaded, see stathist_map() */
+static int load_hist_table(int fd)
+{
+	struct tcstat_ent **tail = &kern_db;
+	__u32 i;
+	int err;
+
+	err = stathist_map(&hist_map, fd, sizeof(struct tcstat_hist_ent));
+	if (err <= 0)
+		return err;
+
+	strcpy(info_source, hist_map.hdr->info);
+	for (i = 0; i < hist_map.hdr->count; i++) {
+		const struct tcstat_hist_ent *e;
+		struct tcstat_ent *n;
+		const char *name;
+		int k;
+
+		if ((e = stathist_rec(&hist_map, i, &name)) == NULL)
+			continue;
+		if ((n = malloc(sizeof(*n))) == NULL)
+			abort();
+		n->ifindex = e->ifindex;
+		n->handle = e->handle;
+		n->name = (char *)name;
+		memcpy(n->val, e->val, sizeof(n->val));
+		memcpy(n->rate, e->rate, sizeof(n->rate));
+		for (k=0; k<MAXS; k++)
+			n->ival[k] = n->val[k];
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+	return 1;
+}
+
+static void hash_hist_db(void)
+{
+	struct tcstat_ent *h;
+
+	for (h = hist_db; h; h = h->next)
+		db_hash(hist_hash, h);
+}
+
+/* The history; entries not matching the patterns keep their old values */
+static int write_hist_db(int fd)
+{
+	struct stathist_out o;
+	struct tcstat_ent *n;
+
+	stathist_out_init(&o, sizeof(struct tcstat_hist_ent));
+	for (n = kern_db; n; n = n->next) {
+		struct tcstat_hist_ent *e;
+		unsigned long long *vals = n->val;
+		double *rates = n->rate;
+
+		if (!match(n->name)) {
+			struct tcstat_ent *h1;
+
+			h1 = db_lookup(hist_hash, n->ifindex, n->handle);
+			if (h1) {
+				vals = h1->val;
+				rates = h1->rate;
+			}
+		}
+		e = stathist_out_rec(&o, n->name);
+		e->ifindex = n->ifindex;
+		e->handle = n->handle;
+		e->pad = 0;
+		memcpy(e->val, vals, sizeof(e->val));
+		memcpy(e->rate, rates, sizeof(e->rate));
+	}
+	return stathist_out_write(&o, fd, info_source);
+}
+
+void dump_raw_db(FILE *fp)
+{
+	struct tcstat_ent *n;
+
+	fprintf(fp, "#%s\n", info_source);
+	for (n=kern_db; n; n=n->next) {
+		int i;
+
+		fprintf(fp, "%d %x %s ", n->ifindex, n->handle, n->name);
+		for (i=0; i<MAXS; i++)
+			fprintf(fp, "%llu %u ", n->val[i], (unsigned)n->rate[i]);
+		fprintf(fp, "\n");
+	}
+}
+
+/* use communication definitions of meg/kilo etc */
+static const unsigned long long giga = 1000000000ull;
+static const unsigned long long mega = 1000000;
+static const unsigned long long kilo = 1000;
+
+void format_rate(FILE *fp, unsigned long long *vals, double *rates, int i)
+{
+	char temp[64];
+	if (vals[i] > giga)
+		fprintf(fp, "%7lluM ", vals[i]/mega);
+	else if (vals[i] > mega)
+		fprintf(fp, "%7lluK ", vals[i]/kilo);
+	else
+		fprintf(fp, "%8llu ", vals[i]);
+
+	if (rates[i] > mega) {
+		sprintf(temp, "%uM", (unsigned)(rates[i]/mega));
+		fprintf(fp, "%-6s ", temp);
+	} else if (rates[i] > kilo) {
+		sprintf(temp, "%uK", (unsigned)(rates[i]/kilo));
+		fprintf(fp, "%-6s ", temp);
+	} else
+		fprintf(fp, "%-6u ", (unsigned)rates[i]);
+}
+
+void print_head(FILE *fp)
+{
+	fprintf(fp, "#%s\n", info_source);
+	fprintf(fp, "%-24s ", "Qdisc/Class");
+	fprintf(fp, "%8s/%-6s ", "Pkts", "Rate");
+	fprintf(fp, "%8s/%-6s ", "Bytes", "Rate");
+	fprintf(fp, "%8s/%-6s ", "Drops", "Rate");
+	fprintf(fp, "%8s/%-6s ", "Overlim", "Rate");
+	fprintf(fp, "%8s %6s\n", "Backlog", "Qlen");
+}
+
+void print_one(FILE *fp, struct tcstat_ent *n, unsigned long long *vals)
+{
+	fprintf(fp, "%-24s ", n->name);
+	format_rate(fp, vals, n->rate, S_PACKETS);
+	format_rate(fp, vals, n->rate, S_BYTES);
+	format_rate(fp, vals, n->rate, S_DROPS);
+	format_rate(fp, vals, n->rate, S_OVERLIMITS);
+	fprintf(fp, "%8llu %6llu\n", vals[S_BACKLOG], vals[S_QLEN]);
+}
+
+static int zero_ent(struct tcstat_ent *n, unsigned long long *vals)
+{
+	int i;
+
+	for (i = 0; i < MAXS; i++)
+		if (vals[i] || (unsigned)n->rate[i])
+			return 0;
+	return 1;
+}
+
+void dump_kern_db(FILE *fp)
+{
+	struct tcstat_ent *n;
+
+	print_head(fp);
+
+	for (n=kern_db; n; n=n->next) {
+		if (!match(n->name))
+			continue;
+		if (!dump_zeros && zero_ent(n, n->val))
+			continue;
+		print_one(fp, n, n->val);
+	}
+}
+
+void dump_incr_db(FILE *fp)
+{
+	struct tcstat_ent *n;
+
+	print_head(fp);
+
+	for (n=kern_db; n; n=n->next) {
+		int i;
+		unsigned long long vals[MAXS];
+		struct tcstat_ent *h1;
+
+		if (!match(n->name))
+			continue;
+		memcpy(vals, n->val, sizeof(vals));
+		h1 = db_lookup(hist_hash, n->ifindex, n->handle);
+		if (h1) {
+			for (i = 0; i < NCOUNTERS; i++)
+				vals[i] -= h1->val[i];
+		}
+		if (!dump_zeros && zero_ent(n, vals))
+			continue;
+		print_one(fp, n, vals);
+	}
+}
+
+
+static int children;
+
+void sigchild(int signo)
+{
+}
+
+void sigterm(int signo)
+{
+	shmstat_destroy(shm);
+	_exit(0);
+}
+
+static void publish_db(void)
+{
+	struct tcstat_shm_ent *e;
+	struct tcstat_ent *n;
+	size_t cnt = 0;
+
+	if (shm == NULL)
+		return;
+	for (n = kern_db; n; n = n->next)
+		cnt++;
+	if ((e = shmstat_begin(shm, cnt * sizeof(*e))) == NULL)
+		return;
+	for (n = kern_db; n; n = n->next, e++) {
+		e->ifindex = n->ifindex;
+		e->handle = n->handle;
+		memset(e->name, 0, sizeof(e->name));
+		strncpy(e->name, n->name, sizeof(e->name) - 1);
+		memcpy(e->val, n->val, sizeof(e->val));
+		memcpy(e->rate, n->rate, sizeof(e->rate));
+	}
+	shmstat_end(shm);
+}
+
+/* The table of a running daemon, from its shared memory segment */
+static int load_shm_db(void)
+{
+	struct tcstat_ent **tail = &kern_db;
+	struct tcstat_shm_ent *tbl;
+	char info[sizeof(info_source)];
+	char name[64];
+	size_t len, i;
+
+	shmstat_name(name, sizeof(name), "tcstat", getuid());
+	tbl = shmstat_read(name, &len, info, sizeof(info));
+	if (tbl == NULL && getuid()) {
+		shmstat_name(name, sizeof(name), "tcstat", 0);
+		tbl = shmstat_read(name, &len, info, sizeof(info));
+	}
+	if (tbl == NULL)
+		return -1;
+
+	if (info_source[0] && strcmp(info_source, info))
+		source_mismatch = 1;
+	strcpy(info_source, info);
+
+	for (i = 0; i < len / sizeof(*tbl); i++) {
+		struct tcstat_ent *n = malloc(sizeof(*n));
+		int k;
+
+		if (!n)
+			abort();
+		n->ifindex = tbl[i].ifindex;
+		n->handle = tbl[i].handle;
+		n->name = strdup(tbl[i].name);
+		memcpy(n->val, tbl[i].val, sizeof(n->val));
+		memcpy(n->rate, tbl[i].rate, sizeof(n->rate));
+		for (k=0; k<MAXS; k++)
+			n->ival[k] = n->val[k];
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+	free(tbl);
+	return 0;
+}
+
+#define T_DIFF(a,b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
+
+
+void server_loop(int fd)
+{
+	char name[64];
+
+	struct timeval snaptime = { 0 };
+	struct pollfd p;
+	p.fd = fd;
+	p.events = p.revents = POLLIN;
+
+	sprintf(info_source, "%d.%lu sampling_interval=%d time_const=%d",
+		getpid(), (unsigned long)random(), scan_interval/1000, time_constant/1000);
+
+	load_info();
+
+	shmstat_name(name, sizeof(name), "tcstat", getuid());
+	shm = shmstat_create(name, info_source);
+	publish_db();
+
+	for (;;) {
+		int status;
+		int tdiff;
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		tdiff = T_DIFF(now, snaptime);
+		if (tdiff >= scan_interval) {
+			update_db(tdiff);
+			publish_db();
+			snaptime = now;
+			tdiff = 0;
+		}
+
+		if (poll(&p, 1, tdiff + scan_interval) > 0
+		    && (p.revents&POLLIN)) {
+			int clnt = accept(fd, NULL, NULL);
+			if (clnt >= 0) {
+				pid_t pid;
+				if (children >= 5) {
+					close(clnt);
+				} else if ((pid = fork()) != 0) {
+					if (pid>0)
+						children++;
+					close(clnt);
+				} else {
+					FILE *fp = fdopen(clnt, "w");
+					if (fp) {
+						if (tdiff > 0) {
+							/* Leave the parent's
+							 * socket alone */
+							if (rtnl_open(&dump_rth, 0) < 0)
+								exit(1);
+							update_db(tdiff);
+						}
+						dump_raw_db(fp);
+					}
+					exit(0);
+				}
+			}
+		}
+		while (children && waitpid(-1, &status, WNOHANG) > 0)
+			children--;
+	}
+}
+
+int verify_forging(int fd)
+{
+	struct ucred cred;
+	socklen_t olen = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, (void*)&cred, &olen) ||
+	    olen < sizeof(cred))
+		return -1;
+	if (cred.uid == getuid() || cred.uid == 0)
+		return 0;
+	return -1;
+}
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: tcstat [OPTION] [ PATTERN [ PATTERN ] ]\n"
+"   -h, --help		this message\n"
+"   -a, --ignore	ignore history\n"
+"   -d, --scan=SECS	sample every statistics every SECS\n"
+"   -n, --nooutput	do history only\n"
+"   -r, --reset		reset history\n"
+"   -s, --noupdate	don't update history\n"
+"   -t, --interval=SECS	report average over the last SECS\n"
+"   -V, --version	output version information\n"
+"   -z, --zeros		show entries with zero activity\n");
+
+	exit(-1);
+}
+
+static const struct option longopts[] = {
+	{ "help", 0, 0, 'h' },
+	{ "ignore",  0,  0, 'a' },
+	{ "scan", 1, 0, 'd'},
+	{ "nooutput", 0, 0, 'n' },
+	{ "reset", 0, 0, 'r' },
+	{ "noupdate", 0, 0, 's' },
+	{ "interval", 1, 0, 't' },
+	{ "version", 0, 0, 'V' },
+	{ "zeros", 0, 0, 'z' },
+	{ 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	char hist_name[128];
+	struct sockaddr_un sun;
+	FILE *hist_fp = NULL;
+	char *end;
+	int ch;
+	int fd;
+
+	while ((ch = getopt_long(argc, argv, "hvVzrnasd:t:",
+			longopts, NULL)) != EOF) {
+		switch(ch) {
+		case 'z':
+			dump_zeros = 1;
+			break;
+		case 'r':
+			reset_history = 1;
+			break;
+		case 'a':
+			ignore_history = 1;
+			break;
+		case 's':
+			no_update = 1;
+			break;
+		case 'n':
+			no_output = 1;
+			break;
+		case 'd':
+			scan_interval = strtod(optarg, &end) * 1000;
+			if (*end || scan_interval <= 0) {
+				fprintf(stderr, "tcstat: invalid scan interval\n");
+				exit(-1);
+			}
+			break;
+		case 't':
+			time_constant = atoi(optarg);
+			if (time_constant <= 0) {
+				fprintf(stderr, "tcstat: invalid time constant divisor\n");
+				exit(-1);
+			}
+			break;
+		case 'v':
+		case 'V':
+			printf("tcstat utility, iproute2-ss%s\n", SNAPSHOT);
+			exit(0);
+		case 'h':
+		case '?':
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	sun.sun_family = AF_UNIX;
+	sun.sun_path[0] = 0;
+	sprintf(sun.sun_path+1, "tcstat%d", getuid());
+
+	if (scan_interval > 0) {
+		if (time_constant == 0)
+			time_constant = 60;
+		time_constant *= 1000;
+		W = 1 - 1/exp(log(10)*(double)scan_interval/time_constant);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+			perror("tcstat: socket");
+			exit(-1);
+		}
+		if (bind(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) < 0) {
+			perror("tcstat: bind");
+			exit(-1);
+		}
+		if (listen(fd, 5) < 0) {
+			perror("tcstat: listen");
+			exit(-1);
+		}
+		if (daemon(0, 0)) {
+			perror("tcstat: daemon");
+			exit(-1);
+		}
+		signal(SIGPIPE, SIG_IGN);
+		signal(SIGCHLD, sigchild);
+		signal(SIGTERM, sigterm);
+		signal(SIGINT, sigterm);
+		server_loop(fd);
+		exit(0);
+	}
+
+	patterns = argv;
+	npatterns = argc;
+
+	if (getenv("TCSTAT_HISTORY"))
+		snprintf(hist_name, sizeof(hist_name),
+			 "%s", getenv("TCSTAT_HISTORY"));
+	else
+		snprintf(hist_name, sizeof(hist_name),
+			 "%s/.tcstat.u%d", P_tmpdir, getuid());
+
+	if (reset_history)
+		unlink(hist_name);
+
+	if (!ignore_history || !no_update) {
+		struct stat stb;
+
+		fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
+		if (fd < 0) {
+			perror("tcstat: open history file");
+			exit(-1);
+		}
+		if ((hist_fp = fdopen(fd, "r+")) == NULL) {
+			perror("tcstat: fdopen history file");
+			exit(-1);
+		}
+		if (flock(fileno(hist_fp), LOCK_EX)) {
+			perror("tcstat: flock history file");
+			exit(-1);
+		}
+		if (fstat(fileno(hist_fp), &stb) != 0) {
+			perror("tcstat: fstat history file");
+			exit(-1);
+		}
+		if (stb.st_nlink != 1 || stb.st_uid != getuid()) {
+			fprintf(stderr, "tcstat: something is so wrong with history file, that I prefer not to proceed.\n");
+			exit(-1);
+		}
+		if (!ignore_history) {
+			FILE *tfp;
+			long uptime = -1;
+			if ((tfp = fopen("/proc/uptime", "r")) != NULL) {
+				if (fscanf(tfp, "%ld", &uptime) != 1)
+					uptime = -1;
+				fclose(tfp);
+			}
+			if (uptime >= 0 && time(NULL) >= stb.st_mtime+uptime) {
+				fprintf(stderr, "tcstat: history is aged out, resetting\n");
+				ftruncate(fileno(hist_fp), 0);
+			}
+		}
+
+		switch (load_hist_table(fileno(hist_fp))) {
+		case 0:
+			load_raw_table(hist_fp);
+			break;
+		case -1:
+			fprintf(stderr, "tcstat: history file is damaged, resetting\n");
+			break;
+		}
+
+		hist_db = kern_db;
+		kern_db = NULL;
+	}
+
+	if (load_shm_db() == 0) {
+		if (hist_db && source_mismatch) {
+			fprintf(stderr, "tcstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	    (connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0
+	     || (strcpy(sun.sun_path+1, "tcstat0"),
+		 connect(fd, (struct sockaddr*)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
+	    && verify_forging(fd) == 0) {
+		FILE *sfp = fdopen(fd, "r");
+		load_raw_table(sfp);
+		if (hist_db && source_mismatch) {
+			fprintf(stderr, "tcstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+		fclose(sfp);
+	} else {
+		if (fd >= 0)
+			close(fd);
+		if (hist_db && info_source[0] && strcmp(info_source, "kernel")) {
+			fprintf(stderr, "tcstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+			info_source[0] = 0;
+		}
+		load_info();
+		if (info_source[0] == 0)
+			strcpy(info_source, "kernel");
+	}
+	hash_hist_db();
+
+	if (!no_output) {
+		if (ignore_history || hist_db == NULL)
+			dump_kern_db(stdout);
+		else
+			dump_incr_db(stdout);
+	}
+	if (!no_update) {
+		if (write_hist_db(fileno(hist_fp)) < 0) {
+			perror("tcstat: write history file");
+			exit(-1);
+		}
+	}
+	exit(0);
+}
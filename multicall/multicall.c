@@ -0,0 +1,98 @@
+/*
+ * multicall.c		ip, tc, ss, genl, ifstat and nstat in one binary.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Each program is linked in whole, with its main() renamed to
+ * <name>_main and its other symbols made local, so the programs cannot
+ * see each other.  The program run is the one the binary is called as,
+ * through a link named after it; "iproute2 tc ..." runs tc as well.
+ * Names starting with "ip" run ip, which takes the rest of the name
+ * as its object, as iplink or ipaddr do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern int ip_main(int argc, char **argv);
+extern int tc_main(int argc, char **argv);
+extern int ss_main(int argc, char **argv);
+extern int genl_main(int argc, char **argv);
+extern int ifstat_main(int argc, char **argv);
+extern int nstat_main(int argc, char **argv);
+
+static const struct applet
+{
+	const char	*name;
+	int		(*main)(int argc, char **argv);
+} applets[] = {
+	{ "tc",		tc_main },
+	{ "ss",		ss_main },
+	{ "genl",	genl_main },
+	{ "ifstat",	ifstat_main },
+	{ "nstat",	nstat_main },
+	{ "ip",		ip_main },
+	{ NULL,		NULL }
+};
+
+static const char *base_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+static const struct applet *find_applet(const char *name)
+{
+	const struct applet *a;
+
+	for (a = applets; a->name; a++)
+		if (strcmp(name, a->name) == 0)
+			return a;
+	if (strncmp(name, "ip", 2) == 0)
+		return find_applet("ip");
+	return NULL;
+}
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	const struct applet *a;
+
+	fprintf(stderr, "Usage: iproute2 PROGRAM [ ARGS ]\n"
+			"where  PROGRAM :=");
+	for (a = applets; a->name; a++)
+		fprintf(stderr, " %s%s", a->name, a[1].name ? " |" : "");
+	fprintf(stderr, "\n");
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = base_name(argv[0]);
+	const struct applet *a = NULL;
+
+	/* "iproute2" itself starts the way ip's names do */
+	if (strcmp(name, "iproute2") != 0)
+		a = find_applet(name);
+	if (a == NULL) {
+		if (argc < 2)
+			usage();
+		a = find_applet(base_name(argv[1]));
+		if (a == NULL) {
+			fprintf(stderr, "Unknown program \"%s\".\n", argv[1]);
+			usage();
+		}
+		argc--;
+		argv++;
+	}
+	return a->main(argc, argv);
+}
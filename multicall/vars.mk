@@ -0,0 +1,3 @@
+# Read along with the Makefile of a directory, to print its variables
+print-%:
+	@echo '$($*)'
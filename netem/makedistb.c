@@ -0,0 +1,58 @@
+/*
+ * Convert a netem distribution table from the text .dist format read
+ * by older tc to the binary .distb format, see include/netem_dist.h.
+ *
+ *	makedistb < normal.dist > normal.distb
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/types.h>
+#include <linux/pkt_sched.h>
+#include "netem_dist.h"
+
+int
+main(int argc, char **argv)
+{
+	static __s16 data[NETEM_DIST_MAX];
+	struct netem_distb_hdr h;
+	char *line = NULL;
+	size_t len = 0;
+	int n = 0;
+
+	while (getline(&line, &len, stdin) != -1) {
+		char *p, *endp;
+		long x;
+
+		if (*line == '\n' || *line == '#')
+			continue;
+
+		for (p = line; ; p = endp) {
+			x = strtol(p, &endp, 0);
+			if (endp == p)
+				break;
+			if (n >= NETEM_DIST_MAX) {
+				fprintf(stderr, "makedistb: too much data\n");
+				exit(2);
+			}
+			data[n++] = x;
+		}
+	}
+	free(line);
+
+	if (n == 0) {
+		fprintf(stderr, "makedistb: no data\n");
+		exit(2);
+	}
+
+	h.magic = NETEM_DISTB_MAGIC;
+	h.count = n;
+	if (fwrite(&h, sizeof(h), 1, stdout) != 1 ||
+	    fwrite(data, sizeof(data[0]), n, stdout) != n ||
+	    fflush(stdout)) {
+		perror("makedistb: write");
+		exit(1);
+	}
+	return 0;
+}
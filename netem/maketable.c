@@ -10,119 +10,388 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <malloc.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+/* Create a (normalized) distribution table from a set of observed
+ * values.  The table is fixed to run from (as it happens) -4 to +4,
+ * with granularity .00002.
+ */
+
+#define TABLESIZE	16384/4
+#define TABLEFACTOR	8192
+#ifndef MINSHORT
+#define MINSHORT	-32768
+#define MAXSHORT	32767
+#endif
+
+/* Since entries in the inverse are scaled by TABLEFACTOR, and can't be bigger
+ * than MAXSHORT, we don't bother looking at a larger domain than this:
+ */
+#define DISTTABLEDOMAIN ((MAXSHORT/TABLEFACTOR)+1)
+#define DISTTABLEGRANULARITY 50000
+#define DISTTABLESIZE (DISTTABLEDOMAIN*DISTTABLEGRANULARITY*2)
 
-double *
-readdoubles(FILE *fp, int *number)
+/* Slot of a normalized value in the distribution table */
+static int
+distindex(double input)
 {
-	struct stat info;
-	double *x;
-	int limit;
-	int n=0, i;
+	int index = (int)rint((input+DISTTABLEDOMAIN)*DISTTABLEGRANULARITY);
 
-	fstat(fileno(fp), &info);
-	if (info.st_size > 0) {
-		limit = 2*info.st_size/sizeof(double);	/* @@ approximate */
-	} else {
-		limit = 10000;
-	}
+	if (index < 0) index = 0;
+	if (index >= DISTTABLESIZE) index = DISTTABLESIZE-1;
+	return index;
+}
+
+static unsigned long long *
+disttable(void)
+{
+	unsigned long long *table = calloc(DISTTABLESIZE, sizeof(*table));
 
-	x = calloc(limit, sizeof(double));
-	if (!x) {
-		perror("double alloc");
+	if (!table) {
+		perror("table alloc");
 		exit(3);
 	}
+	return table;
+}
 
-	for (i=0; i<limit; ++i){
-		fscanf(fp, "%lf", &x[i]);
-		if (feof(fp))
-			break;
-		++n;
+/*
+ * A regular file is read twice by a number of threads, each taking
+ * its share of the lines.  The first pass finds every share's count,
+ * mean and sum of squared deviations (Welford), which are merged into
+ * the mean and deviation of all the data (Chan et al.).  The second
+ * pass normalizes the values right away and counts them in a
+ * distribution table per thread; the tables are added up.  The
+ * correlation of successive values is summed in the same pass, the
+ * pairs that straddle two shares when they are merged.
+ */
+#define MAXTHREADS	64
+#define MINSHARE	(1 << 20)	/* bytes */
+
+struct share {
+	const char		*file;
+	off_t			start, end;
+	int			pass;
+
+	/* first pass */
+	unsigned long long	n;
+	double			mean, m2;
+	double			first, last;
+
+	/* second pass */
+	double			mu, sigma;
+	unsigned long long	*table;
+	unsigned long long	seen;
+	double			prev, top, sigma2;
+};
+
+static void
+share_value(struct share *sh, double x)
+{
+	double d;
+
+	if (sh->pass == 1) {
+		if (sh->n++ == 0)
+			sh->first = x;
+		d = x - sh->mean;
+		sh->mean += d / sh->n;
+		sh->m2 += d * (x - sh->mean);
+		sh->last = x;
+		return;
+	}
+
+	d = x - sh->mu;
+	if (sh->seen++) {
+		sh->top += d * sh->prev;
+		sh->sigma2 += sh->prev * sh->prev;
 	}
-	*number = n;
-	return x;
+	sh->prev = d;
+	++sh->table[distindex(d / sh->sigma)];
 }
 
-void
-arraystats(double *x, int limit, double *mu, double *sigma, double *rho)
+/* A line belongs to the share it starts in */
+static void *
+share_read(void *arg)
 {
-	int n=0, i;
-	double sumsquare=0.0, sum=0.0, top=0.0;
-	double sigma2=0.0;
+	struct share *sh = arg;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t r;
+	off_t pos = sh->start;
+	FILE *fp;
+
+	if (!(fp = fopen(sh->file, "r"))) {
+		perror(sh->file);
+		exit(1);
+	}
+	if (pos > 0) {
+		if (fseeko(fp, pos - 1, SEEK_SET) < 0) {
+			perror(sh->file);
+			exit(1);
+		}
+		r = getline(&line, &len, fp);
+		pos += r > 0 ? r - 1 : 0;
+	}
 
-	for (i=0; i<limit; ++i){
-		sumsquare += x[i]*x[i];
-		sum += x[i];
-		++n;
+	while (pos < sh->end && (r = getline(&line, &len, fp)) != -1) {
+		char *p, *endp;
+		double x;
+
+		pos += r;
+		for (p = line; ; p = endp) {
+			x = strtod(p, &endp);
+			if (endp == p)
+				break;
+			share_value(sh, x);
+		}
 	}
-	*mu = sum/(double)n;
-	*sigma = sqrt((sumsquare - (double)n*(*mu)*(*mu))/(double)(n-1));
+	free(line);
+	fclose(fp);
+	return NULL;
+}
 
-	for (i=1; i < n; ++i){
-		top += ((double)x[i]- *mu)*((double)x[i-1]- *mu);
-		sigma2 += ((double)x[i-1] - *mu)*((double)x[i-1] - *mu);
+static void
+share_pass(struct share *sh, int nshares, int pass)
+{
+	pthread_t tid[MAXTHREADS];
+	int i;
 
+	for (i = 0; i < nshares; i++) {
+		sh[i].pass = pass;
+		if (i > 0 && pthread_create(&tid[i], NULL, share_read, &sh[i])) {
+			perror("pthread_create");
+			exit(3);
+		}
+	}
+	share_read(&sh[0]);
+	for (i = 1; i < nshares; i++)
+		pthread_join(tid[i], NULL);
+}
+
+static unsigned long long *
+readshares(const char *file, off_t size, int nthreads,
+	   double *mu, double *sigma, double *rho, unsigned long long *count)
+{
+	struct share sh[MAXTHREADS];
+	unsigned long long n = 0;
+	double mean = 0, m2 = 0, top = 0, sigma2 = 0, last = 0;
+	unsigned long long *table;
+	int nshares, i, j;
+
+	nshares = size / MINSHARE + 1;
+	if (nshares > nthreads)
+		nshares = nthreads;
+
+	memset(sh, 0, sizeof(sh));
+	for (i = 0; i < nshares; i++) {
+		sh[i].file = file;
+		sh[i].start = size / nshares * i;
+		sh[i].end = i == nshares - 1 ? size : size / nshares * (i + 1);
+	}
+
+	share_pass(sh, nshares, 1);
+	for (i = 0; i < nshares; i++) {
+		double delta = sh[i].mean - mean;
+		unsigned long long tot = n + sh[i].n;
+
+		if (sh[i].n == 0)
+			continue;
+		mean += delta * sh[i].n / tot;
+		m2 += sh[i].m2 + delta * delta * n * sh[i].n / tot;
+		n = tot;
+	}
+	*count = n;
+	if (n < 2)
+		return NULL;
+	*mu = mean;
+	*sigma = sqrt(m2 / (n - 1));
+	if (!(*sigma > 0))
+		return NULL;
+
+	for (i = 0; i < nshares; i++) {
+		sh[i].mu = *mu;
+		sh[i].sigma = *sigma;
+		sh[i].table = disttable();
+	}
+	share_pass(sh, nshares, 2);
+
+	table = sh[0].table;
+	for (i = 0, n = 0; i < nshares; i++) {
+		if (sh[i].seen == 0)
+			continue;
+		if (n) {
+			top += (last - *mu) * (sh[i].first - *mu);
+			sigma2 += (last - *mu) * (last - *mu);
+		}
+		n += sh[i].seen;
+		last = sh[i].last;
+		top += sh[i].top;
+		sigma2 += sh[i].sigma2;
+		if (i > 0) {
+			for (j = 0; j < DISTTABLESIZE; j++)
+				table[j] += sh[i].table[j];
+			free(sh[i].table);
+		}
 	}
 	*rho = top/sigma2;
+	return table;
 }
 
-/* Create a (normalized) distribution table from a set of observed
- * values.  The table is fixed to run from (as it happens) -4 to +4,
- * with granularity .00002.
+/*
+ * Anything else is read in one pass and counted in a histogram of
+ * RAWBINS equal bins, so a trace of any length takes the same memory.
+ * The histogram starts out very fine around the first value; whenever
+ * a value falls outside it, the bin width is doubled by merging pairs
+ * of bins, growing towards the value.  The bins end up between one and
+ * two times the spread of the data divided by RAWBINS wide, well below
+ * the granularity of the distribution table for any sane data.  The
+ * sums for mean, deviation and correlation are taken of the distance
+ * to the first value, which keeps them exact enough for any offset.
  */
+#define RAWBINS		(1 << 20)
 
-#define TABLESIZE	16384/4
-#define TABLEFACTOR	8192
-#ifndef MINSHORT
-#define MINSHORT	-32768
-#define MAXSHORT	32767
-#endif
+struct rawhist {
+	double			lo;		/* of bin 0 */
+	double			width;
+	unsigned long long	*count;
+	unsigned long long	n;
+	double			first;
+	double			sum, sumsquare;	/* of x - first */
+	double			sumprod, prev;	/* for the correlation */
+};
 
-/* Since entries in the inverse are scaled by TABLEFACTOR, and can't be bigger
- * than MAXSHORT, we don't bother looking at a larger domain than this:
- */
-#define DISTTABLEDOMAIN ((MAXSHORT/TABLEFACTOR)+1)
-#define DISTTABLEGRANULARITY 50000
-#define DISTTABLESIZE (DISTTABLEDOMAIN*DISTTABLEGRANULARITY*2)
+static void
+rawhist_grow(struct rawhist *h, double x)
+{
+	unsigned long long *c = h->count;
+	int i, half = RAWBINS / 2;
+
+	while (x < h->lo || x >= h->lo + h->width * RAWBINS) {
+		if (x < h->lo) {
+			/* the old bins become the upper half */
+			for (i = RAWBINS - 1; i >= half; i--)
+				c[i] = c[2*(i-half)] + c[2*(i-half)+1];
+			memset(c, 0, half * sizeof(*c));
+			h->lo -= h->width * RAWBINS;
+		} else {
+			for (i = 0; i < half; i++)
+				c[i] = c[2*i] + c[2*i+1];
+			memset(c + half, 0, half * sizeof(*c));
+		}
+		h->width *= 2;
+	}
+}
 
-static int *
-makedist(double *x, int limit, double mu, double sigma)
+static void
+rawhist_add(struct rawhist *h, double x)
 {
-	int *table;
-	int i, index, first=DISTTABLESIZE, last=0;
-	double input;
+	double d;
+	long i;
 
-	table = calloc(DISTTABLESIZE, sizeof(int));
-	if (!table) {
-		perror("table alloc");
-		exit(3);
+	if (h->n == 0) {
+		/* spanning 2^-30 of the first value, or 2^-30 */
+		h->width = ldexp(fabs(x) > 1 ? fabs(x) : 1, -30) / RAWBINS;
+		h->lo = x - h->width * (RAWBINS / 2);
+		h->first = x;
+	} else
+		rawhist_grow(h, x);
+
+	i = (long)((x - h->lo) / h->width);
+	if (i >= RAWBINS)
+		i = RAWBINS - 1;
+	h->count[i]++;
+
+	d = x - h->first;
+	h->n++;
+	h->sum += d;
+	h->sumsquare += d * d;
+	h->sumprod += d * h->prev;
+	h->prev = d;
+}
+
+static void
+readvalues(FILE *fp, struct rawhist *h)
+{
+	char *line = NULL;
+	size_t len = 0;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *p, *endp;
+		double x;
+
+		for (p = line; ; p = endp) {
+			x = strtod(p, &endp);
+			if (endp == p)
+				break;
+			rawhist_add(h, x);
+		}
 	}
+	free(line);
+}
 
-	for (i=0; i < limit; ++i) {
-		/* Normalize value */
-		input = (x[i]-mu)/sigma;
-
-		index = (int)rint((input+DISTTABLEDOMAIN)*DISTTABLEGRANULARITY);
-		if (index < 0) index = 0;
-		if (index >= DISTTABLESIZE) index = DISTTABLESIZE-1;
-		++table[index];
-		if (index > last)
-			last = index +1;
-		if (index < first)
-			first = index;
+static void
+rawstats(const struct rawhist *h, double *mu, double *sigma, double *rho)
+{
+	double n = h->n, m = h->sum/n, last = h->prev;
+	double top, sigma2;
+
+	*mu = h->first + m;
+	*sigma = sqrt((h->sumsquare - n*m*m)/(n-1));
+
+	/* sum of (x[i]-mu)*(x[i-1]-mu) and of (x[i-1]-mu)^2 for i >= 1 */
+	top = h->sumprod - m*(2*h->sum - last) + (n-1)*m*m;
+	sigma2 = h->sumsquare - last*last - 2*m*(h->sum - last) + (n-1)*m*m;
+	*rho = top/sigma2;
+}
+
+static unsigned long long *
+makedist(const struct rawhist *h, double mu, double sigma)
+{
+	unsigned long long *table = disttable();
+	int i;
+
+	for (i=0; i < RAWBINS; ++i) {
+		/* Normalize the middle of the bin */
+		if (h->count[i])
+			table[distindex((h->lo + (i + .5)*h->width - mu)/sigma)]
+				+= h->count[i];
 	}
 	return table;
 }
 
+static unsigned long long *
+readstream(FILE *fp, double *mu, double *sigma, double *rho,
+	   unsigned long long *count)
+{
+	struct rawhist h;
+	unsigned long long *table = NULL;
+
+	memset(&h, 0, sizeof(h));
+	h.count = calloc(RAWBINS, sizeof(*h.count));
+	if (!h.count) {
+		perror("histogram alloc");
+		exit(3);
+	}
+	readvalues(fp, &h);
+	*count = h.n;
+	if (h.n >= 2) {
+		rawstats(&h, mu, sigma, rho);
+		if (*sigma > 0)
+			table = makedist(&h, *mu, *sigma);
+	}
+	free(h.count);
+	return table;
+}
+
 /* replace an array by its cumulative distribution */
 static void
-cumulativedist(int *table, int limit, int *total)
+cumulativedist(unsigned long long *table, int limit,
+	       unsigned long long *total)
 {
-	int accum=0;
+	unsigned long long accum=0;
 
 	while (--limit >= 0) {
 		accum += *table;
@@ -132,7 +401,8 @@ cumulativedist(int *table, int limit, int *total)
 }
 
 static short *
-inverttable(int *table, int inversesize, int tablesize, int cumulative)
+inverttable(const unsigned long long *table, int inversesize, int tablesize,
+	    unsigned long long cumulative)
 {
 	int i, inverseindex, inversevalue;
 	short *inverse;
@@ -192,38 +462,82 @@ printtable(const short *table, int limit)
 	}
 }
 
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: maketable [ -s ] [ -j THREADS ] [ FILE ]\n");
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
 	FILE *fp;
-	double *x;
-	double mu, sigma, rho;
-	int limit;
-	int *table;
+	struct stat st;
+	double mu = 0, sigma = 0, rho = 0;
+	unsigned long long *table;
 	short *inverse;
-	int total;
+	unsigned long long total, count;
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int statsonly = 0;
+	int ch;
 
-	if (argc > 1) {
-		if (!(fp = fopen(argv[1], "r"))) {
-			perror(argv[1]);
-			exit(1);
+	while ((ch = getopt(argc, argv, "sj:")) != EOF) {
+		switch (ch) {
+		case 's':
+			statsonly = 1;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			if (nthreads <= 0)
+				usage();
+			break;
+		default:
+			usage();
 		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1)
+		usage();
+	if (nthreads > MAXTHREADS)
+		nthreads = MAXTHREADS;
+	if (nthreads <= 0)
+		nthreads = 1;
+
+	if (argc > 0 && stat(argv[0], &st) == 0 && S_ISREG(st.st_mode)) {
+		table = readshares(argv[0], st.st_size, nthreads,
+				   &mu, &sigma, &rho, &count);
 	} else {
-		fp = stdin;
-	}				
-	x = readdoubles(fp, &limit);
-	if (limit <= 0) {
+		if (argc > 0) {
+			if (!(fp = fopen(argv[0], "r"))) {
+				perror(argv[0]);
+				exit(1);
+			}
+		} else {
+			fp = stdin;
+		}
+		table = readstream(fp, &mu, &sigma, &rho, &count);
+	}
+	if (count < 2) {
 		fprintf(stderr, "Nothing much read!\n");
 		exit(2);
 	}
-	arraystats(x, limit, &mu, &sigma, &rho);
 #ifdef DEBUG
-	fprintf(stderr, "%d values, mu %10.4f, sigma %10.4f, rho %10.4f\n",
-		limit, mu, sigma, rho);
+	fprintf(stderr, "%llu values, mu %10.4f, sigma %10.4f, rho %10.4f\n",
+		count, mu, sigma, rho);
 #endif
-	
-	table = makedist(x, limit, mu, sigma);
-	free((void *) x);
+	if (statsonly) {
+		printf("mu =    %12.6f\n", mu);
+		printf("sigma = %12.6f\n", sigma);
+		printf("rho =   %12.6f\n", rho);
+		return 0;
+	}
+	if (!table) {
+		fprintf(stderr, "All values are the same!\n");
+		exit(2);
+	}
+
 	cumulativedist(table, DISTTABLESIZE, &total);
 	inverse = inverttable(table, TABLESIZE, DISTTABLESIZE, total);
 	interpolatetable(inverse, TABLESIZE);
@@ -22,6 +22,7 @@
 
 #include "m_ematch.h"
 #include <linux/tc_ematch/tc_em_cmp.h>
+#include "tc_sim.h"
 
 extern struct ematch_util cmp_ematch_util;
 
@@ -178,10 +179,105 @@ static int cmp_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 	return 0;
 }
 
+static int cmp_sim_match(struct tcf_ematch_hdr *hdr, void *data, int len,
+			 const struct sim_pkt *p)
+{
+	struct tcf_em_cmp *cmp = data;
+	const __u8 *ptr;
+	unsigned int avail;
+	__u32 val;
+
+	if (len < sizeof(*cmp))
+		return -1;
+	if (p == NULL)
+		return cmp->layer == TCF_LAYER_LINK ? -1 : 0;
+
+	ptr = sim_layer(p, cmp->layer, &avail);
+	if (ptr == NULL || cmp->off + cmp->align > avail)
+		return 0;
+	ptr += cmp->off;
+	switch (cmp->align) {
+	case TCF_EM_ALIGN_U8:
+		val = ptr[0];
+		break;
+	case TCF_EM_ALIGN_U16:
+		val = (ptr[0] << 8) | ptr[1];
+		if (cmp->flags & TCF_EM_CMP_TRANS)
+			val = ntohs(val);
+		break;
+	case TCF_EM_ALIGN_U32:
+		val = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+		if (cmp->flags & TCF_EM_CMP_TRANS)
+			val = ntohl(val);
+		break;
+	default:
+		return 0;
+	}
+	if (cmp->mask)
+		val &= cmp->mask;
+
+	switch (cmp->opnd) {
+	case TCF_EM_OPND_EQ:
+		return val == cmp->val;
+	case TCF_EM_OPND_LT:
+		return val < cmp->val;
+	case TCF_EM_OPND_GT:
+		return val > cmp->val;
+	}
+	return 0;
+}
+
+static int cmp_cost(struct tcf_ematch_hdr *hdr, void *data, int len)
+{
+	return 1;
+}
+
+static __u32 cmp_mask(const struct tcf_em_cmp *cmp)
+{
+	if (cmp->mask)
+		return cmp->mask;
+
+	switch (cmp->align) {
+	case TCF_EM_ALIGN_U8:
+		return 0xFF;
+	case TCF_EM_ALIGN_U16:
+		return 0xFFFF;
+	}
+	return 0xFFFFFFFF;
+}
+
+/* Two equality tests of the same value hold together if their bits do */
+static int cmp_merge(void *data, int len, const void *other, int other_len)
+{
+	struct tcf_em_cmp *a = data;
+	const struct tcf_em_cmp *b = other;
+	__u32 ma, mb;
+
+	if (len < sizeof(*a) || other_len < sizeof(*b))
+		return -1;
+
+	if (a->off != b->off || a->align != b->align ||
+	    a->layer != b->layer || a->flags != b->flags ||
+	    a->opnd != TCF_EM_OPND_EQ || b->opnd != TCF_EM_OPND_EQ)
+		return -1;
+
+	ma = cmp_mask(a);
+	mb = cmp_mask(b);
+	if ((a->val & ~ma) || (b->val & ~mb) || ((a->val ^ b->val) & ma & mb))
+		return -1;
+
+	a->mask = ma | mb;
+	a->val |= b->val;
+	return 0;
+}
+
 struct ematch_util cmp_ematch_util = {
 	.kind = "cmp",
 	.kind_num = TCF_EM_CMP,
 	.parse_eopt = cmp_parse_eopt,
 	.print_eopt = cmp_print_eopt,
-	.print_usage = cmp_print_usage
+	.print_usage = cmp_print_usage,
+	.sim_match = cmp_sim_match,
+	.cost = cmp_cost,
+	.merge = cmp_merge,
 };
@@ -44,6 +44,7 @@ struct meta_entry {
 	char *		kind;
 	char *		mask;
 	char *		desc;
+	struct meta_entry *next;	/* in meta_hash */
 } meta_table[] = {
 #define TCF_META_ID_SECTION 0
 #define __A(id, name, mask, desc) { TCF_META_ID_##id, name, mask, desc }
@@ -122,27 +123,67 @@ static inline int map_type(char k)
 	return INT_MAX;
 }
 
-static struct meta_entry * lookup_meta_entry(struct bstr *kind)
+#define META_HASH	64
+
+static struct meta_entry *meta_hash[META_HASH];
+static struct meta_entry *meta_by_id[TCF_META_ID_MAX + 1];
+
+static unsigned int meta_hashfn(const char *s, int len)
+{
+	unsigned int h = 0;
+
+	while (len-- > 0)
+		h = h * 31 + (unsigned char) *s++;
+
+	return h % META_HASH;
+}
+
+/* Indexes meta_table by name and id; the first entry of a name or id wins */
+static void meta_index(void)
 {
+	static int done;
 	int i;
 
-	for (i = 0; i < (sizeof(meta_table)/sizeof(meta_table[0])); i++)
-		if (!bstrcmp(kind, meta_table[i].kind) &&
-		    meta_table[i].id != 0)
-			return &meta_table[i];
+	if (done)
+		return;
+
+	for (i = (sizeof(meta_table)/sizeof(meta_table[0])) - 1; i >= 0; i--) {
+		struct meta_entry *e = &meta_table[i];
+
+		if (e->id <= TCF_META_ID_MAX)
+			meta_by_id[e->id] = e;
+		if (e->id != 0) {
+			unsigned int h = meta_hashfn(e->kind, strlen(e->kind));
+
+			e->next = meta_hash[h];
+			meta_hash[h] = e;
+		}
+	}
+
+	done = 1;
+}
+
+static struct meta_entry * lookup_meta_entry(struct bstr *kind)
+{
+	struct meta_entry *e;
+
+	meta_index();
+
+	for (e = meta_hash[meta_hashfn(kind->data, kind->len)]; e; e = e->next)
+		if (!bstrcmp(kind, e->kind))
+			return e;
 
 	return NULL;
 }
 
 static struct meta_entry * lookup_meta_entry_byid(int id)
 {
-	int i;
+	meta_index();
 
-	for (i = 0; i < (sizeof(meta_table)/sizeof(meta_table[0])); i++)
-		if (meta_table[i].id == id)
-			return &meta_table[i];
+	if (id < 0 || id > TCF_META_ID_MAX)
+		return NULL;
 
-	return NULL;
+	return meta_by_id[id];
 }
 
 static inline void dump_value(struct nlmsghdr *n, int tlv, unsigned long val,
@@ -537,10 +578,41 @@ static int meta_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 	return print_object(fd, &meta_hdr->right, tb[TCA_EM_META_RVALUE]);
 }
 
+static int meta_object_cost(const struct tcf_meta_val *obj)
+{
+	int id = TCF_META_ID(obj->kind);
+	int cost = 0;
+
+	/* Socket values go through skb->sk, if there is one */
+	if (id >= TCF_META_ID_SK_FAMILY && id <= TCF_META_ID_SK_WRITE_PENDING)
+		cost += 2;
+	if (TCF_META_TYPE(obj->kind) == TCF_META_TYPE_VAR)
+		cost += 2;
+
+	return cost;
+}
+
+static int meta_cost(struct tcf_ematch_hdr *hdr, void *data, int data_len)
+{
+	struct rtattr *tb[TCA_EM_META_MAX+1];
+	struct tcf_meta_hdr *meta_hdr;
+
+	if (parse_rtattr(tb, TCA_EM_META_MAX, data, data_len) < 0 ||
+	    tb[TCA_EM_META_HDR] == NULL ||
+	    RTA_PAYLOAD(tb[TCA_EM_META_HDR]) < sizeof(*meta_hdr))
+		return -1;
+
+	meta_hdr = RTA_DATA(tb[TCA_EM_META_HDR]);
+
+	return 2 + meta_object_cost(&meta_hdr->left) +
+	       meta_object_cost(&meta_hdr->right);
+}
+
 struct ematch_util meta_ematch_util = {
 	.kind = "meta",
 	.kind_num = TCF_EM_META,
 	.parse_eopt = meta_parse_eopt,
 	.print_eopt = meta_print_eopt,
-	.print_usage = meta_print_usage
+	.print_usage = meta_print_usage,
+	.cost = meta_cost,
 };
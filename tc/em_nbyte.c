@@ -22,6 +22,7 @@
 
 #include "m_ematch.h"
 #include <linux/tc_ematch/tc_em_nbyte.h>
+#include "tc_sim.h"
 
 extern struct ematch_util nbyte_ematch_util;
 
@@ -134,10 +135,40 @@ static int nbyte_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 	return 0;
 }
 
+static int nbyte_sim_match(struct tcf_ematch_hdr *hdr, void *data, int len,
+			   const struct sim_pkt *p)
+{
+	struct tcf_em_nbyte *nb = data;
+	const __u8 *ptr;
+	unsigned int avail;
+
+	if (len < sizeof(*nb) || len < sizeof(*nb) + nb->len)
+		return -1;
+	if (p == NULL)
+		return nb->layer == TCF_LAYER_LINK ? -1 : 0;
+
+	ptr = sim_layer(p, nb->layer, &avail);
+	if (ptr == NULL || nb->off + nb->len > avail)
+		return 0;
+	return memcmp(ptr + nb->off, nb + 1, nb->len) == 0;
+}
+
+static int nbyte_cost(struct tcf_ematch_hdr *hdr, void *data, int len)
+{
+	struct tcf_em_nbyte *nb = data;
+
+	if (len < sizeof(*nb))
+		return -1;
+
+	return 2 + (nb->len + 7) / 8;
+}
+
 struct ematch_util nbyte_ematch_util = {
 	.kind = "nbyte",
 	.kind_num = TCF_EM_NBYTE,
 	.parse_eopt = nbyte_parse_eopt,
 	.print_eopt = nbyte_print_eopt,
-	.print_usage = nbyte_print_usage
+	.print_usage = nbyte_print_usage,
+	.sim_match = nbyte_sim_match,
+	.cost = nbyte_cost,
 };
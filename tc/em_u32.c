@@ -21,6 +21,7 @@
 #include <errno.h>
 
 #include "m_ematch.h"
+#include "tc_sim.h"
 
 extern struct ematch_util u32_ematch_util;
 
@@ -168,10 +169,62 @@ static int u32_print_eopt(FILE *fd, struct tcf_ematch_hdr *hdr, void *data,
 	return 0;
 }
 
+static int u32_sim_match(struct tcf_ematch_hdr *hdr, void *data, int len,
+			 const struct sim_pkt *p)
+{
+	struct tc_u32_key *key = data;
+	const __u8 *ptr;
+	unsigned int avail;
+	__u32 word;
+
+	if (len < sizeof(*key))
+		return -1;
+	if (p == NULL)
+		return 0;
+
+	ptr = sim_layer(p, TCF_LAYER_NETWORK, &avail);
+	if (key->off < 0 || key->off + 4 > avail)
+		return 0;
+	memcpy(&word, ptr + key->off, 4);
+	return !((word ^ key->val) & key->mask);
+}
+
+static int u32_cost(struct tcf_ematch_hdr *hdr, void *data, int len)
+{
+	struct tc_u32_key *key = data;
+
+	if (len < sizeof(*key))
+		return -1;
+
+	/* nexthdr+ reads the header length first */
+	return key->offmask ? 2 : 1;
+}
+
+static int u32_merge(void *data, int len, const void *other, int other_len)
+{
+	struct tc_u32_key *a = data;
+	const struct tc_u32_key *b = other;
+
+	if (len < sizeof(*a) || other_len < sizeof(*b))
+		return -1;
+
+	if (a->off != b->off || a->offmask != b->offmask ||
+	    (a->val & ~a->mask) || (b->val & ~b->mask) ||
+	    ((a->val ^ b->val) & a->mask & b->mask))
+		return -1;
+
+	a->mask |= b->mask;
+	a->val |= b->val;
+	return 0;
+}
+
 struct ematch_util u32_ematch_util = {
 	.kind = "u32",
 	.kind_num = TCF_EM_U32,
 	.parse_eopt = u32_parse_eopt,
 	.print_eopt = u32_print_eopt,
-	.print_usage = u32_print_usage
+	.print_usage = u32_print_usage,
+	.sim_match = u32_sim_match,
+	.cost = u32_cost,
+	.merge = u32_merge,
 };
@@ -22,6 +22,7 @@
  extern void yyerror(const char *s);
  extern struct ematch *ematch_root;
  extern char *ematch_err;
+ extern int ematch_trailing;
 %}
 
 %token <i> ERROR
@@ -40,6 +41,7 @@ input:
 	| expr error
 		{
 			ematch_root = $1;
+			ematch_trailing = 1;
 			YYACCEPT;
 		}
 	;
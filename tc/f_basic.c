@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "tc_util.h"
 #include "m_ematch.h"
+#include "tc_sim.h"
 
 static void explain(void)
 {
@@ -140,8 +141,77 @@ static int basic_print_opt(struct filter_util *qu, FILE *f,
 	return 0;
 }
 
+/* basic as "tc sim" runs it: the first filter whose ematches match */
+struct basic_sim_filter
+{
+	struct basic_sim_filter	*next;
+	__u32			handle;
+	__u32			classid;
+	struct em_sim_tree	*ematches;
+};
+
+static int basic_sim_add(struct sim_tp *tp, __u32 handle, struct rtattr *opt)
+{
+	struct basic_sim_filter *f, **fp;
+	struct rtattr *tb[TCA_BASIC_MAX+1];
+
+	/* A dump names the tp with no options; a request without a handle
+	 * gets one past the highest, much as the kernel's generator would
+	 */
+	if (handle == 0) {
+		if (opt == NULL)
+			return 0;
+		for (f = tp->priv; f; f = f->next)
+			if (f->handle > handle)
+				handle = f->handle;
+		handle++;
+	}
+	for (fp = (struct basic_sim_filter **)&tp->priv; *fp; fp = &(*fp)->next)
+		if ((*fp)->handle == handle)
+			break;
+	f = *fp;
+	if (f == NULL) {
+		f = *fp = calloc(1, sizeof(*f));
+		if (f == NULL)
+			return -1;
+		f->handle = handle;
+	}
+
+	memset(tb, 0, sizeof(tb));
+	if (opt)
+		parse_rtattr_nested(tb, TCA_BASIC_MAX, opt);
+	if (tb[TCA_BASIC_CLASSID])
+		f->classid = rta_getattr_u32(tb[TCA_BASIC_CLASSID]);
+	if (tb[TCA_BASIC_EMATCHES]) {
+		f->ematches = em_sim_tree(tb[TCA_BASIC_EMATCHES]);
+		if (f->ematches == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+static int basic_sim_classify(struct sim_tp *tp, const struct sim_pkt *p,
+			      __u32 *classid)
+{
+	struct basic_sim_filter *f;
+
+	for (f = tp->priv; f; f = f->next) {
+		if (em_sim_match(f->ematches, p)) {
+			*classid = f->classid;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static const struct sim_filter_ops basic_sim = {
+	.add		= basic_sim_add,
+	.classify	= basic_sim_classify,
+};
+
 struct filter_util basic_filter_util = {
 	.id = "basic",
 	.parse_fopt = basic_parse_opt,
 	.print_fopt = basic_print_opt,
+	.sim = &basic_sim,
 };
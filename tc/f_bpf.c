@@ -0,0 +1,186 @@
+/*
+ * f_bpf.c		BPF-based Classifier
+ *
+ *		This program is free software; you can distribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_bpf.h"
+#include "bpf_elf.h"
+
+static const struct bpf_cfg_ops bpf_cls_ops = {
+	.ops_len	= TCA_BPF_OPS_LEN,
+	.ops		= TCA_BPF_OPS,
+	.fd		= TCA_BPF_FD,
+	.name		= TCA_BPF_NAME,
+};
+
+static void explain(void)
+{
+	fprintf(stderr, "Usage: ... bpf BPF_PROG [ direct-action ] [ classid CLASSID ]\n");
+	fprintf(stderr, "                [ police POLICE_SPEC ] [ action ACTION_SPEC ]\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Where: BPF_PROG := { bytecode BPF_BYTECODE | bytecode-file FILE |\n");
+	fprintf(stderr, "                     object-file FILE [ section NAME ] [ verbose ] |\n");
+	fprintf(stderr, "                     object-pinned FILE }\n");
+	fprintf(stderr, "       BPF_BYTECODE := \"N,CODE JT JF K,...\", as tcpdump -ddd prints it\n");
+	fprintf(stderr, "\nThe section of an object defaults to \"%s\", its maps\n",
+		ELF_SECTION_CLASSIFIER);
+	fprintf(stderr, "with pinning are shared under %s/%s.\n", BPF_FS_DIR,
+		BPF_FS_TC);
+	fprintf(stderr, "With direct-action the program's return code is the action.\n");
+	fprintf(stderr, "\nNOTE: CLASSID is parsed as hexadecimal input.\n");
+}
+
+static int bpf_parse_opt(struct filter_util *qu, char *handle,
+			 int argc, char **argv, struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tail;
+	__u32 flags = 0;
+	int prog = 0;
+
+	if (handle) {
+		if (get_u32(&t->tcm_handle, handle, 0)) {
+			fprintf(stderr, "Illegal \"handle\"\n");
+			return -1;
+		}
+	}
+
+	if (argc == 0)
+		return 0;
+
+	tail = NLMSG_TAIL(n);
+	addattr_l(n, MAX_MSG, TCA_OPTIONS, NULL, 0);
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bytecode") == 0 || strcmp(*argv, "bc") == 0 ||
+		    strcmp(*argv, "bytecode-file") == 0 ||
+		    strcmp(*argv, "bcf") == 0 ||
+		    strcmp(*argv, "object-file") == 0 ||
+		    strcmp(*argv, "obj") == 0 ||
+		    strcmp(*argv, "object-pinned") == 0 ||
+		    strcmp(*argv, "pinned") == 0) {
+			if (prog) {
+				fprintf(stderr, "Only one BPF program per filter\n");
+				return -1;
+			}
+			if (bpf_parse_common(&argc, &argv, &bpf_cls_ops,
+					     BPF_PROG_TYPE_SCHED_CLS,
+					     ELF_SECTION_CLASSIFIER, n))
+				return -1;
+			prog = 1;
+			continue;
+		} else if (strcmp(*argv, "direct-action") == 0 ||
+			   strcmp(*argv, "da") == 0) {
+			flags |= TCA_BPF_FLAG_ACT_DIRECT;
+		} else if (matches(*argv, "classid") == 0 ||
+			   strcmp(*argv, "flowid") == 0) {
+			unsigned handle;
+			NEXT_ARG();
+			if (get_tc_classid(&handle, *argv)) {
+				fprintf(stderr, "Illegal \"classid\"\n");
+				return -1;
+			}
+			addattr32(n, MAX_MSG, TCA_BPF_CLASSID, handle);
+		} else if (matches(*argv, "action") == 0) {
+			NEXT_ARG();
+			if (parse_action(&argc, &argv, TCA_BPF_ACT, n)) {
+				fprintf(stderr, "Illegal \"action\"\n");
+				return -1;
+			}
+			continue;
+		} else if (matches(*argv, "police") == 0) {
+			NEXT_ARG();
+			if (parse_police(&argc, &argv, TCA_BPF_POLICE, n)) {
+				fprintf(stderr, "Illegal \"police\"\n");
+				return -1;
+			}
+			continue;
+		} else if (strcmp(*argv, "help") == 0) {
+			explain();
+			return -1;
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			explain();
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (!prog) {
+		fprintf(stderr, "bpf: a program is needed\n");
+		explain();
+		return -1;
+	}
+	if (flags)
+		addattr32(n, MAX_MSG, TCA_BPF_FLAGS, flags);
+
+	tail->rta_len = (((void*)n)+n->nlmsg_len) - (void*)tail;
+	return 0;
+}
+
+static int bpf_print_opt(struct filter_util *qu, FILE *f,
+			 struct rtattr *opt, __u32 handle)
+{
+	struct rtattr *tb[TCA_BPF_MAX+1];
+
+	if (opt == NULL)
+		return 0;
+
+	parse_rtattr_nested(tb, TCA_BPF_MAX, opt);
+
+	if (handle)
+		fprintf(f, "handle 0x%x ", handle);
+
+	if (tb[TCA_BPF_CLASSID]) {
+		SPRINT_BUF(b1);
+		fprintf(f, "flowid %s ",
+			sprint_tc_classid(rta_getattr_u32(tb[TCA_BPF_CLASSID]), b1));
+	}
+
+	if (tb[TCA_BPF_NAME])
+		fprintf(f, "%s ", rta_getattr_str(tb[TCA_BPF_NAME]));
+	else if (tb[TCA_BPF_FD])
+		fprintf(f, "pfd %u ", rta_getattr_u32(tb[TCA_BPF_FD]));
+
+	if (tb[TCA_BPF_FLAGS] &&
+	    (rta_getattr_u32(tb[TCA_BPF_FLAGS]) & TCA_BPF_FLAG_ACT_DIRECT))
+		fprintf(f, "direct-action ");
+
+	if (tb[TCA_BPF_ID])
+		fprintf(f, "id %u ", rta_getattr_u32(tb[TCA_BPF_ID]));
+	if (tb[TCA_BPF_TAG])
+		bpf_print_tag(f, tb[TCA_BPF_TAG]);
+
+	if (tb[TCA_BPF_OPS] && tb[TCA_BPF_OPS_LEN]) {
+		bpf_print_ops(f, tb[TCA_BPF_OPS],
+			      rta_getattr_u16(tb[TCA_BPF_OPS_LEN]));
+		fprintf(f, " ");
+	}
+
+	if (tb[TCA_BPF_POLICE]) {
+		fprintf(f, "\n");
+		tc_print_police(f, tb[TCA_BPF_POLICE]);
+	}
+
+	if (tb[TCA_BPF_ACT])
+		tc_print_action(f, tb[TCA_BPF_ACT]);
+
+	return 0;
+}
+
+struct filter_util bpf_filter_util = {
+	.id		= "bpf",
+	.parse_fopt	= bpf_parse_opt,
+	.print_fopt	= bpf_print_opt,
+};
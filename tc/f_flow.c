@@ -13,10 +13,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <arpa/inet.h>
 
 #include "utils.h"
 #include "tc_util.h"
 #include "m_ematch.h"
+#include "tc_sim.h"
 
 static void explain(void)
 {
@@ -27,6 +29,7 @@ static void explain(void)
 " [hashing mode]: hash keys KEY-LIST ... [ perturb SECS ]\n"
 "\n"
 "                 [ divisor NUM ] [ baseclass ID ] [ match EMATCH_TREE ]\n"
+"                 [ sample FILE ]\n"
 "                 [ police POLICE_SPEC ] [ action ACTION_SPEC ]\n"
 "\n"
 "KEY-LIST := [ KEY-LIST , ] KEY\n"
@@ -36,6 +39,11 @@ static void explain(void)
 "              vlan-tag | rxhash ]\n"
 "OPS      := [ or NUM | and NUM | xor NUM | rshift NUM | addend NUM ]\n"
 "ID       := X:Y\n"
+"\n"
+"sample FILE reads flows, \"ss -tun\" or \"tcpdump -n\" lines, and hashes\n"
+"them into the divisor buckets as the kernel would. Without keys the\n"
+"set of src, dst, proto, proto-src and proto-dst giving the smallest\n"
+"fullest bucket is used.\n"
 	);
 }
 
@@ -89,6 +97,239 @@ static int flow_parse_keys(__u32 *keys, __u32 *nkeys, char *argv)
 	return 0;
 }
 
+/* Flows read for "sample": the values the kernel would hash for the
+ * keys a sample can tell, in key order.
+ */
+#define SAMPLE_KEYS	((1 << FLOW_KEY_SRC) | (1 << FLOW_KEY_DST) | \
+			 (1 << FLOW_KEY_PROTO) | (1 << FLOW_KEY_PROTO_SRC) | \
+			 (1 << FLOW_KEY_PROTO_DST))
+#define SAMPLE_SEEDS	16
+
+struct flow_sample {
+	__u32	key[FLOW_KEY_PROTO_DST + 1];
+};
+
+/* "10.0.0.1:22", "[2001:db8::1]:22" (ss) or "10.0.0.1.22" (tcpdump),
+ * giving the last 32 bits of the address, as cls_flow keys them.
+ */
+static int sample_endpoint(const char *tok, int dot, __u32 *addr, __u32 *port)
+{
+	char buf[INET6_ADDRSTRLEN + 8], *sep, *a = buf;
+	unsigned char bin[16];
+	size_t len = strlen(tok);
+
+	if (len && tok[len - 1] == ':')
+		len--;
+	if (len >= sizeof(buf))
+		return -1;
+	memcpy(buf, tok, len);
+	buf[len] = '\0';
+
+	sep = strrchr(buf, dot ? '.' : ':');
+	if (!sep || get_u32(port, sep + 1, 10) || *port > 0xffff)
+		return -1;
+	*sep = '\0';
+	if (*a == '[' && sep[-1] == ']') {
+		a++;
+		sep[-1] = '\0';
+	}
+	if ((sep = strchr(a, '%')) != NULL)
+		*sep = '\0';
+	if (inet_pton(AF_INET, a, bin) == 1)
+		memcpy(addr, bin, 4);
+	else if (inet_pton(AF_INET6, a, bin) == 1)
+		memcpy(addr, bin + 12, 4);
+	else
+		return -1;
+	*addr = ntohl(*addr);
+	return 0;
+}
+
+/* Lines naming no two endpoints, such as headers, return -1 */
+static int sample_line(char *line, struct flow_sample *fs)
+{
+	__u32 addr[2], port[2];
+	int proto = IPPROTO_TCP;
+	int n = 0, dot = 0;
+	char *tok;
+
+	if (strstr(line, " > ") && !strstr(line, "ESTAB"))
+		dot = 1;
+	if (strstr(line, dot ? "UDP" : "udp"))
+		proto = IPPROTO_UDP;
+	for (tok = strtok(line, " \t\n"); tok && n < 2;
+	     tok = strtok(NULL, " \t\n")) {
+		if (sample_endpoint(tok, dot, &addr[n], &port[n]) == 0)
+			n++;
+	}
+	if (n < 2)
+		return -1;
+
+	memset(fs, 0, sizeof(*fs));
+	fs->key[FLOW_KEY_SRC] = addr[0];
+	fs->key[FLOW_KEY_DST] = addr[1];
+	fs->key[FLOW_KEY_PROTO] = proto;
+	fs->key[FLOW_KEY_PROTO_SRC] = port[0];
+	fs->key[FLOW_KEY_PROTO_DST] = port[1];
+	return 0;
+}
+
+static struct flow_sample *sample_read(const char *file, int *count)
+{
+	struct flow_sample *fs = NULL;
+	int n = 0, max = 0;
+	char line[512];
+	FILE *fp;
+
+	fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n", file,
+			strerror(errno));
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (n == max) {
+			struct flow_sample *p;
+
+			max = max ? max * 2 : 1024;
+			p = realloc(fs, max * sizeof(*fs));
+			if (p == NULL) {
+				free(fs);
+				fs = NULL;
+				break;
+			}
+			fs = p;
+		}
+		if (sample_line(line, &fs[n]) == 0)
+			n++;
+	}
+	if (fp != stdin)
+		fclose(fp);
+	if (fs && n == 0) {
+		fprintf(stderr, "No flows in \"%s\"\n", file);
+		free(fs);
+		fs = NULL;
+	}
+	*count = n;
+	return fs;
+}
+
+/* The fullest bucket, averaged over and at worst for a few random
+ * hashrnd values: the kernel picks its own and every perturb period
+ * picks another, so only the spread over seeds can be known.
+ */
+static void sample_load(const struct flow_sample *fs, int count, __u32 keys,
+			__u32 divisor, __u32 *buckets, double *avg,
+			__u32 *worst)
+{
+	__u32 seed, sum = 0;
+	int i, j;
+
+	*worst = 0;
+	for (seed = 0; seed < SAMPLE_SEEDS; seed++) {
+		__u32 rnd = seed * 0x9e3779b9 + 1, max = 0;
+
+		memset(buckets, 0, divisor * sizeof(*buckets));
+		for (i = 0; i < count; i++) {
+			__u32 v[FLOW_KEY_PROTO_DST + 1], nv = 0, h;
+
+			for (j = 0; j <= FLOW_KEY_PROTO_DST; j++)
+				if (keys & (1 << j))
+					v[nv++] = fs[i].key[j];
+			h = tc_jhash2(v, nv, rnd) % divisor;
+			if (++buckets[h] > max)
+				max = buckets[h];
+		}
+		sum += max;
+		if (max > *worst)
+			*worst = max;
+	}
+	*avg = (double)sum / SAMPLE_SEEDS;
+}
+
+static const char *sprint_keys(__u32 keys, char *buf, int len)
+{
+	const char *sep = "";
+	int i, n = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i <= FLOW_KEY_MAX && n < len; i++) {
+		if (keys & (1 << i)) {
+			n += snprintf(buf + n, len - n, "%s%s", sep,
+				      flow_keys[i]);
+			sep = ",";
+		}
+	}
+	return buf;
+}
+
+/* With no keys given, tries every set of the keys a sample tells and
+ * keeps the one with the smallest fullest bucket.  The result goes to
+ * stderr as the filter it makes.
+ */
+static int flow_sample_keys(const char *file, __u32 *keys, __u32 *nkeys,
+			    __u32 divisor)
+{
+	struct flow_sample *fs;
+	__u32 *buckets, k, best = 0, best_worst = 0, worst;
+	int nk, best_nk = 0;
+	double avg, best_avg = 0;
+	int count;
+	char b1[128];
+
+	if (divisor == 0) {
+		fprintf(stderr, "\"sample\" needs a \"divisor\"\n");
+		return -1;
+	}
+	fs = sample_read(file, &count);
+	if (fs == NULL)
+		return -1;
+	buckets = malloc(divisor * sizeof(*buckets));
+	if (buckets == NULL) {
+		free(fs);
+		return -1;
+	}
+
+	if (*keys & ~SAMPLE_KEYS) {
+		fprintf(stderr, "Flow keys not in a sample: %s\n",
+			sprint_keys(*keys & ~SAMPLE_KEYS, b1, sizeof(b1)));
+		goto out;
+	}
+	/* Smaller sets first: one more key has to do clearly better than
+	 * the seeds differ by, adding a constant one never does.
+	 */
+	for (nk = 1; nk <= 5; nk++) {
+		for (k = 1; k <= SAMPLE_KEYS; k++) {
+			if (*keys ? k != *keys : (k & ~SAMPLE_KEYS) != 0)
+				continue;
+			if (__builtin_popcount(k) != nk)
+				continue;
+			sample_load(fs, count, k, divisor, buckets, &avg,
+				    &worst);
+			if (best == 0 ||
+			    avg < best_avg * (best_nk < nk ? 0.95 : 1)) {
+				best = k;
+				best_nk = nk;
+				best_avg = avg;
+				best_worst = worst;
+			}
+		}
+	}
+out:
+	free(buckets);
+	free(fs);
+	if (best == 0)
+		return -1;
+
+	fprintf(stderr, "flow hash keys %s divisor %u: %d flows, "
+		"fullest bucket %.1f (%u at worst, %u even)\n",
+		sprint_keys(best, b1, sizeof(b1)), divisor, count,
+		best_avg, best_worst, (count + divisor - 1) / divisor);
+	*keys = best;
+	*nkeys = __builtin_popcount(best);
+	return 0;
+}
+
 static void transfer_bitop(__u32 *mask, __u32 *xor, __u32 m, __u32 x)
 {
 	*xor = x ^ (*xor & m);
@@ -139,6 +380,8 @@ static int flow_parse_opt(struct filter_util *fu, char *handle,
 	__u32 mask = ~0U, xor = 0;
 	__u32 keys = 0, nkeys = 0;
 	__u32 mode = FLOW_MODE_MAP;
+	__u32 divisor = 0;
+	char *sample = NULL;
 	__u32 tmp;
 
 	memset(&tp, 0, sizeof(tp));
@@ -162,7 +405,6 @@ static int flow_parse_opt(struct filter_util *fu, char *handle,
 			NEXT_ARG();
 			if (flow_parse_keys(&keys, &nkeys, *argv))
 				return -1;
-			addattr32(n, 4096, TCA_FLOW_KEYS, keys);
 		} else if (matches(*argv, "and") == 0) {
 			NEXT_ARG();
 			if (get_u32(&tmp, *argv, 0)) {
@@ -204,6 +446,7 @@ static int flow_parse_opt(struct filter_util *fu, char *handle,
 				fprintf(stderr, "Illegal \"divisor\"\n");
 				return -1;
 			}
+			divisor = tmp;
 			addattr32(n, 4096, TCA_FLOW_DIVISOR, tmp);
 		} else if (matches(*argv, "baseclass") == 0) {
 			NEXT_ARG();
@@ -219,6 +462,9 @@ static int flow_parse_opt(struct filter_util *fu, char *handle,
 				return -1;
 			}
 			addattr32(n, 4096, TCA_FLOW_PERTURB, tmp);
+		} else if (matches(*argv, "sample") == 0) {
+			NEXT_ARG();
+			sample = *argv;
 		} else if (matches(*argv, "police") == 0) {
 			NEXT_ARG();
 			if (parse_police(&argc, &argv, TCA_FLOW_POLICE, n)) {
@@ -251,6 +497,17 @@ static int flow_parse_opt(struct filter_util *fu, char *handle,
 		argv++, argc--;
 	}
 
+	if (sample) {
+		if (mode != FLOW_MODE_HASH) {
+			fprintf(stderr, "\"sample\" needs mode \"hash\"\n");
+			return -1;
+		}
+		if (flow_sample_keys(sample, &keys, &nkeys, divisor))
+			return -1;
+	}
+	if (keys)
+		addattr32(n, 4096, TCA_FLOW_KEYS, keys);
+
 	if (nkeys > 1 && mode != FLOW_MODE_HASH) {
 		fprintf(stderr, "Invalid mode \"map\" for multiple keys\n");
 		return -1;
@@ -354,8 +611,153 @@ static int flow_print_opt(struct filter_util *fu, FILE *f, struct rtattr *opt,
 	return 0;
 }
 
+/* flow as "tc sim" runs it, cls_flow.c with a hash seed of 0 */
+struct flow_sim_filter
+{
+	struct flow_sim_filter	*next;
+	__u32			handle;
+	__u32			keymask;
+	__u32			mode;
+	__u32			mask;
+	__u32			xor;
+	__u32			rshift;
+	__u32			addend;
+	__u32			divisor;
+	__u32			baseclass;
+	struct em_sim_tree	*ematches;
+};
+
+static int flow_sim_add(struct sim_tp *tp, __u32 handle, struct rtattr *opt)
+{
+	struct flow_sim_filter *f, **fp;
+	struct rtattr *tb[TCA_FLOW_MAX+1];
+
+	if (handle == 0) {
+		if (opt == NULL)
+			return 0;
+		fprintf(stderr, "sim: flow filter without a handle\n");
+		return -1;
+	}
+	for (fp = (struct flow_sim_filter **)&tp->priv; *fp; fp = &(*fp)->next)
+		if ((*fp)->handle == handle)
+			break;
+	f = *fp;
+	if (f == NULL) {
+		f = *fp = calloc(1, sizeof(*f));
+		if (f == NULL)
+			return -1;
+		f->handle = handle;
+		f->mode = FLOW_MODE_MAP;
+		f->mask = ~0U;
+	}
+
+	memset(tb, 0, sizeof(tb));
+	if (opt)
+		parse_rtattr_nested(tb, TCA_FLOW_MAX, opt);
+	if (tb[TCA_FLOW_KEYS])
+		f->keymask = rta_getattr_u32(tb[TCA_FLOW_KEYS]);
+	if (tb[TCA_FLOW_MODE])
+		f->mode = rta_getattr_u32(tb[TCA_FLOW_MODE]);
+	if (tb[TCA_FLOW_MASK])
+		f->mask = rta_getattr_u32(tb[TCA_FLOW_MASK]);
+	if (tb[TCA_FLOW_XOR])
+		f->xor = rta_getattr_u32(tb[TCA_FLOW_XOR]);
+	if (tb[TCA_FLOW_RSHIFT])
+		f->rshift = rta_getattr_u32(tb[TCA_FLOW_RSHIFT]);
+	if (tb[TCA_FLOW_ADDEND])
+		f->addend = rta_getattr_u32(tb[TCA_FLOW_ADDEND]);
+	if (tb[TCA_FLOW_DIVISOR])
+		f->divisor = rta_getattr_u32(tb[TCA_FLOW_DIVISOR]);
+	if (tb[TCA_FLOW_BASECLASS])
+		f->baseclass = rta_getattr_u32(tb[TCA_FLOW_BASECLASS]);
+	if (tb[TCA_FLOW_EMATCHES]) {
+		f->ematches = em_sim_tree(tb[TCA_FLOW_EMATCHES]);
+		if (f->ematches == NULL)
+			return -1;
+	}
+	if (TC_H_MIN(f->baseclass) == 0)
+		f->baseclass = TC_H_MAKE(f->baseclass, 1);
+	if (TC_H_MAJ(f->baseclass) == 0)
+		f->baseclass = TC_H_MAKE(tp->qhandle, f->baseclass);
+	return 0;
+}
+
+static __u32 flow_sim_addr(const __u32 *a, int alen)
+{
+	__u32 v = 0;
+	int i;
+
+	for (i = 0; i < alen; i++)
+		v ^= a[i];
+	return ntohl(v);
+}
+
+/* Keys without a packet field to come from, such as iif, are 0 */
+static __u32 flow_sim_key(const struct sim_pkt *p, const struct sim_flow *fl,
+			  int key)
+{
+	switch (key) {
+	case FLOW_KEY_SRC:
+	case FLOW_KEY_NFCT_SRC:
+		return flow_sim_addr(fl->src, fl->alen);
+	case FLOW_KEY_DST:
+	case FLOW_KEY_NFCT_DST:
+		return flow_sim_addr(fl->dst, fl->alen);
+	case FLOW_KEY_PROTO:
+		return fl->proto;
+	case FLOW_KEY_PROTO_SRC:
+	case FLOW_KEY_NFCT_PROTO_SRC:
+		return fl->sport;
+	case FLOW_KEY_PROTO_DST:
+	case FLOW_KEY_NFCT_PROTO_DST:
+		return fl->dport;
+	case FLOW_KEY_PRIORITY:
+		return p->priority;
+	case FLOW_KEY_MARK:
+		return p->mark;
+	}
+	return 0;
+}
+
+static int flow_sim_classify(struct sim_tp *tp, const struct sim_pkt *p,
+			     __u32 *classid)
+{
+	struct flow_sim_filter *f;
+	struct sim_flow fl;
+	__u32 keys[FLOW_KEY_MAX+1], id;
+	int i, n;
+
+	sim_flow_keys(p, &fl);
+	for (f = tp->priv; f; f = f->next) {
+		if (!em_sim_match(f->ematches, p))
+			continue;
+		for (i = n = 0; i <= FLOW_KEY_MAX; i++)
+			if (f->keymask & (1 << i))
+				keys[n++] = flow_sim_key(p, &fl, i);
+
+		if (f->mode == FLOW_MODE_HASH) {
+			id = tc_jhash2(keys, n, 0);
+		} else {
+			id = n ? keys[0] : 0;
+			id = ((id & f->mask) ^ f->xor) >> f->rshift;
+			id += f->addend;
+		}
+		if (f->divisor)
+			id %= f->divisor;
+		*classid = TC_H_MAKE(f->baseclass, f->baseclass + id);
+		return 0;
+	}
+	return -1;
+}
+
+static const struct sim_filter_ops flow_sim = {
+	.add		= flow_sim_add,
+	.classify	= flow_sim_classify,
+};
+
 struct filter_util flow_filter_util = {
 	.id		= "flow",
 	.parse_fopt	= flow_parse_opt,
 	.print_fopt	= flow_print_opt,
+	.sim		= &flow_sim,
 };
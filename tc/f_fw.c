@@ -22,6 +22,7 @@
 #include <linux/if.h> /* IFNAMSIZ */
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_sim.h"
 
 static void explain(void)
 {
@@ -29,6 +30,10 @@ static void explain(void)
 	fprintf(stderr, "       POLICE_SPEC := ... look at TBF\n");
 	fprintf(stderr, "       CLASSID := X:Y\n");
 	fprintf(stderr, "\nNOTE: CLASSID is parsed as hexadecimal input.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: tc filter { compile | swap } ... fw FILE [ compact ]\n");
+	fprintf(stderr, "       FILE lines: MARK[-MARK][/MASK] classid CLASSID [ OPTIONS ]\n");
+	fprintf(stderr, "                   MARK[-MARK][/MASK] queue { QUEUE[-QUEUE] | all } [ OPTIONS ]\n");
 }
 
 static int fw_parse_opt(struct filter_util *qu, char *handle, int argc, char **argv, struct nlmsghdr *n)
@@ -155,8 +160,343 @@ static int fw_print_opt(struct filter_util *qu, FILE *f, struct rtattr *opt, __u
 	return 0;
 }
 
+/*
+ * Map compiler.  Each line maps a range of marks to as many classes,
+ * the class minor counting up with the mark from the one given:
+ *
+ *	0x100-0x1ff classid 1:100
+ *
+ * and comes out as one "handle MARK fw classid X:Y" filter per mark,
+ * for "tc filter compile" to print or "tc filter swap" to pipeline.
+ * Fw filters cannot be built unreachable, so with fc->gate each one
+ * just takes its mark over from the old set when added.
+ *
+ * With "compact", a map giving every mark the class of that minor is
+ * made one fw filter without handles instead: the kernel then uses the
+ * mark itself as the minor of a class of the qdisc it is attached to.
+ *
+ * A map to TX queues instead steers the marks over them in turn, with
+ * an skbedit action per mark; "all" is every queue of the device:
+ *
+ *	0-63/0x3f queue all
+ */
+struct fw_map
+{
+	__u32	first, last;
+	__u32	mask;
+	int	mask_set;
+	__u32	classid;
+	int	queues;		/* 0 for a class map, -1 for all queues */
+	__u32	queue;		/* the first, with queues of them */
+	char	*opts;		/* the rest of the line */
+};
+
+static int fw_map_parse(struct fw_map *m, char *line)
+{
+	char *argv[256], *dash, *slash;
+	int argc, i, n = 0;
+	size_t len = 1;
+
+	memset(m, 0, sizeof(*m));
+	argc = makeargs(line, argv, 256);
+	if (argc == 0)
+		return 1;
+	if (argc < 3 || (strcmp(argv[1], "classid") &&
+			 strcmp(argv[1], "flowid") && strcmp(argv[1], "queue")))
+		return -1;
+
+	if ((slash = strchr(argv[0], '/')) != NULL) {
+		*slash = '\0';
+		if (get_u32(&m->mask, slash + 1, 0))
+			return -1;
+		m->mask_set = 1;
+	}
+	if ((dash = strchr(argv[0], '-')) != NULL)
+		*dash = '\0';
+	if (get_u32(&m->first, argv[0], 0))
+		return -1;
+	m->last = m->first;
+	if (dash && (get_u32(&m->last, dash + 1, 0) || m->last < m->first))
+		return -1;
+	if (strcmp(argv[1], "queue") == 0) {
+		__u32 last;
+
+		if (strcmp(argv[2], "all") == 0) {
+			m->queues = -1;
+		} else {
+			if ((dash = strchr(argv[2], '-')) != NULL)
+				*dash = '\0';
+			if (get_u32(&m->queue, argv[2], 0))
+				return -1;
+			last = m->queue;
+			if (dash && (get_u32(&last, dash + 1, 0) ||
+				     last < m->queue))
+				return -1;
+			if (last > 0xFFFF)
+				return -1;
+			m->queues = last - m->queue + 1;
+		}
+	} else if (get_tc_classid(&m->classid, argv[2]) ||
+		   TC_H_MIN(m->classid) + (m->last - m->first) > 0xFFFF)
+		return -1;
+
+	for (i = 3; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	m->opts = malloc(len);
+	if (m->opts == NULL)
+		return -1;
+	m->opts[0] = '\0';
+	for (i = 3; i < argc; i++)
+		n += sprintf(m->opts + n, " %s", argv[i]);
+	return 0;
+}
+
+static int fw_map_emit(struct filter_compile *fc, const struct fw_map *m)
+{
+	char cmd[8192], mask[16] = "";
+	__u32 mark;
+	int n;
+
+	if (m->mask_set)
+		snprintf(mask, sizeof(mask), "/0x%x", m->mask);
+	for (mark = m->first; ; mark++) {
+		__u32 classid = m->classid + (mark - m->first);
+
+		if (m->queues)
+			n = snprintf(cmd, sizeof(cmd), "%s handle 0x%x%s fw%s "
+				     "action skbedit queue_mapping %u",
+				     fc->prefix, mark, mask, m->opts,
+				     m->queue + (mark - m->first) % m->queues);
+		else
+			n = snprintf(cmd, sizeof(cmd), "%s handle 0x%x%s fw "
+				     "classid %x:%x%s", fc->prefix, mark, mask,
+				     TC_H_MAJ(classid) >> 16, TC_H_MIN(classid),
+				     m->opts);
+		if (n >= sizeof(cmd) || fc->emit(fc, cmd))
+			return -1;
+		if (mark == m->last)
+			break;
+	}
+	return 0;
+}
+
+/* Fits the queues of a map to the device, asked for once per file */
+static int fw_map_queues(struct filter_compile *fc, struct fw_map *m,
+			 int *txqueues)
+{
+	if (m->queues == 0)
+		return 0;
+	if (*txqueues < 0)
+		*txqueues = fc->txqueues ? fc->txqueues(fc) : 0;
+
+	if (m->queues < 0) {
+		if (*txqueues == 0) {
+			fprintf(stderr, "\"queue all\" needs a device that "
+				"tells its number of TX queues\n");
+			return -1;
+		}
+		m->queue = 0;
+		m->queues = *txqueues;
+	} else if (*txqueues && m->queue + m->queues > *txqueues) {
+		fprintf(stderr, "Queue %u is past the %d TX queues of the "
+			"device\n", m->queue + m->queues - 1, *txqueues);
+		return -1;
+	}
+	return 0;
+}
+
+/* Every mark its own minor, of one qdisc, with nothing else to do */
+static int fw_map_identity(const struct fw_map *maps, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (maps[i].mask_set || maps[i].opts[0] || maps[i].queues ||
+		    TC_H_MIN(maps[i].classid) != maps[i].first ||
+		    TC_H_MAJ(maps[i].classid) != TC_H_MAJ(maps[0].classid))
+			return 0;
+	}
+	return 1;
+}
+
+static int fw_compile(struct filter_util *qu, struct filter_compile *fc,
+		      int argc, char **argv)
+{
+	struct fw_map *maps = NULL;
+	char *line = NULL, cmd[512];
+	size_t len = 0;
+	int i, n = 0, err = 0, compact = 0, txqueues = -1;
+	int lineno = cmdlineno;
+	FILE *fp;
+
+	if (argc == 2 && strcmp(argv[1], "compact") == 0)
+		compact = 1;
+	else if (argc != 1) {
+		fprintf(stderr, "Usage: tc filter compile ... fw FILE "
+			"[ compact ]\n");
+		return -1;
+	}
+	fp = strcmp(argv[0], "-") ? fopen(argv[0], "r") : stdin;
+	if (fp == NULL) {
+		perror(argv[0]);
+		return -1;
+	}
+
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		struct fw_map m;
+		int ret = fw_map_parse(&m, line);
+
+		if (ret > 0)
+			continue;
+		if (ret < 0) {
+			fprintf(stderr, "%s:%d: illegal mark map\n",
+				argv[0], cmdlineno);
+			err = -1;
+			break;
+		}
+		if (n % 256 == 0) {
+			struct fw_map *p;
+
+			p = realloc(maps, (n + 256) * sizeof(*maps));
+			if (p == NULL) {
+				free(m.opts);
+				err = -1;
+				break;
+			}
+			maps = p;
+		}
+		maps[n++] = m;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = lineno;
+
+	if (err == 0 && compact) {
+		if (n == 0 || !fw_map_identity(maps, n)) {
+			fprintf(stderr, "\"compact\" needs every mark mapped "
+				"to the class of the same minor\n");
+			err = -1;
+		} else {
+			snprintf(cmd, sizeof(cmd), "%s fw", fc->prefix);
+			err = fc->emit(fc, cmd);
+		}
+	}
+	for (i = 0; err == 0 && !compact && i < n; i++) {
+		err = fw_map_queues(fc, &maps[i], &txqueues);
+		if (err == 0)
+			err = fw_map_emit(fc, &maps[i]);
+	}
+
+	for (i = 0; i < n; i++)
+		free(maps[i].opts);
+	free(maps);
+	return err;
+}
+
+/* fw as "tc sim" runs it: the masked mark finds the filter, or is
+ * the class ID itself while the tp has no filters, as cls_fw.c
+ */
+#define FW_SIM_HTSIZE	256
+
+struct fw_sim_filter
+{
+	struct fw_sim_filter	*next;
+	__u32			id;
+	__u32			classid;
+};
+
+struct fw_sim
+{
+	__u32			mask;
+	struct fw_sim_filter	*ht[FW_SIM_HTSIZE];
+};
+
+static unsigned int fw_sim_hash(__u32 id)
+{
+	id ^= id >> 16;
+	id ^= id >> 8;
+	return id % FW_SIM_HTSIZE;
+}
+
+static int fw_sim_add(struct sim_tp *tp, __u32 handle, struct rtattr *opt)
+{
+	struct fw_sim *fs = tp->priv;
+	struct rtattr *tb[TCA_FW_MAX+1];
+	struct fw_sim_filter *f;
+	__u32 mask = 0xFFFFFFFF;
+
+	if (handle == 0) {
+		if (fs == NULL)
+			return 0;
+		fprintf(stderr, "sim: fw filter without a handle\n");
+		return -1;
+	}
+	memset(tb, 0, sizeof(tb));
+	if (opt)
+		parse_rtattr_nested(tb, TCA_FW_MAX, opt);
+	if (tb[TCA_FW_MASK])
+		mask = rta_getattr_u32(tb[TCA_FW_MASK]);
+	if (fs == NULL) {
+		fs = tp->priv = calloc(1, sizeof(*fs));
+		if (fs == NULL)
+			return -1;
+		fs->mask = mask;
+	} else if (fs->mask != mask) {
+		fprintf(stderr, "sim: fw filters of one priority have one mask\n");
+		return -1;
+	}
+
+	for (f = fs->ht[fw_sim_hash(handle)]; f; f = f->next)
+		if (f->id == handle)
+			break;
+	if (f == NULL) {
+		f = calloc(1, sizeof(*f));
+		if (f == NULL)
+			return -1;
+		f->id = handle;
+		f->next = fs->ht[fw_sim_hash(handle)];
+		fs->ht[fw_sim_hash(handle)] = f;
+	}
+	if (tb[TCA_FW_CLASSID])
+		f->classid = rta_getattr_u32(tb[TCA_FW_CLASSID]);
+	return 0;
+}
+
+static int fw_sim_classify(struct sim_tp *tp, const struct sim_pkt *p,
+			   __u32 *classid)
+{
+	struct fw_sim *fs = tp->priv;
+	struct fw_sim_filter *f;
+	__u32 id = p->mark;
+
+	if (fs == NULL) {
+		if (id && (TC_H_MAJ(id) == 0 || !TC_H_MAJ(id ^ tp->qhandle))) {
+			*classid = id;
+			return 0;
+		}
+		return -1;
+	}
+	id &= fs->mask;
+	for (f = fs->ht[fw_sim_hash(id)]; f; f = f->next) {
+		if (f->id == id) {
+			*classid = f->classid;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static const struct sim_filter_ops fw_sim = {
+	.add		= fw_sim_add,
+	.classify	= fw_sim_classify,
+};
+
 struct filter_util fw_filter_util = {
 	.id = "fw",
 	.parse_fopt = fw_parse_opt,
 	.print_fopt = fw_print_opt,
+	.compile_fopt = fw_compile,
+	.sim = &fw_sim,
 };
@@ -20,11 +20,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <stdarg.h>
 #include <linux/if.h>
 #include <linux/if_ether.h>
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_sim.h"
 
 extern int show_pretty;
 
@@ -1287,8 +1289,783 @@ static int u32_print_opt(struct filter_util *qu, FILE *f, struct rtattr *opt,
 	return 0;
 }
 
+/*
+ * Rule compiler.  Reads flat rules, one per line in the syntax of
+ * "tc filter add ... u32", and prints a tc -batch script building a
+ * hashed hierarchy that classifies the same way.  A run of consecutive
+ * rules that all match one full byte of the header is moved to a hash
+ * table keyed on that byte and reached through one link node; the
+ * byte is chosen to give the smallest worst case bucket, and the
+ * divisor is the smallest one that separates all values seen.  Buckets
+ * that are still long are hashed again on another byte.  Rules that do
+ * not match the byte stay where they were, so the first matching rule
+ * still wins.
+ */
+#define U32_COMPILE_DEPTH	4
+#define U32_COMPILE_CAND	64
+
+struct u32_rule
+{
+	char			*text;
+	int			nkeys;
+	struct tc_u32_key	*keys;
+};
+
+struct u32_compiler
+{
+	struct filter_compile	*fc;
+	struct u32_rule		*rules;
+	int			nrules;
+	unsigned		next_ht;
+};
+
+/* A window is the byte at shift (24, 16, 8 or 0) of the word at off */
+#define U32_WIN(off, shift)	(((off) << 2) | ((shift) >> 3))
+#define U32_WIN_OFF(w)		((w) >> 2)
+#define U32_WIN_SHIFT(w)	(((w) & 3) << 3)
+
+static int u32_rule_byte(const struct u32_rule *r, int w)
+{
+	int i;
+
+	for (i = 0; i < r->nkeys; i++) {
+		const struct tc_u32_key *k = &r->keys[i];
+
+		if (k->off == U32_WIN_OFF(w) && k->offmask == 0 &&
+		    ((ntohl(k->mask) >> U32_WIN_SHIFT(w)) & 0xFF) == 0xFF)
+			return (ntohl(k->val) >> U32_WIN_SHIFT(w)) & 0xFF;
+	}
+	return -1;
+}
+
+/* Hand one "filter add" command to the sink; ht NULL is the root */
+static int u32_emit(struct u32_compiler *c, const char *ht,
+		    const char *fmt, ...)
+{
+	char cmd[8192];
+	va_list ap;
+	int len;
+
+	len = snprintf(cmd, sizeof(cmd), "%s u32 ", c->fc->prefix);
+	if (ht)
+		len += snprintf(cmd + len, sizeof(cmd) - len, "ht %s ", ht);
+	va_start(ap, fmt);
+	len += vsnprintf(cmd + len, sizeof(cmd) - len, fmt, ap);
+	va_end(ap);
+	if (len >= sizeof(cmd)) {
+		fprintf(stderr, "Rule is too long\n");
+		return -1;
+	}
+	return c->fc->emit(c->fc, cmd);
+}
+
+/* Create a hash table with a free ID.  IDs from 0x800 up are given by
+ * the kernel to the root tables of u32 instances and are never used.
+ */
+static int u32_new_ht(struct u32_compiler *c, int divisor)
+{
+	char cmd[512];
+	unsigned id;
+
+	while (c->next_ht < 0x800 && c->fc->ht_busy &&
+	       c->fc->ht_busy[c->next_ht])
+		c->next_ht++;
+	if (c->next_ht >= 0x800) {
+		fprintf(stderr, "Out of hash table IDs\n");
+		return -1;
+	}
+	id = c->next_ht++;
+	snprintf(cmd, sizeof(cmd), "%s handle %x: u32 divisor %d",
+		 c->fc->prefix, id, divisor);
+	if (c->fc->emit(c->fc, cmd))
+		return -1;
+	return id;
+}
+
+static int u32_rule_parse(struct filter_util *qu, struct u32_rule *r,
+			  char *line)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[MAX_MSG];
+	} req;
+	struct rtattr *tb[TCA_MAX+1];
+	struct rtattr *opt[TCA_U32_MAX+1];
+	struct tc_u32_sel *sel;
+	char *argv[256];
+	int argc, i, len;
+
+	r->text = strdup(line);
+	if (r->text == NULL)
+		return -1;
+	argc = makeargs(line, argv, 256);
+	if (argc == 0) {
+		r->text[0] = 0;
+		return 0;
+	}
+
+	/* Printed back normalized, one space between words */
+	for (i = 0, len = 0; i < argc; i++)
+		len += sprintf(r->text + len, i ? " %s" : "%s", argv[i]);
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	if (u32_parse_opt(qu, NULL, argc, argv, &req.n))
+		return -1;
+	if (req.t.tcm_handle) {
+		fprintf(stderr, "\"order\" is assigned by the compiler\n");
+		return -1;
+	}
+
+	len = req.n.nlmsg_len - NLMSG_LENGTH(sizeof(struct tcmsg));
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(&req.t), len);
+	if (tb[TCA_OPTIONS] == NULL)
+		return 0;
+	parse_rtattr_nested(opt, TCA_U32_MAX, tb[TCA_OPTIONS]);
+	if (opt[TCA_U32_HASH] || opt[TCA_U32_LINK] || opt[TCA_U32_DIVISOR]) {
+		fprintf(stderr, "\"ht\", \"link\", \"sample\" and \"divisor\" "
+			"are built by the compiler\n");
+		return -1;
+	}
+	if (opt[TCA_U32_SEL] == NULL)
+		return 0;
+
+	sel = RTA_DATA(opt[TCA_U32_SEL]);
+	r->keys = malloc(sel->nkeys * sizeof(*r->keys) + 1);
+	if (r->keys == NULL)
+		return -1;
+	memcpy(r->keys, sel->keys, sel->nkeys * sizeof(*r->keys));
+	r->nkeys = sel->nkeys;
+	return 0;
+}
+
+/* Worst case number of rules tried when set is hashed on window w */
+static int u32_win_cost(struct u32_compiler *c, const int *set, int n, int w)
+{
+	int count[256];
+	int i, rest = 0, max = 0;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++) {
+		int v = u32_rule_byte(&c->rules[set[i]], w);
+
+		if (v < 0)
+			rest++;
+		else if (++count[v] > max)
+			max = count[v];
+	}
+	return rest + max + 1;
+}
+
+static int u32_best_win(struct u32_compiler *c, const int *set, int n,
+			const int *used, int nused)
+{
+	int cand[U32_COMPILE_CAND];
+	int i, j, k, ncand = 0, best = -1, best_cost = n;
+
+	for (i = 0; i < n; i++) {
+		const struct u32_rule *r = &c->rules[set[i]];
+
+		for (j = 0; j < r->nkeys && ncand < U32_COMPILE_CAND; j++) {
+			int shift;
+
+			if (r->keys[j].offmask)
+				continue;
+			for (shift = 24; shift >= 0; shift -= 8) {
+				int w = U32_WIN(r->keys[j].off, shift);
+
+				if (((ntohl(r->keys[j].mask) >> shift) & 0xFF) != 0xFF)
+					continue;
+				for (k = 0; k < nused && used[k] != w; k++)
+					;
+				if (k < nused)
+					continue;
+				for (k = 0; k < ncand && cand[k] != w; k++)
+					;
+				if (k == ncand && ncand < U32_COMPILE_CAND)
+					cand[ncand++] = w;
+			}
+		}
+	}
+
+	for (i = 0; i < ncand; i++) {
+		int cost = u32_win_cost(c, set, n, cand[i]);
+
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = cand[i];
+		}
+	}
+	return best;
+}
+
+static int u32_compile_set(struct u32_compiler *c, const int *set, int n,
+			   const char *ht, int *used, int nused);
+
+static int u32_compile_run(struct u32_compiler *c, const int *run, int n,
+			   const char *ht, int w, int *used, int nused)
+{
+	unsigned char seen[256];
+	int count[256];
+	int *bucket;
+	int i, b, id, distinct = 0, divisor;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		if (count[u32_rule_byte(&c->rules[run[i]], w)]++ == 0)
+			distinct++;
+
+	/* The smallest divisor that keeps all values apart */
+	for (divisor = 2; divisor < 256; divisor <<= 1) {
+		int d = 0;
+
+		memset(seen, 0, sizeof(seen));
+		for (i = 0; i < 256; i++)
+			if (count[i] && !seen[i & (divisor - 1)]++)
+				d++;
+		if (d == distinct)
+			break;
+	}
+
+	id = u32_new_ht(c, divisor);
+	if (id < 0)
+		return -1;
+
+	bucket = malloc(n * sizeof(*bucket));
+	if (bucket == NULL)
+		return -1;
+	used[nused] = w;
+	for (b = 0; b < divisor; b++) {
+		char bht[32];
+		int nb = 0;
+
+		for (i = 0; i < n; i++)
+			if ((u32_rule_byte(&c->rules[run[i]], w) &
+			     (divisor - 1)) == b)
+				bucket[nb++] = run[i];
+		if (nb == 0)
+			continue;
+		sprintf(bht, "%x:%x:", id, b);
+		if (u32_compile_set(c, bucket, nb, bht, used, nused + 1)) {
+			free(bucket);
+			return -1;
+		}
+	}
+	free(bucket);
+
+	return u32_emit(c, ht, "match u32 0 0 hashkey mask 0x%08x at %d link %x:",
+			(divisor - 1) << U32_WIN_SHIFT(w), U32_WIN_OFF(w), id);
+}
+
+static int u32_compile_set(struct u32_compiler *c, const int *set, int n,
+			   const char *ht, int *used, int nused)
+{
+	int i, j, w = -1;
+
+	if (nused < U32_COMPILE_DEPTH)
+		w = u32_best_win(c, set, n, used, nused);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i; j < n; j++)
+			if (w < 0 || u32_rule_byte(&c->rules[set[j]], w) < 0)
+				break;
+
+		if (j - i > 1 && u32_win_cost(c, set + i, j - i, w) < j - i) {
+			if (u32_compile_run(c, set + i, j - i, ht, w,
+					    used, nused))
+				return -1;
+			continue;
+		}
+		if (j == i)
+			j++;
+		for (; i < j; i++)
+			if (u32_emit(c, ht, "%s", c->rules[set[i]].text))
+				return -1;
+	}
+	return 0;
+}
+
+/* With a gate the top level goes to a table of its own, and the node
+ * linking the root to it is added last, once the rest is in place.
+ */
+static int u32_compile_rules(struct u32_compiler *c, int *used)
+{
+	char gate[32];
+	int *set, i, err, id = -1;
+
+	set = malloc(c->nrules * sizeof(*set));
+	if (set == NULL)
+		return -1;
+	for (i = 0; i < c->nrules; i++)
+		set[i] = i;
+
+	if (c->fc->gate) {
+		id = u32_new_ht(c, 1);
+		if (id < 0) {
+			free(set);
+			return -1;
+		}
+		sprintf(gate, "%x:0:", id);
+	}
+	err = u32_compile_set(c, set, c->nrules, id < 0 ? NULL : gate,
+			      used, 0);
+	free(set);
+
+	if (err == 0 && id >= 0) {
+		if (c->fc->sync && c->fc->sync(c->fc))
+			return -1;
+		err = u32_emit(c, NULL, "match u32 0 0 link %x:", id);
+	}
+	return err;
+}
+
+static int u32_compile(struct filter_util *qu, struct filter_compile *fc,
+		       int argc, char **argv)
+{
+	struct u32_compiler c;
+	int used[U32_COMPILE_DEPTH];
+	char *line = NULL;
+	size_t len = 0;
+	int i, err = 0;
+	int lineno = cmdlineno;
+	FILE *fp;
+
+	if (argc != 1) {
+		fprintf(stderr, "Usage: tc filter compile ... u32 FILE\n");
+		return -1;
+	}
+	fp = strcmp(argv[0], "-") ? fopen(argv[0], "r") : stdin;
+	if (fp == NULL) {
+		perror(argv[0]);
+		return -1;
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.fc = fc;
+	c.next_ht = 1;
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		struct u32_rule r;
+
+		memset(&r, 0, sizeof(r));
+		if (u32_rule_parse(qu, &r, line)) {
+			fprintf(stderr, "%s:%d: illegal rule\n",
+				argv[0], cmdlineno);
+			free(r.text);
+			err = -1;
+			break;
+		}
+		if (r.text[0] == 0) {
+			free(r.text);
+			continue;
+		}
+		if (c.nrules % 1024 == 0) {
+			struct u32_rule *rules;
+
+			rules = realloc(c.rules,
+					(c.nrules + 1024) * sizeof(*rules));
+			if (rules == NULL) {
+				err = -1;
+				break;
+			}
+			c.rules = rules;
+		}
+		c.rules[c.nrules++] = r;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = lineno;
+
+	if (err == 0 && c.nrules)
+		err = u32_compile_rules(&c, used);
+
+	for (i = 0; i < c.nrules; i++) {
+		free(c.rules[i].text);
+		free(c.rules[i].keys);
+	}
+	free(c.rules);
+	return err;
+}
+
+/*
+ * u32 as "tc sim" runs it, after cls_u32.c.  Hash tables belong to the
+ * qdisc and are shared by its u32 filters; each filter starts in its
+ * root table.  A request makes the root as the kernel would; a dump
+ * only names tables, and the root of a filter is then its own table
+ * that nothing links to, the oldest if there are several.
+ */
+struct u32_sim_ht;
+
+struct u32_sim_knode
+{
+	struct u32_sim_knode	*next;
+	__u32			handle;
+	__u32			classid;
+	__u32			link;
+	struct u32_sim_ht	*ht_up;
+	struct u32_sim_ht	*ht_down;
+	int			fshift;
+	int			has_mark;
+	struct tc_u32_mark	mark;
+	struct tc_u32_sel	*sel;
+};
+
+struct u32_sim_ht
+{
+	struct u32_sim_ht	*next;
+	__u32			handle;
+	__u32			prio;
+	unsigned int		divisor;	/* buckets less one */
+	int			linked;
+	struct u32_sim_knode	*ht[0];
+};
+
+struct u32_sim_common
+{
+	struct u32_sim_common	*next;
+	__u32			qhandle;
+	struct u32_sim_ht	*hlist;		/* newest first */
+	unsigned int		hgenerator;
+};
+
+struct u32_sim
+{
+	struct u32_sim_common	*c;
+	struct u32_sim_ht	*root;
+};
+
+static struct u32_sim_common *u32_sim_commons;
+
+static struct u32_sim_ht *u32_sim_ht_find(struct u32_sim_common *c,
+					  __u32 handle)
+{
+	struct u32_sim_ht *ht;
+
+	for (ht = c->hlist; ht; ht = ht->next)
+		if (ht->handle == handle)
+			return ht;
+	return NULL;
+}
+
+static __u32 u32_sim_new_htid(struct u32_sim_common *c)
+{
+	int i = 0x800;
+
+	do {
+		if (++c->hgenerator == 0x7FF)
+			c->hgenerator = 1;
+	} while (--i > 0 &&
+		 u32_sim_ht_find(c, (c->hgenerator | 0x800) << 20));
+	return i > 0 ? (c->hgenerator | 0x800) << 20 : 0;
+}
+
+static struct u32_sim_ht *u32_sim_ht_new(struct u32_sim_common *c,
+					 __u32 handle, __u32 prio,
+					 unsigned int divisor)
+{
+	struct u32_sim_ht *ht;
+
+	ht = calloc(1, sizeof(*ht) + (divisor + 1) * sizeof(ht->ht[0]));
+	if (ht == NULL)
+		return NULL;
+	ht->handle = handle;
+	ht->prio = prio;
+	ht->divisor = divisor;
+	ht->next = c->hlist;
+	c->hlist = ht;
+	return ht;
+}
+
+static struct u32_sim *u32_sim_get(struct sim_tp *tp, int *created)
+{
+	struct u32_sim *us = tp->priv;
+	struct u32_sim_common *c;
+
+	if (us)
+		return us;
+	us = tp->priv = calloc(1, sizeof(*us));
+	if (us == NULL)
+		return NULL;
+	for (c = u32_sim_commons; c; c = c->next)
+		if (c->qhandle == tp->qhandle)
+			break;
+	if (c == NULL) {
+		c = calloc(1, sizeof(*c));
+		if (c == NULL)
+			return NULL;
+		c->qhandle = tp->qhandle;
+		c->next = u32_sim_commons;
+		u32_sim_commons = c;
+		if (created)
+			*created = 1;
+	}
+	us->c = c;
+	return us;
+}
+
+static int u32_sim_init(struct sim_tp *tp)
+{
+	int created = 0;
+	struct u32_sim *us = u32_sim_get(tp, &created);
+	__u32 handle;
+
+	if (us == NULL)
+		return -1;
+	handle = created ? 0x80000000 : u32_sim_new_htid(us->c);
+	us->root = u32_sim_ht_new(us->c, handle, tp->prio, 0);
+	return us->root ? 0 : -1;
+}
+
+static int u32_sim_add(struct sim_tp *tp, __u32 handle, struct rtattr *opt)
+{
+	struct u32_sim *us = u32_sim_get(tp, NULL);
+	struct rtattr *tb[TCA_U32_MAX+1];
+	struct u32_sim_knode *n, **ins;
+	struct u32_sim_ht *ht;
+	struct tc_u32_sel *sel;
+	__u32 htid;
+	int len;
+
+	if (us == NULL)
+		return -1;
+	if (opt == NULL)
+		return 0;
+	parse_rtattr_nested(tb, TCA_U32_MAX, opt);
+
+	if (tb[TCA_U32_DIVISOR]) {
+		unsigned int divisor = rta_getattr_u32(tb[TCA_U32_DIVISOR]);
+
+		if (divisor == 0 || --divisor > 0x100 || TC_U32_KEY(handle)) {
+			fprintf(stderr, "sim: bad u32 hash table\n");
+			return -1;
+		}
+		handle = handle ? TC_U32_HTID(handle) : u32_sim_new_htid(us->c);
+		if (handle == 0 || u32_sim_ht_find(us->c, handle)) {
+			fprintf(stderr, "sim: u32 hash table %x: exists\n",
+				TC_U32_USERHTID(handle));
+			return -1;
+		}
+		return u32_sim_ht_new(us->c, handle, tp->prio, divisor) ? 0 : -1;
+	}
+
+	if (tb[TCA_U32_HASH] && TC_U32_HTID(rta_getattr_u32(tb[TCA_U32_HASH])) !=
+				TC_U32_ROOT) {
+		htid = rta_getattr_u32(tb[TCA_U32_HASH]);
+		ht = u32_sim_ht_find(us->c, TC_U32_HTID(htid));
+	} else {
+		ht = us->root;
+		htid = ht ? ht->handle : 0;
+	}
+	if (ht == NULL || TC_U32_HASH(htid) > ht->divisor) {
+		fprintf(stderr, "sim: no u32 hash table %x:\n",
+			TC_U32_USERHTID(htid));
+		return -1;
+	}
+	if (handle) {
+		if (TC_U32_HTID(handle) && TC_U32_HTID(handle ^ htid)) {
+			fprintf(stderr, "sim: u32 handle %x not in table %x:\n",
+				handle, TC_U32_USERHTID(htid));
+			return -1;
+		}
+		handle = htid | TC_U32_NODE(handle);
+	} else {
+		unsigned int i = 0x7FF;
+
+		for (n = ht->ht[TC_U32_HASH(htid)]; n; n = n->next)
+			if (i < TC_U32_NODE(n->handle))
+				i = TC_U32_NODE(n->handle);
+		i++;
+		handle = htid | (i > 0xFFF ? 0xFFF : i);
+	}
+
+	if (tb[TCA_U32_SEL] == NULL ||
+	    RTA_PAYLOAD(tb[TCA_U32_SEL]) < sizeof(*sel)) {
+		fprintf(stderr, "sim: u32 filter without a selector\n");
+		return -1;
+	}
+	sel = RTA_DATA(tb[TCA_U32_SEL]);
+	len = sizeof(*sel) + sel->nkeys * sizeof(struct tc_u32_key);
+	if (RTA_PAYLOAD(tb[TCA_U32_SEL]) < len)
+		return -1;
+
+	for (ins = &ht->ht[TC_U32_HASH(handle)]; *ins; ins = &(*ins)->next)
+		if (TC_U32_NODE(handle) <= TC_U32_NODE((*ins)->handle))
+			break;
+	n = *ins;
+	if (n == NULL || n->handle != handle) {
+		n = calloc(1, sizeof(*n));
+		if (n == NULL)
+			return -1;
+		n->handle = handle;
+		n->ht_up = ht;
+		n->next = *ins;
+		*ins = n;
+	}
+	free(n->sel);
+	n->sel = malloc(len);
+	if (n->sel == NULL)
+		return -1;
+	memcpy(n->sel, sel, len);
+	n->fshift = sel->hmask ? ffs(ntohl(sel->hmask)) - 1 : 0;
+	if (tb[TCA_U32_CLASSID])
+		n->classid = rta_getattr_u32(tb[TCA_U32_CLASSID]);
+	if (tb[TCA_U32_LINK])
+		n->link = TC_U32_HTID(rta_getattr_u32(tb[TCA_U32_LINK]));
+	if (tb[TCA_U32_MARK] &&
+	    RTA_PAYLOAD(tb[TCA_U32_MARK]) >= sizeof(n->mark)) {
+		memcpy(&n->mark, RTA_DATA(tb[TCA_U32_MARK]), sizeof(n->mark));
+		n->has_mark = 1;
+	}
+	return 0;
+}
+
+/* Links name tables that may be dumped after them */
+static int u32_sim_start(struct sim_tp *tp)
+{
+	struct u32_sim *us = tp->priv;
+	struct u32_sim_ht *ht, *root = NULL;
+	struct u32_sim_knode *n;
+	unsigned int h;
+
+	if (us == NULL) {
+		us = u32_sim_get(tp, NULL);
+		if (us == NULL)
+			return -1;
+	}
+	for (ht = us->c->hlist; ht; ht = ht->next) {
+		for (h = 0; h <= ht->divisor; h++) {
+			for (n = ht->ht[h]; n; n = n->next) {
+				if (n->link == 0 || n->ht_down)
+					continue;
+				n->ht_down = u32_sim_ht_find(us->c, n->link);
+				if (n->ht_down == NULL) {
+					fprintf(stderr, "sim: u32 link to missing table %x:\n",
+						TC_U32_USERHTID(n->link));
+					return -1;
+				}
+				n->ht_down->linked = 1;
+			}
+		}
+	}
+	if (us->root)
+		return 0;
+	for (ht = us->c->hlist; ht; ht = ht->next)
+		if (ht->prio == tp->prio && !ht->linked &&
+		    (ht->handle & 0x80000000))
+			root = ht;
+	us->root = root ? : u32_sim_ht_new(us->c, 0, tp->prio, 0);
+	return us->root ? 0 : -1;
+}
+
+static int u32_sim_word(const struct sim_pkt *p, int off, __u32 *v)
+{
+	if (off < 0 || off + 4 > p->caplen)
+		return -1;
+	memcpy(v, p->data + off, 4);
+	return 0;
+}
+
+static int u32_sim_classify(struct sim_tp *tp, const struct sim_pkt *p,
+			    __u32 *classid)
+{
+	struct {
+		struct u32_sim_knode	*knode;
+		unsigned int		off;
+	} stack[TC_U32_MAXDEPTH];
+	struct u32_sim *us = tp->priv;
+	struct u32_sim_ht *ht = us->root;
+	struct u32_sim_knode *n;
+	unsigned int off = 0, sel = 0;
+	int sdepth = 0, off2 = 0, i;
+	__u32 data;
+
+next_ht:
+	n = ht->ht[sel];
+next_knode:
+	if (n) {
+		struct tc_u32_key *key = n->sel->keys;
+
+		if (n->has_mark && (p->mark & n->mark.mask) != n->mark.val) {
+			n = n->next;
+			goto next_knode;
+		}
+		for (i = n->sel->nkeys; i > 0; i--, key++) {
+			if (u32_sim_word(p, off + key->off + (off2 & key->offmask),
+					 &data))
+				return -1;
+			if ((data ^ key->val) & key->mask) {
+				n = n->next;
+				goto next_knode;
+			}
+		}
+		if (n->ht_down == NULL) {
+check_terminal:
+			if (n->sel->flags & TC_U32_TERMINAL) {
+				*classid = n->classid;
+				return 0;
+			}
+			n = n->next;
+			goto next_knode;
+		}
+
+		if (sdepth >= TC_U32_MAXDEPTH)
+			return -1;
+		stack[sdepth].knode = n;
+		stack[sdepth].off = off;
+		sdepth++;
+		ht = n->ht_down;
+		sel = 0;
+		if (ht->divisor) {
+			if (u32_sim_word(p, off + n->sel->hoff, &data))
+				return -1;
+			sel = ht->divisor &
+			      (ntohl(data & n->sel->hmask) >> n->fshift);
+		}
+		if (!(n->sel->flags & (TC_U32_VAROFFSET|TC_U32_OFFSET|TC_U32_EAT)))
+			goto next_ht;
+		if (n->sel->flags & (TC_U32_OFFSET|TC_U32_VAROFFSET)) {
+			off2 = n->sel->off + 3;
+			if (n->sel->flags & TC_U32_VAROFFSET) {
+				__u16 v;
+
+				if (off + n->sel->offoff + 2 > p->caplen)
+					return -1;
+				memcpy(&v, p->data + off + n->sel->offoff, 2);
+				off2 += ntohs(n->sel->offmask & v) >>
+					n->sel->offshift;
+			}
+			off2 &= ~3;
+		}
+		if (n->sel->flags & TC_U32_EAT) {
+			off += off2;
+			off2 = 0;
+		}
+		if (off < p->caplen)
+			goto next_ht;
+	}
+
+	if (sdepth--) {
+		n = stack[sdepth].knode;
+		ht = n->ht_up;
+		off = stack[sdepth].off;
+		goto check_terminal;
+	}
+	return -1;
+}
+
+static const struct sim_filter_ops u32_sim = {
+	.init		= u32_sim_init,
+	.add		= u32_sim_add,
+	.start		= u32_sim_start,
+	.classify	= u32_sim_classify,
+};
+
 struct filter_util u32_filter_util = {
 	.id = "u32",
 	.parse_fopt = u32_parse_opt,
 	.print_fopt = u32_print_opt,
+	.compile_fopt = u32_compile,
+	.sim = &u32_sim,
 };
@@ -40,6 +40,9 @@ int gact_ld = 0 ; //fuckin backward compatibility
 int batch_c = 0;
 int tab_flush = 0;
 
+/* "tc actions list ... offset N limit N" pages through the dump */
+static unsigned act_offset, act_limit, act_seen;
+
 void act_usage(void)
 {
 	/*XXX: In the near future add a action->print_help to improve
@@ -62,6 +65,11 @@ void act_usage(void)
 			"\tACTDETAIL := <ACTNAME> <ACTPARAMS>\n"
 			"\t\tExample ACTNAME is gact, mirred etc\n"
 			"\t\tEach action has its own parameters (ACTPARAMS)\n"
+			"\n"
+			"\tA single ACTSPEC of add, change or replace may take\n"
+			"\t\tindex FIRST-LAST to install one action per index;\n"
+			"\t\tfilters refer to one with action <ACTNAME> index N\n"
+			"\tls and list take [offset N] [limit N] after ACTNAMESPEC\n"
 			"\n");
 
 	exit(-1);
@@ -111,6 +119,11 @@ restart_s:
 			return a;
 	}
 
+	snprintf(buf, sizeof(buf), "%s_action_util", str);
+	a = get_builtin_sym(buf);
+	if (a)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), "%s/m_%s.so", get_tc_lib(), str);
 	dlh = dlopen(buf, RTLD_LAZY | RTLD_GLOBAL);
 	if (dlh == NULL) {
@@ -164,8 +177,10 @@ new_cmd(char **argv)
 
 }
 
-int
-parse_action(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
+/* Parses up to max actions; argv is left at the "action" of the next */
+static int
+parse_action_n(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n,
+	       int max)
 {
 	int argc = *argc_p;
 	char **argv = *argv_p;
@@ -189,6 +204,8 @@ parse_action(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 		memset(k, 0, sizeof (k));
 
 		if (strcmp(*argv, "action") == 0 ) {
+			if (ok >= max)
+				break;
 			argc--;
 			argv++;
 			eap = 1;
@@ -254,6 +271,19 @@ bad_val:
 	return -1;
 }
 
+int
+parse_action(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
+{
+	if (parse_action_n(argc_p, argv_p, tca_id, n, TCA_ACT_MAX_PRIO) < 0)
+		return -1;
+	if (*argc_p > 0 && strcmp(**argv_p, "action") == 0) {
+		fprintf(stderr, "Too many actions, at most %d\n",
+			TCA_ACT_MAX_PRIO);
+		return -1;
+	}
+	return 0;
+}
+
 int
 tc_print_one_action(FILE * f, struct rtattr *arg)
 {
@@ -314,8 +344,14 @@ tc_print_action(FILE * f, const struct rtattr *arg)
 		return ret;
 	}
 
-	for (i = 0; i < TCA_ACT_MAX_PRIO; i++) {
+	/* Dumps number the actions from 0, filters from 1 */
+	for (i = 0; i <= TCA_ACT_MAX_PRIO; i++) {
 		if (tb[i]) {
+			unsigned seen = act_seen++;
+
+			if (seen < act_offset ||
+			    (act_limit && seen - act_offset >= act_limit))
+				continue;
 			fprintf(f, "\n\taction order %d: ", i + batch_c);
 			if (0 > tc_print_one_action(f, tb[i])) {
 				fprintf(f, "Error printing action\n");
@@ -328,6 +364,49 @@ tc_print_action(FILE * f, const struct rtattr *arg)
 	return 0;
 }
 
+/* One object per action; the ones of filters stay in their options */
+static void print_action_json(FILE *f, struct nlmsghdr *n,
+			      const struct rtattr *arg)
+{
+	struct rtattr *tb[TCA_ACT_MAX_PRIO + 1];
+	int i;
+
+	parse_rtattr_nested(tb, TCA_ACT_MAX_PRIO, arg);
+
+	for (i = 0; i <= TCA_ACT_MAX_PRIO; i++) {
+		struct rtattr *atb[TCA_ACT_MAX + 1];
+		struct action_util *a;
+		struct json_text jt;
+		unsigned seen;
+
+		if (tb[i] == NULL)
+			continue;
+		seen = act_seen++;
+		if (seen < act_offset ||
+		    (act_limit && seen - act_offset >= act_limit))
+			continue;
+
+		parse_rtattr_nested(atb, TCA_ACT_MAX, tb[i]);
+		if (atb[TCA_ACT_KIND] == NULL)
+			continue;
+
+		fprintf(f, "{\"object\":\"action\"");
+		if (n->nlmsg_type == RTM_DELACTION)
+			fprintf(f, ",\"deleted\":true");
+		fprintf(f, ",\"order\":%d,\"kind\":", i + batch_c);
+		print_json_string(f, rta_getattr_str(atb[TCA_ACT_KIND]));
+		a = get_action_kind(RTA_DATA(atb[TCA_ACT_KIND]));
+		if (a && atb[TCA_ACT_OPTIONS] && json_text_open(&jt)) {
+			a->print_aopt(a, jt.fp, atb[TCA_ACT_OPTIONS]);
+			json_text_close(f, "options", &jt);
+		}
+		print_tcstats_json(f, atb[TCA_ACT_STATS], NULL, NULL);
+		fprintf(f, "}\n");
+	}
+
+	batch_c += TCA_ACT_MAX_PRIO;
+}
+
 int print_action(const struct sockaddr_nl *who,
 			   struct nlmsghdr *n,
 			   void *arg)
@@ -352,6 +431,15 @@ int print_action(const struct sockaddr_nl *who,
 		return -1;
 	}
 
+	if (show_tlv) {
+		fwrite(n, n->nlmsg_len, 1, fp);
+		return 0;
+	}
+	if (show_json) {
+		print_action_json(fp, n, tb[TCA_ACT_TAB]);
+		return 0;
+	}
+
 	if (n->nlmsg_type == RTM_DELACTION) {
 		if (n->nlmsg_flags & NLM_F_ROOT) {
 			fprintf(fp, "Flushed table ");
@@ -480,12 +568,9 @@ bad_val:
 	return ret;
 }
 
-int tc_action_modify(int cmd, unsigned flags, int *argc_p, char ***argv_p)
+static int tc_action_send(int cmd, unsigned flags, int *argc_p,
+			  char ***argv_p)
 {
-	int argc = *argc_p;
-	char **argv = *argv_p;
-	int ret = 0;
-
 	struct rtattr *tail;
 	struct {
 		struct nlmsghdr         n;
@@ -493,17 +578,15 @@ int tc_action_modify(int cmd, unsigned flags, int *argc_p, char ***argv_p)
 		char                    buf[MAX_MSG];
 	} req;
 
-	req.t.tca_family = AF_UNSPEC;
-
 	memset(&req, 0, sizeof(req));
 
 	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg));
 	req.n.nlmsg_flags = NLM_F_REQUEST|flags;
 	req.n.nlmsg_type = cmd;
+	req.t.tca_family = AF_UNSPEC;
 	tail = NLMSG_TAIL(&req.n);
-	argc -=1;
-	argv +=1;
-	if (parse_action(&argc, &argv, TCA_ACT_TAB, &req.n)) {
+	if (parse_action_n(argc_p, argv_p, TCA_ACT_TAB, &req.n,
+			   TCA_ACT_MAX_PRIO)) {
 		fprintf(stderr, "Illegal \"action\"\n");
 		return -1;
 	}
@@ -511,7 +594,113 @@ int tc_action_modify(int cmd, unsigned flags, int *argc_p, char ***argv_p)
 
 	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0) {
 		fprintf(stderr, "We have an error talking to the kernel\n");
-		ret = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* Splits "FIRST-LAST" */
+static int get_index_range(__u32 *first, __u32 *last, char *str)
+{
+	char *dash = strchr(str, '-');
+	int err;
+
+	if (dash == NULL)
+		return -1;
+	*dash = 0;
+	err = get_u32(first, str, 10) || get_u32(last, dash + 1, 10) ||
+		*first == 0 || *first > *last;
+	*dash = '-';
+	return err ? -1 : 0;
+}
+
+/*
+ * One ACTSPEC with "index FIRST-LAST" stands for one action per index,
+ * sent TCA_ACT_MAX_PRIO to a message.
+ */
+static int tc_action_bulk(int cmd, unsigned flags, int argc, char **argv,
+			  int range, __u32 first, __u32 last)
+{
+	char num[TCA_ACT_MAX_PRIO][11];
+	char **largv;
+	__u64 i = first;
+	int j, k, ret = 0;
+
+	largv = malloc(TCA_ACT_MAX_PRIO * argc * sizeof(*largv));
+	if (largv == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	while (i <= last && ret == 0) {
+		int largc = 0;
+		char **lp = largv;
+
+		for (j = 0; j < TCA_ACT_MAX_PRIO && i <= last; j++, i++) {
+			snprintf(num[j], sizeof(num[j]), "%u", (unsigned)i);
+			for (k = 0; k < argc; k++)
+				largv[largc++] = k == range ? num[j] : argv[k];
+		}
+		ret = tc_action_send(cmd, flags, &largc, &lp);
+	}
+
+	free(largv);
+	return ret;
+}
+
+int tc_action_modify(int cmd, unsigned flags, int *argc_p, char ***argv_p)
+{
+	int argc = *argc_p - 1;
+	char **argv = *argv_p + 1;
+	int nact = 0, range = -1;
+	__u32 first, last;
+	int own_pipe = 0;
+	int ret = 0;
+	int i;
+
+	/* Up to the next command */
+	for (i = 0; i < argc && !new_cmd(&argv[i]); i++) {
+		if (strcmp(argv[i], "action") == 0)
+			nact++;
+		else if (i > 0 && strcmp(argv[i - 1], "index") == 0 &&
+			 strchr(argv[i], '-')) {
+			if (range >= 0 ||
+			    get_index_range(&first, &last, argv[i])) {
+				fprintf(stderr, "Illegal \"index\" range \"%s\"\n",
+					argv[i]);
+				return -1;
+			}
+			range = i;
+		}
+	}
+	if (range >= 0 && nact > 1) {
+		fprintf(stderr, "An \"index\" range needs a single action\n");
+		return -1;
+	}
+
+	if (rth.pipe == NULL && (range >= 0 || nact > TCA_ACT_MAX_PRIO)) {
+		if (rtnl_pipeline_open(&rth, batch_window ? batch_window : 64,
+				       NULL, NULL) < 0) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			return -1;
+		}
+		own_pipe = 1;
+	}
+
+	if (range >= 0) {
+		ret = tc_action_bulk(cmd, flags, i, argv, range, first, last);
+		argc -= i;
+		argv += i;
+	} else {
+		do {
+			ret = tc_action_send(cmd, flags, &argc, &argv);
+		} while (ret == 0 && argc > 0 && strcmp(*argv, "action") == 0);
+	}
+
+	if (own_pipe) {
+		if (rtnl_pipeline_sync(&rth))
+			ret = -1;
+		rtnl_pipeline_close(&rth);
 	}
 
 	*argc_p = argc;
@@ -559,6 +748,26 @@ int tc_act_list_or_flush(int argc, char **argv, int event)
 	}
 	strncpy(k, *argv, sizeof (k) - 1);
 
+	act_offset = act_limit = act_seen = 0;
+	for (argc--, argv++; argc > 0; argc--, argv++) {
+		if (event != RTM_GETACTION) {
+			fprintf(stderr, "Unknown argument \"%s\"\n", *argv);
+			return -1;
+		}
+		if (strcmp(*argv, "offset") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&act_offset, *argv, 0))
+				invarg("invalid \"offset\"\n", *argv);
+		} else if (strcmp(*argv, "limit") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&act_limit, *argv, 0))
+				invarg("invalid \"limit\"\n", *argv);
+		} else {
+			fprintf(stderr, "Unknown argument \"%s\"\n", *argv);
+			return -1;
+		}
+	}
+
 	addattr_l(&req.n, MAX_MSG, ++prio, NULL, 0);
 	addattr_l(&req.n, MAX_MSG, TCA_ACT_KIND, k, strlen(k) + 1);
 	tail2->rta_len = (void *) NLMSG_TAIL(&req.n) - (void *) tail2;
@@ -571,7 +780,8 @@ int tc_act_list_or_flush(int argc, char **argv, int event)
 			perror("Cannot send dump request");
 			return 1;
 		}
-		ret = rtnl_dump_filter(&rth, print_action, stdout);
+		ret = rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file :
+				       print_action, stdout);
 	}
 
 	if (event == RTM_DELACTION) {
@@ -0,0 +1,189 @@
+/*
+ * m_bpf.c	BPF based action module
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_bpf.h"
+#include "bpf_elf.h"
+#include <linux/tc_act/tc_bpf.h>
+
+static const struct bpf_cfg_ops bpf_act_ops = {
+	.ops_len	= TCA_ACT_BPF_OPS_LEN,
+	.ops		= TCA_ACT_BPF_OPS,
+	.fd		= TCA_ACT_BPF_FD,
+	.name		= TCA_ACT_BPF_NAME,
+};
+
+static void
+explain(void)
+{
+	fprintf(stderr, "Usage: ... bpf BPF_PROG [ CONTROL ] [ index INDEX ]\n"
+		"BPF_PROG := { bytecode BPF_BYTECODE | bytecode-file FILE |\n"
+		"              object-file FILE [ section NAME ] [ verbose ] |\n"
+		"              object-pinned FILE }\n"
+		"BPF_BYTECODE := \"N,CODE JT JF K,...\", as tcpdump -ddd prints it\n"
+		"CONTROL := { reclassify | pipe | drop | continue | pass }\n"
+		"The section of an object defaults to \"%s\", its maps\n"
+		"with pinning are shared under %s/%s.\n",
+		ELF_SECTION_ACTION, BPF_FS_DIR, BPF_FS_TC);
+}
+
+static void
+usage(void)
+{
+	explain();
+	exit(-1);
+}
+
+static int
+parse_bpf(struct action_util *a, int *argc_p, char ***argv_p, int tca_id,
+	  struct nlmsghdr *n)
+{
+	int argc = *argc_p;
+	char **argv = *argv_p;
+	struct tc_act_bpf parm = { .action = TC_ACT_PIPE };
+	struct rtattr *tail;
+	int prog = 0;
+
+	if (matches(*argv, "bpf") != 0)
+		return -1;
+
+	NEXT_ARG();
+
+	tail = NLMSG_TAIL(n);
+	addattr_l(n, MAX_MSG, tca_id, NULL, 0);
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bytecode") == 0 || strcmp(*argv, "bc") == 0 ||
+		    strcmp(*argv, "bytecode-file") == 0 ||
+		    strcmp(*argv, "bcf") == 0 ||
+		    strcmp(*argv, "object-file") == 0 ||
+		    strcmp(*argv, "obj") == 0 ||
+		    strcmp(*argv, "object-pinned") == 0 ||
+		    strcmp(*argv, "pinned") == 0) {
+			if (prog) {
+				fprintf(stderr, "Only one BPF program per action\n");
+				return -1;
+			}
+			if (bpf_parse_common(&argc, &argv, &bpf_act_ops,
+					     BPF_PROG_TYPE_SCHED_ACT,
+					     ELF_SECTION_ACTION, n))
+				return -1;
+			prog = 1;
+			continue;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			break;
+		}
+	}
+
+	if (!prog) {
+		fprintf(stderr, "bpf: a program is needed\n");
+		explain();
+		return -1;
+	}
+
+	if (argc) {
+		if (matches(*argv, "reclassify") == 0) {
+			parm.action = TC_ACT_RECLASSIFY;
+			argc--; argv++;
+		} else if (matches(*argv, "pipe") == 0) {
+			parm.action = TC_ACT_PIPE;
+			argc--; argv++;
+		} else if (matches(*argv, "drop") == 0 ||
+			   matches(*argv, "shot") == 0) {
+			parm.action = TC_ACT_SHOT;
+			argc--; argv++;
+		} else if (matches(*argv, "continue") == 0) {
+			parm.action = TC_ACT_UNSPEC;
+			argc--; argv++;
+		} else if (matches(*argv, "pass") == 0) {
+			parm.action = TC_ACT_OK;
+			argc--; argv++;
+		}
+	}
+
+	if (argc) {
+		if (matches(*argv, "index") == 0) {
+			NEXT_ARG();
+			if (get_u32(&parm.index, *argv, 10)) {
+				fprintf(stderr, "bpf: Illegal \"index\"\n");
+				return -1;
+			}
+			argc--; argv++;
+		}
+	}
+
+	addattr_l(n, MAX_MSG, TCA_ACT_BPF_PARMS, &parm, sizeof(parm));
+	tail->rta_len = (char *)NLMSG_TAIL(n) - (char *)tail;
+
+	*argc_p = argc;
+	*argv_p = argv;
+	return 0;
+}
+
+static int print_bpf(struct action_util *au, FILE *f, struct rtattr *arg)
+{
+	struct rtattr *tb[TCA_ACT_BPF_MAX + 1];
+	struct tc_act_bpf *parm;
+	SPRINT_BUF(b1);
+
+	if (arg == NULL)
+		return -1;
+
+	parse_rtattr_nested(tb, TCA_ACT_BPF_MAX, arg);
+
+	if (tb[TCA_ACT_BPF_PARMS] == NULL) {
+		fprintf(f, "[NULL bpf parameters]");
+		return -1;
+	}
+	parm = RTA_DATA(tb[TCA_ACT_BPF_PARMS]);
+
+	fprintf(f, "bpf ");
+	if (tb[TCA_ACT_BPF_NAME])
+		fprintf(f, "%s ", rta_getattr_str(tb[TCA_ACT_BPF_NAME]));
+	else if (tb[TCA_ACT_BPF_FD])
+		fprintf(f, "pfd %u ", rta_getattr_u32(tb[TCA_ACT_BPF_FD]));
+	if (tb[TCA_ACT_BPF_ID])
+		fprintf(f, "id %u ", rta_getattr_u32(tb[TCA_ACT_BPF_ID]));
+	if (tb[TCA_ACT_BPF_TAG])
+		bpf_print_tag(f, tb[TCA_ACT_BPF_TAG]);
+	if (tb[TCA_ACT_BPF_OPS] && tb[TCA_ACT_BPF_OPS_LEN]) {
+		bpf_print_ops(f, tb[TCA_ACT_BPF_OPS],
+			      rta_getattr_u16(tb[TCA_ACT_BPF_OPS_LEN]));
+		fprintf(f, " ");
+	}
+
+	fprintf(f, "default-action %s\n", action_n2a(parm->action, b1, sizeof(b1)));
+	fprintf(f, "\tindex %d ref %d bind %d", parm->index, parm->refcnt,
+		parm->bindcnt);
+
+	if (show_stats) {
+		if (tb[TCA_ACT_BPF_TM]) {
+			struct tcf_t *tm = RTA_DATA(tb[TCA_ACT_BPF_TM]);
+			print_tm(f, tm);
+		}
+	}
+
+	fprintf(f, "\n ");
+	return 0;
+}
+
+struct action_util bpf_action_util = {
+	.id = "bpf",
+	.parse_aopt = parse_bpf,
+	.print_aopt = print_bpf,
+};
@@ -35,6 +35,9 @@ int ematch_argc;
 char **ematch_argv;
 char *ematch_err = NULL;
 struct ematch *ematch_root;
+int ematch_trailing;
+
+int ematch_optimize;
 
 static int begin_argc;
 static char **begin_argv;
@@ -138,6 +141,11 @@ static struct ematch_util *get_ematch_kind(char *kind)
 			return e;
 	}
 
+	snprintf(buf, sizeof(buf), "%s_ematch_util", kind);
+	e = get_builtin_sym(buf);
+	if (e)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), "em_%s.so", kind);
 	dlh = dlopen(buf, RTLD_LAZY);
 	if (dlh == NULL) {
@@ -154,6 +162,7 @@ static struct ematch_util *get_ematch_kind(char *kind)
 	if (e == NULL)
 		return NULL;
 
+reg:
 	e->next = ematch_list;
 	ematch_list = e;
 
@@ -170,6 +179,32 @@ static struct ematch_util *get_ematch_kind_num(__u16 kind)
 	return get_ematch_kind(name);
 }
 
+static int lookup_ematch(struct ematch *t, struct ematch_util **e, int *num)
+{
+	char buf[64];
+	int err;
+
+	if (t->args == NULL)
+		return -1;
+
+	strncpy(buf, (char*) t->args->data, sizeof(buf)-1);
+	*e = get_ematch_kind(buf);
+	if (*e == NULL) {
+		fprintf(stderr, "Unknown ematch \"%s\"\n",
+		    buf);
+		return -1;
+	}
+
+	err = lookup_map_id(buf, num, EMATCH_MAP);
+	if (err < 0) {
+		if (err == -ENOENT)
+			map_warning((*e)->kind_num, buf);
+		return err;
+	}
+
+	return 0;
+}
+
 static int parse_tree(struct nlmsghdr *n, struct ematch *tree)
 {
 	int index = 1;
@@ -190,28 +225,21 @@ static int parse_tree(struct nlmsghdr *n, struct ematch *tree)
 			__u32 r = t->child_ref;
 			addraw_l(n, MAX_MSG, &hdr, sizeof(hdr));
 			addraw_l(n, MAX_MSG, &r, sizeof(r));
+		} else if (t->data) {
+			struct tcf_ematch_hdr *h = t->data;
+
+			hdr.matchid = h->matchid;
+			hdr.kind = h->kind;
+			hdr.flags |= h->flags & ~(TCF_EM_REL_MASK|TCF_EM_INVERT);
+			addraw_l(n, MAX_MSG, &hdr, sizeof(hdr));
+			addraw_l(n, MAX_MSG, h + 1, t->len - sizeof(hdr));
 		} else {
 			int num = 0, err;
-			char buf[64];
 			struct ematch_util *e;
 
-			if (t->args == NULL)
-				return -1;
-
-			strncpy(buf, (char*) t->args->data, sizeof(buf)-1);
-			e = get_ematch_kind(buf);
-			if (e == NULL) {
-				fprintf(stderr, "Unknown ematch \"%s\"\n",
-				    buf);
-				return -1;
-			}
-
-			err = lookup_map_id(buf, &num, EMATCH_MAP);
-			if (err < 0) {
-				if (err == -ENOENT)
-					map_warning(e->kind_num, buf);
+			err = lookup_ematch(t, &e, &num);
+			if (err < 0)
 				return err;
-			}
 
 			hdr.kind = num;
 			if (e->parse_eopt(n, &hdr, t->args->next) < 0)
@@ -254,6 +282,191 @@ static int flatten_tree(struct ematch *head, struct ematch *tree)
 	return count;
 }
 
+/*
+ * With -optimize the tree is rewritten before it is flattened.  The
+ * kernel runs a sequence left to right and stops as soon as a relation
+ * settles the result, so "a AND b OR c" is a AND (b OR c): the matches
+ * of a run sharing one relation, together with the rest of the sequence
+ * after them, may be swapped around since matches have no side effects.
+ * So containers that only continue the run they are in are opened, the
+ * matches of each run are put cheapest first and, where all of a run
+ * must hold, two matches of a kind able to fold them become one.
+ */
+#define EM_COST_DEFAULT	8
+#define EM_RUN_MAX	32
+
+static int encode_tree(struct ematch *tree)
+{
+	static __u32 buf[MAX_MSG / sizeof(__u32)];
+	struct nlmsghdr *n = (struct nlmsghdr *) buf;
+	struct ematch *t;
+
+	for (t = tree; t; t = t->next) {
+		int num = 0, err;
+		struct ematch_util *e;
+		struct tcf_ematch_hdr hdr = {};
+
+		if (t->child) {
+			if (encode_tree(t->child) < 0)
+				return -1;
+			continue;
+		}
+
+		err = lookup_ematch(t, &e, &num);
+		if (err < 0)
+			return err;
+
+		hdr.kind = num;
+		n->nlmsg_len = NLMSG_LENGTH(0);
+		if (e->parse_eopt(n, &hdr, t->args->next) < 0)
+			return -1;
+
+		t->len = NLMSG_ALIGN(n->nlmsg_len) - NLMSG_LENGTH(0);
+		if (t->len < sizeof(hdr))
+			return -1;
+		t->data = malloc(t->len);
+		if (t->data == NULL)
+			return -1;
+		memcpy(t->data, NLMSG_DATA(n), t->len);
+		t->e = e;
+	}
+
+	return 0;
+}
+
+static int ematch_cost(const struct ematch *t)
+{
+	struct tcf_ematch_hdr *hdr = t->data;
+	int cost = 0;
+
+	if (t->child) {
+		for (t = t->child; t; t = t->next)
+			cost += ematch_cost(t);
+		return cost;
+	}
+
+	if (t->e->cost)
+		cost = t->e->cost(hdr, hdr + 1, t->len - sizeof(*hdr));
+
+	return cost > 0 ? cost : EM_COST_DEFAULT;
+}
+
+static int ematch_merge(struct ematch *a, const struct ematch *b)
+{
+	struct tcf_ematch_hdr *ha = a->data, *hb = b->data;
+
+	if (a->child || b->child || a->inverted || b->inverted ||
+	    a->e != b->e || a->e->merge == NULL ||
+	    ha->kind != hb->kind || ha->matchid != hb->matchid ||
+	    ha->flags != hb->flags)
+		return -1;
+
+	return a->e->merge(ha + 1, a->len - sizeof(*ha),
+			   hb + 1, b->len - sizeof(*hb));
+}
+
+/* The relation all of a sequence is joined by, 0 if there are several */
+static int ematch_relation(const struct ematch *t)
+{
+	int relation = t->relation;
+
+	for (; t->next; t = t->next)
+		if (t->relation != relation)
+			return 0;
+
+	return relation;
+}
+
+/* Orders and merges the run starting at *pp, returns where the next starts */
+static struct ematch **optimize_run(struct ematch **pp)
+{
+	struct ematch *run[EM_RUN_MAX], *t = *pp;
+	int cost[EM_RUN_MAX];
+	int i, j, n = 0, last = 0, relation = t->relation;
+
+	if (relation == 0)
+		return &t->next;
+
+	for (; t && t->relation == relation && n < EM_RUN_MAX; t = t->next)
+		run[n++] = t;
+	if (t && t->relation == 0 && n < EM_RUN_MAX) {
+		run[n++] = t;
+		t = t->next;
+		last = 1;
+	}
+
+	if (relation == TCF_EM_REL_AND) {
+		for (i = 0; i < n; i++) {
+			for (j = i + 1; j < n; ) {
+				if (ematch_merge(run[i], run[j]) < 0) {
+					j++;
+					continue;
+				}
+				memmove(&run[j], &run[j + 1],
+					(n - j - 1) * sizeof(run[0]));
+				n--;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		struct ematch *m = run[i];
+		int c = ematch_cost(m);
+
+		for (j = i; j > 0 && cost[j - 1] > c; j--) {
+			run[j] = run[j - 1];
+			cost[j] = cost[j - 1];
+		}
+		run[j] = m;
+		cost[j] = c;
+	}
+
+	for (i = 0; i < n; i++) {
+		run[i]->relation = relation;
+		run[i]->next = i + 1 < n ? run[i + 1] : t;
+	}
+	if (last)
+		run[n - 1]->relation = 0;
+
+	*pp = run[0];
+	return &run[n - 1]->next;
+}
+
+static struct ematch *optimize_tree(struct ematch *tree)
+{
+	struct ematch **pp, *t, *c;
+
+	for (t = tree; t; t = t->next)
+		if (t->child)
+			t->child = optimize_tree(t->child);
+
+	for (pp = &tree; (t = *pp) != NULL; ) {
+		c = t->child;
+		if (c == NULL) {
+			pp = &t->next;
+		} else if (c->next == NULL) {
+			c->inverted ^= t->inverted;
+			c->relation = t->relation;
+			c->next = t->next;
+			*pp = c;
+		} else if (!t->inverted && (t->relation == 0 ||
+			   ematch_relation(c) == t->relation)) {
+			while (c->next)
+				c = c->next;
+			c->relation = t->relation;
+			c->next = t->next;
+			*pp = t->child;
+		} else {
+			pp = &t->next;
+		}
+	}
+
+	for (pp = &tree; *pp; )
+		pp = optimize_run(pp);
+
+	return tree;
+}
+
 int em_parse_error(int err, struct bstr *args, struct bstr *carg,
 		   struct ematch_util *e, char *fmt, ...)
 {
@@ -315,12 +528,126 @@ static inline void free_ematch_err(void)
 	}
 }
 
+/*
+ * Filters generated in bulk repeat a handful of expressions, so the tree
+ * built for an expression is kept, keyed by its words, and copied into
+ * later messages without running the parser again.  Only expressions
+ * that ended before another argument are kept: that argument is what
+ * told the parser the expression was over, and a later use is reused
+ * only if what follows it could not continue the expression either.
+ */
+#define EMATCH_CACHE_HASH	256
+
+struct ematch_cached
+{
+	struct ematch_cached	*next;
+	int			nwords;
+	char			**words;
+	int			len;
+	char			tree[0];
+};
+
+static struct ematch_cached *ematch_cache[EMATCH_CACHE_HASH];
+
+static unsigned int ematch_cache_hash(const char *word)
+{
+	unsigned int h = 0;
+
+	while (*word)
+		h = h * 31 + (unsigned char) *word++;
+
+	return h % EMATCH_CACHE_HASH;
+}
+
+/* Could the lexer carry on with the expression into this argument? */
+static int ematch_continues(const char *word)
+{
+	int n;
+
+	while (*word == ' ' || *word == '\t' || *word == '\r' || *word == '\n')
+		word++;
+
+	if (*word == 0 || *word == '"')
+		return 1;
+
+	if (strncasecmp(word, "and", 3) == 0)
+		n = 3;
+	else if (strncasecmp(word, "or", 2) == 0)
+		n = 2;
+	else
+		return 0;
+
+	return strchr(" \t\r\n()", word[n]) != NULL;
+}
+
+static struct ematch_cached *ematch_cache_find(int argc, char **argv)
+{
+	struct ematch_cached *c;
+	int i;
+
+	for (c = ematch_cache[ematch_cache_hash(*argv)]; c; c = c->next) {
+		if (argc <= c->nwords || ematch_continues(argv[c->nwords]))
+			continue;
+		for (i = 0; i < c->nwords; i++)
+			if (strcmp(c->words[i], argv[i]) != 0)
+				break;
+		if (i == c->nwords)
+			return c;
+	}
+
+	return NULL;
+}
+
+static void ematch_cache_add(int nwords, char **words, struct rtattr *tree)
+{
+	struct ematch_cached *c;
+	int i, len = RTA_PAYLOAD(tree);
+	unsigned int h;
+
+	c = malloc(sizeof(*c) + len);
+	if (c == NULL)
+		return;
+	c->words = calloc(nwords, sizeof(char *));
+	if (c->words == NULL) {
+		free(c);
+		return;
+	}
+	for (i = 0; i < nwords; i++) {
+		c->words[i] = strdup(words[i]);
+		if (c->words[i] == NULL) {
+			while (i--)
+				free(c->words[i]);
+			free(c->words);
+			free(c);
+			return;
+		}
+	}
+	c->nwords = nwords;
+	c->len = len;
+	memcpy(c->tree, RTA_DATA(tree), len);
+
+	h = ematch_cache_hash(*words);
+	c->next = ematch_cache[h];
+	ematch_cache[h] = c;
+}
+
 extern int ematch_parse(void);
 
 int parse_ematch(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 {
+	struct ematch_cached *c;
+
+	if (*argc_p > 0 && (c = ematch_cache_find(*argc_p, *argv_p)) != NULL) {
+		addattr_l(n, MAX_MSG, tca_id, c->tree, c->len);
+		*argc_p -= c->nwords;
+		*argv_p += c->nwords;
+		return 0;
+	}
+
 	begin_argc = ematch_argc = *argc_p;
 	begin_argv = ematch_argv = *argv_p;
+	ematch_root = NULL;
+	ematch_trailing = 0;
 
 	if (ematch_parse()) {
 		int err = em_parse_error(EINVAL, NULL, NULL, NULL,
@@ -335,6 +662,12 @@ int parse_ematch(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 	ematch_argc++;
 	ematch_argv--;
 
+	if (ematch_root && ematch_optimize) {
+		if (encode_tree(ematch_root) < 0)
+			return -1;
+		ematch_root = optimize_tree(ematch_root);
+	}
+
 	if (ematch_root) {
 		struct rtattr *tail, *tail_list;
 
@@ -355,6 +688,10 @@ int parse_ematch(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 
 		tail_list->rta_len = (void*) NLMSG_TAIL(n) - (void*) tail_list;
 		tail->rta_len = (void*) NLMSG_TAIL(n) - (void*) tail;
+
+		if (ematch_trailing && begin_argc > ematch_argc)
+			ematch_cache_add(begin_argc - ematch_argc, begin_argv,
+					 tail);
 	}
 
 	*argc_p = ematch_argc;
@@ -492,6 +829,134 @@ int print_ematch(FILE *fd, const struct rtattr *rta)
 	return print_ematch_list(fd, hdr, tb[TCA_EMATCH_TREE_LIST]);
 }
 
+/* An ematch tree for "tc sim", run as tcf_em_tree_match() does */
+struct em_sim_match
+{
+	struct tcf_ematch_hdr	*hdr;
+	void			*data;
+	int			len;
+	__u32			ref;		/* of a container */
+	struct ematch_util	*e;
+};
+
+struct em_sim_tree
+{
+	int			nmatches;
+	struct em_sim_match	m[0];
+};
+
+#define EM_SIM_STACK	32
+
+struct em_sim_tree *em_sim_tree(const struct rtattr *rta)
+{
+	struct rtattr *tb[TCA_EMATCH_TREE_MAX+1], **list;
+	struct tcf_ematch_tree_hdr *hdr;
+	struct em_sim_tree *t;
+	struct rtattr *copy;
+	int i;
+
+	if (parse_rtattr_nested(tb, TCA_EMATCH_TREE_MAX, rta) < 0 ||
+	    tb[TCA_EMATCH_TREE_HDR] == NULL || tb[TCA_EMATCH_TREE_LIST] == NULL ||
+	    RTA_PAYLOAD(tb[TCA_EMATCH_TREE_HDR]) < sizeof(*hdr)) {
+		fprintf(stderr, "sim: bad ematch tree\n");
+		return NULL;
+	}
+	hdr = RTA_DATA(tb[TCA_EMATCH_TREE_HDR]);
+	/* The matches are kept past the message, which is reused */
+	t = calloc(1, sizeof(*t) + hdr->nmatches * sizeof(t->m[0]) +
+		   tb[TCA_EMATCH_TREE_LIST]->rta_len);
+	list = calloc(hdr->nmatches + 1, sizeof(*list));
+	if (t == NULL || list == NULL)
+		goto err;
+	t->nmatches = hdr->nmatches;
+	copy = (struct rtattr *) &t->m[t->nmatches];
+	memcpy(copy, tb[TCA_EMATCH_TREE_LIST], tb[TCA_EMATCH_TREE_LIST]->rta_len);
+	if (parse_rtattr_nested(list, hdr->nmatches, copy) < 0)
+		goto err;
+
+	for (i = 0; i < t->nmatches; i++) {
+		struct em_sim_match *m = &t->m[i];
+		struct rtattr *a = list[i + 1];
+
+		if (a == NULL || RTA_PAYLOAD(a) < sizeof(*m->hdr)) {
+			fprintf(stderr, "sim: ematch %d missing\n", i + 1);
+			goto err;
+		}
+		m->hdr = RTA_DATA(a);
+		m->data = m->hdr + 1;
+		m->len = RTA_PAYLOAD(a) - sizeof(*m->hdr);
+		if (m->hdr->kind == TCF_EM_CONTAINER) {
+			if (m->len < sizeof(__u32))
+				goto err;
+			memcpy(&m->ref, m->data, sizeof(__u32));
+			if (m->ref <= i || m->ref >= t->nmatches) {
+				fprintf(stderr, "sim: bad ematch container\n");
+				goto err;
+			}
+			continue;
+		}
+		m->e = get_ematch_kind_num(m->hdr->kind);
+		if (m->e == NULL || m->e->sim_match == NULL ||
+		    m->e->sim_match(m->hdr, m->data, m->len, NULL) < 0) {
+			fprintf(stderr, "sim: ematch %s cannot be simulated\n",
+				m->e ? m->e->kind : "of unknown kind");
+			goto err;
+		}
+	}
+	free(list);
+	return t;
+
+err:
+	free(list);
+	free(t);
+	return NULL;
+}
+
+static int em_sim_early_end(const struct em_sim_match *m, int res)
+{
+	int rel = m->hdr->flags & TCF_EM_REL_MASK;
+
+	return rel == TCF_EM_REL_END || (!res && (rel & TCF_EM_REL_AND)) ||
+	       (res && (rel & TCF_EM_REL_OR));
+}
+
+int em_sim_match(const struct em_sim_tree *t, const struct sim_pkt *p)
+{
+	int stack[EM_SIM_STACK], sp = 0, i = 0, res = 0;
+	const struct em_sim_match *m;
+
+	if (t == NULL || t->nmatches == 0)
+		return 1;
+proceed:
+	while (i < t->nmatches) {
+		m = &t->m[i];
+		if (m->hdr->kind == TCF_EM_CONTAINER) {
+			if (sp >= EM_SIM_STACK)
+				return 0;
+			stack[sp++] = i;
+			i = m->ref;
+			goto proceed;
+		}
+		res = m->e->sim_match(m->hdr, m->data, m->len, p);
+		if (m->hdr->flags & TCF_EM_INVERT)
+			res = !res;
+		if (em_sim_early_end(m, res))
+			break;
+		i++;
+	}
+	while (sp > 0) {
+		i = stack[--sp];
+		m = &t->m[i];
+		if (m->hdr->flags & TCF_EM_INVERT)
+			res = !res;
+		if (!em_sim_early_end(m, res)) {
+			i++;
+			goto proceed;
+		}
+	}
+	return res;
+}
+
 struct bstr * bstr_alloc(const char *text)
 {
 	struct bstr *b = calloc(1, sizeof(*b));
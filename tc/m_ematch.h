@@ -62,6 +62,12 @@ struct ematch
 	int		child_ref;
 	struct ematch	*child;
 	struct ematch	*next;
+	/* With -optimize, a match encoded ahead of the tree: its
+	 * tcf_ematch_hdr followed by the kind's data.
+	 */
+	struct ematch_util	*e;
+	void		*data;
+	int		len;
 };
 
 static inline struct ematch * new_ematch(struct bstr *args, int inverted)
@@ -80,6 +86,8 @@ static inline struct ematch * new_ematch(struct bstr *args, int inverted)
 extern void print_ematch_tree(const struct ematch *tree);
 
 
+struct sim_pkt;
+
 struct ematch_util
 {
 	char			kind[EMATCHKINDSIZ];
@@ -88,6 +96,17 @@ struct ematch_util
 			      struct bstr *);
 	int	(*print_eopt)(FILE *, struct tcf_ematch_hdr *, void *, int);
 	void	(*print_usage)(FILE *);
+	/* For "tc sim": 1 for a match, 0 for none; with no packet, 0 if
+	 * the match can be run and -1 if not.
+	 */
+	int	(*sim_match)(struct tcf_ematch_hdr *, void *, int,
+			     const struct sim_pkt *);
+	/* For -optimize: a rough cost of running the match, and folding
+	 * the second match into the first when both must hold (0 if done,
+	 * -1 if the two cannot be expressed as one).
+	 */
+	int	(*cost)(struct tcf_ematch_hdr *, void *, int);
+	int	(*merge)(void *, int, const void *, int);
 	struct ematch_util	*next;
 };
 
@@ -106,6 +125,11 @@ static inline int parse_layer(struct bstr *b)
 extern int em_parse_error(int err, struct bstr *args, struct bstr *carg,
 		   struct ematch_util *, char *fmt, ...);
 extern int print_ematch(FILE *, const struct rtattr *);
+
+struct em_sim_tree;
+extern struct em_sim_tree *em_sim_tree(const struct rtattr *rta);
+extern int em_sim_match(const struct em_sim_tree *tree,
+			const struct sim_pkt *p);
 extern int parse_ematch(int *, char ***, int, struct nlmsghdr *);
 
 #endif
@@ -86,6 +86,11 @@ struct m_pedit_util
 			return p;
 	}
 
+	snprintf(buf, sizeof(buf), "p_pedit_%s", str);
+	p = get_builtin_sym(buf);
+	if (p)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), "p_%s.so", str);
 	dlh = dlopen(buf, RTLD_LAZY);
 	if (dlh == NULL) {
@@ -457,6 +462,73 @@ done:
 	return res;
 }
 
+static int
+pedit_key_static(struct tc_pedit_key *k)
+{
+	return k->offmask == 0;
+}
+
+/*
+ * The kernel applies each key as word = (word & mask) ^ val, so two keys
+ * on the same word compose into one with mask m1 & m2 and val
+ * (v1 & m2) ^ v2.  Keys at fixed offsets are sorted by offset, keeping
+ * the order of keys on the same word, merged, and the ones that no
+ * longer change anything dropped.  A key whose offset is read from the
+ * packet (offmask) may depend on what the keys before it wrote, so
+ * nothing is moved across it.
+ */
+static void
+pedit_merge_keys(struct tc_pedit_sel *sel)
+{
+	struct tc_pedit_key *keys = sel->keys;
+	int i, j, start, n = 0;
+
+	for (start = 0; start < sel->nkeys; ) {
+		int end = start, first = n;
+
+		if (!pedit_key_static(&keys[start])) {
+			keys[n++] = keys[start++];
+			continue;
+		}
+
+		while (end < sel->nkeys && pedit_key_static(&keys[end]))
+			end++;
+
+		/* insertion sort; stable, and runs are short */
+		for (i = start + 1; i < end; i++) {
+			struct tc_pedit_key k = keys[i];
+
+			for (j = i; j > start &&
+			     (int)keys[j - 1].off > (int)k.off; j--)
+				keys[j] = keys[j - 1];
+			keys[j] = k;
+		}
+
+		for (i = start; i < end; i++) {
+			if (n > first && keys[n - 1].off == keys[i].off) {
+				struct tc_pedit_key *k = &keys[n - 1];
+
+				k->val = (k->val & keys[i].mask) ^ keys[i].val;
+				k->mask &= keys[i].mask;
+			} else {
+				keys[n++] = keys[i];
+			}
+		}
+
+		for (i = j = first; i < n; i++)
+			if (keys[i].mask != ~0U || keys[i].val != 0)
+				keys[j++] = keys[i];
+		n = j;
+
+		start = end;
+	}
+
+	/* the kernel wants at least one key; keys[0] is still a merged one */
+	if (n == 0 && sel->nkeys)
+		n = 1;
+	sel->nkeys = n;
+}
+
 int
 parse_pedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 {
@@ -538,6 +610,8 @@ parse_pedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id, stru
 		}
 	}
 
+	pedit_merge_keys(&sel.sel);
+
 	tail = NLMSG_TAIL(n);
 	addattr_l(n, MAX_MSG, tca_id, NULL, 0);
 	addattr_l(n, MAX_MSG, TCA_PEDIT_PARMS,&sel, sizeof(sel.sel)+sel.sel.nkeys*sizeof(struct tc_pedit_key));
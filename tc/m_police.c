@@ -132,6 +132,7 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 	__u32 rtab[256];
 	__u32 ptab[256];
 	__u32 avrate = 0;
+	__u64 rate64 = 0, prate64 = 0;
 	int presult = 0;
 	unsigned buffer=0, mtu=0, mpu=0;
 	unsigned short overhead=0;
@@ -191,11 +192,11 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 			}
 		} else if (strcmp(*argv, "rate") == 0) {
 			NEXT_ARG();
-			if (p.rate.rate) {
+			if (rate64) {
 				fprintf(stderr, "Double \"rate\" spec\n");
 				return -1;
 			}
-			if (get_rate(&p.rate.rate, *argv)) {
+			if (get_rate64(&rate64, *argv)) {
 				explain1("rate");
 				return -1;
 			}
@@ -211,11 +212,11 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 			}
 		} else if (matches(*argv, "peakrate") == 0) {
 			NEXT_ARG();
-			if (p.peakrate.rate) {
+			if (prate64) {
 				fprintf(stderr, "Double \"peakrate\" spec\n");
 				return -1;
 			}
-			if (get_rate(&p.peakrate.rate, *argv)) {
+			if (get_rate64(&prate64, *argv)) {
 				explain1("peakrate");
 				return -1;
 			}
@@ -259,12 +260,12 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 	if (!ok)
 		return -1;
 
-	if (p.rate.rate && !buffer) {
+	if (rate64 && !buffer) {
 		fprintf(stderr, "\"burst\" requires \"rate\".\n");
 		return -1;
 	}
-	if (p.peakrate.rate) {
-		if (!p.rate.rate) {
+	if (prate64) {
+		if (!rate64) {
 			fprintf(stderr, "\"peakrate\" requires \"rate\".\n");
 			return -1;
 		}
@@ -274,6 +275,15 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 		}
 	}
 
+	/* rates above 32 bits go in their own attributes, the rate
+	 * tables the kernel still wants are those of the 32 bit cap */
+	if ((rate64 > ~0U || prate64 > ~0U) && !tc_core_kernel_police_rates()) {
+		fprintf(stderr, "POLICE: rates above 32 bits are not supported by this kernel.\n");
+		return -1;
+	}
+	p.rate.rate = rate64 > ~0U ? ~0U : rate64;
+	p.peakrate.rate = prate64 > ~0U ? ~0U : prate64;
+
 	if (p.rate.rate) {
 		p.rate.mpu = mpu;
 		p.rate.overhead = overhead;
@@ -281,7 +291,7 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 			fprintf(stderr, "TBF: failed to calculate rate table.\n");
 			return -1;
 		}
-		p.burst = tc_calc_xmittime(p.rate.rate, buffer);
+		p.burst = tc_calc_burst(rate64, buffer);
 	}
 	p.mtu = mtu;
 	if (p.peakrate.rate) {
@@ -300,6 +310,10 @@ int act_parse_police(struct action_util *a,int *argc_p, char ***argv_p, int tca_
 		addattr_l(n, MAX_MSG, TCA_POLICE_RATE, rtab, 1024);
 	if (p.peakrate.rate)
                 addattr_l(n, MAX_MSG, TCA_POLICE_PEAKRATE, ptab, 1024);
+	if (rate64 > ~0U)
+		addattr64(n, MAX_MSG, TCA_POLICE_RATE64, rate64);
+	if (prate64 > ~0U)
+		addattr64(n, MAX_MSG, TCA_POLICE_PEAKRATE64, prate64);
 	if (avrate)
 		addattr32(n, MAX_MSG, TCA_POLICE_AVRATE, avrate);
 	if (presult)
@@ -325,6 +339,7 @@ print_police(struct action_util *a, FILE *f, struct rtattr *arg)
 	struct tc_police *p;
 	struct rtattr *tb[TCA_POLICE_MAX+1];
 	unsigned buffer;
+	__u64 rate64, prate64;
 
 	if (arg == NULL)
 		return 0;
@@ -344,14 +359,23 @@ print_police(struct action_util *a, FILE *f, struct rtattr *arg)
 	p = RTA_DATA(tb[TCA_POLICE_TBF]);
 
 	fprintf(f, " police 0x%x ", p->index);
-	fprintf(f, "rate %s ", sprint_rate(p->rate.rate, b1));
-	buffer = tc_calc_xmitsize(p->rate.rate, p->burst);
+	rate64 = p->rate.rate;
+	if (tb[TCA_POLICE_RATE64] &&
+	    RTA_PAYLOAD(tb[TCA_POLICE_RATE64]) >= sizeof(rate64))
+		rate64 = rta_getattr_u64(tb[TCA_POLICE_RATE64]);
+	prate64 = p->peakrate.rate;
+	if (tb[TCA_POLICE_PEAKRATE64] &&
+	    RTA_PAYLOAD(tb[TCA_POLICE_PEAKRATE64]) >= sizeof(prate64))
+		prate64 = rta_getattr_u64(tb[TCA_POLICE_PEAKRATE64]);
+
+	fprintf(f, "rate %s ", sprint_rate(rate64, b1));
+	buffer = tc_calc_xmitsize(rate64, p->burst);
 	fprintf(f, "burst %s ", sprint_size(buffer, b1));
 	fprintf(f, "mtu %s ", sprint_size(p->mtu, b1));
 	if (show_raw)
 		fprintf(f, "[%08x] ", p->burst);
-	if (p->peakrate.rate)
-		fprintf(f, "peakrate %s ", sprint_rate(p->peakrate.rate, b1));
+	if (prate64)
+		fprintf(f, "peakrate %s ", sprint_rate(prate64, b1));
 	if (tb[TCA_POLICE_AVRATE])
 		fprintf(f, "avrate %s ", sprint_rate(rta_getattr_u32(tb[TCA_POLICE_AVRATE]), b1));
 	fprintf(f, "action %s", police_action_n2a(p->action, b1, sizeof(b1)));
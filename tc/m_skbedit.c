@@ -32,10 +32,11 @@ static void
 explain(void)
 {
  	fprintf(stderr, "Usage: ... skbedit <[QM] [PM] [MM]>\n"
-		"QM = queue_mapping QUEUE_MAPPING\n"
+		"QM = queue_mapping { QUEUE_MAPPING | skbhash FIRST LAST }\n"
 		"PM = priority PRIORITY \n"
 		"MM = mark MARK \n"
 		"QUEUE_MAPPING = device transmit queue to use\n"
+		"FIRST, LAST = queues the flow hash of the packet picks from\n"
 		"PRIORITY = classID to assign to priority field\n"
 		"MARK = firewall mark to set\n");
 }
@@ -56,7 +57,7 @@ parse_skbedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id,
 	int ok = 0;
 	struct rtattr *tail;
 	unsigned int tmp;
-	__u16 queue_mapping;
+	__u16 queue_mapping, queue_mapping_max = 0;
 	__u32 flags = 0, priority, mark;
 	struct tc_skbedit sel = { 0 };
 
@@ -69,11 +70,24 @@ parse_skbedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id,
 		if (matches(*argv, "queue_mapping") == 0) {
 			flags |= SKBEDIT_F_QUEUE_MAPPING;
 			NEXT_ARG();
+			if (strcmp(*argv, "skbhash") == 0) {
+				flags |= SKBEDIT_F_TXQ_SKBHASH;
+				NEXT_ARG();
+			}
 			if (get_unsigned(&tmp, *argv, 10) || tmp > 65535) {
 				fprintf(stderr, "Illegal queue_mapping\n");
 				return -1;
 			}
 			queue_mapping = tmp;
+			if (flags & SKBEDIT_F_TXQ_SKBHASH) {
+				NEXT_ARG();
+				if (get_unsigned(&tmp, *argv, 10) ||
+				    tmp > 65535 || tmp < queue_mapping) {
+					fprintf(stderr, "Illegal queue_mapping range\n");
+					return -1;
+				}
+				queue_mapping_max = tmp;
+			}
 			ok++;
 		} else if (matches(*argv, "priority") == 0) {
 			flags |= SKBEDIT_F_PRIORITY;
@@ -145,6 +159,11 @@ parse_skbedit(struct action_util *a, int *argc_p, char ***argv_p, int tca_id,
 	if (flags & SKBEDIT_F_QUEUE_MAPPING)
 		addattr_l(n, MAX_MSG, TCA_SKBEDIT_QUEUE_MAPPING,
 			  &queue_mapping, sizeof(queue_mapping));
+	if (flags & SKBEDIT_F_TXQ_SKBHASH) {
+		addattr_l(n, MAX_MSG, TCA_SKBEDIT_QUEUE_MAPPING_MAX,
+			  &queue_mapping_max, sizeof(queue_mapping_max));
+		addattr64(n, MAX_MSG, TCA_SKBEDIT_FLAGS, SKBEDIT_F_TXQ_SKBHASH);
+	}
 	if (flags & SKBEDIT_F_PRIORITY)
 		addattr_l(n, MAX_MSG, TCA_SKBEDIT_PRIORITY,
 			  &priority, sizeof(priority));
@@ -165,6 +184,7 @@ static int print_skbedit(struct action_util *au, FILE *f, struct rtattr *arg)
 	__u32 *priority;
 	__u32 *mark;
 	__u16 *queue_mapping;
+	__u64 flags = 0;
 
 	if (arg == NULL)
 		return -1;
@@ -178,9 +198,18 @@ static int print_skbedit(struct action_util *au, FILE *f, struct rtattr *arg)
 
 	fprintf(f, " skbedit");
 
+	if (tb[TCA_SKBEDIT_FLAGS] &&
+	    RTA_PAYLOAD(tb[TCA_SKBEDIT_FLAGS]) >= sizeof(__u64))
+		flags = rta_getattr_u64(tb[TCA_SKBEDIT_FLAGS]);
+
 	if (tb[TCA_SKBEDIT_QUEUE_MAPPING] != NULL) {
 		queue_mapping = RTA_DATA(tb[TCA_SKBEDIT_QUEUE_MAPPING]);
-		fprintf(f, " queue_mapping %u", *queue_mapping);
+		if ((flags & SKBEDIT_F_TXQ_SKBHASH) &&
+		    tb[TCA_SKBEDIT_QUEUE_MAPPING_MAX])
+			fprintf(f, " queue_mapping skbhash %u %u", *queue_mapping,
+				rta_getattr_u16(tb[TCA_SKBEDIT_QUEUE_MAPPING_MAX]));
+		else
+			fprintf(f, " queue_mapping %u", *queue_mapping);
 	}
 	if (tb[TCA_SKBEDIT_PRIORITY] != NULL) {
 		priority = RTA_DATA(tb[TCA_SKBEDIT_PRIORITY]);
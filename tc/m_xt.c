@@ -112,10 +112,73 @@ inline void set_lib_dir(void)
 
 }
 
+/*
+ * xtables is set up once per process and every target found is kept with
+ * its options merged, so a batch or a dump with many xt actions pays for
+ * that once per target rather than once per action.
+ */
+struct xt_cached_target
+{
+	struct xt_cached_target	*next;
+	struct xtables_target	*m;
+	struct option		*opts;
+	int			revision;
+	char			name[XT_EXTENSION_MAXNAMELEN];
+};
+
+static struct xt_cached_target *xt_targets;
+
+static void xt_init(void)
+{
+	static int inited;
+
+	if (inited)
+		return;
+	xtables_init_all(&tcipt_globals, NFPROTO_IPV4);
+	set_lib_dir();
+	inited = 1;
+}
+
+/* A revision of -1 takes whichever revision xtables finds */
+static struct xt_cached_target *xt_find_target(const char *name, int revision)
+{
+	struct xt_cached_target *c;
+	struct xtables_target *m;
+
+	for (c = xt_targets; c; c = c->next)
+		if (strcmp(c->name, name) == 0 &&
+		    (revision < 0 || c->revision == revision))
+			return c;
+
+	m = xtables_find_target(name, XTF_TRY_LOAD);
+	if (m == NULL)
+		return NULL;
+
+	c = xtables_calloc(1, sizeof(*c));
+	c->m = m;
+	c->revision = revision < 0 ? m->revision : revision;
+	strncpy(c->name, name, sizeof(c->name) - 1);
+	c->opts = xtables_merge_options(
+#if (XTABLES_VERSION_CODE >= 6)
+		tcipt_globals.orig_opts,
+#endif
+		tcipt_globals.orig_opts,
+		m->extra_opts,
+		&m->option_offset);
+	if (c->opts == NULL) {
+		free(c);
+		return NULL;
+	}
+	c->next = xt_targets;
+	xt_targets = c;
+	return c;
+}
+
 static int parse_ipt(struct action_util *a,int *argc_p,
 		     char ***argv_p, int tca_id, struct nlmsghdr *n)
 {
 	struct xtables_target *m = NULL;
+	struct xt_cached_target *ct;
 	struct ipt_entry fw;
 	struct rtattr *tail;
 	int c;
@@ -127,8 +190,7 @@ static int parse_ipt(struct action_util *a,int *argc_p,
 	int iok = 0, ok = 0;
 	__u32 hook = 0, index = 0;
 
-	xtables_init_all(&tcipt_globals, NFPROTO_IPV4);
-	set_lib_dir();
+	xt_init();
 
 	{
 		int i;
@@ -151,21 +213,14 @@ static int parse_ipt(struct action_util *a,int *argc_p,
 			break;
 		switch (c) {
 		case 'j':
-			m = xtables_find_target(optarg, XTF_TRY_LOAD);
-			if (NULL != m) {
-
+			ct = xt_find_target(optarg, -1);
+			if (NULL != ct) {
+				m = ct->m;
 				if (0 > build_st(m, NULL)) {
 					printf(" %s error \n", m->name);
 					return -1;
 				}
-				tcipt_globals.opts =
-				    xtables_merge_options(
-#if (XTABLES_VERSION_CODE >= 6)
-				        tcipt_globals.orig_opts,
-#endif
-				        tcipt_globals.opts,
-				        m->extra_opts,
-				        &m->option_offset);
+				tcipt_globals.opts = ct->opts;
 			} else {
 				fprintf(stderr," failed to find target %s\n\n", optarg);
 				return -1;
@@ -193,7 +248,7 @@ static int parse_ipt(struct action_util *a,int *argc_p,
 		if (matches(argv[optind], "index") == 0) {
 			if (get_u32(&index, argv[optind + 1], 10)) {
 				fprintf(stderr, "Illegal \"index\"\n");
-				xtables_free_opts(1);
+				tcipt_globals.opts = tcipt_globals.orig_opts;
 				return -1;
 			}
 			iok++;
@@ -251,7 +306,7 @@ static int parse_ipt(struct action_util *a,int *argc_p,
 	*argv_p = argv;
 
 	optind = 0;
-	xtables_free_opts(1);
+	tcipt_globals.opts = tcipt_globals.orig_opts;
 
 	if (m) {
 		/* Clear flags if target will be used again */
@@ -275,8 +330,7 @@ print_ipt(struct action_util *au,FILE * f, struct rtattr *arg)
 	if (arg == NULL)
 		return -1;
 
-	xtables_init_all(&tcipt_globals, NFPROTO_IPV4);
-	set_lib_dir();
+	xt_init();
 
 	parse_rtattr_nested(tb, TCA_IPT_MAX, arg);
 
@@ -300,23 +354,16 @@ print_ipt(struct action_util *au,FILE * f, struct rtattr *arg)
 		fprintf(f, "\t[NULL ipt target parameters ] \n");
 		return -1;
 	} else {
+		struct xt_cached_target *ct;
 		struct xtables_target *m = NULL;
 		t = RTA_DATA(tb[TCA_IPT_TARG]);
-		m = xtables_find_target(t->u.user.name, XTF_TRY_LOAD);
-		if (NULL != m) {
+		ct = xt_find_target(t->u.user.name, t->u.user.revision);
+		if (NULL != ct) {
+			m = ct->m;
 			if (0 > build_st(m, t)) {
 				fprintf(stderr, " %s error \n", m->name);
 				return -1;
 			}
-
-			tcipt_globals.opts =
-			    xtables_merge_options(
-#if (XTABLES_VERSION_CODE >= 6)
-				                  tcipt_globals.orig_opts,
-#endif
-				                  tcipt_globals.opts,
-			                          m->extra_opts,
-			                          &m->option_offset);
 		} else {
 			fprintf(stderr, " failed to find target %s\n\n",
 				t->u.user.name);
@@ -345,7 +392,6 @@ print_ipt(struct action_util *au,FILE * f, struct rtattr *arg)
 		fprintf(f, " \n");
 
 	}
-	xtables_free_opts(1);
 
 	return 0;
 }
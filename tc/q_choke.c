@@ -29,6 +29,7 @@ static void explain(void)
 {
 	fprintf(stderr, "Usage: ... choke limit PACKETS bandwidth KBPS [ecn]\n");
 	fprintf(stderr, "                 [ min PACKETS ] [ max PACKETS ] [ burst PACKETS ]\n");
+	fprintf(stderr, "                 [ target TIME [ rtt TIME ] [ flows NUMBER ] ]\n");
 }
 
 static int choke_parse_opt(struct qdisc_util *qu, int argc, char **argv,
@@ -44,8 +45,11 @@ static int choke_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 	__u8 sbuf[256];
 	__u32 max_P;
 	struct rtattr *tail;
+	struct tc_red_tune tune;
+	int given = 0;
 
 	memset(&opt, 0, sizeof(opt));
+	memset(&tune, 0, sizeof(tune));
 
 	while (argc > 0) {
 		if (strcmp(*argv, "limit") == 0) {
@@ -60,6 +64,24 @@ static int choke_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 				fprintf(stderr, "Illegal \"bandwidth\"\n");
 				return -1;
 			}
+		} else if (strcmp(*argv, "target") == 0) {
+			NEXT_ARG();
+			if (get_time(&tune.target, *argv) || !tune.target) {
+				fprintf(stderr, "Illegal \"target\"\n");
+				return -1;
+			}
+		} else if (strcmp(*argv, "rtt") == 0) {
+			NEXT_ARG();
+			if (get_time(&tune.rtt, *argv)) {
+				fprintf(stderr, "Illegal \"rtt\"\n");
+				return -1;
+			}
+		} else if (strcmp(*argv, "flows") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&tune.flows, *argv, 0)) {
+				fprintf(stderr, "Illegal \"flows\"\n");
+				return -1;
+			}
 		} else if (strcmp(*argv, "ecn") == 0) {
 			ecn_ok = 1;
 		} else if (strcmp(*argv, "min") == 0) {
@@ -92,6 +114,7 @@ static int choke_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 				fprintf(stderr, "Illegal \"probability\"\n");
 				return -1;
 			}
+			given = 1;
 		} else if (strcmp(*argv, "help") == 0) {
 			explain();
 			return -1;
@@ -108,6 +131,24 @@ static int choke_parse_opt(struct qdisc_util *qu, int argc, char **argv,
 		return -1;
 	}
 
+	/* The thresholds are in packets here */
+	if (tune.target) {
+		if (opt.qth_min || opt.qth_max || burst || given) {
+			fprintf(stderr, "CHOKE: \"target\" picks min, max, burst and probability\n");
+			return -1;
+		}
+		tune.limit = opt.limit * avpkt;
+		tune.avpkt = avpkt;
+		tune.rate = rate;
+		if (tc_red_tune(&tune) < 0)
+			return -1;
+		tc_red_tune_print("CHOKE", &tune);
+		opt.qth_min = (tune.qth_min + avpkt / 2) / avpkt;
+		opt.qth_max = (tune.qth_max + avpkt / 2) / avpkt;
+		burst = tune.burst;
+		probability = tune.probability;
+	}
+
 	/* Compute default min/max thresholds based on 
 	   Sally Floyd's recommendations:
 	   http://www.icir.org/floyd/REDparameters.txt
@@ -22,6 +22,7 @@
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_sim.h"
 
 static void explain(void)
 {
@@ -76,27 +77,140 @@ static int fifo_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 	return 0;
 }
 
+/* The fifos as "tc sim" runs them, pfifo_fast in three bands */
+struct fifo_sim
+{
+	struct sim_queue	band[3];
+	unsigned int		limit;
+};
+
+static const __u8 pfifo_fast_prio2band[TC_PRIO_MAX+1] = {
+	1, 2, 2, 2, 1, 2, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+static struct fifo_sim *fifo_sim_new(struct sim_qdisc *q)
+{
+	struct fifo_sim *f = q->priv;
+	int i;
+
+	if (f == NULL) {
+		f = q->priv = calloc(1, sizeof(*f));
+		if (f == NULL)
+			return NULL;
+		for (i = 0; i < 3; i++)
+			sim_queue_init(&f->band[i]);
+	}
+	return f;
+}
+
+static int fifo_sim_init(struct sim_qdisc *q, struct rtattr *opt)
+{
+	struct fifo_sim *f = fifo_sim_new(q);
+
+	if (f == NULL)
+		return -1;
+	if (opt && RTA_PAYLOAD(opt) >= sizeof(struct tc_fifo_qopt))
+		f->limit = ((struct tc_fifo_qopt *)RTA_DATA(opt))->limit;
+	else if (strcmp(q->kind, "bfifo") == 0)
+		f->limit = sim_txqueuelen * sim_mtu;
+	else
+		f->limit = sim_txqueuelen ? : 1;
+	return 0;
+}
+
+static int fifo_sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p, double now)
+{
+	struct fifo_sim *f = q->priv;
+	struct sim_queue *sq = &f->band[0];
+
+	if (strcmp(q->kind, "bfifo") == 0) {
+		if (sq->bytes + p->len <= f->limit) {
+			sim_queue_tail(sq, p);
+			return 0;
+		}
+	} else if (sq->qlen < f->limit) {
+		sim_queue_tail(sq, p);
+		return 0;
+	} else if (strcmp(q->kind, "pfifo_head_drop") == 0 && sq->qlen) {
+		sim_drop(q, sim_queue_head(sq));
+		sim_queue_tail(sq, p);
+		return 0;
+	}
+	sim_drop(q, p);
+	return -1;
+}
+
+static struct sim_pkt *fifo_sim_dequeue(struct sim_qdisc *q, double now,
+					double *next)
+{
+	struct fifo_sim *f = q->priv;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (f->band[i].qlen)
+			return sim_queue_head(&f->band[i]);
+	return NULL;
+}
+
+static const struct sim_qdisc_ops fifo_sim = {
+	.init = fifo_sim_init,
+	.enqueue = fifo_sim_enqueue,
+	.dequeue = fifo_sim_dequeue,
+};
+
+static int pfifo_fast_sim_init(struct sim_qdisc *q, struct rtattr *opt)
+{
+	struct fifo_sim *f = fifo_sim_new(q);
+
+	if (f == NULL)
+		return -1;
+	f->limit = sim_txqueuelen;
+	return 0;
+}
+
+static int pfifo_fast_sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p,
+				  double now)
+{
+	struct fifo_sim *f = q->priv;
+
+	if (q->qlen < f->limit) {
+		sim_queue_tail(&f->band[pfifo_fast_prio2band[p->priority & TC_PRIO_MAX]], p);
+		return 0;
+	}
+	sim_drop(q, p);
+	return -1;
+}
+
+static const struct sim_qdisc_ops pfifo_fast_sim = {
+	.init = pfifo_fast_sim_init,
+	.enqueue = pfifo_fast_sim_enqueue,
+	.dequeue = fifo_sim_dequeue,
+};
 
 struct qdisc_util bfifo_qdisc_util = {
 	.id = "bfifo",
 	.parse_qopt = fifo_parse_opt,
 	.print_qopt = fifo_print_opt,
+	.sim = &fifo_sim,
 };
 
 struct qdisc_util pfifo_qdisc_util = {
 	.id = "pfifo",
 	.parse_qopt = fifo_parse_opt,
 	.print_qopt = fifo_print_opt,
+	.sim = &fifo_sim,
 };
 
 struct qdisc_util pfifo_head_drop_qdisc_util = {
 	.id = "pfifo_head_drop",
 	.parse_qopt = fifo_parse_opt,
 	.print_qopt = fifo_print_opt,
+	.sim = &fifo_sim,
 };
 
 extern int prio_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt);
 struct qdisc_util pfifo_fast_qdisc_util = {
 	.id = "pfifo_fast",
 	.print_qopt = prio_print_opt,
+	.sim = &pfifo_fast_sim,
 };
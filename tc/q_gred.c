@@ -42,6 +42,8 @@ static void explain(void)
 	fprintf(stderr, "    avpkt BYTES burst PACKETS probability PROBABILITY "
 	    "bandwidth KBPS\n");
 	fprintf(stderr, "    [prio value]\n");
+	fprintf(stderr, "    [target TIME [rtt TIME] [flows NUMBER]] in place of "
+	    "min, max, burst and probability\n");
 	fprintf(stderr," OR ...\n");
 	fprintf(stderr," gred setup DPs <num of DPs> default <default DP> "
 	    "[grio]\n");
@@ -127,8 +129,11 @@ static int gred_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct n
 	__u8 sbuf[256];
 	struct rtattr *tail;
 	__u32 max_P;
+	struct tc_red_tune tune;
+	int given = 0;
 
 	memset(&opt, 0, sizeof(opt));
+	memset(&tune, 0, sizeof(tune));
 
 	while (argc > 0) {
 		if (strcmp(*argv, "limit") == 0) {
@@ -190,6 +195,7 @@ static int gred_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct n
 				fprintf(stderr, "Illegal \"probability\"\n");
 				return -1;
 			}
+			given = 1;
 			ok++;
 		} else if (strcmp(*argv, "prio") == 0) {
 			NEXT_ARG();
@@ -203,6 +209,27 @@ static int gred_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct n
 				return -1;
 			}
 			ok++;
+		} else if (strcmp(*argv, "target") == 0) {
+			NEXT_ARG();
+			if (get_time(&tune.target, *argv) || !tune.target) {
+				fprintf(stderr, "Illegal \"target\"\n");
+				return -1;
+			}
+			ok++;
+		} else if (strcmp(*argv, "rtt") == 0) {
+			NEXT_ARG();
+			if (get_time(&tune.rtt, *argv)) {
+				fprintf(stderr, "Illegal \"rtt\"\n");
+				return -1;
+			}
+			ok++;
+		} else if (strcmp(*argv, "flows") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&tune.flows, *argv, 0)) {
+				fprintf(stderr, "Illegal \"flows\"\n");
+				return -1;
+			}
+			ok++;
 		} else if (strcmp(*argv, "help") == 0) {
 			explain();
 			return -1;
@@ -217,6 +244,23 @@ static int gred_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct n
 	if (rate == 0)
 		get_rate(&rate, "10Mbit");
 
+	if (tune.target) {
+		if (opt.qth_min || opt.qth_max || burst || given) {
+			fprintf(stderr, "GRED: \"target\" picks min, max, burst and probability\n");
+			return -1;
+		}
+		tune.limit = opt.limit;
+		tune.avpkt = avpkt;
+		tune.rate = rate;
+		if (tc_red_tune(&tune) < 0)
+			return -1;
+		tc_red_tune_print("GRED", &tune);
+		opt.qth_min = tune.qth_min;
+		opt.qth_max = tune.qth_max;
+		burst = tune.burst;
+		probability = tune.probability;
+	}
+
 	if (!opt.qth_min || !opt.qth_max || !opt.limit || !avpkt ||
 	    (opt.DP<0)) {
 		fprintf(stderr, "Required parameter (min, max, limit, "
@@ -20,6 +20,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 
 #include "utils.h"
 #include "tc_util.h"
@@ -142,50 +143,47 @@ hfsc_print_xstats(struct qdisc_util *qu, FILE *f, struct rtattr *xstats)
 	return 0;
 }
 
-static int
-hfsc_parse_class_opt(struct qdisc_util *qu, int argc, char **argv,
-                     struct nlmsghdr *n)
-{
+struct hfsc_curves {
 	struct tc_service_curve rsc, fsc, usc;
 	int rsc_ok, fsc_ok, usc_ok;
-	struct rtattr *tail;
+};
 
-	memset(&rsc, 0, sizeof(rsc));
-	memset(&fsc, 0, sizeof(fsc));
-	memset(&usc, 0, sizeof(usc));
-	rsc_ok = fsc_ok = usc_ok = 0;
+static int
+hfsc_parse_curves(int argc, char **argv, struct hfsc_curves *c)
+{
+	memset(c, 0, sizeof(*c));
 
 	while (argc > 0) {
 		if (matches(*argv, "rt") == 0) {
 			NEXT_ARG();
-			if (hfsc_get_sc(&argc, &argv, &rsc) < 0) {
+			if (hfsc_get_sc(&argc, &argv, &c->rsc) < 0) {
 				explain1("rt");
 				return -1;
 			}
-			rsc_ok = 1;
+			c->rsc_ok = 1;
 		} else if (matches(*argv, "ls") == 0) {
 			NEXT_ARG();
-			if (hfsc_get_sc(&argc, &argv, &fsc) < 0) {
+			if (hfsc_get_sc(&argc, &argv, &c->fsc) < 0) {
 				explain1("ls");
 				return -1;
 			}
-			fsc_ok = 1;
+			c->fsc_ok = 1;
 		} else if (matches(*argv, "sc") == 0) {
 			NEXT_ARG();
-			if (hfsc_get_sc(&argc, &argv, &rsc) < 0) {
+			if (hfsc_get_sc(&argc, &argv, &c->rsc) < 0) {
 				explain1("sc");
 				return -1;
 			}
-			memcpy(&fsc, &rsc, sizeof(fsc));
-			rsc_ok = 1;
-			fsc_ok = 1;
+			memcpy(&c->fsc, &c->rsc, sizeof(c->fsc));
+			c->rsc_ok = 1;
+			c->fsc_ok = 1;
 		} else if (matches(*argv, "ul") == 0) {
 			NEXT_ARG();
-			if (hfsc_get_sc(&argc, &argv, &usc) < 0) {
+			if (hfsc_get_sc(&argc, &argv, &c->usc) < 0) {
 				explain1("ul");
 				return -1;
 			}
-			usc_ok = 1;
+			c->usc_ok = 1;
 		} else if (matches(*argv, "help") == 0) {
 			explain_class();
 			return -1;
@@ -197,27 +195,45 @@ hfsc_parse_class_opt(struct qdisc_util *qu, int argc, char **argv,
 		argc--, argv++;
 	}
 
-	if (!(rsc_ok || fsc_ok || usc_ok)) {
+	if (!(c->rsc_ok || c->fsc_ok || c->usc_ok)) {
 		fprintf(stderr, "HFSC: no parameters given\n");
 		explain_class();
 		return -1;
 	}
-	if (usc_ok && !fsc_ok) {
+	if (c->usc_ok && !c->fsc_ok) {
 		fprintf(stderr, "HFSC: Upper-limit Service Curve without "
 		                "Link-Share Service Curve\n");
 		explain_class();
 		return -1;
 	}
+	return 0;
+}
+
+static void
+hfsc_add_curves(struct nlmsghdr *n, int maxlen, struct hfsc_curves *c)
+{
+	if (c->rsc_ok)
+		addattr_l(n, maxlen, TCA_HFSC_RSC, &c->rsc, sizeof(c->rsc));
+	if (c->fsc_ok)
+		addattr_l(n, maxlen, TCA_HFSC_FSC, &c->fsc, sizeof(c->fsc));
+	if (c->usc_ok)
+		addattr_l(n, maxlen, TCA_HFSC_USC, &c->usc, sizeof(c->usc));
+}
+
+static int
+hfsc_parse_class_opt(struct qdisc_util *qu, int argc, char **argv,
+                     struct nlmsghdr *n)
+{
+	struct hfsc_curves c;
+	struct rtattr *tail;
+
+	if (hfsc_parse_curves(argc, argv, &c) < 0)
+		return -1;
 
 	tail = NLMSG_TAIL(n);
 
 	addattr_l(n, 1024, TCA_OPTIONS, NULL, 0);
-	if (rsc_ok)
-		addattr_l(n, 1024, TCA_HFSC_RSC, &rsc, sizeof(rsc));
-	if (fsc_ok)
-		addattr_l(n, 1024, TCA_HFSC_FSC, &fsc, sizeof(fsc));
-	if (usc_ok)
-		addattr_l(n, 1024, TCA_HFSC_USC, &usc, sizeof(usc));
+	hfsc_add_curves(n, 1024, &c);
 
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
@@ -280,6 +296,195 @@ hfsc_print_class_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 	return 0;
 }
 
+/*
+ * Class generator for "tc class bulk ... hfsc FILE".  The file names
+ * tiers, each a set of curves parsed once, and then subscribers:
+ *
+ *	tier NAME [ parent CLASSID ] CLASS_OPTIONS
+ *	CLASSID[-CLASSID] TIER [ scale FACTOR ] [ parent CLASSID ]
+ *
+ * A subscriber line adds a class of the tier for each class ID in the
+ * range, with the slopes of every curve multiplied by FACTOR.
+ */
+
+#define HFSC_BULK_ARGS	64
+
+struct hfsc_opt {
+	struct nlmsghdr	n;
+	char		buf[128];
+};
+
+struct hfsc_tier {
+	struct hfsc_tier	*next;
+	char			*name;
+	__u32			parent;
+	struct hfsc_curves	c;
+	struct hfsc_opt		opt;	/* TCA_OPTIONS of the unscaled tier */
+};
+
+static void
+hfsc_bulk_opt(struct hfsc_opt *o, struct hfsc_curves *c)
+{
+	o->n.nlmsg_len = NLMSG_LENGTH(0);
+	hfsc_add_curves(&o->n, sizeof(*o), c);
+}
+
+static int
+hfsc_scale_sc(struct tc_service_curve *sc, double scale)
+{
+	double m1 = rint(sc->m1 * scale), m2 = rint(sc->m2 * scale);
+
+	if (m1 > UINT32_MAX || m2 > UINT32_MAX)
+		return -1;
+	sc->m1 = m1;
+	sc->m2 = m2;
+	return 0;
+}
+
+static int
+hfsc_bulk_tier(struct hfsc_tier **tiers, int argc, char **argv)
+{
+	struct hfsc_tier *t;
+
+	if (argc < 2) {
+		fprintf(stderr, "HFSC: tier needs a name and curves\n");
+		return -1;
+	}
+	for (t = *tiers; t; t = t->next) {
+		if (strcmp(t->name, *argv) == 0) {
+			fprintf(stderr, "HFSC: Double tier \"%s\"\n", *argv);
+			return -1;
+		}
+	}
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL || (t->name = strdup(*argv)) == NULL) {
+		free(t);
+		fprintf(stderr, "HFSC: out of memory\n");
+		return -1;
+	}
+	t->next = *tiers;
+	*tiers = t;
+	argc--, argv++;
+
+	if (strcmp(*argv, "parent") == 0) {
+		NEXT_ARG();
+		if (get_tc_classid(&t->parent, *argv)) {
+			explain1("parent");
+			return -1;
+		}
+		argc--, argv++;
+	}
+	if (hfsc_parse_curves(argc, argv, &t->c) < 0)
+		return -1;
+	hfsc_bulk_opt(&t->opt, &t->c);
+	return 0;
+}
+
+static int
+hfsc_bulk_subscribers(struct class_bulk *cb, struct hfsc_tier *tiers,
+		      int argc, char **argv)
+{
+	struct hfsc_opt scaled, *opt;
+	struct hfsc_tier *t;
+	__u32 min, max, id, parent = 0;
+	double scale = 1.0;
+
+	if (argc < 2 || get_tc_classid_range(&min, &max, argv[0]) ||
+	    TC_H_MAJ(min) != TC_H_MAJ(max)) {
+		fprintf(stderr, "HFSC: expected tier or CLASSID[-CLASSID]\n");
+		return -1;
+	}
+	for (t = tiers; t; t = t->next)
+		if (strcmp(t->name, argv[1]) == 0)
+			break;
+	if (t == NULL) {
+		fprintf(stderr, "HFSC: unknown tier \"%s\"\n", argv[1]);
+		return -1;
+	}
+	argc -= 2, argv += 2;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "scale") == 0) {
+			char *end;
+
+			NEXT_ARG();
+			scale = strtod(*argv, &end);
+			if (*end || end == *argv || !(scale > 0)) {
+				explain1("scale");
+				return -1;
+			}
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (get_tc_classid(&parent, *argv)) {
+				explain1("parent");
+				return -1;
+			}
+		} else {
+			fprintf(stderr, "HFSC: What is \"%s\" ?\n", *argv);
+			return -1;
+		}
+		argc--, argv++;
+	}
+	if (parent == 0)
+		parent = t->parent ? t->parent : cb->parent;
+
+	opt = &t->opt;
+	if (scale != 1.0) {
+		struct hfsc_curves c = t->c;
+
+		if (hfsc_scale_sc(&c.rsc, scale) < 0 ||
+		    hfsc_scale_sc(&c.fsc, scale) < 0 ||
+		    hfsc_scale_sc(&c.usc, scale) < 0) {
+			fprintf(stderr, "HFSC: scaled rate out of range\n");
+			return -1;
+		}
+		hfsc_bulk_opt(&scaled, &c);
+		opt = &scaled;
+	}
+
+	for (id = min; ; id++) {
+		if (cb->emit(cb, parent, id, NLMSG_DATA(&opt->n),
+			     opt->n.nlmsg_len - NLMSG_LENGTH(0)) < 0)
+			return -1;
+		if (id == max)
+			break;
+	}
+	return 0;
+}
+
+static int
+hfsc_bulk_class(struct qdisc_util *qu, struct class_bulk *cb, FILE *fp)
+{
+	struct hfsc_tier *tiers = NULL, *t;
+	char *line = NULL;
+	size_t len = 0;
+	int err = 0;
+
+	while (!err && getcmdline(&line, &len, fp) != -1) {
+		char *argv[HFSC_BULK_ARGS];
+		int argc = makeargs(line, argv, HFSC_BULK_ARGS);
+
+		if (argc == 0)
+			continue;
+		if (strcmp(argv[0], "tier") == 0)
+			err = hfsc_bulk_tier(&tiers, argc - 1, argv + 1);
+		else
+			err = hfsc_bulk_subscribers(cb, tiers, argc, argv);
+		if (err)
+			fprintf(stderr, "%s:%d: illegal line\n", cb->name,
+				cmdlineno);
+	}
+	free(line);
+
+	while ((t = tiers) != NULL) {
+		tiers = t->next;
+		free(t->name);
+		free(t);
+	}
+	return err;
+}
+
 struct qdisc_util hfsc_qdisc_util = {
 	.id		= "hfsc",
 	.parse_qopt	= hfsc_parse_opt,
@@ -287,6 +492,7 @@ struct qdisc_util hfsc_qdisc_util = {
 	.print_xstats	= hfsc_print_xstats,
 	.parse_copt	= hfsc_parse_class_opt,
 	.print_copt	= hfsc_print_class_opt,
+	.bulk_copt	= hfsc_bulk_class,
 };
 
 static int
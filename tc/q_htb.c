@@ -19,9 +19,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <math.h>
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_sim.h"
 
 #define HTB_TC_VER 0x30003
 #if HTB_TC_VER >> 16 != TC_HTB_PROTOVER
@@ -103,6 +105,8 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 	int ok=0;
 	struct tc_htb_opt opt;
 	__u32 rtab[256],ctab[256];
+	__u64 rate64 = 0, ceil64 = 0;
+	int send_rtab, send_ctab;
 	unsigned buffer=0,cbuffer=0;
 	int cell_log=-1,ccell_log = -1;
 	unsigned mtu;
@@ -165,22 +169,22 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 			ok++;
 		} else if (strcmp(*argv, "ceil") == 0) {
 			NEXT_ARG();
-			if (opt.ceil.rate) {
+			if (ceil64) {
 				fprintf(stderr, "Double \"ceil\" spec\n");
 				return -1;
 			}
-			if (get_rate(&opt.ceil.rate, *argv)) {
+			if (get_rate64(&ceil64, *argv)) {
 				explain1("ceil");
 				return -1;
 			}
 			ok++;
 		} else if (strcmp(*argv, "rate") == 0) {
 			NEXT_ARG();
-			if (opt.rate.rate) {
+			if (rate64) {
 				fprintf(stderr, "Double \"rate\" spec\n");
 				return -1;
 			}
-			if (get_rate(&opt.rate.rate, *argv)) {
+			if (get_rate64(&rate64, *argv)) {
 				explain1("rate");
 				return -1;
 			}
@@ -199,17 +203,25 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 /*	if (!ok)
 		return 0;*/
 
-	if (opt.rate.rate == 0) {
+	if (rate64 == 0) {
 		fprintf(stderr, "\"rate\" is required.\n");
 		return -1;
 	}
 	/* if ceil params are missing, use the same as rate */
-	if (!opt.ceil.rate) opt.ceil = opt.rate;
+	if (!ceil64) ceil64 = rate64;
+
+	/* rates above 32 bits go in their own attributes */
+	if ((rate64 > ~0U || ceil64 > ~0U) && !tc_core_kernel_rates()) {
+		fprintf(stderr, "htb: rates above 32 bits are not supported by this kernel.\n");
+		return -1;
+	}
+	opt.rate.rate = rate64 > ~0U ? ~0U : rate64;
+	opt.ceil.rate = ceil64 > ~0U ? ~0U : ceil64;
 
 	/* compute minimal allowed burst from rate; mtu is added here to make
 	   sute that buffer is larger than mtu and to have some safeguard space */
-	if (!buffer) buffer = opt.rate.rate / get_hz() + mtu;
-	if (!cbuffer) cbuffer = opt.ceil.rate / get_hz() + mtu;
+	if (!buffer) buffer = rate64 / get_hz() + mtu;
+	if (!cbuffer) cbuffer = ceil64 / get_hz() + mtu;
 
 	opt.ceil.overhead = overhead;
 	opt.rate.overhead = overhead;
@@ -217,33 +229,42 @@ static int htb_parse_class_opt(struct qdisc_util *qu, int argc, char **argv, str
 	opt.ceil.mpu = mpu;
 	opt.rate.mpu = mpu;
 
-	if (tc_calc_rtable(&opt.rate, rtab, cell_log, mtu, linklayer) < 0) {
+	send_rtab = tc_calc_ratespec(&opt.rate, rtab, cell_log, mtu, linklayer);
+	if (send_rtab < 0) {
 		fprintf(stderr, "htb: failed to calculate rate table.\n");
 		return -1;
 	}
-	opt.buffer = tc_calc_xmittime(opt.rate.rate, buffer);
+	opt.buffer = tc_calc_burst(rate64, buffer);
 
-	if (tc_calc_rtable(&opt.ceil, ctab, ccell_log, mtu, linklayer) < 0) {
+	send_ctab = tc_calc_ratespec(&opt.ceil, ctab, ccell_log, mtu, linklayer);
+	if (send_ctab < 0) {
 		fprintf(stderr, "htb: failed to calculate ceil rate table.\n");
 		return -1;
 	}
-	opt.cbuffer = tc_calc_xmittime(opt.ceil.rate, cbuffer);
+	opt.cbuffer = tc_calc_burst(ceil64, cbuffer);
 
 	tail = NLMSG_TAIL(n);
 	addattr_l(n, 1024, TCA_OPTIONS, NULL, 0);
 	addattr_l(n, 2024, TCA_HTB_PARMS, &opt, sizeof(opt));
-	addattr_l(n, 3024, TCA_HTB_RTAB, rtab, 1024);
-	addattr_l(n, 4024, TCA_HTB_CTAB, ctab, 1024);
+	if (rate64 > ~0U)
+		addattr_l(n, 2124, TCA_HTB_RATE64, &rate64, sizeof(rate64));
+	if (ceil64 > ~0U)
+		addattr_l(n, 2224, TCA_HTB_CEIL64, &ceil64, sizeof(ceil64));
+	if (send_rtab)
+		addattr_l(n, 3224, TCA_HTB_RTAB, rtab, 1024);
+	if (send_ctab)
+		addattr_l(n, 4224, TCA_HTB_CTAB, ctab, 1024);
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
 }
 
 static int htb_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 {
-	struct rtattr *tb[TCA_HTB_RTAB+1];
+	struct rtattr *tb[TCA_HTB_MAX+1];
 	struct tc_htb_opt *hopt;
 	struct tc_htb_glob *gopt;
 	double buffer,cbuffer;
+	__u64 rate64, ceil64;
 	SPRINT_BUF(b1);
 	SPRINT_BUF(b2);
 	SPRINT_BUF(b3);
@@ -251,7 +272,7 @@ static int htb_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 	if (opt == NULL)
 		return 0;
 
-	parse_rtattr_nested(tb, TCA_HTB_RTAB, opt);
+	parse_rtattr_nested(tb, TCA_HTB_MAX, opt);
 
 	if (tb[TCA_HTB_PARMS]) {
 
@@ -263,10 +284,19 @@ static int htb_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 			if (show_details)
 				fprintf(f, "quantum %d ", (int)hopt->quantum);
 		}
-	    fprintf(f, "rate %s ", sprint_rate(hopt->rate.rate, b1));
-	    buffer = tc_calc_xmitsize(hopt->rate.rate, hopt->buffer);
-	    fprintf(f, "ceil %s ", sprint_rate(hopt->ceil.rate, b1));
-	    cbuffer = tc_calc_xmitsize(hopt->ceil.rate, hopt->cbuffer);
+	    rate64 = hopt->rate.rate;
+	    if (tb[TCA_HTB_RATE64] &&
+		RTA_PAYLOAD(tb[TCA_HTB_RATE64]) >= sizeof(rate64))
+		rate64 = rta_getattr_u64(tb[TCA_HTB_RATE64]);
+	    ceil64 = hopt->ceil.rate;
+	    if (tb[TCA_HTB_CEIL64] &&
+		RTA_PAYLOAD(tb[TCA_HTB_CEIL64]) >= sizeof(ceil64))
+		ceil64 = rta_getattr_u64(tb[TCA_HTB_CEIL64]);
+
+	    fprintf(f, "rate %s ", sprint_rate(rate64, b1));
+	    buffer = tc_calc_xmitsize(rate64, hopt->buffer);
+	    fprintf(f, "ceil %s ", sprint_rate(ceil64, b1));
+	    cbuffer = tc_calc_xmitsize(ceil64, hopt->cbuffer);
 	    if (show_details) {
 		fprintf(f, "burst %s/%u mpu %s overhead %s ",
 			sprint_size(buffer, b1),
@@ -315,6 +345,708 @@ static int htb_print_xstats(struct qdisc_util *qu, FILE *f, struct rtattr *xstat
 	return 0;
 }
 
+/*
+ * HTB as "tc sim" runs it, after sch_htb.c: classes that can send are
+ * in a row of their level and prio, classes that may borrow in the
+ * feed of their parent, and classes waiting for tokens in a heap by
+ * the time their mode changes.  The kernel's rb-trees by class ID
+ * become bits over the classes sorted by ID, their pointers the index
+ * of a class, which finds the next one up once it has gone as the
+ * remembered ID does.  Levels count down from the root classes.
+ */
+#define HTB_SIM_MBUFFER		60.0	/* seconds of tokens at most */
+#define HTB_SIM_EPS		1e-9
+
+enum { HTB_CANT_SEND, HTB_MAY_BORROW, HTB_CAN_SEND };
+
+struct htb_sim_set
+{
+	struct sim_class	**cls;		/* by ID, shared with other prios */
+	unsigned int		n;
+	unsigned int		count;
+	__u64			*bits;
+	__u64			*sum;		/* of non-zero words of bits */
+};
+
+struct htb_sim_class
+{
+	struct tc_ratespec	rspec;
+	struct tc_ratespec	cspec;
+	__u64			rate;
+	__u64			ceil;
+	double			buffer;
+	double			cbuffer;
+	__u32			quantum;
+	int			prio;
+	int			level;
+	int			mode;
+	double			tokens;
+	double			ctokens;
+	double			t_c;
+	int			prio_activity;
+	double			pq_key;
+	int			heap;		/* index in the wait heap, or -1 */
+	int			pos;		/* in the feeds of the parent */
+	int			rowpos;		/* in the rows of the level */
+	int			deficit[TC_HTB_MAXDEPTH];
+	struct htb_sim_set	feed[TC_HTB_NUMPRIO];
+	int			ptr[TC_HTB_NUMPRIO];
+};
+
+struct htb_sim
+{
+	__u32			defcls;
+	__u32			r2q;
+	__u32			direct_qlen;
+	struct sim_qdisc	*direct;
+	struct htb_sim_set	row[TC_HTB_MAXDEPTH][TC_HTB_NUMPRIO];
+	int			rowptr[TC_HTB_MAXDEPTH][TC_HTB_NUMPRIO];
+	struct sim_class	**heap;
+	int			nheap;
+};
+
+static int htb_set_init(struct htb_sim_set *s, struct sim_class **cls,
+			unsigned int n)
+{
+	unsigned int words = (n + 63) / 64;
+
+	s->cls = cls;
+	s->n = n;
+	s->count = 0;
+	s->bits = calloc(words ? : 1, sizeof(__u64));
+	s->sum = calloc((words + 63) / 64 ? : 1, sizeof(__u64));
+	return s->bits && s->sum ? 0 : -1;
+}
+
+static void htb_set_add(struct htb_sim_set *s, int i)
+{
+	__u64 bit = 1ULL << (i % 64);
+
+	if (s->bits[i / 64] & bit)
+		return;
+	s->bits[i / 64] |= bit;
+	s->sum[i / 4096] |= 1ULL << ((i / 64) % 64);
+	s->count++;
+}
+
+static void htb_set_del(struct htb_sim_set *s, int i)
+{
+	__u64 bit = 1ULL << (i % 64);
+
+	if (!(s->bits[i / 64] & bit))
+		return;
+	s->bits[i / 64] &= ~bit;
+	if (s->bits[i / 64] == 0)
+		s->sum[i / 4096] &= ~(1ULL << ((i / 64) % 64));
+	s->count--;
+}
+
+/* The first member at i or above, -1 if there is none */
+static int htb_set_next(const struct htb_sim_set *s, int i)
+{
+	unsigned int words = (s->n + 63) / 64, sums = (words + 63) / 64;
+	unsigned int w, sw;
+	__u64 m;
+
+	if (i < 0 || i >= s->n)
+		return -1;
+	w = i / 64;
+	m = s->bits[w] & (~0ULL << (i % 64));
+	if (m)
+		return w * 64 + __builtin_ctzll(m);
+	if (++w >= words)
+		return -1;
+	sw = w / 64;
+	m = s->sum[sw] & (~0ULL << (w % 64));
+	while (m == 0) {
+		if (++sw >= sums)
+			return -1;
+		m = s->sum[sw];
+	}
+	w = sw * 64 + __builtin_ctzll(m);
+	return w * 64 + __builtin_ctzll(s->bits[w]);
+}
+
+static int htb_sim_init(struct sim_qdisc *q, struct rtattr *opt)
+{
+	struct htb_sim *hs = q->priv;
+	struct rtattr *tb[TCA_HTB_MAX+1];
+	struct tc_htb_glob *gopt;
+
+	if (hs == NULL) {
+		hs = q->priv = calloc(1, sizeof(*hs));
+		if (hs == NULL)
+			return -1;
+		hs->r2q = 10;
+		hs->direct_qlen = sim_txqueuelen < 2 ? 2 : sim_txqueuelen;
+	}
+	if (opt == NULL)
+		return 0;
+	parse_rtattr_nested(tb, TCA_HTB_MAX, opt);
+	if (tb[TCA_HTB_INIT]) {
+		if (RTA_PAYLOAD(tb[TCA_HTB_INIT]) < sizeof(*gopt))
+			return -1;
+		gopt = RTA_DATA(tb[TCA_HTB_INIT]);
+		hs->r2q = gopt->rate2quantum;
+		hs->defcls = gopt->defcls;
+	}
+	if (tb[TCA_HTB_DIRECT_QLEN] &&
+	    RTA_PAYLOAD(tb[TCA_HTB_DIRECT_QLEN]) >= sizeof(__u32))
+		hs->direct_qlen = rta_getattr_u32(tb[TCA_HTB_DIRECT_QLEN]);
+	return 0;
+}
+
+static int htb_sim_class_init(struct sim_class *cl, struct rtattr *opt)
+{
+	struct htb_sim_class *hc = cl->priv;
+	struct rtattr *tb[TCA_HTB_MAX+1];
+	struct tc_htb_opt *hopt;
+
+	if (opt == NULL)
+		return hc ? 0 : -1;
+	parse_rtattr_nested(tb, TCA_HTB_MAX, opt);
+	if (tb[TCA_HTB_PARMS] == NULL ||
+	    RTA_PAYLOAD(tb[TCA_HTB_PARMS]) < sizeof(*hopt)) {
+		fprintf(stderr, "sim: htb class without parameters\n");
+		return -1;
+	}
+	hopt = RTA_DATA(tb[TCA_HTB_PARMS]);
+	if (hc == NULL) {
+		hc = cl->priv = calloc(1, sizeof(*hc));
+		if (hc == NULL)
+			return -1;
+	}
+
+	/* The kernel leaves mpu to the rate tables it no longer uses */
+	hc->rspec = hopt->rate;
+	hc->rspec.mpu = 0;
+	hc->cspec = hopt->ceil;
+	hc->cspec.mpu = 0;
+	hc->rate = hopt->rate.rate;
+	if (tb[TCA_HTB_RATE64] &&
+	    RTA_PAYLOAD(tb[TCA_HTB_RATE64]) >= sizeof(__u64))
+		hc->rate = rta_getattr_u64(tb[TCA_HTB_RATE64]);
+	hc->ceil = hopt->ceil.rate;
+	if (tb[TCA_HTB_CEIL64] &&
+	    RTA_PAYLOAD(tb[TCA_HTB_CEIL64]) >= sizeof(__u64))
+		hc->ceil = rta_getattr_u64(tb[TCA_HTB_CEIL64]);
+	hc->buffer = (double)tc_core_tick2time(hopt->buffer) /
+		     TIME_UNITS_PER_SEC;
+	hc->cbuffer = (double)tc_core_tick2time(hopt->cbuffer) /
+		      TIME_UNITS_PER_SEC;
+	hc->quantum = hopt->quantum;
+	hc->prio = hopt->prio < TC_HTB_NUMPRIO ? hopt->prio : TC_HTB_NUMPRIO - 1;
+	return 0;
+}
+
+static int htb_sim_cmp(const void *a, const void *b)
+{
+	const struct sim_class *x = *(struct sim_class **)a;
+	const struct sim_class *y = *(struct sim_class **)b;
+
+	return x->classid < y->classid ? -1 : x->classid > y->classid;
+}
+
+/* Classes sorted by ID that are at level (with parent NULL) or below
+ * parent, numbered in pos or rowpos
+ */
+static struct sim_class **htb_sim_sorted(struct sim_qdisc *q,
+					 struct sim_class *parent, int level,
+					 unsigned int *n)
+{
+	struct sim_class **cls, *cl;
+	unsigned int i = 0;
+
+	for (cl = q->classes; cl; cl = cl->next) {
+		struct htb_sim_class *hc = cl->priv;
+
+		if (parent ? cl->parent == parent : hc->level == level)
+			i++;
+	}
+	cls = malloc((i ? : 1) * sizeof(*cls));
+	if (cls == NULL)
+		return NULL;
+	*n = i;
+	i = 0;
+	for (cl = q->classes; cl; cl = cl->next) {
+		struct htb_sim_class *hc = cl->priv;
+
+		if (parent ? cl->parent == parent : hc->level == level)
+			cls[i++] = cl;
+	}
+	qsort(cls, *n, sizeof(*cls), htb_sim_cmp);
+	for (i = 0; i < *n; i++) {
+		struct htb_sim_class *hc = cls[i]->priv;
+
+		if (parent)
+			hc->pos = i;
+		else
+			hc->rowpos = i;
+	}
+	return cls;
+}
+
+static int htb_sim_level(struct sim_class *cl)
+{
+	if (cl->children == 0)
+		return 0;
+	if (cl->parent == NULL)
+		return TC_HTB_MAXDEPTH - 1;
+	return htb_sim_level(cl->parent) - 1;
+}
+
+static int htb_sim_start(struct sim_qdisc *q, double now)
+{
+	struct htb_sim *hs = q->priv;
+	struct sim_class *cl, **cls;
+	unsigned int n, nclasses = 0;
+	int level, prio;
+	char b1[16];
+
+	for (cl = q->classes; cl; cl = cl->next) {
+		struct htb_sim_class *hc = cl->priv;
+
+		hc->level = htb_sim_level(cl);
+		if (cl->children && hc->level <= 0) {
+			fprintf(stderr, "sim: htb class %s is too deep\n",
+				sprint_tc_classid(cl->classid, b1));
+			return -1;
+		}
+		if (hc->quantum == 0) {
+			hc->quantum = hs->r2q ? hc->rate / hs->r2q : 200000;
+			if (hc->quantum < 1000)
+				hc->quantum = 1000;
+			if (hc->quantum > 200000)
+				hc->quantum = 200000;
+		}
+		hc->mode = HTB_CAN_SEND;
+		hc->tokens = hc->buffer;
+		hc->ctokens = hc->cbuffer;
+		hc->t_c = now;
+		hc->heap = -1;
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++)
+			hc->ptr[prio] = -1;
+		nclasses++;
+	}
+
+	for (cl = q->classes; cl; cl = cl->next) {
+		struct htb_sim_class *hc = cl->priv;
+
+		if (cl->children == 0)
+			continue;
+		cls = htb_sim_sorted(q, cl, 0, &n);
+		if (cls == NULL)
+			return -1;
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++)
+			if (htb_set_init(&hc->feed[prio], cls, n) < 0)
+				return -1;
+	}
+	for (level = 0; level < TC_HTB_MAXDEPTH; level++) {
+		cls = htb_sim_sorted(q, NULL, level, &n);
+		if (cls == NULL)
+			return -1;
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++) {
+			if (htb_set_init(&hs->row[level][prio], cls, n) < 0)
+				return -1;
+			hs->rowptr[level][prio] = -1;
+		}
+	}
+
+	hs->heap = malloc((nclasses ? : 1) * sizeof(hs->heap[0]));
+	hs->direct = sim_qdisc_builtin(q, NULL, "pfifo", hs->direct_qlen);
+	return hs->heap && hs->direct ? 0 : -1;
+}
+
+static struct sim_qdisc *htb_sim_classify(struct sim_qdisc *q,
+					  struct sim_pkt *p)
+{
+	struct htb_sim *hs = q->priv;
+	struct sim_class *cl;
+	struct sim_tp *chain;
+	__u32 classid;
+
+	if (p->priority == q->handle)
+		return hs->direct;
+	cl = sim_class_find(q, p->priority);
+	if (cl) {
+		if (cl->children == 0)
+			return cl->child;
+		chain = cl->filters;
+	} else {
+		chain = q->filters;
+	}
+	while (chain && sim_filter(chain, p, &classid) == 0) {
+		if (classid == q->handle)
+			return hs->direct;
+		cl = sim_class_find(q, classid);
+		if (cl == NULL)
+			break;
+		if (cl->children == 0)
+			return cl->child;
+		chain = cl->filters;
+	}
+	cl = sim_class_find(q, TC_H_MAKE(q->handle, hs->defcls));
+	if (cl == NULL || cl->children)
+		return hs->direct;
+	return cl->child;
+}
+
+static void htb_sim_heap_swap(struct htb_sim *hs, int i, int j)
+{
+	struct sim_class *t = hs->heap[i];
+
+	hs->heap[i] = hs->heap[j];
+	hs->heap[j] = t;
+	((struct htb_sim_class *)hs->heap[i]->priv)->heap = i;
+	((struct htb_sim_class *)hs->heap[j]->priv)->heap = j;
+}
+
+static double htb_sim_key(struct htb_sim *hs, int i)
+{
+	return ((struct htb_sim_class *)hs->heap[i]->priv)->pq_key;
+}
+
+static void htb_sim_heap_fix(struct htb_sim *hs, int i)
+{
+	while (i > 0 && htb_sim_key(hs, i) < htb_sim_key(hs, (i - 1) / 2)) {
+		htb_sim_heap_swap(hs, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	for (;;) {
+		int c = 2 * i + 1;
+
+		if (c >= hs->nheap)
+			break;
+		if (c + 1 < hs->nheap && htb_sim_key(hs, c + 1) < htb_sim_key(hs, c))
+			c++;
+		if (htb_sim_key(hs, c) >= htb_sim_key(hs, i))
+			break;
+		htb_sim_heap_swap(hs, i, c);
+		i = c;
+	}
+}
+
+static void htb_sim_wait(struct htb_sim *hs, struct sim_class *cl, double key)
+{
+	struct htb_sim_class *hc = cl->priv;
+
+	hc->pq_key = key;
+	hc->heap = hs->nheap;
+	hs->heap[hs->nheap++] = cl;
+	htb_sim_heap_fix(hs, hc->heap);
+}
+
+static void htb_sim_unwait(struct htb_sim *hs, struct sim_class *cl)
+{
+	struct htb_sim_class *hc = cl->priv;
+	int i = hc->heap;
+
+	if (i < 0)
+		return;
+	hc->heap = -1;
+	if (i != --hs->nheap) {
+		hs->heap[i] = hs->heap[hs->nheap];
+		((struct htb_sim_class *)hs->heap[i]->priv)->heap = i;
+		htb_sim_heap_fix(hs, i);
+	}
+}
+
+/* The mode at now, and how long until it changes, as htb_class_mode() */
+static int htb_sim_mode(struct htb_sim_class *hc, double now, double *wait)
+{
+	double diff = fmin(now - hc->t_c, HTB_SIM_MBUFFER);
+	double toks;
+
+	toks = hc->ctokens + diff;
+	if (toks < -HTB_SIM_EPS) {
+		*wait = -toks;
+		return HTB_CANT_SEND;
+	}
+	toks = hc->tokens + diff;
+	if (toks >= -HTB_SIM_EPS)
+		return HTB_CAN_SEND;
+	*wait = -toks;
+	return HTB_MAY_BORROW;
+}
+
+static void htb_sim_activate_prios(struct htb_sim *hs, struct sim_class *cl)
+{
+	struct htb_sim_class *hc = cl->priv;
+	int mask = hc->prio_activity, prio;
+
+	while (hc->mode == HTB_MAY_BORROW && cl->parent && mask) {
+		struct htb_sim_class *hp = cl->parent->priv;
+
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++) {
+			if (!(mask & (1 << prio)))
+				continue;
+			/* the parent is fed in this prio already */
+			if (hp->feed[prio].count)
+				mask &= ~(1 << prio);
+			htb_set_add(&hp->feed[prio], hc->pos);
+		}
+		hp->prio_activity |= mask;
+		cl = cl->parent;
+		hc = hp;
+	}
+	if (hc->mode == HTB_CAN_SEND && mask)
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++)
+			if (mask & (1 << prio))
+				htb_set_add(&hs->row[hc->level][prio], hc->rowpos);
+}
+
+static void htb_sim_deactivate_prios(struct htb_sim *hs, struct sim_class *cl)
+{
+	struct htb_sim_class *hc = cl->priv;
+	int mask = hc->prio_activity, m, prio;
+
+	while (hc->mode == HTB_MAY_BORROW && cl->parent && mask) {
+		struct htb_sim_class *hp = cl->parent->priv;
+
+		m = mask;
+		mask = 0;
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++) {
+			if (!(m & (1 << prio)))
+				continue;
+			htb_set_del(&hp->feed[prio], hc->pos);
+			if (hp->feed[prio].count == 0)
+				mask |= 1 << prio;
+		}
+		hp->prio_activity &= ~mask;
+		cl = cl->parent;
+		hc = hp;
+	}
+	if (hc->mode == HTB_CAN_SEND && mask)
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++)
+			if (mask & (1 << prio))
+				htb_set_del(&hs->row[hc->level][prio], hc->rowpos);
+}
+
+static void htb_sim_activate(struct htb_sim *hs, struct sim_class *cl)
+{
+	struct htb_sim_class *hc = cl->priv;
+
+	if (hc->prio_activity == 0) {
+		hc->prio_activity = 1 << hc->prio;
+		htb_sim_activate_prios(hs, cl);
+	}
+}
+
+static void htb_sim_deactivate(struct htb_sim *hs, struct sim_class *cl)
+{
+	struct htb_sim_class *hc = cl->priv;
+
+	htb_sim_deactivate_prios(hs, cl);
+	hc->prio_activity = 0;
+}
+
+static void htb_sim_change_mode(struct htb_sim *hs, struct sim_class *cl,
+				double now, double *wait)
+{
+	struct htb_sim_class *hc = cl->priv;
+	int mode = htb_sim_mode(hc, now, wait);
+
+	if (mode == hc->mode)
+		return;
+	if (hc->prio_activity) {
+		if (hc->mode != HTB_CANT_SEND)
+			htb_sim_deactivate_prios(hs, cl);
+		hc->mode = mode;
+		if (mode != HTB_CANT_SEND)
+			htb_sim_activate_prios(hs, cl);
+	} else {
+		hc->mode = mode;
+	}
+}
+
+static void htb_sim_events(struct htb_sim *hs, double now)
+{
+	while (hs->nheap && htb_sim_key(hs, 0) <= now) {
+		struct sim_class *cl = hs->heap[0];
+		struct htb_sim_class *hc = cl->priv;
+		double wait = 0;
+
+		htb_sim_unwait(hs, cl);
+		htb_sim_change_mode(hs, cl, now, &wait);
+		if (hc->mode != HTB_CAN_SEND)
+			htb_sim_wait(hs, cl, now + wait);
+	}
+}
+
+/* Tokens of the classes that lent, at level and up, ceil tokens of all */
+static void htb_sim_charge(struct htb_sim *hs, struct sim_class *cl,
+			   int level, unsigned int len, double now)
+{
+	for (; cl; cl = cl->parent) {
+		struct htb_sim_class *hc = cl->priv;
+		double diff = fmin(now - hc->t_c, HTB_SIM_MBUFFER);
+		double toks, wait = 0;
+		int old;
+
+		if (hc->level >= level) {
+			toks = fmin(hc->tokens + diff, hc->buffer) -
+			       sim_l2t(&hc->rspec, hc->rate, len);
+			hc->tokens = fmax(toks, -HTB_SIM_MBUFFER);
+		} else {
+			hc->tokens += diff;
+		}
+		toks = fmin(hc->ctokens + diff, hc->cbuffer) -
+		       sim_l2t(&hc->cspec, hc->ceil, len);
+		hc->ctokens = fmax(toks, -HTB_SIM_MBUFFER);
+		hc->t_c = now;
+
+		old = hc->mode;
+		htb_sim_change_mode(hs, cl, now, &wait);
+		if (old != hc->mode) {
+			if (old != HTB_CAN_SEND)
+				htb_sim_unwait(hs, cl);
+			if (hc->mode != HTB_CAN_SEND)
+				htb_sim_wait(hs, cl, now + wait);
+		}
+	}
+}
+
+/* Down the feeds from the row to a leaf, as htb_lookup_leaf() */
+static struct sim_class *htb_sim_lookup_leaf(struct htb_sim *hs, int prio,
+					     int level)
+{
+	struct {
+		struct htb_sim_set	*set;
+		int			*ptr;
+	} stk[TC_HTB_MAXDEPTH], *sp = stk;
+	int i;
+
+	sp->set = &hs->row[level][prio];
+	sp->ptr = &hs->rowptr[level][prio];
+	if (sp->set->count == 0)
+		return NULL;
+	for (;;) {
+		i = *sp->ptr < 0 ? -1 : htb_set_next(sp->set, *sp->ptr);
+		if (i < 0) {
+			/* at the right end: rewind and go up */
+			*sp->ptr = htb_set_next(sp->set, 0);
+			if (*sp->ptr < 0)
+				return NULL;
+			if (sp > stk) {
+				sp--;
+				++*sp->ptr;
+			}
+		} else {
+			struct sim_class *cl = sp->set->cls[i];
+			struct htb_sim_class *hc = cl->priv;
+
+			*sp->ptr = i;
+			if (hc->level == 0)
+				return cl;
+			if (sp == &stk[TC_HTB_MAXDEPTH - 1])
+				return NULL;
+			sp++;
+			sp->set = &hc->feed[prio];
+			sp->ptr = &hc->ptr[prio];
+		}
+	}
+}
+
+static int *htb_sim_leaf_ptr(struct htb_sim *hs, struct sim_class *cl,
+			     int prio, int level)
+{
+	if (level == 0)
+		return &hs->rowptr[0][prio];
+	return &((struct htb_sim_class *)cl->parent->priv)->ptr[prio];
+}
+
+static struct sim_pkt *htb_sim_dequeue_tree(struct htb_sim *hs, int prio,
+					    int level, double now,
+					    double *next)
+{
+	struct sim_class *cl, *start;
+	struct htb_sim_class *hc;
+	struct sim_pkt *p;
+
+	start = cl = htb_sim_lookup_leaf(hs, prio, level);
+	for (;;) {
+		if (cl == NULL)
+			return NULL;
+		if (cl->child->qlen == 0) {
+			struct sim_class *nx;
+
+			htb_sim_deactivate(hs, cl);
+			if (hs->row[level][prio].count == 0)
+				return NULL;
+			nx = htb_sim_lookup_leaf(hs, prio, level);
+			if (cl == start)
+				start = nx;
+			cl = nx;
+			continue;
+		}
+		p = sim_dequeue(cl->child, now, next);
+		if (p)
+			break;
+		/* a leaf qdisc that is not work-conserving */
+		++*htb_sim_leaf_ptr(hs, cl, prio, level);
+		cl = htb_sim_lookup_leaf(hs, prio, level);
+		if (cl == start)
+			return NULL;
+	}
+
+	hc = cl->priv;
+	hc->deficit[level] -= p->len;
+	if (hc->deficit[level] < 0) {
+		hc->deficit[level] += hc->quantum;
+		++*htb_sim_leaf_ptr(hs, cl, prio, level);
+	}
+	if (cl->child->qlen == 0)
+		htb_sim_deactivate(hs, cl);
+	htb_sim_charge(hs, cl, level, p->len, now);
+	return p;
+}
+
+static int htb_sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p, double now)
+{
+	struct htb_sim *hs = q->priv;
+	struct sim_class *cl = sim_class_of(q, p);
+
+	if (cl == NULL)
+		return sim_enqueue(hs->direct, p, now);
+	if (sim_enqueue(cl->child, p, now) < 0)
+		return -1;
+	htb_sim_activate(hs, cl);
+	return 0;
+}
+
+static struct sim_pkt *htb_sim_dequeue(struct sim_qdisc *q, double now,
+				       double *next)
+{
+	struct htb_sim *hs = q->priv;
+	struct sim_pkt *p;
+	int level, prio;
+
+	if (hs->direct->qlen)
+		return sim_dequeue(hs->direct, now, next);
+	htb_sim_events(hs, now);
+	for (level = 0; level < TC_HTB_MAXDEPTH; level++) {
+		for (prio = 0; prio < TC_HTB_NUMPRIO; prio++) {
+			if (hs->row[level][prio].count == 0)
+				continue;
+			p = htb_sim_dequeue_tree(hs, prio, level, now, next);
+			if (p)
+				return p;
+		}
+	}
+	if (hs->nheap && htb_sim_key(hs, 0) < *next)
+		*next = htb_sim_key(hs, 0);
+	return NULL;
+}
+
+static const struct sim_qdisc_ops htb_sim = {
+	.init		= htb_sim_init,
+	.class_init	= htb_sim_class_init,
+	.start		= htb_sim_start,
+	.classify	= htb_sim_classify,
+	.enqueue	= htb_sim_enqueue,
+	.dequeue	= htb_sim_dequeue,
+};
+
 struct qdisc_util htb_qdisc_util = {
 	.id 		= "htb",
 	.parse_qopt	= htb_parse_opt,
@@ -322,6 +1054,7 @@ struct qdisc_util htb_qdisc_util = {
 	.print_xstats 	= htb_print_xstats,
 	.parse_copt	= htb_parse_class_opt,
 	.print_copt	= htb_print_opt,
+	.sim		= &htb_sim,
 };
 
 /* for testing of old one */
@@ -332,4 +1065,5 @@ struct qdisc_util htb2_qdisc_util = {
 	.print_xstats 	= htb_print_xstats,
 	.parse_copt	= htb_parse_class_opt,
 	.print_copt	= htb_print_opt,
+	.sim		= &htb_sim,
 };
@@ -22,10 +22,12 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <byteswap.h>
 
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
+#include "netem_dist.h"
 
 static void explain(void)
 {
@@ -103,7 +105,39 @@ char * sprint_percent(__u32 per, char *buf)
  *	# comment line(s)
  *	data0 data1 ...
  */
-static int get_distribution(const char *type, __s16 *data, int maxdata)
+/* Binary table written by netem/makedistb */
+static int get_distribution_bin(FILE *f, const char *name,
+				__s16 *data, int maxdata)
+{
+	struct netem_distb_hdr h;
+	int swap, i;
+
+	if (fread(&h, sizeof(h), 1, f) != 1)
+		goto bad;
+
+	swap = h.magic != NETEM_DISTB_MAGIC;
+	if (swap) {
+		if (bswap_32(h.magic) != NETEM_DISTB_MAGIC)
+			goto bad;
+		h.count = bswap_32(h.count);
+	}
+	if (h.count > maxdata) {
+		fprintf(stderr, "%s: too much data\n", name);
+		return -1;
+	}
+	if (fread(data, sizeof(data[0]), h.count, f) != h.count)
+		goto bad;
+	if (swap)
+		for (i = 0; i < h.count; i++)
+			data[i] = bswap_16(data[i]);
+	return h.count;
+
+ bad:
+	fprintf(stderr, "%s: bad distribution table\n", name);
+	return -1;
+}
+
+int get_distribution(const char *type, __s16 *data, int maxdata)
 {
 	FILE *f;
 	int n;
@@ -112,6 +146,13 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 	char *line = NULL;
 	char name[128];
 
+	snprintf(name, sizeof(name), "%s/%s.distb", get_tc_lib(), type);
+	if ((f = fopen(name, "r")) != NULL) {
+		n = get_distribution_bin(f, name, data, maxdata);
+		fclose(f);
+		return n;
+	}
+
 	snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
 	if ((f = fopen(name, "r")) == NULL) {
 		fprintf(stderr, "No distribution data for %s (%s: %s)\n",
@@ -22,6 +22,7 @@
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_sim.h"
 
 static void explain(void)
 {
@@ -117,9 +118,110 @@ int prio_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 	return 0;
 }
 
+/* Bands are classes major:1 to major:bands, served in order */
+struct prio_sim
+{
+	int			bands;
+	__u8			prio2band[TC_PRIO_MAX+1];
+	struct sim_class	*band[TCQ_PRIO_BANDS];
+};
+
+static int prio_sim_init(struct sim_qdisc *q, struct rtattr *opt)
+{
+	struct prio_sim *ps = q->priv;
+	struct tc_prio_qopt *qopt;
+	struct rtattr *tb[TCA_PRIO_MAX+1];
+	int i;
+
+	if (opt == NULL)
+		return 0;
+	if (parse_rtattr_nested_compat(tb, TCA_PRIO_MAX, opt, qopt,
+				       sizeof(*qopt)))
+		return -1;
+	if (qopt->bands < 2 || qopt->bands > TCQ_PRIO_BANDS) {
+		fprintf(stderr, "sim: prio of %d bands\n", qopt->bands);
+		return -1;
+	}
+	if (ps == NULL) {
+		ps = q->priv = calloc(1, sizeof(*ps));
+		if (ps == NULL)
+			return -1;
+	}
+	ps->bands = qopt->bands;
+	memcpy(ps->prio2band, qopt->priomap, sizeof(ps->prio2band));
+	for (i = 0; i < ps->bands; i++) {
+		if (ps->band[i])
+			continue;
+		ps->band[i] = sim_class_new(q, q->handle | (i + 1));
+		if (ps->band[i] == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+/* Bands are there from the start */
+static int prio_sim_class_init(struct sim_class *cl, struct rtattr *opt)
+{
+	struct prio_sim *ps = cl->qdisc->priv;
+
+	if (ps && TC_H_MIN(cl->classid) <= ps->bands)
+		return 0;
+	fprintf(stderr, "sim: prio has no band %x\n", TC_H_MIN(cl->classid));
+	return -1;
+}
+
+static struct sim_qdisc *prio_sim_classify(struct sim_qdisc *q,
+					   struct sim_pkt *p)
+{
+	struct prio_sim *ps = q->priv;
+	__u32 band = p->priority;
+
+	if (TC_H_MAJ(band) != q->handle) {
+		if (q->filters == NULL || sim_filter(q->filters, p, &band)) {
+			if (TC_H_MAJ(band))
+				band = 0;
+			return ps->band[ps->prio2band[band & TC_PRIO_MAX]]->child;
+		}
+	}
+	band = TC_H_MIN(band) - 1;
+	if (band >= ps->bands)
+		return ps->band[ps->prio2band[0]]->child;
+	return ps->band[band]->child;
+}
+
+static int prio_sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p, double now)
+{
+	return sim_enqueue(sim_class_of(q, p)->child, p, now);
+}
+
+static struct sim_pkt *prio_sim_dequeue(struct sim_qdisc *q, double now,
+					double *next)
+{
+	struct prio_sim *ps = q->priv;
+	struct sim_pkt *p;
+	int i;
+
+	for (i = 0; i < ps->bands; i++) {
+		struct sim_qdisc *child = ps->band[i]->child;
+
+		if (child->qlen && (p = sim_dequeue(child, now, next)))
+			return p;
+	}
+	return NULL;
+}
+
+static const struct sim_qdisc_ops prio_sim = {
+	.init		= prio_sim_init,
+	.class_init	= prio_sim_class_init,
+	.classify	= prio_sim_classify,
+	.enqueue	= prio_sim_enqueue,
+	.dequeue	= prio_sim_dequeue,
+};
+
 struct qdisc_util prio_qdisc_util = {
 	.id	 	= "prio",
 	.parse_qopt	= prio_parse_opt,
 	.print_qopt	= prio_print_opt,
+	.sim		= &prio_sim,
 };
 
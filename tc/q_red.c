@@ -31,6 +31,7 @@ static void explain(void)
 	fprintf(stderr, "Usage: ... red limit BYTES [min BYTES] [max BYTES] avpkt BYTES [burst PACKETS]\n");
 	fprintf(stderr, "               [adaptive] [probability PROBABILITY] bandwidth KBPS\n");
 	fprintf(stderr, "               [ecn] [harddrop]\n");
+	fprintf(stderr, "               [target TIME [rtt TIME] [flows NUMBER]]\n");
 }
 
 static int red_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nlmsghdr *n)
@@ -44,8 +45,11 @@ static int red_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 	__u8 sbuf[256];
 	__u32 max_P;
 	struct rtattr *tail;
+	struct tc_red_tune tune;
+	int given = 0;
 
 	memset(&opt, 0, sizeof(opt));
+	memset(&tune, 0, sizeof(tune));
 
 	while (argc > 0) {
 		if (strcmp(*argv, "limit") == 0) {
@@ -84,12 +88,31 @@ static int red_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 				fprintf(stderr, "Illegal \"probability\"\n");
 				return -1;
 			}
+			given = 1;
 		} else if (strcmp(*argv, "bandwidth") == 0) {
 			NEXT_ARG();
 			if (get_rate(&rate, *argv)) {
 				fprintf(stderr, "Illegal \"bandwidth\"\n");
 				return -1;
 			}
+		} else if (strcmp(*argv, "target") == 0) {
+			NEXT_ARG();
+			if (get_time(&tune.target, *argv) || !tune.target) {
+				fprintf(stderr, "Illegal \"target\"\n");
+				return -1;
+			}
+		} else if (strcmp(*argv, "rtt") == 0) {
+			NEXT_ARG();
+			if (get_time(&tune.rtt, *argv)) {
+				fprintf(stderr, "Illegal \"rtt\"\n");
+				return -1;
+			}
+		} else if (strcmp(*argv, "flows") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&tune.flows, *argv, 0)) {
+				fprintf(stderr, "Illegal \"flows\"\n");
+				return -1;
+			}
 		} else if (strcmp(*argv, "ecn") == 0) {
 			opt.flags |= TC_RED_ECN;
 		} else if (strcmp(*argv, "harddrop") == 0) {
@@ -116,6 +139,22 @@ static int red_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 		fprintf(stderr, "RED: Required parameter (limit, avpkt) is missing\n");
 		return -1;
 	}
+	if (tune.target) {
+		if (opt.qth_min || opt.qth_max || burst || given) {
+			fprintf(stderr, "RED: \"target\" picks min, max, burst and probability\n");
+			return -1;
+		}
+		tune.limit = opt.limit;
+		tune.avpkt = avpkt;
+		tune.rate = rate;
+		if (tc_red_tune(&tune) < 0)
+			return -1;
+		tc_red_tune_print("RED", &tune);
+		opt.qth_min = tune.qth_min;
+		opt.qth_max = tune.qth_max;
+		burst = tune.burst;
+		probability = tune.probability;
+	}
 	/* Compute default min/max thresholds based on
 	 * Sally Floyd's recommendations:
 	 * http://www.icir.org/floyd/REDparameters.txt
@@ -24,6 +24,13 @@
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_red.h"
+#include "tc_sim.h"
+
+/* sch_sfq.c's bounds */
+#define SFQ_MAX_DEPTH		127
+#define SFQ_MAX_FLOWS		65536
+#define SFQ_MAX_DIVISOR		65536
+#define SFQ_DEFAULT_LIMIT	127
 
 static void explain(void)
 {
@@ -50,7 +57,7 @@ static int sfq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 		if (strcmp(*argv, "quantum") == 0) {
 			NEXT_ARG();
 			if (get_size(&opt.v0.quantum, *argv)) {
-				fprintf(stderr, "Illegal \"limit\"\n");
+				fprintf(stderr, "Illegal \"quantum\"\n");
 				return -1;
 			}
 			ok++;
@@ -78,6 +85,12 @@ static int sfq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 				fprintf(stderr, "Illegal \"divisor\"\n");
 				return -1;
 			}
+			if (opt.v0.divisor == 0 || opt.v0.divisor > SFQ_MAX_DIVISOR ||
+			    (opt.v0.divisor & (opt.v0.divisor - 1))) {
+				fprintf(stderr, "Illegal \"divisor\", must be a power of 2 up to %u\n",
+					SFQ_MAX_DIVISOR);
+				return -1;
+			}
 			ok++;
 		} else if (strcmp(*argv, "flows") == 0) {
 			NEXT_ARG();
@@ -85,11 +98,21 @@ static int sfq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 				fprintf(stderr, "Illegal \"flows\"\n");
 				return -1;
 			}
+			if (opt.v0.flows > SFQ_MAX_FLOWS) {
+				fprintf(stderr, "Illegal \"flows\", must be at most %u\n",
+					SFQ_MAX_FLOWS);
+				return -1;
+			}
 			ok++;
 		} else if (strcmp(*argv, "depth") == 0) {
 			NEXT_ARG();
 			if (get_u32(&opt.depth, *argv, 0)) {
-				fprintf(stderr, "Illegal \"flows\"\n");
+				fprintf(stderr, "Illegal \"depth\"\n");
+				return -1;
+			}
+			if (opt.depth > SFQ_MAX_DEPTH) {
+				fprintf(stderr, "Illegal \"depth\", must be at most %u\n",
+					SFQ_MAX_DEPTH);
 				return -1;
 			}
 			ok++;
@@ -98,21 +121,21 @@ static int sfq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 			ok++;
 		} else if (strcmp(*argv, "redflowlimit") == 0) {
 			NEXT_ARG();
-			if (get_u32(&opt.limit, *argv, 0)) {
+			if (get_size(&opt.limit, *argv)) {
 				fprintf(stderr, "Illegal \"redflowlimit\"\n");
 				return -1;
 			}
 			red++;
 		} else if (strcmp(*argv, "min") == 0) {
 			NEXT_ARG();
-			if (get_u32(&opt.qth_min, *argv, 0)) {
+			if (get_size(&opt.qth_min, *argv)) {
 				fprintf(stderr, "Illegal \"min\"\n");
 				return -1;
 			}
 			red++;
 		} else if (strcmp(*argv, "max") == 0) {
 			NEXT_ARG();
-			if (get_u32(&opt.qth_max, *argv, 0)) {
+			if (get_size(&opt.qth_max, *argv)) {
 				fprintf(stderr, "Illegal \"max\"\n");
 				return -1;
 			}
@@ -154,6 +177,12 @@ static int sfq_parse_opt(struct qdisc_util *qu, int argc, char **argv, struct nl
 		}
 		argc--; argv++;
 	}
+
+	/* Flows with packets cannot outnumber the packets the queue holds */
+	if (opt.v0.flows && opt.v0.flows > (opt.v0.limit ? : SFQ_DEFAULT_LIMIT))
+		fprintf(stderr, "SFQ: WARNING. Only %u of %u flows fit in the limit, raise \"limit\".\n",
+			opt.v0.limit ? : SFQ_DEFAULT_LIMIT, opt.v0.flows);
+
 	if (red) {
 		if (!opt.limit) {
 			fprintf(stderr, "Required parameter (redflowlimit) is missing\n");
@@ -239,6 +268,8 @@ static int sfq_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 			qopt_ext->max_P / pow(2, 32));
 		if (qopt_ext->flags & TC_RED_ECN)
 			fprintf(f, "ecn ");
+		if (qopt_ext->flags & TC_RED_HARDDROP)
+			fprintf(f, "harddrop ");
 		if (show_stats) {
 			fprintf(f, "\n prob_mark %u prob_mark_head %u prob_drop %u",
 				qopt_ext->stats.prob_mark,
@@ -269,9 +300,278 @@ static int sfq_print_xstats(struct qdisc_util *qu, FILE *f,
 	return 0;
 }
 
+/* Flows are buckets of the hash, or of the filters, that get a slot
+ * while they have packets; active slots take turns in a ring, each
+ * sending up to quantum bytes.  RED and perturbation are not modelled.
+ */
+struct sfq_sim_slot
+{
+	struct sim_queue	q;
+	int			allot;
+	int			next;		/* in the ring */
+	unsigned int		bucket;
+};
+
+struct sfq_sim
+{
+	unsigned int		quantum;
+	unsigned int		limit;
+	unsigned int		divisor;
+	unsigned int		maxflows;
+	unsigned int		maxdepth;
+	int			headdrop;
+	int			*ht;		/* bucket to slot, or -1 */
+	struct sfq_sim_slot	*slots;
+	int			*free;
+	int			nfree;
+	int			tail;		/* of the ring, or -1 */
+};
+
+static int sfq_sim_init(struct sim_qdisc *q, struct rtattr *opt)
+{
+	struct sfq_sim *sq = q->priv;
+	struct tc_sfq_qopt_v1 *v1 = NULL;
+	struct tc_sfq_qopt *qopt;
+
+	if (sq == NULL) {
+		sq = q->priv = calloc(1, sizeof(*sq));
+		if (sq == NULL)
+			return -1;
+		sq->quantum = sim_mtu;
+		sq->limit = SFQ_DEFAULT_LIMIT;
+		sq->divisor = 1024;
+		sq->maxflows = 128;
+		sq->maxdepth = SFQ_MAX_DEPTH;
+	}
+	if (opt == NULL)
+		return 0;
+	if (RTA_PAYLOAD(opt) < sizeof(*qopt))
+		return -1;
+	qopt = RTA_DATA(opt);
+	if (RTA_PAYLOAD(opt) >= sizeof(*v1))
+		v1 = RTA_DATA(opt);
+
+	/* As sfq_change() takes them */
+	if (qopt->quantum)
+		sq->quantum = qopt->quantum;
+	if (qopt->flows)
+		sq->maxflows = MIN(SFQ_MAX_FLOWS, qopt->flows);
+	if (qopt->divisor)
+		sq->divisor = qopt->divisor;
+	if (v1 && v1->depth)
+		sq->maxdepth = MIN(SFQ_MAX_DEPTH, v1->depth);
+	if (v1)
+		sq->headdrop = v1->headdrop;
+	if (qopt->limit) {
+		sq->limit = MIN(qopt->limit, sq->maxdepth * sq->maxflows);
+		sq->maxflows = MIN(sq->maxflows, sq->limit);
+	}
+	return 0;
+}
+
+static int sfq_sim_start(struct sim_qdisc *q, double now)
+{
+	struct sfq_sim *sq = q->priv;
+	unsigned int i;
+
+	sq->ht = malloc(sq->divisor * sizeof(sq->ht[0]));
+	sq->slots = calloc(sq->maxflows, sizeof(sq->slots[0]));
+	sq->free = malloc(sq->maxflows * sizeof(sq->free[0]));
+	if (!sq->ht || !sq->slots || !sq->free)
+		return -1;
+	for (i = 0; i < sq->divisor; i++)
+		sq->ht[i] = -1;
+	for (i = 0; i < sq->maxflows; i++) {
+		sim_queue_init(&sq->slots[i].q);
+		sq->free[i] = sq->maxflows - 1 - i;
+	}
+	sq->nfree = sq->maxflows;
+	sq->tail = -1;
+	return 0;
+}
+
+/* The bucket, from 1, or 0 to drop */
+static unsigned int sfq_sim_bucket(struct sim_qdisc *q, struct sfq_sim *sq,
+				   const struct sim_pkt *p)
+{
+	struct sim_flow fl;
+	__u32 classid, h;
+
+	if (TC_H_MAJ(p->priority) == q->handle &&
+	    TC_H_MIN(p->priority) > 0 && TC_H_MIN(p->priority) <= sq->divisor)
+		return TC_H_MIN(p->priority);
+
+	if (q->filters == NULL) {
+		if (sim_flow_keys(p, &fl) < 0) {
+			h = p->protocol;
+		} else {
+			__u32 k[10];
+			int n = 0;
+
+			memcpy(k, fl.src, fl.alen * 4);
+			memcpy(k + fl.alen, fl.dst, fl.alen * 4);
+			n = 2 * fl.alen;
+			k[n++] = fl.proto;
+			k[n++] = (fl.sport << 16) | fl.dport;
+			h = tc_jhash2(k, n, 0);
+		}
+		return (((__u64)h * sq->divisor) >> 32) + 1;
+	}
+	if (sim_filter(q->filters, p, &classid) == 0 &&
+	    TC_H_MIN(classid) <= sq->divisor)
+		return TC_H_MIN(classid);
+	return 0;
+}
+
+/* Takes the packet last in sl off it */
+static struct sim_pkt *sfq_sim_tail(struct sfq_sim_slot *sl)
+{
+	struct sim_pkt **pp = &sl->q.head, *p;
+
+	while ((*pp)->next)
+		pp = &(*pp)->next;
+	p = *pp;
+	*pp = NULL;
+	sl->q.tail = pp;
+	sl->q.qlen--;
+	sl->q.bytes -= p->len;
+	return p;
+}
+
+static void sfq_sim_unring(struct sfq_sim *sq, int x)
+{
+	struct sfq_sim_slot *sl = &sq->slots[x];
+	int prev;
+
+	if (sl->next == x) {
+		sq->tail = -1;
+	} else {
+		for (prev = sq->tail; sq->slots[prev].next != x;
+		     prev = sq->slots[prev].next)
+			;
+		sq->slots[prev].next = sl->next;
+		if (sq->tail == x)
+			sq->tail = prev;
+	}
+	sq->ht[sl->bucket] = -1;
+	sq->free[sq->nfree++] = x;
+}
+
+/* From the tail of the longest flow, as sfq_drop() */
+static struct sim_pkt *sfq_sim_drop(struct sfq_sim *sq)
+{
+	int x, best = -1;
+	struct sim_pkt *p;
+
+	if (sq->tail < 0)
+		return NULL;
+	x = sq->tail;
+	do {
+		x = sq->slots[x].next;
+		if (best < 0 || sq->slots[x].q.qlen > sq->slots[best].q.qlen)
+			best = x;
+	} while (x != sq->tail);
+
+	p = sfq_sim_tail(&sq->slots[best]);
+	if (sq->slots[best].q.qlen == 0)
+		sfq_sim_unring(sq, best);
+	return p;
+}
+
+static int sfq_sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p, double now)
+{
+	struct sfq_sim *sq = q->priv;
+	unsigned int bucket = sfq_sim_bucket(q, sq, p);
+	struct sfq_sim_slot *sl;
+	struct sim_pkt *d;
+	int x;
+
+	if (bucket == 0) {
+		sim_drop(q, p);
+		return -1;
+	}
+	x = sq->ht[bucket - 1];
+	if (x < 0) {
+		if (sq->nfree == 0) {
+			sim_drop(q, p);
+			return -1;
+		}
+		x = sq->free[--sq->nfree];
+		sq->ht[bucket - 1] = x;
+		sq->slots[x].bucket = bucket - 1;
+	}
+	sl = &sq->slots[x];
+	if (sl->q.qlen >= sq->maxdepth) {
+		if (!sq->headdrop) {
+			sim_drop(q, p);
+			return -1;
+		}
+		sim_drop(q, sim_queue_head(&sl->q));
+		sim_queue_tail(&sl->q, p);
+		return 0;
+	}
+
+	if (sl->q.qlen == 0) {
+		if (sq->tail < 0) {
+			sl->next = x;
+		} else {
+			sl->next = sq->slots[sq->tail].next;
+			sq->slots[sq->tail].next = x;
+		}
+		sq->tail = x;
+		sl->allot = sq->quantum;
+	}
+	sim_queue_tail(&sl->q, p);
+	if (q->qlen + 1 <= sq->limit)
+		return 0;
+
+	d = sfq_sim_drop(sq);
+	if (d == p) {
+		p->next = p;
+		sim_drop(q, p);
+		return -1;
+	}
+	sim_drop(q, d);
+	return 0;
+}
+
+static struct sim_pkt *sfq_sim_dequeue(struct sim_qdisc *q, double now,
+				       double *next)
+{
+	struct sfq_sim *sq = q->priv;
+	struct sfq_sim_slot *sl;
+	struct sim_pkt *p;
+	int x;
+
+	if (sq->tail < 0)
+		return NULL;
+	for (;;) {
+		x = sq->slots[sq->tail].next;
+		sl = &sq->slots[x];
+		if (sl->allot > 0)
+			break;
+		sq->tail = x;
+		sl->allot += sq->quantum;
+	}
+	p = sim_queue_head(&sl->q);
+	if (sl->q.qlen == 0)
+		sfq_sim_unring(sq, x);
+	else
+		sl->allot -= p->len;
+	return p;
+}
+
+static const struct sim_qdisc_ops sfq_sim = {
+	.init		= sfq_sim_init,
+	.start		= sfq_sim_start,
+	.enqueue	= sfq_sim_enqueue,
+	.dequeue	= sfq_sim_dequeue,
+};
+
 struct qdisc_util sfq_qdisc_util = {
 	.id		= "sfq",
 	.parse_qopt	= sfq_parse_opt,
 	.print_qopt	= sfq_print_opt,
 	.print_xstats	= sfq_print_xstats,
+	.sim		= &sfq_sim,
 };
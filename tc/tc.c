@@ -29,15 +29,24 @@
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
+#include "probes.h"
 
 int show_stats = 0;
 int show_details = 0;
 int show_raw = 0;
 int show_pretty = 0;
+int show_counters = 0;
+int show_json = 0;
+int show_tlv = 0;
+int dump_capture = 0;
 
 int resolve_hosts = 0;
 int use_iec = 0;
 int force = 0;
+unsigned int batch_window = 0;
+unsigned int batch_coalesce = 0;
+int batch_noack = 0;
+unsigned int batch_jobs = 0;
 struct rtnl_handle rth;
 
 static void *BODY = NULL;	/* cached handle dlopen(NULL) */
@@ -120,6 +129,11 @@ struct qdisc_util *get_qdisc_kind(const char *str)
 		if (strcmp(q->id, str) == 0)
 			return q;
 
+	snprintf(buf, sizeof(buf), "%s_qdisc_util", str);
+	q = get_builtin_sym(buf);
+	if (q)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), "%s/q_%s.so", get_tc_lib(), str);
 	dlh = dlopen(buf, RTLD_LAZY);
 	if (!dlh) {
@@ -174,6 +188,11 @@ struct filter_util *get_filter_kind(const char *str)
 		if (strcmp(q->id, str) == 0)
 			return q;
 
+	snprintf(buf, sizeof(buf), "%s_filter_util", str);
+	q = get_builtin_sym(buf);
+	if (q)
+		goto reg;
+
 	snprintf(buf, sizeof(buf), "%s/f_%s.so", get_tc_lib(), str);
 	dlh = dlopen(buf, RTLD_LAZY);
 	if (dlh == NULL) {
@@ -206,16 +225,52 @@ noexist:
 	return q;
 }
 
+/* Asks for the one qdisc, class or filter that t names, without a dump
+ * of the device, and prints it as the dump would.  Returns 1 if it
+ * cannot be asked that way, from a model or a kernel that only dumps,
+ * and the caller should dump instead.  Qdiscs and classes are only
+ * echoed to the asker with NLM_F_ECHO.
+ */
+int tc_get_object(int type, const struct tcmsg *t, rtnl_filter_t print)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+	} req;
+	char answer[16384];
+	struct nlmsghdr *n = (struct nlmsghdr *)answer;
+
+	if (rth.replay || rth.record)
+		return 1;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ECHO;
+	req.n.nlmsg_type = type;
+	req.t = *t;
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, n) < 0)
+		return errno == EOPNOTSUPP ? 1 : -1;
+	if ((dump_capture ? rtnl_to_file : print)(NULL, n, stdout) < 0)
+		return -1;
+	fflush(stdout);
+	return 0;
+}
+
 static void usage(void)
 {
 	fprintf(stderr, "Usage: tc [ OPTIONS ] OBJECT { COMMAND | help }\n"
 #ifdef ANDROID
 			"       tc [-force]\n"
 #else
-			"       tc [-force] -batch filename\n"
+			"       tc [-force] [-window SIZE] [-coalesce BYTES] [-noack]\n"
+			"          [-batch-jobs N] [-batch-latency N] -batch filename\n"
+			"       tc [ OPTIONS ] -server SOCKET\n"
 #endif
-	                "where  OBJECT := { qdisc | class | filter | action | monitor }\n"
-	                "       OPTIONS := { -s[tatistics] | -d[etails] | -r[aw] | -p[retty] | -b[atch] [filename] }\n");
+	                "where  OBJECT := { qdisc | class | filter | action | monitor | sim }\n"
+	                "       OPTIONS := { -s[tatistics] | -d[etails] | -r[aw] | -p[retty] | -b[atch] [filename] |\n"
+	                "                    -cou[nters] | -j[son] | -tlv | -cap[ture] |\n"
+	                "                    -replay filename | -timing | -o[ptimize] }\n");
 }
 
 static int do_cmd(int argc, char **argv)
@@ -235,6 +290,9 @@ static int do_cmd(int argc, char **argv)
 	if (matches(*argv, "monitor") == 0)
 		return do_tcmonitor(argc-1, argv+1);
 
+	if (matches(*argv, "sim") == 0)
+		return do_sim(argc-1, argv+1);
+
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -246,10 +304,150 @@ static int do_cmd(int argc, char **argv)
 }
 
 #ifndef ANDROID
+static int batch_errors;
+
+static void batch_error(int lineno, int error, void *arg)
+{
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	fprintf(stderr, "Command failed %s:%d\n", (const char *)arg, lineno);
+	batch_errors++;
+}
+
+/* Commands may exit() on their own; still send what is queued */
+static void batch_exit(void)
+{
+	if (rth.pipe)
+		rtnl_pipeline_close(&rth);
+}
+
+static const char *batch_name;
+
+static int batch_begin(void)
+{
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+
+	if ((batch_coalesce || batch_noack) && !batch_window)
+		batch_window = 64;
+	if (batch_window) {
+		if (rtnl_pipeline_open(&rth, batch_window, batch_error,
+				       (void *)batch_name) < 0 ||
+		    (batch_coalesce &&
+		     rtnl_pipeline_coalesce(&rth, batch_coalesce) < 0) ||
+		    (batch_noack && rtnl_pipeline_noack(&rth) < 0)) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			return -1;
+		}
+		atexit(batch_exit);
+	}
+	return 0;
+}
+
+static int batch_sync(void)
+{
+	if (rth.pipe && rtnl_pipeline_sync(&rth) < 0)
+		return -1;
+	return 0;
+}
+
+static int batch_end(void)
+{
+	int ret = 0;
+
+	if (rth.pipe && rtnl_pipeline_close(&rth) < 0)
+		ret = -1;
+	if (batch_errors)
+		ret = -1;
+	rtnl_close(&rth);
+	batch_latency_report();
+	return ret;
+}
+
+/* Run one line of the batch; nonzero if it failed */
+static int batch_run(int argc, char **argv)
+{
+	int errors = batch_errors;
+	int failed;
+
+	rtnl_pipeline_cookie(&rth, cmdlineno);
+	PROBE1(batch_cmd_entry, cmdlineno);
+	batch_latency_begin();
+	failed = do_cmd(argc, argv) != 0;
+	batch_latency_end();
+	PROBE2(batch_cmd_exit, cmdlineno, failed);
+	if (failed) {
+		fprintf(stderr, "Command failed %s:%d\n", batch_name, cmdlineno);
+		return 1;
+	}
+	return batch_errors != errors;
+}
+
+static const struct batch_job_ops batch_job_ops = {
+	.start	= batch_begin,
+	.run	= batch_run,
+	.sync	= batch_sync,
+	.finish	= batch_end,
+};
+
+static int parse_options(int argc, char ***argvp);
+
+/* tc -server: each line runs in a fork with a socket of its own */
+static int server_begin(void)
+{
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* A line may start with options, like a command line */
+static int server_run(int argc, char **argv)
+{
+	char *args[argc + 2];
+	char **av = args;
+
+	args[0] = "tc";
+	memcpy(args + 1, argv, (argc + 1) * sizeof(char *));
+	argc = parse_options(argc + 1, &av);
+	if (argc <= 1) {
+		usage();
+		return 0;
+	}
+	return do_cmd(argc - 1, av + 1);
+}
+
+static const struct batch_job_ops server_ops = {
+	.start	= server_begin,
+	.run	= server_run,
+};
+
+/* With -batch-jobs, qdiscs, classes and filters are ordered by their
+ * device; everything else runs only after all the lines before it.
+ */
+static const char *batch_key(int argc, char **argv)
+{
+	int i;
+
+	if (matches(argv[0], "qdisc") && matches(argv[0], "class") &&
+	    matches(argv[0], "filter"))
+		return NULL;
+
+	for (i = 1; i + 1 < argc; i++)
+		if (strcmp(argv[i], "dev") == 0)
+			return argv[i + 1];
+	return NULL;
+}
+
 static int batch(const char *name)
 {
-	char *line = NULL;
-	size_t len = 0;
+	struct batch_jobs bj = { .njobs = 0 };
+	struct cmdfile cf;
+	char **largv;
+	int largc;
+	int dirty = 0;
 	int ret = 0;
 
 	if (name && strcmp(name, "-") != 0) {
@@ -259,46 +457,78 @@ static int batch(const char *name)
 			return -1;
 		}
 	}
+	batch_name = name;
 
 	tc_core_init();
 
-	if (rtnl_open(&rth, 0) < 0) {
-		fprintf(stderr, "Cannot open rtnetlink\n");
+	if (batch_jobs > 1 &&
+	    batch_jobs_start(&bj, batch_jobs, &batch_job_ops, !force) < 0) {
+		fprintf(stderr, "Cannot start batch jobs: %s\n",
+			strerror(errno));
 		return -1;
 	}
 
-	cmdlineno = 0;
-	while (getcmdline(&line, &len, stdin) != -1) {
-		char *largv[100];
-		int largc;
+	if (batch_begin() < 0)
+		return -1;
 
-		largc = makeargs(line, largv, 100);
+	cmdfile_open(&cf, stdin);
+	cmdlineno = 0;
+	while ((largc = cmdfile_getargs(&cf, &largv)) != -1) {
 		if (largc == 0)
 			continue;	/* blank line */
 
-		if (do_cmd(largc, largv)) {
-			fprintf(stderr, "Command failed %s:%d\n", name, cmdlineno);
+		if (bj.njobs) {
+			const char *key = batch_key(largc, largv);
+
+			if (key) {
+				/* What we ran ourselves must be done first */
+				if (dirty && batch_sync() < 0 && !force) {
+					ret = 1;
+					break;
+				}
+				dirty = 0;
+				if (batch_jobs_send(&bj, key, largc, largv) < 0) {
+					ret = 1;
+					break;
+				}
+				continue;
+			}
+			if (batch_jobs_sync(&bj) < 0) {
+				ret = 1;
+				break;
+			}
+			dirty = 1;
+		}
+
+		if (batch_run(largc, largv)) {
 			ret = 1;
 			if (!force)
 				break;
 		}
 	}
-	if (line)
-		free(line);
-
-	rtnl_close(&rth);
+	if (cf.error)
+		ret = 1;
+	cmdfile_close(&cf);
+
+	if (bj.njobs && batch_jobs_finish(&bj))
+		ret = 1;
+	if (batch_end() < 0)
+		ret = 1;
 	return ret;
 }
 #endif
 
-int main(int argc, char **argv)
-{
-	int ret;
 #ifndef ANDROID
-	int do_batching = 0;
-	char *batchfile = NULL;
+static int do_batching;
+static char *batchfile;
+static char *server_path;
 #endif
 
+/* Take the options off the front of argv; argv[0] is not one */
+static int parse_options(int argc, char ***argvp)
+{
+	char **argv = *argvp;
+
 	while (argc > 1) {
 		if (argv[1][0] != '-')
 			break;
@@ -313,30 +543,108 @@ int main(int argc, char **argv)
 			++show_pretty;
 		} else if (matches(argv[1], "-Version") == 0) {
 			printf("tc utility, iproute2-ss%s\n", SNAPSHOT);
-			return 0;
+			exit(0);
 		} else if (matches(argv[1], "-iec") == 0) {
 			++use_iec;
 		} else if (matches(argv[1], "-help") == 0) {
 			usage();
-			return 0;
+			exit(0);
 		} else if (matches(argv[1], "-force") == 0) {
 			++force;
 #ifndef ANDROID
+		} else if (strcmp(argv[1], "-batch-jobs") == 0) {
+			if (argc <= 2 || get_unsigned(&batch_jobs, argv[2], 0) ||
+			    batch_jobs == 0 || batch_jobs > BATCH_JOBS_MAX) {
+				fprintf(stderr, "Invalid number of batch jobs\n");
+				exit(-1);
+			}
+			argc--;	argv++;
+		} else if (strcmp(argv[1], "-batch-latency") == 0) {
+			if (argc <= 2 || get_unsigned(&batch_latency, argv[2], 0) ||
+			    batch_latency == 0) {
+				fprintf(stderr, "Invalid number of lines\n");
+				exit(-1);
+			}
+			argc--;	argv++;
+		} else if (strcmp(argv[1], "-server") == 0) {
+			if (argc <= 2) {
+				fprintf(stderr, "Missing socket path\n");
+				exit(-1);
+			}
+			server_path = argv[2];
+			argc--;	argv++;
 		} else 	if (matches(argv[1], "-batch") == 0) {
 			do_batching = 1;
 			if (argc > 2)
 				batchfile = argv[2];
 			argc--;	argv++;
+		} else if (matches(argv[1], "-window") == 0) {
+			if (argc <= 2 || get_unsigned(&batch_window, argv[2], 0)) {
+				fprintf(stderr, "Invalid window size\n");
+				exit(-1);
+			}
+			argc--;	argv++;
+		} else if (matches(argv[1], "-coalesce") == 0) {
+			if (argc <= 2 || get_unsigned(&batch_coalesce, argv[2], 0)) {
+				fprintf(stderr, "Invalid coalesce size\n");
+				exit(-1);
+			}
+			argc--;	argv++;
+		} else if (strcmp(argv[1], "-noack") == 0) {
+			batch_noack = 1;
 #endif
+		} else if (matches(argv[1], "-counters") == 0) {
+			++show_counters;
+		} else if (matches(argv[1], "-json") == 0) {
+			++show_json;
+		} else if (matches(argv[1], "-tlv") == 0) {
+			++show_tlv;
+		} else if (matches(argv[1], "-capture") == 0) {
+			++dump_capture;
+		} else if (strcmp(argv[1], "-replay") == 0) {
+			if (argc <= 2) {
+				fprintf(stderr, "No replay file\n");
+				exit(-1);
+			}
+			rtnl_replay_file = argv[2];
+			argc--;	argv++;
+		} else if (strcmp(argv[1], "-timing") == 0) {
+			rtnl_stats_start();
+		} else if (matches(argv[1], "-optimize") == 0) {
+			++ematch_optimize;
 		} else {
 			fprintf(stderr, "Option \"%s\" is unknown, try \"tc -help\".\n", argv[1]);
-			return -1;
+			exit(-1);
 		}
 		argc--;	argv++;
 	}
+	*argvp = argv;
+	return argc;
+}
+
+int main(int argc, char **argv)
+{
+	int ret;
+
+	argc = parse_options(argc, &argv);
+
+	/* Large listings leave in a few big writes; a terminal
+	 * still gets its output as it is printed.
+	 */
+	if (dump_capture && isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending binary stream to stdout\n");
+		return -1;
+	}
+	if (!isatty(STDOUT_FILENO))
+		setvbuf(stdout, NULL, _IOFBF, TC_OUTBUF_SIZE);
+
 #ifndef ANDROID
 	if (do_batching)
 		return batch(batchfile);
+	if (server_path) {
+		tc_core_init();
+		return cmd_server(server_path, &server_ops) < 0 ? -1 : 0;
+	}
 #endif
 
 	if (argc <= 1) {
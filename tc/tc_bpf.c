@@ -0,0 +1,797 @@
+/*
+ * tc_bpf.c	BPF programs of the bpf filter and action.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * Classic BPF is given as "tcpdump -ddd" prints it: the instruction
+ * count, then "code jt jf k" for each instruction, separated by commas
+ * or lines.  eBPF comes from an ELF object laid out as bpf_elf.h has
+ * it, read here without libelf, or from a program pinned in the BPF
+ * file system.
+ *
+ * An object section is loaded once per process, so a batch attaching it
+ * to many devices shares one program, and its maps with pinning are
+ * shared with other processes through the BPF file system.  Sections
+ * named "ID/KEY" are tail calls: each is loaded as well and put at KEY
+ * of the program array map whose id is ID.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <elf.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "tc_bpf.h"
+#include "bpf_elf.h"
+
+#ifndef EM_BPF
+#define EM_BPF		247
+#endif
+
+#ifndef BPF_FS_MAGIC
+#define BPF_FS_MAGIC	0xcafe4a11
+#endif
+
+#define BPF_LOG_SIZE	(256 * 1024)
+
+static int bpf(int cmd, union bpf_attr *attr)
+{
+#ifdef __NR_bpf
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static __u64 bpf_ptr(const void *p)
+{
+	return (unsigned long)p;
+}
+
+int bpf_parse_ops(const char *arg, int from_file, struct sock_filter *bpf_ops)
+{
+	char *buf, *tok, *save = NULL;
+	unsigned int cnt = 0, i = 0;
+	size_t len = 0;
+
+	if (from_file) {
+		FILE *fp = fopen(arg, "r");
+		size_t size = 4096;
+
+		if (fp == NULL) {
+			fprintf(stderr, "Cannot open \"%s\": %s\n", arg,
+				strerror(errno));
+			return -1;
+		}
+		buf = malloc(size);
+		while (buf) {
+			len += fread(buf + len, 1, size - len - 1, fp);
+			if (len < size - 1)
+				break;
+			size *= 2;
+			buf = realloc(buf, size);
+		}
+		fclose(fp);
+		if (buf == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		buf[len] = '\0';
+	} else {
+		buf = strdup(arg);
+		if (buf == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+	}
+
+	for (tok = strtok_r(buf, ",\n", &save); tok;
+	     tok = strtok_r(NULL, ",\n", &save)) {
+		struct sock_filter *f;
+		char c;
+
+		if (strspn(tok, " \t\r") == strlen(tok))
+			continue;
+		if (cnt == 0) {
+			if (sscanf(tok, "%u %c", &cnt, &c) != 1 || cnt == 0 ||
+			    cnt > BPF_MAXINSNS) {
+				fprintf(stderr, "bpf: bad instruction count \"%s\"\n",
+					tok);
+				goto err;
+			}
+			continue;
+		}
+		if (i == cnt) {
+			fprintf(stderr, "bpf: more than %u instructions\n", cnt);
+			goto err;
+		}
+		f = &bpf_ops[i++];
+		if (sscanf(tok, "%hu %hhu %hhu %u %c", &f->code, &f->jt,
+			   &f->jf, &f->k, &c) != 4) {
+			fprintf(stderr, "bpf: bad instruction \"%s\"\n", tok);
+			goto err;
+		}
+	}
+	if (cnt == 0 || i != cnt) {
+		fprintf(stderr, "bpf: %u instructions of %u\n", i, cnt);
+		goto err;
+	}
+	free(buf);
+	return cnt;
+err:
+	free(buf);
+	return -1;
+}
+
+void bpf_print_ops(FILE *fp, struct rtattr *bpf_ops, __u16 len)
+{
+	struct sock_filter *ops = RTA_DATA(bpf_ops);
+	int i;
+
+	if (len == 0 || RTA_PAYLOAD(bpf_ops) < len * sizeof(*ops))
+		return;
+
+	fprintf(fp, "bytecode \'%u,", len);
+	for (i = 0; i < len; i++)
+		fprintf(fp, "%hu %hhu %hhu %u%s", ops[i].code, ops[i].jt,
+			ops[i].jf, ops[i].k, i == len - 1 ? "\'" : ",");
+}
+
+/* The tag as bpftool and the kernel's fdinfo print it */
+void bpf_print_tag(FILE *fp, struct rtattr *tag)
+{
+	const __u8 *p = RTA_DATA(tag);
+	int i;
+
+	fprintf(fp, "tag ");
+	for (i = 0; i < RTA_PAYLOAD(tag); i++)
+		fprintf(fp, "%02x", p[i]);
+	fprintf(fp, " ");
+}
+
+int bpf_obj_get(const char *path)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = bpf_ptr(path);
+	return bpf(BPF_OBJ_GET, &attr);
+}
+
+static int bpf_obj_pin(int fd, const char *path)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = bpf_ptr(path);
+	attr.bpf_fd = fd;
+	return bpf(BPF_OBJ_PIN, &attr);
+}
+
+struct bpf_elf
+{
+	const char		*path;
+	unsigned char		*data;		/* the file, privately mapped */
+	size_t			size;
+	Elf64_Ehdr		*eh;
+	Elf64_Shdr		*sh;
+	const char		*section;	/* the program */
+	enum bpf_prog_type	type;
+	int			verbose;
+	int			sym_idx;	/* sections, or 0 */
+	int			maps_idx;
+	struct bpf_elf_map	*maps;
+	int			nmaps;
+	int			*map_fd;
+	const char		*license;
+	char			ns[17];		/* of PIN_OBJECT_NS maps */
+};
+
+static void *elf_data(struct bpf_elf *e, int i)
+{
+	return e->data + e->sh[i].sh_offset;
+}
+
+static const char *elf_sec_name(struct bpf_elf *e, int i)
+{
+	Elf64_Shdr *s = &e->sh[e->eh->e_shstrndx];
+
+	if (e->sh[i].sh_name >= s->sh_size)
+		return "";
+	return (const char *)e->data + s->sh_offset + e->sh[i].sh_name;
+}
+
+static int elf_find(struct bpf_elf *e, const char *name)
+{
+	int i;
+
+	for (i = 1; i < e->eh->e_shnum; i++)
+		if (strcmp(elf_sec_name(e, i), name) == 0)
+			return i;
+	return 0;
+}
+
+/* The name of the symbol at value in section shndx */
+static const char *elf_sym_name(struct bpf_elf *e, int shndx, Elf64_Addr value)
+{
+	Elf64_Shdr *s, *str;
+	Elf64_Sym *sym;
+	size_t i;
+
+	if (!e->sym_idx)
+		return NULL;
+	s = &e->sh[e->sym_idx];
+	str = &e->sh[s->sh_link];
+	sym = elf_data(e, e->sym_idx);
+	for (i = 0; i < s->sh_size / sizeof(*sym); i++)
+		if (sym[i].st_shndx == shndx && sym[i].st_value == value &&
+		    sym[i].st_name && sym[i].st_name < str->sh_size &&
+		    ELF64_ST_TYPE(sym[i].st_info) != STT_SECTION)
+			return (const char *)e->data + str->sh_offset +
+				sym[i].st_name;
+	return NULL;
+}
+
+/* Sections and names all within the file, ending where they should */
+static int elf_check(struct bpf_elf *e)
+{
+	Elf64_Ehdr *eh = (Elf64_Ehdr *)e->data;
+	int i;
+
+	if (e->size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS64) {
+		fprintf(stderr, "%s: not a 64-bit ELF object\n", e->path);
+		return -1;
+	}
+	if (eh->e_ident[EI_DATA] != (__BYTE_ORDER == __LITTLE_ENDIAN ?
+				     ELFDATA2LSB : ELFDATA2MSB) ||
+	    (eh->e_machine != EM_BPF && eh->e_machine != EM_NONE)) {
+		fprintf(stderr, "%s: not a BPF object for this host\n", e->path);
+		return -1;
+	}
+	if (eh->e_shentsize != sizeof(Elf64_Shdr) || eh->e_shnum == 0 ||
+	    eh->e_shoff > e->size ||
+	    eh->e_shnum > (e->size - eh->e_shoff) / sizeof(Elf64_Shdr) ||
+	    eh->e_shstrndx == 0 || eh->e_shstrndx >= eh->e_shnum)
+		goto bad;
+	e->eh = eh;
+	e->sh = (Elf64_Shdr *)(e->data + eh->e_shoff);
+	if (e->sh[eh->e_shstrndx].sh_type != SHT_STRTAB)
+		goto bad;
+
+	for (i = 1; i < eh->e_shnum; i++) {
+		Elf64_Shdr *s = &e->sh[i];
+
+		if (s->sh_type != SHT_NOBITS &&
+		    (s->sh_offset > e->size || s->sh_size > e->size - s->sh_offset))
+			goto bad;
+		if (s->sh_type == SHT_SYMTAB) {
+			if (s->sh_link == 0 || s->sh_link >= eh->e_shnum ||
+			    e->sh[s->sh_link].sh_type != SHT_STRTAB)
+				goto bad;
+			e->sym_idx = i;
+		}
+	}
+	for (i = 1; i < eh->e_shnum; i++) {
+		Elf64_Shdr *s = &e->sh[i];
+
+		if (s->sh_type == SHT_STRTAB && s->sh_size &&
+		    e->data[s->sh_offset + s->sh_size - 1] != '\0')
+			goto bad;
+	}
+	return 0;
+bad:
+	fprintf(stderr, "%s: malformed ELF object\n", e->path);
+	return -1;
+}
+
+/* The BPF file system, mounted if need be, with tc's directories */
+static int bpf_fs_dir(char *buf, size_t len, const char *ns)
+{
+	struct statfs st;
+
+	if (statfs(BPF_FS_DIR, &st) < 0 || st.f_type != BPF_FS_MAGIC) {
+		if (mount("bpf", BPF_FS_DIR, "bpf", 0, "mode=0700") < 0) {
+			fprintf(stderr, "Cannot mount the BPF file system on %s: %s\n",
+				BPF_FS_DIR, strerror(errno));
+			return -1;
+		}
+	}
+	snprintf(buf, len, "%s/%s", BPF_FS_DIR, BPF_FS_TC);
+	if (mkdir(buf, 0700) < 0 && errno != EEXIST)
+		goto err;
+	snprintf(buf, len, "%s/%s/%s", BPF_FS_DIR, BPF_FS_TC, ns);
+	if (mkdir(buf, 0700) < 0 && errno != EEXIST)
+		goto err;
+	return 0;
+err:
+	fprintf(stderr, "Cannot create %s: %s\n", buf, strerror(errno));
+	return -1;
+}
+
+/* Whether a pinned map is what the object asks for.  Kernels that do
+ * not say are trusted.
+ */
+static int map_matches(int fd, const struct bpf_elf_map *m)
+{
+	char path[64], line[128];
+	unsigned int val;
+	int bad = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "map_type: %u", &val) == 1)
+			bad |= val != m->type;
+		else if (sscanf(line, "key_size: %u", &val) == 1)
+			bad |= val != m->size_key;
+		else if (sscanf(line, "value_size: %u", &val) == 1)
+			bad |= val != m->size_value;
+		else if (sscanf(line, "max_entries: %u", &val) == 1)
+			bad |= val != m->max_elem;
+	}
+	fclose(fp);
+	return !bad;
+}
+
+static int map_create(const struct bpf_elf_map *m)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = m->type;
+	attr.key_size = m->size_key;
+	attr.value_size = m->size_value;
+	attr.max_entries = m->max_elem;
+	attr.map_flags = m->flags;
+	return bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_open(struct bpf_elf *e, int i)
+{
+	const struct bpf_elf_map *m = &e->maps[i];
+	const char *name = elf_sym_name(e, e->maps_idx, i * sizeof(*m));
+	char path[PATH_MAX];
+	int fd, tries;
+
+	if (m->pinning == PIN_NONE) {
+		fd = map_create(m);
+		if (fd < 0)
+			goto err;
+		return fd;
+	}
+	if (m->pinning != PIN_OBJECT_NS && m->pinning != PIN_GLOBAL_NS) {
+		fprintf(stderr, "%s: map %s has unknown pinning %u\n",
+			e->path, name ? name : "?", m->pinning);
+		return -1;
+	}
+	if (name == NULL) {
+		fprintf(stderr, "%s: pinned map %d has no name\n", e->path, i);
+		return -1;
+	}
+	if (bpf_fs_dir(path, sizeof(path), m->pinning == PIN_GLOBAL_NS ?
+		       BPF_FS_GLOBALS : e->ns) < 0)
+		return -1;
+	snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%s", name);
+
+	/* Another tc may pin the map between our get and pin */
+	for (tries = 0; tries < 2; tries++) {
+		fd = bpf_obj_get(path);
+		if (fd >= 0) {
+			if (!map_matches(fd, m)) {
+				fprintf(stderr, "%s: pinned map %s differs from the one of %s\n",
+					path, name, e->path);
+				close(fd);
+				return -1;
+			}
+			return fd;
+		}
+		if (errno != ENOENT) {
+			fprintf(stderr, "Cannot open %s: %s\n", path,
+				strerror(errno));
+			return -1;
+		}
+		fd = map_create(m);
+		if (fd < 0)
+			goto err;
+		if (bpf_obj_pin(fd, path) == 0)
+			return fd;
+		close(fd);
+		if (errno != EEXIST) {
+			fprintf(stderr, "Cannot pin map %s at %s: %s\n", name,
+				path, strerror(errno));
+			return -1;
+		}
+	}
+	fprintf(stderr, "Cannot pin map %s at %s\n", name, path);
+	return -1;
+err:
+	fprintf(stderr, "Cannot create map %s of %s: %s\n", name ? name : "?",
+		e->path, strerror(errno));
+	return -1;
+}
+
+static int elf_maps(struct bpf_elf *e)
+{
+	Elf64_Shdr *s;
+	int i;
+
+	e->maps_idx = elf_find(e, ELF_SECTION_MAPS);
+	if (!e->maps_idx)
+		return 0;
+	s = &e->sh[e->maps_idx];
+	if (s->sh_type != SHT_PROGBITS ||
+	    s->sh_size % sizeof(struct bpf_elf_map)) {
+		fprintf(stderr, "%s: maps section is not an array of struct bpf_elf_map\n",
+			e->path);
+		return -1;
+	}
+	e->maps = elf_data(e, e->maps_idx);
+	e->nmaps = s->sh_size / sizeof(struct bpf_elf_map);
+	e->map_fd = calloc(e->nmaps, sizeof(int));
+	if (e->map_fd == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < e->nmaps; i++)
+		e->map_fd[i] = -1;
+	for (i = 0; i < e->nmaps; i++) {
+		e->map_fd[i] = map_open(e, i);
+		if (e->map_fd[i] < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Points the map loads of section idx at the maps */
+static int elf_relocate(struct bpf_elf *e, int idx)
+{
+	struct bpf_insn *insns = elf_data(e, idx);
+	size_t cnt = e->sh[idx].sh_size / sizeof(*insns);
+	int i;
+
+	for (i = 1; i < e->eh->e_shnum; i++) {
+		Elf64_Shdr *s = &e->sh[i];
+		Elf64_Rel *rel = elf_data(e, i);
+		Elf64_Sym *sym;
+		size_t j, nsym;
+
+		if (s->sh_type != SHT_REL || s->sh_info != idx)
+			continue;
+		if (s->sh_link != e->sym_idx || !e->sym_idx) {
+			fprintf(stderr, "%s: relocations without symbols\n",
+				e->path);
+			return -1;
+		}
+		sym = elf_data(e, e->sym_idx);
+		nsym = e->sh[e->sym_idx].sh_size / sizeof(*sym);
+		for (j = 0; j < s->sh_size / sizeof(*rel); j++) {
+			size_t k = rel[j].r_offset / sizeof(*insns);
+			size_t n = ELF64_R_SYM(rel[j].r_info);
+			__u64 map;
+
+			if (k >= cnt || n >= nsym) {
+				fprintf(stderr, "%s: relocation out of range\n",
+					e->path);
+				return -1;
+			}
+			if (insns[k].code != (BPF_LD | BPF_IMM | BPF_DW)) {
+				fprintf(stderr, "%s: relocation of instruction %zu is not a load\n",
+					e->path, k);
+				return -1;
+			}
+			if (!e->maps_idx || sym[n].st_shndx != e->maps_idx ||
+			    sym[n].st_value % sizeof(struct bpf_elf_map)) {
+				fprintf(stderr, "%s: instruction %zu of %s loads no map\n",
+					e->path, k, elf_sec_name(e, idx));
+				return -1;
+			}
+			map = sym[n].st_value / sizeof(struct bpf_elf_map);
+			if (map >= (__u64)e->nmaps) {
+				fprintf(stderr, "%s: relocation out of range\n",
+					e->path);
+				return -1;
+			}
+			insns[k].src_reg = BPF_PSEUDO_MAP_FD;
+			insns[k].imm = e->map_fd[map];
+		}
+	}
+	return 0;
+}
+
+/* A buffer for the verifier to explain itself in */
+static char *prog_log(union bpf_attr *attr)
+{
+	char *log = malloc(BPF_LOG_SIZE);
+
+	if (log) {
+		log[0] = '\0';
+		attr->log_buf = bpf_ptr(log);
+		attr->log_size = BPF_LOG_SIZE;
+		attr->log_level = 1;
+	}
+	return log;
+}
+
+static int prog_load(struct bpf_elf *e, int idx)
+{
+	Elf64_Shdr *s = &e->sh[idx];
+	union bpf_attr attr;
+	char *log = NULL;
+	int fd, err;
+
+	if (s->sh_type != SHT_PROGBITS || s->sh_size == 0 ||
+	    s->sh_size % sizeof(struct bpf_insn)) {
+		fprintf(stderr, "%s: section %s holds no program\n", e->path,
+			elf_sec_name(e, idx));
+		return -1;
+	}
+	if (elf_relocate(e, idx) < 0)
+		return -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = e->type;
+	attr.insns = bpf_ptr(elf_data(e, idx));
+	attr.insn_cnt = s->sh_size / sizeof(struct bpf_insn);
+	attr.license = bpf_ptr(e->license);
+
+	/* The verifier is asked to explain a rejection, or if wanted */
+	if (e->verbose)
+		log = prog_log(&attr);
+	fd = bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0 && !log && (errno == EACCES || errno == EINVAL) &&
+	    (log = prog_log(&attr)) != NULL)
+		fd = bpf(BPF_PROG_LOAD, &attr);
+	err = errno;
+
+	if (log && log[0])
+		fprintf(stderr, "Verifier log of %s:\n%s\n",
+			elf_sec_name(e, idx), log);
+	if (fd < 0)
+		fprintf(stderr, "Cannot load %s of %s: %s\n",
+			elf_sec_name(e, idx), e->path, strerror(err));
+	free(log);
+	return fd;
+}
+
+/* Loads the "ID/KEY" sections into their program arrays */
+static int elf_tail_calls(struct bpf_elf *e)
+{
+	int i;
+
+	for (i = 1; i < e->eh->e_shnum; i++) {
+		const char *name = elf_sec_name(e, i);
+		unsigned int id, key;
+		union bpf_attr attr;
+		int m, fd, ret;
+		char c;
+
+		if (sscanf(name, "%u/%u%c", &id, &key, &c) != 2)
+			continue;
+		for (m = 0; m < e->nmaps; m++)
+			if (e->maps[m].type == BPF_MAP_TYPE_PROG_ARRAY &&
+			    e->maps[m].id == id)
+				break;
+		if (m == e->nmaps) {
+			fprintf(stderr, "%s: no program array with id %u for %s\n",
+				e->path, id, name);
+			return -1;
+		}
+		fd = prog_load(e, i);
+		if (fd < 0)
+			return -1;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = e->map_fd[m];
+		attr.key = bpf_ptr(&key);
+		attr.value = bpf_ptr(&fd);
+		attr.flags = BPF_ANY;
+		ret = bpf(BPF_MAP_UPDATE_ELEM, &attr);
+		close(fd);
+		if (ret < 0) {
+			fprintf(stderr, "Cannot add %s to its program array: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Loaded programs, for the rest of the process */
+struct bpf_loaded
+{
+	struct bpf_loaded	*next;
+	dev_t			dev;
+	ino_t			ino;
+	time_t			mtime;
+	enum bpf_prog_type	type;
+	char			*section;
+	int			fd;
+};
+
+static struct bpf_loaded *bpf_loaded;
+
+int bpf_obj_open(const char *path, const char *section,
+		 enum bpf_prog_type type, int verbose)
+{
+	struct bpf_elf e;
+	struct bpf_loaded *l;
+	struct stat st;
+	__u64 hash = 0xcbf29ce484222325ULL;
+	int fd = -1, idx, i;
+	size_t k;
+
+	memset(&e, 0, sizeof(e));
+	e.path = path;
+	e.section = section;
+	e.type = type;
+	e.verbose = verbose;
+
+	i = open(path, O_RDONLY);
+	if (i < 0 || fstat(i, &st) < 0) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n", path, strerror(errno));
+		if (i >= 0)
+			close(i);
+		return -1;
+	}
+	for (l = bpf_loaded; l; l = l->next)
+		if (l->dev == st.st_dev && l->ino == st.st_ino &&
+		    l->mtime == st.st_mtime && l->type == type &&
+		    strcmp(l->section, section) == 0) {
+			close(i);
+			return l->fd;
+		}
+
+	/* Private, as relocation writes to the instructions */
+	e.size = st.st_size;
+	e.data = e.size ? mmap(NULL, e.size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE, i, 0) : MAP_FAILED;
+	close(i);
+	if (e.data == MAP_FAILED) {
+		fprintf(stderr, "Cannot map \"%s\": %s\n", path,
+			e.size ? strerror(errno) : "empty file");
+		return -1;
+	}
+	if (elf_check(&e) < 0)
+		goto out;
+
+	idx = elf_find(&e, section);
+	if (!idx) {
+		fprintf(stderr, "%s: no section %s\n", path, section);
+		goto out;
+	}
+	i = elf_find(&e, ELF_SECTION_LICENSE);
+	e.license = i && e.sh[i].sh_type == SHT_PROGBITS && e.sh[i].sh_size &&
+		    memchr(elf_data(&e, i), '\0', e.sh[i].sh_size) ?
+		    elf_data(&e, i) : "";
+
+	/* Loads of the same object share its PIN_OBJECT_NS maps (FNV-1a) */
+	for (k = 0; k < e.size; k++)
+		hash = (hash ^ e.data[k]) * 0x100000001b3ULL;
+	snprintf(e.ns, sizeof(e.ns), "%016llx", (unsigned long long)hash);
+
+	if (elf_maps(&e) < 0 || elf_tail_calls(&e) < 0)
+		goto out;
+	fd = prog_load(&e, idx);
+	if (fd < 0)
+		goto out;
+
+	l = calloc(1, sizeof(*l));
+	if (l && (l->section = strdup(section)) != NULL) {
+		l->dev = st.st_dev;
+		l->ino = st.st_ino;
+		l->mtime = st.st_mtime;
+		l->type = type;
+		l->fd = fd;
+		l->next = bpf_loaded;
+		bpf_loaded = l;
+	} else {
+		free(l);
+	}
+out:
+	for (i = 0; e.map_fd && i < e.nmaps; i++)
+		if (e.map_fd[i] >= 0)
+			close(e.map_fd[i]);
+	free(e.map_fd);
+	munmap(e.data, e.size);
+	return fd;
+}
+
+int bpf_parse_common(int *argc_p, char ***argv_p,
+		     const struct bpf_cfg_ops *ops, enum bpf_prog_type type,
+		     const char *section, struct nlmsghdr *n)
+{
+	int argc = *argc_p;
+	char **argv = *argv_p;
+	char name[256];
+	const char *base;
+	int fd;
+
+	if (strcmp(*argv, "bytecode") == 0 || strcmp(*argv, "bc") == 0 ||
+	    strcmp(*argv, "bytecode-file") == 0 || strcmp(*argv, "bcf") == 0) {
+		struct sock_filter insns[BPF_MAXINSNS];
+		int from_file = strcmp(*argv, "bytecode-file") == 0 ||
+				strcmp(*argv, "bcf") == 0;
+		int len;
+
+		NEXT_ARG();
+		len = bpf_parse_ops(*argv, from_file, insns);
+		if (len < 0)
+			return -1;
+		addattr16(n, MAX_MSG, ops->ops_len, len);
+		addattr_l(n, MAX_MSG, ops->ops, insns, len * sizeof(insns[0]));
+		argc--; argv++;
+	} else if (strcmp(*argv, "object-file") == 0 ||
+		   strcmp(*argv, "obj") == 0) {
+		const char *file;
+		int verbose = 0;
+
+		NEXT_ARG();
+		file = *argv;
+		argc--; argv++;
+		while (argc > 0) {
+			if (strcmp(*argv, "section") == 0 ||
+			    strcmp(*argv, "sec") == 0) {
+				NEXT_ARG();
+				section = *argv;
+			} else if (strcmp(*argv, "verbose") == 0 ||
+				   strcmp(*argv, "verb") == 0) {
+				verbose = 1;
+			} else {
+				break;
+			}
+			argc--; argv++;
+		}
+		fd = bpf_obj_open(file, section, type, verbose);
+		if (fd < 0)
+			return -1;
+		base = strrchr(file, '/');
+		snprintf(name, sizeof(name), "%s:[%s]", base ? base + 1 : file,
+			 section);
+		addattr32(n, MAX_MSG, ops->fd, fd);
+		addattrstrz(n, MAX_MSG, ops->name, name);
+	} else if (strcmp(*argv, "object-pinned") == 0 ||
+		   strcmp(*argv, "pinned") == 0) {
+		NEXT_ARG();
+		fd = bpf_obj_get(*argv);
+		if (fd < 0) {
+			fprintf(stderr, "Cannot open pinned program %s: %s\n",
+				*argv, strerror(errno));
+			return -1;
+		}
+		base = strrchr(*argv, '/');
+		addattr32(n, MAX_MSG, ops->fd, fd);
+		addattrstrz(n, MAX_MSG, ops->name, base ? base + 1 : *argv);
+		argc--; argv++;
+	} else {
+		fprintf(stderr, "bpf: expected bytecode, bytecode-file, object-file or object-pinned, not \"%s\"\n",
+			*argv);
+		return -1;
+	}
+
+	*argc_p = argc;
+	*argv_p = argv;
+	return 0;
+}
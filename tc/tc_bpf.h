@@ -0,0 +1,28 @@
+#ifndef _TC_BPF_H_
+#define _TC_BPF_H_ 1
+
+#include <linux/filter.h>
+#include <linux/bpf.h>
+
+/* The attributes a kind carries a program in */
+struct bpf_cfg_ops
+{
+	int	ops_len;	/* classic BPF, the instruction count */
+	int	ops;		/* and the instructions */
+	int	fd;		/* eBPF, the program */
+	int	name;		/* and what it was loaded from */
+};
+
+extern int bpf_parse_common(int *argc_p, char ***argv_p,
+			    const struct bpf_cfg_ops *ops,
+			    enum bpf_prog_type type, const char *section,
+			    struct nlmsghdr *n);
+extern int bpf_parse_ops(const char *arg, int from_file,
+			 struct sock_filter *bpf_ops);
+extern void bpf_print_ops(FILE *fp, struct rtattr *bpf_ops, __u16 len);
+extern void bpf_print_tag(FILE *fp, struct rtattr *tag);
+extern int bpf_obj_open(const char *path, const char *section,
+			enum bpf_prog_type type, int verbose);
+extern int bpf_obj_get(const char *path);
+
+#endif
@@ -34,9 +34,17 @@ static void usage(void)
 	fprintf(stderr, "       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "       tc class show [ dev STRING ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       [ classid CLASSID[-CLASSID] ]\n");
+	fprintf(stderr, "       tc class build dev STRING [ root | parent CLASSID ] FILE\n");
+	fprintf(stderr, "       tc class bulk [ add | replace | change ] dev STRING\n");
+	fprintf(stderr, "       [ root | parent CLASSID ] QDISC_KIND FILE\n");
 	fprintf(stderr, "Where:\n");
 	fprintf(stderr, "QDISC_KIND := { prio | cbq | etc. }\n");
 	fprintf(stderr, "OPTIONS := ... try tc class add <desired QDISC_KIND> help\n");
+	fprintf(stderr, "FILE holds an indented tree of lines\n");
+	fprintf(stderr, "       { qdisc QHANDLE | class CLASSID } QDISC_KIND OPTIONS\n");
+	fprintf(stderr, "       filter FILTER_OPTIONS\n");
+	fprintf(stderr, "each added under the first less indented line above it.\n");
 	return;
 }
 
@@ -147,6 +155,58 @@ int tc_class_modify(int cmd, unsigned flags, int argc, char **argv)
 int filter_ifindex;
 __u32 filter_qdisc;
 __u32 filter_classid;
+__u32 filter_classid_max;
+
+RTATTR_TABLE(class_tb, TCA_MAX);
+
+/* One line of plain numbers per class, for pollers */
+static void print_class_counters(FILE *fp, struct tcmsg *t, struct rtattr *tb[])
+{
+	char abuf[64];
+
+	print_tc_classid(abuf, sizeof(abuf), t->tcm_handle);
+	fprintf(fp, "class %s %s ", ll_index_to_name(t->tcm_ifindex), abuf);
+	print_tc_classid(abuf, sizeof(abuf), t->tcm_parent);
+	fprintf(fp, "%s %s ", abuf, rta_getattr_str(tb[TCA_KIND]));
+	print_tcstats_counters(fp, tb);
+	fprintf(fp, "\n");
+}
+
+static void print_class_json(FILE *fp, struct nlmsghdr *n, struct tcmsg *t,
+			     struct rtattr *tb[])
+{
+	struct qdisc_util *q;
+	struct json_text jt;
+	char abuf[64];
+
+	fprintf(fp, "{\"object\":\"class\"");
+	if (n->nlmsg_type == RTM_DELTCLASS)
+		fprintf(fp, ",\"deleted\":true");
+	fprintf(fp, ",\"dev\":");
+	print_json_string(fp, ll_index_to_name(t->tcm_ifindex));
+	fprintf(fp, ",\"kind\":");
+	print_json_string(fp, rta_getattr_str(tb[TCA_KIND]));
+	print_tc_classid(abuf, sizeof(abuf), t->tcm_handle);
+	fprintf(fp, ",\"handle\":");
+	print_json_string(fp, abuf);
+	if (t->tcm_parent == TC_H_ROOT)
+		strcpy(abuf, "root");
+	else
+		print_tc_classid(abuf, sizeof(abuf), t->tcm_parent);
+	fprintf(fp, ",\"parent\":");
+	print_json_string(fp, abuf);
+	if (t->tcm_info)
+		fprintf(fp, ",\"leaf\":\"%x:\"", t->tcm_info >> 16);
+
+	q = get_qdisc_kind(RTA_DATA(tb[TCA_KIND]));
+	if (tb[TCA_OPTIONS] && q && q->print_copt && json_text_open(&jt)) {
+		q->print_copt(q, jt.fp, tb[TCA_OPTIONS]);
+		json_text_close(fp, "options", &jt);
+	}
+	print_tcstats_json(fp, tb[TCA_STATS2], tb[TCA_STATS], tb[TCA_XSTATS]);
+	print_xstats_json(fp, q, tb[TCA_STATS2], tb[TCA_XSTATS]);
+	fprintf(fp, "}\n");
+}
 
 int print_class(const struct sockaddr_nl *who,
 		       struct nlmsghdr *n, void *arg)
@@ -154,7 +214,7 @@ int print_class(const struct sockaddr_nl *who,
 	FILE *fp = (FILE*)arg;
 	struct tcmsg *t = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[TCA_MAX+1];
+	struct rtattr **tb;
 	struct qdisc_util *q;
 	char abuf[256];
 
@@ -170,17 +230,30 @@ int print_class(const struct sockaddr_nl *who,
 	if (filter_qdisc && TC_H_MAJ(t->tcm_handle^filter_qdisc))
 		return 0;
 
-	if (filter_classid && t->tcm_handle != filter_classid)
+	if (filter_classid &&
+	    (t->tcm_handle < filter_classid || t->tcm_handle > filter_classid_max))
 		return 0;
 
-	memset(tb, 0, sizeof(tb));
-	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	tb = parse_rtattr_table(&class_tb, TCA_RTA(t), len);
 
 	if (tb[TCA_KIND] == NULL) {
 		fprintf(stderr, "print_class: NULL kind\n");
 		return -1;
 	}
 
+	if (show_counters) {
+		print_class_counters(fp, t, tb);
+		return 0;
+	}
+	if (show_tlv) {
+		print_tcmsg_tlv(fp, n, tb);
+		return 0;
+	}
+	if (show_json) {
+		print_class_json(fp, n, t, tb);
+		return 0;
+	}
+
 	if (n->nlmsg_type == RTM_DELTCLASS)
 		fprintf(fp, "deleted ");
 
@@ -227,7 +300,6 @@ int print_class(const struct sockaddr_nl *who,
 			fprintf(fp, "\n");
 		}
 	}
-	fflush(fp);
 	return 0;
 }
 
@@ -240,6 +312,8 @@ int tc_class_list(int argc, char **argv)
 	memset(&t, 0, sizeof(t));
 	t.tcm_family = AF_UNSPEC;
 	memset(d, 0, sizeof(d));
+	/* Nothing is left from the last line of a batch */
+	filter_qdisc = filter_classid = filter_classid_max = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -257,7 +331,8 @@ int tc_class_list(int argc, char **argv)
 			NEXT_ARG();
 			if (filter_classid)
 				duparg("classid", *argv);
-			if (get_tc_classid(&filter_classid, *argv))
+			if (get_tc_classid_range(&filter_classid,
+						 &filter_classid_max, *argv))
 				invarg(*argv, "invalid class ID");
 		} else if (strcmp(*argv, "root") == 0) {
 			if (t.tcm_parent) {
@@ -293,19 +368,344 @@ int tc_class_list(int argc, char **argv)
 		filter_ifindex = t.tcm_ifindex;
 	}
 
+	/* One class of one device is asked for alone */
+	if (filter_classid && filter_classid == filter_classid_max &&
+	    t.tcm_ifindex) {
+		int ret;
+
+		t.tcm_handle = filter_classid;
+		ret = tc_get_object(RTM_GETTCLASS, &t, print_class);
+		if (ret <= 0)
+			return ret ? 1 : 0;
+		t.tcm_handle = 0;
+	}
+
  	if (rtnl_dump_request(&rth, RTM_GETTCLASS, &t, sizeof(t)) < 0) {
 		perror("Cannot send dump request");
 		return 1;
 	}
 
- 	if (rtnl_dump_filter(&rth, print_class, stdout) < 0) {
+ 	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_class,
+			     stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
+	fflush(stdout);
 
 	return 0;
 }
 
+#define BUILD_DEPTH	64
+#define BUILD_ARGS	256
+
+static void build_error(int lineno, int error, void *arg)
+{
+	fprintf(stderr, "RTNETLINK answers: %s\n", strerror(error));
+	fprintf(stderr, "%s:%d: command failed\n", (const char *)arg, lineno);
+}
+
+/* Columns of leading white space, tabs to the next multiple of 8 */
+static int build_indent(const char *line)
+{
+	int col = 0;
+
+	for (;; line++) {
+		if (*line == ' ')
+			col++;
+		else if (*line == '\t')
+			col = (col + 8) & ~7;
+		else
+			return col;
+	}
+}
+
+/*
+ * Adds a whole tree from an indented file in one pass: each line becomes
+ * the "add" of a qdisc, class or filter whose parent is the first line
+ * above it with less indentation, or the parent given for the tree.
+ * Rate tables are computed once per rate by tc_core and the requests go
+ * out pipelined.
+ */
+static int tc_class_build(int argc, char **argv)
+{
+	struct {
+		int	indent;
+		char	id[16];
+	} stack[BUILD_DEPTH];
+	char d[16] = "", top[16] = "root";
+	const char *name = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = cmdlineno, depth = 0, own_pipe = 0, err = 0;
+	FILE *fp;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				duparg("dev", *argv);
+			strncpy(d, *argv, sizeof(d) - 1);
+		} else if (strcmp(*argv, "root") == 0) {
+			strcpy(top, "root");
+		} else if (strcmp(*argv, "parent") == 0) {
+			__u32 handle;
+
+			NEXT_ARG();
+			if (get_tc_classid(&handle, *argv))
+				invarg(*argv, "invalid parent ID");
+			strncpy(top, *argv, sizeof(top) - 1);
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			return 0;
+		} else if (name == NULL) {
+			name = *argv;
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+	if (!d[0] || name == NULL) {
+		usage();
+		return -1;
+	}
+
+	fp = strcmp(name, "-") ? fopen(name, "r") : stdin;
+	if (fp == NULL) {
+		perror(name);
+		return 1;
+	}
+
+	if (rth.pipe == NULL) {
+		if (rtnl_pipeline_open(&rth, batch_window ? batch_window : 64,
+				       build_error, (void *)name) < 0 ||
+		    (batch_coalesce &&
+		     rtnl_pipeline_coalesce(&rth, batch_coalesce) < 0)) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			if (fp != stdin)
+				fclose(fp);
+			return 1;
+		}
+		own_pipe = 1;
+	}
+
+	cmdlineno = 0;
+	while (!err && getcmdline(&line, &len, fp) != -1) {
+		char *largv[BUILD_ARGS], *cargv[BUILD_ARGS + 8];
+		const char *parent;
+		int largc, cargc = 0, indent, i;
+
+		indent = build_indent(line);
+		largc = makeargs(line, largv, BUILD_ARGS);
+		if (largc == 0)
+			continue;
+
+		while (depth > 0 && stack[depth - 1].indent >= indent)
+			depth--;
+		parent = depth ? stack[depth - 1].id : top;
+
+		cargv[cargc++] = "add";
+		cargv[cargc++] = "dev";
+		cargv[cargc++] = d;
+		if (strcmp(parent, "root") == 0) {
+			cargv[cargc++] = "root";
+		} else {
+			cargv[cargc++] = "parent";
+			cargv[cargc++] = (char *)parent;
+		}
+
+		if ((strcmp(largv[0], "qdisc") == 0 ||
+		     strcmp(largv[0], "class") == 0) && largc > 2) {
+			if (depth == BUILD_DEPTH) {
+				fprintf(stderr, "%s:%d: nested too deep\n",
+					name, cmdlineno);
+				err = 1;
+				break;
+			}
+			stack[depth].indent = indent;
+			strncpy(stack[depth].id, largv[1],
+				sizeof(stack[depth].id) - 1);
+			stack[depth].id[sizeof(stack[depth].id) - 1] = 0;
+			depth++;
+
+			cargv[cargc++] = largv[0][0] == 'q' ? "handle" : "classid";
+		} else if (strcmp(largv[0], "filter") != 0) {
+			fprintf(stderr, "%s:%d: expected qdisc, class or filter\n",
+				name, cmdlineno);
+			err = 1;
+			break;
+		}
+		for (i = 1; i < largc; i++)
+			cargv[cargc++] = largv[i];
+
+		/* under -batch, errors are reported against the batch line */
+		if (own_pipe)
+			rtnl_pipeline_cookie(&rth, cmdlineno);
+
+		if (largv[0][0] == 'q')
+			err = tc_qdisc_modify(RTM_NEWQDISC, NLM_F_EXCL|NLM_F_CREATE,
+					      cargc - 1, cargv + 1);
+		else if (largv[0][0] == 'c')
+			err = tc_class_modify(RTM_NEWTCLASS, NLM_F_EXCL|NLM_F_CREATE,
+					      cargc - 1, cargv + 1);
+		else
+			err = do_filter(cargc, cargv);
+		if (err)
+			fprintf(stderr, "%s:%d: illegal line\n", name, cmdlineno);
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = lineno;
+
+	if (rtnl_pipeline_sync(&rth))
+		err = 1;
+	if (own_pipe)
+		rtnl_pipeline_close(&rth);
+
+	return err ? 1 : 0;
+}
+
+struct bulk_ctx
+{
+	struct class_bulk	cb;
+	int			ifindex;
+	int			flags;
+	int			own_pipe;
+	const char		*kind;
+};
+
+static int bulk_emit(struct class_bulk *cb, __u32 parent, __u32 classid,
+		     const void *opt, int len)
+{
+	struct bulk_ctx *ctx = (struct bulk_ctx *)cb;
+	struct {
+		struct nlmsghdr 	n;
+		struct tcmsg 		t;
+		char   			buf[1024];
+	} req;
+
+	memset(&req, 0, sizeof(req.n) + sizeof(req.t));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST|ctx->flags;
+	req.n.nlmsg_type = RTM_NEWTCLASS;
+	req.t.tcm_family = AF_UNSPEC;
+	req.t.tcm_ifindex = ctx->ifindex;
+	req.t.tcm_parent = parent;
+	req.t.tcm_handle = classid;
+	addattr_l(&req.n, sizeof(req), TCA_KIND, ctx->kind,
+		  strlen(ctx->kind) + 1);
+	if (addattr_l(&req.n, sizeof(req), TCA_OPTIONS, opt, len) < 0)
+		return -1;
+
+	if (ctx->own_pipe)
+		rtnl_pipeline_cookie(&rth, cmdlineno);
+	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Adds the classes of a file that the qdisc kind's generator reads,
+ * e.g. HFSC tiers instantiated for each subscriber.  Options are parsed
+ * once per template by the generator, the requests go out pipelined.
+ */
+static int tc_class_bulk(int argc, char **argv)
+{
+	struct bulk_ctx ctx;
+	struct qdisc_util *q;
+	const char *name;
+	char d[16] = "";
+	int lineno = cmdlineno, err;
+	FILE *fp;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.flags = NLM_F_EXCL|NLM_F_CREATE;
+	ctx.cb.parent = TC_H_ROOT;
+	if (argc > 0 && strcmp(*argv, "add") == 0) {
+		argc--; argv++;
+	} else if (argc > 0 && strcmp(*argv, "replace") == 0) {
+		ctx.flags = NLM_F_CREATE;
+		argc--; argv++;
+	} else if (argc > 0 && strcmp(*argv, "change") == 0) {
+		ctx.flags = 0;
+		argc--; argv++;
+	}
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				duparg("dev", *argv);
+			strncpy(d, *argv, sizeof(d) - 1);
+		} else if (strcmp(*argv, "root") == 0) {
+			ctx.cb.parent = TC_H_ROOT;
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (get_tc_classid(&ctx.cb.parent, *argv))
+				invarg(*argv, "invalid parent ID");
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			return 0;
+		} else
+			break;
+		argc--; argv++;
+	}
+	if (!d[0] || argc != 2) {
+		usage();
+		return -1;
+	}
+	ctx.kind = argv[0];
+	name = ctx.cb.name = argv[1];
+	ctx.cb.emit = bulk_emit;
+
+	q = get_qdisc_kind(ctx.kind);
+	if (q == NULL || q->bulk_copt == NULL) {
+		fprintf(stderr, "Error: Qdisc \"%s\" has no class generator.\n",
+			ctx.kind);
+		return -1;
+	}
+
+	ll_init_map(&rth);
+	ctx.ifindex = ll_name_to_index(d);
+	if (ctx.ifindex == 0) {
+		fprintf(stderr, "Cannot find device \"%s\"\n", d);
+		return 1;
+	}
+
+	fp = strcmp(name, "-") ? fopen(name, "r") : stdin;
+	if (fp == NULL) {
+		perror(name);
+		return 1;
+	}
+
+	if (rth.pipe == NULL) {
+		if (rtnl_pipeline_open(&rth, batch_window ? batch_window : 64,
+				       build_error, (void *)name) < 0 ||
+		    (batch_coalesce &&
+		     rtnl_pipeline_coalesce(&rth, batch_coalesce) < 0)) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			if (fp != stdin)
+				fclose(fp);
+			return 1;
+		}
+		ctx.own_pipe = 1;
+	}
+
+	cmdlineno = 0;
+	err = q->bulk_copt(q, &ctx.cb, fp);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = lineno;
+
+	if (rtnl_pipeline_sync(&rth))
+		err = 1;
+	if (ctx.own_pipe)
+		rtnl_pipeline_close(&rth);
+
+	return err ? 1 : 0;
+}
+
 int do_class(int argc, char **argv)
 {
 	if (argc < 1)
@@ -325,6 +725,10 @@ int do_class(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return tc_class_list(argc-1, argv+1);
+	if (strcmp(*argv, "build") == 0)
+		return tc_class_build(argc-1, argv+1);
+	if (strcmp(*argv, "bulk") == 0)
+		return tc_class_bulk(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
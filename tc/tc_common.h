@@ -1,16 +1,29 @@
 
 #define TCA_BUF_MAX	(64*1024)
+#define TC_OUTBUF_SIZE	(256*1024)
 
 extern struct rtnl_handle rth;
+extern int force;
+extern unsigned int batch_window;
+extern unsigned int batch_coalesce;
+extern int batch_noack;
+extern int show_counters;
+extern int show_json;
+extern int show_tlv;
+extern int ematch_optimize;
+extern int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv);
+extern int tc_class_modify(int cmd, unsigned flags, int argc, char **argv);
 extern int do_qdisc(int argc, char **argv);
 extern int do_class(int argc, char **argv);
 extern int do_filter(int argc, char **argv);
 extern int do_action(int argc, char **argv);
 extern int do_tcmonitor(int argc, char **argv);
+extern int do_sim(int argc, char **argv);
 extern int print_action(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg);
 extern int print_filter(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg);
 extern int print_qdisc(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg);
 extern int print_class(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg);
+extern int tc_get_object(int type, const struct tcmsg *t, rtnl_filter_t print);
 extern void print_size_table(FILE *fp, const char *prefix, struct rtattr *rta);
 
 struct tc_estimator;
@@ -17,15 +17,18 @@
 #include <fcntl.h>
 #include <math.h>
 #include <sys/socket.h>
+#include <sys/utsname.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "tc_core.h"
 #include <linux/atm.h>
 
 static double tick_in_usec = 1;
 static double clock_factor = 1;
+static int kernel_major = -1, kernel_minor;
 
 int tc_core_time2big(unsigned time)
 {
@@ -56,14 +59,27 @@ unsigned tc_core_ktime2time(unsigned ktime)
 	return ktime / clock_factor;
 }
 
-unsigned tc_calc_xmittime(unsigned rate, unsigned size)
+/* Neither is rounded to whole time units, which at 10Gbit and more
+ * is most of a burst */
+unsigned tc_calc_xmittime(__u64 rate, unsigned size)
 {
-	return tc_core_time2tick(TIME_UNITS_PER_SEC*((double)size/rate));
+	return TIME_UNITS_PER_SEC*((double)size/rate)*tick_in_usec;
 }
 
-unsigned tc_calc_xmitsize(unsigned rate, unsigned ticks)
+unsigned tc_calc_xmitsize(__u64 rate, unsigned ticks)
 {
-	return ((double)rate*tc_core_tick2time(ticks))/TIME_UNITS_PER_SEC;
+	return ((double)rate*ticks/tick_in_usec)/TIME_UNITS_PER_SEC;
+}
+
+/* Time to send a bucket of size bytes.  Unlike the rate table entries
+ * this is rounded up, so that a bucket of one mtu still holds a full
+ * packet when a tick is most of it, and kept in 32 bits at slow rates.
+ */
+unsigned tc_calc_burst(__u64 rate, unsigned size)
+{
+	double t = ceil(TIME_UNITS_PER_SEC*((double)size/rate)*tick_in_usec);
+
+	return t < ~0U ? t : ~0U;
 }
 
 /*
@@ -102,6 +118,35 @@ unsigned tc_adjust_size(unsigned sz, unsigned mpu, enum link_layer linklayer)
 	}
 }
 
+/*
+ * The classes and policers of a batch mostly share a few rates, so the
+ * rate tables are remembered, direct mapped by their parameters.  The
+ * tables depend on the clock too; tc_core_init() forgets them.
+ */
+#define RTAB_CACHE_SIZE	64
+
+struct rtab_cache_ent
+{
+	int		valid;
+	unsigned	rate;
+	unsigned	mpu;
+	int		cell_log;
+	enum link_layer	linklayer;
+	__u32		rtab[256];
+};
+
+static struct rtab_cache_ent rtab_cache[RTAB_CACHE_SIZE];
+
+static struct rtab_cache_ent *rtab_cache_slot(unsigned rate, unsigned mpu,
+					      int cell_log,
+					      enum link_layer linklayer)
+{
+	unsigned h = rate * 2654435761U;
+
+	h ^= mpu * 40503U + (cell_log << 8) + linklayer;
+	return &rtab_cache[(h >> 16) % RTAB_CACHE_SIZE];
+}
+
 /*
    rtab[pkt_len>>cell_log] = pkt_xmit_time
  */
@@ -110,6 +155,7 @@ int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 		   int cell_log, unsigned mtu,
 		   enum link_layer linklayer)
 {
+	struct rtab_cache_ent *c;
 	int i;
 	unsigned sz;
 	unsigned bps = r->rate;
@@ -124,22 +170,104 @@ int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 			cell_log++;
 	}
 
-	for (i=0; i<256; i++) {
-		sz = tc_adjust_size((i + 1) << cell_log, mpu, linklayer);
-		rtab[i] = tc_calc_xmittime(bps, sz);
+	c = rtab_cache_slot(bps, mpu, cell_log, linklayer);
+	if (!c->valid || c->rate != bps || c->mpu != mpu ||
+	    c->cell_log != cell_log || c->linklayer != linklayer) {
+		for (i=0; i<256; i++) {
+			sz = tc_adjust_size((i + 1) << cell_log, mpu, linklayer);
+			c->rtab[i] = tc_calc_xmittime(bps, sz);
+		}
+		c->valid = 1;
+		c->rate = bps;
+		c->mpu = mpu;
+		c->cell_log = cell_log;
+		c->linklayer = linklayer;
 	}
+	memcpy(rtab, c->rtab, sizeof(c->rtab));
 
 	r->cell_align=-1; // Due to the sz calc
 	r->cell_log=cell_log;
 	return cell_log;
 }
 
+static int kernel_at_least(int major, int minor)
+{
+	struct utsname u;
+
+	if (kernel_major < 0) {
+		kernel_major = 0;
+		if (uname(&u) != 0 ||
+		    sscanf(u.release, "%d.%d", &kernel_major, &kernel_minor) != 2)
+			kernel_major = 0;
+	}
+	return kernel_major > major ||
+	       (kernel_major == major && kernel_minor >= minor);
+}
+
+/*
+ * Since 3.13 the kernel computes the transmit times of HTB and TBF from
+ * the ratespec itself, takes rates above 32 bits in separate attributes
+ * and only looks at a rate table sent by binaries that leave the link
+ * layer of the ratespec unset.
+ */
+int tc_core_kernel_rates(void)
+{
+	return kernel_at_least(3, 13);
+}
+
+/* Policers took rates above 32 bits only in 5.0 */
+int tc_core_kernel_police_rates(void)
+{
+	return kernel_at_least(5, 0);
+}
+
+/*
+ * Fills in the ratespec for a qdisc that may compute the transmit times
+ * in the kernel.  Returns 1 if rtab was computed and has to be sent,
+ * 0 if the kernel does without it.
+ */
+int tc_calc_ratespec(struct tc_ratespec *r, __u32 *rtab,
+		     int cell_log, unsigned mtu,
+		     enum link_layer linklayer)
+{
+	if (!tc_core_kernel_rates())
+		return tc_calc_rtable(r, rtab, cell_log, mtu, linklayer) < 0 ?
+			-1 : 1;
+
+	if (mtu == 0)
+		mtu = 2047;
+
+	if (cell_log < 0) {
+		cell_log = 0;
+		while ((mtu >> cell_log) > 255)
+			cell_log++;
+	}
+
+	r->cell_align = -1;
+	r->cell_log = cell_log;
+	r->linklayer = linklayer & TC_LINKLAYER_MASK;
+	return 0;
+}
+
+/* Size tables computed so far: the qdiscs of a batch usually share a
+ * few.  The tables stay here, callers must not free them.
+ */
+#define STAB_CACHE_SIZE	16
+
+static struct stab_cache {
+	struct tc_sizespec	in, out;
+	__u16			*data;
+} stab_cache[STAB_CACHE_SIZE];
+static int stab_cache_next;
+
 /*
    stab[pkt_len>>cell_log] = pkt_xmit_size>>size_log
  */
 
 int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 {
+	struct tc_sizespec in = *s;
+	struct stab_cache *c;
 	int i;
 	enum link_layer linklayer = s->linklayer;
 	unsigned int sz;
@@ -154,19 +282,31 @@ int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 		return 0;
 	}
 
+	for (i = 0; i < STAB_CACHE_SIZE; i++) {
+		c = &stab_cache[i];
+		if (c->data && memcmp(&in, &c->in, sizeof(in)) == 0) {
+			*s = c->out;
+			*stab = c->data;
+			return 0;
+		}
+	}
+
 	if (s->mtu == 0)
 		s->mtu = 2047;
 	if (s->tsize == 0)
 		s->tsize = 512;
 
+	c = &stab_cache[stab_cache_next];
+	free(c->data);
+	c->data = malloc(s->tsize * sizeof(__u16));
+	if (!c->data)
+		return -1;
+	stab_cache_next = (stab_cache_next + 1) % STAB_CACHE_SIZE;
+
 	s->cell_log = 0;
 	while ((s->mtu >> s->cell_log) > s->tsize - 1)
 		s->cell_log++;
 
-	*stab = malloc(s->tsize * sizeof(__u16));
-	if (!*stab)
-		return -1;
-
 again:
 	for (i = s->tsize - 1; i >= 0; i--) {
 		sz = tc_adjust_size((i + 1) << s->cell_log, s->mpu, linklayer);
@@ -174,10 +314,14 @@ again:
 			s->size_log++;
 			goto again;
 		}
-		(*stab)[i] = sz >> s->size_log;
+		c->data[i] = sz >> s->size_log;
 	}
 
 	s->cell_align = -1; // Due to the sz calc
+
+	c->in = in;
+	c->out = *s;
+	*stab = c->data;
 	return 0;
 }
 
@@ -207,5 +351,6 @@ int tc_core_init()
 
 	clock_factor  = (double)clock_res / TIME_UNITS_PER_SEC;
 	tick_in_usec = (double)t2us / us2t * clock_factor;
+	memset(rtab_cache, 0, sizeof(rtab_cache));
 	return 0;
 }
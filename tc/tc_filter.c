@@ -19,6 +19,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/if_ether.h>
 
 #include "rt_names.h"
@@ -33,12 +34,17 @@ static void usage(void)
 	fprintf(stderr, "Usage: tc filter [ add | del | change | replace | show ] dev STRING\n");
 	fprintf(stderr, "       [ pref PRIO ] protocol PROTO\n");
 	fprintf(stderr, "       [ estimator INTERVAL TIME_CONSTANT ]\n");
-	fprintf(stderr, "       [ root | classid CLASSID ] [ handle FILTERID ]\n");
+	fprintf(stderr, "       [ root | ingress | egress | parent CLASSID ] [ handle FILTERID ]\n");
 	fprintf(stderr, "       [ [ FILTER_TYPE ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "       tc filter show [ dev STRING ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       tc filter show [ dev STRING ] [ root | ingress | egress | parent CLASSID ]\n");
+	fprintf(stderr, "       [ pref PRIO ] [ protocol PROTO ] [ handle FILTERID ]\n");
+	fprintf(stderr, "       tc filter compile [ dev STRING ] [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       pref PRIO [ protocol PROTO ] FILTER_TYPE FILE\n");
+	fprintf(stderr, "       tc filter swap dev STRING [ root | parent CLASSID ]\n");
+	fprintf(stderr, "       [ pref PRIO ] [ protocol PROTO ] FILTER_TYPE FILE\n");
 	fprintf(stderr, "Where:\n");
-	fprintf(stderr, "FILTER_TYPE := { rsvp | u32 | fw | route | etc. }\n");
+	fprintf(stderr, "FILTER_TYPE := { rsvp | u32 | bpf | fw | route | etc. }\n");
 	fprintf(stderr, "FILTERID := ... format depends on classifier, see there\n");
 	fprintf(stderr, "OPTIONS := ... try tc filter add <desired FILTER_KIND> help\n");
 	return;
@@ -87,6 +93,16 @@ int tc_filter_modify(int cmd, unsigned flags, int argc, char **argv)
 				return -1;
 			}
 			req.t.tcm_parent = TC_H_ROOT;
+		} else if (strcmp(*argv, "ingress") == 0 ||
+			   strcmp(*argv, "egress") == 0) {
+			if (req.t.tcm_parent) {
+				fprintf(stderr, "Error: \"%s\" is duplicate parent ID\n",
+					*argv);
+				return -1;
+			}
+			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT, *argv[0] == 'i' ?
+						     TC_H_MIN_INGRESS :
+						     TC_H_MIN_EGRESS);
 		} else if (strcmp(*argv, "parent") == 0) {
 			__u32 handle;
 			NEXT_ARG();
@@ -175,12 +191,559 @@ int tc_filter_modify(int cmd, unsigned flags, int argc, char **argv)
 	return 0;
 }
 
+static int compile_print(struct filter_compile *fc, char *cmd)
+{
+	printf("%s\n", cmd);
+	return 0;
+}
+
+static int compile_txqueues(struct filter_compile *fc)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[64];
+	} req;
+	char answer[16384];
+	struct nlmsghdr *n = (struct nlmsghdr *)answer;
+	struct rtattr *tb[IFLA_MAX+1];
+	int len;
+
+	if (fc->dev == NULL)
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = RTM_GETLINK;
+	req.i.ifi_family = AF_UNSPEC;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, fc->dev,
+		  strlen(fc->dev) + 1);
+
+	if (rtnl_talk(&rth, &req.n, 0, 0, n) < 0)
+		return 0;
+	len = n->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(NLMSG_DATA(n)), len);
+	if (tb[IFLA_NUM_TX_QUEUES] == NULL)
+		return 0;
+	return rta_getattr_u32(tb[IFLA_NUM_TX_QUEUES]);
+}
+
+/* Translate a file of rules into a tc -batch script on stdout */
+static int tc_filter_compile(int argc, char **argv)
+{
+	struct filter_compile fc;
+	struct filter_util *q = NULL;
+	char prefix[256];
+	int len, prio_set = 0;
+
+	memset(&fc, 0, sizeof(fc));
+	len = snprintf(prefix, sizeof(prefix), "filter add");
+	while (argc > 0) {
+		if (strcmp(*argv, "root") == 0) {
+			len += snprintf(prefix + len, sizeof(prefix) - len,
+					" root");
+		} else if (strcmp(*argv, "dev") == 0 ||
+			   strcmp(*argv, "parent") == 0 ||
+			   matches(*argv, "protocol") == 0) {
+			NEXT_ARG();
+			if (strcmp(argv[-1], "dev") == 0)
+				fc.dev = *argv;
+			len += snprintf(prefix + len, sizeof(prefix) - len,
+					" %s %s", argv[-1], *argv);
+		} else if (matches(*argv, "preference") == 0 ||
+			   matches(*argv, "priority") == 0) {
+			__u32 prio;
+
+			NEXT_ARG();
+			if (get_u32(&prio, *argv, 0))
+				invarg(*argv, "invalid priority value");
+			len += snprintf(prefix + len, sizeof(prefix) - len,
+					" prio %u", prio);
+			prio_set = 1;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			return 0;
+		} else {
+			q = get_filter_kind(*argv);
+			argc--; argv++;
+			break;
+		}
+		if (len >= sizeof(prefix)) {
+			fprintf(stderr, "Arguments are too long\n");
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (q == NULL || q->compile_fopt == NULL) {
+		fprintf(stderr, "Filter type must be given and support "
+			"\"compile\". Try \"tc filter help\".\n");
+		return -1;
+	}
+	if (!prio_set) {
+		fprintf(stderr, "\"compile\" needs a priority, "
+			"all rules share it\n");
+		return -1;
+	}
+	fc.prefix = prefix;
+	fc.emit = compile_print;
+	fc.txqueues = compile_txqueues;
+	return q->compile_fopt(q, &fc, argc, argv) ? 1 : 0;
+}
+
+struct swap_state
+{
+	__u16		protocol;
+	int		nprios;
+	__u32		prio[256];
+	int		old[256];	/* of the same protocol */
+	__u32		u32_info;	/* of some u32 instance */
+	__u8		ht_busy[0x800];
+	__u8		ht_keep[0x800];	/* dumped under a priority that stays */
+};
+
+static int swap_collect(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			void *arg)
+{
+	struct swap_state *s = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	__u32 prio = TC_H_MAJ(t->tcm_info) >> 16;
+	int i;
+
+	if (n->nlmsg_type != RTM_NEWTFILTER || len < 0)
+		return 0;
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+
+	for (i = 0; i < s->nprios && s->prio[i] != prio; i++)
+		;
+	if (i == s->nprios) {
+		if (s->nprios == 256) {
+			fprintf(stderr, "Too many filter priorities\n");
+			return -1;
+		}
+		s->prio[s->nprios] = prio;
+		s->old[s->nprios] = !s->protocol ||
+				    TC_H_MIN(t->tcm_info) == s->protocol;
+		s->nprios++;
+	}
+
+	if (tb[TCA_KIND] && strcmp(rta_getattr_str(tb[TCA_KIND]), "u32") == 0) {
+		s->u32_info = t->tcm_info;
+		if (!s->old[i] && (t->tcm_handle & 0xFFFFF) == 0 &&
+		    (t->tcm_handle >> 20) < 0x800)
+			s->ht_keep[t->tcm_handle >> 20] = 1;
+	}
+	return 0;
+}
+
+static int swap_prio_used(struct swap_state *s, __u32 prio)
+{
+	int i;
+
+	for (i = 0; i < s->nprios; i++)
+		if (s->prio[i] == prio)
+			return 1;
+	return 0;
+}
+
+static int swap_cmd(int cmd, unsigned flags, char *line)
+{
+	char *argv[300];
+	int argc;
+
+	argc = makeargs(line, argv, 300);
+	if (cmd == RTM_NEWTFILTER) {
+		/* Skip "filter add" */
+		argc -= 2;
+		memmove(argv, argv + 2, (argc + 1) * sizeof(*argv));
+	}
+	return tc_filter_modify(cmd, flags, argc, argv);
+}
+
+static void swap_probe_error(int cookie, int error, void *arg)
+{
+	struct swap_state *s = arg;
+
+	s->ht_busy[cookie] = error == ENOENT ? 0 : 1;
+}
+
+static int swap_probe_send(struct rtnl_handle *prth, struct swap_state *s,
+			   int cmd, int ifindex, __u32 parent, unsigned id)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[64];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_type = cmd;
+	req.t.tcm_family = AF_UNSPEC;
+	req.t.tcm_ifindex = ifindex;
+	req.t.tcm_parent = parent;
+	req.t.tcm_info = s->u32_info;
+	req.t.tcm_handle = id << 20;
+	addattr_l(&req.n, sizeof(req), TCA_KIND, "u32", 4);
+	rtnl_pipeline_cookie(prth, id);
+	return rtnl_talk(prth, &req.n, 0, 0, NULL);
+}
+
+/* u32 hash table IDs are shared by all instances on a qdisc, and the
+ * tables of a deleted instance stay behind until the last one goes,
+ * with their IDs taken.  So look every ID up through a live instance,
+ * and try to delete the tables not shown under a priority that stays:
+ * the kernel only lets those that nothing links to go, which cannot
+ * classify anything.  Pipelined on a socket of its own.
+ */
+static int swap_probe(struct swap_state *s, int ifindex, __u32 parent)
+{
+	struct rtnl_handle prth;
+	unsigned id;
+	int err = 0;
+
+	if (!s->u32_info)
+		return 0;
+
+	if (rtnl_open(&prth, 0) < 0)
+		return -1;
+	if (rtnl_pipeline_open(&prth, 64, swap_probe_error, s) < 0) {
+		rtnl_close(&prth);
+		return -1;
+	}
+	for (id = 1; id < 0x800 && !err; id++) {
+		s->ht_busy[id] = 1;
+		err = swap_probe_send(&prth, s, RTM_GETTFILTER, ifindex,
+				      parent, id);
+	}
+	if (rtnl_pipeline_sync(&prth) < 0)
+		err = -1;
+
+	/* Left at 2 unless the delete fails */
+	for (id = 1; id < 0x800 && !err; id++) {
+		if (!s->ht_busy[id] || s->ht_keep[id])
+			continue;
+		s->ht_busy[id] = 2;
+		err = swap_probe_send(&prth, s, RTM_DELTFILTER, ifindex,
+				      parent, id);
+	}
+	if (rtnl_pipeline_close(&prth) < 0)
+		err = -1;
+	rtnl_close(&prth);
+
+	for (id = 1; id < 0x800; id++)
+		if (s->ht_busy[id] == 2)
+			s->ht_busy[id] = 0;
+	return err;
+}
+
+static int swap_emit(struct filter_compile *fc, char *cmd)
+{
+	return swap_cmd(RTM_NEWTFILTER, NLM_F_EXCL|NLM_F_CREATE, cmd);
+}
+
+static int swap_sync(struct filter_compile *fc)
+{
+	return rtnl_pipeline_sync(&rth) ? -1 : 0;
+}
+
+/* Each line holds the options of one filter of the given kind */
+static int swap_lines(struct filter_compile *fc, const char *kind,
+		      int argc, char **argv)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = cmdlineno, err = 0;
+	FILE *fp;
+
+	if (argc != 1) {
+		fprintf(stderr, "Usage: tc filter swap ... %s FILE\n", kind);
+		return -1;
+	}
+	fp = strcmp(argv[0], "-") ? fopen(argv[0], "r") : stdin;
+	if (fp == NULL) {
+		perror(argv[0]);
+		return -1;
+	}
+
+	cmdlineno = 0;
+	while (err == 0 && getcmdline(&line, &len, fp) != -1) {
+		char cmd[8192], *largv[256];
+		int largc, i, n;
+
+		largc = makeargs(line, largv, 256);
+		if (largc == 0)
+			continue;
+		n = snprintf(cmd, sizeof(cmd), "%s", fc->prefix);
+		i = 0;
+		if (largc > 1 && strcmp(largv[0], "handle") == 0) {
+			n += snprintf(cmd + n, sizeof(cmd) - n, " handle %s",
+				      largv[1]);
+			i = 2;
+		}
+		n += snprintf(cmd + n, sizeof(cmd) - n, " %s", kind);
+		for (; i < largc; i++)
+			n += snprintf(cmd + n, sizeof(cmd) - n, " %s",
+				      largv[i]);
+		if (n >= sizeof(cmd) || fc->emit(fc, cmd)) {
+			fprintf(stderr, "%s:%d: illegal filter\n",
+				argv[0], cmdlineno);
+			err = -1;
+		}
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = lineno;
+	return err;
+}
+
+/* Replace all filters of a parent: the new set goes to a free priority,
+ * pipelined, and the old priorities are deleted once it is complete.
+ * Compiled sets are built unreachable and switched on by one request;
+ * others are added after the old set, so until it is deleted they only
+ * see packets it does not classify.
+ */
+static int tc_filter_swap(int argc, char **argv)
+{
+	struct filter_compile fc;
+	struct filter_util *q = NULL;
+	struct swap_state *s;
+	struct tcmsg t;
+	char where[128], prefix[256], cmd[256];
+	char d[16] = "";
+	__u32 prio = 0;
+	int i, len, err, own_pipe = 0;
+
+	memset(&t, 0, sizeof(t));
+	t.tcm_family = AF_UNSPEC;
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return -1;
+
+	len = 0;
+	where[0] = 0;
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				duparg("dev", *argv);
+			strncpy(d, *argv, sizeof(d)-1);
+		} else if (strcmp(*argv, "root") == 0) {
+			if (t.tcm_parent)
+				duparg("root", *argv);
+			t.tcm_parent = TC_H_ROOT;
+			len += snprintf(where + len, sizeof(where) - len,
+					" root");
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (t.tcm_parent)
+				duparg("parent", *argv);
+			if (get_tc_classid(&t.tcm_parent, *argv))
+				invarg(*argv, "invalid parent ID");
+			len += snprintf(where + len, sizeof(where) - len,
+					" parent %s", *argv);
+		} else if (matches(*argv, "protocol") == 0) {
+			NEXT_ARG();
+			if (s->protocol)
+				duparg("protocol", *argv);
+			if (ll_proto_a2n(&s->protocol, *argv))
+				invarg(*argv, "invalid protocol");
+			len += snprintf(where + len, sizeof(where) - len,
+					" protocol %s", *argv);
+		} else if (matches(*argv, "preference") == 0 ||
+			   matches(*argv, "priority") == 0) {
+			NEXT_ARG();
+			if (prio)
+				duparg("priority", *argv);
+			if (get_u32(&prio, *argv, 0) || prio == 0 ||
+			    prio > 0xFFFF)
+				invarg(*argv, "invalid priority value");
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			free(s);
+			return 0;
+		} else {
+			q = get_filter_kind(*argv);
+			argc--; argv++;
+			break;
+		}
+		if (len >= sizeof(where)) {
+			fprintf(stderr, "Arguments are too long\n");
+			free(s);
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if (!d[0] || q == NULL) {
+		fprintf(stderr, "\"swap\" needs a device and a filter type. "
+			"Try \"tc filter help\".\n");
+		free(s);
+		return -1;
+	}
+	ll_init_map(&rth);
+	t.tcm_ifindex = ll_name_to_index(d);
+	if (t.tcm_ifindex == 0) {
+		fprintf(stderr, "Cannot find device \"%s\"\n", d);
+		free(s);
+		return 1;
+	}
+
+	if (rtnl_dump_request(&rth, RTM_GETTFILTER, &t, sizeof(t)) < 0) {
+		perror("Cannot send dump request");
+		free(s);
+		return 1;
+	}
+	if (rtnl_dump_filter(&rth, swap_collect, s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		free(s);
+		return 1;
+	}
+
+	if (q->compile_fopt && swap_probe(s, t.tcm_ifindex, t.tcm_parent) < 0) {
+		fprintf(stderr, "Cannot look up hash table IDs\n");
+		free(s);
+		return 1;
+	}
+
+	if (prio && swap_prio_used(s, prio)) {
+		fprintf(stderr, "Priority %u is in use\n", prio);
+		free(s);
+		return 1;
+	}
+	if (!prio) {
+		__u32 lo = 0xFFFF, hi = 0;
+
+		for (i = 0; i < s->nprios; i++) {
+			if (!s->old[i])
+				continue;
+			if (s->prio[i] < lo)
+				lo = s->prio[i];
+			if (s->prio[i] > hi)
+				hi = s->prio[i];
+		}
+		/* A compiled set is switched on with the old one still there:
+		 * put it in front.
+		 */
+		if (q->compile_fopt && hi)
+			for (prio = lo - 1; prio && swap_prio_used(s, prio); prio--)
+				;
+		if (!prio)
+			for (prio = hi + 1; prio <= 0xFFFF &&
+			     swap_prio_used(s, prio); prio++)
+				;
+		if (prio > 0xFFFF) {
+			fprintf(stderr, "No free priority\n");
+			free(s);
+			return 1;
+		}
+	}
+
+	snprintf(prefix, sizeof(prefix), "filter add dev %s%s prio %u",
+		 d, where, prio);
+	memset(&fc, 0, sizeof(fc));
+	fc.prefix = prefix;
+	fc.dev = d;
+	fc.gate = 1;
+	fc.ht_busy = s->ht_busy;
+	fc.emit = swap_emit;
+	fc.sync = swap_sync;
+	fc.txqueues = compile_txqueues;
+
+	if (rth.pipe == NULL) {
+		if (rtnl_pipeline_open(&rth, batch_window ? batch_window : 64,
+				       NULL, NULL) < 0) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			free(s);
+			return 1;
+		}
+		own_pipe = 1;
+	}
+
+	if (q->compile_fopt)
+		err = q->compile_fopt(q, &fc, argc, argv);
+	else
+		err = swap_lines(&fc, q->id, argc, argv);
+	if (rtnl_pipeline_sync(&rth))
+		err = -1;
+
+	if (err) {
+		fprintf(stderr, "Installing the new filters failed, "
+			"removing them\n");
+		snprintf(cmd, sizeof(cmd), "dev %s%s prio %u", d, where, prio);
+		swap_cmd(RTM_DELTFILTER, 0, cmd);
+	} else {
+		for (i = 0; i < s->nprios; i++) {
+			if (!s->old[i])
+				continue;
+			snprintf(cmd, sizeof(cmd), "dev %s%s prio %u",
+				 d, where, s->prio[i]);
+			swap_cmd(RTM_DELTFILTER, 0, cmd);
+		}
+	}
+	if (rtnl_pipeline_sync(&rth))
+		err = -1;
+	if (own_pipe)
+		rtnl_pipeline_close(&rth);
+
+	free(s);
+	return err ? 1 : 0;
+}
+
 static __u32 filter_parent;
 static int filter_ifindex;
 static __u32 filter_prio;
 static __u32 filter_protocol;
+static __u32 filter_handle;
 __u16 f_proto = 0;
 
+static void print_filter_json(FILE *fp, struct nlmsghdr *n, struct tcmsg *t,
+			      struct rtattr *tb[])
+{
+	struct filter_util *q;
+	struct json_text jt;
+	char abuf[64];
+
+	fprintf(fp, "{\"object\":\"filter\"");
+	if (n->nlmsg_type == RTM_DELTFILTER)
+		fprintf(fp, ",\"deleted\":true");
+	fprintf(fp, ",\"dev\":");
+	print_json_string(fp, ll_index_to_name(t->tcm_ifindex));
+	if (t->tcm_parent == TC_H_ROOT)
+		strcpy(abuf, "root");
+	else
+		print_tc_classid(abuf, sizeof(abuf), t->tcm_parent);
+	fprintf(fp, ",\"parent\":");
+	print_json_string(fp, abuf);
+	if (t->tcm_info) {
+		SPRINT_BUF(b1);
+
+		f_proto = TC_H_MIN(t->tcm_info);
+		fprintf(fp, ",\"protocol\":");
+		print_json_string(fp, ll_proto_n2a(f_proto, b1, sizeof(b1)));
+		fprintf(fp, ",\"pref\":%u", TC_H_MAJ(t->tcm_info) >> 16);
+	}
+	fprintf(fp, ",\"kind\":");
+	print_json_string(fp, rta_getattr_str(tb[TCA_KIND]));
+	fprintf(fp, ",\"handle\":\"%x\"", t->tcm_handle);
+
+	q = get_filter_kind(RTA_DATA(tb[TCA_KIND]));
+	if (tb[TCA_OPTIONS] && q && json_text_open(&jt)) {
+		q->print_fopt(q, jt.fp, tb[TCA_OPTIONS], t->tcm_handle);
+		json_text_close(fp, "options", &jt);
+	}
+	print_tcstats_json(fp, tb[TCA_STATS2], tb[TCA_STATS], NULL);
+	fprintf(fp, "}\n");
+}
+
 int print_filter(const struct sockaddr_nl *who,
 			struct nlmsghdr *n,
 			void *arg)
@@ -210,6 +773,19 @@ int print_filter(const struct sockaddr_nl *who,
 		return -1;
 	}
 
+	if (filter_handle && filter_handle != t->tcm_handle)
+		return 0;
+
+	if (show_tlv) {
+		fwrite(n, n->nlmsg_len, 1, fp);
+		return 0;
+	}
+	if (show_json) {
+		print_filter_json(fp, n, t, tb);
+		fflush(fp);
+		return 0;
+	}
+
 	if (n->nlmsg_type == RTM_DELTFILTER)
 		fprintf(fp, "deleted ");
 
@@ -267,10 +843,13 @@ int tc_filter_list(int argc, char **argv)
 	__u32 prio = 0;
 	__u32 protocol = 0;
 	char *fhandle = NULL;
+	int ret;
 
 	memset(&t, 0, sizeof(t));
 	t.tcm_family = AF_UNSPEC;
 	memset(d, 0, sizeof(d));
+	/* Nothing is left from the last line of a batch */
+	filter_parent = filter_prio = filter_protocol = filter_handle = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -284,6 +863,16 @@ int tc_filter_list(int argc, char **argv)
 				return -1;
 			}
 			filter_parent = t.tcm_parent = TC_H_ROOT;
+		} else if (strcmp(*argv, "ingress") == 0 ||
+			   strcmp(*argv, "egress") == 0) {
+			if (t.tcm_parent) {
+				fprintf(stderr, "Error: \"%s\" is duplicate parent ID\n",
+					*argv);
+				return -1;
+			}
+			filter_parent = t.tcm_parent =
+				TC_H_MAKE(TC_H_CLSACT, *argv[0] == 'i' ?
+					  TC_H_MIN_INGRESS : TC_H_MIN_EGRESS);
 		} else if (strcmp(*argv, "parent") == 0) {
 			__u32 handle;
 			NEXT_ARG();
@@ -336,12 +925,25 @@ int tc_filter_list(int argc, char **argv)
 		filter_ifindex = t.tcm_ifindex;
 	}
 
+	/* A handle is kind-specific; the plain numbers of most kinds can
+	 * be asked for alone, the others keep being dumped in full.
+	 */
+	if (fhandle && get_u32(&filter_handle, fhandle, 16) == 0 &&
+	    filter_handle && t.tcm_ifindex && t.tcm_parent && prio) {
+		t.tcm_handle = filter_handle;
+		ret = tc_get_object(RTM_GETTFILTER, &t, print_filter);
+		if (ret <= 0)
+			return ret ? 1 : 0;
+		t.tcm_handle = 0;
+	}
+
  	if (rtnl_dump_request(&rth, RTM_GETTFILTER, &t, sizeof(t)) < 0) {
 		perror("Cannot send dump request");
 		return 1;
 	}
 
- 	if (rtnl_dump_filter(&rth, print_filter, stdout) < 0) {
+ 	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_filter,
+			     stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
@@ -368,6 +970,10 @@ int do_filter(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return tc_filter_list(argc-1, argv+1);
+	if (matches(*argv, "compile") == 0)
+		return tc_filter_compile(argc-1, argv+1);
+	if (matches(*argv, "swap") == 0)
+		return tc_filter_swap(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -20,6 +20,10 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <linux/if.h>
 #include "rt_names.h"
 #include "utils.h"
 #include "tc_util.h"
@@ -30,12 +34,347 @@ static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: tc monitor\n");
+	fprintf(stderr, "Usage: tc monitor [ file FILE ] [ rcvbuf SIZE ] [ coalesce MSECS ]\n");
+	fprintf(stderr, "                  [ dev DEV ] [ parent CLASSID | root ] [ kind KIND ]\n");
 	exit(-1);
 }
 
+/*
+ * "dev", "parent" and "kind" select events by their tcmsg header and
+ * TCA_KIND before anything is decoded.  Actions belong to no device,
+ * so they only pass a "kind" filter, which their first action must
+ * match.  Live, the checks on qdiscs, classes and filters are made in
+ * the kernel as well, by a socket filter.
+ */
+static struct
+{
+	int		ifindex;
+	int		parent_set;
+	__u32		parent;
+	const char	*kind;
+} mon_filter;
 
-int accept_tcmsg(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
+static struct rtattr *mon_find_attr(struct rtattr *rta, int len, int type)
+{
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+		if (rta->rta_type == type)
+			return rta;
+	return NULL;
+}
+
+static int mon_kind_match(const struct rtattr *kind)
+{
+	return kind && RTA_PAYLOAD(kind) > 0 &&
+		strncmp(RTA_DATA(kind), mon_filter.kind, RTA_PAYLOAD(kind)) == 0 &&
+		strlen(mon_filter.kind) < RTA_PAYLOAD(kind);
+}
+
+static int mon_accept_action(struct nlmsghdr *n)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tab, *act;
+
+	if (mon_filter.ifindex || mon_filter.parent_set)
+		return 0;
+	if (mon_filter.kind == NULL)
+		return 1;
+	if (len < 0)
+		return 0;
+	tab = mon_find_attr(TA_RTA(t), len, TCA_ACT_TAB);
+	if (tab == NULL || RTA_PAYLOAD(tab) < sizeof(struct rtattr))
+		return 0;
+	act = RTA_DATA(tab);
+	if (!RTA_OK(act, RTA_PAYLOAD(tab)))
+		return 0;
+	return mon_kind_match(mon_find_attr(RTA_DATA(act), RTA_PAYLOAD(act),
+					    TCA_ACT_KIND));
+}
+
+static int mon_accept(struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+
+	if (len < 0)
+		return 1;	/* let the printer complain */
+	if (mon_filter.ifindex && t->tcm_ifindex != mon_filter.ifindex)
+		return 0;
+	if (mon_filter.parent_set && t->tcm_parent != mon_filter.parent)
+		return 0;
+	if (mon_filter.kind &&
+	    !mon_kind_match(mon_find_attr(TCA_RTA(t), len, TCA_KIND)))
+		return 0;
+	return 1;
+}
+
+static void mon_kfilter(struct rtnl_handle *rth)
+{
+	static const __u16 types[] = {
+		RTM_NEWQDISC, RTM_NEWTCLASS, RTM_NEWTFILTER,
+	};
+	struct rtnl_kcheck c[3 * ARRAY_SIZE(types)], *p = c;
+	int i;
+
+	memset(c, 0, sizeof(c));
+	for (i = 0; i < ARRAY_SIZE(types); i++) {
+		if (mon_filter.ifindex) {
+			p->type = types[i];
+			p->offset = offsetof(struct tcmsg, tcm_ifindex);
+			p->size = 4;
+			p->value = mon_filter.ifindex;
+			p++;
+		}
+		if (mon_filter.parent_set) {
+			p->type = types[i];
+			p->offset = offsetof(struct tcmsg, tcm_parent);
+			p->size = 4;
+			p->value = mon_filter.parent;
+			p++;
+		}
+		if (mon_filter.kind) {
+			p->type = types[i];
+			p->hdrlen = sizeof(struct tcmsg);
+			p->attr = TCA_KIND;
+			p->str = mon_filter.kind;
+			p++;
+		}
+	}
+	if (rtnl_kfilter(rth, c, p - c) < 0)
+		fprintf(stderr, "Warning: events are filtered in user space\n");
+}
+
+/*
+ * "tc monitor coalesce MSECS" keeps only the latest message per qdisc,
+ * class and filter over a window of MSECS and prints what is left at
+ * the end of it, in the order the objects first changed, followed by
+ * the event rates of the window and the number of times the socket
+ * overflowed.  Actions and other messages are printed as they come.
+ */
+#define MON_HASH_MIN		256
+
+enum {
+	MON_QDISC, MON_CLASS, MON_FILTER, MON_OTHER, MON_MAX
+};
+
+static const char *mon_class_names[MON_MAX] = {
+	"qdisc", "class", "filter", "other"
+};
+
+struct mon_key
+{
+	__u32	class;
+	__u32	ifindex;
+	__u32	parent;
+	__u32	handle;
+	__u32	info;		/* priority and protocol of a filter */
+};
+
+struct mon_ent
+{
+	struct mon_ent	*hash_next;
+	struct mon_ent	*next;
+	struct mon_key	key;
+	struct nlmsghdr	*n;
+	int		size;
+};
+
+static struct
+{
+	unsigned		window;
+	struct timeval		start;
+	struct rtnl_handle	*rth;
+	struct mon_ent		**hash;
+	unsigned		size;
+	unsigned		count;
+	struct mon_ent		*head;
+	struct mon_ent		*last;
+	unsigned		events[MON_MAX];
+	__u64			overruns;
+} coal;
+
+/* Returns the class of n and fills key for the coalesced ones */
+static int mon_key(struct nlmsghdr *n, struct mon_key *key)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+
+	memset(key, 0, sizeof(*key));
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*t)))
+		return MON_OTHER;
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+		key->class = MON_QDISC;
+		break;
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+		key->class = MON_CLASS;
+		break;
+	case RTM_NEWTFILTER:
+	case RTM_DELTFILTER:
+		key->class = MON_FILTER;
+		key->info = t->tcm_info;
+		break;
+	default:
+		return MON_OTHER;
+	}
+	key->ifindex = t->tcm_ifindex;
+	key->parent = t->tcm_parent;
+	key->handle = t->tcm_handle;
+	return key->class;
+}
+
+static unsigned mon_hash(const struct mon_key *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	unsigned hash = 5381;
+	int i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash << 5) + hash + p[i];
+	return hash;
+}
+
+static void mon_free(void)
+{
+	struct mon_ent *e, *next;
+
+	for (e = coal.head; e; e = next) {
+		next = e->next;
+		free(e->n);
+		free(e);
+	}
+	free(coal.hash);
+	coal.hash = NULL;
+	coal.size = coal.count = 0;
+	coal.head = coal.last = NULL;
+}
+
+static int mon_grow(void)
+{
+	unsigned size = coal.size ? coal.size * 2 : MON_HASH_MIN;
+	struct mon_ent **hash, *e;
+
+	hash = calloc(size, sizeof(*hash));
+	if (hash == NULL)
+		return -1;
+	for (e = coal.head; e; e = e->next) {
+		unsigned h = mon_hash(&e->key) & (size - 1);
+
+		e->hash_next = hash[h];
+		hash[h] = e;
+	}
+	free(coal.hash);
+	coal.hash = hash;
+	coal.size = size;
+	return 0;
+}
+
+/* Stores a copy of n as the latest message of key */
+static int mon_store(const struct mon_key *key, const struct nlmsghdr *n)
+{
+	struct mon_ent *e = NULL;
+
+	if (coal.size)
+		for (e = coal.hash[mon_hash(key) & (coal.size - 1)]; e;
+		     e = e->hash_next)
+			if (memcmp(&e->key, key, sizeof(*key)) == 0)
+				break;
+	if (e == NULL) {
+		unsigned h;
+
+		if (coal.count >= coal.size && mon_grow() < 0)
+			goto oom;
+		e = calloc(1, sizeof(*e));
+		if (e == NULL)
+			goto oom;
+		e->key = *key;
+		h = mon_hash(key) & (coal.size - 1);
+		e->hash_next = coal.hash[h];
+		coal.hash[h] = e;
+		if (coal.last)
+			coal.last->next = e;
+		else
+			coal.head = e;
+		coal.last = e;
+		coal.count++;
+	}
+	if (e->size < n->nlmsg_len) {
+		void *p = realloc(e->n, n->nlmsg_len);
+
+		if (p == NULL)
+			goto oom;
+		e->n = p;
+		e->size = n->nlmsg_len;
+	}
+	memcpy(e->n, n, n->nlmsg_len);
+	return 0;
+oom:
+	perror("Cannot allocate memory");
+	return -1;
+}
+
+static int print_tcmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		       void *arg);
+
+static void coalesce_flush(FILE *fp, const struct timeval *now)
+{
+	struct mon_ent *e;
+	unsigned changes = coal.count;
+	__u64 overruns = coal.rth->rx_stats.overruns;
+	unsigned total = 0;
+	double secs;
+	int i, sep = 0;
+
+	for (e = coal.head; e; e = e->next)
+		print_tcmsg(NULL, e->n, fp);
+	mon_free();
+
+	for (i = 0; i < MON_MAX; i++)
+		total += coal.events[i];
+	if (total || overruns != coal.overruns) {
+		secs = (now->tv_sec - coal.start.tv_sec) +
+			(now->tv_usec - coal.start.tv_usec) / 1000000.;
+		if (secs <= 0)
+			secs = coal.window / 1000.;
+		fprintf(fp, "*** %u events, %u changes in %.3fs",
+			total, changes, secs);
+		for (i = 0; i < MON_MAX; i++) {
+			if (!coal.events[i])
+				continue;
+			fprintf(fp, "%s %s %.0f/s", sep++ ? "," : ":",
+				mon_class_names[i], coal.events[i] / secs);
+		}
+		if (overruns != coal.overruns)
+			fprintf(fp, "; %llu overruns, events lost",
+				(unsigned long long)(overruns - coal.overruns));
+		fprintf(fp, " ***\n");
+	}
+	fflush(fp);
+
+	memset(coal.events, 0, sizeof(coal.events));
+	coal.overruns = overruns;
+	coal.start = *now;
+}
+
+static void coalesce_tick(FILE *fp)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	if ((now.tv_sec - coal.start.tv_sec) * 1000 +
+	    (now.tv_usec - coal.start.tv_usec) / 1000 >= coal.window)
+		coalesce_flush(fp, &now);
+}
+
+static int coalesce_idle(void *arg)
+{
+	coalesce_tick(arg);
+	return 0;
+}
+
+static int print_tcmsg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		       void *arg)
 {
 	FILE *fp = (FILE*)arg;
 
@@ -45,35 +384,114 @@ int accept_tcmsg(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 	}
 	if (n->nlmsg_type == RTM_NEWTCLASS || n->nlmsg_type == RTM_DELTCLASS) {
 		print_class(who, n, arg);
+		fflush(fp);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_NEWQDISC || n->nlmsg_type == RTM_DELQDISC) {
 		print_qdisc(who, n, arg);
+		fflush(fp);
+		return 0;
+	}
+	if (n->nlmsg_type == RTM_NEWLINK || n->nlmsg_type == RTM_DELLINK) {
+		ll_remember_index(who, n, NULL);
 		return 0;
 	}
 	if (n->nlmsg_type == RTM_GETACTION || n->nlmsg_type == RTM_NEWACTION ||
 	    n->nlmsg_type == RTM_DELACTION) {
 		print_action(who, n, arg);
+		fflush(fp);
 		return 0;
 	}
 	if (n->nlmsg_type != NLMSG_ERROR && n->nlmsg_type != NLMSG_NOOP &&
 	    n->nlmsg_type != NLMSG_DONE) {
 		fprintf(fp, "Unknown message: length %08d type %08x flags %08x\n",
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
+		fflush(fp);
 	}
 	return 0;
 }
 
+int accept_tcmsg(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
+{
+	struct mon_key key;
+	int class;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		ll_remember_index(who, n, NULL);
+		return 0;
+	case RTM_GETACTION:
+	case RTM_NEWACTION:
+	case RTM_DELACTION:
+		if (!mon_accept_action(n))
+			return 0;
+		break;
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+	case RTM_NEWTFILTER:
+	case RTM_DELTFILTER:
+		if (!mon_accept(n))
+			return 0;
+		break;
+	}
+
+	if (!coal.window)
+		return print_tcmsg(who, n, arg);
+
+	class = mon_key(n, &key);
+	coal.events[class]++;
+	if (class == MON_OTHER)
+		print_tcmsg(who, n, arg);
+	else if (mon_store(&key, n) < 0)
+		return -1;
+	coalesce_tick(arg);
+	return 0;
+}
+
 int do_tcmonitor(int argc, char **argv)
 {
 	struct rtnl_handle rth;
 	char *file = NULL;
+	char *dev = NULL;
 	unsigned groups = nl_mgrp(RTNLGRP_TC);
+	unsigned window = 0;
+	unsigned size = 0;
 
+	memset(&mon_filter, 0, sizeof(mon_filter));
 	while (argc > 0) {
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (matches(*argv, "coalesce") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&window, *argv, 0) || window == 0)
+				invarg("invalid \"coalesce\" window\n", *argv);
+		} else if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			dev = *argv;
+		} else if (strcmp(*argv, "root") == 0) {
+			if (mon_filter.parent_set)
+				duparg("parent", *argv);
+			mon_filter.parent = TC_H_ROOT;
+			mon_filter.parent_set = 1;
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (mon_filter.parent_set)
+				duparg("parent", *argv);
+			if (get_tc_classid(&mon_filter.parent, *argv))
+				invarg("invalid parent ID", *argv);
+			mon_filter.parent_set = 1;
+		} else if (strcmp(*argv, "kind") == 0) {
+			NEXT_ARG();
+			mon_filter.kind = *argv;
+		} else if (strcmp(*argv, "rcvbuf") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&size, *argv, 0) || size == 0 ||
+			    size > INT_MAX)
+				invarg("invalid \"rcvbuf\" size\n", *argv);
 		} else {
 			if (matches(*argv, "help") == 0) {
 				usage();
@@ -85,6 +503,11 @@ int do_tcmonitor(int argc, char **argv)
 		argc--;	argv++;
 	}
 
+	if (file && window) {
+		fprintf(stderr, "\"coalesce\" cannot be used with \"file\"\n");
+		exit(-1);
+	}
+
 	if (file) {
 		FILE *fp;
 		fp = fopen(file, "r");
@@ -92,13 +515,43 @@ int do_tcmonitor(int argc, char **argv)
 			perror("Cannot fopen");
 			exit(-1);
 		}
+		if (dev) {
+			if (rtnl_open(&rth, 0) < 0)
+				exit(1);
+			ll_init_map(&rth);
+			rtnl_close(&rth);
+			if ((mon_filter.ifindex = ll_name_to_index(dev)) == 0) {
+				fprintf(stderr, "Cannot find device \"%s\"\n", dev);
+				exit(1);
+			}
+		}
 		return rtnl_from_file(fp, accept_tcmsg, (void*)stdout);
 	}
 
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
+	if (size && rtnl_rcvbuf(&rth, size) < 0)
+		exit(1);
+	if (show_stats)
+		fprintf(stderr, "Receive buffer: %d bytes\n", rth.rcvbuf);
 
 	ll_init_map(&rth);
+	ll_map_subscribe(&rth);
+	if (dev && (mon_filter.ifindex = ll_name_to_index(dev)) == 0) {
+		fprintf(stderr, "Cannot find device \"%s\"\n", dev);
+		exit(1);
+	}
+	rth.batch = RTNL_DEFAULT_BATCH;
+	rtnl_rx_ring_setup(&rth, RTNL_RX_FRAME_SIZE, RTNL_RX_FRAME_NR);
+	mon_kfilter(&rth);
+
+	if (window) {
+		coal.window = window;
+		coal.rth = &rth;
+		gettimeofday(&coal.start, NULL);
+		rth.idle = coalesce_idle;
+		rth.idle_timeout = window;
+	}
 
 	if (rtnl_listen(&rth, accept_tcmsg, (void*)stdout) < 0) {
 		rtnl_close(&rth);
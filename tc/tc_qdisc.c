@@ -31,19 +31,133 @@ static int usage(void);
 static int usage(void)
 {
 	fprintf(stderr, "Usage: tc qdisc [ add | del | replace | change | show ] dev STRING\n");
-	fprintf(stderr, "       [ handle QHANDLE ] [ root | ingress | parent CLASSID ]\n");
+	fprintf(stderr, "       [ handle QHANDLE ] [ root | ingress | clsact | parent CLASSID |\n");
+	fprintf(stderr, "                            perqueue QHANDLE ]\n");
 	fprintf(stderr, "       [ estimator INTERVAL TIME_CONSTANT ]\n");
 	fprintf(stderr, "       [ stab [ help | STAB_OPTIONS] ]\n");
 	fprintf(stderr, "       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "       tc qdisc show [ dev STRING ] [ingress]\n");
+	fprintf(stderr, "       tc qdisc show dev STRING [ root | ingress | parent CLASSID ]\n");
+	fprintf(stderr, "       handle QHANDLE\n");
+	fprintf(stderr, "       tc qdisc show dev STRING queues [ sort SORT_KEY ] [ top N ]\n");
 	fprintf(stderr, "Where:\n");
 	fprintf(stderr, "QDISC_KIND := { [p|b]fifo | tbf | prio | cbq | red | etc. }\n");
 	fprintf(stderr, "OPTIONS := ... try tc qdisc add <desired QDISC_KIND> help\n");
 	fprintf(stderr, "STAB_OPTIONS := ... try tc qdisc add stab help\n");
+	fprintf(stderr, "perqueue applies the command under every class of QHANDLE,\n");
+	fprintf(stderr, "e.g. each TX queue of mq or mqprio or each band of multiq.\n");
+	fprintf(stderr, "SORT_KEY := { drops | backlog | requeues | qlen }\n");
 	return -1;
 }
 
+/* The classes of the qdisc "perqueue" names */
+struct perqueue_list
+{
+	__u32		major;
+	int		n;
+	int		max;
+	__u32		*classid;
+};
+
+static int perqueue_collect(const struct sockaddr_nl *who,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct perqueue_list *l = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+
+	if (n->nlmsg_type != RTM_NEWTCLASS ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*t)) ||
+	    TC_H_MAJ(t->tcm_handle) != l->major || !TC_H_MIN(t->tcm_handle))
+		return 0;
+
+	if (l->n == l->max) {
+		int max = l->max ? l->max * 2 : 64;
+		__u32 *c = realloc(l->classid, max * sizeof(*c));
+
+		if (c == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		l->classid = c;
+		l->max = max;
+	}
+	l->classid[l->n++] = t->tcm_handle;
+	return 0;
+}
+
+static int perqueue_cmp(const void *a, const void *b)
+{
+	__u32 x = *(const __u32 *)a, y = *(const __u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * One request per class of the qdisc, with the options parsed once; a
+ * handle given becomes the first of consecutive majors.
+ */
+static int tc_qdisc_perqueue(struct nlmsghdr *n, __u32 qhandle)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct perqueue_list l;
+	struct tcmsg dt;
+	__u32 handle = t->tcm_handle;
+	int i, own_pipe = 0, err = 0;
+
+	memset(&l, 0, sizeof(l));
+	l.major = TC_H_MAJ(qhandle);
+
+	memset(&dt, 0, sizeof(dt));
+	dt.tcm_family = AF_UNSPEC;
+	dt.tcm_ifindex = t->tcm_ifindex;
+	if (rtnl_dump_request(&rth, RTM_GETTCLASS, &dt, sizeof(dt)) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+	if (rtnl_dump_filter(&rth, perqueue_collect, &l) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		free(l.classid);
+		return 1;
+	}
+	if (l.n == 0) {
+		fprintf(stderr, "Qdisc %x: has no classes\n", l.major >> 16);
+		return 1;
+	}
+	if (handle && (handle >> 16) + l.n - 1 >= 0xFFFF) {
+		fprintf(stderr, "Not enough handles after %x: for %d queues\n",
+			handle >> 16, l.n);
+		free(l.classid);
+		return 1;
+	}
+	qsort(l.classid, l.n, sizeof(*l.classid), perqueue_cmp);
+
+	if (rth.pipe == NULL) {
+		if (rtnl_pipeline_open(&rth, batch_window ? batch_window : 64,
+				       NULL, NULL) < 0) {
+			fprintf(stderr, "Cannot set up request pipeline\n");
+			free(l.classid);
+			return 1;
+		}
+		own_pipe = 1;
+	}
+
+	for (i = 0; i < l.n && !err; i++) {
+		t->tcm_parent = l.classid[i];
+		if (handle)
+			t->tcm_handle = handle + (i << 16);
+		if (rtnl_talk(&rth, n, 0, 0, NULL) < 0)
+			err = 1;
+	}
+	if (rtnl_pipeline_sync(&rth))
+		err = 1;
+	if (own_pipe)
+		rtnl_pipeline_close(&rth);
+
+	free(l.classid);
+	return err ? 2 : 0;
+}
+
 int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 {
 	struct qdisc_util *q = NULL;
@@ -54,6 +168,7 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 	} stab;
 	char  d[16];
 	char  k[16];
+	__u32 perqueue = 0;
 	struct {
 		struct nlmsghdr 	n;
 		struct tcmsg 		t;
@@ -86,14 +201,14 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 				invarg(*argv, "invalid qdisc ID");
 			req.t.tcm_handle = handle;
 		} else if (strcmp(*argv, "root") == 0) {
-			if (req.t.tcm_parent) {
+			if (req.t.tcm_parent || perqueue) {
 				fprintf(stderr, "Error: \"root\" is duplicate parent ID\n");
 				return -1;
 			}
 			req.t.tcm_parent = TC_H_ROOT;
 #ifdef TC_H_INGRESS
 		} else if (strcmp(*argv, "ingress") == 0) {
-			if (req.t.tcm_parent) {
+			if (req.t.tcm_parent || perqueue) {
 				fprintf(stderr, "Error: \"ingress\" is a duplicate parent ID\n");
 				return -1;
 			}
@@ -102,17 +217,35 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 			q = get_qdisc_kind(k);
 			req.t.tcm_handle = 0xffff0000;
 
+			argc--; argv++;
+			break;
+		} else if (strcmp(*argv, "clsact") == 0) {
+			if (req.t.tcm_parent || perqueue) {
+				fprintf(stderr, "Error: \"clsact\" is a duplicate parent ID\n");
+				return -1;
+			}
+			req.t.tcm_parent = TC_H_CLSACT;
+			strncpy(k, "clsact", sizeof(k)-1);
+			q = get_qdisc_kind(k);
+			req.t.tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0);
+
 			argc--; argv++;
 			break;
 #endif
 		} else if (strcmp(*argv, "parent") == 0) {
 			__u32 handle;
 			NEXT_ARG();
-			if (req.t.tcm_parent)
+			if (req.t.tcm_parent || perqueue)
 				duparg("parent", *argv);
 			if (get_tc_classid(&handle, *argv))
 				invarg(*argv, "invalid parent ID");
 			req.t.tcm_parent = handle;
+		} else if (strcmp(*argv, "perqueue") == 0) {
+			NEXT_ARG();
+			if (req.t.tcm_parent || perqueue)
+				duparg("perqueue", *argv);
+			if (get_qdisc_handle(&perqueue, *argv) || !perqueue)
+				invarg(*argv, "invalid qdisc ID");
 		} else if (matches(*argv, "estimator") == 0) {
 			if (parse_estimator(&argc, &argv, &est))
 				return -1;
@@ -170,8 +303,6 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 			addattr_l(&req.n, sizeof(req), TCA_STAB_DATA, stab.data,
 				  stab.szopts.tsize * sizeof(__u16));
 		tail->rta_len = (void *)NLMSG_TAIL(&req.n) - (void *)tail;
-		if (stab.data)
-			free(stab.data);
 	}
 
 	if (d[0])  {
@@ -186,6 +317,14 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 		req.t.tcm_ifindex = idx;
 	}
 
+	if (perqueue) {
+		if (!d[0]) {
+			fprintf(stderr, "\"perqueue\" needs a device\n");
+			return 1;
+		}
+		return tc_qdisc_perqueue(&req.n, perqueue);
+	}
+
 	if (rtnl_talk(&rth, &req.n, 0, 0, NULL) < 0)
 		return 2;
 
@@ -193,6 +332,56 @@ int tc_qdisc_modify(int cmd, unsigned flags, int argc, char **argv)
 }
 
 static int filter_ifindex;
+static __u32 filter_handle;
+
+RTATTR_TABLE(qdisc_tb, TCA_MAX);
+
+/* One line of plain numbers per qdisc, as for classes */
+static void print_qdisc_counters(FILE *fp, struct tcmsg *t, struct rtattr *tb[])
+{
+	char abuf[64];
+
+	print_tc_classid(abuf, sizeof(abuf), t->tcm_parent);
+	fprintf(fp, "qdisc %s %x: %s %s ", ll_index_to_name(t->tcm_ifindex),
+		t->tcm_handle>>16, abuf, rta_getattr_str(tb[TCA_KIND]));
+	print_tcstats_counters(fp, tb);
+	fprintf(fp, "\n");
+}
+
+static void print_qdisc_json(FILE *fp, struct nlmsghdr *n, struct tcmsg *t,
+			     struct rtattr *tb[])
+{
+	struct qdisc_util *q;
+	struct json_text jt;
+	char abuf[64];
+
+	fprintf(fp, "{\"object\":\"qdisc\"");
+	if (n->nlmsg_type == RTM_DELQDISC)
+		fprintf(fp, ",\"deleted\":true");
+	fprintf(fp, ",\"dev\":");
+	print_json_string(fp, ll_index_to_name(t->tcm_ifindex));
+	fprintf(fp, ",\"kind\":");
+	print_json_string(fp, rta_getattr_str(tb[TCA_KIND]));
+	fprintf(fp, ",\"handle\":\"%x:\",\"parent\":", t->tcm_handle >> 16);
+	if (t->tcm_parent == TC_H_ROOT)
+		strcpy(abuf, "root");
+	else
+		print_tc_classid(abuf, sizeof(abuf), t->tcm_parent);
+	print_json_string(fp, abuf);
+	fprintf(fp, ",\"refcnt\":%u", t->tcm_info);
+
+	if (strcmp("pfifo_fast", RTA_DATA(tb[TCA_KIND])) == 0)
+		q = get_qdisc_kind("prio");
+	else
+		q = get_qdisc_kind(RTA_DATA(tb[TCA_KIND]));
+	if (tb[TCA_OPTIONS] && q && json_text_open(&jt)) {
+		q->print_qopt(q, jt.fp, tb[TCA_OPTIONS]);
+		json_text_close(fp, "options", &jt);
+	}
+	print_tcstats_json(fp, tb[TCA_STATS2], tb[TCA_STATS], tb[TCA_XSTATS]);
+	print_xstats_json(fp, q, tb[TCA_STATS2], tb[TCA_XSTATS]);
+	fprintf(fp, "}\n");
+}
 
 int print_qdisc(const struct sockaddr_nl *who,
 		       struct nlmsghdr *n,
@@ -201,7 +390,7 @@ int print_qdisc(const struct sockaddr_nl *who,
 	FILE *fp = (FILE*)arg;
 	struct tcmsg *t = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr * tb[TCA_MAX+1];
+	struct rtattr **tb;
 	struct qdisc_util *q;
 	char abuf[256];
 
@@ -217,15 +406,29 @@ int print_qdisc(const struct sockaddr_nl *who,
 
 	if (filter_ifindex && filter_ifindex != t->tcm_ifindex)
 		return 0;
+	if (filter_handle && filter_handle != t->tcm_handle)
+		return 0;
 
-	memset(tb, 0, sizeof(tb));
-	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	tb = parse_rtattr_table(&qdisc_tb, TCA_RTA(t), len);
 
 	if (tb[TCA_KIND] == NULL) {
 		fprintf(stderr, "print_qdisc: NULL kind\n");
 		return -1;
 	}
 
+	if (show_counters) {
+		print_qdisc_counters(fp, t, tb);
+		return 0;
+	}
+	if (show_tlv) {
+		print_tcmsg_tlv(fp, n, tb);
+		return 0;
+	}
+	if (show_json) {
+		print_qdisc_json(fp, n, t, tb);
+		return 0;
+	}
+
 	if (n->nlmsg_type == RTM_DELQDISC)
 		fprintf(fp, "deleted ");
 
@@ -272,19 +475,200 @@ int print_qdisc(const struct sockaddr_nl *who,
 			fprintf(fp, "\n");
 		}
 	}
-	fflush(fp);
 	return 0;
 }
 
 
+/*
+ * "show dev DEV queues": the qdiscs directly below the root qdisc, such
+ * as the one of each TX queue of mq or mqprio, as a table collected in
+ * a single dump.
+ */
+enum {
+	QSORT_PARENT,
+	QSORT_DROPS,
+	QSORT_BACKLOG,
+	QSORT_REQUEUES,
+	QSORT_QLEN,
+};
+
+struct queue_stat
+{
+	__u32			handle;
+	__u32			parent;
+	char			kind[16];
+	struct gnet_stats_basic	bs;
+	struct gnet_stats_queue	q;
+};
+
+struct queue_list
+{
+	__u32			root;
+	int			have_root;
+	char			root_kind[16];
+	int			n;
+	int			max;
+	struct queue_stat	*qs;
+};
+
+static int queue_sort;
+
+static int queues_collect(const struct sockaddr_nl *who,
+			  struct nlmsghdr *n, void *arg)
+{
+	struct queue_list *l = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct gnet_stats_rate_est re;
+	struct queue_stat *qs;
+	struct rtattr **tb;
+	struct rtattr *app;
+
+	if (n->nlmsg_type != RTM_NEWQDISC || len < 0 ||
+	    t->tcm_ifindex != filter_ifindex)
+		return 0;
+
+	tb = parse_rtattr_table(&qdisc_tb, TCA_RTA(t), len);
+	if (tb[TCA_KIND] == NULL)
+		return 0;
+
+	if (t->tcm_parent == TC_H_ROOT) {
+		l->root = TC_H_MAJ(t->tcm_handle);
+		l->have_root = 1;
+		strncpy(l->root_kind, rta_getattr_str(tb[TCA_KIND]),
+			sizeof(l->root_kind) - 1);
+		return 0;
+	}
+	if (t->tcm_parent == TC_H_INGRESS || TC_H_MIN(t->tcm_parent) == 0)
+		return 0;
+
+	if (l->n == l->max) {
+		int max = l->max ? l->max * 2 : 64;
+
+		qs = realloc(l->qs, max * sizeof(*qs));
+		if (qs == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		l->qs = qs;
+		l->max = max;
+	}
+
+	qs = &l->qs[l->n++];
+	memset(qs, 0, sizeof(*qs));
+	qs->handle = t->tcm_handle;
+	qs->parent = t->tcm_parent;
+	strncpy(qs->kind, rta_getattr_str(tb[TCA_KIND]), sizeof(qs->kind) - 1);
+	tcstats_collect(tb[TCA_STATS2], tb[TCA_STATS], &qs->bs, &qs->q, &re,
+			&app);
+	return 0;
+}
+
+static __u32 queue_key(const struct queue_stat *qs)
+{
+	switch (queue_sort) {
+	case QSORT_DROPS:
+		return qs->q.drops;
+	case QSORT_BACKLOG:
+		return qs->q.backlog;
+	case QSORT_REQUEUES:
+		return qs->q.requeues;
+	case QSORT_QLEN:
+		return qs->q.qlen;
+	}
+	return 0;
+}
+
+/* Largest key first, then by parent class */
+static int queue_cmp(const void *a, const void *b)
+{
+	const struct queue_stat *x = a, *y = b;
+	__u32 kx = queue_key(x), ky = queue_key(y);
+
+	if (kx != ky)
+		return kx > ky ? -1 : 1;
+	return x->parent < y->parent ? -1 : x->parent > y->parent;
+}
+
+static void print_queue_stat(const char *parent, const char *handle,
+			     const char *kind, const struct queue_stat *qs)
+{
+	printf("%-10s %-10s %-10s %14llu %10u %8u %10u %8u %10u %6u\n",
+	       parent, handle, kind,
+	       (unsigned long long)qs->bs.bytes, qs->bs.packets,
+	       qs->q.drops, qs->q.overlimits, qs->q.requeues,
+	       qs->q.backlog, qs->q.qlen);
+}
+
+static int tc_qdisc_queues(struct tcmsg *t, unsigned int top)
+{
+	struct queue_list l;
+	struct queue_stat sum;
+	char abuf[64], hbuf[16];
+	int i, n;
+
+	memset(&l, 0, sizeof(l));
+	if (rtnl_dump_request(&rth, RTM_GETQDISC, t, sizeof(*t)) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+	if (rtnl_dump_filter(&rth, queues_collect, &l) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		free(l.qs);
+		return 1;
+	}
+
+	/* The root may be dumped after its children */
+	for (i = n = 0; i < l.n; i++)
+		if (l.have_root && TC_H_MAJ(l.qs[i].parent) == l.root)
+			l.qs[n++] = l.qs[i];
+	if (n == 0) {
+		fprintf(stderr, "No qdiscs below the root qdisc of \"%s\"\n",
+			ll_index_to_name(filter_ifindex));
+		free(l.qs);
+		return 1;
+	}
+	qsort(l.qs, n, sizeof(*l.qs), queue_cmp);
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < n; i++) {
+		sum.bs.bytes += l.qs[i].bs.bytes;
+		sum.bs.packets += l.qs[i].bs.packets;
+		sum.q.drops += l.qs[i].q.drops;
+		sum.q.overlimits += l.qs[i].q.overlimits;
+		sum.q.requeues += l.qs[i].q.requeues;
+		sum.q.backlog += l.qs[i].q.backlog;
+		sum.q.qlen += l.qs[i].q.qlen;
+	}
+
+	printf("%-10s %-10s %-10s %14s %10s %8s %10s %8s %10s %6s\n",
+	       "parent", "qdisc", "kind", "bytes", "packets", "drops",
+	       "overlimits", "requeues", "backlog", "qlen");
+	for (i = 0; i < n && (top == 0 || i < top); i++) {
+		print_tc_classid(abuf, sizeof(abuf), l.qs[i].parent);
+		snprintf(hbuf, sizeof(hbuf), "%x:", l.qs[i].handle >> 16);
+		print_queue_stat(abuf, hbuf, l.qs[i].kind, &l.qs[i]);
+	}
+	/* The total is over all children, not just the top ones */
+	snprintf(hbuf, sizeof(hbuf), "%x:", l.root >> 16);
+	print_queue_stat("total", hbuf, l.root_kind, &sum);
+
+	free(l.qs);
+	fflush(stdout);
+	return 0;
+}
+
 int tc_qdisc_list(int argc, char **argv)
 {
 	struct tcmsg t;
 	char d[16];
+	unsigned int top = 0;
+	int queues = 0;
 
 	memset(&t, 0, sizeof(t));
 	t.tcm_family = AF_UNSPEC;
 	memset(&d, 0, sizeof(d));
+	filter_handle = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -298,6 +682,48 @@ int tc_qdisc_list(int argc, char **argv)
                              }
                              t.tcm_parent = TC_H_INGRESS;
 #endif
+		} else if (strcmp(*argv, "root") == 0) {
+			if (t.tcm_parent) {
+				fprintf(stderr, "Duplicate parent ID\n");
+				usage();
+			}
+			t.tcm_parent = TC_H_ROOT;
+		} else if (strcmp(*argv, "parent") == 0) {
+			__u32 handle;
+			NEXT_ARG();
+			if (t.tcm_parent)
+				duparg("parent", *argv);
+			if (get_tc_classid(&handle, *argv))
+				invarg(*argv, "invalid parent ID");
+			t.tcm_parent = handle;
+		} else if (strcmp(*argv, "handle") == 0) {
+			__u32 handle;
+			NEXT_ARG();
+			if (t.tcm_handle)
+				duparg("handle", *argv);
+			if (get_qdisc_handle(&handle, *argv) || !handle)
+				invarg(*argv, "invalid qdisc ID");
+			filter_handle = t.tcm_handle = handle;
+		} else if (strcmp(*argv, "queues") == 0) {
+			queues = 1;
+		} else if (strcmp(*argv, "sort") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "drops") == 0)
+				queue_sort = QSORT_DROPS;
+			else if (strcmp(*argv, "backlog") == 0)
+				queue_sort = QSORT_BACKLOG;
+			else if (strcmp(*argv, "requeues") == 0)
+				queue_sort = QSORT_REQUEUES;
+			else if (strcmp(*argv, "qlen") == 0)
+				queue_sort = QSORT_QLEN;
+			else
+				invarg("sort key is invalid\n", *argv);
+			queues = 1;
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0) || top == 0)
+				invarg("\"top\" needs a positive number\n", *argv);
+			queues = 1;
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 		} else {
@@ -318,15 +744,44 @@ int tc_qdisc_list(int argc, char **argv)
 		filter_ifindex = t.tcm_ifindex;
 	}
 
+	if (queues) {
+		if (!filter_ifindex) {
+			fprintf(stderr, "\"queues\" needs a \"dev\"\n");
+			return -1;
+		}
+		return tc_qdisc_queues(&t, top);
+	}
+
+	/* One qdisc is asked for alone.  The kernel answers with the
+	 * parent it was asked for, so without one the device is dumped.
+	 */
+	if (t.tcm_handle) {
+		int ret;
+
+		if (!filter_ifindex) {
+			fprintf(stderr, "\"handle\" needs a \"dev\"\n");
+			return -1;
+		}
+		if (!t.tcm_parent)
+			goto dump;
+		ret = tc_get_object(RTM_GETQDISC, &t, print_qdisc);
+		if (ret <= 0)
+			return ret ? 1 : 0;
+		t.tcm_handle = 0;
+	}
+
+dump:
  	if (rtnl_dump_request(&rth, RTM_GETQDISC, &t, sizeof(t)) < 0) {
 		perror("Cannot send dump request");
 		return 1;
 	}
 
- 	if (rtnl_dump_filter(&rth, print_qdisc, stdout) < 0) {
+ 	if (rtnl_dump_filter(&rth, dump_capture ? rtnl_to_file : print_qdisc,
+			     stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
+	fflush(stdout);
 
 	return 0;
 }
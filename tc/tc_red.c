@@ -20,8 +20,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <pthread.h>
 
+#include "utils.h"
 #include "tc_core.h"
+#include "tc_util.h"
 #include "tc_red.h"
 
 /*
@@ -96,3 +99,395 @@ int tc_red_eval_idle_damping(int Wlog, unsigned avpkt, unsigned bps, __u8 *sbuf)
 	sbuf[255] = 31;
 	return clog;
 }
+
+/*
+ * Parameter search for target delay.  Each candidate (min, max,
+ * probability) runs a discrete event simulation: t->flows window based
+ * senders with a base round trip of t->rtt share a link of t->rate bytes
+ * per second through a RED queue of t->limit bytes, with packets of
+ * avpkt bytes.  A sender grows its window by one packet per round trip
+ * (doubling it in slow start) and halves it at most once per round trip
+ * when a packet is dropped.  The queue keeps its average like the
+ * kernel, the idle decay included.  All candidates see the same random
+ * numbers and run in parallel, one thread per CPU.  Of those with a mean
+ * queueing delay within t->target the one with the best utilization
+ * wins, a lower drop rate breaking near ties; if none meets the target
+ * the one with the lowest delay is taken.
+ */
+#define TUNE_RATIOS	3
+#define TUNE_PROBS	5
+#define TUNE_MINS	7
+#define TUNE_NR		(TUNE_MINS * TUNE_RATIOS * TUNE_PROBS)
+#define TUNE_PKTS	300000
+
+static const double tune_min[TUNE_MINS] = { 0.2, 0.3, 0.5, 0.75, 1, 1.5, 2 };
+static const double tune_ratio[TUNE_RATIOS] = { 2, 3, 4 };
+static const double tune_prob[TUNE_PROBS] = { 0.01, 0.02, 0.05, 0.1, 0.2 };
+
+struct tune_event
+{
+	double		time;
+	int		flow;
+	int		lost;
+};
+
+struct tune_flow
+{
+	double		cwnd;
+	double		ssthresh;
+	double		recover;	/* no further halving before this */
+	int		inflight;
+};
+
+struct tune_run
+{
+	const struct tc_red_tune *t;
+	unsigned	qth_min;
+	unsigned	qth_max;
+	double		probability;
+	int		valid;
+	double		delay;
+	double		util;
+	double		drops;
+};
+
+struct tune_sim
+{
+	const struct tc_red_tune *t;
+	double		xmit;		/* seconds per packet */
+	double		W;
+	double		qmin, qmax, max_p;
+	double		avg;
+	int		count;
+	__u64		rnd;
+	/* departure times of the queued packets, a ring */
+	double		*dep;
+	unsigned	size, head, qlen;
+	double		last_dep;
+	/* events, a binary heap on time */
+	struct tune_event *ev;
+	unsigned	nev, maxev;
+	struct tune_flow *flow;
+	/* measurement */
+	double		start, end;
+	double		delay_sum;
+	unsigned long	arrived, dropped, delivered;
+};
+
+static double tune_random(struct tune_sim *s)
+{
+	s->rnd ^= s->rnd << 13;
+	s->rnd ^= s->rnd >> 7;
+	s->rnd ^= s->rnd << 17;
+	return (s->rnd >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int tune_push(struct tune_sim *s, double time, int flow, int lost)
+{
+	unsigned i;
+
+	if (s->nev == s->maxev) {
+		unsigned max = s->maxev ? s->maxev * 2 : 1024;
+		struct tune_event *ev = realloc(s->ev, max * sizeof(*ev));
+
+		if (ev == NULL)
+			return -1;
+		s->ev = ev;
+		s->maxev = max;
+	}
+	for (i = s->nev++; i > 0 && s->ev[(i - 1) / 2].time > time;
+	     i = (i - 1) / 2)
+		s->ev[i] = s->ev[(i - 1) / 2];
+	s->ev[i].time = time;
+	s->ev[i].flow = flow;
+	s->ev[i].lost = lost;
+	return 0;
+}
+
+static struct tune_event tune_pop(struct tune_sim *s)
+{
+	struct tune_event top = s->ev[0], last = s->ev[--s->nev];
+	unsigned i = 0, c;
+
+	while ((c = 2 * i + 1) < s->nev) {
+		if (c + 1 < s->nev && s->ev[c + 1].time < s->ev[c].time)
+			c++;
+		if (s->ev[c].time >= last.time)
+			break;
+		s->ev[i] = s->ev[c];
+		i = c;
+	}
+	s->ev[i] = last;
+	return top;
+}
+
+/* One packet of flow f arrives at the queue at time now */
+static int tune_enqueue(struct tune_sim *s, int f, double now)
+{
+	const struct tc_red_tune *t = s->t;
+	int measure = now >= s->start;
+	double backlog, dep;
+	int drop = 0;
+
+	while (s->qlen && s->dep[s->head] <= now) {
+		s->head = (s->head + 1) % s->size;
+		s->qlen--;
+	}
+	backlog = (double)s->qlen * t->avpkt;
+
+	if (s->qlen == 0 && now > s->last_dep)
+		s->avg *= pow(1 - s->W, (now - s->last_dep) / s->xmit);
+	else
+		s->avg += s->W * (backlog - s->avg);
+
+	if (s->avg < s->qmin) {
+		s->count = -1;
+	} else if (s->avg >= s->qmax) {
+		s->count = -1;
+		drop = 1;
+	} else {
+		double pb = s->max_p * (s->avg - s->qmin) / (s->qmax - s->qmin);
+		double pa;
+
+		s->count++;
+		pa = s->count * pb < 1 ? pb / (1 - s->count * pb) : 1;
+		if (tune_random(s) < pa) {
+			s->count = 0;
+			drop = 1;
+		}
+	}
+	if (backlog + t->avpkt > t->limit || s->qlen == s->size)
+		drop = 1;
+
+	if (measure)
+		s->arrived++;
+	if (drop) {
+		if (measure)
+			s->dropped++;
+		return tune_push(s, now + t->rtt / 1e6, f, 1);
+	}
+
+	dep = (now > s->last_dep ? now : s->last_dep) + s->xmit;
+	s->last_dep = dep;
+	s->dep[(s->head + s->qlen++) % s->size] = dep;
+	if (measure) {
+		s->delay_sum += dep - now - s->xmit;
+		if (dep <= s->end)
+			s->delivered++;
+	}
+	return tune_push(s, dep + t->rtt / 1e6, f, 0);
+}
+
+static int tune_send(struct tune_sim *s, int f, double now)
+{
+	struct tune_flow *fl = &s->flow[f];
+
+	while (fl->inflight < (int)fl->cwnd) {
+		fl->inflight++;
+		if (tune_enqueue(s, f, now) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void tune_simulate(struct tune_run *r)
+{
+	const struct tc_red_tune *t = r->t;
+	struct tune_sim s;
+	unsigned burst = (2 * r->qth_min + r->qth_max) / (3 * t->avpkt);
+	double now = 0;
+	int wlog, i;
+
+	memset(&s, 0, sizeof(s));
+	s.t = t;
+	s.xmit = (double)t->avpkt / t->rate;
+	s.qmin = r->qth_min;
+	s.qmax = r->qth_max;
+	s.max_p = r->probability;
+	s.rnd = 0x9e3779b97f4a7c15ULL;
+
+	wlog = tc_red_eval_ewma(r->qth_min, burst, t->avpkt);
+	if (wlog < 0 || tc_red_eval_P(r->qth_min, r->qth_max,
+				      r->probability) < 0)
+		return;
+	s.W = 1.0 / (1 << wlog);
+
+	/* Long enough for the windows to settle, a quarter of warm up */
+	s.end = TUNE_PKTS * s.xmit;
+	if (s.end < 200 * t->rtt / 1e6)
+		s.end = 200 * t->rtt / 1e6;
+	s.start = s.end / 4;
+
+	s.size = t->limit / t->avpkt + 1;
+	s.dep = malloc(s.size * sizeof(*s.dep));
+	s.flow = calloc(t->flows, sizeof(*s.flow));
+	if (s.dep == NULL || s.flow == NULL)
+		goto out;
+
+	for (i = 0; i < t->flows; i++) {
+		s.flow[i].cwnd = 1;
+		s.flow[i].ssthresh = 1e9;
+		if (tune_push(&s, i * t->rtt / 1e6 / t->flows, i, 0) < 0)
+			goto out;
+		s.flow[i].inflight = 1;
+	}
+
+	while (s.nev && now < s.end) {
+		struct tune_event e = tune_pop(&s);
+		struct tune_flow *fl = &s.flow[e.flow];
+
+		now = e.time;
+		fl->inflight--;
+		if (e.lost) {
+			if (now >= fl->recover) {
+				fl->ssthresh = fl->cwnd / 2 > 1 ? fl->cwnd / 2 : 1;
+				fl->cwnd = fl->ssthresh;
+				fl->recover = now + t->rtt / 1e6;
+			}
+		} else if (fl->cwnd < fl->ssthresh) {
+			fl->cwnd += 1;
+		} else {
+			fl->cwnd += 1 / fl->cwnd;
+		}
+		if (fl->inflight < 0)
+			fl->inflight = 0;
+		if (tune_send(&s, e.flow, now) < 0)
+			goto out;
+	}
+
+	if (s.arrived > s.dropped) {
+		r->delay = s.delay_sum / (s.arrived - s.dropped) * 1e6;
+		r->util = s.delivered * s.xmit / (s.end - s.start);
+		r->drops = (double)s.dropped / s.arrived;
+		r->valid = 1;
+	}
+out:
+	free(s.dep);
+	free(s.flow);
+	free(s.ev);
+}
+
+struct tune_work
+{
+	pthread_mutex_t	lock;
+	int		next;
+	int		nr;
+	struct tune_run	*run;
+};
+
+static void *tune_worker(void *arg)
+{
+	struct tune_work *w = arg;
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&w->lock);
+		i = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		if (i >= w->nr)
+			return NULL;
+		tune_simulate(&w->run[i]);
+	}
+}
+
+/* Is a better than b for target delay (usecs)? */
+static int tune_better(const struct tune_run *a, const struct tune_run *b,
+		       double target)
+{
+	int fa = a->delay <= target, fb = b->delay <= target;
+
+	if (fa != fb)
+		return fa;
+	if (!fa)
+		return a->delay < b->delay;
+	if (fabs(a->util - b->util) > 0.005)
+		return a->util > b->util;
+	return a->drops < b->drops;
+}
+
+int tc_red_tune(struct tc_red_tune *t)
+{
+	struct tune_run run[TUNE_NR], *best = NULL;
+	struct tune_work w;
+	pthread_t tid[TUNE_NR];
+	double target_bytes = (double)t->target * t->rate / 1e6;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, j, k, nr = 0, nthreads = 0;
+
+	if (!t->avpkt || !t->rate || !t->target || !t->limit) {
+		fprintf(stderr, "tc_red_tune: target, limit, avpkt and bandwidth are required\n");
+		return -1;
+	}
+	if (!t->rtt)
+		t->rtt = 100000;
+	if (!t->flows)
+		t->flows = 8;
+
+	for (i = 0; i < TUNE_MINS; i++) {
+		for (j = 0; j < TUNE_RATIOS; j++) {
+			unsigned qmin = tune_min[i] * target_bytes;
+			unsigned qmax = qmin * tune_ratio[j];
+
+			if (qmin < t->avpkt || qmax > t->limit)
+				continue;
+			for (k = 0; k < TUNE_PROBS; k++) {
+				memset(&run[nr], 0, sizeof(run[nr]));
+				run[nr].t = t;
+				run[nr].qth_min = qmin;
+				run[nr].qth_max = qmax;
+				run[nr].probability = tune_prob[k];
+				nr++;
+			}
+		}
+	}
+	if (nr == 0) {
+		fprintf(stderr, "tc_red_tune: target is too small for avpkt or too large for limit\n");
+		return -1;
+	}
+
+	memset(&w, 0, sizeof(w));
+	pthread_mutex_init(&w.lock, NULL);
+	w.nr = nr;
+	w.run = run;
+	if (ncpu > nr)
+		ncpu = nr;
+	for (i = 1; i < ncpu; i++)
+		if (pthread_create(&tid[nthreads], NULL, tune_worker, &w) == 0)
+			nthreads++;
+	tune_worker(&w);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tid[i], NULL);
+	pthread_mutex_destroy(&w.lock);
+
+	for (i = 0; i < nr; i++)
+		if (run[i].valid &&
+		    (best == NULL || tune_better(&run[i], best, t->target)))
+			best = &run[i];
+	if (best == NULL) {
+		fprintf(stderr, "tc_red_tune: no candidate could be simulated\n");
+		return -1;
+	}
+
+	t->qth_min = best->qth_min;
+	t->qth_max = best->qth_max;
+	t->burst = (2 * best->qth_min + best->qth_max) / (3 * t->avpkt);
+	t->probability = best->probability;
+	t->delay = best->delay;
+	t->util = best->util;
+	t->drops = best->drops;
+	return 0;
+}
+
+void tc_red_tune_print(const char *who, const struct tc_red_tune *t)
+{
+	SPRINT_BUF(b1);
+	SPRINT_BUF(b2);
+	SPRINT_BUF(b3);
+
+	fprintf(stderr, "%s: min %s max %s burst %u probability %g: "
+		"delay %s, utilization %.1f%%, drops %.2f%%\n", who,
+		sprint_size(t->qth_min, b1), sprint_size(t->qth_max, b2),
+		t->burst, t->probability, sprint_time(t->delay, b3),
+		t->util * 100, t->drops * 100);
+}
@@ -5,4 +5,26 @@ extern int tc_red_eval_P(unsigned qmin, unsigned qmax, double prob);
 extern int tc_red_eval_ewma(unsigned qmin, unsigned burst, unsigned avpkt);
 extern int tc_red_eval_idle_damping(int wlog, unsigned avpkt, unsigned bandwidth, __u8 *sbuf);
 
+struct tc_red_tune
+{
+	/* what to tune for */
+	unsigned	limit;		/* bytes */
+	unsigned	avpkt;
+	unsigned	rate;		/* bytes per second */
+	unsigned	target;		/* mean queueing delay, usecs */
+	unsigned	rtt;		/* usecs, 100ms if 0 */
+	unsigned	flows;		/* 8 if 0 */
+	/* the recommendation and how it did */
+	unsigned	qth_min;
+	unsigned	qth_max;
+	unsigned	burst;
+	double		probability;
+	double		delay;		/* usecs */
+	double		util;
+	double		drops;
+};
+
+extern int tc_red_tune(struct tc_red_tune *t);
+extern void tc_red_tune_print(const char *who, const struct tc_red_tune *t);
+
 #endif
@@ -0,0 +1,1701 @@
+/*
+ * tc_sim.c		"tc sim".
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * The model is made of the same messages the kernel would get: a
+ * capture of qdisc, class and filter dumps, or the requests that the
+ * commands of a batch file make, which are recorded instead of sent.
+ * Each kind turns its options into state through its sim ops.
+ *
+ * A trace is then replayed through it.  Packets are classified first,
+ * which needs no state and is split over "jobs" processes, and then
+ * enqueued at their arrival times and dequeued whenever the link is
+ * free, in one process, as classes share their tokens.  Times are in
+ * seconds from the first packet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+
+#include "utils.h"
+#include "ll_map.h"
+#include "tc_util.h"
+#include "tc_common.h"
+#include "tc_sim.h"
+
+#define SIM_IFINDEX	0x7fffffff	/* of a device named on the command line */
+#define SIM_JOBS_MAX	64
+#define SIM_ARGS	128
+
+unsigned int sim_txqueuelen = 1000;
+unsigned int sim_mtu = 1514;
+
+static struct sim_qdisc *sim_qdiscs, *sim_root;
+static struct sim_qdisc *sim_majors[0x10000];
+static struct sim_class **sim_chash;
+static unsigned int sim_chash_size, sim_nclasses;
+static int sim_ifindex;
+static unsigned int sim_skipped;
+static __u32 sim_auto_handle = 0x8000;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: tc sim [ dev DEV ] { config FILE | batch FILE } TRAFFIC\n"
+		"              [ linkrate RATE ] [ txqueuelen PACKETS ] [ mtu BYTES ]\n"
+		"              [ jobs N ]\n"
+		"TRAFFIC := pcap FILE | FLOWS [ FLOWS ]... [ duration TIME ] [ seed N ]\n"
+		"FLOWS := flows N rate RATE [ size BYTES ] [ jitter TIME [ distribution NAME ] ]\n"
+		"         [ src ADDR ] [ dst ADDR ] [ proto { tcp | udp } ] [ sport PORT ]\n"
+		"         [ dport PORT ] [ mark MARK ] [ priority PRIO ]\n"
+		"config FILE holds qdisc, class and filter dumps written by \"tc -capture\",\n"
+		"batch FILE is read as by \"tc -batch\" without changing the device.\n");
+}
+
+/*
+ * The model
+ */
+
+static unsigned int sim_chash_fn(__u32 classid)
+{
+	return ((classid ^ (classid >> 16)) * 0x9e3779b1U) & (sim_chash_size - 1);
+}
+
+static int sim_chash_resize(unsigned int size)
+{
+	struct sim_class **h, *cl, *next;
+	unsigned int i, old = sim_chash_size;
+
+	h = calloc(size, sizeof(*h));
+	if (h == NULL)
+		return -1;
+	sim_chash_size = size;
+	for (i = 0; i < old; i++) {
+		for (cl = sim_chash[i]; cl; cl = next) {
+			unsigned int b = sim_chash_fn(cl->classid);
+
+			next = cl->hnext;
+			cl->hnext = h[b];
+			h[b] = cl;
+		}
+	}
+	free(sim_chash);
+	sim_chash = h;
+	return 0;
+}
+
+struct sim_class *sim_class_find(struct sim_qdisc *q, __u32 classid)
+{
+	struct sim_class *cl;
+
+	if (sim_chash_size == 0)
+		return NULL;
+	for (cl = sim_chash[sim_chash_fn(classid)]; cl; cl = cl->hnext)
+		if (cl->classid == classid && cl->qdisc == q)
+			return cl;
+	return NULL;
+}
+
+struct sim_class *sim_class_new(struct sim_qdisc *q, __u32 classid)
+{
+	struct sim_class *cl;
+	unsigned int b;
+
+	if (sim_nclasses >= sim_chash_size &&
+	    sim_chash_resize(sim_chash_size ? sim_chash_size * 2 : 256) < 0)
+		return NULL;
+	cl = calloc(1, sizeof(*cl));
+	if (cl == NULL)
+		return NULL;
+	cl->qdisc = q;
+	cl->classid = classid;
+	cl->next = q->classes;
+	q->classes = cl;
+	b = sim_chash_fn(classid);
+	cl->hnext = sim_chash[b];
+	sim_chash[b] = cl;
+	sim_nclasses++;
+	return cl;
+}
+
+static void sim_class_unhash(struct sim_class *cl)
+{
+	struct sim_class **clp;
+
+	for (clp = &sim_chash[sim_chash_fn(cl->classid)]; *clp;
+	     clp = &(*clp)->hnext) {
+		if (*clp == cl) {
+			*clp = cl->hnext;
+			sim_nclasses--;
+			return;
+		}
+	}
+}
+
+static struct sim_qdisc *sim_qdisc_new(const char *kind, __u32 handle,
+				       __u32 parentid)
+{
+	struct qdisc_util *qu = get_qdisc_kind(kind);
+	struct sim_qdisc *q, **qp;
+
+	if (qu == NULL || qu->sim == NULL) {
+		fprintf(stderr, "Qdisc \"%s\" cannot be simulated.\n", kind);
+		return NULL;
+	}
+	q = calloc(1, sizeof(*q));
+	if (q == NULL)
+		return NULL;
+	strncpy(q->kind, kind, sizeof(q->kind) - 1);
+	q->ops = qu->sim;
+	q->handle = handle;
+	q->parentid = parentid;
+	for (qp = &sim_qdiscs; *qp; qp = &(*qp)->next)
+		;
+	*qp = q;
+	if (handle)
+		sim_majors[handle >> 16] = q;
+	return q;
+}
+
+/* A qdisc the kernel makes up, such as the pfifo of a new leaf class */
+struct sim_qdisc *sim_qdisc_builtin(struct sim_qdisc *up,
+				    struct sim_class *parent,
+				    const char *kind, unsigned int limit)
+{
+	struct {
+		struct rtattr		rta;
+		struct tc_fifo_qopt	qopt;
+	} opt;
+	struct sim_qdisc *q;
+
+	q = sim_qdisc_new(kind, 0, parent ? parent->classid : up->handle);
+	if (q == NULL)
+		return NULL;
+	q->builtin = 1;
+	q->up = up;
+	q->parent = parent;
+	if (parent)
+		parent->child = q;
+	opt.rta.rta_type = TCA_OPTIONS;
+	opt.rta.rta_len = RTA_LENGTH(sizeof(opt.qopt));
+	opt.qopt.limit = limit;
+	if (q->ops->init(q, &opt.rta) < 0)
+		return NULL;
+	return q;
+}
+
+/* Drops q and everything below it; the memory goes at exit */
+static void sim_forget(struct sim_qdisc *q)
+{
+	struct sim_qdisc **qp;
+	struct sim_class *cl;
+
+	for (cl = q->classes; cl; cl = cl->next) {
+		if (cl->child)
+			sim_forget(cl->child);
+		sim_class_unhash(cl);
+	}
+	for (qp = &sim_qdiscs; *qp; qp = &(*qp)->next) {
+		if (*qp == q) {
+			*qp = q->next;
+			break;
+		}
+	}
+	if (q->handle && sim_majors[q->handle >> 16] == q)
+		sim_majors[q->handle >> 16] = NULL;
+	if (q->parent && q->parent->child == q)
+		q->parent->child = NULL;
+	if (q == sim_root)
+		sim_root = NULL;
+}
+
+/* Hangs q from the class it was added under, if that exists yet */
+static int sim_attach(struct sim_qdisc *q, int replace)
+{
+	struct sim_qdisc *up = sim_majors[TC_H_MAJ(q->parentid) >> 16];
+	struct sim_class *cl;
+	char b1[16];
+
+	if (up == NULL)
+		return 0;
+	cl = sim_class_find(up, q->parentid);
+	if (cl == NULL)
+		return 0;
+	if (cl->child && cl->child != q) {
+		if (!cl->child->builtin && !replace) {
+			fprintf(stderr, "sim: class %s already has a qdisc\n",
+				sprint_tc_classid(cl->classid, b1));
+			return -1;
+		}
+		sim_forget(cl->child);
+	}
+	cl->child = q;
+	q->up = up;
+	q->parent = cl;
+	return 0;
+}
+
+static int sim_load_qdisc(struct nlmsghdr *n, struct tcmsg *t,
+			  struct rtattr **tb)
+{
+	struct sim_qdisc *q = NULL;
+	const char *kind;
+	__u32 handle;
+
+	if (t->tcm_parent == TC_H_INGRESS)
+		return 0;
+	if (n->nlmsg_type == RTM_DELQDISC) {
+		if (t->tcm_parent == TC_H_ROOT) {
+			if (sim_root)
+				sim_forget(sim_root);
+			return 0;
+		}
+		fprintf(stderr, "sim: only the root qdisc can be deleted\n");
+		return -1;
+	}
+	if (tb[TCA_KIND] == NULL) {
+		fprintf(stderr, "sim: qdisc without a kind\n");
+		return -1;
+	}
+	kind = rta_getattr_str(tb[TCA_KIND]);
+
+	if (t->tcm_handle)
+		q = sim_majors[TC_H_MAJ(t->tcm_handle) >> 16];
+	else if (t->tcm_parent == TC_H_ROOT)
+		q = sim_root;
+	if (q && !(n->nlmsg_flags & NLM_F_EXCL) &&
+	    (t->tcm_parent == 0 || t->tcm_parent == q->parentid ||
+	     (t->tcm_parent == TC_H_ROOT && q == sim_root))) {
+		if (strcmp(q->kind, kind) == 0)
+			return q->ops->init(q, tb[TCA_OPTIONS]);
+		if (!(n->nlmsg_flags & NLM_F_REPLACE)) {
+			fprintf(stderr, "sim: cannot change a qdisc's kind\n");
+			return -1;
+		}
+	} else if (q && t->tcm_handle) {
+		fprintf(stderr, "sim: qdisc %x: exists\n", q->handle >> 16);
+		return -1;
+	}
+
+	if (t->tcm_parent == TC_H_ROOT && sim_root) {
+		if (!(n->nlmsg_flags & NLM_F_REPLACE)) {
+			fprintf(stderr, "sim: there is a root qdisc already\n");
+			return -1;
+		}
+		sim_forget(sim_root);
+	} else if (q) {
+		sim_forget(q);
+	}
+
+	handle = t->tcm_handle ? TC_H_MAJ(t->tcm_handle) :
+		 sim_auto_handle++ << 16;
+	q = sim_qdisc_new(kind, handle, t->tcm_parent);
+	if (q == NULL || q->ops->init(q, tb[TCA_OPTIONS]) < 0)
+		return -1;
+	if (t->tcm_parent == TC_H_ROOT) {
+		sim_root = q;
+		return 0;
+	}
+	return sim_attach(q, n->nlmsg_flags & NLM_F_REPLACE);
+}
+
+static int sim_load_class(struct nlmsghdr *n, struct tcmsg *t,
+			  struct rtattr **tb)
+{
+	struct sim_qdisc *q = sim_majors[TC_H_MAJ(t->tcm_handle) >> 16];
+	struct sim_class *cl;
+	char b1[16];
+
+	if (n->nlmsg_type == RTM_DELTCLASS) {
+		fprintf(stderr, "sim: classes cannot be deleted\n");
+		return -1;
+	}
+	if (q == NULL || TC_H_MIN(t->tcm_handle) == 0) {
+		fprintf(stderr, "sim: no qdisc for class %s\n",
+			sprint_tc_classid(t->tcm_handle, b1));
+		return -1;
+	}
+	if (q->ops->class_init == NULL) {
+		fprintf(stderr, "sim: qdisc \"%s\" is classless\n", q->kind);
+		return -1;
+	}
+	if (tb[TCA_KIND] && strcmp(rta_getattr_str(tb[TCA_KIND]), q->kind)) {
+		fprintf(stderr, "sim: class %s is not of kind \"%s\"\n",
+			sprint_tc_classid(t->tcm_handle, b1), q->kind);
+		return -1;
+	}
+
+	cl = sim_class_find(q, t->tcm_handle);
+	if (cl == NULL) {
+		if (n->nlmsg_type == RTM_NEWTCLASS &&
+		    (n->nlmsg_flags & NLM_F_REQUEST) &&
+		    !(n->nlmsg_flags & NLM_F_CREATE)) {
+			fprintf(stderr, "sim: no class %s to change\n",
+				sprint_tc_classid(t->tcm_handle, b1));
+			return -1;
+		}
+		cl = sim_class_new(q, t->tcm_handle);
+		if (cl == NULL)
+			return -1;
+	}
+	if (t->tcm_parent)
+		cl->parentid = t->tcm_parent;
+	return q->ops->class_init(cl, tb[TCA_OPTIONS]);
+}
+
+static struct sim_tp **sim_chain(__u32 parent, __u32 *qhandle)
+{
+	struct sim_qdisc *q;
+	struct sim_class *cl;
+
+	q = parent == TC_H_ROOT ? sim_root : sim_majors[TC_H_MAJ(parent) >> 16];
+	if (q == NULL)
+		return NULL;
+	*qhandle = q->handle;
+	if (parent == TC_H_ROOT || TC_H_MIN(parent) == 0)
+		return &q->filters;
+	cl = sim_class_find(q, parent);
+	return cl ? &cl->filters : NULL;
+}
+
+static int sim_load_filter(struct nlmsghdr *n, struct tcmsg *t,
+			   struct rtattr **tb)
+{
+	__u32 prio = TC_H_MAJ(t->tcm_info) >> 16;
+	__u16 protocol = TC_H_MIN(t->tcm_info);
+	struct sim_tp **chain, **tpp, *tp;
+	struct filter_util *fu;
+	const char *kind;
+	__u32 qhandle;
+	char b1[16];
+
+	if (t->tcm_parent == TC_H_INGRESS ||
+	    TC_H_MAJ(t->tcm_parent) == TC_H_MAJ(TC_H_INGRESS))
+		return 0;
+	if (n->nlmsg_type == RTM_DELTFILTER) {
+		fprintf(stderr, "sim: filters cannot be deleted\n");
+		return -1;
+	}
+	chain = sim_chain(t->tcm_parent, &qhandle);
+	if (chain == NULL) {
+		fprintf(stderr, "sim: no qdisc or class %s for filter\n",
+			sprint_tc_classid(t->tcm_parent, b1));
+		return -1;
+	}
+	if (tb[TCA_KIND] == NULL) {
+		fprintf(stderr, "sim: filter without a kind\n");
+		return -1;
+	}
+	kind = rta_getattr_str(tb[TCA_KIND]);
+
+	/* As the kernel numbers them: just in front of the first one */
+	if (prio == 0) {
+		for (tp = *chain; tp && tp->prio < 0x8000; tp = tp->next)
+			;
+		prio = tp ? tp->prio - 1 : 0xc000;
+	}
+	for (tpp = chain; (tp = *tpp) && tp->prio < prio; tpp = &tp->next)
+		;
+	if (tp && tp->prio == prio) {
+		if (strcmp(tp->kind, kind) ||
+		    (protocol && tp->protocol != protocol)) {
+			fprintf(stderr, "sim: filters of priority %u are %s\n",
+				prio, tp->kind);
+			return -1;
+		}
+	} else {
+		fu = get_filter_kind(kind);
+		if (fu == NULL || fu->sim == NULL) {
+			fprintf(stderr, "Filter \"%s\" cannot be simulated.\n",
+				kind);
+			return -1;
+		}
+		tp = calloc(1, sizeof(*tp));
+		if (tp == NULL)
+			return -1;
+		tp->ops = fu->sim;
+		strncpy(tp->kind, kind, sizeof(tp->kind) - 1);
+		tp->prio = prio;
+		tp->protocol = protocol;
+		tp->qhandle = qhandle;
+		tp->chain = chain;
+		tp->next = *tpp;
+		*tpp = tp;
+		if ((n->nlmsg_flags & NLM_F_REQUEST) && tp->ops->init &&
+		    tp->ops->init(tp) < 0)
+			return -1;
+	}
+	return tp->ops->add(tp, t->tcm_handle, tb[TCA_OPTIONS]);
+}
+
+/* Loads the message if it is of the pass, or of any with pass < 0 */
+static int sim_load(struct nlmsghdr *n, int pass)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	int type = n->nlmsg_type;
+
+	if (type == RTM_NEWLINK || type == RTM_DELLINK) {
+		if (pass <= 0)
+			ll_remember_index(NULL, n, NULL);
+		return 0;
+	}
+	if (type != RTM_NEWQDISC && type != RTM_DELQDISC &&
+	    type != RTM_NEWTCLASS && type != RTM_DELTCLASS &&
+	    type != RTM_NEWTFILTER && type != RTM_DELTFILTER)
+		return 0;
+	if (len < 0) {
+		fprintf(stderr, "sim: truncated message\n");
+		return -1;
+	}
+	if (pass == 0) {
+		/* Dumps are of every device; which one is meant? */
+		if (sim_ifindex == 0)
+			sim_ifindex = t->tcm_ifindex;
+		else if (t->tcm_ifindex != sim_ifindex)
+			sim_ifindex = -1;
+		return 0;
+	}
+	if (pass > 0 && pass != (type - RTM_NEWQDISC) / 4 + 1)
+		return 0;
+
+	if (sim_ifindex == 0)
+		sim_ifindex = t->tcm_ifindex;
+	if (t->tcm_ifindex != sim_ifindex) {
+		sim_skipped++;
+		return 0;
+	}
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	if (type == RTM_NEWQDISC || type == RTM_DELQDISC)
+		return sim_load_qdisc(n, t, tb);
+	if (type == RTM_NEWTCLASS || type == RTM_DELTCLASS)
+		return sim_load_class(n, t, tb);
+	return sim_load_filter(n, t, tb);
+}
+
+static int sim_load_dump(const struct sockaddr_nl *who, struct nlmsghdr *n,
+			 void *arg)
+{
+	return sim_load(n, *(int *)arg);
+}
+
+/* Dumps come in whichever order they were captured: links first, so
+ * that the device can be named, then qdiscs, classes and filters.
+ */
+static int sim_config(const char *name, const char *dev)
+{
+	FILE *fp = fopen(name, "r");
+	int pass;
+
+	if (fp == NULL) {
+		perror(name);
+		return -1;
+	}
+	for (pass = -1; pass < 3; pass++) {
+		int p = pass < 0 ? 0 : pass + 1;
+
+		rewind(fp);
+		if (rtnl_from_file(fp, sim_load_dump, &p) < 0) {
+			fprintf(stderr, "%s: cannot load\n", name);
+			fclose(fp);
+			return -1;
+		}
+		if (pass >= 0)
+			continue;
+		if (dev) {
+			sim_ifindex = ll_name_to_index(dev);
+			if (sim_ifindex == 0) {
+				fprintf(stderr, "%s: no device \"%s\"\n",
+					name, dev);
+				fclose(fp);
+				return -1;
+			}
+		} else if (sim_ifindex < 0) {
+			fprintf(stderr, "%s: holds several devices, name one with \"dev\"\n",
+				name);
+			fclose(fp);
+			return -1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static int sim_record(struct nlmsghdr *n, void *arg)
+{
+	return sim_load(n, -1) < 0 ? -1 : 0;
+}
+
+/* Names the device of a batch file, whether or not it exists here */
+static void sim_seed_dev(const char *dev)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+		char			buf[64];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.i));
+	req.n.nlmsg_type = RTM_NEWLINK;
+	req.i.ifi_index = SIM_IFINDEX;
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, dev, strlen(dev) + 1);
+	ll_remember_index(NULL, &req.n, NULL);
+	sim_ifindex = SIM_IFINDEX;
+}
+
+static int sim_batch(const char *name)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = cmdlineno, ret = 0;
+	FILE *fp;
+
+	fp = strcmp(name, "-") ? fopen(name, "r") : stdin;
+	if (fp == NULL) {
+		perror(name);
+		return -1;
+	}
+
+	rth.record = sim_record;
+	cmdlineno = 0;
+	while (getcmdline(&line, &len, fp) != -1) {
+		char *largv[SIM_ARGS];
+		int largc, err;
+
+		largc = makeargs(line, largv, SIM_ARGS);
+		if (largc == 0)
+			continue;
+		if (matches(largv[0], "qdisc") == 0)
+			err = do_qdisc(largc - 1, largv + 1);
+		else if (matches(largv[0], "class") == 0)
+			err = do_class(largc - 1, largv + 1);
+		else if (matches(largv[0], "filter") == 0)
+			err = do_filter(largc - 1, largv + 1);
+		else {
+			fprintf(stderr, "%s:%d: only qdiscs, classes and filters are simulated\n",
+				name, cmdlineno);
+			err = 1;
+		}
+		if (err) {
+			fprintf(stderr, "%s:%d: command failed\n", name,
+				cmdlineno);
+			ret = -1;
+			if (!force)
+				break;
+		}
+	}
+	rth.record = NULL;
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = lineno;
+	return ret;
+}
+
+static int sim_start_chain(struct sim_tp *tp)
+{
+	for (; tp; tp = tp->next)
+		if (tp->ops->start && tp->ops->start(tp) < 0)
+			return -1;
+	return 0;
+}
+
+/* Classes find their parents, leaves get a pfifo if they have no qdisc */
+static int sim_link(void)
+{
+	struct sim_qdisc *q;
+	struct sim_class *cl, *p;
+	char b1[16], b2[16];
+
+	if (sim_root == NULL) {
+		fprintf(stderr, "sim: no root qdisc\n");
+		return -1;
+	}
+	for (q = sim_qdiscs; q; q = q->next) {
+		for (cl = q->classes; cl; cl = cl->next) {
+			cl->parent = NULL;
+			cl->children = 0;
+			cl->level = 0;
+		}
+	}
+	for (q = sim_qdiscs; q; q = q->next) {
+		for (cl = q->classes; cl; cl = cl->next) {
+			if (TC_H_MAJ(cl->parentid) != q->handle ||
+			    TC_H_MIN(cl->parentid) == 0)
+				continue;
+			cl->parent = sim_class_find(q, cl->parentid);
+			if (cl->parent == NULL) {
+				fprintf(stderr, "sim: no parent %s for class %s\n",
+					sprint_tc_classid(cl->parentid, b1),
+					sprint_tc_classid(cl->classid, b2));
+				return -1;
+			}
+			cl->parent->children++;
+		}
+	}
+	for (q = sim_qdiscs; q; q = q->next) {
+		if (q != sim_root && q->up == NULL && !q->builtin) {
+			if (sim_attach(q, 0) < 0)
+				return -1;
+			if (q->up == NULL) {
+				fprintf(stderr, "sim: no class %s for qdisc %x:\n",
+					sprint_tc_classid(q->parentid, b1),
+					q->handle >> 16);
+				return -1;
+			}
+		}
+		for (cl = q->classes; cl; cl = cl->next) {
+			int level = 0;
+
+			for (p = cl; p->parent; p = p->parent)
+				if (p->parent->level <= ++level)
+					p->parent->level = level;
+			if (cl->children) {
+				if (cl->child) {
+					fprintf(stderr, "sim: inner class %s has a qdisc\n",
+						sprint_tc_classid(cl->classid, b1));
+					return -1;
+				}
+			} else if (cl->child == NULL &&
+				   sim_qdisc_builtin(q, cl, "pfifo",
+						     sim_txqueuelen) == NULL) {
+				return -1;
+			}
+		}
+	}
+	for (q = sim_qdiscs; q; q = q->next) {
+		if (sim_start_chain(q->filters) < 0)
+			return -1;
+		for (cl = q->classes; cl; cl = cl->next)
+			if (sim_start_chain(cl->filters) < 0)
+				return -1;
+	}
+	for (q = sim_qdiscs; q; q = q->next)
+		if (q->ops->start && q->ops->start(q, 0) < 0)
+			return -1;
+	return 0;
+}
+
+/* The class of q that p passes through, NULL for none */
+struct sim_class *sim_class_of(struct sim_qdisc *q, const struct sim_pkt *p)
+{
+	struct sim_qdisc *x = p->leaf;
+
+	while (x && x->up != q)
+		x = x->up;
+	return x ? x->parent : NULL;
+}
+
+int sim_filter(struct sim_tp *chain, const struct sim_pkt *p, __u32 *classid)
+{
+	__u16 protocol = htons(p->protocol);
+	struct sim_tp *tp;
+
+	for (tp = chain; tp; tp = tp->next) {
+		if (tp->protocol != htons(ETH_P_ALL) && tp->protocol != protocol)
+			continue;
+		if (tp->ops->classify(tp, p, classid) == 0)
+			return 0;
+	}
+	return -1;
+}
+
+static struct sim_qdisc *sim_classify(struct sim_pkt *p)
+{
+	struct sim_qdisc *q = sim_root;
+
+	while (q && q->ops->classify)
+		q = q->ops->classify(q, p);
+	return q;
+}
+
+/*
+ * Queues
+ */
+
+void sim_queue_init(struct sim_queue *sq)
+{
+	sq->head = NULL;
+	sq->tail = &sq->head;
+	sq->qlen = sq->bytes = 0;
+}
+
+void sim_queue_tail(struct sim_queue *sq, struct sim_pkt *p)
+{
+	p->next = NULL;
+	*sq->tail = p;
+	sq->tail = &p->next;
+	sq->qlen++;
+	sq->bytes += p->len;
+}
+
+struct sim_pkt *sim_queue_head(struct sim_queue *sq)
+{
+	struct sim_pkt *p = sq->head;
+
+	if (p) {
+		sq->head = p->next;
+		if (sq->head == NULL)
+			sq->tail = &sq->head;
+		sq->qlen--;
+		sq->bytes -= p->len;
+	}
+	return p;
+}
+
+int sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p, double now)
+{
+	if (q->ops->enqueue(q, p, now) < 0)
+		return -1;
+	q->qlen++;
+	return 0;
+}
+
+struct sim_pkt *sim_dequeue(struct sim_qdisc *q, double now, double *next)
+{
+	struct sim_pkt *p = q->ops->dequeue(q, now, next);
+
+	if (p)
+		q->qlen--;
+	return p;
+}
+
+/* The drop of p by q, counted everywhere on the way to q.  A packet
+ * being enqueued points to itself; any other was queued by q.
+ */
+void sim_drop(struct sim_qdisc *q, struct sim_pkt *p)
+{
+	int queued = p->next != p;
+	struct sim_qdisc *x;
+	struct sim_class *cl;
+
+	for (x = q; x; x = x->up) {
+		x->stats.drops++;
+		if (queued && x != q)
+			x->qlen--;
+		for (cl = x->parent; cl; cl = cl->parent)
+			cl->stats.drops++;
+	}
+	if (queued)
+		q->qlen--;
+}
+
+static void sim_stats_add(struct sim_stats *st, const struct sim_pkt *p,
+			  double delay)
+{
+	double us = delay * 1e6;
+	int b = us < 1 ? 0 : 1 + (int)(log2(us) * 4);
+
+	if (b >= SIM_DELAY_BUCKETS)
+		b = SIM_DELAY_BUCKETS - 1;
+	st->packets++;
+	st->bytes += p->len;
+	st->delay_sum += delay;
+	if (delay > st->delay_max)
+		st->delay_max = delay;
+	st->delay[b]++;
+}
+
+static void sim_sent(struct sim_pkt *p, double now)
+{
+	struct sim_qdisc *x;
+	struct sim_class *cl;
+
+	for (x = p->leaf; x; x = x->up) {
+		sim_stats_add(&x->stats, p, now - p->time);
+		for (cl = x->parent; cl; cl = cl->parent)
+			sim_stats_add(&cl->stats, p, now - p->time);
+	}
+}
+
+/*
+ * Packets
+ */
+
+static __u32 sim_load32(const __u8 *d)
+{
+	__u32 v;
+
+	memcpy(&v, d, sizeof(v));
+	return v;
+}
+
+const __u8 *sim_transport(const struct sim_pkt *p)
+{
+	if (p->protocol == ETH_P_IP && p->caplen >= 20)
+		return p->data + (p->data[0] & 0xf) * 4;
+	if (p->protocol == ETH_P_IPV6 && p->caplen >= 40)
+		return p->data + 40;
+	return NULL;
+}
+
+/* A header of TCF_LAYER_*, with the bytes captured from it on */
+const __u8 *sim_layer(const struct sim_pkt *p, int layer, unsigned int *len)
+{
+	const __u8 *d;
+
+	switch (layer) {
+	case TCF_LAYER_NETWORK:
+		*len = p->caplen;
+		return p->data;
+	case TCF_LAYER_TRANSPORT:
+		d = sim_transport(p);
+		if (d == NULL || d > p->data + p->caplen)
+			return NULL;
+		*len = p->caplen - (d - p->data);
+		return d;
+	}
+	/* The link layer header is not kept */
+	return NULL;
+}
+
+int sim_flow_keys(const struct sim_pkt *p, struct sim_flow *fl)
+{
+	const __u8 *d = p->data, *th;
+
+	memset(fl, 0, sizeof(*fl));
+	if (p->protocol == ETH_P_IP && p->caplen >= 20) {
+		fl->src[0] = sim_load32(d + 12);
+		fl->dst[0] = sim_load32(d + 16);
+		fl->alen = 1;
+		fl->proto = d[9];
+		/* Only first fragments have ports */
+		if (((d[6] << 8) | d[7]) & 0x3fff)
+			return 0;
+	} else if (p->protocol == ETH_P_IPV6 && p->caplen >= 40) {
+		memcpy(fl->src, d + 8, 16);
+		memcpy(fl->dst, d + 24, 16);
+		fl->alen = 4;
+		fl->proto = d[6];
+	} else {
+		return -1;
+	}
+
+	th = sim_transport(p);
+	switch (fl->proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_SCTP:
+	case IPPROTO_DCCP:
+		if (th + 4 <= p->data + p->caplen) {
+			fl->sport = (th[0] << 8) | th[1];
+			fl->dport = (th[2] << 8) | th[3];
+			fl->has_ports = 1;
+		}
+		break;
+	}
+	return 0;
+}
+
+/* Time to send len bytes at rate, with the overhead of the rate spec */
+double sim_l2t(const struct tc_ratespec *r, __u64 rate, unsigned int len)
+{
+	len += r->overhead;
+	if (len < r->mpu)
+		len = r->mpu;
+	if ((r->linklayer & TC_LINKLAYER_MASK) == TC_LINKLAYER_ATM)
+		len = (len + 47) / 48 * 53;
+	return rate ? (double)len / rate : 0;
+}
+
+struct sim_trace
+{
+	struct sim_pkt	*pkts;
+	size_t		count;
+	size_t		size;
+};
+
+static struct sim_pkt *sim_trace_add(struct sim_trace *tr)
+{
+	if (tr->count == tr->size) {
+		size_t size = tr->size ? tr->size * 2 : 4096;
+		struct sim_pkt *pkts = realloc(tr->pkts, size * sizeof(*pkts));
+
+		if (pkts == NULL) {
+			fprintf(stderr, "sim: out of memory for the trace\n");
+			return NULL;
+		}
+		tr->pkts = pkts;
+		tr->size = size;
+	}
+	memset(&tr->pkts[tr->count], 0, sizeof(tr->pkts[0]));
+	return &tr->pkts[tr->count++];
+}
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+
+#define DLT_EN10MB		1
+#define DLT_RAW			101
+#define DLT_LINUX_SLL		113
+#define DLT_IPV4		228
+#define DLT_IPV6		229
+#define DLT_NFLOG		239
+#define DLT_LINUX_SLL2		276
+
+#define NFULA_MARK		3
+#define NFULA_PAYLOAD		9
+
+struct pcap_file_hdr
+{
+	__u32	magic;
+	__u16	major;
+	__u16	minor;
+	__s32	thiszone;
+	__u32	sigfigs;
+	__u32	snaplen;
+	__u32	linktype;
+};
+
+struct pcap_rec_hdr
+{
+	__u32	sec;
+	__u32	frac;
+	__u32	caplen;
+	__u32	len;
+};
+
+static __u32 pcap32(__u32 v, int swap)
+{
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static __u16 pcap16(const __u8 *d, int swap)
+{
+	__u16 v;
+
+	memcpy(&v, d, sizeof(v));
+	return swap ? __builtin_bswap16(v) : v;
+}
+
+/* The network header and its protocol from behind the link header */
+static int sim_pcap_pkt(struct sim_pkt *p, __u32 linktype, int swap,
+			const __u8 *d, unsigned int caplen, unsigned int len)
+{
+	unsigned int off = 0, wire = 0;
+	__u16 proto = 0;
+
+	switch (linktype) {
+	case DLT_EN10MB:
+		off = 14;
+		if (caplen < off)
+			return -1;
+		proto = (d[12] << 8) | d[13];
+		while ((proto == ETH_P_8021Q || proto == ETH_P_8021AD) &&
+		       caplen >= off + 4) {
+			proto = (d[off + 2] << 8) | d[off + 3];
+			off += 4;
+		}
+		wire = len - (off - 14);
+		break;
+	case DLT_LINUX_SLL:
+		off = 16;
+		if (caplen < off)
+			return -1;
+		proto = (d[14] << 8) | d[15];
+		break;
+	case DLT_LINUX_SLL2:
+		off = 20;
+		if (caplen < off)
+			return -1;
+		proto = (d[0] << 8) | d[1];
+		break;
+	case DLT_NFLOG:
+		if (caplen < 4)
+			return -1;
+		proto = d[0] == AF_INET6 ? ETH_P_IPV6 : ETH_P_IP;
+		for (off = 4; off + 4 <= caplen; ) {
+			unsigned int tlen = pcap16(d + off, swap);
+			unsigned int type = pcap16(d + off + 2, swap);
+
+			if (tlen < 4 || off + tlen > caplen)
+				return -1;
+			if (type == NFULA_MARK && tlen >= 8)
+				p->mark = ntohl(sim_load32(d + off + 4));
+			if (type == NFULA_PAYLOAD) {
+				caplen = off + tlen;
+				off += 4;
+				break;
+			}
+			off += (tlen + 3) & ~3;
+		}
+		if (off + 4 > caplen)
+			return -1;
+		break;
+	case DLT_RAW:
+	case DLT_IPV4:
+	case DLT_IPV6:
+		if (caplen < 1)
+			return -1;
+		proto = (d[0] >> 4) == 6 ? ETH_P_IPV6 : ETH_P_IP;
+		break;
+	default:
+		return -2;
+	}
+
+	p->data = d + off;
+	p->caplen = caplen - off;
+	p->protocol = proto;
+	/* As sent on an ethernet device, without the tags */
+	if (wire == 0) {
+		wire = len - off;
+		if (proto == ETH_P_IP && p->caplen >= 4)
+			wire = (p->data[2] << 8) | p->data[3];
+		else if (proto == ETH_P_IPV6 && p->caplen >= 6)
+			wire = ((p->data[4] << 8) | p->data[5]) + 40;
+		wire += 14;
+	}
+	p->len = wire;
+	return 0;
+}
+
+static int sim_pcap(const char *name, struct sim_trace *tr)
+{
+	const struct pcap_file_hdr *fh;
+	const __u8 *map, *d, *end;
+	double scale = 1e-6;
+	struct stat st;
+	int fd, swap;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(name);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (st.st_size < sizeof(*fh)) {
+		fprintf(stderr, "%s: not a pcap file\n", name);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(name);
+		return -1;
+	}
+
+	fh = (const struct pcap_file_hdr *)map;
+	swap = fh->magic != PCAP_MAGIC && fh->magic != PCAP_MAGIC_NS;
+	if (pcap32(fh->magic, swap) == PCAP_MAGIC_NS)
+		scale = 1e-9;
+	else if (pcap32(fh->magic, swap) != PCAP_MAGIC) {
+		fprintf(stderr, "%s: not a pcap file (pcapng can be converted with editcap -F pcap)\n",
+			name);
+		return -1;
+	}
+
+	end = map + st.st_size;
+	for (d = map + sizeof(*fh); d + sizeof(struct pcap_rec_hdr) <= end; ) {
+		struct pcap_rec_hdr rh;
+		struct sim_pkt *p;
+		int err;
+
+		memcpy(&rh, d, sizeof(rh));
+		rh.caplen = pcap32(rh.caplen, swap);
+		d += sizeof(rh);
+		if (rh.caplen > end - d)
+			break;
+		p = sim_trace_add(tr);
+		if (p == NULL)
+			return -1;
+		p->time = pcap32(rh.sec, swap) + pcap32(rh.frac, swap) * scale;
+		err = sim_pcap_pkt(p, pcap32(fh->linktype, swap), swap, d,
+				   rh.caplen, pcap32(rh.len, swap));
+		if (err == -2) {
+			fprintf(stderr, "%s: link type %u is not supported\n",
+				name, pcap32(fh->linktype, swap));
+			return -1;
+		}
+		if (err < 0)
+			tr->count--;
+		d += rh.caplen;
+	}
+	return 0;
+}
+
+/* Flows made up from a rate, a packet size and a netem distribution */
+struct sim_flows
+{
+	struct sim_flows	*next;
+	unsigned int		count;
+	__u64			rate;	/* of each flow */
+	unsigned int		size;
+	double			jitter;
+	__s16			*dist;
+	int			dist_size;
+	__u32			src;
+	__u32			dst;
+	__u8			proto;
+	__u16			sport;
+	__u16			dport;
+	__u32			mark;
+	__u32			priority;
+};
+
+#define SIM_HDR_LEN	40
+
+static __u64 sim_rnd_state = 1;
+
+static __u64 sim_rnd(void)
+{
+	__u64 x = sim_rnd_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	sim_rnd_state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static double sim_rnd_unit(void)
+{
+	return (sim_rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Like netem's delay: mu, with a jitter of sigma that is uniform or
+ * drawn from the distribution table
+ */
+static double sim_interval(const struct sim_flows *fg, double mu)
+{
+	double t = mu;
+
+	if (fg->jitter > 0) {
+		if (fg->dist)
+			t += fg->jitter * fg->dist[sim_rnd() % fg->dist_size] /
+			     NETEM_DIST_SCALE;
+		else
+			t += fg->jitter * (2 * sim_rnd_unit() - 1);
+	}
+	return t > 0 ? t : 0;
+}
+
+static int sim_flows(struct sim_flows *fg, double duration,
+		     struct sim_trace *tr)
+{
+	for (; fg; fg = fg->next) {
+		unsigned int hlen = fg->proto == IPPROTO_TCP ? 40 : 28;
+		double mu = (double)fg->size / fg->rate;
+		__u8 *hdrs;
+		unsigned int k;
+
+		hdrs = calloc(fg->count, SIM_HDR_LEN);
+		if (hdrs == NULL) {
+			fprintf(stderr, "sim: out of memory for flows\n");
+			return -1;
+		}
+		for (k = 0; k < fg->count; k++) {
+			__u8 *h = hdrs + k * SIM_HDR_LEN;
+			__u32 src = htonl(ntohl(fg->src) + k);
+			__u16 sport = htons(fg->sport + k);
+			__u16 dport = htons(fg->dport);
+			__u16 tot = htons(fg->size);
+			double t;
+
+			h[0] = 0x45;
+			memcpy(h + 2, &tot, 2);
+			h[6] = 0x40;
+			h[8] = 64;
+			h[9] = fg->proto;
+			memcpy(h + 12, &src, 4);
+			memcpy(h + 16, &fg->dst, 4);
+			memcpy(h + 20, &sport, 2);
+			memcpy(h + 22, &dport, 2);
+			if (fg->proto == IPPROTO_TCP) {
+				h[32] = 5 << 4;
+				h[33] = 0x10;
+			} else {
+				__u16 ulen = htons(fg->size - 20);
+
+				memcpy(h + 24, &ulen, 2);
+			}
+
+			for (t = sim_rnd_unit() * mu; t < duration;
+			     t += sim_interval(fg, mu)) {
+				struct sim_pkt *p = sim_trace_add(tr);
+
+				if (p == NULL)
+					return -1;
+				p->time = t;
+				p->data = h;
+				p->caplen = hlen;
+				p->len = fg->size + 14;
+				p->protocol = ETH_P_IP;
+				p->mark = fg->mark;
+				p->priority = fg->priority;
+			}
+		}
+	}
+	return 0;
+}
+
+static int sim_cmp_time(const void *a, const void *b)
+{
+	const struct sim_pkt *x = a, *y = b;
+
+	if (x->time < y->time)
+		return -1;
+	if (x->time > y->time)
+		return 1;
+	return x < y ? -1 : x > y;
+}
+
+/* Sorted by time from the first packet, shared with the jobs */
+static int sim_trace_ready(struct sim_trace *tr, int jobs)
+{
+	size_t i;
+	double t0;
+
+	for (i = 1; i < tr->count; i++)
+		if (tr->pkts[i].time < tr->pkts[i - 1].time)
+			break;
+	if (i < tr->count)
+		qsort(tr->pkts, tr->count, sizeof(tr->pkts[0]), sim_cmp_time);
+
+	t0 = tr->count ? tr->pkts[0].time : 0;
+	for (i = 0; i < tr->count; i++)
+		tr->pkts[i].time -= t0;
+
+	if (jobs > 1 && tr->count) {
+		size_t len = tr->count * sizeof(tr->pkts[0]);
+		struct sim_pkt *shared;
+
+		shared = mmap(NULL, len, PROT_READ|PROT_WRITE,
+			      MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (shared == MAP_FAILED) {
+			perror("sim: cannot share the trace");
+			return -1;
+		}
+		memcpy(shared, tr->pkts, len);
+		free(tr->pkts);
+		tr->pkts = shared;
+	}
+	return 0;
+}
+
+static void sim_classify_range(struct sim_pkt *pkts, size_t lo, size_t hi)
+{
+	size_t i;
+
+	for (i = lo; i < hi; i++)
+		pkts[i].leaf = sim_classify(&pkts[i]);
+}
+
+static int sim_classify_all(struct sim_trace *tr, int jobs)
+{
+	pid_t pids[SIM_JOBS_MAX];
+	int k, n, err = 0;
+
+	if (jobs <= 1 || tr->count < 1024) {
+		sim_classify_range(tr->pkts, 0, tr->count);
+		return 0;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (n = 0; n < jobs; n++) {
+		pids[n] = fork();
+		if (pids[n] < 0) {
+			perror("fork");
+			err = -1;
+			break;
+		}
+		if (pids[n] == 0) {
+			sim_classify_range(tr->pkts, tr->count * n / jobs,
+					   tr->count * (n + 1) / jobs);
+			_exit(0);
+		}
+	}
+	for (k = 0; k < n; k++) {
+		int status;
+
+		if (waitpid(pids[k], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			err = -1;
+	}
+	if (err)
+		fprintf(stderr, "sim: classification failed\n");
+	return err;
+}
+
+/* Arrivals are enqueued in order, and the root is dequeued whenever
+ * the link is free until the next arrival.  Returns the time the last
+ * packet is sent.
+ */
+static double sim_run(struct sim_trace *tr, __u64 linkrate)
+{
+	double link = 0;
+	size_t i = 0;
+
+	for (;;) {
+		double ta = i < tr->count ? tr->pkts[i].time : INFINITY;
+		struct sim_pkt *p;
+
+		if (sim_root->qlen && link <= ta) {
+			double next = INFINITY;
+
+			p = sim_dequeue(sim_root, link, &next);
+			if (p) {
+				sim_sent(p, link);
+				if (linkrate)
+					link += (double)p->len / linkrate;
+				continue;
+			}
+			if (next < ta) {
+				link = next > link ? next : link + 1e-9;
+				continue;
+			}
+		}
+		if (i == tr->count)
+			break;
+
+		p = &tr->pkts[i++];
+		if (link < p->time)
+			link = p->time;
+		if (p->leaf == NULL) {
+			p->leaf = sim_root;
+			p->next = p;
+			sim_drop(sim_root, p);
+			continue;
+		}
+		/* not queued yet, for sim_drop() */
+		p->next = p;
+		sim_enqueue(sim_root, p, p->time);
+	}
+	return link;
+}
+
+/*
+ * Results
+ */
+
+static double sim_percentile(const struct sim_stats *st, double f)
+{
+	__u64 want = ceil(st->packets * f), seen = 0;
+	int b;
+
+	for (b = 0; b < SIM_DELAY_BUCKETS; b++) {
+		seen += st->delay[b];
+		if (seen >= want)
+			break;
+	}
+	return fmin(b ? pow(2, b / 4.0) * 1e-6 : 1e-6, st->delay_max);
+}
+
+static void sim_print_stats(FILE *fp, const struct sim_stats *st,
+			    double span, unsigned int backlog)
+{
+	SPRINT_BUF(b1);
+
+	fprintf(fp, " Sent %llu bytes %llu pkt (dropped %llu) ",
+		(unsigned long long)st->bytes,
+		(unsigned long long)st->packets,
+		(unsigned long long)st->drops);
+	fprintf(fp, "rate %s ", sprint_rate(span > 0 ? st->bytes / span : 0,
+					    b1));
+	if (st->packets) {
+		fprintf(fp, "delay avg %s ",
+			sprint_time(st->delay_sum / st->packets * 1e6, b1));
+		fprintf(fp, "p99 %s ",
+			sprint_time(sim_percentile(st, 0.99) * 1e6, b1));
+		fprintf(fp, "max %s ", sprint_time(st->delay_max * 1e6, b1));
+	}
+	if (backlog)
+		fprintf(fp, "backlog %up ", backlog);
+	fprintf(fp, "\n");
+}
+
+static int sim_cmp_class(const void *a, const void *b)
+{
+	const struct sim_class *x = *(struct sim_class **)a;
+	const struct sim_class *y = *(struct sim_class **)b;
+
+	return x->classid < y->classid ? -1 : x->classid > y->classid;
+}
+
+static void sim_report(FILE *fp, double span)
+{
+	struct sim_class **cls = NULL, *cl;
+	struct sim_qdisc *q;
+	char b1[16];
+
+	for (q = sim_qdiscs; q; q = q->next) {
+		size_t n = 0, i;
+
+		if (q->builtin)
+			continue;
+		fprintf(fp, "qdisc %s %x: ", q->kind, q->handle >> 16);
+		if (q == sim_root)
+			fprintf(fp, "root\n");
+		else
+			fprintf(fp, "parent %s\n",
+				sprint_tc_classid(q->parentid, b1));
+		sim_print_stats(fp, &q->stats, span, q->qlen);
+
+		for (cl = q->classes; cl; cl = cl->next)
+			n++;
+		free(cls);
+		cls = malloc(n * sizeof(*cls));
+		if (cls == NULL)
+			continue;
+		for (cl = q->classes, i = 0; cl; cl = cl->next)
+			cls[i++] = cl;
+		qsort(cls, n, sizeof(*cls), sim_cmp_class);
+		for (i = 0; i < n; i++) {
+			cl = cls[i];
+			fprintf(fp, "class %s %s ", q->kind,
+				sprint_tc_classid(cl->classid, b1));
+			if (cl->parent)
+				fprintf(fp, "parent %s ",
+					sprint_tc_classid(cl->parent->classid, b1));
+			else
+				fprintf(fp, "root ");
+			if (cl->child && !cl->child->builtin)
+				fprintf(fp, "leaf %x: ", cl->child->handle >> 16);
+			fprintf(fp, "\n");
+			sim_print_stats(fp, &cl->stats, span,
+					cl->child ? cl->child->qlen : 0);
+		}
+	}
+	free(cls);
+}
+
+static double sim_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int sim_parse_flows(int *argcp, char ***argvp, struct sim_flows *fg)
+{
+	char **argv = *argvp;
+	int argc = *argcp;
+	__u32 v;
+
+	fg->size = 1500;
+	fg->proto = IPPROTO_TCP;
+	fg->src = htonl(0x0a000001);	/* 10.0.0.1 */
+	fg->dst = htonl(0xc0000201);	/* 192.0.2.1 */
+	fg->sport = 1024;
+	fg->dport = 80;
+
+	NEXT_ARG();
+	if (get_unsigned(&fg->count, *argv, 0) || fg->count == 0)
+		invarg("invalid number of flows", *argv);
+
+	while (argc > 1) {
+		argc--; argv++;
+		if (strcmp(*argv, "rate") == 0) {
+			NEXT_ARG();
+			if (get_rate64(&fg->rate, *argv) || fg->rate == 0)
+				invarg("invalid rate", *argv);
+		} else if (strcmp(*argv, "size") == 0) {
+			NEXT_ARG();
+			if (get_size(&fg->size, *argv) || fg->size < 40 ||
+			    fg->size > 65535)
+				invarg("invalid size", *argv);
+		} else if (strcmp(*argv, "jitter") == 0) {
+			unsigned int t;
+
+			NEXT_ARG();
+			if (get_time(&t, *argv))
+				invarg("invalid jitter", *argv);
+			fg->jitter = (double)t / TIME_UNITS_PER_SEC;
+		} else if (strcmp(*argv, "distribution") == 0) {
+			NEXT_ARG();
+			fg->dist = malloc(NETEM_DIST_MAX * sizeof(fg->dist[0]));
+			if (fg->dist == NULL)
+				return -1;
+			fg->dist_size = get_distribution(*argv, fg->dist,
+							 NETEM_DIST_MAX);
+			if (fg->dist_size <= 0)
+				return -1;
+		} else if (strcmp(*argv, "src") == 0 ||
+			   strcmp(*argv, "dst") == 0) {
+			inet_prefix a;
+			char *what = *argv;
+
+			NEXT_ARG();
+			if (get_addr(&a, *argv, AF_INET))
+				invarg("invalid address", *argv);
+			if (what[0] == 's')
+				fg->src = a.data[0];
+			else
+				fg->dst = a.data[0];
+		} else if (strcmp(*argv, "proto") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "tcp") == 0)
+				fg->proto = IPPROTO_TCP;
+			else if (strcmp(*argv, "udp") == 0)
+				fg->proto = IPPROTO_UDP;
+			else
+				invarg("proto is tcp or udp", *argv);
+		} else if (strcmp(*argv, "sport") == 0 ||
+			   strcmp(*argv, "dport") == 0) {
+			__u16 port;
+			char *what = *argv;
+
+			NEXT_ARG();
+			if (get_u16(&port, *argv, 0))
+				invarg("invalid port", *argv);
+			if (what[0] == 's')
+				fg->sport = port;
+			else
+				fg->dport = port;
+		} else if (strcmp(*argv, "mark") == 0) {
+			NEXT_ARG();
+			if (get_u32(&v, *argv, 0))
+				invarg("invalid mark", *argv);
+			fg->mark = v;
+		} else if (strcmp(*argv, "priority") == 0) {
+			NEXT_ARG();
+			if (get_tc_classid(&v, *argv) && get_u32(&v, *argv, 0))
+				invarg("invalid priority", *argv);
+			fg->priority = v;
+		} else {
+			argc++; argv--;
+			break;
+		}
+	}
+	if (fg->rate == 0) {
+		fprintf(stderr, "sim: flows need a rate\n");
+		return -1;
+	}
+	if (fg->jitter == 0 && fg->dist) {
+		fprintf(stderr, "sim: a distribution needs a jitter\n");
+		return -1;
+	}
+
+	*argcp = argc;
+	*argvp = argv;
+	return 0;
+}
+
+int do_sim(int argc, char **argv)
+{
+	const char *dev = NULL, *config = NULL, *batch = NULL, *pcap = NULL;
+	struct sim_flows *flows = NULL, **fgp = &flows;
+	struct sim_trace tr = { NULL };
+	unsigned int duration = 10 * TIME_UNITS_PER_SEC, jobs = 1;
+	__u64 linkrate = 1000000000 / 8;
+	double t0, t1, end;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			dev = *argv;
+		} else if (strcmp(*argv, "config") == 0) {
+			NEXT_ARG();
+			config = *argv;
+		} else if (strcmp(*argv, "batch") == 0) {
+			NEXT_ARG();
+			batch = *argv;
+		} else if (strcmp(*argv, "pcap") == 0) {
+			NEXT_ARG();
+			pcap = *argv;
+		} else if (strcmp(*argv, "flows") == 0) {
+			struct sim_flows *fg = calloc(1, sizeof(*fg));
+
+			if (fg == NULL || sim_parse_flows(&argc, &argv, fg) < 0)
+				return -1;
+			*fgp = fg;
+			fgp = &fg->next;
+		} else if (strcmp(*argv, "duration") == 0) {
+			NEXT_ARG();
+			if (get_time(&duration, *argv) || duration == 0)
+				invarg("invalid duration", *argv);
+		} else if (strcmp(*argv, "seed") == 0) {
+			NEXT_ARG();
+			if (get_u64((__u64 *)&sim_rnd_state, *argv, 0))
+				invarg("invalid seed", *argv);
+			sim_rnd_state = sim_rnd_state * 2 + 1;
+		} else if (strcmp(*argv, "linkrate") == 0) {
+			NEXT_ARG();
+			if (get_rate64(&linkrate, *argv))
+				invarg("invalid link rate", *argv);
+		} else if (strcmp(*argv, "txqueuelen") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&sim_txqueuelen, *argv, 0))
+				invarg("invalid txqueuelen", *argv);
+		} else if (strcmp(*argv, "mtu") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&sim_mtu, *argv, 0) || sim_mtu < 64)
+				invarg("invalid mtu", *argv);
+		} else if (strcmp(*argv, "jobs") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&jobs, *argv, 0) || jobs == 0 ||
+			    jobs > SIM_JOBS_MAX)
+				invarg("invalid number of jobs", *argv);
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			return 0;
+		} else {
+			fprintf(stderr, "What is \"%s\"? Try \"tc sim help\".\n",
+				*argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+	if (!config == !batch || !pcap == !flows || (batch && !dev)) {
+		usage();
+		return -1;
+	}
+
+	if (batch) {
+		sim_seed_dev(dev);
+		if (sim_batch(batch) < 0)
+			return 1;
+	} else if (sim_config(config, dev) < 0) {
+		return 1;
+	}
+	if (sim_skipped)
+		fprintf(stderr, "sim: %u messages of other devices skipped\n",
+			sim_skipped);
+	if (sim_link() < 0)
+		return 1;
+
+	if (pcap ? sim_pcap(pcap, &tr) :
+	    sim_flows(flows, (double)duration / TIME_UNITS_PER_SEC, &tr))
+		return 1;
+	if (sim_trace_ready(&tr, jobs) < 0)
+		return 1;
+
+	t0 = sim_clock();
+	if (sim_classify_all(&tr, jobs) < 0)
+		return 1;
+	t1 = sim_clock();
+	end = sim_run(&tr, linkrate);
+
+	sim_report(stdout, end);
+	printf("trace %zu pkt over %.3fs, classified in %.3fs with %u job%s, scheduled in %.3fs\n",
+	       tr.count, end, t1 - t0, jobs, jobs > 1 ? "s" : "",
+	       sim_clock() - t1);
+	return 0;
+}
@@ -0,0 +1,176 @@
+#ifndef _TC_SIM_H_
+#define _TC_SIM_H_ 1
+
+/*
+ * "tc sim": a model of the qdiscs, classes and filters of one device,
+ * built from the netlink messages that set them up, through which a
+ * packet trace is replayed.  Qdisc and filter kinds take part through
+ * the sim ops of their qdisc_util and filter_util.
+ */
+
+#include <linux/types.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+
+#define SIM_DELAY_BUCKETS	96	/* quarter octaves of microseconds */
+
+struct sim_stats
+{
+	__u64		packets;
+	__u64		bytes;
+	__u64		drops;
+	double		delay_sum;
+	double		delay_max;
+	__u32		delay[SIM_DELAY_BUCKETS];
+};
+
+struct sim_qdisc;
+
+struct sim_pkt
+{
+	struct sim_pkt		*next;		/* in a queue */
+	double			time;		/* of arrival, in seconds */
+	const __u8		*data;		/* network header */
+	unsigned int		caplen;		/* bytes at data */
+	unsigned int		len;		/* on the wire */
+	__u16			protocol;	/* ETH_P_*, host order */
+	__u32			mark;
+	__u32			priority;
+	struct sim_qdisc	*leaf;		/* classless qdisc classified to */
+};
+
+/* Packets in arrival order, as most queues keep them */
+struct sim_queue
+{
+	struct sim_pkt		*head;
+	struct sim_pkt		**tail;
+	unsigned int		qlen;
+	unsigned int		bytes;
+};
+
+struct sim_tp;
+
+struct sim_class
+{
+	struct sim_class	*next;		/* of the qdisc */
+	struct sim_class	*hnext;		/* in the hash of class IDs */
+	struct sim_class	*parent;	/* NULL below the qdisc itself */
+	struct sim_qdisc	*qdisc;		/* the class belongs to */
+	struct sim_qdisc	*child;		/* attached qdisc */
+	struct sim_tp		*filters;
+	__u32			classid;
+	__u32			parentid;
+	int			children;	/* classes below this one */
+	int			level;		/* 0 for a leaf */
+	struct sim_stats	stats;
+	void			*priv;
+};
+
+struct sim_qdisc
+{
+	struct sim_qdisc	*next;		/* of the model */
+	const struct sim_qdisc_ops *ops;
+	char			kind[16];
+	__u32			handle;
+	__u32			parentid;
+	struct sim_qdisc	*up;		/* NULL for the root */
+	struct sim_class	*parent;	/* in up, NULL if up holds it itself */
+	struct sim_class	*classes;
+	struct sim_tp		*filters;
+	unsigned int		qlen;
+	int			builtin;	/* made up, not configured */
+	struct sim_stats	stats;
+	void			*priv;
+};
+
+/* The filters of one kind, priority and protocol */
+struct sim_tp
+{
+	struct sim_tp		*next;		/* by priority */
+	struct sim_tp		**chain;
+	const struct sim_filter_ops *ops;
+	char			kind[16];
+	__u32			prio;
+	__u16			protocol;	/* network order, as in tcm_info */
+	__u32			qhandle;	/* of the qdisc filtered for */
+	void			*priv;
+};
+
+struct sim_qdisc_ops
+{
+	/* Options of the qdisc, or of one of its classes.  Called again
+	 * with the new options for a change; opt may be NULL.
+	 */
+	int	(*init)(struct sim_qdisc *q, struct rtattr *opt);
+	int	(*class_init)(struct sim_class *cl, struct rtattr *opt);
+	/* Once the model is complete */
+	int	(*start)(struct sim_qdisc *q, double now);
+	/* Classful qdiscs: the qdisc below this one a packet goes to,
+	 * or NULL if it is dropped.  Called from several processes at
+	 * once, so nothing may be written.
+	 */
+	struct sim_qdisc *(*classify)(struct sim_qdisc *q, struct sim_pkt *p);
+	/* Returns 0, or -1 if the packet was dropped.  Drops, of it or
+	 * of a queued packet, go through sim_drop().
+	 */
+	int	(*enqueue)(struct sim_qdisc *q, struct sim_pkt *p, double now);
+	/* NULL sets *next to when a packet may be sent, or leaves it */
+	struct sim_pkt *(*dequeue)(struct sim_qdisc *q, double now, double *next);
+};
+
+struct sim_filter_ops
+{
+	/* When a request makes the tp; a dump brings what it made along */
+	int	(*init)(struct sim_tp *tp);
+	/* Adds a filter of the tp, as a RTM_NEWTFILTER would */
+	int	(*add)(struct sim_tp *tp, __u32 handle, struct rtattr *opt);
+	/* Once the model is complete */
+	int	(*start)(struct sim_tp *tp);
+	/* 0 and the class ID for a match, -1 for none */
+	int	(*classify)(struct sim_tp *tp, const struct sim_pkt *p,
+			    __u32 *classid);
+};
+
+/* The model */
+extern unsigned int sim_txqueuelen;
+extern unsigned int sim_mtu;
+
+extern struct sim_class *sim_class_new(struct sim_qdisc *q, __u32 classid);
+extern struct sim_class *sim_class_find(struct sim_qdisc *q, __u32 classid);
+extern struct sim_qdisc *sim_qdisc_builtin(struct sim_qdisc *up,
+					   struct sim_class *parent,
+					   const char *kind, unsigned int limit);
+extern int sim_filter(struct sim_tp *chain, const struct sim_pkt *p,
+		      __u32 *classid);
+extern struct sim_class *sim_class_of(struct sim_qdisc *q,
+				      const struct sim_pkt *p);
+
+/* Queues */
+extern int sim_enqueue(struct sim_qdisc *q, struct sim_pkt *p, double now);
+extern struct sim_pkt *sim_dequeue(struct sim_qdisc *q, double now,
+				   double *next);
+extern void sim_drop(struct sim_qdisc *q, struct sim_pkt *p);
+extern void sim_queue_init(struct sim_queue *sq);
+extern void sim_queue_tail(struct sim_queue *sq, struct sim_pkt *p);
+extern struct sim_pkt *sim_queue_head(struct sim_queue *sq);
+
+/* Packets */
+struct sim_flow
+{
+	__u32	src[4];
+	__u32	dst[4];
+	int	alen;		/* words of address */
+	__u8	proto;
+	__u16	sport;		/* host order */
+	__u16	dport;
+	int	has_ports;
+};
+
+extern int sim_flow_keys(const struct sim_pkt *p, struct sim_flow *fl);
+extern const __u8 *sim_transport(const struct sim_pkt *p);
+extern const __u8 *sim_layer(const struct sim_pkt *p, int layer,
+			     unsigned int *len);
+extern double sim_l2t(const struct tc_ratespec *r, __u64 rate,
+		      unsigned int len);
+
+#endif /* _TC_SIM_H_ */
@@ -27,19 +27,51 @@
 #include "tc_core.h"
 #include "tc_common.h"
 
+/* The overheads of tc-stab(8), "TYPICAL OVERHEADS".  16 byte slots
+ * give ATM sizes exactly, so the table is 128 entries instead of 512.
+ */
+static const struct stab_preset {
+	const char	*name;
+	int		overhead;
+} stab_presets[] = {
+	{ "adsl-pppoa",		10 },
+	{ "adsl-pppoa-vcmux",	10 },
+	{ "adsl-pppoa-llc",	14 },
+	{ "adsl-pppoe",		32 },
+	{ "adsl-pppoe-vcmux",	32 },
+	{ "adsl-pppoe-llc",	40 },
+	{ "adsl-bridged",	24 },
+	{ "adsl-bridged-vcmux",	24 },
+	{ "adsl-bridged-llc",	32 },
+	{ "adsl-ipoa",		8 },
+	{ "adsl-ipoa-vcmux",	8 },
+	{ "adsl-ipoa-llc",	16 },
+	{ NULL }
+};
+
+#define STAB_PRESET_MTU		2047
+#define STAB_PRESET_TSIZE	128
+
 static void stab_help(void)
 {
+	const struct stab_preset *p;
+
 	fprintf(stderr,
 		"Usage: ... stab [ mtu BYTES ] [ tsize SLOTS ] [ mpu BYTES ] \n"
 		"                [ overhead BYTES ] [ linklayer TYPE ] ...\n"
+		"       ... stab preset NAME [ OPTIONS ]\n"
 		"   mtu       : max packet size we create rate map for {2047}\n"
 		"   tsize     : how many slots should size table have {512}\n"
 		"   mpu       : minimum packet size used in rate computations\n"
 		"   overhead  : per-packet size overhead used in rate computations\n"
 		"   linklayer : adapting to a linklayer e.g. atm\n"
-		"Example: ... stab overhead 20 linklayer atm\n");
-
-	return;
+		"   preset    : atm with the overhead of an adsl encapsulation,\n"
+		"               other options given override it\n"
+		"Example: ... stab overhead 20 linklayer atm\n"
+		"Presets:");
+	for (p = stab_presets; p->name; p++)
+		fprintf(stderr, " %s", p->name);
+	fprintf(stderr, "\n");
 }
 
 int check_size_table_opts(struct tc_sizespec *s)
@@ -52,6 +84,8 @@ int parse_size_table(int *argcp, char ***argvp, struct tc_sizespec *sp)
 {
 	char **argv = *argvp;
 	int argc = *argcp;
+	const struct stab_preset *preset = NULL;
+	int overhead_set = 0;
 	struct tc_sizespec s;
 
 	memset(&s, 0, sizeof(s));
@@ -86,6 +120,7 @@ int parse_size_table(int *argcp, char ***argvp, struct tc_sizespec *sp)
 				invarg("overhead", "invalid overhead");
 				return -1;
 			}
+			overhead_set = 1;
 		} else if (matches(*argv, "tsize") == 0) {
 			NEXT_ARG();
 			if (s.tsize)
@@ -102,11 +137,33 @@ int parse_size_table(int *argcp, char ***argvp, struct tc_sizespec *sp)
 				invarg("linklayer", "invalid linklayer");
 				return -1;
 			}
+		} else if (matches(*argv, "preset") == 0) {
+			NEXT_ARG();
+			if (preset)
+				duparg("preset", *argv);
+			for (preset = stab_presets; preset->name; preset++)
+				if (strcmp(preset->name, *argv) == 0)
+					break;
+			if (preset->name == NULL)
+				invarg("unknown preset", *argv);
 		} else
 			break;
 		argc--; argv++;
 	}
 
+	if (preset) {
+		if (s.linklayer == LINKLAYER_UNSPEC)
+			s.linklayer = LINKLAYER_ATM;
+		if (!overhead_set)
+			s.overhead = preset->overhead;
+		if (!s.mtu && !s.tsize)
+			s.tsize = STAB_PRESET_TSIZE;
+		else if (!s.tsize)
+			s.tsize = (s.mtu + 15) / 16;
+		if (!s.mtu)
+			s.mtu = STAB_PRESET_MTU;
+	}
+
 	if (!check_size_table_opts(&s))
 		return -1;
 
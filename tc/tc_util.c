@@ -94,6 +94,27 @@ ok:
 	return 0;
 }
 
+/* CLASSID or an inclusive range CLASSID-CLASSID */
+int get_tc_classid_range(__u32 *min, __u32 *max, char *str)
+{
+	char *dash = strchr(str, '-');
+	int err;
+
+	if (dash == NULL) {
+		if (get_tc_classid(min, str))
+			return -1;
+		*max = *min;
+		return 0;
+	}
+
+	*dash = 0;
+	err = get_tc_classid(min, str) || get_tc_classid(max, dash + 1);
+	*dash = '-';
+	if (err || *max < *min)
+		return -1;
+	return 0;
+}
+
 int print_tc_classid(char *buf, int len, __u32 h)
 {
 	if (h == TC_H_ROOT)
@@ -143,28 +164,39 @@ static const struct rate_suffix {
 };
 
 
-int get_rate(unsigned *rate, const char *str)
+int get_rate64(__u64 *rate, const char *str)
 {
 	char *p;
 	double bps = strtod(str, &p);
 	const struct rate_suffix *s;
 
-	if (p == str)
+	if (p == str || bps < 0)
 		return -1;
 
-	if (*p == '\0') {
-		*rate = bps / 8.;	/* assume bytes/sec */
-		return 0;
+	if (*p != '\0') {
+		for (s = suffixes; s->name; ++s)
+			if (strcasecmp(s->name, p) == 0)
+				break;
+		if (s->name == NULL)
+			return -1;
+		bps *= s->scale;
 	}
 
-	for (s = suffixes; s->name; ++s) {
-		if (strcasecmp(s->name, p) == 0) {
-			*rate = (bps * s->scale) / 8.;
-			return 0;
-		}
-	}
+	bps /= 8.;	/* bytes/sec */
+	if (bps >= 18446744073709551616.)
+		return -1;
+	*rate = bps;
+	return 0;
+}
+
+int get_rate(unsigned *rate, const char *str)
+{
+	__u64 rate64;
 
-	return -1;
+	if (get_rate64(&rate64, str) || rate64 > ~0U)
+		return -1;
+	*rate = rate64;
+	return 0;
 }
 
 int get_rate_and_cell(unsigned *rate, int *cell_log, char *str)
@@ -196,7 +228,7 @@ int get_rate_and_cell(unsigned *rate, int *cell_log, char *str)
 	return 0;
 }
 
-void print_rate(char *buf, int len, __u32 rate)
+void print_rate(char *buf, int len, __u64 rate)
 {
 	double tmp = (double)rate*8;
 	extern int use_iec;
@@ -218,7 +250,7 @@ void print_rate(char *buf, int len, __u32 rate)
 	}
 }
 
-char * sprint_rate(__u32 rate, char *buf)
+char * sprint_rate(__u64 rate, char *buf)
 {
 	print_rate(buf, SPRINT_BSIZE-1, rate);
 	return buf;
@@ -551,3 +583,247 @@ compat_xstats:
 		*xstats = tb[TCA_XSTATS];
 }
 
+
+RTATTR_TABLE(tcstats2_tb, TCA_STATS_MAX);
+
+/* TCA_STATS2, or the old TCA_STATS, in one form */
+void tcstats_collect(struct rtattr *stats2, struct rtattr *stats,
+		     struct gnet_stats_basic *bs,
+		     struct gnet_stats_queue *q,
+		     struct gnet_stats_rate_est *re,
+		     struct rtattr **app)
+{
+	memset(bs, 0, sizeof(*bs));
+	memset(q, 0, sizeof(*q));
+	memset(re, 0, sizeof(*re));
+	*app = NULL;
+
+	if (stats2) {
+		struct rtattr **tbs;
+
+		tbs = parse_rtattr_table_nested(&tcstats2_tb, stats2);
+		if (tbs[TCA_STATS_BASIC])
+			memcpy(bs, RTA_DATA(tbs[TCA_STATS_BASIC]), MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(*bs)));
+		if (tbs[TCA_STATS_QUEUE])
+			memcpy(q, RTA_DATA(tbs[TCA_STATS_QUEUE]), MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]), sizeof(*q)));
+		if (tbs[TCA_STATS_RATE_EST])
+			memcpy(re, RTA_DATA(tbs[TCA_STATS_RATE_EST]), MIN(RTA_PAYLOAD(tbs[TCA_STATS_RATE_EST]), sizeof(*re)));
+		*app = tbs[TCA_STATS_APP];
+	} else if (stats) {
+		struct tc_stats st;
+
+		memset(&st, 0, sizeof(st));
+		memcpy(&st, RTA_DATA(stats), MIN(RTA_PAYLOAD(stats), sizeof(st)));
+		bs->bytes = st.bytes;
+		bs->packets = st.packets;
+		q->drops = st.drops;
+		q->overlimits = st.overlimits;
+		q->backlog = st.backlog;
+		q->qlen = st.qlen;
+		re->bps = st.bps;
+		re->pps = st.pps;
+	}
+}
+
+/* The -counters form of the statistics: "bytes packets drops overlimits
+ * requeues backlog qlen bps pps" as plain numbers, rates in bytes and
+ * packets per second, zero where the kernel reported nothing.
+ */
+void print_tcstats_counters(FILE *fp, struct rtattr *tb[])
+{
+	struct gnet_stats_basic bs;
+	struct gnet_stats_queue q;
+	struct gnet_stats_rate_est re;
+	struct rtattr *app;
+
+	tcstats_collect(tb[TCA_STATS2], tb[TCA_STATS], &bs, &q, &re, &app);
+
+	fprintf(fp, "%llu %u %u %u %u %u %u %u %u",
+		(unsigned long long)bs.bytes, bs.packets, q.drops,
+		q.overlimits, q.requeues, q.backlog, q.qlen, re.bps, re.pps);
+}
+
+void print_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+/*
+ * The kind specific printers only write text; for -json it goes into a
+ * string field, white space folded to single blanks.
+ */
+FILE *json_text_open(struct json_text *jt)
+{
+	jt->buf = NULL;
+	jt->len = 0;
+	jt->fp = open_memstream(&jt->buf, &jt->len);
+	return jt->fp;
+}
+
+void json_text_close(FILE *fp, const char *key, struct json_text *jt)
+{
+	char *r, *w;
+
+	if (jt->fp == NULL)
+		return;
+	fclose(jt->fp);
+
+	for (r = w = jt->buf; *r; r++) {
+		if (*r == ' ' || *r == '\t' || *r == '\n' || *r == '\r') {
+			if (w > jt->buf && w[-1] != ' ')
+				*w++ = ' ';
+		} else
+			*w++ = *r;
+	}
+	if (w > jt->buf && w[-1] == ' ')
+		w--;
+	*w = 0;
+
+	if (w > jt->buf) {
+		fprintf(fp, ",\"%s\":", key);
+		print_json_string(fp, jt->buf);
+	}
+	free(jt->buf);
+}
+
+static void print_json_hex(FILE *fp, const char *key, struct rtattr *rta)
+{
+	const unsigned char *d = RTA_DATA(rta);
+	int i;
+
+	fprintf(fp, ",\"%s\":\"", key);
+	for (i = 0; i < RTA_PAYLOAD(rta); i++)
+		fprintf(fp, "%02x", d[i]);
+	fputc('"', fp);
+}
+
+/* The stats of TCA_STATS2 or TCA_STATS, and the xstats as hex */
+void print_tcstats_json(FILE *fp, struct rtattr *stats2, struct rtattr *stats,
+			struct rtattr *xstats)
+{
+	struct gnet_stats_basic bs;
+	struct gnet_stats_queue q;
+	struct gnet_stats_rate_est re;
+	struct rtattr *app;
+
+	if (stats2 || stats) {
+		tcstats_collect(stats2, stats, &bs, &q, &re, &app);
+		fprintf(fp, ",\"stats\":{\"bytes\":%llu,\"packets\":%u,"
+			"\"drops\":%u,\"overlimits\":%u,\"requeues\":%u,"
+			"\"backlog\":%u,\"qlen\":%u,\"bps\":%u,\"pps\":%u}",
+			(unsigned long long)bs.bytes, bs.packets, q.drops,
+			q.overlimits, q.requeues, q.backlog, q.qlen,
+			re.bps, re.pps);
+		if (app)
+			xstats = app;
+	}
+	if (xstats)
+		print_json_hex(fp, "xstats", xstats);
+}
+
+/*
+ * The xstats as the kind decodes them, for kinds that do, as text the
+ * way the options are given.
+ */
+void print_xstats_json(FILE *fp, struct qdisc_util *q, struct rtattr *stats2,
+		       struct rtattr *xstats)
+{
+	struct json_text jt;
+
+	if (stats2) {
+		struct rtattr *tbs[TCA_STATS_MAX + 1];
+
+		parse_rtattr_nested(tbs, TCA_STATS_MAX, stats2);
+		if (tbs[TCA_STATS_APP])
+			xstats = tbs[TCA_STATS_APP];
+	}
+	if (xstats == NULL || q == NULL || q->print_xstats == NULL ||
+	    !json_text_open(&jt))
+		return;
+	q->print_xstats(q, jt.fp, xstats);
+	json_text_close(fp, "xstats_text", &jt);
+}
+
+/*
+ * -tlv: a qdisc or class goes out as a netlink message holding only its
+ * tcmsg, kind and statistics attributes, so collectors parse the stats
+ * with their netlink code and skip the options.
+ */
+void print_tcmsg_tlv(FILE *fp, struct nlmsghdr *n, struct rtattr *tb[])
+{
+	static const int keep[] = { TCA_KIND, TCA_STATS, TCA_XSTATS, TCA_STATS2 };
+	struct nlmsghdr h = *n;
+	int i;
+
+	h.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	for (i = 0; i < sizeof(keep) / sizeof(keep[0]); i++)
+		if (tb[keep[i]])
+			h.nlmsg_len += RTA_ALIGN(tb[keep[i]]->rta_len);
+
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(NLMSG_DATA(n), NLMSG_ALIGN(sizeof(struct tcmsg)), 1, fp);
+	for (i = 0; i < sizeof(keep) / sizeof(keep[0]); i++) {
+		static const char pad[RTA_ALIGNTO];
+		struct rtattr *rta = tb[keep[i]];
+
+		if (rta == NULL)
+			continue;
+		fwrite(rta, rta->rta_len, 1, fp);
+		fwrite(pad, RTA_ALIGN(rta->rta_len) - rta->rta_len, 1, fp);
+	}
+}
+
+/* jhash2() of the kernel, which cls_flow hashes the keys with */
+#define rol32(x, k)	(((x) << (k)) | ((x) >> (32 - (k))))
+#define jhash_mix(a, b, c) do {				\
+	a -= c; a ^= rol32(c, 4);  c += b;		\
+	b -= a; b ^= rol32(a, 6);  a += c;		\
+	c -= b; c ^= rol32(b, 8);  b += a;		\
+	a -= c; a ^= rol32(c, 16); c += b;		\
+	b -= a; b ^= rol32(a, 19); a += c;		\
+	c -= b; c ^= rol32(b, 4);  b += a;		\
+} while (0)
+#define jhash_final(a, b, c) do {			\
+	c ^= b; c -= rol32(b, 14);			\
+	a ^= c; a -= rol32(c, 11);			\
+	b ^= a; b -= rol32(a, 25);			\
+	c ^= b; c -= rol32(b, 16);			\
+	a ^= c; a -= rol32(c, 4);			\
+	b ^= a; b -= rol32(a, 14);			\
+	c ^= b; c -= rol32(b, 24);			\
+} while (0)
+
+__u32 tc_jhash2(const __u32 *k, __u32 length, __u32 initval)
+{
+	__u32 a, b, c;
+
+	a = b = c = 0xdeadbeef + (length << 2) + initval;
+	while (length > 3) {
+		a += k[0];
+		b += k[1];
+		c += k[2];
+		jhash_mix(a, b, c);
+		length -= 3;
+		k += 3;
+	}
+	switch (length) {
+	case 3: c += k[2];
+	case 2: b += k[1];
+	case 1: a += k[0];
+		jhash_final(a, b, c);
+	case 0:
+		break;
+	}
+	return c;
+}
@@ -23,6 +23,21 @@ enum
 #define TCA_PRIO_MAX    (__TCA_PRIO_MAX - 1)
 #endif
 
+/* A class generator reads a file and adds many classes of one kind.
+ * For each class it hands emit() the parent, the class ID and the
+ * payload of TCA_OPTIONS; emit() sends it behind the common header.
+ */
+struct class_bulk
+{
+	const char	*name;		/* the file, for messages */
+	__u32		parent;		/* of classes that name none */
+	int		(*emit)(struct class_bulk *cb, __u32 parent, __u32 classid,
+				const void *opt, int len);
+};
+
+struct sim_qdisc_ops;
+struct sim_filter_ops;
+
 struct qdisc_util
 {
 	struct  qdisc_util *next;
@@ -33,6 +48,25 @@ struct qdisc_util
 
 	int	(*parse_copt)(struct qdisc_util *qu, int argc, char **argv, struct nlmsghdr *n);
 	int	(*print_copt)(struct qdisc_util *qu, FILE *f, struct rtattr *opt);
+	int	(*bulk_copt)(struct qdisc_util *qu, struct class_bulk *cb, FILE *fp);
+	const struct sim_qdisc_ops *sim;
+};
+
+/* A filter compiler turns a file of rules into "filter add" commands
+ * starting with prefix and hands them to emit() in order.  With gate
+ * set the rules are built unreachable and made live by the last
+ * command, after sync() has confirmed everything before it.
+ * txqueues() gives the TX queue count of dev, 0 if it is not known.
+ */
+struct filter_compile
+{
+	const char	*prefix;
+	const char	*dev;		/* or NULL */
+	int		gate;
+	const __u8	*ht_busy;	/* u32 hash table IDs in use, or NULL */
+	int		(*emit)(struct filter_compile *fc, char *cmd);
+	int		(*sync)(struct filter_compile *fc);
+	int		(*txqueues)(struct filter_compile *fc);
 };
 
 extern __u16 f_proto;
@@ -43,6 +77,9 @@ struct filter_util
 	int	(*parse_fopt)(struct filter_util *qu, char *fhandle, int argc,
 			      char **argv, struct nlmsghdr *n);
 	int	(*print_fopt)(struct filter_util *qu, FILE *f, struct rtattr *opt, __u32 fhandle);
+	int	(*compile_fopt)(struct filter_util *qu, struct filter_compile *fc,
+				int argc, char **argv);
+	const struct sim_filter_ops *sim;
 };
 
 struct action_util
@@ -62,17 +99,18 @@ extern struct filter_util *get_filter_kind(const char *str);
 
 extern int get_qdisc_handle(__u32 *h, const char *str);
 extern int get_rate(unsigned *rate, const char *str);
+extern int get_rate64(__u64 *rate, const char *str);
 extern int get_size(unsigned *size, const char *str);
 extern int get_size_and_cell(unsigned *size, int *cell_log, char *str);
 extern int get_time(unsigned *time, const char *str);
 extern int get_linklayer(unsigned *val, const char *arg);
 
-extern void print_rate(char *buf, int len, __u32 rate);
+extern void print_rate(char *buf, int len, __u64 rate);
 extern void print_size(char *buf, int len, __u32 size);
 extern void print_qdisc_handle(char *buf, int len, __u32 h);
 extern void print_time(char *buf, int len, __u32 time);
 extern void print_linklayer(char *buf, int len, unsigned linklayer);
-extern char * sprint_rate(__u32 rate, char *buf);
+extern char * sprint_rate(__u64 rate, char *buf);
 extern char * sprint_size(__u32 size, char *buf);
 extern char * sprint_qdisc_handle(__u32 h, char *buf);
 extern char * sprint_tc_classid(__u32 h, char *buf);
@@ -82,8 +120,34 @@ extern char * sprint_linklayer(unsigned linklayer, char *buf);
 
 extern void print_tcstats_attr(FILE *fp, struct rtattr *tb[], char *prefix, struct rtattr **xstats);
 extern void print_tcstats2_attr(FILE *fp, struct rtattr *rta, char *prefix, struct rtattr **xstats);
+extern void print_tcstats_counters(FILE *fp, struct rtattr *tb[]);
+extern void tcstats_collect(struct rtattr *stats2, struct rtattr *stats,
+			    struct gnet_stats_basic *bs,
+			    struct gnet_stats_queue *q,
+			    struct gnet_stats_rate_est *re,
+			    struct rtattr **app);
+
+struct json_text
+{
+	FILE	*fp;
+	char	*buf;
+	size_t	len;
+};
+
+extern void print_json_string(FILE *fp, const char *s);
+extern FILE *json_text_open(struct json_text *jt);
+extern void json_text_close(FILE *fp, const char *key, struct json_text *jt);
+extern void print_tcstats_json(FILE *fp, struct rtattr *stats2,
+			       struct rtattr *stats, struct rtattr *xstats);
+extern void print_xstats_json(FILE *fp, struct qdisc_util *q,
+			      struct rtattr *stats2, struct rtattr *xstats);
+extern void print_tcmsg_tlv(FILE *fp, struct nlmsghdr *n, struct rtattr *tb[]);
+
+extern __u32 tc_jhash2(const __u32 *k, __u32 length, __u32 initval);
+extern int get_distribution(const char *type, __s16 *data, int maxdata);
 
 extern int get_tc_classid(__u32 *h, const char *str);
+extern int get_tc_classid_range(__u32 *min, __u32 *max, char *str);
 extern int print_tc_classid(char *buf, int len, __u32 h);
 extern char * sprint_tc_classid(__u32 h, char *buf);
 
@@ -0,0 +1,130 @@
+/*
+ * bench.c		Common part of the microbenchmarks.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libnetlink.h"
+#include "bench.h"
+
+unsigned long long bench_allocs;
+FILE *bench_out;
+double bench_seconds = 0.5;
+
+/* Allocations are counted by standing in for the allocator, which
+ * glibc supports; its own calls come through here too.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+	bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench_report(const char *name, unsigned long long ops, double secs,
+		  unsigned long long allocs)
+{
+	FILE *fp = bench_out ? : stdout;
+
+	fprintf(fp, "%-28s %12.0f msg/s %10.1f ns/msg %8.2f allocs/msg\n",
+		name, secs > 0 ? ops / secs : 0.0,
+		ops ? secs * 1e9 / ops : 0.0,
+		ops ? (double)allocs / ops : 0.0);
+	fflush(fp);
+}
+
+void bench_add(struct bench_msgs *m, const struct nlmsghdr *n)
+{
+	struct nlmsghdr *copy;
+
+	if (m->count == m->size) {
+		m->size = m->size ? 2 * m->size : 1024;
+		m->msg = realloc(m->msg, m->size * sizeof(*m->msg));
+		if (m->msg == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	copy = malloc(NLMSG_ALIGN(n->nlmsg_len));
+	if (copy == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	memcpy(copy, n, n->nlmsg_len);
+	m->msg[m->count++] = copy;
+}
+
+static int bench_keep(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		      void *arg)
+{
+	bench_add(arg, n);
+	return 0;
+}
+
+/* Read a capture as written by "ip -capture" or rtmon */
+int bench_load(struct bench_msgs *m, const char *file)
+{
+	FILE *fp = fopen(file, "r");
+	int ret;
+
+	if (fp == NULL) {
+		perror(file);
+		return -1;
+	}
+	ret = rtnl_from_file(fp, bench_keep, m);
+	fclose(fp);
+	return ret;
+}
+
+/* Same for a capture made up in memory */
+int bench_capture(struct bench_msgs *m, const void *buf, size_t len)
+{
+	FILE *fp = fmemopen((void *)buf, len, "r");
+	int ret;
+
+	if (fp == NULL) {
+		perror("fmemopen");
+		return -1;
+	}
+	ret = rtnl_from_file(fp, bench_keep, m);
+	fclose(fp);
+	return ret;
+}
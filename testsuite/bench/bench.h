@@ -0,0 +1,45 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__ 1
+
+#include <stdio.h>
+#include <linux/netlink.h>
+
+/* Messages of a capture, in the order they were read */
+struct bench_msgs {
+	struct nlmsghdr	**msg;
+	int		count;
+	int		size;
+};
+
+extern unsigned long long bench_allocs;
+extern double bench_seconds;
+extern FILE *bench_out;		/* reports go here, stdout if NULL */
+
+extern double bench_now(void);
+extern void bench_report(const char *name, unsigned long long ops,
+			 double secs, unsigned long long allocs);
+extern int bench_load(struct bench_msgs *m, const char *file);
+extern int bench_capture(struct bench_msgs *m, const void *buf, size_t len);
+extern void bench_add(struct bench_msgs *m, const struct nlmsghdr *n);
+
+/* Run body over every message of m until bench_seconds have passed,
+ * then report the rate and the allocations made per message.
+ */
+#define BENCH_RUN(name, m, body)					\
+do {									\
+	unsigned long long __ops = 0, __allocs = bench_allocs;		\
+	double __start = bench_now(), __t;				\
+	int __i;							\
+									\
+	do {								\
+		for (__i = 0; __i < (m)->count; __i++) {		\
+			struct nlmsghdr *n = (m)->msg[__i];		\
+			body;						\
+		}							\
+		__ops += (m)->count;					\
+		__t = bench_now() - __start;				\
+	} while (__t < bench_seconds && (m)->count);			\
+	bench_report(name, __ops, __t, bench_allocs - __allocs);	\
+} while (0)
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,433 @@
+/*
+ * nlbench.c		Microbenchmarks of libnetlink and of ip's printing.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * nlbench [ -t SECONDS ] [ CAPTURE... ]
+ *
+ * Every benchmark runs over the messages of the captures (as written
+ * by "ip -capture" or rtmon) or, without any, over links, addresses and
+ * routes made up here, and reports messages per second and allocations
+ * per message.  ip is linked in with its main() renamed, so the real
+ * print_route() and friends are measured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <linux/if.h>
+#include <linux/rtnetlink.h>
+
+#include "utils.h"
+#include "libnetlink.h"
+#include "ll_map.h"
+#include "rt_names.h"
+#include "ip_common.h"
+#include "bench.h"
+
+static int nlinks = 1000;
+static int nroutes = 100000;
+
+struct bench_req {
+	struct nlmsghdr	n;
+	union {
+		struct ifinfomsg	ifi;
+		struct ifaddrmsg	ifa;
+		struct rtmsg		r;
+	};
+	char		buf[1024];
+};
+
+static void gen_link(struct bench_msgs *m, int idx)
+{
+	struct bench_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_type = RTM_NEWLINK,
+		.n.nlmsg_flags = NLM_F_MULTI,
+		.ifi.ifi_family = AF_UNSPEC,
+		.ifi.ifi_type = ARPHRD_ETHER,
+		.ifi.ifi_index = idx,
+		.ifi.ifi_flags = IFF_UP | IFF_BROADCAST | IFF_MULTICAST |
+				 IFF_RUNNING | IFF_LOWER_UP,
+	};
+	struct rtnl_link_stats64 stats = {
+		.rx_packets = 123456789, .tx_packets = 98765432,
+		.rx_bytes = 123456789000ULL, .tx_bytes = 98765432000ULL,
+	};
+	unsigned char mac[6] = { 0x52, 0x54, 0, idx >> 16, idx >> 8, idx };
+	unsigned char brd[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	char name[IFNAMSIZ];
+
+	snprintf(name, sizeof(name), "bench%d", idx);
+	addattr_l(&req.n, sizeof(req), IFLA_IFNAME, name, strlen(name) + 1);
+	addattr32(&req.n, sizeof(req), IFLA_MTU, 1500);
+	addattr32(&req.n, sizeof(req), IFLA_TXQLEN, 1000);
+	addattr8(&req.n, sizeof(req), IFLA_OPERSTATE, IF_OPER_UP);
+	addattr_l(&req.n, sizeof(req), IFLA_QDISC, "fq_codel", 9);
+	addattr_l(&req.n, sizeof(req), IFLA_ADDRESS, mac, sizeof(mac));
+	addattr_l(&req.n, sizeof(req), IFLA_BROADCAST, brd, sizeof(brd));
+	addattr_l(&req.n, sizeof(req), IFLA_STATS64, &stats, sizeof(stats));
+	bench_add(m, &req.n);
+}
+
+static void gen_addr(struct bench_msgs *m, int idx, int family)
+{
+	struct bench_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+		.n.nlmsg_type = RTM_NEWADDR,
+		.n.nlmsg_flags = NLM_F_MULTI,
+		.ifa.ifa_family = family,
+		.ifa.ifa_index = idx,
+	};
+	char name[IFNAMSIZ];
+
+	if (family == AF_INET) {
+		__u32 a = htonl(0x0a000001 | idx << 8);
+		__u32 b = htonl(0x0a0000ff | idx << 8);
+
+		req.ifa.ifa_prefixlen = 24;
+		addattr_l(&req.n, sizeof(req), IFA_LOCAL, &a, 4);
+		addattr_l(&req.n, sizeof(req), IFA_ADDRESS, &a, 4);
+		addattr_l(&req.n, sizeof(req), IFA_BROADCAST, &b, 4);
+		snprintf(name, sizeof(name), "bench%d", idx);
+		addattr_l(&req.n, sizeof(req), IFA_LABEL, name,
+			  strlen(name) + 1);
+	} else {
+		struct in6_addr a = { { { 0x20, 0x01, 0x0d, 0xb8 } } };
+
+		a.s6_addr[6] = idx >> 8;
+		a.s6_addr[7] = idx;
+		a.s6_addr[15] = 1;
+		req.ifa.ifa_prefixlen = 64;
+		addattr_l(&req.n, sizeof(req), IFA_ADDRESS, &a, 16);
+	}
+	bench_add(m, &req.n);
+}
+
+static void gen_route(struct bench_msgs *m, int i)
+{
+	struct bench_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
+		.n.nlmsg_type = RTM_NEWROUTE,
+		.n.nlmsg_flags = NLM_F_MULTI,
+		.r.rtm_table = RT_TABLE_MAIN,
+		.r.rtm_protocol = RTPROT_STATIC,
+		.r.rtm_scope = RT_SCOPE_UNIVERSE,
+		.r.rtm_type = RTN_UNICAST,
+	};
+	int oif = 1 + i % nlinks;
+
+	if (i % 4) {
+		__u32 dst = htonl(0x14000000 | i << 8);
+		__u32 gw = htonl(0x0a000002 | (oif - 1) << 8);
+
+		req.r.rtm_family = AF_INET;
+		req.r.rtm_dst_len = 24;
+		addattr_l(&req.n, sizeof(req), RTA_DST, &dst, 4);
+		addattr_l(&req.n, sizeof(req), RTA_GATEWAY, &gw, 4);
+	} else {
+		struct in6_addr dst = { { { 0x20, 0x01, 0x0d, 0xb8, 0xff } } };
+
+		dst.s6_addr[5] = i >> 16;
+		dst.s6_addr[6] = i >> 8;
+		dst.s6_addr[7] = i;
+		req.r.rtm_family = AF_INET6;
+		req.r.rtm_dst_len = 64;
+		addattr_l(&req.n, sizeof(req), RTA_DST, &dst, 16);
+		addattr32(&req.n, sizeof(req), RTA_PRIORITY, 1024);
+	}
+	addattr32(&req.n, sizeof(req), RTA_TABLE, RT_TABLE_MAIN);
+	addattr32(&req.n, sizeof(req), RTA_OIF, oif);
+	bench_add(m, &req.n);
+}
+
+/* Made up messages go through a capture in memory, so that they are
+ * read back just as a recorded one would be.
+ */
+static void gen_capture(struct bench_msgs *m)
+{
+	struct bench_msgs gen = { 0 };
+	size_t len = 0, off = 0;
+	char *buf;
+	int i;
+
+	for (i = 1; i <= nlinks; i++)
+		gen_link(&gen, i);
+	for (i = 1; i <= nlinks; i++) {
+		gen_addr(&gen, i, AF_INET);
+		gen_addr(&gen, i, AF_INET6);
+	}
+	for (i = 0; i < nroutes; i++)
+		gen_route(&gen, i);
+
+	for (i = 0; i < gen.count; i++)
+		len += NLMSG_ALIGN(gen.msg[i]->nlmsg_len);
+	buf = calloc(1, len);
+	if (buf == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < gen.count; i++) {
+		memcpy(buf + off, gen.msg[i], gen.msg[i]->nlmsg_len);
+		off += NLMSG_ALIGN(gen.msg[i]->nlmsg_len);
+		free(gen.msg[i]);
+	}
+	free(gen.msg);
+
+	if (bench_capture(m, buf, len) < 0)
+		exit(1);
+	free(buf);
+}
+
+static void split(const struct bench_msgs *all, struct bench_msgs *links,
+		  struct bench_msgs *addrs, struct bench_msgs *routes)
+{
+	int i;
+
+	for (i = 0; i < all->count; i++) {
+		struct nlmsghdr *n = all->msg[i];
+		struct bench_msgs *m;
+
+		switch (n->nlmsg_type) {
+		case RTM_NEWLINK:
+			m = links;
+			break;
+		case RTM_NEWADDR:
+			m = addrs;
+			break;
+		case RTM_NEWROUTE:
+			m = routes;
+			break;
+		default:
+			continue;
+		}
+		if (m->count == m->size) {
+			m->size = m->size ? 2 * m->size : 1024;
+			m->msg = realloc(m->msg, m->size * sizeof(*m->msg));
+			if (m->msg == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		m->msg[m->count++] = n;
+	}
+}
+
+static int parse_one(struct nlmsghdr *n)
+{
+	struct rtattr *tb[64];
+	int len;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWLINK:
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifinfomsg));
+		return parse_rtattr(tb, IFLA_MAX < 63 ? IFLA_MAX : 63,
+				    IFLA_RTA(NLMSG_DATA(n)), len);
+	case RTM_NEWADDR:
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		return parse_rtattr(tb, IFA_MAX, IFA_RTA(NLMSG_DATA(n)), len);
+	case RTM_NEWROUTE:
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(struct rtmsg));
+		return parse_rtattr(tb, RTA_MAX, RTM_RTA(NLMSG_DATA(n)), len);
+	}
+	return 0;
+}
+
+static int count_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+		     void *arg)
+{
+	(*(unsigned long long *)arg)++;
+	return 0;
+}
+
+/* Feed the capture, as dump replies of up to 16k, through a socket
+ * pair to rtnl_dump_filter_l(), from a writer process.
+ */
+static void bench_dump(const struct bench_msgs *m)
+{
+	struct rtnl_handle rth;
+	unsigned long long ops = 0, allocs;
+	struct {
+		struct nlmsghdr	n;
+		int		error;
+	} done = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(int)),
+		.n.nlmsg_type = NLMSG_DONE,
+		.n.nlmsg_seq = 1,
+	};
+	int sv[2], bufsize = 4 << 20;
+	double start, t = 0;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+		perror("socketpair");
+		return;
+	}
+	setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+	pid = fork();
+	if (pid == 0) {
+		char buf[16384 + 8192];
+
+		close(sv[0]);
+		for (;;) {
+			size_t len = 0;
+			int i;
+
+			for (i = 0; i < m->count; i++) {
+				struct nlmsghdr *h = (void *)(buf + len);
+
+				memcpy(h, m->msg[i], m->msg[i]->nlmsg_len);
+				h->nlmsg_seq = 1;
+				h->nlmsg_pid = 0;
+				len += NLMSG_ALIGN(h->nlmsg_len);
+				if (len >= 16384) {
+					if (send(sv[1], buf, len, 0) < 0)
+						exit(0);
+					len = 0;
+				}
+			}
+			memcpy(buf + len, &done, done.n.nlmsg_len);
+			len += NLMSG_ALIGN(done.n.nlmsg_len);
+			if (send(sv[1], buf, len, 0) < 0)
+				exit(0);
+		}
+	}
+	close(sv[1]);
+
+	memset(&rth, 0, sizeof(rth));
+	rth.fd = sv[0];
+	rth.dump = 1;
+
+	allocs = bench_allocs;
+	start = bench_now();
+	do {
+		if (rtnl_dump_filter(&rth, count_msg, &ops) < 0)
+			break;
+		t = bench_now() - start;
+	} while (t < bench_seconds);
+	bench_report("rtnl_dump_filter_l", ops, t, bench_allocs - allocs);
+
+	close(sv[0]);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	free(rth.buf);
+}
+
+/* The name tables are loaded once per process, so each load gets a
+ * process of its own.
+ */
+static void bench_names(void)
+{
+	unsigned long long loads = 0, allocs = 0;
+	double secs = 0;
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		struct { double secs; unsigned long long allocs; } r;
+		int pfd[2];
+		pid_t pid;
+
+		if (pipe(pfd) < 0)
+			return;
+		pid = fork();
+		if (pid == 0) {
+			double start = bench_now();
+
+			r.allocs = bench_allocs;
+			rtnl_names_preload();
+			r.secs = bench_now() - start;
+			r.allocs = bench_allocs - r.allocs;
+			if (write(pfd[1], &r, sizeof(r)) != sizeof(r))
+				exit(1);
+			exit(0);
+		}
+		close(pfd[1]);
+		if (read(pfd[0], &r, sizeof(r)) == sizeof(r)) {
+			secs += r.secs;
+			allocs += r.allocs;
+			loads++;
+		}
+		close(pfd[0]);
+		waitpid(pid, NULL, 0);
+	}
+	bench_report("rt_names load (per load)", loads, secs, allocs);
+}
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: nlbench [ -t SECONDS ] [ CAPTURE... ]\n");
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_msgs all = { 0 }, links = { 0 }, addrs = { 0 },
+			  routes = { 0 };
+	struct sockaddr_nl who = { .nl_family = AF_NETLINK };
+	FILE *null;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			bench_seconds = atof(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++)
+			if (bench_load(&all, argv[i]) < 0)
+				exit(1);
+	} else {
+		gen_capture(&all);
+	}
+	split(&all, &links, &addrs, &routes);
+	printf("%d messages: %d links, %d addresses, %d routes\n",
+	       all.count, links.count, addrs.count, routes.count);
+
+	null = fopen("/dev/null", "w");
+	if (null == NULL) {
+		perror("/dev/null");
+		exit(1);
+	}
+	_SL_ = "\n";
+
+	/* Names of the links come from the capture, not the kernel */
+	for (i = 0; i < links.count; i++)
+		ll_remember_index(&who, links.msg[i], NULL);
+
+	BENCH_RUN("parse_rtattr", &all, parse_one(n));
+	bench_dump(&all);
+	BENCH_RUN("print_linkinfo", &links, print_linkinfo(&who, n, null));
+	BENCH_RUN("print_addrinfo", &addrs, print_addrinfo(&who, n, null));
+	BENCH_RUN("print_route", &routes, print_route(&who, n, null));
+	BENCH_RUN("ll_map lookup", &links, {
+		struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+		ll_name_to_index(ll_index_to_name(ifi->ifi_index));
+	});
+	bench_names();
+
+	fclose(null);
+	return 0;
+}
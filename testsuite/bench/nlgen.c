@@ -0,0 +1,803 @@
+/*
+ * nlgen.c		Generate large netlink captures for benchmarks.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * nlgen [ -s SEED ] [ -l LINKS ] DATASET[=COUNT]... > FILE
+ *
+ * Writes made up dump replies, in the format rtnl_from_file() reads,
+ * for "ip -replay", "tc -replay", nlbench and, for the sockets, ss with
+ * $TCPDIAG_FILE.  Datasets, and their default sizes, are
+ *
+ *	links	50000 links, with an IPv4 and an IPv6 address each
+ *	routes	1000000 IPv4 routes of a full BGP table, a third multipath
+ *	routes6	200000 IPv6 routes of the same
+ *	neigh	1000000 neighbours spread over the links
+ *	htb	65536 HTB classes, 16384 below each of four roots
+ *	tcp	2000000 TCP sockets with tcp_info, ended by NLMSG_DONE
+ *	all	all of the above but tcp, which ss wants in a file of its own
+ *
+ * and are written in this order whatever the order given.  Routes,
+ * neighbours, classes and sockets refer to the links by index, so the
+ * number of links (-l, or COUNT of links) matters to them even when
+ * the links themselves are not written.
+ * The same SEED gives the same bytes; each dataset has a generator of
+ * its own, so it does not change with the other datasets asked for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <linux/if.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <linux/pkt_sched.h>
+#include <linux/gen_stats.h>
+#include <linux/inet_diag.h>
+
+#include "libnetlink.h"
+
+#define NLGEN_PEERS	4	/* links the BGP routes go out of */
+#define NLGEN_ROOTS	4	/* devices with an HTB tree */
+
+enum {
+	DS_LINKS,
+	DS_ROUTES,
+	DS_ROUTES6,
+	DS_NEIGH,
+	DS_HTB,
+	DS_TCP,
+	DS_MAX
+};
+
+static const struct {
+	const char	*name;
+	unsigned int	count;
+} datasets[DS_MAX] = {
+	[DS_LINKS]	= { "links",	50000 },
+	[DS_ROUTES]	= { "routes",	1000000 },
+	[DS_ROUTES6]	= { "routes6",	200000 },
+	[DS_NEIGH]	= { "neigh",	1000000 },
+	[DS_HTB]	= { "htb",	65536 },
+	[DS_TCP]	= { "tcp",	2000000 },
+};
+
+static unsigned int count[DS_MAX];
+static unsigned long long seed = 1;
+static unsigned long long rnd_state;
+static FILE *out;
+
+struct nlgen_req {
+	struct nlmsghdr	n;
+	char		buf[4096];
+};
+
+static void rnd_seed(int ds)
+{
+	rnd_state = (seed ^ (0x9e3779b97f4a7c15ULL * (ds + 1))) | 1;
+}
+
+/* xorshift64*, good enough and the same everywhere */
+static unsigned long long rnd(void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned int rnd_below(unsigned int n)
+{
+	return (rnd() >> 32) % n;
+}
+
+/* Pick from a table of weights, in parts per thousand */
+static int rnd_pick(const int *weight, int n)
+{
+	int r = rnd_below(1000), i;
+
+	for (i = 0; i < n - 1; i++) {
+		if (r < weight[i])
+			return i;
+		r -= weight[i];
+	}
+	return n - 1;
+}
+
+static void *msg_start(struct nlgen_req *req, int type, int hdrlen)
+{
+	memset(&req->n, 0, NLMSG_LENGTH(hdrlen));
+	req->n.nlmsg_len = NLMSG_LENGTH(hdrlen);
+	req->n.nlmsg_type = type;
+	req->n.nlmsg_flags = NLM_F_MULTI;
+	req->n.nlmsg_seq = 1;
+	return NLMSG_DATA(&req->n);
+}
+
+static void msg_put(struct nlgen_req *req)
+{
+	if (rtnl_to_file(NULL, &req->n, out) < 0)
+		exit(1);
+}
+
+/* Link 1 is lo; link idx has 10.H.L.1/24 and 2001:db8:0:idx::1/64 */
+static __u32 link_addr4(int idx, int host)
+{
+	return htonl(0x0a000000 | (idx & 0xffff) << 8 | host);
+}
+
+static void link_addr6(struct in6_addr *a, int idx, int host)
+{
+	memset(a, 0, sizeof(*a));
+	a->s6_addr[0] = 0x20;
+	a->s6_addr[1] = 0x01;
+	a->s6_addr[2] = 0x0d;
+	a->s6_addr[3] = 0xb8;
+	a->s6_addr[6] = idx >> 8;
+	a->s6_addr[7] = idx;
+	a->s6_addr[12] = host >> 24;
+	a->s6_addr[13] = host >> 16;
+	a->s6_addr[14] = host >> 8;
+	a->s6_addr[15] = host;
+}
+
+static void link_name(char *name, int idx)
+{
+	if (idx == 1)
+		strcpy(name, "lo");
+	else if (idx <= 1 + NLGEN_PEERS)
+		sprintf(name, "eth%d", idx - 2);
+	else
+		sprintf(name, "veth%d", idx);
+}
+
+static void gen_link(struct nlgen_req *req, int idx)
+{
+	struct ifinfomsg *ifi = msg_start(req, RTM_NEWLINK, sizeof(*ifi));
+	struct rtnl_link_stats64 stats = {
+		.rx_packets = rnd() >> 36, .tx_packets = rnd() >> 36,
+		.rx_bytes = rnd() >> 26, .tx_bytes = rnd() >> 26,
+		.rx_dropped = rnd_below(100),
+	};
+	unsigned char mac[6] = { 0x52, 0x54, 0, idx >> 16, idx >> 8, idx };
+	static const unsigned char brd[6] = { 0xff, 0xff, 0xff,
+					       0xff, 0xff, 0xff };
+	char name[IFNAMSIZ];
+
+	link_name(name, idx);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = idx;
+	ifi->ifi_flags = IFF_UP | IFF_RUNNING | IFF_LOWER_UP;
+	if (idx == 1) {
+		ifi->ifi_type = ARPHRD_LOOPBACK;
+		ifi->ifi_flags |= IFF_LOOPBACK;
+		memset(mac, 0, sizeof(mac));
+	} else {
+		ifi->ifi_type = ARPHRD_ETHER;
+		ifi->ifi_flags |= IFF_BROADCAST | IFF_MULTICAST;
+	}
+
+	addattr_l(&req->n, sizeof(*req), IFLA_IFNAME, name, strlen(name) + 1);
+	addattr32(&req->n, sizeof(*req), IFLA_TXQLEN, 1000);
+	addattr8(&req->n, sizeof(*req), IFLA_OPERSTATE,
+		 idx == 1 ? IF_OPER_UNKNOWN : IF_OPER_UP);
+	addattr8(&req->n, sizeof(*req), IFLA_LINKMODE, 0);
+	addattr32(&req->n, sizeof(*req), IFLA_MTU, idx == 1 ? 65536 : 1500);
+	addattr32(&req->n, sizeof(*req), IFLA_GROUP, 0);
+	addattr_l(&req->n, sizeof(*req), IFLA_QDISC,
+		  idx == 1 ? "noqueue" : "fq_codel",
+		  idx == 1 ? 8 : 9);
+	addattr_l(&req->n, sizeof(*req), IFLA_ADDRESS, mac, sizeof(mac));
+	addattr_l(&req->n, sizeof(*req), IFLA_BROADCAST,
+		  idx == 1 ? mac : brd, sizeof(brd));
+	addattr_l(&req->n, sizeof(*req), IFLA_STATS64, &stats, sizeof(stats));
+	if (idx > 1 + NLGEN_PEERS) {
+		struct rtattr *linkinfo;
+
+		linkinfo = addattr_nest(&req->n, sizeof(*req), IFLA_LINKINFO);
+		addattr_l(&req->n, sizeof(*req), IFLA_INFO_KIND, "veth", 5);
+		addattr_nest_end(&req->n, linkinfo);
+	}
+	msg_put(req);
+}
+
+static void gen_addr(struct nlgen_req *req, int idx, int family)
+{
+	struct ifaddrmsg *ifa = msg_start(req, RTM_NEWADDR, sizeof(*ifa));
+	struct ifa_cacheinfo ci = {
+		.ifa_prefered = 0xffffffff, .ifa_valid = 0xffffffff,
+	};
+
+	ifa->ifa_family = family;
+	ifa->ifa_index = idx;
+	ifa->ifa_flags = IFA_F_PERMANENT;
+	if (family == AF_INET) {
+		__u32 a = idx == 1 ? htonl(INADDR_LOOPBACK) : link_addr4(idx, 1);
+		__u32 b = a | htonl(0xff);
+		char name[IFNAMSIZ];
+
+		ifa->ifa_prefixlen = idx == 1 ? 8 : 24;
+		ifa->ifa_scope = idx == 1 ? RT_SCOPE_HOST : RT_SCOPE_UNIVERSE;
+		link_name(name, idx);
+		addattr_l(&req->n, sizeof(*req), IFA_ADDRESS, &a, 4);
+		addattr_l(&req->n, sizeof(*req), IFA_LOCAL, &a, 4);
+		if (idx != 1)
+			addattr_l(&req->n, sizeof(*req), IFA_BROADCAST, &b, 4);
+		addattr_l(&req->n, sizeof(*req), IFA_LABEL, name,
+			  strlen(name) + 1);
+	} else {
+		struct in6_addr a;
+
+		if (idx == 1) {
+			memset(&a, 0, sizeof(a));
+			a.s6_addr[15] = 1;
+			ifa->ifa_prefixlen = 128;
+			ifa->ifa_scope = RT_SCOPE_HOST;
+		} else {
+			link_addr6(&a, idx, 1);
+			ifa->ifa_prefixlen = 64;
+		}
+		addattr_l(&req->n, sizeof(*req), IFA_ADDRESS, &a, 16);
+	}
+	addattr_l(&req->n, sizeof(*req), IFA_CACHEINFO, &ci, sizeof(ci));
+	msg_put(req);
+}
+
+static void gen_links(void)
+{
+	struct nlgen_req req;
+	int idx;
+
+	/* A link dump, then an address dump, as "ip addr" would get */
+	for (idx = 1; idx <= count[DS_LINKS]; idx++)
+		gen_link(&req, idx);
+	for (idx = 1; idx <= count[DS_LINKS]; idx++)
+		gen_addr(&req, idx, AF_INET);
+	for (idx = 1; idx <= count[DS_LINKS]; idx++)
+		gen_addr(&req, idx, AF_INET6);
+}
+
+/* Prefixes of a full table, upper 64 bits only for IPv6 */
+struct prefix {
+	unsigned long long	addr;
+	int			len;
+};
+
+static int prefix_cmp(const void *a, const void *b)
+{
+	const struct prefix *p = a, *q = b;
+
+	if (p->addr != q->addr)
+		return p->addr < q->addr ? -1 : 1;
+	return p->len - q->len;
+}
+
+/* Share of prefix lengths in a BGP table, per thousand */
+static const int len4[] = { 600, 100, 120, 50, 50, 30, 20, 15, 12, 3 };
+static const int bits4[] = { 24, 23, 22, 21, 20, 19, 18, 17, 16, 12 };
+static const int len6[] = { 500, 150, 100, 80, 50, 50, 40, 30 };
+static const int bits6[] = { 48, 32, 44, 40, 36, 29, 46, 56 };
+
+static unsigned long long prefix_random(int family, int len)
+{
+	unsigned long long a;
+
+	if (family == AF_INET) {
+		unsigned int top;
+
+		/* Neither 0/8, 10/8, 127/8 nor class D and E */
+		do {
+			a = rnd() >> 32;
+			top = a >> 24;
+		} while (top == 0 || top == 10 || top == 127 || top >= 224);
+		return a & (0xffffffffULL << (32 - len)) & 0xffffffff;
+	}
+	/* 2000::/3 */
+	a = (rnd() >> 3) | 0x2000000000000000ULL;
+	return a & (~0ULL << (64 - len));
+}
+
+static struct prefix *gen_prefixes(int family, unsigned int n)
+{
+	struct prefix *p = calloc(n ? n : 1, sizeof(*p));
+	unsigned int have = 0, i, j;
+
+	if (p == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	/* Draw, sort and drop duplicates until there are enough */
+	while (have < n) {
+		for (i = have; i < n; i++) {
+			if (family == AF_INET)
+				p[i].len = bits4[rnd_pick(len4, 10)];
+			else
+				p[i].len = bits6[rnd_pick(len6, 8)];
+			p[i].addr = prefix_random(family, p[i].len);
+		}
+		qsort(p, n, sizeof(*p), prefix_cmp);
+		for (i = j = 0; i < n; i++)
+			if (j == 0 || prefix_cmp(&p[j - 1], &p[i]))
+				p[j++] = p[i];
+		have = j;
+	}
+	return p;
+}
+
+static int peers(void)
+{
+	return count[DS_LINKS] - 1 < NLGEN_PEERS ? count[DS_LINKS] - 1 :
+						    NLGEN_PEERS;
+}
+
+/* The gateway of peer, in the message or in the nexthops at mp */
+static void put_gateway(struct nlgen_req *req, struct rtattr *mp, int maxlen,
+			int family, int peer)
+{
+	struct in6_addr gw6;
+	__u32 gw4;
+	void *gw;
+	int len;
+
+	if (family == AF_INET) {
+		gw4 = link_addr4(2 + peer, 2);
+		gw = &gw4;
+		len = 4;
+	} else {
+		link_addr6(&gw6, 2 + peer, 2);
+		gw = &gw6;
+		len = 16;
+	}
+	if (mp)
+		rta_addattr_l(mp, maxlen, RTA_GATEWAY, gw, len);
+	else
+		addattr_l(&req->n, sizeof(*req), RTA_GATEWAY, gw, len);
+}
+
+static void gen_route(struct nlgen_req *req, int family,
+		      const struct prefix *p)
+{
+	struct rtmsg *r = msg_start(req, RTM_NEWROUTE, sizeof(*r));
+	int npeers = peers(), peer = rnd_below(npeers), paths = 1;
+
+	r->rtm_family = family;
+	r->rtm_dst_len = p->len;
+	r->rtm_table = RT_TABLE_MAIN;
+	r->rtm_protocol = RTPROT_ZEBRA;
+	r->rtm_scope = RT_SCOPE_UNIVERSE;
+	r->rtm_type = RTN_UNICAST;
+
+	addattr32(&req->n, sizeof(*req), RTA_TABLE, RT_TABLE_MAIN);
+	if (family == AF_INET) {
+		__u32 dst = htonl(p->addr);
+
+		addattr_l(&req->n, sizeof(*req), RTA_DST, &dst, 4);
+	} else {
+		unsigned char dst[16] = { 0 };
+		int i;
+
+		for (i = 0; i < 8; i++)
+			dst[i] = p->addr >> (56 - 8 * i);
+		addattr_l(&req->n, sizeof(*req), RTA_DST, dst, 16);
+	}
+	addattr32(&req->n, sizeof(*req), RTA_PRIORITY, 20);
+
+	if (npeers > 1 && rnd_below(3) == 0)
+		paths = 2 + rnd_below(npeers - 1);
+	if (paths == 1) {
+		put_gateway(req, NULL, 0, family, peer);
+		addattr32(&req->n, sizeof(*req), RTA_OIF, 2 + peer);
+	} else {
+		char buf[512];
+		struct rtattr *mp = (struct rtattr *)buf;
+		int i;
+
+		mp->rta_type = RTA_MULTIPATH;
+		mp->rta_len = RTA_LENGTH(0);
+		for (i = 0; i < paths; i++) {
+			struct rtnexthop *nh = (void *)((char *)RTA_DATA(mp) +
+							RTA_PAYLOAD(mp));
+			int len = mp->rta_len;
+
+			memset(nh, 0, sizeof(*nh));
+			nh->rtnh_len = sizeof(*nh);
+			nh->rtnh_ifindex = 2 + (peer + i) % npeers;
+			mp->rta_len += sizeof(*nh);
+			put_gateway(req, mp, sizeof(buf), family,
+				    (peer + i) % npeers);
+			nh->rtnh_len = mp->rta_len - len;
+		}
+		addattr_l(&req->n, sizeof(*req), RTA_MULTIPATH, RTA_DATA(mp),
+			  RTA_PAYLOAD(mp));
+	}
+	msg_put(req);
+}
+
+static void gen_routes(int family, unsigned int n)
+{
+	struct nlgen_req req;
+	struct prefix *p;
+	unsigned int i;
+
+	if (peers() < 1) {
+		fprintf(stderr, "Routes need at least two links\n");
+		exit(1);
+	}
+	p = gen_prefixes(family, n);
+	for (i = 0; i < n; i++)
+		gen_route(&req, family, &p[i]);
+	free(p);
+}
+
+static void gen_neigh(void)
+{
+	static const int state_weight[] = { 500, 350, 100, 50 };
+	static const int states[] = { NUD_REACHABLE, NUD_STALE, NUD_DELAY,
+				      NUD_FAILED };
+	struct nlgen_req req;
+	unsigned int i, nlinks = count[DS_LINKS] - 1;
+
+	if (count[DS_LINKS] < 2) {
+		fprintf(stderr, "Neighbours need at least two links\n");
+		exit(1);
+	}
+
+	for (i = 0; i < count[DS_NEIGH]; i++) {
+		struct ndmsg *ndm = msg_start(&req, RTM_NEWNEIGH, sizeof(*ndm));
+		struct nda_cacheinfo ci = {
+			.ndm_confirmed = rnd_below(300000),
+			.ndm_used = rnd_below(300000),
+			.ndm_updated = rnd_below(300000),
+		};
+		unsigned char mac[6] = { 0x02, 0, i >> 24, i >> 16, i >> 8, i };
+		int idx = 2 + i % nlinks;
+		unsigned int host = 2 + i / nlinks;
+
+		ndm->ndm_ifindex = idx;
+		ndm->ndm_state = states[rnd_pick(state_weight, 4)];
+		ndm->ndm_type = RTN_UNICAST;
+		/* Past .254 of a link's /24 the neighbours are IPv6 */
+		if (host < 255) {
+			__u32 dst = link_addr4(idx, host);
+
+			ndm->ndm_family = AF_INET;
+			addattr_l(&req.n, sizeof(req), NDA_DST, &dst, 4);
+		} else {
+			struct in6_addr dst;
+
+			ndm->ndm_family = AF_INET6;
+			link_addr6(&dst, idx, host);
+			addattr_l(&req.n, sizeof(req), NDA_DST, &dst, 16);
+		}
+		if (ndm->ndm_state != NUD_FAILED)
+			addattr_l(&req.n, sizeof(req), NDA_LLADDR, mac, 6);
+		addattr_l(&req.n, sizeof(req), NDA_CACHEINFO, &ci, sizeof(ci));
+		addattr32(&req.n, sizeof(req), NDA_PROBES, 0);
+		msg_put(&req);
+	}
+}
+
+static void gen_htb_stats(struct nlgen_req *req)
+{
+	/* As the kernel sends it, without padding */
+	struct gnet_stats_basic_packed bs = {
+		.bytes = rnd() >> 28, .packets = rnd() >> 40,
+	};
+	struct gnet_stats_queue q = { .drops = rnd_below(1000) };
+	struct gnet_stats_rate_est est = { 0 };
+	struct tc_stats st;
+	struct tc_htb_xstats xs = {
+		.lends = rnd_below(100000), .borrows = rnd_below(100000),
+		.tokens = 1000 + rnd_below(100000),
+		.ctokens = 1000 + rnd_below(100000),
+	};
+	struct rtattr *stats;
+
+	/* Padded, and to be written out the same every time */
+	memset(&st, 0, sizeof(st));
+	st.bytes = bs.bytes;
+	st.packets = bs.packets;
+	st.drops = q.drops;
+
+	stats = addattr_nest(&req->n, sizeof(*req), TCA_STATS2);
+	addattr_l(&req->n, sizeof(*req), TCA_STATS_BASIC, &bs, sizeof(bs));
+	addattr_l(&req->n, sizeof(*req), TCA_STATS_RATE_EST, &est,
+		  sizeof(est));
+	addattr_l(&req->n, sizeof(*req), TCA_STATS_QUEUE, &q, sizeof(q));
+	addattr_l(&req->n, sizeof(*req), TCA_STATS_APP, &xs, sizeof(xs));
+	addattr_nest_end(&req->n, stats);
+	addattr_l(&req->n, sizeof(*req), TCA_STATS, &st, sizeof(st));
+	addattr_l(&req->n, sizeof(*req), TCA_XSTATS, &xs, sizeof(xs));
+}
+
+static void gen_htb(void)
+{
+	struct nlgen_req req;
+	unsigned int per_root = (count[DS_HTB] + NLGEN_ROOTS - 1) / NLGEN_ROOTS;
+	unsigned int i;
+	int root;
+
+	if (per_root > 0xfffe) {
+		fprintf(stderr, "At most %d HTB classes\n", 0xfffe * NLGEN_ROOTS);
+		exit(1);
+	}
+	if (count[DS_LINKS] < 1 + NLGEN_ROOTS) {
+		fprintf(stderr, "HTB classes need at least %d links\n",
+			1 + NLGEN_ROOTS);
+		exit(1);
+	}
+
+	for (root = 0; root < NLGEN_ROOTS; root++) {
+		struct tcmsg *t = msg_start(&req, RTM_NEWQDISC, sizeof(*t));
+		struct tc_htb_glob glob = {
+			.version = 3, .rate2quantum = 10, .defcls = 0xffff,
+		};
+		struct rtattr *opts;
+
+		t->tcm_family = AF_UNSPEC;
+		t->tcm_ifindex = 2 + root;
+		t->tcm_handle = TC_H_MAKE(1 << 16, 0);
+		t->tcm_parent = TC_H_ROOT;
+		t->tcm_info = 1;
+		addattr_l(&req.n, sizeof(req), TCA_KIND, "htb", 4);
+		opts = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+		addattr_l(&req.n, sizeof(req), TCA_HTB_INIT, &glob,
+			  sizeof(glob));
+		addattr32(&req.n, sizeof(req), TCA_HTB_DIRECT_QLEN, 1000);
+		addattr_nest_end(&req.n, opts);
+		gen_htb_stats(&req);
+		msg_put(&req);
+	}
+
+	/* Per root, a parent class 1:1 and leaves 1:2 onwards below it */
+	for (i = 0; i < count[DS_HTB]; i++) {
+		struct tcmsg *t = msg_start(&req, RTM_NEWTCLASS, sizeof(*t));
+		unsigned int minor = 1 + i % per_root;
+		unsigned int rate = minor == 1 ? 1250000000 :
+				    125000 * (1 + rnd_below(800));
+		struct tc_htb_opt opt = {
+			.rate.rate = rate,
+			.ceil.rate = minor == 1 ? rate : rate * 2,
+			.buffer = 1600,
+			.cbuffer = 1600,
+			.quantum = 1514 * (1 + rnd_below(8)),
+			.level = minor == 1 ? 1 : 0,
+			.prio = rnd_below(8),
+		};
+		struct rtattr *opts;
+
+		t->tcm_family = AF_UNSPEC;
+		t->tcm_ifindex = 2 + i / per_root;
+		t->tcm_handle = TC_H_MAKE(1 << 16, minor);
+		t->tcm_parent = minor == 1 ? TC_H_MAKE(1 << 16, 0) :
+					     TC_H_MAKE(1 << 16, 1);
+		t->tcm_info = minor == 1 ? 0 : TC_H_MAKE(minor << 16, 0);
+		opt.rate.cell_log = opt.ceil.cell_log = 3;
+		opt.rate.linklayer = opt.ceil.linklayer = TC_LINKLAYER_ETHERNET;
+		addattr_l(&req.n, sizeof(req), TCA_KIND, "htb", 4);
+		opts = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+		addattr_l(&req.n, sizeof(req), TCA_HTB_PARMS, &opt, sizeof(opt));
+		addattr_nest_end(&req.n, opts);
+		gen_htb_stats(&req);
+		msg_put(&req);
+	}
+}
+
+static void gen_tcp(void)
+{
+	static const int state_weight[] = { 900, 10, 60, 30 };
+	static const int states[] = { TCP_ESTABLISHED, TCP_LISTEN,
+				      TCP_TIME_WAIT, TCP_CLOSE_WAIT };
+	struct nlgen_req req;
+	unsigned int i, nlinks = count[DS_LINKS] - 1;
+	struct nlmsghdr done = {
+		.nlmsg_len = NLMSG_LENGTH(sizeof(int)),
+		.nlmsg_type = NLMSG_DONE,
+		.nlmsg_flags = NLM_F_MULTI,
+		.nlmsg_seq = 1,
+	};
+	int zero = 0;
+
+	if (count[DS_LINKS] < 2) {
+		fprintf(stderr, "Sockets need at least two links\n");
+		exit(1);
+	}
+
+	for (i = 0; i < count[DS_TCP]; i++) {
+		struct inet_diag_msg *r = msg_start(&req, TCPDIAG_GETSOCK,
+						    sizeof(*r));
+		int idx = 2 + i % nlinks;
+		int state = states[rnd_pick(state_weight, 4)];
+
+		r->idiag_family = rnd_below(5) ? AF_INET : AF_INET6;
+		r->idiag_state = state;
+		r->idiag_uid = rnd_below(4) ? 0 : 1000 + rnd_below(100);
+		r->idiag_inode = state == TCP_TIME_WAIT ? 0 : 10000 + i;
+		r->id.idiag_cookie[0] = i;
+		r->id.idiag_cookie[1] = 0;
+		if (state == TCP_LISTEN) {
+			r->id.idiag_sport = htons(1 + rnd_below(1024));
+		} else {
+			r->id.idiag_sport = htons(rnd_below(3) ? 443 : 22);
+			r->id.idiag_dport = htons(32768 + rnd_below(28232));
+			r->idiag_rqueue = rnd_below(4) ? 0 : rnd_below(65536);
+			r->idiag_wqueue = rnd_below(4) ? 0 : rnd_below(65536);
+		}
+		if (state == TCP_TIME_WAIT) {
+			r->idiag_timer = 3;
+			r->idiag_expires = rnd_below(60000);
+		} else if (state == TCP_ESTABLISHED && r->idiag_wqueue) {
+			r->idiag_timer = 1;
+			r->idiag_expires = rnd_below(400);
+		}
+
+		if (r->idiag_family == AF_INET) {
+			r->id.idiag_src[0] = link_addr4(idx, 1);
+			if (state != TCP_LISTEN)
+				r->id.idiag_dst[0] = htonl(rnd() >> 32);
+		} else {
+			struct in6_addr a;
+
+			link_addr6(&a, idx, 1);
+			memcpy(r->id.idiag_src, &a, 16);
+			if (state != TCP_LISTEN) {
+				link_addr6(&a, idx, rnd() >> 32);
+				memcpy(r->id.idiag_dst, &a, 16);
+			}
+		}
+
+		/* The kernel has no tcp_info for timewait sockets */
+		if (state != TCP_TIME_WAIT) {
+			struct tcp_info info = {
+				.tcpi_state = state,
+				.tcpi_options = TCPI_OPT_TIMESTAMPS |
+						TCPI_OPT_SACK | TCPI_OPT_WSCALE,
+				.tcpi_snd_wscale = 7,
+				.tcpi_rcv_wscale = 7,
+				.tcpi_rto = 204000 + rnd_below(100000),
+				.tcpi_ato = 40000,
+				.tcpi_snd_mss = 1448,
+				.tcpi_rcv_mss = 536 + rnd_below(913),
+				.tcpi_last_data_recv = rnd_below(100000),
+				.tcpi_last_ack_recv = rnd_below(100000),
+				.tcpi_rtt = 200 + rnd_below(200000),
+				.tcpi_rttvar = rnd_below(50000),
+				.tcpi_snd_ssthresh = rnd_below(2) ? 0x7fffffff :
+						     10 + rnd_below(500),
+				.tcpi_snd_cwnd = 10 + rnd_below(500),
+				.tcpi_rcv_space = 29200,
+				.tcpi_total_retrans = rnd_below(4) ? 0 :
+						      rnd_below(100),
+			};
+
+			addattr_l(&req.n, sizeof(req), INET_DIAG_INFO, &info,
+				  sizeof(info));
+			addattr_l(&req.n, sizeof(req), INET_DIAG_CONG, "cubic",
+				  6);
+		}
+		msg_put(&req);
+	}
+
+	/* ss reads $TCPDIAG_FILE up to this */
+	fwrite(&done, 1, sizeof(done), out);
+	fwrite(&zero, 1, sizeof(zero), out);
+}
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	int i;
+
+	fprintf(stderr, "Usage: nlgen [ -s SEED ] [ -l LINKS ] DATASET[=COUNT]...\n"
+			"where  DATASET := { all |");
+	for (i = 0; i < DS_MAX; i++)
+		fprintf(stderr, " %s%s", datasets[i].name,
+			i < DS_MAX - 1 ? " |" : " }\n");
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	int want[DS_MAX] = { 0 };
+	int opt, i;
+
+	for (i = 0; i < DS_MAX; i++)
+		count[i] = datasets[i].count;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'l':
+			count[DS_LINKS] = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+
+	for (; optind < argc; optind++) {
+		char *arg = argv[optind], *eq = strchr(arg, '=');
+		unsigned long n = 0;
+
+		if (eq) {
+			char *end;
+
+			*eq++ = '\0';
+			n = strtoul(eq, &end, 0);
+			if (*eq == '\0' || *end || n > 0xffffffffUL)
+				usage();
+		}
+		if (strcmp(arg, "all") == 0) {
+			for (i = 0; i < DS_TCP; i++)
+				want[i] = 1;
+			continue;
+		}
+		for (i = 0; i < DS_MAX; i++)
+			if (strcmp(arg, datasets[i].name) == 0)
+				break;
+		if (i == DS_MAX)
+			usage();
+		want[i] = 1;
+		if (eq)
+			count[i] = n;
+	}
+	if (count[DS_LINKS] > 0xffff) {
+		fprintf(stderr, "At most %d links\n", 0xffff);
+		exit(1);
+	}
+
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending binary stream to stdout\n");
+		exit(-1);
+	}
+	out = stdout;
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+	for (i = 0; i < DS_MAX; i++) {
+		if (!want[i])
+			continue;
+		rnd_seed(i);
+		switch (i) {
+		case DS_LINKS:
+			gen_links();
+			break;
+		case DS_ROUTES:
+			gen_routes(AF_INET, count[i]);
+			break;
+		case DS_ROUTES6:
+			gen_routes(AF_INET6, count[i]);
+			break;
+		case DS_NEIGH:
+			gen_neigh();
+			break;
+		case DS_HTB:
+			gen_htb();
+			break;
+		case DS_TCP:
+			gen_tcp();
+			break;
+		}
+	}
+
+	if (fflush(out) != 0) {
+		perror("nlgen");
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * ssbench.c		Microbenchmark of the socket formatting of ss.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+/*
+ * ss keeps its state in globals which clash with ip's, so it gets a
+ * program of its own, with ss.c built in and its main() renamed.
+ * Made up inet_diag replies, with tcp_info attached, are formatted the
+ * way "ss -tn" and "ss -tni" do, to /dev/null.
+ */
+
+#define main ss_main
+#include "../../misc/ss.c"
+#undef main
+
+#include "bench.h"
+
+static void gen_sock(struct bench_msgs *m, int i)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct inet_diag_msg	r;
+		char			buf[512];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct inet_diag_msg)),
+		.n.nlmsg_type = TCPDIAG_GETSOCK,
+		.n.nlmsg_flags = NLM_F_MULTI,
+		.r.idiag_family = AF_INET,
+		.r.idiag_state = SS_ESTABLISHED,
+		.r.idiag_rqueue = i % 7,
+		.r.idiag_wqueue = i % 13,
+		.r.idiag_inode = 100000 + i,
+	};
+	struct tcp_info info = {
+		.tcpi_state = SS_ESTABLISHED,
+		.tcpi_options = TCPI_OPT_TIMESTAMPS | TCPI_OPT_SACK |
+				TCPI_OPT_WSCALE,
+		.tcpi_snd_wscale = 7,
+		.tcpi_rcv_wscale = 7,
+		.tcpi_rto = 204000,
+		.tcpi_ato = 40000,
+		.tcpi_snd_mss = 1448,
+		.tcpi_rcv_mss = 1448,
+		.tcpi_rtt = 1500 + i % 1000,
+		.tcpi_rttvar = 750,
+		.tcpi_snd_cwnd = 10,
+		.tcpi_snd_ssthresh = 0x7fffffff,
+		.tcpi_rcv_space = 29200,
+	};
+	struct rtattr *rta;
+
+	req.r.id.idiag_sport = htons(22);
+	req.r.id.idiag_dport = htons(1024 + i % 60000);
+	req.r.id.idiag_src[0] = htonl(0x0a000001);
+	req.r.id.idiag_dst[0] = htonl(0xc0a80000 | (i & 0xffff));
+	req.r.id.idiag_cookie[0] = i;
+
+	rta = NLMSG_TAIL(&req.n);
+	rta->rta_type = INET_DIAG_INFO;
+	rta->rta_len = RTA_LENGTH(sizeof(info));
+	memcpy(RTA_DATA(rta), &info, sizeof(info));
+	req.n.nlmsg_len = NLMSG_ALIGN(req.n.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	bench_add(m, &req.n);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_msgs socks = { 0 };
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			bench_seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: ssbench [ -t SECONDS ]\n");
+			exit(-1);
+		}
+	}
+
+	for (i = 0; i < 10000; i++)
+		gen_sock(&socks, i);
+
+	/* Widths of an 80 column terminal, with numeric ports */
+	state_width = 10;
+	addr_width = 22;
+	serv_width = 5;
+	resolve_services = 0;
+
+	/* ss prints to stdout, so the reports go to a copy of it */
+	fflush(stdout);
+	bench_out = fdopen(dup(STDOUT_FILENO), "w");
+	if (bench_out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+		perror("/dev/null");
+		exit(1);
+	}
+
+	BENCH_RUN("tcp_show_sock", &socks, tcp_show_sock(n, NULL));
+	show_tcpinfo = 1;
+	BENCH_RUN("tcp_show_sock (-i)", &socks, tcp_show_sock(n, NULL));
+
+	fclose(bench_out);
+	return 0;
+}